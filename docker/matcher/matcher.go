@@ -5,9 +5,13 @@ package main
 import "C"
 
 import (
+    "net"
     "time"
     "fmt"
     "log"
+    "sort"
+    "strings"
+    "sync"
     "unsafe"
     "strconv"
     "net/http"
@@ -27,6 +31,9 @@ const ConnectTokenBytes = 1024
 const MaxServersPerConnectToken = 8
 const ConnectTokenExpireSeconds = 30
 const ServerAddress = "127.0.0.1:40000"
+const BinaryMatchContentType = "application/x-yojimbo-match"
+const ServerLoadTimeOut = 10 * time.Second
+const MinTickHeadroom = 0.1
 
 type ConnectToken struct {
     ProtocolId         string `json:"protocolId"`
@@ -112,6 +119,121 @@ func GenerateMatchResponse( connectToken ConnectToken, nonce uint64 ) ( MatchRes
     return matchResponse, ok
 }
 
+// The binary match response is the same data as MatchResponse without JSON or base64. See Matcher::ParseBinaryMatchResponses in yojimbo_matcher.h for the layout.
+
+func WantsBinaryMatchResponse( r * http.Request ) bool {
+    return strings.Contains( r.Header.Get( "Accept" ), BinaryMatchContentType )
+}
+
+func AppendBinaryMatchResponse( buffer [] byte, connectToken ConnectToken, serverAddresses [] string, nonce uint64 ) ( [] byte, bool ) {
+    encryptedConnectToken, ok := EncryptConnectToken( connectToken, nonce )
+    if ( !ok ) { return buffer, false }
+    clientToServerKey, _ := base64.StdEncoding.DecodeString( connectToken.ClientToServerKey )
+    serverToClientKey, _ := base64.StdEncoding.DecodeString( connectToken.ServerToClientKey )
+    expireTimestamp, _ := strconv.ParseUint( connectToken.ExpireTimestamp, 10, 64 )
+    buffer = append( buffer, byte( len( serverAddresses ) ) )
+    for _, serverAddress := range serverAddresses {
+        address, error := net.ResolveUDPAddr( "udp", serverAddress )
+        if ( error != nil ) { return buffer, false }
+        if ip4 := address.IP.To4(); ip4 != nil {
+            buffer = append( buffer, 4 )
+            buffer = append( buffer, ip4... )
+        } else {
+            buffer = append( buffer, 6 )
+            buffer = append( buffer, address.IP.To16()... )
+        }
+        buffer = append( buffer, byte( address.Port ), byte( address.Port >> 8 ) )
+    }
+    value := make( []byte, 8 )
+    binary.LittleEndian.PutUint64( value, expireTimestamp )
+    buffer = append( buffer, value... )
+    binary.LittleEndian.PutUint64( value, nonce )
+    buffer = append( buffer, value... )
+    buffer = append( buffer, clientToServerKey... )
+    buffer = append( buffer, serverToClientKey... )
+    buffer = append( buffer, byte( len( encryptedConnectToken ) ), byte( len( encryptedConnectToken ) >> 8 ) )
+    buffer = append( buffer, encryptedConnectToken... )
+    return buffer, true
+}
+
+func WriteBinaryMatchResponses( w http.ResponseWriter, buffer [] byte ) {
+    w.Header().Set( "Content-Type", BinaryMatchContentType )
+    w.Header().Set( "Content-Length", strconv.Itoa( len( buffer ) ) )
+    w.Write( buffer )
+}
+
+// Dedicated servers report their load with Matcher::ReportServerLoad. Connect tokens list the servers that reported recently, have free slots and aren't overloaded.
+// Servers with the fewest free slots come first, so clients cluster onto servers that already have players. Ties go to the server with the most tick headroom.
+
+type ServerLoad struct {
+    ServerAddress           string  `json:"serverAddress"`
+    NumConnectedClients     int     `json:"numConnectedClients"`
+    MaxClients              int     `json:"maxClients"`
+    TickHeadroom            float64 `json:"tickHeadroom"`
+    PacketsSent             uint64  `json:"packetsSent"`
+    PacketsReceived         uint64  `json:"packetsReceived"`
+    PacketsDropped          uint64  `json:"packetsDropped"`
+    ProtocolId              uint64  `json:"-"`
+    ReportTime              time.Time `json:"-"`
+}
+
+var ServerLoads = map[string] ServerLoad {}
+var ServerLoadsMutex sync.Mutex
+
+func MatchServerAddresses( protocolId uint64 ) [] string {
+    ServerLoadsMutex.Lock()
+    defer ServerLoadsMutex.Unlock()
+    now := time.Now()
+    candidates := [] ServerLoad {}
+    for address, serverLoad := range ServerLoads {
+        if ( now.Sub( serverLoad.ReportTime ) > ServerLoadTimeOut ) {
+            delete( ServerLoads, address )
+            continue
+        }
+        if ( serverLoad.ProtocolId != protocolId || serverLoad.NumConnectedClients >= serverLoad.MaxClients || serverLoad.TickHeadroom < MinTickHeadroom ) { continue }
+        candidates = append( candidates, serverLoad )
+    }
+    sort.Slice( candidates, func( i, j int ) bool {
+        freeSlotsI := candidates[i].MaxClients - candidates[i].NumConnectedClients
+        freeSlotsJ := candidates[j].MaxClients - candidates[j].NumConnectedClients
+        if ( freeSlotsI != freeSlotsJ ) { return freeSlotsI < freeSlotsJ }
+        return candidates[i].TickHeadroom > candidates[j].TickHeadroom
+    } )
+    serverAddresses := [] string {}
+    for i := 0; i < len( candidates ) && i < MaxServersPerConnectToken; i++ {
+        serverAddresses = append( serverAddresses, candidates[i].ServerAddress )
+    }
+    if ( len( serverAddresses ) == 0 ) { serverAddresses = append( serverAddresses, ServerAddress ) }
+    return serverAddresses
+}
+
+func Base64EncodeAddresses( serverAddresses [] string ) [] string {
+    encodedAddresses := make( [] string, len( serverAddresses ) )
+    for i, serverAddress := range serverAddresses { encodedAddresses[i] = Base64EncodeString( serverAddress ) }
+    return encodedAddresses
+}
+
+func ServerLoadHandler( w http.ResponseWriter, r * http.Request ) {
+    vars := mux.Vars( r )
+    protocolId, _ := strconv.ParseUint( vars["protocolId"], 10, 64 )
+    var serverLoad ServerLoad
+    if error := json.NewDecoder( r.Body ).Decode( &serverLoad ); error != nil || serverLoad.MaxClients <= 0 {
+        http.Error( w, "bad server load report", http.StatusBadRequest )
+        return
+    }
+    if _, error := net.ResolveUDPAddr( "udp", serverLoad.ServerAddress ); error != nil {
+        http.Error( w, "bad server address", http.StatusBadRequest )
+        return
+    }
+    serverLoad.ProtocolId = protocolId
+    serverLoad.ReportTime = time.Now()
+    ServerLoadsMutex.Lock()
+    ServerLoads[serverLoad.ServerAddress] = serverLoad
+    ServerLoadsMutex.Unlock()
+    w.Header().Set( "Content-Length", "0" )
+    w.WriteHeader( http.StatusOK )
+}
+
 var MatchNonce = uint64(0)
 
 var PrivateKey = [] byte { 0x60, 0x6a, 0xbe, 0x6e, 0xc9, 0x19, 0x10, 0xea, 
@@ -129,21 +251,76 @@ func MatchHandler( w http.ResponseWriter, r * http.Request ) {
     vars := mux.Vars( r )
     clientId, _ := strconv.ParseUint( vars["clientId"], 10, 64 )
     protocolId, _ := strconv.ParseUint( vars["protocolId"], 10, 64 )
-    serverAddresses := []string { Base64EncodeString( ServerAddress ) }
+    matchAddresses := MatchServerAddresses( protocolId )
+    serverAddresses := Base64EncodeAddresses( matchAddresses )
     connectToken := GenerateConnectToken( protocolId, clientId, serverAddresses[:] )
+    if ( WantsBinaryMatchResponse( r ) ) {
+        buffer, ok := AppendBinaryMatchResponse( [] byte { 1, 0 }, connectToken, matchAddresses, atomic.AddUint64( &MatchNonce, 1 ) )
+        if ( !ok ) {
+            http.Error( w, "failed to generate match response", http.StatusInternalServerError )
+            return
+        }
+        fmt.Printf( "matched client %.16x to %s\n", clientId, matchAddresses[0] )
+        WriteBinaryMatchResponses( w, buffer )
+        return
+    }
     matchResponse, ok := GenerateMatchResponse( connectToken, atomic.AddUint64( &MatchNonce, 1 ) )
     w.Header().Set( "Content-Type", "application/json" )
     if ( ok ) { 
-        fmt.Printf( "matched client %.16x to %s\n", clientId, ServerAddress )
+        fmt.Printf( "matched client %.16x to %s\n", clientId, matchAddresses[0] )
         json.NewEncoder(w).Encode( matchResponse ); 
     }
 }
 
+const MaxMatchBatchSize = 1024
+
+func MatchBatchHandler( w http.ResponseWriter, r * http.Request ) {
+    vars := mux.Vars( r )
+    protocolId, _ := strconv.ParseUint( vars["protocolId"], 10, 64 )
+    var clientIds [] uint64
+    if error := json.NewDecoder( r.Body ).Decode( &clientIds ); error != nil || len( clientIds ) == 0 || len( clientIds ) > MaxMatchBatchSize {
+        http.Error( w, "bad match batch", http.StatusBadRequest )
+        return
+    }
+    matchAddresses := MatchServerAddresses( protocolId )
+    serverAddresses := Base64EncodeAddresses( matchAddresses )
+    if ( WantsBinaryMatchResponse( r ) ) {
+        buffer := [] byte { byte( len( clientIds ) ), byte( len( clientIds ) >> 8 ) }
+        for _, clientId := range clientIds {
+            connectToken := GenerateConnectToken( protocolId, clientId, serverAddresses[:] )
+            var ok bool
+            buffer, ok = AppendBinaryMatchResponse( buffer, connectToken, matchAddresses, atomic.AddUint64( &MatchNonce, 1 ) )
+            if ( !ok ) {
+                http.Error( w, "failed to generate match response", http.StatusInternalServerError )
+                return
+            }
+        }
+        fmt.Printf( "matched %d clients to %s\n", len( clientIds ), matchAddresses[0] )
+        WriteBinaryMatchResponses( w, buffer )
+        return
+    }
+    matchResponses := make( [] MatchResponse, len( clientIds ) )
+    for i, clientId := range clientIds {
+        connectToken := GenerateConnectToken( protocolId, clientId, serverAddresses[:] )
+        matchResponse, ok := GenerateMatchResponse( connectToken, atomic.AddUint64( &MatchNonce, 1 ) )
+        if ( !ok ) {
+            http.Error( w, "failed to generate match response", http.StatusInternalServerError )
+            return
+        }
+        matchResponses[i] = matchResponse
+    }
+    fmt.Printf( "matched %d clients to %s\n", len( clientIds ), matchAddresses[0] )
+    w.Header().Set( "Content-Type", "application/json" )
+    json.NewEncoder(w).Encode( matchResponses );
+}
+
 func main() {
     result := int( C.sodium_init() )
     if result != 0 { panic( "failed to initialize sodium" ) }
     fmt.Printf( "\nstarted matchmaker on port %d\n\n", Port )
     r := mux.NewRouter()
     r.HandleFunc( "/match/{protocolId:[0-9]+}/{clientId:[0-9]+}", MatchHandler )
+    r.HandleFunc( "/matches/{protocolId:[0-9]+}", MatchBatchHandler ).Methods( "POST" )
+    r.HandleFunc( "/servers/{protocolId:[0-9]+}", ServerLoadHandler ).Methods( "POST" )
     log.Fatal( http.ListenAndServeTLS( ":" + strconv.Itoa(Port), "server.pem", "server.key", r ) )
 }
@@ -5,7 +5,10 @@ if os.is "windows" then
     debug_libs = { "sodium-debug", "mbedtls-debug", "mbedx509-debug", "mbedcrypto-debug" }
     release_libs = { "sodium-release", "mbedtls-release", "mbedx509-release", "mbedcrypto-release" }
 else
-    debug_libs = { "sodium", "mbedtls", "mbedx509", "mbedcrypto" }
+    debug_libs = { "sodium", "mbedtls", "mbedx509", "mbedcrypto", "pthread" }
+    if os.is "linux" then
+        table.insert( debug_libs, "rt" )            -- shm_open for SharedMemoryTransport. only needed before glibc 2.34
+    end
     release_libs = debug_libs
 end
 
@@ -75,6 +78,26 @@ project "profile"
     files { "tests/profile.cpp", "tests/shared.h" }
     links { "yojimbo" }
 
+project "load"
+    files { "tests/load.cpp", "tests/shared.h" }
+    links { "yojimbo" }
+
+project "bench"
+    files { "tests/bench.cpp" }
+    links { "yojimbo" }
+
+project "benchmark"
+    files { "tests/benchmark.cpp", "tests/shared.h" }
+    links { "yojimbo" }
+
+project "crypto_bench"
+    files { "tests/crypto_bench.cpp" }
+    links { "yojimbo" }
+
+project "channel_bench"
+    files { "tests/channel_bench.cpp", "tests/shared.h" }
+    links { "yojimbo" }
+
 if not os.is "windows" then
 
     -- MacOSX and Linux.
@@ -236,6 +259,70 @@ if not os.is "windows" then
         end
     }
 
+    newaction
+    {
+        trigger     = "load",
+        description = "Build and run many-client load test",
+        execute = function ()
+            os.execute "test ! -e Makefile && premake5 gmake"
+            if os.execute "make -j32 load config=release_x64" == 0 then
+                os.execute "./bin/load"
+            end
+        end
+    }
+
+    newaction
+    {
+        trigger     = "bench",
+        description = "Build and run serialization microbenchmarks",
+        execute = function ()
+            os.execute "test ! -e Makefile && premake5 gmake"
+            if os.execute "make -j32 bench config=release_x64" == 0 then
+                os.execute "./bin/bench"
+            end
+        end
+    }
+
+    newaction
+    {
+        trigger     = "benchmark",
+        description = "Build and run benchmarks. Writes benchmark.json, and compares against baseline.json if it exists",
+        execute = function ()
+            os.execute "test ! -e Makefile && premake5 gmake"
+            if os.execute "make -j32 benchmark config=release_x64" == 0 then
+                if os.isfile "baseline.json" then
+                    os.execute "./bin/benchmark --json benchmark.json --baseline baseline.json"
+                else
+                    os.execute "./bin/benchmark --json benchmark.json"
+                end
+            end
+        end
+    }
+
+    newaction
+    {
+        trigger     = "crypto_bench",
+        description = "Build and run crypto throughput benchmarks",
+        execute = function ()
+            os.execute "test ! -e Makefile && premake5 gmake"
+            if os.execute "make -j32 crypto_bench config=release_x64" == 0 then
+                os.execute "./bin/crypto_bench"
+            end
+        end
+    }
+
+    newaction
+    {
+        trigger     = "channel_bench",
+        description = "Build and run channel throughput benchmarks under simulated loss and latency",
+        execute = function ()
+            os.execute "test ! -e Makefile && premake5 gmake"
+            if os.execute "make -j32 channel_bench config=release_x64" == 0 then
+                os.execute "./bin/channel_bench"
+            end
+        end
+    }
+
     newaction
     {
         trigger     = "cppcheck",
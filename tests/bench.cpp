@@ -0,0 +1,920 @@
+/*
+    Bench Testbed.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace yojimbo;
+
+const int NumValues = 16 * 1024;                                // values serialized per pass. small enough that the working set stays in cache.
+const int NumPasses = 64;                                       // passes per trial.
+const int NumTrials = 5;                                        // the fastest trial is reported, to filter out noise from the rest of the system.
+const int NumStrings = 16;
+const int MaxStringLength = 32;
+const int BufferSize = NumValues * ( MaxStringLength + 4 );    // large enough for the worst case (strings).
+
+const int ArrayBits = 10;                                       // bits per value in the fixed width array benchmarks.
+const int ArrayRun = 64;                                        // values serialized per serialize_bits_array call.
+const int IntMin = -1000;
+const int IntMax = +1000;
+
+struct BenchData
+{
+    uint32_t bitsValue[NumValues];
+    int bitsCount[NumValues];
+    uint32_t arrayValue[NumValues];
+    int32_t intValue[NumValues];
+    uint32_t relativePrevious[NumValues];
+    uint32_t relativeCurrent[NumValues];
+    uint32_t varintValue[NumValues];
+    int32_t zigzagValue[NumValues];
+    uint16_t ackSequence[NumValues];
+    uint16_t ack[NumValues];
+    float floatValue[NumValues];
+    char string[NumStrings][MaxStringLength];
+    char readString[MaxStringLength];
+};
+
+static BenchData data;
+
+static uint8_t * buffer;
+
+static volatile int sink;                                      // results are written here so the compiler can't throw away the work being measured.
+
+static uint32_t seed;
+
+static uint32_t bench_random()
+{
+    // IMPORTANT: xorshift32 with a fixed seed, so every run benchmarks exactly the same data.
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void GenerateBenchData()
+{
+    seed = 0x12345678;
+
+    for ( int i = 0; i < NumValues; ++i )
+    {
+        const int bits = 1 + bench_random() % 32;
+        data.bitsCount[i] = bits;
+        data.bitsValue[i] = bench_random() & ( bits == 32 ? 0xFFFFFFFF : ( ( 1U << bits ) - 1 ) );
+
+        data.arrayValue[i] = bench_random() & ( ( 1U << ArrayBits ) - 1 );
+
+        data.intValue[i] = IntMin + int( bench_random() % ( IntMax - IntMin + 1 ) );
+
+        // spread the relative differences across every encoding bucket, weighted towards the common small deltas
+
+        uint32_t difference = 1;
+        switch ( bench_random() % 8 )
+        {
+            case 3: difference = 2 + bench_random() % 5;            break;
+            case 4: difference = 7 + bench_random() % 17;           break;
+            case 5: difference = 24 + bench_random() % 257;         break;
+            case 6: difference = 281 + bench_random() % 4097;       break;
+            case 7: difference = 4378 + bench_random() % 65537;     break;
+            default: break;
+        }
+        data.relativePrevious[i] = bench_random() >> 1;
+        data.relativeCurrent[i] = data.relativePrevious[i] + difference;
+
+        // skewed towards small values, like entity ids and counters: each extra bit of magnitude is half as likely
+
+        const int magnitude = trailing_zeros( uint64_t( bench_random() ) | ( uint64_t(1) << 31 ) );
+        data.varintValue[i] = bench_random() & ( ( 1U << magnitude ) - 1 );
+        data.zigzagValue[i] = ( bench_random() & 1 ) ? -int32_t( data.varintValue[i] ) : int32_t( data.varintValue[i] );
+
+        // most acks are within 64 of the sequence, but some fall back to the full 16 bits
+
+        const int ackDelta = ( bench_random() % 8 ) ? 1 + bench_random() % 64 : 65 + bench_random() % 1000;
+        data.ackSequence[i] = uint16_t( bench_random() );
+        data.ack[i] = uint16_t( data.ackSequence[i] - ackDelta );
+
+        data.floatValue[i] = ( bench_random() / float( 0xFFFFFFFF ) ) * 2000.0f - 1000.0f;
+    }
+
+    for ( int i = 0; i < NumStrings; ++i )
+    {
+        const int length = bench_random() % ( MaxStringLength - 2 );
+        for ( int j = 0; j < length; ++j )
+            data.string[i][j] = 'a' + bench_random() % 26;
+        data.string[i][length] = '\0';
+    }
+}
+
+static void PrintResult( const char * name, double time, int bits )
+{
+    const double ops = double( NumValues ) * NumPasses;
+    printf( "%-56s %8.2f ns/op %8.2f bits/op\n", name, time * 1000000000.0 / ops, bits / double( NumValues ) );
+}
+
+static void BenchWriteBits()
+{
+    double bestTime = 1000000.0;
+    int bits = 0;
+
+    for ( int trial = 0; trial < NumTrials; ++trial )
+    {
+        const double startTime = platform_time();
+
+        for ( int pass = 0; pass < NumPasses; ++pass )
+        {
+            BitWriter writer( buffer, BufferSize );
+            for ( int i = 0; i < NumValues; ++i )
+                writer.WriteBits( data.bitsValue[i], data.bitsCount[i] );
+            writer.FlushBits();
+            bits = writer.GetBitsWritten();
+            sink = bits;
+        }
+
+        const double time = platform_time() - startTime;
+        if ( time < bestTime )
+            bestTime = time;
+    }
+
+    PrintResult( "BitWriter::WriteBits", bestTime, bits );
+}
+
+static void BenchReadBits()
+{
+    BitWriter writer( buffer, BufferSize );
+    for ( int i = 0; i < NumValues; ++i )
+        writer.WriteBits( data.bitsValue[i], data.bitsCount[i] );
+    writer.FlushBits();
+    const int bytes = writer.GetBytesWritten();
+
+    double bestTime = 1000000.0;
+    int bits = 0;
+
+    for ( int trial = 0; trial < NumTrials; ++trial )
+    {
+        const double startTime = platform_time();
+
+        for ( int pass = 0; pass < NumPasses; ++pass )
+        {
+            BitReader reader( buffer, bytes );
+            int hash = 0;
+            for ( int i = 0; i < NumValues; ++i )
+                hash ^= reader.ReadBits( data.bitsCount[i] );
+            bits = reader.GetBitsRead();
+            sink = hash ^ bits;
+        }
+
+        const double time = platform_time() - startTime;
+        if ( time < bestTime )
+            bestTime = time;
+    }
+
+    PrintResult( "BitReader::ReadBits", bestTime, bits );
+}
+
+struct SerializeBits
+{
+    static const char * GetName() { return "serialize_bits"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        serialize_bits( stream, data.bitsValue[i], data.bitsCount[i] );
+        return true;
+    }
+};
+
+struct SerializeBitsFixed
+{
+    static const char * GetName() { return "serialize_bits (10 bits)"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        serialize_bits( stream, data.arrayValue[i], ArrayBits );
+        return true;
+    }
+};
+
+struct SerializeBitsArray
+{
+    static const char * GetName() { return "serialize_bits_array (10 bits)"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        // same values and bits as serialize_bits (10 bits), serialized ArrayRun values at a time. see BenchRun
+
+        serialize_bits_array( stream, &data.arrayValue[i], ArrayRun, ArrayBits );
+        return true;
+    }
+};
+
+struct SerializeInt
+{
+    static const char * GetName() { return "serialize_int"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        serialize_int( stream, data.intValue[i], IntMin, IntMax );
+        return true;
+    }
+};
+
+struct SerializeIntRelative
+{
+    static const char * GetName() { return "serialize_int_relative_internal"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        return serialize_int_relative_internal( stream, data.relativePrevious[i], data.relativeCurrent[i] );
+    }
+};
+
+struct SerializeVarintRelative
+{
+    static const char * GetName() { return "serialize_varint (relative)"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        // same differences as serialize_int_relative_internal, for comparison. differences are at least 1, so encode difference - 1
+
+        uint32_t difference = 0;
+        if ( Stream::IsWriting )
+            difference = data.relativeCurrent[i] - data.relativePrevious[i] - 1;
+        serialize_varint( stream, difference );
+        if ( Stream::IsReading )
+            sink = data.relativePrevious[i] + difference + 1;
+        return true;
+    }
+};
+
+struct SerializeVarint
+{
+    static const char * GetName() { return "serialize_varint"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        serialize_varint( stream, data.varintValue[i] );
+        return true;
+    }
+};
+
+struct SerializeZigzag
+{
+    static const char * GetName() { return "serialize_zigzag"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        serialize_zigzag( stream, data.zigzagValue[i] );
+        return true;
+    }
+};
+
+struct SerializeIntZigzagRange
+{
+    static const char * GetName() { return "serialize_zigzag (int range)"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        serialize_zigzag( stream, data.intValue[i] );
+        return true;
+    }
+};
+
+struct SerializeAckRelative
+{
+    static const char * GetName() { return "serialize_ack_relative_internal"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        return serialize_ack_relative_internal( stream, data.ackSequence[i], data.ack[i] );
+    }
+};
+
+struct SerializeFloat
+{
+    static const char * GetName() { return "serialize_float_internal"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        return serialize_float_internal( stream, data.floatValue[i] );
+    }
+};
+
+struct SerializeQuantizedFloat
+{
+    static const char * GetName() { return "serialize_quantized_float (16 bits)"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        float value = data.floatValue[i];
+        serialize_quantized_float( stream, value, -1000.0f, 1000.0f, 16 );
+        if ( Stream::IsReading )
+            sink = int( value );
+        return true;
+    }
+};
+
+struct SerializeString
+{
+    static const char * GetName() { return "serialize_string_internal"; }
+
+    template <typename Stream> static bool Serialize( Stream & stream, int i )
+    {
+        char * string = Stream::IsWriting ? data.string[i%NumStrings] : data.readString;
+        return serialize_string_internal( stream, string, MaxStringLength );
+    }
+};
+
+template <typename Op> struct BenchRun { enum { Value = 1 }; };                          // values serialized per call to Op::Serialize.
+
+template <> struct BenchRun<SerializeBitsArray> { enum { Value = ArrayRun }; };
+
+template <typename Op, typename Stream> bool SerializeValues( Stream & stream )
+{
+    for ( int i = 0; i < NumValues; i += BenchRun<Op>::Value )
+    {
+        if ( !Op::Serialize( stream, i ) )
+            return false;
+    }
+    return true;
+}
+
+static void BenchFailed( const char * streamName, const char * name )
+{
+    printf( "error: %s %s failed\n", streamName, name );
+    exit( 1 );
+}
+
+static void PrintStreamResult( const char * streamName, const char * name, double time, int bits )
+{
+    char label[256];
+    snprintf( label, sizeof( label ), "%s %s", streamName, name );
+    PrintResult( label, time, bits );
+}
+
+template <typename Op> void BenchWriteStream()
+{
+    double bestTime = 1000000.0;
+    int bits = 0;
+
+    for ( int trial = 0; trial < NumTrials; ++trial )
+    {
+        const double startTime = platform_time();
+
+        for ( int pass = 0; pass < NumPasses; ++pass )
+        {
+            WriteStream stream( buffer, BufferSize );
+            if ( !SerializeValues<Op>( stream ) )
+                BenchFailed( "WriteStream", Op::GetName() );
+            stream.Flush();
+            bits = stream.GetBitsProcessed();
+            sink = bits;
+        }
+
+        const double time = platform_time() - startTime;
+        if ( time < bestTime )
+            bestTime = time;
+    }
+
+    PrintStreamResult( "WriteStream", Op::GetName(), bestTime, bits );
+}
+
+template <typename Op> void BenchReadStream()
+{
+    WriteStream writeStream( buffer, BufferSize );
+    if ( !SerializeValues<Op>( writeStream ) )
+        BenchFailed( "WriteStream", Op::GetName() );
+    writeStream.Flush();
+    const int bytes = writeStream.GetBytesProcessed();
+
+    double bestTime = 1000000.0;
+    int bits = 0;
+
+    for ( int trial = 0; trial < NumTrials; ++trial )
+    {
+        const double startTime = platform_time();
+
+        for ( int pass = 0; pass < NumPasses; ++pass )
+        {
+            ReadStream stream( buffer, bytes );
+            if ( !SerializeValues<Op>( stream ) )
+                BenchFailed( "ReadStream", Op::GetName() );
+            bits = stream.GetBitsProcessed();
+            sink = bits;
+        }
+
+        const double time = platform_time() - startTime;
+        if ( time < bestTime )
+            bestTime = time;
+    }
+
+    PrintStreamResult( "ReadStream", Op::GetName(), bestTime, bits );
+}
+
+template <typename Op> void BenchMeasureStream()
+{
+    double bestTime = 1000000.0;
+    int bits = 0;
+
+    for ( int trial = 0; trial < NumTrials; ++trial )
+    {
+        const double startTime = platform_time();
+
+        for ( int pass = 0; pass < NumPasses; ++pass )
+        {
+            MeasureStream stream;
+            if ( !SerializeValues<Op>( stream ) )
+                BenchFailed( "MeasureStream", Op::GetName() );
+            bits = stream.GetBitsProcessed();
+            sink = bits;
+        }
+
+        const double time = platform_time() - startTime;
+        if ( time < bestTime )
+            bestTime = time;
+    }
+
+    PrintStreamResult( "MeasureStream", Op::GetName(), bestTime, bits );
+}
+
+template <typename Op> void BenchStreams()
+{
+    BenchWriteStream<Op>();
+    BenchReadStream<Op>();
+    BenchMeasureStream<Op>();
+}
+
+// per-client server state as it was laid out before ServerClientTickData. the fields touched each tick were spread across several arrays and mixed in with cold data.
+
+struct ServerClientDataBefore
+{
+    Address address;
+    uint64_t clientId;
+    double connectTime;
+    double lastPacketSendTime;
+    double lastPacketReceiveTime;
+    double nextSendTime;
+    float sendRate;
+    bool pendingAcks;
+    bool fullyConnected;
+    uint64_t clientSalt;
+    bool insecure;
+};
+
+struct ServerStateBefore
+{
+    bool connected[MaxClients];
+    uint64_t clientId[MaxClients];
+    uint64_t sequence[MaxClients];
+    Address address[MaxClients];
+    ServerClientDataBefore data[MaxClients];
+    Connection * connection[MaxClients];
+    ConnectionPacket * jobPacket[MaxClients];
+};
+
+struct ServerStateAfter
+{
+    uint64_t clientId[MaxClients];
+    Address address[MaxClients];
+    ServerClientData data[MaxClients];
+    uint8_t tickMemory[sizeof( ServerClientTickData ) * MaxClients + CacheLineBytes - 1];
+    ServerClientTickData * tick;
+};
+
+const int NumServerTicks = 256;                                 // ticks per trial.
+const int CacheFlushBytes = 32 * 1024 * 1024;                   // written between ticks in the cold benchmarks, to push server state out of cache like the rest of a frame would.
+const double ServerTickRate = 60.0;
+const float ServerKeepAliveRate = 10.0f;
+
+static uint8_t * cacheFlushBuffer;
+
+static void FlushCache()
+{
+    for ( int i = 0; i < CacheFlushBytes; i += 64 )
+        cacheFlushBuffer[i]++;
+}
+
+static int ServerTickBefore( ServerStateBefore & server, double time )
+{
+    int numPacketsSent = 0;
+
+    // half of the clients sent a packet since the last tick
+
+    for ( int i = 0; i < MaxClients; i += 2 )
+    {
+        server.data[i].lastPacketReceiveTime = time;
+        server.data[i].pendingAcks = true;
+    }
+
+    for ( int i = 0; i < MaxClients; ++i )
+    {
+        if ( !server.connected[i] )
+            continue;
+
+        ServerClientDataBefore & clientData = server.data[i];
+
+        if ( clientData.fullyConnected && server.connection[i] && !( clientData.sendRate > 0.0f && clientData.nextSendTime > time ) && clientData.pendingAcks )
+        {
+            server.jobPacket[i] = NULL;
+            clientData.pendingAcks = false;
+            clientData.nextSendTime += 1.0 / clientData.sendRate;
+            clientData.lastPacketSendTime = time;
+            server.sequence[i]++;
+            numPacketsSent++;
+        }
+
+        if ( clientData.lastPacketSendTime + ( 1.0f / ServerKeepAliveRate ) <= time )
+        {
+            clientData.lastPacketSendTime = time;
+            server.sequence[i]++;
+            numPacketsSent++;
+        }
+    }
+
+    return numPacketsSent;
+}
+
+static int ServerTickAfter( ServerStateAfter & server, double time )
+{
+    int numPacketsSent = 0;
+
+    for ( int i = 0; i < MaxClients; i += 2 )
+    {
+        server.tick[i].lastPacketReceiveTime = time;
+        server.tick[i].pendingAcks = true;
+    }
+
+    for ( int i = 0; i < MaxClients; ++i )
+    {
+        ServerClientTickData & clientTick = server.tick[i];
+
+        if ( !clientTick.connected )
+            continue;
+
+        if ( clientTick.fullyConnected && clientTick.connection && !( clientTick.sendRate > 0.0f && clientTick.nextSendTime > time ) && clientTick.pendingAcks )
+        {
+            clientTick.jobPacket = NULL;
+            clientTick.pendingAcks = false;
+            clientTick.nextSendTime += 1.0 / clientTick.sendRate;
+            clientTick.lastPacketSendTime = time;
+            clientTick.sequence++;
+            numPacketsSent++;
+        }
+
+        if ( clientTick.lastPacketSendTime + ( 1.0f / ServerKeepAliveRate ) <= time )
+        {
+            clientTick.lastPacketSendTime = time;
+            clientTick.sequence++;
+            numPacketsSent++;
+        }
+    }
+
+    return numPacketsSent;
+}
+
+template <typename State> double BenchServerTick( State & server, int (*tick)( State & server, double time ), bool cold )
+{
+    double bestTime = 1000000.0;
+
+    double time = 100.0;
+
+    for ( int trial = 0; trial < NumTrials; ++trial )
+    {
+        double trialTime = 0.0;
+
+        for ( int i = 0; i < NumServerTicks; ++i )
+        {
+            if ( cold )
+                FlushCache();
+
+            const double startTime = platform_time();
+
+            sink = tick( server, time );
+
+            trialTime += platform_time() - startTime;
+
+            time += 1.0 / ServerTickRate;
+        }
+
+        if ( trialTime < bestTime )
+            bestTime = trialTime;
+    }
+
+    return bestTime;
+}
+
+static void PrintServerTickResult( const char * name, double time )
+{
+    const double ops = double( MaxClients ) * NumServerTicks;
+    printf( "%-56s %8.2f ns/client\n", name, time * 1000000000.0 / ops );
+}
+
+static void BenchServerTicks()
+{
+    // every client slot is connected, and a connection packet is due for every client that sent one since the last tick
+
+    Connection * connection = (Connection*) &cacheFlushBuffer[0];
+
+    ServerStateBefore * before = new ServerStateBefore;
+    ServerStateAfter * after = new ServerStateAfter;
+
+    after->tick = (ServerClientTickData*) ( ( uintptr_t( after->tickMemory ) + CacheLineBytes - 1 ) & ~uintptr_t( CacheLineBytes - 1 ) );
+
+    for ( int i = 0; i < MaxClients; ++i )
+    {
+        before->connected[i] = true;
+        before->clientId[i] = after->clientId[i] = 1 + i;
+        before->sequence[i] = 0;
+        before->address[i] = after->address[i] = Address( "::1", 40000 + i );
+        before->connection[i] = connection;
+        before->jobPacket[i] = NULL;
+
+        ServerClientDataBefore & clientData = before->data[i];
+        clientData.address = before->address[i];
+        clientData.clientId = before->clientId[i];
+        clientData.connectTime = 0.0;
+        clientData.lastPacketSendTime = 0.0;
+        clientData.lastPacketReceiveTime = 0.0;
+        clientData.nextSendTime = 0.0;
+        clientData.sendRate = float( ServerTickRate );
+        clientData.pendingAcks = false;
+        clientData.fullyConnected = true;
+        clientData.clientSalt = 0;
+        clientData.insecure = false;
+
+        after->data[i].address = after->address[i];
+        after->data[i].clientId = after->clientId[i];
+
+        ServerClientTickData * clientTick = new ( &after->tick[i] ) ServerClientTickData();
+        clientTick->connection = connection;
+        clientTick->sendRate = float( ServerTickRate );
+        clientTick->connected = true;
+        clientTick->fullyConnected = true;
+    }
+
+    PrintServerTickResult( "server tick (before, warm cache)", BenchServerTick( *before, ServerTickBefore, false ) );
+    PrintServerTickResult( "server tick (after, warm cache)", BenchServerTick( *after, ServerTickAfter, false ) );
+    PrintServerTickResult( "server tick (before, cold cache)", BenchServerTick( *before, ServerTickBefore, true ) );
+    PrintServerTickResult( "server tick (after, cold cache)", BenchServerTick( *after, ServerTickAfter, true ) );
+
+    delete before;
+    delete after;
+}
+
+const int NumBenchMessages = 1024;                              // messages referenced per pass. small enough that the working set stays in cache.
+const int NumMessagePasses = 256;                               // passes per trial.
+
+struct BenchMessage : public Message
+{
+    uint32_t value;
+
+    BenchMessage()
+    {
+        value = 0;
+    }
+
+    template <typename Stream> bool Serialize( Stream & stream )
+    {
+        serialize_bits( stream, value, 32 );
+        return true;
+    }
+
+    YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+};
+
+YOJIMBO_MESSAGE_FACTORY_START( BenchMessageFactory, MessageFactory, 1 );
+    YOJIMBO_DECLARE_POOLED_MESSAGE_TYPE( 0, BenchMessage, NumBenchMessages );
+YOJIMBO_MESSAGE_FACTORY_FINISH();
+
+static double BenchMessageRefs( MessageFactory & messageFactory )
+{
+    // like a message added to several packets, then acked
+
+    Message * messages[NumBenchMessages];
+    for ( int i = 0; i < NumBenchMessages; ++i )
+        messages[i] = messageFactory.Create( 0 );
+
+    double bestTime = 1000000.0;
+
+    for ( int trial = 0; trial < NumTrials; ++trial )
+    {
+        const double startTime = platform_time();
+
+        for ( int pass = 0; pass < NumMessagePasses; ++pass )
+        {
+            for ( int i = 0; i < NumBenchMessages; ++i )
+                messageFactory.AddRef( messages[i] );
+            for ( int i = 0; i < NumBenchMessages; ++i )
+                messageFactory.Release( messages[i] );
+        }
+
+        const double trialTime = platform_time() - startTime;
+        if ( trialTime < bestTime )
+            bestTime = trialTime;
+    }
+
+    for ( int i = 0; i < NumBenchMessages; ++i )
+    {
+        sink = messages[i]->GetRefCount();
+        messageFactory.Release( messages[i] );
+    }
+
+    return bestTime;
+}
+
+static double BenchMessageCreate( MessageFactory & messageFactory )
+{
+    Message * messages[NumBenchMessages];
+
+    double bestTime = 1000000.0;
+
+    for ( int trial = 0; trial < NumTrials; ++trial )
+    {
+        const double startTime = platform_time();
+
+        for ( int pass = 0; pass < NumMessagePasses; ++pass )
+        {
+            for ( int i = 0; i < NumBenchMessages; ++i )
+                messages[i] = messageFactory.Create( 0 );
+            for ( int i = 0; i < NumBenchMessages; ++i )
+                messageFactory.Release( messages[i] );
+        }
+
+        const double trialTime = platform_time() - startTime;
+        if ( trialTime < bestTime )
+            bestTime = trialTime;
+    }
+
+    return bestTime;
+}
+
+static void PrintMessageResult( const char * name, double time )
+{
+    const double ops = double( NumBenchMessages ) * NumMessagePasses;
+    printf( "%-56s %8.2f ns/message\n", name, time * 1000000000.0 / ops );
+}
+
+static void BenchMessages()
+{
+    BenchMessageFactory messageFactory( GetDefaultAllocator() );
+
+    BenchMessageFactory threadSafeMessageFactory( GetDefaultAllocator() );
+
+    threadSafeMessageFactory.SetThreadSafe( true );
+
+#if YOJIMBO_ATOMIC_MESSAGE_REFS
+    printf( "note: YOJIMBO_ATOMIC_MESSAGE_REFS is 1, so the non-atomic results below are atomic too\n\n" );
+#endif // #if YOJIMBO_ATOMIC_MESSAGE_REFS
+
+    PrintMessageResult( "message add ref + release (non-atomic)", BenchMessageRefs( messageFactory ) );
+    PrintMessageResult( "message add ref + release (atomic)", BenchMessageRefs( threadSafeMessageFactory ) );
+    PrintMessageResult( "message create + release (non-atomic)", BenchMessageCreate( messageFactory ) );
+    PrintMessageResult( "message create + release (thread-safe factory)", BenchMessageCreate( threadSafeMessageFactory ) );
+}
+
+const int NumBenchConnectTokens = 16 * 1024;
+const double ConnectTokenTargetPerSecond = 50000.0;            // tokens per-second we want to issue from one backend during a launch.
+
+static IssuedConnectToken issuedConnectTokens[NumBenchConnectTokens];
+
+static double BenchIssueConnectTokens( int numThreads )
+{
+    static uint64_t clientIds[NumBenchConnectTokens];
+    for ( int i = 0; i < NumBenchConnectTokens; ++i )
+        clientIds[i] = i + 1;
+
+    uint8_t key[KeyBytes];
+    GenerateKey( key );
+
+    Address serverAddresses[2];
+    serverAddresses[0] = Address( 127, 0, 0, 1, 40000 );
+    serverAddresses[1] = Address( 127, 0, 0, 1, 40001 );
+
+    uint64_t nonce = 0;
+
+    double bestTime = 1000000.0;
+
+    for ( int trial = 0; trial < NumTrials; ++trial )
+    {
+        const double startTime = platform_time();
+
+        if ( !IssueConnectTokens( clientIds, NumBenchConnectTokens, 2, serverAddresses, 1, 45, key, nonce, issuedConnectTokens, numThreads ) )
+        {
+            printf( "error: failed to issue connect tokens\n" );
+            exit( 1 );
+        }
+
+        const double trialTime = platform_time() - startTime;
+        if ( trialTime < bestTime )
+            bestTime = trialTime;
+    }
+
+    sink = issuedConnectTokens[NumBenchConnectTokens-1].connectTokenBytes;
+
+    return bestTime;
+}
+
+static void BenchConnectTokens()
+{
+    const int threadCounts[] = { 1, 2, 4, 8 };
+
+    for ( int i = 0; i < int( sizeof( threadCounts ) / sizeof( threadCounts[0] ) ); ++i )
+    {
+        const double time = BenchIssueConnectTokens( threadCounts[i] );
+        const double tokensPerSecond = NumBenchConnectTokens / time;
+
+        char name[64];
+        snprintf( name, sizeof( name ), "issue connect tokens (%d thread%s)", threadCounts[i], threadCounts[i] > 1 ? "s" : "" );
+
+        printf( "%-56s %8.0f tokens/sec %s\n", name, tokensPerSecond, tokensPerSecond >= ConnectTokenTargetPerSecond ? "" : "(below target)" );
+    }
+}
+
+int BenchMain()
+{
+    GenerateBenchData();
+
+    buffer = (uint8_t*) malloc( BufferSize );
+
+    printf( "\n" );
+
+#ifndef NDEBUG
+    printf( "warning: asserts are enabled. build with config=release for meaningful results\n\n" );
+#endif // #ifndef NDEBUG
+
+    BenchWriteBits();
+    BenchReadBits();
+
+    BenchStreams<SerializeBits>();
+    BenchStreams<SerializeBitsFixed>();
+    BenchStreams<SerializeBitsArray>();
+    BenchStreams<SerializeInt>();
+    BenchStreams<SerializeIntZigzagRange>();
+    BenchStreams<SerializeIntRelative>();
+    BenchStreams<SerializeVarintRelative>();
+    BenchStreams<SerializeVarint>();
+    BenchStreams<SerializeZigzag>();
+    BenchStreams<SerializeAckRelative>();
+    BenchStreams<SerializeFloat>();
+    BenchStreams<SerializeQuantizedFloat>();
+    BenchStreams<SerializeString>();
+
+    printf( "\n" );
+
+    cacheFlushBuffer = (uint8_t*) calloc( CacheFlushBytes, 1 );
+
+    BenchServerTicks();
+
+    printf( "\n" );
+
+    BenchMessages();
+
+    printf( "\n" );
+
+    BenchConnectTokens();
+
+    printf( "\n" );
+
+    free( cacheFlushBuffer );
+
+    free( buffer );
+
+    return 0;
+}
+
+int main()
+{
+    if ( !InitializeYojimbo() )
+    {
+        printf( "error: failed to initialize yojimbo\n" );
+        exit( 1 );
+    }
+
+    int result = BenchMain();
+
+    ShutdownYojimbo();
+
+    return result;
+}
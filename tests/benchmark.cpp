@@ -0,0 +1,1099 @@
+/*
+    Benchmark Runner.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#define SERVER 1
+#define CLIENT 1
+#define QUIET 1
+
+#include "shared.h"
+#include "rapidjson/document.h"
+#include <string.h>
+#include <math.h>
+
+// Benchmark runner with machine readable output.
+//
+//   benchmark                                  run everything and print a table
+//   benchmark --json results.json              also write the results with environment metadata
+//   benchmark --baseline baseline.json         compare against a stored baseline. exits with 1 if anything regressed
+//   benchmark --filter crypto                  only run benchmarks with this substring in their name
+//   benchmark --samples 30 --threshold 3       samples per benchmark, and the smallest change (%) worth reporting
+//
+// Store a baseline by saving --json output from a release build of the revision you are comparing against.
+
+const int DefaultNumSamples = 20;
+const int MaxSamples = 256;
+const double DefaultThreshold = 5.0;                            // changes in the mean smaller than this (%) are noise, even when they are statistically significant.
+
+const int BufferSize = 64 * 1024;
+
+static uint8_t buffer[BufferSize];
+
+static volatile int sink;                                      // results are written here so the compiler can't throw away the work being measured.
+
+struct Benchmark
+{
+    const char * name;                                          // group/name. the group is one of serializer, channel, connection, crypto, transport or client_server.
+    int opsPerSample;                                           // operations timed per sample. results are reported per operation.
+    bool (*setup)();
+    void (*run)( int numOps );
+    void (*shutdown)();
+};
+
+struct BenchmarkResult
+{
+    const char * name;
+    int opsPerSample;
+    int numSamples;
+    double samples[MaxSamples];                                 // ns/op for each sample
+    double mean;
+    double median;
+    double stddev;
+    double min;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+struct BenchObject
+{
+    uint32_t id;
+    int32_t health;
+    float position[3];
+    float orientation[4];
+    uint32_t flags;
+    bool active;
+    char name[16];
+
+    template <typename Stream> bool Serialize( Stream & stream )
+    {
+        serialize_bits( stream, id, 20 );
+        serialize_int( stream, health, -100, 100 );
+        for ( int i = 0; i < 3; ++i )
+            serialize_quantized_float( stream, position[i], -1000.0f, 1000.0f, 20 );
+        serialize_quaternion( stream, orientation, 10 );
+        serialize_varint( stream, flags );
+        serialize_bool( stream, active );
+        serialize_string( stream, name, sizeof( name ) );
+        return true;
+    }
+};
+
+const int NumObjects = 256;                                     // objects serialized per operation. about one packet worth.
+
+static BenchObject objects[NumObjects];
+
+static int serializedBytes;
+
+template <typename Stream> static bool SerializeObjects( Stream & stream )
+{
+    for ( int i = 0; i < NumObjects; ++i )
+    {
+        if ( !objects[i].Serialize( stream ) )
+            return false;
+    }
+    return true;
+}
+
+static bool SetupSerializer()
+{
+    for ( int i = 0; i < NumObjects; ++i )
+    {
+        BenchObject & object = objects[i];
+        object.id = i * 17;
+        object.health = i % 100;
+        object.position[0] = i * 1.5f;
+        object.position[1] = -i * 0.25f;
+        object.position[2] = 100.0f;
+        object.orientation[0] = 0.0f;
+        object.orientation[1] = 0.0f;
+        object.orientation[2] = 0.0f;
+        object.orientation[3] = 1.0f;
+        object.flags = i;
+        object.active = ( i & 1 ) != 0;
+        snprintf( object.name, sizeof( object.name ), "object %d", i );
+    }
+
+    WriteStream stream( buffer, BufferSize );
+    if ( !SerializeObjects( stream ) )
+        return false;
+    stream.Flush();
+    serializedBytes = stream.GetBytesProcessed();
+    return true;
+}
+
+static void RunWriteStream( int numOps )
+{
+    for ( int i = 0; i < numOps; ++i )
+    {
+        WriteStream stream( buffer, BufferSize );
+        SerializeObjects( stream );
+        stream.Flush();
+        sink = stream.GetBytesProcessed();
+    }
+}
+
+static void RunReadStream( int numOps )
+{
+    for ( int i = 0; i < numOps; ++i )
+    {
+        ReadStream stream( buffer, serializedBytes );
+        sink = SerializeObjects( stream );
+    }
+}
+
+static void RunMeasureStream( int numOps )
+{
+    for ( int i = 0; i < numOps; ++i )
+    {
+        MeasureStream stream;
+        SerializeObjects( stream );
+        sink = stream.GetBitsProcessed();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+const uint8_t EncryptionPacketBytes = 200;                      // typical game packet.
+
+static uint8_t encryptionKey[KeyBytes];
+static uint8_t encryptionNonce[NonceBytes];
+static uint8_t encryptionPacket[1200];
+static uint8_t encryptedPacket[1200 + MacBytes];
+static uint8_t decryptedPacket[1200 + MacBytes];
+static int encryptedPacketBytes;
+
+static bool SetupCrypto()
+{
+    GenerateKey( encryptionKey );
+    memset( encryptionNonce, 0, sizeof( encryptionNonce ) );
+    for ( int i = 0; i < (int) sizeof( encryptionPacket ); ++i )
+        encryptionPacket[i] = uint8_t( i );
+    return Encrypt( encryptionPacket, sizeof( encryptionPacket ), encryptedPacket, encryptedPacketBytes, encryptionNonce, encryptionKey );
+}
+
+static void RunEncrypt( int numOps )
+{
+    int bytes = 0;
+    for ( int i = 0; i < numOps; ++i )
+    {
+        encryptionNonce[0] = uint8_t( i );
+        Encrypt( encryptionPacket, EncryptionPacketBytes, decryptedPacket, bytes, encryptionNonce, encryptionKey );
+    }
+    sink = bytes;
+}
+
+static void RunDecrypt( int numOps )
+{
+    encryptionNonce[0] = 0;
+    int bytes = 0;
+    for ( int i = 0; i < numOps; ++i )
+        sink = Decrypt( encryptedPacket, encryptedPacketBytes, decryptedPacket, bytes, encryptionNonce, encryptionKey );
+}
+
+static void RunEncryptMTU( int numOps )
+{
+    int bytes = 0;
+    for ( int i = 0; i < numOps; ++i )
+    {
+        encryptionNonce[0] = uint8_t( i );
+        Encrypt( encryptionPacket, sizeof( encryptionPacket ), decryptedPacket, bytes, encryptionNonce, encryptionKey );
+    }
+    sink = bytes;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+const int SenderPort = 10000;
+const int ReceiverPort = 10001;
+
+const double EncryptionMappingTimeout = 1000000.0;                // simulated time moves forward every operation, so this must outlast every sample.
+
+static double transportTime;
+
+static TestPacketFactory * packetFactory;
+static TestMessageFactory * messageFactory;
+static NetworkSimulator * networkSimulator;
+static TransportContext * transportContext;
+static ConnectionContext * connectionContext;
+static ConnectionConfig connectionConfig;
+static LocalTransport * senderTransport;
+static LocalTransport * receiverTransport;
+static Connection * sender;
+static Connection * receiver;
+
+static bool SetupTransports( bool encrypted )
+{
+    transportTime = 100.0;
+
+    packetFactory = new TestPacketFactory();
+    messageFactory = new TestMessageFactory();
+    networkSimulator = new NetworkSimulator( GetDefaultAllocator() );
+
+    connectionConfig = ConnectionConfig();
+    connectionConfig.connectionPacketType = TEST_PACKET_CONNECTION;
+
+    connectionContext = new ConnectionContext();
+    connectionContext->messageFactory = messageFactory;
+    connectionContext->connectionConfig = &connectionConfig;
+
+    transportContext = new TransportContext( GetDefaultAllocator(), *packetFactory );
+    transportContext->connectionContext = connectionContext;
+
+    Address senderAddress( "::1", SenderPort );
+    Address receiverAddress( "::1", ReceiverPort );
+
+    senderTransport = new LocalTransport( GetDefaultAllocator(), *networkSimulator, senderAddress, ProtocolId, transportTime );
+    receiverTransport = new LocalTransport( GetDefaultAllocator(), *networkSimulator, receiverAddress, ProtocolId, transportTime );
+
+    senderTransport->SetContext( *transportContext );
+    receiverTransport->SetContext( *transportContext );
+
+    if ( encrypted )
+    {
+        uint8_t senderKey[KeyBytes];
+        uint8_t receiverKey[KeyBytes];
+        GenerateKey( senderKey );
+        GenerateKey( receiverKey );
+
+        senderTransport->EnablePacketEncryption();
+        receiverTransport->EnablePacketEncryption();
+
+        if ( !senderTransport->AddEncryptionMapping( receiverAddress, senderKey, receiverKey, EncryptionMappingTimeout ) || 
+             !receiverTransport->AddEncryptionMapping( senderAddress, receiverKey, senderKey, EncryptionMappingTimeout ) )
+            return false;
+    }
+
+    return true;
+}
+
+static void ShutdownTransports()
+{
+    delete sender;
+    delete receiver;
+    delete senderTransport;
+    delete receiverTransport;
+    delete transportContext;
+    delete connectionContext;
+    delete networkSimulator;
+    delete messageFactory;
+    delete packetFactory;
+
+    sender = NULL;
+    receiver = NULL;
+    senderTransport = NULL;
+    receiverTransport = NULL;
+    transportContext = NULL;
+    connectionContext = NULL;
+    networkSimulator = NULL;
+    messageFactory = NULL;
+    packetFactory = NULL;
+}
+
+static int ReceiveAll( Transport & transport )
+{
+    int numPackets = 0;
+    while ( true )
+    {
+        Address from;
+        Packet * packet = transport.ReceivePacket( from, NULL );
+        if ( !packet )
+            break;
+        packet->Destroy();
+        numPackets++;
+    }
+    return numPackets;
+}
+
+static void AdvanceTransports()
+{
+    transportTime += 0.01;
+    senderTransport->AdvanceTime( transportTime );
+    receiverTransport->AdvanceTime( transportTime );
+}
+
+static bool SetupTransport()
+{
+    return SetupTransports( false );
+}
+
+static bool SetupEncryptedTransport()
+{
+    return SetupTransports( true );
+}
+
+static void RunTransport( int numOps )
+{
+    const Address & receiverAddress = receiverTransport->GetAddress();
+
+    for ( int i = 0; i < numOps; ++i )
+    {
+        senderTransport->SendPacket( receiverAddress, packetFactory->Create( TEST_PACKET_A ), 0, false );
+        senderTransport->WritePackets();
+        receiverTransport->ReadPackets();
+        sink = ReceiveAll( *receiverTransport );
+        AdvanceTransports();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+const int MessagesPerPacket = 8;
+
+static void ExchangeConnectionPackets()
+{
+    senderTransport->SendPacket( receiverTransport->GetAddress(), sender->GeneratePacket(), 0, false );
+    receiverTransport->SendPacket( senderTransport->GetAddress(), receiver->GeneratePacket(), 0, false );
+
+    senderTransport->WritePackets();
+    receiverTransport->WritePackets();
+
+    senderTransport->ReadPackets();
+    receiverTransport->ReadPackets();
+
+    Connection * connections[] = { sender, receiver };
+    Transport * transports[] = { senderTransport, receiverTransport };
+
+    for ( int i = 0; i < 2; ++i )
+    {
+        while ( true )
+        {
+            Address from;
+            Packet * packet = transports[i]->ReceivePacket( from, NULL );
+            if ( !packet )
+                break;
+
+            if ( packet->GetType() == TEST_PACKET_CONNECTION )
+                connections[i]->ProcessPacket( (ConnectionPacket*) packet );
+
+            packet->Destroy();
+        }
+    }
+
+    AdvanceTransports();
+
+    sender->AdvanceTime( transportTime );
+    receiver->AdvanceTime( transportTime );
+}
+
+static bool SetupConnection()
+{
+    if ( !SetupTransports( true ) )
+        return false;
+
+    sender = new Connection( GetDefaultAllocator(), *packetFactory, *messageFactory, connectionConfig );
+    receiver = new Connection( GetDefaultAllocator(), *packetFactory, *messageFactory, connectionConfig );
+
+    return true;
+}
+
+static void RunConnection( int numOps )
+{
+    for ( int i = 0; i < numOps; ++i )
+        ExchangeConnectionPackets();
+}
+
+static void RunChannel( int numOps )
+{
+    uint16_t sequence = 0;
+
+    for ( int i = 0; i < numOps; i += MessagesPerPacket )
+    {
+        for ( int j = 0; j < MessagesPerPacket && sender->CanSendMsg(); ++j )
+        {
+            TestMessage * message = (TestMessage*) messageFactory->Create( TEST_MESSAGE );
+            if ( !message )
+                break;
+            message->sequence = sequence++;
+            sender->SendMsg( message );
+        }
+
+        ExchangeConnectionPackets();
+
+        while ( true )
+        {
+            Message * message = receiver->ReceiveMsg();
+            if ( !message )
+                break;
+            sink = message->GetId();
+            messageFactory->Release( message );
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+static double clientServerTime;
+
+static LocalTransport * clientTransport;
+static LocalTransport * serverTransport;
+static GameClient * client;
+static GameServer * server;
+
+static void PumpClientServer()
+{
+    client->SendPackets();
+    server->SendPackets();
+
+    clientTransport->WritePackets();
+    serverTransport->WritePackets();
+
+    clientTransport->ReadPackets();
+    serverTransport->ReadPackets();
+
+    client->ReceivePackets();
+    server->ReceivePackets();
+
+    client->CheckForTimeOut();
+    server->CheckForTimeOut();
+
+    clientServerTime += 0.01;
+
+    client->AdvanceTime( clientServerTime );
+    server->AdvanceTime( clientServerTime );
+
+    clientTransport->AdvanceTime( clientServerTime );
+    serverTransport->AdvanceTime( clientServerTime );
+}
+
+static bool ConnectClient()
+{
+    const uint64_t clientId = 1;
+
+    client->InsecureConnect( clientId, Address( "::1", ServerPort ) );
+
+    for ( int i = 0; i < 1000; ++i )
+    {
+        PumpClientServer();
+
+        if ( client->ConnectionFailed() )
+            return false;
+
+        if ( client->IsConnected() && server->GetNumConnectedClients() == 1 )
+            return true;
+    }
+
+    return false;
+}
+
+static void DisconnectClient()
+{
+    client->Disconnect();
+
+    for ( int i = 0; i < 1000 && server->GetNumConnectedClients() > 0; ++i )
+        PumpClientServer();
+}
+
+static bool SetupClientServer( bool connect )
+{
+    clientServerTime = 100.0;
+
+    if ( !SetupTransports( false ) )
+        return false;
+
+    Address clientAddress( "::1", ClientPort );
+    Address serverAddress( "::1", ServerPort );
+
+    clientTransport = new LocalTransport( GetDefaultAllocator(), *networkSimulator, clientAddress, ProtocolId, clientServerTime );
+    serverTransport = new LocalTransport( GetDefaultAllocator(), *networkSimulator, serverAddress, ProtocolId, clientServerTime );
+
+    clientTransport->SetFlags( TRANSPORT_FLAG_INSECURE_MODE );
+    serverTransport->SetFlags( TRANSPORT_FLAG_INSECURE_MODE );
+
+    ClientServerConfig config;
+
+    client = new GameClient( GetDefaultAllocator(), *clientTransport, config, clientServerTime );
+    server = new GameServer( GetDefaultAllocator(), *serverTransport, config, clientServerTime );
+
+    server->SetServerAddress( serverAddress );
+    server->SetFlags( SERVER_FLAG_ALLOW_INSECURE_CONNECT );
+    server->Start();
+
+    return !connect || ConnectClient();
+}
+
+static void ShutdownClientServer()
+{
+    client->Disconnect();
+    server->Stop();
+
+    delete client;
+    delete server;
+    delete clientTransport;
+    delete serverTransport;
+
+    client = NULL;
+    server = NULL;
+    clientTransport = NULL;
+    serverTransport = NULL;
+
+    ShutdownTransports();
+}
+
+static bool SetupClientServerConnect()
+{
+    return SetupClientServer( false );
+}
+
+static bool SetupClientServerConnected()
+{
+    return SetupClientServer( true );
+}
+
+static void RunClientServerConnect( int numOps )
+{
+    for ( int i = 0; i < numOps; ++i )
+    {
+        sink = ConnectClient();
+        DisconnectClient();
+    }
+}
+
+static void RunClientServerMessages( int numOps )
+{
+    uint16_t sequence = 0;
+
+    for ( int i = 0; i < numOps; ++i )
+    {
+        if ( client->CanSendMsg() )
+        {
+            TestMessage * message = (TestMessage*) client->CreateMsg( TEST_MESSAGE );
+            if ( message )
+            {
+                message->sequence = sequence;
+                client->SendMsg( message );
+            }
+        }
+
+        if ( server->CanSendMsg( 0 ) )
+        {
+            TestMessage * message = (TestMessage*) server->CreateMsg( 0, TEST_MESSAGE );
+            if ( message )
+            {
+                message->sequence = sequence;
+                server->SendMsg( 0, message );
+            }
+        }
+
+        sequence++;
+
+        PumpClientServer();
+
+        while ( Message * message = client->ReceiveMsg() )
+        {
+            sink = message->GetId();
+            client->ReleaseMsg( message );
+        }
+
+        while ( Message * message = server->ReceiveMsg( 0 ) )
+        {
+            sink = message->GetId();
+            server->ReleaseMsg( 0, message );
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+static const Benchmark benchmarks[] = 
+{
+    { "serializer/write_stream",                64,     SetupSerializer,                RunWriteStream,             NULL },
+    { "serializer/read_stream",                 64,     SetupSerializer,                RunReadStream,              NULL },
+    { "serializer/measure_stream",              64,     SetupSerializer,                RunMeasureStream,           NULL },
+    { "channel/reliable_ordered_messages",      4096,   SetupConnection,                RunChannel,                 ShutdownTransports },
+    { "connection/packet_exchange",             1024,   SetupConnection,                RunConnection,              ShutdownTransports },
+    { "crypto/encrypt_200",                     4096,   SetupCrypto,                    RunEncrypt,                 NULL },
+    { "crypto/encrypt_1200",                    1024,   SetupCrypto,                    RunEncryptMTU,              NULL },
+    { "crypto/decrypt_1200",                    1024,   SetupCrypto,                    RunDecrypt,                 NULL },
+    { "transport/local_send_receive",           4096,   SetupTransport,                 RunTransport,               ShutdownTransports },
+    { "transport/encrypted_send_receive",       4096,   SetupEncryptedTransport,        RunTransport,               ShutdownTransports },
+    { "client_server/connect_disconnect",       8,      SetupClientServerConnect,       RunClientServerConnect,     ShutdownClientServer },
+    { "client_server/message_exchange",         1024,   SetupClientServerConnected,     RunClientServerMessages,    ShutdownClientServer },
+};
+
+const int NumBenchmarks = sizeof( benchmarks ) / sizeof( benchmarks[0] );
+
+static int CompareDoubles( const void * a, const void * b )
+{
+    const double x = *(const double*) a;
+    const double y = *(const double*) b;
+    return ( x < y ) ? -1 : ( x > y ) ? 1 : 0;
+}
+
+static void CalculateStatistics( BenchmarkResult & result )
+{
+    const int n = result.numSamples;
+
+    double sorted[MaxSamples];
+    memcpy( sorted, result.samples, n * sizeof( double ) );
+    qsort( sorted, n, sizeof( double ), CompareDoubles );
+
+    double sum = 0.0;
+    for ( int i = 0; i < n; ++i )
+        sum += sorted[i];
+
+    result.mean = sum / n;
+    result.median = ( n & 1 ) ? sorted[n/2] : ( sorted[n/2-1] + sorted[n/2] ) * 0.5;
+    result.min = sorted[0];
+
+    double variance = 0.0;
+    for ( int i = 0; i < n; ++i )
+        variance += ( sorted[i] - result.mean ) * ( sorted[i] - result.mean );
+
+    result.stddev = ( n > 1 ) ? sqrt( variance / ( n - 1 ) ) : 0.0;
+}
+
+static bool RunBenchmark( const Benchmark & benchmark, int numSamples, BenchmarkResult & result )
+{
+    memset( &result, 0, sizeof( result ) );
+    result.name = benchmark.name;
+    result.opsPerSample = benchmark.opsPerSample;
+    result.numSamples = numSamples;
+
+    if ( benchmark.setup && !benchmark.setup() )
+    {
+        printf( "error: %s setup failed\n", benchmark.name );
+        if ( benchmark.shutdown )
+            benchmark.shutdown();
+        return false;
+    }
+
+    // IMPORTANT: one untimed sample first, so caches, branch predictors and allocator free lists are warm before we start measuring.
+
+    benchmark.run( benchmark.opsPerSample );
+
+    for ( int i = 0; i < numSamples; ++i )
+    {
+        const uint64_t start = platform_time_ns();
+        benchmark.run( benchmark.opsPerSample );
+        const uint64_t finish = platform_time_ns();
+        result.samples[i] = double( finish - start ) / benchmark.opsPerSample;
+    }
+
+    if ( benchmark.shutdown )
+        benchmark.shutdown();
+
+    CalculateStatistics( result );
+
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+static const char * GetPlatformName()
+{
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+    return "windows";
+#elif YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC
+    return "mac";
+#elif defined(__linux__)
+    return "linux";
+#else
+    return "unix";
+#endif
+}
+
+static const char * GetCompilerName()
+{
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc";
+#else
+    return "unknown";
+#endif
+}
+
+static const char * GetBuildConfig()
+{
+#ifdef NDEBUG
+    return "release";
+#else // #ifdef NDEBUG
+    return "debug";
+#endif // #ifdef NDEBUG
+}
+
+static void WriteJSONString( FILE * file, const char * string )
+{
+    fputc( '"', file );
+    for ( const char * p = string; *p; ++p )
+    {
+        if ( *p == '"' || *p == '\\' )
+            fputc( '\\', file );
+        if ( (unsigned char) *p >= 0x20 )
+            fputc( *p, file );
+    }
+    fputc( '"', file );
+}
+
+static bool WriteResults( const char * filename, const BenchmarkResult * results, int numResults, int numSamples )
+{
+    FILE * file = fopen( filename, "w" );
+    if ( !file )
+    {
+        printf( "error: could not open %s for writing\n", filename );
+        return false;
+    }
+
+    char timestamp[64];
+    const time_t now = time( NULL );
+    strftime( timestamp, sizeof( timestamp ), "%Y-%m-%dT%H:%M:%SZ", gmtime( &now ) );
+
+    fprintf( file, "{\n    \"environment\": {\n" );
+    fprintf( file, "        \"version\": \"%d.%d.%d\",\n", YOJIMBO_MAJOR_VERSION, YOJIMBO_MINOR_VERSION, YOJIMBO_PATCH_VERSION );
+    fprintf( file, "        \"platform\": \"%s\",\n", GetPlatformName() );
+    fprintf( file, "        \"compiler\": " );
+    WriteJSONString( file, GetCompilerName() );
+    fprintf( file, ",\n" );
+    fprintf( file, "        \"config\": \"%s\",\n", GetBuildConfig() );
+    fprintf( file, "        \"pointer_bits\": %d,\n", int( sizeof( void* ) * 8 ) );
+    fprintf( file, "        \"timestamp\": \"%s\",\n", timestamp );
+    fprintf( file, "        \"samples\": %d\n", numSamples );
+    fprintf( file, "    },\n    \"benchmarks\": [\n" );
+
+    for ( int i = 0; i < numResults; ++i )
+    {
+        const BenchmarkResult & result = results[i];
+        fprintf( file, "        {\n" );
+        fprintf( file, "            \"name\": \"%s\",\n", result.name );
+        fprintf( file, "            \"ops_per_sample\": %d,\n", result.opsPerSample );
+        fprintf( file, "            \"mean_ns\": %.3f,\n", result.mean );
+        fprintf( file, "            \"median_ns\": %.3f,\n", result.median );
+        fprintf( file, "            \"stddev_ns\": %.3f,\n", result.stddev );
+        fprintf( file, "            \"min_ns\": %.3f,\n", result.min );
+        fprintf( file, "            \"samples_ns\": [" );
+        for ( int j = 0; j < result.numSamples; ++j )
+            fprintf( file, "%s%.3f", j ? ", " : "", result.samples[j] );
+        fprintf( file, "]\n        }%s\n", ( i < numResults - 1 ) ? "," : "" );
+    }
+
+    fprintf( file, "    ]\n}\n" );
+
+    fclose( file );
+
+    return true;
+}
+
+static char * ReadFile( const char * filename )
+{
+    FILE * file = fopen( filename, "rb" );
+    if ( !file )
+        return NULL;
+
+    fseek( file, 0, SEEK_END );
+    const long size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+
+    char * data = (char*) malloc( size + 1 );
+    if ( fread( data, 1, size, file ) != size_t( size ) )
+    {
+        free( data );
+        fclose( file );
+        return NULL;
+    }
+
+    data[size] = '\0';
+    fclose( file );
+    return data;
+}
+
+/*
+    One-sided critical values of Student's t distribution at 95% confidence, indexed by degrees of freedom.
+ */
+
+static double CriticalT( double degreesOfFreedom )
+{
+    static const double table[] = { 6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812, 
+                                    1.796, 1.782, 1.771, 1.761, 1.753, 1.746, 1.740, 1.734, 1.729, 1.725, 
+                                    1.721, 1.717, 1.714, 1.711, 1.708, 1.706, 1.703, 1.701, 1.699, 1.697 };
+
+    const int df = int( degreesOfFreedom );
+
+    if ( df < 1 )
+        return table[0];
+
+    if ( df <= 30 )
+        return table[df-1];
+
+    return 1.645;
+}
+
+enum CompareResult
+{
+    COMPARE_UNCHANGED,
+    COMPARE_FASTER,
+    COMPARE_SLOWER,
+};
+
+/*
+    Welch's t-test between the baseline samples and the current samples. A change is only reported when the mean moved by more than the threshold, and the samples say it wasn't just noise.
+ */
+
+static CompareResult Compare( const BenchmarkResult & result, const double * baselineSamples, int numBaselineSamples, double threshold, double & change )
+{
+    double baselineMean = 0.0;
+    for ( int i = 0; i < numBaselineSamples; ++i )
+        baselineMean += baselineSamples[i];
+    baselineMean /= numBaselineSamples;
+
+    double baselineVariance = 0.0;
+    for ( int i = 0; i < numBaselineSamples; ++i )
+        baselineVariance += ( baselineSamples[i] - baselineMean ) * ( baselineSamples[i] - baselineMean );
+    baselineVariance = ( numBaselineSamples > 1 ) ? baselineVariance / ( numBaselineSamples - 1 ) : 0.0;
+
+    change = ( baselineMean > 0.0 ) ? ( result.mean - baselineMean ) / baselineMean * 100.0 : 0.0;
+
+    if ( fabs( change ) < threshold || numBaselineSamples < 2 || result.numSamples < 2 )
+        return COMPARE_UNCHANGED;
+
+    const double a = baselineVariance / numBaselineSamples;
+    const double b = result.stddev * result.stddev / result.numSamples;
+
+    if ( a + b <= 0.0 )
+        return change > 0.0 ? COMPARE_SLOWER : COMPARE_FASTER;
+
+    const double t = ( result.mean - baselineMean ) / sqrt( a + b );
+
+    const double df = ( a + b ) * ( a + b ) / ( a * a / ( numBaselineSamples - 1 ) + b * b / ( result.numSamples - 1 ) );
+
+    if ( fabs( t ) < CriticalT( df ) )
+        return COMPARE_UNCHANGED;
+
+    return t > 0.0 ? COMPARE_SLOWER : COMPARE_FASTER;
+}
+
+static bool CompareResults( const char * filename, const BenchmarkResult * results, int numResults, double threshold, int & numRegressions )
+{
+    numRegressions = 0;
+
+    char * json = ReadFile( filename );
+    if ( !json )
+    {
+        printf( "error: could not read baseline %s\n", filename );
+        return false;
+    }
+
+    rapidjson::Document doc;
+    doc.Parse( json );
+    free( json );
+
+    if ( doc.HasParseError() || !doc.IsObject() || !doc.HasMember( "benchmarks" ) || !doc["benchmarks"].IsArray() )
+    {
+        printf( "error: baseline %s is not valid benchmark json\n", filename );
+        return false;
+    }
+
+    if ( doc.HasMember( "environment" ) && doc["environment"].IsObject() )
+    {
+        const rapidjson::Value & environment = doc["environment"];
+
+        if ( environment.HasMember( "config" ) && environment["config"].IsString() && strcmp( environment["config"].GetString(), GetBuildConfig() ) != 0 )
+            printf( "warning: baseline was built with config %s, this is %s\n", environment["config"].GetString(), GetBuildConfig() );
+
+        if ( environment.HasMember( "compiler" ) && environment["compiler"].IsString() && strcmp( environment["compiler"].GetString(), GetCompilerName() ) != 0 )
+            printf( "warning: baseline was built with %s, this is %s\n", environment["compiler"].GetString(), GetCompilerName() );
+    }
+
+    printf( "\n%-40s %12s %12s %9s\n", "benchmark", "baseline", "current", "change" );
+
+    const rapidjson::Value & baseline = doc["benchmarks"];
+
+    for ( int i = 0; i < numResults; ++i )
+    {
+        const BenchmarkResult & result = results[i];
+
+        const rapidjson::Value * entry = NULL;
+        for ( rapidjson::SizeType j = 0; j < baseline.Size(); ++j )
+        {
+            const rapidjson::Value & value = baseline[j];
+            if ( value.IsObject() && value.HasMember( "name" ) && value["name"].IsString() && strcmp( value["name"].GetString(), result.name ) == 0 )
+            {
+                entry = &value;
+                break;
+            }
+        }
+
+        if ( !entry || !entry->HasMember( "samples_ns" ) || !(*entry)["samples_ns"].IsArray() )
+        {
+            printf( "%-40s %12s %12.2f %9s\n", result.name, "-", result.mean, "new" );
+            continue;
+        }
+
+        const rapidjson::Value & samples = (*entry)["samples_ns"];
+
+        double baselineSamples[MaxSamples];
+        int numBaselineSamples = 0;
+        double baselineMean = 0.0;
+        for ( rapidjson::SizeType j = 0; j < samples.Size() && numBaselineSamples < MaxSamples; ++j )
+        {
+            if ( !samples[j].IsNumber() )
+                continue;
+            baselineSamples[numBaselineSamples] = samples[j].GetDouble();
+            baselineMean += baselineSamples[numBaselineSamples];
+            numBaselineSamples++;
+        }
+
+        if ( numBaselineSamples == 0 )
+        {
+            printf( "%-40s %12s %12.2f %9s\n", result.name, "-", result.mean, "new" );
+            continue;
+        }
+
+        baselineMean /= numBaselineSamples;
+
+        double change = 0.0;
+        const CompareResult compare = Compare( result, baselineSamples, numBaselineSamples, threshold, change );
+
+        const char * verdict = "";
+        if ( compare == COMPARE_SLOWER )
+        {
+            verdict = "  REGRESSION";
+            numRegressions++;
+        }
+        else if ( compare == COMPARE_FASTER )
+        {
+            verdict = "  faster";
+        }
+
+        printf( "%-40s %12.2f %12.2f %+8.1f%%%s\n", result.name, baselineMean, result.mean, change, verdict );
+    }
+
+    printf( "\n" );
+
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+static void PrintUsage()
+{
+    printf( "usage: benchmark [--json results.json] [--baseline baseline.json] [--filter substring] [--samples n] [--threshold percent] [--list]\n" );
+}
+
+int BenchmarkMain( int argc, char * argv[] )
+{
+    const char * jsonFile = NULL;
+    const char * baselineFile = NULL;
+    const char * filter = NULL;
+    int numSamples = DefaultNumSamples;
+    double threshold = DefaultThreshold;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const bool hasValue = i + 1 < argc;
+
+        if ( strcmp( argv[i], "--json" ) == 0 && hasValue )
+            jsonFile = argv[++i];
+        else if ( strcmp( argv[i], "--baseline" ) == 0 && hasValue )
+            baselineFile = argv[++i];
+        else if ( strcmp( argv[i], "--filter" ) == 0 && hasValue )
+            filter = argv[++i];
+        else if ( strcmp( argv[i], "--samples" ) == 0 && hasValue )
+            numSamples = atoi( argv[++i] );
+        else if ( strcmp( argv[i], "--threshold" ) == 0 && hasValue )
+            threshold = atof( argv[++i] );
+        else if ( strcmp( argv[i], "--list" ) == 0 )
+        {
+            for ( int j = 0; j < NumBenchmarks; ++j )
+                printf( "%s\n", benchmarks[j].name );
+            return 0;
+        }
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if ( numSamples < 2 || numSamples > MaxSamples )
+    {
+        printf( "error: samples must be in [2,%d]\n", MaxSamples );
+        return 1;
+    }
+
+    printf( "\n" );
+
+#ifndef NDEBUG
+    printf( "warning: asserts are enabled. build with config=release for meaningful results\n\n" );
+#endif // #ifndef NDEBUG
+
+    printf( "%-40s %12s %12s %12s %12s\n", "benchmark", "mean ns/op", "median", "stddev", "min" );
+
+    BenchmarkResult * results = (BenchmarkResult*) malloc( sizeof( BenchmarkResult ) * NumBenchmarks );
+    int numResults = 0;
+
+    for ( int i = 0; i < NumBenchmarks; ++i )
+    {
+        if ( filter && !strstr( benchmarks[i].name, filter ) )
+            continue;
+
+        BenchmarkResult & result = results[numResults];
+
+        if ( !RunBenchmark( benchmarks[i], numSamples, result ) )
+            continue;
+
+        printf( "%-40s %12.2f %12.2f %12.2f %12.2f\n", result.name, result.mean, result.median, result.stddev, result.min );
+
+        numResults++;
+    }
+
+    int exitCode = 0;
+
+    if ( jsonFile && !WriteResults( jsonFile, results, numResults, numSamples ) )
+        exitCode = 1;
+
+    if ( baselineFile )
+    {
+        int numRegressions = 0;
+        if ( !CompareResults( baselineFile, results, numResults, threshold, numRegressions ) )
+        {
+            exitCode = 1;
+        }
+        else if ( numRegressions > 0 )
+        {
+            printf( "%d benchmark%s regressed by more than %.1f%%\n\n", numRegressions, numRegressions == 1 ? "" : "s", threshold );
+            exitCode = 1;
+        }
+    }
+
+    free( results );
+
+    return exitCode;
+}
+
+int main( int argc, char * argv[] )
+{
+    if ( !InitializeYojimbo() )
+    {
+        printf( "error: failed to initialize yojimbo\n" );
+        exit( 1 );
+    }
+
+    int result = BenchmarkMain( argc, argv );
+
+    ShutdownYojimbo();
+
+    return result;
+}
@@ -0,0 +1,454 @@
+/*
+    Channel Benchmark.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "shared.h"
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+// Sustained throughput and delivery latency of reliable-ordered and unreliable-unordered channels, between two connections over the
+// network simulator. Each run saturates the sender for a fixed amount of simulated time, under a given packet loss and round trip time.
+//
+//   channel_bench                          sweep everything
+//   channel_bench --loss 5 --rtt 100       one network condition instead of the default sweep
+//   channel_bench --channel reliable       only reliable-ordered (or unreliable)
+//   channel_bench --duration 30            simulated seconds per run
+//   channel_bench --rate 600               offer this many messages per second, instead of saturating the channel
+//
+// Starting from the default ChannelConfig, each sweep changes one parameter at a time, so its effect can be read off against the
+// baseline row above it.
+//
+// Latency is measured from SendMsg to ReceiveMsg, so when the channel is saturated it is mostly time spent in the send queue.
+// Use --rate below the sustained throughput to see the latency added by loss and resends alone.
+
+const double DeltaTime = 1.0 / 60.0;                            // one connection packet each way per update, like a 60Hz server tick.
+const double DefaultDuration = 10.0;                            // simulated seconds per run. the first second is warmup and isn't counted.
+const double WarmupTime = 1.0;
+const int MaxMessagesPerUpdate = 512;                           // cap on messages queued per update, so a channel that never says no can't queue forever.
+const int BlockSize = 16 * 1024;
+const int MaxBlocksInFlight = 4;
+
+const int SenderPort = 10000;
+const int ReceiverPort = 10001;
+
+const float DefaultLoss[] = { 0.0f, 5.0f, 20.0f };
+const float DefaultRTT[] = { 50.0f, 200.0f };
+
+enum SweepParameter
+{
+    SWEEP_NONE,
+    SWEEP_MAX_MESSAGES_PER_PACKET,
+    SWEEP_PACKET_BUDGET,
+    SWEEP_FRAGMENT_SIZE,
+    SWEEP_MESSAGE_RESEND_TIME,
+    SWEEP_FRAGMENT_RESEND_TIME,
+};
+
+struct Sweep
+{
+    SweepParameter parameter;
+    const char * name;
+    bool blocks;                                                // true if this sweep is run with blocks instead of messages.
+    bool reliableOnly;
+    int numValues;
+    float values[4];
+};
+
+static const Sweep sweeps[] = 
+{
+    { SWEEP_NONE,                       "baseline",                 false,  false,  1,  { 0 } },
+    { SWEEP_MAX_MESSAGES_PER_PACKET,    "maxMessagesPerPacket",     false,  false,  3,  { 8, 32, 256 } },
+    { SWEEP_PACKET_BUDGET,              "packetBudget",             false,  false,  4,  { -1, 256, 512, 2048 } },
+    { SWEEP_MESSAGE_RESEND_TIME,        "messageResendTime",        false,  true,   3,  { 0.05f, 0.2f, 0.5f } },
+    { SWEEP_NONE,                       "blocks baseline",          true,   true,   1,  { 0 } },
+    { SWEEP_FRAGMENT_SIZE,              "fragmentSize",             true,   true,   3,  { 256, 512, 1000 } },
+    { SWEEP_FRAGMENT_RESEND_TIME,       "fragmentResendTime",       true,   true,   3,  { 0.05f, 0.1f, 0.5f } },
+};
+
+const int NumSweeps = sizeof( sweeps ) / sizeof( sweeps[0] );
+
+struct ChannelBenchResult
+{
+    bool error;
+    double messagesPerSecond;
+    double blockBytesPerSecond;
+    double sentKbps;
+    float latency50;                                            // delivery latency percentiles, from SendMsg to ReceiveMsg (milliseconds).
+    float latency95;
+    float latency99;
+    float latencyMax;
+};
+
+static void ApplySweep( ChannelConfig & channelConfig, SweepParameter parameter, float value )
+{
+    switch ( parameter )
+    {
+        case SWEEP_MAX_MESSAGES_PER_PACKET:     channelConfig.maxMessagesPerPacket = int( value );      break;
+        case SWEEP_PACKET_BUDGET:               channelConfig.packetBudget = int( value );              break;
+        case SWEEP_FRAGMENT_SIZE:               channelConfig.fragmentSize = int( value );              break;
+        case SWEEP_MESSAGE_RESEND_TIME:         channelConfig.messageResendTime = value;                break;
+        case SWEEP_FRAGMENT_RESEND_TIME:        channelConfig.fragmentResendTime = value;               break;
+        default:                                                                                        break;
+    }
+}
+
+static void ProcessPackets( Transport & transport, Connection & connection )
+{
+    while ( true )
+    {
+        Address from;
+        Packet * packet = transport.ReceivePacket( from, NULL );
+        if ( !packet )
+            break;
+
+        if ( packet->GetType() == TEST_PACKET_CONNECTION )
+            connection.ProcessPacket( (ConnectionPacket*) packet );
+
+        packet->Destroy();
+    }
+}
+
+static float Percentile( const std::vector<float> & sorted, float percent )
+{
+    if ( sorted.empty() )
+        return 0.0f;
+    const size_t index = size_t( ( sorted.size() - 1 ) * percent / 100.0f );
+    return sorted[index];
+}
+
+static ChannelBenchResult RunChannelBench( const ConnectionConfig & connectionConfig, bool blocks, float loss, float rtt, double duration, double rate )
+{
+    ChannelBenchResult result;
+    memset( &result, 0, sizeof( result ) );
+
+    const ChannelType channelType = connectionConfig.channel[0].type;
+
+    TestPacketFactory packetFactory;
+    TestMessageFactory messageFactory;
+
+    Connection sender( GetDefaultAllocator(), packetFactory, messageFactory, connectionConfig );
+    Connection receiver( GetDefaultAllocator(), packetFactory, messageFactory, connectionConfig );
+
+    ConnectionContext connectionContext;
+    connectionContext.messageFactory = &messageFactory;
+    connectionContext.connectionConfig = &connectionConfig;
+
+    NetworkSimulator networkSimulator( GetDefaultAllocator() );
+    networkSimulator.SetLatency( rtt / 2 );
+    networkSimulator.SetPacketLoss( loss );
+
+    double time = 100.0;
+
+    TransportContext transportContext( GetDefaultAllocator(), packetFactory );
+    transportContext.connectionContext = &connectionContext;
+
+    LocalTransport senderTransport( GetDefaultAllocator(), networkSimulator, Address( "::1", SenderPort ), ProtocolId, time );
+    LocalTransport receiverTransport( GetDefaultAllocator(), networkSimulator, Address( "::1", ReceiverPort ), ProtocolId, time );
+
+    senderTransport.SetContext( transportContext );
+    receiverTransport.SetContext( transportContext );
+
+    // IMPORTANT: message sequence numbers are 16 bits, so send times are looked up modulo 65536. nothing stays in flight long enough to wrap.
+
+    std::vector<double> sendTime( 65536, 0.0 );
+    std::vector<float> latencies;
+
+    uint16_t sequence = 0;
+    int blocksInFlight = 0;
+    uint64_t messagesReceived = 0;
+    uint64_t blockBytesReceived = 0;
+    double sentKbps = 0.0;
+    int numBandwidthSamples = 0;
+    double messagesOffered = 0.0;
+
+    const double startTime = time;
+    const double measureTime = startTime + WarmupTime;
+    const double finishTime = measureTime + duration;
+
+    while ( time < finishTime )
+    {
+        // saturate the sender. reliable channels push back with CanSendMsg once the send queue is full. unreliable channels never do,
+        // so offer them a packet's worth of messages per update, and let whatever doesn't fit get dropped.
+
+        int maxMessages = ( channelType == CHANNEL_TYPE_RELIABLE_ORDERED ) ? MaxMessagesPerUpdate : connectionConfig.channel[0].maxMessagesPerPacket;
+
+        if ( rate > 0.0 )
+        {
+            messagesOffered += rate * DeltaTime;
+            maxMessages = int( messagesOffered );
+            messagesOffered -= maxMessages;
+        }
+
+        for ( int i = 0; i < maxMessages && sender.CanSendMsg(); ++i )
+        {
+            if ( blocks )
+            {
+                if ( blocksInFlight >= MaxBlocksInFlight )
+                    break;
+
+                TestBlockMessage * message = (TestBlockMessage*) messageFactory.Create( TEST_BLOCK_MESSAGE );
+                uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), BlockSize );
+                if ( !message || !blockData )
+                {
+                    if ( message )
+                        messageFactory.Release( message );
+                    YOJIMBO_FREE( messageFactory.GetAllocator(), blockData );
+                    break;
+                }
+
+                memset( blockData, sequence & 0xFF, BlockSize );
+                message->sequence = sequence;
+                message->AttachBlock( messageFactory.GetAllocator(), blockData, BlockSize );
+                sender.SendMsg( message );
+                blocksInFlight++;
+            }
+            else
+            {
+                TestMessage * message = (TestMessage*) messageFactory.Create( TEST_MESSAGE );
+                if ( !message )
+                    break;
+                message->sequence = sequence;
+                sender.SendMsg( message );
+            }
+
+            sendTime[sequence] = time;
+            sequence++;
+        }
+
+        senderTransport.SendPacket( receiverTransport.GetAddress(), sender.GeneratePacket(), 0, false );
+        receiverTransport.SendPacket( senderTransport.GetAddress(), receiver.GeneratePacket(), 0, false );
+
+        senderTransport.WritePackets();
+        receiverTransport.WritePackets();
+
+        senderTransport.ReadPackets();
+        receiverTransport.ReadPackets();
+
+        ProcessPackets( senderTransport, sender );
+        ProcessPackets( receiverTransport, receiver );
+
+        while ( true )
+        {
+            Message * message = receiver.ReceiveMsg();
+            if ( !message )
+                break;
+
+            const bool measuring = time >= measureTime;
+
+            if ( message->IsBlockMessage() )
+            {
+                TestBlockMessage * blockMessage = (TestBlockMessage*) message;
+                if ( measuring )
+                    blockBytesReceived += blockMessage->GetBlockSize();
+                blocksInFlight--;
+                if ( measuring )
+                    latencies.push_back( float( ( time - sendTime[blockMessage->sequence] ) * 1000.0 ) );
+            }
+            else
+            {
+                TestMessage * testMessage = (TestMessage*) message;
+                if ( measuring )
+                    latencies.push_back( float( ( time - sendTime[testMessage->sequence] ) * 1000.0 ) );
+            }
+
+            if ( measuring )
+                messagesReceived++;
+
+            messageFactory.Release( message );
+        }
+
+        if ( sender.GetError() != CONNECTION_ERROR_NONE || receiver.GetError() != CONNECTION_ERROR_NONE )
+        {
+            result.error = true;
+            return result;
+        }
+
+        if ( time >= measureTime )
+        {
+            NetworkInfo info;
+            sender.GetNetworkInfo( info );
+            sentKbps += info.sentBandwidth;
+            numBandwidthSamples++;
+        }
+
+        time += DeltaTime;
+
+        sender.AdvanceTime( time );
+        receiver.AdvanceTime( time );
+
+        senderTransport.AdvanceTime( time );
+        receiverTransport.AdvanceTime( time );
+    }
+
+    std::sort( latencies.begin(), latencies.end() );
+
+    result.messagesPerSecond = messagesReceived / duration;
+    result.blockBytesPerSecond = blockBytesReceived / duration;
+    result.sentKbps = numBandwidthSamples ? sentKbps / numBandwidthSamples : 0.0;
+    result.latency50 = Percentile( latencies, 50.0f );
+    result.latency95 = Percentile( latencies, 95.0f );
+    result.latency99 = Percentile( latencies, 99.0f );
+    result.latencyMax = latencies.empty() ? 0.0f : latencies.back();
+
+    return result;
+}
+
+static void PrintHeader( const char * channelName, float loss, float rtt )
+{
+    printf( "%s, %.0f%% loss, %.0fms rtt\n\n", channelName, loss, rtt );
+    printf( "%-30s %12s %12s %10s %9s %9s %9s %9s\n", "config", "messages/s", "block KB/s", "sent kbps", "p50 ms", "p95 ms", "p99 ms", "max ms" );
+}
+
+static void PrintResult( const char * name, const ChannelBenchResult & result )
+{
+    if ( result.error )
+    {
+        printf( "%-30s %12s\n", name, "error" );
+        return;
+    }
+
+    printf( "%-30s %12.0f %12.1f %10.0f %9.1f %9.1f %9.1f %9.1f\n", name, result.messagesPerSecond, result.blockBytesPerSecond / 1024.0, result.sentKbps, result.latency50, result.latency95, result.latency99, result.latencyMax );
+}
+
+static void RunSweeps( ChannelType channelType, float loss, float rtt, double duration, double rate )
+{
+    PrintHeader( channelType == CHANNEL_TYPE_RELIABLE_ORDERED ? "reliable-ordered" : "unreliable-unordered", loss, rtt );
+
+    for ( int i = 0; i < NumSweeps; ++i )
+    {
+        const Sweep & sweep = sweeps[i];
+
+        if ( sweep.reliableOnly && channelType != CHANNEL_TYPE_RELIABLE_ORDERED )
+            continue;
+
+        for ( int j = 0; j < sweep.numValues; ++j )
+        {
+            ConnectionConfig connectionConfig;
+            connectionConfig.connectionPacketType = TEST_PACKET_CONNECTION;
+            connectionConfig.channel[0].type = channelType;
+            ApplySweep( connectionConfig.channel[0], sweep.parameter, sweep.values[j] );
+
+            char name[64];
+            if ( sweep.parameter == SWEEP_NONE )
+                snprintf( name, sizeof( name ), "%s", sweep.name );
+            else
+                snprintf( name, sizeof( name ), "%s = %g", sweep.name, sweep.values[j] );
+
+            const ChannelBenchResult result = RunChannelBench( connectionConfig, sweep.blocks, loss, rtt, duration, rate );
+
+            PrintResult( name, result );
+        }
+    }
+
+    printf( "\n" );
+}
+
+int ChannelBenchMain( int argc, char * argv[] )
+{
+    float loss = -1.0f;
+    float rtt = -1.0f;
+    double duration = DefaultDuration;
+    double rate = 0.0;
+    bool reliable = true;
+    bool unreliable = true;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const bool hasValue = i + 1 < argc;
+
+        if ( strcmp( argv[i], "--loss" ) == 0 && hasValue )
+        {
+            loss = float( atof( argv[++i] ) );
+        }
+        else if ( strcmp( argv[i], "--rtt" ) == 0 && hasValue )
+        {
+            rtt = float( atof( argv[++i] ) );
+        }
+        else if ( strcmp( argv[i], "--duration" ) == 0 && hasValue )
+        {
+            duration = atof( argv[++i] );
+        }
+        else if ( strcmp( argv[i], "--rate" ) == 0 && hasValue )
+        {
+            rate = atof( argv[++i] );
+        }
+        else if ( strcmp( argv[i], "--channel" ) == 0 && hasValue )
+        {
+            const char * channel = argv[++i];
+            reliable = strcmp( channel, "reliable" ) == 0;
+            unreliable = strcmp( channel, "unreliable" ) == 0;
+        }
+        else
+        {
+            printf( "usage: channel_bench [--loss percent] [--rtt ms] [--channel reliable|unreliable] [--duration seconds] [--rate messages/s]\n" );
+            return 1;
+        }
+    }
+
+    if ( duration <= 0.0 || ( !reliable && !unreliable ) )
+    {
+        printf( "error: duration must be positive, and channel must be reliable or unreliable\n" );
+        return 1;
+    }
+
+    const int numLoss = ( loss >= 0.0f ) ? 1 : int( sizeof( DefaultLoss ) / sizeof( DefaultLoss[0] ) );
+    const int numRTT = ( rtt >= 0.0f ) ? 1 : int( sizeof( DefaultRTT ) / sizeof( DefaultRTT[0] ) );
+
+    printf( "\n" );
+
+    for ( int i = 0; i < numLoss; ++i )
+    {
+        for ( int j = 0; j < numRTT; ++j )
+        {
+            const float conditionLoss = ( loss >= 0.0f ) ? loss : DefaultLoss[i];
+            const float conditionRTT = ( rtt >= 0.0f ) ? rtt : DefaultRTT[j];
+
+            if ( reliable )
+                RunSweeps( CHANNEL_TYPE_RELIABLE_ORDERED, conditionLoss, conditionRTT, duration, rate );
+
+            if ( unreliable )
+                RunSweeps( CHANNEL_TYPE_UNRELIABLE_UNORDERED, conditionLoss, conditionRTT, duration, rate );
+        }
+    }
+
+    return 0;
+}
+
+int main( int argc, char * argv[] )
+{
+    if ( !InitializeYojimbo() )
+    {
+        printf( "error: failed to initialize yojimbo\n" );
+        exit( 1 );
+    }
+
+    srand( 0 );
+
+    int result = ChannelBenchMain( argc, argv );
+
+    ShutdownYojimbo();
+
+    return result;
+}
@@ -0,0 +1,599 @@
+/*
+    Crypto Benchmark.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace yojimbo;
+
+// Throughput of every encryption path a secure server runs per packet or per connect, across packet sizes, on one thread and on many.
+//
+//   crypto_bench                   run with 1 thread and 4 threads
+//   crypto_bench --threads 16      run with 1 thread and 16 threads
+//   crypto_bench --filter aead     only run cases with this substring in their name
+//
+// Packets/s is the total across all threads. Cycles/byte is measured with the time stamp counter on x86, which ticks at the nominal
+// clock rate, so it reads low when the CPU is boosting and high when it is throttled. Other platforms don't report it.
+
+const int PacketSizes[] = { 64, 128, 256, 512, 1024, 1200, 2048, 4096 };
+const int NumPacketSizes = sizeof( PacketSizes ) / sizeof( PacketSizes[0] );
+const int MaxPacketSize = 4096;
+
+const int BytesPerTrial = 4 * 1024 * 1024;                     // bytes encrypted per thread, per trial. enough to run for a few milliseconds at the smallest size.
+const int TokensPerTrial = 2048;                                // tokens per thread, per trial.
+const int NumTrials = 3;                                        // the fastest trial is reported, to filter out noise from the rest of the system.
+const int DefaultNumThreads = 4;
+const int MaxThreads = 64;
+const int BatchSize = 32;                                       // packets per EncryptBatch_InPlace call. about one server tick worth of packets to a single client group.
+
+static volatile int sink;                                      // results are written here so the compiler can't throw away the work being measured.
+
+#if ( defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) ) ) || ( defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) ) )
+const bool HasCycleCounter = true;
+#else
+const bool HasCycleCounter = false;
+#endif
+
+struct CryptoThreadData
+{
+    int packetBytes;
+    int numOps;
+    int opBytes;                                                // bytes processed per op. the packet size, or the size of the encrypted token.
+
+    uint8_t key[KeyBytes];
+    uint8_t nonce[NonceBytes];
+    uint8_t additional[8];
+
+    uint8_t plaintext[MaxPacketSize];
+    uint8_t ciphertext[MaxPacketSize + MacBytes];
+    uint64_t ciphertextBytes;
+    uint8_t work[MaxPacketSize + MacBytes];
+    uint8_t mac[MacBytes];
+
+    uint8_t batch[BatchSize][MaxPacketSize];
+    uint8_t batchMac[BatchSize][MacBytes];
+    EncryptBatchEntry batchEntries[BatchSize];
+
+    EncryptionManager * encryptionManager;
+    const PacketCipherState * keyState;
+
+    ConnectToken connectToken;
+    ChallengeToken challengeToken;
+    uint8_t tokenData[ConnectTokenBytes];
+
+    uint64_t ticks;
+    bool failed;
+};
+
+struct CryptoCase
+{
+    const char * name;
+    bool packetSized;                                           // true if the case runs for each packet size, false for fixed size tokens.
+    bool (*setup)( CryptoThreadData & data );
+    bool (*run)( CryptoThreadData & data );
+};
+
+static void NextNonce( CryptoThreadData & data )
+{
+    // IMPORTANT: never reuse a nonce with the same key, even in a benchmark. some ciphers are measurably faster on repeated input.
+    for ( int i = 0; i < NonceBytes; ++i )
+    {
+        if ( ++data.nonce[i] != 0 )
+            break;
+    }
+}
+
+static bool SetupKey( CryptoThreadData & data )
+{
+    GenerateKey( data.key );
+    memset( data.nonce, 0, sizeof( data.nonce ) );
+    RandomBytes( data.additional, sizeof( data.additional ) );
+    if ( data.packetBytes > 0 )
+        RandomBytes( data.plaintext, data.packetBytes );
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+static bool RunEncrypt( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        int bytes = 0;
+        NextNonce( data );
+        if ( !Encrypt( data.plaintext, data.packetBytes, data.ciphertext, bytes, data.nonce, data.key ) )
+            return false;
+    }
+    return true;
+}
+
+static bool SetupDecrypt( CryptoThreadData & data )
+{
+    SetupKey( data );
+    int bytes = 0;
+    const bool result = Encrypt( data.plaintext, data.packetBytes, data.ciphertext, bytes, data.nonce, data.key );
+    data.ciphertextBytes = bytes;
+    return result;
+}
+
+static bool RunDecrypt( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        int bytes = 0;
+        if ( !Decrypt( data.ciphertext, int( data.ciphertextBytes ), data.work, bytes, data.nonce, data.key ) )
+            return false;
+    }
+    return true;
+}
+
+static bool SetupBatch( CryptoThreadData & data )
+{
+    SetupKey( data );
+    for ( int i = 0; i < BatchSize; ++i )
+    {
+        memcpy( data.batch[i], data.plaintext, data.packetBytes );
+        EncryptBatchEntry & entry = data.batchEntries[i];
+        entry.message = data.batch[i];
+        entry.messageLength = data.packetBytes;
+        entry.mac = data.batchMac[i];
+        entry.key = data.key;
+        entry.keyState = NULL;
+    }
+    return true;
+}
+
+static bool RunEncryptBatch( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; i += BatchSize )
+    {
+        const int numEntries = ( data.numOps - i < BatchSize ) ? data.numOps - i : BatchSize;
+
+        for ( int j = 0; j < numEntries; ++j )
+        {
+            NextNonce( data );
+            memcpy( data.batchEntries[j].nonce, data.nonce, NonceBytes );
+        }
+
+        if ( !EncryptBatch_InPlace( PACKET_CIPHER_XSALSA20_POLY1305, data.batchEntries, numEntries ) )
+            return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+static bool SetupAES( CryptoThreadData & data )
+{
+    if ( !IsPacketCipherAvailable( PACKET_CIPHER_AES256_GCM ) )
+        return false;
+
+    SetupKey( data );
+
+    // the key state lives in the encryption manager, the same way it does for the transport
+
+    data.encryptionManager = new EncryptionManager( GetDefaultAllocator() );
+    data.encryptionManager->SetPacketCipher( PACKET_CIPHER_AES256_GCM );
+
+    const Address address( "::1", 40000 );
+    if ( !data.encryptionManager->AddEncryptionMapping( address, data.key, data.key, 0.0, 1000000.0 ) )
+        return false;
+
+    data.keyState = data.encryptionManager->GetSendKeyState( data.encryptionManager->FindEncryptionMapping( address, 0.0 ) );
+
+    memcpy( data.ciphertext, data.plaintext, data.packetBytes );
+    return Encrypt_InPlace( PACKET_CIPHER_AES256_GCM, data.ciphertext, data.packetBytes, data.mac, data.nonce, data.key, data.keyState );
+}
+
+static bool RunEncryptAES( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        NextNonce( data );
+        if ( !Encrypt_InPlace( PACKET_CIPHER_AES256_GCM, data.work, data.packetBytes, data.mac, data.nonce, data.key, data.keyState ) )
+            return false;
+    }
+    return true;
+}
+
+static bool RunDecryptAES( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        // IMPORTANT: decrypting in place destroys the ciphertext, so each packet is copied in first, like it would be from the socket buffer.
+        memcpy( data.work, data.ciphertext, data.packetBytes );
+        if ( !Decrypt_InPlace( PACKET_CIPHER_AES256_GCM, data.work, data.packetBytes, data.mac, data.nonce, data.key, data.keyState ) )
+            return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+static bool RunEncryptAEAD( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        NextNonce( data );
+        if ( !Encrypt_AEAD( data.plaintext, data.packetBytes, data.ciphertext, data.ciphertextBytes, data.additional, sizeof( data.additional ), data.nonce, data.key ) )
+            return false;
+    }
+    return true;
+}
+
+static bool SetupDecryptAEAD( CryptoThreadData & data )
+{
+    SetupKey( data );
+    return Encrypt_AEAD( data.plaintext, data.packetBytes, data.ciphertext, data.ciphertextBytes, data.additional, sizeof( data.additional ), data.nonce, data.key );
+}
+
+static bool RunDecryptAEAD( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        uint64_t bytes = 0;
+        if ( !Decrypt_AEAD( data.ciphertext, data.ciphertextBytes, data.work, bytes, data.additional, sizeof( data.additional ), data.nonce, data.key ) )
+            return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+static bool SetupTokens( CryptoThreadData & data )
+{
+    SetupKey( data );
+
+    Address serverAddresses[2];
+    serverAddresses[0] = Address( 127, 0, 0, 1, 40000 );
+    serverAddresses[1] = Address( "::1", 40001 );
+
+    GenerateConnectToken( data.connectToken, 1, 2, serverAddresses, 0x11223344556677ULL, 45 );
+
+    data.opBytes = ConnectTokenBytes;
+
+    return true;
+}
+
+static bool SetupCompactTokens( CryptoThreadData & data )
+{
+    if ( !SetupTokens( data ) || !EncryptCompactConnectToken( data.connectToken, data.tokenData, data.nonce, data.key ) )
+        return false;
+
+    data.opBytes = GetConnectTokenBytes( data.tokenData );
+
+    return true;
+}
+
+static bool RunEncryptConnectToken( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        NextNonce( data );
+        if ( !EncryptConnectToken( data.connectToken, data.tokenData, data.nonce, data.key ) )
+            return false;
+    }
+    return true;
+}
+
+static bool RunEncryptCompactConnectToken( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        NextNonce( data );
+        if ( !EncryptCompactConnectToken( data.connectToken, data.tokenData, data.nonce, data.key ) )
+            return false;
+    }
+    return true;
+}
+
+static bool SetupDecryptConnectToken( CryptoThreadData & data )
+{
+    return SetupTokens( data ) && EncryptConnectToken( data.connectToken, data.tokenData, data.nonce, data.key );
+}
+
+static bool RunDecryptConnectToken( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        ConnectToken token;
+        if ( !DecryptConnectToken( data.tokenData, token, data.nonce, data.key, data.connectToken.expireTimestamp ) )
+            return false;
+    }
+    return true;
+}
+
+static bool SetupChallengeToken( CryptoThreadData & data )
+{
+    if ( !SetupTokens( data ) )
+        return false;
+
+    // the mac of the encrypted connect token identifies the connect token inside the challenge token
+
+    if ( !EncryptConnectToken( data.connectToken, data.tokenData, data.nonce, data.key ) )
+        return false;
+
+    memcpy( data.mac, data.tokenData, MacBytes );
+
+    data.opBytes = ChallengeTokenBytes;
+
+    return GenerateChallengeToken( data.connectToken, data.mac, data.challengeToken ) && EncryptChallengeToken( data.challengeToken, data.tokenData, data.nonce, data.key );
+}
+
+static bool RunEncryptChallengeToken( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        NextNonce( data );
+        if ( !GenerateChallengeToken( data.connectToken, data.mac, data.challengeToken ) || !EncryptChallengeToken( data.challengeToken, data.work, data.nonce, data.key ) )
+            return false;
+    }
+    return true;
+}
+
+static bool RunDecryptChallengeToken( CryptoThreadData & data )
+{
+    for ( int i = 0; i < data.numOps; ++i )
+    {
+        ChallengeToken token;
+        if ( !DecryptChallengeToken( data.tokenData, token, data.nonce, data.key ) )
+            return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------------
+
+static const CryptoCase cases[] = 
+{
+    { "encrypt (xsalsa20-poly1305)",            true,   SetupKey,                           RunEncrypt },
+    { "decrypt (xsalsa20-poly1305)",            true,   SetupDecrypt,                       RunDecrypt },
+    { "encrypt batch (xsalsa20-poly1305)",      true,   SetupBatch,                         RunEncryptBatch },
+    { "encrypt (aes256-gcm)",                   true,   SetupAES,                           RunEncryptAES },
+    { "decrypt (aes256-gcm)",                   true,   SetupAES,                           RunDecryptAES },
+    { "encrypt aead (chacha20-poly1305)",       true,   SetupKey,                           RunEncryptAEAD },
+    { "decrypt aead (chacha20-poly1305)",       true,   SetupDecryptAEAD,                   RunDecryptAEAD },
+    { "encrypt connect token",                  false,  SetupTokens,                        RunEncryptConnectToken },
+    { "encrypt compact connect token",          false,  SetupCompactTokens,                 RunEncryptCompactConnectToken },
+    { "decrypt connect token",                  false,  SetupDecryptConnectToken,           RunDecryptConnectToken },
+    { "decrypt compact connect token",          false,  SetupCompactTokens,                 RunDecryptConnectToken },
+    { "encrypt challenge token",                false,  SetupChallengeToken,                RunEncryptChallengeToken },
+    { "decrypt challenge token",                false,  SetupChallengeToken,                RunDecryptChallengeToken },
+};
+
+const int NumCases = sizeof( cases ) / sizeof( cases[0] );
+
+static const CryptoCase * currentCase;
+
+static void CryptoThreadFunction( void * data )
+{
+    CryptoThreadData & threadData = *(CryptoThreadData*) data;
+    const uint64_t start = profile_ticks();
+    threadData.failed = !currentCase->run( threadData );
+    threadData.ticks = profile_ticks() - start;
+}
+
+/*
+    Runs a case on every thread at once, and returns the wall clock time of the fastest trial, or a negative value if the case failed.
+ */
+
+static double RunCase( const CryptoCase & crypto, CryptoThreadData * threadData, int numThreads, int packetBytes, uint64_t & ticks )
+{
+    const int numOps = crypto.packetSized ? BytesPerTrial / packetBytes : TokensPerTrial;
+
+    for ( int i = 0; i < numThreads; ++i )
+    {
+        threadData[i].packetBytes = packetBytes;
+        threadData[i].numOps = numOps;
+        threadData[i].opBytes = packetBytes;
+        threadData[i].encryptionManager = NULL;
+        threadData[i].keyState = NULL;
+    }
+
+    double result = -1.0;
+
+    bool setup = true;
+    for ( int i = 0; i < numThreads; ++i )
+        setup = setup && crypto.setup( threadData[i] );
+
+    if ( setup )
+    {
+        currentCase = &crypto;
+
+        double bestTime = 1000000.0;
+
+        for ( int trial = 0; trial < NumTrials; ++trial )
+        {
+            PlatformThread * threads[MaxThreads];
+
+            const uint64_t start = platform_time_ns();
+
+            if ( numThreads == 1 )
+            {
+                CryptoThreadFunction( &threadData[0] );
+            }
+            else
+            {
+                for ( int i = 0; i < numThreads; ++i )
+                    threads[i] = platform_thread_create( GetDefaultAllocator(), CryptoThreadFunction, &threadData[i] );
+
+                for ( int i = 0; i < numThreads; ++i )
+                {
+                    if ( threads[i] )
+                        platform_thread_join( GetDefaultAllocator(), threads[i] );
+                    else
+                        threadData[i].failed = true;
+                }
+            }
+
+            const double trialTime = ( platform_time_ns() - start ) / 1000000000.0;
+
+            bool failed = false;
+            uint64_t trialTicks = 0;
+            for ( int i = 0; i < numThreads; ++i )
+            {
+                failed = failed || threadData[i].failed;
+                trialTicks += threadData[i].ticks;
+            }
+
+            if ( failed )
+            {
+                bestTime = -1.0;
+                break;
+            }
+
+            if ( trialTime < bestTime )
+            {
+                bestTime = trialTime;
+                ticks = trialTicks;
+            }
+        }
+
+        result = bestTime;
+    }
+
+    for ( int i = 0; i < numThreads; ++i )
+    {
+        delete threadData[i].encryptionManager;
+        threadData[i].encryptionManager = NULL;
+    }
+
+    return result;
+}
+
+static void PrintCaseResult( const CryptoCase & crypto, CryptoThreadData * threadData, int numThreads, int packetBytes )
+{
+    char name[64];
+    if ( crypto.packetSized )
+        snprintf( name, sizeof( name ), "%s %dB", crypto.name, packetBytes );
+    else
+        snprintf( name, sizeof( name ), "%s", crypto.name );
+
+    uint64_t ticks = 0;
+    const double time = RunCase( crypto, threadData, numThreads, packetBytes, ticks );
+
+    if ( time < 0.0 )
+    {
+        printf( "%-48s %7d %14s\n", name, numThreads, "unavailable" );
+        return;
+    }
+
+    const int numOps = crypto.packetSized ? BytesPerTrial / packetBytes : TokensPerTrial;
+    const double totalOps = double( numOps ) * numThreads;
+    const double totalBytes = totalOps * threadData[0].opBytes;
+
+    printf( "%-48s %7d %14.0f %10.1f", name, numThreads, totalOps / time, totalBytes / time / ( 1024.0 * 1024.0 ) );
+
+    if ( HasCycleCounter )
+        printf( " %12.2f %12.0f\n", ticks / totalBytes, ticks / totalOps );
+    else
+        printf( " %12s %12s\n", "-", "-" );
+}
+
+int CryptoBenchMain( int argc, char * argv[] )
+{
+    int numThreads = DefaultNumThreads;
+    const char * filter = NULL;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( strcmp( argv[i], "--threads" ) == 0 && i + 1 < argc )
+        {
+            numThreads = atoi( argv[++i] );
+        }
+        else if ( strcmp( argv[i], "--filter" ) == 0 && i + 1 < argc )
+        {
+            filter = argv[++i];
+        }
+        else
+        {
+            printf( "usage: crypto_bench [--threads n] [--filter substring]\n" );
+            return 1;
+        }
+    }
+
+    if ( numThreads < 1 || numThreads > MaxThreads )
+    {
+        printf( "error: threads must be in [1,%d]\n", MaxThreads );
+        return 1;
+    }
+
+    printf( "\n" );
+
+#ifndef NDEBUG
+    printf( "warning: asserts are enabled. build with config=release for meaningful results\n\n" );
+#endif // #ifndef NDEBUG
+
+    CryptoThreadData * threadData = new CryptoThreadData[numThreads];
+
+    printf( "%-48s %7s %14s %10s %12s %12s\n", "case", "threads", "ops/s", "MB/s", "cycles/byte", "cycles/op" );
+
+    const int threadCounts[] = { 1, numThreads };
+    const int numThreadCounts = ( numThreads > 1 ) ? 2 : 1;
+
+    for ( int i = 0; i < NumCases; ++i )
+    {
+        const CryptoCase & crypto = cases[i];
+
+        if ( filter && !strstr( crypto.name, filter ) )
+            continue;
+
+        for ( int j = 0; j < numThreadCounts; ++j )
+        {
+            if ( crypto.packetSized )
+            {
+                for ( int k = 0; k < NumPacketSizes; ++k )
+                    PrintCaseResult( crypto, threadData, threadCounts[j], PacketSizes[k] );
+            }
+            else
+            {
+                PrintCaseResult( crypto, threadData, threadCounts[j], 0 );
+            }
+        }
+
+        printf( "\n" );
+    }
+
+    delete [] threadData;
+
+    return 0;
+}
+
+int main( int argc, char * argv[] )
+{
+    if ( !InitializeYojimbo() )
+    {
+        printf( "error: failed to initialize yojimbo\n" );
+        exit( 1 );
+    }
+
+    int result = CryptoBenchMain( argc, argv );
+
+    ShutdownYojimbo();
+
+    return result;
+}
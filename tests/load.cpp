@@ -0,0 +1,999 @@
+/*
+    Load Testbed
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define SERVER 1
+#define CLIENT 1
+#define MATCHER 1
+#define QUIET 1
+
+#include "shared.h"
+#include <signal.h>
+
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+#include <time.h>
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+
+// Spins up many clients against one or more servers, spread across threads, and reports throughput, message latency and cpu cost per-client.
+// Each thread runs a shard: a set of servers and the clients connecting to them, with its own allocator and network simulator, so shards never share state.
+
+static const int MaxLoadClients = ServerPort - ClientPort;
+
+static const int MaxLoadServers = 1000;
+
+static const int NumFailureStates = -CLIENT_STATE_RESUME_REQUEST_TIMEOUT + 1;    // client states in [CLIENT_STATE_RESUME_REQUEST_TIMEOUT,CLIENT_STATE_DISCONNECTED]
+
+static const int LatencyWindow = 1024;                  // must be at least ChannelConfig::sendQueueSize, and divide evenly into 65536
+
+static volatile int quit = 0;
+
+void interrupt_handler( int /*dummy*/ )
+{
+    quit = 1;
+}
+
+static LatencyHistogram s_messageLatency;                // microseconds. recording is lock-free, so it is shared between shards
+
+static double thread_cpu_time()
+{
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if ( !GetThreadTimes( GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime ) )
+        return 0.0;
+    const uint64_t kernel = ( uint64_t( kernelTime.dwHighDateTime ) << 32 ) | kernelTime.dwLowDateTime;
+    const uint64_t user = ( uint64_t( userTime.dwHighDateTime ) << 32 ) | userTime.dwLowDateTime;
+    return ( kernel + user ) / 10000000.0;
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+    timespec ts;
+    if ( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) != 0 )
+        return 0.0;
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+}
+
+static inline uint32_t load_random( uint32_t & state )
+{
+    // xorshift32. rand is shared between threads, so each shard has its own generator
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+struct LoadConfig
+{
+    int numClients;
+    int numServers;
+    int numThreads;
+    float duration;                                     // seconds
+    float tickRate;                                     // ticks per-second
+    bool sockets;                                       // true for NetworkTransport over loopback, false for LocalTransport
+    int maxMessagesPerTick;                             // each client and each server client slot sends [0,maxMessagesPerTick] messages per-tick
+    int blockPercent;                                   // percent of messages that are block messages
+    int maxBlockSize;                                   // bytes
+    int memory;                                         // per-client memory on client and server (kilobytes)
+    float latency;                                      // milliseconds
+    float jitter;                                       // milliseconds
+    float packetLoss;                                   // percent
+    float duplicate;                                    // percent
+    float bandwidth;                                    // kilobits per-second, per-link. local transports only
+    float burst;                                        // percent chance per-packet of entering a loss burst. local transports only
+    float burstLength;                                  // average loss burst length (packets)
+
+    LoadConfig()
+    {
+        numClients = 256;
+        numServers = 4;
+        numThreads = 4;
+        duration = 30.0f;
+        tickRate = 60.0f;
+        sockets = false;
+        maxMessagesPerTick = 8;
+        blockPercent = 1;
+        maxBlockSize = 4 * 1024;
+        memory = 512;
+        latency = 0.0f;
+        jitter = 0.0f;
+        packetLoss = 0.0f;
+        duplicate = 0.0f;
+        bandwidth = 0.0f;
+        burst = 0.0f;
+        burstLength = 5.0f;
+    }
+};
+
+struct LoadClient
+{
+    GameClient * client;
+    Transport * transport;
+    Address address;
+    uint64_t clientId;
+    int serverIndex;                                    // index of the server in the shard
+
+    uint8_t connectTokenData[ConnectTokenBytes];
+    uint8_t connectTokenNonce[NonceBytes];
+    uint8_t clientToServerKey[KeyBytes];
+    uint8_t serverToClientKey[KeyBytes];
+    uint64_t connectTokenExpireTimestamp;
+    int numServerAddresses;
+    Address serverAddresses[MaxServersPerConnect];
+
+    bool connected;
+    bool failed;
+
+    uint64_t numMessagesSent;                           // client to server
+    uint64_t numServerMessagesSent;                     // server to client
+
+    double sendTime[LatencyWindow];                     // send time of client to server messages, by message id
+    double serverSendTime[LatencyWindow];               // send time of server to client messages, by message id
+};
+
+struct LoadServer
+{
+    GameServer * server;
+    Transport * transport;
+    Address address;
+    int maxClients;
+    LoadClient ** clientSlot;                           // the client connected in each client slot, once it knows it is connected
+};
+
+struct LoadShard
+{
+    int shardIndex;
+    const LoadConfig * config;
+
+    DefaultAllocator allocator;                         // IMPORTANT: allocators are not thread safe, so everything in a shard is allocated from its own allocator
+
+    NetworkSimulator * networkSimulator;
+
+    int numServers;
+    LoadServer * servers;
+
+    int numClients;
+    LoadClient * clients;
+
+    uint32_t random;
+
+    volatile int done;
+    volatile int numConnected;
+    volatile uint64_t numMessagesReceived;
+
+    uint64_t numMessagesSent;
+    uint64_t numConnectFailures;
+    uint64_t numDisconnects;
+    uint64_t numFailureStates[NumFailureStates];        // the state each disconnected or failed client ended up in, indexed by -state
+    uint64_t numPacketsSent;
+    uint64_t numPacketsReceived;
+    uint64_t numTicks;
+    uint64_t numSlowTicks;
+    double clientTime;                                  // cpu time spent updating clients and their transports (seconds)
+    double serverTime;                                  // cpu time spent updating servers and their transports (seconds)
+    double sentBandwidth;                               // sum over connected clients at the end of the run (kbps)
+    double receivedBandwidth;
+    double rtt;                                         // sum over connected clients at the end of the run (milliseconds)
+    int numNetworkInfo;
+};
+
+Message * CreateRandomMessage( MessageFactory & messageFactory, uint64_t numMessagesSent, const LoadConfig & config, uint32_t & random )
+{
+    if ( int( load_random( random ) % 100 ) >= config.blockPercent )
+    {
+        TestMessage * message = (TestMessage*) messageFactory.Create( TEST_MESSAGE );
+        
+        if ( message )
+        {
+            message->sequence = (uint16_t) numMessagesSent;
+            
+            return message;
+        }
+    }
+    else
+    {
+        TestBlockMessage * blockMessage = (TestBlockMessage*) messageFactory.Create( TEST_BLOCK_MESSAGE );
+
+        if ( blockMessage )
+        {
+            blockMessage->sequence = (uint16_t) numMessagesSent;
+
+            const int blockSize = 1 + int( load_random( random ) % uint32_t( config.maxBlockSize ) );
+
+            uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), blockSize );
+
+            if ( blockData )
+            {
+                for ( int j = 0; j < blockSize; ++j )
+                    blockData[j] = uint8_t( numMessagesSent + j );
+
+                blockMessage->AttachBlock( messageFactory.GetAllocator(), blockData, blockSize );
+
+                return blockMessage;
+            }
+
+            messageFactory.Release( blockMessage );
+        }
+    }
+
+    return NULL;
+}
+
+static void RecordLatency( double sendTime, double receiveTime )
+{
+    const double latency = receiveTime - sendTime;
+
+    if ( latency >= 0.0 )
+        s_messageLatency.Record( uint64_t( latency * 1000000.0 ) );
+}
+
+static Transport * CreateTransport( LoadShard & shard, const Address & address, int queueSize, double time )
+{
+    const LoadConfig & config = *shard.config;
+
+    Transport * transport;
+
+    if ( config.sockets )
+    {
+        NetworkTransport * networkTransport = YOJIMBO_NEW( shard.allocator, NetworkTransport, shard.allocator, address, ProtocolId, time, DefaultMaxPacketSize, queueSize, queueSize );
+
+        if ( networkTransport->IsError() )
+        {
+            char addressString[MaxAddressLength];
+            address.ToString( addressString, sizeof( addressString ) );
+            printf( "error: failed to create socket on %s\n", addressString );
+            YOJIMBO_DELETE( shard.allocator, NetworkTransport, networkTransport );
+            return NULL;
+        }
+
+        transport = networkTransport;
+    }
+    else
+    {
+        transport = YOJIMBO_NEW( shard.allocator, LocalTransport, shard.allocator, *shard.networkSimulator, address, ProtocolId, time, DefaultMaxPacketSize, queueSize, queueSize );
+    }
+
+    if ( config.latency > 0.0f || config.jitter > 0.0f || config.packetLoss > 0.0f || config.duplicate > 0.0f )
+        transport->SetNetworkConditions( config.latency, config.jitter, config.packetLoss, config.duplicate );
+
+    return transport;
+}
+
+static void UpdateServers( LoadShard & shard, double time )
+{
+    const LoadConfig & config = *shard.config;
+
+    for ( int i = 0; i < shard.numServers; ++i )
+    {
+        LoadServer & server = shard.servers[i];
+
+        server.transport->ReadPackets();
+
+        server.server->ReceivePackets();
+
+        for ( int clientIndex = 0; clientIndex < server.maxClients; ++clientIndex )
+        {
+            if ( !server.server->IsClientConnected( clientIndex ) )
+                continue;
+
+            LoadClient * client = server.clientSlot[clientIndex];
+
+            while ( true )
+            {
+                Message * message = server.server->ReceiveMsg( clientIndex );
+
+                if ( !message )
+                    break;
+
+                if ( client )
+                    RecordLatency( client->sendTime[message->GetId() % LatencyWindow], platform_time() );
+
+                shard.numMessagesReceived++;
+
+                server.server->ReleaseMsg( clientIndex, message );
+            }
+
+            if ( !client )
+                continue;
+
+            const int messagesToSend = int( load_random( shard.random ) % uint32_t( config.maxMessagesPerTick + 1 ) );
+
+            for ( int j = 0; j < messagesToSend; ++j )
+            {
+                if ( !server.server->CanSendMsg( clientIndex ) )
+                    break;
+
+                Message * message = CreateRandomMessage( server.server->GetMsgFactory( clientIndex ), client->numServerMessagesSent, config, shard.random );
+
+                if ( !message )
+                    break;
+
+                client->serverSendTime[client->numServerMessagesSent % LatencyWindow] = platform_time();
+
+                server.server->SendMsg( clientIndex, message );
+
+                client->numServerMessagesSent++;
+
+                shard.numMessagesSent++;
+            }
+        }
+
+        server.server->CheckForTimeOut();
+
+        server.server->AdvanceTime( time );
+
+        server.transport->AdvanceTime( time );
+
+        server.server->SendPackets();
+
+        server.transport->WritePackets();
+    }
+}
+
+static void UpdateClients( LoadShard & shard, double time )
+{
+    const LoadConfig & config = *shard.config;
+
+    for ( int i = 0; i < shard.numClients; ++i )
+    {
+        LoadClient & client = shard.clients[i];
+
+        if ( client.failed )
+            continue;
+
+        client.transport->ReadPackets();
+
+        client.client->ReceivePackets();
+
+        LoadServer & server = shard.servers[client.serverIndex];
+
+        const bool connected = client.client->IsConnected();
+
+        if ( connected && !client.connected )
+        {
+            client.connected = true;
+            server.clientSlot[client.client->GetClientIndex()] = &client;
+            shard.numConnected++;
+        }
+        else if ( !connected && client.connected )
+        {
+            for ( int j = 0; j < server.maxClients; ++j )
+            {
+                if ( server.clientSlot[j] == &client )
+                    server.clientSlot[j] = NULL;
+            }
+            client.connected = false;
+            client.failed = true;
+            shard.numConnected--;
+            shard.numDisconnects++;
+            shard.numFailureStates[-client.client->GetClientState()]++;
+            continue;
+        }
+        else if ( client.client->ConnectionFailed() )
+        {
+            client.failed = true;
+            shard.numConnectFailures++;
+            shard.numFailureStates[-client.client->GetClientState()]++;
+            continue;
+        }
+
+        if ( connected )
+        {
+            while ( true )
+            {
+                Message * message = client.client->ReceiveMsg();
+
+                if ( !message )
+                    break;
+
+                RecordLatency( client.serverSendTime[message->GetId() % LatencyWindow], platform_time() );
+
+                shard.numMessagesReceived++;
+
+                client.client->ReleaseMsg( message );
+            }
+
+            const int messagesToSend = int( load_random( shard.random ) % uint32_t( config.maxMessagesPerTick + 1 ) );
+
+            for ( int j = 0; j < messagesToSend; ++j )
+            {
+                if ( !client.client->CanSendMsg() )
+                    break;
+
+                Message * message = CreateRandomMessage( client.client->GetMsgFactory(), client.numMessagesSent, config, shard.random );
+
+                if ( !message )
+                    break;
+
+                client.sendTime[client.numMessagesSent % LatencyWindow] = platform_time();
+
+                client.client->SendMsg( message );
+
+                client.numMessagesSent++;
+
+                shard.numMessagesSent++;
+            }
+        }
+
+        client.client->CheckForTimeOut();
+
+        client.client->AdvanceTime( time );
+
+        client.transport->AdvanceTime( time );
+
+        client.client->SendPackets();
+
+        client.transport->WritePackets();
+    }
+}
+
+static void LoadShardThread( void * data )
+{
+    LoadShard & shard = *( (LoadShard*) data );
+
+    const LoadConfig & config = *shard.config;
+
+    Allocator & allocator = shard.allocator;
+
+    double time = platform_time();
+
+    if ( !config.sockets )
+    {
+        shard.networkSimulator = YOJIMBO_NEW( allocator, NetworkSimulator, allocator, yojimbo::max( 4096, ( shard.numClients + shard.numServers ) * 256 ), shard.numClients + shard.numServers );
+        shard.networkSimulator->SetBandwidth( config.bandwidth );
+        shard.networkSimulator->SetBurstLoss( config.burst, 100.0f / config.burstLength );
+    }
+
+    ClientServerConfig clientServerConfig;
+    clientServerConfig.clientMemory = config.memory * 1024;
+    clientServerConfig.serverPerClientMemory = config.memory * 1024;
+    clientServerConfig.serverReserveClientMemory = true;
+    clientServerConfig.connectionConfig.channel[0].maxBlockSize = yojimbo::max( config.maxBlockSize, clientServerConfig.connectionConfig.channel[0].fragmentSize );
+
+    bool ok = true;
+
+    for ( int i = 0; i < shard.numServers && ok; ++i )
+    {
+        LoadServer & server = shard.servers[i];
+
+        server.transport = CreateTransport( shard, server.address, yojimbo::max( DefaultPacketSendQueueSize, server.maxClients * 8 ), time );
+
+        if ( !server.transport )
+        {
+            ok = false;
+            break;
+        }
+
+        server.server = YOJIMBO_NEW( allocator, GameServer, allocator, *server.transport, clientServerConfig, time );
+
+        server.server->SetServerAddress( server.address );
+
+        server.server->Start( server.maxClients );
+    }
+
+    for ( int i = 0; i < shard.numClients && ok; ++i )
+    {
+        LoadClient & client = shard.clients[i];
+
+        client.transport = CreateTransport( shard, client.address, DefaultPacketSendQueueSize, time );
+
+        if ( !client.transport )
+        {
+            ok = false;
+            break;
+        }
+
+        client.client = YOJIMBO_NEW( allocator, GameClient, allocator, *client.transport, clientServerConfig, time );
+
+        client.client->Connect( client.clientId,
+                                client.serverAddresses,
+                                client.numServerAddresses,
+                                client.connectTokenData,
+                                client.connectTokenNonce,
+                                client.clientToServerKey,
+                                client.serverToClientKey,
+                                client.connectTokenExpireTimestamp );
+    }
+
+    if ( !ok )
+        quit = 1;
+
+    const double startTime = platform_time();
+
+    // tick on integer nanosecond deadlines so the tick rate doesn't drift as time gets large
+
+    const uint64_t tickDeltaTime = uint64_t( 1000000000.0 / config.tickRate );
+
+    uint64_t tickTime = platform_time_ns();
+
+    while ( !quit )
+    {
+        time = platform_time();
+
+        if ( time - startTime >= config.duration )
+            break;
+
+        const double cpuStart = thread_cpu_time();
+
+        UpdateServers( shard, time );
+
+        const double cpuServers = thread_cpu_time();
+
+        UpdateClients( shard, time );
+
+        const double cpuClients = thread_cpu_time();
+
+        shard.serverTime += cpuServers - cpuStart;
+        shard.clientTime += cpuClients - cpuServers;
+        shard.numTicks++;
+
+        tickTime += tickDeltaTime;
+
+        const uint64_t currentTime = platform_time_ns();
+
+        if ( currentTime < tickTime )
+        {
+            platform_sleep_until( tickTime );
+        }
+        else
+        {
+            shard.numSlowTicks++;
+
+            // don't try to catch up if we fall more than a tick behind. just report it
+
+            if ( currentTime - tickTime > tickDeltaTime )
+                tickTime = currentTime;
+        }
+    }
+
+    for ( int i = 0; i < shard.numClients; ++i )
+    {
+        LoadClient & client = shard.clients[i];
+
+        if ( client.client && client.client->IsConnected() )
+        {
+            NetworkInfo info;
+            client.client->GetNetworkInfo( info );
+            shard.sentBandwidth += info.sentBandwidth;
+            shard.receivedBandwidth += info.receivedBandwidth;
+            shard.rtt += info.RTT;
+            shard.numNetworkInfo++;
+        }
+
+        if ( client.client )
+        {
+            client.client->Disconnect();
+            YOJIMBO_DELETE( allocator, GameClient, client.client );
+        }
+
+        if ( client.transport )
+        {
+            shard.numPacketsSent += client.transport->GetCounter( TRANSPORT_COUNTER_PACKETS_WRITTEN );
+            shard.numPacketsReceived += client.transport->GetCounter( TRANSPORT_COUNTER_PACKETS_READ );
+            YOJIMBO_DELETE( allocator, Transport, client.transport );
+        }
+    }
+
+    for ( int i = 0; i < shard.numServers; ++i )
+    {
+        LoadServer & server = shard.servers[i];
+
+        if ( server.server )
+        {
+            server.server->Stop();
+            YOJIMBO_DELETE( allocator, GameServer, server.server );
+        }
+
+        if ( server.transport )
+        {
+            shard.numPacketsSent += server.transport->GetCounter( TRANSPORT_COUNTER_PACKETS_WRITTEN );
+            shard.numPacketsReceived += server.transport->GetCounter( TRANSPORT_COUNTER_PACKETS_READ );
+            YOJIMBO_DELETE( allocator, Transport, server.transport );
+        }
+    }
+
+    YOJIMBO_DELETE( allocator, NetworkSimulator, shard.networkSimulator );
+
+    shard.done = 1;
+}
+
+static void PrintUsage()
+{
+    printf( "usage: load [options]\n\n" );
+    printf( "    -clients N          number of clients (default 256)\n" );
+    printf( "    -servers N          number of servers. clients are spread evenly across them (default 4)\n" );
+    printf( "    -threads N          number of threads. servers and their clients are spread across them (default 4)\n" );
+    printf( "    -duration S         how long to run for (seconds, default 30)\n" );
+    printf( "    -tickrate N         client and server updates per-second (default 60)\n" );
+    printf( "    -sockets            send packets over loopback sockets instead of local transports\n" );
+    printf( "    -messages N         maximum messages sent per-tick by each client and each server client slot (default 8)\n" );
+    printf( "    -blocks P           percent of messages that are block messages (default 1)\n" );
+    printf( "    -blocksize BYTES    maximum block size (default 4096)\n" );
+    printf( "    -memory KB          per-client memory on the client and the server (default 512)\n" );
+    printf( "    -latency MS         simulated latency (default 0)\n" );
+    printf( "    -jitter MS          simulated jitter (default 0)\n" );
+    printf( "    -loss P             simulated packet loss percent (default 0)\n" );
+    printf( "    -duplicate P        simulated duplicate packet percent (default 0)\n" );
+    printf( "    -bandwidth KBPS     simulated bandwidth of each client and server link. local transports only (default unlimited)\n" );
+    printf( "    -burst P            percent chance per-packet of a link starting a loss burst. local transports only (default 0)\n" );
+    printf( "    -burstlength N      average number of packets lost in a burst (default 5)\n" );
+    printf( "\n" );
+}
+
+static bool ParseCommandLine( int argc, char ** argv, LoadConfig & config )
+{
+    for ( int i = 1; i < argc; ++i )
+    {
+        const char * option = argv[i];
+
+        if ( strcmp( option, "-sockets" ) == 0 )
+        {
+            config.sockets = true;
+            continue;
+        }
+
+        if ( i + 1 >= argc )
+        {
+            printf( "error: missing value for option '%s'\n\n", option );
+            return false;
+        }
+
+        const char * value = argv[++i];
+
+        if ( strcmp( option, "-clients" ) == 0 )
+            config.numClients = atoi( value );
+        else if ( strcmp( option, "-servers" ) == 0 )
+            config.numServers = atoi( value );
+        else if ( strcmp( option, "-threads" ) == 0 )
+            config.numThreads = atoi( value );
+        else if ( strcmp( option, "-duration" ) == 0 )
+            config.duration = (float) atof( value );
+        else if ( strcmp( option, "-tickrate" ) == 0 )
+            config.tickRate = (float) atof( value );
+        else if ( strcmp( option, "-messages" ) == 0 )
+            config.maxMessagesPerTick = atoi( value );
+        else if ( strcmp( option, "-blocks" ) == 0 )
+            config.blockPercent = atoi( value );
+        else if ( strcmp( option, "-blocksize" ) == 0 )
+            config.maxBlockSize = atoi( value );
+        else if ( strcmp( option, "-memory" ) == 0 )
+            config.memory = atoi( value );
+        else if ( strcmp( option, "-latency" ) == 0 )
+            config.latency = (float) atof( value );
+        else if ( strcmp( option, "-jitter" ) == 0 )
+            config.jitter = (float) atof( value );
+        else if ( strcmp( option, "-loss" ) == 0 )
+            config.packetLoss = (float) atof( value );
+        else if ( strcmp( option, "-duplicate" ) == 0 )
+            config.duplicate = (float) atof( value );
+        else if ( strcmp( option, "-bandwidth" ) == 0 )
+            config.bandwidth = (float) atof( value );
+        else if ( strcmp( option, "-burst" ) == 0 )
+            config.burst = (float) atof( value );
+        else if ( strcmp( option, "-burstlength" ) == 0 )
+            config.burstLength = (float) atof( value );
+        else
+        {
+            printf( "error: unknown option '%s'\n\n", option );
+            return false;
+        }
+    }
+
+    if ( config.numClients < 1 || config.numClients > MaxLoadClients )
+    {
+        printf( "error: number of clients must be in [1,%d]\n\n", MaxLoadClients );
+        return false;
+    }
+
+    if ( config.numServers < 1 || config.numServers > yojimbo::min( config.numClients, MaxLoadServers ) )
+    {
+        printf( "error: number of servers must be in [1,%d]\n\n", yojimbo::min( config.numClients, MaxLoadServers ) );
+        return false;
+    }
+
+    if ( ( config.numClients + config.numServers - 1 ) / config.numServers > MaxClients )
+    {
+        printf( "error: too many clients per-server. each server supports at most %d clients\n\n", MaxClients );
+        return false;
+    }
+
+    if ( config.numThreads < 1 || config.duration <= 0.0f || config.tickRate <= 0.0f || config.maxMessagesPerTick < 0 || config.blockPercent < 0 || config.maxBlockSize < 1 || config.memory < 64 || config.bandwidth < 0.0f || config.burst < 0.0f || config.burstLength < 1.0f )
+    {
+        printf( "error: bad option value\n\n" );
+        return false;
+    }
+
+    if ( config.sockets && ( config.bandwidth > 0.0f || config.burst > 0.0f ) )
+    {
+        printf( "error: bandwidth and burst loss can only be simulated with local transports\n\n" );
+        return false;
+    }
+
+    // IMPORTANT: a shard owns its servers, so there can't be more threads than servers
+
+    config.numThreads = yojimbo::min( config.numThreads, config.numServers );
+
+    return true;
+}
+
+static void PrintReport( const LoadConfig & config, const LoadShard * shards, double elapsedTime )
+{
+    uint64_t numMessagesSent = 0;
+    uint64_t numMessagesReceived = 0;
+    uint64_t numConnectFailures = 0;
+    uint64_t numDisconnects = 0;
+    uint64_t numPacketsSent = 0;
+    uint64_t numPacketsReceived = 0;
+    uint64_t numTicks = 0;
+    uint64_t numSlowTicks = 0;
+    double clientTime = 0.0;
+    double serverTime = 0.0;
+    double sentBandwidth = 0.0;
+    double receivedBandwidth = 0.0;
+    double rtt = 0.0;
+    int numConnected = 0;
+    int numNetworkInfo = 0;
+    uint64_t numFailureStates[NumFailureStates];
+
+    memset( numFailureStates, 0, sizeof( numFailureStates ) );
+
+    for ( int i = 0; i < config.numThreads; ++i )
+    {
+        const LoadShard & shard = shards[i];
+        numMessagesSent += shard.numMessagesSent;
+        numMessagesReceived += shard.numMessagesReceived;
+        numConnectFailures += shard.numConnectFailures;
+        numDisconnects += shard.numDisconnects;
+        numPacketsSent += shard.numPacketsSent;
+        numPacketsReceived += shard.numPacketsReceived;
+        numTicks += shard.numTicks;
+        numSlowTicks += shard.numSlowTicks;
+        clientTime += shard.clientTime;
+        serverTime += shard.serverTime;
+        sentBandwidth += shard.sentBandwidth;
+        receivedBandwidth += shard.receivedBandwidth;
+        rtt += shard.rtt;
+        numConnected += shard.numConnected;
+        numNetworkInfo += shard.numNetworkInfo;
+        for ( int j = 0; j < NumFailureStates; ++j )
+            numFailureStates[j] += shard.numFailureStates[j];
+    }
+
+    if ( elapsedTime <= 0.0 )
+        elapsedTime = 1.0;
+
+    printf( "\nload test results:\n\n" );
+    printf( "    transport:              %s\n", config.sockets ? "sockets" : "local" );
+    printf( "    clients:                %d (%d connected, %" PRIu64 " failed to connect, %" PRIu64 " disconnected)\n", config.numClients, numConnected, numConnectFailures, numDisconnects );
+
+    for ( int i = 0; i < NumFailureStates; ++i )
+    {
+        if ( numFailureStates[i] > 0 )
+            printf( "                            %" PRIu64 " %s\n", numFailureStates[i], GetClientStateName( (ClientState) -i ) );
+    }
+
+    printf( "    servers:                %d on %d threads\n", config.numServers, config.numThreads );
+    printf( "    time:                   %.1f seconds\n", elapsedTime );
+    printf( "    messages sent:          %" PRIu64 " (%.0f per-second)\n", numMessagesSent, numMessagesSent / elapsedTime );
+    printf( "    messages received:      %" PRIu64 " (%.0f per-second)\n", numMessagesReceived, numMessagesReceived / elapsedTime );
+    printf( "    packets sent:           %" PRIu64 " (%.0f per-second)\n", numPacketsSent, numPacketsSent / elapsedTime );
+    printf( "    packets received:       %" PRIu64 " (%.0f per-second)\n", numPacketsReceived, numPacketsReceived / elapsedTime );
+
+    if ( numNetworkInfo > 0 )
+    {
+        printf( "    bandwidth per-client:   %.1f kbps sent, %.1f kbps received\n", sentBandwidth / numNetworkInfo, receivedBandwidth / numNetworkInfo );
+        printf( "    rtt:                    %.1f ms\n", rtt / numNetworkInfo );
+    }
+
+    if ( s_messageLatency.GetCount() > 0 )
+    {
+        printf( "    message latency:        %.2f ms p50, %.2f ms p99, %.2f ms p999\n", 
+            s_messageLatency.GetPercentile( 0.5 ) / 1000.0, 
+            s_messageLatency.GetPercentile( 0.99 ) / 1000.0, 
+            s_messageLatency.GetPercentile( 0.999 ) / 1000.0 );
+    }
+
+    printf( "    cpu per-client:         %.1f us/sec client side, %.1f us/sec server side\n", clientTime * 1000000.0 / config.numClients / elapsedTime, serverTime * 1000000.0 / config.numClients / elapsedTime );
+    printf( "    slow ticks:             %" PRIu64 " of %" PRIu64 "\n", numSlowTicks, numTicks );
+    printf( "\n" );
+}
+
+int LoadMain( const LoadConfig & config )
+{
+    printf( "%d clients, %d servers, %d threads, %s transport\n\n", config.numClients, config.numServers, config.numThreads, config.sockets ? "sockets" : "local" );
+
+    LoadShard * shards = new LoadShard[config.numThreads];
+
+    for ( int i = 0; i < config.numThreads; ++i )
+    {
+        LoadShard & shard = shards[i];
+        shard.shardIndex = i;
+        shard.config = &config;
+        shard.networkSimulator = NULL;
+        shard.numServers = 0;
+        shard.numClients = 0;
+        shard.random = 0x9E3779B9u * uint32_t( i + 1 );
+        shard.done = 0;
+        shard.numConnected = 0;
+        shard.numMessagesReceived = 0;
+        shard.numMessagesSent = 0;
+        shard.numConnectFailures = 0;
+        shard.numDisconnects = 0;
+        memset( shard.numFailureStates, 0, sizeof( shard.numFailureStates ) );
+        shard.numPacketsSent = 0;
+        shard.numPacketsReceived = 0;
+        shard.numTicks = 0;
+        shard.numSlowTicks = 0;
+        shard.clientTime = 0.0;
+        shard.serverTime = 0.0;
+        shard.sentBandwidth = 0.0;
+        shard.receivedBandwidth = 0.0;
+        shard.rtt = 0.0;
+        shard.numNetworkInfo = 0;
+    }
+
+    // server i runs on shard i % numThreads. client i connects to server i % numServers, so it runs on the same shard as its server
+
+    for ( int i = 0; i < config.numServers; ++i )
+        shards[i % config.numThreads].numServers++;
+
+    for ( int i = 0; i < config.numClients; ++i )
+        shards[( i % config.numServers ) % config.numThreads].numClients++;
+
+    for ( int i = 0; i < config.numThreads; ++i )
+    {
+        LoadShard & shard = shards[i];
+        shard.servers = new LoadServer[shard.numServers]();
+        shard.clients = new LoadClient[shard.numClients]();
+        shard.numServers = 0;
+        shard.numClients = 0;
+    }
+
+    for ( int i = 0; i < config.numServers; ++i )
+    {
+        LoadShard & shard = shards[i % config.numThreads];
+        LoadServer & server = shard.servers[shard.numServers++];
+        server.address = Address( "::1", ServerPort + i );
+        server.maxClients = ( config.numClients - i + config.numServers - 1 ) / config.numServers;
+        server.clientSlot = new LoadClient*[server.maxClients];
+        memset( server.clientSlot, 0, sizeof( LoadClient* ) * server.maxClients );
+    }
+
+    LocalMatcher matcher;
+
+    for ( int i = 0; i < config.numClients; ++i )
+    {
+        const int serverIndex = i % config.numServers;
+
+        LoadShard & shard = shards[serverIndex % config.numThreads];
+        LoadClient & client = shard.clients[shard.numClients++];
+
+        client.address = Address( "::1", ClientPort + i );
+        client.clientId = 1 + i;
+        client.serverIndex = serverIndex / config.numThreads;
+
+        if ( !matcher.RequestMatch( client.clientId, 
+                                    client.connectTokenData, 
+                                    client.connectTokenNonce, 
+                                    client.clientToServerKey, 
+                                    client.serverToClientKey,
+                                    client.connectTokenExpireTimestamp, 
+                                    client.numServerAddresses, 
+                                    client.serverAddresses,
+                                    0,
+                                    ServerPort + serverIndex ) )
+        {
+            printf( "error: client %d request match failed\n", i );
+            quit = 1;
+            break;
+        }
+    }
+
+    PlatformThread ** threads = new PlatformThread*[config.numThreads];
+
+    const double startTime = platform_time();
+
+    for ( int i = 0; i < config.numThreads; ++i )
+    {
+        threads[i] = quit ? NULL : platform_thread_create( GetDefaultAllocator(), LoadShardThread, &shards[i] );
+
+        if ( !threads[i] )
+            quit = 1;
+    }
+
+    while ( true )
+    {
+        int numDone = 0;
+        int numConnected = 0;
+        uint64_t numMessagesReceived = 0;
+
+        for ( int i = 0; i < config.numThreads; ++i )
+        {
+            numDone += ( shards[i].done || !threads[i] ) ? 1 : 0;
+            numConnected += shards[i].numConnected;
+            numMessagesReceived += shards[i].numMessagesReceived;
+        }
+
+        if ( numDone == config.numThreads )
+            break;
+
+        printf( "%6.1f: %d/%d clients connected, %" PRIu64 " messages received\n", platform_time() - startTime, numConnected, config.numClients, numMessagesReceived );
+
+        platform_sleep( 1.0 );
+    }
+
+    const double elapsedTime = yojimbo::min( platform_time() - startTime, (double) config.duration );
+
+    for ( int i = 0; i < config.numThreads; ++i )
+    {
+        if ( threads[i] )
+            platform_thread_join( GetDefaultAllocator(), threads[i] );
+    }
+
+    if ( quit )
+        printf( "\nstopped\n" );
+
+    PrintReport( config, shards, elapsedTime );
+
+    for ( int i = 0; i < config.numThreads; ++i )
+    {
+        for ( int j = 0; j < shards[i].numServers; ++j )
+            delete [] shards[i].servers[j].clientSlot;
+        delete [] shards[i].servers;
+        delete [] shards[i].clients;
+    }
+
+    delete [] threads;
+
+    delete [] shards;
+
+    return 0;
+}
+
+int main( int argc, char ** argv )
+{
+    printf( "\nload test\n\n" );
+
+    LoadConfig config;
+
+    if ( !ParseCommandLine( argc, argv, config ) )
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    if ( !InitializeYojimbo() )
+    {
+        printf( "error: failed to initialize Yojimbo!\n" );
+        return 1;
+    }
+
+    signal( SIGINT, interrupt_handler ); 
+
+    int result = LoadMain( config );
+
+    ShutdownYojimbo();
+
+    return result;
+}
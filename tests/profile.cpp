@@ -49,8 +49,8 @@ struct ServerData
 
     Address address;
 
-    uint64_t numMessagesSent[MaxClients];
-    uint64_t numMessagesReceived[MaxClients];
+    uint64_t numMessagesSent[DefaultMaxClients];
+    uint64_t numMessagesReceived[DefaultMaxClients];
 
     ServerData()
     {
@@ -167,11 +167,11 @@ int ProfileMain()
     ServerData * serverData = new ServerData();
     serverData->address = Address( "::1", ServerPort );
 
-	ClientData * clientData = new ClientData[MaxClients];
+	ClientData * clientData = new ClientData[DefaultMaxClients];
 
     LocalMatcher matcher;
 
-    for ( int i = 0; i < MaxClients; ++i )
+    for ( int i = 0; i < DefaultMaxClients; ++i )
     {
         clientData[i].address = Address( "::1", ClientPort + i );
 
@@ -197,21 +197,21 @@ int ProfileMain()
 
     serverData->transport = new NetworkTransport( GetDefaultAllocator(), serverData->address, ProtocolId, time );
 
-    for ( int i = 0; i < MaxClients; ++i )
+    for ( int i = 0; i < DefaultMaxClients; ++i )
     {
         clientData[i].transport = new NetworkTransport( GetDefaultAllocator(), clientData[i].address, ProtocolId, time );
     }
 
     serverData->server = new GameServer( GetDefaultAllocator(), *serverData->transport, ClientServerConfig(), time );
 
-    for ( int i = 0; i < MaxClients; ++i )
+    for ( int i = 0; i < DefaultMaxClients; ++i )
         clientData[i].client = new GameClient( GetDefaultAllocator(), *clientData[i].transport, ClientServerConfig(), time );
 
     serverData->server->SetServerAddress( serverData->address );
 
     serverData->server->Start();
 
-    for ( int i = 0; i < MaxClients; ++i )
+    for ( int i = 0; i < DefaultMaxClients; ++i )
     {
         clientData[i].client->Connect( clientData[i].clientId,
                                        clientData[i].serverAddresses,
@@ -229,25 +229,25 @@ int ProfileMain()
     {
         serverData->server->SendPackets();
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
             clientData[i].client->SendPackets();
 
         serverData->transport->WritePackets();
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
             clientData[i].transport->WritePackets();
 
         serverData->transport->ReadPackets();
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
             clientData[i].transport->ReadPackets();
 
         serverData->server->ReceivePackets();
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
             clientData[i].client->ReceivePackets();
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
         {
             if ( clientData[i].client->ConnectionFailed() )
             {
@@ -259,7 +259,7 @@ int ProfileMain()
 
         time += 0.1;
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
         {
             const int messagesToSend = random_int( 0, 64 );
 
@@ -279,7 +279,7 @@ int ProfileMain()
             }
         }            
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
         {
             const int messagesToSend = random_int( 0, 64 );
 
@@ -299,7 +299,7 @@ int ProfileMain()
             } 
         }            
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
         {
             while ( true )
             {
@@ -316,7 +316,7 @@ int ProfileMain()
             }
         }
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
         {
             while ( true )
             {
@@ -335,20 +335,36 @@ int ProfileMain()
 
         serverData->server->CheckForTimeOut();
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
             clientData[i].client->CheckForTimeOut();
 
         serverData->server->AdvanceTime( time );
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
             clientData[i].client->AdvanceTime( time );
 
         serverData->transport->AdvanceTime( time );
 
-        for ( int i = 0; i < MaxClients; ++i )
+        for ( int i = 0; i < DefaultMaxClients; ++i )
             clientData[i].transport->AdvanceTime( time );
 
-        platform_sleep( 0.1 );
+        // wait until the next tick, processing packets as they arrive on the server instead of sleeping through them
+
+        const double tickTime = platform_time() + 0.1;
+
+        while ( !quit )
+        {
+            const double timeRemaining = tickTime - platform_time();
+            if ( timeRemaining <= 0.0 )
+                break;
+
+            if ( serverData->transport->WaitForPacket( timeRemaining ) )
+            {
+                serverData->transport->ReadPackets();
+
+                serverData->server->ReceivePackets();
+            }
+        }
     }
 
     if ( quit )
@@ -59,12 +59,27 @@ int ServerMain()
 
     server.Start();
 
+    // report load to the matcher every few seconds, so it can send clients to this server
+
+    Matcher matcher( GetDefaultAllocator() );
+
+    const bool matcherInitialized = matcher.Initialize();
+
+    if ( !matcherInitialized )
+        printf( "warning: failed to initialize matcher. server load will not be reported\n" );
+
+    const double loadReportInterval = 2.0;
+
+    double nextLoadReportTime = platform_time();
+
     const double deltaTime = 0.1;
 
     signal( SIGINT, interrupt_handler );    
 
     while ( !quit )
     {
+        const double tickStartTime = platform_time();
+
         server.SendPackets();
 
         serverTransport.WritePackets();
@@ -81,7 +96,31 @@ int ServerMain()
 
         serverTransport.AdvanceTime( time );
 
-        platform_sleep( deltaTime );
+        if ( matcherInitialized && platform_time() >= nextLoadReportTime && matcher.GetMatchStatus() != MATCH_BUSY )
+        {
+            ServerLoadReport loadReport;
+            server.GetLoadReport( loadReport, float( 1.0 - ( platform_time() - tickStartTime ) / deltaTime ) );
+            matcher.ReportServerLoad( ProtocolId, loadReport );
+            nextLoadReportTime += loadReportInterval;
+        }
+
+        // wait until the next tick, processing packets as they arrive instead of sleeping through them
+
+        const double tickTime = platform_time() + deltaTime;
+
+        while ( !quit )
+        {
+            const double timeRemaining = tickTime - platform_time();
+            if ( timeRemaining <= 0.0 )
+                break;
+
+            if ( serverTransport.WaitForPacket( timeRemaining ) )
+            {
+                serverTransport.ReadPackets();
+
+                server.ReceivePackets();
+            }
+        }
     }
 
     printf( "\nserver stopped\n" );
@@ -87,7 +87,23 @@ int ServerMain()
 
         serverTransport.AdvanceTime( time );
 
-        platform_sleep( deltaTime );
+        // wait until the next tick, processing packets as they arrive instead of sleeping through them
+
+        const double tickTime = platform_time() + deltaTime;
+
+        while ( !quit )
+        {
+            const double timeRemaining = tickTime - platform_time();
+            if ( timeRemaining <= 0.0 )
+                break;
+
+            if ( serverTransport.WaitForPacket( timeRemaining ) )
+            {
+                serverTransport.ReadPackets();
+
+                server.ReceivePackets();
+            }
+        }
     }
 
     printf( "\nserver stopped\n" );
@@ -175,6 +175,8 @@ inline int GetNumBitsForMessage( uint16_t sequence )
 
 struct TestMessage : public Message
 {
+    enum { MaxSerializeBits = 16 + 512 };
+
     uint16_t sequence;
 
     TestMessage()
@@ -203,6 +205,8 @@ struct TestMessage : public Message
 
 struct TestBlockMessage : public BlockMessage
 {
+    enum { MaxSerializeBits = 16 };
+
     uint16_t sequence;
 
     TestBlockMessage()
@@ -267,12 +271,13 @@ enum TestMessageType
     NUM_TEST_MESSAGE_TYPES
 };
 
-YOJIMBO_MESSAGE_FACTORY_START( TestMessageFactory, MessageFactory, NUM_TEST_MESSAGE_TYPES );
-    YOJIMBO_DECLARE_MESSAGE_TYPE( TEST_MESSAGE, TestMessage );
-    YOJIMBO_DECLARE_MESSAGE_TYPE( TEST_BLOCK_MESSAGE, TestBlockMessage );
-    YOJIMBO_DECLARE_MESSAGE_TYPE( TEST_SERIALIZE_FAIL_ON_READ_MESSAGE, TestSerializeFailOnReadMessage );
-    YOJIMBO_DECLARE_MESSAGE_TYPE( TEST_EXHAUST_STREAM_ALLOCATOR_ON_READ_MESSAGE, TestExhaustStreamAllocatorOnReadMessage );
-YOJIMBO_MESSAGE_FACTORY_FINISH();
+#define TEST_MESSAGE_TYPES( declare )                                                                                   \
+    declare( TEST_MESSAGE, TestMessage )                                                                                \
+    declare( TEST_BLOCK_MESSAGE, TestBlockMessage )                                                                     \
+    declare( TEST_SERIALIZE_FAIL_ON_READ_MESSAGE, TestSerializeFailOnReadMessage )                                      \
+    declare( TEST_EXHAUST_STREAM_ALLOCATOR_ON_READ_MESSAGE, TestExhaustStreamAllocatorOnReadMessage )
+
+YOJIMBO_MESSAGE_FACTORY_TYPE_LIST( TestMessageFactory, MessageFactory, NUM_TEST_MESSAGE_TYPES, TEST_MESSAGE_TYPES );
 
 #if SERVER || MATCHER
 
@@ -320,7 +325,7 @@ public:
         memcpy( clientToServerKey, token.clientToServerKey, KeyBytes );
         memcpy( serverToClientKey, token.serverToClientKey, KeyBytes );
 
-        if ( !EncryptConnectToken( token, tokenData, (const uint8_t*) &m_nonce, private_key ) )
+        if ( !EncryptCompactConnectToken( token, tokenData, (const uint8_t*) &m_nonce, private_key ) )
             return false;
 
         assert( NonceBytes == 8 );
@@ -459,6 +464,14 @@ protected:
                 printf( "ignored connection request from %s. failed to encrypt challenge token\n", addressString );
                 break;
 
+            case SERVER_CONNECTION_REQUEST_IGNORED_ADDRESS_RATE_LIMITED:
+                printf( "ignored connection request from %s. address rate limited\n", addressString );
+                break;
+
+            case SERVER_CONNECTION_REQUEST_IGNORED_SUBNET_RATE_LIMITED:
+                printf( "ignored connection request from %s. subnet rate limited\n", addressString );
+                break;
+
             default:
                 break;
         }
@@ -487,6 +500,18 @@ protected:
                 printf( "ignored connection response from %s. client id %" PRIx64 " already connected\n", addressString, challengeToken.clientId );
                 break;
 
+            case SERVER_CHALLENGE_RESPONSE_IGNORED_CHALLENGE_TOKEN_EXPIRED:
+                printf( "ignored challenge response from %s. challenge token has expired\n", addressString );
+                break;
+
+            case SERVER_CHALLENGE_RESPONSE_IGNORED_CONNECT_TOKEN_ALREADY_USED:
+                printf( "ignored challenge response from %s. connect token already used\n", addressString );
+                break;
+
+            case SERVER_CHALLENGE_RESPONSE_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING:
+                printf( "ignored challenge response from %s. failed to add encryption mapping\n", addressString );
+                break;
+
             default:
                 break;
         }
@@ -544,6 +569,10 @@ protected:
         {
             case CLIENT_SERVER_PACKET_CONNECTION_REQUEST:         packetTypeString = "connection request";        break;
             case CLIENT_SERVER_PACKET_CHALLENGE_RESPONSE:         packetTypeString = "challenge response";        break;
+            case CLIENT_SERVER_PACKET_RESUME_REQUEST:             packetTypeString = "resume request";            break;
+            case CLIENT_SERVER_PACKET_PING:                       packetTypeString = "ping";                      break;
+            case CLIENT_SERVER_PACKET_PONG:                       packetTypeString = "pong";                      break;
+            case CLIENT_SERVER_PACKET_HANDOFF:                    packetTypeString = "handoff";                   break;
             case CLIENT_SERVER_PACKET_KEEPALIVE:                  packetTypeString = "keep alive";                break;  
             case CLIENT_SERVER_PACKET_DISCONNECT:                 packetTypeString = "disconnect";                break;
 
@@ -659,6 +688,10 @@ protected:
         {
             case CLIENT_SERVER_PACKET_CONNECTION_REQUEST:         packetTypeString = "connection request";        break;
             case CLIENT_SERVER_PACKET_CHALLENGE_RESPONSE:         packetTypeString = "challenge response";        break;
+            case CLIENT_SERVER_PACKET_RESUME_REQUEST:             packetTypeString = "resume request";            break;
+            case CLIENT_SERVER_PACKET_PING:                       packetTypeString = "ping";                      break;
+            case CLIENT_SERVER_PACKET_PONG:                       packetTypeString = "pong";                      break;
+            case CLIENT_SERVER_PACKET_HANDOFF:                    packetTypeString = "handoff";                   break;
             case CLIENT_SERVER_PACKET_KEEPALIVE:                  packetTypeString = "keep alive";                break;  
             case CLIENT_SERVER_PACKET_DISCONNECT:                 packetTypeString = "disconnect";                break;
 
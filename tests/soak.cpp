@@ -32,6 +32,12 @@
 
 static const int MaxBlockSize = 25 * 1024;
 
+static const double VirtualUpdateTime = 0.01;               // the shortest step in virtual time. events due now are handled at this update rate
+
+static const double VirtualMessageTime = 1.0;               // in virtual time the client sends a burst of messages this often, so the connection goes idle in between
+
+static const int DriftHeapStride = 16;                      // heap stats are read every this many updates for drift reporting, since reading them walks the whole heap
+
 static volatile int quit = 0;
 
 void interrupt_handler( int /*dummy*/ )
@@ -39,7 +45,190 @@ void interrupt_handler( int /*dummy*/ )
     quit = 1;
 }
 
-int SoakMain()
+struct DriftConfig
+{
+    double threshold;                                       // how far a metric may grow past its baseline before the soak fails, as a fraction of the baseline. zero turns drift reporting off
+    double sampleTime;                                      // soak time per sample (seconds)
+    double baselineTime;                                    // soak time at the start that the baseline is averaged over (seconds). the first sample is left out, since the heap and queues are still filling up
+
+    DriftConfig()
+    {
+        threshold = 0.0;
+        sampleTime = 300.0;
+        baselineTime = 1800.0;
+    }
+};
+
+enum DriftMetric
+{
+    DRIFT_METRIC_TICK_TIME,                                 // mean wall clock time per update (microseconds)
+    DRIFT_METRIC_HEAP_USED,                                 // mean bytes allocated in the server client slot heap (kilobytes)
+    DRIFT_METRIC_HEAP_FRAGMENTATION,                        // mean percent of free bytes in the server client slot heap outside the largest free block
+    DRIFT_METRIC_QUEUED_MESSAGES,                           // mean number of messages in the client send queue, including sent messages waiting for acks
+    DRIFT_METRIC_BYTES_PER_MESSAGE,                         // bytes the client channel wrote per message sent, not counting block fragments. includes resends
+    DRIFT_METRIC_PACKETS_PER_MESSAGE,                       // connection packets the client generated per message sent
+    NUM_DRIFT_METRICS
+};
+
+static const char * DriftMetricNames[] = { "tick time", "heap used", "heap fragmentation", "queued messages", "bytes per message", "packets per message" };
+
+static const char * DriftMetricUnits[] = { "us", "kb", "%", "", "", "" };
+
+static const double DriftMetricSlack[] = { 1.0, 16.0, 5.0, 1.0, 1.0, 0.1 };  // added to the limit for each metric, so noise on metrics with a baseline near zero doesn't fail the soak
+
+struct DriftSampler
+{
+    double nextSampleTime;
+    int numSamples;
+
+    double updateTime;                                      // accumulated over the current sample
+    uint64_t numUpdates;
+    double queuedMessages;
+    double heapUsed;
+    double heapFragmentation;
+    int numHeapStats;
+
+    uint64_t channelBits;                                   // client connection counters at the start of the current sample
+    uint64_t messagesSent;
+    uint64_t packetsGenerated;
+
+    double baseline[NUM_DRIFT_METRICS];
+    int numBaselineSamples;
+    double average[NUM_DRIFT_METRICS];                      // moving average of the samples after the baseline, over as many samples as the baseline
+    double maxDrift[NUM_DRIFT_METRICS];
+
+    DriftSampler()
+    {
+        memset( this, 0, sizeof( DriftSampler ) );
+    }
+};
+
+static void GetDriftCounters( const Client & client, uint64_t & channelBits, uint64_t & messagesSent, uint64_t & packetsGenerated )
+{
+    const Connection * connection = client.GetConnection();
+
+    if ( !connection )
+    {
+        channelBits = 0;
+        messagesSent = 0;
+        packetsGenerated = 0;
+        return;
+    }
+
+    channelBits = connection->GetChannelBitsWritten( 0 ) - connection->GetChannelFragmentBitsWritten( 0 );
+    messagesSent = connection->GetChannel( 0 )->GetCounter( CHANNEL_COUNTER_MESSAGES_SENT );
+    packetsGenerated = connection->GetCounter( CONNECTION_COUNTER_PACKETS_GENERATED );
+}
+
+static void UpdateDriftHeapStats( DriftSampler & sampler, GameServer & server, const Client & client )
+{
+    const int clientIndex = client.GetClientIndex();
+
+    if ( clientIndex < 0 || !server.IsClientConnected( clientIndex ) )
+        return;
+
+    AllocatorStats stats;
+    server.GetClientAllocator( clientIndex ).GetStats( stats );
+
+    sampler.heapUsed += stats.bytesAllocated / 1024.0;
+
+    if ( stats.freeBytes > 0 )
+        sampler.heapFragmentation += 100.0 * ( 1.0 - double( stats.largestFreeBlock ) / double( stats.freeBytes ) );
+
+    sampler.numHeapStats++;
+}
+
+static bool TakeDriftSample( DriftSampler & sampler, const DriftConfig & config, double time, const Client & client )
+{
+    uint64_t channelBits, messagesSent, packetsGenerated;
+    GetDriftCounters( client, channelBits, messagesSent, packetsGenerated );
+
+    const uint64_t sampleMessages = messagesSent - sampler.messagesSent;
+
+    double value[NUM_DRIFT_METRICS];
+    value[DRIFT_METRIC_TICK_TIME] = sampler.numUpdates ? sampler.updateTime / sampler.numUpdates * 1000000.0 : 0.0;
+    value[DRIFT_METRIC_HEAP_USED] = sampler.numHeapStats ? sampler.heapUsed / sampler.numHeapStats : 0.0;
+    value[DRIFT_METRIC_HEAP_FRAGMENTATION] = sampler.numHeapStats ? sampler.heapFragmentation / sampler.numHeapStats : 0.0;
+    value[DRIFT_METRIC_QUEUED_MESSAGES] = sampler.numUpdates ? sampler.queuedMessages / sampler.numUpdates : 0.0;
+    value[DRIFT_METRIC_BYTES_PER_MESSAGE] = sampleMessages ? ( channelBits - sampler.channelBits ) / 8.0 / sampleMessages : 0.0;
+    value[DRIFT_METRIC_PACKETS_PER_MESSAGE] = sampleMessages ? double( packetsGenerated - sampler.packetsGenerated ) / sampleMessages : 0.0;
+
+    sampler.numSamples++;
+
+    printf( "drift sample %d at %.0fs:", sampler.numSamples, time );
+    for ( int i = 0; i < NUM_DRIFT_METRICS; ++i )
+        printf( " %s %.2f%s%s", DriftMetricNames[i], value[i], DriftMetricUnits[i], i < NUM_DRIFT_METRICS - 1 ? "," : "\n" );
+
+    // start the next sample
+
+    sampler.updateTime = 0.0;
+    sampler.numUpdates = 0;
+    sampler.queuedMessages = 0.0;
+    sampler.heapUsed = 0.0;
+    sampler.heapFragmentation = 0.0;
+    sampler.numHeapStats = 0;
+    sampler.channelBits = channelBits;
+    sampler.messagesSent = messagesSent;
+    sampler.packetsGenerated = packetsGenerated;
+
+    // IMPORTANT: The first sample is left out of the baseline. It includes connecting, and the heap and queues start out empty, so it would make later samples look like they drifted.
+
+    if ( sampler.numSamples == 1 )
+        return true;
+
+    if ( time <= config.baselineTime || sampler.numBaselineSamples == 0 )
+    {
+        for ( int i = 0; i < NUM_DRIFT_METRICS; ++i )
+        {
+            sampler.baseline[i] = ( sampler.baseline[i] * sampler.numBaselineSamples + value[i] ) / ( sampler.numBaselineSamples + 1 );
+            sampler.average[i] = sampler.baseline[i];
+        }
+
+        sampler.numBaselineSamples++;
+
+        return true;
+    }
+
+    // IMPORTANT: Single samples are too noisy to check against the baseline, eg. the send queue backs up behind large blocks. Averaging over as many samples as the baseline smooths that out, while a slow degradation still pulls the average up.
+
+    bool result = true;
+
+    for ( int i = 0; i < NUM_DRIFT_METRICS; ++i )
+    {
+        sampler.average[i] += ( value[i] - sampler.average[i] ) / sampler.numBaselineSamples;
+
+        const double baseline = sampler.baseline[i];
+
+        if ( baseline > 0.0 )
+            sampler.maxDrift[i] = yojimbo::max( sampler.maxDrift[i], sampler.average[i] / baseline - 1.0 );
+
+        const double limit = baseline * ( 1.0 + config.threshold ) + DriftMetricSlack[i];
+
+        if ( sampler.average[i] > limit )
+        {
+            printf( "error: %s drifted to %.2f%s on average, baseline is %.2f%s and the limit is %.2f%s\n", DriftMetricNames[i], sampler.average[i], DriftMetricUnits[i], baseline, DriftMetricUnits[i], limit, DriftMetricUnits[i] );
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+static void PrintDriftReport( const DriftSampler & sampler, const DriftConfig & config )
+{
+    if ( sampler.numBaselineSamples == 0 )
+    {
+        printf( "\ndrift: no baseline. run for longer than the %.0fs baseline plus one %.0fs sample\n", config.baselineTime, config.sampleTime );
+        return;
+    }
+
+    printf( "\ndrift over %d samples, against a baseline of %d samples (threshold %.0f%%):\n", sampler.numSamples, sampler.numBaselineSamples, config.threshold * 100.0 );
+
+    for ( int i = 0; i < NUM_DRIFT_METRICS; ++i )
+        printf( "    %-20s baseline %.2f%s, max drift %+.1f%%\n", DriftMetricNames[i], sampler.baseline[i], DriftMetricUnits[i], sampler.maxDrift[i] * 100.0 );
+}
+
+int SoakMain( double virtualTime, const DriftConfig & driftConfig )
 {
     srand( (unsigned int) time( NULL ) );
 
@@ -85,6 +274,15 @@ int SoakMain()
     clientServerConfig.connectionConfig.channel[0].packetBudget = 256;
     clientServerConfig.connectionConfig.channel[0].maxMessagesPerPacket = 256;
 
+    // in virtual time, time jumps straight to the next event, so only send packets when there is something to send. otherwise the next event is always due now
+
+    if ( virtualTime > 0.0 )
+    {
+        clientServerConfig.clientSendIdle = false;
+        clientServerConfig.serverSendIdleClients = false;
+        clientServerConfig.connectionIdleKeepAliveSendRate = 1.0f;
+    }
+
     GameClient client( GetDefaultAllocator(), clientTransport, clientServerConfig, time );
 
     GameServer server( GetDefaultAllocator(), serverTransport, clientServerConfig, time );
@@ -98,10 +296,26 @@ int SoakMain()
     uint64_t numMessagesSentToServer = 0;
     uint64_t numMessagesReceivedFromClient = 0;
 
+    uint64_t numUpdates = 0;
+
+    double nextMessageTime = 0.0;
+
+    const bool drift = driftConfig.threshold > 0.0;
+
+    DriftSampler driftSampler;
+
+    driftSampler.nextSampleTime = driftConfig.sampleTime;
+
+    int result = 0;
+
+    const double startTime = platform_time();
+
     signal( SIGINT, interrupt_handler );
 
-    while ( !quit )
+    while ( !quit && ( virtualTime <= 0.0 || time < virtualTime ) )
     {
+        const double updateStartTime = drift ? platform_time() : 0.0;
+
         client.SendPackets();
         server.SendPackets();
 
@@ -120,10 +334,24 @@ int SoakMain()
             break;
         }
 
-        time += 0.1f;
+        if ( virtualTime > 0.0 )
+        {
+            const double nextEventTime = yojimbo::min( yojimbo::min( client.GetNextEventTime(), server.GetNextEventTime() ), yojimbo::min( networkSimulator.GetNextDeliveryTime(), nextMessageTime ) );
+
+            time = yojimbo::max( nextEventTime, time + VirtualUpdateTime );
+        }
+        else
+        {
+            time += 0.1f;
+        }
+
+        numUpdates++;
 
-        if ( client.IsConnected() )
+        if ( client.IsConnected() && time >= nextMessageTime )
         {
+            if ( virtualTime > 0.0 )
+                nextMessageTime = time + VirtualMessageTime;
+
             const int messagesToSend = random_int( 0, 64 );
 
             for ( int i = 0; i < messagesToSend; ++i )
@@ -192,7 +420,8 @@ int SoakMain()
 
                         assert( testMessage->sequence == uint16_t( numMessagesReceivedFromClient ) );
 
-                        printf( "received message %d\n", testMessage->sequence );
+                        if ( !drift )
+                            printf( "received message %d\n", testMessage->sequence );
 
                         server.ReleaseMsg( clientIndex, message );
 
@@ -229,7 +458,8 @@ int SoakMain()
                             }
                         }
 
-                        printf( "received block %d\n", uint16_t( numMessagesReceivedFromClient ) );
+                        if ( !drift )
+                            printf( "received block %d\n", uint16_t( numMessagesReceivedFromClient ) );
 
                         server.ReleaseMsg( clientIndex, message );
 
@@ -245,6 +475,31 @@ int SoakMain()
 
         clientTransport.AdvanceTime( time );
         serverTransport.AdvanceTime( time );
+
+        // sample metrics for drift reporting. the message checks above have their printfs turned off in this mode, so they don't count against the update time
+
+        if ( drift )
+        {
+            driftSampler.updateTime += platform_time() - updateStartTime;
+            driftSampler.numUpdates++;
+
+            if ( client.GetConnection() )
+                driftSampler.queuedMessages += client.GetConnection()->GetChannel( 0 )->GetNumQueuedMessages();
+
+            if ( ( numUpdates % DriftHeapStride ) == 0 )
+                UpdateDriftHeapStats( driftSampler, server, client );
+
+            if ( time >= driftSampler.nextSampleTime )
+            {
+                driftSampler.nextSampleTime += driftConfig.sampleTime;
+
+                if ( !TakeDriftSample( driftSampler, driftConfig, time, client ) )
+                {
+                    result = 1;
+                    break;
+                }
+            }
+        }
     }
 
     if ( quit )
@@ -252,15 +507,65 @@ int SoakMain()
         printf( "\nstopped\n" );
     }
 
+    if ( drift )
+    {
+        PrintDriftReport( driftSampler, driftConfig );
+    }
+
+    if ( virtualTime > 0.0 )
+    {
+        const double realTime = platform_time() - startTime;
+
+        printf( "\nsimulated %.1f seconds in %.1f seconds with %" PRIu64 " updates, vs. %" PRIu64 " updates stepping at %d updates per-second\n", time, realTime, numUpdates, uint64_t( time / VirtualUpdateTime ), int( 1.0 / VirtualUpdateTime ) );
+    }
+
     client.Disconnect();
     
     server.Stop();
 
-    return 0;
+    return result;
 }
 
-int main()
+int main( int argc, char * argv[] )
 {
+    // usage: soak [--virtual <seconds>] [--drift <percent>] [--sample <seconds>] [--baseline <seconds>]. by default time steps forward 0.1 seconds per-update until ctrl-c. with --virtual, time jumps to the next client, server or network simulator event instead, and the soak stops after that many seconds of virtual time
+    // with --drift, the soak samples update time, server client heap usage and fragmentation, send queue depth, and bytes and packets per message every --sample seconds of soak time (default 300). it fails as soon as the moving average of the samples grows more than that percent past the average of the first --baseline seconds (default 1800)
+
+    double virtualTime = 0.0;
+
+    DriftConfig driftConfig;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( strcmp( argv[i], "--virtual" ) == 0 && i + 1 < argc )
+        {
+            virtualTime = atof( argv[++i] );
+        }
+        else if ( strcmp( argv[i], "--drift" ) == 0 && i + 1 < argc )
+        {
+            driftConfig.threshold = atof( argv[++i] ) / 100.0;
+        }
+        else if ( strcmp( argv[i], "--sample" ) == 0 && i + 1 < argc )
+        {
+            driftConfig.sampleTime = atof( argv[++i] );
+        }
+        else if ( strcmp( argv[i], "--baseline" ) == 0 && i + 1 < argc )
+        {
+            driftConfig.baselineTime = atof( argv[++i] );
+        }
+        else
+        {
+            printf( "usage: soak [--virtual <seconds>] [--drift <percent>] [--sample <seconds>] [--baseline <seconds>]\n" );
+            return 1;
+        }
+    }
+
+    if ( driftConfig.sampleTime <= 0.0 )
+    {
+        printf( "error: sample time must be positive\n" );
+        return 1;
+    }
+
     printf( "\nsoak test\n\n" );
 
     verbose_logging = true;
@@ -272,7 +577,7 @@ int main()
 
     srand( (unsigned int) time( NULL ) );
 
-    int result = SoakMain();
+    int result = SoakMain( virtualTime, driftConfig );
 
     ShutdownYojimbo();
 
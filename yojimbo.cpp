@@ -32,10 +32,6 @@
 
 #include <sodium.h>
 
-#if YOJIMBO_DEBUG_MEMORY_LEAKS
-#include <map>
-#endif // YOJIMBO_DEBUG_MEMORY_LEAKS
-
 static yojimbo::Allocator * g_defaultAllocator = NULL;
 
 namespace yojimbo
@@ -57,6 +53,12 @@ bool InitializeYojimbo()
     assert( yojimbo::KeyBytes == crypto_secretbox_KEYBYTES );
     assert( yojimbo::MacBytes == crypto_secretbox_MACBYTES );
 
+    yojimbo::ResetProfile();
+
+#if YOJIMBO_ZONES == YOJIMBO_ZONES_PERFETTO
+    yojimbo_perfetto::TrackEvent::Register();
+#endif // #if YOJIMBO_ZONES == YOJIMBO_ZONES_PERFETTO
+
     if ( !yojimbo::InitializeNetwork() )
         return false;
 
@@ -30,12 +30,23 @@
 #include "yojimbo_packet.h"
 #include "yojimbo_message.h"
 #include "yojimbo_network.h"
+#include "yojimbo_address_map.h"
+#include "yojimbo_id_map.h"
+#include "yojimbo_string_dictionary.h"
+#include "yojimbo_timer_wheel.h"
+#include "yojimbo_metrics.h"
+#include "yojimbo_profile.h"
+#include "yojimbo_trace.h"
+#include "yojimbo_serialize_profiler.h"
 #include "yojimbo_sockets.h"
 #include "yojimbo_matcher.h"
 #include "yojimbo_platform.h"
 #include "yojimbo_network_simulator.h"
+#include "yojimbo_packet_capture.h"
 #include "yojimbo_allocator.h"
 #include "yojimbo_encryption.h"
+#include "yojimbo_compression.h"
+#include "yojimbo_fec.h"
 #include "yojimbo_packet_processor.h"
 #include "yojimbo_tokens.h"
 #include "yojimbo_client.h"
@@ -65,6 +65,7 @@
 #include <string.h>
 
 #include "yojimbo_address.h"
+#include "yojimbo_common.h"
 
 
 namespace yojimbo
@@ -75,16 +76,17 @@ namespace yojimbo
     }
 
     Address::Address( uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint16_t port )
-        : m_type( ADDRESS_IPV4 )
     {
-        
+        Clear();
+        m_type = ADDRESS_IPV4;
         m_address.ipv4 = uint32_t(a) | (uint32_t(b)<<8) | (uint32_t(c)<<16) | (uint32_t(d)<<24);
         m_port = port;
     }
 
     Address::Address( uint32_t address, int16_t port )
-        : m_type( ADDRESS_IPV4 )
     {
+        Clear();
+        m_type = ADDRESS_IPV4;
         m_address.ipv4 = htonl( address );        // IMPORTANT: stored in network byte order. eg. big endian!
         m_port = port;
     }
@@ -92,8 +94,9 @@ namespace yojimbo
     Address::Address( uint16_t a, uint16_t b, uint16_t c, uint16_t d,
                       uint16_t e, uint16_t f, uint16_t g, uint16_t h,
                       uint16_t port )
-        : m_type( ADDRESS_IPV6 )
     {
+        Clear();
+        m_type = ADDRESS_IPV6;
         m_address.ipv6[0] = htons( a );
         m_address.ipv6[1] = htons( b );
         m_address.ipv6[2] = htons( c );
@@ -106,8 +109,9 @@ namespace yojimbo
     }
 
     Address::Address( const uint16_t address[], uint16_t port )
-        : m_type( ADDRESS_IPV6 )
     {
+        Clear();
+        m_type = ADDRESS_IPV6;
         for ( int i = 0; i < 8; ++i )
             m_address.ipv6[i] = htons( address[i] );
         m_port = port;
@@ -117,6 +121,8 @@ namespace yojimbo
     {
         assert( addr );
 
+        Clear();
+
         if ( addr->ss_family == AF_INET )
         {
             const sockaddr_in * addr_ipv4 = (const sockaddr_in*) addr;
@@ -130,6 +136,15 @@ namespace yojimbo
             m_type = ADDRESS_IPV6;
             memcpy( m_address.ipv6, &addr_ipv6->sin6_addr, 16 );
             m_port = ntohs( addr_ipv6->sin6_port );
+
+            if ( IsIPv4Mapped() )
+            {
+                uint32_t ipv4;
+                memcpy( &ipv4, ( (const uint8_t*) &addr_ipv6->sin6_addr ) + 12, 4 );
+                memset( &m_address, 0, sizeof( m_address ) );
+                m_type = ADDRESS_IPV4;
+                m_address.ipv4 = ipv4;
+            }
         }
         else
         {
@@ -162,8 +177,9 @@ namespace yojimbo
         strncpy( address, address_in, MaxAddressLength - 1 );
         address[MaxAddressLength-1] = '\0';
 
+        Clear();
+
         int addressLength = (int) strlen( address );
-        m_port = 0;
         if ( address[0] == '[' )
         {
             const int base_index = addressLength - 1;
@@ -223,9 +239,9 @@ namespace yojimbo
 
     void Address::Clear()
     {
+        assert( sizeof( Address ) == 24 );
+        memset( (void*) this, 0, sizeof( Address ) );
         m_type = ADDRESS_NONE;
-        memset( &m_address, 0, sizeof( m_address ) );
-        m_port = 0;
     }
 
     uint32_t Address::GetAddress4() const
@@ -252,7 +268,7 @@ namespace yojimbo
 
     AddressType Address::GetType() const
     {
-        return m_type;
+        return (AddressType) m_type;
     }
 
     const char * Address::ToString( char buffer[], int bufferSize ) const
@@ -313,6 +329,16 @@ namespace yojimbo
         return m_type == ADDRESS_IPV6 && m_address.ipv6[0] == htons( 0xff00 );
     }
 
+    bool Address::IsIPv4Mapped() const
+    {
+        return m_type == ADDRESS_IPV6 && m_address.ipv6[0] == 0
+                                      && m_address.ipv6[1] == 0
+                                      && m_address.ipv6[2] == 0
+                                      && m_address.ipv6[3] == 0
+                                      && m_address.ipv6[4] == 0
+                                      && m_address.ipv6[5] == 0xFFFF;
+    }
+
     bool Address::IsLoopback() const
     {
         return ( m_type == ADDRESS_IPV4 && m_address.ipv4 == htonl( 0x7F000001 ) ) 
@@ -335,18 +361,21 @@ namespace yojimbo
                                       && !IsLoopback();
     }
 
+    uint64_t Address::GetHash() const
+    {
+        uint64_t packed[3];
+        memcpy( packed, (const void*) this, sizeof( packed ) );
+        return murmur_hash_64( packed, sizeof( packed ), 0 );
+    }
+
     bool Address::operator ==( const Address & other ) const
     {
-        if ( m_type != other.m_type )
-            return false;
-        if ( m_port != other.m_port )
-            return false;
-        if ( m_type == ADDRESS_IPV4 && m_address.ipv4 == other.m_address.ipv4 )
-            return true;
-        else if ( m_type == ADDRESS_IPV6 && memcmp( m_address.ipv6, other.m_address.ipv6, sizeof( m_address.ipv6 ) ) == 0 )
-            return true;
-        else
-            return false;
+        uint64_t a[3];
+        uint64_t b[3];
+        memcpy( a, (const void*) this, sizeof( a ) );
+        memcpy( b, (const void*) &other, sizeof( b ) );
+        const uint64_t difference = ( a[0] ^ b[0] ) | ( a[1] ^ b[1] ) | ( a[2] ^ b[2] );
+        return ( difference == 0 ) & ( m_type != ADDRESS_NONE );
     }
 
     bool Address::operator !=( const Address & other ) const
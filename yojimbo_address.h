@@ -73,7 +73,7 @@ namespace yojimbo
 
     class Address
     {
-        AddressType m_type;                                                 ///< The address type: IPv4 or IPv6.
+        // IMPORTANT: Addresses are packed into 24 bytes, and bytes not used by the address type are always zero. This way addresses are compared and hashed as three 64 bit words, without branching on the address type.
 
         union
         {
@@ -83,6 +83,10 @@ namespace yojimbo
 
         uint16_t m_port;                                                    ///< The IP port. Valid for IPv4 and IPv6 address types.
 
+        uint8_t m_type;                                                     ///< The address type: IPv4 or IPv6. See yojimbo::AddressType.
+
+        uint8_t m_padding[5];                                               ///< Always zero. Pads the address out to a multiple of 8 bytes.
+
    public:
 
         /**
@@ -160,6 +164,8 @@ namespace yojimbo
 
             Depending on the information in sockaddr_storage ss_family, the address will become ADDRESS_TYPE_IPV4 or ADDRESS_TYPE_IPV6.
 
+            IPv4-mapped IPv6 addresses (::ffff:a.b.c.d), which is how dual-stack sockets report packets from IPv4 senders, become ADDRESS_TYPE_IPV4. This way the same client has the same address whether its packets arrive on an IPv4 or a dual-stack socket.
+
             If something goes wrong in the conversion the address type is set to ADDRESS_TYPE_NONE and Address::IsValid returns false.
 
             @param addr The sockaddr_storage data to convert to an address.
@@ -290,6 +296,16 @@ namespace yojimbo
 
         bool IsLoopback() const;
 
+        /**
+            Is this an IPv4-mapped IPv6 address?
+
+            Corresponds to an IPv6 address of the form "::ffff:a.b.c.d".
+
+            @returns True if this is an IPv4-mapped IPv6 address.
+         */
+
+        bool IsIPv4Mapped() const;
+
         /**
             Is this an IPv6 link local address?
 
@@ -335,8 +351,24 @@ namespace yojimbo
 
         bool IsGlobalUnicast() const;
 
+        /**
+            Get a hash of the address.
+
+            Two addresses that compare equal are guaranteed to have the same hash. Used to index addresses in hash tables. See AddressMap.
+
+            @returns A 64 bit hash of the packed address type, address data and port.
+         */
+
+        uint64_t GetHash() const;
+
         // -----------------------------------
 
+        /**
+            Compare two addresses.
+
+            Addresses are compared as packed words without branching, so this is cheap enough to use in tight lookup loops. Invalid addresses never compare equal, even to each other.
+         */
+
         bool operator ==( const Address & other ) const;
 
         bool operator !=( const Address & other ) const;
@@ -0,0 +1,155 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_config.h"
+#include "yojimbo_address_map.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    AddressMap::AddressMap( Allocator & allocator, int capacity )
+    {
+        assert( capacity > 0 );
+
+        m_allocator = &allocator;
+
+        m_capacity = capacity;
+
+        uint32_t tableSize = 1;
+        while ( tableSize < uint32_t( capacity ) * 2 )
+            tableSize <<= 1;
+
+        m_tableMask = tableSize - 1;
+
+        m_address = (Address*) YOJIMBO_ALLOCATE( allocator, sizeof( Address ) * tableSize );
+        m_value = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * tableSize );
+
+        Clear();
+    }
+
+    AddressMap::~AddressMap()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_address );
+        YOJIMBO_FREE( *m_allocator, m_value );
+
+        m_allocator = NULL;
+    }
+
+    void AddressMap::Clear()
+    {
+        m_numEntries = 0;
+
+        for ( uint32_t i = 0; i <= m_tableMask; ++i )
+        {
+            m_address[i] = Address();
+            m_value[i] = -1;
+        }
+    }
+
+    int AddressMap::FindSlot( const Address & address ) const
+    {
+        uint32_t slot = uint32_t( address.GetHash() ) & m_tableMask;
+
+        while ( m_address[slot].IsValid() && m_address[slot] != address )
+        {
+            slot = ( slot + 1 ) & m_tableMask;
+        }
+
+        return (int) slot;
+    }
+
+    bool AddressMap::Insert( const Address & address, int value )
+    {
+        assert( address.IsValid() );
+        assert( value >= 0 );
+
+        const int slot = FindSlot( address );
+
+        if ( m_address[slot].IsValid() )
+        {
+            m_value[slot] = value;
+            return true;
+        }
+
+        if ( m_numEntries == m_capacity )
+            return false;
+
+        m_address[slot] = address;
+        m_value[slot] = value;
+        m_numEntries++;
+
+        return true;
+    }
+
+    bool AddressMap::Remove( const Address & address )
+    {
+        if ( !address.IsValid() )
+            return false;
+
+        uint32_t slot = (uint32_t) FindSlot( address );
+
+        if ( !m_address[slot].IsValid() )
+            return false;
+
+        // backward shift deletion: move entries up into the hole, so probe sequences stay unbroken without tombstones
+
+        uint32_t next = slot;
+
+        while ( true )
+        {
+            next = ( next + 1 ) & m_tableMask;
+
+            if ( !m_address[next].IsValid() )
+                break;
+
+            const uint32_t ideal = uint32_t( m_address[next].GetHash() ) & m_tableMask;
+
+            if ( ( ( next - ideal ) & m_tableMask ) >= ( ( next - slot ) & m_tableMask ) )
+            {
+                m_address[slot] = m_address[next];
+                m_value[slot] = m_value[next];
+                slot = next;
+            }
+        }
+
+        m_address[slot] = Address();
+        m_value[slot] = -1;
+        m_numEntries--;
+
+        return true;
+    }
+
+    int AddressMap::Find( const Address & address ) const
+    {
+        if ( !address.IsValid() )
+            return -1;
+
+        const int slot = FindSlot( address );
+
+        return m_address[slot].IsValid() ? m_value[slot] : -1;
+    }
+}
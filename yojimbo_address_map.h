@@ -0,0 +1,151 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef YOJIMBO_ADDRESS_MAP_H
+#define YOJIMBO_ADDRESS_MAP_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_address.h"
+#include "yojimbo_allocator.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        Maps addresses to integer values in O(1).
+
+        This is an open addressing hash table with linear probing. Removed entries are backward shifted so no tombstones are left behind, which keeps lookups fast even when entries are added and removed constantly (eg. clients connecting and disconnecting).
+
+        The hash table is sized to the next power of two at least twice the capacity passed in to the constructor, so the load factor never exceeds 50%.
+
+        Typically used to index arrays of per-address data, where the value is the index into the array.
+
+        @see Address::GetHash
+     */
+
+    class AddressMap
+    {
+    public:
+
+        /**
+            Address map constructor.
+
+            @param allocator The allocator used to allocate the hash table.
+            @param capacity The maximum number of entries that can be stored in the map.
+         */
+
+        AddressMap( Allocator & allocator, int capacity );
+
+        /**
+            Address map destructor.
+         */
+
+        ~AddressMap();
+
+        /**
+            Remove all entries from the map.
+         */
+
+        void Clear();
+
+        /**
+            Insert an entry into the map.
+
+            If an entry already exists for this address, its value is updated.
+
+            @param address The address key. Must be a valid address.
+            @param value The value to associate with the address. Must be non-negative.
+
+            @returns True if the entry was inserted or updated, false if the map is at capacity.
+         */
+
+        bool Insert( const Address & address, int value );
+
+        /**
+            Remove an entry from the map.
+
+            @param address The address key to remove.
+
+            @returns True if an entry was found and removed, false otherwise.
+         */
+
+        bool Remove( const Address & address );
+
+        /**
+            Find the value associated with an address.
+
+            @param address The address key to search for.
+
+            @returns The value associated with the address, or -1 if the address is not in the map.
+         */
+
+        int Find( const Address & address ) const;
+
+        /**
+            Get the number of entries in the map.
+
+            @returns The number of entries in [0,capacity].
+         */
+
+        int GetNumEntries() const { return m_numEntries; }
+
+        /**
+            Get the capacity of the map.
+
+            @returns The maximum number of entries that can be stored in the map.
+         */
+
+        int GetCapacity() const { return m_capacity; }
+
+    protected:
+
+        /**
+            Find the hash table slot for an address.
+
+            @param address The address to search for.
+
+            @returns The slot containing the address, or the empty slot where it would be inserted.
+         */
+
+        int FindSlot( const Address & address ) const;
+
+    private:
+
+        Allocator * m_allocator;                                ///< The allocator passed into the constructor.
+
+        int m_capacity;                                         ///< The maximum number of entries in the map.
+
+        int m_numEntries;                                       ///< The current number of entries in the map.
+
+        uint32_t m_tableMask;                                   ///< The hash table size minus one. The hash table size is always a power of two.
+
+        Address * m_address;                                    ///< The address key per-slot. Set to an invalid address if the slot is empty.
+
+        int * m_value;                                          ///< The value per-slot. Valid only if the address in the same slot is valid.
+    };
+}
+
+#endif // #ifndef YOJIMBO_ADDRESS_MAP_H
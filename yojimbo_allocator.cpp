@@ -24,17 +24,265 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_allocator.h"
+#include "yojimbo_common.h"
+#include "yojimbo_platform.h"
 #include <assert.h>
 #include <stdlib.h>
-
-#if YOJIMBO_DEBUG_MEMORY_LEAKS
 #include <stdio.h>
-#endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
 
 #include "tlsf/tlsf.h"
 
 namespace yojimbo
 {
+    static inline uint64_t leak_tracker_hash( const void * pointer )
+    {
+        return uint64_t( uintptr_t( pointer ) ) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    static inline uint64_t leak_tracker_site_hash( const char * file, int line )
+    {
+        return ( uint64_t( uintptr_t( file ) ) ^ ( uint64_t( uint32_t( line ) ) << 32 ) ) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    LeakTracker::LeakTracker()
+    {
+        m_entries = NULL;
+        m_entryShift = 64;
+        m_numEntries = 0;
+        m_maxEntries = 0;
+        m_numLive = 0;
+        m_sites = NULL;
+        m_numSites = 0;
+        m_maxSites = 0;
+        m_siteTable = NULL;
+    }
+
+    LeakTracker::~LeakTracker()
+    {
+        free( m_entries );
+        free( m_sites );
+        free( m_siteTable );
+    }
+
+    void LeakTracker::Add( const void * pointer, size_t size, const char * file, int line )
+    {
+        assert( pointer );
+
+        m_numLive++;
+
+        if ( !IsSampled( pointer ) )
+            return;
+
+        assert( FindEntry( pointer ) < 0 );
+
+        if ( ( m_numEntries + 1 ) * 2 > m_maxEntries )
+            GrowEntries();
+
+        const int site = FindSite( file, line );
+
+        m_sites[site].numLive++;
+        m_sites[site].bytesLive += size;
+
+        const int mask = m_maxEntries - 1;
+
+        int index = int( leak_tracker_hash( pointer ) >> m_entryShift );
+
+        while ( m_entries[index].pointer )
+            index = ( index + 1 ) & mask;
+
+        m_entries[index].pointer = pointer;
+        m_entries[index].size = size;
+        m_entries[index].site = site;
+
+        m_numEntries++;
+    }
+
+    bool LeakTracker::Remove( const void * pointer, size_t * size )
+    {
+        assert( pointer );
+        assert( m_numLive > 0 );
+
+        m_numLive--;
+
+        if ( !IsSampled( pointer ) )
+            return false;
+
+        int hole = FindEntry( pointer );
+
+        assert( hole >= 0 );
+        if ( hole < 0 )
+            return false;
+
+        const LeakTrackerEntry & entry = m_entries[hole];
+
+        if ( size )
+            *size = entry.size;
+
+        LeakTrackerSite & site = m_sites[entry.site];
+        assert( site.numLive > 0 );
+        site.numLive--;
+        site.bytesLive -= entry.size;
+
+        // IMPORTANT: shift entries after the hole back into it, while their probe sequence passes through the hole. Otherwise they can't be found any more.
+
+        const int mask = m_maxEntries - 1;
+
+        int index = ( hole + 1 ) & mask;
+
+        while ( m_entries[index].pointer )
+        {
+            const int home = int( leak_tracker_hash( m_entries[index].pointer ) >> m_entryShift );
+
+            if ( ( ( index - home ) & mask ) >= ( ( index - hole ) & mask ) )
+            {
+                m_entries[hole] = m_entries[index];
+                hole = index;
+            }
+
+            index = ( index + 1 ) & mask;
+        }
+
+        m_entries[hole].pointer = NULL;
+
+        m_numEntries--;
+
+        return true;
+    }
+
+    void LeakTracker::Report( const char * name ) const
+    {
+        printf( "%d %s leaked\n", m_numLive, name );
+
+        if ( m_numEntries != m_numLive )
+            printf( "%d of them were sampled (YOJIMBO_DEBUG_LEAK_SAMPLE_RATE is %d)\n", m_numEntries, YOJIMBO_DEBUG_LEAK_SAMPLE_RATE );
+
+        for ( int i = 0; i < m_numSites; ++i )
+        {
+            const LeakTrackerSite & site = m_sites[i];
+
+            if ( site.numLive == 0 )
+                continue;
+
+            if ( site.file )
+                printf( "leaked %d %s (%d bytes) - %s:%d\n", site.numLive, name, (int) site.bytesLive, site.file, site.line );
+            else
+                printf( "leaked %d %s of type %d\n", site.numLive, name, site.line );
+        }
+
+        printf( "\n" );
+    }
+
+    int LeakTracker::FindEntry( const void * pointer ) const
+    {
+        if ( !m_entries )
+            return -1;
+
+        const int mask = m_maxEntries - 1;
+
+        int index = int( leak_tracker_hash( pointer ) >> m_entryShift );
+
+        while ( m_entries[index].pointer )
+        {
+            if ( m_entries[index].pointer == pointer )
+                return index;
+            index = ( index + 1 ) & mask;
+        }
+
+        return -1;
+    }
+
+    int LeakTracker::FindSite( const char * file, int line )
+    {
+        if ( ( m_numSites + 1 ) > m_maxSites )
+            GrowSites();
+
+        const int mask = m_maxSites * 2 - 1;
+
+        int index = int( leak_tracker_site_hash( file, line ) & mask );
+
+        while ( m_siteTable[index] >= 0 )
+        {
+            const LeakTrackerSite & site = m_sites[m_siteTable[index]];
+            if ( site.file == file && site.line == line )
+                return m_siteTable[index];
+            index = ( index + 1 ) & mask;
+        }
+
+        const int siteIndex = m_numSites++;
+
+        LeakTrackerSite & site = m_sites[siteIndex];
+        site.file = file;
+        site.line = line;
+        site.numLive = 0;
+        site.bytesLive = 0;
+
+        m_siteTable[index] = siteIndex;
+
+        return siteIndex;
+    }
+
+    void LeakTracker::GrowEntries()
+    {
+        LeakTrackerEntry * oldEntries = m_entries;
+        const int oldMaxEntries = m_maxEntries;
+
+        m_maxEntries = m_maxEntries ? m_maxEntries * 2 : 256;
+        m_entryShift = 64;
+        for ( int i = m_maxEntries; i > 1; i >>= 1 )
+            m_entryShift--;
+
+        m_entries = (LeakTrackerEntry*) calloc( m_maxEntries, sizeof( LeakTrackerEntry ) );
+        assert( m_entries );
+        if ( !m_entries )
+            exit( 1 );
+
+        const int mask = m_maxEntries - 1;
+
+        for ( int i = 0; i < oldMaxEntries; ++i )
+        {
+            if ( !oldEntries[i].pointer )
+                continue;
+
+            int index = int( leak_tracker_hash( oldEntries[i].pointer ) >> m_entryShift );
+            while ( m_entries[index].pointer )
+                index = ( index + 1 ) & mask;
+
+            m_entries[index] = oldEntries[i];
+        }
+
+        free( oldEntries );
+    }
+
+    void LeakTracker::GrowSites()
+    {
+        m_maxSites = m_maxSites ? m_maxSites * 2 : 64;
+
+        m_sites = (LeakTrackerSite*) realloc( m_sites, sizeof( LeakTrackerSite ) * m_maxSites );
+
+        free( m_siteTable );
+        m_siteTable = (int*) malloc( sizeof( int ) * m_maxSites * 2 );
+
+        assert( m_sites );
+        assert( m_siteTable );
+        if ( !m_sites || !m_siteTable )
+            exit( 1 );
+
+        const int mask = m_maxSites * 2 - 1;
+
+        for ( int i = 0; i <= mask; ++i )
+            m_siteTable[i] = -1;
+
+        for ( int i = 0; i < m_numSites; ++i )
+        {
+            int index = int( leak_tracker_site_hash( m_sites[i].file, m_sites[i].line ) & mask );
+            while ( m_siteTable[index] >= 0 )
+                index = ( index + 1 ) & mask;
+            m_siteTable[index] = i;
+        }
+    }
+
+    // =============================================
+
     Allocator::Allocator() 
     {
         SetError( ALLOCATOR_ERROR_NONE );
@@ -43,17 +291,10 @@ namespace yojimbo
     Allocator::~Allocator()
     {
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
-        if ( m_alloc_map.size() )
+        if ( m_leakTracker.GetNumLive() )
         {
             printf( "you leaked memory!\n\n" );
-            typedef std::map<void*,AllocatorEntry>::iterator itor_type;
-            for ( itor_type i = m_alloc_map.begin(); i != m_alloc_map.end(); ++i )
-            {
-                void * p = i->first;
-                AllocatorEntry entry = i->second;
-                printf( "leaked block %p (%d bytes) - %s:%d\n", p, (int) entry.size, entry.file, entry.line );
-            }
-            printf( "\n" );
+            m_leakTracker.Report( "blocks" );
             exit(1);
         }
 #endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
@@ -61,15 +302,16 @@ namespace yojimbo
 
     void Allocator::TrackAlloc( void * p, size_t size, const char * file, int line )
     {
-#if YOJIMBO_DEBUG_MEMORY_LEAKS
+        m_stats.bytesAllocated += size;
+        m_stats.numAllocations++;
+        m_stats.totalAllocations++;
+
+        if ( m_stats.bytesAllocated > m_stats.peakBytesAllocated )
+            m_stats.peakBytesAllocated = m_stats.bytesAllocated;
 
-        assert( m_alloc_map.find( p ) == m_alloc_map.end() );
+#if YOJIMBO_DEBUG_MEMORY_LEAKS
 
-        AllocatorEntry entry;
-        entry.size = size;
-        entry.file = file;
-        entry.line = line;
-        m_alloc_map[p] = entry;
+        m_leakTracker.Add( p, size, file, line );
 
 #else // #if YOJIMBO_DEBUG_MEMORY_LEAKS
 
@@ -86,24 +328,62 @@ namespace yojimbo
         (void) p;
         (void) file;
         (void) line;
+
+        assert( m_stats.numAllocations > 0 );
+        m_stats.numAllocations--;
+        m_stats.totalFrees++;
+
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
-        assert( m_alloc_map.find( p ) != m_alloc_map.end() );
-        m_alloc_map.erase( p );
+        size_t size = 0;
+        if ( m_leakTracker.Remove( p, &size ) )
+        {
+            assert( m_stats.bytesAllocated >= size );
+            m_stats.bytesAllocated -= size;
+        }
 #endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
     }
 
+    void Allocator::TrackFree( void * p, size_t size, const char * file, int line )
+    {
+        (void) p;
+        (void) size;
+        (void) file;
+        (void) line;
+
+        assert( m_stats.numAllocations > 0 );
+        m_stats.numAllocations--;
+        m_stats.totalFrees++;
+
+#if YOJIMBO_DEBUG_MEMORY_LEAKS
+        size_t trackedSize = 0;
+        if ( m_leakTracker.Remove( p, &trackedSize ) )
+            assert( trackedSize == size );
+#endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
+
+        assert( m_stats.bytesAllocated >= size );
+        m_stats.bytesAllocated -= size;
+    }
+
     // =============================================
 
+    // IMPORTANT: Each allocation is prefixed with its size, so frees can be accounted for without a lookup. The header is 16 bytes so the alignment malloc gives is kept.
+
+    const size_t DefaultAllocatorHeaderSize = 16;
+
     void * DefaultAllocator::Allocate( size_t size, const char * file, int line )
     {
-        void * p = malloc( size );
+        uint8_t * block = (uint8_t*) malloc( DefaultAllocatorHeaderSize + size );
 
-        if ( !p )
+        if ( !block )
         {
             SetError( ALLOCATOR_ERROR_FAILED_TO_ALLOCATE );
             return NULL;
         }
 
+        *( (size_t*) block ) = size;
+
+        void * p = block + DefaultAllocatorHeaderSize;
+
         TrackAlloc( p, size, file, line );
 
         return p;
@@ -114,9 +394,11 @@ namespace yojimbo
         if ( !p )
             return;
 
-        TrackFree( p, file, line );
+        uint8_t * block = ( (uint8_t*) p ) - DefaultAllocatorHeaderSize;
+
+        TrackFree( p, *( (size_t*) block ), file, line );
 
-        free( p );
+        free( block );
     }
 
     // =============================================
@@ -168,7 +450,9 @@ namespace yojimbo
             return NULL;
         }
 
-        TrackAlloc( p, size, file, line );
+        // IMPORTANT: Track the size of the block TLSF actually used, so bytes allocated counts the rounding up, and frees can get the same size back.
+
+        TrackAlloc( p, tlsf_block_size( p ), file, line );
         
         return p;
     }
@@ -178,8 +462,483 @@ namespace yojimbo
         if ( !p )
             return;
 
-        TrackFree( p, file, line );
+        TrackFree( p, tlsf_block_size( p ), file, line );
 
         tlsf_free( m_tlsf, p );
     }
+
+    static void TLSF_StatsWalker( void * ptr, size_t size, int used, void * user )
+    {
+        (void) ptr;
+
+        if ( used )
+            return;
+
+        AllocatorStats & stats = *( (AllocatorStats*) user );
+
+        stats.freeBytes += size;
+
+        if ( size > stats.largestFreeBlock )
+            stats.largestFreeBlock = size;
+    }
+
+    void TLSF_Allocator::GetStats( AllocatorStats & stats ) const
+    {
+        stats = m_stats;
+        stats.freeBytes = 0;
+        stats.largestFreeBlock = 0;
+
+        tlsf_walk_pool( tlsf_get_pool( m_tlsf ), TLSF_StatsWalker, &stats );
+    }
+
+    struct TLSF_DiscardData
+    {
+        size_t pageSize;
+        size_t bytesDiscarded;
+    };
+
+    static void TLSF_DiscardWalker( void * ptr, size_t size, int used, void * user )
+    {
+        if ( used )
+            return;
+
+        TLSF_DiscardData & data = *( (TLSF_DiscardData*) user );
+
+        // IMPORTANT: A free block starts with its links in the free list, and the last word of the block holds the header of the next block. Only discard whole pages in between.
+
+        const uintptr_t FreeLinksSize = 2 * sizeof( void* );
+        const uintptr_t NextHeaderSize = sizeof( size_t );
+
+        if ( size <= FreeLinksSize + NextHeaderSize )
+            return;
+
+        const uintptr_t pageMask = data.pageSize - 1;
+        const uintptr_t start = ( uintptr_t( ptr ) + FreeLinksSize + pageMask ) & ~pageMask;
+        const uintptr_t finish = ( uintptr_t( ptr ) + size - NextHeaderSize ) & ~pageMask;
+
+        if ( finish <= start )
+            return;
+
+        platform_memory_discard( (void*) start, finish - start );
+
+        data.bytesDiscarded += finish - start;
+    }
+
+    size_t TLSF_Allocator::DiscardFreeMemory()
+    {
+        TLSF_DiscardData data;
+        data.pageSize = platform_page_size();
+        data.bytesDiscarded = 0;
+
+        tlsf_walk_pool( tlsf_get_pool( m_tlsf ), TLSF_DiscardWalker, &data );
+
+        return data.bytesDiscarded;
+    }
+
+    // =============================================
+
+    ThreadedTLSF_Allocator::ThreadedTLSF_Allocator( void * memory, size_t size, int numThreads )
+    {
+        assert( memory );
+        assert( numThreads >= 1 );
+        assert( numThreads <= MaxAllocatorThreads );
+
+        m_error = ALLOCATOR_ERROR_NONE;
+
+        m_numHeaps = numThreads;
+
+        const int AlignBytes = 8;
+
+        const size_t heapSize = size / numThreads;
+
+        for ( int i = 0; i < m_numHeaps; ++i )
+        {
+            uint8_t * heapMemory = ( (uint8_t*) memory ) + heapSize * i;
+
+            Heap & heap = m_heaps[i];
+            heap.memoryStart = (uint8_t*) AlignPointerUp( heapMemory, AlignBytes );
+            heap.memoryFinish = (uint8_t*) AlignPointerDown( heapMemory + heapSize, AlignBytes );
+            heap.ownerThreadId = 0;
+            heap.state = HEAP_FREE;
+            heap.returnedBlocks = NULL;
+            heap.allocator = new ( AlignPointerUp( m_heapAllocatorStorage[i], AlignBytes ) ) TLSF_Allocator( heap.memoryStart, heap.memoryFinish - heap.memoryStart );
+        }
+    }
+
+    ThreadedTLSF_Allocator::~ThreadedTLSF_Allocator()
+    {
+        for ( int i = 0; i < m_numHeaps; ++i )
+        {
+            FreeReturnedBlocks( m_heaps[i] );
+            m_heaps[i].allocator->~TLSF_Allocator();
+        }
+    }
+
+    ThreadedTLSF_Allocator::Heap * ThreadedTLSF_Allocator::FindHeap( uint64_t threadId )
+    {
+        for ( int i = 0; i < m_numHeaps; ++i )
+        {
+            Heap & heap = m_heaps[i];
+            if ( atomic_load( &heap.state ) == HEAP_CLAIMED && heap.ownerThreadId == threadId )
+                return &heap;
+        }
+        return NULL;
+    }
+
+    ThreadedTLSF_Allocator::Heap * ThreadedTLSF_Allocator::ClaimHeap( uint64_t threadId )
+    {
+        for ( int i = 0; i < m_numHeaps; ++i )
+        {
+            Heap & heap = m_heaps[i];
+
+            if ( !atomic_compare_exchange( &heap.state, HEAP_FREE, HEAP_CLAIMING ) )
+                continue;
+
+            // IMPORTANT: The owner is written before the heap is published as claimed, so other threads never see a claimed heap with a stale owner.
+
+            heap.ownerThreadId = threadId;
+
+            atomic_store( &heap.state, HEAP_CLAIMED );
+
+            return &heap;
+        }
+
+        return NULL;
+    }
+
+    ThreadedTLSF_Allocator::Heap * ThreadedTLSF_Allocator::FindBlockHeap( void * p )
+    {
+        for ( int i = 0; i < m_numHeaps; ++i )
+        {
+            Heap & heap = m_heaps[i];
+            if ( (uint8_t*) p >= heap.memoryStart && (uint8_t*) p < heap.memoryFinish )
+                return &heap;
+        }
+        return NULL;
+    }
+
+    void ThreadedTLSF_Allocator::FreeReturnedBlocks( Heap & heap )
+    {
+        if ( !atomic_load_pointer( &heap.returnedBlocks ) )
+            return;
+
+        // IMPORTANT: The whole list is taken in one exchange, so blocks are never popped one at a time while other threads push. This keeps the list free of ABA problems.
+
+        ReturnedBlock * block = (ReturnedBlock*) atomic_exchange_pointer( &heap.returnedBlocks, NULL );
+
+        while ( block )
+        {
+            ReturnedBlock * next = block->next;
+            YOJIMBO_FREE( *heap.allocator, block );
+            block = next;
+        }
+    }
+
+    void ThreadedTLSF_Allocator::FreeReturnedBlocks()
+    {
+        Heap * heap = FindHeap( platform_thread_id() );
+        if ( heap )
+            FreeReturnedBlocks( *heap );
+    }
+
+    void ThreadedTLSF_Allocator::ReleaseThread()
+    {
+        Heap * heap = FindHeap( platform_thread_id() );
+        if ( !heap )
+            return;
+
+        FreeReturnedBlocks( *heap );
+
+        atomic_store( &heap->state, HEAP_FREE );
+    }
+
+    void * ThreadedTLSF_Allocator::Allocate( size_t size, const char * file, int line )
+    {
+        const uint64_t threadId = platform_thread_id();
+
+        Heap * heap = FindHeap( threadId );
+
+        if ( !heap )
+        {
+            heap = ClaimHeap( threadId );
+
+            if ( !heap )
+            {
+                SetError( ALLOCATOR_ERROR_FAILED_TO_ALLOCATE );
+                return NULL;
+            }
+        }
+
+        FreeReturnedBlocks( *heap );
+
+        void * p = heap->allocator->Allocate( size, file, line );
+
+        if ( !p )
+            SetError( ALLOCATOR_ERROR_FAILED_TO_ALLOCATE );
+
+        return p;
+    }
+
+    void ThreadedTLSF_Allocator::Free( void * p, const char * file, int line )
+    {
+        if ( !p )
+            return;
+
+        Heap * heap = FindBlockHeap( p );
+
+        assert( heap );
+
+        if ( atomic_load( &heap->state ) == HEAP_CLAIMED && heap->ownerThreadId == platform_thread_id() )
+        {
+            heap->allocator->Free( p, file, line );
+            return;
+        }
+
+        // IMPORTANT: Each heap tracks its own allocations, which is not thread safe, so the free is only tracked once the owning thread drains the block.
+
+        ReturnedBlock * block = (ReturnedBlock*) p;
+
+        while ( true )
+        {
+            void * head = atomic_load_pointer( &heap->returnedBlocks );
+
+            block->next = (ReturnedBlock*) head;
+
+            if ( atomic_compare_exchange_pointer( &heap->returnedBlocks, head, block ) )
+                break;
+        }
+    }
+
+    void ThreadedTLSF_Allocator::GetStats( AllocatorStats & stats ) const
+    {
+        stats = AllocatorStats();
+
+        for ( int i = 0; i < m_numHeaps; ++i )
+        {
+            AllocatorStats heapStats;
+
+            m_heaps[i].allocator->GetStats( heapStats );
+
+            stats.bytesAllocated += heapStats.bytesAllocated;
+            stats.peakBytesAllocated += heapStats.peakBytesAllocated;
+            stats.numAllocations += heapStats.numAllocations;
+            stats.totalAllocations += heapStats.totalAllocations;
+            stats.totalFrees += heapStats.totalFrees;
+            stats.freeBytes += heapStats.freeBytes;
+
+            if ( heapStats.largestFreeBlock > stats.largestFreeBlock )
+                stats.largestFreeBlock = heapStats.largestFreeBlock;
+        }
+
+        // IMPORTANT: Failed heap allocations are counted here too, along with allocations that failed because no heap was free.
+
+        stats.numFailedAllocations = m_stats.numFailedAllocations;
+    }
+
+    // =============================================
+
+    ArenaAllocator::ArenaAllocator( int initialSize )
+    {
+        assert( initialSize > 0 );
+        m_allocator = NULL;
+        m_block = NULL;
+        m_blockSize = 0;
+        m_nextBlockSize = initialSize;
+        m_bytesAllocated = 0;
+        m_bytesPassedThrough = 0;
+    }
+
+    ArenaAllocator::~ArenaAllocator()
+    {
+        if ( m_allocator )
+        {
+            YOJIMBO_FREE( *m_allocator, m_block );
+        }
+    }
+
+    void ArenaAllocator::SetAllocator( Allocator & allocator )
+    {
+        if ( m_allocator == &allocator )
+            return;
+
+        assert( m_bytesAllocated == 0 );
+        assert( m_bytesPassedThrough == 0 );
+
+        if ( m_allocator )
+        {
+            YOJIMBO_FREE( *m_allocator, m_block );
+        }
+
+        m_allocator = &allocator;
+        m_blockSize = 0;
+    }
+
+    void ArenaAllocator::Reset()
+    {
+        // IMPORTANT: Grow the block so everything allocated since the last reset fits in it next time.
+
+        const size_t bytesRequired = m_bytesAllocated + m_bytesPassedThrough;
+
+        if ( bytesRequired > m_blockSize && m_bytesPassedThrough > 0 )
+        {
+            if ( m_allocator )
+            {
+                YOJIMBO_FREE( *m_allocator, m_block );
+            }
+
+            m_blockSize = 0;
+            if ( bytesRequired > m_nextBlockSize )
+                m_nextBlockSize = bytesRequired;
+        }
+
+        m_bytesAllocated = 0;
+        m_bytesPassedThrough = 0;
+
+        // IMPORTANT: Frees from the arena don't know their size, but everything has been freed by now, so the bytes allocated can be put right.
+
+        assert( m_stats.numAllocations == 0 );
+        m_stats.bytesAllocated = 0;
+    }
+
+    void * ArenaAllocator::Allocate( size_t size, const char * file, int line )
+    {
+        assert( m_allocator );
+
+        const size_t AlignBytes = 8;
+
+        const size_t alignedSize = ( size + ( AlignBytes - 1 ) ) & ~( AlignBytes - 1 );
+
+        if ( !m_block && m_bytesPassedThrough == 0 )
+        {
+            const size_t blockSize = alignedSize > m_nextBlockSize ? alignedSize : m_nextBlockSize;
+            m_block = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, blockSize );
+            m_blockSize = m_block ? blockSize : 0;
+        }
+
+        void * p = NULL;
+
+        if ( m_block && m_bytesAllocated + alignedSize <= m_blockSize )
+        {
+            p = m_block + m_bytesAllocated;
+            m_bytesAllocated += alignedSize;
+        }
+        else
+        {
+            p = YOJIMBO_ALLOCATE( *m_allocator, size );
+            if ( p )
+                m_bytesPassedThrough += alignedSize;
+        }
+
+        if ( !p )
+        {
+            SetError( ALLOCATOR_ERROR_FAILED_TO_ALLOCATE );
+            return NULL;
+        }
+
+        TrackAlloc( p, size, file, line );
+
+        return p;
+    }
+
+    void ArenaAllocator::Free( void * p, const char * file, int line )
+    {
+        if ( !p )
+            return;
+
+        TrackFree( p, file, line );
+
+        if ( m_block && (uint8_t*) p >= m_block && (uint8_t*) p < m_block + m_blockSize )
+            return;
+
+        assert( m_allocator );
+
+        m_allocator->Free( p, file, line );
+    }
+
+    FrameAllocator::FrameAllocator( Allocator & allocator, int size )
+    {
+        assert( size > 0 );
+        m_allocator = &allocator;
+        m_block = NULL;
+        m_size = size;
+        m_bytesAllocated = 0;
+        m_bytesOverflowed = 0;
+        m_highWaterMark = 0;
+        m_numOverflows = 0;
+        m_overflow = NULL;
+    }
+
+    FrameAllocator::~FrameAllocator()
+    {
+        Reset();
+
+        YOJIMBO_FREE( *m_allocator, m_block );
+    }
+
+    void FrameAllocator::Reset()
+    {
+        while ( m_overflow )
+        {
+            OverflowHeader * next = m_overflow->next;
+            YOJIMBO_FREE( *m_allocator, m_overflow );
+            m_overflow = next;
+        }
+
+        m_bytesAllocated = 0;
+        m_bytesOverflowed = 0;
+    }
+
+    void * FrameAllocator::Allocate( size_t size, const char * file, int line )
+    {
+        (void) file;
+        (void) line;
+
+        const size_t AlignBytes = 8;
+
+        const size_t alignedSize = ( size + ( AlignBytes - 1 ) ) & ~( AlignBytes - 1 );
+
+        if ( !m_block )
+        {
+            m_block = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_size );
+        }
+
+        void * p = NULL;
+
+        if ( m_block && m_bytesAllocated + alignedSize <= m_size )
+        {
+            p = m_block + m_bytesAllocated;
+            m_bytesAllocated += alignedSize;
+        }
+        else
+        {
+            OverflowHeader * header = (OverflowHeader*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( OverflowHeader ) + size );
+            if ( header )
+            {
+                header->next = m_overflow;
+                m_overflow = header;
+                m_bytesOverflowed += alignedSize;
+                m_numOverflows++;
+                p = header + 1;
+            }
+        }
+
+        if ( !p )
+        {
+            SetError( ALLOCATOR_ERROR_FAILED_TO_ALLOCATE );
+            return NULL;
+        }
+
+        const size_t bytesAllocated = m_bytesAllocated + m_bytesOverflowed;
+        if ( bytesAllocated > m_highWaterMark )
+            m_highWaterMark = bytesAllocated;
+
+        return p;
+    }
+
+    void FrameAllocator::Free( void * p, const char * file, int line )
+    {
+        (void) p;
+        (void) file;
+        (void) line;
+    }
 }
@@ -1,342 +1,922 @@
-/*
-    Yojimbo Client/Server Network Protocol Library.
-
-    Copyright © 2016, The Network Protocol Company, Inc.
-
-    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
-
-        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
-
-        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
-           in the documentation and/or other materials provided with the distribution.
-
-        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
-           from this software without specific prior written permission.
-
-    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
-    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
-    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
-    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
-    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
-    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
-    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
-*/
-
-#ifndef YOJIMBO_ALLOCATOR_H
-#define YOJIMBO_ALLOCATOR_H
-
-#include <stdint.h>
-#include <new>
-#if YOJIMBO_DEBUG_MEMORY_LEAKS
-#include <map>
-#endif // YOJIMBO_DEBUG_MEMORY_LEAKS
-
-/** @file */
-
-typedef void* tlsf_t;
-
-namespace yojimbo
-{
-    /**
-        Get the default allocator.
-
-        Use this allocator when you just want to use malloc/free, but in the form of a yojimbo allocator.
-
-        This allocator instance is created inside InitializeYojimbo and destroyed in ShutdownYojimbo.
-
-        In debug build, it will automatically check for memory leaks and print them out for you when you shutdown the library.
-
-        @returns The default allocator instances backed by malloc and free.
-     */
-
-    class Allocator & GetDefaultAllocator();
-
-    /// Macro for creating a new object instance with a yojimbo allocator.
-
-    #define YOJIMBO_NEW( a, T, ... ) ( new ( (a).Allocate( sizeof(T), __FILE__, __LINE__ ) ) T(__VA_ARGS__) )
-
-    /// Macro for deleting an object created with a yojimbo allocator.
-
-    #define YOJIMBO_DELETE( a, T, p ) do { if (p) { (p)->~T(); (a).Free( p, __FILE__, __LINE__ ); p = NULL; } } while (0)    
-
-    /// Macro for allocating a block of memory with a yojimbo allocator. 
-
-    #define YOJIMBO_ALLOCATE( a, bytes ) (a).Allocate( (bytes), __FILE__, __LINE__ )
-
-    /// Macro for freeing a block of memory created with a yojimbo allocator.
-
-    #define YOJIMBO_FREE( a, p ) do { if ( p ) { (a).Free( p, __FILE__, __LINE__ ); p = NULL; } } while(0)
-
-    /// Allocator error level.
-
-    enum AllocatorError
-    {
-        ALLOCATOR_ERROR_NONE = 0,                                                   ///< No error. All is well.
-        ALLOCATOR_ERROR_FAILED_TO_ALLOCATE                                          ///<  Tried to make an allocation but failed because the allocator was out of memory.
-    };
-
-#if YOJIMBO_DEBUG_MEMORY_LEAKS
-
-    /**
-        Debug structure used to track allocations and find memory leaks. 
-
-        Active in debug build only. Disabled in release builds for performance reasons.
-     */
-
-    struct AllocatorEntry
-    {
-        size_t size;                                                                ///< The size of the allocation in bytes.
-        const char * file;                                                          ///< Filename of the source code file that made the allocation.
-        int line;                                                                   ///< Line number in the source code where the allocation was made.
-    };
-
-#endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
-
-    /**
-        Functionality common to all allocators.
-
-        Extend this class to hook up your own allocator to yojimbo.
-
-        IMPORTANT: This allocator is not yet thread safe. Only call it from one thread!
-     */
-
-    class Allocator
-    {
-    public:
-
-        /**
-            Allocator constructor.
-
-            Sets the error level to ALLOCATOR_ERROR_NONE.
-         */
-
-        Allocator();
-
-        /**
-            Allocator destructor.
-
-            Make sure all allocations made from this allocator are freed before you destroy this allocator.
-
-            In debug build, validates this is true walks the map of allocator entries. Any outstanding entries are considered memory leaks and printed to stdout.
-         */
-
-        virtual ~Allocator();
-
-        /**
-            Allocate a block of memory.
-
-            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
-
-            @param size The size of the block of memory to allocate (bytes).
-            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
-            @param line The line number in the source code file that is performing the allocation.
-
-            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATION_ERROR_FAILED_TO_ALLOCATE.
-
-            @see Allocator::Free
-            @see Allocator::GetError
-         */
-
-        virtual void * Allocate( size_t size, const char * file, int line ) = 0;
-
-        /**
-            Free a block of memory.
-
-            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
-
-            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator. Will assert otherwise.
-            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
-            @param line The line number in the source code file that is performing the free.
-
-            @see Allocator::Allocate
-            @see Allocator::GetError
-         */
-
-        virtual void Free( void * p, const char * file, int line ) = 0;
-
-        /**
-            Get the allocator error level.
-
-            Use this function to check if an allocation has failed. This is used in the client/server to disconnect a client with a failed allocation.
-
-            @returns The allocator error level.
-         */
-
-        AllocatorError GetError() const { return m_error; }
-
-        /**
-            Clear the allocator error level back to default.
-         */
-
-        void ClearError() { m_error = ALLOCATOR_ERROR_NONE; }
-
-    protected:
-
-        /**
-            Set the error level.
-
-            For correct client/server behavior when an allocation fails, please make sure you call this method to set the error level to ALLOCATOR_ERROR_FAILED_TO_ALLOCATE.
-
-            @param error The allocator error level to set.
-         */
-
-        void SetError( AllocatorError error ) { m_error = error; }
-
-        /**
-            Call this function to track an allocation made by your derived allocator class.
-
-            In debug build, tracked allocations are automatically checked for leaks when the allocator is destroyed.
-
-            @param p Pointer to the memory that was allocated.
-            @param size The size of the allocation in bytes.
-            @param file The source code file that performed the allocation.
-            @param line The line number in the source file where the allocation was performed.
-         */
-
-        void TrackAlloc( void * p, size_t size, const char * file, int line );
-
-        /**
-            Call this function to track a free made by your derived allocator class.
-
-            In debug build, any allocation tracked without a corresponding free is considered a memory leak when the allocator is destroyed.
-
-            @param p Pointer to the memory that was allocated.
-            @param file The source code file that is calling in to free the memory.
-            @param line The line number in the source file where the free is being called from.
-         */
-
-        void TrackFree( void * p, const char * file, int line );
-
-        AllocatorError m_error;                                                 ///< The allocator error level.
-
-#if YOJIMBO_DEBUG_MEMORY_LEAKS
-        std::map<void*,AllocatorEntry> m_alloc_map;                             ///< Debug only data structure used to find and report memory leaks.
-#endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
-
-    private:
-
-        Allocator( const Allocator & other );
-
-        Allocator & operator = ( const Allocator & other );
-    };
-
-    /**
-        Allocator implementation based on malloc and free.
-     */
-
-    class DefaultAllocator : public Allocator
-    {
-    public:
-
-        /**
-            Default constructor.
-         */
-
-        DefaultAllocator() {}
-
-        /**
-            Allocates a block of memory using "malloc".
-
-            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
-
-            @param size The size of the block of memory to allocate (bytes).
-            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
-            @param line The line number in the source code file that is performing the allocation.
-
-            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATION_ERROR_FAILED_TO_ALLOCATE.
-         */
-
-        void * Allocate( size_t size, const char * file, int line );
-
-        /**
-            Free a block of memory by calling "free".
-
-            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
-
-            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator. Will assert otherwise.
-            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
-            @param line The line number in the source code file that is performing the free.
-         */
-
-        void Free( void * p, const char * file, int line );
-
-    private:
-
-        DefaultAllocator( const DefaultAllocator & other );
-
-        DefaultAllocator & operator = ( const DefaultAllocator & other );
-    };
-
-    /**
-        Allocator built on the TLSF allocator implementation by Matt Conte. Thanks Matt!
-
-        This is a fast allocator that supports multiple heaps. It's used inside the yojimbo server to silo allocations for each client to their own heap.
-
-        See https://github.com/mattconte/tlsf for details on this allocator implementation.
-     */
-
-    class TLSF_Allocator : public Allocator
-    {
-    public:
-
-        /**
-            TLSF allocator constructor.
-
-            If you want to integrate your own allocator with yojimbo for use with the client and server, this class is a good template to start from. 
-
-            Make sure your constructor has the same signature as this one, and it will work with the YOJIMBO_SERVER_ALLOCATOR and YOJIMBO_CLIENT_ALLOCATOR helper macros.
-
-            @param memory Block of memory in which the allocator will work. This block must remain valid while this allocator exists. The allocator does not assume ownership of it, you must free it elsewhere, if necessary.
-            @param bytes The size of the block of memory (bytes). The maximum amount of memory you can allocate will be less, due to allocator overhead.
-         */
-
-        TLSF_Allocator( void * memory, size_t bytes );
-
-        /**
-            TLSF allocator destructor.
-
-            Checks for memory leaks in debug build. Free all memory allocated by this allocator before destroying.
-         */
-
-        ~TLSF_Allocator();
-
-        /**
-            Allocates a block of memory using TLSF.
-
-            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
-
-            @param size The size of the block of memory to allocate (bytes).
-            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
-            @param line The line number in the source code file that is performing the allocation.
-
-            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATION_ERROR_FAILED_TO_ALLOCATE.
-         */
-
-        void * Allocate( size_t size, const char * file, int line );
-
-        /**
-            Free a block of memory using TLSF.
-
-            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
-
-            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator. Will assert otherwise.
-            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
-            @param line The line number in the source code file that is performing the free.
-
-            @see Allocator::Allocate
-            @see Allocator::GetError
-         */
-
-        void Free( void * p, const char * file, int line );
-
-    private:
-
-        tlsf_t m_tlsf;                                                  ///< The TLSF allocator instance backing this allocator.
-
-        TLSF_Allocator( const TLSF_Allocator & other );
-
-        TLSF_Allocator & operator = ( const TLSF_Allocator & other );
-    };
-}
-
-#endif
+/*
+    Yojimbo Client/Server Network Protocol Library.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef YOJIMBO_ALLOCATOR_H
+#define YOJIMBO_ALLOCATOR_H
+
+#include "yojimbo_config.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+
+/** @file */
+
+typedef void* tlsf_t;
+
+namespace yojimbo
+{
+    /**
+        Get the default allocator.
+
+        Use this allocator when you just want to use malloc/free, but in the form of a yojimbo allocator.
+
+        This allocator instance is created inside InitializeYojimbo and destroyed in ShutdownYojimbo.
+
+        In debug build, it will automatically check for memory leaks and print them out for you when you shutdown the library.
+
+        @returns The default allocator instances backed by malloc and free.
+     */
+
+    class Allocator & GetDefaultAllocator();
+
+    /// Macro for creating a new object instance with a yojimbo allocator.
+
+    #define YOJIMBO_NEW( a, T, ... ) ( new ( (a).Allocate( sizeof(T), __FILE__, __LINE__ ) ) T(__VA_ARGS__) )
+
+    /// Macro for deleting an object created with a yojimbo allocator.
+
+    #define YOJIMBO_DELETE( a, T, p ) do { if (p) { (p)->~T(); (a).Free( p, __FILE__, __LINE__ ); p = NULL; } } while (0)    
+
+    /// Macro for allocating a block of memory with a yojimbo allocator. 
+
+    #define YOJIMBO_ALLOCATE( a, bytes ) (a).Allocate( (bytes), __FILE__, __LINE__ )
+
+    /// Macro for freeing a block of memory created with a yojimbo allocator.
+
+    #define YOJIMBO_FREE( a, p ) do { if ( p ) { (a).Free( p, __FILE__, __LINE__ ); p = NULL; } } while(0)
+
+    /// Allocator error level.
+
+    enum AllocatorError
+    {
+        ALLOCATOR_ERROR_NONE = 0,                                                   ///< No error. All is well.
+        ALLOCATOR_ERROR_FAILED_TO_ALLOCATE                                          ///<  Tried to make an allocation but failed because the allocator was out of memory.
+    };
+
+    /// An object tracked by LeakTracker.
+
+    struct LeakTrackerEntry
+    {
+        const void * pointer;                                                       ///< The tracked object. NULL if this slot in the table is empty.
+        size_t size;                                                                ///< The size of the object in bytes.
+        int site;                                                                   ///< Index of the site that created the object. See LeakTrackerSite.
+    };
+
+    /// Objects tracked by LeakTracker are aggregated by the site that created them, so leaks are reported per-site instead of per-object.
+
+    struct LeakTrackerSite
+    {
+        const char * file;                                                          ///< The source file that created the objects. NULL if objects are aggregated by type instead, eg. packets and messages.
+        int line;                                                                   ///< The line number in the source file. The object type if file is NULL.
+        int numLive;                                                                ///< The number of objects created at this site that are still tracked.
+        size_t bytesLive;                                                           ///< The number of bytes in objects created at this site that are still tracked.
+    };
+
+    /**
+        Debug tracking of live objects, used to find and report memory, packet and message leaks.
+
+        Tracked objects are kept in an open addressing hash table keyed by pointer, and aggregated by the site that created them. Adding and removing an object is a hash and a short linear probe, with no allocation unless the table grows.
+
+        Objects are sampled by address according to YOJIMBO_DEBUG_LEAK_SAMPLE_RATE, so most objects can skip the table altogether. Leaks are always counted exactly, but only sampled objects are reported by site.
+
+        Memory for the table comes from malloc, since the tracker is used inside allocators. This class is not thread safe.
+     */
+
+    class LeakTracker
+    {
+    public:
+
+        LeakTracker();
+
+        ~LeakTracker();
+
+        /**
+            Should an object at this address be tracked individually?
+
+            @param pointer The object address.
+
+            @returns True if the object is sampled. Always true if YOJIMBO_DEBUG_LEAK_SAMPLE_RATE is 1.
+         */
+
+        static bool IsSampled( const void * pointer )
+        {
+#if YOJIMBO_DEBUG_LEAK_SAMPLE_RATE > 1
+            return ( ( uint64_t( uintptr_t( pointer ) ) * 0x9E3779B97F4A7C15ULL ) >> 32 ) % YOJIMBO_DEBUG_LEAK_SAMPLE_RATE == 0;
+#else // #if YOJIMBO_DEBUG_LEAK_SAMPLE_RATE > 1
+            (void) pointer;
+            return true;
+#endif // #if YOJIMBO_DEBUG_LEAK_SAMPLE_RATE > 1
+        }
+
+        /**
+            Start tracking an object.
+
+            @param pointer The object. Must not already be tracked.
+            @param size The size of the object in bytes.
+            @param file The source file that created the object, or NULL to aggregate objects by type.
+            @param line The line number in the source file, or the object type if file is NULL.
+         */
+
+        void Add( const void * pointer, size_t size, const char * file, int line );
+
+        /**
+            Stop tracking an object.
+
+            @param pointer The object. Asserts if the object is sampled but not tracked, eg. on a double free.
+            @param size The size the object was added with (out). Only set if this returns true.
+
+            @returns True if the object was sampled, and was found and removed from the table.
+         */
+
+        bool Remove( const void * pointer, size_t * size = NULL );
+
+        /**
+            Get the number of objects added and not yet removed, sampled or not.
+
+            @returns The number of live objects. Anything other than zero when the owner is destroyed is a leak.
+         */
+
+        int GetNumLive() const { return m_numLive; }
+
+        /**
+            Print the live objects to stdout, aggregated by the site that created them.
+
+            @param name What the objects are, eg. "blocks", "packets" or "messages".
+         */
+
+        void Report( const char * name ) const;
+
+    private:
+
+        int FindEntry( const void * pointer ) const;
+
+        int FindSite( const char * file, int line );
+
+        void GrowEntries();
+
+        void GrowSites();
+
+        LeakTrackerEntry * m_entries;                                               ///< The hash table of tracked objects. Open addressing with linear probing.
+
+        int m_entryShift;                                                           ///< Shift applied to the pointer hash to get an index into m_entries. 64 minus log2 of the table size.
+
+        int m_numEntries;                                                           ///< The number of objects in m_entries.
+
+        int m_maxEntries;                                                           ///< The size of m_entries. Always a power of two, and grown so it stays no more than half full.
+
+        int m_numLive;                                                              ///< The number of objects added and not yet removed, including objects that were not sampled.
+
+        LeakTrackerSite * m_sites;                                                  ///< Array of sites that created tracked objects. Sites are never removed.
+
+        int m_numSites;                                                             ///< The number of sites in m_sites.
+
+        int m_maxSites;                                                             ///< The size of m_sites.
+
+        int * m_siteTable;                                                          ///< Hash table from site to index in m_sites, with -1 in empty slots. Twice the size of m_sites, so it stays no more than half full.
+
+        LeakTracker( const LeakTracker & other );
+
+        LeakTracker & operator = ( const LeakTracker & other );
+    };
+
+    /**
+        Allocator statistics.
+
+        These are kept in all builds, so you can see how much memory each allocator really needs, and size the memory budgets in ClientServerConfig from that.
+
+        @see Allocator::GetStats
+     */
+
+    struct AllocatorStats
+    {
+        uint64_t bytesAllocated;                                                    ///< The number of bytes currently allocated.
+        uint64_t peakBytesAllocated;                                                ///< The largest number of bytes allocated at the same time since the allocator was created.
+        uint64_t numAllocations;                                                    ///< The number of allocations currently outstanding.
+        uint64_t totalAllocations;                                                  ///< The number of allocations made since the allocator was created. Sample this over time to get the allocation rate.
+        uint64_t totalFrees;                                                        ///< The number of frees since the allocator was created.
+        uint64_t numFailedAllocations;                                              ///< The number of allocations that failed since the allocator was created.
+        uint64_t freeBytes;                                                         ///< The number of bytes free in the heap. Zero if the allocator doesn't manage a fixed heap, like DefaultAllocator.
+        uint64_t largestFreeBlock;                                                  ///< The size of the largest free block in the heap (bytes). The heap is fragmented when this is much smaller than freeBytes. Zero if the allocator doesn't manage a fixed heap.
+
+        AllocatorStats()
+        {
+            bytesAllocated = 0;
+            peakBytesAllocated = 0;
+            numAllocations = 0;
+            totalAllocations = 0;
+            totalFrees = 0;
+            numFailedAllocations = 0;
+            freeBytes = 0;
+            largestFreeBlock = 0;
+        }
+    };
+
+    /**
+        Functionality common to all allocators.
+
+        Extend this class to hook up your own allocator to yojimbo.
+
+        IMPORTANT: This allocator is not yet thread safe. Only call it from one thread!
+     */
+
+    class Allocator
+    {
+    public:
+
+        /**
+            Allocator constructor.
+
+            Sets the error level to ALLOCATOR_ERROR_NONE.
+         */
+
+        Allocator();
+
+        /**
+            Allocator destructor.
+
+            Make sure all allocations made from this allocator are freed before you destroy this allocator.
+
+            In debug build, validates this is true walks the map of allocator entries. Any outstanding entries are considered memory leaks and printed to stdout.
+         */
+
+        virtual ~Allocator();
+
+        /**
+            Allocate a block of memory.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATION_ERROR_FAILED_TO_ALLOCATE.
+
+            @see Allocator::Free
+            @see Allocator::GetError
+         */
+
+        virtual void * Allocate( size_t size, const char * file, int line ) = 0;
+
+        /**
+            Free a block of memory.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator. Will assert otherwise.
+            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the free.
+
+            @see Allocator::Allocate
+            @see Allocator::GetError
+         */
+
+        virtual void Free( void * p, const char * file, int line ) = 0;
+
+        /**
+            Get the allocator error level.
+
+            Use this function to check if an allocation has failed. This is used in the client/server to disconnect a client with a failed allocation.
+
+            @returns The allocator error level.
+         */
+
+        AllocatorError GetError() const { return m_error; }
+
+        /**
+            Clear the allocator error level back to default.
+         */
+
+        void ClearError() { m_error = ALLOCATOR_ERROR_NONE; }
+
+        /**
+            Get the allocator statistics.
+
+            Counters are updated by TrackAlloc, TrackFree and SetError, so they cost almost nothing to keep. Allocators that manage a fixed heap also fill in the free memory in the heap, which may walk the heap, so don't call this more often than you need to.
+
+            @param stats The allocator statistics (out).
+         */
+
+        virtual void GetStats( AllocatorStats & stats ) const { stats = m_stats; }
+
+        /**
+            Give the physical memory backing free pages in the allocator back to the operating system.
+
+            This is only useful for allocators working inside memory from platform_memory_reserve. The memory stays usable, and pages are committed again when they are next allocated. Allocators that don't support this do nothing.
+
+            @returns The number of bytes given back to the operating system.
+         */
+
+        virtual size_t DiscardFreeMemory() { return 0; }
+
+        /**
+            Called by a thread that is done allocating from this allocator, before it exits.
+
+            Allocators with per-thread state, like ThreadedTLSF_Allocator, give that state up here so another thread can take it. Other allocators do nothing.
+         */
+
+        virtual void ReleaseThread() {}
+
+    protected:
+
+        /**
+            Set the error level.
+
+            For correct client/server behavior when an allocation fails, please make sure you call this method to set the error level to ALLOCATOR_ERROR_FAILED_TO_ALLOCATE.
+
+            @param error The allocator error level to set.
+         */
+
+        void SetError( AllocatorError error ) 
+        { 
+            m_error = error; 
+            if ( error == ALLOCATOR_ERROR_FAILED_TO_ALLOCATE )
+                m_stats.numFailedAllocations++;
+        }
+
+        /**
+            Call this function to track an allocation made by your derived allocator class.
+
+            In debug build, tracked allocations are automatically checked for leaks when the allocator is destroyed.
+
+            @param p Pointer to the memory that was allocated.
+            @param size The size of the allocation in bytes.
+            @param file The source code file that performed the allocation.
+            @param line The line number in the source file where the allocation was performed.
+         */
+
+        void TrackAlloc( void * p, size_t size, const char * file, int line );
+
+        /**
+            Call this function to track a free made by your derived allocator class.
+
+            In debug build, any allocation tracked without a corresponding free is considered a memory leak when the allocator is destroyed.
+
+            @param p Pointer to the memory that was allocated.
+            @param file The source code file that is calling in to free the memory.
+            @param line The line number in the source file where the free is being called from.
+         */
+
+        void TrackFree( void * p, const char * file, int line );
+
+        /**
+            Call this function to track a free made by your derived allocator class, when you know the size of the allocation.
+
+            Prefer this to the version without a size, so the number of bytes allocated is kept correct in release build, where allocations are not tracked individually.
+
+            @param p Pointer to the memory that was allocated.
+            @param size The size of the allocation in bytes. Must match the size passed to TrackAlloc.
+            @param file The source code file that is calling in to free the memory.
+            @param line The line number in the source file where the free is being called from.
+         */
+
+        void TrackFree( void * p, size_t size, const char * file, int line );
+
+        AllocatorError m_error;                                                 ///< The allocator error level.
+
+        AllocatorStats m_stats;                                                 ///< The allocator statistics. Heap statistics are filled in by GetStats.
+
+#if YOJIMBO_DEBUG_MEMORY_LEAKS
+        LeakTracker m_leakTracker;                                              ///< Debug only tracking of allocations, used to find and report memory leaks.
+#endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
+
+    private:
+
+        Allocator( const Allocator & other );
+
+        Allocator & operator = ( const Allocator & other );
+    };
+
+    /**
+        Allocator implementation based on malloc and free.
+
+        Each allocation has a small header in front of it holding its size, so the allocator statistics stay correct in release build.
+     */
+
+    class DefaultAllocator : public Allocator
+    {
+    public:
+
+        /**
+            Default constructor.
+         */
+
+        DefaultAllocator() {}
+
+        /**
+            Allocates a block of memory using "malloc".
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATION_ERROR_FAILED_TO_ALLOCATE.
+         */
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        /**
+            Free a block of memory by calling "free".
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator. Will assert otherwise.
+            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the free.
+         */
+
+        void Free( void * p, const char * file, int line );
+
+    private:
+
+        DefaultAllocator( const DefaultAllocator & other );
+
+        DefaultAllocator & operator = ( const DefaultAllocator & other );
+    };
+
+    /**
+        Allocator built on the TLSF allocator implementation by Matt Conte. Thanks Matt!
+
+        This is a fast allocator that supports multiple heaps. It's used inside the yojimbo server to silo allocations for each client to their own heap.
+
+        See https://github.com/mattconte/tlsf for details on this allocator implementation.
+     */
+
+    class TLSF_Allocator : public Allocator
+    {
+    public:
+
+        /**
+            TLSF allocator constructor.
+
+            If you want to integrate your own allocator with yojimbo for use with the client and server, this class is a good template to start from. 
+
+            Make sure your constructor has the same signature as this one, and it will work with the YOJIMBO_SERVER_ALLOCATOR and YOJIMBO_CLIENT_ALLOCATOR helper macros.
+
+            @param memory Block of memory in which the allocator will work. This block must remain valid while this allocator exists. The allocator does not assume ownership of it, you must free it elsewhere, if necessary.
+            @param bytes The size of the block of memory (bytes). The maximum amount of memory you can allocate will be less, due to allocator overhead.
+         */
+
+        TLSF_Allocator( void * memory, size_t bytes );
+
+        /**
+            TLSF allocator destructor.
+
+            Checks for memory leaks in debug build. Free all memory allocated by this allocator before destroying.
+         */
+
+        ~TLSF_Allocator();
+
+        /**
+            Allocates a block of memory using TLSF.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATION_ERROR_FAILED_TO_ALLOCATE.
+         */
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        /**
+            Free a block of memory using TLSF.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator. Will assert otherwise.
+            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the free.
+
+            @see Allocator::Allocate
+            @see Allocator::GetError
+         */
+
+        void Free( void * p, const char * file, int line );
+
+        /**
+            Get the allocator statistics, including free memory in the heap.
+
+            IMPORTANT: This walks every block in the heap to find the free memory and the largest free block.
+
+            @param stats The allocator statistics (out).
+         */
+
+        void GetStats( AllocatorStats & stats ) const;
+
+        /**
+            Give the physical memory backing free blocks back to the operating system.
+
+            Whole pages inside each free block are discarded. The TLSF block headers at either end of the block are left alone, so the heap stays intact.
+
+            IMPORTANT: The memory passed in to the constructor must come from platform_memory_reserve. This walks every block in the heap.
+
+            @returns The number of bytes given back to the operating system.
+         */
+
+        size_t DiscardFreeMemory();
+
+    private:
+
+        tlsf_t m_tlsf;                                                  ///< The TLSF allocator instance backing this allocator.
+
+        TLSF_Allocator( const TLSF_Allocator & other );
+
+        TLSF_Allocator & operator = ( const TLSF_Allocator & other );
+    };
+
+    /**
+        TLSF allocator that can be used from more than one thread.
+
+        The memory passed in is split into one TLSF heap per-thread. The first time a thread allocates, it claims a heap of its own, so threads allocate without locks or contention.
+
+        Blocks can be freed on any thread. A block freed on the thread that owns its heap goes straight back to the heap. A block freed on any other thread is pushed onto a lock-free return list for its heap, which the owning thread drains back into the heap the next time it allocates, or when FreeReturnedBlocks is called.
+
+        This is for messages created on one thread, eg. decoded on an I/O thread, and released on another by MessageFactory::Release.
+
+        The constructor has the same signature as TLSF_Allocator, so it works with the YOJIMBO_SERVER_ALLOCATOR and YOJIMBO_CLIENT_ALLOCATOR helper macros.
+
+        IMPORTANT: Each thread can only allocate from its own share of the memory, so make the block of memory large enough for the busiest thread times the number of threads. Blocks freed on other threads stay allocated until the owning thread drains them, so a thread that stops allocating should call FreeReturnedBlocks periodically, or ReleaseThread once it is done.
+     */
+
+    class ThreadedTLSF_Allocator : public Allocator
+    {
+    public:
+
+        /**
+            Threaded TLSF allocator constructor.
+
+            @param memory Block of memory in which the allocator will work. This block must remain valid while this allocator exists. The allocator does not assume ownership of it, you must free it elsewhere, if necessary.
+            @param bytes The size of the block of memory (bytes). It is split evenly between the heaps, and the maximum amount of memory each thread can allocate will be less, due to allocator overhead.
+            @param numThreads The number of threads that can allocate from this allocator at the same time. Must be in [1,MaxAllocatorThreads].
+         */
+
+        ThreadedTLSF_Allocator( void * memory, size_t bytes, int numThreads = 2 );
+
+        /**
+            Threaded TLSF allocator destructor.
+
+            Drains blocks returned by other threads, then checks each heap for memory leaks in debug build. Make sure no other thread is still using this allocator.
+         */
+
+        ~ThreadedTLSF_Allocator();
+
+        /**
+            Free blocks returned by other threads back into the calling thread's heap.
+
+            This is done automatically each time the thread allocates. Does nothing if the calling thread has not claimed a heap.
+         */
+
+        void FreeReturnedBlocks();
+
+        /**
+            Give up the calling thread's heap, so another thread can claim it.
+
+            Blocks still allocated from the heap stay valid, and can be freed on any thread. They are drained by the next thread to claim the heap.
+         */
+
+        void ReleaseThread();
+
+        /**
+            Allocates a block of memory from the calling thread's heap.
+
+            If the calling thread doesn't have a heap yet, it claims one. Blocks returned to the heap by other threads are freed first, so their memory can be reused.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATION_ERROR_FAILED_TO_ALLOCATE. This includes when all heaps are already claimed by other threads.
+         */
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        /**
+            Free a block of memory on any thread.
+
+            If the calling thread owns the heap the block came from, the block is freed right away. Otherwise it is pushed onto the heap's return list, and freed by the owning thread later.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator. Will assert otherwise.
+            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the free.
+         */
+
+        void Free( void * p, const char * file, int line );
+
+        /**
+            Get the allocator statistics, summed across all heaps.
+
+            IMPORTANT: This walks every block in every heap. Heaps claimed by other threads are read while those threads may be allocating, so treat the result as approximate.
+
+            @param stats The allocator statistics (out). The peak bytes allocated is the sum of the peaks of each heap, and the largest free block is the largest in any one heap.
+         */
+
+        void GetStats( AllocatorStats & stats ) const;
+
+    protected:
+
+        /// Heap state. A heap goes from free to claiming to claimed when a thread takes it, and back to free in ReleaseThread.
+
+        enum HeapState
+        {
+            HEAP_FREE,                                                  ///< No thread owns this heap.
+            HEAP_CLAIMING,                                              ///< A thread is in the middle of claiming this heap.
+            HEAP_CLAIMED                                                ///< The heap is owned by the thread with id ownerThreadId.
+        };
+
+        /// A block freed on a thread other than the one that owns its heap. Stored in the first bytes of the freed block itself, so the return list needs no memory of its own.
+
+        struct ReturnedBlock
+        {
+            ReturnedBlock * next;                                       ///< The next block in the return list, or NULL if this is the last one.
+        };
+
+        /// A per-thread heap.
+
+        struct Heap
+        {
+            TLSF_Allocator * allocator;                                 ///< The TLSF allocator for this heap. Tracks allocations made from the heap, so leaks are reported per-heap.
+            uint8_t * memoryStart;                                      ///< The start of the memory for this heap.
+            uint8_t * memoryFinish;                                     ///< One byte past the end of the memory for this heap.
+            uint64_t ownerThreadId;                                     ///< The id of the thread that owns this heap. Only valid while the heap is claimed. See platform_thread_id.
+            int state;                                                  ///< The heap state. See HeapState.
+            void * returnedBlocks;                                      ///< Head of the lock-free return list of blocks freed on threads other than the owner. Pushed by any thread, taken all at once by the owning thread.
+        };
+
+        Heap * FindHeap( uint64_t threadId );
+
+        Heap * ClaimHeap( uint64_t threadId );
+
+        Heap * FindBlockHeap( void * p );
+
+        void FreeReturnedBlocks( Heap & heap );
+
+    private:
+
+        int m_numHeaps;                                                 ///< The number of heaps the memory is split into. One per-thread that can allocate from this allocator.
+
+        Heap m_heaps[MaxAllocatorThreads];                              ///< The per-thread heaps.
+
+        uint8_t m_heapAllocatorStorage[MaxAllocatorThreads][sizeof(TLSF_Allocator)+8];      ///< Storage for the per-heap TLSF allocators, which are constructed in place.
+
+        ThreadedTLSF_Allocator( const ThreadedTLSF_Allocator & other );
+
+        ThreadedTLSF_Allocator & operator = ( const ThreadedTLSF_Allocator & other );
+    };
+
+    /**
+        Bump pointer allocator working inside a block of memory taken from another allocator.
+
+        Allocating moves a pointer forward through the block, and freeing does nothing until the arena is reset, when the whole block is reused. Allocations that don't fit in the block are passed through to the backing allocator, and the block is grown to fit them the next time the arena is reset while it's empty.
+
+        This is used by connection packets, so all the per-channel data in a packet shares one block of memory, which is kept when the packet is recycled. See ConnectionPacket.
+
+        IMPORTANT: Free everything allocated from the arena before resetting it. Allocations are still tracked, so leaks are reported as usual in debug build.
+     */
+
+    class ArenaAllocator : public Allocator
+    {
+    public:
+
+        /**
+            Arena allocator constructor.
+
+            No memory is allocated until the first allocation made from the arena.
+
+            @param initialSize The size of the block to allocate from the backing allocator on first use (bytes).
+         */
+
+        explicit ArenaAllocator( int initialSize );
+
+        /**
+            Arena allocator destructor.
+
+            Returns the block to the backing allocator.
+         */
+
+        ~ArenaAllocator();
+
+        /**
+            Set the allocator that the arena takes its block of memory from.
+
+            If this is a different allocator to the one the block came from, the block is returned to that allocator. The arena must be reset.
+
+            @param allocator The backing allocator.
+         */
+
+        void SetAllocator( Allocator & allocator );
+
+        /**
+            Reset the arena, so its whole block can be allocated again.
+
+            If allocations were passed through to the backing allocator since the last reset, the block is freed, and the next block allocated is large enough to fit them.
+         */
+
+        void Reset();
+
+        /**
+            Allocates a block of memory from the arena.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATION_ERROR_FAILED_TO_ALLOCATE.
+         */
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        /**
+            Free a block of memory allocated from the arena.
+
+            Memory inside the arena block is only reclaimed when the arena is reset. Allocations that were passed through to the backing allocator are freed with it.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_DELETE or YOJIMBO_FREE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param p Pointer to the block of memory to free. Must be non-NULL block of memory that was allocated with this allocator. Will assert otherwise.
+            @param file The source code filename that is performing the free. Used for tracking allocations and reporting on memory leaks.
+            @param line The line number in the source code file that is performing the free.
+         */
+
+        void Free( void * p, const char * file, int line );
+
+        /**
+            Get the size of the arena block.
+
+            @returns The size of the block allocations are made from (bytes). Zero if no block is allocated.
+         */
+
+        int GetBlockSize() const { return (int) m_blockSize; }
+
+    private:
+
+        Allocator * m_allocator;                                        ///< The backing allocator. NULL until set.
+        uint8_t * m_block;                                              ///< The block of memory allocations are made from. NULL until the first allocation.
+        size_t m_blockSize;                                             ///< The size of the block (bytes).
+        size_t m_nextBlockSize;                                         ///< The size of the block to allocate next time one is needed (bytes).
+        size_t m_bytesAllocated;                                        ///< The number of bytes allocated from the block since the last reset.
+        size_t m_bytesPassedThrough;                                    ///< The number of bytes passed through to the backing allocator since the last reset, because they didn't fit in the block.
+
+        ArenaAllocator( const ArenaAllocator & other );
+
+        ArenaAllocator & operator = ( const ArenaAllocator & other );
+    };
+
+    /**
+        Linear allocator for memory that only lives until the end of the current frame.
+
+        Allocating moves a pointer forward through a fixed size block taken from the parent allocator, and resetting moves it back to the start, so everything allocated since the last reset is released at once. Freeing individual allocations does nothing.
+
+        Allocations that don't fit in the block are made from the parent allocator instead, and are freed on reset. Use the high water mark to size the block so this doesn't happen in steady state.
+
+        This replaces alloca for temporary arrays whose size depends on configuration, like the packet arrays read from the network simulator in BaseTransport::ReadPackets. The transport resets its frame allocator in BaseTransport::AdvanceTime.
+
+        IMPORTANT: Don't keep pointers to memory allocated from a frame allocator past the next reset. Allocations are not tracked for leaks, because resetting releases them all.
+     */
+
+    class FrameAllocator : public Allocator
+    {
+    public:
+
+        /**
+            Frame allocator constructor.
+
+            No memory is allocated until the first allocation made from the frame allocator.
+
+            @param allocator The parent allocator. The block is allocated from this, as are any allocations that don't fit in the block.
+            @param size The size of the block (bytes).
+         */
+
+        FrameAllocator( Allocator & allocator, int size );
+
+        /**
+            Frame allocator destructor.
+
+            Frees any overflow allocations and returns the block to the parent allocator.
+         */
+
+        ~FrameAllocator();
+
+        /**
+            Reset the frame allocator.
+
+            Everything allocated since the last reset is released. This is constant time, unless allocations overflowed to the parent allocator since the last reset, in which case they are freed.
+         */
+
+        void Reset();
+
+        /**
+            Allocates a block of memory from the frame allocator.
+
+            IMPORTANT: Don't call this directly. Use the YOJIMBO_NEW or YOJIMBO_ALLOCATE macros instead, because they automatically pass in the source filename and line number for you.
+
+            @param size The size of the block of memory to allocate (bytes).
+            @param file The source code filename that is performing the allocation.
+            @param line The line number in the source code file that is performing the allocation.
+
+            @returns A block of memory of the requested size, aligned to 8 bytes, or NULL if the allocation could not be performed. If NULL is returned, the error level is set to ALLOCATION_ERROR_FAILED_TO_ALLOCATE.
+         */
+
+        void * Allocate( size_t size, const char * file, int line );
+
+        /**
+            Free a block of memory allocated from the frame allocator.
+
+            This does nothing. Memory is only released when the frame allocator is reset.
+
+            @param p Pointer to the block of memory to free.
+            @param file The source code filename that is performing the free.
+            @param line The line number in the source code file that is performing the free.
+         */
+
+        void Free( void * p, const char * file, int line );
+
+        /**
+            Get the size of the block.
+
+            @returns The size of the block allocations are made from (bytes).
+         */
+
+        int GetSize() const { return (int) m_size; }
+
+        /**
+            Get the number of bytes allocated since the last reset.
+
+            @returns The number of bytes allocated since the last reset, including allocations that overflowed to the parent allocator (bytes).
+         */
+
+        int GetBytesAllocated() const { return (int) ( m_bytesAllocated + m_bytesOverflowed ); }
+
+        /**
+            Get the high water mark.
+
+            @returns The largest number of bytes allocated between resets since the frame allocator was created, including allocations that overflowed to the parent allocator (bytes). If this is larger than the block size, the block should be made bigger.
+         */
+
+        int GetHighWaterMark() const { return (int) m_highWaterMark; }
+
+        /**
+            Get the number of allocations that overflowed to the parent allocator.
+
+            @returns The number of allocations that didn't fit in the block since the frame allocator was created.
+         */
+
+        uint64_t GetNumOverflows() const { return m_numOverflows; }
+
+    private:
+
+        /// Header placed in front of each allocation that overflows to the parent allocator, so they can be freed on reset.
+
+        struct OverflowHeader
+        {
+            OverflowHeader * next;                                      ///< The next overflow allocation, or NULL if this is the first since the last reset.
+            uint64_t padding;                                           ///< Keeps the allocation following the header aligned.
+        };
+
+        Allocator * m_allocator;                                        ///< The parent allocator.
+        uint8_t * m_block;                                              ///< The block of memory allocations are made from. NULL until the first allocation.
+        size_t m_size;                                                  ///< The size of the block (bytes).
+        size_t m_bytesAllocated;                                        ///< The number of bytes allocated from the block since the last reset.
+        size_t m_bytesOverflowed;                                       ///< The number of bytes allocated from the parent allocator since the last reset, because they didn't fit in the block.
+        size_t m_highWaterMark;                                         ///< The largest number of bytes allocated between resets.
+        uint64_t m_numOverflows;                                        ///< The number of allocations that didn't fit in the block.
+        OverflowHeader * m_overflow;                                    ///< Linked list of overflow allocations made since the last reset. Most recent first.
+
+        FrameAllocator( const FrameAllocator & other );
+
+        FrameAllocator & operator = ( const FrameAllocator & other );
+    };
+}
+
+#endif
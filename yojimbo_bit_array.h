@@ -25,6 +25,7 @@
 #ifndef YOJIMBO_BIT_ARRAY_H
 #define YOJIMBO_BIT_ARRAY_H
 
+#include "yojimbo_common.h"
 #include "yojimbo_allocator.h"
 
 /** @file */
@@ -35,6 +36,8 @@ namespace yojimbo
         A simple bit array class.
 
         You can create a bit array with a number of bits, set, clear and test if each bit is set.
+
+        Searches, counts and range operations work a 64 bit word at a time, so scanning for the next unacked fragment of a block doesn't test each bit individually.
      */
 
     class BitArray
@@ -134,6 +137,123 @@ namespace yojimbo
             return ( m_data[data_index] >> bit_index ) & 1;
         }
 
+        /**
+            Get the values of a run of up to 32 consecutive bits.
+
+            @param index The index of the first bit.
+            @param count The number of bits to get in [0,32].
+
+            @returns The bit values. Bit n of the result is the value of bit index + n.
+         */
+
+        uint32_t GetBits( int index, int count ) const
+        {
+            assert( index >= 0 );
+            assert( count >= 0 );
+            assert( count <= 32 );
+            assert( index + count <= m_size );
+            if ( count == 0 )
+                return 0;
+            const int data_index = index >> 6;
+            const int bit_index = index & ( (1<<6) - 1 );
+            uint64_t value = m_data[data_index] >> bit_index;
+            if ( bit_index + count > 64 )
+                value |= m_data[data_index+1] << ( 64 - bit_index );
+            return uint32_t( value & ( ( uint64_t(1) << count ) - 1 ) );
+        }
+
+        /**
+            Set all bits in a range to 1.
+
+            @param start The index of the first bit to set.
+            @param count The number of bits to set.
+         */
+
+        void SetRange( int start, int count )
+        {
+            assert( start >= 0 );
+            assert( count >= 0 );
+            assert( start + count <= m_size );
+            int index = start;
+            const int end = start + count;
+            while ( index < end )
+            {
+                const int data_index = index >> 6;
+                const int bit_index = index & ( (1<<6) - 1 );
+                const int num_bits = min( 64 - bit_index, end - index );
+                m_data[data_index] |= GetMask( bit_index, num_bits );
+                index += num_bits;
+            }
+        }
+
+        /**
+            Clear all bits in a range to 0.
+
+            @param start The index of the first bit to clear.
+            @param count The number of bits to clear.
+         */
+
+        void ClearRange( int start, int count )
+        {
+            assert( start >= 0 );
+            assert( count >= 0 );
+            assert( start + count <= m_size );
+            int index = start;
+            const int end = start + count;
+            while ( index < end )
+            {
+                const int data_index = index >> 6;
+                const int bit_index = index & ( (1<<6) - 1 );
+                const int num_bits = min( 64 - bit_index, end - index );
+                m_data[data_index] &= ~GetMask( bit_index, num_bits );
+                index += num_bits;
+            }
+        }
+
+        /**
+            Find the first bit set to 1 in the range [start,end).
+
+            @param start The index of the first bit to search.
+            @param end The index one past the last bit to search.
+
+            @returns The index of the first bit set to 1 in the range, or -1 if all bits in the range are 0.
+         */
+
+        int FindNextSet( int start, int end ) const
+        {
+            return FindNext( start, end, 0 );
+        }
+
+        /**
+            Find the first bit set to 0 in the range [start,end).
+
+            @param start The index of the first bit to search.
+            @param end The index one past the last bit to search.
+
+            @returns The index of the first bit set to 0 in the range, or -1 if all bits in the range are 1.
+         */
+
+        int FindNextZero( int start, int end ) const
+        {
+            return FindNext( start, end, ~uint64_t(0) );
+        }
+
+        /**
+            Count the number of bits set to 1.
+
+            @returns The number of bits set to 1 in the bit array.
+         */
+
+        int CountSetBits() const
+        {
+            // IMPORTANT: Bits past the end of the array are never set, so whole words can be counted.
+            int count = 0;
+            const int num_words = m_bytes / 8;
+            for ( int i = 0; i < num_words; ++i )
+                count += popcount64( m_data[i] );
+            return count;
+        }
+
         /**
             Gets the size of the bit array, in number of bits.
 
@@ -155,6 +275,37 @@ namespace yojimbo
         
         uint64_t * m_data;                                  ///< The data backing the bit array is an array of 64 bit integer values.
 
+        static uint64_t GetMask( int bit_index, int num_bits )
+        {
+            assert( bit_index >= 0 );
+            assert( num_bits > 0 );
+            assert( bit_index + num_bits <= 64 );
+            const uint64_t mask = ( num_bits == 64 ) ? ~uint64_t(0) : ( ( uint64_t(1) << num_bits ) - 1 );
+            return mask << bit_index;
+        }
+
+        int FindNext( int start, int end, uint64_t invert ) const
+        {
+            assert( start >= 0 );
+            assert( end <= m_size );
+            if ( start >= end )
+                return -1;
+            int data_index = start >> 6;
+            uint64_t word = ( m_data[data_index] ^ invert ) & ( ~uint64_t(0) << ( start & ( (1<<6) - 1 ) ) );
+            const int last_data_index = ( end - 1 ) >> 6;
+            while ( true )
+            {
+                if ( word )
+                {
+                    const int index = ( data_index << 6 ) + trailing_zeros( word );
+                    return ( index < end ) ? index : -1;
+                }
+                if ( ++data_index > last_data_index )
+                    return -1;
+                word = m_data[data_index] ^ invert;
+            }
+        }
+
         BitArray( const BitArray & other );
         BitArray & operator = ( const BitArray & other );
     };
@@ -41,6 +41,8 @@ namespace yojimbo
 
         Once the low 32 bits of the scratch is filled with bits it is flushed to memory as a dword and the scratch value is shifted right by 32.
 
+        When YOJIMBO_BITPACK_64 is 1, the scratch is instead flushed as a 64 bit word once all 64 bits are filled. This halves the number of flushes and byte swaps. A 64 bit little endian word is the same bytes as two consecutive 32 bit little endian words, so the bit stream written is exactly the same.
+
         The bit stream is written to memory in little endian order, which is considered network byte order for this library.
 
         @see BitReader
@@ -92,20 +94,96 @@ namespace yojimbo
             assert( m_bitsWritten + bits <= m_numBits );
             assert( uint64_t( value ) <= ( ( 1ULL << bits ) - 1 ) );
 
-            m_scratch |= uint64_t( value ) << m_scratchBits;
+            PackBits( m_data, m_scratch, m_scratchBits, m_wordIndex, value, bits );
+
+            m_bitsWritten += bits;
+        }
+
+        /**
+            Write an array of values with the same number of bits.
+
+            Writes exactly the same bits as calling WriteBits for each value, but the scratch value and word index stay in local variables for the whole array, instead of being loaded and stored for each value.
+
+            @param values The values to write. Each value must be in [0,(1<<bits)-1].
+            @param count The number of values to write.
+            @param bits The number of bits to write per value in [1,32].
 
-            m_scratchBits += bits;
+            @see BitReader::ReadBitsArray
+         */
 
-            if ( m_scratchBits >= 32 )
+        void WriteBitsArray( const uint32_t * values, int count, int bits )
+        {
+            assert( values || count == 0 );
+            assert( count >= 0 );
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            assert( int64_t( m_bitsWritten ) + int64_t( count ) * bits <= m_numBits );
+
+            uint32_t * data = m_data;
+            uint64_t scratch = m_scratch;
+            int scratchBits = m_scratchBits;
+            int wordIndex = m_wordIndex;
+
+            for ( int i = 0; i < count; ++i )
             {
-                assert( m_wordIndex < m_numWords );
-                m_data[m_wordIndex] = host_to_network( uint32_t( m_scratch & 0xFFFFFFFF ) );
-                m_scratch >>= 32;
-                m_scratchBits -= 32;
-                m_wordIndex++;
+                assert( uint64_t( values[i] ) <= ( ( 1ULL << bits ) - 1 ) );
+                PackBits( data, scratch, scratchBits, wordIndex, values[i], bits );
             }
 
-            m_bitsWritten += bits;
+            m_scratch = scratch;
+            m_scratchBits = scratchBits;
+            m_wordIndex = wordIndex;
+
+            m_bitsWritten += count * bits;
+        }
+
+        /**
+            Overwrite bits that have already been written.
+
+            Use this to fill in a value that isn't known until after the bits that follow it are written, eg. the size of the data after it. Write a placeholder first, then overwrite it with the real value.
+
+            @param bitIndex The index of the first bit to overwrite. The bits must already have been written.
+            @param value The value to write. Must be in [0,(1<<bits)-1].
+            @param bits The number of bits to overwrite in [1,32].
+         */
+
+        void OverwriteBits( int bitIndex, uint32_t value, int bits )
+        {
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            assert( bitIndex >= 0 );
+            assert( bitIndex + bits <= m_bitsWritten );
+            assert( uint64_t( value ) <= ( ( 1ULL << bits ) - 1 ) );
+
+            // IMPORTANT: bits before the scratch have been flushed to memory. The scratch always starts on a word boundary, so no word is split between the two.
+
+            const int flushedBits = m_bitsWritten - m_scratchBits;
+
+            assert( ( flushedBits % 32 ) == 0 );
+
+            while ( bits > 0 )
+            {
+                const int wordBits = bitIndex % 32;
+                const int n = ( bits < 32 - wordBits ) ? bits : 32 - wordBits;
+                const uint32_t mask = uint32_t( ( uint64_t(1) << n ) - 1 );
+                const uint32_t chunk = value & mask;
+
+                if ( bitIndex < flushedBits )
+                {
+                    uint32_t word = network_to_host( m_data[bitIndex / 32] );
+                    word = ( word & ~( mask << wordBits ) ) | ( chunk << wordBits );
+                    m_data[bitIndex / 32] = host_to_network( word );
+                }
+                else
+                {
+                    const int shift = bitIndex - flushedBits;
+                    m_scratch = ( m_scratch & ~( uint64_t( mask ) << shift ) ) | ( uint64_t( chunk ) << shift );
+                }
+
+                value = uint32_t( uint64_t( value ) >> n );
+                bitIndex += n;
+                bits -= n;
+            }
         }
 
         /**
@@ -149,11 +227,13 @@ namespace yojimbo
             assert( m_bitsWritten + bytes * 8 <= m_numBits );
             assert( ( m_bitsWritten % 32 ) == 0 || ( m_bitsWritten % 32 ) == 8 || ( m_bitsWritten % 32 ) == 16 || ( m_bitsWritten % 32 ) == 24 );
 
+            // IMPORTANT: the head and tail bytes are each packed into one WriteBits call. Bytes are written in order from the low bits, so this writes exactly the same bits as writing one byte at a time.
+
             int headBytes = ( 4 - ( m_bitsWritten % 32 ) / 8 ) % 4;
             if ( headBytes > bytes )
                 headBytes = bytes;
-            for ( int i = 0; i < headBytes; ++i )
-                WriteBits( data[i], 8 );
+            if ( headBytes > 0 )
+                WriteBits( PackBytes( data, headBytes ), headBytes * 8 );
             if ( headBytes == bytes )
                 return;
 
@@ -176,8 +256,8 @@ namespace yojimbo
             int tailStart = headBytes + numWords * 4;
             int tailBytes = bytes - tailStart;
             assert( tailBytes >= 0 && tailBytes < 4 );
-            for ( int i = 0; i < tailBytes; ++i )
-                WriteBits( data[tailStart+i], 8 );
+            if ( tailBytes > 0 )
+                WriteBits( PackBytes( data + tailStart, tailBytes ), tailBytes * 8 );
 
             assert( GetAlignBits() == 0 );
 
@@ -194,6 +274,20 @@ namespace yojimbo
 
         void FlushBits()
         {
+#if YOJIMBO_BITPACK_64
+            if ( m_scratchBits > 32 )
+            {
+                // IMPORTANT: the buffer size is a multiple of 4 and more than 32 bits have been written past the current word, so the next 64 bits are inside the buffer.
+
+                assert( m_wordIndex + 2 <= m_numWords );
+                const uint64_t word = host_to_network( m_scratch );
+                memcpy( &m_data[m_wordIndex], &word, 8 );
+                m_scratch = 0;
+                m_scratchBits = 0;
+                m_wordIndex += 2;
+            }
+#endif // #if YOJIMBO_BITPACK_64
+
             if ( m_scratchBits != 0 )
             {
                 assert( m_scratchBits <= 32 );
@@ -270,13 +364,80 @@ namespace yojimbo
 
     private:
 
+        /**
+            Pack a value into the scratch, flushing the scratch to memory when it fills up.
+
+            The scratch state is passed in so WriteBitsArray can keep it in local variables for the whole array.
+
+            @param data The buffer being written to.
+            @param scratch The scratch value.
+            @param scratchBits The number of bits in the scratch value.
+            @param wordIndex The index of the next word to flush to memory.
+            @param value The value to pack.
+            @param bits The number of bits to pack in [1,32].
+         */
+
+        void PackBits( uint32_t * data, uint64_t & scratch, int & scratchBits, int & wordIndex, uint32_t value, int bits )
+        {
+#if YOJIMBO_BITPACK_64
+            if ( scratchBits + bits >= 64 )
+            {
+                // IMPORTANT: the high bits of value that don't fit in this word start the scratch for the next word.
+
+                assert( wordIndex + 2 <= m_numWords );
+                const uint64_t word = host_to_network( scratch | ( uint64_t( value ) << scratchBits ) );
+                memcpy( &data[wordIndex], &word, 8 );
+                scratch = uint64_t( value ) >> ( 64 - scratchBits );
+                scratchBits += bits - 64;
+                wordIndex += 2;
+            }
+            else
+            {
+                scratch |= uint64_t( value ) << scratchBits;
+                scratchBits += bits;
+            }
+#else // #if YOJIMBO_BITPACK_64
+            scratch |= uint64_t( value ) << scratchBits;
+
+            scratchBits += bits;
+
+            if ( scratchBits >= 32 )
+            {
+                assert( wordIndex < m_numWords );
+                data[wordIndex] = host_to_network( uint32_t( scratch & 0xFFFFFFFF ) );
+                scratch >>= 32;
+                scratchBits -= 32;
+                wordIndex++;
+            }
+#endif // #if YOJIMBO_BITPACK_64
+        }
+
+        /**
+            Pack up to 3 bytes into an integer value, with the first byte in the low bits.
+
+            @param data The bytes to pack.
+            @param bytes The number of bytes to pack in [1,3].
+
+            @returns The packed value.
+         */
+
+        static uint32_t PackBytes( const uint8_t * data, int bytes )
+        {
+            assert( bytes > 0 );
+            assert( bytes < 4 );
+            uint32_t value = 0;
+            for ( int i = 0; i < bytes; ++i )
+                value |= uint32_t( data[i] ) << ( i * 8 );
+            return value;
+        }
+
         uint32_t * m_data;                                  ///< The buffer we are writing to, as a uint32_t * because we're writing dwords at a time.
-        uint64_t m_scratch;                                 ///< The scratch value where we write bits to (right to left). 64 bit for overflow. Once # of bits in scratch is >= 32, the low 32 bits are flushed to memory.
+        uint64_t m_scratch;                                 ///< The scratch value where we write bits to (right to left). 64 bit for overflow. Once # of bits in scratch is >= 32, the low 32 bits are flushed to memory. With YOJIMBO_BITPACK_64, all 64 bits are flushed once it is full.
         int m_numBits;                                      ///< The number of bits in the buffer. This is equivalent to the size of the buffer in bytes multiplied by 8. Note that the buffer size must always be a multiple of 4.
         int m_numWords;                                     ///< The number of words in the buffer. This is equivalent to the size of the buffer in bytes divided by 4. Note that the buffer size must always be a multiple of 4.
         int m_bitsWritten;                                  ///< The number of bits written so far.
         int m_wordIndex;                                    ///< The current word index. The next word flushed to memory will be at this index in m_data.
-        int m_scratchBits;                                  ///< The number of bits in scratch. When this is >= 32, the low 32 bits of scratch is flushed to memory as a dword and scratch is shifted right by 32.
+        int m_scratchBits;                                  ///< The number of bits in scratch. When this is >= 32, the low 32 bits of scratch is flushed to memory as a dword and scratch is shifted right by 32. With YOJIMBO_BITPACK_64, this is always < 64.
     };
 
     /**
@@ -285,6 +446,8 @@ namespace yojimbo
         Relies on the user reconstructing the exact same set of bit reads as bit writes when the buffer was written. This is an unattributed bitpacked binary stream!
 
         Implementation: 32 bit dwords are read in from memory to the high bits of a scratch value as required. The user reads off bit values from the scratch value from the right, after which the scratch value is shifted by the same number of bits.
+
+        When YOJIMBO_BITPACK_64 is 1, 64 bit words are read in instead, except for the last dword of a buffer that isn't a multiple of 8 bytes. This reads exactly the same bit stream, and never reads past the buffer rounded up to the next 4 bytes.
      */
 
     class BitReader
@@ -304,11 +467,11 @@ namespace yojimbo
             @see BitWriter
          */
 
-#ifndef NDEBUG
+#if !defined( NDEBUG ) || YOJIMBO_BITPACK_64
         BitReader( const void * data, int bytes ) : m_data( (const uint32_t*) data ), m_numBytes( bytes ), m_numWords( ( bytes + 3 ) / 4)
-#else // #ifndef NDEBUG
+#else // #if !defined( NDEBUG ) || YOJIMBO_BITPACK_64
         BitReader( const void * data, int bytes ) : m_data( (const uint32_t*) data ), m_numBytes( bytes )
-#endif // #ifndef NDEBUG
+#endif // #if !defined( NDEBUG ) || YOJIMBO_BITPACK_64
         {
             assert( data );
             m_numBits = m_numBytes * 8;
@@ -354,7 +517,62 @@ namespace yojimbo
 
             m_bitsRead += bits;
 
-            assert( m_scratchBits >= 0 && m_scratchBits <= 64 );
+            return UnpackBits( m_scratch, m_scratchBits, m_wordIndex, bits );
+        }
+
+        /**
+            Read an array of values with the same number of bits.
+
+            Reads exactly the same bits as calling ReadBits for each value, but the scratch value and word index stay in local variables for the whole array, instead of being loaded and stored for each value.
+
+            This function will assert in debug builds if this read would read past the end of the buffer.
+
+            @param values The values read are stored here. Each value will be in [0,(1<<bits)-1].
+            @param count The number of values to read.
+            @param bits The number of bits to read per value in [1,32].
+
+            @see BitWriter::WriteBitsArray
+         */
+
+        void ReadBitsArray( uint32_t * values, int count, int bits )
+        {
+            assert( values || count == 0 );
+            assert( count >= 0 );
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            assert( int64_t( m_bitsRead ) + int64_t( count ) * bits <= m_numBits );
+
+            uint64_t scratch = m_scratch;
+            int scratchBits = m_scratchBits;
+            int wordIndex = m_wordIndex;
+
+            for ( int i = 0; i < count; ++i )
+                values[i] = UnpackBits( scratch, scratchBits, wordIndex, bits );
+
+            m_scratch = scratch;
+            m_scratchBits = scratchBits;
+            m_wordIndex = wordIndex;
+
+            m_bitsRead += count * bits;
+        }
+
+        /**
+            Look at the next bits in the bit buffer without reading them.
+
+            This function will assert in debug builds if the peek would go past the end of the buffer.
+
+            @param bits The number of bits to peek in [1,32].
+
+            @returns The integer value of the next bits, in range [0,(1<<bits)-1]. The next call to ReadBits returns the same bits.
+
+            @see BitReader::ReadBits
+         */
+
+        uint32_t PeekBits( int bits )
+        {
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            assert( m_bitsRead + bits <= m_numBits );
 
             if ( m_scratchBits < bits )
             {
@@ -364,14 +582,7 @@ namespace yojimbo
                 m_wordIndex++;
             }
 
-            assert( m_scratchBits >= bits );
-
-            const uint32_t output = m_scratch & ( (uint64_t(1)<<bits) - 1 );
-
-            m_scratch >>= bits;
-            m_scratchBits -= bits;
-
-            return output;
+            return m_scratch & ( (uint64_t(1)<<bits) - 1 );
         }
 
         /**
@@ -416,8 +627,8 @@ namespace yojimbo
             int headBytes = ( 4 - ( m_bitsRead % 32 ) / 8 ) % 4;
             if ( headBytes > bytes )
                 headBytes = bytes;
-            for ( int i = 0; i < headBytes; ++i )
-                data[i] = (uint8_t) ReadBits( 8 );
+            if ( headBytes > 0 )
+                UnpackBytes( ReadBits( headBytes * 8 ), data, headBytes );
             if ( headBytes == bytes )
                 return;
 
@@ -426,10 +637,14 @@ namespace yojimbo
             int numWords = ( bytes - headBytes ) / 4;
             if ( numWords > 0 )
             {
+                // IMPORTANT: with YOJIMBO_BITPACK_64 the scratch can hold bits past the current position that were already loaded, so restart from the word at the current position.
+
                 assert( ( m_bitsRead % 32 ) == 0 );
+                m_wordIndex = m_bitsRead / 32;
                 memcpy( data + headBytes, &m_data[m_wordIndex], numWords * 4 );
                 m_bitsRead += numWords * 32;
                 m_wordIndex += numWords;
+                m_scratch = 0;
                 m_scratchBits = 0;
             }
 
@@ -438,14 +653,74 @@ namespace yojimbo
             int tailStart = headBytes + numWords * 4;
             int tailBytes = bytes - tailStart;
             assert( tailBytes >= 0 && tailBytes < 4 );
-            for ( int i = 0; i < tailBytes; ++i )
-                data[tailStart+i] = (uint8_t) ReadBits( 8 );
+            if ( tailBytes > 0 )
+                UnpackBytes( ReadBits( tailBytes * 8 ), data + tailStart, tailBytes );
 
             assert( GetAlignBits() == 0 );
 
             assert( headBytes + numWords * 4 + tailBytes == bytes );
         }
 
+        /**
+            Read an array of bytes in place, without copying them.
+
+            The bytes in the buffer are in the same order they were written with BitWriter::WriteBytes, so they can be returned as a pointer into the buffer being read.
+
+            IMPORTANT: The pointer returned is only valid as long as the buffer passed in to the constructor.
+
+            This function will assert in debug builds if this read would read past the end of the buffer.
+
+            @param bytes The number of bytes to read.
+
+            @returns A pointer to the bytes in the buffer being read.
+
+            @see BitWriter::WriteBytes
+         */
+
+        const uint8_t * ReadBytesView( int bytes )
+        {
+            assert( GetAlignBits() == 0 );
+            assert( bytes >= 0 );
+            assert( m_bitsRead + bytes * 8 <= m_numBits );
+
+            const uint8_t * data = ( (const uint8_t*) m_data ) + m_bitsRead / 8;
+
+            SkipBits( bytes * 8 );
+
+            return data;
+        }
+
+        /**
+            Skip over bits without reading them.
+
+            This function will assert in debug builds if this would skip past the end of the buffer.
+
+            @param bits The number of bits to skip.
+         */
+
+        void SkipBits( int bits )
+        {
+            assert( bits >= 0 );
+            assert( m_bitsRead + bits <= m_numBits );
+
+            m_bitsRead += bits;
+
+            // IMPORTANT: restart from the word at the new position. if it starts part way into a word, the rest of that word goes in the scratch.
+
+            m_wordIndex = m_bitsRead / 32;
+            m_scratch = 0;
+            m_scratchBits = 0;
+
+            const int wordBits = m_bitsRead % 32;
+            if ( wordBits != 0 )
+            {
+                assert( m_wordIndex < m_numWords );
+                m_scratch = uint64_t( network_to_host( m_data[m_wordIndex] ) ) >> wordBits;
+                m_scratchBits = 32 - wordBits;
+                m_wordIndex++;
+            }
+        }
+
         /**
             How many align bits would be read, if we were to read an align right now?
 
@@ -483,17 +758,451 @@ namespace yojimbo
 
     private:
 
+        /**
+            Unpack a value from the scratch, refilling the scratch from memory when it runs out.
+
+            The scratch state is passed in so ReadBitsArray can keep it in local variables for the whole array.
+
+            @param scratch The scratch value.
+            @param scratchBits The number of bits in the scratch value.
+            @param wordIndex The index of the next word to read from memory.
+            @param bits The number of bits to unpack in [1,32].
+
+            @returns The value unpacked, in range [0,(1<<bits)-1].
+         */
+
+        uint32_t UnpackBits( uint64_t & scratch, int & scratchBits, int & wordIndex, int bits )
+        {
+            assert( scratchBits >= 0 && scratchBits <= 64 );
+
+            if ( scratchBits < bits )
+            {
+#if YOJIMBO_BITPACK_64
+                if ( wordIndex + 2 <= m_numWords )
+                {
+                    // IMPORTANT: the output is split across the bits left in scratch and the low bits of the new word, and the rest of the new word becomes the scratch.
+
+                    uint64_t word;
+                    memcpy( &word, &m_data[wordIndex], 8 );
+                    word = network_to_host( word );
+                    const uint32_t output = uint32_t( ( scratch | ( word << scratchBits ) ) & ( ( uint64_t(1) << bits ) - 1 ) );
+                    scratch = word >> ( bits - scratchBits );
+                    scratchBits += 64 - bits;
+                    wordIndex += 2;
+                    return output;
+                }
+#endif // #if YOJIMBO_BITPACK_64
+
+                assert( wordIndex < m_numWords );
+                scratch |= uint64_t( network_to_host( m_data[wordIndex] ) ) << scratchBits;
+                scratchBits += 32;
+                wordIndex++;
+            }
+
+            assert( scratchBits >= bits );
+
+            const uint32_t output = scratch & ( (uint64_t(1)<<bits) - 1 );
+
+            scratch >>= bits;
+            scratchBits -= bits;
+
+            return output;
+        }
+
+        /**
+            Unpack up to 3 bytes from an integer value, with the first byte in the low bits.
+
+            @param value The packed value.
+            @param data The bytes to unpack into [out].
+            @param bytes The number of bytes to unpack in [1,3].
+         */
+
+        static void UnpackBytes( uint32_t value, uint8_t * data, int bytes )
+        {
+            assert( bytes > 0 );
+            assert( bytes < 4 );
+            for ( int i = 0; i < bytes; ++i )
+                data[i] = uint8_t( value >> ( i * 8 ) );
+        }
+
         const uint32_t * m_data;                            ///< The bitpacked data we're reading as a dword array.
         uint64_t m_scratch;                                 ///< The scratch value. New data is read in 32 bits at a top to the left of this buffer, and data is read off to the right.
         int m_numBits;                                      ///< Number of bits to read in the buffer. Of course, we can't *really* know this so it's actually m_numBytes * 8.
         int m_numBytes;                                     ///< Number of bytes to read in the buffer. We know this, and this is the non-rounded up version.
-#ifndef NDEBUG
+#if !defined( NDEBUG ) || YOJIMBO_BITPACK_64
         int m_numWords;                                     ///< Number of words to read in the buffer. This is rounded up to the next word if necessary.
-#endif // #ifndef NDEBUG
+#endif // #if !defined( NDEBUG ) || YOJIMBO_BITPACK_64
         int m_bitsRead;                                     ///< Number of bits read from the buffer so far.
         int m_scratchBits;                                  ///< Number of bits currently in the scratch value. If the user wants to read more bits than this, we have to go fetch another dword from memory.
         int m_wordIndex;                                    ///< Index of the next word to read from memory.
     };
+
+    const int RangeProbabilityBits = 11;                            ///< Probabilities used by the range coder are fixed point in [0,1<<RangeProbabilityBits].
+
+    const uint16_t RangeProbabilityInit = 1 << ( RangeProbabilityBits - 1 );   ///< The initial value for adaptive probabilities: a zero bit and a one bit are equally likely.
+
+    const int RangeProbabilityShift = 4;                            ///< How fast adaptive probabilities move towards the bits coded. Each bit moves the probability 1/16th of the way. This adapts quickly, since models start from scratch each packet.
+
+    /**
+        Binary range encoder.
+
+        Codes bits with an adaptive probability, so bits that are usually zero or usually one cost a fraction of a bit each. This is the same carryless range coder used by LZMA, except the first output byte (which is always zero) is not written.
+
+        Bytes are written in big endian order, because carries propagate back from the low byte of the range into bytes that have already been output.
+
+        @see RangeDecoder
+        @see RangeEncodeStream
+     */
+
+    class RangeEncoder
+    {
+    public:
+
+        /**
+            Range encoder constructor.
+
+            @param data Pointer to the buffer to write encoded data to.
+            @param bytes The size of the buffer in bytes.
+         */
+
+        RangeEncoder( uint8_t * data, int bytes ) : m_data( data ), m_numBytes( bytes )
+        {
+            assert( data );
+            assert( bytes >= 0 );
+            m_bytesWritten = 0;
+            m_low = 0;
+            m_range = 0xFFFFFFFF;
+            m_cache = 0;
+            m_cacheSize = 1;
+            m_first = true;
+            m_overflow = false;
+        }
+
+        /**
+            Encode a bit with an adaptive probability.
+
+            @param probability The probability that the bit is zero. Updated to adapt to the bit value encoded.
+            @param bit The bit value to encode. Zero or one.
+         */
+
+        void EncodeBit( uint16_t & probability, uint32_t bit )
+        {
+            assert( bit <= 1 );
+
+            const uint32_t bound = ( m_range >> RangeProbabilityBits ) * probability;
+
+            if ( bit == 0 )
+            {
+                m_range = bound;
+                probability += ( ( 1 << RangeProbabilityBits ) - probability ) >> RangeProbabilityShift;
+            }
+            else
+            {
+                m_low += bound;
+                m_range -= bound;
+                probability -= probability >> RangeProbabilityShift;
+            }
+
+            while ( m_range < ( 1U << 24 ) )
+            {
+                m_range <<= 8;
+                ShiftLow();
+            }
+        }
+
+        /**
+            Encode bits with a fixed probability of one half.
+
+            This is for bits that are effectively random, where an adaptive probability would gain nothing. Each bit costs exactly one bit.
+
+            @param value The value to encode. Bits are encoded from most significant to least significant.
+            @param bits The number of bits to encode in [1,32].
+         */
+
+        void EncodeDirectBits( uint32_t value, int bits )
+        {
+            assert( bits > 0 );
+            assert( bits <= 32 );
+
+            for ( int i = bits - 1; i >= 0; --i )
+            {
+                m_range >>= 1;
+
+                if ( ( value >> i ) & 1 )
+                    m_low += m_range;
+
+                while ( m_range < ( 1U << 24 ) )
+                {
+                    m_range <<= 8;
+                    ShiftLow();
+                }
+            }
+        }
+
+        /**
+            Flush the encoder state to memory.
+
+            Call this once, after you finish encoding. The decoder needs these bytes to decode the last few bits.
+         */
+
+        void Flush()
+        {
+            for ( int i = 0; i < 5; ++i )
+                ShiftLow();
+        }
+
+        /**
+            Did the encoded data run past the end of the buffer?
+
+            @returns True if the buffer is too small for the data encoded. Encoded data past the end of the buffer is lost.
+         */
+
+        bool IsOverflow() const
+        {
+            return m_overflow;
+        }
+
+        /**
+            How many bytes have been written to the buffer?
+
+            @returns The number of bytes written. After RangeEncoder::Flush, this is the size of the encoded data.
+         */
+
+        int GetBytesWritten() const
+        {
+            return m_bytesWritten;
+        }
+
+        /**
+            Get an upper bound for the number of bits encoded so far.
+
+            This includes bytes that are still pending in the encoder state, so it's the size the encoded data would be if it was flushed right now.
+
+            @returns The number of bits the encoded data would take up if flushed now.
+         */
+
+        int GetBitsWritten() const
+        {
+            return ( m_bytesWritten + int( m_cacheSize ) + 4 - ( m_first ? 1 : 0 ) ) * 8;
+        }
+
+        /**
+            Get a pointer to the encoded data.
+
+            @returns A pointer to the buffer passed in to the constructor.
+         */
+
+        const uint8_t * GetData() const
+        {
+            return m_data;
+        }
+
+    private:
+
+        void ShiftLow()
+        {
+            // IMPORTANT: A run of 0xFF bytes is held back in the cache until we know whether a carry is going to propagate through it.
+
+            if ( uint32_t( m_low ) < 0xFF000000U || ( m_low >> 32 ) != 0 )
+            {
+                const uint8_t carry = uint8_t( m_low >> 32 );
+                uint8_t value = m_cache;
+                do
+                {
+                    WriteByte( uint8_t( value + carry ) );
+                    value = 0xFF;
+                }
+                while ( --m_cacheSize != 0 );
+                m_cache = uint8_t( m_low >> 24 );
+            }
+
+            m_cacheSize++;
+            m_low = ( m_low & 0x00FFFFFF ) << 8;
+        }
+
+        void WriteByte( uint8_t value )
+        {
+            if ( m_first )
+            {
+                assert( value == 0 );
+                m_first = false;
+                return;
+            }
+
+            if ( m_bytesWritten >= m_numBytes )
+            {
+                m_overflow = true;
+                return;
+            }
+
+            m_data[m_bytesWritten++] = value;
+        }
+
+        uint8_t * m_data;                                   ///< The buffer we are writing to.
+        int m_numBytes;                                     ///< The size of the buffer in bytes.
+        int m_bytesWritten;                                 ///< The number of bytes written to the buffer so far.
+        uint64_t m_low;                                     ///< The low end of the current range. Bit 32 is the carry into the bytes held back in the cache.
+        uint32_t m_range;                                   ///< The size of the current range. Kept at or above 2^24 by normalization.
+        uint8_t m_cache;                                    ///< The byte waiting to be written, in case a carry propagates into it.
+        uint32_t m_cacheSize;                               ///< The number of bytes held back: the cache byte plus any 0xFF bytes following it.
+        bool m_first;                                       ///< True until the first byte is output. The first byte is always zero, so it is never written.
+        bool m_overflow;                                    ///< True if we tried to write past the end of the buffer.
+    };
+
+    /**
+        Binary range decoder.
+
+        Decodes bits written by RangeEncoder. The decoder must be fed exactly the same sequence of probabilities the encoder used, otherwise it decodes garbage.
+
+        Reads past the end of the buffer are detected. They return zero bytes and set the overflow flag, so corrupt data can't read out of bounds.
+
+        @see RangeEncoder
+        @see RangeDecodeStream
+     */
+
+    class RangeDecoder
+    {
+    public:
+
+        /**
+            Range decoder constructor.
+
+            @param data Pointer to the encoded data.
+            @param bytes The size of the encoded data in bytes.
+         */
+
+        RangeDecoder( const uint8_t * data, int bytes ) : m_data( data ), m_numBytes( bytes )
+        {
+            assert( data );
+            assert( bytes >= 0 );
+            m_bytesRead = 0;
+            m_range = 0xFFFFFFFF;
+            m_code = 0;
+            m_overflow = false;
+            for ( int i = 0; i < 4; ++i )
+                m_code = ( m_code << 8 ) | ReadByte();
+        }
+
+        /**
+            Decode a bit with an adaptive probability.
+
+            @param probability The probability that the bit is zero. Updated exactly the same way as RangeEncoder::EncodeBit.
+
+            @returns The bit value decoded. Zero or one.
+         */
+
+        uint32_t DecodeBit( uint16_t & probability )
+        {
+            const uint32_t bound = ( m_range >> RangeProbabilityBits ) * probability;
+
+            uint32_t bit;
+
+            if ( m_code < bound )
+            {
+                m_range = bound;
+                probability += ( ( 1 << RangeProbabilityBits ) - probability ) >> RangeProbabilityShift;
+                bit = 0;
+            }
+            else
+            {
+                m_code -= bound;
+                m_range -= bound;
+                probability -= probability >> RangeProbabilityShift;
+                bit = 1;
+            }
+
+            while ( m_range < ( 1U << 24 ) )
+            {
+                m_range <<= 8;
+                m_code = ( m_code << 8 ) | ReadByte();
+            }
+
+            return bit;
+        }
+
+        /**
+            Decode bits with a fixed probability of one half.
+
+            @param bits The number of bits to decode in [1,32].
+
+            @returns The value decoded.
+
+            @see RangeEncoder::EncodeDirectBits
+         */
+
+        uint32_t DecodeDirectBits( int bits )
+        {
+            assert( bits > 0 );
+            assert( bits <= 32 );
+
+            uint32_t value = 0;
+
+            for ( int i = 0; i < bits; ++i )
+            {
+                m_range >>= 1;
+
+                uint32_t bit = 0;
+
+                if ( m_code >= m_range )
+                {
+                    m_code -= m_range;
+                    bit = 1;
+                }
+
+                value = ( value << 1 ) | bit;
+
+                while ( m_range < ( 1U << 24 ) )
+                {
+                    m_range <<= 8;
+                    m_code = ( m_code << 8 ) | ReadByte();
+                }
+            }
+
+            return value;
+        }
+
+        /**
+            Did the decoder try to read past the end of the buffer?
+
+            @returns True if the decoder ran out of data. Any bits decoded since then are garbage.
+         */
+
+        bool IsOverflow() const
+        {
+            return m_overflow;
+        }
+
+        /**
+            How many bytes have been read from the buffer?
+
+            @returns The number of bytes read so far.
+         */
+
+        int GetBytesRead() const
+        {
+            return m_bytesRead;
+        }
+
+    private:
+
+        uint8_t ReadByte()
+        {
+            if ( m_bytesRead >= m_numBytes )
+            {
+                m_overflow = true;
+                return 0;
+            }
+
+            return m_data[m_bytesRead++];
+        }
+
+        const uint8_t * m_data;                             ///< The encoded data we are reading.
+        int m_numBytes;                                     ///< The size of the encoded data in bytes.
+        int m_bytesRead;                                    ///< The number of bytes read so far.
+        uint32_t m_range;                                   ///< The size of the current range. Mirrors the encoder range.
+        uint32_t m_code;                                    ///< The encoded value, relative to the low end of the current range.
+        bool m_overflow;                                    ///< True if we tried to read past the end of the buffer.
+    };
 }
 
 #endif // #ifndef YOJIMBO_BITPACK_H
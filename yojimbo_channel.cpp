@@ -28,12 +28,19 @@
 
 namespace yojimbo
 {
-    void ChannelPacketData::Initialize()
+    void ChannelPacketData::Initialize( Allocator * packetAllocator )
     {
+        allocator = packetAllocator;
         channelId = 0;
         blockMessage = 0;
         messageFailedToSerialize = 0;
+        snapshotMessage = 0;
+        blockCacheReply = 0;
+        blockCacheHit = 0;
+        blockCacheMessageId = 0;
+        sendTime = 0;
         message.numMessages = 0;
+        message.messageIds = NULL;
         initialized = 1;
     }
 
@@ -41,9 +48,13 @@ namespace yojimbo
     {
         assert( initialized );
 
-        Allocator & allocator = messageFactory.GetAllocator();
+        Allocator & allocator = GetAllocator( messageFactory );
 
-        if ( !blockMessage )
+        if ( snapshotMessage )
+        {
+            YOJIMBO_FREE( allocator, snapshot.data );
+        }
+        else if ( !blockMessage )
         {
             if ( message.numMessages > 0 )
             {
@@ -66,16 +77,131 @@ namespace yojimbo
                 block.message = NULL;
             }
 
-            YOJIMBO_FREE( allocator, block.fragmentData );
+            if ( block.messages.numMessages > 0 )
+            {
+                for ( int i = 0; i < block.messages.numMessages; ++i )
+                {
+                    if ( block.messages.messages[i] )
+                    {
+                        messageFactory.Release( block.messages.messages[i] );
+                    }
+                }
+
+                YOJIMBO_FREE( allocator, block.messages.messages );
+            }
+
+            if ( block.ownsFragmentData )
+            {
+                YOJIMBO_FREE( allocator, block.fragmentData );
+            }
         }
 
         initialized = 0;
     }
 
-    template <typename Stream> bool SerializeOrderedMessages( Stream & stream, MessageFactory & messageFactory, int & numMessages, Message ** & messages, int maxMessagesPerPacket )
+    template <typename Stream> bool SerializeCachedMessage( Stream & stream, const Message * message )
+    {
+        assert( Stream::IsWriting );
+        assert( message->GetSerializedData() );
+
+        // IMPORTANT: the stream is byte aligned here, so whole bytes of the cached bits are copied as-is
+
+        uint8_t * data = (uint8_t*) message->GetSerializedData();
+
+        const int bits = message->GetSerializedBits();
+
+        const int bytes = bits / 8;
+
+        if ( bytes > 0 )
+            serialize_bytes( stream, data, bytes );
+
+        const int remainderBits = bits - bytes * 8;
+
+        if ( remainderBits > 0 )
+        {
+            uint32_t value = data[bytes] & ( ( 1 << remainderBits ) - 1 );
+            serialize_bits( stream, value, remainderBits );
+        }
+
+        return true;
+    }
+
+    // IMPORTANT: with ChannelConfig::skipDiscardedMessages, each message is prefixed with its size in bits so the receiver can skip over it. The size is written as zero, then overwritten once the message has been written
+
+    static int GetMessageSizeBits( const ChannelConfig & channelConfig )
+    {
+        return channelConfig.skipDiscardedMessages ? bits_required( 0, channelConfig.packetBudget * 8 ) : 0;
+    }
+
+    static bool FinishMessageSize( WriteStream & stream, int sizeStartBits, int messageBits, int sizeBits )
+    {
+        (void) messageBits;
+        const int bits = stream.GetBitsProcessed() - sizeStartBits - sizeBits;
+        assert( bits >= 0 );
+        assert( uint64_t( bits ) < ( uint64_t(1) << sizeBits ) );
+        stream.OverwriteBits( sizeStartBits, uint32_t( bits ), sizeBits );
+        return true;
+    }
+
+    static bool FinishMessageSize( ReadStream & stream, int sizeStartBits, int messageBits, int sizeBits )
+    {
+        return stream.GetBitsProcessed() - sizeStartBits - sizeBits == messageBits;
+    }
+
+    static bool FinishMessageSize( MeasureStream & stream, int sizeStartBits, int messageBits, int sizeBits )
+    {
+        (void) stream;
+        (void) sizeStartBits;
+        (void) messageBits;
+        (void) sizeBits;
+        return true;
+    }
+
+    static bool SkipMessage( ReadStream & stream, int messageBits )
+    {
+        return stream.SkipBits( messageBits );
+    }
+
+    static bool SkipMessage( WriteStream & stream, int messageBits )
+    {
+        (void) stream;
+        (void) messageBits;
+        return false;
+    }
+
+    static bool SkipMessage( MeasureStream & stream, int messageBits )
     {
-        const int maxMessageType = messageFactory.GetNumTypes() - 1;
+        (void) stream;
+        (void) messageBits;
+        return false;
+    }
+
+    static void RemoveDiscardedMessages( Allocator & allocator, int & numMessages, Message ** & messages, uint16_t * messageIds, const bool * discarded )
+    {
+        int numKept = 0;
+
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            if ( discarded[i] )
+                continue;
+
+            messages[numKept] = messages[i];
+            if ( messageIds )
+                messageIds[numKept] = messageIds[i];
+            numKept++;
+        }
+
+        numMessages = numKept;
+
+        if ( numMessages == 0 )
+        {
+            YOJIMBO_FREE( allocator, messages );
+            messages = NULL;
+        }
+    }
 
+    template <typename Stream> bool SerializeOrderedMessages( Stream & stream, MessageFactory & messageFactory, Allocator & allocator, int & numMessages, Message ** & messages, uint16_t * & sendMessageIds, int maxMessagesPerPacket, int maxAggregateMessages, bool cacheSerializedMessages, bool expireMessages, int messageSizeBits, const Channel * channel, uint64_t * messageTypeBits )
+    {
         bool hasMessages = Stream::IsWriting && numMessages != 0;
 
         serialize_bool( stream, hasMessages );
@@ -97,16 +223,17 @@ namespace yojimbo
 
                 for ( int i = 0; i < numMessages; ++i )
                 {
-                    assert( messages[i] );
-                    messageTypes[i] = messages[i]->GetType();
-                    messageIds[i] = messages[i]->GetId();
+                    // IMPORTANT: expired messages have no message, only an id
+
+                    assert( messages[i] || ( expireMessages && sendMessageIds ) );
+                    messageTypes[i] = messages[i] ? messages[i]->GetType() : 0;
+                    messageIds[i] = sendMessageIds ? sendMessageIds[i] : messages[i]->GetId();
                 }
             }
             else
             {
-                Allocator & allocator = messageFactory.GetAllocator();
-
-                messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
+                messages = (Message**) YOJIMBO_ALLOCATE( allocator, ( sizeof( Message* ) + sizeof( uint16_t ) ) * numMessages );
+                sendMessageIds = (uint16_t*) ( messages + numMessages );
 
                 for ( int i = 0; i < numMessages; ++i )
                 {
@@ -119,20 +246,62 @@ namespace yojimbo
             for ( int i = 1; i < numMessages; ++i )
                 serialize_sequence_relative( stream, messageIds[i-1], messageIds[i] );
 
+            if ( Stream::IsReading )
+                memcpy( sendMessageIds, messageIds, sizeof( uint16_t ) * numMessages );
+
+            bool * discarded = (bool*) alloca( sizeof( bool ) * numMessages );
+
+            memset( discarded, 0, sizeof( bool ) * numMessages );
+
+            int numDiscarded = 0;
+
             for ( int i = 0; i < numMessages; ++i )
             {
-                if ( maxMessageType > 0 )
+                const int messageStartBits = stream.GetBitsProcessed();
+
+                if ( expireMessages )
                 {
-                    serialize_int( stream, messageTypes[i], 0, maxMessageType );
+                    bool expired = Stream::IsWriting && messages[i] == NULL;
+
+                    serialize_bool( stream, expired );
+
+                    if ( expired )
+                        continue;
                 }
-                else
+
+                const int messageSizeStartBits = stream.GetBitsProcessed();
+
+                int messageBits = 0;
+
+                if ( messageSizeBits > 0 )
                 {
-                    messageTypes[i] = 0;
+                    serialize_bits( stream, messageBits, messageSizeBits );
+
+                    if ( Stream::IsReading && channel && channel->WillDiscardMessage( messageIds[i] ) )
+                    {
+                        if ( !SkipMessage( stream, messageBits ) )
+                            return false;
+
+                        discarded[i] = true;
+                        numDiscarded++;
+                        continue;
+                    }
                 }
 
+                if ( !messageFactory.SerializeType( stream, messageTypes[i] ) )
+                    return false;
+
+                bool aggregate = Stream::IsWriting && messages[i]->IsAggregateMessage();
+
+                if ( maxAggregateMessages > 1 )
+                    serialize_bool( stream, aggregate );
+
                 if ( Stream::IsReading )
                 {
-                    messages[i] = messageFactory.Create( messageTypes[i] );
+                    if ( aggregate )
+                        messages[i] = messageFactory.CreateAggregate( messageTypes[i], maxAggregateMessages );
+                    else
+                        messages[i] = messageFactory.Create( messageTypes[i] );
 
                     if ( !messages[i] )
                     {
@@ -145,11 +314,43 @@ namespace yojimbo
 
                 assert( messages[i] );
 
-                if ( !messages[i]->SerializeInternal( stream ) )
+                bool cached = false;
+
+                if ( cacheSerializedMessages )
+                {
+                    serialize_align( stream );
+
+                    if ( Stream::IsWriting && messages[i]->GetSerializedData() )
+                    {
+                        if ( !SerializeCachedMessage( stream, messages[i] ) )
+                            return false;
+
+                        cached = true;
+                    }
+                }
+
+                if ( !cached && !messageFactory.SerializeMessage( messages[i], stream ) )
                 {
                     debug_printf( "error: failed to serialize message of type %d (SerializeOrderedMessages)\n", messageTypes[i] );
                     return false;
                 }
+
+                if ( messageSizeBits > 0 && !FinishMessageSize( stream, messageSizeStartBits, messageBits, messageSizeBits ) )
+                {
+                    debug_printf( "error: message of type %d does not match its size (SerializeOrderedMessages)\n", messageTypes[i] );
+                    return false;
+                }
+
+                if ( messageTypeBits )
+                    messageTypeBits[messageTypes[i]] += stream.GetBitsProcessed() - messageStartBits;
+            }
+
+            if ( Stream::IsReading && numDiscarded > 0 )
+            {
+                RemoveDiscardedMessages( allocator, numMessages, messages, sendMessageIds, discarded );
+
+                if ( !messages )
+                    sendMessageIds = NULL;
             }
         }
 
@@ -185,10 +386,8 @@ namespace yojimbo
         return true;
     }
 
-    template <typename Stream> bool SerializeUnorderedMessages( Stream & stream, MessageFactory & messageFactory, int & numMessages, Message ** & messages, int maxMessagesPerPacket, int maxBlockSize )
+    template <typename Stream> bool SerializeUnorderedMessages( Stream & stream, MessageFactory & messageFactory, Allocator & allocator, int & numMessages, Message ** & messages, int maxMessagesPerPacket, int maxBlockSize, bool redundant, int messageSizeBits, const Channel * channel, uint64_t * messageTypeBits )
     {
-        const int maxMessageType = messageFactory.GetNumTypes() - 1;
-
         bool hasMessages = Stream::IsWriting && numMessages != 0;
 
         serialize_bool( stream, hasMessages );
@@ -213,25 +412,61 @@ namespace yojimbo
             }
             else
             {
-                Allocator & allocator = messageFactory.GetAllocator();
-
                 messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
 
                 for ( int i = 0; i < numMessages; ++i )
                     messages[i] = NULL;
             }
 
-            for ( int i = 0; i < numMessages; ++i )
+            // IMPORTANT: with redundancy, messages carry ids so the receiver can drop copies it already has. The ids in a packet are always consecutive
+
+            uint16_t firstMessageId = 0;
+
+            if ( redundant )
             {
-                if ( maxMessageType > 0 )
+                if ( Stream::IsWriting )
                 {
-                    serialize_int( stream, messageTypes[i], 0, maxMessageType );
+                    firstMessageId = messages[0]->GetId();
+
+                    for ( int i = 1; i < numMessages; ++i )
+                        assert( messages[i]->GetId() == uint16_t( firstMessageId + i ) );
                 }
-                else
+
+                serialize_bits( stream, firstMessageId, 16 );
+            }
+
+            bool * discarded = (bool*) alloca( sizeof( bool ) * numMessages );
+
+            memset( discarded, 0, sizeof( bool ) * numMessages );
+
+            int numDiscarded = 0;
+
+            for ( int i = 0; i < numMessages; ++i )
+            {
+                const int messageStartBits = stream.GetBitsProcessed();
+
+                const int messageSizeStartBits = stream.GetBitsProcessed();
+
+                int messageBits = 0;
+
+                if ( messageSizeBits > 0 )
                 {
-                    messageTypes[i] = 0;
+                    serialize_bits( stream, messageBits, messageSizeBits );
+
+                    if ( Stream::IsReading && channel && channel->WillDiscardMessage( uint16_t( firstMessageId + i ) ) )
+                    {
+                        if ( !SkipMessage( stream, messageBits ) )
+                            return false;
+
+                        discarded[i] = true;
+                        numDiscarded++;
+                        continue;
+                    }
                 }
 
+                if ( !messageFactory.SerializeType( stream, messageTypes[i] ) )
+                    return false;
+
                 if ( Stream::IsReading )
                 {
                     messages[i] = messageFactory.Create( messageTypes[i] );
@@ -241,35 +476,66 @@ namespace yojimbo
                         debug_printf( "error: failed to create message type %d (SerializeUnorderedMessages)\n", messageTypes[i] );
                         return false;
                     }
+
+                    if ( redundant )
+                        messages[i]->SetId( uint16_t( firstMessageId + i ) );
                 }
 
                 assert( messages[i] );
 
-                if ( !messages[i]->SerializeInternal( stream ) )
+                bool cached = false;
+
+                if ( redundant && !messages[i]->IsBlockMessage() )
                 {
-                    debug_printf( "error: failed to serialize message type %d (SerializeUnorderedMessages)\n", messageTypes[i] );
-                    return false;
+                    serialize_align( stream );
+
+                    if ( Stream::IsWriting && messages[i]->GetSerializedData() )
+                    {
+                        if ( !SerializeCachedMessage( stream, messages[i] ) )
+                            return false;
+
+                        cached = true;
+                    }
                 }
 
-                if ( messages[i]->IsBlockMessage() )
+                if ( !cached )
                 {
-                    BlockMessage * blockMessage = (BlockMessage*) messages[i];
-                    if ( !SerializeMessageBlock( stream, messageFactory, blockMessage, maxBlockSize ) )
+                    if ( !messageFactory.SerializeMessage( messages[i], stream ) )
                     {
-                        debug_printf( "error: failed to serialize message block (SerializeUnorderedMessages)\n" );
+                        debug_printf( "error: failed to serialize message type %d (SerializeUnorderedMessages)\n", messageTypes[i] );
                         return false;
                     }
+
+                    if ( messages[i]->IsBlockMessage() )
+                    {
+                        BlockMessage * blockMessage = (BlockMessage*) messages[i];
+                        if ( !SerializeMessageBlock( stream, messageFactory, blockMessage, maxBlockSize ) )
+                        {
+                            debug_printf( "error: failed to serialize message block (SerializeUnorderedMessages)\n" );
+                            return false;
+                        }
+                    }
+                }
+
+                if ( messageSizeBits > 0 && !FinishMessageSize( stream, messageSizeStartBits, messageBits, messageSizeBits ) )
+                {
+                    debug_printf( "error: message type %d does not match its size (SerializeUnorderedMessages)\n", messageTypes[i] );
+                    return false;
                 }
+
+                if ( messageTypeBits )
+                    messageTypeBits[messageTypes[i]] += stream.GetBitsProcessed() - messageStartBits;
             }
+
+            if ( Stream::IsReading && numDiscarded > 0 )
+                RemoveDiscardedMessages( allocator, numMessages, messages, NULL, discarded );
         }
 
         return true;
     }
 
-    template <typename Stream> bool SerializeBlockFragment( Stream & stream, MessageFactory & messageFactory, ChannelPacketData::BlockData & block, const ChannelConfig & channelConfig )
+    template <typename Stream> bool SerializeBlockFragment( Stream & stream, MessageFactory & messageFactory, Allocator & allocator, ChannelPacketData::BlockData & block, const ChannelConfig & channelConfig )
     {
-        const int maxMessageType = messageFactory.GetNumTypes() - 1;
-
         serialize_bits( stream, block.messageId, 16 );
 
         serialize_int( stream, block.numFragments, 1, channelConfig.GetMaxFragmentsPerBlock() );
@@ -283,11 +549,26 @@ namespace yojimbo
             block.fragmentId = 0;
         }
 
-        serialize_int( stream, block.fragmentSize, 1, channelConfig.fragmentSize );
+        const int maxPacketFragments = min( channelConfig.maxBlockFragmentsPerPacket, int( block.numFragments - block.fragmentId ) );
+
+        if ( maxPacketFragments > 1 )
+        {
+            serialize_int( stream, block.numPacketFragments, 1, maxPacketFragments );
+        }
+        else
+        {
+            block.numPacketFragments = 1;
+        }
+
+        // IMPORTANT: Only the last fragment in the packet may be smaller than the fragment size.
+
+        serialize_int( stream, block.fragmentSize, ( block.numPacketFragments - 1 ) * channelConfig.fragmentSize + 1, block.numPacketFragments * channelConfig.fragmentSize );
 
         if ( Stream::IsReading )
         {
-            block.fragmentData = (uint8_t*) YOJIMBO_ALLOCATE( messageFactory.GetAllocator(), block.fragmentSize );
+            block.fragmentData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, block.fragmentSize );
+
+            block.ownsFragmentData = true;
 
             if ( !block.fragmentData )
             {
@@ -300,9 +581,24 @@ namespace yojimbo
 
         if ( block.fragmentId == 0 )
         {
+            // compressed blocks send the size of the block once decompressed, so the receiver can allocate it up front
+
+            if ( channelConfig.compressBlocks )
+            {
+                serialize_bool( stream, block.compressed );
+
+                if ( block.compressed )
+                    serialize_int( stream, block.blockSize, 1, channelConfig.maxBlockSize );
+            }
+            else if ( Stream::IsReading )
+            {
+                block.compressed = false;
+            }
+
             // block message
 
-            serialize_int( stream, block.messageType, 0, maxMessageType );
+            if ( !messageFactory.SerializeType( stream, block.messageType ) )
+                return false;
 
             if ( Stream::IsReading )
             {
@@ -325,7 +621,7 @@ namespace yojimbo
 
             assert( block.message );
 
-            if ( !block.message->SerializeInternal( stream ) )
+            if ( !messageFactory.SerializeMessage( block.message, stream ) )
             {
                 debug_printf( "error: failed to serialize block message of type %d (SerializeBlockFragment)\n", block.messageType );
                 return false;
@@ -334,127 +630,400 @@ namespace yojimbo
         else
         {
             if ( Stream::IsReading )
+            {
                 block.message = NULL;
+                block.compressed = false;
+            }
         }
 
         return true;
     }
 
-    template <typename Stream> bool ChannelPacketData::Serialize( Stream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels )
+    template <typename Stream> bool SerializeBlockAnnounce( Stream & stream, MessageFactory & messageFactory, ChannelPacketData::BlockData & block, const ChannelConfig & channelConfig )
     {
-        assert( initialized );
+        if ( Stream::IsReading )
+        {
+            block.message = NULL;
+            block.fragmentData = NULL;
+            block.ownsFragmentData = false;
+            block.fragmentId = 0;
+            block.numPacketFragments = 0;
+            block.fragmentSize = 0;
+            block.compressed = false;
+        }
 
-#if YOJIMBO_VALIDATE_PACKET_BUDGET
-        int startBits = stream.GetBitsProcessed();
-#endif // #if YOJIMBO_VALIDATE_PACKET_BUDGET
+        serialize_bits( stream, block.messageId, 16 );
 
-        if ( numChannels > 1 )
-            serialize_int( stream, channelId, 0, numChannels - 1 );
-        else
-            channelId = 0;
+        serialize_int( stream, block.blockSize, 1, channelConfig.maxBlockSize );
 
-        const ChannelConfig & channelConfig = channelConfigs[channelId];
+        serialize_uint64( stream, block.blockHash );
 
-        serialize_bool( stream, blockMessage );
+        if ( Stream::IsReading )
+            block.numFragments = ( block.blockSize + channelConfig.fragmentSize - 1 ) / channelConfig.fragmentSize;
 
-        if ( !blockMessage )
+        if ( !messageFactory.SerializeType( stream, block.messageType ) )
+            return false;
+
+        if ( Stream::IsReading )
         {
-            switch ( channelConfig.type )
-            {
-                case CHANNEL_TYPE_RELIABLE_ORDERED:
-                {
-                    if ( !SerializeOrderedMessages( stream, messageFactory, message.numMessages, message.messages, channelConfig.maxMessagesPerPacket ) )
-                    {
-                        messageFailedToSerialize = 1;
-                        return true;
-                    }
-                }
-                break;
+            Message * msg = messageFactory.Create( block.messageType );
 
-                case CHANNEL_TYPE_UNRELIABLE_UNORDERED:
-                {
-                    if ( !SerializeUnorderedMessages( stream, messageFactory, message.numMessages, message.messages, channelConfig.maxMessagesPerPacket, channelConfig.maxBlockSize ) )
-                    {
-                        messageFailedToSerialize = 1;
-                        return true;
-                    }
-                }
-                break;
+            if ( !msg )
+            {
+                debug_printf( "error: failed to create block message type %d (SerializeBlockAnnounce)\n", block.messageType );
+                return false;
             }
 
-#if YOJIMBO_VALIDATE_PACKET_BUDGET
-            if ( channelConfig.packetBudget > 0 )
+            if ( !msg->IsBlockMessage() )
             {
-                assert( stream.GetBitsProcessed() - startBits <= channelConfig.packetBudget * 8 );
+                debug_printf( "error: received block announcement for non-block message (SerializeBlockAnnounce)\n" );
+                messageFactory.Release( msg );
+                return false;
             }
-#endif // #if YOJIMBO_VALIDATE_PACKET_BUDGET
+
+            block.message = (BlockMessage*) msg;
         }
-        else
-        {
-            if ( channelConfig.disableBlocks )
-                return false;
 
-            if ( !SerializeBlockFragment( stream, messageFactory, block, channelConfig ) )
-                return false;
+        assert( block.message );
+
+        if ( !messageFactory.SerializeMessage( block.message, stream ) )
+        {
+            debug_printf( "error: failed to serialize block message of type %d (SerializeBlockAnnounce)\n", block.messageType );
+            return false;
         }
 
         return true;
     }
 
-    bool ChannelPacketData::SerializeInternal( ReadStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels )
+    template <typename Stream> bool SerializeSnapshot( Stream & stream, MessageFactory & messageFactory, Allocator & allocator, ChannelPacketData::SnapshotData & snapshot, const ChannelConfig & channelConfig )
     {
-        return Serialize( stream, messageFactory, channelConfigs, numChannels );
-    }
+        serialize_bits( stream, snapshot.snapshotId, 16 );
 
-    bool ChannelPacketData::SerializeInternal( WriteStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels )
-    {
-        return Serialize( stream, messageFactory, channelConfigs, numChannels );
-    }
+        serialize_bool( stream, snapshot.hasBaseline );
 
-    bool ChannelPacketData::SerializeInternal( MeasureStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels )
-    {
-        return Serialize( stream, messageFactory, channelConfigs, numChannels );
-    }
+        if ( snapshot.hasBaseline )
+            serialize_ack_relative( stream, snapshot.snapshotId, snapshot.baselineId );
 
-    // ------------------------------------------------------------------------------------
+        if ( !messageFactory.SerializeType( stream, snapshot.messageType ) )
+            return false;
 
-    Channel::Channel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId ) : m_config( config )
-    {
-        assert( channelId >= 0 );
-        assert( channelId < MaxChannels );
+        serialize_varint( stream, snapshot.bits );
 
-        m_channelId = channelId;
+        const int bytes = ( ( snapshot.bits + 31 ) / 32 ) * 4;
 
-        m_allocator = &allocator;
+        if ( Stream::IsReading )
+        {
+            // IMPORTANT: the message can't be bigger than the packet budget, or the block size if there is no budget. Don't let a bad packet allocate more than that
 
-        m_messageFactory = &messageFactory;
+            const int maxBits = channelConfig.packetBudget > 0 ? channelConfig.packetBudget * 8 : channelConfig.maxBlockSize * 8;
 
-        m_listener = NULL;
+            if ( snapshot.bits < 0 || snapshot.bits > maxBits )
+                return false;
 
-        m_error = CHANNEL_ERROR_NONE;
+            if ( bytes > 0 )
+            {
+                snapshot.data = (uint8_t*) YOJIMBO_ALLOCATE( allocator, bytes );
+                if ( !snapshot.data )
+                {
+                    debug_printf( "error: failed to allocate snapshot data (SerializeSnapshot)\n" );
+                    return false;
+                }
+            }
 
-        m_time = 0.0;
+            BitWriter writer( snapshot.data, bytes );
 
-        ResetCounters();
-    }
+            int bits = snapshot.bits;
 
-    uint64_t Channel::GetCounter( int index ) const
-    {
-        assert( index >= 0 );
-        assert( index < CHANNEL_COUNTER_NUM_COUNTERS );
-        return m_counters[index];
-    }
+            while ( bits > 0 )
+            {
+                const int n = bits < 32 ? bits : 32;
+                uint32_t value = 0;
+                serialize_bits( stream, value, n );
+                writer.WriteBits( value, n );
+                bits -= n;
+            }
 
-    void Channel::ResetCounters() 
-    { 
-        memset( m_counters, 0, sizeof( m_counters ) ); 
-    }
+            writer.FlushBits();
+        }
+        else
+        {
+            BitReader reader( snapshot.data, bytes );
+
+            int bits = snapshot.bits;
+
+            while ( bits > 0 )
+            {
+                const int n = bits < 32 ? bits : 32;
+                uint32_t value = reader.ReadBits( n );
+                serialize_bits( stream, value, n );
+                bits -= n;
+            }
+        }
+
+        return true;
+    }
+
+    template <typename Stream> bool ChannelPacketData::Serialize( Stream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, PacketBitCounters * bitCounters, bool implicitChannelId, const Channel * const * channels )
+    {
+        assert( initialized );
+
+        const int startBits = stream.GetBitsProcessed();
+
+        uint64_t * messageTypeBits = ( Stream::IsWriting && bitCounters ) ? bitCounters->messageTypeBits : NULL;
+
+        if ( implicitChannelId )
+        {
+            if ( (int) channelId >= numChannels )
+                return false;
+        }
+        else if ( numChannels > 1 )
+        {
+            serialize_int( stream, channelId, 0, numChannels - 1 );
+        }
+        else
+        {
+            channelId = 0;
+        }
+
+        const ChannelConfig & channelConfig = channelConfigs[channelId];
+
+        const int messageSizeBits = GetMessageSizeBits( channelConfig );
+
+        const Channel * channel = ( Stream::IsReading && channels ) ? channels[channelId] : NULL;
+
+        serialize_bool( stream, blockMessage );
+
+        if ( channelConfig.type == CHANNEL_TYPE_RELIABLE_ORDERED && channelConfig.blockCache )
+        {
+            serialize_bool( stream, blockCacheReply );
+
+            if ( blockCacheReply )
+            {
+                serialize_bits( stream, blockCacheMessageId, 16 );
+                serialize_bool( stream, blockCacheHit );
+            }
+        }
+
+        if ( !blockMessage )
+        {
+            switch ( channelConfig.type )
+            {
+                case CHANNEL_TYPE_RELIABLE_ORDERED:
+                {
+                    if ( !SerializeOrderedMessages( stream, messageFactory, GetAllocator( messageFactory ), message.numMessages, message.messages, message.messageIds, channelConfig.maxMessagesPerPacket, channelConfig.maxAggregateMessages, channelConfig.cacheSerializedMessages, channelConfig.expireMessages, messageSizeBits, channel, messageTypeBits ) )
+                    {
+                        messageFailedToSerialize = 1;
+                        return true;
+                    }
+                }
+                break;
+
+                case CHANNEL_TYPE_UNRELIABLE_UNORDERED:
+                case CHANNEL_TYPE_UNRELIABLE_SEQUENCED:
+                case CHANNEL_TYPE_UNRELIABLE_LATEST_STATE:
+                {
+                    if ( channelConfig.playoutBuffer )
+                        serialize_bits( stream, sendTime, 16 );
+
+                    if ( !SerializeUnorderedMessages( stream, messageFactory, GetAllocator( messageFactory ), message.numMessages, message.messages, channelConfig.maxMessagesPerPacket, channelConfig.maxBlockSize, channelConfig.redundancyWindow > 1, messageSizeBits, channel, messageTypeBits ) )
+                    {
+                        messageFailedToSerialize = 1;
+                        return true;
+                    }
+                }
+                break;
+
+                case CHANNEL_TYPE_SNAPSHOT:
+                {
+                    if ( Stream::IsReading )
+                    {
+                        snapshotMessage = 1;
+                        snapshot.data = NULL;
+                        snapshot.bits = 0;
+                    }
+
+                    const int snapshotStartBits = stream.GetBitsProcessed();
+
+                    if ( !SerializeSnapshot( stream, messageFactory, GetAllocator( messageFactory ), snapshot, channelConfig ) )
+                    {
+                        messageFailedToSerialize = 1;
+                        return true;
+                    }
+
+                    if ( messageTypeBits )
+                        messageTypeBits[snapshot.messageType] += stream.GetBitsProcessed() - snapshotStartBits;
+                }
+                break;
+            }
+
+#if YOJIMBO_VALIDATE_PACKET_BUDGET
+            if ( channelConfig.packetBudget > 0 )
+            {
+                assert( stream.GetBitsProcessed() - startBits <= channelConfig.packetBudget * 8 );
+            }
+#endif // #if YOJIMBO_VALIDATE_PACKET_BUDGET
+        }
+        else
+        {
+            if ( channelConfig.disableBlocks || channelConfig.type == CHANNEL_TYPE_SNAPSHOT )
+                return false;
+
+            const int fragmentStartBits = stream.GetBitsProcessed();
+
+            if ( Stream::IsReading )
+            {
+                block.messages.numMessages = 0;
+                block.messages.messages = NULL;
+                block.messages.messageIds = NULL;
+            }
+
+            if ( channelConfig.type == CHANNEL_TYPE_RELIABLE_ORDERED && channelConfig.blockCache )
+            {
+                serialize_bool( stream, block.announce );
+            }
+            else if ( Stream::IsReading )
+            {
+                block.announce = false;
+            }
+
+            if ( block.announce )
+            {
+                if ( !SerializeBlockAnnounce( stream, messageFactory, block, channelConfig ) )
+                    return false;
+            }
+            else if ( !SerializeBlockFragment( stream, messageFactory, GetAllocator( messageFactory ), block, channelConfig ) )
+            {
+                return false;
+            }
+
+            if ( Stream::IsWriting && bitCounters )
+            {
+                const int fragmentBits = stream.GetBitsProcessed() - fragmentStartBits;
+
+                bitCounters->channelFragmentBits[channelId] += fragmentBits;
+
+                if ( messageTypeBits )
+                    messageTypeBits[block.messageType] += fragmentBits;
+            }
+
+            if ( channelConfig.type == CHANNEL_TYPE_RELIABLE_ORDERED && channelConfig.sendMessagesWithFragments )
+            {
+                if ( !SerializeOrderedMessages( stream, messageFactory, GetAllocator( messageFactory ), block.messages.numMessages, block.messages.messages, block.messages.messageIds, channelConfig.maxMessagesPerPacket, channelConfig.maxAggregateMessages, channelConfig.cacheSerializedMessages, channelConfig.expireMessages, messageSizeBits, channel, messageTypeBits ) )
+                {
+                    messageFailedToSerialize = 1;
+                    return true;
+                }
+            }
+        }
+
+        if ( Stream::IsWriting && bitCounters )
+            bitCounters->channelBits[channelId] += stream.GetBitsProcessed() - startBits;
+
+        return true;
+    }
+
+    bool ChannelPacketData::SerializeInternal( ReadStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, PacketBitCounters * bitCounters, bool implicitChannelId, const Channel * const * channels )
+    {
+        return Serialize( stream, messageFactory, channelConfigs, numChannels, bitCounters, implicitChannelId, channels );
+    }
+
+    bool ChannelPacketData::SerializeInternal( WriteStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, PacketBitCounters * bitCounters, bool implicitChannelId, const Channel * const * channels )
+    {
+        return Serialize( stream, messageFactory, channelConfigs, numChannels, bitCounters, implicitChannelId, channels );
+    }
+
+    bool ChannelPacketData::SerializeInternal( MeasureStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, PacketBitCounters * bitCounters, bool implicitChannelId, const Channel * const * channels )
+    {
+        return Serialize( stream, messageFactory, channelConfigs, numChannels, bitCounters, implicitChannelId, channels );
+    }
+
+    // ------------------------------------------------------------------------------------
+
+    Channel::Channel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId ) : m_config( config )
+    {
+        assert( channelId >= 0 );
+        assert( channelId < MaxChannels );
+        assert( !config.skipDiscardedMessages || config.packetBudget > 0 );
+        assert( !config.playoutBuffer || config.minPlayoutDelay <= config.maxPlayoutDelay );
+
+        m_channelId = channelId;
+
+        m_allocator = &allocator;
+
+        m_messageFactory = &messageFactory;
+
+        m_listener = NULL;
+
+        m_error = CHANNEL_ERROR_NONE;
+
+        m_time = 0.0;
+
+        m_rtt = 0.0f;
+        m_rttVariance = 0.0f;
+
+        m_deferBlocks = false;
+
+        m_congestionLimitBits = -1;
+
+        ResetCounters();
+    }
+
+    uint64_t Channel::GetCounter( int index ) const
+    {
+        assert( index >= 0 );
+        assert( index < CHANNEL_COUNTER_NUM_COUNTERS );
+        return m_counters[index];
+    }
+
+    void Channel::ResetCounters() 
+    { 
+        memset( m_counters, 0, sizeof( m_counters ) ); 
+    }
 
     int Channel::GetChannelId() const 
     { 
         return m_channelId;
     }
 
+    void Channel::SendMsgs( Message ** messages, int numMessages )
+    {
+        assert( messages );
+        assert( numMessages >= 0 );
+        assert( CanSendMsgs( numMessages ) );
+
+        if ( GetError() != CHANNEL_ERROR_NONE || !CanSendMsgs( numMessages ) )
+        {
+            if ( GetError() == CHANNEL_ERROR_NONE )
+                SetError( CHANNEL_ERROR_SEND_QUEUE_FULL );
+
+            for ( int i = 0; i < numMessages; ++i )
+                m_messageFactory->Release( messages[i] );
+
+            return;
+        }
+
+        for ( int i = 0; i < numMessages; ++i )
+            SendMsg( messages[i] );
+    }
+
+    int Channel::ReceiveMsgs( Message ** messages, int maxMessages )
+    {
+        assert( messages );
+        assert( maxMessages >= 0 );
+
+        int numMessages = 0;
+
+        while ( numMessages < maxMessages )
+        {
+            Message * message = ReceiveMsg();
+            if ( !message )
+                break;
+            messages[numMessages++] = message;
+        }
+
+        return numMessages;
+    }
+
     void Channel::SetError( ChannelError error )
     {
         if ( error != m_error && error != CHANNEL_ERROR_NONE )
@@ -478,7 +1047,13 @@ namespace yojimbo
 
         assert( ( 65536 % config.sendQueueSize ) == 0 );
         assert( ( 65536 % config.receiveQueueSize ) == 0 );
+        assert( config.sendQueueSize <= MaxReliableMessageWindow );
+        assert( config.receiveQueueSize <= MaxReliableMessageWindow );
         assert( ( 65536 % config.sentPacketBufferSize ) == 0 );
+        assert( config.disableBlocks || config.GetMaxFragmentsPerBlock() <= 65535 );
+        assert( !config.streamBlocks || config.blockStreamWindow > 0 );
+        assert( config.maxAggregateMessages <= MaxAggregateMessages );
+        assert( config.sentPacketMessageIdBufferSize == 0 || config.sentPacketMessageIdBufferSize >= config.maxMessagesPerPacket );
 
         m_sentPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<SentPacketEntry>, *m_allocator, m_config.sentPacketBufferSize );
         
@@ -486,13 +1061,15 @@ namespace yojimbo
         
         m_messageReceiveQueue = YOJIMBO_NEW( *m_allocator, SequenceBuffer<MessageReceiveQueueEntry>, *m_allocator, m_config.receiveQueueSize );
         
-        m_sentPacketMessageIds = (uint16_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint16_t ) * m_config.maxMessagesPerPacket * m_config.sentPacketBufferSize );
+        const int numSentPacketMessageIds = ( m_config.sentPacketMessageIdBufferSize > 0 ) ? m_config.sentPacketMessageIdBufferSize : m_config.maxMessagesPerPacket * m_config.sentPacketBufferSize;
+
+        m_sentPacketMessageIds = (uint16_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint16_t ) * numSentPacketMessageIds );
 
         if ( !config.disableBlocks )
         {
-            m_sendBlock = YOJIMBO_NEW( *m_allocator, SendBlockData, *m_allocator, m_config.maxBlockSize, m_config.GetMaxFragmentsPerBlock() );
+            m_sendBlock = YOJIMBO_NEW( *m_allocator, SendBlockData, *m_allocator, m_config.GetMaxFragmentsPerBlock() );
             
-            m_receiveBlock = YOJIMBO_NEW( *m_allocator, ReceiveBlockData, *m_allocator, m_config.maxBlockSize, m_config.GetMaxFragmentsPerBlock() );
+            m_receiveBlock = YOJIMBO_NEW( *m_allocator, ReceiveBlockData, *m_allocator, m_config.GetMaxFragmentsPerBlock() );
         }
         else
         {
@@ -500,6 +1077,11 @@ namespace yojimbo
             m_receiveBlock = NULL;
         }
 
+        m_blockCompressor = NULL;
+
+        if ( !config.disableBlocks && config.compressBlocks )
+            m_blockCompressor = YOJIMBO_NEW( *m_allocator, PacketCompressor, *m_allocator );
+
         Reset();
     }
 
@@ -509,6 +1091,7 @@ namespace yojimbo
 
         YOJIMBO_DELETE( *m_allocator, SendBlockData, m_sendBlock );
         YOJIMBO_DELETE( *m_allocator, ReceiveBlockData, m_receiveBlock );
+        YOJIMBO_DELETE( *m_allocator, PacketCompressor, m_blockCompressor );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<SentPacketEntry>, m_sentPackets );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<MessageSendQueueEntry>, m_messageSendQueue );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<MessageReceiveQueueEntry>, m_messageReceiveQueue );
@@ -527,18 +1110,28 @@ namespace yojimbo
         m_sendMessageId = 0;
         m_receiveMessageId = 0;
         m_oldestUnackedMessageId = 0;
-
-        for ( int i = 0; i < m_messageSendQueue->GetSize(); ++i )
+        m_hasMostRecentAck = false;
+        m_mostRecentAck = 0;
+        m_hasLostPacketSequence = false;
+        m_lostPacketSequence = 0;
+        m_remoteReceiveWindow = uint16_t( m_config.receiveQueueSize );
+        m_blockCacheReplyPending = false;
+        m_blockCacheReplyHit = false;
+        m_blockCacheReplyMessageId = 0;
+        m_sentPacketMessageIdHead = 0;
+        m_numSentPacketMessageIds = 0;
+
+        for ( int i = m_messageSendQueue->GetNextIndex( 0 ); i >= 0; i = m_messageSendQueue->GetNextIndex( i + 1 ) )
         {
             MessageSendQueueEntry * entry = m_messageSendQueue->GetAtIndex( i );
-            if ( entry && entry->message )
+            if ( entry->message )
                 m_messageFactory->Release( entry->message );
         }
 
-        for ( int i = 0; i < m_messageReceiveQueue->GetSize(); ++i )
+        for ( int i = m_messageReceiveQueue->GetNextIndex( 0 ); i >= 0; i = m_messageReceiveQueue->GetNextIndex( i + 1 ) )
         {
             MessageReceiveQueueEntry * entry = m_messageReceiveQueue->GetAtIndex( i );
-            if ( entry && entry->message )
+            if ( entry->message )
                 m_messageFactory->Release( entry->message );
         }
 
@@ -555,6 +1148,8 @@ namespace yojimbo
         {
             m_receiveBlock->Reset();
 
+            YOJIMBO_FREE( m_messageFactory->GetAllocator(), m_receiveBlock->blockData );
+
             if ( m_receiveBlock->blockMessage )
             {
                 m_messageFactory->Release( m_receiveBlock->blockMessage );
@@ -572,6 +1167,15 @@ namespace yojimbo
         return m_messageSendQueue->Available( m_sendMessageId );
     }
 
+    bool ReliableOrderedChannel::CanSendMsgs( int numMessages ) const
+    {
+        assert( m_messageSendQueue );
+
+        // IMPORTANT: the send queue holds every message from the oldest unacked message id up to the next send message id
+
+        return uint16_t( m_sendMessageId - m_oldestUnackedMessageId ) + numMessages <= m_config.sendQueueSize;
+    }
+
     void ReliableOrderedChannel::SendMsg( Message * message )
     {
         assert( message );
@@ -600,16 +1204,8 @@ namespace yojimbo
             return;
         }
 
-        message->SetId( m_sendMessageId );
-
-        MessageSendQueueEntry * entry = m_messageSendQueue->Insert( m_sendMessageId );
-
-        assert( entry );
-
-        entry->block = message->IsBlockMessage();
-        entry->message = message;
-        entry->measuredBits = 0;
-        entry->timeLastSent = -1.0;
+        if ( m_config.maxAggregateMessages > 1 && AggregateMsg( message ) )
+            return;
 
         if ( message->IsBlockMessage() )
         {
@@ -617,11 +1213,33 @@ namespace yojimbo
             assert( ((BlockMessage*)message)->GetBlockSize() <= m_config.maxBlockSize );
         }
 
-        MeasureStream measureStream;
+        const int measuredBits = MeasureMessage( message );
+
+        if ( measuredBits < 0 )
+        {
+            SetError( CHANNEL_ERROR_FAILED_TO_SERIALIZE );
+            m_messageFactory->Release( message );
+            return;
+        }
 
-        message->SerializeInternal( measureStream );
+        // IMPORTANT: broadcast messages are shared with other connections, so their id is tracked in the send queue and channel packet data only
 
-        entry->measuredBits = measureStream.GetBitsProcessed();
+        if ( !message->IsBroadcastMessage() )
+            message->SetId( m_sendMessageId );
+
+        MessageSendQueueEntry * entry = m_messageSendQueue->Insert( m_sendMessageId );
+
+        assert( entry );
+
+        entry->block = message->IsBlockMessage();
+        entry->message = message;
+        entry->messageType = uint16_t( message->GetType() );
+        entry->measuredBits = measuredBits;
+        entry->timeLastSent = -1.0;
+        entry->numTimesSent = 0;
+        entry->lost = 0;
+        entry->expired = 0;
+        entry->expireTime = GetExpireTime( message );
 
         m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
 
@@ -634,6 +1252,17 @@ namespace yojimbo
             return NULL;
 
         MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Find( m_receiveMessageId );
+
+        // skip over messages that expired before the sender could deliver them
+
+        while ( entry && !entry->message )
+        {
+            m_messageReceiveQueue->Remove( m_receiveMessageId );
+            m_counters[CHANNEL_COUNTER_MESSAGES_EXPIRED]++;
+            m_receiveMessageId++;
+            entry = m_messageReceiveQueue->Find( m_receiveMessageId );
+        }
+
         if ( !entry )
             return NULL;
 
@@ -642,6 +1271,28 @@ namespace yojimbo
         assert( message );
         assert( message->GetId() == m_receiveMessageId );
 
+        if ( message->IsAggregateMessage() )
+        {
+            // the aggregate stays at the front of the receive queue until all of its messages have been received
+
+            AggregateMessage * aggregateMessage = (AggregateMessage*) message;
+
+            message = aggregateMessage->PopMessage();
+
+            assert( message );
+
+            if ( aggregateMessage->IsEmpty() )
+            {
+                m_messageReceiveQueue->Remove( m_receiveMessageId );
+                m_messageFactory->Release( aggregateMessage );
+                m_receiveMessageId++;
+            }
+
+            m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
+
+            return message;
+        }
+
         m_messageReceiveQueue->Remove( m_receiveMessageId );
 
         m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
@@ -656,41 +1307,136 @@ namespace yojimbo
         m_time = time;
     }
     
-    int ReliableOrderedChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
+    int ReliableOrderedChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits, Allocator * packetAllocator )
     {
-        if ( !HasMessagesToSend() )
-            return 0;
+        int packetDataBits = GetSendQueuePacketData( packetData, packetSequence, availableBits, packetAllocator );
 
-        if ( SendingBlockMessage() )
+        if ( m_blockCacheReplyPending )
         {
-            uint16_t messageId;
-            uint16_t fragmentId;
-            int fragmentBytes;
-            int numFragments;
-            int messageType;
+            // IMPORTANT: The reply is sent with whatever else the channel has to send. When there is nothing else, it is sent on its own with no messages.
 
-            uint8_t * fragmentData = GetFragmentToSend( messageId, fragmentId, fragmentBytes, numFragments, messageType );
-
-            if ( fragmentData )
+            if ( packetDataBits == 0 )
             {
-                const int fragmentBits = GetFragmentPacketData( packetData, messageId, fragmentId, fragmentData, fragmentBytes, numFragments, messageType );
+                packetData.Initialize( packetAllocator );
 
-                AddFragmentPacketEntry( messageId, fragmentId, packetSequence );
+                packetData.channelId = GetChannelId();
 
-                return fragmentBits;
+                packetDataBits = 1;
             }
-        }
-        else
-        {
-            int numMessageIds = 0;
 
-            uint16_t * messageIds = (uint16_t*) alloca( m_config.maxMessagesPerPacket * sizeof( uint16_t ) );
+            packetData.blockCacheReply = 1;
+            packetData.blockCacheHit = m_blockCacheReplyHit ? 1 : 0;
+            packetData.blockCacheMessageId = m_blockCacheReplyMessageId;
+
+            packetDataBits += 18;
+
+            m_blockCacheReplyPending = false;
+        }
+
+        return packetDataBits;
+    }
+
+    int ReliableOrderedChannel::GetSendQueuePacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits, Allocator * packetAllocator )
+    {
+        if ( GetNumQueuedMessages() == 0 )
+            return 0;
+
+        if ( m_config.fastResendThreshold > 0 )
+            DetectLostPackets();
+
+        const bool sendingBlock = SendingBlockMessage();
+
+        if ( sendingBlock && m_deferBlocks )
+        {
+            m_counters[CHANNEL_COUNTER_BLOCKS_DEFERRED]++;
+            return 0;
+        }
+
+        if ( sendingBlock && !HasReceiveCredit( m_oldestUnackedMessageId ) )
+        {
+            m_counters[CHANNEL_COUNTER_FLOW_CONTROL_STALLS]++;
+            return 0;
+        }
+
+        if ( sendingBlock && !m_sendBlock->active )
+        {
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
+
+            assert( entry );
+
+            StartSendingBlock( (BlockMessage*) entry->message );
+        }
+
+        if ( sendingBlock && m_sendBlock->waitingForCacheReply )
+        {
+            const int announceBits = GetBlockAnnouncePacketData( packetData, availableBits, packetAllocator );
+
+            if ( announceBits > 0 )
+                return announceBits;
+        }
+
+        if ( sendingBlock && !m_sendBlock->waitingForCacheReply )
+        {
+            uint16_t messageId;
+            uint16_t fragmentId;
+            int numPacketFragments;
+            int fragmentBytes;
+            int numFragments;
+            int messageType;
+
+            uint8_t * fragmentData = GetFragmentToSend( messageId, fragmentId, numPacketFragments, fragmentBytes, numFragments, messageType, availableBits );
+
+            if ( fragmentData )
+            {
+                int fragmentBits = GetFragmentPacketData( packetData, messageId, fragmentId, numPacketFragments, fragmentData, fragmentBytes, numFragments, messageType, packetAllocator );
+
+                int numMessageIds = 0;
+
+                uint16_t * messageIds = NULL;
+
+                if ( m_config.sendMessagesWithFragments )
+                {
+                    // fill what is left of the packet and the channel budget with messages queued after the block
+
+                    int remainingBits = availableBits - fragmentBits;
+
+                    if ( m_config.packetBudget > 0 )
+                        remainingBits = min( remainingBits, m_config.packetBudget * 8 - fragmentBits );
+
+                    if ( remainingBits > 0 )
+                    {
+                        messageIds = (uint16_t*) alloca( m_config.maxMessagesPerPacket * sizeof( uint16_t ) );
+
+                        const int messageBits = GetMessagesToSend( messageIds, numMessageIds, remainingBits );
+
+                        if ( numMessageIds > 0 )
+                        {
+                            GetMessageData( packetData.block.messages, packetData.GetAllocator( *m_messageFactory ), messageIds, numMessageIds );
+
+                            fragmentBits += messageBits;
+                        }
+                    }
+                }
+
+                AddFragmentPacketEntry( messageId, fragmentId, numPacketFragments, messageIds, numMessageIds, packetSequence );
+
+                return fragmentBits;
+            }
+        }
+
+        // IMPORTANT: while all fragments of the block are in flight, messages queued after it are still sent on their own
+
+        if ( !sendingBlock || m_config.sendMessagesWithFragments )
+        {
+            int numMessageIds = 0;
+
+            uint16_t * messageIds = (uint16_t*) alloca( m_config.maxMessagesPerPacket * sizeof( uint16_t ) );
             
             const int messageBits = GetMessagesToSend( messageIds, numMessageIds, availableBits );
 
             if ( numMessageIds > 0 )
             {
-                GetMessagePacketData( packetData, messageIds, numMessageIds );
+                GetMessagePacketData( packetData, messageIds, numMessageIds, packetAllocator );
 
                 AddMessagePacketEntry( messageIds, numMessageIds, packetSequence );
 
@@ -703,12 +1449,299 @@ namespace yojimbo
 
     bool ReliableOrderedChannel::HasMessagesToSend() const
     {
-        return m_oldestUnackedMessageId != m_sendMessageId;
+        return m_oldestUnackedMessageId != m_sendMessageId || m_blockCacheReplyPending;
+    }
+
+    int ReliableOrderedChannel::GetNumQueuedMessages() const
+    {
+        return uint16_t( m_sendMessageId - m_oldestUnackedMessageId );
+    }
+
+    template <typename Stream> bool ReliableOrderedChannel::SerializeStateInternal( Stream & stream )
+    {
+        // IMPORTANT: a block part way through being received can't be carried over, since fragments already acked won't be sent again
+
+        if ( Stream::IsWriting && m_receiveBlock && m_receiveBlock->active )
+            return false;
+
+        // IMPORTANT: the channel time is kept, so messages read in expire relative to the current time
+
+        if ( Stream::IsReading )
+        {
+            const double time = m_time;
+            Reset();
+            m_time = time;
+        }
+
+        const int maxMessageType = m_messageFactory->GetNumTypes() - 1;
+
+        uint16_t sendMessageId = m_sendMessageId;
+        uint16_t receiveMessageId = m_receiveMessageId;
+        uint16_t oldestUnackedMessageId = m_oldestUnackedMessageId;
+        uint16_t sentPacketSequence = m_sentPackets->GetSequence();
+
+        serialize_bits( stream, sendMessageId, 16 );
+        serialize_bits( stream, receiveMessageId, 16 );
+        serialize_bits( stream, oldestUnackedMessageId, 16 );
+        serialize_bits( stream, sentPacketSequence, 16 );
+
+        const int numSendQueueEntries = uint16_t( sendMessageId - oldestUnackedMessageId );
+
+        if ( numSendQueueEntries > m_config.sendQueueSize )
+            return false;
+
+        if ( Stream::IsReading )
+        {
+            m_sendMessageId = sendMessageId;
+            m_receiveMessageId = receiveMessageId;
+            m_oldestUnackedMessageId = oldestUnackedMessageId;
+            m_remoteReceiveWindow = uint16_t( oldestUnackedMessageId + m_config.receiveQueueSize );
+            m_sentPackets->Reset( sentPacketSequence );
+            m_messageSendQueue->Reset( oldestUnackedMessageId );
+            m_messageReceiveQueue->Reset( receiveMessageId );
+        }
+
+        for ( int i = 0; i < m_config.sendQueueSize + m_config.receiveQueueSize; ++i )
+        {
+            const bool sendQueue = i < m_config.sendQueueSize;
+
+            if ( sendQueue && i >= numSendQueueEntries )
+                continue;
+
+            const uint16_t messageId = sendQueue ? uint16_t( oldestUnackedMessageId + i ) : uint16_t( receiveMessageId + i - m_config.sendQueueSize );
+
+            MessageSendQueueEntry * sendQueueEntry = NULL;
+            MessageReceiveQueueEntry * receiveQueueEntry = NULL;
+            Message * message = NULL;
+
+            if ( Stream::IsWriting )
+            {
+                if ( sendQueue )
+                {
+                    sendQueueEntry = m_messageSendQueue->Find( messageId );
+                    if ( sendQueueEntry )
+                        message = sendQueueEntry->message;
+                }
+                else
+                {
+                    receiveQueueEntry = m_messageReceiveQueue->Find( messageId );
+                    if ( receiveQueueEntry )
+                        message = receiveQueueEntry->message;
+                }
+
+                if ( message && message->IsBroadcastMessage() )
+                    return false;
+            }
+
+            bool hasEntry = Stream::IsWriting && ( sendQueueEntry || receiveQueueEntry );
+
+            serialize_bool( stream, hasEntry );
+
+            if ( !hasEntry )
+                continue;
+
+            // IMPORTANT: messages that expired before they were acked or delivered are carried over by id only
+
+            bool expired = Stream::IsWriting && message == NULL;
+
+            serialize_bool( stream, expired );
+
+            if ( !expired )
+            {
+                int messageType = Stream::IsWriting ? message->GetType() : 0;
+
+                if ( maxMessageType > 0 )
+                    serialize_int( stream, messageType, 0, maxMessageType );
+
+                bool aggregate = Stream::IsWriting && message->IsAggregateMessage();
+
+                if ( m_config.maxAggregateMessages > 1 )
+                    serialize_bool( stream, aggregate );
+
+                if ( Stream::IsReading )
+                {
+                    if ( aggregate )
+                        message = m_messageFactory->CreateAggregate( messageType, m_config.maxAggregateMessages );
+                    else
+                        message = m_messageFactory->Create( messageType );
+
+                    if ( !message )
+                        return false;
+
+                    message->SetId( messageId );
+                }
+
+                bool result = m_messageFactory->SerializeMessage( message, stream );
+
+                if ( result && message->IsBlockMessage() )
+                    result = SerializeMessageBlock( stream, *m_messageFactory, (BlockMessage*) message, m_config.maxBlockSize );
+
+                if ( !result )
+                {
+                    if ( Stream::IsReading )
+                        m_messageFactory->Release( message );
+                    return false;
+                }
+            }
+
+            if ( Stream::IsReading )
+            {
+                if ( sendQueue )
+                {
+                    const int measuredBits = message ? MeasureMessage( message ) : 0;
+
+                    if ( measuredBits < 0 )
+                    {
+                        m_messageFactory->Release( message );
+                        return false;
+                    }
+
+                    sendQueueEntry = m_messageSendQueue->Insert( messageId );
+
+                    assert( sendQueueEntry );
+
+                    sendQueueEntry->block = message && message->IsBlockMessage();
+                    sendQueueEntry->message = message;
+                    sendQueueEntry->messageType = uint16_t( message ? message->GetType() : 0 );
+                    sendQueueEntry->measuredBits = measuredBits;
+                    sendQueueEntry->timeLastSent = -1.0;
+                    sendQueueEntry->numTimesSent = 0;
+                    sendQueueEntry->lost = 0;
+                    sendQueueEntry->expired = message == NULL;
+                    sendQueueEntry->expireTime = message ? GetExpireTime( message ) : -1.0;
+                }
+                else
+                {
+                    receiveQueueEntry = m_messageReceiveQueue->Insert( messageId );
+
+                    assert( receiveQueueEntry );
+
+                    receiveQueueEntry->message = message;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    bool ReliableOrderedChannel::SerializeState( ReadStream & stream )
+    {
+        return SerializeStateInternal( stream );
+    }
+
+    bool ReliableOrderedChannel::SerializeState( WriteStream & stream )
+    {
+        return SerializeStateInternal( stream );
+    }
+
+    bool ReliableOrderedChannel::SerializeState( MeasureStream & stream )
+    {
+        return SerializeStateInternal( stream );
+    }
+
+    uint16_t ReliableOrderedChannel::GetReceiveWindow() const
+    {
+        return uint16_t( m_receiveMessageId + m_config.receiveQueueSize );
+    }
+
+    void ReliableOrderedChannel::ProcessReceiveWindow( uint16_t receiveWindow )
+    {
+        assert( m_config.flowControl );
+
+        if ( sequence_greater_than( receiveWindow, m_remoteReceiveWindow ) )
+            m_remoteReceiveWindow = receiveWindow;
+    }
+
+    bool ReliableOrderedChannel::HasReceiveCredit( uint16_t messageId ) const
+    {
+        // IMPORTANT: a message not sent yet is never behind the receive window by more than the receive queue size, nor past it by more than the send queue size, so this holds up to MaxReliableMessageWindow
+
+        return !m_config.flowControl || uint16_t( m_remoteReceiveWindow - messageId - 1 ) < m_config.receiveQueueSize;
+    }
+
+    bool ReliableOrderedChannel::AggregateMsg( Message * message )
+    {
+        assert( message );
+        assert( m_config.maxAggregateMessages > 1 );
+
+        if ( message->IsBlockMessage() || message->IsBroadcastMessage() )
+            return false;
+
+        if ( GetNumQueuedMessages() == 0 )
+            return false;
+
+        // IMPORTANT: an aggregate expires as a whole, so messages that can expire are kept apart
+
+        if ( GetExpireTime( message ) >= 0.0 )
+            return false;
+
+        const uint16_t messageId = uint16_t( m_sendMessageId - 1 );
+
+        MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
+
+        if ( !entry || entry->block || entry->numTimesSent > 0 || entry->expireTime >= 0.0 )
+            return false;
+
+        Message * previousMessage = entry->message;
+
+        assert( previousMessage );
+
+        if ( previousMessage->GetType() != message->GetType() || previousMessage->IsBroadcastMessage() )
+            return false;
+
+        if ( previousMessage->IsAggregateMessage() && ( (AggregateMessage*) previousMessage )->IsFull() )
+            return false;
+
+        MeasureStream measureStream;
+
+        m_messageFactory->SerializeMessage( message, measureStream );
+
+        int aggregateBits = entry->measuredBits + measureStream.GetBitsProcessed();
+
+        if ( !previousMessage->IsAggregateMessage() )
+            aggregateBits += bits_required( 1, m_config.maxAggregateMessages );
+
+        if ( aggregateBits > m_config.maxAggregateBytes * 8 )
+            return false;
+
+        AggregateMessage * aggregateMessage;
+
+        if ( previousMessage->IsAggregateMessage() )
+        {
+            aggregateMessage = (AggregateMessage*) previousMessage;
+        }
+        else
+        {
+            aggregateMessage = m_messageFactory->CreateAggregate( previousMessage->GetType(), m_config.maxAggregateMessages );
+            if ( !aggregateMessage )
+                return false;
+
+            aggregateMessage->SetId( messageId );
+            aggregateMessage->AddMessage( previousMessage );
+
+            // the previous message is now serialized as part of the aggregate, so its cached bits are no longer used
+
+            if ( previousMessage->GetSerializedData() )
+                m_messageFactory->FreeSerializedMessage( previousMessage );
+
+            entry->message = aggregateMessage;
+        }
+
+        message->SetId( messageId );
+
+        aggregateMessage->AddMessage( message );
+
+        entry->measuredBits = aggregateBits;
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
+        m_counters[CHANNEL_COUNTER_MESSAGES_AGGREGATED]++;
+
+        return true;
     }
 
     int ReliableOrderedChannel::GetMessagesToSend( uint16_t * messageIds, int & numMessageIds, int availableBits )
     {
-        assert( HasMessagesToSend() );
+        assert( GetNumQueuedMessages() > 0 );
 
         numMessageIds = 0;
 
@@ -717,7 +1750,9 @@ namespace yojimbo
 
         const int giveUpBits = 4 * 8;
 
-        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+        // IMPORTANT: when aggregation is enabled, each message has an extra bit saying whether it's an aggregate. When messages are cached, each message is byte aligned, which takes up to 7 bits. Messages may also be prefixed with their size. The message type is added per-message, since its size can depend on the type
+
+        const int messageTypeBits = ( m_config.maxAggregateMessages > 1 ? 1 : 0 ) + ( m_config.cacheSerializedMessages ? 7 : 0 ) + ( m_config.expireMessages ? 1 : 0 ) + GetMessageSizeBits( m_config );
 
         const int messageLimit = min( m_config.sendQueueSize, m_config.receiveQueueSize );
 
@@ -735,6 +1770,14 @@ namespace yojimbo
             if ( giveUpCounter > m_config.sendQueueSize )
                 break;
 
+            // skip over holes in the send queue directly, rather than probing each message id in turn
+
+            const int offset = m_messageSendQueue->GetNextEntryOffset( uint16_t( m_oldestUnackedMessageId + i ), messageLimit - i );
+            if ( offset < 0 )
+                break;
+
+            i += offset;
+
             uint16_t messageId = m_oldestUnackedMessageId + i;
 
             MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
@@ -742,12 +1785,30 @@ namespace yojimbo
             if ( !entry )
                 continue;
 
+            // IMPORTANT: the other side drops messages that don't fit in its receive queue. Sending them would only mean resending them later. Messages already sent had room when they were first sent
+
+            if ( entry->numTimesSent == 0 && !HasReceiveCredit( messageId ) )
+            {
+                m_counters[CHANNEL_COUNTER_FLOW_CONTROL_STALLS]++;
+                break;
+            }
+
             if ( entry->block )
+            {
+                // IMPORTANT: messages queued after the block being sent may go along with its fragments. Any later block waits its turn
+
+                if ( m_config.sendMessagesWithFragments && messageId == m_oldestUnackedMessageId )
+                    continue;
+
                 break;
+            }
+
+            if ( !entry->expired && entry->expireTime >= 0.0 && entry->expireTime <= m_time )
+                ExpireMessage( messageId );
             
-            if ( entry->timeLastSent + m_config.messageResendTime <= m_time && availableBits >= (int) entry->measuredBits )
+            if ( ( entry->lost || entry->timeLastSent + GetResendTime( m_config.messageResendTime, entry->numTimesSent ) <= m_time ) && availableBits >= (int) entry->measuredBits )
             {                
-                int messageBits = entry->measuredBits + messageTypeBits;
+                int messageBits = entry->expired ? 1 : entry->measuredBits + messageTypeBits + m_messageFactory->GetTypeBits( entry->messageType );
                 
                 if ( numMessageIds == 0 )
                 {
@@ -755,9 +1816,7 @@ namespace yojimbo
                 }
                 else
                 {
-                    MeasureStream stream;
-                    serialize_sequence_relative_internal( stream, previousMessageId, messageId );
-                    messageBits += stream.GetBitsProcessed();
+                    messageBits += sequence_relative_bits( previousMessageId, messageId );
                 }
 
                 if ( usedBits + messageBits > availableBits )
@@ -771,6 +1830,10 @@ namespace yojimbo
                 messageIds[numMessageIds++] = messageId;
                 
                 entry->timeLastSent = m_time;
+                entry->lost = 0;
+
+                if ( entry->numTimesSent < 0xFFFF )
+                    entry->numTimesSent++;
 
                 previousMessageId = messageId;
             }
@@ -782,27 +1845,35 @@ namespace yojimbo
         return usedBits;
     }
 
-    void ReliableOrderedChannel::GetMessagePacketData( ChannelPacketData & packetData, const uint16_t * messageIds, int numMessageIds )
+    void ReliableOrderedChannel::GetMessagePacketData( ChannelPacketData & packetData, const uint16_t * messageIds, int numMessageIds, Allocator * packetAllocator )
     {
         assert( messageIds );
 
-        packetData.Initialize();
+        packetData.Initialize( packetAllocator );
 
         packetData.channelId = GetChannelId();
-        
-        packetData.message.numMessages = numMessageIds;
+
+        GetMessageData( packetData.message, packetData.GetAllocator( *m_messageFactory ), messageIds, numMessageIds );
+    }
+
+    void ReliableOrderedChannel::GetMessageData( ChannelPacketData::MessageData & messageData, Allocator & allocator, const uint16_t * messageIds, int numMessageIds )
+    {
+        messageData.numMessages = numMessageIds;
         
         if ( numMessageIds == 0 )
             return;
 
-        packetData.message.messages = (Message**) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), sizeof( Message* ) * numMessageIds );
+        messageData.messages = (Message**) YOJIMBO_ALLOCATE( allocator, ( sizeof( Message* ) + sizeof( uint16_t ) ) * numMessageIds );
+        messageData.messageIds = (uint16_t*) ( messageData.messages + numMessageIds );
 
         for ( int i = 0; i < numMessageIds; ++i )
         {
             MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageIds[i] );
             assert( entry );
-            packetData.message.messages[i] = entry->message;
-            m_messageFactory->AddRef( packetData.message.messages[i] );
+            messageData.messages[i] = entry->message;
+            messageData.messageIds[i] = messageIds[i];
+            if ( entry->message )
+                m_messageFactory->AddRef( entry->message );
         }
     }
 
@@ -817,7 +1888,7 @@ namespace yojimbo
             sentPacket->acked = 0;
             sentPacket->block = 0;
             sentPacket->timeSent = m_time;
-            sentPacket->messageIds = &m_sentPacketMessageIds[ ( sequence % m_config.sentPacketBufferSize ) * m_config.maxMessagesPerPacket ];
+            AllocateSentPacketMessageIds( sentPacket, numMessageIds, sequence );
             sentPacket->numMessageIds = numMessageIds;            
             for ( int i = 0; i < numMessageIds; ++i )
             {
@@ -826,37 +1897,77 @@ namespace yojimbo
         }
     }
 
-    void ReliableOrderedChannel::ProcessPacketMessages( int numMessages, Message ** messages )
+    void ReliableOrderedChannel::AllocateSentPacketMessageIds( SentPacketEntry * sentPacket, int numMessageIds, uint16_t sequence )
     {
-        const uint16_t minMessageId = m_receiveMessageId;
-        const uint16_t maxMessageId = m_receiveMessageId + m_config.receiveQueueSize - 1;
+        assert( sentPacket );
+        assert( numMessageIds <= m_config.maxMessagesPerPacket );
 
-        for ( int i = 0; i < (int) numMessages; ++i )
+        if ( m_config.sentPacketMessageIdBufferSize <= 0 )
         {
-            Message * message = messages[i];
-
-            assert( message );  
+            sentPacket->messageIds = &m_sentPacketMessageIds[ ( sequence % m_config.sentPacketBufferSize ) * m_config.maxMessagesPerPacket ];
+            sentPacket->messageIdStart = 0;
+            return;
+        }
 
-            const uint16_t messageId = message->GetId();
+        // IMPORTANT: The ids of one packet are kept contiguous, so ids that don't fit at the end of the ring buffer go at the start. The skipped slots count as stored, so packets stored before them are invalidated in order.
 
-            if ( sequence_less_than( messageId, minMessageId ) )
-                continue;
+        if ( m_sentPacketMessageIdHead + numMessageIds > m_config.sentPacketMessageIdBufferSize )
+        {
+            m_numSentPacketMessageIds += uint32_t( m_config.sentPacketMessageIdBufferSize - m_sentPacketMessageIdHead );
+            m_sentPacketMessageIdHead = 0;
+        }
 
-            if ( sequence_greater_than( messageId, maxMessageId ) )
-            {
-                SetError( CHANNEL_ERROR_DESYNC );
-                return;
-            }
+        sentPacket->messageIds = &m_sentPacketMessageIds[m_sentPacketMessageIdHead];
+        sentPacket->messageIdStart = m_numSentPacketMessageIds;
 
-            if ( m_messageReceiveQueue->Find( messageId ) )
-                continue;
+        m_sentPacketMessageIdHead += numMessageIds;
+        m_numSentPacketMessageIds += uint32_t( numMessageIds );
+    }
 
-            MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
+    bool ReliableOrderedChannel::HasSentPacketMessageIds( const SentPacketEntry * sentPacket ) const
+    {
+        assert( sentPacket );
 
-            entry->message = message;
+        if ( m_config.sentPacketMessageIdBufferSize <= 0 || sentPacket->numMessageIds == 0 )
+            return true;
 
-            m_messageFactory->AddRef( message );
-        }
+        return uint32_t( m_numSentPacketMessageIds - sentPacket->messageIdStart ) <= uint32_t( m_config.sentPacketMessageIdBufferSize );
+    }
+
+    void ReliableOrderedChannel::ProcessPacketMessages( const ChannelPacketData::MessageData & messageData )
+    {
+        for ( int i = 0; i < messageData.numMessages; ++i )
+        {
+            Message * message = messageData.messages[i];
+
+            assert( message || m_config.expireMessages );
+            assert( messageData.messageIds );
+
+            const uint16_t messageId = messageData.messageIds[i];
+
+            // IMPORTANT: the sender resends messages up to a full send queue behind the next message id to receive, so with a window of MaxReliableMessageWindow, an id exactly half way around is behind, not ahead
+
+            const uint16_t offset = uint16_t( messageId - m_receiveMessageId );
+
+            if ( offset >= MaxReliableMessageWindow )
+                continue;
+
+            if ( offset >= m_config.receiveQueueSize )
+            {
+                SetError( CHANNEL_ERROR_DESYNC );
+                return;
+            }
+
+            if ( m_messageReceiveQueue->Find( messageId ) )
+                continue;
+
+            MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
+
+            entry->message = message;
+
+            if ( message )
+                m_messageFactory->AddRef( message );
+        }
     }
 
     void ReliableOrderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
@@ -872,18 +1983,68 @@ namespace yojimbo
 
         (void)packetSequence;
 
+        if ( packetData.blockCacheReply )
+            ProcessBlockCacheReply( packetData.blockCacheMessageId, packetData.blockCacheHit != 0 );
+
         if ( packetData.blockMessage )
         {
-            ProcessPacketFragment( packetData.block.messageType, packetData.block.messageId, packetData.block.numFragments, packetData.block.fragmentId, packetData.block.fragmentData, packetData.block.fragmentSize, packetData.block.message );
+            if ( packetData.block.announce )
+            {
+                ProcessBlockAnnounce( packetData.block );
+            }
+            else
+            {
+                const int numPacketFragments = packetData.block.numPacketFragments;
+
+                for ( int i = 0; i < numPacketFragments && m_error == CHANNEL_ERROR_NONE; ++i )
+                {
+                    const uint16_t fragmentId = uint16_t( packetData.block.fragmentId + i );
+
+                    const int fragmentBytes = ( i < numPacketFragments - 1 ) ? m_config.fragmentSize : packetData.block.fragmentSize - i * m_config.fragmentSize;
+
+                    const int uncompressedBlockSize = ( i == 0 && packetData.block.compressed ) ? packetData.block.blockSize : 0;
+
+                    ProcessPacketFragment( packetData.block.messageType, packetData.block.messageId, packetData.block.numFragments, fragmentId, packetData.block.fragmentData + i * m_config.fragmentSize, fragmentBytes, i == 0 ? packetData.block.message : NULL, uncompressedBlockSize );
+                }
+            }
+
+            if ( m_error == CHANNEL_ERROR_NONE && packetData.block.messages.numMessages > 0 )
+                ProcessPacketMessages( packetData.block.messages );
         }
         else
         {
-            ProcessPacketMessages( packetData.message.numMessages, packetData.message.messages );
+            ProcessPacketMessages( packetData.message );
         }
     }
 
+    bool ReliableOrderedChannel::WillDiscardMessage( uint16_t messageId ) const
+    {
+        if ( m_error != CHANNEL_ERROR_NONE )
+            return true;
+
+        // IMPORTANT: the next message id to receive only moves forward, and messages stay in the receive queue until they are dequeued, so messages discarded here are also discarded when the packet is processed
+
+        const uint16_t offset = uint16_t( messageId - m_receiveMessageId );
+
+        if ( offset >= MaxReliableMessageWindow )
+            return true;
+
+        if ( offset >= m_config.receiveQueueSize )
+            return false;
+
+        return m_messageReceiveQueue->Find( messageId ) != NULL;
+    }
+
     void ReliableOrderedChannel::ProcessAck( uint16_t ack )
     {
+        // IMPORTANT: Every ack counts towards fast resend, even for packets with no data on this channel. It shows the packets before it had time to arrive.
+
+        if ( !m_hasMostRecentAck || sequence_greater_than( ack, m_mostRecentAck ) )
+        {
+            m_hasMostRecentAck = true;
+            m_mostRecentAck = ack;
+        }
+
         SentPacketEntry * sentPacketEntry = m_sentPackets->Find( ack );
 
         if ( !sentPacketEntry )
@@ -891,6 +2052,14 @@ namespace yojimbo
 
         assert( !sentPacketEntry->acked );
 
+        sentPacketEntry->acked = 1;
+
+        if ( !HasSentPacketMessageIds( sentPacketEntry ) )
+        {
+            m_counters[CHANNEL_COUNTER_SENT_PACKET_MESSAGE_IDS_OVERWRITTEN]++;
+            sentPacketEntry->numMessageIds = 0;
+        }
+
         for ( int i = 0; i < (int) sentPacketEntry->numMessageIds; ++i )
         {
             const uint16_t messageId = sentPacketEntry->messageIds[i];
@@ -899,10 +2068,11 @@ namespace yojimbo
             
             if ( sendQueueEntry )
             {
-                assert( sendQueueEntry->message );
-                assert( sendQueueEntry->message->GetId() == messageId );
+                assert( sendQueueEntry->message || sendQueueEntry->expired );
+                assert( !sendQueueEntry->message || sendQueueEntry->message->IsBroadcastMessage() || sendQueueEntry->message->GetId() == messageId );
 
-                m_messageFactory->Release( sendQueueEntry->message );
+                if ( sendQueueEntry->message )
+                    m_messageFactory->Release( sendQueueEntry->message );
 
                 m_messageSendQueue->Remove( messageId );
 
@@ -913,14 +2083,24 @@ namespace yojimbo
         if ( !m_config.disableBlocks && sentPacketEntry->block && m_sendBlock->active && m_sendBlock->blockMessageId == sentPacketEntry->blockMessageId )
         {        
             const int messageId = sentPacketEntry->blockMessageId;
-            const int fragmentId = sentPacketEntry->blockFragmentId;
 
-            if ( !m_sendBlock->ackedFragment->GetBit( fragmentId ) )
+            for ( int i = 0; i < (int) sentPacketEntry->blockNumFragments; ++i )
             {
+                const int fragmentId = sentPacketEntry->blockFragmentId + i;
+
+                if ( m_sendBlock->ackedFragment->GetBit( fragmentId ) )
+                    continue;
+
                 m_sendBlock->ackedFragment->SetBit( fragmentId );
 
                 m_sendBlock->numAckedFragments++;
 
+                if ( fragmentId == m_sendBlock->firstUnackedFragment )
+                {
+                    const int firstUnackedFragment = m_sendBlock->ackedFragment->FindNextZero( fragmentId, m_sendBlock->numFragments );
+                    m_sendBlock->firstUnackedFragment = ( firstUnackedFragment >= 0 ) ? firstUnackedFragment : m_sendBlock->numFragments;
+                }
+
                 if ( m_sendBlock->numAckedFragments == m_sendBlock->numFragments )
                 {
                     m_sendBlock->active = false;
@@ -934,6 +2114,8 @@ namespace yojimbo
                     m_messageSendQueue->Remove( messageId );
 
                     UpdateOldestUnackedMessageId();
+
+                    break;
                 }
             }
         }
@@ -948,6 +2130,17 @@ namespace yojimbo
             if ( m_oldestUnackedMessageId == stopMessageId )
                 break;
 
+            const int count = min( int( uint16_t( stopMessageId - m_oldestUnackedMessageId ) ), m_messageSendQueue->GetSize() );
+
+            const int offset = m_messageSendQueue->GetNextEntryOffset( m_oldestUnackedMessageId, count );
+            if ( offset < 0 )
+            {
+                m_oldestUnackedMessageId += count;
+                continue;
+            }
+
+            m_oldestUnackedMessageId += offset;
+
             MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
             if ( entry )
                 break;
@@ -955,19 +2148,324 @@ namespace yojimbo
             ++m_oldestUnackedMessageId;
         }
 
-        assert( !sequence_greater_than( m_oldestUnackedMessageId, stopMessageId ) );
+        assert( uint16_t( stopMessageId - m_oldestUnackedMessageId ) <= m_config.sendQueueSize );
+    }
+
+    void ReliableOrderedChannel::DetectLostPackets()
+    {
+        assert( m_config.fastResendThreshold > 0 );
+
+        if ( !m_hasMostRecentAck )
+            return;
+
+        // sent packets up to and including this sequence number are lost if they haven't been acked by now
+
+        const uint16_t lostSequence = m_mostRecentAck - uint16_t( m_config.fastResendThreshold );
+
+        const uint16_t oldestSequence = m_sentPackets->GetSequence() - uint16_t( m_sentPackets->GetSize() );
+
+        uint16_t sequence = m_hasLostPacketSequence ? m_lostPacketSequence : oldestSequence;
+
+        if ( sequence_less_than( sequence, oldestSequence ) )
+            sequence = oldestSequence;
+
+        if ( sequence_greater_than( sequence, lostSequence ) )
+            return;
+
+        const int count = min( int( uint16_t( lostSequence - sequence ) ) + 1, m_sentPackets->GetSize() );
+
+        int offset = 0;
+
+        while ( offset < count )
+        {
+            const int next = m_sentPackets->GetNextEntryOffset( sequence + uint16_t( offset ), count - offset );
+
+            if ( next < 0 )
+                break;
+
+            offset += next;
+
+            const uint16_t packetSequence = sequence + uint16_t( offset );
+
+            SentPacketEntry * sentPacketEntry = m_sentPackets->Find( packetSequence );
+
+            if ( sentPacketEntry && !sentPacketEntry->acked )
+            {
+                bool lost = false;
+
+                if ( !HasSentPacketMessageIds( sentPacketEntry ) )
+                {
+                    m_counters[CHANNEL_COUNTER_SENT_PACKET_MESSAGE_IDS_OVERWRITTEN]++;
+                    sentPacketEntry->numMessageIds = 0;
+                }
+
+                // IMPORTANT: Only data that hasn't been sent again since this packet is resent. Otherwise a later copy may still be on its way.
+
+                for ( int i = 0; i < (int) sentPacketEntry->numMessageIds; ++i )
+                {
+                    MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( sentPacketEntry->messageIds[i] );
+
+                    if ( sendQueueEntry && !sendQueueEntry->block && sendQueueEntry->timeLastSent <= sentPacketEntry->timeSent )
+                    {
+                        sendQueueEntry->lost = 1;
+                        lost = true;
+                    }
+                }
+
+                if ( sentPacketEntry->block && m_sendBlock->active && m_sendBlock->blockMessageId == sentPacketEntry->blockMessageId )
+                {
+                    for ( int i = 0; i < (int) sentPacketEntry->blockNumFragments; ++i )
+                    {
+                        const int fragmentId = sentPacketEntry->blockFragmentId + i;
+
+                        if ( !m_sendBlock->ackedFragment->GetBit( fragmentId ) && m_sendBlock->fragmentSendTime[fragmentId] <= sentPacketEntry->timeSent )
+                        {
+                            m_sendBlock->lostFragment->SetBit( fragmentId );
+                            lost = true;
+                        }
+                    }
+                }
+
+                if ( lost )
+                    m_counters[CHANNEL_COUNTER_FAST_RESENDS]++;
+            }
+
+            offset++;
+        }
+
+        m_hasLostPacketSequence = true;
+        m_lostPacketSequence = lostSequence + 1;
+    }
+
+    double ReliableOrderedChannel::GetResendTime( float fixedResendTime, int numTimesSent ) const
+    {
+        if ( !m_config.adaptiveResendTime || m_rtt <= 0.0f )
+            return fixedResendTime;
+
+        if ( numTimesSent == 0 )
+            return 0.0;
+
+        // IMPORTANT: Retransmission timeout as per TCP (RFC 6298), with exponential backoff for each resend of the same data.
+
+        const int MaxBackoff = 16;
+
+        double resendTime = ( m_rtt + max( (double) m_config.minResendTime, 4.0 * m_rttVariance ) ) * ( 1 << min( numTimesSent - 1, MaxBackoff ) );
+
+        return min( resendTime, (double) m_config.maxResendTime );
+    }
+
+    double ReliableOrderedChannel::GetExpireTime( const Message * message ) const
+    {
+        assert( message );
+
+        if ( !m_config.expireMessages || message->IsBlockMessage() )
+            return -1.0;
+
+        const float timeToLive = ( message->GetTimeToLive() > 0.0f ) ? message->GetTimeToLive() : m_config.messageTimeToLive;
+
+        if ( timeToLive <= 0.0f )
+            return -1.0;
+
+        return m_time + timeToLive;
+    }
+
+    int ReliableOrderedChannel::MeasureMessage( Message * message )
+    {
+        assert( message );
+
+        if ( m_config.cacheSerializedMessages && !message->IsBlockMessage() && !message->IsBroadcastMessage() && !message->IsAggregateMessage() )
+        {
+            // IMPORTANT: the message is serialized once here. Every packet it is included in copies these bits instead of serializing it again
+
+            return m_messageFactory->CacheSerializedMessage( message );
+        }
+
+        MeasureStream measureStream;
+
+        m_messageFactory->SerializeMessage( message, measureStream );
+
+        return measureStream.GetBitsProcessed();
+    }
+
+    void ReliableOrderedChannel::ExpireMessage( uint16_t messageId )
+    {
+        MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
+
+        assert( entry );
+        assert( entry->message );
+        assert( !entry->block );
+        assert( !entry->expired );
+
+        m_messageFactory->Release( entry->message );
+
+        entry->message = NULL;
+        entry->messageType = 0;
+        entry->measuredBits = 0;
+        entry->expired = 1;
+        entry->timeLastSent = -1.0;
+        entry->lost = 1;
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_EXPIRED]++;
     }
 
     bool ReliableOrderedChannel::SendingBlockMessage()
     {
-        assert( HasMessagesToSend() );
+        assert( GetNumQueuedMessages() > 0 );
 
         MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
 
         return entry ? entry->block : false;
     }
 
-    uint8_t * ReliableOrderedChannel::GetFragmentToSend( uint16_t & messageId, uint16_t & fragmentId, int & fragmentBytes, int & numFragments, int & messageType )
+    void ReliableOrderedChannel::StartSendingBlock( BlockMessage * blockMessage )
+    {
+        assert( blockMessage );
+        assert( !m_sendBlock->active );
+
+        const int blockSize = blockMessage->GetBlockSize();
+
+        m_sendBlock->active = true;
+        m_sendBlock->blockSize = blockSize;
+        m_sendBlock->blockMessageId = blockMessage->GetId();
+        m_sendBlock->numFragments = (int) ceil( blockSize / float( m_config.fragmentSize ) );
+        m_sendBlock->numAckedFragments = 0;
+        m_sendBlock->firstUnackedFragment = 0;
+        m_sendBlock->uncompressedBlockSize = blockSize;
+        m_sendBlock->compressed = false;
+        m_sendBlock->blockHash = 0;
+        m_sendBlock->waitingForCacheReply = false;
+        m_sendBlock->announceSendTime = -1.0;
+        m_sendBlock->announceSendCount = 0;
+
+        const int MaxFragmentsPerBlock = m_config.GetMaxFragmentsPerBlock();
+
+        assert( m_sendBlock->numFragments > 0 );
+        assert( m_sendBlock->numFragments <= MaxFragmentsPerBlock );
+
+        m_sendBlock->ackedFragment->Clear();
+        m_sendBlock->lostFragment->Clear();
+
+        for ( int i = 0; i < MaxFragmentsPerBlock; ++i )
+        {
+            m_sendBlock->fragmentSendTime[i] = -1.0;
+            m_sendBlock->fragmentSendCount[i] = 0;
+        }
+
+        // IMPORTANT: Streamed blocks are never assembled on the other side, so there is nothing to cache. They are sent without being announced.
+
+        if ( m_config.blockCache && !m_config.streamBlocks )
+        {
+            m_sendBlock->blockHash = murmur_hash_64( blockMessage->GetBlockData(), blockSize, 0 );
+            m_sendBlock->waitingForCacheReply = true;
+        }
+
+        // IMPORTANT: Announced blocks are only compressed once the other side asks for the fragments, so blocks found in its cache are never compressed.
+
+        if ( m_blockCompressor && !m_config.streamBlocks && !m_sendBlock->waitingForCacheReply )
+            CompressSendBlock( blockMessage );
+    }
+
+    void ReliableOrderedChannel::CompressSendBlock( BlockMessage * blockMessage )
+    {
+        assert( m_blockCompressor );
+        assert( m_sendBlock->active );
+        assert( m_sendBlock->blockMessageId == blockMessage->GetId() );
+        assert( m_sendBlock->numAckedFragments == 0 );
+
+        // IMPORTANT: A shared block is read-only and may be attached to messages for other connections, so it can't be replaced.
+
+        if ( blockMessage->GetSharedBlock() )
+            return;
+
+        const int blockSize = blockMessage->GetBlockSize();
+
+        Allocator & allocator = m_messageFactory->GetAllocator();
+
+        uint8_t * compressBuffer = (uint8_t*) YOJIMBO_ALLOCATE( allocator, blockSize );
+
+        if ( !compressBuffer )
+            return;
+
+        const int compressedBytes = m_blockCompressor->Compress( blockMessage->GetBlockData(), blockSize, compressBuffer, blockSize - 1 );
+
+        // copy the compressed block into an allocation of its exact size, so the block held while it is in flight is as small as possible
+
+        uint8_t * compressedData = compressedBytes > 0 ? (uint8_t*) YOJIMBO_ALLOCATE( allocator, compressedBytes ) : NULL;
+
+        if ( compressedData )
+            memcpy( compressedData, compressBuffer, compressedBytes );
+
+        YOJIMBO_FREE( allocator, compressBuffer );
+
+        if ( !compressedData )
+            return;
+
+        Allocator * blockAllocator = blockMessage->GetAllocator();
+        uint8_t * blockData = blockMessage->GetBlockData();
+
+        assert( blockAllocator );
+
+        blockMessage->DetachBlock();
+
+        YOJIMBO_FREE( *blockAllocator, blockData );
+
+        blockMessage->AttachBlock( allocator, compressedData, compressedBytes );
+
+        m_sendBlock->blockSize = compressedBytes;
+        m_sendBlock->numFragments = ( compressedBytes + m_config.fragmentSize - 1 ) / m_config.fragmentSize;
+        m_sendBlock->compressed = true;
+    }
+
+    int ReliableOrderedChannel::GetBlockAnnouncePacketData( ChannelPacketData & packetData, int availableBits, Allocator * packetAllocator )
+    {
+        assert( m_sendBlock->active );
+        assert( m_sendBlock->waitingForCacheReply );
+
+        if ( availableBits <= 0 )
+            return 0;
+
+        if ( m_sendBlock->announceSendCount > 0 && m_sendBlock->announceSendTime + GetResendTime( m_config.fragmentResendTime, m_sendBlock->announceSendCount ) >= m_time )
+            return 0;
+
+        MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_sendBlock->blockMessageId );
+
+        assert( entry );
+        assert( entry->message );
+
+        packetData.Initialize( packetAllocator );
+
+        packetData.channelId = GetChannelId();
+
+        packetData.blockMessage = 1;
+
+        packetData.block.announce = true;
+        packetData.block.fragmentData = NULL;
+        packetData.block.ownsFragmentData = false;
+        packetData.block.messageId = m_sendBlock->blockMessageId;
+        packetData.block.fragmentId = 0;
+        packetData.block.numPacketFragments = 0;
+        packetData.block.fragmentSize = 0;
+        packetData.block.numFragments = m_sendBlock->numFragments;
+        packetData.block.messageType = entry->messageType;
+        packetData.block.compressed = false;
+        packetData.block.blockSize = m_sendBlock->uncompressedBlockSize;
+        packetData.block.blockHash = m_sendBlock->blockHash;
+        packetData.block.messages.numMessages = 0;
+        packetData.block.messages.messages = NULL;
+        packetData.block.messages.messageIds = NULL;
+        packetData.block.message = (BlockMessage*) entry->message;
+
+        m_messageFactory->AddRef( packetData.block.message );
+
+        m_sendBlock->announceSendTime = m_time;
+
+        if ( m_sendBlock->announceSendCount < 0xFFFF )
+            m_sendBlock->announceSendCount++;
+
+        return ConservativeFragmentHeaderEstimate + 64 + entry->measuredBits + m_messageFactory->GetTypeBits( entry->messageType );
+    }
+
+    uint8_t * ReliableOrderedChannel::GetFragmentToSend( uint16_t & messageId, uint16_t & fragmentId, int & numPacketFragments, int & fragmentBytes, int & numFragments, int & messageType, int availableBits )
     {
         MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
 
@@ -982,36 +2480,23 @@ namespace yojimbo
 
         const int blockSize = blockMessage->GetBlockSize();
 
-        if ( !m_sendBlock->active )
-        {
-            // start sending this block
-
-            m_sendBlock->active = true;
-            m_sendBlock->blockSize = blockSize;
-            m_sendBlock->blockMessageId = messageId;
-            m_sendBlock->numFragments = (int) ceil( blockSize / float( m_config.fragmentSize ) );
-            m_sendBlock->numAckedFragments = 0;
-
-            const int MaxFragmentsPerBlock = m_config.GetMaxFragmentsPerBlock();
-
-            assert( m_sendBlock->numFragments > 0 );
-            assert( m_sendBlock->numFragments <= MaxFragmentsPerBlock );
-
-            m_sendBlock->ackedFragment->Clear();
-
-            for ( int i = 0; i < MaxFragmentsPerBlock; ++i )
-                m_sendBlock->fragmentSendTime[i] = -1.0;
-        }
+        assert( m_sendBlock->active );
+        assert( m_sendBlock->blockMessageId == messageId );
 
         numFragments = m_sendBlock->numFragments;
 
-        // find the next fragment to send (there may not be one)
+        // find the next fragment to send (there may not be one). only unacked fragments are visited, starting from the first unacked fragment
 
         fragmentId = 0xFFFF;
 
-        for ( int i = 0; i < m_sendBlock->numFragments; ++i )
+        int lastFragmentToSearch = m_sendBlock->numFragments;
+
+        if ( m_config.streamBlocks )
+            lastFragmentToSearch = min( lastFragmentToSearch, m_sendBlock->firstUnackedFragment + m_config.blockStreamWindow );
+
+        for ( int i = m_sendBlock->ackedFragment->FindNextZero( m_sendBlock->firstUnackedFragment, lastFragmentToSearch ); i >= 0; i = m_sendBlock->ackedFragment->FindNextZero( i + 1, lastFragmentToSearch ) )
         {
-            if ( !m_sendBlock->ackedFragment->GetBit( i ) && m_sendBlock->fragmentSendTime[i] + m_config.fragmentResendTime < m_time )
+            if ( FragmentReadyToSend( i ) )
             {
                 fragmentId = uint16_t( i );
                 break;
@@ -1021,70 +2506,126 @@ namespace yojimbo
         if ( fragmentId == 0xFFFF )
             return NULL;
 
-        // allocate and return a copy of the fragment data
-
         messageType = blockMessage->GetType();
 
-        fragmentBytes = m_config.fragmentSize;
+        // IMPORTANT: The first fragment is sent even if it doesn't fit, so fragments larger than the packet or channel budget still get through.
+        // It is held back when there are no bits available at all, or when it doesn't fit in the connection congestion window while packets are in flight.
+
+        if ( availableBits <= 0 )
+            return NULL;
+
+        int fragmentBits = ConservativeFragmentHeaderEstimate + m_config.fragmentSize * 8;
+
+        if ( fragmentId == 0 )
+            fragmentBits += entry->measuredBits + m_messageFactory->GetTypeBits( messageType );
+
+        if ( m_congestionLimitBits >= 0 && fragmentBits > m_congestionLimitBits )
+            return NULL;
+
+        availableBits -= fragmentBits;
+
+        // include the fragments that follow it, while they are ready to send and fit in the packet
+
+        numPacketFragments = 1;
+
+        if ( m_config.maxBlockFragmentsPerPacket > 1 )
+        {
+            if ( m_config.packetBudget > 0 )
+                availableBits = min( availableBits, m_config.packetBudget * 8 - ( ConservativeFragmentHeaderEstimate + m_config.fragmentSize * 8 ) );
+
+            while ( numPacketFragments < m_config.maxBlockFragmentsPerPacket && availableBits >= m_config.fragmentSize * 8 )
+            {
+                const int nextFragmentId = fragmentId + numPacketFragments;
+
+                if ( nextFragmentId >= m_sendBlock->numFragments || !FragmentReadyToSend( nextFragmentId ) )
+                    break;
+
+                availableBits -= m_config.fragmentSize * 8;
+
+                numPacketFragments++;
+            }
+        }
+
+        // return the fragment data in place. the packet data holds a reference to the block message, so it stays valid until the packet is destroyed
+
+        const int lastFragmentId = fragmentId + numPacketFragments - 1;
+
+        fragmentBytes = numPacketFragments * m_config.fragmentSize;
         
         const int fragmentRemainder = blockSize % m_config.fragmentSize;
 
-        if ( fragmentRemainder && fragmentId == m_sendBlock->numFragments - 1 )
-            fragmentBytes = fragmentRemainder;
+        if ( fragmentRemainder && lastFragmentId == m_sendBlock->numFragments - 1 )
+            fragmentBytes -= m_config.fragmentSize - fragmentRemainder;
 
-        uint8_t * fragmentData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), fragmentBytes );
-
-        if ( fragmentData )
+        for ( int i = fragmentId; i <= lastFragmentId; ++i )
         {
-            memcpy( fragmentData, blockMessage->GetBlockData() + fragmentId * m_config.fragmentSize, fragmentBytes );
+            m_sendBlock->fragmentSendTime[i] = m_time;
+            m_sendBlock->lostFragment->ClearBit( i );
 
-            m_sendBlock->fragmentSendTime[fragmentId] = m_time;
+            if ( m_sendBlock->fragmentSendCount[i] < 0xFFFF )
+                m_sendBlock->fragmentSendCount[i]++;
         }
 
-        return fragmentData;
+        return blockMessage->GetBlockData() + fragmentId * m_config.fragmentSize;
+    }
+
+    bool ReliableOrderedChannel::FragmentReadyToSend( int fragmentId ) const
+    {
+        if ( m_config.streamBlocks && fragmentId >= m_sendBlock->firstUnackedFragment + m_config.blockStreamWindow )
+            return false;
+
+        if ( m_sendBlock->ackedFragment->GetBit( fragmentId ) )
+            return false;
+
+        return m_sendBlock->lostFragment->GetBit( fragmentId ) || m_sendBlock->fragmentSendTime[fragmentId] + GetResendTime( m_config.fragmentResendTime, m_sendBlock->fragmentSendCount[fragmentId] ) < m_time;
     }
 
-    int ReliableOrderedChannel::GetFragmentPacketData( ChannelPacketData & packetData, uint16_t messageId, uint16_t fragmentId, uint8_t * fragmentData, int fragmentSize, int numFragments, int messageType )
+    int ReliableOrderedChannel::GetFragmentPacketData( ChannelPacketData & packetData, uint16_t messageId, uint16_t fragmentId, int numPacketFragments, uint8_t * fragmentData, int fragmentSize, int numFragments, int messageType, Allocator * packetAllocator )
     {
-        packetData.Initialize();
+        packetData.Initialize( packetAllocator );
 
         packetData.channelId = GetChannelId();
 
         packetData.blockMessage = 1;
 
+        packetData.block.announce = false;
+        packetData.block.compressed = m_sendBlock->compressed;
+        packetData.block.blockSize = m_sendBlock->uncompressedBlockSize;
         packetData.block.fragmentData = fragmentData;
+        packetData.block.ownsFragmentData = false;
         packetData.block.messageId = messageId;
         packetData.block.fragmentId = fragmentId;
+        packetData.block.numPacketFragments = numPacketFragments;
         packetData.block.fragmentSize = fragmentSize;
         packetData.block.numFragments = numFragments;
         packetData.block.messageType = messageType;
+        packetData.block.messages.numMessages = 0;
+        packetData.block.messages.messages = NULL;
+        packetData.block.messages.messageIds = NULL;
 
-        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+        int fragmentBits = ConservativeFragmentHeaderEstimate + fragmentSize * 8;
 
-        int fragmentBits = ConservativeFragmentHeaderEstimate + fragmentSize;
+        MessageSendQueueEntry * entry = m_messageSendQueue->Find( packetData.block.messageId );
 
-        if ( fragmentId == 0 )
-        {
-            MessageSendQueueEntry * entry = m_messageSendQueue->Find( packetData.block.messageId );
+        assert( entry );
+        assert( entry->message );
 
-            assert( entry );
-            assert( entry->message );
+        // IMPORTANT: The fragment data points into the block attached to this message, so hold a reference to it for every fragment, not just fragment 0.
 
-            packetData.block.message = (BlockMessage*) entry->message;
+        packetData.block.message = (BlockMessage*) entry->message;
 
-            m_messageFactory->AddRef( packetData.block.message );
+        m_messageFactory->AddRef( packetData.block.message );
 
-            fragmentBits += entry->measuredBits + messageTypeBits;
-        }
-        else
-        {
-            packetData.block.message = NULL;
-        }
+        if ( fragmentId == 0 )
+            fragmentBits += entry->measuredBits + m_messageFactory->GetTypeBits( messageType );
+
+        if ( fragmentId == 0 && m_config.compressBlocks )
+            fragmentBits += 1 + ( m_sendBlock->compressed ? bits_required( 1, m_config.maxBlockSize ) : 0 );
 
         return fragmentBits;
     }
 
-    void ReliableOrderedChannel::AddFragmentPacketEntry( uint16_t messageId, uint16_t fragmentId, uint16_t sequence )
+    void ReliableOrderedChannel::AddFragmentPacketEntry( uint16_t messageId, uint16_t fragmentId, int numPacketFragments, const uint16_t * messageIds, int numMessageIds, uint16_t sequence )
     {
         SentPacketEntry * sentPacket = m_sentPackets->Insert( sequence );
         
@@ -1092,26 +2633,55 @@ namespace yojimbo
 
         if ( sentPacket )
         {
-            sentPacket->numMessageIds = 0;
+            sentPacket->numMessageIds = numMessageIds;
             sentPacket->messageIds = NULL;
+            if ( numMessageIds > 0 )
+            {
+                AllocateSentPacketMessageIds( sentPacket, numMessageIds, sequence );
+                for ( int i = 0; i < numMessageIds; ++i )
+                    sentPacket->messageIds[i] = messageIds[i];
+            }
             sentPacket->timeSent = m_time;
             sentPacket->acked = 0;
             sentPacket->block = 1;
             sentPacket->blockMessageId = messageId;
             sentPacket->blockFragmentId = fragmentId;
+            sentPacket->blockNumFragments = numPacketFragments;
         }
     }
 
-    void ReliableOrderedChannel::ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, uint16_t fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage )
+    void ReliableOrderedChannel::ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, uint16_t fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage, int uncompressedBlockSize )
     {  
         assert( !m_config.disableBlocks );
 
         if ( fragmentData )
         {
-            const uint16_t expectedMessageId = m_messageReceiveQueue->GetSequence();
+            if ( m_config.sendMessagesWithFragments )
+            {
+                // IMPORTANT: messages sent after the block may already be in the receive queue, so its sequence can't be used to find the block id.
+                // The sender only sends fragments once every message before the block is acked, so any block not received yet is the one being sent.
 
-            if ( messageId != expectedMessageId )
-                return;
+                const uint16_t offset = uint16_t( messageId - m_receiveMessageId );
+
+                if ( offset >= MaxReliableMessageWindow || m_messageReceiveQueue->Find( messageId ) )
+                    return;
+
+                if ( offset >= m_config.receiveQueueSize )
+                {
+                    SetError( CHANNEL_ERROR_DESYNC );
+                    return;
+                }
+
+                if ( m_receiveBlock->active && m_receiveBlock->messageId != messageId )
+                    return;
+            }
+            else
+            {
+                const uint16_t expectedMessageId = m_messageReceiveQueue->GetSequence();
+
+                if ( messageId != expectedMessageId )
+                    return;
+            }
 
             // start receiving a new block
 
@@ -1123,9 +2693,28 @@ namespace yojimbo
                 m_receiveBlock->active = true;
                 m_receiveBlock->numFragments = numFragments;
                 m_receiveBlock->numReceivedFragments = 0;
+                m_receiveBlock->numStreamedFragments = 0;
                 m_receiveBlock->messageId = messageId;
                 m_receiveBlock->blockSize = 0;
+                m_receiveBlock->uncompressedBlockSize = 0;
                 m_receiveBlock->receivedFragment->Clear();
+
+                // IMPORTANT: The reassembly buffer is handed over to the block message when the block completes, so allocate it per-block.
+                // The block size isn't known until the last fragment arrives, so allocate enough for all fragments at full size.
+                // When streaming blocks, only the fragments in the stream window are buffered.
+
+                const int numBufferedFragments = m_config.streamBlocks ? min( numFragments, m_config.blockStreamWindow ) : numFragments;
+
+                assert( !m_receiveBlock->blockData );
+
+                m_receiveBlock->blockData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), numBufferedFragments * m_config.fragmentSize );
+
+                if ( !m_receiveBlock->blockData )
+                {
+                    m_receiveBlock->active = false;
+                    SetError( CHANNEL_ERROR_OUT_OF_MEMORY );
+                    return;
+                }
             }
 
             // validate fragment
@@ -1142,103 +2731,1134 @@ namespace yojimbo
                 return;
             }
 
-            // receive the fragment
+            // receive the fragment
+
+            if ( !m_receiveBlock->receivedFragment->GetBit( fragmentId ) )
+            {
+                // IMPORTANT: The sender never has fragments in flight past the stream window, so a fragment outside of it means the two sides disagree on the channel config.
+
+                if ( m_config.streamBlocks && fragmentId >= m_receiveBlock->numStreamedFragments + m_config.blockStreamWindow )
+                {
+                    SetError( CHANNEL_ERROR_DESYNC );
+                    return;
+                }
+
+                if ( m_listener )
+                    m_listener->OnChannelFragmentReceived( this, messageId, fragmentId, fragmentBytes, m_receiveBlock->numReceivedFragments + 1, m_receiveBlock->numFragments );
+                
+                m_receiveBlock->receivedFragment->SetBit( fragmentId );
+
+                const int fragmentSlot = m_config.streamBlocks ? fragmentId % m_config.blockStreamWindow : fragmentId;
+
+                memcpy( m_receiveBlock->blockData + fragmentSlot * m_config.fragmentSize, fragmentData, fragmentBytes );
+
+                if ( fragmentId == 0 )
+                {
+                    m_receiveBlock->messageType = messageType;
+                    m_receiveBlock->uncompressedBlockSize = uncompressedBlockSize;
+                }
+
+                if ( fragmentId == m_receiveBlock->numFragments - 1 )
+                {
+                    m_receiveBlock->blockSize = ( m_receiveBlock->numFragments - 1 ) * m_config.fragmentSize + fragmentBytes;
+
+                    assert( m_receiveBlock->blockSize <= (uint32_t) m_config.maxBlockSize );
+                }
+
+                m_receiveBlock->numReceivedFragments++;
+
+                if ( fragmentId == 0 )
+                {
+                    // save block message (sent with fragment 0)
+
+                    m_receiveBlock->blockMessage = blockMessage;
+
+                    m_messageFactory->AddRef( m_receiveBlock->blockMessage );
+                }
+
+                if ( m_config.streamBlocks )
+                    StreamBlockData();
+
+                if ( m_receiveBlock->numReceivedFragments == m_receiveBlock->numFragments )
+                {
+                    // finished receiving block
+
+                    blockMessage = m_receiveBlock->blockMessage;
+
+                    assert( blockMessage );
+
+                    if ( m_config.streamBlocks )
+                    {
+                        // the block data has already been passed to the listener, so the message is received without it
+
+                        assert( m_receiveBlock->numStreamedFragments == m_receiveBlock->numFragments );
+
+                        YOJIMBO_FREE( m_messageFactory->GetAllocator(), m_receiveBlock->blockData );
+                    }
+                    else
+                    {
+                        if ( m_receiveBlock->uncompressedBlockSize > 0 )
+                        {
+                            // IMPORTANT: The block message always gets the block as it was before it was compressed.
+
+                            const int uncompressedBlockSize = m_receiveBlock->uncompressedBlockSize;
+
+                            uint8_t * uncompressedBlockData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), uncompressedBlockSize );
+
+                            if ( !uncompressedBlockData )
+                            {
+                                SetError( CHANNEL_ERROR_OUT_OF_MEMORY );
+                                return;
+                            }
+
+                            const int decompressedBytes = m_blockCompressor ? m_blockCompressor->Decompress( m_receiveBlock->blockData, m_receiveBlock->blockSize, uncompressedBlockData, uncompressedBlockSize ) : 0;
+
+                            YOJIMBO_FREE( m_messageFactory->GetAllocator(), m_receiveBlock->blockData );
+
+                            m_receiveBlock->blockData = uncompressedBlockData;
+
+                            if ( decompressedBytes != uncompressedBlockSize )
+                            {
+                                SetError( CHANNEL_ERROR_DESYNC );
+                                return;
+                            }
+
+                            m_receiveBlock->blockSize = uncompressedBlockSize;
+                            m_receiveBlock->uncompressedBlockSize = 0;
+                        }
+
+                        if ( m_config.blockCache && m_listener )
+                            m_listener->OnChannelBlockCacheStore( this, murmur_hash_64( m_receiveBlock->blockData, m_receiveBlock->blockSize, 0 ), m_receiveBlock->blockData, m_receiveBlock->blockSize );
+
+                        // hand the reassembly buffer over to the block message instead of copying it
+
+                        blockMessage->AttachBlock( m_messageFactory->GetAllocator(), m_receiveBlock->blockData, m_receiveBlock->blockSize );
+
+                        m_receiveBlock->blockData = NULL;
+                    }
+
+                    blockMessage->SetId( messageId );
+
+                    MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
+
+                    assert( entry );
+
+                    if ( !entry )
+                    {
+                        SetError( CHANNEL_ERROR_DESYNC );
+                        return;
+                    }
+
+                    m_receiveBlock->active = false;
+                    m_receiveBlock->blockMessage = NULL;
+
+                    entry->message = blockMessage;
+                }
+            }
+        }
+    }
+
+    void ReliableOrderedChannel::StreamBlockData()
+    {
+        assert( m_config.streamBlocks );
+        assert( m_receiveBlock->active );
+
+        while ( m_receiveBlock->numStreamedFragments < m_receiveBlock->numFragments && m_receiveBlock->receivedFragment->GetBit( m_receiveBlock->numStreamedFragments ) )
+        {
+            const int fragmentId = m_receiveBlock->numStreamedFragments;
+
+            const bool lastFragment = fragmentId == m_receiveBlock->numFragments - 1;
+
+            const int fragmentBytes = lastFragment ? m_receiveBlock->blockSize - fragmentId * m_config.fragmentSize : m_config.fragmentSize;
+            
+            const uint8_t * fragmentData = m_receiveBlock->blockData + ( fragmentId % m_config.blockStreamWindow ) * m_config.fragmentSize;
+
+            // IMPORTANT: Fragment 0 is always streamed first, and the block message is sent with it, so the block message is always known here.
+
+            assert( m_receiveBlock->blockMessage );
+
+            if ( m_listener )
+                m_listener->OnChannelBlockDataReceived( this, m_receiveBlock->messageId, m_receiveBlock->blockMessage, fragmentId * m_config.fragmentSize, fragmentData, fragmentBytes, lastFragment );
+
+            m_receiveBlock->numStreamedFragments++;
+        }
+    }
+
+    void ReliableOrderedChannel::ProcessBlockAnnounce( const ChannelPacketData::BlockData & block )
+    {
+        assert( !m_config.disableBlocks );
+        assert( block.message );
+
+        const uint16_t messageId = block.messageId;
+
+        // IMPORTANT: A block that was already received is answered as a cache hit, so the sender stops announcing it.
+        // This happens when the reply to an earlier announcement was lost.
+
+        bool received = false;
+
+        if ( m_config.sendMessagesWithFragments )
+        {
+            const uint16_t offset = uint16_t( messageId - m_receiveMessageId );
+
+            received = offset >= MaxReliableMessageWindow || m_messageReceiveQueue->Find( messageId ) != NULL;
+
+            if ( !received && offset >= m_config.receiveQueueSize )
+            {
+                SetError( CHANNEL_ERROR_DESYNC );
+                return;
+            }
+        }
+        else
+        {
+            const uint16_t expectedMessageId = m_messageReceiveQueue->GetSequence();
+
+            if ( sequence_greater_than( messageId, expectedMessageId ) )
+                return;
+
+            received = messageId != expectedMessageId;
+        }
+
+        bool hit = received;
+
+        if ( !received )
+        {
+            // IMPORTANT: Once fragments of the block are arriving, the cache must not be checked again, or the block could be received twice.
+
+            if ( m_receiveBlock->active )
+            {
+                if ( m_receiveBlock->messageId != messageId )
+                    return;
+            }
+            else
+            {
+                SharedBlock * sharedBlock = m_listener ? m_listener->OnChannelBlockCacheFind( this, block.blockHash, block.blockSize ) : NULL;
+
+                if ( sharedBlock && sharedBlock->GetSize() == block.blockSize )
+                {
+                    MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
+
+                    if ( !entry )
+                    {
+                        SetError( CHANNEL_ERROR_DESYNC );
+                        return;
+                    }
+
+                    BlockMessage * blockMessage = block.message;
+
+                    m_messageFactory->AddRef( blockMessage );
+
+                    blockMessage->AttachSharedBlock( sharedBlock );
+
+                    blockMessage->SetId( messageId );
+
+                    entry->message = blockMessage;
+
+                    hit = true;
+                }
+            }
+        }
+
+        m_blockCacheReplyPending = true;
+        m_blockCacheReplyHit = hit;
+        m_blockCacheReplyMessageId = messageId;
+    }
+
+    void ReliableOrderedChannel::ProcessBlockCacheReply( uint16_t messageId, bool hit )
+    {
+        if ( m_config.disableBlocks || !m_sendBlock->active || !m_sendBlock->waitingForCacheReply || m_sendBlock->blockMessageId != messageId )
+            return;
+
+        m_sendBlock->waitingForCacheReply = false;
+
+        if ( !hit )
+        {
+            m_counters[CHANNEL_COUNTER_BLOCK_CACHE_MISSES]++;
+
+            if ( m_blockCompressor )
+            {
+                MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( messageId );
+
+                assert( sendQueueEntry );
+
+                CompressSendBlock( (BlockMessage*) sendQueueEntry->message );
+            }
+
+            return;
+        }
+
+        // the other side has the block already, so it is acked without sending any fragments
+
+        m_counters[CHANNEL_COUNTER_BLOCK_CACHE_HITS]++;
+
+        m_sendBlock->active = false;
+
+        MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( messageId );
+
+        assert( sendQueueEntry );
+
+        m_messageFactory->Release( sendQueueEntry->message );
+
+        m_messageSendQueue->Remove( messageId );
+
+        UpdateOldestUnackedMessageId();
+    }
+
+    // ------------------------------------------------
+
+    UnreliableUnorderedChannel::UnreliableUnorderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId ) : Channel( allocator, messageFactory, config, channelId )
+    {
+        assert( config.type == CHANNEL_TYPE_UNRELIABLE_UNORDERED || config.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED || config.type == CHANNEL_TYPE_UNRELIABLE_LATEST_STATE );
+
+        m_messageSendQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.sendQueueSize );
+        
+        m_messageReceiveQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.receiveQueueSize );
+
+        m_sendQueueBits = NULL;
+        m_redundantMessages = NULL;
+        m_receivedMessageIds = NULL;
+        m_sendQueueKeys = NULL;
+        m_playoutBuffer = NULL;
+        m_numPlayoutMessages = 0;
+
+        if ( m_config.playoutBuffer )
+            m_playoutBuffer = (PlayoutEntry*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( PlayoutEntry ) * m_config.receiveQueueSize );
+
+        // IMPORTANT: packing reorders messages, so it would break the ordering guarantee of unreliable-sequenced channels
+
+        if ( m_config.packingWindow > 1 && m_config.type != CHANNEL_TYPE_UNRELIABLE_SEQUENCED )
+            m_sendQueueBits = YOJIMBO_NEW( *m_allocator, Queue<int>, *m_allocator, m_config.sendQueueSize );
+
+        if ( m_config.redundancyWindow > 1 )
+        {
+            // IMPORTANT: messages leave the window after redundancyWindow - 1 more packets, and each packet adds at most maxMessagesPerPacket messages to it, so it never holds more than this
+
+            m_redundantMessages = YOJIMBO_NEW( *m_allocator, Queue<RedundantMessageEntry>, *m_allocator, ( m_config.redundancyWindow - 1 ) * m_config.maxMessagesPerPacket );
+
+            m_receivedMessageIds = YOJIMBO_NEW( *m_allocator, SequenceBuffer<uint8_t>, *m_allocator, m_config.receiveQueueSize );
+        }
+
+        Reset();
+    }
+
+    UnreliableUnorderedChannel::~UnreliableUnorderedChannel()
+    {
+        Reset();
+
+        YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageSendQueue );
+        YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageReceiveQueue );
+        YOJIMBO_DELETE( *m_allocator, Queue<int>, m_sendQueueBits );
+        YOJIMBO_DELETE( *m_allocator, Queue<RedundantMessageEntry>, m_redundantMessages );
+        YOJIMBO_DELETE( *m_allocator, SequenceBuffer<uint8_t>, m_receivedMessageIds );
+        YOJIMBO_DELETE( *m_allocator, IdMap, m_sendQueueKeys );
+        YOJIMBO_FREE( *m_allocator, m_playoutBuffer );
+    }
+
+    void UnreliableUnorderedChannel::Reset()
+    {
+        SetError( CHANNEL_ERROR_NONE );
+
+        for ( int i = 0; i < m_messageSendQueue->GetNumEntries(); ++i )
+            m_messageFactory->Release( (*m_messageSendQueue)[i] );
+
+        for ( int i = 0; i < m_messageReceiveQueue->GetNumEntries(); ++i )
+            m_messageFactory->Release( (*m_messageReceiveQueue)[i] );
+
+        m_messageSendQueue->Clear();
+        m_messageReceiveQueue->Clear();
+
+        if ( m_sendQueueKeys )
+            m_sendQueueKeys->Clear();
+
+        if ( m_sendQueueBits )
+            m_sendQueueBits->Clear();
+
+        m_sendQueueHead = 0;
+
+        if ( m_redundantMessages )
+        {
+            for ( int i = 0; i < m_redundantMessages->GetNumEntries(); ++i )
+                m_messageFactory->Release( (*m_redundantMessages)[i].message );
+
+            m_redundantMessages->Clear();
+        }
+
+        if ( m_receivedMessageIds )
+            m_receivedMessageIds->Reset();
+
+        m_sendMessageId = 0;
+
+        for ( int i = 0; i < m_numPlayoutMessages; ++i )
+            m_messageFactory->Release( m_playoutBuffer[i].message );
+
+        m_numPlayoutMessages = 0;
+        m_playoutReceivedPacket = false;
+        m_playoutSendTime = 0;
+        m_playoutSenderTime = 0.0;
+        m_playoutReceiveTime = 0.0;
+        m_playoutOffset[0] = 0.0;
+        m_playoutOffset[1] = 0.0;
+        m_playoutWindowStart = 0.0;
+  
+        ResetCounters();
+    }
+
+    bool UnreliableUnorderedChannel::CanSendMsg() const
+    {
+        assert( m_messageSendQueue );
+        return !m_messageSendQueue->IsFull();
+    }
+
+    bool UnreliableUnorderedChannel::CanSendMsgs( int numMessages ) const
+    {
+        assert( m_messageSendQueue );
+        return m_messageSendQueue->GetNumEntries() + numMessages <= m_messageSendQueue->GetSize();
+    }
+
+    void UnreliableUnorderedChannel::SendMsg( Message * message )
+    {
+        assert( message );
+        assert( CanSendMsg() || FindQueuedKey( message ) >= 0 );
+
+        if ( GetError() != CHANNEL_ERROR_NONE )
+        {
+            m_messageFactory->Release( message );
+            return;
+        }
+
+        // IMPORTANT: a message that replaces a queued message with the same key doesn't take up a send queue entry, so it can be sent while the queue is full
+
+        if ( !CanSendMsg() && FindQueuedKey( message ) < 0 )
+        {
+            SetError( CHANNEL_ERROR_SEND_QUEUE_FULL );
+            m_messageFactory->Release( message );
+            return;
+        }
+
+        assert( !( message->IsBlockMessage() && m_config.disableBlocks ) );
+
+        if ( message->IsBlockMessage() && m_config.disableBlocks )
+        {
+            SetError( CHANNEL_ERROR_BLOCKS_DISABLED );
+            m_messageFactory->Release( message );
+            return;
+        }
+
+        if ( message->IsBlockMessage() )
+        {
+            assert( ((BlockMessage*)message)->GetBlockSize() > 0 );
+            assert( ((BlockMessage*)message)->GetBlockSize() <= m_config.maxBlockSize );
+        }
+
+        if ( message->HasKey() )
+        {
+            const int index = FindQueuedKey( message );
+
+            if ( index >= 0 )
+            {
+                // IMPORTANT: the queued message hasn't been included in a packet yet, so it can be swapped out in place. The new message keeps its position in the queue
+
+                m_messageFactory->Release( (*m_messageSendQueue)[index] );
+
+                (*m_messageSendQueue)[index] = message;
+
+                if ( m_sendQueueBits )
+                    (*m_sendQueueBits)[index] = -1;
+
+                m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
+                m_counters[CHANNEL_COUNTER_MESSAGES_REPLACED]++;
+
+                return;
+            }
+
+            if ( !m_sendQueueKeys )
+                m_sendQueueKeys = YOJIMBO_NEW( *m_allocator, IdMap, *m_allocator, m_config.sendQueueSize );
+
+            const uint32_t position = m_sendQueueHead + m_messageSendQueue->GetNumEntries();
+
+            const bool inserted = m_sendQueueKeys->Insert( message->GetKey(), int( position & 0x7FFFFFFF ) );
+
+            assert( inserted );
+            (void) inserted;
+        }
+
+        m_messageSendQueue->Push( message );
+
+        if ( m_sendQueueBits )
+            m_sendQueueBits->Push( -1 );
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
+    }
+
+    int UnreliableUnorderedChannel::FindQueuedKey( const Message * message ) const
+    {
+        assert( message );
+
+        if ( !message->HasKey() || !m_sendQueueKeys )
+            return -1;
+
+        const int position = m_sendQueueKeys->Find( message->GetKey() );
+
+        if ( position < 0 )
+            return -1;
+
+        const int index = int( ( uint32_t( position ) - m_sendQueueHead ) & 0x7FFFFFFF );
+
+        assert( index < m_messageSendQueue->GetNumEntries() );
+
+        return index;
+    }
+
+    Message * UnreliableUnorderedChannel::PopSendQueue()
+    {
+        Message * message = m_messageSendQueue->Pop();
+
+        assert( message );
+
+        m_sendQueueHead++;
+
+        if ( m_sendQueueBits )
+            m_sendQueueBits->Pop();
+
+        if ( message->HasKey() && m_sendQueueKeys )
+            m_sendQueueKeys->Remove( message->GetKey() );
+
+        return message;
+    }
+
+    Message * UnreliableUnorderedChannel::ReceiveMsg()
+    {
+        if ( GetError() != CHANNEL_ERROR_NONE )
+            return NULL;
+
+        if ( m_messageReceiveQueue->IsEmpty() )
+            return NULL;
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
+
+        return m_messageReceiveQueue->Pop();
+    }
+
+    void UnreliableUnorderedChannel::AdvanceTime( double time )
+    {
+        m_time = time;
+
+        if ( m_playoutBuffer )
+            UpdatePlayoutBuffer();
+    }
+
+    double UnreliableUnorderedChannel::GetPlayoutTime( uint16_t sendTime )
+    {
+        int delta = int16_t( sendTime - m_playoutSendTime );
+
+        // IMPORTANT: Send times wrap around every 65.536 seconds, so they can only be unwrapped across short gaps between packets. Start over as if this was the first packet after a long gap, or when the sender's clock jumps by more than any packet could be reordered by, eg. packets sent before the sender's first update.
+
+        if ( !m_playoutReceivedPacket || m_time - m_playoutReceiveTime > 30.0 || delta > 10000 || delta < -10000 )
+        {
+            m_playoutReceivedPacket = true;
+            m_playoutSendTime = sendTime;
+            m_playoutSenderTime = sendTime * 0.001;
+            m_playoutReceiveTime = m_time;
+            m_playoutOffset[0] = m_playoutOffset[1] = m_time - m_playoutSenderTime;
+            m_playoutWindowStart = m_time;
+            delta = 0;
+        }
+
+        const double senderTime = m_playoutSenderTime + delta * 0.001;
+
+        if ( delta > 0 )
+        {
+            m_playoutSendTime = sendTime;
+            m_playoutSenderTime = senderTime;
+            m_playoutReceiveTime = m_time;
+        }
+
+        const double offset = m_time - senderTime;
+
+        if ( m_time >= m_playoutWindowStart + PlayoutOffsetWindow )
+        {
+            m_playoutOffset[1] = m_playoutOffset[0];
+            m_playoutOffset[0] = offset;
+            m_playoutWindowStart = m_time;
+        }
+        else
+        {
+            m_playoutOffset[0] = min( m_playoutOffset[0], offset );
+        }
+
+        const float targetDelay = clamp( 2.0f * m_rttVariance, m_config.minPlayoutDelay, m_config.maxPlayoutDelay );
+
+        return senderTime + min( m_playoutOffset[0], m_playoutOffset[1] ) + targetDelay;
+    }
+
+    void UnreliableUnorderedChannel::AddPlayoutMessage( Message * message, double playoutTime )
+    {
+        assert( m_playoutBuffer );
+        assert( m_numPlayoutMessages < m_config.receiveQueueSize );
+
+        if ( playoutTime < m_time )
+            m_counters[CHANNEL_COUNTER_PLAYOUT_LATE_MESSAGES]++;
+
+        int index = m_numPlayoutMessages;
+
+        while ( index > 0 && m_playoutBuffer[index-1].playoutTime > playoutTime )
+        {
+            m_playoutBuffer[index] = m_playoutBuffer[index-1];
+            index--;
+        }
+
+        m_playoutBuffer[index].message = message;
+        m_playoutBuffer[index].playoutTime = playoutTime;
+
+        m_numPlayoutMessages++;
+    }
+
+    void UnreliableUnorderedChannel::UpdatePlayoutBuffer()
+    {
+        int numMessages = 0;
+
+        while ( numMessages < m_numPlayoutMessages && m_playoutBuffer[numMessages].playoutTime <= m_time && !m_messageReceiveQueue->IsFull() )
+        {
+            m_messageReceiveQueue->Push( m_playoutBuffer[numMessages].message );
+            numMessages++;
+        }
+
+        if ( numMessages == 0 )
+            return;
+
+        m_numPlayoutMessages -= numMessages;
+
+        memmove( m_playoutBuffer, m_playoutBuffer + numMessages, sizeof( PlayoutEntry ) * m_numPlayoutMessages );
+    }
+    
+    int UnreliableUnorderedChannel::MeasureMessage( Message * message )
+    {
+        assert( message );
+
+        if ( m_redundantMessages && !message->IsBlockMessage() && !message->IsBroadcastMessage() )
+        {
+            // IMPORTANT: the message is serialized once here. This packet and every redundant copy after it copy these bits instead of serializing it again
+
+            const int bits = m_messageFactory->CacheSerializedMessage( message );
+
+            return ( bits >= 0 ) ? bits + m_messageFactory->GetTypeBits( message->GetType() ) : -1;
+        }
+
+        MeasureStream measureStream;
+
+        m_messageFactory->SerializeMessage( message, measureStream );
+
+        if ( message->IsBlockMessage() )
+        {
+            BlockMessage * blockMessage = (BlockMessage*) message;
+            
+            SerializeMessageBlock( measureStream, *m_messageFactory, blockMessage, m_config.maxBlockSize );
+        }
+
+        return measureStream.GetBitsProcessed() + m_messageFactory->GetTypeBits( message->GetType() );
+    }
+
+    void UnreliableUnorderedChannel::PackMessages( Message ** messages, int * measuredBits, int & numMessages, int & usedBits, int availableBits, int messageTypeBits )
+    {
+        assert( m_sendQueueBits );
+        assert( m_sendQueueBits->GetNumEntries() == m_messageSendQueue->GetNumEntries() );
+
+        const int giveUpBits = 4 * 8;
+
+        const int windowSize = min( m_config.packingWindow, m_messageSendQueue->GetNumEntries() );
+
+        if ( windowSize == 0 || availableBits - usedBits < giveUpBits )
+            return;
+
+        enum { PACK_KEEP, PACK_SEND, PACK_DROP };
+
+        uint8_t * state = (uint8_t*) alloca( windowSize );
+
+        // IMPORTANT: each message is measured once, the first time it enters the window. It can wait in the window for several packets before it fits
+
+        for ( int i = 0; i < windowSize; ++i )
+        {
+            int & bits = (*m_sendQueueBits)[i];
+
+            if ( bits < 0 )
+                bits = MeasureMessage( (*m_messageSendQueue)[i] );
+
+            state[i] = ( bits < 0 ) ? PACK_DROP : PACK_KEEP;
+        }
+
+        // the oldest message always goes first, so every message leaves the window eventually. if it doesn't fit it is dropped, like it would be without packing
+
+        int numRemoved = 0;
+
+        for ( int i = 0; i < windowSize; ++i )
+        {
+            if ( state[i] == PACK_DROP )
+            {
+                numRemoved++;
+                continue;
+            }
+
+            if ( usedBits + messageTypeBits + (*m_sendQueueBits)[i] <= availableBits && numMessages < m_config.maxMessagesPerPacket )
+            {
+                usedBits += messageTypeBits + (*m_sendQueueBits)[i];
+                state[i] = PACK_SEND;
+                numMessages++;
+            }
+            else
+            {
+                state[i] = PACK_DROP;
+            }
+
+            numRemoved++;
+
+            break;
+        }
+
+        // fill the rest of the packet with the largest messages that still fit
+
+        while ( numMessages < m_config.maxMessagesPerPacket && availableBits - usedBits >= giveUpBits )
+        {
+            int best = -1;
+
+            for ( int i = 0; i < windowSize; ++i )
+            {
+                if ( state[i] != PACK_KEEP )
+                    continue;
+
+                const int bits = (*m_sendQueueBits)[i];
+
+                if ( usedBits + messageTypeBits + bits > availableBits )
+                    continue;
+
+                if ( best < 0 || bits > (*m_sendQueueBits)[best] )
+                    best = i;
+            }
+
+            if ( best < 0 )
+                break;
+
+            usedBits += messageTypeBits + (*m_sendQueueBits)[best];
+            state[best] = PACK_SEND;
+            numMessages++;
+            numRemoved++;
+        }
+
+        assert( usedBits <= availableBits );
+
+        // move the removed messages to the front of the queue, and the messages that stay behind them, keeping the order of both. messages that move get their key position updated
+
+        Message ** keptMessages = (Message**) alloca( sizeof( Message* ) * windowSize );
+
+        int * keptBits = (int*) alloca( sizeof( int ) * windowSize );
+
+        int numKept = 0;
+        int removedIndex = 0;
+
+        for ( int i = 0; i < windowSize; ++i )
+        {
+            if ( state[i] == PACK_KEEP )
+            {
+                keptMessages[numKept] = (*m_messageSendQueue)[i];
+                keptBits[numKept] = (*m_sendQueueBits)[i];
+                numKept++;
+            }
+            else
+            {
+                (*m_messageSendQueue)[removedIndex] = (*m_messageSendQueue)[i];
+                (*m_sendQueueBits)[removedIndex] = (*m_sendQueueBits)[i];
+                state[removedIndex] = state[i];
+                removedIndex++;
+            }
+        }
+
+        assert( removedIndex == numRemoved );
+
+        for ( int i = 0; i < numKept; ++i )
+        {
+            const int index = numRemoved + i;
+
+            (*m_messageSendQueue)[index] = keptMessages[i];
+            (*m_sendQueueBits)[index] = keptBits[i];
+
+            if ( keptMessages[i]->HasKey() && m_sendQueueKeys )
+                m_sendQueueKeys->Insert( keptMessages[i]->GetKey(), int( ( m_sendQueueHead + index ) & 0x7FFFFFFF ) );
+        }
+
+        int numPacked = 0;
+
+        for ( int i = 0; i < numRemoved; ++i )
+        {
+            const int bits = (*m_sendQueueBits)[0];
+
+            Message * message = PopSendQueue();
+
+            if ( state[i] == PACK_DROP )
+            {
+                m_messageFactory->Release( message );
+                continue;
+            }
+
+            measuredBits[numPacked] = bits;
+            messages[numPacked++] = message;
+        }
+
+        assert( numPacked == numMessages );
+    }
+
+    void UnreliableUnorderedChannel::AddRedundantMessages( Message ** messages, int & numMessages, int & usedBits, int availableBits, int messageTypeBits )
+    {
+        assert( m_redundantMessages );
+
+        int numRedundantMessages = 0;
+
+        for ( int i = m_redundantMessages->GetNumEntries() - 1; i >= 0; --i )
+        {
+            if ( numMessages + numRedundantMessages == m_config.maxMessagesPerPacket )
+                break;
+
+            const int messageBits = messageTypeBits + (*m_redundantMessages)[i].measuredBits;
+
+            if ( usedBits + messageBits > availableBits )
+                break;
+
+            usedBits += messageBits;
+
+            numRedundantMessages++;
+        }
+
+        if ( numRedundantMessages > 0 )
+        {
+            // IMPORTANT: redundant messages were sent before the new messages, so they go first. This keeps the message ids in the packet consecutive
+
+            memmove( messages + numRedundantMessages, messages, sizeof( Message* ) * numMessages );
+
+            const int firstEntry = m_redundantMessages->GetNumEntries() - numRedundantMessages;
+
+            for ( int i = 0; i < numRedundantMessages; ++i )
+            {
+                Message * message = (*m_redundantMessages)[firstEntry + i].message;
+                m_messageFactory->AddRef( message );
+                messages[i] = message;
+            }
+
+            numMessages += numRedundantMessages;
+
+            m_counters[CHANNEL_COUNTER_REDUNDANT_MESSAGES_SENT] += numRedundantMessages;
+        }
+
+        for ( int i = 0; i < m_redundantMessages->GetNumEntries(); ++i )
+            (*m_redundantMessages)[i].packetsRemaining--;
+
+        while ( !m_redundantMessages->IsEmpty() && (*m_redundantMessages)[0].packetsRemaining <= 0 )
+            m_messageFactory->Release( m_redundantMessages->Pop().message );
+    }
+
+    int UnreliableUnorderedChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits, Allocator * packetAllocator )
+    {
+        (void) packetSequence;
+
+        if ( !HasMessagesToSend() )
+            return 0;
+
+        if ( m_config.packetBudget > 0 )
+            availableBits = min( m_config.packetBudget * 8, availableBits );
+
+        const int giveUpBits = 4 * 8;
+
+        const bool redundant = m_redundantMessages != NULL;
+
+        // IMPORTANT: with redundancy, each message is byte aligned so its cached bits can be copied as-is, which takes up to 7 bits. The packet also has the 16 bit id of its first message. The message type is included in the measured bits of each message, since its size can depend on the type
+
+        const int messageTypeBits = ( redundant ? 7 : 0 ) + GetMessageSizeBits( m_config );
+
+        int usedBits = ConservativeMessageHeaderEstimate + ( redundant ? 16 : 0 ) + ( m_config.playoutBuffer ? 16 : 0 );
+
+        int numMessages = 0;
+
+        Message ** messages = (Message**) alloca( sizeof( Message* ) * m_config.maxMessagesPerPacket );
+
+        int * measuredBits = (int*) alloca( sizeof( int ) * m_config.maxMessagesPerPacket );
+
+        if ( m_sendQueueBits )
+        {
+            PackMessages( messages, measuredBits, numMessages, usedBits, availableBits, messageTypeBits );
+        }
+        else
+        {
+            while ( true )
+            {
+                if ( m_messageSendQueue->IsEmpty() )
+                    break;
+
+                if ( availableBits - usedBits < giveUpBits )
+                    break;
+
+                if ( numMessages == m_config.maxMessagesPerPacket )
+                    break;
+
+                Message * message = PopSendQueue();
+
+                const int bits = MeasureMessage( message );
+
+                if ( bits < 0 )
+                {
+                    m_messageFactory->Release( message );
+                    continue;
+                }
+
+                const int messageBits = messageTypeBits + bits;
+
+                if ( usedBits + messageBits > availableBits )
+                {
+                    m_messageFactory->Release( message );
+                    continue;
+                }
+
+                usedBits += messageBits;
+
+                assert( usedBits <= availableBits );
+
+                measuredBits[numMessages] = bits;
+
+                messages[numMessages++] = message;
+            }
+        }
+
+        if ( redundant )
+        {
+            const int numNewMessages = numMessages;
+
+            for ( int i = 0; i < numNewMessages; ++i )
+                messages[i]->SetId( uint16_t( m_sendMessageId + i ) );
+
+            m_sendMessageId += uint16_t( numNewMessages );
+
+            AddRedundantMessages( messages, numMessages, usedBits, availableBits, messageTypeBits );
+
+            // new messages join the window after the redundant messages for this packet are picked, so they aren't included twice
+
+            for ( int i = 0; i < numNewMessages; ++i )
+            {
+                Message * message = messages[numMessages - numNewMessages + i];
+
+                if ( m_redundantMessages->IsFull() )
+                    m_messageFactory->Release( m_redundantMessages->Pop().message );
+
+                RedundantMessageEntry entry;
+                entry.message = message;
+                entry.measuredBits = measuredBits[i];
+                entry.packetsRemaining = m_config.redundancyWindow - 1;
+
+                m_messageFactory->AddRef( message );
+
+                m_redundantMessages->Push( entry );
+            }
+        }
+
+        if ( numMessages == 0 )
+            return 0;
+
+        packetData.Initialize( packetAllocator );
+
+        packetData.channelId = GetChannelId();
+
+        // IMPORTANT: The receiver only compares send times with each other, so they wrap around freely.
+
+        if ( m_config.playoutBuffer )
+            packetData.sendTime = uint16_t( int64_t( m_time * 1000.0 ) );
+
+        packetData.message.numMessages = numMessages;
+
+        packetData.message.messages = (Message**) YOJIMBO_ALLOCATE( packetData.GetAllocator( *m_messageFactory ), sizeof( Message* ) * numMessages );
+
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            packetData.message.messages[i] = messages[i];
+        }
+
+        return usedBits;
+    }
+
+    void UnreliableUnorderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        if ( m_error != CHANNEL_ERROR_NONE )
+            return;
+        
+        if ( packetData.messageFailedToSerialize )
+        {
+            SetError( CHANNEL_ERROR_FAILED_TO_SERIALIZE );
+            return;
+        }
+
+        const double playoutTime = ( m_playoutBuffer && packetData.message.numMessages > 0 ) ? GetPlayoutTime( packetData.sendTime ) : 0.0;
+
+        for ( int i = 0; i < (int) packetData.message.numMessages; ++i )
+        {
+            Message * message = packetData.message.messages[i];
+
+            assert( message );  
+
+            if ( m_playoutBuffer ? m_numPlayoutMessages == m_config.receiveQueueSize : m_messageReceiveQueue->IsFull() )
+                continue;
+
+            if ( m_receivedMessageIds )
+            {
+                // IMPORTANT: the message id was set by the sender. Anything already received, or too old to tell, is a redundant copy
+
+                const uint16_t messageId = message->GetId();
+
+                if ( m_receivedMessageIds->Exists( messageId ) || !m_receivedMessageIds->Insert( messageId ) )
+                {
+                    m_counters[CHANNEL_COUNTER_REDUNDANT_MESSAGES_DISCARDED]++;
+                    continue;
+                }
+            }
+            else
+            {
+                message->SetId( packetSequence );
+            }
+
+            m_messageFactory->AddRef( message );
+
+            if ( m_playoutBuffer )
+                AddPlayoutMessage( message, playoutTime );
+            else
+                m_messageReceiveQueue->Push( message );
+        }
+    }
+
+    bool UnreliableUnorderedChannel::WillDiscardMessage( uint16_t messageId ) const
+    {
+        if ( m_error != CHANNEL_ERROR_NONE )
+            return true;
 
-            if ( !m_receiveBlock->receivedFragment->GetBit( fragmentId ) )
-            {
-                if ( m_listener )
-                    m_listener->OnChannelFragmentReceived( this, messageId, fragmentId, fragmentBytes, m_receiveBlock->numReceivedFragments + 1, m_receiveBlock->numFragments );
-                
-                m_receiveBlock->receivedFragment->SetBit( fragmentId );
+        if ( m_playoutBuffer ? m_numPlayoutMessages == m_config.receiveQueueSize : m_messageReceiveQueue->IsFull() )
+            return true;
 
-                memcpy( m_receiveBlock->blockData + fragmentId * m_config.fragmentSize, fragmentData, fragmentBytes );
+        return m_receivedMessageIds && m_receivedMessageIds->Exists( messageId );
+    }
 
-                if ( fragmentId == 0 )
-                {
-                    m_receiveBlock->messageType = messageType;
-                }
+    void UnreliableUnorderedChannel::ProcessAck( uint16_t ack )
+    {
+        (void)ack;
+    }
 
-                if ( fragmentId == m_receiveBlock->numFragments - 1 )
-                {
-                    m_receiveBlock->blockSize = ( m_receiveBlock->numFragments - 1 ) * m_config.fragmentSize + fragmentBytes;
+    bool UnreliableUnorderedChannel::HasMessagesToSend() const
+    {
+        return !m_messageSendQueue->IsEmpty() || ( m_redundantMessages && !m_redundantMessages->IsEmpty() );
+    }
 
-                    assert( m_receiveBlock->blockSize <= (uint32_t) m_config.maxBlockSize );
-                }
+    int UnreliableUnorderedChannel::GetNumQueuedMessages() const
+    {
+        return m_messageSendQueue->GetNumEntries();
+    }
 
-                m_receiveBlock->numReceivedFragments++;
+    // ------------------------------------------------------------------------------------
 
-                if ( fragmentId == 0 )
-                {
-                    // save block message (sent with fragment 0)
+    UnreliableSequencedChannel::UnreliableSequencedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId ) : UnreliableUnorderedChannel( allocator, messageFactory, config, channelId )
+    {
+        assert( config.type == CHANNEL_TYPE_UNRELIABLE_SEQUENCED );
 
-                    m_receiveBlock->blockMessage = blockMessage;
+        Reset();
+    }
 
-                    m_messageFactory->AddRef( m_receiveBlock->blockMessage );
-                }
+    void UnreliableSequencedChannel::Reset()
+    {
+        UnreliableUnorderedChannel::Reset();
 
-                if ( m_receiveBlock->numReceivedFragments == m_receiveBlock->numFragments )
-                {
-                    // finished receiving block
+        m_receivedPacket = false;
+        m_mostRecentPacketSequence = 0;
+    }
 
-                    blockMessage = m_receiveBlock->blockMessage;
+    void UnreliableSequencedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        if ( m_error != CHANNEL_ERROR_NONE )
+            return;
 
-                    assert( blockMessage );
+        // IMPORTANT: Connection packet sequence numbers increase with each packet sent, so they order the messages in different packets.
+        // Messages in a packet older than the most recent packet received are stale. Drop them here so they never reach the receive queue.
 
-                    uint8_t * blockData = (uint8_t*) YOJIMBO_ALLOCATE( m_messageFactory->GetAllocator(), m_receiveBlock->blockSize );
+        if ( m_receivedPacket && !sequence_greater_than( packetSequence, m_mostRecentPacketSequence ) )
+            return;
 
-                    if ( !blockData )
-                    {
-                        SetError( CHANNEL_ERROR_OUT_OF_MEMORY );
-                        return;
-                    }
+        m_receivedPacket = true;
+        m_mostRecentPacketSequence = packetSequence;
 
-                    memcpy( blockData, m_receiveBlock->blockData, m_receiveBlock->blockSize );
+        UnreliableUnorderedChannel::ProcessPacketData( packetData, packetSequence );
+    }
 
-                    blockMessage->AttachBlock( m_messageFactory->GetAllocator(), blockData, m_receiveBlock->blockSize );
+    // ------------------------------------------------------------------------------------
 
-                    blockMessage->SetId( messageId );
+    UnreliableLatestStateChannel::UnreliableLatestStateChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId ) : UnreliableUnorderedChannel( allocator, messageFactory, config, channelId )
+    {
+        assert( config.type == CHANNEL_TYPE_UNRELIABLE_LATEST_STATE );
+    }
 
-                    MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Insert( messageId );
+    bool UnreliableLatestStateChannel::CanSendMsg() const
+    {
+        return true;
+    }
 
-                    assert( entry );
+    bool UnreliableLatestStateChannel::CanSendMsgs( int numMessages ) const
+    {
+        (void) numMessages;
+        return true;
+    }
 
-                    if ( !entry )
-                    {
-                        SetError( CHANNEL_ERROR_DESYNC );
-                        return;
-                    }
+    void UnreliableLatestStateChannel::SendMsg( Message * message )
+    {
+        assert( message );
 
-                    m_receiveBlock->active = false;
-                    m_receiveBlock->blockMessage = NULL;
+        // IMPORTANT: a full send queue drops its oldest message to make room, instead of failing with CHANNEL_ERROR_SEND_QUEUE_FULL.
+        // A message that replaces a queued message with the same key doesn't need room, so nothing is dropped for it.
 
-                    entry->message = blockMessage;
-                }
-            }
+        if ( GetError() == CHANNEL_ERROR_NONE && m_messageSendQueue->IsFull() && FindQueuedKey( message ) < 0 )
+        {
+            m_messageFactory->Release( PopSendQueue() );
+
+            m_counters[CHANNEL_COUNTER_MESSAGES_DROPPED]++;
         }
+
+        UnreliableUnorderedChannel::SendMsg( message );
     }
 
-    // ------------------------------------------------
+    // ------------------------------------------------------------------------------------
 
-    UnreliableUnorderedChannel::UnreliableUnorderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId ) : Channel( allocator, messageFactory, config, channelId )
+    SnapshotChannel::SnapshotChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId ) : Channel( allocator, messageFactory, config, channelId )
     {
-        assert( config.type == CHANNEL_TYPE_UNRELIABLE_UNORDERED );
+        assert( config.type == CHANNEL_TYPE_SNAPSHOT );
+        assert( config.sentPacketBufferSize > 0 );
+        assert( config.sentPacketBufferSize <= 32768 );
 
         m_messageSendQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.sendQueueSize );
         
         m_messageReceiveQueue = YOJIMBO_NEW( *m_allocator, Queue<Message*>, *m_allocator, m_config.receiveQueueSize );
 
+        m_sentPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<SnapshotSentPacketEntry>, *m_allocator, m_config.sentPacketBufferSize );
+
+        m_sentSnapshots = (SnapshotEntry*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( SnapshotEntry ) * m_config.sentPacketBufferSize );
+
+        m_receivedSnapshots = (SnapshotEntry*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( SnapshotEntry ) * m_config.sentPacketBufferSize );
+
+        memset( m_sentSnapshots, 0, sizeof( SnapshotEntry ) * m_config.sentPacketBufferSize );
+
+        memset( m_receivedSnapshots, 0, sizeof( SnapshotEntry ) * m_config.sentPacketBufferSize );
+
         Reset();
     }
 
-    UnreliableUnorderedChannel::~UnreliableUnorderedChannel()
+    SnapshotChannel::~SnapshotChannel()
     {
         Reset();
 
         YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageSendQueue );
         YOJIMBO_DELETE( *m_allocator, Queue<Message*>, m_messageReceiveQueue );
+        YOJIMBO_DELETE( *m_allocator, SequenceBuffer<SnapshotSentPacketEntry>, m_sentPackets );
+
+        YOJIMBO_FREE( *m_allocator, m_sentSnapshots );
+        YOJIMBO_FREE( *m_allocator, m_receivedSnapshots );
     }
 
-    void UnreliableUnorderedChannel::Reset()
+    void SnapshotChannel::Reset()
     {
         SetError( CHANNEL_ERROR_NONE );
 
@@ -1250,17 +3870,35 @@ namespace yojimbo
 
         m_messageSendQueue->Clear();
         m_messageReceiveQueue->Clear();
+
+        ReleaseAllSnapshots( m_sentSnapshots );
+        ReleaseAllSnapshots( m_receivedSnapshots );
+
+        m_sentPackets->Reset();
+
+        m_sendSnapshotId = 0;
+        m_sendBaselineId = 0;
+        m_oldestSentSnapshotId = 0;
+        m_receiveBaselineId = 0;
+        m_hasSendBaseline = false;
+        m_hasReceiveBaseline = false;
   
         ResetCounters();
     }
 
-    bool UnreliableUnorderedChannel::CanSendMsg() const
+    bool SnapshotChannel::CanSendMsg() const
     {
         assert( m_messageSendQueue );
         return !m_messageSendQueue->IsFull();
     }
 
-    void UnreliableUnorderedChannel::SendMsg( Message * message )
+    bool SnapshotChannel::CanSendMsgs( int numMessages ) const
+    {
+        assert( m_messageSendQueue );
+        return m_messageSendQueue->GetNumEntries() + numMessages <= m_messageSendQueue->GetSize();
+    }
+
+    void SnapshotChannel::SendMsg( Message * message )
     {
         assert( message );
         assert( CanSendMsg() );
@@ -1278,27 +3916,21 @@ namespace yojimbo
             return;
         }
 
-        assert( !( message->IsBlockMessage() && m_config.disableBlocks ) );
+        assert( !message->IsBlockMessage() );
 
-        if ( message->IsBlockMessage() && m_config.disableBlocks )
+        if ( message->IsBlockMessage() )
         {
             SetError( CHANNEL_ERROR_BLOCKS_DISABLED );
             m_messageFactory->Release( message );
             return;
         }
 
-        if ( message->IsBlockMessage() )
-        {
-            assert( ((BlockMessage*)message)->GetBlockSize() > 0 );
-            assert( ((BlockMessage*)message)->GetBlockSize() <= m_config.maxBlockSize );
-        }
-
         m_messageSendQueue->Push( message );
 
         m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
     }
 
-    Message * UnreliableUnorderedChannel::ReceiveMsg()
+    Message * SnapshotChannel::ReceiveMsg()
     {
         if ( GetError() != CHANNEL_ERROR_NONE )
             return NULL;
@@ -1311,95 +3943,113 @@ namespace yojimbo
         return m_messageReceiveQueue->Pop();
     }
 
-    void UnreliableUnorderedChannel::AdvanceTime( double time )
+    void SnapshotChannel::AdvanceTime( double time )
     {
         (void) time;
     }
-    
-    int UnreliableUnorderedChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
-    {
-        (void) packetSequence;
 
+    int SnapshotChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits, Allocator * packetAllocator )
+    {
         if ( m_messageSendQueue->IsEmpty() )
             return 0;
 
+        // only the most recent message is sent. older messages still in the queue are superseded by it
+
+        while ( m_messageSendQueue->GetNumEntries() > 1 )
+        {
+            m_messageFactory->Release( m_messageSendQueue->Pop() );
+            m_sendSnapshotId++;
+        }
+
+        Message * message = m_messageSendQueue->Pop();
+
+        assert( message );
+
+        const uint16_t snapshotId = m_sendSnapshotId++;
+
         if ( m_config.packetBudget > 0 )
             availableBits = min( m_config.packetBudget * 8, availableBits );
 
-        const int giveUpBits = 4 * 8;
+        DeltaMessage * baseline = NULL;
 
-        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+        if ( m_hasSendBaseline && message->IsDeltaMessage() )
+        {
+            Message * baselineMessage = FindSnapshot( m_sentSnapshots, m_sendBaselineId );
+            if ( baselineMessage && baselineMessage->GetType() == message->GetType() )
+                baseline = (DeltaMessage*) baselineMessage;
+        }
 
-        int usedBits = ConservativeMessageHeaderEstimate;
+        if ( message->IsDeltaMessage() )
+            ( (DeltaMessage*) message )->SetBaseline( baseline );
 
-        int numMessages = 0;
+        MeasureStream measureStream( m_messageFactory->GetAllocator() );
 
-        Message ** messages = (Message**) alloca( sizeof( Message* ) * m_config.maxMessagesPerPacket );
+        m_messageFactory->SerializeMessage( message, measureStream );
 
-        while ( true )
-        {
-            if ( m_messageSendQueue->IsEmpty() )
-                break;
+        const int measuredBits = measureStream.GetBitsProcessed();
 
-            if ( availableBits - usedBits < giveUpBits )
-                break;
+        const int headerBits = ConservativeMessageHeaderEstimate + 16 + 1 + 17 + m_messageFactory->GetTypeBits( message->GetType() ) + varint_bits( measuredBits );
 
-            if ( numMessages == m_config.maxMessagesPerPacket )
-                break;
+        Allocator & allocator = packetAllocator ? *packetAllocator : m_messageFactory->GetAllocator();
 
-            Message * message = m_messageSendQueue->Pop();
+        uint8_t * data = NULL;
 
-            assert( message );
+        int bits = 0;
 
-            MeasureStream measureStream;
+        bool serialized = false;
 
-            message->SerializeInternal( measureStream );
+        if ( headerBits + measuredBits <= availableBits )
+        {
+            // IMPORTANT: measured bits are conservative, so they always have room for what is actually written
 
-            if ( message->IsBlockMessage() )
-            {
-                BlockMessage * blockMessage = (BlockMessage*) message;
-                
-                SerializeMessageBlock( measureStream, *m_messageFactory, blockMessage, m_config.maxBlockSize );
-            }
+            const int bytes = max( 4, ( ( measuredBits + 31 ) / 32 ) * 4 );
 
-            const int messageBits = messageTypeBits + measureStream.GetBitsProcessed();
+            data = (uint8_t*) YOJIMBO_ALLOCATE( allocator, bytes );
 
-            if ( usedBits + messageBits > availableBits )
+            if ( data )
             {
-                m_messageFactory->Release( message );
-                continue;
+                WriteStream writeStream( data, bytes, m_messageFactory->GetAllocator() );
+                serialized = m_messageFactory->SerializeMessage( message, writeStream );
+                writeStream.Flush();
+                bits = writeStream.GetBitsProcessed();
             }
+        }
 
-            usedBits += messageBits;
-
-            assert( usedBits <= availableBits );
+        if ( message->IsDeltaMessage() )
+            ( (DeltaMessage*) message )->SetBaseline( NULL );
 
-            messages[numMessages++] = message;
+        if ( !serialized )
+        {
+            YOJIMBO_FREE( allocator, data );
+            m_messageFactory->Release( message );
+            return 0;
         }
 
-        if ( numMessages == 0 )
-            return 0;
+        message->SetId( snapshotId );
 
-        Allocator & allocator = m_messageFactory->GetAllocator();
+        StoreSnapshot( m_sentSnapshots, snapshotId, message );
 
-        packetData.Initialize();
+        SnapshotSentPacketEntry * sentPacket = m_sentPackets->Insert( packetSequence );
+        if ( sentPacket )
+            sentPacket->snapshotId = snapshotId;
 
+        packetData.Initialize( packetAllocator );
         packetData.channelId = GetChannelId();
-
-        packetData.message.numMessages = numMessages;
-
-        packetData.message.messages = (Message**) YOJIMBO_ALLOCATE( allocator, sizeof( Message* ) * numMessages );
-
-        for ( int i = 0; i < numMessages; ++i )
-        {
-            packetData.message.messages[i] = messages[i];
-        }
-
-        return usedBits;
+        packetData.snapshotMessage = 1;
+        packetData.snapshot.data = data;
+        packetData.snapshot.bits = bits;
+        packetData.snapshot.messageType = message->GetType();
+        packetData.snapshot.snapshotId = snapshotId;
+        packetData.snapshot.baselineId = baseline ? m_sendBaselineId : 0;
+        packetData.snapshot.hasBaseline = baseline != NULL;
+
+        return headerBits + measuredBits;
     }
 
-    void UnreliableUnorderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    void SnapshotChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
     {
+        (void) packetSequence;
+
         if ( m_error != CHANNEL_ERROR_NONE )
             return;
         
@@ -1409,25 +4059,170 @@ namespace yojimbo
             return;
         }
 
-        for ( int i = 0; i < (int) packetData.message.numMessages; ++i )
+        if ( !packetData.snapshotMessage )
+            return;
+
+        const ChannelPacketData::SnapshotData & snapshot = packetData.snapshot;
+
+        // a message we already have was delivered in a packet that was duplicated, or arrived after a newer one referenced it as a baseline
+
+        if ( FindSnapshot( m_receivedSnapshots, snapshot.snapshotId ) )
+            return;
+
+        Message * baseline = NULL;
+
+        if ( snapshot.hasBaseline )
         {
-            Message * message = packetData.message.messages[i];
+            if ( m_hasReceiveBaseline && sequence_less_than( snapshot.baselineId, m_receiveBaselineId ) )
+                return;
 
-            assert( message );  
+            baseline = FindSnapshot( m_receivedSnapshots, snapshot.baselineId );
 
-            message->SetId( packetSequence );
+            // IMPORTANT: the baseline was released, or is too old to still be kept. this snapshot can't be read, so drop it
 
-            if ( !m_messageReceiveQueue->IsFull() )
+            if ( !baseline )
+                return;
+
+            if ( baseline->GetType() != snapshot.messageType || !baseline->IsDeltaMessage() )
             {
-                m_messageFactory->AddRef( message );
+                SetError( CHANNEL_ERROR_DESYNC );
+                return;
+            }
+        }
 
-                m_messageReceiveQueue->Push( message );
+        Message * message = m_messageFactory->Create( snapshot.messageType );
+
+        if ( !message )
+        {
+            SetError( CHANNEL_ERROR_OUT_OF_MEMORY );
+            return;
+        }
+
+        if ( message->IsDeltaMessage() )
+            ( (DeltaMessage*) message )->SetBaseline( (DeltaMessage*) baseline );
+
+        ReadStream readStream( snapshot.data, ( ( snapshot.bits + 31 ) / 32 ) * 4, m_messageFactory->GetAllocator() );
+
+        const bool result = m_messageFactory->SerializeMessage( message, readStream );
+
+        if ( message->IsDeltaMessage() )
+            ( (DeltaMessage*) message )->SetBaseline( NULL );
+
+        if ( !result )
+        {
+            m_messageFactory->Release( message );
+            SetError( CHANNEL_ERROR_FAILED_TO_SERIALIZE );
+            return;
+        }
+
+        message->SetId( snapshot.snapshotId );
+
+        // the sender never goes back to an older baseline, so received messages older than this one are no longer needed
+
+        if ( snapshot.hasBaseline )
+        {
+            if ( !m_hasReceiveBaseline )
+                m_receiveBaselineId = snapshot.baselineId - m_config.sentPacketBufferSize;
+            ReleaseSnapshots( m_receivedSnapshots, m_receiveBaselineId, snapshot.baselineId );
+            m_hasReceiveBaseline = true;
+        }
+
+        if ( !m_messageReceiveQueue->IsFull() )
+        {
+            m_messageFactory->AddRef( message );
+            m_messageReceiveQueue->Push( message );
+        }
+
+        StoreSnapshot( m_receivedSnapshots, snapshot.snapshotId, message );
+    }
+
+    bool SnapshotChannel::HasMessagesToSend() const
+    {
+        return !m_messageSendQueue->IsEmpty();
+    }
+
+    int SnapshotChannel::GetNumQueuedMessages() const
+    {
+        return m_messageSendQueue->GetNumEntries();
+    }
+
+    void SnapshotChannel::ProcessAck( uint16_t ack )
+    {
+        SnapshotSentPacketEntry * sentPacket = m_sentPackets->Find( ack );
+        if ( !sentPacket )
+            return;
+
+        const uint16_t snapshotId = sentPacket->snapshotId;
+
+        m_sentPackets->Remove( ack );
+
+        if ( m_hasSendBaseline && !sequence_greater_than( snapshotId, m_sendBaselineId ) )
+            return;
+
+        if ( !FindSnapshot( m_sentSnapshots, snapshotId ) )
+            return;
+
+        ReleaseSnapshots( m_sentSnapshots, m_oldestSentSnapshotId, snapshotId );
+
+        m_sendBaselineId = snapshotId;
+        m_hasSendBaseline = true;
+    }
+
+    bool SnapshotChannel::GetSendBaselineId( uint16_t & baselineId ) const
+    {
+        baselineId = m_sendBaselineId;
+        return m_hasSendBaseline;
+    }
+
+    Message * SnapshotChannel::FindSnapshot( SnapshotEntry * entries, uint16_t snapshotId )
+    {
+        SnapshotEntry & entry = entries[snapshotId % m_config.sentPacketBufferSize];
+        return ( entry.message && entry.snapshotId == snapshotId ) ? entry.message : NULL;
+    }
+
+    void SnapshotChannel::StoreSnapshot( SnapshotEntry * entries, uint16_t snapshotId, Message * message )
+    {
+        assert( message );
+        SnapshotEntry & entry = entries[snapshotId % m_config.sentPacketBufferSize];
+        if ( entry.message )
+            m_messageFactory->Release( entry.message );
+        entry.message = message;
+        entry.snapshotId = snapshotId;
+    }
+
+    void SnapshotChannel::ReleaseSnapshots( SnapshotEntry * entries, uint16_t & oldestId, uint16_t newestId )
+    {
+        int count = uint16_t( newestId - oldestId );
+
+        if ( count > m_config.sentPacketBufferSize )
+        {
+            count = m_config.sentPacketBufferSize;
+            oldestId = newestId - m_config.sentPacketBufferSize;
+        }
+
+        for ( int i = 0; i < count; ++i )
+        {
+            const uint16_t snapshotId = oldestId + i;
+            SnapshotEntry & entry = entries[snapshotId % m_config.sentPacketBufferSize];
+            if ( entry.message && entry.snapshotId == snapshotId )
+            {
+                m_messageFactory->Release( entry.message );
+                entry.message = NULL;
             }
         }
+
+        oldestId = newestId;
     }
 
-    void UnreliableUnorderedChannel::ProcessAck( uint16_t ack )
+    void SnapshotChannel::ReleaseAllSnapshots( SnapshotEntry * entries )
     {
-        (void)ack;
+        for ( int i = 0; i < m_config.sentPacketBufferSize; ++i )
+        {
+            if ( entries[i].message )
+            {
+                m_messageFactory->Release( entries[i].message );
+                entries[i].message = NULL;
+            }
+        }
     }
 }
@@ -29,11 +29,32 @@
 #include "yojimbo_allocator.h"
 #include "yojimbo_queue.h"
 #include "yojimbo_sequence_buffer.h"
+#include "yojimbo_id_map.h"
+#include "yojimbo_compression.h"
 
 /** @file */
 
 namespace yojimbo
 {
+    /**
+        Bit counters accumulated as connection packets are written.
+
+        Channel packet data adds the bits it writes for each channel and message type, so you can see which channels and message types use up the packet budget.
+
+        @see Connection::GetChannelBitsWritten
+        @see Connection::GetMessageTypeBitsWritten
+     */
+
+    struct PacketBitCounters
+    {
+        uint64_t channelBits[MaxChannels];                              ///< The number of bits written for each channel. Includes everything the channel writes into the packet: the channel header, message ids and types, messages, blocks, block fragments and snapshots.
+        uint64_t channelFragmentBits[MaxChannels];                      ///< The number of bits written for block fragments on each channel. These bits are also included in channelBits.
+        uint64_t * messageTypeBits;                                     ///< The number of bits written for each message type, indexed by message type. Includes the message type, the message and its block, and block fragments and snapshots of that type. Does not include per-channel overhead such as message ids.
+        int numMessageTypes;                                            ///< The number of entries in the message type bits array.
+    };
+
+    class Channel;
+
     /**
         Per-channel data inside a connection packet.
 
@@ -45,6 +66,8 @@ namespace yojimbo
 
     struct ChannelPacketData
     {
+        Allocator * allocator;                                          ///< The allocator that arrays in this channel packet data are allocated with, eg. the arena of the connection packet it belongs to. NULL for the message factory allocator. See ChannelPacketData::GetAllocator.
+
         uint32_t channelId : 16;                                        ///< The id of the channel this data belongs to in [0,numChannels-1].
         
         uint32_t initialized : 1;                                       ///< 1 if this channel packet data was properly initialized, 0 otherwise. This is a safety measure to make sure ChannelPacketData::Initialize gets called.
@@ -53,38 +76,81 @@ namespace yojimbo
         
         uint32_t messageFailedToSerialize : 1;                          ///< Set to 1 if a message for this channel fails to serialized. Used to set CHANNEL_ERROR_FAILED_TO_SERIALIZE on the Channel object.
 
+        uint32_t snapshotMessage : 1;                                   ///< 1 if this channel data contains a snapshot (eg. the channel is a snapshot channel), 0 otherwise.
+
+        uint32_t blockCacheReply : 1;                                   ///< 1 if this channel data answers a block announcement from the other side. Sent alongside whatever else the channel has to send. See ChannelConfig::blockCache.
+
+        uint32_t blockCacheHit : 1;                                     ///< 1 if the block announced was found in the block cache, so its fragments don't need to be sent. 0 to ask for the fragments. Valid only if blockCacheReply is 1.
+
+        uint16_t blockCacheMessageId;                                   ///< The message id of the block being answered. Valid only if blockCacheReply is 1.
+
+        uint16_t sendTime;                                              ///< The sender's channel time when this channel data was generated, in milliseconds modulo 65536. Sent with messages on unreliable channels with ChannelConfig::playoutBuffer.
+
         /// Data sent when a channel is sending regular messages.
 
         struct MessageData
         {
             int numMessages;                                            ///< The number of messages included in the packet for this channel.
-            Message ** messages;                                        ///< Array of message pointers (dynamically allocated). The messages in this array have references added, so they must be released when the packet containing this channel data is destroyed.
+            Message ** messages;                                        ///< Array of message pointers (dynamically allocated). The messages in this array have references added, so they must be released when the packet containing this channel data is destroyed. NULL entries are expired messages, which only carry their id. See ChannelConfig::expireMessages.
+            uint16_t * messageIds;                                      ///< Array of message ids, allocated in the same block as the message pointers. NULL when sending if the ids are taken from the messages. Required for broadcast messages, since they are shared between connections and can't hold a per-connection id, and for expired messages. Always set when reading reliable-ordered messages.
         };
 
         /// Data sent when a channel is sending a block message. @see BlockMessage.
 
         struct BlockData
         {
-            BlockMessage * message;                                     ///< The message the block is attached to. The message is serialized and included as well as the block data which is split up into fragments.
-            uint8_t * fragmentData;                                     ///< Pointer to the fragment data being sent in this packet. Blocks are split up into fragments of size ChannelConfig::fragmentSize.
+            BlockMessage * message;                                     ///< The message the block is attached to. The message is serialized and included with fragment 0. When sending, a reference is held on the message for every fragment, so the block data stays valid while the packet exists. When receiving, this is NULL unless the packet includes fragment 0.
+            uint8_t * fragmentData;                                     ///< Pointer to the fragment data being sent in this packet. Blocks are split up into fragments of size ChannelConfig::fragmentSize. When sending, this points directly into the block attached to the message.
+            bool ownsFragmentData;                                      ///< True if the fragment data was allocated for this packet and is freed with it. This is the case when the packet is read from the network. Fragment data of packets being sent belongs to the block message and is not freed.
             uint64_t messageId : 16;                                    ///< The message id that this block is attached to. Used for ordering. Message id increases with each packet sent across a channel.
-            uint64_t fragmentId : 16;                                   ///< The id of the fragment being sent in [0,numFragments-1].
-            uint64_t fragmentSize : 16;                                 ///< The size of the fragment. Typically this is ChannelConfig::fragmentSize, except for the last fragment, which may be smaller.
+            uint64_t fragmentId : 16;                                   ///< The id of the first fragment being sent in [0,numFragments-1].
             uint64_t numFragments : 16;                                 ///< The number of fragments this block is split up into. Lets the receiver know when all fragments have been received.
+            uint64_t numPacketFragments : 16;                           ///< The number of consecutive fragments in this packet, starting at fragmentId. Always 1 unless ChannelConfig::maxBlockFragmentsPerPacket is greater than 1.
+            int fragmentSize;                                           ///< The size of the fragment data in this packet. Typically this is ChannelConfig::fragmentSize x numPacketFragments, except when the packet includes the last fragment, which may be smaller.
             int messageType;                                            ///< The message type. Used to create the corresponding message object on the receiver side once all fragments are received.
+            bool compressed;                                            ///< True if the block is compressed. Sent with fragment 0, along with the size of the block once decompressed in blockSize. See ChannelConfig::compressBlocks.
+            bool announce;                                              ///< True if this is a block announcement instead of fragment data. The announcement carries the block message, block size and block hash, but no fragments. See ChannelConfig::blockCache.
+            int blockSize;                                              ///< The size of the block being announced, or the size of a compressed block once decompressed (bytes). Valid only if announce or compressed is true.
+            uint64_t blockHash;                                         ///< The hash of the block being announced. Valid only if announce is true.
+            MessageData messages;                                       ///< Regular messages queued after the block, sent in the rest of the packet. Only used if ChannelConfig::sendMessagesWithFragments is true.
+        };
+
+        /// Data sent when a channel is sending a snapshot. @see SnapshotChannel.
+
+        struct SnapshotData
+        {
+            uint8_t * data;                                             ///< The message serialized relative to its baseline (dynamically allocated). The snapshot channel serializes the message itself, because only it knows the baselines on each side.
+            int bits;                                                   ///< The number of bits of serialized message data.
+            int messageType;                                            ///< The message type. Used to create the message object on the receiver side.
+            uint16_t snapshotId;                                        ///< The message id. Increases with each message sent across the channel.
+            uint16_t baselineId;                                        ///< The message id of the baseline the message was serialized relative to. Valid only if hasBaseline is true.
+            bool hasBaseline;                                           ///< True if the message was serialized relative to a baseline, false if it was serialized in full.
         };
 
         union
         {
             MessageData message;                                        ///< Data for sending messages.
             BlockData block;                                            ///< Data for sending a block fragment.
+            SnapshotData snapshot;                                      ///< Data for sending a snapshot.
         };
 
         /**
             Initialize the channel packet data to default values.
+
+            @param packetAllocator The allocator for arrays in this channel packet data. NULL to use the message factory allocator.
+         */
+
+        void Initialize( Allocator * packetAllocator = NULL );
+
+        /**
+            Get the allocator that arrays in this channel packet data are allocated with.
+
+            @param messageFactory The message factory. Its allocator is used when no allocator was set in ChannelPacketData::Initialize.
+
+            @returns The allocator.
          */
 
-        void Initialize();
+        Allocator & GetAllocator( MessageFactory & messageFactory ) const { return allocator ? *allocator : messageFactory.GetAllocator(); }
 
         /**
             Release messages stored in channel packet data and free allocations.
@@ -103,21 +169,24 @@ namespace yojimbo
             @param messageFactory The message factory used to create message objects on serialize read.
             @param channelConfigs Array of channel configs, indexed by channel id in [0,numChannels-1].
             @param numChannels The number of channels configured on the connection.
+            @param bitCounters The bit counters to add the bits written to. NULL to skip accounting. Only used when writing.
+            @param implicitChannelId If true, the channel id is not serialized. It is implied by where the entry is in the packet, so set it before reading. See ConnectionConfig::compressPacketHeader.
+            @param channels Array of the channels the packet is being read for, indexed by channel id. Messages these channels would discard are skipped instead of being created. NULL to create every message. Only used when reading channels with ChannelConfig::skipDiscardedMessages.
          */
 
-        template <typename Stream> bool Serialize( Stream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels );
+        template <typename Stream> bool Serialize( Stream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, PacketBitCounters * bitCounters, bool implicitChannelId, const Channel * const * channels );
 
         /// Implements serialize read by a calling into ChannelPacketData::Serialize with a ReadStream.
 
-        bool SerializeInternal( ReadStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels );
+        bool SerializeInternal( ReadStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, PacketBitCounters * bitCounters = NULL, bool implicitChannelId = false, const Channel * const * channels = NULL );
 
         /// Implements serialize write by a calling into ChannelPacketData::Serialize with a WriteStream.
 
-        bool SerializeInternal( WriteStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels );
+        bool SerializeInternal( WriteStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, PacketBitCounters * bitCounters = NULL, bool implicitChannelId = false, const Channel * const * channels = NULL );
 
         /// Implements serialize measure by a calling into ChannelPacketData::Serialize with a MeasureStream.
 
-        bool SerializeInternal( MeasureStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels );
+        bool SerializeInternal( MeasureStream & stream, MessageFactory & messageFactory, const ChannelConfig * channelConfigs, int numChannels, PacketBitCounters * bitCounters = NULL, bool implicitChannelId = false, const Channel * const * channels = NULL );
     };
 
     /// Implement this interface to receive callbacks for channel events.
@@ -142,6 +211,55 @@ namespace yojimbo
          */
 
         virtual void OnChannelFragmentReceived( class Channel * channel, uint16_t messageId, uint16_t fragmentId, int fragmentBytes, int numFragmentsReceived, int numFragmentsInBlock ) { (void) channel; (void) messageId; (void) fragmentId; (void) fragmentBytes; (void) numFragmentsReceived; (void) numFragmentsInBlock; }
+
+        /**
+            Override this method to get a callback when block data is streamed in.
+
+            Only called when ChannelConfig::streamBlocks is true. Block data is passed in order, one fragment at a time, as soon as all data before it has been received.
+
+            @param channel The channel the block is being sent over.
+            @param messageId The message id the block is attached to.
+            @param blockMessage The message the block is attached to. It is received once the block completes, without the block attached.
+            @param blockOffset The offset of this data in the block (bytes).
+            @param data The block data. Only valid for the duration of the callback.
+            @param dataBytes The size of the block data (bytes).
+            @param blockComplete True if this is the end of the block.
+
+            @see ChannelConfig::streamBlocks
+         */
+
+        virtual void OnChannelBlockDataReceived( class Channel * channel, uint16_t messageId, BlockMessage * blockMessage, int blockOffset, const uint8_t * data, int dataBytes, bool blockComplete ) { (void) channel; (void) messageId; (void) blockMessage; (void) blockOffset; (void) data; (void) dataBytes; (void) blockComplete; }
+
+        /**
+            Override this method to look up announced blocks in a local block cache.
+
+            Only called when ChannelConfig::blockCache is true. If a block is returned, the block message is received with it attached, and none of its fragments are sent.
+
+            @param channel The channel the block is being sent over.
+            @param blockHash The hash of the block data. See murmur_hash_64.
+            @param blockSize The size of the block (bytes).
+
+            @returns The cached block, or NULL if the block is not in the cache. The channel adds its own reference to the block, so the cache keeps ownership of it.
+
+            @see ChannelConfig::blockCache
+         */
+
+        virtual SharedBlock * OnChannelBlockCacheFind( class Channel * channel, uint64_t blockHash, int blockSize ) { (void) channel; (void) blockHash; (void) blockSize; return NULL; }
+
+        /**
+            Override this method to add blocks received over the network to a local block cache.
+
+            Only called when ChannelConfig::blockCache is true, once all fragments of a block that was not found in the cache have been received.
+
+            @param channel The channel the block was sent over.
+            @param blockHash The hash of the block data, computed from the data received. See murmur_hash_64.
+            @param blockData The block data. Only valid for the duration of the callback.
+            @param blockSize The size of the block (bytes).
+
+            @see ChannelConfig::blockCache
+         */
+
+        virtual void OnChannelBlockCacheStore( class Channel * channel, uint64_t blockHash, const uint8_t * blockData, int blockSize ) { (void) channel; (void) blockHash; (void) blockData; (void) blockSize; }
     };
 
     /**
@@ -154,9 +272,57 @@ namespace yojimbo
     {
         CHANNEL_COUNTER_MESSAGES_SENT,                          ///< Number of messages sent over this channel.
         CHANNEL_COUNTER_MESSAGES_RECEIVED,                      ///< Number of messages received over this channel.
+        CHANNEL_COUNTER_MESSAGES_AGGREGATED,                    ///< Number of messages sent over this channel that were added to an aggregate message instead of getting their own send queue entry. See ChannelConfig::maxAggregateMessages.
+        CHANNEL_COUNTER_FAST_RESENDS,                           ///< Number of sent packets with data on this channel that were counted as lost because later packets were acked, so their data was resent right away. See ChannelConfig::fastResendThreshold.
+        CHANNEL_COUNTER_REDUNDANT_MESSAGES_SENT,                ///< Number of copies of messages included in packets after the packet each message was first sent in. See ChannelConfig::redundancyWindow.
+        CHANNEL_COUNTER_REDUNDANT_MESSAGES_DISCARDED,           ///< Number of messages received that were dropped because a copy of the same message was already received. See ChannelConfig::redundancyWindow.
+        CHANNEL_COUNTER_MESSAGES_REPLACED,                      ///< Number of messages sent over this channel that replaced a queued message with the same key, instead of being added to the send queue. See Message::SetKey.
+        CHANNEL_COUNTER_MESSAGES_DROPPED,                       ///< Number of queued messages dropped to make room for a new message because the send queue was full. Unreliable latest state channels only.
+        CHANNEL_COUNTER_FLOW_CONTROL_STALLS,                    ///< Number of times messages waiting to be sent were held back from a packet because the receive queue on the other side had no room for them. See ChannelConfig::flowControl.
+        CHANNEL_COUNTER_MESSAGES_EXPIRED,                       ///< Number of messages whose time to live ran out before they were acked. Counted by the sender when a message expires, and by the receiver when it skips one. See ChannelConfig::expireMessages.
+        CHANNEL_COUNTER_BLOCK_CACHE_HITS,                       ///< Number of blocks sent over this channel that the other side found in its block cache, so their fragments were not sent. See ChannelConfig::blockCache.
+        CHANNEL_COUNTER_BLOCK_CACHE_MISSES,                     ///< Number of blocks sent over this channel that the other side did not have in its block cache, so their fragments were sent. See ChannelConfig::blockCache.
+        CHANNEL_COUNTER_BLOCKS_DEFERRED,                        ///< Number of packets this channel left its block fragments out of because sending blocks was deferred. See Channel::SetDeferBlocks.
+        CHANNEL_COUNTER_PLAYOUT_LATE_MESSAGES,                  ///< Number of messages received after their playout time, because they were delayed by more than the target playout delay. Raise the minimum playout delay if this is high. See ChannelConfig::playoutBuffer.
+        CHANNEL_COUNTER_SENT_PACKET_MESSAGE_IDS_OVERWRITTEN,    ///< Number of sent packets acked or lost after their message ids were overwritten, so their messages had to wait to be resent. Raise the sent packet message id buffer size if this is not zero. See ChannelConfig::sentPacketMessageIdBufferSize.
         CHANNEL_COUNTER_NUM_COUNTERS                            ///< The number of channel counters.
     };
 
+    /**
+        Get the name of a channel counter.
+
+        Names are lower case with underscores, so they can be used directly in metric names, eg. "messages_sent". See MetricsSnapshot.
+
+        @param index The channel counter index. See yojimbo::ChannelCounters.
+
+        @returns The name of the counter.
+     */
+
+    inline const char * GetChannelCounterName( int index )
+    {
+        switch ( index )
+        {
+            case CHANNEL_COUNTER_MESSAGES_SENT:                  return "messages_sent";
+            case CHANNEL_COUNTER_MESSAGES_RECEIVED:              return "messages_received";
+            case CHANNEL_COUNTER_MESSAGES_AGGREGATED:            return "messages_aggregated";
+            case CHANNEL_COUNTER_FAST_RESENDS:                   return "fast_resends";
+            case CHANNEL_COUNTER_REDUNDANT_MESSAGES_SENT:        return "redundant_messages_sent";
+            case CHANNEL_COUNTER_REDUNDANT_MESSAGES_DISCARDED:   return "redundant_messages_discarded";
+            case CHANNEL_COUNTER_MESSAGES_REPLACED:              return "messages_replaced";
+            case CHANNEL_COUNTER_MESSAGES_DROPPED:               return "messages_dropped";
+            case CHANNEL_COUNTER_FLOW_CONTROL_STALLS:            return "flow_control_stalls";
+            case CHANNEL_COUNTER_MESSAGES_EXPIRED:               return "messages_expired";
+            case CHANNEL_COUNTER_BLOCK_CACHE_HITS:               return "block_cache_hits";
+            case CHANNEL_COUNTER_BLOCK_CACHE_MISSES:             return "block_cache_misses";
+            case CHANNEL_COUNTER_BLOCKS_DEFERRED:                return "blocks_deferred";
+            case CHANNEL_COUNTER_PLAYOUT_LATE_MESSAGES:          return "playout_late_messages";
+            case CHANNEL_COUNTER_SENT_PACKET_MESSAGE_IDS_OVERWRITTEN: return "sent_packet_message_ids_overwritten";
+            default:
+                assert( false );
+                return "???";
+        }
+    }
+
     /**
         Channel error codes.
 
@@ -243,6 +409,38 @@ namespace yojimbo
 
         virtual Message * ReceiveMsg() = 0;
 
+        /**
+            Returns true if a batch of messages can be sent over this channel.
+
+            @param numMessages The number of messages in the batch.
+
+            @returns True if the send queue has room for all messages in the batch. False otherwise.
+         */
+
+        virtual bool CanSendMsgs( int numMessages ) const = 0;
+
+        /**
+            Queue a batch of messages to be sent across this channel.
+
+            The send queue is checked once for room for the whole batch, instead of once per message. If there isn't room for all of them, no messages are queued, the channel is put in an error state and the messages are released.
+
+            @param messages The array of messages to be sent.
+            @param numMessages The number of messages in the array.
+         */
+
+        virtual void SendMsgs( Message ** messages, int numMessages );
+
+        /**
+            Pop messages off the receive queue until it runs dry or the output array is full.
+
+            @param messages The array of message pointers to fill [out].
+            @param maxMessages The size of the message pointer array.
+
+            @returns The number of messages received in [0,maxMessages]. The caller owns the message objects returned and is responsible for releasing them via Message::Release.
+         */
+
+        virtual int ReceiveMsgs( Message ** messages, int maxMessages );
+
         /**
             Advance channel time.
 
@@ -257,6 +455,7 @@ namespace yojimbo
             @param packetData The channel packet data to be filled [out]
             @param packetSequence The sequence number of the packet being generated.
             @param availableBits The maximum number of bits of packet data the channel is allowed to write.
+            @param packetAllocator The allocator for the arrays in the packet data, eg. the arena of the connection packet being generated. NULL to use the message factory allocator.
 
             @returns The number of bits of packet data written by the channel.
 
@@ -264,7 +463,7 @@ namespace yojimbo
             @see Connection::GeneratePacket
          */
 
-        virtual int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits ) = 0;
+        virtual int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits, Allocator * packetAllocator = NULL ) = 0;
 
         /**
             Process packet data included in a connection packet.
@@ -278,6 +477,20 @@ namespace yojimbo
 
         virtual void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence ) = 0;
 
+        /**
+            Would this channel discard a message with this id if it was received now?
+
+            Called as connection packets are read, so messages that would be discarded are skipped instead of being created and read. See ChannelConfig::skipDiscardedMessages.
+
+            IMPORTANT: Only return true if the message would still be discarded when the packet is processed later. Packets are read before any of them are processed.
+
+            @param messageId The id of the message. Only valid on channels that send message ids.
+
+            @returns True if the message would be discarded. By default, messages are never discarded.
+         */
+
+        virtual bool WillDiscardMessage( uint16_t messageId ) const { (void) messageId; return false; }
+
         /**
             Process a connection packet ack.
 
@@ -287,11 +500,67 @@ namespace yojimbo
 
                 2. Does nothing at all (unreliable-unordered).
 
+                3. Advances the baseline that messages are serialized relative to (snapshot).
+
             @param sequence The sequence number of the connection packet that was acked.
          */
 
         virtual void ProcessAck( uint16_t sequence ) = 0;
 
+        /**
+            Does this channel have messages waiting to be sent?
+
+            Used by Connection::GeneratePacket to share the packet between channels that have data to send. See ChannelConfig::priority and ChannelConfig::weight.
+
+            @returns True if the channel has at least one message in its send queue. For reliable-ordered channels, this includes messages that have been sent but not acked yet.
+         */
+
+        virtual bool HasMessagesToSend() const = 0;
+
+        /**
+            Get the number of messages in the send queue.
+
+            Exported as a gauge by MetricsSnapshot::AddConnection.
+
+            @returns The number of messages waiting to be sent. For reliable-ordered channels, this includes messages that have been sent but not acked yet.
+         */
+
+        virtual int GetNumQueuedMessages() const = 0;
+
+        /**
+            Serialize the channel state (read).
+
+            Used to move a connection between servers without the client reconnecting. See Server::HandoffClient.
+
+            By default there is no state to carry over, so this does nothing. Reliable-ordered channels override this to carry their message ids and queued messages.
+
+            @param stream The stream to read the channel state from.
+
+            @returns True if the state was read successfully, false otherwise.
+         */
+
+        virtual bool SerializeState( ReadStream & stream ) { (void) stream; return true; }
+
+        /**
+            Serialize the channel state (write).
+
+            @param stream The stream to write the channel state to.
+
+            @returns True if the state was written successfully, false if this channel is in a state that can't be carried over.
+         */
+
+        virtual bool SerializeState( WriteStream & stream ) { (void) stream; return true; }
+
+        /**
+            Serialize the channel state (measure).
+
+            @param stream The stream to measure the channel state with.
+
+            @returns True if the state could be written, false if this channel is in a state that can't be carried over.
+         */
+
+        virtual bool SerializeState( MeasureStream & stream ) { (void) stream; return true; }
+
     public:
 
         /** 
@@ -304,6 +573,39 @@ namespace yojimbo
 
         void SetListener( ChannelListener * listener ) { m_listener = listener; }
 
+        /**
+            Set the round trip time estimate for the connection this channel belongs to.
+
+            Called by Connection::AdvanceTime for each channel. Used by reliable-ordered channels to adapt resend times. See ChannelConfig::adaptiveResendTime.
+
+            @param rtt The smoothed round trip time (seconds). Zero if there is no RTT estimate yet.
+            @param rttVariance The smoothed round trip time variance (seconds).
+         */
+
+        void SetRoundTripTime( float rtt, float rttVariance ) { m_rtt = rtt; m_rttVariance = rttVariance; }
+
+        /**
+            Hold back block fragments from packets until this is cleared.
+
+            Called by Connection::SetDeferBlocks. Used by the server to shed bulk data when it is overloaded. Only reliable-ordered channels split blocks into fragments, so this has no effect on other channel types.
+
+            IMPORTANT: Messages on a reliable-ordered channel are delivered in order, so messages queued behind a block are held back with it.
+
+            @param deferBlocks True to hold back block fragments, false to send them again.
+         */
+
+        void SetDeferBlocks( bool deferBlocks ) { m_deferBlocks = deferBlocks; }
+
+        /**
+            Set the bits of channel data the connection congestion window allows in the next packet.
+
+            Called by Connection::GeneratePacket before it asks the channel for packet data. Block fragments that don't fit are held back, instead of being sent anyway like fragments that are larger than the packet or channel budget.
+
+            @param congestionLimitBits The bits the congestion window allows, or -1 if there is no congestion limit. The connection passes -1 while nothing is in flight, so a fragment larger than the window still gets through.
+         */
+
+        void SetCongestionLimit( int congestionLimitBits ) { m_congestionLimitBits = congestionLimitBits; }
+
         /**
             Get the channel error level.
 
@@ -358,6 +660,14 @@ namespace yojimbo
         int m_channelId;                                                                ///< The channel id in [0,numChannels-1].
 
         double m_time;                                                                  ///< The current time.
+
+        float m_rtt;                                                                    ///< The smoothed round trip time (seconds). Zero if there is no RTT estimate yet. See Channel::SetRoundTripTime.
+
+        float m_rttVariance;                                                            ///< The smoothed round trip time variance (seconds). See Channel::SetRoundTripTime.
+
+        bool m_deferBlocks;                                                             ///< True if block fragments are held back from packets. See Channel::SetDeferBlocks.
+
+        int m_congestionLimitBits;                                                      ///< The bits the congestion window allows in the next packet, or -1 for no limit. See Channel::SetCongestionLimit.
         
         ChannelError m_error;                                                           ///< The channel error level.
 
@@ -413,12 +723,16 @@ namespace yojimbo
 
         Message * ReceiveMsg();
 
+        bool CanSendMsgs( int numMessages ) const;
+
         void AdvanceTime( double time );
 
-        int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
+        int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits, Allocator * packetAllocator = NULL );
 
         void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
 
+        bool WillDiscardMessage( uint16_t messageId ) const;
+
         void ProcessAck( uint16_t ack );
 
         // -----------------------------
@@ -428,11 +742,63 @@ namespace yojimbo
 
             Messages are acked individually and remain in the send queue until acked.
 
-            @returns True if there is at least one unacked message in the send queue.            
+            Also true while a reply to a block announcement is waiting to be sent, so the reply goes out even when the send queue is empty. See ChannelConfig::blockCache.
+
+            @returns True if there is at least one unacked message in the send queue, or a block cache reply to send.
          */
 
         bool HasMessagesToSend() const;
 
+        int GetNumQueuedMessages() const;
+
+        bool SerializeState( ReadStream & stream );
+
+        bool SerializeState( WriteStream & stream );
+
+        bool SerializeState( MeasureStream & stream );
+
+        /**
+            Get the receive window to advertise to the other side.
+
+            Included in each connection packet when ChannelConfig::flowControl is enabled. See Connection::GeneratePacket.
+
+            @returns The id of the first message that doesn't fit in the receive queue yet. Advances as messages are dequeued with ReceiveMsg.
+         */
+
+        uint16_t GetReceiveWindow() const;
+
+        /**
+            Process the receive window advertised by the other side.
+
+            Called by Connection::ProcessPacket when ChannelConfig::flowControl is enabled. The receive window only moves forward, so windows from packets that arrive out of order are ignored.
+
+            @param receiveWindow The id of the first message that doesn't fit in the receive queue on the other side.
+         */
+
+        void ProcessReceiveWindow( uint16_t receiveWindow );
+
+        /**
+            Does the other side have room in its receive queue for a message?
+
+            @param messageId The id of a message that hasn't been sent yet, or the block message being sent.
+
+            @returns True if ChannelConfig::flowControl is disabled, or the message is before the receive window advertised by the other side.
+         */
+
+        bool HasReceiveCredit( uint16_t messageId ) const;
+
+        /**
+            Add a message to the newest message in the send queue, instead of giving it an entry of its own.
+
+            The newest message is turned into an aggregate message if it isn't one already. This is only done while the newest message has not been included in any packet, since the packets that include a message must all carry the same message. See ChannelConfig::maxAggregateMessages.
+
+            @param message The message to add. On success, the channel takes ownership of this message.
+
+            @returns True if the message was added to the newest message in the send queue. False if it needs a send queue entry of its own.
+         */
+
+        bool AggregateMsg( Message * message );
+
         /**
             Get messages to include in a packet.
 
@@ -451,6 +817,21 @@ namespace yojimbo
 
         int GetMessagesToSend( uint16_t * messageIds, int & numMessageIds, int remainingPacketBits );
 
+        /**
+            Fill channel packet data from the send queue.
+
+            Called by GetPacketData, which adds any pending block cache reply to the packet data afterwards.
+
+            @param packetData The packet data to fill [out]
+            @param packetSequence The sequence number of the packet being generated.
+            @param availableBits The number of bits available for this channel in the packet.
+            @param packetAllocator The allocator for arrays in the packet data. NULL to use the message factory allocator.
+
+            @returns An estimate of the number of bits required to serialize the packet data, or 0 if there is nothing to send from the send queue.
+         */
+
+        int GetSendQueuePacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits, Allocator * packetAllocator );
+
         /**
             Fill channel packet data with messages.
 
@@ -461,11 +842,25 @@ namespace yojimbo
             @param packetData The packet data to fill [out]
             @param messageIds Array of message ids identifying which messages to add to the packet from the message send queue.
             @param numMessageIds The number of message ids in the array.
+            @param packetAllocator The allocator for the message array in the packet data. NULL to use the message factory allocator.
 
             @see GetMessagesToSend
          */
 
-        void GetMessagePacketData( ChannelPacketData & packetData, const uint16_t * messageIds, int numMessageIds );
+        void GetMessagePacketData( ChannelPacketData & packetData, const uint16_t * messageIds, int numMessageIds, Allocator * packetAllocator );
+
+        /**
+            Fill message data with messages from the send queue.
+
+            Used for regular message packet data, and for messages sent along with block fragments. See ChannelConfig::sendMessagesWithFragments.
+
+            @param messageData The message data to fill [out].
+            @param allocator The allocator for the message array.
+            @param messageIds Array of message ids identifying which messages to add from the message send queue.
+            @param numMessageIds The number of message ids in the array.
+         */
+
+        void GetMessageData( ChannelPacketData::MessageData & messageData, Allocator & allocator, const uint16_t * messageIds, int numMessageIds );
 
         /**
             Add a packet entry for the set of messages included in a packet.
@@ -482,13 +877,12 @@ namespace yojimbo
         /**
             Process messages included in a packet.
 
-            Any messages that have not already been received are added to the message receive queue. Messages that are added to the receive queue have a reference added. See Message::AddRef.
+            Any messages that have not already been received are added to the message receive queue. Messages that are added to the receive queue have a reference added. See Message::AddRef. Expired messages are added to the receive queue without a message, so ReceiveMsg skips over them.
 
-            @param numMessages The number of messages to process.
-            @param messages Array of pointers to messages.
+            @param messageData The messages in the packet.
          */
 
-        void ProcessPacketMessages( int numMessages, Message ** messages );
+        void ProcessPacketMessages( const ChannelPacketData::MessageData & messageData );
 
         /**
             Track the oldest unacked message id in the send queue.
@@ -504,6 +898,75 @@ namespace yojimbo
 
         void UpdateOldestUnackedMessageId();
 
+        /**
+            Get the time to wait before resending a message or fragment.
+
+            When ChannelConfig::adaptiveResendTime is enabled and there is an RTT estimate, this is RTT + max( ChannelConfig::minResendTime, 4 x RTT variance ), doubled for each time the message or fragment has already been resent, and capped at ChannelConfig::maxResendTime. Otherwise it is the fixed resend time passed in.
+
+            @param fixedResendTime The fixed resend time for this kind of data. Either ChannelConfig::messageResendTime or ChannelConfig::fragmentResendTime.
+            @param numTimesSent The number of times the message or fragment has been sent so far.
+
+            @returns The resend time (seconds).
+         */
+
+        double GetResendTime( float fixedResendTime, int numTimesSent ) const;
+
+        /**
+            Get the time a message being sent expires if it hasn't been acked.
+
+            @param message The message being sent.
+
+            @returns The current time plus the time to live of the message, or ChannelConfig::messageTimeToLive if it doesn't have one. Negative if the message never expires, because ChannelConfig::expireMessages is false, the message is a block message, or it has no time to live.
+         */
+
+        double GetExpireTime( const Message * message ) const;
+
+        /**
+            Measure a message before it is added to the send queue.
+
+            If ChannelConfig::cacheSerializedMessages is enabled, the message is serialized once here and its bits are cached on the message.
+
+            @param message The message to measure.
+
+            @returns The number of bits the message takes up in a bit stream, or -1 if it failed to serialize.
+         */
+
+        int MeasureMessage( Message * message );
+
+        /**
+            Serialize the message ids and queued messages of this channel.
+
+            Messages in the send queue are carried over as unsent, so they are sent again from the new connection. Blocks are sent again from the first fragment.
+
+            @param stream The stream to read from, write to or measure.
+
+            @returns True if serialization succeeded. False if the channel can't be carried over, because a block is part way through being received, or a broadcast message is in the send queue.
+         */
+
+        template <typename Stream> bool SerializeStateInternal( Stream & stream );
+
+        /**
+            Expire a message in the send queue that ran out of time to live before it was acked.
+
+            The message is released, and the entry stays in the send queue with just its id until it is acked, so the receiver can skip the message. The id is sent in the next packet, without waiting for the resend time.
+
+            @param messageId The id of the message.
+         */
+
+        void ExpireMessage( uint16_t messageId );
+
+        /**
+            Count sent packets as lost once a packet sent long enough after them is acked.
+
+            Walks forward over the sent packets that have not been checked yet, up to ChannelConfig::fastResendThreshold packets before the most recent acked packet. Messages and fragments in packets that are still unacked, and that have not been sent again since, are marked to resend right away.
+
+            IMPORTANT: This is called when generating packet data rather than as each ack is processed, so packets acked by the same connection packet as the most recent ack are never counted as lost.
+
+            @see ChannelConfig::fastResendThreshold
+         */
+
+        void DetectLostPackets();
+
         /**
             True if we are currently sending a block message.
 
@@ -528,62 +991,154 @@ namespace yojimbo
 
             The next block fragment is selected by scanning left to right over the set of fragments in the block, skipping over any fragments that have already been acked or have been sent within ChannelConfig::fragmentResendTime.
 
+            If ChannelConfig::maxBlockFragmentsPerPacket is greater than 1, the fragments following it are sent in the same packet while they are also ready to send and fit in the available bits.
+
             @param messageId The id of the message that the block is attached to [out].
-            @param fragmentId The id of the fragment to send [out].
-            @param fragmentBytes The size of the fragment in bytes.
-            @param numFragments The total number of fragments in this block.
-            @param messageType The type of message the block is attached to. See MessageFactory.
+            @param fragmentId The id of the first fragment to send [out].
+            @param numPacketFragments The number of consecutive fragments to send, starting at fragmentId [out].
+            @param fragmentBytes The size of the fragment data in bytes [out].
+            @param numFragments The total number of fragments in this block [out].
+            @param messageType The type of message the block is attached to. See MessageFactory [out].
+            @param availableBits The number of bits available in the packet. The first fragment is sent if any bits are available, so this mostly limits how many fragments follow it.
+
+            @returns Pointer to the fragment data. This points directly into the block attached to the message, so no copy is made. NULL if there is no fragment to send.
+         */
+
+        /**
+            Start sending the block attached to the oldest unacked message.
+
+            Sets up the send block state for the block. If ChannelConfig::blockCache is true, the block is hashed and announced to the other side before any fragments are sent.
 
-            @returns Pointer to the fragment data.
+            @param blockMessage The block message being sent.
          */
 
-        uint8_t * GetFragmentToSend( uint16_t & messageId, uint16_t & fragmentId, int & fragmentBytes, int & numFragments, int & messageType );
+        void StartSendingBlock( BlockMessage * blockMessage );
 
         /**
-            Fill the packet data with block and fragment data.
+            Fill the packet data with an announcement of the block being sent.
 
-            This is the payload function that fills the channel packet data while we are sending a block message.
+            The block message, block size and block hash are sent until the other side replies to say whether it has the block in its block cache.
 
             @param packetData The packet data to fill [out]
-            @param messageId The id of the message that the block is attached to.
-            @param fragmentId The id of the block fragment being sent.
-            @param fragmentData The fragment data.
-            @param fragmentSize The size of the fragment data (bytes).
-            @param numFragments The number of fragments in the block.
-            @param messageType The type of message the block is attached to.
+            @param availableBits The number of bits available in the packet. The announcement is sent if any bits are available.
+            @param packetAllocator The allocator set on the packet data. NULL to use the message factory allocator.
 
-            @returns An estimate of the number of bits required to serialize the block message and fragment data (upper bound).
+            @returns An estimate of the number of bits required to serialize the announcement, or 0 if the announcement was sent within the fragment resend time.
+
+            @see ChannelConfig::blockCache
          */
 
-        int GetFragmentPacketData( ChannelPacketData & packetData, uint16_t messageId, uint16_t fragmentId, uint8_t * fragmentData, int fragmentSize, int numFragments, int messageType );
+        int GetBlockAnnouncePacketData( ChannelPacketData & packetData, int availableBits, Allocator * packetAllocator );
 
         /**
-            Adds a packet entry for the fragment.
+            Compress the block being sent, before any of its fragments are sent.
 
-            This lets us look up the fragment that was in the packet later on when it is acked, so we can ack that block fragment.
+            The block attached to the message is replaced with the compressed block, if it is smaller. Otherwise the block is sent as-is.
 
-            @param messageId The message id that the block was attached to.
-            @param fragmentId The fragment id.
-            @param sequence The sequence number of the packet the fragment was included in.
+            @param blockMessage The block message being sent.
+
+            @see ChannelConfig::compressBlocks
          */
 
-        void AddFragmentPacketEntry( uint16_t messageId, uint16_t fragmentId, uint16_t sequence );
+        void CompressSendBlock( BlockMessage * blockMessage );
+
+        uint8_t * GetFragmentToSend( uint16_t & messageId, uint16_t & fragmentId, int & numPacketFragments, int & fragmentBytes, int & numFragments, int & messageType, int availableBits );
 
         /**
-            Process a packet fragment.
+            Is a fragment of the block being sent ready to send?
 
-            The fragment is added to the set of received fragments for the block. When all packet fragments are received, that block is reconstructed, attached to the block message and added to the message receive queue.
+            @param fragmentId The fragment id in [0,numFragments-1].
 
-            @param messageType The type of the message this block fragment is attached to. This is used to make sure this message type actually allows blocks to be attached to it.
+            @returns True if the fragment has not been acked, and has not been sent within the fragment resend time or was counted as lost.
+         */
+
+        bool FragmentReadyToSend( int fragmentId ) const;
+
+        /**
+            Fill the packet data with block and fragment data.
+
+            This is the payload function that fills the channel packet data while we are sending a block message.
+
+            @param packetData The packet data to fill [out]
+            @param messageId The id of the message that the block is attached to.
+            @param fragmentId The id of the first block fragment being sent.
+            @param numPacketFragments The number of consecutive block fragments being sent.
+            @param fragmentData The fragment data. Points into the block attached to the message, which the packet data holds a reference to.
+            @param fragmentSize The size of the fragment data (bytes).
+            @param numFragments The number of fragments in the block.
+            @param messageType The type of message the block is attached to.
+            @param packetAllocator The allocator set on the packet data. NULL to use the message factory allocator.
+
+            @returns An estimate of the number of bits required to serialize the block message and fragment data (upper bound).
+         */
+
+        int GetFragmentPacketData( ChannelPacketData & packetData, uint16_t messageId, uint16_t fragmentId, int numPacketFragments, uint8_t * fragmentData, int fragmentSize, int numFragments, int messageType, Allocator * packetAllocator );
+
+        /**
+            Adds a packet entry for the fragment.
+
+            This lets us look up the fragments that were in the packet later on when it is acked, so we can ack those block fragments.
+
+            @param messageId The message id that the block was attached to.
+            @param fragmentId The id of the first fragment in the packet.
+            @param numPacketFragments The number of consecutive fragments in the packet.
+            @param messageIds The ids of regular messages sent along with the fragments. See ChannelConfig::sendMessagesWithFragments.
+            @param numMessageIds The number of message ids in the array.
+            @param sequence The sequence number of the packet the fragments were included in.
+         */
+
+        void AddFragmentPacketEntry( uint16_t messageId, uint16_t fragmentId, int numPacketFragments, const uint16_t * messageIds, int numMessageIds, uint16_t sequence );
+
+        /**
+            Process a packet fragment.
+
+            The fragment is added to the set of received fragments for the block. When all packet fragments are received, that block is reconstructed, attached to the block message and added to the message receive queue.
+
+            @param messageType The type of the message this block fragment is attached to. This is used to make sure this message type actually allows blocks to be attached to it.
             @param messageId The id of the message the block fragment belongs to.
             @param numFragments The number of fragments in the block.
             @param fragmentId The id of the fragment in [0,numFragments-1].
             @param fragmentData The fragment data.
             @param fragmentBytes The size of the fragment data in bytes.
             @param blockMessage Pointer to the block message. Passed this in only with the first fragment (0), pass NULL for all other fragments.
+            @param uncompressedBlockSize The size of the block once decompressed, passed in with the first fragment (0) of compressed blocks. Pass 0 for blocks that are not compressed, and for all other fragments. See ChannelConfig::compressBlocks.
+         */
+
+        void ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, uint16_t fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage, int uncompressedBlockSize );
+
+        /**
+            Pass received block data to the channel listener, in order.
+
+            Called after each fragment is received while streaming blocks. Walks forward from the last fragment passed to the listener, over every fragment that has been received since.
+
+            @see ChannelConfig::streamBlocks
+            @see ChannelListener::OnChannelBlockDataReceived
+         */
+
+        void StreamBlockData();
+
+        /**
+            Process a block announcement from the other side.
+
+            Looks the block up in the block cache through the channel listener. If it is found, the block message is received right away with the cached block attached. Either way, a reply is sent back to say whether the fragments are needed.
+
+            @param block The block announcement.
+
+            @see ChannelListener::OnChannelBlockCacheFind
          */
 
-        void ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, uint16_t fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage );
+        void ProcessBlockAnnounce( const ChannelPacketData::BlockData & block );
+
+        /**
+            Process a reply to a block announcement.
+
+            If the other side has the block in its block cache, the block message is acked without sending any fragments. Otherwise the fragments are sent.
+
+            @param messageId The message id of the block the reply is for.
+            @param hit True if the other side found the block in its block cache.
+         */
+
+        void ProcessBlockCacheReply( uint16_t messageId, bool hit );
 
     protected:
 
@@ -591,14 +1146,21 @@ namespace yojimbo
             An entry in the send queue of the reliable-ordered channel.
 
             Messages stay into the send queue until acked. Each message is acked individually, so there can be "holes" in the message send queue.
+
+            IMPORTANT: Everything needed to pick the messages for a packet is kept in the entry, so walking the send queue doesn't touch the messages themselves. Messages can't be stored in the entry, since they are polymorphic, reference counted and shared with packets in flight. Keep this at 32 bytes.
          */
 
         struct MessageSendQueueEntry
         {
             Message * message;                                                          ///< Pointer to the message. When inserted in the send queue the message has one reference. It is released when the message is acked and removed from the send queue.
             double timeLastSent;                                                        ///< The time the message was last sent. Used to implement ChannelConfig::messageResendTime.
-            uint32_t measuredBits : 31;                                                 ///< The number of bits the message takes up in a bit stream.
+            double expireTime;                                                          ///< The time the message expires if it hasn't been acked, or a negative value if it never expires. See ChannelConfig::expireMessages.
+            uint16_t numTimesSent;                                                      ///< The number of times the message has been sent. Used to back off adaptive resends. See ChannelConfig::adaptiveResendTime.
+            uint16_t messageType;                                                       ///< The type of the message. Zero if the message expired.
+            uint32_t measuredBits : 29;                                                 ///< The number of bits the message takes up in a bit stream.
             uint32_t block : 1;                                                         ///< 1 if this is a block message. Block messages are treated differently to regular messages when sent over a reliable-ordered channel.
+            uint32_t lost : 1;                                                          ///< 1 if the last packet the message was sent in was counted as lost. The message is resent without waiting for its resend time. See ChannelConfig::fastResendThreshold.
+            uint32_t expired : 1;                                                       ///< 1 if the message expired before it was acked. The message has been released, and only its id is sent until it is acked.
         };
 
         /**
@@ -607,7 +1169,7 @@ namespace yojimbo
 
         struct MessageReceiveQueueEntry
         {
-            Message * message;                                                          ///< The message pointer. Has at a reference count of at least 1 while in the receive queue. Ownership of the message is passed back to the caller when the message is dequeued.
+            Message * message;                                                          ///< The message pointer. Has at a reference count of at least 1 while in the receive queue. Ownership of the message is passed back to the caller when the message is dequeued. NULL if the message expired before the sender could deliver it.
         };
 
         /**
@@ -618,13 +1180,37 @@ namespace yojimbo
         {
             double timeSent;                                                            ///< The time the packet was sent. Used to estimate round trip time.
             uint16_t * messageIds;                                                      ///< Pointer to an array of message ids. Dynamically allocated because the user can configure the maximum number of messages in a packet per-channel with ChannelConfig::maxMessagesPerPacket.
-            uint32_t numMessageIds : 16;                                                ///< The number of message ids in in the array.
-            uint32_t acked : 1;                                                         ///< 1 if this packet has been acked.
+            uint64_t numMessageIds : 16;                                                ///< The number of message ids in in the array.
+            uint64_t acked : 1;                                                         ///< 1 if this packet has been acked.
+            uint64_t messageIdStart : 32;                                               ///< The number of message ids stored before this packet's (modulo 2^32), when the message ids are stored in a ring buffer. The message ids are still valid while fewer than the ring buffer size have been stored since. Shares a word with numMessageIds and acked, so the entry is 32 bytes on 64-bit platforms with or without the ring buffer. See ChannelConfig::sentPacketMessageIdBufferSize.
             uint64_t block : 1;                                                         ///< 1 if this packet contains a fragment of a block message.
             uint64_t blockMessageId : 16;                                               ///< The block message id. Valid only if "block" is 1.
-            uint64_t blockFragmentId : 16;                                              ///< The block fragment id. Valid only if "block" is 1.
+            uint64_t blockFragmentId : 16;                                              ///< The id of the first block fragment in the packet. Valid only if "block" is 1.
+            uint64_t blockNumFragments : 16;                                            ///< The number of consecutive block fragments in the packet. Valid only if "block" is 1.
         };
 
+        /**
+            Get storage for the message ids of a sent packet entry.
+
+            Without ChannelConfig::sentPacketMessageIdBufferSize each sent packet has a fixed slot of ChannelConfig::maxMessagesPerPacket ids. With it, ids are stored back to back in a ring buffer, wrapping around to the start when they don't fit at the end.
+
+            @param sentPacket The sent packet entry. Its message id pointer and start are set.
+            @param numMessageIds The number of message ids to store.
+            @param sequence The sequence number of the connection packet.
+         */
+
+        void AllocateSentPacketMessageIds( SentPacketEntry * sentPacket, int numMessageIds, uint16_t sequence );
+
+        /**
+            Are the message ids of a sent packet entry still valid?
+
+            @param sentPacket The sent packet entry.
+
+            @returns True if the message ids have not been overwritten by message ids of later packets. Always true without ChannelConfig::sentPacketMessageIdBufferSize.
+         */
+
+        bool HasSentPacketMessageIds( const SentPacketEntry * sentPacket ) const;
+
         /**
             Internal state for a block being sent across the reliable ordered channel.
             
@@ -635,21 +1221,23 @@ namespace yojimbo
 
         struct SendBlockData
         {
-            SendBlockData( Allocator & allocator, int maxBlockSize, int maxFragmentsPerBlock )
+            SendBlockData( Allocator & allocator, int maxFragmentsPerBlock )
             {
                 m_allocator = &allocator;
                 ackedFragment = YOJIMBO_NEW( allocator, BitArray, allocator, maxFragmentsPerBlock );
                 fragmentSendTime = (double*) YOJIMBO_ALLOCATE( allocator, sizeof( double) * maxFragmentsPerBlock );
-                blockData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, maxBlockSize );
-                assert( ackedFragment && blockData && fragmentSendTime );
+                fragmentSendCount = (uint16_t*) YOJIMBO_ALLOCATE( allocator, sizeof( uint16_t ) * maxFragmentsPerBlock );
+                lostFragment = YOJIMBO_NEW( allocator, BitArray, allocator, maxFragmentsPerBlock );
+                assert( ackedFragment && fragmentSendTime && fragmentSendCount && lostFragment );
                 Reset();
             }
 
             ~SendBlockData()
             {
                 YOJIMBO_DELETE( *m_allocator, BitArray, ackedFragment );
-                YOJIMBO_FREE( *m_allocator, blockData );
                 YOJIMBO_FREE( *m_allocator, fragmentSendTime );
+                YOJIMBO_FREE( *m_allocator, fragmentSendCount );
+                YOJIMBO_DELETE( *m_allocator, BitArray, lostFragment );
             }
 
             void Reset()
@@ -657,22 +1245,37 @@ namespace yojimbo
                 active = false;
                 numFragments = 0;
                 numAckedFragments = 0;
+                firstUnackedFragment = 0;
                 blockMessageId = 0;
                 blockSize = 0;
+                uncompressedBlockSize = 0;
+                compressed = false;
+                blockHash = 0;
+                waitingForCacheReply = false;
+                announceSendTime = -1.0;
+                announceSendCount = 0;
             }
 
             bool active;                                                                ///< True if we are currently sending a block.
-            int blockSize;                                                              ///< The size of the block (bytes).
+            int blockSize;                                                              ///< The size of the block (bytes). This is the compressed size once the block is compressed.
+            int uncompressedBlockSize;                                                  ///< The size of the block before it was compressed (bytes).
+            bool compressed;                                                            ///< True if the block attached to the message was replaced with a compressed block. See ChannelConfig::compressBlocks.
+            uint64_t blockHash;                                                         ///< The hash of the block data. Only set when ChannelConfig::blockCache is true.
+            bool waitingForCacheReply;                                                  ///< True while the block is announced, but the other side hasn't said whether it has it in its block cache. No fragments are sent until it does. See ChannelConfig::blockCache.
+            double announceSendTime;                                                    ///< Last time the block announcement was sent.
+            uint16_t announceSendCount;                                                 ///< Number of times the block announcement was sent. Used to back off adaptive resends.
             int numFragments;                                                           ///< Number of fragments in the block being sent.
             int numAckedFragments;                                                      ///< Number of acked fragments in the block being sent.
+            int firstUnackedFragment;                                                   ///< All fragments before this one are acked. Limits the fragments in flight when streaming blocks. See ChannelConfig::blockStreamWindow.
             uint16_t blockMessageId;                                                    ///< The message id the block is attached to.
             BitArray * ackedFragment;                                                   ///< Has fragment n been received?
             double * fragmentSendTime;                                                  ///< Last time fragment was sent.
-            uint8_t * blockData;                                                        ///< The block data.
+            uint16_t * fragmentSendCount;                                               ///< Number of times fragment was sent. Used to back off adaptive resends.
+            BitArray * lostFragment;                                                    ///< Was the last packet fragment n was sent in counted as lost? Lost fragments are resent without waiting for the fragment resend time. See ChannelConfig::fastResendThreshold.
 
         private:
 
-            Allocator * m_allocator;                                                    ///< Allocator used to create the block data.
+            Allocator * m_allocator;                                                    ///< Allocator used to create the per-fragment data.
         
             SendBlockData( const SendBlockData & other );
             
@@ -689,12 +1292,12 @@ namespace yojimbo
 
         struct ReceiveBlockData
         {
-            ReceiveBlockData( Allocator & allocator, int maxBlockSize, int maxFragmentsPerBlock )
+            ReceiveBlockData( Allocator & allocator, int maxFragmentsPerBlock )
             {
                 m_allocator = &allocator;
                 receivedFragment = YOJIMBO_NEW( allocator, BitArray, allocator, maxFragmentsPerBlock );
-                blockData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, maxBlockSize );
-                assert( receivedFragment && blockData );
+                assert( receivedFragment );
+                blockData = NULL;
                 blockMessage = NULL;
                 Reset();
             }
@@ -702,7 +1305,7 @@ namespace yojimbo
             ~ReceiveBlockData()
             {
                 YOJIMBO_DELETE( *m_allocator, BitArray, receivedFragment );
-                YOJIMBO_FREE( *m_allocator, blockData );
+                assert( !blockData );
             }
 
             void Reset()
@@ -710,19 +1313,23 @@ namespace yojimbo
                 active = false;
                 numFragments = 0;
                 numReceivedFragments = 0;
+                numStreamedFragments = 0;
                 messageId = 0;
                 messageType = 0;
                 blockSize = 0;
+                uncompressedBlockSize = 0;
             }
 
             bool active;                                                                ///< True if we are currently receiving a block.
             int numFragments;                                                           ///< The number of fragments in this block
             int numReceivedFragments;                                                   ///< The number of fragments received.
+            int numStreamedFragments;                                                   ///< The number of fragments passed to the channel listener so far. Only used when streaming blocks.
             uint16_t messageId;                                                         ///< The message id corresponding to the block.
             int messageType;                                                            ///< Message type of the block being received.
             uint32_t blockSize;                                                         ///< Block size in bytes.
+            int uncompressedBlockSize;                                                  ///< The size of the block once decompressed (bytes), sent with fragment 0. Zero if the block is not compressed. See ChannelConfig::compressBlocks.
             BitArray * receivedFragment;                                                ///< Has fragment n been received?
-            uint8_t * blockData;                                                        ///< Block data for receive.
+            uint8_t * blockData;                                                        ///< Block data for receive. Allocated with the message factory allocator when a block starts being received, then handed over to the block message once all fragments have arrived. When streaming blocks, this is a ring buffer of ChannelConfig::blockStreamWindow fragments instead.
             BlockMessage * blockMessage;                                                ///< Block message (sent with fragment 0).
 
         private:
@@ -739,12 +1346,23 @@ namespace yojimbo
         uint16_t m_sendMessageId;                                                       ///< Id of the next message to be added to the send queue.
         uint16_t m_receiveMessageId;                                                    ///< Id of the next message to be added to the receive queue.
         uint16_t m_oldestUnackedMessageId;                                              ///< Id of the oldest unacked message in the send queue.
+        bool m_hasMostRecentAck;                                                        ///< True once any packet has been acked. See ChannelConfig::fastResendThreshold.
+        uint16_t m_mostRecentAck;                                                       ///< The most recent sequence number acked. Only valid if m_hasMostRecentAck is true.
+        bool m_hasLostPacketSequence;                                                   ///< True once sent packets have been checked for fast resend. See ChannelConfig::fastResendThreshold.
+        uint16_t m_lostPacketSequence;                                                  ///< All sent packets before this sequence number have been checked for fast resend. Only valid if m_hasLostPacketSequence is true.
+        uint16_t m_remoteReceiveWindow;                                                 ///< The id of the first message the receive queue on the other side has no room for, from the most recent connection packet received. Messages from this id on are held back. Only used with ChannelConfig::flowControl.
         SequenceBuffer<SentPacketEntry> * m_sentPackets;                                ///< Stores information per sent connection packet about messages and block data included in each packet. Used to walk from connection packet level acks to message and data block fragment level acks.
         SequenceBuffer<MessageSendQueueEntry> * m_messageSendQueue;                     ///< Message send queue.
         SequenceBuffer<MessageReceiveQueueEntry> * m_messageReceiveQueue;               ///< Message receive queue.
-        uint16_t * m_sentPacketMessageIds;                                              ///< Array of n message ids per sent connection packet. Allows the maximum number of messages per-packet to be allocated dynamically.
+        uint16_t * m_sentPacketMessageIds;                                              ///< Array of n message ids per sent connection packet. Allows the maximum number of messages per-packet to be allocated dynamically. A ring buffer of ChannelConfig::sentPacketMessageIdBufferSize ids if that is set.
+        int m_sentPacketMessageIdHead;                                                  ///< Index in the ring buffer where the next sent packet message ids are stored. Only used with ChannelConfig::sentPacketMessageIdBufferSize.
+        uint32_t m_numSentPacketMessageIds;                                             ///< Number of message ids stored in the ring buffer, counting the slots skipped at the end when ids wrap around to the start. Only used with ChannelConfig::sentPacketMessageIdBufferSize.
         SendBlockData * m_sendBlock;                                                    ///< Data about the block being currently sent.
         ReceiveBlockData * m_receiveBlock;                                              ///< Data about the block being currently received.
+        PacketCompressor * m_blockCompressor;                                           ///< Compresses blocks before they are sent, and decompresses them once received. NULL unless ChannelConfig::compressBlocks is true.
+        bool m_blockCacheReplyPending;                                                  ///< True if a reply to a block announcement is waiting to be sent. Sent with the next packet data generated for this channel. See ChannelConfig::blockCache.
+        bool m_blockCacheReplyHit;                                                      ///< True if the pending reply says the block was found in the block cache.
+        uint16_t m_blockCacheReplyMessageId;                                            ///< The message id of the block the pending reply is for.
 
     private:
 
@@ -757,6 +1375,10 @@ namespace yojimbo
         Messages sent across this channel are not guaranteed to arrive, and may be received in a different order than they were sent.
         
         This channel type is best used for time critical data like snapshots and object state.
+
+        Set ChannelConfig::redundancyWindow to include each message in several consecutive packets, like sending the most recent inputs in every packet. Redundant copies of a message share the same message object and serialized bits, and the receiver drops any copies after the first.
+
+        Messages with a key (see Message::SetKey) replace the queued message with the same key, if there is one, so state updates sent faster than the channel drains don't pile up in the send queue.
      */
 
     class UnreliableUnorderedChannel : public Channel
@@ -790,18 +1412,153 @@ namespace yojimbo
 
         Message * ReceiveMsg();
 
+        bool CanSendMsgs( int numMessages ) const;
+
         void AdvanceTime( double time );
 
-        int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
+        int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits, Allocator * packetAllocator = NULL );
 
         void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
 
+        bool WillDiscardMessage( uint16_t messageId ) const;
+
         void ProcessAck( uint16_t ack );
 
+        bool HasMessagesToSend() const;
+
+        int GetNumQueuedMessages() const;
+
     protected:
 
+        /**
+            A message kept so it can be included in the packets after the one it was first sent in.
+         */
+
+        struct RedundantMessageEntry
+        {
+            Message * message;                                                          ///< The message. The channel holds a reference to it while it is in the redundant window.
+            int measuredBits;                                                           ///< The number of bits the message takes in a packet, including its message type but not its id.
+            int packetsRemaining;                                                       ///< The number of packets this message can still be included in. Counts down with each packet generated for this channel, whether or not the message fits in it.
+        };
+
+        /**
+            Add the messages in the redundant window to a packet.
+
+            The most recent messages are added first, and this stops at the first message that doesn't fit, so the message ids in the packet are always consecutive. Messages that run out of packets are removed from the window.
+
+            @param messages The array of messages to add to [in/out]. Redundant messages are added before the messages already in the array, so messages are in the order they were sent.
+            @param numMessages The number of messages in the array [in/out].
+            @param usedBits The number of bits used in the packet so far [in/out].
+            @param availableBits The number of bits available in the packet.
+            @param messageTypeBits The number of bits per-message for alignment and the message size, on top of the measured bits of each message.
+         */
+
+        void AddRedundantMessages( Message ** messages, int & numMessages, int & usedBits, int availableBits, int messageTypeBits );
+
+        /**
+            Measure a message for inclusion in a packet.
+
+            With redundancy, non-block messages that aren't broadcast are serialized and cached here, so the bits can be copied into each packet the message goes out in.
+
+            @param message The message to measure.
+
+            @returns The number of bits the message takes in a packet, including its message type but not its id, or -1 if the message could not be cached.
+         */
+
+        int MeasureMessage( Message * message );
+
+        /**
+            Fill a packet with the messages in the packing window that fit best. See ChannelConfig::packingWindow.
+
+            The oldest queued message is always picked first, and is dropped if it doesn't fit, like it would be without packing. The rest of the space is filled with the largest messages in the window that still fit. Picked messages are removed from the send queue, and the rest keep their order.
+
+            @param messages The array to add the picked messages to, in the order they were sent [out].
+            @param measuredBits The measured bits of each picked message [out].
+            @param numMessages The number of messages picked [out].
+            @param usedBits The number of bits used in the packet so far [in/out].
+            @param availableBits The number of bits available in the packet.
+            @param messageTypeBits The number of bits per-message for alignment and the message size, on top of the measured bits of each message.
+         */
+
+        void PackMessages( Message ** messages, int * measuredBits, int & numMessages, int & usedBits, int availableBits, int messageTypeBits );
+
+        /**
+            Find the queued message with the same key as a message.
+
+            @param message The message to look for.
+
+            @returns The index of the queued message with the same key in the send queue, or -1 if the message has no key or no queued message has the same key.
+         */
+
+        int FindQueuedKey( const Message * message ) const;
+
+        /**
+            Pop the oldest message from the send queue.
+
+            Always use this instead of popping the send queue directly, so the key index stays in sync with the queue.
+
+            @returns The message. The caller owns the reference the send queue held on it.
+         */
+
+        Message * PopSendQueue();
+
+        /**
+            A received message waiting in the playout buffer. See ChannelConfig::playoutBuffer.
+         */
+
+        struct PlayoutEntry
+        {
+            Message * message;                                                          ///< The message. The channel holds a reference to it until it is moved to the receive queue.
+            double playoutTime;                                                         ///< The time the message is moved to the receive queue.
+        };
+
+        /**
+            Get the playout time for the messages in a received packet.
+
+            Unwraps the send time in the packet to the sender's clock, and tracks the smallest difference between receive time and sender time over the last two PlayoutOffsetWindow. That offset belongs to the fastest packets, so the playout time is the sender time plus this offset plus the target playout delay.
+
+            @param sendTime The sender's channel time when the packet was generated, in milliseconds modulo 65536.
+
+            @returns The time the messages in the packet should be moved to the receive queue.
+         */
+
+        double GetPlayoutTime( uint16_t sendTime );
+
+        /**
+            Add a received message to the playout buffer.
+
+            The playout buffer is kept sorted by playout time. Packets mostly arrive in the order they were sent, so this usually appends.
+
+            @param message The message. The playout buffer takes over the reference held on it.
+            @param playoutTime The time the message should be moved to the receive queue.
+         */
+
+        void AddPlayoutMessage( Message * message, double playoutTime );
+
+        /**
+            Move messages whose playout time has passed from the playout buffer to the receive queue, in playout order.
+
+            Stops early if the receive queue is full. The rest are moved on a later update, once messages have been received from the queue.
+         */
+
+        void UpdatePlayoutBuffer();
+
         Queue<Message*> * m_messageSendQueue;                                           ///< Message send queue.
         Queue<Message*> * m_messageReceiveQueue;                                        ///< Message receive queue.
+        PlayoutEntry * m_playoutBuffer;                                                 ///< Received messages waiting for their playout time, sorted by playout time. Holds up to ChannelConfig::receiveQueueSize messages. NULL unless ChannelConfig::playoutBuffer is true.
+        int m_numPlayoutMessages;                                                       ///< The number of messages in the playout buffer.
+        bool m_playoutReceivedPacket;                                                   ///< True once a packet with messages has been received with the playout buffer enabled, so the playout state below is valid.
+        uint16_t m_playoutSendTime;                                                     ///< The most recent send time received (milliseconds modulo 65536).
+        double m_playoutSenderTime;                                                     ///< The most recent send time received, unwrapped to seconds on the sender's clock.
+        double m_playoutReceiveTime;                                                    ///< The time the packet with the most recent send time was received. Send times are only unwrapped across gaps shorter than half their wrap around.
+        double m_playoutOffset[2];                                                      ///< The smallest receive time minus sender time over the current and previous PlayoutOffsetWindow.
+        double m_playoutWindowStart;                                                    ///< The time the current offset window started.
+        Queue<int> * m_sendQueueBits;                                                   ///< The measured bits of each message in the send queue, in the same order, or -1 if the message hasn't been measured yet. NULL unless packing is enabled. See ChannelConfig::packingWindow.
+        Queue<RedundantMessageEntry> * m_redundantMessages;                             ///< Messages sent in recent packets, oldest first. NULL unless ChannelConfig::redundancyWindow is greater than one.
+        SequenceBuffer<uint8_t> * m_receivedMessageIds;                                 ///< Ids of messages received recently, so redundant copies of them can be dropped. NULL unless ChannelConfig::redundancyWindow is greater than one.
+        uint16_t m_sendMessageId;                                                       ///< The id given to the next message with its first copy included in a packet. Only used with redundancy.
+        IdMap * m_sendQueueKeys;                                                        ///< Maps the key of each keyed message in the send queue to its position. Positions count messages pushed since the channel was reset, so they stay valid as the queue is popped. NULL until the first message with a key is sent.
+        uint32_t m_sendQueueHead;                                                       ///< The position of the oldest message in the send queue. Increases each time a message is popped.
 
     private:
 
@@ -809,6 +1566,235 @@ namespace yojimbo
 
         UnreliableUnorderedChannel & operator = ( const UnreliableUnorderedChannel & other );
     };
+
+    /**
+        Messages sent across this channel are not guaranteed to arrive, but are never received out of order.
+
+        This channel type is best used for streams where only the most recent data matters, like player inputs or state updates. Rather than queueing up messages that arrive late, messages older than the newest message received are dropped as soon as they arrive. Nothing is resent, so a lost message never holds up the messages after it.
+
+        Messages are ordered by the sequence number of the connection packet they were sent in. Messages sent in the same packet are received in the order they were sent.
+
+        Like the unreliable-unordered channel, blocks are sent as-is without splitting them up into fragments.
+     */
+
+    class UnreliableSequencedChannel : public UnreliableUnorderedChannel
+    {
+    public:
+
+        /** 
+            Unreliable sequenced channel constructor.
+
+            @param allocator The allocator to use.
+            @param messageFactory Message factory for creating and destroying messages.
+            @param config The configuration for this channel.
+            @param channelId The channel id in [0,numChannels-1].
+         */
+
+        UnreliableSequencedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId );
+
+        void Reset();
+
+        void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
+
+    protected:
+
+        bool m_receivedPacket;                                                          ///< True once a connection packet with data for this channel has been received.
+        uint16_t m_mostRecentPacketSequence;                                            ///< The sequence number of the most recent connection packet received with data for this channel. Messages in older packets are dropped.
+
+    private:
+
+        UnreliableSequencedChannel( const UnreliableSequencedChannel & other );
+
+        UnreliableSequencedChannel & operator = ( const UnreliableSequencedChannel & other );
+    };
+
+    /**
+        Messages sent across this channel are not guaranteed to arrive, and may be received in a different order than they were sent.
+
+        This channel type is for state that may be sent faster than the connection can drain it, like entity state updates. It behaves like an unreliable-unordered channel, except that a full send queue never puts the channel in an error state. Instead, the oldest queued message is dropped to make room for the new one, since newer state supersedes it.
+
+        Give each message a key (see Message::SetKey), like the id of the entity it updates, and a new message replaces the queued message with the same key in place. This way only the most recent state for each key is sent, and the send queue only fills up when there are more keys than queue entries. Message keys need YOJIMBO_MESSAGE_KEYS set to 1.
+     */
+
+    class UnreliableLatestStateChannel : public UnreliableUnorderedChannel
+    {
+    public:
+
+        /** 
+            Unreliable latest state channel constructor.
+
+            @param allocator The allocator to use.
+            @param messageFactory Message factory for creating and destroying messages.
+            @param config The configuration for this channel.
+            @param channelId The channel id in [0,numChannels-1].
+         */
+
+        UnreliableLatestStateChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId );
+
+        bool CanSendMsg() const;
+
+        bool CanSendMsgs( int numMessages ) const;
+
+        void SendMsg( Message * message );
+
+    private:
+
+        UnreliableLatestStateChannel( const UnreliableLatestStateChannel & other );
+
+        UnreliableLatestStateChannel & operator = ( const UnreliableLatestStateChannel & other );
+    };
+
+    /**
+        Messages sent across this channel are not guaranteed to arrive, and are delta encoded against the most recent message the other side received.
+
+        This channel type is best used for snapshots of world state, where each message replaces the one before it and most fields don't change from one message to the next.
+
+        Each time a connection packet is generated, only the most recent message in the send queue is included, and older queued messages are discarded. When the packet containing a message is acked, that message becomes the baseline. Messages derived from DeltaMessage are serialized relative to the baseline, so they only need to send fields that changed. The receiver keeps the messages it received, so it can find the same baseline to read the message. Each connection has its own channel, so each client has its own baseline.
+
+        Snapshots that reference a baseline the receiver no longer has are dropped. Blocks can't be sent over this channel.
+
+        @see DeltaMessage
+     */
+
+    class SnapshotChannel : public Channel
+    {
+    public:
+
+        /** 
+            Snapshot channel constructor.
+
+            @param allocator The allocator to use.
+            @param messageFactory Message factory for creating and destroying messages.
+            @param config The configuration for this channel.
+            @param channelId The channel id in [0,numChannels-1].
+         */
+
+        SnapshotChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId );
+
+        /**
+            Snapshot channel destructor.
+
+            Any messages still in the send or receive queues, and any messages kept as baselines, will be released.
+         */
+
+        ~SnapshotChannel();
+
+        void Reset();
+
+        bool CanSendMsg() const;
+
+        void SendMsg( Message * message );
+
+        Message * ReceiveMsg();
+
+        bool CanSendMsgs( int numMessages ) const;
+
+        void AdvanceTime( double time );
+
+        int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits, Allocator * packetAllocator = NULL );
+
+        void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
+
+        void ProcessAck( uint16_t ack );
+
+        bool HasMessagesToSend() const;
+
+        int GetNumQueuedMessages() const;
+
+        /**
+            Get the id of the message that messages sent are serialized relative to.
+
+            @param baselineId The baseline message id [out].
+
+            @returns True if there is a send baseline, false if no sent message has been acked yet.
+         */
+
+        bool GetSendBaselineId( uint16_t & baselineId ) const;
+
+    protected:
+
+        /**
+            A message kept so it can be used as a baseline.
+
+            Sent messages are kept until they are too old to be acked, or the baseline moves past them. Received messages are kept until the other side stops using them as a baseline.
+         */
+
+        struct SnapshotEntry
+        {
+            Message * message;                                                          ///< The message. Holds a reference. NULL if this entry is empty.
+            uint16_t snapshotId;                                                        ///< The message id.
+        };
+
+        /**
+            Maps packet level acks to the message sent in each packet.
+         */
+
+        struct SnapshotSentPacketEntry
+        {
+            uint16_t snapshotId;                                                        ///< The id of the message included in the packet.
+        };
+
+        /**
+            Find a message kept as a baseline.
+
+            @param entries The array of baseline entries (sent or received).
+            @param snapshotId The message id.
+
+            @returns The message if it is still kept, otherwise NULL.
+         */
+
+        Message * FindSnapshot( SnapshotEntry * entries, uint16_t snapshotId );
+
+        /**
+            Keep a message as a baseline, replacing whatever was in its entry.
+
+            @param entries The array of baseline entries (sent or received).
+            @param snapshotId The message id.
+            @param message The message. The entry takes ownership of a reference.
+         */
+
+        void StoreSnapshot( SnapshotEntry * entries, uint16_t snapshotId, Message * message );
+
+        /**
+            Release kept messages with ids in [oldestId,newestId).
+
+            Called when the baseline moves forward, since older messages can no longer become the baseline.
+
+            @param entries The array of baseline entries (sent or received).
+            @param oldestId The oldest message id that may still be kept [in/out]. Set to newestId.
+            @param newestId The new baseline id. This message is kept.
+         */
+
+        void ReleaseSnapshots( SnapshotEntry * entries, uint16_t & oldestId, uint16_t newestId );
+
+        /**
+            Release all kept messages.
+
+            @param entries The array of baseline entries (sent or received).
+         */
+
+        void ReleaseAllSnapshots( SnapshotEntry * entries );
+
+    protected:
+
+        Queue<Message*> * m_messageSendQueue;                                           ///< Message send queue.
+        Queue<Message*> * m_messageReceiveQueue;                                        ///< Message receive queue.
+        SequenceBuffer<SnapshotSentPacketEntry> * m_sentPackets;                        ///< Maps sent connection packets to the message included in them, so acks can move the send baseline.
+        SnapshotEntry * m_sentSnapshots;                                                ///< Sent messages indexed by message id modulo ChannelConfig::sentPacketBufferSize. Candidates for the send baseline.
+        SnapshotEntry * m_receivedSnapshots;                                            ///< Received messages indexed by message id modulo ChannelConfig::sentPacketBufferSize. The sender may use any of these as a baseline.
+        uint16_t m_sendSnapshotId;                                                      ///< Id of the next message to be sent.
+        uint16_t m_sendBaselineId;                                                      ///< Id of the most recent sent message that was acked. Valid only if m_hasSendBaseline is true.
+        uint16_t m_oldestSentSnapshotId;                                                ///< Id of the oldest sent message that may still be kept.
+        uint16_t m_receiveBaselineId;                                                   ///< Id of the most recent baseline the sender used. Received messages older than this are released.
+        bool m_hasSendBaseline;                                                         ///< True if a sent message has been acked and can be used as a baseline.
+        bool m_hasReceiveBaseline;                                                      ///< True if a received message has referenced a baseline.
+
+    private:
+
+        SnapshotChannel( const SnapshotChannel & other );
+
+        SnapshotChannel & operator = ( const SnapshotChannel & other );
+    };
 }
 
 #endif
@@ -24,10 +24,12 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_client.h"
+#include "yojimbo_platform.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <time.h>
+#include <math.h>
 
 namespace yojimbo
 {
@@ -48,22 +50,50 @@ namespace yojimbo
         m_clientIndex = -1;
         m_lastPacketSendTime = 0.0;
         m_lastPacketReceiveTime = 0.0;
+        m_pendingAcks = false;
 #if !YOJIMBO_SECURE_MODE
         m_clientSalt = 0;
 #endif // #if !YOJIMBO_SECURE_MODE
         m_sequence = 0;
+        m_keepAlivePacketBytes = 0;
+        m_disconnectPacketBytes = 0;
         m_connectTokenExpireTimestamp = 0;
+        m_connectTokenExpireTime = 0.0;
         m_shouldDisconnect = false;
         m_shouldDisconnectState = CLIENT_STATE_DISCONNECTED;
         m_serverAddressIndex = 0;
         m_numServerAddresses = 0;
+        m_numRaceServers = 1;
+        m_raceDeniedMask = 0;
+        m_pingSalt = 0;
+        m_pingStartTime = 0.0;
         memset( m_counters, 0, sizeof( m_counters ) );
         memset( m_connectTokenData, 0, sizeof( m_connectTokenData ) );
         memset( m_connectTokenNonce, 0, sizeof( m_connectTokenNonce ) );
+        memset( m_serverPingTime, 0, sizeof( m_serverPingTime ) );
         memset( m_challengeTokenData, 0, sizeof( m_challengeTokenData ) );
         memset( m_challengeTokenNonce, 0, sizeof( m_challengeTokenNonce ) );
         memset( m_clientToServerKey, 0, sizeof( m_clientToServerKey ) );
         memset( m_serverToClientKey, 0, sizeof( m_serverToClientKey ) );
+        m_resumeTokenValid = false;
+        m_resumeTokenExpireTime = 0.0;
+        m_resumeClientId = 0;
+        memset( m_resumeTokenData, 0, sizeof( m_resumeTokenData ) );
+        memset( m_resumeTokenNonce, 0, sizeof( m_resumeTokenNonce ) );
+        memset( m_resumeClientToServerKey, 0, sizeof( m_resumeClientToServerKey ) );
+        memset( m_resumeServerToClientKey, 0, sizeof( m_resumeServerToClientKey ) );
+        m_sharedClientState = CLIENT_STATE_DISCONNECTED;
+        m_networkThread = NULL;
+        m_networkThreadId = 0;
+        m_networkThreadStarted = 0;
+        m_networkThreadQuit = 0;
+        m_networkThreadSendError = 0;
+        m_networkThreadUpdateRate = 0.0;
+        m_networkThreadStartTime = 0.0;
+        m_deferDestroyConnectionResources = false;
+        m_threadSendQueue = NULL;
+        for ( int i = 0; i < MaxChannels; ++i )
+            m_threadReceiveQueues[i] = NULL;
     }
 
     void Client::CreateAllocators()
@@ -74,7 +104,7 @@ namespace yojimbo
 
         m_clientMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.clientMemory );
 
-        m_clientAllocator = YOJIMBO_NEW( *m_allocator, TLSF_Allocator, m_clientMemory, m_config.clientMemory );
+        m_clientAllocator = CreateAllocator( *m_allocator, m_clientMemory, m_config.clientMemory );
     }
 
     void Client::DestroyAllocators()
@@ -105,9 +135,14 @@ namespace yojimbo
 
     Client::~Client()
     {
+        StopNetworkThread();
+
         // IMPORTANT: Please disconnect the client before destroying it
         assert( !IsConnected() );
 
+        if ( m_clientAllocator )
+            DestroyConnectionResources();
+
         m_transport = NULL;
         m_allocator = NULL;
     }
@@ -192,15 +227,73 @@ namespace yojimbo
 
         m_connectTokenExpireTimestamp = connectTokenExpireTimestamp;
 
+        // IMPORTANT: the connect token expire timestamp is wall clock time, but client time is whatever the caller passes in. Convert it once here.
+
+        m_connectTokenExpireTime = GetTime() + ( (double) connectTokenExpireTimestamp - (double) ::time( NULL ) );
+
         SetEncryptedPacketTypes();
 
+        if ( m_config.enableServerPing && m_numServerAddresses > 1 )
+        {
+            InternalPingServers();
+            return;
+        }
+
         InternalSecureConnect( m_serverAddresses[0] );
     }
 
+    bool Client::CanResume() const
+    {
+        return m_resumeTokenValid && m_resumeTokenExpireTime > GetTime();
+    }
+
+    bool Client::Resume()
+    {
+        if ( !CanResume() )
+            return false;
+
+        // IMPORTANT: disconnecting doesn't touch the resume token, so this is safe to call while connected to the server that issued it
+
+        Disconnect();
+
+        InitializeConnection( m_resumeClientId );
+
+        m_serverAddressIndex = 0;
+        m_numServerAddresses = 1;
+        m_serverAddresses[0] = m_resumeServerAddress;
+
+        char addressString[MaxAddressLength];
+        m_resumeServerAddress.ToString( addressString, sizeof( addressString ) );
+        debug_printf( "resume secure session: %s\n", addressString );
+
+        memcpy( m_clientToServerKey, m_resumeClientToServerKey, KeyBytes );
+        memcpy( m_serverToClientKey, m_resumeServerToClientKey, KeyBytes );
+
+        SetEncryptedPacketTypes();
+
+        m_serverAddress = m_resumeServerAddress;
+
+        m_numRaceServers = 1;
+        m_raceDeniedMask = 0;
+
+        OnConnect( m_serverAddress );
+
+        SetClientState( CLIENT_STATE_SENDING_RESUME_REQUEST );
+
+        m_transport->ResetEncryptionMappings();
+
+        m_transport->AddEncryptionMapping( m_serverAddress, m_clientToServerKey, m_serverToClientKey, m_config.connectionTimeOut );
+
+        return true;
+    }
+
     void Client::Disconnect( ClientState clientState, bool sendDisconnectPacket )
     {
         assert( clientState <= CLIENT_STATE_DISCONNECTED );
 
+        if ( IsOtherThread() )
+            StopNetworkThread();
+
         if ( m_clientState <= CLIENT_STATE_DISCONNECTED || m_clientState == clientState )
             return;
 
@@ -210,6 +303,9 @@ namespace yojimbo
         {
             for ( int i = 0; i < m_config.numDisconnectPackets; ++i )
             {
+                if ( SendSerializedPacketToServer_Internal( CLIENT_SERVER_PACKET_DISCONNECT, (const uint8_t*) m_disconnectPacketData, m_disconnectPacketBytes, true ) )
+                    continue;
+
                 DisconnectPacket * packet = (DisconnectPacket*) CreatePacket( CLIENT_SERVER_PACKET_DISCONNECT );            
 
                 if ( packet )
@@ -235,6 +331,9 @@ namespace yojimbo
         if ( !IsConnected() )
             return false;
 
+        if ( IsOtherThread() )
+            return m_threadSendQueue && !m_threadSendQueue->IsFull();
+
         assert( m_messageFactory );
         assert( m_connection );
         
@@ -243,12 +342,49 @@ namespace yojimbo
 
     void Client::SendMsg( Message * message, int channelId )
     {
+        if ( IsOtherThread() )
+        {
+            // IMPORTANT: the network thread may disconnect at any time, so don't assert on the client state here. Messages queued after a disconnect are released by the network thread.
+
+            assert( m_threadSendQueue );
+            assert( channelId >= 0 );
+            assert( channelId < m_config.connectionConfig.numChannels );
+
+            ClientThreadMessage entry;
+            entry.message = message;
+            entry.channelId = channelId;
+
+            if ( !m_threadSendQueue->Push( entry ) )
+            {
+                debug_printf( "client network thread send queue is full\n" );
+                m_messageFactory->Release( message );
+                atomic_store( &m_networkThreadSendError, 1 );
+            }
+
+            return;
+        }
+
         assert( IsConnected() );
         assert( m_messageFactory );
         assert( m_connection );
         m_connection->SendMsg( message, channelId );
     }
 
+    void Client::SendMsgs( Message ** messages, int numMessages, int channelId )
+    {
+        if ( IsOtherThread() )
+        {
+            for ( int i = 0; i < numMessages; ++i )
+                SendMsg( messages[i], channelId );
+            return;
+        }
+
+        assert( IsConnected() );
+        assert( m_messageFactory );
+        assert( m_connection );
+        m_connection->SendMsgs( messages, numMessages, channelId );
+    }
+
     Message * Client::ReceiveMsg( int channelId )
     {
         assert( m_messageFactory );
@@ -256,11 +392,40 @@ namespace yojimbo
         if ( !IsConnected() )
             return NULL;
 
+        if ( IsOtherThread() )
+        {
+            assert( channelId >= 0 );
+            assert( channelId < m_config.connectionConfig.numChannels );
+            Message * message = NULL;
+            m_threadReceiveQueues[channelId]->Pop( message );
+            return message;
+        }
+
         assert( m_connection );
 
         return m_connection->ReceiveMsg( channelId );
     }
 
+    int Client::ReceiveMsgs( Message ** messages, int maxMessages, int channelId )
+    {
+        assert( m_messageFactory );
+
+        if ( !IsConnected() )
+            return 0;
+
+        if ( IsOtherThread() )
+        {
+            int numMessages = 0;
+            while ( numMessages < maxMessages && m_threadReceiveQueues[channelId]->Pop( messages[numMessages] ) )
+                numMessages++;
+            return numMessages;
+        }
+
+        assert( m_connection );
+
+        return m_connection->ReceiveMsgs( messages, maxMessages, channelId );
+    }
+
     void Client::ReleaseMsg( Message * message )
     {
         assert( message );
@@ -276,27 +441,30 @@ namespace yojimbo
 
     bool Client::IsConnecting() const
     {
-        return m_clientState > CLIENT_STATE_DISCONNECTED && m_clientState < CLIENT_STATE_CONNECTED;
+        const ClientState clientState = GetClientState();
+        return clientState > CLIENT_STATE_DISCONNECTED && clientState < CLIENT_STATE_CONNECTED;
     }
 
     bool Client::IsConnected() const
     {
-        return m_clientState == CLIENT_STATE_CONNECTED;
+        return GetClientState() == CLIENT_STATE_CONNECTED;
     }
 
     bool Client::IsDisconnected() const
     {
-        return m_clientState <= CLIENT_STATE_DISCONNECTED;
+        return GetClientState() <= CLIENT_STATE_DISCONNECTED;
     }
 
     bool Client::ConnectionFailed() const
     {
-        return m_clientState < CLIENT_STATE_DISCONNECTED;
+        return GetClientState() < CLIENT_STATE_DISCONNECTED;
     }
 
     ClientState Client::GetClientState() const
     { 
-        return m_clientState;
+        // IMPORTANT: the client state may be changed by the network thread, so read the copy that is written atomically. See Client::StartNetworkThread.
+
+        return (ClientState) atomic_load( &m_sharedClientState );
     }
 
     Packet * Client::CreatePacket( int type )
@@ -307,6 +475,9 @@ namespace yojimbo
 
     void Client::SendPackets()
     {
+        if ( IsOtherThread() )
+            return;
+
         const double time = GetTime();
 
         switch ( m_clientState )
@@ -330,20 +501,50 @@ namespace yojimbo
 
 #endif // #if !YOJIMBO_SECURE_MODE
 
-            case CLIENT_STATE_SENDING_CONNECTION_REQUEST:
+            case CLIENT_STATE_PINGING_SERVERS:
             {
                 if ( m_lastPacketSendTime + ( 1.0f / m_config.connectionNegotiationSendRate ) > time )
                     return;
 
-                ConnectionRequestPacket * packet = (ConnectionRequestPacket*) CreatePacket( CLIENT_SERVER_PACKET_CONNECTION_REQUEST );
+                for ( int i = 0; i < m_numServerAddresses; ++i )
+                {
+                    if ( m_serverPingTime[i] >= 0.0f )
+                        continue;
 
-                if ( packet )
+                    PingPacket * packet = (PingPacket*) CreatePacket( CLIENT_SERVER_PACKET_PING );
+
+                    if ( !packet )
+                        break;
+
+                    packet->pingId = m_pingSalt + i;
+                    packet->pingTime = (uint64_t) ( time * 1000000.0 );
+
+                    SendPacketToAddress_Internal( m_serverAddresses[i], packet, true );
+                }
+            }
+            break;
+
+            case CLIENT_STATE_SENDING_CONNECTION_REQUEST:
+            {
+                if ( m_lastPacketSendTime + ( 1.0f / m_config.connectionNegotiationSendRate ) > time )
+                    return;
+
+                for ( int i = 0; i < m_numRaceServers; ++i )
                 {
+                    if ( m_raceDeniedMask & ( 1 << i ) )
+                        continue;
+
+                    ConnectionRequestPacket * packet = (ConnectionRequestPacket*) CreatePacket( CLIENT_SERVER_PACKET_CONNECTION_REQUEST );
+
+                    if ( !packet )
+                        break;
+
                     packet->connectTokenExpireTimestamp = m_connectTokenExpireTimestamp;
-                    memcpy( packet->connectTokenData, m_connectTokenData, ConnectTokenBytes );
+                    packet->connectTokenBytes = GetConnectTokenBytes( m_connectTokenData );
+                    memcpy( packet->connectTokenData, m_connectTokenData, packet->connectTokenBytes );
                     memcpy( packet->connectTokenNonce, m_connectTokenNonce, NonceBytes );
 
-                    SendPacketToServer_Internal( packet );
+                    SendPacketToAddress_Internal( m_serverAddresses[m_serverAddressIndex+i], packet );
                 }
             }
             break;
@@ -365,19 +566,42 @@ namespace yojimbo
             }
             break;
 
+            case CLIENT_STATE_SENDING_RESUME_REQUEST:
+            {
+                if ( m_lastPacketSendTime + ( 1.0f / m_config.connectionNegotiationSendRate ) > time )
+                    return;
+
+                ResumeRequestPacket * packet = (ResumeRequestPacket*) CreatePacket( CLIENT_SERVER_PACKET_RESUME_REQUEST );
+
+                if ( packet )
+                {
+                    memcpy( packet->resumeTokenData, m_resumeTokenData, ResumeTokenBytes );
+                    memcpy( packet->resumeTokenNonce, m_resumeTokenNonce, NonceBytes );
+
+                    SendPacketToServer_Internal( packet );
+                }
+            }
+            break;
+
             case CLIENT_STATE_CONNECTED:
             {
-                if ( m_connection )
+                const bool hasMessagesToSend = m_connection && m_connection->HasMessagesToSend();
+
+                if ( m_connection && ( m_config.clientSendIdle || m_pendingAcks || hasMessagesToSend ) && m_connection->ReadyToSendPacket() )
                 {
                     ConnectionPacket * packet = m_connection->GeneratePacket();
 
+                    m_pendingAcks = false;
+
                     if ( packet )
                     {
                         SendPacketToServer( packet );
                     }
                 }
 
-                if ( m_lastPacketSendTime + ( 1.0f / m_config.connectionKeepAliveSendRate ) <= time )
+                const float keepAliveSendRate = ( m_config.connectionIdleKeepAliveSendRate > 0.0f && !hasMessagesToSend ) ? m_config.connectionIdleKeepAliveSendRate : m_config.connectionKeepAliveSendRate;
+
+                if ( m_lastPacketSendTime + ( 1.0f / keepAliveSendRate ) <= time && !SendSerializedPacketToServer_Internal( CLIENT_SERVER_PACKET_KEEPALIVE, (const uint8_t*) m_keepAlivePacketData, m_keepAlivePacketBytes ) )
                 {
                     KeepAlivePacket * packet = (KeepAlivePacket*) CreatePacket( CLIENT_SERVER_PACKET_KEEPALIVE );
 
@@ -396,15 +620,19 @@ namespace yojimbo
 
     void Client::ReceivePackets()
     {
+        if ( IsOtherThread() )
+            return;
+
         while ( true )
         {
             Address address;
             uint64_t sequence;
-            Packet * packet = m_transport->ReceivePacket( address, &sequence );
+            double receiveTime;
+            Packet * packet = m_transport->ReceivePacket( address, &sequence, &receiveTime );
             if ( !packet )
                 break;
 
-            ProcessPacket( packet, address, sequence );
+            ProcessPacket( packet, address, sequence, receiveTime );
 
             packet->Destroy();
         }
@@ -412,8 +640,18 @@ namespace yojimbo
 
     void Client::CheckForTimeOut()
     {
+        if ( IsOtherThread() )
+            return;
+
         const double time = GetTime();
 
+        if ( ( m_clientState == CLIENT_STATE_PINGING_SERVERS || m_clientState == CLIENT_STATE_SENDING_CONNECTION_REQUEST || m_clientState == CLIENT_STATE_SENDING_CHALLENGE_RESPONSE ) && m_connectTokenExpireTime <= time )
+        {
+            debug_printf( "connect token expired\n" );
+            Disconnect( CLIENT_STATE_CONNECT_TOKEN_EXPIRED, false );
+            return;
+        }
+
         if ( m_shouldDisconnect )
         {
             debug_printf( "m_shouldDisconnect -> %s\n", GetClientStateName( m_shouldDisconnectState ) );
@@ -442,6 +680,17 @@ namespace yojimbo
 
 #endif // #if !YOJIMBO_SECURE_MODE
 
+            case CLIENT_STATE_PINGING_SERVERS:
+            {
+                if ( m_pingStartTime + m_config.clientPingTimeOut <= time )
+                {
+                    debug_printf( "ping servers timed out\n" );
+                    FinishPingServers();
+                    return;
+                }
+            }
+            break;
+
             case CLIENT_STATE_SENDING_CONNECTION_REQUEST:
             {
                 if ( m_lastPacketReceiveTime + m_config.connectionNegotiationTimeOut < time )
@@ -468,6 +717,17 @@ namespace yojimbo
             }
             break;
 
+            case CLIENT_STATE_SENDING_RESUME_REQUEST:
+            {
+                if ( m_lastPacketReceiveTime + m_config.connectionNegotiationTimeOut < time )
+                {
+                    debug_printf( "resume request timed out\n" );
+                    Disconnect( CLIENT_STATE_RESUME_REQUEST_TIMEOUT, false );
+                    return;
+                }
+            }
+            break;
+
             case CLIENT_STATE_CONNECTED:
             {
                 if ( m_lastPacketReceiveTime + m_config.connectionTimeOut < time )
@@ -486,6 +746,9 @@ namespace yojimbo
 
     void Client::AdvanceTime( double time )
     {
+        if ( IsOtherThread() )
+            return;
+
         m_time = time;
 
         if ( m_clientAllocator && m_clientAllocator->GetError() )
@@ -518,135 +781,520 @@ namespace yojimbo
         }
     }
 
-    double Client::GetTime() const
-    {
-        return m_time;
-    }
-
-    uint64_t Client::GetClientId() const
-    {
-        return m_clientId;
-    }
-
-    int Client::GetClientIndex() const
-    {
-        return m_clientIndex;
-    }
-
-    uint64_t Client::GetCounter( int index ) const 
+    double Client::GetNextEventTime() const
     {
-        assert( index >= 0 );
-        assert( index < NUM_CLIENT_COUNTERS );
-        return m_counters[index];
-    }
+        const double time = GetTime();
 
-    Allocator & Client::GetClientAllocator()
-    {
-        assert( m_clientAllocator );
-        return *m_clientAllocator;
-    }
+        if ( m_shouldDisconnect )
+            return time;
 
-    void Client::InitializeConnection( uint64_t clientId )
-    {
-        debug_printf( "Client::InitializeConnection (%p), clientId = %" PRIx64 "\n", this, clientId );
+        const double negotiationSendTime = m_lastPacketSendTime + ( 1.0f / m_config.connectionNegotiationSendRate );
 
-        m_clientId = clientId;
+        const double negotiationTimeOutTime = m_lastPacketReceiveTime + m_config.connectionNegotiationTimeOut;
 
-        m_lastPacketSendTime = m_time - 1.0f;
-        m_lastPacketReceiveTime = m_time;
+        double nextEventTime = NoEventTime;
 
-        CreateAllocators();
+        switch ( m_clientState )
+        {
+#if !YOJIMBO_SECURE_MODE
 
-        assert( m_clientAllocator );
+            case CLIENT_STATE_SENDING_INSECURE_CONNECT:
+                nextEventTime = min( negotiationSendTime, negotiationTimeOutTime );
+                break;
 
-        assert( !m_packetFactory );
+#endif // #if !YOJIMBO_SECURE_MODE
 
-        m_packetFactory = CreatePacketFactory( *m_clientAllocator );
+            case CLIENT_STATE_PINGING_SERVERS:
+                nextEventTime = min( min( negotiationSendTime, m_pingStartTime + m_config.clientPingTimeOut ), m_connectTokenExpireTime );
+                break;
 
-        assert( m_packetFactory );
+            case CLIENT_STATE_SENDING_CONNECTION_REQUEST:
+            case CLIENT_STATE_SENDING_CHALLENGE_RESPONSE:
+                nextEventTime = min( min( negotiationSendTime, negotiationTimeOutTime ), m_connectTokenExpireTime );
+                break;
 
-        m_replayProtection = YOJIMBO_NEW( *m_clientAllocator, ReplayProtection );
+            case CLIENT_STATE_SENDING_RESUME_REQUEST:
+                nextEventTime = min( negotiationSendTime, negotiationTimeOutTime );
+                break;
 
-        if ( m_config.enableMessages )
-        {
-            if ( m_allocateConnection )
+            case CLIENT_STATE_CONNECTED:
             {
-                assert( !m_connection );
-                assert( !m_messageFactory );
+                const bool hasMessagesToSend = m_connection && m_connection->HasMessagesToSend();
 
-                m_messageFactory = CreateMessageFactory( *m_clientAllocator );
-                
-                assert( m_messageFactory );
-                
-                m_connection = YOJIMBO_NEW( *m_clientAllocator, Connection, *m_clientAllocator, *m_packetFactory, *m_messageFactory, m_config.connectionConfig );
-                
-                assert( m_connection );
+                const float keepAliveSendRate = ( m_config.connectionIdleKeepAliveSendRate > 0.0f && !hasMessagesToSend ) ? m_config.connectionIdleKeepAliveSendRate : m_config.connectionKeepAliveSendRate;
 
-                m_connection->SetListener( this );
+                nextEventTime = min( m_lastPacketSendTime + ( 1.0f / keepAliveSendRate ), m_lastPacketReceiveTime + m_config.connectionTimeOut );
+
+                if ( m_connection && ( m_config.clientSendIdle || m_pendingAcks || hasMessagesToSend ) )
+                    nextEventTime = min( nextEventTime, m_connection->GetNextSendTime() );
             }
+            break;
+
+            default:
+                return NoEventTime;
         }
 
-        m_transportContext = TransportContext();
+        return max( nextEventTime, time );
+    }
 
-        m_transportContext.allocator = m_clientAllocator;
-        m_transportContext.userContext = m_userContext;
-        m_transportContext.packetFactory = m_packetFactory;
-        m_transportContext.replayProtection = m_replayProtection;
-        m_transportContext.encryptionIndex = m_transport->FindEncryptionMapping( m_serverAddress );
+    bool Client::StartNetworkThread( double updateRate )
+    {
+        assert( updateRate > 0.0 );
+        assert( !m_networkThread );
+        assert( m_clientAllocator );
 
-        if ( m_allocateConnection )
+        if ( m_networkThread )
+            return true;
+
+        if ( m_messageFactory )
         {
-            m_connectionContext.messageFactory = m_messageFactory;
-            m_connectionContext.connectionConfig = &m_config.connectionConfig;
-            m_transportContext.connectionContext = &m_connectionContext;
-        }
+            m_messageFactory->SetThreadSafe( true );
 
-        m_transport->SetContext( m_transportContext );
-    }
+            int sendQueueSize = 0;
+            for ( int i = 0; i < m_config.connectionConfig.numChannels; ++i )
+                sendQueueSize += m_config.connectionConfig.channel[i].sendQueueSize;
 
-    void Client::ShutdownConnection()
-    {
-        debug_printf( "Client::ShutdownConnection (%p)\n", this );
+            m_threadSendQueue = YOJIMBO_NEW( *m_allocator, LockFreeQueue<ClientThreadMessage>, *m_allocator, sendQueueSize );
 
-        m_transport->ClearContext();
+            for ( int i = 0; i < m_config.connectionConfig.numChannels; ++i )
+                m_threadReceiveQueues[i] = YOJIMBO_NEW( *m_allocator, LockFreeQueue<Message*>, *m_allocator, m_config.connectionConfig.channel[i].receiveQueueSize );
+        }
 
-        m_transport->Reset();
+        m_networkThreadUpdateRate = updateRate;
+        m_networkThreadStartTime = m_time;
+        m_networkThreadQuit = 0;
+        m_networkThreadSendError = 0;
 
-        YOJIMBO_DELETE( *m_clientAllocator, Connection, m_connection );
+        m_networkThread = platform_thread_create( *m_allocator, NetworkThreadFunction, this );
 
-        YOJIMBO_DELETE( *m_clientAllocator, PacketFactory, m_packetFactory );
+        if ( !m_networkThread )
+        {
+            debug_printf( "failed to create client network thread\n" );
+            ReleaseNetworkThreadMessages();
+            return false;
+        }
 
-        YOJIMBO_DELETE( *m_clientAllocator, MessageFactory, m_messageFactory );
+        if ( m_config.clientNetworkThreadCpu >= 0 && !platform_thread_set_affinity( m_networkThread, m_config.clientNetworkThreadCpu ) )
+            debug_printf( "failed to pin client network thread to cpu %d\n", m_config.clientNetworkThreadCpu );
 
-        YOJIMBO_DELETE( *m_clientAllocator, ReplayProtection, m_replayProtection );
+        // IMPORTANT: wait until the network thread knows its own id, so calls made on this thread from now on are passed to the network thread instead of touching the connection directly.
 
-        DestroyAllocators();
+        while ( !atomic_load( &m_networkThreadStarted ) )
+            platform_sleep( 0.0001 );
+
+        return true;
     }
 
-    void Client::SetEncryptedPacketTypes()
+    void Client::StopNetworkThread()
     {
-        m_transport->EnablePacketEncryption();
+        if ( !m_networkThread )
+            return;
 
-        m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_CONNECTION_REQUEST );
+        atomic_store( &m_networkThreadQuit, 1 );
+        platform_thread_join( *m_allocator, m_networkThread );
+        m_networkThread = NULL;
+        atomic_store( &m_networkThreadStarted, 0 );
+
+        ReleaseNetworkThreadMessages();
+
+        if ( m_deferDestroyConnectionResources )
+        {
+            m_deferDestroyConnectionResources = false;
+            DestroyConnectionResources();
+        }
     }
 
-    PacketFactory * Client::CreatePacketFactory( Allocator & allocator )
+    bool Client::IsNetworkThreadRunning() const
     {
-        return YOJIMBO_NEW( allocator, ClientServerPacketFactory, allocator );
+        return m_networkThread != NULL;
     }
 
-    MessageFactory * Client::CreateMessageFactory( Allocator & /*allocator*/ )
+    void Client::NetworkThreadFunction( void * data )
     {
-        assert( !"you need to override Client::CreateMessageFactory if you want to use messages" );
-        return NULL;
-    }    
+        Client * client = (Client*) data;
 
-    void Client::SetClientState( ClientState clientState )
-    {
+        client->m_networkThreadId = platform_thread_id();
+
+        atomic_store( &client->m_networkThreadStarted, 1 );
+
+        const uint64_t startTime = platform_time_ns();
+        const uint64_t tickTime = (uint64_t) ( 1000000000.0 / client->m_networkThreadUpdateRate );
+        uint64_t tick = 0;
+
+        while ( !atomic_load( &client->m_networkThreadQuit ) )
+        {
+            const uint64_t currentTime = platform_time_ns();
+
+            client->NetworkThreadUpdate( client->m_networkThreadStartTime + ( currentTime - startTime ) / 1000000000.0 );
+
+            // IMPORTANT: if an update ran long, skip the ticks that were missed instead of running them back to back
+
+            tick++;
+            const uint64_t finishTime = platform_time_ns();
+            if ( startTime + tick * tickTime < finishTime )
+                tick = ( finishTime - startTime ) / tickTime + 1;
+
+            platform_sleep_until( startTime + tick * tickTime );
+        }
+
+        if ( client->m_clientAllocator )
+            client->m_clientAllocator->ReleaseThread();
+    }
+
+    void Client::NetworkThreadUpdate( double time )
+    {
+        if ( m_threadSendQueue )
+        {
+            // IMPORTANT: messages are only moved to a channel while it has room, so a channel that is backed up holds back the messages queued after it, instead of failing the connection.
+
+            ClientThreadMessage * entry;
+
+            while ( ( entry = m_threadSendQueue->Peek() ) != NULL )
+            {
+                if ( m_clientState == CLIENT_STATE_CONNECTED )
+                {
+                    if ( !m_connection->CanSendMsg( entry->channelId ) )
+                        break;
+                    m_connection->SendMsg( entry->message, entry->channelId );
+                }
+                else
+                {
+                    m_messageFactory->Release( entry->message );
+                }
+
+                ClientThreadMessage sent;
+                m_threadSendQueue->Pop( sent );
+            }
+        }
+
+        SendPackets();
+
+        m_transport->WritePackets();
+
+        m_transport->ReadPackets();
+
+        ReceivePackets();
+
+        if ( m_connection && m_clientState == CLIENT_STATE_CONNECTED )
+        {
+            for ( int i = 0; i < m_config.connectionConfig.numChannels; ++i )
+            {
+                LockFreeQueue<Message*> * receiveQueue = m_threadReceiveQueues[i];
+
+                while ( !receiveQueue->IsFull() )
+                {
+                    Message * message = m_connection->ReceiveMsg( i );
+                    if ( !message )
+                        break;
+                    receiveQueue->Push( message );
+                }
+            }
+        }
+
+        if ( atomic_load( &m_networkThreadSendError ) )
+        {
+            atomic_store( &m_networkThreadSendError, 0 );
+            Disconnect( CLIENT_STATE_CONNECTION_ERROR, true );
+        }
+
+        CheckForTimeOut();
+
+        AdvanceTime( time );
+
+        m_transport->AdvanceTime( time );
+    }
+
+    bool Client::IsOtherThread() const
+    {
+        return atomic_load( &m_networkThreadStarted ) && platform_thread_id() != m_networkThreadId;
+    }
+
+    void Client::ReleaseNetworkThreadMessages()
+    {
+        if ( m_threadSendQueue )
+        {
+            ClientThreadMessage entry;
+            while ( m_threadSendQueue->Pop( entry ) )
+                m_messageFactory->Release( entry.message );
+
+            YOJIMBO_DELETE( *m_allocator, LockFreeQueue<ClientThreadMessage>, m_threadSendQueue );
+        }
+
+        for ( int i = 0; i < MaxChannels; ++i )
+        {
+            if ( !m_threadReceiveQueues[i] )
+                continue;
+
+            Message * message;
+            while ( m_threadReceiveQueues[i]->Pop( message ) )
+                m_messageFactory->Release( message );
+
+            YOJIMBO_DELETE( *m_allocator, LockFreeQueue<Message*>, m_threadReceiveQueues[i] );
+        }
+
+        if ( m_messageFactory )
+            m_messageFactory->SetThreadSafe( false );
+    }
+
+    double Client::GetTime() const
+    {
+        return m_time;
+    }
+
+    uint64_t Client::GetClientId() const
+    {
+        return m_clientId;
+    }
+
+    const Address & Client::GetServerAddress() const
+    {
+        return m_serverAddress;
+    }
+
+    int Client::GetClientIndex() const
+    {
+        return m_clientIndex;
+    }
+
+    uint64_t Client::GetCounter( int index ) const 
+    {
+        assert( index >= 0 );
+        assert( index < NUM_CLIENT_COUNTERS );
+        return m_counters[index];
+    }
+
+    void Client::GetNetworkInfo( NetworkInfo & info ) const
+    {
+        if ( !m_connection )
+        {
+            info = NetworkInfo();
+            return;
+        }
+
+        m_connection->GetNetworkInfo( info );
+    }
+
+    double Client::GetServerTickSendTime() const
+    {
+        if ( !IsConnected() || !m_connection || !m_connection->HasClockSync() )
+            return m_time;
+
+        NetworkInfo info;
+        m_connection->GetNetworkInfo( info );
+
+        const double tickInterval = m_connection->GetRemoteTickInterval();
+
+        double sendTime = m_connection->GetNextRemoteTickTime() - ( info.RTT * 0.5 + info.jitter * 2.0 ) / 1000.0;
+
+        if ( sendTime < m_time )
+            sendTime += ceil( ( m_time - sendTime ) / tickInterval ) * tickInterval;
+
+        return sendTime;
+    }
+
+    Allocator & Client::GetClientAllocator()
+    {
+        assert( m_clientAllocator );
+        return *m_clientAllocator;
+    }
+
+    void Client::InitializeConnection( uint64_t clientId )
+    {
+        debug_printf( "Client::InitializeConnection (%p), clientId = %" PRIx64 "\n", this, clientId );
+
+        m_clientId = clientId;
+
+        m_lastPacketSendTime = m_time - 1.0f;
+        m_lastPacketReceiveTime = m_time;
+        m_pendingAcks = false;
+
+        if ( m_clientAllocator )
+            ResetConnectionResources();
+        else
+            CreateConnectionResources();
+
+        m_transportContext = TransportContext();
+
+        m_transportContext.allocator = m_clientAllocator;
+        m_transportContext.userContext = m_userContext;
+        m_transportContext.packetFactory = m_packetFactory;
+        m_transportContext.replayProtection = m_replayProtection;
+        m_transportContext.encryptionIndex = m_transport->FindEncryptionMapping( m_serverAddress );
+
+        if ( m_allocateConnection )
+        {
+            m_connectionContext.messageFactory = m_messageFactory;
+            m_connectionContext.connectionConfig = &m_config.connectionConfig;
+            m_connectionContext.bitCounters = m_connection->GetPacketBitCounters();
+            m_connectionContext.channels = m_connection->GetChannels();
+            m_connectionContext.stringDictionary = m_connection->GetStringDictionary();
+            m_transportContext.connectionContext = &m_connectionContext;
+        }
+
+        m_transport->SetContext( m_transportContext );
+
+        // IMPORTANT: Keep-alive and disconnect packets sent to the server are the same every time, so serialize them once up front. Only encryption is done each time they are sent.
+
+        m_keepAlivePacketBytes = SerializeControlPacket( CLIENT_SERVER_PACKET_KEEPALIVE, m_keepAlivePacketData );
+
+        m_disconnectPacketBytes = SerializeControlPacket( CLIENT_SERVER_PACKET_DISCONNECT, m_disconnectPacketData );
+    }
+
+    int Client::SerializeControlPacket( int packetType, uint32_t * buffer )
+    {
+        Packet * packet = CreatePacket( packetType );
+
+        if ( !packet )
+            return 0;
+
+        const int packetBytes = m_transport->SerializePacket( packet, (uint8_t*) buffer, SerializedControlPacketBytes );
+
+        packet->Destroy();
+
+        return packetBytes;
+    }
+
+    void Client::ShutdownConnection()
+    {
+        debug_printf( "Client::ShutdownConnection (%p)\n", this );
+
+        m_transport->ClearContext();
+
+        m_transport->Reset();
+
+        if ( m_config.clientPersistentResources )
+            return;
+
+        // IMPORTANT: if the network thread disconnected, the game thread may still be creating and releasing messages, so destroy the connection resources once the network thread stops.
+
+        if ( atomic_load( &m_networkThreadStarted ) )
+            m_deferDestroyConnectionResources = true;
+        else
+            DestroyConnectionResources();
+    }
+
+    void Client::CreateConnectionResources()
+    {
+        CreateAllocators();
+
+        assert( m_clientAllocator );
+
+        assert( !m_packetFactory );
+
+        m_packetFactory = CreatePacketFactory( *m_clientAllocator );
+
+        assert( m_packetFactory );
+
+        m_replayProtection = YOJIMBO_NEW( *m_clientAllocator, ReplayProtection );
+
+        if ( m_config.enableMessages )
+        {
+            if ( m_allocateConnection )
+            {
+                assert( !m_connection );
+                assert( !m_messageFactory );
+
+                m_messageFactory = CreateMessageFactory( *m_clientAllocator );
+                
+                assert( m_messageFactory );
+                
+                m_connection = YOJIMBO_NEW( *m_clientAllocator, Connection, *m_clientAllocator, *m_packetFactory, *m_messageFactory, m_config.connectionConfig );
+                
+                assert( m_connection );
+
+                m_connection->SetListener( this );
+            }
+        }
+    }
+
+    void Client::ResetConnectionResources()
+    {
+        // IMPORTANT: These were kept from the previous connect because ClientServerConfig::clientPersistentResources is true. Resetting them is much cheaper than creating them again, and doesn't allocate.
+
+        assert( m_config.clientPersistentResources );
+        assert( m_clientAllocator );
+        assert( m_packetFactory );
+        assert( m_replayProtection );
+
+        m_clientAllocator->ClearError();
+
+        m_packetFactory->ClearError();
+
+        m_replayProtection->Reset();
+
+        if ( m_messageFactory )
+            m_messageFactory->ClearError();
+
+        if ( m_connection )
+            m_connection->Reset();
+    }
+
+    void Client::DestroyConnectionResources()
+    {
+        YOJIMBO_DELETE( *m_clientAllocator, Connection, m_connection );
+
+        YOJIMBO_DELETE( *m_clientAllocator, PacketFactory, m_packetFactory );
+
+        YOJIMBO_DELETE( *m_clientAllocator, MessageFactory, m_messageFactory );
+
+        YOJIMBO_DELETE( *m_clientAllocator, ReplayProtection, m_replayProtection );
+
+        DestroyAllocators();
+    }
+
+    void Client::SetEncryptedPacketTypes()
+    {
+        m_transport->SetPacketCipher( m_config.packetCipher );
+
+        m_transport->EnablePacketEncryption();
+
+        m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_CONNECTION_REQUEST );
+
+        m_transport->SetMaxUnencryptedPacketBytes( CLIENT_SERVER_PACKET_CONNECTION_REQUEST, ConnectionRequestPacketMaxBytes );
+
+        if ( m_config.enableStatelessChallenge )
+        {
+            m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_CHALLENGE_RESPONSE );
+
+            m_transport->SetMaxUnencryptedPacketBytes( CLIENT_SERVER_PACKET_CHALLENGE_RESPONSE, ChallengeResponsePacketMaxBytes );
+        }
+
+        if ( m_config.enableResumeTokens )
+        {
+            m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_RESUME_REQUEST );
+
+            m_transport->SetMaxUnencryptedPacketBytes( CLIENT_SERVER_PACKET_RESUME_REQUEST, ResumeRequestPacketMaxBytes );
+        }
+
+        if ( m_config.enableServerPing )
+        {
+            m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_PING );
+            m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_PONG );
+
+            m_transport->SetMaxUnencryptedPacketBytes( CLIENT_SERVER_PACKET_PING, PingPacketMaxBytes );
+            m_transport->SetMaxUnencryptedPacketBytes( CLIENT_SERVER_PACKET_PONG, PongPacketMaxBytes );
+        }
+    }
+
+    PacketFactory * Client::CreatePacketFactory( Allocator & allocator )
+    {
+        return YOJIMBO_NEW( allocator, ClientServerPacketFactory, allocator );
+    }
+
+    MessageFactory * Client::CreateMessageFactory( Allocator & /*allocator*/ )
+    {
+        assert( !"you need to override Client::CreateMessageFactory if you want to use messages" );
+        return NULL;
+    }    
+
+    void Client::SetClientState( ClientState clientState )
+    {
         const ClientState previous = m_clientState;
 
         m_clientState = (ClientState) clientState;
 
+        atomic_store( &m_sharedClientState, m_clientState );
+
         if ( clientState != previous )
         {
             OnClientStateChange( previous, clientState );
@@ -662,6 +1310,8 @@ namespace yojimbo
         m_serverAddress = Address();
         m_serverAddressIndex = 0;
         m_numServerAddresses = 0;
+        m_numRaceServers = 1;
+        m_raceDeniedMask = 0;
 
         SetClientState( clientState );
 
@@ -686,6 +1336,7 @@ namespace yojimbo
     {
         m_lastPacketSendTime = m_time - 1.0f;
         m_lastPacketReceiveTime = m_time;
+        m_pendingAcks = false;
 
         m_shouldDisconnect = false;
         m_shouldDisconnectState = CLIENT_STATE_DISCONNECTED;
@@ -710,10 +1361,10 @@ namespace yojimbo
 
     bool Client::ConnectToNextServer()
     {
-        if ( m_serverAddressIndex + 1 >= m_numServerAddresses )
+        if ( m_serverAddressIndex + m_numRaceServers >= m_numServerAddresses )
             return false;
 
-        m_serverAddressIndex++;
+        m_serverAddressIndex += m_numRaceServers;
 
         ResetBeforeNextConnect();
 
@@ -747,6 +1398,9 @@ namespace yojimbo
     {
         m_serverAddress = serverAddress;
 
+        m_numRaceServers = 1;
+        m_raceDeniedMask = 0;
+
         OnConnect( serverAddress );
 
         SetClientState( CLIENT_STATE_SENDING_INSECURE_CONNECT );
@@ -769,6 +1423,72 @@ namespace yojimbo
         m_transport->ResetEncryptionMappings();
 
         m_transport->AddEncryptionMapping( serverAddress, m_clientToServerKey, m_serverToClientKey, m_config.connectionTimeOut );
+
+        // IMPORTANT: when racing, connection requests go out to each of the next servers in the list at the same time.
+        // All of them share the keys from the connect token, so each needs its own encryption mapping to decrypt its challenge.
+
+        m_numRaceServers = 1;
+        m_raceDeniedMask = 0;
+
+        if ( m_config.clientConnectRaceServers > 1 && m_numServerAddresses > 0 && serverAddress == m_serverAddresses[m_serverAddressIndex] )
+        {
+            m_numRaceServers = m_config.clientConnectRaceServers;
+
+            if ( m_numRaceServers > m_numServerAddresses - m_serverAddressIndex )
+                m_numRaceServers = m_numServerAddresses - m_serverAddressIndex;
+
+            for ( int i = 1; i < m_numRaceServers; ++i )
+                m_transport->AddEncryptionMapping( m_serverAddresses[m_serverAddressIndex+i], m_clientToServerKey, m_serverToClientKey, m_config.connectionTimeOut );
+        }
+    }
+
+    void Client::InternalPingServers()
+    {
+        assert( m_numServerAddresses > 1 );
+
+        m_serverAddress = m_serverAddresses[0];
+
+        SetClientState( CLIENT_STATE_PINGING_SERVERS );
+
+        RandomBytes( (uint8_t*) &m_pingSalt, sizeof( m_pingSalt ) );
+
+        m_pingStartTime = GetTime();
+
+        for ( int i = 0; i < m_numServerAddresses; ++i )
+            m_serverPingTime[i] = -1.0f;
+    }
+
+    void Client::FinishPingServers()
+    {
+        // IMPORTANT: stable insertion sort by round trip time. Servers that didn't reply keep their order from the connect token, after all servers that did.
+
+        for ( int i = 1; i < m_numServerAddresses; ++i )
+        {
+            const Address address = m_serverAddresses[i];
+            const float pingTime = m_serverPingTime[i];
+
+            int j = i;
+
+            while ( j > 0 && pingTime >= 0.0f && ( m_serverPingTime[j-1] < 0.0f || m_serverPingTime[j-1] > pingTime ) )
+            {
+                m_serverAddresses[j] = m_serverAddresses[j-1];
+                m_serverPingTime[j] = m_serverPingTime[j-1];
+                j--;
+            }
+
+            m_serverAddresses[j] = address;
+            m_serverPingTime[j] = pingTime;
+        }
+
+        m_serverAddressIndex = 0;
+
+        ResetBeforeNextConnect();
+
+        char addressString[MaxAddressLength];
+        m_serverAddresses[0].ToString( addressString, sizeof( addressString ) );
+        debug_printf( "connect to closest secure server: %s (%.1fms)\n", addressString, m_serverPingTime[0] * 1000.0f );
+
+        InternalSecureConnect( m_serverAddresses[0] );
     }
 
     void Client::SendPacketToServer( Packet * packet )
@@ -791,32 +1511,138 @@ namespace yojimbo
         assert( m_clientState > CLIENT_STATE_DISCONNECTED );
         assert( m_serverAddress.IsValid() );
 
-        m_transport->SendPacket( m_serverAddress, packet, ++m_sequence, immediate );
+        SendPacketToAddress_Internal( m_serverAddress, packet, immediate );
+    }
+
+    bool Client::SendSerializedPacketToServer_Internal( int packetType, const uint8_t * packetData, int packetBytes, bool immediate )
+    {
+        assert( m_clientState > CLIENT_STATE_DISCONNECTED );
+        assert( m_serverAddress.IsValid() );
+
+        if ( packetBytes <= 0 )
+            return false;
+
+        // IMPORTANT: The sequence number is only used up if the packet is sent. Otherwise the caller falls back to sending a packet object, which takes the next sequence number instead.
+
+        if ( !m_transport->SendSerializedPacket( m_serverAddress, packetType, packetData, packetBytes, m_sequence + 1, immediate ) )
+            return false;
 
-        OnPacketSent( packet->GetType(), m_serverAddress, immediate );
+        m_sequence++;
+
+        OnPacketSent( packetType, m_serverAddress, immediate );
 
         m_lastPacketSendTime = GetTime();
+
+        return true;
+    }
+
+    void Client::SendPacketToAddress_Internal( const Address & address, Packet * packet, bool immediate )
+    {
+        assert( packet );
+        assert( m_clientState > CLIENT_STATE_DISCONNECTED );
+        assert( address.IsValid() );
+
+        m_transport->SendPacket( address, packet, ++m_sequence, immediate );
+
+        OnPacketSent( packet->GetType(), address, immediate );
+
+        m_lastPacketSendTime = GetTime();
+    }
+
+    int Client::FindRaceServerIndex( const Address & address ) const
+    {
+        for ( int i = 0; i < m_numRaceServers; ++i )
+        {
+            if ( m_serverAddresses[m_serverAddressIndex+i] == address )
+                return i;
+        }
+        return -1;
     }
 
     void Client::ProcessConnectionDenied( const ConnectionDeniedPacket & /*packet*/, const Address & address )
     {
-        if ( m_clientState != CLIENT_STATE_SENDING_CONNECTION_REQUEST )
+        if ( m_clientState != CLIENT_STATE_SENDING_CONNECTION_REQUEST && m_clientState != CLIENT_STATE_SENDING_RESUME_REQUEST )
             return;
 
-        if ( address != m_serverAddress )
+        if ( m_numRaceServers > 1 )
+        {
+            const int raceIndex = FindRaceServerIndex( address );
+            if ( raceIndex < 0 )
+                return;
+
+            m_raceDeniedMask |= ( 1 << raceIndex );
+
+            if ( m_raceDeniedMask != ( 1U << m_numRaceServers ) - 1 )
+                return;
+        }
+        else if ( address != m_serverAddress )
+        {
             return;
+        }
 
         m_shouldDisconnect = true;
         m_shouldDisconnectState = CLIENT_STATE_CONNECTION_DENIED;
     }
 
+    void Client::ProcessPong( const PongPacket & packet, const Address & address )
+    {
+        if ( m_clientState != CLIENT_STATE_PINGING_SERVERS )
+            return;
+
+        const int index = int( packet.pingId - m_pingSalt );
+
+        if ( packet.pingId - m_pingSalt >= (uint64_t) m_numServerAddresses || m_serverAddresses[index] != address || m_serverPingTime[index] >= 0.0f )
+            return;
+
+        const double pingTime = GetTime() - packet.pingTime / 1000000.0;
+
+        m_serverPingTime[index] = pingTime > 0.0 ? (float) pingTime : 0.0f;
+
+        for ( int i = 0; i < m_numServerAddresses; ++i )
+        {
+            if ( m_serverPingTime[i] < 0.0f )
+                return;
+        }
+
+        FinishPingServers();
+    }
+
     void Client::ProcessChallenge( const ChallengePacket & packet, const Address & address )
     {
         if ( m_clientState != CLIENT_STATE_SENDING_CONNECTION_REQUEST )
             return;
 
-        if ( address != m_serverAddress )
+        if ( m_numRaceServers > 1 )
+        {
+            const int raceIndex = FindRaceServerIndex( address );
+            if ( raceIndex < 0 || ( m_raceDeniedMask & ( 1 << raceIndex ) ) )
+                return;
+
+            // IMPORTANT: the first challenge wins the race. Drop the encryption mappings for the other servers so their
+            // packets are no longer decrypted, and reset replay protection so their sequence numbers can't block ours.
+
+            for ( int i = 0; i < m_numRaceServers; ++i )
+            {
+                if ( i != raceIndex )
+                    m_transport->RemoveEncryptionMapping( m_serverAddresses[m_serverAddressIndex+i] );
+            }
+
+            m_serverAddressIndex += raceIndex;
+            m_numRaceServers = 1;
+            m_raceDeniedMask = 0;
+            m_serverAddress = address;
+
+            if ( m_replayProtection )
+                m_replayProtection->Reset();
+
+            char addressString[MaxAddressLength];
+            address.ToString( addressString, sizeof( addressString ) );
+            debug_printf( "won connect race: %s (%d/%d)\n", addressString, m_serverAddressIndex + 1, m_numServerAddresses );
+        }
+        else if ( address != m_serverAddress )
+        {
             return;
+        }
 
         memcpy( m_challengeTokenData, packet.challengeTokenData, ChallengeTokenBytes );
         memcpy( m_challengeTokenNonce, packet.challengeTokenNonce, NonceBytes );
@@ -831,15 +1657,15 @@ namespace yojimbo
     bool Client::IsPendingConnect()
     {
 #if !YOJIMBO_SECURE_MODE
-        return m_clientState == CLIENT_STATE_SENDING_CHALLENGE_RESPONSE || m_clientState == CLIENT_STATE_SENDING_INSECURE_CONNECT;
+        return m_clientState == CLIENT_STATE_SENDING_CHALLENGE_RESPONSE || m_clientState == CLIENT_STATE_SENDING_RESUME_REQUEST || m_clientState == CLIENT_STATE_SENDING_INSECURE_CONNECT;
 #else // #if !YOJIMBO_SECURE_MODE
-        return m_clientState == CLIENT_STATE_SENDING_CHALLENGE_RESPONSE;
+        return m_clientState == CLIENT_STATE_SENDING_CHALLENGE_RESPONSE || m_clientState == CLIENT_STATE_SENDING_RESUME_REQUEST;
 #endif // #if !YOJIMBO_SECURE_MODE
     }
 
     void Client::CompletePendingConnect( int clientIndex )
     {
-        if ( m_clientState == CLIENT_STATE_SENDING_CHALLENGE_RESPONSE )
+        if ( m_clientState == CLIENT_STATE_SENDING_CHALLENGE_RESPONSE || m_clientState == CLIENT_STATE_SENDING_RESUME_REQUEST )
         {
             m_clientIndex = clientIndex;
 
@@ -878,12 +1704,36 @@ namespace yojimbo
         }
 #endif // #if !YOJIMBO_SECURE_MODE
 
+        // IMPORTANT: the client index changes when the client is handed off to another server. See Server::HandoffClient.
+
         if ( IsPendingConnect() )
             CompletePendingConnect( packet.clientIndex );
+        else if ( m_clientState == CLIENT_STATE_CONNECTED )
+            m_clientIndex = packet.clientIndex;
+
+        if ( packet.hasResumeToken && m_clientState == CLIENT_STATE_CONNECTED )
+            StoreResumeToken( packet );
 
         m_lastPacketReceiveTime = GetTime();
     }
 
+    void Client::StoreResumeToken( const KeepAlivePacket & packet )
+    {
+        assert( packet.hasResumeToken );
+
+        // IMPORTANT: the expire timestamp is wall clock time, so convert it to client time the same as the connect token expire timestamp
+
+        m_resumeTokenValid = true;
+        m_resumeTokenExpireTime = GetTime() + ( (double) packet.resumeTokenExpireTimestamp - (double) ::time( NULL ) );
+        m_resumeClientId = m_clientId;
+        m_resumeServerAddress = m_serverAddress;
+
+        memcpy( m_resumeTokenData, packet.resumeTokenData, ResumeTokenBytes );
+        memcpy( m_resumeTokenNonce, packet.resumeTokenNonce, NonceBytes );
+        memcpy( m_resumeClientToServerKey, packet.resumeClientToServerKey, KeyBytes );
+        memcpy( m_resumeServerToClientKey, packet.resumeServerToClientKey, KeyBytes );
+    }
+
     void Client::ProcessDisconnect( const DisconnectPacket & /*packet*/, const Address & address )
     {
         if ( m_clientState != CLIENT_STATE_CONNECTED )
@@ -896,7 +1746,46 @@ namespace yojimbo
         m_shouldDisconnectState = CLIENT_STATE_DISCONNECTED;
     }
 
-    void Client::ProcessConnectionPacket( ConnectionPacket & packet, const Address & address )
+    void Client::ProcessHandoff( const HandoffPacket & packet, const Address & address )
+    {
+        if ( m_clientState != CLIENT_STATE_CONNECTED )
+            return;
+
+        if ( address != m_serverAddress )
+            return;
+
+        if ( !packet.serverAddress.IsValid() || packet.serverAddress == m_serverAddress )
+            return;
+
+        // IMPORTANT: the other server carries on with the same keys, packet sequence numbers and messages, so only the address changes
+
+        uint8_t clientToServerKey[KeyBytes];
+        uint8_t serverToClientKey[KeyBytes];
+
+        if ( !m_transport->GetEncryptionMappingKeys( m_serverAddress, clientToServerKey, serverToClientKey ) )
+            return;
+
+        if ( !m_transport->AddEncryptionMapping( packet.serverAddress, clientToServerKey, serverToClientKey, m_config.connectionTimeOut ) )
+            return;
+
+        m_transport->RemoveEncryptionMapping( m_serverAddress );
+
+        m_transportContext.encryptionIndex = m_transport->FindEncryptionMapping( packet.serverAddress );
+
+        m_transport->AddContextMapping( packet.serverAddress, m_transportContext );
+
+        char fromString[MaxAddressLength];
+        char toString[MaxAddressLength];
+        m_serverAddress.ToString( fromString, sizeof( fromString ) );
+        packet.serverAddress.ToString( toString, sizeof( toString ) );
+        debug_printf( "client handed off from %s to %s\n", fromString, toString );
+
+        m_serverAddress = packet.serverAddress;
+
+        m_lastPacketReceiveTime = GetTime();
+    }
+
+    void Client::ProcessConnectionPacket( ConnectionPacket & packet, const Address & address, double receiveTime )
     {
         if ( !IsConnected() )
             return;
@@ -905,12 +1794,19 @@ namespace yojimbo
             return;
 
         if ( m_connection )
-            m_connection->ProcessPacket( &packet );
+        {
+            m_connection->ProcessPacket( &packet, receiveTime );
+
+            // IMPORTANT: Only packets with channel data need to be acked. Acking packets that only carry acks would bounce connection packets back and forth with the server forever.
+
+            if ( packet.numChannelEntries > 0 )
+                m_pendingAcks = true;
+        }
 
         m_lastPacketReceiveTime = GetTime();
     }
 
-    void Client::ProcessPacket( Packet * packet, const Address & address, uint64_t /*sequence*/ )
+    void Client::ProcessPacket( Packet * packet, const Address & address, uint64_t /*sequence*/, double receiveTime )
     {
         OnPacketReceived( packet->GetType(), address );
         
@@ -924,6 +1820,10 @@ namespace yojimbo
                 ProcessChallenge( *(ChallengePacket*)packet, address );
                 return;
 
+            case CLIENT_SERVER_PACKET_PONG:
+                ProcessPong( *(PongPacket*)packet, address );
+                return;
+
             case CLIENT_SERVER_PACKET_KEEPALIVE:
                 ProcessKeepAlive( *(KeepAlivePacket*)packet, address );
                 return;
@@ -932,8 +1832,12 @@ namespace yojimbo
                 ProcessDisconnect( *(DisconnectPacket*)packet, address );
                 return;
 
+            case CLIENT_SERVER_PACKET_HANDOFF:
+                ProcessHandoff( *(HandoffPacket*)packet, address );
+                return;
+
             case CLIENT_SERVER_PACKET_CONNECTION:
-                ProcessConnectionPacket( *(ConnectionPacket*)packet, address );
+                ProcessConnectionPacket( *(ConnectionPacket*)packet, address, receiveTime );
                 return;
 
             default:
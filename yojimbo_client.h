@@ -34,6 +34,7 @@
 #include "yojimbo_packet_processor.h"
 #include "yojimbo_client_server_packets.h"
 #include "yojimbo_tokens.h"
+#include "yojimbo_queue.h"
 
 /** @file */
 
@@ -58,6 +59,8 @@ namespace yojimbo
 
     enum ClientState
     {
+        CLIENT_STATE_RESUME_REQUEST_TIMEOUT = -11,                              ///< The client timed out while sending resume request packets to the server. The server may have restarted since it issued the resume token, or it hasn't timed out the previous session yet. Connect with a fresh connect token instead.
+        CLIENT_STATE_CONNECT_TOKEN_EXPIRED = -10,                               ///< The connect token passed to Client::Connect expired before the client could connect to any of the servers. Remaining servers are not tried, because they would reject the expired connect token anyway.
 #if !YOJIMBO_SECURE_MODE
         CLIENT_STATE_INSECURE_CONNECT_TIMEOUT = -9,                             ///< The client tried to connect to a server via Client::InsecureConnect, but the connection timed out.
 #endif // #if !YOJIMBO_SECURE_MODE
@@ -73,8 +76,10 @@ namespace yojimbo
 #if !YOJIMBO_SECURE_MODE
         CLIENT_STATE_SENDING_INSECURE_CONNECT,                                  ///< The client is sending insecure connect packets to the server. This state immediately follows Client::InsecureConnect and transitions directly to CLIENT_STATE_CONNECTED when an insecure connection is established.
 #endif // #if !YOJIMBO_SECURE_MODE
+        CLIENT_STATE_PINGING_SERVERS,                                           ///< The client is pinging every server in its connect token to measure round trip time. This state immediately follows Client::Connect when ClientServerConfig::enableServerPing is true and there is more than one server address. It transitions to CLIENT_STATE_SENDING_CONNECTION_REQUEST once all servers reply or ClientServerConfig::clientPingTimeOut passes, with the server addresses sorted by round trip time.
         CLIENT_STATE_SENDING_CONNECTION_REQUEST,                                ///< The client is sending connection request packets to the server. This state immediately follows Client::Connect. It transitions to CLIENT_STATE_SENDING_CHALLENGE_RESPONSE and then to CLIENT_STATE_CONNECTED.
         CLIENT_STATE_SENDING_CHALLENGE_RESPONSE,                                ///< The client is sending challenge response packets to the server. Challenge/response during connect filters out clients trying to connect with a spoofed packet source address.
+        CLIENT_STATE_SENDING_RESUME_REQUEST,                                    ///< The client is sending resume request packets to the server. This state immediately follows Client::Resume and transitions directly to CLIENT_STATE_CONNECTED.
         CLIENT_STATE_CONNECTED                                                  ///< The client is connected to the server.
     };
 
@@ -90,6 +95,8 @@ namespace yojimbo
     {
         switch ( clientState )
         {
+            case CLIENT_STATE_RESUME_REQUEST_TIMEOUT:           return "resume request timeout";
+            case CLIENT_STATE_CONNECT_TOKEN_EXPIRED:            return "connect token expired";
 #if !YOJIMBO_SECURE_MODE
             case CLIENT_STATE_INSECURE_CONNECT_TIMEOUT:         return "insecure connect timeout";
 #endif // #if !YOJIMBO_SECURE_MODE
@@ -105,8 +112,10 @@ namespace yojimbo
 #if !YOJIMBO_SECURE_MODE
             case CLIENT_STATE_SENDING_INSECURE_CONNECT:         return "sending insecure connect";
 #endif // #if !YOJIMBO_SECURE_MODE
+            case CLIENT_STATE_PINGING_SERVERS:                  return "pinging servers";
             case CLIENT_STATE_SENDING_CONNECTION_REQUEST:       return "sending connection request";
             case CLIENT_STATE_SENDING_CHALLENGE_RESPONSE:       return "sending challenge response";
+            case CLIENT_STATE_SENDING_RESUME_REQUEST:           return "sending resume request";
             case CLIENT_STATE_CONNECTED:                        return "connected";
             default:
                 assert( false );
@@ -123,6 +132,14 @@ namespace yojimbo
         NUM_CLIENT_COUNTERS                                                     
     };
 
+    /// A message passed from the game thread to the client network thread, along with the channel to send it on. See Client::StartNetworkThread.
+
+    struct ClientThreadMessage
+    {
+        Message * message;                                                      ///< The message to send. The queue owns the reference passed in to Client::SendMsg.
+        int channelId;                                                          ///< The channel to send the message on.
+    };
+
     /** 
         A client that connects to a server.
 
@@ -188,6 +205,8 @@ namespace yojimbo
 
             The client tries to connect to each server in the list, in turn, until one of the servers is connected to, or it reaches the end of the server address list.
 
+            If ClientServerConfig::clientConnectRaceServers is greater than one, the client sends connection requests to that many servers at the same time, keeps the first server that replies with a challenge and abandons the rest. This avoids waiting a full negotiation timeout for each server that is down or full.
+
             IMPORTANT: Insecure connections are not encrypted and do not provide authentication. 
 
             They are provided for convenience in development only, and should not be used in production code!
@@ -216,7 +235,7 @@ namespace yojimbo
             @param connectTokenNonce Pointer to the connect token nonce from the matcher.
             @param clientToServerKey The encryption key for client to server packets.
             @param serverToClientKey The encryption key for server to client packets.
-            @param connectTokenExpireTimestamp The timestamp for when the connect token expires. Used by the server to quickly reject stale connect tokens without decrypting them.
+            @param connectTokenExpireTimestamp The timestamp for when the connect token expires. Used by the server to quickly reject stale connect tokens without decrypting them. The client gives up connecting with CLIENT_STATE_CONNECT_TOKEN_EXPIRED once this time passes.
          */
 
         void Connect( uint64_t clientId,
@@ -243,7 +262,7 @@ namespace yojimbo
             @param connectTokenNonce Pointer to the connect token nonce from the matcher.
             @param clientToServerKey The encryption key for client to server packets.
             @param serverToClientKey The encryption key for server to client packets.
-            @param connectTokenExpireTimestamp The timestamp for when the connect token expires. Used by the server to quickly reject stale connect tokens without decrypting them.
+            @param connectTokenExpireTimestamp The timestamp for when the connect token expires. Used by the server to quickly reject stale connect tokens without decrypting them. The client gives up connecting with CLIENT_STATE_CONNECT_TOKEN_EXPIRED once this time passes.
          */
 
         void Connect( uint64_t clientId, 
@@ -254,6 +273,28 @@ namespace yojimbo
                       const uint8_t * serverToClientKey,
                       uint64_t connectTokenExpireTimestamp );
 
+        /**
+            Check if the client can resume its previous session.
+
+            @returns True if the client holds a resume token that hasn't expired yet. See Client::Resume.
+         */
+
+        bool CanResume() const;
+
+        /**
+            Resume the previous session with the server (secure).
+
+            If ClientServerConfig::enableResumeTokens is true, the server issues each connected client a resume token in its keep-alive packets, and refreshes it while the client stays connected. The client keeps the most recent one after it disconnects.
+
+            Resuming sends the resume token straight back to the server that issued it. The server replies with a keep-alive packet and the client is connected after one round trip, without a connect token, challenge or challenge response. The resumed session has the same client id, and new packet encryption keys that came with the resume token.
+
+            If the server doesn't accept the resume token, eg. it restarted since issuing it, or it hasn't timed out the previous session yet, the client ends up in CLIENT_STATE_RESUME_REQUEST_TIMEOUT. Connect with a fresh connect token from the matcher in that case.
+
+            @returns True if the client is resuming its previous session. False if it has no valid resume token. See Client::CanResume.
+         */
+
+        bool Resume();
+
         /**
             Disconnect from the server.
 
@@ -309,6 +350,56 @@ namespace yojimbo
 
         void AdvanceTime( double time );
 
+        /**
+            Get the next time the client has something to do without receiving packets.
+
+            This is the earliest of the next packet send, keep-alive, connection negotiation resend, connect token expiry or timeout. Use this to drive the client in virtual time, eg. in soak tests that simulate hours of play over LocalTransport and NetworkSimulator, jumping straight to the next event instead of stepping time in small increments. Combine it with Server::GetNextEventTime and NetworkSimulator::GetNextDeliveryTime.
+
+            IMPORTANT: The client sends a connection packet on every call to Client::SendPackets while it has messages in flight, or always if ClientServerConfig::clientSendIdle is true. Then the current time is returned, so step time forward by at least your update rate.
+
+            @returns The time of the next client event. The current time if something is due now. NoEventTime if the client is disconnected.
+         */
+
+        double GetNextEventTime() const;
+
+        /**
+            Start a dedicated thread that runs the client network update at a fixed rate.
+
+            While the network thread runs, it calls SendPackets, Transport::WritePackets, Transport::ReadPackets, ReceivePackets, CheckForTimeOut and AdvanceTime for you, so acks, keep-alives and resends go out on time even when the game thread hitches. Calls to those functions from any other thread do nothing.
+
+            Messages are exchanged with the game thread through lock-free queues. Client::SendMsg queues the message for the network thread to send, and Client::ReceiveMsg dequeues messages the network thread has received. The message factory is made thread-safe, so the client allocator must be safe to allocate from two threads at once. Use YOJIMBO_CLIENT_ALLOCATOR( yojimbo::ThreadedTLSF_Allocator ).
+
+            Client time is driven by the network thread from platform_time, starting at the current client time. Client callbacks such as OnClientStateChange and ProcessUserPacket are called on the network thread.
+
+            IMPORTANT: Call this after Client::Connect or Client::InsecureConnect, and only access the client from one other thread while the network thread is running. Calling Client::Disconnect or destroying the client stops the network thread first.
+
+            @param updateRate The number of network updates per-second.
+
+            @returns True if the network thread was started, false if the thread could not be created.
+
+            @see Client::StopNetworkThread
+         */
+
+        bool StartNetworkThread( double updateRate );
+
+        /**
+            Stop the network thread and wait for it to exit.
+
+            Messages queued for sending that the network thread has not picked up yet are released, as are received messages that were not dequeued. Afterwards you must call SendPackets, ReceivePackets, CheckForTimeOut and AdvanceTime yourself again.
+
+            This function is safe to call if the network thread is not running. In that case it does nothing.
+         */
+
+        void StopNetworkThread();
+
+        /**
+            Is the network thread running?
+
+            @returns True if the network thread started with Client::StartNetworkThread is running.
+         */
+
+        bool IsNetworkThreadRunning() const;
+
         /**
             Is the client connecting to a server?
 
@@ -389,6 +480,16 @@ namespace yojimbo
 
         int GetClientIndex() const;
 
+        /**
+            Get the address of the server the client is connecting or connected to.
+
+            This changes when the server hands the client off to another server. See Server::HandoffClient.
+
+            @returns The server address. Only valid while the client is connecting or connected.
+         */
+
+        const Address & GetServerAddress() const;
+
         /**
             Get a counter value.
 
@@ -399,6 +500,42 @@ namespace yojimbo
 
         uint64_t GetCounter( int index ) const;
 
+        /**
+            Get network statistics for the connection to the server.
+
+            RTT, jitter, packet loss and bandwidth are estimated by the connection from connection packets and their acks. They are useful for debugging, telemetry and adapting send rates to network conditions.
+
+            @param info The network info struct to fill. All values are zero if the client has no connection object, eg. if the connection config has no channels.
+
+            @see Connection::GetNetworkInfo
+         */
+
+        void GetNetworkInfo( NetworkInfo & info ) const;
+
+        /**
+            Get the time to send input so it reaches the server just before the server's next tick.
+
+            The server tick is estimated from the send times of connection packets from the server, which it generates once per-tick. Input sent at this time arrives half the round trip time later, with a margin of twice the jitter, ahead of the server tick that reads it. Send input earlier and it waits on the server for a tick, send it later and it misses the tick.
+
+            Requires ConnectionConfig::enableClockSync on both sides, and the server sending packets every tick.
+
+            @returns The client time to send input for the next server tick. Never earlier than the current time. The current time if the client is not connected or there is no clock sync yet.
+
+            @see Connection::GetNextRemoteTickTime
+         */
+
+        double GetServerTickSendTime() const;
+
+        /**
+            Get the connection object for the connection to the server.
+
+            Lets telemetry read connection and channel counters. See MetricsSnapshot::AddClient.
+
+            @returns The connection, or NULL if the client has no connection object, eg. if it is not connecting or connected, or messages are disabled.
+         */
+
+        const Connection * GetConnection() const { return m_connection; }
+
         /**
             Create a message of the specified type.
 
@@ -447,6 +584,22 @@ namespace yojimbo
 
         void SendMsg( Message * message, int channelId = 0 );
 
+        /**
+            Queue a batch of messages to be sent to the server.
+
+            Equivalent to calling Client::SendMsg for each message, except the channel send queue is checked once for room for the whole batch. If it doesn't have room for all of the messages, none of them are queued and the client disconnects with a runtime error, just like Client::SendMsg.
+
+            IMPORTANT: This function takes ownership of all messages in the array.
+
+            @param messages The array of messages to be sent. They must be allocated from the message factory set on this client.
+            @param numMessages The number of messages in the array.
+            @param channelId The id of the channel to send the messages across in [0,numChannels-1].
+
+            @see Client::SendMsg
+         */
+
+        void SendMsgs( Message ** messages, int numMessages, int channelId = 0 );
+
         /** 
             Poll this method to receive messages from the server.
 
@@ -461,6 +614,22 @@ namespace yojimbo
 
         Message * ReceiveMsg( int channelId = 0 );
 
+        /** 
+            Receive a batch of messages from the server.
+
+            Fills the array with messages until the channel receive queue runs dry or the array is full.
+
+            IMPORTANT: Each message returned by this function has one reference. You are responsible for releasing these messages via Client::ReleaseMsg.
+
+            @param messages The array of message pointers to fill [out].
+            @param maxMessages The size of the message pointer array.
+            @param channelId The id of the channel to receive messages from.
+
+            @returns The number of messages received in [0,maxMessages].
+         */
+
+        int ReceiveMsgs( Message ** messages, int maxMessages, int channelId = 0 );
+
         /**
             Release a message returned by Client::ReceiveMsg.
 
@@ -623,6 +792,58 @@ namespace yojimbo
 
         virtual void OnConnectionFragmentReceived( Connection * connection, int channelId, uint16_t messageId, uint16_t fragmentId, int fragmentBytes, int numFragmentsReceived, int numFragmentsInBlock ) { (void) connection; (void) channelId; (void) messageId; (void) fragmentId; (void) fragmentBytes; (void) numFragmentsReceived; (void) numFragmentsInBlock; }
 
+        /**
+            Override this method to get block data as it is streamed in from the server.
+
+            Only called for channels with ChannelConfig::streamBlocks set. Block data is passed in order as soon as all data before it has been received, so large blocks like level data can be processed incrementally and never have to be held in memory in full.
+
+            @param connection The connection that the block belongs to. There is just one connection object on the client-side.
+            @param channelId The channel the block is being sent over.
+            @param messageId The message id the block is attached to.
+            @param blockMessage The message the block is attached to. It is received once the block completes, without the block attached.
+            @param blockOffset The offset of this data in the block (bytes).
+            @param data The block data. Only valid for the duration of the callback.
+            @param dataBytes The size of the block data (bytes).
+            @param blockComplete True if this is the end of the block.
+
+            @see ChannelConfig::streamBlocks
+         */
+
+        virtual void OnConnectionBlockDataReceived( Connection * connection, int channelId, uint16_t messageId, BlockMessage * blockMessage, int blockOffset, const uint8_t * data, int dataBytes, bool blockComplete ) { (void) connection; (void) channelId; (void) messageId; (void) blockMessage; (void) blockOffset; (void) data; (void) dataBytes; (void) blockComplete; }
+
+        /**
+            Override this method to look up blocks the server announces in a local block cache.
+
+            Only called for channels with ChannelConfig::blockCache set. Return the cached block to receive the block message with it attached, without the server sending any of its fragments. For example, keep level data from earlier connections in memory mapped files (see MappedFileBlock), keyed by hash.
+
+            @param connection The connection that the block belongs to. There is just one connection object on the client-side.
+            @param channelId The channel the block is being sent over.
+            @param blockHash The hash of the block data. See murmur_hash_64.
+            @param blockSize The size of the block (bytes).
+
+            @returns The cached block, or NULL if it is not in the cache. The block message adds its own reference to the block, so the cache keeps ownership of it.
+
+            @see ChannelConfig::blockCache
+         */
+
+        virtual SharedBlock * OnConnectionBlockCacheFind( Connection * connection, int channelId, uint64_t blockHash, int blockSize ) { (void) connection; (void) channelId; (void) blockHash; (void) blockSize; return NULL; }
+
+        /**
+            Override this method to add blocks received from the server to a local block cache.
+
+            Only called for channels with ChannelConfig::blockCache set, once a block that was not found in the cache has been received in full.
+
+            @param connection The connection that the block belongs to. There is just one connection object on the client-side.
+            @param channelId The channel the block was sent over.
+            @param blockHash The hash of the block data. Pass this to OnConnectionBlockCacheFind to find the block again.
+            @param blockData The block data. Only valid for the duration of the callback.
+            @param blockSize The size of the block (bytes).
+
+            @see ChannelConfig::blockCache
+         */
+
+        virtual void OnConnectionBlockCacheStore( Connection * connection, int channelId, uint64_t blockHash, const uint8_t * blockData, int blockSize ) { (void) connection; (void) channelId; (void) blockHash; (void) blockData; (void) blockSize; }
+
         /** 
             Override this method to process user packets sent from the server.
 
@@ -663,25 +884,51 @@ namespace yojimbo
 
         virtual void InternalSecureConnect( const Address & serverAddress );
 
+        virtual void InternalPingServers();
+
+        virtual void FinishPingServers();
+
         virtual void SendPacketToServer( Packet * packet );
 
     private:
 
         void SendPacketToServer_Internal( Packet * packet, bool immediate = false );
 
+        bool SendSerializedPacketToServer_Internal( int packetType, const uint8_t * packetData, int packetBytes, bool immediate = false );
+
+        int SerializeControlPacket( int packetType, uint32_t * buffer );
+
+        void SendPacketToAddress_Internal( const Address & address, Packet * packet, bool immediate = false );
+
+        int FindRaceServerIndex( const Address & address ) const;
+
+        static void NetworkThreadFunction( void * data );
+
+        void NetworkThreadUpdate( double time );
+
+        bool IsOtherThread() const;
+
+        void ReleaseNetworkThreadMessages();
+
     protected:
 
         void ProcessConnectionDenied( const ConnectionDeniedPacket & packet, const Address & address );
 
+        void ProcessPong( const PongPacket & packet, const Address & address );
+
         void ProcessChallenge( const ChallengePacket & packet, const Address & address );
 
         void ProcessKeepAlive( const KeepAlivePacket & packet, const Address & address );
 
+        void StoreResumeToken( const KeepAlivePacket & packet );
+
         void ProcessDisconnect( const DisconnectPacket & packet, const Address & address );
 
-        void ProcessConnectionPacket( ConnectionPacket & packet, const Address & address );
+        void ProcessHandoff( const HandoffPacket & packet, const Address & address );
+
+        void ProcessConnectionPacket( ConnectionPacket & packet, const Address & address, double receiveTime );
 
-        void ProcessPacket( Packet * packet, const Address & address, uint64_t sequence );
+        void ProcessPacket( Packet * packet, const Address & address, uint64_t sequence, double receiveTime );
 
         bool IsPendingConnect();
 
@@ -697,6 +944,12 @@ namespace yojimbo
 
         virtual Allocator * CreateAllocator( Allocator & allocator, void * memory, size_t bytes );
 
+        void CreateConnectionResources();
+
+        void ResetConnectionResources();
+
+        void DestroyConnectionResources();
+
         ClientServerConfig m_config;                                        ///< The client/server configuration.
 
         Allocator * m_allocator;                                            ///< The allocator passed in to the client on creation.
@@ -705,7 +958,7 @@ namespace yojimbo
 
         uint8_t * m_clientMemory;                                           ///< Memory backing the client allocator. Allocated from m_allocator.
 
-        Allocator * m_clientAllocator;                                      ///< The client allocator. Everything allocated between Client::Connect and Client::Disconnect is allocated and freed via this allocator.
+        Allocator * m_clientAllocator;                                      ///< The client allocator. Everything allocated between Client::Connect and Client::Disconnect is allocated and freed via this allocator. Kept across connects if ClientServerConfig::clientPersistentResources is true.
 
         PacketFactory * m_packetFactory;                                    ///< Packet factory for creating and destroying messages. Created via Client::CreatePacketFactory.
 
@@ -729,18 +982,32 @@ namespace yojimbo
 
         uint64_t m_connectTokenExpireTimestamp;                             ///< Expire timestamp for connect token used in secure connect. This is used as the additional data in the connect token AEAD, so we can quickly reject stale connect tokens without decrypting them.
 
+        double m_connectTokenExpireTime;                                    ///< The client time when the connect token expires. Converted from m_connectTokenExpireTimestamp on Client::Connect. Once this time passes while connecting, the client gives up with CLIENT_STATE_CONNECT_TOKEN_EXPIRED instead of trying the remaining servers.
+
         int m_serverAddressIndex;                                           ///< Current index in the server address array. This is the server we are currently connecting to.
 
         int m_numServerAddresses;                                           ///< Number of server addresses in the array.
 
         Address m_serverAddresses[MaxServersPerConnect];                    ///< List of server addresses we are connecting to.
 
+        int m_numRaceServers;                                               ///< Number of servers in the server address array, starting at m_serverAddressIndex, that we are sending connection requests to at the same time. See ClientServerConfig::clientConnectRaceServers.
+
+        uint32_t m_raceDeniedMask;                                          ///< Bit i is set if server m_serverAddressIndex + i denied our connection request while racing. Once all servers being raced have denied us, the connect fails over to the next servers in the list.
+
+        uint64_t m_pingSalt;                                                ///< Random salt rolled each time the client starts pinging servers. The ping id sent to server address i is m_pingSalt + i, so pongs from anywhere else are ignored.
+
+        double m_pingStartTime;                                             ///< The client time when the client started pinging servers. See ClientServerConfig::clientPingTimeOut.
+
+        float m_serverPingTime[MaxServersPerConnect];                       ///< Round trip time measured to each server address while pinging (seconds). Negative if that server hasn't replied yet.
+
         Address m_serverAddress;                                            ///< The current server address we are connecting/connected to.
 
         double m_lastPacketSendTime;                                        ///< The last time we sent a packet to the server.
 
         double m_lastPacketReceiveTime;                                     ///< The last time we received a packet from the server.
 
+        bool m_pendingAcks;                                                 ///< True if we have received connection packets with channel data from the server since we last sent a connection packet. Those packets are acked by the next connection packet sent. See ClientServerConfig::clientSendIdle.
+
         Transport * m_transport;                                            ///< The transport for sending and receiving packets.
 
         bool m_shouldDisconnect;                                            ///< Set to true when we receive a disconnect packet from the server so we can defer disconnection until the update.
@@ -755,6 +1022,14 @@ namespace yojimbo
 
         uint64_t m_sequence;                                                ///< Sequence # for packets sent from client to server.
 
+        uint32_t m_keepAlivePacketData[SerializedControlPacketBytes/4];     ///< Keep-alive packet serialized once per connect, so keep-alive packets don't have to be created and serialized each time they are sent. Stored as words so it is 4 byte aligned. See Transport::SerializePacket.
+
+        int m_keepAlivePacketBytes;                                         ///< The number of bytes of serialized keep-alive packet data. 0 if the packet could not be serialized.
+
+        uint32_t m_disconnectPacketData[SerializedControlPacketBytes/4];    ///< Disconnect packet serialized once per connect. Stored as words so it is 4 byte aligned.
+
+        int m_disconnectPacketBytes;                                        ///< The number of bytes of serialized disconnect packet data. 0 if the packet could not be serialized.
+
         uint64_t m_counters[NUM_CLIENT_COUNTERS];                           ///< Counters to aid with debugging and telemetry.
 
         uint8_t m_connectTokenData[ConnectTokenBytes];                      ///< Encrypted connect token data for the connection request packet.
@@ -769,6 +1044,44 @@ namespace yojimbo
 
         uint8_t m_serverToClientKey[KeyBytes];                              ///< Server to client packet encryption key.
 
+        bool m_resumeTokenValid;                                            ///< True if the client holds a resume token from its last session. Kept across disconnects. See Client::Resume.
+
+        double m_resumeTokenExpireTime;                                     ///< The client time when the resume token expires. Converted from the expire timestamp sent with the resume token.
+
+        uint64_t m_resumeClientId;                                          ///< The client id of the session the resume token was issued for.
+
+        Address m_resumeServerAddress;                                      ///< The address of the server that issued the resume token.
+
+        uint8_t m_resumeTokenData[ResumeTokenBytes];                        ///< Encrypted resume token data for the resume request packet.
+
+        uint8_t m_resumeTokenNonce[NonceBytes];                             ///< Nonce to send to server so it can decrypt the resume token.
+
+        uint8_t m_resumeClientToServerKey[KeyBytes];                        ///< Client to server packet encryption key for the resumed session.
+
+        uint8_t m_resumeServerToClientKey[KeyBytes];                        ///< Server to client packet encryption key for the resumed session.
+
+        int m_sharedClientState;                                            ///< Copy of m_clientState read by other threads while the network thread is running. Accessed with atomic_load and atomic_store.
+
+        PlatformThread * m_networkThread;                                   ///< The network thread. NULL unless Client::StartNetworkThread was called.
+
+        uint64_t m_networkThreadId;                                         ///< The platform thread id of the network thread. Only valid while the network thread is running.
+
+        int m_networkThreadStarted;                                         ///< Set to 1 by the network thread once m_networkThreadId is valid. Accessed with atomic_load and atomic_store.
+
+        int m_networkThreadQuit;                                            ///< Set to 1 to tell the network thread to exit. Accessed with atomic_load and atomic_store.
+
+        int m_networkThreadSendError;                                       ///< Set to 1 when a message could not be queued for the network thread to send. The network thread disconnects with CLIENT_STATE_CONNECTION_ERROR, the same as a full channel send queue. Accessed with atomic_load and atomic_store.
+
+        double m_networkThreadUpdateRate;                                   ///< The number of network updates per-second. See Client::StartNetworkThread.
+
+        double m_networkThreadStartTime;                                    ///< The client time when the network thread was started.
+
+        bool m_deferDestroyConnectionResources;                             ///< True if the connection resources should be destroyed once the network thread stops. The game thread may still be creating and releasing messages when the network thread disconnects, so they can't be destroyed right away.
+
+        LockFreeQueue<ClientThreadMessage> * m_threadSendQueue;             ///< Messages queued on the game thread for the network thread to send.
+
+        LockFreeQueue<Message*> * m_threadReceiveQueues[MaxChannels];       ///< Messages received by the network thread for the game thread to dequeue, per-channel.
+
     private:
 
         Client( const Client & other );
@@ -780,7 +1093,7 @@ namespace yojimbo
 /** 
     Helper macro to set the client allocator class.
 
-    You can use this macro to specify that the client uses your own custom allocator class. The default allocator to use is TLSF_Allocator. 
+    You can use this macro to specify that the client uses your own custom allocator class. The default allocator to use is TLSF_Allocator. Use ThreadedTLSF_Allocator if messages are released on a different thread to the one that creates them.
 
     The constructor of your derived allocator class must match the signature of the TLSF_Allocator constructor to work with this macro.
     
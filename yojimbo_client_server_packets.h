@@ -34,6 +34,20 @@
 
 namespace yojimbo
 {
+    const int ConnectionRequestPacketMaxBytes = 1 + 4 + 4 + 8 + ConnectTokenBytes + NonceBytes + 4;       ///< The largest a connection request packet can be on the wire: the prefix byte, CRC32, packet type and alignment, expire timestamp, connect token, nonce and serialize check (bytes). See Transport::SetMaxUnencryptedPacketBytes.
+
+    const int ChallengeResponsePacketMaxBytes = 1 + 4 + 4 + ChallengeTokenBytes + NonceBytes + 4;          ///< The largest a challenge response packet can be on the wire: the prefix byte, CRC32, packet type and alignment, challenge token, nonce and serialize check (bytes). See Transport::SetMaxUnencryptedPacketBytes.
+
+    const int ResumeRequestPacketMaxBytes = 1 + 4 + 4 + ResumeTokenBytes + NonceBytes + 4;                ///< The largest a resume request packet can be on the wire: the prefix byte, CRC32, packet type and alignment, resume token, nonce and serialize check (bytes). See Transport::SetMaxUnencryptedPacketBytes.
+
+    const int PingPaddingBytes = 64;                                                                        ///< Zero padding at the end of each ping packet. Ping packets are larger than the pong packets sent back, so a spoofed ping can't be used to amplify traffic to another address (bytes).
+
+    const int PingPacketMaxBytes = 1 + 4 + 4 + 8 + 8 + PingPaddingBytes + 4;                              ///< The largest a ping packet can be on the wire: the prefix byte, CRC32, packet type and alignment, ping id, ping time, padding and serialize check (bytes). See Transport::SetMaxUnencryptedPacketBytes.
+
+    const int PongPacketMaxBytes = 1 + 4 + 4 + 8 + 8 + 4;                                                 ///< The largest a pong packet can be on the wire: the prefix byte, CRC32, packet type and alignment, ping id, ping time and serialize check (bytes). See Transport::SetMaxUnencryptedPacketBytes.
+
+    const int SerializedControlPacketBytes = 64;                                                            ///< Size of the buffers keep-alive and disconnect packets are serialized into once, so they can be sent over and over without serializing them each time (bytes). Must be a multiple of 4. See Transport::SerializePacket.
+
     /**
         Sent from client to server when a client is first requesting a connection. 
 
@@ -51,21 +65,41 @@ namespace yojimbo
     struct ConnectionRequestPacket : public Packet
     {
         uint64_t connectTokenExpireTimestamp;                                           ///< The timestamp when the connect token expires. Connect tokens are typically short lived (45 seconds only).
+        int connectTokenBytes;                                                          ///< The size of the encrypted connect token (bytes). Only this many bytes of connectTokenData are sent. See GetConnectTokenBytes.
         uint8_t connectTokenData[ConnectTokenBytes];                                    ///< Encrypted connect token data generated by matchmaker. See matcher.go
         uint8_t connectTokenNonce[NonceBytes];                                          ///< Nonce required to decrypt the connect token. Basically a sequence number. Increments with each connect token generated by matcher.go.
 
         ConnectionRequestPacket()
         {
             connectTokenExpireTimestamp = 0;
+            connectTokenBytes = ConnectTokenBytes;
             memset( connectTokenData, 0, sizeof( connectTokenData ) );
             memset( connectTokenNonce, 0, sizeof( connectTokenNonce ) );
         }
 
+        /**
+            Get the connect token MAC.
+
+            The MAC is the last MacBytes of the encrypted connect token, wherever that ends. The server uses it to identify the connect token in its connect token entries and challenge tokens.
+         */
+
+        const uint8_t * GetConnectTokenMac() const
+        {
+            return connectTokenData + connectTokenBytes - MacBytes;
+        }
+
         template <typename Stream> bool Serialize( Stream & stream )
         {
             serialize_uint64( stream, connectTokenExpireTimestamp );
-            serialize_bytes( stream, connectTokenData, sizeof( connectTokenData ) );
+            serialize_int_constant( stream, connectTokenBytes, MinCompactConnectTokenBytes, ConnectTokenBytes );
+            serialize_bytes( stream, connectTokenData, connectTokenBytes );
             serialize_bytes( stream, connectTokenNonce, sizeof( connectTokenNonce ) );
+
+            // IMPORTANT: The size sent must agree with the connect token header, otherwise the server would decrypt the wrong number of bytes.
+
+            if ( Stream::IsReading && GetConnectTokenBytes( connectTokenData ) != connectTokenBytes )
+                return false;
+
             return true;
         }
 
@@ -151,6 +185,37 @@ namespace yojimbo
         YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
     };
 
+    /**
+        Sent from client to server to resume a previous session without a connect token.
+
+        The server accepts the resume token in place of the connect token, challenge and challenge response, and replies with a keep-alive packet, so the client is connected after one round trip.
+
+        IMPORTANT: There is no challenge, so the server does not verify the client owns the address it sent this packet from. Each resume token may only be used from a single address (see Server::FindOrAddConnectTokenEntry) and resume tokens are only issued to connected clients, which limits what a spoofed resume request can do.
+
+        @see ResumeToken
+     */
+
+    struct ResumeRequestPacket : public Packet
+    {
+        uint8_t resumeTokenData[ResumeTokenBytes];                                      ///< Encrypted resume token data generated by the server.
+        uint8_t resumeTokenNonce[NonceBytes];                                           ///< Nonce required to decrypt the resume token on the server.
+
+        ResumeRequestPacket()
+        {
+            memset( resumeTokenData, 0, sizeof( resumeTokenData ) );
+            memset( resumeTokenNonce, 0, sizeof( resumeTokenNonce ) );
+        }
+
+        template <typename Stream> bool Serialize( Stream & stream )
+        {
+            serialize_bytes( stream, resumeTokenData, sizeof( resumeTokenData ) );
+            serialize_bytes( stream, resumeTokenNonce, sizeof( resumeTokenNonce ) );
+            return true;
+        }
+
+        YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+    };
+
     /**
         Sent once client/server connection is established, but only if necessary to avoid time out.
 
@@ -163,6 +228,12 @@ namespace yojimbo
 #if !YOJIMBO_SECURE_MODE
         uint64_t clientSalt;                                                            ///< Random number rolled on each call to Client::InsecureConnect. Makes insecure reconnect much more robust, by distinguishing each connect session from previous ones.
 #endif // #if !YOJIMBO_SECURE_MODE
+        bool hasResumeToken;                                                            ///< True if this packet carries a resume token for the client. See ClientServerConfig::enableResumeTokens.
+        uint64_t resumeTokenExpireTimestamp;                                            ///< The timestamp when the resume token expires. Only valid if hasResumeToken is true.
+        uint8_t resumeTokenData[ResumeTokenBytes];                                      ///< Encrypted resume token data. The client sends this back in a resume request packet. Only valid if hasResumeToken is true.
+        uint8_t resumeTokenNonce[NonceBytes];                                           ///< Nonce required to decrypt the resume token on the server. Only valid if hasResumeToken is true.
+        uint8_t resumeClientToServerKey[KeyBytes];                                      ///< Client to server packet encryption key for the resumed session. Only sent in keep-alive packets, which are encrypted. Only valid if hasResumeToken is true.
+        uint8_t resumeServerToClientKey[KeyBytes];                                      ///< Server to client packet encryption key for the resumed session. Only valid if hasResumeToken is true.
 
         KeepAlivePacket()
         {
@@ -170,14 +241,25 @@ namespace yojimbo
 #if !YOJIMBO_SECURE_MODE
             clientSalt = 0;
 #endif // #if !YOJIMBO_SECURE_MODE
+            hasResumeToken = false;
+            resumeTokenExpireTimestamp = 0;
         }
 
         template <typename Stream> bool Serialize( Stream & stream )
         { 
-            serialize_int( stream, clientIndex, 0, MaxClients - 1 );
+            serialize_int_constant( stream, clientIndex, 0, MaxClients - 1 );
 #if !YOJIMBO_SECURE_MODE
             serialize_uint64( stream, clientSalt );
 #endif // #if !YOJIMBO_SECURE_MODE
+            serialize_bool( stream, hasResumeToken );
+            if ( hasResumeToken )
+            {
+                serialize_uint64( stream, resumeTokenExpireTimestamp );
+                serialize_bytes( stream, resumeTokenData, ResumeTokenBytes );
+                serialize_bytes( stream, resumeTokenNonce, NonceBytes );
+                serialize_bytes( stream, resumeClientToServerKey, KeyBytes );
+                serialize_bytes( stream, resumeServerToClientKey, KeyBytes );
+            }
             return true; 
         }
 
@@ -197,6 +279,84 @@ namespace yojimbo
         YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
     };
 
+    /**
+        Sent unencrypted from client to each server in its connect token before connecting, to measure round trip time.
+
+        Pings carry no connect token, so any address can send them. The server replies with a pong without keeping any state, and it rate limits pings per source address. See ClientServerConfig::enableServerPing.
+     */
+
+    struct PingPacket : public Packet
+    {
+        uint64_t pingId;                                                                ///< Random salt rolled by the client on connect, plus the index of the server address being pinged. Pongs that don't echo a ping id the client sent are ignored.
+        uint64_t pingTime;                                                              ///< Client time the ping was sent (microseconds). Echoed back in the pong, so the client measures round trip time without remembering when each ping was sent.
+
+        PingPacket()
+        {
+            pingId = 0;
+            pingTime = 0;
+        }
+
+        template <typename Stream> bool Serialize( Stream & stream )
+        {
+            serialize_uint64( stream, pingId );
+            serialize_uint64( stream, pingTime );
+
+            // IMPORTANT: padding makes pings larger than pongs, so the server never sends more bytes than it receives
+
+            uint8_t padding[PingPaddingBytes];
+            memset( padding, 0, sizeof( padding ) );
+            serialize_bytes( stream, padding, PingPaddingBytes );
+
+            return true;
+        }
+
+        YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+    };
+
+    /**
+        Sent unencrypted from server to client in response to a ping packet.
+     */
+
+    struct PongPacket : public Packet
+    {
+        uint64_t pingId;                                                                ///< The ping id from the ping packet.
+        uint64_t pingTime;                                                              ///< The ping time from the ping packet.
+
+        PongPacket()
+        {
+            pingId = 0;
+            pingTime = 0;
+        }
+
+        template <typename Stream> bool Serialize( Stream & stream )
+        {
+            serialize_uint64( stream, pingId );
+            serialize_uint64( stream, pingTime );
+            return true;
+        }
+
+        YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+    };
+
+    /**
+        Sent from server to a connected client to move it to another server.
+
+        The session has already been handed to the other server, so the client keeps its encryption keys, packet sequence numbers and messages, and just starts sending to the new address. See Server::HandoffClient.
+     */
+
+    struct HandoffPacket : public Packet
+    {
+        Address serverAddress;                                                          ///< The address of the server that took over the session.
+
+        template <typename Stream> bool Serialize( Stream & stream )
+        {
+            serialize_address( stream, serverAddress );
+            return true;
+        }
+
+        YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS();
+    };
+
 #if !YOJIMBO_SECURE_MODE
 
     /**
@@ -244,6 +404,10 @@ namespace yojimbo
         CLIENT_SERVER_PACKET_CHALLENGE_RESPONSE,                                        ///< Client response to the server challenge.
         CLIENT_SERVER_PACKET_KEEPALIVE,                                                 ///< Keep-alive packet sent at some low rate (once per-second) to keep the connection alive. Also used to inform the client of their client index (slot #).
         CLIENT_SERVER_PACKET_DISCONNECT,                                                ///< Courtesy packet to indicate that the other side has disconnected. Beats timing out.
+        CLIENT_SERVER_PACKET_RESUME_REQUEST,                                            ///< Client requests to resume a previous session with a resume token. See Client::Resume.
+        CLIENT_SERVER_PACKET_PING,                                                      ///< Client pings a server before connecting to measure round trip time. See ClientServerConfig::enableServerPing.
+        CLIENT_SERVER_PACKET_PONG,                                                      ///< Server response to a ping.
+        CLIENT_SERVER_PACKET_HANDOFF,                                                   ///< Server tells a connected client its session moved to another server. See Server::HandoffClient.
 #if !YOJIMBO_SECURE_MODE
         CLIENT_SERVER_PACKET_INSECURE_CONNECT,                                          ///< Client requests an insecure connection (dev only!)
 #endif // #if !YOJIMBO_SECURE_MODE
@@ -259,10 +423,14 @@ namespace yojimbo
         YOJIMBO_DECLARE_PACKET_TYPE( CLIENT_SERVER_PACKET_CHALLENGE_RESPONSE,       ChallengeResponsePacket );
         YOJIMBO_DECLARE_PACKET_TYPE( CLIENT_SERVER_PACKET_KEEPALIVE,                KeepAlivePacket );
         YOJIMBO_DECLARE_PACKET_TYPE( CLIENT_SERVER_PACKET_DISCONNECT,               DisconnectPacket );
+        YOJIMBO_DECLARE_PACKET_TYPE( CLIENT_SERVER_PACKET_RESUME_REQUEST,           ResumeRequestPacket );
+        YOJIMBO_DECLARE_PACKET_TYPE( CLIENT_SERVER_PACKET_PING,                     PingPacket );
+        YOJIMBO_DECLARE_PACKET_TYPE( CLIENT_SERVER_PACKET_PONG,                     PongPacket );
+        YOJIMBO_DECLARE_PACKET_TYPE( CLIENT_SERVER_PACKET_HANDOFF,                  HandoffPacket );
 #if !YOJIMBO_SECURE_MODE
         YOJIMBO_DECLARE_PACKET_TYPE( CLIENT_SERVER_PACKET_INSECURE_CONNECT,         InsecureConnectPacket );
 #endif // #if !YOJIMBO_SECURE_MODE
-        YOJIMBO_DECLARE_PACKET_TYPE( CLIENT_SERVER_PACKET_CONNECTION,               ConnectionPacket );
+        YOJIMBO_DECLARE_POOLED_PACKET_TYPE( CLIENT_SERVER_PACKET_CONNECTION,        ConnectionPacket, ConnectionPacketPoolSize );
 
     YOJIMBO_PACKET_FACTORY_FINISH()
 }
@@ -31,6 +31,9 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <assert.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // #ifdef _MSC_VER
     
 /** @file */
 
@@ -243,6 +246,40 @@ namespace yojimbo
 #endif // #ifdef __GNUC__
     }
 
+    /**
+        Calculates the population count of an unsigned 64 bit integer.
+
+        @param x The input integer value.
+
+        @returns The number of bits set to 1 in the input value.
+     */
+
+    inline int popcount64( uint64_t x )
+    {
+#ifdef __GNUC__
+        return __builtin_popcountll( x );
+#else // #ifdef __GNUC__
+        return int( popcount( uint32_t( x ) ) + popcount( uint32_t( x >> 32 ) ) );
+#endif // #ifdef __GNUC__
+    }
+
+    /**
+        Reverses the order of the bits in an unsigned 32 bit integer.
+
+        @param x The input integer value.
+
+        @returns The input value with bit n moved to bit 31 - n.
+     */
+
+    inline uint32_t reverse_bits( uint32_t x )
+    {
+        x = ( ( x >> 1 ) & 0x55555555 ) | ( ( x & 0x55555555 ) << 1 );
+        x = ( ( x >> 2 ) & 0x33333333 ) | ( ( x & 0x33333333 ) << 2 );
+        x = ( ( x >> 4 ) & 0x0F0F0F0F ) | ( ( x & 0x0F0F0F0F ) << 4 );
+        x = ( ( x >> 8 ) & 0x00FF00FF ) | ( ( x & 0x00FF00FF ) << 8 );
+        return ( x >> 16 ) | ( x << 16 );
+    }
+
     /**
         Calculates the log base 2 of an unsigned 32 bit integer.
     
@@ -280,6 +317,225 @@ namespace yojimbo
 #endif // #ifdef __GNUC__
     }
 
+    /**
+        Calculates the number of trailing zero bits in an unsigned 64 bit integer.
+
+        This is the index of the lowest bit set to 1.
+
+        @param x The input integer value. Must not be zero.
+
+        @returns The number of trailing zero bits in [0,63].
+     */
+
+    inline int trailing_zeros( uint64_t x )
+    {
+        assert( x != 0 );
+#ifdef __GNUC__
+        return __builtin_ctzll( x );
+#else // #ifdef __GNUC__
+        const uint32_t low = uint32_t( x );
+        if ( low )
+            return popcount( ( low & ( ~low + 1 ) ) - 1 );
+        const uint32_t high = uint32_t( x >> 32 );
+        return 32 + popcount( ( high & ( ~high + 1 ) ) - 1 );
+#endif // #ifdef __GNUC__
+    }
+
+    /**
+        Atomically increment an integer.
+
+        Used for reference counts on objects shared between threads. See JobScheduler.
+
+        @param value Pointer to the integer to increment.
+
+        @returns The value after it was incremented.
+     */
+
+    inline int atomic_increment( int * value )
+    {
+#ifdef _MSC_VER
+        return (int) _InterlockedIncrement( (volatile long*) value );
+#else // #ifdef _MSC_VER
+        return __sync_add_and_fetch( value, 1 );
+#endif // #ifdef _MSC_VER
+    }
+
+    /**
+        Atomically decrement an integer.
+
+        @param value Pointer to the integer to decrement.
+
+        @returns The value after it was decremented.
+     */
+
+    inline int atomic_decrement( int * value )
+    {
+#ifdef _MSC_VER
+        return (int) _InterlockedDecrement( (volatile long*) value );
+#else // #ifdef _MSC_VER
+        return __sync_sub_and_fetch( value, 1 );
+#endif // #ifdef _MSC_VER
+    }
+
+    /**
+        Atomically increment a reference count, without ordering other memory accesses around it (relaxed).
+
+        Taking another reference only needs the count to be exact. The thread taking it already holds a reference, so the object can't be destroyed underneath it.
+
+        @param value Pointer to the reference count to increment.
+
+        @returns The value after it was incremented.
+     */
+
+    inline int atomic_increment_relaxed( int * value )
+    {
+#ifdef _MSC_VER
+        return (int) _InterlockedIncrement( (volatile long*) value );
+#else // #ifdef _MSC_VER
+        return __atomic_add_fetch( value, 1, __ATOMIC_RELAXED );
+#endif // #ifdef _MSC_VER
+    }
+
+    /**
+        Atomically decrement a reference count (acquire-release).
+
+        Release makes writes to the object made by this thread visible to the thread that drops the last reference. Acquire makes writes by every other thread visible to this thread, if it drops the last reference and destroys the object.
+
+        @param value Pointer to the reference count to decrement.
+
+        @returns The value after it was decremented.
+     */
+
+    inline int atomic_decrement_acq_rel( int * value )
+    {
+#ifdef _MSC_VER
+        return (int) _InterlockedDecrement( (volatile long*) value );
+#else // #ifdef _MSC_VER
+        return __atomic_sub_fetch( value, 1, __ATOMIC_ACQ_REL );
+#endif // #ifdef _MSC_VER
+    }
+
+    /**
+        Atomically read an integer written by another thread with atomic_store.
+
+        Reads and writes made by the other thread before its atomic_store are visible to this thread after the atomic_load (acquire).
+
+        @param value Pointer to the integer to read.
+
+        @returns The value read.
+     */
+
+    inline int atomic_load( const int * value )
+    {
+#ifdef _MSC_VER
+        const int result = *( (const volatile int*) value );
+        _ReadWriteBarrier();
+        return result;
+#else // #ifdef _MSC_VER
+        return __atomic_load_n( value, __ATOMIC_ACQUIRE );
+#endif // #ifdef _MSC_VER
+    }
+
+    /**
+        Atomically write an integer to be read by another thread with atomic_load.
+
+        Reads and writes made by this thread before the atomic_store are visible to the other thread once it reads the new value (release).
+
+        @param value Pointer to the integer to write.
+        @param newValue The value to write.
+     */
+
+    inline void atomic_store( int * value, int newValue )
+    {
+#ifdef _MSC_VER
+        _ReadWriteBarrier();
+        *( (volatile int*) value ) = newValue;
+#else // #ifdef _MSC_VER
+        __atomic_store_n( value, newValue, __ATOMIC_RELEASE );
+#endif // #ifdef _MSC_VER
+    }
+
+    /**
+        Atomically replace an integer, but only if it still has the value expected.
+
+        This is a full barrier when it succeeds.
+
+        @param value Pointer to the integer to replace.
+        @param expected The value the integer must have for it to be replaced.
+        @param newValue The new value.
+
+        @returns True if the integer had the expected value and was replaced, false otherwise.
+     */
+
+    inline bool atomic_compare_exchange( int * value, int expected, int newValue )
+    {
+#ifdef _MSC_VER
+        return _InterlockedCompareExchange( (volatile long*) value, newValue, expected ) == expected;
+#else // #ifdef _MSC_VER
+        return __atomic_compare_exchange_n( value, &expected, newValue, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+#endif // #ifdef _MSC_VER
+    }
+
+    /**
+        Atomically read a pointer written by another thread with atomic_exchange_pointer or atomic_compare_exchange_pointer (acquire).
+
+        @param value Pointer to the pointer to read.
+
+        @returns The pointer read.
+     */
+
+    inline void * atomic_load_pointer( void * const * value )
+    {
+#ifdef _MSC_VER
+        void * result = *( (void * const volatile*) value );
+        _ReadWriteBarrier();
+        return result;
+#else // #ifdef _MSC_VER
+        return __atomic_load_n( value, __ATOMIC_ACQUIRE );
+#endif // #ifdef _MSC_VER
+    }
+
+    /**
+        Atomically replace a pointer, returning the value it had before.
+
+        This is a full barrier. Reads and writes made before the exchange are visible to the thread that reads the new value, and writes made by the thread that stored the previous value are visible after it.
+
+        @param value Pointer to the pointer to replace.
+        @param newValue The new pointer value.
+
+        @returns The previous pointer value.
+     */
+
+    inline void * atomic_exchange_pointer( void ** value, void * newValue )
+    {
+#ifdef _MSC_VER
+        return _InterlockedExchangePointer( (void * volatile*) value, newValue );
+#else // #ifdef _MSC_VER
+        return __atomic_exchange_n( value, newValue, __ATOMIC_ACQ_REL );
+#endif // #ifdef _MSC_VER
+    }
+
+    /**
+        Atomically replace a pointer, but only if it still has the value expected.
+
+        This is a full barrier when it succeeds. Use it in a loop to make an update derived from the value previously read with atomic_load_pointer.
+
+        @param value Pointer to the pointer to replace.
+        @param expected The value the pointer must have for it to be replaced.
+        @param newValue The new pointer value.
+
+        @returns True if the pointer had the expected value and was replaced, false otherwise.
+     */
+
+    inline bool atomic_compare_exchange_pointer( void ** value, void * expected, void * newValue )
+    {
+#ifdef _MSC_VER
+        return _InterlockedCompareExchangePointer( (void * volatile*) value, newValue, expected ) == expected;
+#else // #ifdef _MSC_VER
+        return __atomic_compare_exchange_n( value, &expected, newValue, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+#endif // #ifdef _MSC_VER
+    }
+
     /**
         Reverse the order of bytes in a 64 bit integer.
         
@@ -489,6 +745,22 @@ namespace yojimbo
 
     uint64_t decompress_packet_sequence( uint8_t prefix_byte, const uint8_t * sequence_bytes );
 
+    /**
+        Calculate the code lengths of a length limited prefix code (Huffman code) for a set of symbol frequencies.
+
+        Symbols with higher frequencies get shorter codes. If the optimal code has codes longer than max_bits, the frequencies are halved until it doesn't, which keeps frequent symbols short while flattening the rare ones.
+
+        @param frequencies The frequency of each symbol. Zero frequencies are treated as one, so every symbol gets a code.
+        @param num_symbols The number of symbols. Must be at least 2, and no more than 65536.
+        @param max_bits The maximum code length in bits. Must be large enough to give every symbol a code, eg. at least bits_required( 0, num_symbols - 1 ).
+        @param code_lengths The code length of each symbol [out].
+        @param scratch Scratch memory. Must have room for 2 * num_symbols entries.
+
+        @returns True if the code lengths were calculated, false if max_bits is too small for the number of symbols.
+     */
+
+    bool calculate_prefix_code_lengths( const uint32_t * frequencies, int num_symbols, int max_bits, uint8_t * code_lengths, uint64_t * scratch );
+
     /**
         Calculates the CRC32 of a buffer.
 
@@ -0,0 +1,333 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include "yojimbo_config.h"
+#include "yojimbo_compression.h"
+#include "yojimbo_common.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    static const int CompressionHashBits = 12;
+
+    static const int CompressionHashSize = 1 << CompressionHashBits;
+
+    static const int MinMatchBytes = 4;
+
+    static const int MaxMatchOffset = 65535;
+
+    static inline uint32_t compression_read_uint32( const uint8_t * p )
+    {
+        return uint32_t( p[0] ) | ( uint32_t( p[1] ) << 8 ) | ( uint32_t( p[2] ) << 16 ) | ( uint32_t( p[3] ) << 24 );
+    }
+
+    static inline int compression_hash( uint32_t value )
+    {
+        return int( ( value * 2654435761U ) >> ( 32 - CompressionHashBits ) );
+    }
+
+    static bool compression_write_length( uint8_t * output, int & outputIndex, int maxOutputBytes, int length )
+    {
+        while ( length >= 255 )
+        {
+            if ( outputIndex >= maxOutputBytes )
+                return false;
+            output[outputIndex++] = 255;
+            length -= 255;
+        }
+
+        if ( outputIndex >= maxOutputBytes )
+            return false;
+
+        output[outputIndex++] = uint8_t( length );
+
+        return true;
+    }
+
+    static bool compression_read_length( const uint8_t * input, int inputBytes, int & inputIndex, int & length, int maxLength )
+    {
+        while ( true )
+        {
+            if ( inputIndex >= inputBytes )
+                return false;
+
+            const int value = input[inputIndex++];
+
+            length += value;
+
+            if ( length > maxLength )
+                return false;
+
+            if ( value != 255 )
+                return true;
+        }
+    }
+
+    static bool compression_write_sequence( uint8_t * output, int & outputIndex, int maxOutputBytes, const uint8_t * literals, int numLiterals, int matchOffset, int matchBytes )
+    {
+        // IMPORTANT: A sequence with zero match bytes is the last sequence. It only has literals, and no match offset follows it.
+
+        assert( numLiterals >= 0 );
+        assert( matchBytes == 0 || matchBytes >= MinMatchBytes );
+        assert( matchOffset >= 0 );
+        assert( matchOffset <= MaxMatchOffset );
+
+        if ( outputIndex >= maxOutputBytes )
+            return false;
+
+        const int literalCode = min( numLiterals, 15 );
+        const int matchCode = matchBytes ? min( matchBytes - MinMatchBytes, 15 ) : 0;
+
+        output[outputIndex++] = uint8_t( ( literalCode << 4 ) | matchCode );
+
+        if ( literalCode == 15 && !compression_write_length( output, outputIndex, maxOutputBytes, numLiterals - 15 ) )
+            return false;
+
+        if ( numLiterals > maxOutputBytes - outputIndex )
+            return false;
+
+        memcpy( output + outputIndex, literals, numLiterals );
+        outputIndex += numLiterals;
+
+        if ( !matchBytes )
+            return true;
+
+        if ( maxOutputBytes - outputIndex < 2 )
+            return false;
+
+        output[outputIndex++] = uint8_t( matchOffset & 0xFF );
+        output[outputIndex++] = uint8_t( matchOffset >> 8 );
+
+        if ( matchCode == 15 && !compression_write_length( output, outputIndex, maxOutputBytes, matchBytes - MinMatchBytes - 15 ) )
+            return false;
+
+        return true;
+    }
+
+    PacketCompressor::PacketCompressor( Allocator & allocator )
+    {
+        m_allocator = &allocator;
+        m_dictionary = NULL;
+        m_dictionaryBytes = 0;
+        m_dictionaryTable = NULL;
+        m_hashTable = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * CompressionHashSize );
+    }
+
+    PacketCompressor::~PacketCompressor()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_dictionary );
+        YOJIMBO_FREE( *m_allocator, m_dictionaryTable );
+        YOJIMBO_FREE( *m_allocator, m_hashTable );
+
+        m_dictionaryBytes = 0;
+        m_allocator = NULL;
+    }
+
+    bool PacketCompressor::SetDictionary( const uint8_t * dictionary, int dictionaryBytes )
+    {
+        assert( dictionaryBytes >= 0 );
+        assert( dictionary || dictionaryBytes == 0 );
+
+        YOJIMBO_FREE( *m_allocator, m_dictionary );
+        YOJIMBO_FREE( *m_allocator, m_dictionaryTable );
+
+        m_dictionaryBytes = 0;
+
+        if ( !dictionary || dictionaryBytes == 0 )
+            return true;
+
+        if ( dictionaryBytes > MaxCompressionDictionaryBytes )
+        {
+            debug_printf( "packet compressor: dictionary is too large (%d bytes)\n", dictionaryBytes );
+            return false;
+        }
+
+        m_dictionary = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, dictionaryBytes );
+        m_dictionaryTable = (int*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( int ) * CompressionHashSize );
+
+        if ( !m_dictionary || !m_dictionaryTable )
+        {
+            YOJIMBO_FREE( *m_allocator, m_dictionary );
+            YOJIMBO_FREE( *m_allocator, m_dictionaryTable );
+            return false;
+        }
+
+        memcpy( m_dictionary, dictionary, dictionaryBytes );
+
+        m_dictionaryBytes = dictionaryBytes;
+
+        BuildDictionaryTable();
+
+        return true;
+    }
+
+    void PacketCompressor::BuildDictionaryTable()
+    {
+        assert( m_dictionary );
+        assert( m_dictionaryTable );
+
+        memset( m_dictionaryTable, 0xFF, sizeof( int ) * CompressionHashSize );
+
+        // IMPORTANT: Later positions overwrite earlier ones, so matches against the end of the dictionary are preferred. These have the smallest offsets, and the end of the dictionary is where the most common data should go.
+
+        for ( int i = 0; i + MinMatchBytes <= m_dictionaryBytes; ++i )
+            m_dictionaryTable[ compression_hash( compression_read_uint32( m_dictionary + i ) ) ] = i;
+    }
+
+    int PacketCompressor::Compress( const uint8_t * input, int inputBytes, uint8_t * output, int maxOutputBytes )
+    {
+        assert( input );
+        assert( inputBytes > 0 );
+        assert( output );
+        assert( maxOutputBytes >= 0 );
+        assert( m_hashTable );
+
+        if ( !m_hashTable )
+            return 0;
+
+        // IMPORTANT: Positions in the hash table are in the combined stream of the dictionary followed by the input, so one lookup finds matches in either.
+
+        if ( m_dictionaryTable )
+            memcpy( m_hashTable, m_dictionaryTable, sizeof( int ) * CompressionHashSize );
+        else
+            memset( m_hashTable, 0xFF, sizeof( int ) * CompressionHashSize );
+
+        const int dictionaryBytes = m_dictionaryBytes;
+
+        int inputIndex = 0;
+        int literalIndex = 0;
+        int outputIndex = 0;
+
+        while ( inputIndex + MinMatchBytes <= inputBytes )
+        {
+            const int hash = compression_hash( compression_read_uint32( input + inputIndex ) );
+
+            const int position = dictionaryBytes + inputIndex;
+
+            const int candidate = m_hashTable[hash];
+
+            m_hashTable[hash] = position;
+
+            if ( candidate < 0 || position - candidate > MaxMatchOffset )
+            {
+                inputIndex++;
+                continue;
+            }
+
+            int matchBytes = 0;
+
+            while ( inputIndex + matchBytes < inputBytes )
+            {
+                const int source = candidate + matchBytes;
+                const uint8_t value = ( source < dictionaryBytes ) ? m_dictionary[source] : input[source - dictionaryBytes];
+                if ( value != input[inputIndex + matchBytes] )
+                    break;
+                matchBytes++;
+            }
+
+            if ( matchBytes < MinMatchBytes )
+            {
+                inputIndex++;
+                continue;
+            }
+
+            if ( !compression_write_sequence( output, outputIndex, maxOutputBytes, input + literalIndex, inputIndex - literalIndex, position - candidate, matchBytes ) )
+                return 0;
+
+            inputIndex += matchBytes;
+            literalIndex = inputIndex;
+        }
+
+        if ( !compression_write_sequence( output, outputIndex, maxOutputBytes, input + literalIndex, inputBytes - literalIndex, 0, 0 ) )
+            return 0;
+
+        return outputIndex;
+    }
+
+    int PacketCompressor::Decompress( const uint8_t * input, int inputBytes, uint8_t * output, int maxOutputBytes ) const
+    {
+        assert( input );
+        assert( output );
+        assert( maxOutputBytes >= 0 );
+
+        const int dictionaryBytes = m_dictionaryBytes;
+
+        int inputIndex = 0;
+        int outputIndex = 0;
+
+        while ( inputIndex < inputBytes )
+        {
+            const int token = input[inputIndex++];
+
+            int numLiterals = token >> 4;
+
+            if ( numLiterals == 15 && !compression_read_length( input, inputBytes, inputIndex, numLiterals, maxOutputBytes ) )
+                return 0;
+
+            if ( numLiterals > inputBytes - inputIndex || numLiterals > maxOutputBytes - outputIndex )
+                return 0;
+
+            memcpy( output + outputIndex, input + inputIndex, numLiterals );
+            inputIndex += numLiterals;
+            outputIndex += numLiterals;
+
+            if ( inputIndex == inputBytes )
+                return ( ( token & 0xF ) == 0 ) ? outputIndex : 0;
+
+            if ( inputBytes - inputIndex < 2 )
+                return 0;
+
+            const int matchOffset = int( input[inputIndex] ) | ( int( input[inputIndex+1] ) << 8 );
+            inputIndex += 2;
+
+            if ( matchOffset == 0 || matchOffset > outputIndex + dictionaryBytes )
+                return 0;
+
+            int matchBytes = token & 0xF;
+
+            if ( matchBytes == 15 && !compression_read_length( input, inputBytes, inputIndex, matchBytes, maxOutputBytes ) )
+                return 0;
+
+            matchBytes += MinMatchBytes;
+
+            if ( matchBytes > maxOutputBytes - outputIndex )
+                return 0;
+
+            // IMPORTANT: Copy one byte at a time. Matches may overlap the bytes they are writing, which is how runs are encoded.
+
+            int source = outputIndex - matchOffset;
+
+            for ( int i = 0; i < matchBytes; ++i, ++source )
+                output[outputIndex++] = ( source < 0 ) ? m_dictionary[dictionaryBytes + source] : output[source];
+        }
+
+        // the last sequence must contain literals only. we ran out of input after a match
+
+        return 0;
+    }
+}
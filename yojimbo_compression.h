@@ -0,0 +1,141 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef YOJIMBO_COMPRESSION_H
+#define YOJIMBO_COMPRESSION_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_allocator.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    const int MaxCompressionDictionaryBytes = 65535;                ///< The maximum size of a compression dictionary. Matches are encoded with 16 bit offsets, so anything further back than this can't be referenced.
+
+    const int DefaultCompressionThreshold = 64;                     ///< Packets smaller than this many bytes are not compressed by default. See PacketProcessor::SetCompressionThreshold.
+
+    /**
+        A fast LZ77 compressor for packet payloads.
+
+        The format is the same sequence format used by LZ4 blocks: a token byte with 4 bits of literal length and 4 bits of match length, followed by the literals, then a 16 bit offset back to the start of the match. Lengths that don't fit in 4 bits continue in extension bytes.
+
+        Packets are small, so on their own they don't contain many repeats. Most of the gains come from the dictionary, which is treated as if it comes immediately before each packet, so matches can reference it. A good dictionary is a concatenation of typical packet payloads, with the most common data at the end.
+
+        IMPORTANT: The sender and receiver must use exactly the same dictionary, otherwise packets decompress into garbage. Pass in the same dictionary at startup on both sides.
+     */
+
+    class PacketCompressor
+    {
+    public:
+
+        /**
+            Packet compressor constructor.
+
+            @param allocator The allocator to use.
+         */
+
+        explicit PacketCompressor( Allocator & allocator );
+
+        /**
+            Packet compressor destructor.
+         */
+
+        ~PacketCompressor();
+
+        /**
+            Set the dictionary used to compress and decompress packets.
+
+            The dictionary is copied, so you don't need to keep it around after this call. Pass in NULL to clear the dictionary.
+
+            @param dictionary The dictionary data. Typically a concatenation of sample packet payloads.
+            @param dictionaryBytes The size of the dictionary in bytes. Must be in [0,yojimbo::MaxCompressionDictionaryBytes].
+
+            @returns True if the dictionary was set, false if it is too large or the allocation failed. On failure, the compressor is left without a dictionary.
+         */
+
+        bool SetDictionary( const uint8_t * dictionary, int dictionaryBytes );
+
+        /**
+            Get the size of the current dictionary.
+
+            @returns The dictionary size in bytes. Zero if there is no dictionary.
+         */
+
+        int GetDictionaryBytes() const { return m_dictionaryBytes; }
+
+        /**
+            Get the current dictionary.
+
+            @returns The compressor's copy of the dictionary. NULL if there is no dictionary.
+         */
+
+        const uint8_t * GetDictionary() const { return m_dictionary; }
+
+        /**
+            Compress data.
+
+            @param input The data to compress.
+            @param inputBytes The number of bytes of data to compress.
+            @param output The buffer to write compressed data to. Must not overlap the input.
+            @param maxOutputBytes The size of the output buffer in bytes. Pass in less than the input size to only accept results that actually save space.
+
+            @returns The number of bytes of compressed data written, or zero if the compressed data didn't fit in the output buffer.
+         */
+
+        int Compress( const uint8_t * input, int inputBytes, uint8_t * output, int maxOutputBytes );
+
+        /**
+            Decompress data.
+
+            Every length and offset is checked against the input, the output buffer and the dictionary, so it's safe to pass in data received from the network.
+
+            @param input The compressed data.
+            @param inputBytes The number of bytes of compressed data.
+            @param output The buffer to write decompressed data to. Must not overlap the input.
+            @param maxOutputBytes The size of the output buffer in bytes.
+
+            @returns The number of bytes of decompressed data written, or zero if the compressed data is malformed or doesn't fit in the output buffer.
+         */
+
+        int Decompress( const uint8_t * input, int inputBytes, uint8_t * output, int maxOutputBytes ) const;
+
+    private:
+
+        void BuildDictionaryTable();
+
+        Allocator * m_allocator;                                    ///< The allocator passed in to the constructor.
+
+        uint8_t * m_dictionary;                                     ///< Copy of the dictionary. NULL if there is no dictionary.
+
+        int m_dictionaryBytes;                                      ///< The size of the dictionary in bytes.
+
+        int * m_dictionaryTable;                                    ///< Hash table of positions in the dictionary, built once when the dictionary is set. Copied into the hash table at the start of each compress.
+
+        int * m_hashTable;                                          ///< Hash table from four byte sequences to the most recent position they were seen, in the combined dictionary and input.
+    };
+}
+
+#endif // #ifndef YOJIMBO_COMPRESSION_H
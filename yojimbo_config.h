@@ -102,10 +102,114 @@
 
 #define YOJIMBO_SOCKETS                             1
 
+#if !defined( YOJIMBO_SOCKETS_BATCH_IO )
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && ( defined(__linux__) || defined(__FreeBSD__) )
+#define YOJIMBO_SOCKETS_BATCH_IO                    1               ///< Batched socket IO via recvmmsg/sendmmsg. Linux and FreeBSD only. Other platforms fall back to one syscall per-packet, except for receives on macOS. See YOJIMBO_SOCKETS_RECVMSG_X.
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && ( defined(__linux__) || defined(__FreeBSD__) )
+#define YOJIMBO_SOCKETS_BATCH_IO                    0
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && ( defined(__linux__) || defined(__FreeBSD__) )
+#endif // #if !defined( YOJIMBO_SOCKETS_BATCH_IO )
+
+#if !defined( YOJIMBO_SOCKETS_RECVMSG_X )
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC
+#define YOJIMBO_SOCKETS_RECVMSG_X                   1               ///< Batched socket receives via the Darwin recvmsg_x system call. macOS only. Sends stay one syscall per-packet, because sendmsg_x only sends on connected sockets.
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC
+#define YOJIMBO_SOCKETS_RECVMSG_X                   0
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC
+#endif // #if !defined( YOJIMBO_SOCKETS_RECVMSG_X )
+
+#if !defined( YOJIMBO_SOCKETS_KQUEUE )
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC || ( YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && ( defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__) ) )
+#define YOJIMBO_SOCKETS_KQUEUE                      1               ///< Wait for packets with kqueue instead of select. macOS and BSD only. Sockets fall back to select if the kqueue can't be created.
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC || ...
+#define YOJIMBO_SOCKETS_KQUEUE                      0
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC || ...
+#endif // #if !defined( YOJIMBO_SOCKETS_KQUEUE )
+
+#if !defined( YOJIMBO_SOCKETS_IO_URING )
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#define YOJIMBO_SOCKETS_IO_URING                    1               ///< io_uring socket backend, enabled per-socket with SOCKET_FLAG_IO_URING. Linux only. Needs Linux 6.0 or later at runtime, sockets fall back to batched IO on older kernels.
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#define YOJIMBO_SOCKETS_IO_URING                    0
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#endif // #if !defined( YOJIMBO_SOCKETS_IO_URING )
+
+#if !defined( YOJIMBO_SOCKETS_AF_XDP )
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#define YOJIMBO_SOCKETS_AF_XDP                      1               ///< AF_XDP kernel bypass socket backend, enabled per-socket with SOCKET_FLAG_AF_XDP. Linux only. Needs Linux 5.9 or later, and CAP_NET_ADMIN and CAP_BPF at runtime. Sockets fall back to regular IO otherwise.
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#define YOJIMBO_SOCKETS_AF_XDP                      0
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#endif // #if !defined( YOJIMBO_SOCKETS_AF_XDP )
+
+#if !defined( YOJIMBO_SOCKETS_RIO )
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+#define YOJIMBO_SOCKETS_RIO                         1               ///< Registered I/O socket backend, enabled per-socket with SOCKET_FLAG_RIO. Windows only. Needs Windows 8 or Windows Server 2012 or later at runtime, sockets fall back to regular IO otherwise.
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+#define YOJIMBO_SOCKETS_RIO                         0
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+#endif // #if !defined( YOJIMBO_SOCKETS_RIO )
+
+#if !defined( YOJIMBO_SOCKETS_TIMESTAMPS )
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#define YOJIMBO_SOCKETS_TIMESTAMPS                  1               ///< Kernel receive timestamps via SO_TIMESTAMPNS. Linux only. Other platforms timestamp packets with platform_time when they are read from the socket.
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#define YOJIMBO_SOCKETS_TIMESTAMPS                  0
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#endif // #if !defined( YOJIMBO_SOCKETS_TIMESTAMPS )
+
+#if !defined( YOJIMBO_SOCKETS_TXTIME )
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#define YOJIMBO_SOCKETS_TXTIME                      1               ///< Earliest departure times for paced sends via SO_TXTIME, and pacing rate caps via SO_MAX_PACING_RATE. Linux only. Other platforms pace packets in the transport instead. See NetworkTransport::EnablePacing.
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#define YOJIMBO_SOCKETS_TXTIME                      0
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX && defined(__linux__)
+#endif // #if !defined( YOJIMBO_SOCKETS_TXTIME )
+
 #if !defined( YOJIMBO_SECURE_MODE )
 #define YOJIMBO_SECURE_MODE                         0               ///< IMPORTANT: This should be set to 1 in your retail build!
 #endif // #if !defined( YOJIMBO_SECURE_MODE )
 
+#if !defined( YOJIMBO_PROFILE )
+#define YOJIMBO_PROFILE                             0               ///< Set to 1 to time hot path stages into latency histograms. See yojimbo::ProfileStage and MetricsSnapshot::AddProfile.
+#endif // #if !defined( YOJIMBO_PROFILE )
+
+#if !defined( YOJIMBO_TRACE )
+#define YOJIMBO_TRACE                               0               ///< Set to 1 to pass every packet read and written by a transport to a trace function. See yojimbo::SetPacketTraceFunction.
+#endif // #if !defined( YOJIMBO_TRACE )
+
+#define YOJIMBO_ZONES_NONE                          0
+#define YOJIMBO_ZONES_TRACY                         1
+#define YOJIMBO_ZONES_PERFETTO                      2
+
+#if !defined( YOJIMBO_ZONES )
+#define YOJIMBO_ZONES                               YOJIMBO_ZONES_NONE      ///< Set to YOJIMBO_ZONES_TRACY or YOJIMBO_ZONES_PERFETTO to mark the major stages as zones in that profiler, and plot queue depths and bytes sent per tick. The profiler headers must be on the include path. See YOJIMBO_ZONE.
+#endif // #if !defined( YOJIMBO_ZONES )
+
+#if !defined( YOJIMBO_ATOMIC_MESSAGE_REFS )
+#define YOJIMBO_ATOMIC_MESSAGE_REFS                 0               ///< Set to 1 to change the reference count of every message atomically, so any message can be shared between threads. Otherwise only broadcast messages and messages created by a thread-safe message factory are. See MessageFactory::SetThreadSafe.
+#endif // #if !defined( YOJIMBO_ATOMIC_MESSAGE_REFS )
+
+#if !defined( YOJIMBO_MESSAGE_KEYS )
+#define YOJIMBO_MESSAGE_KEYS                        0               ///< Set to 1 to give messages keys, so a new message replaces the queued message with the same key on unreliable channels. Adds 16 bytes to every message. See Message::SetKey.
+#endif // #if !defined( YOJIMBO_MESSAGE_KEYS )
+
+#if !defined( YOJIMBO_MESSAGE_TIME_TO_LIVE )
+#define YOJIMBO_MESSAGE_TIME_TO_LIVE                0               ///< Set to 1 to give each message its own time to live on reliable-ordered channels with ChannelConfig::expireMessages. Adds up to 8 bytes to every message. See Message::SetTimeToLive.
+#endif // #if !defined( YOJIMBO_MESSAGE_TIME_TO_LIVE )
+
+#if !defined( YOJIMBO_MESSAGE_CACHE )
+#define YOJIMBO_MESSAGE_CACHE                       0               ///< Set to 1 to cache the serialized bits of messages, so ChannelConfig::cacheSerializedMessages and redundant messages copy them into packets instead of serializing messages again. Adds 8 bytes to every message. Otherwise messages are serialized each time, and the packets are the same.
+#endif // #if !defined( YOJIMBO_MESSAGE_CACHE )
+
+#if !defined( YOJIMBO_BITPACK_64 )
+#if defined( __x86_64__ ) || defined( _M_X64 ) || defined( __aarch64__ ) || defined( _M_ARM64 )
+#define YOJIMBO_BITPACK_64                          1               ///< The bitpacker flushes and refills 64 bit words instead of 32 bit words. The bit stream is exactly the same either way, so this only changes speed. On by default on 64 bit targets.
+#else // #if defined( __x86_64__ ) || defined( _M_X64 ) || defined( __aarch64__ ) || defined( _M_ARM64 )
+#define YOJIMBO_BITPACK_64                          0
+#endif // #if defined( __x86_64__ ) || defined( _M_X64 ) || defined( __aarch64__ ) || defined( _M_ARM64 )
+#endif // #if !defined( YOJIMBO_BITPACK_64 )
+
 #define YOJIMBO_SERIALIZE_CHECKS                    1
 
 #ifndef NDEBUG
@@ -120,8 +224,66 @@
 
 #endif // #ifndef NDEBUG
 
+#if !defined( YOJIMBO_DEBUG_LEAK_SAMPLE_RATE )
+#define YOJIMBO_DEBUG_LEAK_SAMPLE_RATE              1               ///< Track one in this many allocations, packets and messages individually for leak reports, chosen by address. Leaks are always counted exactly, but only sampled leaks are reported by the site that created them. Raise this to make debug builds with leak tracking faster.
+#endif // #if !defined( YOJIMBO_DEBUG_LEAK_SAMPLE_RATE )
+
 #define YOJIMBO_DEBUG_SPAM                          0
 
+#if defined( YOJIMBO_USER_CONFIG )
+#include YOJIMBO_USER_CONFIG                                        // Optional header, usually generated per-binary, that defines any of the limits below. Define YOJIMBO_USER_CONFIG as its quoted name, eg. -DYOJIMBO_USER_CONFIG=\"game_yojimbo_config.h\".
+#endif // #if defined( YOJIMBO_USER_CONFIG )
+
+#if !defined( YOJIMBO_MAX_CLIENTS )
+#define YOJIMBO_MAX_CLIENTS                         1024            ///< Sets yojimbo::MaxClients. Also sets the number of bits used to send the client index, so clients and servers must be built with the same value.
+#endif // #if !defined( YOJIMBO_MAX_CLIENTS )
+
+#if !defined( YOJIMBO_MAX_CHANNELS )
+#define YOJIMBO_MAX_CHANNELS                        64              ///< Sets yojimbo::MaxChannels.
+#endif // #if !defined( YOJIMBO_MAX_CHANNELS )
+
+#if !defined( YOJIMBO_MAX_CONTEXT_MAPPINGS )
+#define YOJIMBO_MAX_CONTEXT_MAPPINGS                YOJIMBO_MAX_CLIENTS             ///< Sets yojimbo::MaxContextMappings.
+#endif // #if !defined( YOJIMBO_MAX_CONTEXT_MAPPINGS )
+
+#if !defined( YOJIMBO_MAX_ENCRYPTION_MAPPINGS )
+#define YOJIMBO_MAX_ENCRYPTION_MAPPINGS             ( YOJIMBO_MAX_CLIENTS * 4 )     ///< Sets yojimbo::MaxEncryptionMappings.
+#endif // #if !defined( YOJIMBO_MAX_ENCRYPTION_MAPPINGS )
+
+#if !defined( YOJIMBO_CONNECT_TOKEN_ENTRIES_PER_CLIENT )
+#define YOJIMBO_CONNECT_TOKEN_ENTRIES_PER_CLIENT    16              ///< Sets yojimbo::ConnectTokenEntriesPerClient.
+#endif // #if !defined( YOJIMBO_CONNECT_TOKEN_ENTRIES_PER_CLIENT )
+
+#if !defined( YOJIMBO_REPLAY_PROTECTION_BUFFER_SIZE )
+#define YOJIMBO_REPLAY_PROTECTION_BUFFER_SIZE       1024            ///< Sets yojimbo::ReplayProtectionBufferSize.
+#endif // #if !defined( YOJIMBO_REPLAY_PROTECTION_BUFFER_SIZE )
+
+// IMPORTANT: These limits size arrays inside library classes, so every translation unit that includes yojimbo, library and application alike, must be built with the same values.
+
+#if YOJIMBO_MAX_CLIENTS < 1
+#error YOJIMBO_MAX_CLIENTS must be at least 1
+#endif // #if YOJIMBO_MAX_CLIENTS < 1
+
+#if YOJIMBO_MAX_CHANNELS < 1
+#error YOJIMBO_MAX_CHANNELS must be at least 1
+#endif // #if YOJIMBO_MAX_CHANNELS < 1
+
+#if YOJIMBO_MAX_CONTEXT_MAPPINGS < 1
+#error YOJIMBO_MAX_CONTEXT_MAPPINGS must be at least 1
+#endif // #if YOJIMBO_MAX_CONTEXT_MAPPINGS < 1
+
+#if YOJIMBO_MAX_ENCRYPTION_MAPPINGS < YOJIMBO_MAX_CLIENTS
+#error YOJIMBO_MAX_ENCRYPTION_MAPPINGS must be at least YOJIMBO_MAX_CLIENTS
+#endif // #if YOJIMBO_MAX_ENCRYPTION_MAPPINGS < YOJIMBO_MAX_CLIENTS
+
+#if YOJIMBO_CONNECT_TOKEN_ENTRIES_PER_CLIENT < 1
+#error YOJIMBO_CONNECT_TOKEN_ENTRIES_PER_CLIENT must be at least 1
+#endif // #if YOJIMBO_CONNECT_TOKEN_ENTRIES_PER_CLIENT < 1
+
+#if YOJIMBO_REPLAY_PROTECTION_BUFFER_SIZE < 64 || ( YOJIMBO_REPLAY_PROTECTION_BUFFER_SIZE % 64 ) != 0
+#error YOJIMBO_REPLAY_PROTECTION_BUFFER_SIZE must be a non-zero multiple of 64
+#endif // #if YOJIMBO_REPLAY_PROTECTION_BUFFER_SIZE < 64 || ( YOJIMBO_REPLAY_PROTECTION_BUFFER_SIZE % 64 ) != 0
+
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -129,35 +291,122 @@
 
 namespace yojimbo
 {
-    const int MaxClients = 64;                                      ///< The maximum number of clients supported by this library. You can increase this if you want, but this library is designed around patterns that work best for [2,64] player games. If your game has less than 64 clients, reducing this will save memory.
-    const int MaxChannels = 64;                                     ///< The maximum number of message channels supported by this library. If you need less than 64 channels, reducing this will save memory.
-    const int ConnectTokenBytes = 1024;                             ///< The size of a connect token (bytes). Connect tokens are generated by matcher.go and sent from client to server as part of the secure connection process.
+    const int MaxClients = YOJIMBO_MAX_CLIENTS;                     ///< The maximum number of clients supported by this library. Set with YOJIMBO_MAX_CLIENTS. Per-client data is allocated in Server::Start according to the number of client slots requested, so this only caps the number of slots a server can allocate (and sets the number of bits used to send the client index).
+    const int CacheLineBytes = 64;                                  ///< The size of a cache line on the target CPU (bytes). Per-client state the server touches every tick is packed into one cache line per client. See ServerClientTickData.
+    const int DefaultMaxClients = 64;                               ///< The default number of client slots allocated by Server::Start. This library is designed around patterns that work best for [2,64] player games, but you can pass in up to MaxClients to Server::Start for lobby and hub servers.
+    const int MaxChannels = YOJIMBO_MAX_CHANNELS;                   ///< The maximum number of message channels supported by this library. Set with YOJIMBO_MAX_CHANNELS. Per-connection storage is sized by ConnectionConfig::numChannels, so this only bounds the channel configs carried by ConnectionConfig. If you need less than 64 channels, reducing this will save memory.
+    const int MaxReliableMessageWindow = 32768;                     ///< The largest send and receive queue size for reliable-ordered channels (messages). Message ids are 16 bits on the wire, and the receiver places each id by its offset from the next message id it expects, so any id more than this far ahead is a stale copy of a message already received. This is the widest window that keeps the two apart as ids wrap around.
+    const int ConnectTokenBytes = 1024;                             ///< The maximum size of a connect token (bytes). Connect tokens are generated by matcher.go and sent from client to server as part of the secure connection process. Tokens in the original JSON format are always exactly this size. Compact connect tokens are smaller. See EncryptCompactConnectToken.
+    const int CompactConnectTokenHeaderBytes = 8;                   ///< Size of the unencrypted header at the front of a compact connect token (bytes). It holds a tag, a version and the total token size, so servers can size the token without decrypting it. See GetConnectTokenBytes.
+    const int CompactConnectTokenVersion = 1;                       ///< Version of the compact connect token layout. Compact connect tokens with any other version are rejected.
     const int ChallengeTokenBytes = 256;                            ///< Size of a challenge token (bytes). Challenge tokens are sent back from server to client as part of secure connect. Challenge tokens are intentionally smaller than connect tokens to avoid DDoS amplification attacks.
+    const int MinCompactConnectTokenBytes = ChallengeTokenBytes;    ///< The smallest compact connect token (bytes). Compact connect tokens are padded up to this size so a connection request packet is never smaller than the challenge packet the server sends back, which would let attackers use servers to amplify DDoS attacks.
+    const int ResumeTokenBytes = 128;                               ///< Size of a resume token (bytes). Resume tokens are issued by the server to connected clients in keep-alive packets and sent back by the client to resume its session without a connect token. See Client::Resume.
     const int MaxServersPerConnect = 8;                             ///< The maximum number of server addresses per-connect token, and (conveniently) the maximum number of server addresses that can be passed in to Client::Connect and Client::InsecureConnect.
+    const int MaxMatchBatchSize = 1024;                             ///< The maximum number of client ids per-call to Matcher::RequestMatches.
+    const int MaxConnectTokenIssueThreads = 32;                     ///< The maximum number of threads IssueConnectTokens will spread a batch of connect tokens across.
     const int NonceBytes = 8;                                       ///< The size of a nonce (number, used only once) used as part of the encryption. Corresponds to a 64 bit sequence number that increases with block of data that is encrypted.
     const int KeyBytes = 32;                                        ///< Size of the encryption key used for symmetric encryption of packets and tokens (bytes).
     const int MacBytes = 16;                                        ///< Size of the message authentication code (MAC) sent with each encrypted packet and token (bytes). Used to quickly test if a packet or token has been modified and reject before attempting to decrypt it.
-    const int MaxContextMappings = MaxClients;                      ///< The maximum number transport context mappings. When a Transport is used with a Server, we need one context per-connected client, so this is set to MaxClients by default. If you use transport directly without client/server, you might want to set this to some different number.
-    const int MaxEncryptionMappings = MaxClients * 8;               ///< The maximum number of encryption mappings for a transport. Encryption mappings are needed for potential clients during the connection negotiation process, and per-client once they are fully connected. Because multiple clients can be negotiating connection at the same time, this needs to be some multiple of MaxClients.
-    const int MaxConnectTokenEntries = MaxClients * 16;             ///< The maximum number of connect tokens entries stored in the Server when filtering out connect tokens that have already been used to protect against packet replay attacks. This should be a generous multiple of MaxClients.
-    const int ReplayProtectionBufferSize = 64;                      ///< The size of the replay protection buffer (number of packets). Packets that fit in this buffer are passed to the application the first time they are received and rejected after that. Packets older than the buffer size are rejected. Protects against packets being recorded and replayed in an attempt to corrupt internal protocol state.
+    const int MaxContextMappings = YOJIMBO_MAX_CONTEXT_MAPPINGS;    ///< The maximum number transport context mappings. Set with YOJIMBO_MAX_CONTEXT_MAPPINGS. When a Transport is used with a Server, we need one context per-connected client, so this is set to MaxClients by default. If you use transport directly without client/server, you might want to set this to some different number. Sizes the context arrays inside every transport.
+    const int MaxEncryptionMappings = YOJIMBO_MAX_ENCRYPTION_MAPPINGS;      ///< The maximum number of encryption mappings for a transport. Set with YOJIMBO_MAX_ENCRYPTION_MAPPINGS. Sizes the key and address arrays inside every EncryptionManager, so small servers and client builds save a lot of memory by lowering it. Encryption mappings are needed for potential clients during the connection negotiation process, and per-client once they are fully connected. Because multiple clients can be negotiating connection at the same time, this needs to be some multiple of MaxClients.
+    const int TimerWheelSlots = 256;                                ///< The number of slots in each TimerWheel. Must be a power of two. Timers due more than TimerWheelSlots * TimerWheelTickTime seconds out share slots with nearer timers, and are skipped over as those slots are visited.
+    const double TimerWheelTickTime = 0.1;                          ///< The time covered by each TimerWheel slot (seconds). Expirations are exact, this only controls how timers are spread across slots.
+    const int LatencyHistogramSubBucketBits = 4;                    ///< Each power of two in a LatencyHistogram is split into 2^LatencyHistogramSubBucketBits linear sub-buckets. 4 bits keeps percentiles within about 6% of the true value.
+    const int LatencyHistogramSubBuckets = 1 << LatencyHistogramSubBucketBits;        ///< The number of linear sub-buckets per power of two in a LatencyHistogram.
+    const int ConnectTokenEntriesPerClient = YOJIMBO_CONNECT_TOKEN_ENTRIES_PER_CLIENT;     ///< The number of connect token entries stored in the Server per-client slot when filtering out connect tokens that have already been used to protect against packet replay attacks. Used to size the connect token table in Server::Start unless ClientServerConfig::serverConnectTokenEntries is set. Set with YOJIMBO_CONNECT_TOKEN_ENTRIES_PER_CLIENT.
+    const int ConnectTokenCacheEntriesPerClient = 2;                ///< The number of recently decrypted connect tokens cached by the Server per-client slot, so connection requests resent by clients waiting for a challenge don't decrypt the same connect token again. Used to size the connect token cache in Server::Start unless ClientServerConfig::serverConnectTokenCacheEntries is set.
+    const int ConnectionRequestBucketsPerClient = 32;               ///< The number of connection request rate limiting buckets stored in the Server per-client slot. Used to size the connection request limiter in Server::Start unless ClientServerConfig::serverConnectionRequestBuckets is set.
+    const int ServerQueuedPacketsPerClient = 8;                     ///< The maximum number of received connection packets queued per-client before the Server processes them with the job scheduler. See Server::SetJobScheduler.
+    const int ServerQueuedConnectionRequests = 64;                  ///< The maximum number of received connection requests queued before the Server decrypts their connect tokens in a batch with the job scheduler. See Server::SetJobScheduler.
+    const int ReplayProtectionBufferSize = YOJIMBO_REPLAY_PROTECTION_BUFFER_SIZE;          ///< The size of the replay protection window (number of packets). Set with YOJIMBO_REPLAY_PROTECTION_BUFFER_SIZE. Must be a multiple of 64. Packets inside the window are passed to the application the first time they are received and rejected after that. Packets older than the window are rejected. Costs one bit per packet, so it can be made large enough to cover heavy reordering at high packet rates. Protects against packets being recorded and replayed in an attempt to corrupt internal protocol state.
     const int DefaultMaxPacketSize = 4 * 1024;                      ///< The default maximum packet size that can be sent with a transport. You can override this by passing in a different value to the transport constructor.
+    const int DefaultFragmentSize = 1200;                           ///< The default fragment size for a transport (bytes). Packets larger than this are split into fragments no larger than this and reassembled on the other side, so large packets don't rely on IP fragmentation. You can override this with Transport::SetFragmentSize.
+    const int MaxFragmentsPerPacket = 64;                           ///< The maximum number of fragments a packet can be split into. The fragment size must be large enough that a packet of maximum size fits in this many fragments.
+    const int FragmentReassemblyBufferSize = 32;                    ///< The number of fragmented packets that can be reassembled at the same time per-transport. Each entry pre-allocates a buffer of maximum packet size.
+    const int MaxFecGroupSize = 32;                                 ///< The maximum number of packets protected by each parity packet when forward error correction is enabled. See Transport::EnableForwardErrorCorrection.
+    const int FecBufferSize = 32;                                   ///< The number of forward error correction groups that can be encoded, and decoded, at the same time per-transport. Each entry pre-allocates a buffer of maximum packet size.
     const int DefaultPacketSendQueueSize = 1024;                    ///< The default packet send queue size for a transport (number of packets). You can override this by passing in a different value to the transport constructor.
     const int DefaultPacketReceiveQueueSize = 1024;                 ///< The default packet receive queue size for a transport (number of packets). You can override this by passing in a different value to the transport constructor.
+    const int DefaultPacketReceiveRingSize = 1024;                  ///< The default size of the ring buffer that ThreadedNetworkTransport receives packets into on its receive thread (number of packets). You can override this by passing in a different value to the transport constructor.
+    const int DefaultSharedMemoryRingSize = 1024;                   ///< The default size of each ring buffer that SharedMemoryTransport exchanges packets through (number of packets). There is one ring in each direction, and each slot is the size of a maximum size packet. You can override this by passing in a different value to the transport constructor.
+    const int PacketReceiveBatchSize = 32;                          ///< The maximum number of packets read from the network per-batch in Transport::ReadPackets. On Linux this corresponds to the number of packets read by a single call to recvmmsg. Each transport pre-allocates this many packet buffers of maximum packet size.
+    const int MaxSharedSocketRouteChanges = 64;                     ///< The maximum number of routes a SharedServerTransport can claim between calls to SharedServerSocket::ReceivePackets. Packets sent to new addresses once this many routes are waiting to be claimed are dropped.
+    const double DefaultSharedSocketRouteTimeout = 10.0;            ///< The default time after which a SharedServerSocket releases the route to a client address that it has not received a packet from (seconds). You can override this by passing in a different value to the shared socket constructor.
+    const double PlayoutOffsetWindow = 10.0;                        ///< Playout buffers track the smallest difference between the time packets are received and the time they were sent, over the current and previous window of this length (seconds). The fastest packets set the base of the playout delay, and old windows are forgotten so the playout delay follows changes in route delay. See ChannelConfig::playoutBuffer.
+    const double NoEventTime = 1.0e300;                             ///< A time later than any real time. Returned by Client::GetNextEventTime, Server::GetNextEventTime, Connection::GetNextSendTime and NetworkSimulator::GetNextDeliveryTime when nothing is scheduled, so event times can be combined with min.
+    const int MaxReceiveWorkers = 16;                               ///< The maximum number of worker threads that decode received packets in parallel. See Transport::EnableParallelReceive.
+    const int PacketSendBatchSize = 32;                             ///< The maximum number of packets written to the network per-batch in Transport::WritePackets. On Linux this corresponds to the number of packets sent by a single call to sendmmsg. Each transport pre-allocates this many packet buffers of maximum packet size.
+    const int MaxCoalescedPackets = 32;                             ///< The maximum number of packets that can be coalesced into one packet when TRANSPORT_FLAG_COALESCE_PACKETS is set. See Transport::SetFlags.
+    const int MaxAddressMigrationAttempts = 16;                     ///< The maximum number of encrypted packets from unknown addresses checked against the keys of every client each time a transport reads packets when TRANSPORT_FLAG_ADDRESS_MIGRATION is set. Bounds the decryption work an attacker can cause by sending junk from many addresses.
+    const int ConnectionPacketPoolSize = 256;                       ///< The number of connection packet objects pooled per-packet factory by ClientServerPacketFactory. Connection packets are created for every packet carrying messages in both directions, so they are recycled instead of being allocated and freed every time. If more connection packets are alive at once, the extra packets are allocated as normal.
+    const int ConnectionPacketArenaSize = 1024;                     ///< The initial size of the arena each connection packet allocates its per-channel data from (bytes). The arena grows to fit the largest packet seen, and is kept when the packet is recycled. See ArenaAllocator.
+    const int TransportFrameAllocatorSize = 64 * 1024;              ///< The size of the frame allocator each transport uses for temporary arrays, which is reset in Transport::AdvanceTime (bytes). Large enough for the packets read from the network simulator with the default receive queue size. Allocated the first time it is needed. See FrameAllocator.
+    const int MaxAllocatorThreads = 8;                              ///< The maximum number of threads that can allocate from one ThreadedTLSF_Allocator. Each thread allocates from its own heap, carved out of the allocator's memory.
     const int DefaultSocketSendBufferSize = 1024 * 1024;            ///< The default socket send buffer size for a transport (bytes). Corresponds to SO_SNDBUF on the socket. You can override this by passing in a different value to the transport constructor.
     const int DefaultSocketReceiveBufferSize = 1024 * 1024;         ///< The default socket receive buffer size for a transport (bytes). Corresponds to SO_RECBUF on the socket. You can override this by passing in a different value to the transport constructor.
+    const int SocketBusyPollMicroseconds = 50;                      ///< How long a receive call busy polls the network device queue for packets before sleeping (microseconds). Corresponds to SO_BUSY_POLL on the socket. See SOCKET_FLAG_BUSY_POLL.
+    const int SocketDscpExpedited = 46;                             ///< The expedited forwarding (EF) differentiated services code point. Networks that honor QoS markings queue EF packets ahead of bulk traffic, which suits gameplay packets. See SOCKET_FLAG_DSCP_EF and Socket::SetDscp.
+    const int MaxSocketErrors = 32;                                 ///< The maximum number of errors read from the socket error queue each time a network transport reads packets. Any others are read next time. See SOCKET_FLAG_RECEIVE_ERRORS.
+    const int SocketRingNumReceiveBuffers = 256;                    ///< The number of receive buffers each io_uring socket keeps posted to the kernel. Must be a power of two. See SOCKET_FLAG_IO_URING.
+    const int SocketRingNumSendSlots = 256;                         ///< The number of sends each io_uring socket can have in flight. Packets sent while all slots are busy are sent with sendto instead. See SOCKET_FLAG_IO_URING.
+    const int SocketRingMaxPacketSize = DefaultMaxPacketSize;       ///< The largest packet an io_uring socket can send or receive through the ring (bytes). Larger packets received are discarded, and larger packets sent go through sendto. See SOCKET_FLAG_IO_URING.
+    const int SocketXdpNumFrames = 1024;                            ///< The number of frames in the memory shared with the kernel for each network interface queue an AF_XDP socket receives on. Half are kept posted for receiving and half are used for sending. Must be a power of two. See SOCKET_FLAG_AF_XDP.
+    const int SocketXdpFrameSize = 2048;                            ///< The size of each AF_XDP frame (bytes). Must be 2048 or 4096. Packets that don't fit in a frame, or in the interface MTU, with their ethernet, IP and UDP headers are sent with sendto instead. See SOCKET_FLAG_AF_XDP.
+    const int SocketXdpMaxQueues = 8;                               ///< The maximum number of network interface receive queues an AF_XDP socket receives on. Packets arriving on other queues go through the kernel. See SOCKET_FLAG_AF_XDP.
+    const int SocketXdpNumNeighbors = 1024;                         ///< The number of entries in the table of ethernet addresses an AF_XDP socket learns from the packets it receives. Must be a power of two. Packets sent to addresses missing from the table are sent with sendto instead. See SOCKET_FLAG_AF_XDP.
+    const int SocketRioNumReceiveBuffers = 256;                     ///< The number of receive buffers each Registered I/O socket keeps posted to the kernel. See SOCKET_FLAG_RIO.
+    const int SocketRioNumSendSlots = 256;                          ///< The number of sends each Registered I/O socket can have in flight. Packets sent while all slots are busy are sent with sendto instead. See SOCKET_FLAG_RIO.
+    const int SocketRioMaxPacketSize = DefaultMaxPacketSize;        ///< The largest packet a Registered I/O socket can send or receive through registered buffers (bytes). Larger packets received are discarded, and larger packets sent go through sendto. See SOCKET_FLAG_RIO.
+    const int SocketFilterMaxKnownAddresses = 16384;                ///< The number of addresses the socket packet filter can hold that are not rate limited. See Socket::AddKnownAddress.
+    const int SocketFilterMaxSources = 65536;                       ///< The number of source IP addresses the socket packet filter counts packets for when rate limiting unknown addresses. The least recently seen source is evicted when the table is full. See SocketFilterConfig::unknownSourcePacketsPerSecond.
+    const int DefaultUnknownSourcePacketsPerSecond = 256;           ///< The default number of packets per-second let through by the packet filter from each source IP address that is not a known address, eg. a client that is connecting. See NetworkTransport::EnablePacketFilter.
+    const int MaxRelays = 8;                                        ///< The maximum number of relays a network transport sends and receives relayed packets through. See NetworkTransport::AddRelay.
+    const int DefaultMaxRelayRoutes = 1024;                         ///< The number of addresses a network transport can reach through relays. When the table is full, the route learned least recently is replaced. See NetworkTransport::AddRelay.
+    const int MaxRelayOrigins = 64;                                 ///< The maximum number of origin servers a transport in relay mode forwards packets to. See NetworkTransport::EnableRelayMode.
+    const float DefaultRelayPacketsPerSecond = 256.0f;              ///< The default number of packets per-second a relay forwards to origin servers from each source IP address. See NetworkTransport::EnableRelayMode.
+    const float DefaultRelayPacketBurst = 512.0f;                   ///< The default number of packets a relay forwards to origin servers in a burst from each source IP address, before it is limited to DefaultRelayPacketsPerSecond.
     const int ConservativeMessageHeaderEstimate = 32;               ///< Conservative message header estimate used when checking that message data fits within the packet budget. See YOJIMBO_VALIDATE_PACKET_BUDGET
     const int ConservativeFragmentHeaderEstimate = 64;              ///< Conservative fragment header estimate used when checking that message data fits within the packet budget. See YOJIMBO_VALIDATE_PACKET_BUDGET
     const int ConservativeChannelHeaderEstimate = 32;               ///< Conservative channel header estimate used when checking that message data fits within the packet budget. See YOJIMBO_VALIDATE_PACKET_BUDGET
-    const int ConservativeConnectionPacketHeaderEstimate = 128;     ///< Conservative packet header estimate used when checking that message data fits within the packet budget. See YOJIMBO_VALIDATE_PACKET_BUDGET
+    const int ConservativeConnectionPacketHeaderEstimate = 128;     ///< Conservative packet header estimate used when checking that message data fits within the packet budget. Covers a 32 packet ack window. Wider ack windows add their extra ack bits on top of this. See YOJIMBO_VALIDATE_PACKET_BUDGET
+    const int MaxAckWindowSize = 256;                               ///< The maximum number of packets acked by each connection packet. See ConnectionConfig::ackWindowSize.
+    const int MaxAggregateMessages = 64;                            ///< The maximum number of small messages that can be combined into one aggregate message on a reliable-ordered channel. See ChannelConfig::maxAggregateMessages.
+    const int MaxMessageTypes = 1 << 15;                            ///< The maximum number of message types per message factory. The message type is stored in 15 bits of each message. Message factories created with more types fail to create messages, even in release builds. See MESSAGE_FACTORY_ERROR_TOO_MANY_MESSAGE_TYPES.
+    const int MaxMessageTypeCodeBits = 16;                          ///< The longest prefix code a message type can get when the message factory has type frequencies set. See MessageFactory::SetTypeFrequencies.
+    const int MaxInternedStrings = 4096;                            ///< The maximum number of strings in the per-connection string dictionary. Interned strings are measured with ids of this many bits, since messages are measured without a connection. See ConnectionConfig::maxInternedStrings.
+    const int CompressedSequenceBits = 8;                           ///< The number of low bits of the sequence number written in compressed connection packet headers, when the sequence is close enough to the most recent packet acked by the other side. See ConnectionConfig::compressPacketHeader.
+    const int CompressedSequenceWindow = 64;                        ///< Compressed connection packet headers only truncate the sequence number when it is no more than this many packets past the most recent packet acked by the other side. The receiver places truncated sequence numbers up to this many packets ahead of the most recent packet it received, and up to ( 1 << CompressedSequenceBits ) - CompressedSequenceWindow packets behind it.
+    const double ClockSyncWindow = 10.0;                            ///< Clock sync tracks the smallest difference between the time connection packets are received and the time they were sent, and the smallest gap between the send times of consecutive packets, over the current and previous window of this length (seconds). Old windows are forgotten so the estimates follow changes in route delay and tick rate. See ConnectionConfig::enableClockSync.
+
+    const int MtuSearchGranularity = 16;                            ///< Path MTU discovery stops once the largest connection packet size confirmed is within this many bytes of the smallest size that failed (bytes). See ConnectionConfig::enableMtuDiscovery.
     const uint32_t SerializeCheckValue = 0x12345678;                ///< The value written to the stream for serialize checks. See WriteStream::SerializeCheck and ReadStream::SerializeCheck.
 
+    /**
+        The cipher used to encrypt packets sent between the client and server.
+
+        IMPORTANT: The client and server must use the same packet cipher, otherwise encrypted packets fail to decrypt and the client can't connect. Consider including the packet cipher in your protocol id.
+
+        @see ClientServerConfig::packetCipher
+        @see IsPacketCipherAvailable
+     */
+
+    enum PacketCipher
+    {
+        PACKET_CIPHER_XSALSA20_POLY1305,                            ///< XSalsa20-Poly1305 (libsodium crypto_secretbox). Available everywhere. This is the default.
+        PACKET_CIPHER_AES256_GCM,                                   ///< AES-256-GCM (libsodium crypto_aead_aes256gcm). Much faster per-byte on CPUs with hardware AES, but only available on CPUs that support AES-NI and CLMUL.
+        NUM_PACKET_CIPHERS
+    };
+
     /// Channel type. Determines the reliability and ordering guarantees for a channel.
 
     enum ChannelType
     {
         CHANNEL_TYPE_RELIABLE_ORDERED,                              ///< Messages are received reliably and in the same order they were sent. 
-        CHANNEL_TYPE_UNRELIABLE_UNORDERED                           ///< Messages are sent unreliably. Messages may arrive out of order, or not at all.
+        CHANNEL_TYPE_UNRELIABLE_UNORDERED,                          ///< Messages are sent unreliably. Messages may arrive out of order, or not at all.
+        CHANNEL_TYPE_SNAPSHOT,                                      ///< Messages are sent unreliably, and delta encoded against the most recent message the other side acked. Only the most recent message queued is sent. See SnapshotChannel.
+        CHANNEL_TYPE_UNRELIABLE_SEQUENCED,                          ///< Messages are sent unreliably. Messages may not arrive, but are never received out of order: messages older than the newest one received are dropped. See UnreliableSequencedChannel.
+        CHANNEL_TYPE_UNRELIABLE_LATEST_STATE                        ///< Messages are sent unreliably, like unreliable-unordered. A full send queue drops its oldest message instead of failing, so the channel never errors from sending faster than it drains. See UnreliableLatestStateChannel.
     };
 
     /** 
@@ -165,7 +414,7 @@ namespace yojimbo
      
         Channels let you specify different reliability and ordering guarantees for messages sent across a connection.
      
-        They may be configured as one of two types: reliable-ordered or unreliable-unordered.
+        They may be configured as one of five types: reliable-ordered, unreliable-unordered, unreliable-sequenced, unreliable-latest-state or snapshot.
      
         Reliable ordered channels guarantee that messages (see Message) are received reliably and in the same order they were sent. 
         This channel type is designed for control messages and RPCs sent between the client and server.
@@ -173,6 +422,15 @@ namespace yojimbo
         Unreliable unordered channels are like UDP. There is no guarantee that messages will arrive, and messages may arrive out of order.
         This channel type is designed for data that is time critical and should not be resent if dropped, like snapshots of world state sent rapidly 
         from server to client, or cosmetic events such as effects and sounds.
+
+        Unreliable sequenced channels are unreliable unordered channels that drop messages older than the newest message received, instead of
+        delivering them late. This channel type is designed for streams where only the latest data matters, like player inputs and state updates.
+        Messages are never resent, so there is no head-of-line blocking. Unreliable sequenced channels treat blocks the same way as unreliable
+        unordered channels.
+
+        Unreliable latest state channels are unreliable unordered channels for state that is sent faster than the connection can drain it. When
+        the send queue is full, the oldest queued message is dropped to make room rather than putting the channel in an error state. Combine this
+        with message keys (see Message::SetKey) so a new state update replaces the queued update for the same entity.
         
         Both channel types support blocks of data attached to messages (see BlockMessage), but their treatment of blocks is quite different.
         
@@ -185,22 +443,51 @@ namespace yojimbo
         should be used on top of the generated packet to split it up into into smaller packets that can be sent across typical Internet MTU (<1500 bytes). 
         Because of this, you need to make sure that the maximum block size for an unreliable-unordered channel fits within the maximum packet size.
         
+        Snapshot channels are unreliable too, but each message is serialized relative to the most recent message on the channel that the other side
+        has acked (its baseline), so messages derived from DeltaMessage only need to send what changed. Only the most recent message queued is sent
+        each packet. Snapshot channels don't support blocks. The sent packet buffer size also sets how many sent and received messages are kept as baselines.
+
         Channels are typically configured as part of a ConnectionConfig, which is included inside the ClientServerConfig that is passed into the Client and Server constructors.
      */
 
     struct ChannelConfig
     {
-        ChannelType type;                                           ///< Channel type: reliable-ordered or unreliable-unordered.
+        ChannelType type;                                           ///< Channel type: reliable-ordered, unreliable-unordered, unreliable-sequenced, unreliable-latest-state or snapshot.
         bool disableBlocks;                                         ///< Disables blocks being sent across this channel.
-        int sendQueueSize;                                          ///< Number of messages in the send queue for this channel.
-        int receiveQueueSize;                                       ///< Number of messages in the receive queue for this channel.
-        int sentPacketBufferSize;                                   ///< Maps packet level acks to individual messages & fragments. Please consider your packet send rate and make sure you have at least a few seconds worth of entries in this buffer.
+        int sendQueueSize;                                          ///< Number of messages in the send queue for this channel. For reliable-ordered channels, this bounds the number of messages in flight, so raise it along with receiveQueueSize to fill links with a large bandwidth-delay product. Must be a power of two, and no larger than MaxReliableMessageWindow for reliable-ordered channels.
+        int receiveQueueSize;                                       ///< Number of messages in the receive queue for this channel. Must be a power of two, and no larger than MaxReliableMessageWindow for reliable-ordered channels.
+        int sentPacketBufferSize;                                   ///< Maps packet level acks to individual messages & fragments. Please consider your packet send rate and make sure you have at least a few seconds worth of entries in this buffer. For snapshot channels, this is also the number of sent and received messages kept as baselines.
+        int sentPacketMessageIdBufferSize;                          ///< Number of message ids kept for sent packets by reliable-ordered channels. Zero reserves the worst case, maxMessagesPerPacket ids for each of the sentPacketBufferSize packets. A smaller value stores the message ids of each sent packet back to back in a ring buffer, so memory scales with the messages actually sent instead. Packets whose message ids are overwritten before they are acked are treated as never acked, so their messages are resent. Like sentPacketBufferSize, make sure this holds at least a few seconds worth of message ids at your peak send rate, otherwise acks for the oldest messages keep getting lost and the channel stalls resending them. Must be zero or at least maxMessagesPerPacket. See CalculateMemoryFootprint.
         int maxMessagesPerPacket;                                   ///< Maximum number of messages to include in each packet. Will write up to this many messages, provided the messages fit into the channel packet budget and the number of bytes remaining in the packet.
         int packetBudget;                                           ///< Maximum amount of message data to write to the packet for this channel (bytes). Specifying -1 means the channel can use up to the rest of the bytes remaining in the packet.
+        int priority;                                               ///< Channels with higher priority are given space in each connection packet first. Lower priority channels get whatever space is left over. Use this to guarantee bandwidth to latency critical channels. Only used if ConnectionConfig::enableChannelScheduling is true.
+        int weight;                                                 ///< Channels with the same priority share the space left for them in proportion to their weight, using deficit round robin. Must be at least 1. Only used if ConnectionConfig::enableChannelScheduling is true.
         int maxBlockSize;                                           ///< The size of the largest block that can be sent across this channel (bytes).
         int fragmentSize;                                           ///< Blocks are split up into fragments of this size when sent over a reliable-ordered channel (bytes).
+        int maxBlockFragmentsPerPacket;                             ///< Maximum number of consecutive block fragments to include in each packet on a reliable-ordered channel. Fragments after the first are only included if they fit in the packet and the channel packet budget, so raise packetBudget to get several fragments per packet. Both sides must use the same value.
+        bool streamBlocks;                                          ///< If true, reliable-ordered channels pass block data to the channel listener in order as it arrives, instead of assembling the whole block. The block message is still received once the block completes, but without the block attached. See ChannelListener::OnChannelBlockDataReceived. Both sides must use the same value.
+        bool sendMessagesWithFragments;                             ///< If true, reliable-ordered channels fill the space left in packets carrying block fragments with regular messages queued after the block, and keep sending those messages while all fragments are in flight. They are still received in order, after the block, but they no longer wait for the whole block to be acked before they are sent. Both sides must use the same value.
+        int blockStreamWindow;                                      ///< The number of fragments past the last one passed to the listener that can be in flight while streaming blocks. The receiver buffers this many fragments, regardless of the block size. Both sides must use the same value.
         float messageResendTime;                                    ///< Minimum delay between message resends (seconds). Avoids sending the same message too frequently.
         float fragmentResendTime;                                   ///< Minimum delay between fragment resends (seconds). Avoids sending the same fragment too frequently.
+        bool adaptiveResendTime;                                    ///< If true, reliable-ordered channels resend messages and fragments after a timeout of RTT + 4 x RTT variance once the connection has an RTT estimate, doubling it each time the same message or fragment is resent. The fixed resend times above are used until then.
+        float minResendTime;                                        ///< The adaptive resend timeout is at least this much longer than the RTT (seconds). Plays the role of clock granularity in RFC 6298, so data is not resent on the same update its ack is due when RTT variance is low. Only used when adaptiveResendTime is true.
+        float maxResendTime;                                        ///< The adaptive resend timeout is never higher than this, including backoff (seconds). Only used when adaptiveResendTime is true.
+        int fastResendThreshold;                                    ///< If greater than zero, reliable-ordered channels count a packet with data on the channel as lost once a packet sent at least this many packets after it is acked. Its messages and fragments are resent in the next packet, instead of waiting for their resend time. 3 works well, like TCP fast retransmit. 0 disables fast resend.
+        int maxAggregateMessages;                                   ///< If greater than one, reliable-ordered channels combine up to this many consecutive messages of the same type into one aggregate message with a single id and send queue entry, as long as none of them have been included in a packet yet. Must be no larger than MaxAggregateMessages. Both sides must use the same value. See AggregateMessage.
+        int maxAggregateBytes;                                      ///< Messages are only added to an aggregate message while it stays this size or smaller, so only small messages are combined and the aggregate always fits in a packet (bytes). Only used when maxAggregateMessages is greater than one.
+        bool cacheSerializedMessages;                               ///< If true, reliable-ordered channels serialize each message once when it is sent, and copy the cached bits into each packet the message is included in, instead of serializing the message again on every resend. Message data is byte aligned in the packet so the bits can be copied as-is. Messages must not be modified after they are sent, and their serialization must not depend on the stream context. Block and broadcast messages are not cached. Bits are only cached when YOJIMBO_MESSAGE_CACHE is 1. Otherwise messages are serialized again each time, in the same byte aligned layout. Both sides must use the same value.
+        int redundancyWindow;                                       ///< If greater than one, unreliable-unordered and unreliable-sequenced channels include each message in up to this many consecutive packets, so it gets through unless all of those packets are lost, without waiting for a resend. Each message is serialized once, the first time it is included in a packet, and the cached bits are copied into the packets after that. The receiver drops copies of messages it has already received by message id. Block and broadcast messages are not cached, but are still sent redundantly. Messages must not be modified after they are sent. Both sides must use the same value.
+        bool expireMessages;                                        ///< If true, reliable-ordered channels stop resending messages once their time to live runs out before they are acked (see Message::SetTimeToLive), and send just their id in their place. The receiver skips expired messages, so the messages after them are still received in order, and bandwidth goes to fresh data instead. Costs 1 bit per message. Both sides must use the same value.
+        float messageTimeToLive;                                    ///< The time to live for messages sent over this channel that don't set their own with Message::SetTimeToLive (seconds). Zero means those messages never expire. Only used when expireMessages is true, and only the sender needs to set it.
+        int packingWindow;                                          ///< If greater than one, unreliable-unordered and unreliable-latest-state channels fill each packet from the oldest this many queued messages, instead of strictly in the order they were sent. The oldest queued message goes first, then the space left is filled with the largest messages in the window that still fit. Messages that don't fit stay queued for a later packet instead of being dropped, and each message is only measured once while it waits. Ignored by unreliable-sequenced channels, since messages would be received out of order. Only the sender needs to set this.
+        bool flowControl;                                           ///< If true, every connection packet advertises how far this reliable-ordered channel's receive queue has room for messages, and the sender holds back messages beyond that instead of sending them. Received messages take up the receive queue until they are dequeued with ReceiveMsg, so without this, a receiver that is slow to dequeue messages makes the sender resend messages it has no room for over and over. Costs 16 bits per connection packet. Both sides must use the same value.
+        bool compressBlocks;                                        ///< If true, reliable-ordered channels compress each block once, right before its fragments are first sent, and send the compressed block instead when it is smaller. The receiver decompresses the block once all fragments have arrived, so maxBlockSize still applies to the uncompressed size. Blocks attached with BlockMessage::AttachSharedBlock are sent as-is, since they are shared with other connections, and streamed blocks are never compressed. Both sides must use the same value. See PacketCompressor.
+        bool blockCache;                                            ///< If true, reliable-ordered channels announce the hash and size of each block before sending its fragments. The receiver looks the block up in its local block cache (see Client::OnConnectionBlockCacheFind) and receives its cached copy right away if it has one, so the fragments are never sent. Otherwise it asks for the fragments, and offers the block to the cache once it has been received. Blocks the receiver doesn't have cost a round trip before their fragments are sent. Ignored while streaming blocks. Both sides must use the same value.
+        bool skipDiscardedMessages;                                 ///< If true, each message on reliable-ordered and unreliable channels is prefixed with its size in bits, so the receiver can skip over messages it would discard without creating or reading them: messages it has already received, and on unreliable channels, messages that arrive while the receive queue is full. Costs bits_required( 0, packetBudget * 8 ) bits per message, so packetBudget must be set. Both sides must use the same value.
+        bool playoutBuffer;                                         ///< If true, unreliable channels hold received messages in a playout buffer and move them to the receive queue at the same cadence they were sent, a target delay after the fastest packets arrive. The target delay is twice the connection's jitter estimate, clamped to [minPlayoutDelay,maxPlayoutDelay]. Trades minimal latency for consistent latency, so updates sent once per-tick are received once per-tick under jitter, instead of two in one frame and none in the next. Messages that arrive after their playout time are moved to the receive queue on the next update. Costs 16 bits per packet with messages on this channel. Both sides must use the same value.
+        float minPlayoutDelay;                                      ///< The smallest target delay of the playout buffer (seconds). Only used when playoutBuffer is true.
+        float maxPlayoutDelay;                                      ///< The largest target delay of the playout buffer (seconds). Bounds the latency added under heavy jitter. Only used when playoutBuffer is true.
 
         ChannelConfig() : type ( CHANNEL_TYPE_RELIABLE_ORDERED )
         {
@@ -208,12 +495,37 @@ namespace yojimbo
             sendQueueSize = 1024;
             receiveQueueSize = 1024;
             sentPacketBufferSize = 1024;
+            sentPacketMessageIdBufferSize = 0;
             maxMessagesPerPacket = 64;
             packetBudget = 1100;
+            priority = 0;
+            weight = 1;
             maxBlockSize = 256 * 1024;
             fragmentSize = 1024;
+            maxBlockFragmentsPerPacket = 1;
+            streamBlocks = false;
+            blockStreamWindow = 32;
+            sendMessagesWithFragments = false;
             messageResendTime = 0.1f;
             fragmentResendTime = 0.25f;
+            adaptiveResendTime = false;
+            minResendTime = 0.02f;
+            maxResendTime = 1.0f;
+            fastResendThreshold = 0;
+            maxAggregateMessages = 0;
+            maxAggregateBytes = 256;
+            cacheSerializedMessages = false;
+            redundancyWindow = 0;
+            expireMessages = false;
+            messageTimeToLive = 0.0f;
+            packingWindow = 0;
+            flowControl = false;
+            compressBlocks = false;
+            blockCache = false;
+            skipDiscardedMessages = false;
+            playoutBuffer = false;
+            minPlayoutDelay = 0.02f;
+            maxPlayoutDelay = 0.2f;
         }
 
         int GetMaxFragmentsPerBlock() const
@@ -234,7 +546,26 @@ namespace yojimbo
     {
         int connectionPacketType;                               ///< Connection packet type (so you can override it). Only necessary to set this if you are using Connection directly. Not necessary to set when using client/server as it overrides it to CLIENT_SERVER_PACKET_CONNECTION for you automatically.
         int slidingWindowSize;                                  ///< The size of the sliding window used for packet acks (# of packets in history). Depending on your packet send rate, you should make sure this buffer is large enough to cover at least a few seconds worth of packets.
+        int ackWindowSize;                                      ///< The number of packets acked by each connection packet. Must be 32, 64, 128 or 256 and no larger than the sliding window size. Each packet is acked redundantly by every packet sent back while it is inside this window, so increase it if your send rate is high and acks are lost to bursty packet loss.
+        float rttSmoothingFactor;                               ///< Exponential smoothing factor applied to each round trip time sample when a packet is acked. RTT variance is smoothed at twice this rate. See Connection::GetNetworkInfo.
+        float packetLossSmoothingFactor;                        ///< Exponential smoothing factor applied to each packet loss sample. A sample of 0% or 100% is taken for each packet generated, so keep this small to average loss over many packets. See Connection::GetNetworkInfo.
+        float bandwidthSmoothingFactor;                         ///< Exponential smoothing factor applied to bandwidth samples. A sample is taken each time the connection time is advanced. See Connection::GetNetworkInfo.
+        bool enableCongestionControl;                           ///< If true, the connection limits the channel data it sends to a congestion window driven by acks, so it backs off when the link is congested. See LedbatCongestionController.
+        float congestionTargetDelay;                            ///< The queuing delay the congestion controller aims for (seconds). The congestion window grows while the RTT is less than this above the lowest RTT seen, and shrinks once it is more. Only used when enableCongestionControl is true.
         int maxPacketSize;                                      ///< The maximum size of packets generated to transmit messages between client and server (bytes).
+        bool enableMtuDiscovery;                                ///< If true, the connection searches for the largest connection packet that gets through the path to the other side by sending padded probe packets, and limits the message data in each packet to the largest size confirmed so far. Send with SOCKET_FLAG_PMTU_PROBE, and make the transport fragment size larger than mtuDiscoveryMaxPacketSize plus packet overhead, otherwise oversized probes are fragmented and always get through. See Connection::GetPathMaxPacketSize.
+        int mtuDiscoveryMinPacketSize;                          ///< The connection packet size that is assumed to always get through (bytes). Packets are limited to this size until larger probe packets are acked. Only used if enableMtuDiscovery is true.
+        int mtuDiscoveryMaxPacketSize;                          ///< The largest connection packet size probed for (bytes). No larger than maxPacketSize. Only used if enableMtuDiscovery is true.
+        float mtuProbeTimeout;                                  ///< A probe packet that is not acked within this time is counted as lost (seconds). Only used if enableMtuDiscovery is true.
+        int mtuProbeMaxAttempts;                                ///< The number of probe packets of one size that must be lost before that size is considered too large for the path. Only used if enableMtuDiscovery is true.
+        float mtuRaiseInterval;                                 ///< Once the search has finished below mtuDiscoveryMaxPacketSize, it is started again after this much time, in case the path now allows larger packets (seconds). Only used if enableMtuDiscovery is true.
+        bool delayAcks;                                         ///< If true, connection packets that would only carry acks are held back, so acks piggyback on the next connection packet with messages instead. Acks are sent on their own once they have been pending for ackDelay. Only packets with messages are acked, so ack-only packets don't bounce back and forth. See Connection::ReadyToSendPacket.
+        float ackDelay;                                         ///< The longest time acks for received packets with messages are held back waiting for a packet with messages to piggyback on (seconds). Only used if delayAcks is true.
+        bool compressPacketHeader;                              ///< If true, connection packets write a compressed header. The sequence number is sent as its low CompressedSequenceBits bits while acks from the other side are keeping up, the ack is encoded relative to the sequence with fewer bits for small differences, and the channels with data in the packet are sent as one bit per channel instead of a count and a channel id per entry. Both sides must use the same value.
+        bool enableClockSync;                                   ///< If true, each connection packet carries the time it was generated, and the connection estimates the offset between the clocks on each side and the tick interval and phase of the other side. Lets clients time their input to arrive just before the server's next tick. Costs 32 bits per-packet. Both sides must use the same value. See Connection::GetNextRemoteTickTime and Client::GetServerTickSendTime.
+        bool enableChannelScheduling;                           ///< If true, space in each connection packet is given to channels in order of ChannelConfig::priority, and channels with the same priority share the space left for them in proportion to ChannelConfig::weight with deficit round robin, so a busy channel can't starve the others. If false, channels are filled in channel id order and each channel can use all the space left over by the channels before it.
+        int maxInternedStrings;                                 ///< The number of strings each side of the connection can intern with serialize_interned_string, in [0,MaxInternedStrings]. Set to zero to disable the string dictionary, so interned strings are always sent inline. Both sides must use the same value. See StringDictionary.
+        int maxInternedStringLength;                            ///< The longest string that can be interned (characters). Longer strings are sent inline. The send and receive tables each take maxInternedStrings * ( maxInternedStringLength + 1 ) bytes per-connection. Both sides must use the same value.
         int numChannels;                                        ///< Number of message channels in [1,MaxChannels]. Each message channel must have a corresponding configuration below.
         ChannelConfig channel[MaxChannels];                     ///< Per-channel configuration. See ChannelConfig for details.
 
@@ -243,6 +574,25 @@ namespace yojimbo
             connectionPacketType = 0;
             maxPacketSize = 4 * 1024;
             slidingWindowSize = 1024;
+            ackWindowSize = 32;
+            rttSmoothingFactor = 0.125f;
+            packetLossSmoothingFactor = 0.01f;
+            bandwidthSmoothingFactor = 0.1f;
+            enableCongestionControl = false;
+            congestionTargetDelay = 0.1f;
+            enableMtuDiscovery = false;
+            mtuDiscoveryMinPacketSize = 1100;
+            mtuDiscoveryMaxPacketSize = 1400;
+            mtuProbeTimeout = 1.0f;
+            mtuProbeMaxAttempts = 3;
+            mtuRaiseInterval = 60.0f;
+            delayAcks = false;
+            ackDelay = 0.05f;
+            compressPacketHeader = false;
+            enableClockSync = false;
+            enableChannelScheduling = false;
+            maxInternedStrings = 0;
+            maxInternedStringLength = 31;
             numChannels = 1;
         }
     };
@@ -264,8 +614,37 @@ namespace yojimbo
         float connectionNegotiationSendRate;                    ///< Send rate for packets sent during connection negotiation process. eg. connection request and challenge response packets (packets per-second).
         float connectionNegotiationTimeOut;                     ///< Connection negotiation times out if no response is received from the other side in this amount of time (seconds).
         float connectionKeepAliveSendRate;                      ///< Keep alive packets are sent at this rate between client and server if no other packets are sent by the client or server. Avoids timeout in situations where you are not sending packets at a steady rate (packets per-second).
+        float connectionIdleKeepAliveSendRate;                  ///< Keep alive packets are sent at this rate instead of connectionKeepAliveSendRate while the connection has no messages waiting to be sent (packets per-second). Set it low with clientSendIdle and serverSendIdleClients false, so clients in menus and lobbies send and receive a heartbeat instead of a packet every tick, eg. to save battery and data on mobile. Queueing a message snaps back to the full rate right away. Must be more than 1 / connectionTimeOut, and should be identical between client and server. Set to zero to always use connectionKeepAliveSendRate.
         float connectionTimeOut;                                ///< Once a connection is established, it times out if it hasn't received any packets from the other side in this amount of time (seconds).
+        int clientConnectRaceServers;                           ///< Number of server addresses the Client sends connection requests to at the same time when connecting to a list of servers (secure). The first server to reply with a challenge wins and the rest are abandoned. If no server in the group replies before ClientServerConfig::connectionNegotiationTimeOut, the Client moves on to the next group of servers in the list. Set to 1 to try servers one at a time.
+        int serverConnectTokenEntries;                          ///< Number of recently used connect tokens remembered by the Server to protect against connect token replay attacks. If this is zero, maxClients * ConnectTokenEntriesPerClient entries are allocated in Server::Start.
+        int serverConnectTokenCacheEntries;                     ///< Number of recently decrypted connect tokens cached by the Server, along with the challenge token generated for them. Connection requests resent while a client waits for a challenge reuse the cached connect token and challenge token instead of decrypting and encrypting again. If this is zero, maxClients * ConnectTokenCacheEntriesPerClient entries are allocated in Server::Start. Set to a negative value to disable the cache.
+        float serverConnectionRequestRate;                      ///< Connection requests per-second admitted by the Server from each source address (IP only, ignoring port) before decrypting the connect token. Excess requests are dropped before any crypto is done. Set to zero to disable connection request rate limiting.
+        float serverConnectionRequestBurst;                     ///< The number of connection requests a source address may send in a burst before being limited to ClientServerConfig::serverConnectionRequestRate.
+        float serverConnectionRequestSubnetRate;                ///< Connection requests per-second admitted by the Server from each source subnet (/24 for IPv4, /48 for IPv6). Set to zero to only limit per-address. Only used if ClientServerConfig::serverConnectionRequestRate is non-zero.
+        float serverConnectionRequestSubnetBurst;               ///< The number of connection requests a source subnet may send in a burst before being limited to ClientServerConfig::serverConnectionRequestSubnetRate.
+        int serverConnectionRequestBuckets;                     ///< Number of rate limiting buckets in the Server connection request limiter, shared between addresses and subnets. If this is zero, maxClients * ConnectionRequestBucketsPerClient buckets are allocated in Server::Start.
+        float serverClientSendRate;                             ///< Default rate the Server sends connection packets to each client (packets per-second). Set to zero to send a connection packet to each client on every call to Server::SendPackets. Override per-client with Server::SetClientSendRate, eg. a lower rate for spectators.
+        bool serverSendIdleClients;                             ///< If this is false the Server only sends a connection packet to a client when it has messages to send to that client, or it has received connection packets from that client that it hasn't acked yet. Idle clients are sent keep-alive packets instead. If this is true the Server sends a connection packet to every connected client at its send rate.
+        bool clientSendIdle;                                    ///< If this is false the Client only sends a connection packet when it has messages to send to the server, or it has received connection packets with messages from the server that it hasn't acked yet. Otherwise it sends keep-alive packets. If this is true the Client sends a connection packet on every call to Client::SendPackets.
         bool enableMessages;                                    ///< If this is true then you can send messages between client and server. Set to false if you don't want to use messages and you want to extend the protocol by adding new packet types instead.
+        bool serverReserveClientMemory;                         ///< If this is true the Server reserves the per-client memory for each client slot from the operating system, instead of allocating it with the allocator passed in to the Server. Physical memory is only committed as a client slot uses it, and the free memory of a client slot is given back to the operating system when its client disconnects, so a server with many client slots needs much less resident memory when it isn't full. Connecting a client still does not allocate.
+        bool serverHugePageMemory;                              ///< If this is true the Server backs its global memory and the per-client memory for each client slot with huge pages reserved from the operating system, instead of allocating them with the allocator passed in to the Server. This cuts TLB misses when packets, messages and connections are spread across many megabytes of client memory. Memory sizes are rounded up to a whole number of huge pages. If huge pages aren't available the memory falls back to regular pages (with a transparent huge page hint on Linux). The free memory of a client slot is not given back to the operating system in this mode, even if serverReserveClientMemory is true, since that would break up its huge pages. See Server::IsUsingHugePages.
+        int serverNumaNode;                                     ///< The NUMA node to place the Server global memory and per-client memory on, or -1 to leave placement to the operating system (default). Set this to the node of the cores the threads updating the server are pinned to, eg. one node per server in a ServerGroup on a multi-socket host, so packet processing doesn't read and write memory across sockets. The memory is reserved from the operating system when this is set. Only supported on Linux. See platform_thread_set_affinity and platform_cpu_numa_node.
+        int serverPrewarmedClients;                             ///< The number of client slots whose per-client resources (packet factory, replay protection, message factory and connection) are created in Server::Start. The other slots create them the first time a client connects to the slot, and keep them after it disconnects. Negative creates them for every slot in Server::Start (default). Lower this for servers with many client slots and large channel queues, so Start returns without touching most of the per-client memory. Pre-warmed slots are created with the job scheduler if the server has one. See Server::SetJobScheduler.
+        int clientNetworkThreadCpu;                             ///< The CPU core to pin the Client network thread to, or -1 to let the operating system schedule it (default). See Client::StartNetworkThread and platform_thread_set_affinity.
+        bool clientPersistentResources;                         ///< If this is true the Client keeps its allocator, packet factory, replay protection, message factory and connection when it disconnects, and resets them on the next connect instead of creating them again. This makes reconnects cheap for clients that connect and disconnect often, at the cost of holding on to ClientServerConfig::clientMemory while disconnected. Everything is freed when the client is destroyed.
+        bool enableStatelessChallenge;                          ///< If this is true the server keeps no state for a client until it receives a valid challenge response. Challenge tokens carry the connect token keys, and the connect token entry and encryption mapping are added only once the challenge response is accepted. Challenge response packets are sent unencrypted in this mode, so this must be identical between client and server.
+        bool enableResumeTokens;                                ///< If this is true the server issues each connected client a resume token in its keep-alive packets. A client that disconnects can pass it back to the server with Client::Resume to connect again in one round trip, skipping the connect token and the challenge. Resume request packets are sent unencrypted in this mode, so this must be identical between client and server.
+        float resumeTokenTimeOut;                               ///< How long a resume token stays valid after the server issues it (seconds). The server issues connected clients a fresh resume token each time a third of this has passed, so a client can resume for at least two thirds of this time after it disconnects. Only used if enableResumeTokens is true.
+        bool enableServerPing;                                  ///< If this is true the server replies to ping packets from any address, and a client connecting with a connect token that lists more than one server pings all of them first, then tries them in order of lowest round trip time. Ping and pong packets are sent unencrypted in this mode, so this must be identical between client and server.
+        float clientPingTimeOut;                                ///< How long the client waits for pongs before connecting (seconds). The client connects as soon as every server has replied. Servers that don't reply in time are tried last, in their original order. Only used if enableServerPing is true.
+        float serverPingRate;                                   ///< Pings per-second the Server replies to from each source address (IP only, ignoring port). Excess pings are dropped. Set to zero to reply to every ping. Only used if enableServerPing is true.
+        float serverPingBurst;                                  ///< The number of pings a source address may send in a burst before being limited to ClientServerConfig::serverPingRate.
+        float serverTickBudget;                                 ///< The time the Server may spend in Server::AdvanceTime, Server::ReceivePackets and Server::SendPackets each tick before it sheds load (seconds). Once a tick goes over budget the Server is overloaded: low priority clients are sent connection packets at no more than serverOverloadSendRate, block fragments are held back and Server::ReceivePackets processes at most serverOverloadReceivePackets packets per-call. It recovers once a tick takes less than half the budget. Set to zero to never shed load. See Server::IsOverloaded.
+        float serverOverloadSendRate;                           ///< The most connection packets per-second the Server sends to each low priority client while it is overloaded. See Server::SetClientLowPriority. Set to zero to keep the send rate of low priority clients when overloaded.
+        int serverOverloadReceivePackets;                       ///< The most packets processed by each call to Server::ReceivePackets while the Server is overloaded. The rest wait in the transport receive queue for the next call. Set to zero to process every packet when overloaded.
+        PacketCipher packetCipher;                              ///< The cipher used to encrypt packets between client and server. Defaults to XSalsa20-Poly1305. Use IsPacketCipherAvailable to check for AES-256-GCM support at runtime before selecting it. Must be identical between client and server. Connect tokens and challenge tokens are always encrypted with ChaCha20-Poly1305, so tokens from the matcher work regardless of the packet cipher.
         ConnectionConfig connectionConfig;                      ///< Configures connection properties and message channels between client and server. Must be identical between client and server to work properly. Only used if enableMessages is true.
 
         ClientServerConfig()
@@ -277,8 +656,37 @@ namespace yojimbo
             connectionNegotiationSendRate = 10.0f;
             connectionNegotiationTimeOut = 5.0f;
             connectionKeepAliveSendRate = 10.0f;
+            connectionIdleKeepAliveSendRate = 0.0f;
             connectionTimeOut = 5.0f;
+            clientConnectRaceServers = 1;
+            serverConnectTokenEntries = 0;
+            serverConnectTokenCacheEntries = 0;
+            serverConnectionRequestRate = 0.0f;
+            serverConnectionRequestBurst = 20.0f;
+            serverConnectionRequestSubnetRate = 0.0f;
+            serverConnectionRequestSubnetBurst = 100.0f;
+            serverConnectionRequestBuckets = 0;
+            serverClientSendRate = 0.0f;
+            serverSendIdleClients = true;
+            clientSendIdle = true;
             enableMessages = true;
+            enableStatelessChallenge = false;
+            enableResumeTokens = false;
+            resumeTokenTimeOut = 60.0f;
+            enableServerPing = false;
+            clientPingTimeOut = 0.5f;
+            serverPingRate = 10.0f;
+            serverPingBurst = 10.0f;
+            serverTickBudget = 0.0f;
+            serverOverloadSendRate = 10.0f;
+            serverOverloadReceivePackets = 256;
+            serverReserveClientMemory = false;
+            serverHugePageMemory = false;
+            serverNumaNode = -1;
+            serverPrewarmedClients = -1;
+            clientNetworkThreadCpu = -1;
+            clientPersistentResources = false;
+            packetCipher = PACKET_CIPHER_XSALSA20_POLY1305;
         }
     };
 }
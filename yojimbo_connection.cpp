@@ -24,30 +24,71 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_connection.h"
+#include "yojimbo_profile.h"
+#include "yojimbo_platform.h"
+#include <math.h>
 
 namespace yojimbo
 {
-    ConnectionPacket::ConnectionPacket()
+    ConnectionPacket::ConnectionPacket() : m_arena( ConnectionPacketArenaSize )
     {
         m_messageFactory = NULL;
         sequence = 0;
         ack = 0;
-        ack_bits = 0;
+        memset( ack_bits, 0, sizeof( ack_bits ) );
+        memset( receiveWindow, 0, sizeof( receiveWindow ) );
         numChannelEntries = 0;
         channelEntry = NULL;
+        probeBytes = 0;
+        sendTime = 0;
+        sequenceBits = 16;
+        m_channelEntryAllocator = NULL;
+        m_maxChannelEntries = 0;
+        m_serializedBytes = 0;
     }
 
     ConnectionPacket::~ConnectionPacket()
     {
-        if ( m_messageFactory )
+        if ( m_messageFactory && channelEntry )
         {
             for ( int i = 0; i < numChannelEntries; ++i )
             {
                 channelEntry[i].Free( *m_messageFactory );
             }
+        }
+
+        m_arena.Reset();
+
+        if ( m_channelEntryAllocator )
+        {
+            YOJIMBO_FREE( *m_channelEntryAllocator, channelEntry );
+        }
+    }
 
-            YOJIMBO_FREE( m_messageFactory->GetAllocator(), channelEntry );
+    bool ConnectionPacket::Recycle()
+    {
+        if ( m_messageFactory && channelEntry )
+        {
+            for ( int i = 0; i < numChannelEntries; ++i )
+            {
+                channelEntry[i].Free( *m_messageFactory );
+            }
         }
+
+        m_arena.Reset();
+
+        m_messageFactory = NULL;
+        sequence = 0;
+        ack = 0;
+        memset( ack_bits, 0, sizeof( ack_bits ) );
+        memset( receiveWindow, 0, sizeof( receiveWindow ) );
+        numChannelEntries = 0;
+        probeBytes = 0;
+        sendTime = 0;
+        sequenceBits = 16;
+        m_serializedBytes = 0;
+
+        return true;
     }
 
     bool ConnectionPacket::AllocateChannelData( MessageFactory & messageFactory, int numEntries )
@@ -59,13 +100,31 @@ namespace yojimbo
 
         Allocator & allocator = messageFactory.GetAllocator();
 
-        channelEntry = (ChannelPacketData*) YOJIMBO_ALLOCATE( allocator, sizeof( ChannelPacketData ) * numEntries );
-        if ( channelEntry == NULL )
-            return false;
+        // a recycled packet reuses its channel entry array if it is big enough and came from the same allocator
+
+        if ( channelEntry && ( m_channelEntryAllocator != &allocator || m_maxChannelEntries < numEntries ) )
+        {
+            YOJIMBO_FREE( *m_channelEntryAllocator, channelEntry );
+            m_channelEntryAllocator = NULL;
+            m_maxChannelEntries = 0;
+        }
+
+        if ( !channelEntry )
+        {
+            channelEntry = (ChannelPacketData*) YOJIMBO_ALLOCATE( allocator, sizeof( ChannelPacketData ) * numEntries );
+            if ( channelEntry == NULL )
+            {
+                numChannelEntries = 0;
+                return false;
+            }
+
+            m_channelEntryAllocator = &allocator;
+            m_maxChannelEntries = numEntries;
+        }
 
         for ( int i = 0; i < numEntries; ++i )
         {
-            channelEntry[i].Initialize();
+            channelEntry[i].Initialize( &m_arena );
         }
 
         numChannelEntries = numEntries;
@@ -73,7 +132,162 @@ namespace yojimbo
         return true;
     }
 
-    template <typename Stream> bool ConnectionPacket::Serialize( Stream & stream )
+    static inline bool has_flow_control( const ChannelConfig & channelConfig )
+    {
+        return channelConfig.type == CHANNEL_TYPE_RELIABLE_ORDERED && channelConfig.flowControl;
+    }
+
+    static inline int receive_window_bits( const ConnectionConfig & connectionConfig )
+    {
+        int bits = 0;
+        for ( int i = 0; i < connectionConfig.numChannels; ++i )
+        {
+            if ( has_flow_control( connectionConfig.channel[i] ) )
+                bits += 16;
+        }
+        return bits;
+    }
+
+    static inline int send_time_bits( const ConnectionConfig & connectionConfig )
+    {
+        return connectionConfig.enableClockSync ? 32 : 0;
+    }
+
+    static inline uint32_t get_ack_bit( const uint32_t * ack_bits, int index )
+    {
+        return ( ack_bits[index/32] >> ( index % 32 ) ) & 1;
+    }
+
+    static inline int get_ack_run_length( const uint32_t * ack_bits, int index, int numBits, uint32_t value )
+    {
+        int end = index;
+        while ( end < numBits && get_ack_bit( ack_bits, end ) == value )
+            end++;
+        return end - index;
+    }
+
+    template <typename Stream> bool serialize_ack_bits( Stream & stream, uint32_t * ack_bits, int numBits )
+    {
+        assert( numBits > 0 );
+        assert( numBits <= MaxAckWindowSize );
+        assert( ( numBits % 32 ) == 0 );
+
+        // IMPORTANT: Ack bits are usually long runs of received packets broken up by a few lost ones, so they are sent as alternating runs of set and clear bits, starting with set bits. If the runs would take more bits than the ack bits themselves, the raw ack bits are sent instead.
+
+        bool run_length = false;
+
+        if ( Stream::IsWriting )
+        {
+            int runLengthBits = 0;
+            uint32_t value = 1;
+            for ( int index = 0; index < numBits; value ^= 1 )
+            {
+                const int run = get_ack_run_length( ack_bits, index, numBits, value );
+                runLengthBits += varint_bits( index == 0 ? run : run - 1 );
+                index += run;
+            }
+            run_length = runLengthBits < numBits;
+        }
+
+        serialize_bool( stream, run_length );
+
+        if ( !run_length )
+        {
+            for ( int i = 0; i < numBits / 32; ++i )
+                serialize_bits( stream, ack_bits[i], 32 );
+            return true;
+        }
+
+        if ( Stream::IsReading )
+            memset( ack_bits, 0, numBits / 8 );
+
+        uint32_t value = 1;
+
+        for ( int index = 0; index < numBits; value ^= 1 )
+        {
+            // IMPORTANT: Only the first run can be empty, so run lengths after it are sent minus one. This also guarantees the loop terminates on read.
+
+            uint32_t encoded = 0;
+
+            if ( Stream::IsWriting )
+            {
+                const int run = get_ack_run_length( ack_bits, index, numBits, value );
+                encoded = uint32_t( index == 0 ? run : run - 1 );
+            }
+
+            serialize_varint( stream, encoded );
+
+            const uint32_t run = ( index == 0 ) ? encoded : encoded + 1;
+
+            if ( run > uint32_t( numBits - index ) )
+                return false;
+
+            if ( Stream::IsReading && value )
+            {
+                for ( int i = index; i < index + int( run ); ++i )
+                    ack_bits[i/32] |= uint32_t( 1 ) << ( i % 32 );
+            }
+
+            index += int( run );
+        }
+
+        return true;
+    }
+
+    template <typename Stream> bool serialize_compressed_ack( Stream & stream, uint16_t sequence, uint16_t & ack )
+    {
+        // IMPORTANT: The ack is sent as its distance behind the sequence, which takes one bit when the two sides send packets in lockstep. An ack equal to the sequence is sent as a distance of 65536.
+
+        uint32_t distance = 0;
+
+        if ( Stream::IsWriting )
+        {
+            distance = uint16_t( sequence - ack );
+            if ( distance == 0 )
+                distance = 65536;
+        }
+
+        serialize_int_relative( stream, uint32_t( 0 ), distance );
+
+        if ( distance > 65536 )
+            return false;
+
+        if ( Stream::IsReading )
+            ack = uint16_t( sequence - distance );
+
+        return true;
+    }
+
+    template <typename Stream> bool serialize_padding( Stream & stream, int bytes )
+    {
+        // IMPORTANT: Padding is filled with noise rather than zeros, so probe packets keep their size if packets are compressed.
+
+        uint8_t padding[64];
+
+        uint32_t seed = 0x9E3779B9;
+
+        while ( bytes > 0 )
+        {
+            const int chunkBytes = min( bytes, (int) sizeof( padding ) );
+
+            if ( Stream::IsWriting )
+            {
+                for ( int i = 0; i < chunkBytes; ++i )
+                {
+                    seed = seed * 1664525 + 1013904223;
+                    padding[i] = uint8_t( seed >> 24 );
+                }
+            }
+
+            serialize_bytes( stream, padding, chunkBytes );
+
+            bytes -= chunkBytes;
+        }
+
+        return true;
+    }
+
+    template <typename Stream> bool ConnectionPacket::Serialize( Stream & stream, PacketBitCounters * bitCounters )
     {
         ConnectionContext * context = (ConnectionContext*) stream.GetContext();
 
@@ -85,29 +299,143 @@ namespace yojimbo
         assert( context->messageFactory );
         assert( context->connectionConfig );
 
+        const int startBits = stream.GetBitsProcessed();
+
         // ack system
 
-        bool perfect_acks = Stream::IsWriting ? ( ack_bits == 0xFFFFFFFF ) : 0;
+        const int ackWindowSize = context->connectionConfig->ackWindowSize;
+
+        bool perfect_acks = false;
+
+        if ( Stream::IsWriting )
+        {
+            perfect_acks = true;
+            for ( int i = 0; i < ackWindowSize / 32; ++i )
+            {
+                if ( ack_bits[i] != 0xFFFFFFFF )
+                    perfect_acks = false;
+            }
+        }
 
         serialize_bool( stream, perfect_acks );
 
         if ( !perfect_acks )
-            serialize_bits( stream, ack_bits, 32 );
+        {
+            if ( !serialize_ack_bits( stream, ack_bits, ackWindowSize ) )
+                return false;
+        }
         else
-            ack_bits = 0xFFFFFFFF;
+        {
+            for ( int i = 0; i < ackWindowSize / 32; ++i )
+                ack_bits[i] = 0xFFFFFFFF;
+        }
+
+        const bool compressHeader = context->connectionConfig->compressPacketHeader;
+
+        if ( compressHeader )
+        {
+            bool truncated = Stream::IsWriting && sequenceBits < 16;
+
+            serialize_bool( stream, truncated );
+
+            if ( truncated )
+            {
+                uint32_t lowBits = sequence & ( ( 1 << CompressedSequenceBits ) - 1 );
+                serialize_bits( stream, lowBits, CompressedSequenceBits );
+                if ( Stream::IsReading )
+                    sequence = uint16_t( lowBits );
+            }
+            else
+            {
+                serialize_bits( stream, sequence, 16 );
+            }
 
-        serialize_bits( stream, sequence, 16 );
+            if ( Stream::IsReading )
+                sequenceBits = truncated ? CompressedSequenceBits : 16;
+
+            if ( !serialize_compressed_ack( stream, sequence, ack ) )
+                return false;
+        }
+        else
+        {
+            serialize_bits( stream, sequence, 16 );
 
-        serialize_ack_relative( stream, sequence, ack );
+            serialize_ack_relative( stream, sequence, ack );
+        }
 
         // channel entries
 
         const int numChannels = context->connectionConfig->numChannels;
 
-        serialize_int( stream, numChannelEntries, 0, context->connectionConfig->numChannels );
+        uint64_t channelMask = 0;
+
+        if ( compressHeader )
+        {
+            // IMPORTANT: One bit per channel says whether the channel has an entry in the packet. Entries are written in channel order, so their channel ids are implied by the mask.
+
+            if ( Stream::IsWriting )
+            {
+                for ( int i = 1; i < numChannelEntries; ++i )
+                {
+                    for ( int j = i; j > 0 && channelEntry[j-1].channelId > channelEntry[j].channelId; --j )
+                    {
+                        ChannelPacketData temp = channelEntry[j];
+                        channelEntry[j] = channelEntry[j-1];
+                        channelEntry[j-1] = temp;
+                    }
+                }
+
+                for ( int i = 0; i < numChannelEntries; ++i )
+                {
+                    assert( ( channelMask & ( uint64_t( 1 ) << channelEntry[i].channelId ) ) == 0 );
+                    channelMask |= uint64_t( 1 ) << channelEntry[i].channelId;
+                }
+            }
+            else
+            {
+                numChannelEntries = 0;
+            }
+
+            for ( int i = 0; i < numChannels; ++i )
+            {
+                bool hasEntry = ( channelMask >> i ) & 1;
+
+                serialize_bool( stream, hasEntry );
+
+                if ( Stream::IsReading && hasEntry )
+                {
+                    channelMask |= uint64_t( 1 ) << i;
+                    numChannelEntries++;
+                }
+            }
+        }
+        else
+        {
+            serialize_int( stream, numChannelEntries, 0, context->connectionConfig->numChannels );
+        }
+
+        // receive windows. sent in every packet, whether or not the channel has an entry, so the sender finds out as soon as messages are dequeued
+
+        for ( int i = 0; i < numChannels; ++i )
+        {
+            if ( has_flow_control( context->connectionConfig->channel[i] ) )
+                serialize_bits( stream, receiveWindow[i], 16 );
+        }
+
+        if ( context->connectionConfig->enableClockSync )
+            serialize_uint32( stream, sendTime );
+
+        // path MTU probes are only sent with path MTU discovery enabled, so the padded flag is only sent then
+
+        bool padded = probeBytes > 0;
+
+        assert( !padded || context->connectionConfig->enableMtuDiscovery );
+
+        if ( context->connectionConfig->enableMtuDiscovery )
+            serialize_bool( stream, padded );
 
 #if YOJIMBO_VALIDATE_PACKET_BUDGET
-        assert( stream.GetBitsProcessed() <= ConservativeConnectionPacketHeaderEstimate );
+        assert( stream.GetBitsProcessed() - startBits <= ConservativeConnectionPacketHeaderEstimate + ackWindowSize - 32 + ( compressHeader ? numChannels : 0 ) + receive_window_bits( *context->connectionConfig ) + send_time_bits( *context->connectionConfig ) );
 #endif // #if YOJIMBO_VALIDATE_PACKET_BUDGET
 
         if ( numChannelEntries > 0 )
@@ -124,13 +452,23 @@ namespace yojimbo
                 {
                     assert( channelEntry[i].messageFailedToSerialize == 0 );
                 }
+
+                if ( compressHeader )
+                {
+                    for ( int i = 0, channelId = 0; i < numChannelEntries; ++i, ++channelId )
+                    {
+                        while ( ( ( channelMask >> channelId ) & 1 ) == 0 )
+                            channelId++;
+                        channelEntry[i].channelId = channelId;
+                    }
+                }
             }
 
             for ( int i = 0; i < numChannelEntries; ++i )
             {
                 assert( channelEntry[i].messageFailedToSerialize == 0 );
 
-                if ( !channelEntry[i].SerializeInternal( stream, *m_messageFactory, context->connectionConfig->channel, numChannels ) )
+                if ( !channelEntry[i].SerializeInternal( stream, *m_messageFactory, context->connectionConfig->channel, numChannels, bitCounters, compressHeader, context->channels ) )
                 {
                     debug_printf( "error: failed to serialize channel %d\n", i );
                     return false;
@@ -138,27 +476,218 @@ namespace yojimbo
             }
         }
 
+        // path MTU probes are padded out to the probe size after the channel data
+
+        if ( padded )
+        {
+            const int maxPaddingBytes = context->connectionConfig->maxPacketSize;
+
+            int paddingBytes = 0;
+
+            if ( Stream::IsWriting )
+            {
+                const int bytesWritten = ( stream.GetBitsProcessed() - startBits + bits_required( 0, maxPaddingBytes ) + 7 ) / 8;
+                paddingBytes = min( max( probeBytes - bytesWritten, 0 ), maxPaddingBytes );
+            }
+
+            serialize_int( stream, paddingBytes, 0, maxPaddingBytes );
+
+            if ( !serialize_padding( stream, paddingBytes ) )
+                return false;
+        }
+
+        if ( Stream::IsReading )
+            m_serializedBytes = stream.GetBytesProcessed();
+
         return true;
     }
 
     bool ConnectionPacket::SerializeInternal( ReadStream & stream )
     {
-        return Serialize( stream );
+        return Serialize( stream, NULL );
     }
 
     bool ConnectionPacket::SerializeInternal( WriteStream & stream )
     {
-        return Serialize( stream );
+        ConnectionContext * context = (ConnectionContext*) stream.GetContext();
+
+        // IMPORTANT: definitions of interned strings written to this packet are recorded against its sequence number, so they can be sent by id once it is acked
+
+        if ( context && context->stringDictionary )
+            context->stringDictionary->BeginPacket( sequence );
+
+        return Serialize( stream, context ? context->bitCounters : NULL );
     }
 
     bool ConnectionPacket::SerializeInternal( MeasureStream & stream )
     {
-        return Serialize( stream );
+        return Serialize( stream, NULL );
+    }
+
+    LedbatCongestionController::LedbatCongestionController( float targetDelay, int maxPacketSize )
+    {
+        assert( targetDelay > 0.0f );
+        assert( maxPacketSize > 0 );
+
+        m_targetDelay = targetDelay;
+        m_maxPacketSize = maxPacketSize;
+
+        Reset();
+    }
+
+    // IMPORTANT: Constants as per RFC 6817. The window is measured in multiples of the maximum packet size.
+
+    static const int LedbatInitialWindow = 2;
+    static const int LedbatMinWindow = 2;
+    static const int LedbatAllowedIncrease = 1;
+    static const double LedbatGain = 1.0;
+    static const double LedbatBaseDelayInterval = 60.0;
+
+    void LedbatCongestionController::Reset()
+    {
+        m_congestionWindow = LedbatInitialWindow * m_maxPacketSize;
+        m_bytesInFlight = 0;
+        m_rtt = 0.0f;
+        m_baseDelay[0] = -1.0f;
+        m_baseDelay[1] = -1.0f;
+        m_baseDelayTime = -1.0;
+        m_lastLossTime = -1.0;
+    }
+
+    void LedbatCongestionController::OnPacketSent( double time, int packetBytes )
+    {
+        (void) time;
+        m_bytesInFlight += packetBytes;
+    }
+
+    void LedbatCongestionController::OnPacketAcked( double time, int packetBytes, float rtt )
+    {
+        const int flightSize = m_bytesInFlight;
+
+        m_bytesInFlight = max( 0, m_bytesInFlight - packetBytes );
+
+        if ( rtt < 0.0f )
+            return;
+
+        m_rtt = rtt;
+
+        if ( m_baseDelayTime < 0.0 )
+        {
+            m_baseDelay[0] = rtt;
+            m_baseDelayTime = time;
+        }
+        else if ( time - m_baseDelayTime >= LedbatBaseDelayInterval )
+        {
+            m_baseDelay[1] = m_baseDelay[0];
+            m_baseDelay[0] = rtt;
+            m_baseDelayTime = time;
+        }
+        else
+        {
+            m_baseDelay[0] = min( m_baseDelay[0], rtt );
+        }
+
+        const double queuingDelay = rtt - GetBaseDelay();
+
+        const double offTarget = ( m_targetDelay - queuingDelay ) / m_targetDelay;
+
+        const double windowChange = LedbatGain * offTarget * packetBytes * m_maxPacketSize / m_congestionWindow;
+
+        if ( windowChange > 0.0 )
+        {
+            // IMPORTANT: Don't grow the window past what is actually being used, otherwise an application that sends less than the window allows builds up a huge window, then floods the link when it starts sending more.
+
+            const double maxWindow = (double) flightSize + LedbatAllowedIncrease * m_maxPacketSize;
+
+            m_congestionWindow = max( m_congestionWindow, min( m_congestionWindow + windowChange, maxWindow ) );
+        }
+        else
+        {
+            m_congestionWindow = max( (double) LedbatMinWindow * m_maxPacketSize, m_congestionWindow + windowChange );
+        }
+    }
+
+    void LedbatCongestionController::OnPacketLost( double time, int packetBytes )
+    {
+        m_bytesInFlight = max( 0, m_bytesInFlight - packetBytes );
+
+        if ( m_lastLossTime >= 0.0 && time - m_lastLossTime < m_rtt )
+            return;
+
+        m_congestionWindow = max( (double) LedbatMinWindow * m_maxPacketSize, m_congestionWindow / 2 );
+
+        m_lastLossTime = time;
+    }
+
+    int LedbatCongestionController::GetAvailableBytes() const
+    {
+        return max( 0, int( m_congestionWindow ) - m_bytesInFlight );
+    }
+
+    float LedbatCongestionController::GetBaseDelay() const
+    {
+        if ( m_baseDelay[1] < 0.0f )
+            return max( m_baseDelay[0], 0.0f );
+        return min( m_baseDelay[0], m_baseDelay[1] );
+    }
+
+    // ------------------------------------------------------------------------------------------------------
+
+    // IMPORTANT: channel types are a closed set fixed by the connection config, so the calls the connection makes on every channel for every packet switch on the type and call the concrete channel directly instead of going through the vtable.
+
+    #define YOJIMBO_CHANNEL_DISPATCH( type, channel, call )                                                                             \
+        switch ( type )                                                                                                                 \
+        {                                                                                                                               \
+            case CHANNEL_TYPE_RELIABLE_ORDERED:         return ( (ReliableOrderedChannel*) channel )->ReliableOrderedChannel::call;                \
+            case CHANNEL_TYPE_UNRELIABLE_UNORDERED:     return ( (UnreliableUnorderedChannel*) channel )->UnreliableUnorderedChannel::call;        \
+            case CHANNEL_TYPE_SNAPSHOT:                 return ( (SnapshotChannel*) channel )->SnapshotChannel::call;                              \
+            case CHANNEL_TYPE_UNRELIABLE_SEQUENCED:     return ( (UnreliableSequencedChannel*) channel )->UnreliableSequencedChannel::call;        \
+            case CHANNEL_TYPE_UNRELIABLE_LATEST_STATE:  return ( (UnreliableLatestStateChannel*) channel )->UnreliableLatestStateChannel::call;    \
+            default:                                    return channel->call;                                                                  \
+        }
+
+    static bool ChannelHasMessagesToSend( ChannelType type, Channel * channel )
+    {
+        YOJIMBO_CHANNEL_DISPATCH( type, channel, HasMessagesToSend() );
+    }
+
+    static void ChannelSendMsg( ChannelType type, Channel * channel, Message * message )
+    {
+        YOJIMBO_CHANNEL_DISPATCH( type, channel, SendMsg( message ) );
+    }
+
+    static int ChannelGetPacketData( ChannelType type, Channel * channel, ChannelPacketData & packetData, uint16_t packetSequence, int availableBits, Allocator * packetAllocator )
+    {
+        YOJIMBO_ZONE( "channel_get_packet_data" );
+        YOJIMBO_CHANNEL_DISPATCH( type, channel, GetPacketData( packetData, packetSequence, availableBits, packetAllocator ) );
+    }
+
+    static void ChannelProcessPacketData( ChannelType type, Channel * channel, const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        YOJIMBO_CHANNEL_DISPATCH( type, channel, ProcessPacketData( packetData, packetSequence ) );
+    }
+
+    static void ChannelProcessAck( ChannelType type, Channel * channel, uint16_t sequence )
+    {
+        YOJIMBO_CHANNEL_DISPATCH( type, channel, ProcessAck( sequence ) );
+    }
+
+    static void ChannelAdvanceTime( ChannelType type, Channel * channel, double time )
+    {
+        YOJIMBO_CHANNEL_DISPATCH( type, channel, AdvanceTime( time ) );
     }
 
-    Connection::Connection( Allocator & allocator, PacketFactory & packetFactory, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig ) : m_connectionConfig( connectionConfig )
+    #undef YOJIMBO_CHANNEL_DISPATCH
+
+    Connection::Connection( Allocator & allocator, PacketFactory & packetFactory, MessageFactory & messageFactory, const ConnectionConfig & connectionConfig ) 
+        : m_connectionConfig( connectionConfig ), m_defaultCongestionController( connectionConfig.congestionTargetDelay, connectionConfig.maxPacketSize )
     {
         assert( ( 65536 % connectionConfig.slidingWindowSize ) == 0 );
+        assert( connectionConfig.ackWindowSize >= 32 );
+        assert( connectionConfig.ackWindowSize <= MaxAckWindowSize );
+        assert( ( connectionConfig.ackWindowSize % 32 ) == 0 );
+        assert( connectionConfig.ackWindowSize <= connectionConfig.slidingWindowSize );
+        assert( connectionConfig.ackDelay >= 0.0f );
 
         m_allocator = &allocator;
 
@@ -189,17 +718,61 @@ namespace yojimbo
                     m_channel[channelId] = YOJIMBO_NEW( *m_allocator, UnreliableUnorderedChannel, *m_allocator, messageFactory, m_connectionConfig.channel[channelId], channelId ); 
                     break;
 
+                case CHANNEL_TYPE_SNAPSHOT: 
+                    m_channel[channelId] = YOJIMBO_NEW( *m_allocator, SnapshotChannel, *m_allocator, messageFactory, m_connectionConfig.channel[channelId], channelId ); 
+                    break;
+
+                case CHANNEL_TYPE_UNRELIABLE_SEQUENCED: 
+                    m_channel[channelId] = YOJIMBO_NEW( *m_allocator, UnreliableSequencedChannel, *m_allocator, messageFactory, m_connectionConfig.channel[channelId], channelId ); 
+                    break;
+
+                case CHANNEL_TYPE_UNRELIABLE_LATEST_STATE: 
+                    m_channel[channelId] = YOJIMBO_NEW( *m_allocator, UnreliableLatestStateChannel, *m_allocator, messageFactory, m_connectionConfig.channel[channelId], channelId ); 
+                    break;
+
                 default: 
                     assert( !"unknown channel type" );
             }
 
             m_channel[channelId]->SetListener( this );
+
+            assert( m_connectionConfig.channel[channelId].weight >= 1 );
+        }
+
+        // sort channels by descending priority for channel scheduling. insertion sort is stable, so channels with the same priority stay in channel id order
+
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            int j = i;
+            while ( j > 0 && m_connectionConfig.channel[m_channelOrder[j-1]].priority < m_connectionConfig.channel[i].priority )
+            {
+                m_channelOrder[j] = m_channelOrder[j-1];
+                j--;
+            }
+            m_channelOrder[j] = i;
         }
 
         m_sentPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<ConnectionSentPacketData>, *m_allocator, m_connectionConfig.slidingWindowSize );
         
         m_receivedPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<ConnectionReceivedPacketData>, *m_allocator, m_connectionConfig.slidingWindowSize );
 
+        m_unackedPackets = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, m_connectionConfig.slidingWindowSize );
+
+        assert( m_connectionConfig.maxInternedStrings >= 0 );
+        assert( m_connectionConfig.maxInternedStrings <= MaxInternedStrings );
+
+        m_stringDictionary = NULL;
+        if ( m_connectionConfig.maxInternedStrings > 0 )
+            m_stringDictionary = YOJIMBO_NEW( *m_allocator, StringDictionary, *m_allocator, m_connectionConfig.maxInternedStrings, m_connectionConfig.maxInternedStringLength, m_connectionConfig.slidingWindowSize );
+
+        m_bitCounters.numMessageTypes = messageFactory.GetNumTypes();
+        m_bitCounters.messageTypeBits = (uint64_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint64_t ) * m_bitCounters.numMessageTypes );
+
+        m_time = -1.0;
+        m_platformTime = 0.0;
+
+        m_congestionController = connectionConfig.enableCongestionControl ? &m_defaultCongestionController : NULL;
+
         Reset();
     }
 
@@ -212,6 +785,10 @@ namespace yojimbo
 
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<ConnectionSentPacketData>, m_sentPackets );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<ConnectionReceivedPacketData>, m_receivedPackets );
+        YOJIMBO_DELETE( *m_allocator, BitArray, m_unackedPackets );
+        YOJIMBO_DELETE( *m_allocator, StringDictionary, m_stringDictionary );
+
+        YOJIMBO_FREE( *m_allocator, m_bitCounters.messageTypeBits );
     }
 
     void Connection::Reset()
@@ -221,35 +798,180 @@ namespace yojimbo
         for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
             m_channel[i]->Reset();
 
+        // IMPORTANT: Unacked bits left over from before the reset are harmless. They are only used to mask acks, and each acked sequence is still looked up in the sent packet buffer, which is now empty.
+
         m_sentPackets->Reset();
         m_receivedPackets->Reset();
 
+        if ( m_stringDictionary )
+            m_stringDictionary->Reset();
+
         memset( m_counters, 0, sizeof( m_counters ) );
+
+        memset( m_bitCounters.channelBits, 0, sizeof( m_bitCounters.channelBits ) );
+        memset( m_bitCounters.channelFragmentBits, 0, sizeof( m_bitCounters.channelFragmentBits ) );
+        memset( m_bitCounters.messageTypeBits, 0, sizeof( uint64_t ) * m_bitCounters.numMessageTypes );
+
+        m_bandwidthTime = -1.0;
+        m_hasRTT = false;
+        m_networkInfo = NetworkInfo();
+        m_bytesSent = 0;
+        m_bytesReceived = 0;
+        m_bytesAcked = 0;
+
+        if ( m_congestionController )
+            m_congestionController->Reset();
+
+        memset( m_channelDeficit, 0, sizeof( m_channelDeficit ) );
+        m_channelRoundRobin = 0;
+
+        const int maxProbeBytes = min( m_connectionConfig.mtuDiscoveryMaxPacketSize, m_connectionConfig.maxPacketSize );
+
+        m_pathMaxPacketSize = m_connectionConfig.enableMtuDiscovery ? min( m_connectionConfig.mtuDiscoveryMinPacketSize, maxProbeBytes ) : m_connectionConfig.maxPacketSize;
+        m_mtuSearchLimit = maxProbeBytes + 1;
+        m_mtuProbeBytes = 0;
+        m_mtuProbeAttempts = 0;
+        m_mtuProbeTime = -1.0;
+        m_mtuSearchTime = -1.0;
+
+        m_hasAckedPacket = false;
+        m_ackPending = false;
+        m_ackPendingTime = 0.0;
+        m_mostRecentAckedSequence = 0;
+
+        m_clockSyncReceivedPacket = false;
+        m_hasRemoteTickInterval = false;
+        m_remoteSendTime = 0;
+        m_remoteTime = 0.0;
+        m_remoteReceiveTime = 0.0;
+        m_clockSyncOffset[0] = m_clockSyncOffset[1] = 0.0;
+        m_remoteTickInterval[0] = m_remoteTickInterval[1] = 0.0;
+        m_clockSyncWindowStart = 0.0;
+    }
+
+    template <typename Stream> bool Connection::SerializeStateInternal( Stream & stream )
+    {
+        if ( Stream::IsReading )
+            Reset();
+
+        uint16_t sentPacketSequence = m_sentPackets->GetSequence();
+        uint16_t receivedPacketSequence = m_receivedPackets->GetSequence();
+
+        serialize_bits( stream, sentPacketSequence, 16 );
+        serialize_bits( stream, receivedPacketSequence, 16 );
+        serialize_bool( stream, m_hasAckedPacket );
+        serialize_bits( stream, m_mostRecentAckedSequence, 16 );
+
+        if ( Stream::IsReading )
+        {
+            m_sentPackets->Reset( sentPacketSequence );
+            m_receivedPackets->Reset( receivedPacketSequence );
+        }
+
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            if ( !m_channel[i]->SerializeState( stream ) )
+            {
+                if ( Stream::IsReading )
+                    Reset();
+                return false;
+            }
+        }
+
+        if ( m_stringDictionary && !m_stringDictionary->SerializeState( stream ) )
+        {
+            if ( Stream::IsReading )
+                Reset();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool Connection::SerializeState( ReadStream & stream )
+    {
+        return SerializeStateInternal( stream );
+    }
+
+    bool Connection::SerializeState( WriteStream & stream )
+    {
+        return SerializeStateInternal( stream );
+    }
+
+    bool Connection::SerializeState( MeasureStream & stream )
+    {
+        return SerializeStateInternal( stream );
+    }
+
+    bool Connection::CanSendMsg( int channelId ) const
+    {
+        assert( channelId >= 0 );
+        assert( channelId < m_connectionConfig.numChannels );
+        return m_channel[channelId]->CanSendMsg();
+    }
+
+    bool Connection::HasMessagesToSend() const
+    {
+        for ( int channelId = 0; channelId < m_connectionConfig.numChannels; ++channelId )
+        {
+            if ( ChannelHasMessagesToSend( m_connectionConfig.channel[channelId].type, m_channel[channelId] ) )
+                return true;
+        }
+        return false;
+    }
+
+    bool Connection::ReadyToSendPacket() const
+    {
+        if ( !m_connectionConfig.delayAcks )
+            return true;
+
+        if ( HasMessagesToSend() )
+            return true;
+
+        return m_ackPending && m_time >= m_ackPendingTime + m_connectionConfig.ackDelay;
+    }
+
+    double Connection::GetNextSendTime() const
+    {
+        if ( ReadyToSendPacket() )
+            return m_time;
+
+        return m_ackPending ? m_ackPendingTime + m_connectionConfig.ackDelay : NoEventTime;
+    }
+
+    void Connection::SendMsg( Message * message, int channelId )
+    {
+        assert( channelId >= 0 );
+        assert( channelId < m_connectionConfig.numChannels );
+        ChannelSendMsg( m_connectionConfig.channel[channelId].type, m_channel[channelId], message );
     }
 
-    bool Connection::CanSendMsg( int channelId ) const
+    Message * Connection::ReceiveMsg( int channelId )
     {
         assert( channelId >= 0 );
         assert( channelId < m_connectionConfig.numChannels );
-        return m_channel[channelId]->CanSendMsg();
+        return m_channel[channelId]->ReceiveMsg();
     }
 
-    void Connection::SendMsg( Message * message, int channelId )
+    void Connection::SendMsgs( Message ** messages, int numMessages, int channelId )
     {
         assert( channelId >= 0 );
         assert( channelId < m_connectionConfig.numChannels );
-        return m_channel[channelId]->SendMsg( message );
+        m_channel[channelId]->SendMsgs( messages, numMessages );
     }
 
-    Message * Connection::ReceiveMsg( int channelId )
+    int Connection::ReceiveMsgs( Message ** messages, int maxMessages, int channelId )
     {
         assert( channelId >= 0 );
         assert( channelId < m_connectionConfig.numChannels );
-        return m_channel[channelId]->ReceiveMsg();
+        return m_channel[channelId]->ReceiveMsgs( messages, maxMessages );
     }
 
     ConnectionPacket * Connection::GeneratePacket()
     {
+        YOJIMBO_PROFILE_SCOPE( PROFILE_STAGE_CONNECTION_GENERATE_PACKET );
+        YOJIMBO_ZONE( "connection_generate_packet" );
+
         if ( m_error != CONNECTION_ERROR_NONE )
             return NULL;
 
@@ -258,60 +980,169 @@ namespace yojimbo
         if ( !packet )
             return NULL;
 
+        packet->SetMessageFactory( *m_messageFactory );
+
         packet->sequence = m_sentPackets->GetSequence();
 
-        GenerateAckBits( *m_receivedPackets, packet->ack, packet->ack_bits );
+        GenerateAckBits( *m_receivedPackets, packet->ack, packet->ack_bits, m_connectionConfig.ackWindowSize );
+
+        m_ackPending = false;
+
+        if ( m_connectionConfig.enableMtuDiscovery )
+            UpdateMtuProbe( packet );
+
+        if ( m_connectionConfig.enableClockSync )
+            packet->sendTime = uint32_t( int64_t( m_time * 1000000.0 ) );
+
+        // IMPORTANT: The sequence number can only be truncated while the other side has received a packet close to it. Otherwise the other side can't tell which sequence number the low bits belong to.
+
+        if ( m_connectionConfig.compressPacketHeader && m_hasAckedPacket && uint16_t( packet->sequence - m_mostRecentAckedSequence ) <= CompressedSequenceWindow )
+            packet->sequenceBits = CompressedSequenceBits;
 
-        InsertAckPacketEntry( packet->sequence );
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            if ( has_flow_control( m_connectionConfig.channel[i] ) )
+                packet->receiveWindow[i] = ( (ReliableOrderedChannel*) m_channel[i] )->GetReceiveWindow();
+        }
+
+        const int headerBits = ConservativeConnectionPacketHeaderEstimate + m_connectionConfig.ackWindowSize - 32 + ( m_connectionConfig.compressPacketHeader ? m_connectionConfig.numChannels : 0 ) + receive_window_bits( m_connectionConfig ) + send_time_bits( m_connectionConfig );
+
+        int packetBits = headerBits;
 
         if ( m_connectionConfig.numChannels > 0 )
         {
+            // IMPORTANT: Channel data is generated directly into the packet's channel entries, so storage for every channel is reserved up front.
+            // Channels only write to an entry when they return data for it, so entries are filled contiguously and the count is set at the end.
+
+            if ( !packet->AllocateChannelData( *m_messageFactory, m_connectionConfig.numChannels ) )
+            {
+                m_error = CONNECTION_ERROR_OUT_OF_MEMORY;
+                packet->Destroy();
+                return NULL;
+            }
+
             int numChannelsWithData = 0;
-            bool channelHasData[MaxChannels];
-            memset( channelHasData, 0, sizeof( channelHasData ) );
-            ChannelPacketData channelData[MaxChannels];
 
-            int availableBits = m_connectionConfig.maxPacketSize * 8;
+            int availableBits = m_pathMaxPacketSize * 8;
+
+            availableBits -= headerBits;
+
+            // IMPORTANT: Block fragments that don't fit in the congestion window are held back while packets are in flight, so bytes in flight stay within the window.
+            // While nothing is in flight there is no limit, so a fragment larger than the window still gets through.
+
+            int congestionLimitBits = -1;
+
+            if ( m_congestionController )
+            {
+                availableBits = min( availableBits, m_congestionController->GetAvailableBytes() * 8 );
+
+                if ( m_congestionController->GetBytesInFlight() > 0 )
+                    congestionLimitBits = m_congestionController->GetAvailableBytes() * 8;
+            }
 
-            availableBits -= ConservativeConnectionPacketHeaderEstimate;
+            const int numChannels = m_connectionConfig.numChannels;
 
-            for ( int channelId = 0; channelId < m_connectionConfig.numChannels; ++channelId )
+            if ( !m_connectionConfig.enableChannelScheduling )
             {
-                int packetDataBits = m_channel[channelId]->GetPacketData( channelData[channelId], packet->sequence, availableBits );
+                // channels are filled in channel id order. each channel can use all the space left over by the channels before it
 
-                if ( packetDataBits > 0 )
+                for ( int channelId = 0; channelId < numChannels; ++channelId )
                 {
-                    availableBits -= ConservativeChannelHeaderEstimate;
+                    m_channel[channelId]->SetCongestionLimit( congestionLimitBits >= 0 ? max( congestionLimitBits, 0 ) : -1 );
 
-                    availableBits -= packetDataBits;
+                    int packetDataBits = ChannelGetPacketData( m_connectionConfig.channel[channelId].type, m_channel[channelId], packet->channelEntry[numChannelsWithData], packet->sequence, availableBits, &packet->GetArena() );
 
-                    channelHasData[channelId] = true;
+                    if ( packetDataBits > 0 )
+                    {
+                        availableBits -= ConservativeChannelHeaderEstimate;
+
+                        availableBits -= packetDataBits;
+
+                        if ( congestionLimitBits >= 0 )
+                            congestionLimitBits -= ConservativeChannelHeaderEstimate + packetDataBits;
+
+                        packetBits += ConservativeChannelHeaderEstimate + packetDataBits;
 
-                    numChannelsWithData++;
+                        numChannelsWithData++;
+                    }
                 }
             }
-
-            if ( numChannelsWithData > 0 )
+            else
             {
-                if ( !packet->AllocateChannelData( *m_messageFactory, numChannelsWithData ) )
-                {
-                    m_error = CONNECTION_ERROR_OUT_OF_MEMORY;
-                    return NULL;
-                }
+                // IMPORTANT: With channel scheduling, channels are filled in priority order. Channels with the same priority share the space left for them by deficit round robin, 
+                // so a channel with lots of data to send can't starve other channels of the same priority. Space a channel doesn't use goes to the channels after it.
 
-                int index = 0;
+                const int maxDeficitBits = m_connectionConfig.maxPacketSize * 8;
 
-                for ( int channelId = 0; channelId < m_connectionConfig.numChannels; ++channelId )
+                for ( int levelStart = 0; levelStart < numChannels; )
                 {
-                    if ( channelHasData[channelId] )
+                    const int priority = m_connectionConfig.channel[m_channelOrder[levelStart]].priority;
+
+                    int levelEnd = levelStart + 1;
+                    while ( levelEnd < numChannels && m_connectionConfig.channel[m_channelOrder[levelEnd]].priority == priority )
+                        levelEnd++;
+
+                    const int levelSize = levelEnd - levelStart;
+
+                    int levelWeight = 0;
+
+                    for ( int i = levelStart; i < levelEnd; ++i )
+                    {
+                        const int channelId = m_channelOrder[i];
+
+                        if ( ChannelHasMessagesToSend( m_connectionConfig.channel[channelId].type, m_channel[channelId] ) )
+                            levelWeight += m_connectionConfig.channel[channelId].weight;
+                        else
+                            m_channelDeficit[channelId] = 0;
+                    }
+
+                    for ( int i = 0; i < levelSize && levelWeight > 0; ++i )
                     {
-                        memcpy( &packet->channelEntry[index], &channelData[channelId], sizeof( ChannelPacketData ) );
-                        index++;
+                        const int channelId = m_channelOrder[levelStart + ( i + m_channelRoundRobin ) % levelSize];
+
+                        if ( !ChannelHasMessagesToSend( m_connectionConfig.channel[channelId].type, m_channel[channelId] ) )
+                            continue;
+
+                        const int weight = m_connectionConfig.channel[channelId].weight;
+
+                        const int shareBits = int( int64_t( max( availableBits, 0 ) ) * weight / levelWeight );
+
+                        levelWeight -= weight;
+
+                        const int channelBits = min( availableBits, shareBits + m_channelDeficit[channelId] );
+
+                        m_channel[channelId]->SetCongestionLimit( congestionLimitBits >= 0 ? max( congestionLimitBits, 0 ) : -1 );
+
+                        int packetDataBits = ChannelGetPacketData( m_connectionConfig.channel[channelId].type, m_channel[channelId], packet->channelEntry[numChannelsWithData], packet->sequence, channelBits, &packet->GetArena() );
+
+                        if ( packetDataBits > 0 )
+                        {
+                            availableBits -= ConservativeChannelHeaderEstimate;
+
+                            availableBits -= packetDataBits;
+
+                            if ( congestionLimitBits >= 0 )
+                                congestionLimitBits -= ConservativeChannelHeaderEstimate + packetDataBits;
+
+                            packetBits += ConservativeChannelHeaderEstimate + packetDataBits;
+
+                            numChannelsWithData++;
+                        }
+
+                        m_channelDeficit[channelId] = min( max( channelBits - packetDataBits, 0 ), maxDeficitBits );
                     }
+
+                    levelStart = levelEnd;
                 }
+
+                m_channelRoundRobin++;
             }
+
+            packet->numChannelEntries = numChannelsWithData;
         }
 
+        InsertAckPacketEntry( packet->sequence, max( ( packetBits + 7 ) / 8, packet->probeBytes ), packet->probeBytes );
+
         m_counters[CONNECTION_COUNTER_PACKETS_GENERATED]++;
 
         if ( m_listener )
@@ -320,14 +1151,37 @@ namespace yojimbo
         return packet;
     }
 
-    bool Connection::ProcessPacket( ConnectionPacket * packet )
+    bool Connection::ProcessPacket( ConnectionPacket * packet, double receiveTime )
     {
+        YOJIMBO_PROFILE_SCOPE( PROFILE_STAGE_CONNECTION_PROCESS_PACKET );
+        YOJIMBO_ZONE( "connection_process_packet" );
+
         if ( m_error != CONNECTION_ERROR_NONE )
             return false;
 
         assert( packet );
         assert( packet->GetType() == m_connectionConfig.connectionPacketType );
 
+        if ( packet->sequenceBits < 16 )
+        {
+            // the truncated sequence number is the one nearest to the packets received so far. the ack was read relative to the truncated sequence, so it moves with it
+
+            const uint16_t expectedSequence = m_receivedPackets->GetSequence();
+
+            const int sequenceMask = ( 1 << packet->sequenceBits ) - 1;
+
+            int difference = ( packet->sequence - expectedSequence ) & sequenceMask;
+
+            if ( difference >= CompressedSequenceWindow )
+                difference -= sequenceMask + 1;
+
+            const uint16_t offset = uint16_t( expectedSequence + difference - packet->sequence );
+
+            packet->sequence += offset;
+            packet->ack += offset;
+            packet->sequenceBits = 16;
+        }
+
         if ( !m_receivedPackets->Insert( packet->sequence ) )
         {
             m_counters[CONNECTION_COUNTER_PACKETS_STALE]++;
@@ -336,10 +1190,25 @@ namespace yojimbo
 
         m_counters[CONNECTION_COUNTER_PACKETS_PROCESSED]++;
 
+        m_bytesReceived += packet->GetSerializedBytes();
+
         if ( m_listener )
             m_listener->OnConnectionPacketReceived( this, packet->sequence );
 
-        ProcessAcks( packet->ack, packet->ack_bits );
+        // IMPORTANT: The packet arrived some time after the connection time was last advanced. Add that on, so acks are timed from when the packet was received instead of the last frame.
+
+        const double ackTime = ( receiveTime >= 0.0 && m_time >= 0.0 ) ? m_time + ( receiveTime - m_platformTime ) : m_time;
+
+        ProcessAcks( packet->ack, packet->ack_bits, ackTime );
+
+        if ( m_connectionConfig.enableClockSync && m_time >= 0.0 )
+            UpdateClockSync( packet->sendTime, ackTime );
+
+        for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
+        {
+            if ( has_flow_control( m_connectionConfig.channel[i] ) )
+                ( (ReliableOrderedChannel*) m_channel[i] )->ProcessReceiveWindow( packet->receiveWindow[i] );
+        }
 
         for ( int i = 0; i < packet->numChannelEntries; ++i )
         {
@@ -348,7 +1217,15 @@ namespace yojimbo
             assert( channelId >= 0 );
             assert( channelId <= m_connectionConfig.numChannels );
 
-            m_channel[channelId]->ProcessPacketData( packet->channelEntry[i], packet->sequence );
+            ChannelProcessPacketData( m_connectionConfig.channel[channelId].type, m_channel[channelId], packet->channelEntry[i], packet->sequence );
+        }
+
+        // IMPORTANT: Packets that only carry acks don't need acks of their own. Acking them would have both sides sending ack-only packets to each other forever.
+
+        if ( packet->numChannelEntries > 0 && !m_ackPending )
+        {
+            m_ackPending = true;
+            m_ackPendingTime = m_time;
         }
 
         return true;
@@ -356,9 +1233,38 @@ namespace yojimbo
 
     void Connection::AdvanceTime( double time )
     {
+        m_time = time;
+        m_platformTime = platform_time();
+
+        if ( m_bandwidthTime < 0.0 )
+        {
+            m_bandwidthTime = time;
+        }
+        else if ( time > m_bandwidthTime )
+        {
+            // IMPORTANT: Bandwidth samples are taken over the time since the last sample, so frames where no packets are sent pull the smoothed bandwidth down just like they should.
+
+            const double deltaTime = time - m_bandwidthTime;
+            const float alpha = m_connectionConfig.bandwidthSmoothingFactor;
+            const float sentBandwidth = float( m_bytesSent * 8 / deltaTime / 1000.0 );
+            const float receivedBandwidth = float( m_bytesReceived * 8 / deltaTime / 1000.0 );
+            const float ackedBandwidth = float( m_bytesAcked * 8 / deltaTime / 1000.0 );
+
+            m_networkInfo.sentBandwidth += ( sentBandwidth - m_networkInfo.sentBandwidth ) * alpha;
+            m_networkInfo.receivedBandwidth += ( receivedBandwidth - m_networkInfo.receivedBandwidth ) * alpha;
+            m_networkInfo.ackedBandwidth += ( ackedBandwidth - m_networkInfo.ackedBandwidth ) * alpha;
+
+            m_bandwidthTime = time;
+            m_bytesSent = 0;
+            m_bytesReceived = 0;
+            m_bytesAcked = 0;
+        }
+
         for ( int i = 0; i < m_connectionConfig.numChannels; ++i )
         {
-            m_channel[i]->AdvanceTime( time );
+            m_channel[i]->SetRoundTripTime( m_networkInfo.RTT / 1000.0f, m_networkInfo.jitter / 1000.0f );
+
+            ChannelAdvanceTime( m_connectionConfig.channel[i].type, m_channel[i], time );
 
             ChannelError error = m_channel[i]->GetError();
 
@@ -377,47 +1283,346 @@ namespace yojimbo
         return m_counters[index];
     }
 
+    const Channel * Connection::GetChannel( int channelId ) const
+    {
+        assert( channelId >= 0 );
+        assert( channelId < m_connectionConfig.numChannels );
+        return m_channel[channelId];
+    }
+
+    uint64_t Connection::GetChannelBitsWritten( int channelId ) const
+    {
+        assert( channelId >= 0 );
+        assert( channelId < m_connectionConfig.numChannels );
+        return m_bitCounters.channelBits[channelId];
+    }
+
+    uint64_t Connection::GetChannelFragmentBitsWritten( int channelId ) const
+    {
+        assert( channelId >= 0 );
+        assert( channelId < m_connectionConfig.numChannels );
+        return m_bitCounters.channelFragmentBits[channelId];
+    }
+
+    uint64_t Connection::GetMessageTypeBitsWritten( int messageType ) const
+    {
+        assert( messageType >= 0 );
+        assert( messageType < m_bitCounters.numMessageTypes );
+        return m_bitCounters.messageTypeBits[messageType];
+    }
+
     ConnectionError Connection::GetError() const
     {
         return m_error;
     }
 
-    void Connection::InsertAckPacketEntry( uint16_t sequence )
+    void Connection::GetNetworkInfo( NetworkInfo & info ) const
+    {
+        info = m_networkInfo;
+    }
+
+    void Connection::SetCongestionController( CongestionController * congestionController )
+    {
+        m_congestionController = congestionController;
+    }
+
+    void Connection::SetDeferBlocks( bool deferBlocks )
+    {
+        for ( int channelId = 0; channelId < m_connectionConfig.numChannels; ++channelId )
+            m_channel[channelId]->SetDeferBlocks( deferBlocks );
+    }
+
+    int Connection::GetPathMaxPacketSize() const
+    {
+        return m_pathMaxPacketSize;
+    }
+
+    bool Connection::IsSearchingPathMaxPacketSize() const
+    {
+        return m_connectionConfig.enableMtuDiscovery && m_mtuSearchTime < 0.0;
+    }
+
+    bool Connection::HasClockSync() const
     {
+        return m_connectionConfig.enableClockSync && m_hasRemoteTickInterval && m_hasRTT;
+    }
+
+    double Connection::GetClockOffset() const
+    {
+        if ( !HasClockSync() )
+            return 0.0;
+
+        return min( m_clockSyncOffset[0], m_clockSyncOffset[1] ) - m_networkInfo.RTT * 0.5 / 1000.0;
+    }
+
+    double Connection::GetRemoteTickInterval() const
+    {
+        if ( !HasClockSync() )
+            return 0.0;
+
+        return min( m_remoteTickInterval[0], m_remoteTickInterval[1] );
+    }
+
+    double Connection::GetNextRemoteTickTime() const
+    {
+        if ( !HasClockSync() )
+            return m_time;
+
+        const double tickInterval = GetRemoteTickInterval();
+
+        const double tickTime = m_remoteTime + GetClockOffset();
+
+        return tickTime + ( floor( ( m_time - tickTime ) / tickInterval ) + 1.0 ) * tickInterval;
+    }
+
+    void Connection::UpdateClockSync( uint32_t sendTime, double receiveTime )
+    {
+        const double delta = int32_t( sendTime - m_remoteSendTime ) * 0.000001;
+
+        // IMPORTANT: Send times wrap around every 71.6 minutes, so they can only be unwrapped across gaps shorter than half that. Start over after a long gap, or when the time between packets on the other side doesn't come close to the time between them here, eg. packets generated before the other side first advanced its connection time.
+
+        if ( !m_clockSyncReceivedPacket || receiveTime - m_remoteReceiveTime > 1800.0 || fabs( delta - ( receiveTime - m_remoteReceiveTime ) ) > 10.0 )
+        {
+            m_clockSyncReceivedPacket = true;
+            m_hasRemoteTickInterval = false;
+            m_remoteSendTime = sendTime;
+            m_remoteTime = sendTime * 0.000001;
+            m_remoteReceiveTime = receiveTime;
+            m_clockSyncOffset[0] = m_clockSyncOffset[1] = receiveTime - m_remoteTime;
+            m_clockSyncWindowStart = receiveTime;
+            return;
+        }
+
+        const double remoteTime = m_remoteTime + delta;
+
+        const double offset = receiveTime - remoteTime;
+
+        const bool newWindow = receiveTime >= m_clockSyncWindowStart + ClockSyncWindow;
+
+        if ( newWindow )
+        {
+            m_clockSyncOffset[1] = m_clockSyncOffset[0];
+            m_clockSyncOffset[0] = offset;
+            m_remoteTickInterval[1] = m_remoteTickInterval[0];
+            m_clockSyncWindowStart = receiveTime;
+        }
+        else
+        {
+            m_clockSyncOffset[0] = min( m_clockSyncOffset[0], offset );
+        }
+
+        // IMPORTANT: Packets generated on the same tick on the other side have the same send time, and packets received out of order go backwards, so only packets from a later tick measure the tick interval.
+
+        if ( delta <= 0.0 )
+            return;
+
+        if ( !m_hasRemoteTickInterval )
+        {
+            m_hasRemoteTickInterval = true;
+            m_remoteTickInterval[0] = m_remoteTickInterval[1] = delta;
+        }
+        else if ( newWindow )
+        {
+            m_remoteTickInterval[0] = delta;
+        }
+        else
+        {
+            m_remoteTickInterval[0] = min( m_remoteTickInterval[0], delta );
+        }
+
+        m_remoteSendTime = sendTime;
+        m_remoteTime = remoteTime;
+        m_remoteReceiveTime = receiveTime;
+    }
+
+    void Connection::UpdateMtuProbe( ConnectionPacket * packet )
+    {
+        assert( packet );
+        assert( m_connectionConfig.enableMtuDiscovery );
+
+        if ( m_time < 0.0 )
+            return;
+
+        if ( m_mtuProbeBytes > 0 )
+        {
+            if ( m_time - m_mtuProbeTime < m_connectionConfig.mtuProbeTimeout )
+                return;
+
+            m_counters[CONNECTION_COUNTER_MTU_PROBES_LOST]++;
+
+            if ( ++m_mtuProbeAttempts >= m_connectionConfig.mtuProbeMaxAttempts )
+            {
+                m_mtuSearchLimit = m_mtuProbeBytes;
+                m_mtuProbeAttempts = 0;
+            }
+
+            m_mtuProbeBytes = 0;
+        }
+
+        if ( m_mtuSearchLimit - m_pathMaxPacketSize <= MtuSearchGranularity )
+        {
+            if ( m_mtuSearchTime < 0.0 )
+                m_mtuSearchTime = m_time;
+
+            const int maxProbeBytes = min( m_connectionConfig.mtuDiscoveryMaxPacketSize, m_connectionConfig.maxPacketSize );
+
+            if ( m_mtuSearchLimit > maxProbeBytes || m_time - m_mtuSearchTime < m_connectionConfig.mtuRaiseInterval )
+                return;
+
+            // the search stopped short of the largest probe size a while ago. search again, in case the path allows larger packets now
+
+            m_mtuSearchLimit = maxProbeBytes + 1;
+            m_mtuSearchTime = -1.0;
+        }
+
+        m_mtuProbeBytes = ( m_pathMaxPacketSize + m_mtuSearchLimit ) / 2;
+        m_mtuProbeTime = m_time;
+
+        packet->probeBytes = m_mtuProbeBytes;
+
+        m_counters[CONNECTION_COUNTER_MTU_PROBES_SENT]++;
+    }
+
+    int Connection::GetPacketLossDelay() const
+    {
+        return min( m_connectionConfig.ackWindowSize * 2, m_connectionConfig.slidingWindowSize );
+    }
+
+    void Connection::InsertAckPacketEntry( uint16_t sequence, int packetBytes, int probeBytes )
+    {
+        // IMPORTANT: Take a packet loss sample for the packet sent twice the ack window ago. By now it has most likely been acked if it was received, and it is still in the sent packet buffer, even if it is about to be replaced by this packet.
+
+        const ConnectionSentPacketData * sampleEntry = m_sentPackets->Find( uint16_t( sequence - GetPacketLossDelay() ) );
+
+        // IMPORTANT: Lost probe packets say the probe size is too large for the path, not that the path is congested, so they don't count as packet loss.
+
+        if ( sampleEntry && !sampleEntry->probeBytes )
+        {
+            const float packetLoss = sampleEntry->acked ? 0.0f : 100.0f;
+            m_networkInfo.packetLoss += ( packetLoss - m_networkInfo.packetLoss ) * m_connectionConfig.packetLossSmoothingFactor;
+
+            if ( !sampleEntry->acked && m_congestionController )
+                m_congestionController->OnPacketLost( m_time, sampleEntry->packetBytes );
+        }
+
         ConnectionSentPacketData * entry = m_sentPackets->Insert( sequence );
         
         assert( entry );
 
         if ( entry )
         {
+            entry->time = m_time;
+            entry->packetBytes = packetBytes;
             entry->acked = 0;
+            entry->probeBytes = uint16_t( probeBytes );
+            m_unackedPackets->SetBit( m_sentPackets->GetIndex( sequence ) );
         }
+
+        m_bytesSent += packetBytes;
+
+        if ( m_congestionController )
+            m_congestionController->OnPacketSent( m_time, packetBytes );
     }
 
-    void Connection::ProcessAcks( uint16_t ack, uint32_t ack_bits )
+    void Connection::ProcessAcks( uint16_t ack, const uint32_t * ack_bits, double ackTime )
     {
-        for ( int i = 0; i < 32; ++i )
+        for ( int i = 0; i < m_connectionConfig.ackWindowSize / 32; ++i )
         {
-            if ( ack_bits & 1 )
-            {                    
-                const uint16_t sequence = ack - i;
+            // IMPORTANT: Bit j of the word is for sequence ack - i * 32 - j, so the unacked bits for the 32 sequence numbers ending there are reversed to line up with it.
+
+            uint32_t word = ack_bits[i] & reverse_bits( GetUnackedBits( uint16_t( ack - i * 32 - 31 ) ) );
+
+            while ( word != 0 )
+            {
+                const int j = trailing_zeros( word );
+
+                word &= word - 1;
+
+                const uint16_t sequence = ack - ( i * 32 + j );
                 ConnectionSentPacketData * packetData = m_sentPackets->Find( sequence );
                 if ( packetData && !packetData->acked )
                 {
+                    if ( !m_hasAckedPacket || sequence_greater_than( sequence, m_mostRecentAckedSequence ) )
+                    {
+                        m_hasAckedPacket = true;
+                        m_mostRecentAckedSequence = sequence;
+                    }
+
                     PacketAcked( sequence );
                     packetData->acked = 1;
+                    m_unackedPackets->ClearBit( m_sentPackets->GetIndex( sequence ) );
+                    const float rtt = packetData->time >= 0.0 ? float( max( ackTime - packetData->time, 0.0 ) ) : -1.0f;
+                    if ( rtt >= 0.0f )
+                        UpdateRTT( rtt * 1000.0f );
+                    m_bytesAcked += packetData->packetBytes;
+
+                    // IMPORTANT: Packets acked after they were counted as lost have already been taken out of the bytes in flight.
+
+                    if ( m_congestionController && uint16_t( m_sentPackets->GetSequence() - sequence ) <= GetPacketLossDelay() )
+                        m_congestionController->OnPacketAcked( m_time, packetData->packetBytes, rtt );
+
+                    if ( packetData->probeBytes )
+                    {
+                        // IMPORTANT: Probes acked after they timed out still count. The path got them through, it was just slow to ack them.
+
+                        m_counters[CONNECTION_COUNTER_MTU_PROBES_ACKED]++;
+
+                        m_pathMaxPacketSize = max( m_pathMaxPacketSize, int( packetData->probeBytes ) );
+                        m_mtuSearchLimit = max( m_mtuSearchLimit, m_pathMaxPacketSize + 1 );
+
+                        if ( packetData->probeBytes >= m_mtuProbeBytes )
+                        {
+                            m_mtuProbeBytes = 0;
+                            m_mtuProbeAttempts = 0;
+                        }
+                    }
                 }
             }
-            ack_bits >>= 1;
         }
     }
 
+    uint32_t Connection::GetUnackedBits( uint16_t sequence ) const
+    {
+        const int index = m_sentPackets->GetIndex( sequence );
+        const int first = min( 32, m_connectionConfig.slidingWindowSize - index );
+
+        uint32_t bits = m_unackedPackets->GetBits( index, first );
+
+        if ( first < 32 )
+            bits |= m_unackedPackets->GetBits( 0, 32 - first ) << first;
+
+        return bits;
+    }
+
+    void Connection::UpdateRTT( float rtt )
+    {
+        if ( !m_hasRTT )
+        {
+            m_networkInfo.RTT = rtt;
+            m_networkInfo.jitter = rtt / 2;
+            m_hasRTT = true;
+            return;
+        }
+
+        // IMPORTANT: Smoothed the same way TCP smooths RTT. Variance is updated with the deviation from the RTT before this sample, and is smoothed at twice the rate of RTT.
+
+        const float alpha = m_connectionConfig.rttSmoothingFactor;
+
+        const float deviation = fabsf( rtt - m_networkInfo.RTT );
+
+        m_networkInfo.jitter += ( deviation - m_networkInfo.jitter ) * min( alpha * 2, 1.0f );
+        m_networkInfo.RTT += ( rtt - m_networkInfo.RTT ) * alpha;
+    }
+
     void Connection::PacketAcked( uint16_t sequence )
     {
         OnPacketAcked( sequence );
 
+        if ( m_stringDictionary )
+            m_stringDictionary->ProcessAck( sequence );
+
         for ( int channelId = 0; channelId < m_connectionConfig.numChannels; ++channelId )
-            m_channel[channelId]->ProcessAck( sequence );
+            ChannelProcessAck( m_connectionConfig.channel[channelId].type, m_channel[channelId], sequence );
 
         m_counters[CONNECTION_COUNTER_PACKETS_ACKED]++;
     }
@@ -437,4 +1642,25 @@ namespace yojimbo
             m_listener->OnConnectionFragmentReceived( this, channel->GetChannelId(), messageId, fragmentId, fragmentBytes, numFragmentsReceived, numFragmentsInBlock );
         }
     }
+
+    void Connection::OnChannelBlockDataReceived( class Channel * channel, uint16_t messageId, BlockMessage * blockMessage, int blockOffset, const uint8_t * data, int dataBytes, bool blockComplete )
+    {
+        if ( m_listener )
+        {
+            m_listener->OnConnectionBlockDataReceived( this, channel->GetChannelId(), messageId, blockMessage, blockOffset, data, dataBytes, blockComplete );
+        }
+    }
+
+    SharedBlock * Connection::OnChannelBlockCacheFind( class Channel * channel, uint64_t blockHash, int blockSize )
+    {
+        return m_listener ? m_listener->OnConnectionBlockCacheFind( this, channel->GetChannelId(), blockHash, blockSize ) : NULL;
+    }
+
+    void Connection::OnChannelBlockCacheStore( class Channel * channel, uint64_t blockHash, const uint8_t * blockData, int blockSize )
+    {
+        if ( m_listener )
+        {
+            m_listener->OnConnectionBlockCacheStore( this, channel->GetChannelId(), blockHash, blockData, blockSize );
+        }
+    }
 }
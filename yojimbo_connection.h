@@ -29,6 +29,7 @@
 #include "yojimbo_message.h"
 #include "yojimbo_allocator.h"
 #include "yojimbo_channel.h"
+#include "yojimbo_string_dictionary.h"
 
 /** @file */
 
@@ -51,12 +52,18 @@ namespace yojimbo
         uint32_t magic;                                                         ///< The magic number for safety checks. Set to yojimbo::ConnectionContextMagic.
         const ConnectionConfig * connectionConfig;                              ///< The connection config. So we know the number of channels and how they are setup.
         class MessageFactory * messageFactory;                                  ///< The message factory used for creating and destroying messages.
+        PacketBitCounters * bitCounters;                                        ///< The bit counters that connection packets add to as they are written. Optional. May be NULL. See Connection::GetPacketBitCounters.
+        const Channel * const * channels;                                       ///< The channels of the connection that connection packets are read for. Optional. May be NULL. Messages these channels would discard are skipped as packets are read. See Connection::GetChannels and ChannelConfig::skipDiscardedMessages.
+        StringDictionary * stringDictionary;                                    ///< The string dictionary used by serialize_interned_string. Optional. May be NULL, in which case interned strings are sent inline. See Connection::GetStringDictionary.
 
         ConnectionContext()
         {
             magic = ConnectionContextMagic;
             messageFactory = NULL;
             connectionConfig = NULL;
+            bitCounters = NULL;
+            channels = NULL;
+            stringDictionary = NULL;
         }
     };
 
@@ -74,16 +81,39 @@ namespace yojimbo
                                                 uint16_t & ack,
                                                 uint32_t & ack_bits )
     {
+        GenerateAckBits( packets, ack, &ack_bits, 32 );
+    }
+
+    /**
+        Helper function to generate ack and ack_bits for an ack window wider than 32 packets.
+
+        @param packets The sequence buffer of received packets.
+        @param ack The sequence number of the most recent received packet [out].
+        @param ack_bits Array of numBits/32 words. Bit n % 32 of word n / 32 is set if ack - n was received [out].
+        @param numBits The size of the ack window. Must be a multiple of 32, and no larger than the sequence buffer.
+
+        IMPORTANT: The ack bits are read straight from the sequence buffer occupancy bitmap, so the sequence buffer size must divide 65536. See SequenceBuffer::GetOccupiedBits.
+
+        @see ConnectionConfig::ackWindowSize
+     */
+
+    template <typename T> void GenerateAckBits( const SequenceBuffer<T> & packets, 
+                                                uint16_t & ack,
+                                                uint32_t * ack_bits,
+                                                int numBits )
+    {
+        assert( ack_bits );
+        assert( numBits > 0 );
+        assert( ( numBits % 32 ) == 0 );
+        assert( numBits <= packets.GetSize() );
+        assert( ( 65536 % packets.GetSize() ) == 0 );
+
         ack = packets.GetSequence() - 1;
-        ack_bits = 0;
-        uint32_t mask = 1;
-        for ( int i = 0; i < 32; ++i )
-        {
-            uint16_t sequence = ack - i;
-            if ( packets.Exists( sequence ) )
-                ack_bits |= mask;
-            mask <<= 1;
-        }
+
+        // IMPORTANT: Bit n is set if ack - n was received, so each word is the occupancy of the 32 sequence numbers ending at ack - i * 32, in reverse order.
+
+        for ( int i = 0; i < numBits / 32; ++i )
+            ack_bits[i] = reverse_bits( packets.GetOccupiedBits( uint16_t( ack - i * 32 - 31 ), 32 ) );
     }
 
     /** 
@@ -102,12 +132,20 @@ namespace yojimbo
 
         uint16_t ack;                                                           ///< The sequence number of the most recent packet received from the other side of the connection.
 
-        uint32_t ack_bits;                                                      ///< Bit n is set if packet ack - n was received from the other side of the connection. See yojimbo::GenerateAckBits.
+        uint32_t ack_bits[MaxAckWindowSize/32];                                 ///< Bit n % 32 of word n / 32 is set if packet ack - n was received from the other side of the connection. Only the first ConnectionConfig::ackWindowSize bits are used. See yojimbo::GenerateAckBits.
 
         int numChannelEntries;                                                  ///< The number of channel entries in this packet. Each channel entry corresponds to message data for a particular channel.
 
         ChannelPacketData * channelEntry;                                       ///< Per-channel message data that was included in this packet.
 
+        int probeBytes;                                                         ///< If non-zero, the packet is a path MTU probe and is padded out to this many bytes when it is written. See ConnectionConfig::enableMtuDiscovery.
+
+        uint16_t receiveWindow[MaxChannels];                                    ///< For each reliable-ordered channel with flow control, the id of the first message that doesn't fit in its receive queue yet. Not sent for other channels. See ChannelConfig::flowControl.
+
+        uint32_t sendTime;                                                      ///< The connection time on the sending side when this packet was generated (microseconds). Wraps around every 71.6 minutes. Only sent if ConnectionConfig::enableClockSync is true.
+
+        int sequenceBits;                                                       ///< The number of low bits of the sequence number sent in a compressed header. When a packet with fewer than 16 is read, only the low bits of sequence and ack are known until Connection::ProcessPacket places them relative to the packets it has received. See ConnectionConfig::compressPacketHeader.
+
         ConnectionPacket();
 
         /** 
@@ -132,7 +170,7 @@ namespace yojimbo
             This is intended to silo each client to their own set of resources on the server, so malicious clients cannot launch an attack to deplete resources shared with other clients.
 
             @param messageFactory The message factory used to create and destroy messages.
-            @param numEntries The number of channel entries to allocate. This corresponds to the number of channels that have data to include in the connection packet.
+            @param numEntries The number of channel entries to allocate. When reading, this is the number of channel entries in the packet. When generating, this is the number of channels on the connection, and numChannelEntries is set to the number of entries actually filled afterwards.
 
             @returns True if the allocation succeeded, false otherwise.
 
@@ -141,13 +179,28 @@ namespace yojimbo
 
         bool AllocateChannelData( MessageFactory & messageFactory, int numEntries );
 
+        /**
+            Recycle the connection packet when it is returned to its packet pool.
+
+            Releases all references to messages included in this packet and resets it, but keeps the channel entry array, so the next packet of this type doesn't need to allocate it again.
+
+            @returns Always true. Connection packets are always recycled.
+
+            @see Packet::Recycle
+         */
+
+        bool Recycle();
+
         /** 
             The template function for serializing the connection packet.
 
             Unifies packet read and write, making it harder to accidentally desync one from the other.
+
+            @param stream The stream used for serialization.
+            @param bitCounters The bit counters to add the bits written for each channel and message type to. NULL when reading or measuring.
          */
 
-        template <typename Stream> bool Serialize( Stream & stream );
+        template <typename Stream> bool Serialize( Stream & stream, PacketBitCounters * bitCounters );
 
         bool SerializeInternal( ReadStream & stream );                          ///< Implements serialize read by calling into ConnectionPacket::Serialize with a ReadStream.
 
@@ -155,12 +208,50 @@ namespace yojimbo
 
         bool SerializeInternal( MeasureStream & stream );                       ///< Implements serialize measure by calling into ConnectionPacket::Serialize with a MeasureStream.
 
-        void SetMessageFactory( MessageFactory & messageFactory ) { m_messageFactory = &messageFactory; }
+        /**
+            Set the message factory used to release messages included in this packet.
+
+            The arena that the per-channel data in this packet is allocated from takes its memory from the message factory allocator.
+
+            @param messageFactory The message factory.
+         */
+
+        void SetMessageFactory( MessageFactory & messageFactory ) { m_messageFactory = &messageFactory; m_arena.SetAllocator( messageFactory.GetAllocator() ); }
+
+        /**
+            Get the arena that per-channel data in this packet is allocated from.
+
+            Message arrays, block fragment data and snapshot data in the channel entries of this packet are allocated from the arena, so a packet costs at most one allocation instead of several, and none once it has been recycled. The arena is reset when the packet is destroyed or recycled. 
+
+            IMPORTANT: Call ConnectionPacket::SetMessageFactory before allocating from the arena.
+
+            @returns The packet arena.
+
+            @see ChannelPacketData::GetAllocator
+         */
+
+        Allocator & GetArena() { return m_arena; }
+
+        /**
+            Get the serialized size of the connection packet.
+
+            @returns The number of bytes processed when the packet was last read from a stream, including the packet header written by yojimbo::WritePacket. Zero if the packet was not read from a stream.
+         */
+
+        int GetSerializedBytes() const { return m_serializedBytes; }
 
     private:
 
         MessageFactory * m_messageFactory;                                      ///< The message factory is cached so we can release messages included in this packet when the packet is destroyed.
 
+        Allocator * m_channelEntryAllocator;                                    ///< The allocator the channel entry array was allocated with. Kept separately from the message factory because the channel entry array can outlive a use of the packet when it is recycled.
+
+        int m_maxChannelEntries;                                                ///< The number of channel entries the channel entry array has room for.
+
+        int m_serializedBytes;                                                  ///< The number of bytes processed when the packet was last read. See ConnectionPacket::GetSerializedBytes.
+
+        ArenaAllocator m_arena;                                                 ///< Per-channel data in this packet is allocated from this arena. See ConnectionPacket::GetArena.
+
         ConnectionPacket( const ConnectionPacket & other );
 
         const ConnectionPacket & operator = ( const ConnectionPacket & other );
@@ -178,9 +269,39 @@ namespace yojimbo
         CONNECTION_COUNTER_PACKETS_PROCESSED,                                   ///< Number of connection packets processed.
         CONNECTION_COUNTER_PACKETS_STALE,                                       ///< Number of connection packets that could not be processed because they were stale.
         CONNECTION_COUNTER_PACKETS_ACKED,                                       ///< Number of connection packets acked.
+        CONNECTION_COUNTER_MTU_PROBES_SENT,                                     ///< Number of path MTU probe packets generated. See ConnectionConfig::enableMtuDiscovery.
+        CONNECTION_COUNTER_MTU_PROBES_ACKED,                                    ///< Number of path MTU probe packets acked.
+        CONNECTION_COUNTER_MTU_PROBES_LOST,                                     ///< Number of path MTU probe packets that timed out before they were acked.
         CONNECTION_COUNTER_NUM_COUNTERS                                         ///< The number of connection counters.
     };
 
+    /**
+        Get the name of a connection counter.
+
+        Names are lower case with underscores, so they can be used directly in metric names, eg. "packets_acked". See MetricsSnapshot.
+
+        @param index The connection counter index. See yojimbo::ConnectionCounters.
+
+        @returns The name of the counter.
+     */
+
+    inline const char * GetConnectionCounterName( int index )
+    {
+        switch ( index )
+        {
+            case CONNECTION_COUNTER_PACKETS_GENERATED:      return "packets_generated";
+            case CONNECTION_COUNTER_PACKETS_PROCESSED:      return "packets_processed";
+            case CONNECTION_COUNTER_PACKETS_STALE:          return "packets_stale";
+            case CONNECTION_COUNTER_PACKETS_ACKED:          return "packets_acked";
+            case CONNECTION_COUNTER_MTU_PROBES_SENT:        return "mtu_probes_sent";
+            case CONNECTION_COUNTER_MTU_PROBES_ACKED:       return "mtu_probes_acked";
+            case CONNECTION_COUNTER_MTU_PROBES_LOST:        return "mtu_probes_lost";
+            default:
+                assert( false );
+                return "???";
+        }
+    }
+
     /// Connection error states.
 
     enum ConnectionError
@@ -207,19 +328,197 @@ namespace yojimbo
         virtual void OnConnectionPacketReceived( class Connection * connection, uint16_t sequence ) { (void) connection; (void) sequence; }
 
         virtual void OnConnectionFragmentReceived( class Connection * connection, int channelId, uint16_t messageId, uint16_t fragmentId, int fragmentBytes, int numFragmentsReceived, int numFragmentsInBlock ) { (void) connection; (void) channelId; (void) messageId; (void) fragmentId; (void) fragmentBytes; (void) numFragmentsReceived; (void) numFragmentsInBlock; }
+
+        virtual void OnConnectionBlockDataReceived( class Connection * connection, int channelId, uint16_t messageId, BlockMessage * blockMessage, int blockOffset, const uint8_t * data, int dataBytes, bool blockComplete ) { (void) connection; (void) channelId; (void) messageId; (void) blockMessage; (void) blockOffset; (void) data; (void) dataBytes; (void) blockComplete; }
+
+        virtual SharedBlock * OnConnectionBlockCacheFind( class Connection * connection, int channelId, uint64_t blockHash, int blockSize ) { (void) connection; (void) channelId; (void) blockHash; (void) blockSize; return NULL; }
+
+        virtual void OnConnectionBlockCacheStore( class Connection * connection, int channelId, uint64_t blockHash, const uint8_t * blockData, int blockSize ) { (void) connection; (void) channelId; (void) blockHash; (void) blockData; (void) blockSize; }
     };
 
     // data stored per-sent connection packet in a sequence buffer
 
     struct ConnectionSentPacketData 
     { 
-        uint8_t acked;
+        double time;                                                            ///< The time the packet was generated. Used to measure round trip time when the packet is acked.
+        uint32_t packetBytes;                                                   ///< The estimated size of the packet (bytes). See Connection::GetNetworkInfo.
+        uint8_t acked;                                                          ///< 1 if the packet has been acked, 0 otherwise.
+        uint16_t probeBytes;                                                    ///< The size the packet was padded to if it is a path MTU probe (bytes). 0 otherwise.
     };
 
     // data stored per-sent connection packet in a sequence buffer (reserved for future expansion)
 
     struct ConnectionReceivedPacketData {};
 
+    /**
+        Network statistics for a connection.
+
+        @see Connection::GetNetworkInfo
+        @see Client::GetNetworkInfo
+        @see Server::GetClientNetworkInfo
+     */
+
+    struct NetworkInfo
+    {
+        float RTT;                                                              ///< Smoothed round trip time (milliseconds). Measured from the time a packet is generated to the time it is first acked.
+        float jitter;                                                           ///< Smoothed round trip time variance, as the mean deviation of RTT samples from the smoothed RTT (milliseconds).
+        float packetLoss;                                                       ///< Smoothed packet loss (percent). A packet counts as lost if it hasn't been acked by the time twice the ack window of newer packets have been generated.
+        float sentBandwidth;                                                    ///< Smoothed sent bandwidth (kilobits per-second). Estimated from the packet budget used by each packet generated, so it includes a conservative header estimate but not transport overhead.
+        float receivedBandwidth;                                                ///< Smoothed received bandwidth (kilobits per-second). Measured from the serialized size of each connection packet processed.
+        float ackedBandwidth;                                                   ///< Smoothed acked bandwidth (kilobits per-second). The part of the sent bandwidth that was acked by the other side.
+
+        NetworkInfo()
+        {
+            RTT = 0.0f;
+            jitter = 0.0f;
+            packetLoss = 0.0f;
+            sentBandwidth = 0.0f;
+            receivedBandwidth = 0.0f;
+            ackedBandwidth = 0.0f;
+        }
+    };
+
+    /**
+        Interface for congestion controllers.
+
+        The congestion controller is told about each connection packet sent, acked and lost, and decides how many bytes of channel data the connection may include in the next packet it generates.
+
+        Packet headers (and therefore acks) are always sent, regardless of what the congestion controller says, so acks keep flowing while the controller holds back channel data.
+
+        Override this class to implement your own congestion control, then set it on the connection with Connection::SetCongestionController.
+
+        @see LedbatCongestionController
+     */
+
+    class CongestionController
+    {
+    public:
+
+        virtual ~CongestionController() {}
+
+        /**
+            Reset the congestion controller to its initial state.
+
+            Called by Connection::Reset.
+         */
+
+        virtual void Reset() = 0;
+
+        /**
+            Called when a connection packet is generated.
+
+            @param time The current connection time (seconds).
+            @param packetBytes The estimated size of the packet (bytes).
+         */
+
+        virtual void OnPacketSent( double time, int packetBytes ) = 0;
+
+        /**
+            Called the first time a connection packet is acked.
+
+            @param time The current connection time (seconds).
+            @param packetBytes The estimated size of the packet (bytes).
+            @param rtt The round trip time measured for this packet (seconds). Negative if the packet was generated before the connection time was first advanced.
+         */
+
+        virtual void OnPacketAcked( double time, int packetBytes, float rtt ) = 0;
+
+        /**
+            Called when a connection packet is considered lost, because it was not acked within twice the ack window.
+
+            @param time The current connection time (seconds).
+            @param packetBytes The estimated size of the packet (bytes).
+         */
+
+        virtual void OnPacketLost( double time, int packetBytes ) = 0;
+
+        /**
+            Get the number of bytes of channel data that may be included in the next packet.
+
+            @returns The number of bytes available to send. May be zero, in which case the next packet only carries the packet header and acks.
+         */
+
+        virtual int GetAvailableBytes() const = 0;
+
+        /**
+            Get the number of bytes in flight.
+
+            While nothing is in flight, a block fragment is sent even if it is larger than the available bytes, so blocks still get through when the window is smaller than a fragment.
+
+            @returns The number of bytes sent that have not yet been acked or considered lost (bytes).
+         */
+
+        virtual int GetBytesInFlight() const = 0;
+    };
+
+    /**
+        A delay based congestion controller in the style of LEDBAT (RFC 6817).
+
+        Tracks the bytes in flight against a congestion window. The window grows while the measured RTT is close to the lowest RTT seen (the base delay), and shrinks once queuing delay rises above the target delay, so large transfers back off before they induce packet loss. The window is halved on packet loss, at most once per RTT.
+
+        This is the congestion controller used when ConnectionConfig::enableCongestionControl is true.
+     */
+
+    class LedbatCongestionController : public CongestionController
+    {
+    public:
+
+        /**
+            LEDBAT congestion controller constructor.
+
+            @param targetDelay The target queuing delay (seconds). See ConnectionConfig::congestionTargetDelay.
+            @param maxPacketSize The maximum connection packet size (bytes). The congestion window is measured in multiples of this.
+         */
+
+        LedbatCongestionController( float targetDelay, int maxPacketSize );
+
+        void Reset();
+
+        void OnPacketSent( double time, int packetBytes );
+
+        void OnPacketAcked( double time, int packetBytes, float rtt );
+
+        void OnPacketLost( double time, int packetBytes );
+
+        int GetAvailableBytes() const;
+
+        /**
+            Get the congestion window.
+
+            @returns The maximum number of bytes that may be in flight (bytes).
+         */
+
+        int GetCongestionWindow() const { return int( m_congestionWindow ); }
+
+        int GetBytesInFlight() const { return m_bytesInFlight; }
+
+        /**
+            Get the base delay.
+
+            @returns The lowest RTT seen over the last two base delay intervals (seconds). Zero if no packets have been acked yet.
+         */
+
+        float GetBaseDelay() const;
+
+    private:
+
+        float m_targetDelay;                                                    ///< The target queuing delay (seconds).
+
+        int m_maxPacketSize;                                                    ///< The maximum packet size (bytes).
+
+        double m_congestionWindow;                                              ///< The congestion window (bytes).
+
+        int m_bytesInFlight;                                                    ///< Bytes sent but not yet acked or lost.
+
+        float m_rtt;                                                            ///< The most recent RTT sample (seconds). Used to limit window reductions to once per RTT.
+
+        float m_baseDelay[2];                                                   ///< Lowest RTT seen in the current and previous base delay intervals (seconds). Negative if no RTT has been seen in that interval.
+
+        double m_baseDelayTime;                                                 ///< The time the current base delay interval started. Negative if no packets have been acked.
+
+        double m_lastLossTime;                                                  ///< The time the window was last reduced due to packet loss.
+    };
+
     /** 
         Implements packet level acks and transmits messages.
 
@@ -259,6 +558,40 @@ namespace yojimbo
 
         void Reset();
 
+        /**
+            Read the connection state written by another connection.
+
+            Used by Server::AcceptClientHandoff to take over a client from another server without the client reconnecting. The connection is reset, then packet sequence numbers, acks and reliable-ordered channel state are restored, so packets and messages carry on from where the other connection left off.
+
+            @param stream The stream to read the connection state from.
+
+            @returns True if the connection state was read successfully, false otherwise. On failure the connection is left reset.
+         */
+
+        bool SerializeState( ReadStream & stream );
+
+        /**
+            Write the connection state, so another connection can carry on from it.
+
+            Used by Server::HandoffClient. Both connections must have the same connection config and message factory.
+
+            @param stream The stream to write the connection state to.
+
+            @returns True if the connection state was written, false if a channel is in a state that can't be carried over. See Channel::SerializeState.
+         */
+
+        bool SerializeState( WriteStream & stream );
+
+        /**
+            Measure the connection state.
+
+            @param stream The stream to measure the connection state with.
+
+            @returns True if the connection state could be written, false otherwise.
+         */
+
+        bool SerializeState( MeasureStream & stream );
+
         /** 
             Check if there is room in the send queue to send a message.
 
@@ -280,6 +613,44 @@ namespace yojimbo
 
         bool CanSendMsg( int channelId = 0 ) const;
 
+        /**
+            Does this connection have messages waiting to be sent?
+
+            Reliable-ordered channels count messages that are sent but not acked yet, since they still need to be resent until they are acked.
+
+            @returns True if any channel has messages to send. False otherwise.
+
+            @see Channel::HasMessagesToSend
+         */
+
+        bool HasMessagesToSend() const;
+
+        /**
+            Is a connection packet worth generating right now?
+
+            This is always true unless ConnectionConfig::delayAcks is set. Then it is only true while the connection has messages to send, or acks for received packets with messages have been pending for ConnectionConfig::ackDelay.
+
+            Client and Server check this before generating connection packets, so idle connections only send keep-alive packets, and most acks go out with messages.
+
+            @returns True if a connection packet should be generated. False if it would only carry acks that can wait.
+
+            @see Connection::GeneratePacket
+         */
+
+        bool ReadyToSendPacket() const;
+
+        /**
+            Get the next time a connection packet is worth generating.
+
+            Use this to drive connections in virtual time, jumping straight to the next time something needs to be sent instead of stepping time in small increments.
+
+            @returns The current connection time if Connection::ReadyToSendPacket is true. The time delayed acks are due if acks are pending. NoEventTime otherwise.
+
+            @see Connection::ReadyToSendPacket
+         */
+
+        double GetNextSendTime() const;
+
         /**
             Queue a message to be sent.
 
@@ -309,6 +680,34 @@ namespace yojimbo
 
         Message * ReceiveMsg( int channelId = 0 );
 
+        /**
+            Queue a batch of messages to be sent.
+
+            The channel send queue is checked once for room for the whole batch. See Channel::SendMsgs.
+
+            @param messages The array of messages to be sent. They must be allocated from the message factory set on this connection.
+            @param numMessages The number of messages in the array.
+            @param channelId The id of the channel to send the messages across in [0,numChannels-1].
+
+            @see Connection::SendMsg
+         */
+
+        void SendMsgs( Message ** messages, int numMessages, int channelId = 0 );
+
+        /**
+            Receive up to a batch of messages.
+
+            IMPORTANT: Each message returned by this function has one reference. You are responsible for releasing these messages via MessageFactory::Release.
+
+            @param messages The array of message pointers to fill [out].
+            @param maxMessages The size of the message pointer array.
+            @param channelId The id of the channel to receive messages from.
+
+            @returns The number of messages received in [0,maxMessages].
+         */
+
+        int ReceiveMsgs( Message ** messages, int maxMessages, int channelId = 0 );
+
         /** 
             Generate a connection packet.
 
@@ -318,6 +717,8 @@ namespace yojimbo
 
             The connection packet also handles packet level acks. This ack system is based around the expectation that connection packets are generated and sent regularly in both directions. There are no separate ack packets. Acks are encoded in the packet header of the connection packet.
 
+            Space in the packet is given to channels in channel id order, each channel using as much of the space left over as it needs. If ConnectionConfig::enableChannelScheduling is true, space is given to channels in order of ChannelConfig::priority instead, and channels with the same priority share the space left for them in proportion to ChannelConfig::weight.
+
             @returns The connection packet that was generated.
 
             @see ConnectionPacket
@@ -336,10 +737,11 @@ namespace yojimbo
             This transmission of connection packets is bidirectional. A -> B, and B -> A. The ack system relies on packets being sent regularly (10,20,30HZ) in both directions to work properly. There are no separate ack packets.
 
             @param packet The connection packet to process.
+            @param receiveTime The time the packet was received, in the same time base as platform_time. See Transport::ReceivePacket. Acks in the packet are timed from when it was received rather than when it is processed, so RTT isn't skewed by how often packets are read. Pass a negative value if the receive time is not known.
             @returns True if the packet was processed successfully, false if something went wrong.
          */
 
-        bool ProcessPacket( ConnectionPacket * packet );
+        bool ProcessPacket( ConnectionPacket * packet, double receiveTime = -1.0 );
 
         /**
             Advance connection time.
@@ -401,30 +803,248 @@ namespace yojimbo
 
         uint64_t GetCounter( int index ) const;
 
+        /**
+            Get the number of message channels on this connection.
+
+            @returns The number of channels. See ConnectionConfig::numChannels.
+         */
+
+        int GetNumChannels() const { return m_connectionConfig.numChannels; }
+
+        /**
+            Get a message channel.
+
+            Lets telemetry read per-channel counters and queue depths. See MetricsSnapshot::AddConnection.
+
+            @param channelId The id of the channel in [0,numChannels-1].
+
+            @returns The channel.
+         */
+
+        const Channel * GetChannel( int channelId ) const;
+
+        /**
+            Get the message channels.
+
+            Set ConnectionContext::channels to this, so connection packets read for this connection skip messages its channels would discard. See ChannelConfig::skipDiscardedMessages.
+
+            @returns The array of channels, indexed by channel id.
+         */
+
+        const Channel * const * GetChannels() const { return m_channel; }
+
+        /**
+            Get the number of bits written for a channel.
+
+            This is counted as connection packets are serialized to be sent, so it is the exact size on the wire of everything the channel includes in packets: message ids and types, messages, blocks, block fragments and snapshots. Use it to find which channel fills up your packets when they hit ConnectionConfig::maxPacketSize.
+
+            @param channelId The id of the channel in [0,numChannels-1].
+
+            @returns The number of bits written for the channel since the connection was reset.
+         */
+
+        uint64_t GetChannelBitsWritten( int channelId ) const;
+
+        /**
+            Get the number of bits written for block fragments on a channel.
+
+            @param channelId The id of the channel in [0,numChannels-1].
+
+            @returns The number of bits written for block fragments on the channel since the connection was reset. These bits are also included in Connection::GetChannelBitsWritten.
+         */
+
+        uint64_t GetChannelFragmentBitsWritten( int channelId ) const;
+
+        /**
+            Get the number of bits written for a message type.
+
+            Includes the message type, the serialized message and its block, or the block fragments and snapshots of that message type, across all channels. Use it to find the message types that are worth compressing.
+
+            @param messageType The message type in [0,numTypes-1]. See MessageFactory::GetNumTypes.
+
+            @returns The number of bits written for messages of this type since the connection was reset.
+         */
+
+        uint64_t GetMessageTypeBitsWritten( int messageType ) const;
+
+        /**
+            Get the bit counters that connection packets add to as they are written.
+
+            IMPORTANT: Connection packets are serialized by the transport after they are generated, so the counters are passed to them via ConnectionContext::bitCounters. The client and server set this up for you.
+
+            @returns The packet bit counters.
+         */
+
+        PacketBitCounters * GetPacketBitCounters() { return &m_bitCounters; }
+
+        /**
+            Get the string dictionary for strings serialized with serialize_interned_string.
+
+            IMPORTANT: Like the packet bit counters, this is passed to connection packets via ConnectionContext::stringDictionary. The client and server set this up for you.
+
+            @returns The string dictionary, or NULL if ConnectionConfig::maxInternedStrings is zero.
+         */
+
+        StringDictionary * GetStringDictionary() { return m_stringDictionary; }
+
+        /**
+            Get network statistics for the connection.
+
+            Round trip time, packet loss and bandwidth are measured as connection packets are generated, processed and acked, and are smoothed according to the smoothing factors in ConnectionConfig.
+
+            @param info The network statistics [out].
+
+            @see NetworkInfo
+         */
+
+        void GetNetworkInfo( NetworkInfo & info ) const;
+
+        /**
+            Set the congestion controller for this connection.
+
+            By default the connection uses its own LedbatCongestionController if ConnectionConfig::enableCongestionControl is true, and no congestion controller otherwise.
+
+            IMPORTANT: The connection does not take ownership of the congestion controller. It must outlive the connection, or be cleared by setting NULL.
+
+            @param congestionController The congestion controller to use. Pass in NULL to disable congestion control.
+         */
+
+        void SetCongestionController( CongestionController * congestionController );
+
+        /**
+            Hold back block fragments from the packets this connection generates until this is cleared.
+
+            Messages without blocks keep flowing on channels that aren't sending a block. Used by the server to shed bulk data when its tick runs over budget. See ClientServerConfig::serverTickBudget.
+
+            @param deferBlocks True to hold back block fragments, false to send them again.
+
+            @see Channel::SetDeferBlocks
+         */
+
+        void SetDeferBlocks( bool deferBlocks );
+
+        /**
+            Get the congestion controller for this connection.
+
+            @returns The congestion controller, or NULL if congestion control is disabled.
+         */
+
+        CongestionController * GetCongestionController() { return m_congestionController; }
+
+        /**
+            Get the largest connection packet size confirmed to get through the path to the other side.
+
+            Message data in each packet generated is limited to this size. Without path MTU discovery this is ConnectionConfig::maxPacketSize.
+
+            @returns The path maximum packet size (bytes).
+
+            @see ConnectionConfig::enableMtuDiscovery
+         */
+
+        int GetPathMaxPacketSize() const;
+
+        /**
+            Is the connection still searching for the path maximum packet size?
+
+            @returns True if path MTU discovery is enabled and the search has not finished, false otherwise.
+         */
+
+        bool IsSearchingPathMaxPacketSize() const;
+
+        /**
+            Has the connection estimated the clock offset and tick interval of the other side?
+
+            Needs connection packets generated on at least two different ticks on the other side.
+
+            @returns True if clock sync is enabled and the estimates are available, false otherwise.
+
+            @see ConnectionConfig::enableClockSync
+         */
+
+        bool HasClockSync() const;
+
+        /**
+            Get the estimated offset between the clocks on each side of the connection.
+
+            This is the connection time on this side minus the connection time on the other side. It assumes the fastest packets take half the round trip time to arrive.
+
+            @returns The clock offset (seconds). 0 if there is no clock sync yet.
+         */
+
+        double GetClockOffset() const;
+
+        /**
+            Get the estimated tick interval on the other side of the connection.
+
+            This is the smallest gap between the times consecutive connection packets were generated on the other side, which is one tick when the other side generates packets every tick.
+
+            @returns The tick interval of the other side (seconds). 0 if there is no clock sync yet.
+         */
+
+        double GetRemoteTickInterval() const;
+
+        /**
+            Get the time the next tick starts on the other side of the connection.
+
+            Ticks on the other side are assumed to start when it generates connection packets, so this is the send time of the most recent packet received, plus whole tick intervals, converted to the connection time on this side.
+
+            @returns The connection time on this side of the first tick on the other side after the current time. The current time if there is no clock sync yet.
+         */
+
+        double GetNextRemoteTickTime() const;
+
     protected:
 
+        /**
+            Update the clock sync estimates with the send time of a connection packet received from the other side.
+
+            @param sendTime The connection time on the other side when the packet was generated (microseconds, wrapped).
+            @param receiveTime The connection time on this side when the packet was received.
+
+            @see ConnectionConfig::enableClockSync
+         */
+
+        void UpdateClockSync( uint32_t sendTime, double receiveTime );
+
         /**
             This is called for each connection packet generated, to mark that connection packet as unacked.
 
             Later on this entry is used to determine if a connection packet has already been acked, so we only trigger packet acked callbacks the first time we receive an ack for that packet.
 
+            It also records the time the packet was sent for RTT estimation, and takes a packet loss sample for an older packet that should have been acked by now.
+
             @param sequence The sequence number of the connection packet that was generated.
+            @param packetBytes The estimated size of the connection packet in bytes. Used for bandwidth estimation.
+            @param probeBytes The size the packet is padded to if it is a path MTU probe (bytes). 0 otherwise.
          */
 
-        void InsertAckPacketEntry( uint16_t sequence );
+        void InsertAckPacketEntry( uint16_t sequence, int packetBytes, int probeBytes = 0 );
 
         /**
             This is the payload function called to process acks in the packet header of the connection packet. 
 
             It walks across the ack bits and if bit n is set, then sequence number "ack - n" has been received be the other side, so it should be acked if it is not already.
 
+            Each word of ack bits is masked with the unacked packets first, and only the set bits that remain are visited, so acks for packets that were already acked cost nothing.
+
             @param ack The most recent acked packet sequence number.
-            @param ack_bits The ack bitfield. Bit n is set if ack - n packet has been received.
+            @param ack_bits The ack bitfield words. Bit n % 32 of word n / 32 is set if ack - n packet has been received. Covers ConnectionConfig::ackWindowSize packets.
+            @param ackTime The connection time the acks were received. Used to measure RTT for newly acked packets.
 
             @see ConnectionPacket
          */
 
-        void ProcessAcks( uint16_t ack, uint32_t ack_bits );
+        void ProcessAcks( uint16_t ack, const uint32_t * ack_bits, double ackTime );
+
+        /**
+            Get the unacked bits for 32 consecutive sent packet sequence numbers.
+
+            @param sequence The first sequence number.
+
+            @returns Bit n is set if the sent packet buffer index for sequence + n holds a packet that has not been acked. Call SequenceBuffer::Find to check it is that packet.
+         */
+
+        uint32_t GetUnackedBits( uint16_t sequence ) const;
 
         /**
             This method is called when a packet is acked.
@@ -436,12 +1056,62 @@ namespace yojimbo
 
         void PacketAcked( uint16_t sequence );
 
+        /**
+            Add an RTT sample to the smoothed RTT and jitter estimates.
+
+            @param rtt The RTT sample in milliseconds. This is the time between a connection packet being generated and the first ack for it being processed.
+
+            @see ConnectionConfig::rttSmoothingFactor
+         */
+
+        void UpdateRTT( float rtt );
+
+        /**
+            Get the number of packets sent after a packet before it is considered lost if it has not been acked.
+
+            This is twice the ack window, so each packet has had plenty of chances to be acked, but no more than the sliding window size, so the sent packet entry is still available.
+
+            @returns The packet loss sample delay (packets).
+         */
+
+        int GetPacketLossDelay() const;
+
+        /**
+            Drive path MTU discovery as packets are generated.
+
+            While the search is running, one packet at a time is made a probe, padded out half way between the largest size confirmed and the smallest size known to fail. Probes that are acked raise the size confirmed, and each size that loses ConnectionConfig::mtuProbeMaxAttempts probes in a row lowers the smallest size known to fail.
+
+            @param packet The connection packet being generated.
+
+            @see ConnectionConfig::enableMtuDiscovery
+         */
+
+        void UpdateMtuProbe( ConnectionPacket * packet );
+
+        /**
+            Serialize the connection state.
+
+            Implements Connection::SerializeState for each stream type.
+
+            @param stream The stream to read from, write to or measure.
+
+            @returns True if serialization succeeded, false otherwise.
+         */
+
+        template <typename Stream> bool SerializeStateInternal( Stream & stream );
+
     protected:
 
         virtual void OnPacketAcked( uint16_t sequence );
 
         virtual void OnChannelFragmentReceived( class Channel * channel, uint16_t messageId, uint16_t fragmentId, int fragmentBytes, int numFragmentsReceived, int numFragmentsInBlock );
 
+        virtual void OnChannelBlockDataReceived( class Channel * channel, uint16_t messageId, BlockMessage * blockMessage, int blockOffset, const uint8_t * data, int dataBytes, bool blockComplete );
+
+        virtual SharedBlock * OnChannelBlockCacheFind( class Channel * channel, uint64_t blockHash, int blockSize );
+
+        virtual void OnChannelBlockCacheStore( class Channel * channel, uint64_t blockHash, const uint8_t * blockData, int blockSize );
+
     private:
 
         const ConnectionConfig m_connectionConfig;                                      ///< The connection configuration.
@@ -464,8 +1134,76 @@ namespace yojimbo
 
         SequenceBuffer<ConnectionReceivedPacketData> * m_receivedPackets;               ///< Sequence buffer for received connection packets. Used by the ack system.
 
+        BitArray * m_unackedPackets;                                                    ///< Bit n is set if the sent packet at index n in the sent packet buffer has not been acked yet. Masks the ack bits so only newly acked packets are looked up.
+
+        StringDictionary * m_stringDictionary;                                          ///< The string dictionary for interned strings. NULL if ConnectionConfig::maxInternedStrings is zero.
+
         uint64_t m_counters[CONNECTION_COUNTER_NUM_COUNTERS];                           ///< Counters for unit testing, stats, telemetry etc.
 
+        PacketBitCounters m_bitCounters;                                                ///< Bits written per-channel and per-message type as connection packets are serialized. The message type array is allocated with the connection allocator.
+
+        double m_time;                                                                  ///< The current connection time. See Connection::AdvanceTime. Negative until the first call to advance time, so packets sent before then are not used for RTT estimation.
+
+        double m_platformTime;                                                          ///< The value of platform_time when Connection::AdvanceTime was last called. Maps packet receive times onto connection time.
+
+        double m_bandwidthTime;                                                         ///< The time of the last bandwidth sample. Negative if no bandwidth sample has been taken yet.
+
+        bool m_hasRTT;                                                                  ///< True once the first round trip time sample has been taken.
+
+        NetworkInfo m_networkInfo;                                                      ///< Smoothed network statistics. See Connection::GetNetworkInfo.
+
+        LedbatCongestionController m_defaultCongestionController;                       ///< The congestion controller used when ConnectionConfig::enableCongestionControl is true.
+
+        CongestionController * m_congestionController;                                  ///< The current congestion controller. NULL if congestion control is disabled. See Connection::SetCongestionController.
+
+        int m_channelOrder[MaxChannels];                                                ///< Channel ids sorted by descending priority. Channels with the same priority keep their relative order. Only used if ConnectionConfig::enableChannelScheduling is true. See ChannelConfig::priority.
+
+        int m_channelDeficit[MaxChannels];                                              ///< Per-channel deficit counters for sharing packet space between channels of the same priority (bits). See ChannelConfig::weight.
+
+        uint32_t m_channelRoundRobin;                                                   ///< Rotates which channel of each priority is filled first in a connection packet, so no channel is always last to be filled.
+
+        uint64_t m_bytesSent;                                                           ///< Bytes sent since the last bandwidth sample.
+
+        uint64_t m_bytesReceived;                                                       ///< Bytes received since the last bandwidth sample.
+
+        uint64_t m_bytesAcked;                                                          ///< Bytes acked since the last bandwidth sample.
+
+        int m_pathMaxPacketSize;                                                        ///< The largest connection packet size confirmed to get through (bytes). See Connection::GetPathMaxPacketSize.
+
+        int m_mtuSearchLimit;                                                           ///< The smallest connection packet size known not to get through (bytes). One more than the largest size probed for until a probe size fails.
+
+        int m_mtuProbeBytes;                                                            ///< The size of the probe packet in flight (bytes). 0 if there is no probe packet in flight.
+
+        int m_mtuProbeAttempts;                                                         ///< The number of probe packets of the current probe size that have been lost.
+
+        double m_mtuProbeTime;                                                          ///< The time the probe packet in flight was generated.
+
+        double m_mtuSearchTime;                                                         ///< The time the last search finished. Negative while searching.
+
+        bool m_hasAckedPacket;                                                          ///< True once any packet sent over this connection has been acked.
+
+        bool m_ackPending;                                                              ///< True if a packet with messages has been received since the last connection packet was generated. See ConnectionConfig::delayAcks.
+
+        double m_ackPendingTime;                                                        ///< The connection time the oldest packet with messages waiting to be acked was received. Only valid if m_ackPending is true.
+
+        uint16_t m_mostRecentAckedSequence;                                             ///< The most recent sequence number acked by the other side. Compressed packet headers only truncate the sequence number while it is close to this. See ConnectionConfig::compressPacketHeader.
+
+        bool m_clockSyncReceivedPacket;                                                 ///< True once a connection packet with a send time has been received. See ConnectionConfig::enableClockSync.
+
+        bool m_hasRemoteTickInterval;                                                   ///< True once connection packets generated on two different ticks on the other side have been received.
+
+        uint32_t m_remoteSendTime;                                                      ///< The wrapped send time of the most recent packet generated on the other side (microseconds).
+
+        double m_remoteTime;                                                            ///< The send time of the most recent packet generated on the other side, unwrapped (seconds). A tick starts on the other side at this time.
+
+        double m_remoteReceiveTime;                                                     ///< The connection time on this side that the most recent packet generated on the other side was received.
+
+        double m_clockSyncOffset[2];                                                    ///< The smallest receive time minus send time over the current and previous ClockSyncWindow (seconds). The fastest packets have the least delay on top of the clock offset.
+
+        double m_remoteTickInterval[2];                                                 ///< The smallest gap between send times of consecutive packets over the current and previous ClockSyncWindow (seconds). Only valid if m_hasRemoteTickInterval is true.
+
+        double m_clockSyncWindowStart;                                                  ///< The connection time the current ClockSyncWindow started.
+
     private:
 
         Connection( const Connection & other );
@@ -34,8 +34,21 @@
 #include <stdlib.h>
 #include <memory.h>
 
+#if defined( __AVX2__ )
+#define YOJIMBO_SALSA_AVX2 1
+#include <immintrin.h>
+#elif defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define YOJIMBO_SALSA_SSE2 1
+#include <emmintrin.h>
+#endif // #if defined( __AVX2__ )
+
 namespace yojimbo
 {
+    struct PacketCipherState
+    {
+        crypto_aead_aes256gcm_state aes256gcm;
+    };
+
     void GenerateKey( uint8_t * key )
     {
         assert( key );
@@ -85,6 +98,394 @@ namespace yojimbo
         return true;
     }
 
+    bool Encrypt_InPlace( uint8_t * message, int messageLength, uint8_t * mac, const uint8_t * nonce, const uint8_t * key )
+    {
+        assert( KeyBytes == crypto_secretbox_KEYBYTES );
+        assert( MacBytes == crypto_secretbox_MACBYTES );
+
+        uint8_t actual_nonce[crypto_secretbox_NONCEBYTES];
+        memset( actual_nonce, 0, sizeof( actual_nonce ) );
+        memcpy( actual_nonce, nonce, NonceBytes );
+
+        return crypto_secretbox_detached( message, mac, message, messageLength, actual_nonce, key ) == 0;
+    }
+
+    bool Decrypt_InPlace( uint8_t * message, int messageLength, const uint8_t * mac, const uint8_t * nonce, const uint8_t * key )
+    {
+        assert( KeyBytes == crypto_secretbox_KEYBYTES );
+        assert( MacBytes == crypto_secretbox_MACBYTES );
+
+        uint8_t actual_nonce[crypto_secretbox_NONCEBYTES];
+        memset( actual_nonce, 0, sizeof( actual_nonce ) );
+        memcpy( actual_nonce, nonce, NonceBytes );
+
+        return crypto_secretbox_open_detached( message, message, mac, messageLength, actual_nonce, key ) == 0;
+    }
+
+    bool IsPacketCipherAvailable( PacketCipher cipher )
+    {
+        switch ( cipher )
+        {
+            case PACKET_CIPHER_XSALSA20_POLY1305:
+                return true;
+
+            case PACKET_CIPHER_AES256_GCM:
+                return crypto_aead_aes256gcm_is_available() != 0;
+
+            default:
+                return false;
+        }
+    }
+
+    bool Encrypt_InPlace( PacketCipher cipher, uint8_t * message, int messageLength, uint8_t * mac, const uint8_t * nonce, const uint8_t * key, const PacketCipherState * keyState )
+    {
+        if ( cipher == PACKET_CIPHER_XSALSA20_POLY1305 )
+            return Encrypt_InPlace( message, messageLength, mac, nonce, key );
+
+        if ( cipher != PACKET_CIPHER_AES256_GCM || !crypto_aead_aes256gcm_is_available() )
+            return false;
+
+        assert( KeyBytes == crypto_aead_aes256gcm_KEYBYTES );
+        assert( MacBytes == crypto_aead_aes256gcm_ABYTES );
+
+        uint8_t actual_nonce[crypto_aead_aes256gcm_NPUBBYTES];
+        memset( actual_nonce, 0, sizeof( actual_nonce ) );
+        memcpy( actual_nonce, nonce, NonceBytes );
+
+        if ( keyState )
+            return crypto_aead_aes256gcm_encrypt_detached_afternm( message, mac, NULL, message, messageLength, NULL, 0, NULL, actual_nonce, &keyState->aes256gcm ) == 0;
+
+        return crypto_aead_aes256gcm_encrypt_detached( message, mac, NULL, message, messageLength, NULL, 0, NULL, actual_nonce, key ) == 0;
+    }
+
+    bool Decrypt_InPlace( PacketCipher cipher, uint8_t * message, int messageLength, const uint8_t * mac, const uint8_t * nonce, const uint8_t * key, const PacketCipherState * keyState )
+    {
+        if ( cipher == PACKET_CIPHER_XSALSA20_POLY1305 )
+            return Decrypt_InPlace( message, messageLength, mac, nonce, key );
+
+        if ( cipher != PACKET_CIPHER_AES256_GCM || !crypto_aead_aes256gcm_is_available() )
+            return false;
+
+        assert( KeyBytes == crypto_aead_aes256gcm_KEYBYTES );
+        assert( MacBytes == crypto_aead_aes256gcm_ABYTES );
+
+        uint8_t actual_nonce[crypto_aead_aes256gcm_NPUBBYTES];
+        memset( actual_nonce, 0, sizeof( actual_nonce ) );
+        memcpy( actual_nonce, nonce, NonceBytes );
+
+        if ( keyState )
+            return crypto_aead_aes256gcm_decrypt_detached_afternm( message, NULL, message, messageLength, mac, NULL, 0, actual_nonce, &keyState->aes256gcm ) == 0;
+
+        return crypto_aead_aes256gcm_decrypt_detached( message, NULL, message, messageLength, mac, NULL, 0, actual_nonce, key ) == 0;
+    }
+
+    // IMPORTANT: Batch encryption works on several Salsa20 blocks at once, one per SIMD lane. Lane n of a SalsaVector holds the same word of the Salsa20 state for block n.
+
+#if YOJIMBO_SALSA_AVX2
+
+    const int SalsaLanes = 8;
+
+    typedef __m256i SalsaVector;
+
+    static inline SalsaVector salsa_load( const uint32_t * p ) { return _mm256_loadu_si256( (const __m256i*) p ); }
+    static inline void salsa_store( uint32_t * p, SalsaVector v ) { _mm256_storeu_si256( (__m256i*) p, v ); }
+    static inline SalsaVector salsa_add( SalsaVector a, SalsaVector b ) { return _mm256_add_epi32( a, b ); }
+    static inline SalsaVector salsa_xor_rotate( SalsaVector a, SalsaVector b, int shift ) { return _mm256_xor_si256( a, _mm256_or_si256( _mm256_slli_epi32( b, shift ), _mm256_srli_epi32( b, 32 - shift ) ) ); }
+
+#elif YOJIMBO_SALSA_SSE2
+
+    const int SalsaLanes = 4;
+
+    typedef __m128i SalsaVector;
+
+    static inline SalsaVector salsa_load( const uint32_t * p ) { return _mm_loadu_si128( (const __m128i*) p ); }
+    static inline void salsa_store( uint32_t * p, SalsaVector v ) { _mm_storeu_si128( (__m128i*) p, v ); }
+    static inline SalsaVector salsa_add( SalsaVector a, SalsaVector b ) { return _mm_add_epi32( a, b ); }
+    static inline SalsaVector salsa_xor_rotate( SalsaVector a, SalsaVector b, int shift ) { return _mm_xor_si128( a, _mm_or_si128( _mm_slli_epi32( b, shift ), _mm_srli_epi32( b, 32 - shift ) ) ); }
+
+#else // #if YOJIMBO_SALSA_AVX2
+
+    const int SalsaLanes = 4;
+
+    struct SalsaVector { uint32_t lane[SalsaLanes]; };
+
+    static inline SalsaVector salsa_load( const uint32_t * p ) { SalsaVector v; memcpy( v.lane, p, sizeof( v.lane ) ); return v; }
+    static inline void salsa_store( uint32_t * p, SalsaVector v ) { memcpy( p, v.lane, sizeof( v.lane ) ); }
+
+    static inline SalsaVector salsa_add( SalsaVector a, SalsaVector b )
+    {
+        for ( int i = 0; i < SalsaLanes; ++i )
+            a.lane[i] += b.lane[i];
+        return a;
+    }
+
+    static inline SalsaVector salsa_xor_rotate( SalsaVector a, SalsaVector b, int shift )
+    {
+        for ( int i = 0; i < SalsaLanes; ++i )
+            a.lane[i] ^= ( b.lane[i] << shift ) | ( b.lane[i] >> ( 32 - shift ) );
+        return a;
+    }
+
+#endif // #if YOJIMBO_SALSA_AVX2
+
+    const int SalsaBlockBytes = 64;
+
+    const int EncryptBatchChunkSize = 64;
+
+    static inline uint32_t salsa_load32( const uint8_t * p )
+    {
+        return uint32_t( p[0] ) | ( uint32_t( p[1] ) << 8 ) | ( uint32_t( p[2] ) << 16 ) | ( uint32_t( p[3] ) << 24 );
+    }
+
+    static inline void salsa_store32( uint8_t * p, uint32_t value )
+    {
+        p[0] = uint8_t( value );
+        p[1] = uint8_t( value >> 8 );
+        p[2] = uint8_t( value >> 16 );
+        p[3] = uint8_t( value >> 24 );
+    }
+
+#define SALSA20_STEP( a, b, c, shift ) v[a] = salsa_xor_rotate( v[a], salsa_add( v[b], v[c] ), shift )
+
+    static void salsa20_lanes( uint32_t x[16][SalsaLanes], bool feedForward )
+    {
+        SalsaVector v[16];
+
+        for ( int i = 0; i < 16; ++i )
+            v[i] = salsa_load( x[i] );
+
+        for ( int i = 0; i < 10; ++i )
+        {
+            SALSA20_STEP(  4,  0, 12,  7 );
+            SALSA20_STEP(  8,  4,  0,  9 );
+            SALSA20_STEP( 12,  8,  4, 13 );
+            SALSA20_STEP(  0, 12,  8, 18 );
+            SALSA20_STEP(  9,  5,  1,  7 );
+            SALSA20_STEP( 13,  9,  5,  9 );
+            SALSA20_STEP(  1, 13,  9, 13 );
+            SALSA20_STEP(  5,  1, 13, 18 );
+            SALSA20_STEP( 14, 10,  6,  7 );
+            SALSA20_STEP(  2, 14, 10,  9 );
+            SALSA20_STEP(  6,  2, 14, 13 );
+            SALSA20_STEP( 10,  6,  2, 18 );
+            SALSA20_STEP(  3, 15, 11,  7 );
+            SALSA20_STEP(  7,  3, 15,  9 );
+            SALSA20_STEP( 11,  7,  3, 13 );
+            SALSA20_STEP( 15, 11,  7, 18 );
+
+            SALSA20_STEP(  1,  0,  3,  7 );
+            SALSA20_STEP(  2,  1,  0,  9 );
+            SALSA20_STEP(  3,  2,  1, 13 );
+            SALSA20_STEP(  0,  3,  2, 18 );
+            SALSA20_STEP(  6,  5,  4,  7 );
+            SALSA20_STEP(  7,  6,  5,  9 );
+            SALSA20_STEP(  4,  7,  6, 13 );
+            SALSA20_STEP(  5,  4,  7, 18 );
+            SALSA20_STEP( 11, 10,  9,  7 );
+            SALSA20_STEP(  8, 11, 10,  9 );
+            SALSA20_STEP(  9,  8, 11, 13 );
+            SALSA20_STEP( 10,  9,  8, 18 );
+            SALSA20_STEP( 12, 15, 14,  7 );
+            SALSA20_STEP( 13, 12, 15,  9 );
+            SALSA20_STEP( 14, 13, 12, 13 );
+            SALSA20_STEP( 15, 14, 13, 18 );
+        }
+
+        // HSalsa20 uses the state as is. Salsa20 adds the input back in.
+
+        for ( int i = 0; i < 16; ++i )
+            salsa_store( x[i], feedForward ? salsa_add( v[i], salsa_load( x[i] ) ) : v[i] );
+    }
+
+#undef SALSA20_STEP
+
+    static void salsa20_set_lane( uint32_t x[16][SalsaLanes], int lane, const uint32_t * key, const uint8_t * input )
+    {
+        // IMPORTANT: The input is the nonce and block counter for Salsa20, and the first 16 bytes of the nonce for HSalsa20. Both go in words 6-9.
+
+        x[0][lane] = 0x61707865;
+        x[1][lane] = key[0];
+        x[2][lane] = key[1];
+        x[3][lane] = key[2];
+        x[4][lane] = key[3];
+        x[5][lane] = 0x3320646e;
+        x[6][lane] = salsa_load32( input );
+        x[7][lane] = salsa_load32( input + 4 );
+        x[8][lane] = salsa_load32( input + 8 );
+        x[9][lane] = salsa_load32( input + 12 );
+        x[10][lane] = 0x79622d32;
+        x[11][lane] = key[4];
+        x[12][lane] = key[5];
+        x[13][lane] = key[6];
+        x[14][lane] = key[7];
+        x[15][lane] = 0x6b206574;
+    }
+
+    static bool EncryptBatch_XSalsa20( EncryptBatchEntry * entries, int numEntries )
+    {
+        assert( numEntries > 0 );
+        assert( numEntries <= EncryptBatchChunkSize );
+
+        uint32_t x[16][SalsaLanes];
+        uint32_t subkeys[EncryptBatchChunkSize][8];
+        uint8_t polyKeys[EncryptBatchChunkSize][32];
+        uint8_t input[SalsaLanes][16];
+        int packetIndex[SalsaLanes];
+        int blockIndex[SalsaLanes];
+
+        memset( x, 0, sizeof( x ) );
+        memset( input, 0, sizeof( input ) );
+
+        // Derive the XSalsa20 subkey for each message with HSalsa20, SalsaLanes messages at a time.
+
+        for ( int first = 0; first < numEntries; first += SalsaLanes )
+        {
+            const int numLanes = ( numEntries - first < SalsaLanes ) ? numEntries - first : SalsaLanes;
+
+            for ( int lane = 0; lane < numLanes; ++lane )
+            {
+                const EncryptBatchEntry & entry = entries[first+lane];
+
+                uint32_t key[8];
+                for ( int i = 0; i < 8; ++i )
+                    key[i] = salsa_load32( entry.key + i * 4 );
+
+                memset( input[lane], 0, 16 );
+                memcpy( input[lane], entry.nonce, NonceBytes );
+
+                salsa20_set_lane( x, lane, key, input[lane] );
+
+                sodium_memzero( key, sizeof( key ) );
+            }
+
+            salsa20_lanes( x, false );
+
+            for ( int lane = 0; lane < numLanes; ++lane )
+            {
+                uint32_t * subkey = subkeys[first+lane];
+                subkey[0] = x[0][lane];
+                subkey[1] = x[5][lane];
+                subkey[2] = x[10][lane];
+                subkey[3] = x[15][lane];
+                subkey[4] = x[6][lane];
+                subkey[5] = x[7][lane];
+                subkey[6] = x[8][lane];
+                subkey[7] = x[9][lane];
+            }
+        }
+
+        // Generate keystream blocks for all messages, SalsaLanes blocks at a time. Blocks are taken in order across messages, so every lane has work to do until the last few blocks of the batch.
+        // The first 32 bytes of keystream for each message is the Poly1305 key. The message is encrypted with the keystream after that.
+
+        memset( input, 0, sizeof( input ) );
+
+        int currentPacket = 0;
+        int currentBlock = 0;
+
+        while ( currentPacket < numEntries )
+        {
+            int numLanes = 0;
+
+            while ( numLanes < SalsaLanes && currentPacket < numEntries )
+            {
+                const int numBlocks = ( 32 + entries[currentPacket].messageLength + SalsaBlockBytes - 1 ) / SalsaBlockBytes;
+
+                packetIndex[numLanes] = currentPacket;
+                blockIndex[numLanes] = currentBlock;
+
+                // IMPORTANT: The last 8 bytes of the 24 byte XSalsa20 nonce are always zero, because only the first yojimbo::NonceBytes are used. So the Salsa20 input is 8 zero bytes followed by the block counter.
+
+                salsa_store32( input[numLanes] + 8, uint32_t( currentBlock ) );
+
+                salsa20_set_lane( x, numLanes, subkeys[currentPacket], input[numLanes] );
+
+                numLanes++;
+
+                if ( ++currentBlock == numBlocks )
+                {
+                    currentPacket++;
+                    currentBlock = 0;
+                }
+            }
+
+            salsa20_lanes( x, true );
+
+            for ( int lane = 0; lane < numLanes; ++lane )
+            {
+                uint8_t keystream[SalsaBlockBytes];
+                for ( int i = 0; i < 16; ++i )
+                    salsa_store32( keystream + i * 4, x[i][lane] );
+
+                EncryptBatchEntry & entry = entries[packetIndex[lane]];
+
+                int keystreamOffset = 0;
+                int messageOffset = blockIndex[lane] * SalsaBlockBytes - 32;
+
+                if ( blockIndex[lane] == 0 )
+                {
+                    memcpy( polyKeys[packetIndex[lane]], keystream, 32 );
+                    keystreamOffset = 32;
+                    messageOffset = 0;
+                }
+
+                int bytes = SalsaBlockBytes - keystreamOffset;
+                if ( bytes > entry.messageLength - messageOffset )
+                    bytes = entry.messageLength - messageOffset;
+
+                for ( int i = 0; i < bytes; ++i )
+                    entry.message[messageOffset+i] ^= keystream[keystreamOffset+i];
+
+                sodium_memzero( keystream, sizeof( keystream ) );
+            }
+        }
+
+        bool result = true;
+
+        for ( int i = 0; i < numEntries; ++i )
+        {
+            if ( crypto_onetimeauth_poly1305( entries[i].mac, entries[i].message, entries[i].messageLength, polyKeys[i] ) != 0 )
+                result = false;
+        }
+
+        sodium_memzero( x, sizeof( x ) );
+        sodium_memzero( subkeys, sizeof( subkeys ) );
+        sodium_memzero( polyKeys, sizeof( polyKeys ) );
+
+        return result;
+    }
+
+    bool EncryptBatch_InPlace( PacketCipher cipher, EncryptBatchEntry * entries, int numEntries )
+    {
+        assert( entries );
+        assert( numEntries >= 0 );
+
+        bool result = true;
+
+        if ( cipher != PACKET_CIPHER_XSALSA20_POLY1305 || numEntries == 1 )
+        {
+            for ( int i = 0; i < numEntries; ++i )
+            {
+                EncryptBatchEntry & entry = entries[i];
+                if ( !Encrypt_InPlace( cipher, entry.message, entry.messageLength, entry.mac, entry.nonce, entry.key, entry.keyState ) )
+                    result = false;
+            }
+
+            return result;
+        }
+
+        assert( KeyBytes == crypto_secretbox_KEYBYTES );
+        assert( MacBytes == crypto_secretbox_MACBYTES );
+
+        for ( int i = 0; i < numEntries; i += EncryptBatchChunkSize )
+        {
+            const int numChunkEntries = ( numEntries - i < EncryptBatchChunkSize ) ? numEntries - i : EncryptBatchChunkSize;
+            if ( !EncryptBatch_XSalsa20( entries + i, numChunkEntries ) )
+                result = false;
+        }
+
+        return result;
+    }
+
     bool Encrypt_AEAD( const uint8_t * message, uint64_t messageLength, 
                        uint8_t * encryptedMessage, uint64_t &  encryptedMessageLength,
                        const uint8_t * additional, uint64_t additionalLength,
@@ -136,11 +537,73 @@ namespace yojimbo
         return result == 0;
     }
 
-    EncryptionManager::EncryptionManager()
+    EncryptionManager::EncryptionManager( Allocator & allocator ) : m_addressMap( allocator, MaxEncryptionMappings ), m_timerWheel( allocator, MaxEncryptionMappings )
     {
+        m_allocator = &allocator;
+        m_packetCipher = PACKET_CIPHER_XSALSA20_POLY1305;
+        memset( m_keyStateMemory, 0, sizeof( m_keyStateMemory ) );
+        memset( m_keyState, 0, sizeof( m_keyState ) );
         ResetEncryptionMappings();
     }
 
+    EncryptionManager::~EncryptionManager()
+    {
+        FreeKeyStates();
+    }
+
+    void EncryptionManager::FreeKeyStates()
+    {
+        for ( int i = 0; i < MaxEncryptionMappings; ++i )
+        {
+            if ( m_keyStateMemory[i] )
+                sodium_memzero( m_keyStateMemory[i], sizeof( PacketCipherState ) * 2 + 16 );
+
+            YOJIMBO_FREE( *m_allocator, m_keyStateMemory[i] );
+
+            m_keyState[i] = NULL;
+        }
+    }
+
+    void EncryptionManager::SetPacketCipher( PacketCipher cipher )
+    {
+        if ( cipher == m_packetCipher )
+            return;
+
+        FreeKeyStates();
+
+        m_packetCipher = cipher;
+
+        for ( int i = 0; i < m_numEncryptionMappings; ++i )
+        {
+            if ( m_address[i].IsValid() )
+                UpdateKeyState( i );
+        }
+    }
+
+    void EncryptionManager::UpdateKeyState( int index )
+    {
+        assert( index >= 0 );
+        assert( index < MaxEncryptionMappings );
+
+        if ( m_packetCipher != PACKET_CIPHER_AES256_GCM || !crypto_aead_aes256gcm_is_available() )
+            return;
+
+        if ( !m_keyStateMemory[index] )
+        {
+            // IMPORTANT: crypto_aead_aes256gcm_state must be 16 byte aligned, which the allocator doesn't guarantee
+
+            m_keyStateMemory[index] = YOJIMBO_ALLOCATE( *m_allocator, sizeof( PacketCipherState ) * 2 + 16 );
+
+            if ( !m_keyStateMemory[index] )
+                return;
+
+            m_keyState[index] = (PacketCipherState*) ( ( uintptr_t( m_keyStateMemory[index] ) + 15 ) & ~uintptr_t( 15 ) );
+        }
+
+        crypto_aead_aes256gcm_beforenm( &m_keyState[index][0].aes256gcm, m_sendKey + index * KeyBytes );
+        crypto_aead_aes256gcm_beforenm( &m_keyState[index][1].aes256gcm, m_receiveKey + index * KeyBytes );
+    }
+
     bool EncryptionManager::AddEncryptionMapping( const Address & address, const uint8_t * sendKey, const uint8_t * receiveKey, double time, double timeout )
     {
 #if YOJIMBO_DEBUG_SPAM
@@ -151,40 +614,48 @@ namespace yojimbo
         }
 #endif // #if YOJIMBO_DEBUG_SPAM
 
-        for ( int i = 0; i < m_numEncryptionMappings; ++i )
-        {
-            if ( m_address[i] == address && m_lastAccessTime[i] + m_timeout[i] >= time )
-            {
-                m_lastAccessTime[i] = time;
-                m_timeout[i] = timeout;
-                memcpy( m_sendKey + i*KeyBytes, sendKey, KeyBytes );
-                memcpy( m_receiveKey + i*KeyBytes, receiveKey, KeyBytes );
-                return true;
-            }
-        }
+        int index = m_addressMap.Find( address );
 
-        for ( int i = 0; i < MaxEncryptionMappings; ++i )
+        if ( index == -1 )
         {
-            if ( m_lastAccessTime[i] + m_timeout[i] < time )
+            // IMPORTANT: Timed out encryption mappings are only freed in AdvanceTime. If there are no free slots, expire them now before giving up.
+
+            if ( m_numFreeEncryptionMappings == 0 )
+                AdvanceTime( time );
+
+            if ( m_numFreeEncryptionMappings == 0 )
             {
-                m_address[i] = address;
-                m_lastAccessTime[i] = time;
-                m_timeout[i] = timeout;
-                memcpy( m_sendKey + i*KeyBytes, sendKey, KeyBytes );
-                memcpy( m_receiveKey + i*KeyBytes, receiveKey, KeyBytes );
-                if ( i + 1 > m_numEncryptionMappings )
-                    m_numEncryptionMappings = i + 1;
-                return true;
+#if YOJIMBO_DEBUG_SPAM
+                char addressString[MaxAddressLength];
+                address.ToString( addressString, MaxAddressLength );
+                debug_printf( "failed to add encryption mapping for %s\n", addressString );
+#endif // #if YOJIMBO_DEBUG_SPAM
+
+                return false;
             }
+
+            index = m_freeEncryptionMappings[--m_numFreeEncryptionMappings];
+
+            m_addressMap.Insert( address, index );
         }
 
-#if YOJIMBO_DEBUG_SPAM
-        char addressString[MaxAddressLength];
-        address.ToString( addressString, MaxAddressLength );
-        debug_printf( "failed to add encryption mapping for %s\n", addressString );
-#endif // #if YOJIMBO_DEBUG_SPAM
+        assert( index >= 0 );
+        assert( index < MaxEncryptionMappings );
+
+        m_address[index] = address;
+        m_lastAccessTime[index] = time;
+        m_timeout[index] = timeout;
+        memcpy( m_sendKey + index*KeyBytes, sendKey, KeyBytes );
+        memcpy( m_receiveKey + index*KeyBytes, receiveKey, KeyBytes );
+
+        UpdateKeyState( index );
+
+        m_timerWheel.Schedule( index, time + timeout );
+
+        if ( index + 1 > m_numEncryptionMappings )
+            m_numEncryptionMappings = index + 1;
 
-        return false;
+        return true;
     }
 
     bool EncryptionManager::RemoveEncryptionMapping( const Address & address, double time )
@@ -197,40 +668,81 @@ namespace yojimbo
         }
 #endif // #if YOJIMBO_DEBUG_SPAM
 
-        for ( int i = 0; i < m_numEncryptionMappings; ++i )
+        const int i = m_addressMap.Find( address );
+
+        if ( i == -1 )
         {
-            if ( m_address[i] == address )
-            {
-                m_address[i] = Address();
-                m_lastAccessTime[i] = -1000.0;
-                m_timeout[i] = 0.0;
-                
-                memset( m_sendKey + i*KeyBytes, 0, KeyBytes );
-                memset( m_receiveKey + i*KeyBytes, 0, KeyBytes );
-
-                if ( i + 1 == m_numEncryptionMappings )
-                {
-                    int index = i - 1;
-                    while ( index >= 0 )
-                    {
-                        if ( m_lastAccessTime[index] + m_timeout[index] >= time )
-                            break;
-                        index--;
-                    }
-                    m_numEncryptionMappings = index + 1;
-                }
+#if YOJIMBO_DEBUG_SPAM
+            char addressString[MaxAddressLength];
+            address.ToString( addressString, MaxAddressLength );
+            debug_printf( "failed to remove encryption mapping: %s\n", addressString );
+#endif // #if YOJIMBO_DEBUG_SPAM
 
-                return true;
-            }
+            return false;
         }
 
+        assert( m_address[i] == address );
+
+        (void) time;
+
+        FreeEncryptionMapping( i );
+
+        return true;
+    }
+
+    void EncryptionManager::FreeEncryptionMapping( int index )
+    {
+        assert( index >= 0 );
+        assert( index < m_numEncryptionMappings );
+        assert( m_address[index].IsValid() );
+        assert( m_numFreeEncryptionMappings < MaxEncryptionMappings );
+
+        m_addressMap.Remove( m_address[index] );
+
+        m_timerWheel.Cancel( index );
+
+        m_address[index] = Address();
+        m_lastAccessTime[index] = -1000.0;
+        m_timeout[index] = 0.0;
+
+        memset( m_sendKey + index*KeyBytes, 0, KeyBytes );
+        memset( m_receiveKey + index*KeyBytes, 0, KeyBytes );
+
+        if ( m_keyState[index] )
+            sodium_memzero( m_keyState[index], sizeof( PacketCipherState ) * 2 );
+
+        m_freeEncryptionMappings[m_numFreeEncryptionMappings++] = index;
+    }
+
+    void EncryptionManager::AdvanceTime( double time )
+    {
+        const int numExpired = m_timerWheel.AdvanceTime( time, m_expiredEncryptionMappings );
+
+        for ( int i = 0; i < numExpired; ++i )
+        {
+            const int index = m_expiredEncryptionMappings[i];
+
+            assert( m_address[index].IsValid() );
+
+            // IMPORTANT: Touching an encryption mapping doesn't reschedule its timer, so the real deadline may have moved since the timer was scheduled.
+
+            const double deadline = m_lastAccessTime[index] + m_timeout[index];
+
+            if ( deadline < time )
+            {
 #if YOJIMBO_DEBUG_SPAM
-        char addressString[MaxAddressLength];
-        address.ToString( addressString, MaxAddressLength );
-        debug_printf( "failed to remove encryption mapping: %s\n", addressString );
+                char addressString[MaxAddressLength];
+                m_address[index].ToString( addressString, MaxAddressLength );
+                debug_printf( "encryption mapping timed out: %s (t=%f)\n", addressString, time );
 #endif // #if YOJIMBO_DEBUG_SPAM
 
-        return false;
+                FreeEncryptionMapping( index );
+            }
+            else
+            {
+                m_timerWheel.Schedule( index, deadline );
+            }
+        }
     }
 
     void EncryptionManager::ResetEncryptionMappings()
@@ -238,29 +750,83 @@ namespace yojimbo
         debug_printf( "reset encryption mappings\n" );
 
         m_numEncryptionMappings = 0;
+
+        m_numFreeEncryptionMappings = MaxEncryptionMappings;
         
         for ( int i = 0; i < MaxEncryptionMappings; ++i )
         {
             m_lastAccessTime[i] = -1000.0;
             m_timeout[i] = 0.0f;
             m_address[i] = Address();
+            m_freeEncryptionMappings[i] = MaxEncryptionMappings - 1 - i;
         }
         
         memset( m_sendKey, 0, sizeof( m_sendKey ) );
         memset( m_receiveKey, 0, sizeof( m_receiveKey ) );
+
+        for ( int i = 0; i < MaxEncryptionMappings; ++i )
+        {
+            if ( m_keyState[i] )
+                sodium_memzero( m_keyState[i], sizeof( PacketCipherState ) * 2 );
+        }
+
+        m_addressMap.Clear();
+
+        m_timerWheel.Reset( 0.0 );
     }
 
-    int EncryptionManager::FindEncryptionMapping( const Address & address, double time )
+    bool EncryptionManager::MoveEncryptionMapping( int index, const Address & address, double time )
     {
-        for ( int i = 0; i < m_numEncryptionMappings; ++i )
+        assert( index >= 0 );
+        assert( index < m_numEncryptionMappings );
+        assert( m_address[index].IsValid() );
+        assert( address.IsValid() );
+
+        // IMPORTANT: The new address may still have an encryption mapping that timed out but hasn't been removed yet. It is safe to free that one.
+
+        const int existing = m_addressMap.Find( address );
+
+        if ( existing != -1 )
         {
-            if ( m_address[i] == address && m_lastAccessTime[i] + m_timeout[i] >= time )
-            {
-                m_lastAccessTime[i] = time;
-                return i;
-            }
+            if ( existing == index || m_lastAccessTime[existing] + m_timeout[existing] >= time )
+                return false;
+
+            FreeEncryptionMapping( existing );
         }
-        return -1;
+
+        m_addressMap.Remove( m_address[index] );
+
+        m_address[index] = address;
+
+        m_addressMap.Insert( address, index );
+
+        m_lastAccessTime[index] = time;
+
+        return true;
+    }
+
+    int EncryptionManager::FindEncryptionMapping( const Address & address, double time )
+    {
+        const int i = m_addressMap.Find( address );
+
+        if ( i == -1 )
+            return -1;
+
+        assert( m_address[i] == address );
+
+        if ( m_lastAccessTime[i] + m_timeout[i] < time )
+            return -1;
+
+        m_lastAccessTime[i] = time;
+
+        return i;
+    }
+
+    void EncryptionManager::TouchEncryptionMapping( int index, double time )
+    {
+        assert( index >= 0 );
+        assert( index < m_numEncryptionMappings );
+        m_lastAccessTime[index] = time;
     }
 
     const uint8_t * EncryptionManager::GetSendKey( int index ) const
@@ -280,4 +846,22 @@ namespace yojimbo
         assert( index < m_numEncryptionMappings );
         return m_receiveKey + index * KeyBytes;
     }
+
+    const PacketCipherState * EncryptionManager::GetSendKeyState( int index ) const
+    {
+        if ( index == -1 )
+            return NULL;
+        assert( index >= 0 );
+        assert( index < m_numEncryptionMappings );
+        return m_keyState[index] ? &m_keyState[index][0] : NULL;
+    }
+
+    const PacketCipherState * EncryptionManager::GetReceiveKeyState( int index ) const
+    {
+        if ( index == -1 )
+            return NULL;
+        assert( index >= 0 );
+        assert( index < m_numEncryptionMappings );
+        return m_keyState[index] ? &m_keyState[index][1] : NULL;
+    }
 }
@@ -28,6 +28,9 @@
 #include "yojimbo_config.h"
 #include "yojimbo_network.h"
 #include "yojimbo_replay_protection.h"
+#include "yojimbo_address_map.h"
+#include "yojimbo_timer_wheel.h"
+#include "yojimbo_allocator.h"
 
 #include <stdint.h>
 
@@ -96,6 +99,133 @@ namespace yojimbo
 
     extern bool Decrypt( const uint8_t * encryptedMessage, int encryptedMessageLength, uint8_t * decryptedMessage, int & decryptedMessageLength, const uint8_t * nonce, const uint8_t * key );
 
+    /**
+        Encrypt a message in-place with a symmetric cipher.
+
+        The message is overwritten with the encrypted message, and the MAC is written separately. If the MAC is written to the yojimbo::MacBytes immediately preceding the message, the result is identical to yojimbo::Encrypt, without needing a second buffer.
+
+        @param message The message to encrypt. Overwritten with the encrypted message.
+        @param messageLength The length of the message to encrypt (bytes).
+        @param mac Buffer where the MAC will be written. Must be yojimbo::MacBytes large and must not overlap the message.
+        @param nonce The nonce to use to encrypt the message. Never pass in a nonce value that has already been used with this key!
+        @param key The key used for encryption.
+
+        @returns True if the message was encrypted successfully, false otherwise.
+
+        @see Decrypt_InPlace
+     */
+
+    extern bool Encrypt_InPlace( uint8_t * message, int messageLength, uint8_t * mac, const uint8_t * nonce, const uint8_t * key );
+
+    /**
+        Decrypt a message in-place that was encrypted with a symmetric cipher.
+
+        @param message The encrypted message. Overwritten with the decrypted message on success.
+        @param messageLength The length of the encrypted message, not including the MAC (bytes).
+        @param mac The MAC for the encrypted message (yojimbo::MacBytes).
+        @param nonce The nonce used to encrypt the message.
+        @param key The key used to encrypt the message.
+
+        @returns True if the message was successfully decrypted, false otherwise.
+
+        @see Encrypt_InPlace
+     */
+
+    extern bool Decrypt_InPlace( uint8_t * message, int messageLength, const uint8_t * mac, const uint8_t * nonce, const uint8_t * key );
+
+    /**
+        Check if a packet cipher can be used on this machine.
+
+        XSalsa20-Poly1305 is always available. AES-256-GCM needs hardware AES support (AES-NI and CLMUL on x86).
+
+        IMPORTANT: The client and server must use the same packet cipher, so only pick AES-256-GCM at runtime if you know every machine you talk to supports it too.
+
+        @param cipher The packet cipher to check.
+
+        @returns True if the packet cipher is available, false otherwise.
+     */
+
+    extern bool IsPacketCipherAvailable( PacketCipher cipher );
+
+    /**
+        Precomputed key state for a packet cipher.
+
+        Some ciphers do expensive per-key work before they can encrypt anything. For AES-256-GCM this is the key schedule and the GHASH tables. Precomputing it once per key, instead of on every packet, makes encrypting and decrypting packets cheaper.
+
+        The definition is internal to yojimbo_encryption.cpp. Key states are created and owned by EncryptionManager.
+
+        @see EncryptionManager::GetSendKeyState
+        @see EncryptionManager::GetReceiveKeyState
+     */
+
+    struct PacketCipherState;
+
+    /**
+        Encrypt a message in-place with the specified packet cipher.
+
+        Same as yojimbo::Encrypt_InPlace, except the cipher is selectable. Encrypting with PACKET_CIPHER_XSALSA20_POLY1305 is identical to yojimbo::Encrypt_InPlace.
+
+        @param cipher The packet cipher to encrypt with. Must be available. See yojimbo::IsPacketCipherAvailable.
+        @param message The message to encrypt. Overwritten with the encrypted message.
+        @param messageLength The length of the message to encrypt (bytes).
+        @param mac Buffer where the MAC will be written. Must be yojimbo::MacBytes large and must not overlap the message.
+        @param nonce The nonce to use to encrypt the message. Never pass in a nonce value that has already been used with this key!
+        @param key The key used for encryption.
+        @param keyState Precomputed state for the key. Optional. Pass in NULL to derive the key state on each call.
+
+        @returns True if the message was encrypted successfully, false otherwise. Always false if the cipher is not available.
+     */
+
+    extern bool Encrypt_InPlace( PacketCipher cipher, uint8_t * message, int messageLength, uint8_t * mac, const uint8_t * nonce, const uint8_t * key, const PacketCipherState * keyState = NULL );
+
+    /**
+        Decrypt a message in-place that was encrypted with the specified packet cipher.
+
+        @param cipher The packet cipher the message was encrypted with.
+        @param message The encrypted message. Overwritten with the decrypted message on success.
+        @param messageLength The length of the encrypted message, not including the MAC (bytes).
+        @param mac The MAC for the encrypted message (yojimbo::MacBytes).
+        @param nonce The nonce used to encrypt the message.
+        @param key The key used to encrypt the message.
+        @param keyState Precomputed state for the key. Optional. Pass in NULL to derive the key state on each call.
+
+        @returns True if the message was successfully decrypted, false otherwise. Always false if the cipher is not available.
+     */
+
+    extern bool Decrypt_InPlace( PacketCipher cipher, uint8_t * message, int messageLength, const uint8_t * mac, const uint8_t * nonce, const uint8_t * key, const PacketCipherState * keyState = NULL );
+
+    /**
+        A message to encrypt in-place as part of a batch.
+
+        @see yojimbo::EncryptBatch_InPlace
+     */
+
+    struct EncryptBatchEntry
+    {
+        uint8_t * message;                                      ///< The message to encrypt. Overwritten with the encrypted message.
+        int messageLength;                                      ///< The length of the message to encrypt (bytes).
+        uint8_t * mac;                                          ///< Buffer where the MAC will be written. Must be yojimbo::MacBytes large and must not overlap the message.
+        uint8_t nonce[NonceBytes];                              ///< The nonce to encrypt the message with. Never use a nonce value that has already been used with this key!
+        const uint8_t * key;                                    ///< The key used for encryption.
+        const PacketCipherState * keyState;                     ///< Precomputed state for the key. Optional. NULL to derive the key state on each call.
+    };
+
+    /**
+        Encrypt a batch of messages in-place with the specified packet cipher.
+
+        The result is identical to calling yojimbo::Encrypt_InPlace on each message in turn, but for PACKET_CIPHER_XSALSA20_POLY1305 the keystream for all messages in the batch is generated together, several 64 byte Salsa20 blocks at a time. Each message is small, so encrypting them one at a time leaves the vector units mostly idle. Generating blocks for different messages side by side fills them up. The MAC is still calculated per-message.
+
+        Other packet ciphers, and batches with only one message, fall back to encrypting each message on its own.
+
+        @param cipher The packet cipher to encrypt with. Must be available. See yojimbo::IsPacketCipherAvailable.
+        @param entries The messages to encrypt.
+        @param numEntries The number of messages to encrypt.
+
+        @returns True if all messages were encrypted successfully, false otherwise. On failure, some messages may have been encrypted and others not.
+     */
+
+    extern bool EncryptBatch_InPlace( PacketCipher cipher, EncryptBatchEntry * entries, int numEntries );
+
     /**
         Encrypt a message with an AEAD primitive (authenticated encryption with associated data).
 
@@ -148,6 +278,8 @@ namespace yojimbo
         Separate keys are used for packets sent to an address vs. packets received from this address. 
 
         This was done to allow the client/server to use the sequence numbers of packets as a nonce in both directions. An alternative would have been to set the high bit of the packet sequence number in one of the directions, but I felt this was cleaner.
+
+        Encryption mappings that time out are removed by EncryptionManager::AdvanceTime, using a timer wheel so the cost per-update is proportional to the number of encryption mappings that expire, not the number of encryption mappings.
      */
 
     class EncryptionManager
@@ -156,9 +288,29 @@ namespace yojimbo
 
         /**
             Encryption manager constructor.
+
+            @param allocator The allocator used to allocate the address hash table and the timer wheel.
          */
 
-        EncryptionManager();
+        explicit EncryptionManager( Allocator & allocator );
+
+        /**
+            Encryption manager destructor.
+
+            Frees any precomputed key states.
+         */
+
+        ~EncryptionManager();
+
+        /**
+            Set the packet cipher that keys are used with.
+
+            Ciphers that benefit from it get precomputed key state for each encryption mapping, so the key schedule is done once when the encryption mapping is added, instead of on every packet. Key states are allocated the first time an encryption mapping index is used, and are reused after that, so adding encryption mappings doesn't allocate in the steady state.
+
+            @param cipher The packet cipher. Defaults to PACKET_CIPHER_XSALSA20_POLY1305, which has nothing to precompute, because XSalsa20 derives a subkey from the key and nonce for every message.
+         */
+
+        void SetPacketCipher( PacketCipher cipher );
 
         /**
             Associates an address with send and receive keys for packet encryption.
@@ -185,6 +337,20 @@ namespace yojimbo
 
         bool RemoveEncryptionMapping( const Address & address, double time );
 
+        /**
+            Move an encryption mapping (by index) to a different address.
+
+            The keys and index of the encryption mapping stay the same, so encryption indices cached in transport contexts remain valid. This is used to follow a client whose address changes. See TRANSPORT_FLAG_ADDRESS_MIGRATION.
+
+            @param index The encryption mapping index. See EncryptionManager::FindEncryptionMapping.
+            @param address The new address for the encryption mapping.
+            @param time The current time (seconds).
+
+            @returns True if the encryption mapping was moved, false if another encryption mapping that hasn't timed out already exists for the new address.
+         */
+
+        bool MoveEncryptionMapping( int index, const Address & address, double time );
+
         /**
             Reset all encryption mappings.
 
@@ -193,6 +359,18 @@ namespace yojimbo
 
         void ResetEncryptionMappings();
 
+        /**
+            Remove encryption mappings that have timed out.
+
+            Encryption mappings that were touched since their timer was scheduled are rescheduled for their new deadline instead of being removed, so touching an encryption mapping stays cheap.
+
+            Call this regularly, eg. once per-frame. See BaseTransport::AdvanceTime.
+
+            @param time The current time (seconds).
+         */
+
+        void AdvanceTime( double time );
+
         /**
             Find an encryption mapping (index) for the specified address.
 
@@ -209,6 +387,17 @@ namespace yojimbo
 
         int FindEncryptionMapping( const Address & address, double time );
 
+        /**
+            Touch an encryption mapping (by index) and reset its last access time to the current time.
+
+            This is used instead of EncryptionManager::FindEncryptionMapping when the encryption mapping index is already known, eg. when it is cached in a TransportContext. Without this, encryption mappings accessed only by cached index would time out while still in use.
+
+            @param index The encryption mapping index. See EncryptionManager::FindEncryptionMapping.
+            @param time The current time (seconds).
+         */
+
+        void TouchEncryptionMapping( int index, double time );
+
         /**
             Get the send key for an encryption mapping (by index).
 
@@ -233,9 +422,49 @@ namespace yojimbo
 
         const uint8_t * GetReceiveKey( int index ) const;
 
+        /**
+            Get the precomputed send key state for an encryption mapping (by index).
+
+            @param index The encryption mapping index. See EncryptionMapping::FindEncryptionMapping
+
+            @returns The precomputed state for the send key, or NULL if there is none. Pass this to yojimbo::Encrypt_InPlace along with the send key.
+         */
+
+        const PacketCipherState * GetSendKeyState( int index ) const;
+
+        /**
+            Get the precomputed receive key state for an encryption mapping (by index).
+
+            @param index The encryption mapping index. See EncryptionMapping::FindEncryptionMapping
+
+            @returns The precomputed state for the receive key, or NULL if there is none. Pass this to yojimbo::Decrypt_InPlace along with the receive key.
+         */
+
+        const PacketCipherState * GetReceiveKeyState( int index ) const;
+
     private:
 
-        int m_numEncryptionMappings;                                                    ///< The number of encryption mappings in the array. This is how far we search from left to right starting at index 0. It's updated as entries are removed from the right.
+        void UpdateKeyState( int index );
+
+        void FreeKeyStates();
+
+        void FreeEncryptionMapping( int index );
+
+        Allocator * m_allocator;                                                        ///< The allocator passed in to the constructor. Used to allocate precomputed key states.
+
+        PacketCipher m_packetCipher;                                                    ///< The packet cipher keys are used with. See EncryptionManager::SetPacketCipher.
+
+        void * m_keyStateMemory[MaxEncryptionMappings];                                 ///< The memory allocated for the key states of each encryption mapping index. NULL if none has been allocated yet.
+
+        PacketCipherState * m_keyState[MaxEncryptionMappings];                          ///< The send and receive key state for each encryption mapping index, aligned within m_keyStateMemory. NULL if there is no precomputed key state for the mapping.
+
+        int m_numEncryptionMappings;                                                    ///< One past the highest encryption mapping index used since the last reset. Only used to validate indices.
+
+        int m_numFreeEncryptionMappings;                                                ///< The number of free encryption mapping indices in m_freeEncryptionMappings.
+
+        int m_freeEncryptionMappings[MaxEncryptionMappings];                            ///< Stack of encryption mapping indices that are not in use. Lowest index on top after a reset.
+
+        int m_expiredEncryptionMappings[MaxEncryptionMappings];                         ///< Scratch array for the timers returned by TimerWheel::AdvanceTime.
 
         double m_lastAccessTime[MaxEncryptionMappings];                                 ///< Array of last access times used to time out encryption mappings.
 
@@ -246,6 +475,10 @@ namespace yojimbo
         uint8_t m_sendKey[KeyBytes*MaxEncryptionMappings];                              ///< Array containing all send keys. The send key for an encryption mapping index n starts at offset KeyBytes * n.
         
         uint8_t m_receiveKey[KeyBytes*MaxEncryptionMappings];                           ///< Array containing all receive keys. The receive key for an encryption mapping index n starts at offset KeyBytes * n.
+
+        AddressMap m_addressMap;                                                        ///< Hash table from address to encryption mapping index. Lets us find the encryption mapping for a packet in O(1). Entries may point to encryption mappings that have timed out but haven't been removed by EncryptionManager::AdvanceTime yet, so the timeout must still be checked after lookup.
+
+        TimerWheel m_timerWheel;                                                        ///< Expires encryption mappings. There is one timer per-encryption mapping index.
     };
 }
 
@@ -0,0 +1,328 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "yojimbo_config.h"
+#include "yojimbo_fec.h"
+#include "yojimbo_packet_processor.h"
+#include "yojimbo_common.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    static void fec_xor( uint8_t * output, const uint8_t * input, int bytes )
+    {
+        // IMPORTANT: XOR a 64 bit word at a time. The compiler turns this loop into vector instructions where they are available.
+
+        int i = 0;
+
+        for ( ; i + 8 <= bytes; i += 8 )
+        {
+            uint64_t a, b;
+            memcpy( &a, output + i, 8 );
+            memcpy( &b, input + i, 8 );
+            a ^= b;
+            memcpy( output + i, &a, 8 );
+        }
+
+        for ( ; i < bytes; ++i )
+            output[i] ^= input[i];
+    }
+
+    static void fec_accumulate( uint8_t * accumulator, int & accumulatorBytes, const uint8_t * data, int bytes )
+    {
+        // IMPORTANT: Bytes past the end of the accumulator are zero, so XOR with them is just a copy. This avoids clearing the whole accumulator for each group.
+
+        if ( bytes <= accumulatorBytes )
+        {
+            fec_xor( accumulator, data, bytes );
+            return;
+        }
+
+        fec_xor( accumulator, data, accumulatorBytes );
+
+        memcpy( accumulator + accumulatorBytes, data + accumulatorBytes, bytes - accumulatorBytes );
+
+        accumulatorBytes = bytes;
+    }
+
+    ForwardErrorCorrection::ForwardErrorCorrection( Allocator & allocator, int maxPacketBytes, int groupSize )
+    {
+        assert( maxPacketBytes > FecParityHeaderBytes );
+        assert( groupSize >= 2 );
+        assert( groupSize <= MaxFecGroupSize );
+
+        m_allocator = &allocator;
+        m_maxPacketBytes = maxPacketBytes;
+        m_groupSize = groupSize;
+        m_groupSequence = 0;
+
+        m_sendGroups = (SendGroup*) YOJIMBO_ALLOCATE( allocator, sizeof( SendGroup ) * FecBufferSize );
+        m_sendData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, FecBufferSize * maxPacketBytes );
+        m_receiveGroups = (ReceiveGroup*) YOJIMBO_ALLOCATE( allocator, sizeof( ReceiveGroup ) * FecBufferSize );
+        m_receiveData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, FecBufferSize * maxPacketBytes );
+
+        Reset();
+    }
+
+    ForwardErrorCorrection::~ForwardErrorCorrection()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_sendGroups );
+        YOJIMBO_FREE( *m_allocator, m_sendData );
+        YOJIMBO_FREE( *m_allocator, m_receiveGroups );
+        YOJIMBO_FREE( *m_allocator, m_receiveData );
+
+        m_allocator = NULL;
+    }
+
+    void ForwardErrorCorrection::Reset()
+    {
+        for ( int i = 0; i < FecBufferSize; ++i )
+        {
+            m_sendGroups[i] = SendGroup();
+            m_receiveGroups[i] = ReceiveGroup();
+        }
+
+        m_parityPacket = NULL;
+        m_parityBytes = 0;
+        m_recoveredPacket = NULL;
+        m_recoveredBytes = 0;
+    }
+
+    int ForwardErrorCorrection::EncodePacket( const Address & address, const uint8_t * packetData, int packetBytes, uint8_t * output )
+    {
+        assert( address.IsValid() );
+        assert( packetData );
+        assert( packetBytes > 0 );
+        assert( output );
+
+        m_parityPacket = NULL;
+        m_parityBytes = 0;
+
+        // IMPORTANT: Packets are only protected if the parity packet for their group still fits in the maximum packet size.
+
+        if ( packetBytes + FecParityHeaderBytes > m_maxPacketBytes )
+            return 0;
+
+        const int index = int( uint32_t( address.GetHash() ) % FecBufferSize );
+
+        SendGroup & group = m_sendGroups[index];
+
+        uint8_t * parityData = m_sendData + index * m_maxPacketBytes;
+
+        if ( group.numPackets == 0 || group.address != address )
+        {
+            group.address = address;
+            group.sequence = m_groupSequence++;
+            group.numPackets = 0;
+            group.maxBytes = 0;
+            group.lengthXor = 0;
+        }
+
+        fec_accumulate( parityData + FecParityHeaderBytes, group.maxBytes, packetData, packetBytes );
+
+        group.lengthXor ^= uint16_t( packetBytes );
+
+        memmove( output + FecPacketHeaderBytes, packetData, packetBytes );
+
+        output[0] = FecPacketPrefix;
+        output[1] = uint8_t( group.sequence & 0xFF );
+        output[2] = uint8_t( group.sequence >> 8 );
+        output[3] = uint8_t( group.numPackets );
+
+        group.numPackets++;
+
+        if ( group.numPackets == m_groupSize )
+        {
+            parityData[0] = FecParityPacketPrefix;
+            parityData[1] = uint8_t( group.sequence & 0xFF );
+            parityData[2] = uint8_t( group.sequence >> 8 );
+            parityData[3] = uint8_t( group.numPackets );
+            parityData[4] = uint8_t( group.lengthXor & 0xFF );
+            parityData[5] = uint8_t( group.lengthXor >> 8 );
+
+            m_parityPacket = parityData;
+            m_parityBytes = FecParityHeaderBytes + group.maxBytes;
+
+            group.numPackets = 0;
+        }
+
+        return packetBytes + FecPacketHeaderBytes;
+    }
+
+    const uint8_t * ForwardErrorCorrection::GetParityPacket( int & parityBytes )
+    {
+        const uint8_t * parityPacket = m_parityPacket;
+
+        parityBytes = m_parityBytes;
+
+        m_parityPacket = NULL;
+        m_parityBytes = 0;
+
+        return parityPacket;
+    }
+
+    ForwardErrorCorrection::ReceiveGroup * ForwardErrorCorrection::FindReceiveGroup( const Address & address, uint16_t sequence, uint8_t * & accumulator )
+    {
+        const int index = int( ( uint32_t( address.GetHash() ) + sequence ) % FecBufferSize );
+
+        ReceiveGroup & group = m_receiveGroups[index];
+
+        accumulator = m_receiveData + index * m_maxPacketBytes;
+
+        if ( group.sequence != sequence || group.address != address )
+        {
+            group = ReceiveGroup();
+            group.address = address;
+            group.sequence = sequence;
+        }
+
+        return &group;
+    }
+
+    void ForwardErrorCorrection::CheckRecovery( ReceiveGroup & group, uint8_t * accumulator )
+    {
+        if ( !group.parityReceived )
+            return;
+
+        if ( group.numReceived == group.numPackets )
+        {
+            group.complete = true;
+            return;
+        }
+
+        if ( group.numReceived != group.numPackets - 1 )
+            return;
+
+        group.complete = true;
+
+        // IMPORTANT: With all other packets and the parity XORed together, what's left is the missing packet. Its size is what's left of the size XOR.
+
+        const int recoveredBytes = group.lengthXor;
+
+        if ( recoveredBytes <= 0 || recoveredBytes > group.maxBytes )
+            return;
+
+        m_recoveredPacket = accumulator;
+        m_recoveredBytes = recoveredBytes;
+    }
+
+    uint8_t * ForwardErrorCorrection::DecodePacket( const Address & address, uint8_t * packetData, int packetBytes, int & innerBytes )
+    {
+        assert( address.IsValid() );
+        assert( packetData );
+        assert( packetBytes > 0 );
+
+        innerBytes = 0;
+
+        m_recoveredPacket = NULL;
+        m_recoveredBytes = 0;
+
+        if ( packetData[0] == FecParityPacketPrefix )
+        {
+            if ( packetBytes <= FecParityHeaderBytes || packetBytes > m_maxPacketBytes )
+                return NULL;
+
+            const uint16_t sequence = uint16_t( packetData[1] ) | ( uint16_t( packetData[2] ) << 8 );
+            const int numPackets = packetData[3];
+            const uint16_t lengthXor = uint16_t( packetData[4] ) | ( uint16_t( packetData[5] ) << 8 );
+
+            if ( numPackets < 2 || numPackets > MaxFecGroupSize )
+                return NULL;
+
+            uint8_t * accumulator;
+            ReceiveGroup * group = FindReceiveGroup( address, sequence, accumulator );
+
+            if ( group->complete || group->parityReceived )
+                return NULL;
+
+            // IMPORTANT: Packets were received that can't be in a group this size, so something is wrong with this group. Don't try to recover anything from it.
+
+            if ( group->receivedMask >> numPackets )
+            {
+                group->complete = true;
+                return NULL;
+            }
+
+            fec_accumulate( accumulator, group->maxBytes, packetData + FecParityHeaderBytes, packetBytes - FecParityHeaderBytes );
+
+            group->lengthXor ^= lengthXor;
+            group->numPackets = numPackets;
+            group->parityReceived = true;
+
+            CheckRecovery( *group, accumulator );
+
+            return NULL;
+        }
+
+        assert( packetData[0] == FecPacketPrefix );
+
+        if ( packetBytes <= FecPacketHeaderBytes || packetBytes > m_maxPacketBytes )
+            return NULL;
+
+        const uint16_t sequence = uint16_t( packetData[1] ) | ( uint16_t( packetData[2] ) << 8 );
+        const int packetIndex = packetData[3];
+
+        if ( packetIndex >= MaxFecGroupSize )
+            return NULL;
+
+        uint8_t * accumulator;
+        ReceiveGroup * group = FindReceiveGroup( address, sequence, accumulator );
+
+        // IMPORTANT: Once a group is complete, any packet that arrives for it has already been received, or was recovered before it arrived.
+
+        if ( group->complete || ( group->receivedMask & ( 1U << packetIndex ) ) )
+            return NULL;
+
+        if ( group->parityReceived && packetIndex >= group->numPackets )
+            return NULL;
+
+        uint8_t * inner = packetData + FecPacketHeaderBytes;
+
+        innerBytes = packetBytes - FecPacketHeaderBytes;
+
+        fec_accumulate( accumulator, group->maxBytes, inner, innerBytes );
+
+        group->lengthXor ^= uint16_t( innerBytes );
+        group->receivedMask |= ( 1U << packetIndex );
+        group->numReceived++;
+
+        CheckRecovery( *group, accumulator );
+
+        return inner;
+    }
+
+    uint8_t * ForwardErrorCorrection::GetRecoveredPacket( int & packetBytes )
+    {
+        uint8_t * recoveredPacket = m_recoveredPacket;
+
+        packetBytes = m_recoveredBytes;
+
+        m_recoveredPacket = NULL;
+        m_recoveredBytes = 0;
+
+        return recoveredPacket;
+    }
+}
@@ -0,0 +1,217 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef YOJIMBO_FEC_H
+#define YOJIMBO_FEC_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_allocator.h"
+#include "yojimbo_address.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    const int FecPacketHeaderBytes = 4;                             ///< The size of the header in front of each packet protected by forward error correction: prefix byte, 16 bit group sequence and the index of the packet in the group.
+
+    const int FecParityHeaderBytes = 6;                             ///< The size of the header in front of each parity packet: prefix byte, 16 bit group sequence, number of packets in the group and the XOR of their sizes.
+
+    /**
+        Forward error correction for packets sent over a transport.
+
+        Packets sent to each address are split into groups. After the last packet of a group is sent, a parity packet is sent with the XOR of all packets in the group, each zero padded to the size of the largest one. The receiver XORs the packets of the group together as they arrive, and when exactly one packet of the group is missing and the parity packet has arrived, what's left is the missing packet.
+
+        This trades bandwidth for latency. A lost packet is recovered as soon as the rest of its group arrives, instead of waiting a round trip for acks and resends. Reliable messages and block fragments in a recovered packet are acked as if the packet was never lost, and unreliable messages get through without any resend at all.
+
+        Only one lost packet per-group can be recovered, so smaller groups recover more under heavy packet loss, at the cost of more parity packets.
+
+        IMPORTANT: Parity is only sent once a group is full, so the last packets sent before a pause in traffic are not protected until more packets are sent to that address.
+     */
+
+    class ForwardErrorCorrection
+    {
+    public:
+
+        /**
+            Forward error correction constructor.
+
+            @param allocator The allocator to use.
+            @param maxPacketBytes The maximum size of packets sent and received, including the forward error correction header (bytes). Typically PacketProcessor::GetMaxPacketBufferSize.
+            @param groupSize The number of packets in each group. Must be in [2,yojimbo::MaxFecGroupSize].
+         */
+
+        ForwardErrorCorrection( Allocator & allocator, int maxPacketBytes, int groupSize );
+
+        /**
+            Forward error correction destructor.
+         */
+
+        ~ForwardErrorCorrection();
+
+        /**
+            Reset all groups being encoded and decoded.
+
+            Packets sent after this call start new groups. Packets received after this call can only be recovered from packets also received after this call.
+         */
+
+        void Reset();
+
+        /**
+            Get the number of packets in each group.
+
+            @returns The group size passed in to the constructor.
+         */
+
+        int GetGroupSize() const { return m_groupSize; }
+
+        /**
+            Protect a packet before it is sent.
+
+            The packet is added to the current group for its address, and written to the output buffer with the forward error correction header in front of it. If this completes the group, a parity packet is ready to send. See ForwardErrorCorrection::GetParityPacket.
+
+            @param address The address the packet is being sent to.
+            @param packetData The packet data, as it would have been sent without forward error correction.
+            @param packetBytes The size of the packet (bytes).
+            @param output The buffer to write the protected packet to. Must have room for packetBytes + yojimbo::FecPacketHeaderBytes. May be the same buffer as the packet data, in which case the packet is moved forward in place.
+
+            @returns The size of the protected packet written to the output buffer, or zero if the packet is too large to protect. Packets that are not protected should be sent as they are.
+         */
+
+        int EncodePacket( const Address & address, const uint8_t * packetData, int packetBytes, uint8_t * output );
+
+        /**
+            Get the parity packet for the group just completed by ForwardErrorCorrection::EncodePacket.
+
+            Send it to the same address as the packet just encoded, before encoding another packet.
+
+            @param parityBytes The size of the parity packet (bytes) [out].
+
+            @returns The parity packet data, or NULL if the last packet encoded didn't complete a group. Each parity packet is only returned once.
+         */
+
+        const uint8_t * GetParityPacket( int & parityBytes );
+
+        /**
+            Process a forward error correction packet read from the network.
+
+            Protected packets are added to their group and the packet inside is returned, so it can be read as usual. Parity packets are added to their group and consumed. Either may complete the recovery of a lost packet. See ForwardErrorCorrection::GetRecoveredPacket.
+
+            @param address The address the packet was received from.
+            @param packetData The packet data, starting with yojimbo::FecPacketPrefix or yojimbo::FecParityPacketPrefix.
+            @param packetBytes The size of the packet (bytes).
+            @param innerBytes The size of the packet inside the protected packet (bytes) [out].
+
+            @returns The packet inside a protected packet, or NULL if this was a parity packet, or a protected packet that is malformed or has already been received or recovered.
+         */
+
+        uint8_t * DecodePacket( const Address & address, uint8_t * packetData, int packetBytes, int & innerBytes );
+
+        /**
+            Get the packet recovered by the last call to ForwardErrorCorrection::DecodePacket.
+
+            The recovered packet is exactly the packet as it was sent, before the forward error correction header was added. It stays valid until the next call to ForwardErrorCorrection::DecodePacket.
+
+            @param packetBytes The size of the recovered packet (bytes) [out].
+
+            @returns The recovered packet data, or NULL if no packet was recovered. Each recovered packet is only returned once.
+         */
+
+        uint8_t * GetRecoveredPacket( int & packetBytes );
+
+    private:
+
+        struct SendGroup
+        {
+            SendGroup()
+            {
+                sequence = 0;
+                numPackets = 0;
+                maxBytes = 0;
+                lengthXor = 0;
+            }
+
+            Address address;                                        ///< The address packets in this group are sent to.
+            uint16_t sequence;                                      ///< The group sequence number. Unique across all addresses, so groups sent to an address are never confused when a different address takes over the entry.
+            int numPackets;                                         ///< The number of packets added to the group so far. Zero if the entry is free.
+            int maxBytes;                                           ///< The size of the largest packet in the group (bytes). The parity data is this size.
+            uint16_t lengthXor;                                     ///< The XOR of the sizes of all packets in the group.
+        };
+
+        struct ReceiveGroup
+        {
+            ReceiveGroup()
+            {
+                sequence = 0;
+                receivedMask = 0;
+                numReceived = 0;
+                numPackets = 0;
+                parityReceived = false;
+                complete = false;
+                maxBytes = 0;
+                lengthXor = 0;
+            }
+
+            Address address;                                        ///< The address the group was received from. Not valid if the entry is free.
+            uint16_t sequence;                                      ///< The group sequence number.
+            uint32_t receivedMask;                                  ///< Bit n is set if packet n in the group has been received.
+            int numReceived;                                        ///< The number of packets in the group received so far, not including the parity packet.
+            int numPackets;                                         ///< The number of packets in the group. Only known once the parity packet has been received.
+            bool parityReceived;                                    ///< True if the parity packet for this group has been received.
+            bool complete;                                          ///< True once every packet in the group has been received or recovered. Any other packets for the group that arrive after this are duplicates.
+            int maxBytes;                                           ///< The number of bytes of the accumulator in use. Everything past this is treated as zero.
+            uint16_t lengthXor;                                     ///< The XOR of the sizes of all packets received so far, and the size XOR from the parity packet.
+        };
+
+        ReceiveGroup * FindReceiveGroup( const Address & address, uint16_t sequence, uint8_t * & accumulator );
+
+        void CheckRecovery( ReceiveGroup & group, uint8_t * accumulator );
+
+        Allocator * m_allocator;                                    ///< The allocator passed in to the constructor.
+
+        int m_maxPacketBytes;                                       ///< The maximum size of packets sent and received (bytes).
+
+        int m_groupSize;                                            ///< The number of packets in each group sent.
+
+        uint16_t m_groupSequence;                                   ///< The sequence number of the next group started. Incremented each time a group is started, for any address.
+
+        SendGroup * m_sendGroups;                                   ///< The groups being sent. Addresses are assigned an entry by hashing. An address that lands on an entry in use by another address starts a new group, and the old group is abandoned without sending parity.
+
+        uint8_t * m_sendData;                                       ///< The parity packet for each send group. Entry i is at m_sendData + i * m_maxPacketBytes, and the XOR of the packets in the group is accumulated after the parity header.
+
+        ReceiveGroup * m_receiveGroups;                             ///< The groups being received. Groups are assigned an entry by hashing the sender address and group sequence. A new group that lands on an entry in use replaces it.
+
+        uint8_t * m_receiveData;                                    ///< The XOR of all packets received for each receive group, including the parity packet. Entry i is at m_receiveData + i * m_maxPacketBytes.
+
+        const uint8_t * m_parityPacket;                             ///< The parity packet returned by the next call to GetParityPacket. NULL if there is none.
+
+        int m_parityBytes;                                          ///< The size of the parity packet (bytes).
+
+        uint8_t * m_recoveredPacket;                                ///< The packet returned by the next call to GetRecoveredPacket. NULL if there is none.
+
+        int m_recoveredBytes;                                       ///< The size of the recovered packet (bytes).
+    };
+}
+
+#endif // #ifndef YOJIMBO_FEC_H
@@ -0,0 +1,154 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_config.h"
+#include "yojimbo_id_map.h"
+#include "yojimbo_common.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    static inline uint32_t hash_id( uint64_t id )
+    {
+        return (uint32_t) murmur_hash_64( &id, sizeof( id ), 0 );
+    }
+
+    IdMap::IdMap( Allocator & allocator, int capacity )
+    {
+        assert( capacity > 0 );
+
+        m_allocator = &allocator;
+
+        m_capacity = capacity;
+
+        uint32_t tableSize = 1;
+        while ( tableSize < uint32_t( capacity ) * 2 )
+            tableSize <<= 1;
+
+        m_tableMask = tableSize - 1;
+
+        m_id = (uint64_t*) YOJIMBO_ALLOCATE( allocator, sizeof( uint64_t ) * tableSize );
+        m_value = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * tableSize );
+
+        Clear();
+    }
+
+    IdMap::~IdMap()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_id );
+        YOJIMBO_FREE( *m_allocator, m_value );
+
+        m_allocator = NULL;
+    }
+
+    void IdMap::Clear()
+    {
+        m_numEntries = 0;
+
+        for ( uint32_t i = 0; i <= m_tableMask; ++i )
+        {
+            m_id[i] = 0;
+            m_value[i] = -1;
+        }
+    }
+
+    int IdMap::FindSlot( uint64_t id ) const
+    {
+        uint32_t slot = hash_id( id ) & m_tableMask;
+
+        while ( m_value[slot] >= 0 && m_id[slot] != id )
+        {
+            slot = ( slot + 1 ) & m_tableMask;
+        }
+
+        return (int) slot;
+    }
+
+    bool IdMap::Insert( uint64_t id, int value )
+    {
+        assert( value >= 0 );
+
+        const int slot = FindSlot( id );
+
+        if ( m_value[slot] >= 0 )
+        {
+            m_value[slot] = value;
+            return true;
+        }
+
+        if ( m_numEntries == m_capacity )
+            return false;
+
+        m_id[slot] = id;
+        m_value[slot] = value;
+        m_numEntries++;
+
+        return true;
+    }
+
+    bool IdMap::Remove( uint64_t id )
+    {
+        uint32_t slot = (uint32_t) FindSlot( id );
+
+        if ( m_value[slot] < 0 )
+            return false;
+
+        // backward shift deletion. see AddressMap::Remove
+
+        uint32_t next = slot;
+
+        while ( true )
+        {
+            next = ( next + 1 ) & m_tableMask;
+
+            if ( m_value[next] < 0 )
+                break;
+
+            const uint32_t ideal = hash_id( m_id[next] ) & m_tableMask;
+
+            if ( ( ( next - ideal ) & m_tableMask ) >= ( ( next - slot ) & m_tableMask ) )
+            {
+                m_id[slot] = m_id[next];
+                m_value[slot] = m_value[next];
+                slot = next;
+            }
+        }
+
+        m_id[slot] = 0;
+        m_value[slot] = -1;
+        m_numEntries--;
+
+        return true;
+    }
+
+    int IdMap::Find( uint64_t id ) const
+    {
+        const int slot = FindSlot( id );
+
+        return m_value[slot];
+    }
+}
@@ -0,0 +1,148 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef YOJIMBO_ID_MAP_H
+#define YOJIMBO_ID_MAP_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_allocator.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        Maps 64 bit ids to integer values in O(1).
+
+        This is the id counterpart to AddressMap. It uses the same open addressing scheme with linear probing and backward shift deletion, and the hash table is sized to the next power of two at least twice the capacity.
+
+        Any 64 bit value is a valid id, so empty slots are marked with a value of -1 rather than a reserved key.
+
+        @see AddressMap
+     */
+
+    class IdMap
+    {
+    public:
+
+        /**
+            Id map constructor.
+
+            @param allocator The allocator used to allocate the hash table.
+            @param capacity The maximum number of entries that can be stored in the map.
+         */
+
+        IdMap( Allocator & allocator, int capacity );
+
+        /**
+            Id map destructor.
+         */
+
+        ~IdMap();
+
+        /**
+            Remove all entries from the map.
+         */
+
+        void Clear();
+
+        /**
+            Insert an entry into the map.
+
+            If an entry already exists for this id, its value is updated.
+
+            @param id The id key.
+            @param value The value to associate with the id. Must be non-negative.
+
+            @returns True if the entry was inserted or updated, false if the map is at capacity.
+         */
+
+        bool Insert( uint64_t id, int value );
+
+        /**
+            Remove an entry from the map.
+
+            @param id The id key to remove.
+
+            @returns True if an entry was found and removed, false otherwise.
+         */
+
+        bool Remove( uint64_t id );
+
+        /**
+            Find the value associated with an id.
+
+            @param id The id key to search for.
+
+            @returns The value associated with the id, or -1 if the id is not in the map.
+         */
+
+        int Find( uint64_t id ) const;
+
+        /**
+            Get the number of entries in the map.
+
+            @returns The number of entries in [0,capacity].
+         */
+
+        int GetNumEntries() const { return m_numEntries; }
+
+        /**
+            Get the capacity of the map.
+
+            @returns The maximum number of entries that can be stored in the map.
+         */
+
+        int GetCapacity() const { return m_capacity; }
+
+    protected:
+
+        /**
+            Find the hash table slot for an id.
+
+            @param id The id to search for.
+
+            @returns The slot containing the id, or the empty slot where it would be inserted.
+         */
+
+        int FindSlot( uint64_t id ) const;
+
+    private:
+
+        Allocator * m_allocator;                                ///< The allocator passed into the constructor.
+
+        int m_capacity;                                         ///< The maximum number of entries in the map.
+
+        int m_numEntries;                                       ///< The current number of entries in the map.
+
+        uint32_t m_tableMask;                                   ///< The hash table size minus one. The hash table size is always a power of two.
+
+        uint64_t * m_id;                                        ///< The id key per-slot. Valid only if the value in the same slot is non-negative.
+
+        int * m_value;                                          ///< The value per-slot. Set to -1 if the slot is empty.
+    };
+}
+
+#endif // #ifndef YOJIMBO_ID_MAP_H
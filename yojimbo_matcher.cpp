@@ -24,6 +24,9 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_matcher.h"
+#include "yojimbo_common.h"
+#include "yojimbo_platform.h"
+#include "yojimbo_server.h"
 
 #include <mbedtls/config.h>
 #include <mbedtls/platform.h>
@@ -48,6 +51,23 @@ using namespace rapidjson;
 
 namespace yojimbo
 {
+    static const int MatchRequestHeaderBytes = 1024;                   // bytes reserved for the HTTP request line and headers
+    static const int MatchResponseBufferBytes = 4 * 1024;              // bytes for a single match response, including HTTP headers
+    static const int MatchBatchClientIdBytes = 24;                     // bytes per-client id in the batch request body (decimal, comma separated)
+    static const int MatchBatchResponseBytes = 3 * 1024;               // bytes per-client in the batch response body
+    static const int MatchDocumentBytes = 4 * 1024;                    // bytes for the parsed JSON document of a single match response
+    static const int MatchDocumentStackBytes = 512;                    // initial bytes for the JSON parse stack
+    static const int MatchBatchDocumentBytes = 512;                    // bytes per-client for the parsed JSON document of a batch match response
+    static const int MatchLoadReportBytes = 512;                       // bytes for the body of a server load report
+
+    // IMPORTANT: Requests accept either response format. Matchers that only speak JSON ignore the binary content type and keep working.
+
+    #define MATCH_ACCEPT_HEADER "Accept: " YOJIMBO_BINARY_MATCH_CONTENT_TYPE ", application/json\r\n"
+
+    // IMPORTANT: Match responses are parsed in-situ, with a document whose values and parse stack both live in a fixed size buffer, so parsing a match response doesn't allocate.
+
+    typedef GenericDocument< UTF8<>, MemoryPoolAllocator<>, MemoryPoolAllocator<> > MatchDocument;
+
     struct MatcherInternal
     {
         mbedtls_net_context server_fd;
@@ -56,6 +76,9 @@ namespace yojimbo
         mbedtls_ssl_context ssl;
         mbedtls_ssl_config conf;
         mbedtls_x509_crt cacert;
+        mbedtls_ssl_session session;        // the TLS session from the last handshake, used to resume the session instead of doing a full handshake next time we connect
+        bool hasSession;                    // true if session holds a TLS session that can be resumed
+        bool connected;                     // true while the connection to the matcher is kept alive between requests
     };
 
     Matcher::Matcher( Allocator & allocator )
@@ -63,12 +86,46 @@ namespace yojimbo
         m_allocator = &allocator;
         m_initialized = false;
         m_matchStatus = MATCH_IDLE;
+        m_protocolId = 0;
+        m_clientId = 0;
+        m_batchRequest = false;
+        m_numBatchClientIds = 0;
+        m_batchClientIds = NULL;
+        m_batchMatchResponses = NULL;
+        m_batchRequestBuffer = NULL;
+        m_batchResponseBuffer = NULL;
+        m_batchResponseBufferSize = 0;
+        m_batchDocumentBuffer = NULL;
+        m_batchDocumentBufferSize = 0;
+        m_loadReport = NULL;
+        m_thread = NULL;
         m_internal = YOJIMBO_NEW( allocator, MatcherInternal );
+        m_internal->hasSession = false;
+        m_internal->connected = false;
+    }
+
+    static void matcher_disconnect( MatcherInternal & internal )
+    {
+        if ( internal.connected )
+        {
+            mbedtls_ssl_close_notify( &internal.ssl );
+            internal.connected = false;
+        }
+
+        mbedtls_net_free( &internal.server_fd );
     }
 
     Matcher::~Matcher()
     {
+        JoinMatchThread();
+
+        FreeBatch();
+
+        if ( m_initialized )
+            matcher_disconnect( *m_internal );
+
         mbedtls_net_free( &m_internal->server_fd );
+        mbedtls_ssl_session_free( &m_internal->session );
         mbedtls_x509_crt_free( &m_internal->cacert );
         mbedtls_ssl_free( &m_internal->ssl );
         mbedtls_ssl_config_free( &m_internal->conf );
@@ -85,6 +142,7 @@ namespace yojimbo
         mbedtls_net_init( &m_internal->server_fd );
         mbedtls_ssl_init( &m_internal->ssl );
         mbedtls_ssl_config_init( &m_internal->conf );
+        mbedtls_ssl_session_init( &m_internal->session );
         mbedtls_x509_crt_init( &m_internal->cacert );
         mbedtls_ctr_drbg_init( &m_internal->ctr_drbg );
         mbedtls_entropy_init( &m_internal->entropy );
@@ -97,44 +155,21 @@ namespace yojimbo
             return false;
         }
 
-        if ( mbedtls_x509_crt_parse( &m_internal->cacert, (const unsigned char *) mbedtls_test_cas_pem, mbedtls_test_cas_pem_len ) < 0 )
+        if ( ( result = mbedtls_x509_crt_parse( &m_internal->cacert, (const unsigned char *) mbedtls_test_cas_pem, mbedtls_test_cas_pem_len ) ) < 0 )
         {
             debug_printf( "mbedtls_x509_crt_parse failed - error code = %d\n", result );
             return false;
         }
 
-        m_initialized = true;
-
-        return true;
-    }
-
-    void Matcher::RequestMatch( uint64_t protocolId, uint64_t clientId )
-    {
-        assert( m_initialized );
-
-        uint32_t flags;
-        char buf[4*1024];
-        char request[1024];
-        int bytesRead = 0;
-        const char * json;
-
-        int result;
-
-        if ( ( result = mbedtls_net_connect( &m_internal->server_fd, SERVER_NAME, SERVER_PORT, MBEDTLS_NET_PROTO_TCP ) ) != 0 )
-        {
-            debug_printf( "mbedtls_net_connect failed - error code = %d\n", result );
-            m_matchStatus = MATCH_FAILED;
-            goto cleanup;
-        }
+        // IMPORTANT: The TLS context is set up once and reset for each new connection, so the certificate chain and config are not rebuilt for every match request.
 
         if ( ( result = mbedtls_ssl_config_defaults( &m_internal->conf,
                         MBEDTLS_SSL_IS_CLIENT,
                         MBEDTLS_SSL_TRANSPORT_STREAM,
                         MBEDTLS_SSL_PRESET_DEFAULT ) ) != 0 )
         {
-            debug_printf( "mbedtls_net_connect failed - error code = %d\n", result );
-            m_matchStatus = MATCH_FAILED;
-            goto cleanup;
+            debug_printf( "mbedtls_ssl_config_defaults failed - error code = %d\n", result );
+            return false;
         }
 
 #if YOJIMBO_SECURE_MODE
@@ -148,115 +183,585 @@ namespace yojimbo
         if ( ( result = mbedtls_ssl_setup( &m_internal->ssl, &m_internal->conf ) ) != 0 )
         {
             debug_printf( "mbedtls_ssl_setup failed - error code = %d\n", result );
-            m_matchStatus = MATCH_FAILED;
-            goto cleanup;
+            return false;
         }
 
         if ( ( result = mbedtls_ssl_set_hostname( &m_internal->ssl, "yojimbo" ) ) != 0 )
         {
             debug_printf( "mbedtls_ssl_set_hostname failed - error code = %d\n", result );
-            m_matchStatus = MATCH_FAILED;
-            goto cleanup;
+            return false;
+        }
+
+        m_initialized = true;
+
+        return true;
+    }
+
+    static bool matcher_connect( MatcherInternal & internal )
+    {
+        assert( !internal.connected );
+
+        int result;
+
+        if ( ( result = mbedtls_net_connect( &internal.server_fd, SERVER_NAME, SERVER_PORT, MBEDTLS_NET_PROTO_TCP ) ) != 0 )
+        {
+            debug_printf( "mbedtls_net_connect failed - error code = %d\n", result );
+            return false;
+        }
+
+        if ( ( result = mbedtls_ssl_session_reset( &internal.ssl ) ) != 0 )
+        {
+            debug_printf( "mbedtls_ssl_session_reset failed - error code = %d\n", result );
+            mbedtls_net_free( &internal.server_fd );
+            return false;
+        }
+
+        if ( internal.hasSession && ( result = mbedtls_ssl_set_session( &internal.ssl, &internal.session ) ) != 0 )
+        {
+            debug_printf( "mbedtls_ssl_set_session failed - error code = %d\n", result );
         }
 
-        mbedtls_ssl_set_bio( &m_internal->ssl, &m_internal->server_fd, mbedtls_net_send, mbedtls_net_recv, NULL );
+        mbedtls_ssl_set_bio( &internal.ssl, &internal.server_fd, mbedtls_net_send, mbedtls_net_recv, NULL );
 
-        while ( ( result = mbedtls_ssl_handshake( &m_internal->ssl ) ) != 0 )
+        while ( ( result = mbedtls_ssl_handshake( &internal.ssl ) ) != 0 )
         {
             if ( result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE )
             {
                 debug_printf( "mbedtls_ssl_handshake failed - error code = %d\n", result );
-                m_matchStatus = MATCH_FAILED;
-                goto cleanup;
+                mbedtls_net_free( &internal.server_fd );
+                return false;
             }
         }
 
-        if ( ( flags = mbedtls_ssl_get_verify_result( &m_internal->ssl ) ) != 0 )
+        internal.connected = true;
+
+        uint32_t flags;
+
+        if ( ( flags = mbedtls_ssl_get_verify_result( &internal.ssl ) ) != 0 )
         {
 #if YOJIMBO_SECURE_MODE
             // IMPORTANT: In secure mode you must use a valid certificate, not a self signed one!
             debug_printf( "mbedtls_ssl_get_verify_result failed - flags = %x\n", flags );
-            m_matchStatus = MATCH_FAILED;
-            goto cleanup;
+            matcher_disconnect( internal );
+            return false;
 #endif // #if YOJIMBO_SECURE_MODE
         }
 
-        sprintf( request, "GET /match/%" PRIu64 "/%" PRIu64 " HTTP/1.0\r\n\r\n", protocolId, clientId );
+        // remember the session, so the next connection can resume it with an abbreviated handshake
+
+        mbedtls_ssl_session_free( &internal.session );
+        mbedtls_ssl_session_init( &internal.session );
+
+        internal.hasSession = mbedtls_ssl_get_session( &internal.ssl, &internal.session ) == 0;
+
+        return true;
+    }
+
+    static bool header_equals( const char * header, const char * name )
+    {
+        // IMPORTANT: HTTP header names are case insensitive.
+
+        while ( *name )
+        {
+            char c = *header++;
+            if ( c >= 'A' && c <= 'Z' )
+                c += 'a' - 'A';
+            if ( c != *name++ )
+                return false;
+        }
+        return true;
+    }
+
+    static const char * find_header( const char * headers, const char * headersEnd, const char * name )
+    {
+        const int nameLength = (int) strlen( name );
+
+        const char * line = headers;
+
+        while ( line < headersEnd )
+        {
+            if ( headersEnd - line > nameLength && header_equals( line, name ) )
+            {
+                const char * value = line + nameLength;
+                while ( *value == ' ' )
+                    ++value;
+                return value;
+            }
+
+            const char * next = strstr( line, "\r\n" );
+            if ( !next )
+                break;
+            line = next + 2;
+        }
+
+        return NULL;
+    }
+
+    static int decode_chunked_body( char * body )
+    {
+        // decode a chunked transfer encoding body in place. returns the length of the decoded body, or -1 if it is malformed.
+
+        const char * read = body;
+        char * write = body;
+
+        while ( true )
+        {
+            char * end = NULL;
+            const long chunkSize = strtol( read, &end, 16 );
+            if ( end == read || chunkSize < 0 )
+                return -1;
+
+            const char * chunkData = strstr( end, "\r\n" );
+            if ( !chunkData )
+                return -1;
+            chunkData += 2;
+
+            if ( chunkSize == 0 )
+                break;
+
+            if ( (long) strlen( chunkData ) < chunkSize + 2 )
+                return -1;
+
+            memmove( write, chunkData, chunkSize );
+            write += chunkSize;
+            read = chunkData + chunkSize + 2;
+        }
+
+        *write = '\0';
+
+        return (int) ( write - body );
+    }
+
+    /*
+        Send a request over the kept alive connection and read the response.
+
+        Returns the response body, or NULL if the request failed. keepAlive is set to true if the connection can be used for the next request.
 
-        debug_printf( "match request:\n" );
-        debug_printf( "%s\n", request );
+        bodyBytes is set to the length of the body, and binary is set to true if the body is a binary match response instead of JSON.
+     */
 
-        while ( ( result = mbedtls_ssl_write( &m_internal->ssl, (uint8_t*) request, strlen( request ) ) ) <= 0 )
+    static char * matcher_http_request( MatcherInternal & internal, const char * request, char * buffer, int bufferSize, bool & keepAlive, int & bodyBytes, bool & binary )
+    {
+        keepAlive = false;
+        bodyBytes = 0;
+        binary = false;
+
+        int result;
+
+        while ( ( result = mbedtls_ssl_write( &internal.ssl, (const uint8_t*) request, strlen( request ) ) ) <= 0 )
         {
             if ( result != MBEDTLS_ERR_SSL_WANT_READ && result != MBEDTLS_ERR_SSL_WANT_WRITE )
             {
                 debug_printf( "mbedtls_ssl_write failed - error code = %d\n", result );
-                m_matchStatus = MATCH_FAILED;
-                goto cleanup;
+                return NULL;
             }
         }
 
-        memset( buf, 0, sizeof( buf ) );
+        memset( buffer, 0, bufferSize );
+
+        int bytesRead = 0;
+        char * body = NULL;
+        int contentLength = -1;
+        bool chunked = false;
+        bool complete = false;
 
-        do
+        while ( true )
         {
-            result = mbedtls_ssl_read( &m_internal->ssl, (uint8_t*) ( buf + bytesRead ), sizeof( buf ) - bytesRead - 1 );
+            if ( body && contentLength >= 0 && bytesRead >= ( body - buffer ) + contentLength )
+                complete = true;
 
-            if ( result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE )
-                continue;
+            // IMPORTANT: A chunked body ends with a zero length chunk. The search starts before the body so a body with no data chunks is found too.
+
+            if ( body && chunked && strstr( body - 2, "\r\n0\r\n\r\n" ) )
+                complete = true;
 
-            if ( result == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY )
+            if ( complete )
                 break;
 
+            if ( bytesRead >= bufferSize - 1 )
+            {
+                debug_printf( "match response is too large\n" );
+                return NULL;
+            }
+
+            result = mbedtls_ssl_read( &internal.ssl, (uint8_t*) ( buffer + bytesRead ), bufferSize - bytesRead - 1 );
+
+            if ( result == MBEDTLS_ERR_SSL_WANT_READ || result == MBEDTLS_ERR_SSL_WANT_WRITE )
+                continue;
+
             if ( result <= 0 )
                 break;
 
             bytesRead += result;
+
+            if ( !body )
+            {
+                char * headersEnd = strstr( buffer, "\r\n\r\n" );
+
+                if ( headersEnd )
+                {
+                    body = headersEnd + 4;
+
+                    const char * contentLengthValue = find_header( buffer, headersEnd, "content-length:" );
+                    if ( contentLengthValue )
+                        contentLength = atoi( contentLengthValue );
+
+                    const char * transferEncodingValue = find_header( buffer, headersEnd, "transfer-encoding:" );
+                    chunked = transferEncodingValue && header_equals( transferEncodingValue, "chunked" );
+
+                    const char * connectionValue = find_header( buffer, headersEnd, "connection:" );
+
+                    keepAlive = ( contentLength >= 0 || chunked ) && strncmp( buffer, "HTTP/1.1", 8 ) == 0 && !( connectionValue && header_equals( connectionValue, "close" ) );
+
+                    const char * contentTypeValue = find_header( buffer, headersEnd, "content-type:" );
+                    binary = contentTypeValue && header_equals( contentTypeValue, YOJIMBO_BINARY_MATCH_CONTENT_TYPE );
+
+                    // IMPORTANT: Chunked bodies are found and decoded with string functions, so a binary body must come with a content length.
+
+                    if ( binary && contentLength < 0 )
+                    {
+                        debug_printf( "binary match response has no content length\n" );
+                        keepAlive = false;
+                        return NULL;
+                    }
+                }
+            }
         }
-        while( 1 );
 
-        json = strstr( (const char*)buf, "\r\n\r\n" );
+        // IMPORTANT: Without a content length or chunked encoding, the body runs until the matcher closes the connection, so the connection can't be reused.
 
-        if ( json && ParseMatchResponse( json, m_matchResponse ) )
+        if ( !complete )
         {
-            m_matchStatus = MATCH_READY;
+            keepAlive = false;
+
+            if ( !body || contentLength >= 0 || chunked )
+                return NULL;
+        }
+
+        if ( chunked )
+        {
+            bodyBytes = decode_chunked_body( body );
+            if ( bodyBytes < 0 )
+                return NULL;
         }
         else
         {
-            debug_printf( "failed to parse match response json:\n%s\n", json );
-            m_matchStatus = MATCH_FAILED;
+            bodyBytes = contentLength >= 0 ? contentLength : (int) strlen( body );
+        }
+
+        return body;
+    }
+
+    void Matcher::RequestMatch( uint64_t protocolId, uint64_t clientId )
+    {
+        assert( m_initialized );
+        assert( GetMatchStatus() != MATCH_BUSY );
+
+        JoinMatchThread();
+
+        FreeBatch();
+
+        m_protocolId = protocolId;
+        m_clientId = clientId;
+        m_batchRequest = false;
+
+        StartMatchRequest();
+    }
+
+    void Matcher::RequestMatches( uint64_t protocolId, const uint64_t * clientIds, int numClientIds )
+    {
+        assert( m_initialized );
+        assert( GetMatchStatus() != MATCH_BUSY );
+        assert( clientIds );
+        assert( numClientIds > 0 );
+        assert( numClientIds <= MaxMatchBatchSize );
+
+        JoinMatchThread();
+
+        FreeBatch();
+
+        m_protocolId = protocolId;
+        m_batchRequest = true;
+
+        // IMPORTANT: Everything the worker thread needs is allocated here, on the calling thread, because allocators are not thread safe.
+
+        const int requestBufferSize = MatchRequestHeaderBytes + numClientIds * MatchBatchClientIdBytes;
+
+        m_batchResponseBufferSize = MatchResponseBufferBytes + numClientIds * MatchBatchResponseBytes;
+
+        m_batchClientIds = (uint64_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint64_t ) * numClientIds );
+        m_batchMatchResponses = (MatchResponse*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( MatchResponse ) * numClientIds );
+        m_batchRequestBuffer = (char*) YOJIMBO_ALLOCATE( *m_allocator, requestBufferSize );
+        m_batchResponseBuffer = (char*) YOJIMBO_ALLOCATE( *m_allocator, m_batchResponseBufferSize );
+
+        m_batchDocumentBufferSize = MatchDocumentBytes + numClientIds * MatchBatchDocumentBytes;
+
+        m_batchDocumentBuffer = YOJIMBO_ALLOCATE( *m_allocator, m_batchDocumentBufferSize );
+
+        if ( !m_batchClientIds || !m_batchMatchResponses || !m_batchRequestBuffer || !m_batchResponseBuffer || !m_batchDocumentBuffer )
+        {
+            debug_printf( "failed to allocate match batch for %d clients\n", numClientIds );
+            FreeBatch();
+            atomic_store( &m_matchStatus, MATCH_FAILED );
+            return;
+        }
+
+        m_numBatchClientIds = numClientIds;
+
+        memcpy( m_batchClientIds, clientIds, sizeof( uint64_t ) * numClientIds );
+
+        for ( int i = 0; i < numClientIds; ++i )
+            new ( &m_batchMatchResponses[i] ) MatchResponse();
+
+        StartMatchRequest();
+    }
+
+    void Matcher::ReportServerLoad( uint64_t protocolId, const ServerLoadReport & report )
+    {
+        assert( m_initialized );
+        assert( GetMatchStatus() != MATCH_BUSY );
+
+        JoinMatchThread();
+
+        FreeBatch();
+
+        m_protocolId = protocolId;
+        m_batchRequest = false;
+
+        m_loadReport = YOJIMBO_NEW( *m_allocator, ServerLoadReport );
+
+        if ( !m_loadReport )
+        {
+            atomic_store( &m_matchStatus, MATCH_FAILED );
+            return;
         }
 
-    cleanup:
+        *m_loadReport = report;
 
-        mbedtls_ssl_close_notify( &m_internal->ssl );
+        StartMatchRequest();
+    }
+
+    void Matcher::StartMatchRequest()
+    {
+        atomic_store( &m_matchStatus, MATCH_BUSY );
+
+        m_thread = platform_thread_create( *m_allocator, MatchThreadFunction, this );
+
+        if ( !m_thread )
+        {
+            debug_printf( "failed to create matcher thread. requesting match on the calling thread\n" );
+            RunMatchRequest();
+        }
+    }
+
+    void Matcher::MatchThreadFunction( void * data )
+    {
+        Matcher * matcher = (Matcher*) data;
+        matcher->RunMatchRequest();
+    }
+
+    void Matcher::JoinMatchThread()
+    {
+        if ( !m_thread )
+            return;
+
+        platform_thread_join( *m_allocator, m_thread );
+
+        m_thread = NULL;
+    }
+
+    void Matcher::FreeBatch()
+    {
+        YOJIMBO_FREE( *m_allocator, m_batchClientIds );
+        YOJIMBO_FREE( *m_allocator, m_batchMatchResponses );
+        YOJIMBO_FREE( *m_allocator, m_batchRequestBuffer );
+        YOJIMBO_FREE( *m_allocator, m_batchResponseBuffer );
+        YOJIMBO_FREE( *m_allocator, m_batchDocumentBuffer );
+        YOJIMBO_DELETE( *m_allocator, ServerLoadReport, m_loadReport );
+
+        m_numBatchClientIds = 0;
+        m_batchResponseBufferSize = 0;
+        m_batchDocumentBufferSize = 0;
+    }
+
+    void Matcher::RunMatchRequest()
+    {
+        MatchStatus matchStatus = MATCH_FAILED;
+
+        char singleRequest[MatchRequestHeaderBytes];
+
+        char singleBuffer[MatchResponseBufferBytes];
+
+        char * request = singleRequest;
+        char * buffer = singleBuffer;
+        int bufferSize = sizeof( singleBuffer );
+
+        char loadReportRequest[MatchRequestHeaderBytes+MatchLoadReportBytes];
+
+        if ( m_loadReport )
+        {
+            // The load report body is a JSON object. The matcher replies with an empty body, so only the status code matters.
+
+            char serverAddress[MaxAddressLength];
+            m_loadReport->serverAddress.ToString( serverAddress, sizeof( serverAddress ) );
+
+            char body[MatchLoadReportBytes];
+
+            const int bodyBytes = snprintf( body, sizeof( body ), "{\"serverAddress\":\"%s\",\"numConnectedClients\":%d,\"maxClients\":%d,\"tickHeadroom\":%.3f,\"packetsSent\":%" PRIu64 ",\"packetsReceived\":%" PRIu64 ",\"packetsDropped\":%" PRIu64 "}",
+                serverAddress, m_loadReport->numConnectedClients, m_loadReport->maxClients, m_loadReport->tickHeadroom, m_loadReport->packetsSent, m_loadReport->packetsReceived, m_loadReport->packetsDropped );
+
+            assert( bodyBytes > 0 && bodyBytes < (int) sizeof( body ) );
+
+            sprintf( loadReportRequest, "POST /servers/%" PRIu64 " HTTP/1.1\r\nHost: " SERVER_NAME ":" SERVER_PORT "\r\nConnection: keep-alive\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n%s", m_protocolId, bodyBytes, body );
+
+            request = loadReportRequest;
+
+            debug_printf( "server load report: %s\n", body );
+        }
+        else if ( m_batchRequest )
+        {
+            // The batch request body is a JSON array of client ids. The matcher replies with a JSON array of match responses in the same order.
+
+            char * body = m_batchRequestBuffer + MatchRequestHeaderBytes;
+            char * p = body;
+
+            *p++ = '[';
+            for ( int i = 0; i < m_numBatchClientIds; ++i )
+                p += sprintf( p, i == 0 ? "%" PRIu64 : ",%" PRIu64, m_batchClientIds[i] );
+            *p++ = ']';
+            *p = '\0';
+
+            // IMPORTANT: The header is written in front of the body, then moved up against it so the request is contiguous.
+
+            char header[MatchRequestHeaderBytes];
+
+            const int headerBytes = sprintf( header, "POST /matches/%" PRIu64 " HTTP/1.1\r\nHost: " SERVER_NAME ":" SERVER_PORT "\r\nConnection: keep-alive\r\n" MATCH_ACCEPT_HEADER "Content-Type: application/json\r\nContent-Length: %d\r\n\r\n", m_protocolId, (int) ( p - body ) );
+
+            request = body - headerBytes;
+            memcpy( request, header, headerBytes );
+
+            buffer = m_batchResponseBuffer;
+            bufferSize = m_batchResponseBufferSize;
+
+            debug_printf( "match request: batch of %d clients\n", m_numBatchClientIds );
+        }
+        else
+        {
+            sprintf( request, "GET /match/%" PRIu64 "/%" PRIu64 " HTTP/1.1\r\nHost: " SERVER_NAME ":" SERVER_PORT "\r\nConnection: keep-alive\r\n" MATCH_ACCEPT_HEADER "\r\n", m_protocolId, m_clientId );
+
+            debug_printf( "match request:\n" );
+            debug_printf( "%s\n", request );
+        }
+
+        char * body = NULL;
+        int bodyBytes = 0;
+        bool binary = false;
+
+        for ( int attempt = 0; attempt < 2; ++attempt )
+        {
+            // IMPORTANT: The matcher may have closed a kept alive connection since the last request. In that case, reconnect and try again once.
+
+            const bool reusingConnection = m_internal->connected;
+
+            if ( !reusingConnection && !matcher_connect( *m_internal ) )
+                break;
+
+            bool keepAlive = false;
+
+            body = matcher_http_request( *m_internal, request, buffer, bufferSize, keepAlive, bodyBytes, binary );
+
+            if ( !body || !keepAlive )
+                matcher_disconnect( *m_internal );
+
+            if ( body || !reusingConnection )
+                break;
+        }
+
+        bool parsed = false;
+
+        if ( m_loadReport )
+        {
+            // IMPORTANT: The response buffer starts with the status line, eg. "HTTP/1.1 200 OK".
+
+            parsed = body && strncmp( buffer, "HTTP/1.", 7 ) == 0 && buffer[9] == '2';
+        }
+        else if ( binary )
+        {
+            parsed = m_batchRequest ? ParseBinaryMatchResponses( (const uint8_t*) body, bodyBytes, m_batchMatchResponses, m_numBatchClientIds ) : ParseBinaryMatchResponses( (const uint8_t*) body, bodyBytes, &m_matchResponse, 1 );
+        }
+        else
+        {
+            parsed = m_batchRequest ? ParseMatchResponses( body, m_batchMatchResponses, m_numBatchClientIds, m_batchDocumentBuffer, m_batchDocumentBufferSize ) : ParseMatchResponse( body, m_matchResponse );
+        }
+
+        if ( body && parsed )
+        {
+            matchStatus = MATCH_READY;
+        }
+        else if ( m_loadReport )
+        {
+            debug_printf( "server load report failed\n" );
+        }
+        else
+        {
+            debug_printf( "failed to parse match response %s\n", binary ? "binary" : "json" );
+        }
+
+        // IMPORTANT: The match response is written before the status, so it is ready once another thread sees MATCH_READY.
+
+        atomic_store( &m_matchStatus, matchStatus );
     }
 
     MatchStatus Matcher::GetMatchStatus()
     {
-        return m_matchStatus;
+        const MatchStatus matchStatus = (MatchStatus) atomic_load( &m_matchStatus );
+
+        if ( matchStatus != MATCH_BUSY )
+            JoinMatchThread();
+
+        return matchStatus;
     }
 
     void Matcher::GetMatchResponse( MatchResponse & matchResponse )
     {
-        matchResponse = ( m_matchStatus == MATCH_READY ) ? m_matchResponse : MatchResponse();
+        GetMatchResponse( 0, matchResponse );
+    }
+
+    int Matcher::GetNumMatchResponses()
+    {
+        if ( GetMatchStatus() != MATCH_READY )
+            return 0;
+
+        if ( m_loadReport )
+            return 0;
+
+        return m_batchRequest ? m_numBatchClientIds : 1;
     }
 
-    static bool exists_and_is_string( Document & doc, const char * key )
+    void Matcher::GetMatchResponse( int index, MatchResponse & matchResponse )
+    {
+        if ( index < 0 || index >= GetNumMatchResponses() )
+        {
+            matchResponse = MatchResponse();
+            return;
+        }
+
+        matchResponse = m_batchRequest ? m_batchMatchResponses[index] : m_matchResponse;
+    }
+
+    static bool exists_and_is_string( const Value & doc, const char * key )
     {
         return doc.HasMember( key ) && doc[key].IsString();
     }
 
-    static bool exists_and_is_array( Document & doc, const char * key )
+    static bool exists_and_is_array( const Value & doc, const char * key )
     {
         return doc.HasMember( key ) && doc[key].IsArray();
     }
 
-    bool Matcher::ParseMatchResponse( const char * json, MatchResponse & matchResponse )
+    static bool parse_match_response( const Value & doc, MatchResponse & matchResponse )
     {
-        Document doc;
-        doc.Parse( json );
-        if ( doc.HasParseError() )
+        if ( !doc.IsObject() )
             return false;
 
         if ( !exists_and_is_string( doc, "connectTokenData" ) )
@@ -274,11 +779,14 @@ namespace yojimbo
         if ( !exists_and_is_string( doc, "serverToClientKey" ) )
             return false;
 
+        if ( !exists_and_is_string( doc, "connectTokenExpireTimestamp" ) )
+            return false;
+
         const char * encryptedConnectTokenBase64 = doc["connectTokenData"].GetString();
 
         int encryptedLength = base64_decode_data( encryptedConnectTokenBase64, matchResponse.connectTokenData, ConnectTokenBytes );
 
-        if ( encryptedLength != ConnectTokenBytes )
+        if ( encryptedLength < MinCompactConnectTokenBytes || encryptedLength != GetConnectTokenBytes( matchResponse.connectTokenData ) )
             return false;        
 
         uint64_t connectTokenNonce = atoll( doc["connectTokenNonce"].GetString() );
@@ -328,4 +836,156 @@ namespace yojimbo
 
         return true;
     }
+
+    bool Matcher::ParseMatchResponse( char * json, MatchResponse & matchResponse )
+    {
+        if ( !json )
+            return false;
+
+        char documentBuffer[MatchDocumentBytes];
+        MemoryPoolAllocator<> documentAllocator( documentBuffer, sizeof( documentBuffer ) );
+        MatchDocument doc( &documentAllocator, MatchDocumentStackBytes, &documentAllocator );
+
+        doc.ParseInsitu( json );
+        if ( doc.HasParseError() )
+            return false;
+
+        return parse_match_response( doc, matchResponse );
+    }
+
+    bool Matcher::ParseMatchResponses( char * json, MatchResponse * matchResponses, int numMatchResponses, void * documentBuffer, int documentBufferSize )
+    {
+        assert( matchResponses );
+        assert( documentBuffer );
+
+        if ( !json )
+            return false;
+
+        MemoryPoolAllocator<> documentAllocator( documentBuffer, documentBufferSize );
+        MatchDocument doc( &documentAllocator, MatchDocumentStackBytes, &documentAllocator );
+
+        doc.ParseInsitu( json );
+        if ( doc.HasParseError() )
+            return false;
+
+        if ( !doc.IsArray() || doc.Size() != (SizeType) numMatchResponses )
+            return false;
+
+        for ( SizeType i = 0; i < doc.Size(); ++i )
+        {
+            if ( !parse_match_response( doc[i], matchResponses[i] ) )
+                return false;
+        }
+
+        return true;
+    }
+
+    static bool read_match_bytes( const uint8_t * & p, const uint8_t * end, void * data, int bytes )
+    {
+        if ( end - p < bytes )
+            return false;
+        memcpy( data, p, bytes );
+        p += bytes;
+        return true;
+    }
+
+    static bool parse_binary_match_response( const uint8_t * & p, const uint8_t * end, MatchResponse & matchResponse )
+    {
+        uint8_t numServerAddresses = 0;
+        if ( !read_match_bytes( p, end, &numServerAddresses, 1 ) )
+            return false;
+
+        if ( numServerAddresses < 1 || numServerAddresses > MaxServersPerConnect )
+            return false;
+
+        matchResponse.numServerAddresses = numServerAddresses;
+
+        for ( int i = 0; i < numServerAddresses; ++i )
+        {
+            uint8_t addressType = 0;
+            uint8_t addressBytes[16];
+            uint16_t port = 0;
+
+            if ( !read_match_bytes( p, end, &addressType, 1 ) )
+                return false;
+
+            if ( addressType != 4 && addressType != 6 )
+                return false;
+
+            if ( !read_match_bytes( p, end, addressBytes, addressType == 4 ? 4 : 16 ) )
+                return false;
+
+            if ( !read_match_bytes( p, end, &port, 2 ) )
+                return false;
+
+            port = network_to_host( port );
+
+            if ( addressType == 4 )
+            {
+                matchResponse.serverAddresses[i] = Address( addressBytes[0], addressBytes[1], addressBytes[2], addressBytes[3], port );
+            }
+            else
+            {
+                uint16_t fields[8];
+                for ( int j = 0; j < 8; ++j )
+                    fields[j] = ( uint16_t( addressBytes[j*2] ) << 8 ) | addressBytes[j*2+1];
+                matchResponse.serverAddresses[i] = Address( fields, port );
+            }
+        }
+
+        uint64_t connectTokenExpireTimestamp = 0;
+        if ( !read_match_bytes( p, end, &connectTokenExpireTimestamp, 8 ) )
+            return false;
+
+        matchResponse.connectTokenExpireTimestamp = network_to_host( connectTokenExpireTimestamp );
+
+        if ( !read_match_bytes( p, end, matchResponse.connectTokenNonce, NonceBytes ) )
+            return false;
+
+        if ( !read_match_bytes( p, end, matchResponse.clientToServerKey, KeyBytes ) )
+            return false;
+
+        if ( !read_match_bytes( p, end, matchResponse.serverToClientKey, KeyBytes ) )
+            return false;
+
+        uint16_t connectTokenBytes = 0;
+        if ( !read_match_bytes( p, end, &connectTokenBytes, 2 ) )
+            return false;
+
+        connectTokenBytes = network_to_host( connectTokenBytes );
+
+        if ( connectTokenBytes < MinCompactConnectTokenBytes || connectTokenBytes > ConnectTokenBytes )
+            return false;
+
+        if ( !read_match_bytes( p, end, matchResponse.connectTokenData, connectTokenBytes ) )
+            return false;
+
+        return GetConnectTokenBytes( matchResponse.connectTokenData ) == connectTokenBytes;
+    }
+
+    bool Matcher::ParseBinaryMatchResponses( const uint8_t * data, int bytes, MatchResponse * matchResponses, int numMatchResponses )
+    {
+        assert( matchResponses );
+
+        if ( !data || bytes < 0 )
+            return false;
+
+        const uint8_t * p = data;
+        const uint8_t * end = data + bytes;
+
+        uint16_t count = 0;
+        if ( !read_match_bytes( p, end, &count, 2 ) )
+            return false;
+
+        if ( network_to_host( count ) != numMatchResponses )
+            return false;
+
+        for ( int i = 0; i < numMatchResponses; ++i )
+        {
+            if ( !parse_binary_match_response( p, end, matchResponses[i] ) )
+                return false;
+        }
+
+        return p == end;
+    }
 }
@@ -31,12 +31,17 @@
 
 /** @file */
 
+/// The content type of binary match responses. Matcher requests accept this as well as JSON, and parse whichever the matcher sends back. See Matcher::ParseBinaryMatchResponses.
+#define YOJIMBO_BINARY_MATCH_CONTENT_TYPE "application/x-yojimbo-match"
+
 namespace yojimbo
 {
+    struct ServerLoadReport;
+
     /**
         Matcher status enum.
 
-        Designed for when the matcher will be made non-blocking. The matcher is currently blocking in Matcher::RequestMatch
+        Matcher::RequestMatch runs in the background, so the status is MATCH_BUSY until the request completes or fails.
      */
 
     enum MatchStatus
@@ -82,7 +87,11 @@ namespace yojimbo
 
         See docker/matcher/matcher.go for details. Launch the matcher via "premake5 matcher".
 
-        This class will be improved in the future, most importantly to make Matcher::RequestMatch a non-blocking operation.
+        Match requests are made on a worker thread, so connecting to the matcher, the TLS handshake and the HTTP request never block the thread calling in to the matcher. Poll Matcher::GetMatchStatus to find out when the request has finished.
+
+        The HTTPS connection to the matcher is kept alive between requests, and the TLS session is cached, so reconnecting after the matcher closes the connection resumes the session without a full handshake.
+
+        Requests accept a binary match response as well as JSON. The binary response is about a third smaller, because the connect token and keys aren't base64 encoded, and it is read straight into MatchResponse without parsing.
      */
 
     class Matcher
@@ -99,6 +108,8 @@ namespace yojimbo
        
         /**
             Matcher destructor.
+
+            IMPORTANT: If a match request is in progress, this waits for it to finish. Closes the connection to the matcher if it is still open.
          */
 
         ~Matcher();
@@ -106,6 +117,8 @@ namespace yojimbo
         /**
             Initialize the matcher. 
 
+            Sets up the TLS configuration used for every connection to the matcher. Does not connect.
+
             @returns True if the matcher initialized successfully, false otherwise.
          */
 
@@ -118,7 +131,9 @@ namespace yojimbo
 
             They request a match and the server replies with a set of servers to connect to, and a connect token to pass to that server.
 
-            IMPORTANT: This function is currently blocking. It will be made non-blocking in the near future.
+            This function does not block. The request is made on a worker thread, and the match status is MATCH_BUSY until it finishes. If the worker thread can't be created, the request is made on the calling thread instead, and has finished by the time this function returns.
+
+            IMPORTANT: Only one match request can be in progress at a time.
 
             @param protocolId The protocol id that we are using. Used to filter out servers with different protocol versions.
             @param clientId A unique client identifier that identifies each client to your back end services. If you don't have this yet, just roll a random 64 bit number.
@@ -129,10 +144,46 @@ namespace yojimbo
 
         void RequestMatch( uint64_t protocolId, uint64_t clientId );
 
+        /**
+            Request matches for a batch of clients in one HTTPS round trip.
+
+            This is intended for load tests and bots, where one process stands in for many clients. Instead of one connection and one request per-client, the client ids are posted to the matcher in a single request, and the matcher replies with a JSON array of match responses, one per-client id, in the same order.
+
+            Like Matcher::RequestMatch, this does not block. The match status is MATCH_BUSY until the request finishes. The whole batch succeeds or fails together.
+
+            IMPORTANT: Only one match request can be in progress at a time. The memory for the batch is allocated here, on the calling thread, and is freed by the next request or when the matcher is destroyed.
+
+            @param protocolId The protocol id that we are using. Used to filter out servers with different protocol versions.
+            @param clientIds The array of client ids to request matches for.
+            @param numClientIds The number of client ids in the array, in [1,MaxMatchBatchSize].
+
+            @see Matcher::GetNumMatchResponses
+            @see Matcher::GetMatchResponse
+         */
+
+        void RequestMatches( uint64_t protocolId, const uint64_t * clientIds, int numClientIds );
+
+        /**
+            Report the load of a dedicated server to the matcher.
+
+            Dedicated servers call this periodically, eg. every few seconds, so the matcher knows which servers are up and how loaded they are. The matcher orders the server addresses in the connect tokens it hands out by this load. Servers that stop reporting are dropped by the matcher after a time out.
+
+            Like Matcher::RequestMatch, this does not block. The match status is MATCH_BUSY until the report has been sent, then MATCH_READY if the matcher accepted it, or MATCH_FAILED. There are no match responses for a load report.
+
+            IMPORTANT: Only one request can be in progress at a time, so don't share a matcher between load reports and match requests.
+
+            @param protocolId The protocol id the server is running. The matcher only sends clients with the same protocol id to this server.
+            @param report The server load report. See Server::GetLoadReport.
+
+            @see Matcher::GetMatchStatus
+         */
+
+        void ReportServerLoad( uint64_t protocolId, const ServerLoadReport & report );
+
         /**
             Get the current match status.
 
-            Because Matcher::RequestMatch is currently blocking this will be MATCH_READY or MATCH_FAILED immediately after that function returns.
+            This is MATCH_BUSY while a request made by Matcher::RequestMatch is in progress, then MATCH_READY or MATCH_FAILED once it finishes. Call this regularly, eg. once per-frame, until the request has finished.
 
             If the status is MATCH_READY you can call Matcher::GetMatchResponse to get the match response data corresponding to the last call to Matcher::RequestMatch.
 
@@ -154,18 +205,128 @@ namespace yojimbo
 
         void GetMatchResponse( MatchResponse & matchResponse );
 
+        /**
+            Get the number of match responses available.
+
+            @returns The number of client ids passed in to the last call to Matcher::RequestMatches, or 1 after Matcher::RequestMatch. Zero if the match status is not MATCH_READY.
+         */
+
+        int GetNumMatchResponses();
+
+        /**
+            Get match response data for one client in a batch.
+
+            This can only be called if the match status is MATCH_READY. The match response at index i corresponds to the client id at index i passed in to Matcher::RequestMatches.
+
+            @param index The index of the match response in [0,GetNumMatchResponses()-1].
+            @param matchResponse The match response data to fill [out].
+
+            @see Matcher::RequestMatches
+         */
+
+        void GetMatchResponse( int index, MatchResponse & matchResponse );
+
     protected:
 
         /**
             Helper function to parse the match response JSON into the MatchResponse struct.
 
-            @param json The JSON match response string to parse.
+            The JSON is parsed in-situ and base64 fields are decoded straight into the match response, so this doesn't allocate.
+
+            IMPORTANT: Parsing in-situ modifies the JSON string.
+
+            @param json The JSON match response string to parse. Modified by parsing.
             @param matchResponse The match response structure to fill [out].
 
             @returns True if the match response JSON was successfully parsed, false otherwise.
          */
 
-        bool ParseMatchResponse( const char * json, MatchResponse & matchResponse );
+        bool ParseMatchResponse( char * json, MatchResponse & matchResponse );
+
+        /**
+            Helper function to parse a batch match response JSON array into an array of MatchResponse structs.
+
+            Each element of the array has the same format as the JSON parsed by Matcher::ParseMatchResponse.
+
+            Like Matcher::ParseMatchResponse, the JSON is parsed in-situ. The parsed document is built in the buffer passed in, which should be at least 512 bytes per-match response.
+
+            @param json The JSON batch match response string to parse. Modified by parsing.
+            @param matchResponses The array of match response structures to fill [out].
+            @param numMatchResponses The number of match responses expected. Parsing fails if the JSON array has a different number of elements.
+            @param documentBuffer The buffer to build the parsed JSON document in.
+            @param documentBufferSize The size of the document buffer in bytes.
+
+            @returns True if every match response in the JSON array was successfully parsed, false otherwise.
+         */
+
+        bool ParseMatchResponses( char * json, MatchResponse * matchResponses, int numMatchResponses, void * documentBuffer, int documentBufferSize );
+
+        /**
+            Helper function to parse a binary match response into an array of MatchResponse structs.
+
+            The matcher sends this instead of JSON when it replies with content type YOJIMBO_BINARY_MATCH_CONTENT_TYPE. All integers are little endian:
+
+                uint16 number of match responses, then for each match response:
+
+                    uint8 number of server addresses, then for each server address:
+                        uint8 address type (4 or 6), then 4 or 16 address bytes in network order, then uint16 port.
+                    uint64 connect token expire timestamp.
+                    NonceBytes connect token nonce.
+                    KeyBytes client to server key.
+                    KeyBytes server to client key.
+                    uint16 connect token bytes, then the encrypted connect token.
+
+            Single match requests get the same format with one match response.
+
+            @param data The binary match response.
+            @param bytes The size of the binary match response (bytes).
+            @param matchResponses The array of match response structures to fill [out].
+            @param numMatchResponses The number of match responses expected. Parsing fails if the response has a different number.
+
+            @returns True if every match response was successfully parsed and there is no data left over, false otherwise.
+         */
+
+        bool ParseBinaryMatchResponses( const uint8_t * data, int bytes, MatchResponse * matchResponses, int numMatchResponses );
+
+        /**
+            Set the match status to MATCH_BUSY and start the worker thread. 
+
+            If the worker thread can't be created, the request is made on the calling thread.
+         */
+
+        void StartMatchRequest();
+
+        /**
+            Free memory allocated for the last batch request or load report.
+
+            IMPORTANT: Must not be called while the worker thread is running.
+         */
+
+        void FreeBatch();
+
+        /**
+            Make the match request. Called on the worker thread.
+
+            This blocks until the request is complete, then sets the match status to MATCH_READY or MATCH_FAILED.
+         */
+
+        void RunMatchRequest();
+
+        /**
+            Wait for the worker thread to finish and free it.
+
+            Does nothing if there is no worker thread.
+         */
+
+        void JoinMatchThread();
+
+        /**
+            The worker thread function.
+
+            @param data The matcher making the request.
+         */
+
+        static void MatchThreadFunction( void * data );
 
     private:
 
@@ -173,9 +334,35 @@ namespace yojimbo
 
         bool m_initialized;                                     ///< True if the matcher was successfully initialized. See Matcher::Initialize.
         
-        MatchStatus m_matchStatus;                              ///< The current match status.
+        int m_matchStatus;                                      ///< The current match status. See MatchStatus. Written by the worker thread, so always accessed with atomic_load and atomic_store.
         
-        MatchResponse m_matchResponse;                          ///< The match response status from the last call to Matcher::RequestMatch if the match status is MATCH_READY.
+        MatchResponse m_matchResponse;                          ///< The match response status from the last call to Matcher::RequestMatch if the match status is MATCH_READY. Written by the worker thread before the match status is set.
+
+        uint64_t m_protocolId;                                  ///< The protocol id passed in to the last call to Matcher::RequestMatch.
+
+        uint64_t m_clientId;                                    ///< The client id passed in to the last call to Matcher::RequestMatch.
+
+        bool m_batchRequest;                                    ///< True if the last request was made with Matcher::RequestMatches.
+
+        int m_numBatchClientIds;                                ///< The number of client ids in the last batch request.
+
+        uint64_t * m_batchClientIds;                            ///< Copy of the client ids passed in to the last call to Matcher::RequestMatches.
+
+        MatchResponse * m_batchMatchResponses;                  ///< The match responses for the last batch request, one per-client id. Written by the worker thread before the match status is set.
+
+        char * m_batchRequestBuffer;                            ///< Buffer the batch HTTP request is written to.
+
+        char * m_batchResponseBuffer;                           ///< Buffer the batch HTTP response is read into.
+
+        int m_batchResponseBufferSize;                          ///< The size of the batch response buffer in bytes.
+
+        void * m_batchDocumentBuffer;                           ///< Buffer the batch response JSON document is parsed into.
+
+        int m_batchDocumentBufferSize;                          ///< The size of the batch document buffer in bytes.
+
+        ServerLoadReport * m_loadReport;                        ///< Copy of the report passed in to the last call to Matcher::ReportServerLoad. NULL if the last request was a match request.
+
+        struct PlatformThread * m_thread;                       ///< The worker thread making the match request. NULL if there is no request in progress, or once the finished request has been joined.
         
         struct MatcherInternal * m_internal;                    ///< Internal match data is contained in this structure here so we don't have to spill details of mbedtls library outside yojimbo_matcher.cpp
     };
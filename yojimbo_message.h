@@ -30,10 +30,7 @@
 #include "yojimbo_serialize.h"
 #include "yojimbo_allocator.h"
 #include "yojimbo_bit_array.h"
-
-#if YOJIMBO_DEBUG_MESSAGE_LEAKS
-#include <map>
-#endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+#include "yojimbo_platform.h"
 
 /** @file */
 
@@ -72,6 +69,18 @@ namespace yojimbo
     {
     public:
 
+        /**
+            The maximum number of bits this message can take when serialized, or zero if it isn't bounded.
+
+            Derived message classes with a fixed maximum size can hide this with their own value, eg. enum { MaxSerializeBits = 16 + 3 * 20 }; Messages read through a factory declared with YOJIMBO_MESSAGE_FACTORY_TYPE_LIST then check that many bits remain once up front, and read the message through an UncheckedReadStream instead of checking each field against the end of the packet.
+
+            IMPORTANT: This must be a true upper bound. Count the worst case of every field, 7 bits for each align, and remember that classes derived from your message inherit the value.
+
+            @see UncheckedReadStream
+         */
+
+        enum { MaxSerializeBits = 0 };
+
         /**
             Message constructor.
 
@@ -82,14 +91,28 @@ namespace yojimbo
             @see MessageFactory::Create
          */
 
-        Message( int blockMessage = 0 ) : m_refCount(1), m_id(0), m_type(0), m_blockMessage( blockMessage ) {}
+        Message( int blockMessage = 0 ) : m_refCount(1), m_id(0), m_type(0), m_blockMessage( blockMessage )
+        {
+#if YOJIMBO_MESSAGE_CACHE
+            m_serializedData = NULL;
+#endif // #if YOJIMBO_MESSAGE_CACHE
+#if YOJIMBO_MESSAGE_KEYS
+            m_key = 0;
+            m_hasKey = false;
+#endif // #if YOJIMBO_MESSAGE_KEYS
+#if YOJIMBO_MESSAGE_TIME_TO_LIVE
+            m_timeToLive = 0.0f;
+#endif // #if YOJIMBO_MESSAGE_TIME_TO_LIVE
+        }
 
         /** 
             Set the message id.
 
             When messages are sent over a reliable-ordered channel, the message id starts at 0 and increases with each message sent over that channel.
 
-            When messages are sent over an unreliable-unordered channel, the message id is set to the sequence number of the packet they are included in.
+            When messages are sent over an unreliable-unordered channel, the message id is set to the sequence number of the packet they are included in. With ChannelConfig::redundancyWindow set, the message id instead starts at 0 and increases with each message included in a packet, so every copy of a message has the same id.
+
+            When messages are sent over a snapshot channel, the message id starts at 0 and increases with each message sent, including messages that are superseded before they are sent.
 
             @param id The message id.
          */
@@ -140,6 +163,158 @@ namespace yojimbo
 
         bool IsBlockMessage() const { return m_blockMessage; }
 
+        /**
+            Is this a broadcast message?
+
+            Broadcast messages are of type BroadcastMessage. They are shared between the connections of many clients, and write bits that were serialized once for all of them.
+
+            @returns True if this is a broadcast message, false otherwise.
+
+            @see BroadcastMessage
+            @see Server::BroadcastMsg
+         */
+
+        virtual bool IsBroadcastMessage() const { return false; }
+
+        /**
+            Is this a delta message?
+
+            Delta messages are of type DeltaMessage. When sent over a snapshot channel, they are serialized relative to a baseline message.
+
+            @returns True if this is a delta message, false otherwise.
+
+            @see DeltaMessage
+         */
+
+        virtual bool IsDeltaMessage() const { return false; }
+
+        /**
+            Is this an aggregate message?
+
+            Aggregate messages are of type AggregateMessage. They combine consecutive small messages of the same type sent over a reliable-ordered channel into one message. You never see them outside the channel.
+
+            @returns True if this is an aggregate message, false otherwise.
+
+            @see AggregateMessage
+         */
+
+        virtual bool IsAggregateMessage() const { return false; }
+
+        /**
+            Set the key for this message.
+
+            When a message with a key is sent over an unreliable-unordered, unreliable-sequenced or unreliable-latest-state channel, and a message with the same key is still in the send queue, the new message replaces the queued one instead of being added after it. Use this for state updates, for example keyed by entity id, so only the most recent state for each key is sent.
+
+            Keys are local to the sender. They are not serialized, and other channel types ignore them. Don't change the key of a message after it has been sent.
+
+            IMPORTANT: Only available when YOJIMBO_MESSAGE_KEYS is 1. Keys make every message bigger, so they are off by default.
+
+            @param key The key for this message.
+         */
+
+#if YOJIMBO_MESSAGE_KEYS
+        void SetKey( uint64_t key ) { m_key = key; m_hasKey = true; }
+#endif // #if YOJIMBO_MESSAGE_KEYS
+
+        /**
+            Remove the key from this message.
+
+            Only available when YOJIMBO_MESSAGE_KEYS is 1.
+
+            @see Message::SetKey
+         */
+
+#if YOJIMBO_MESSAGE_KEYS
+        void ClearKey() { m_key = 0; m_hasKey = false; }
+#endif // #if YOJIMBO_MESSAGE_KEYS
+
+        /**
+            Does this message have a key?
+
+            @returns True if Message::SetKey has been called on this message. Always false when YOJIMBO_MESSAGE_KEYS is 0.
+         */
+
+#if YOJIMBO_MESSAGE_KEYS
+        bool HasKey() const { return m_hasKey; }
+#else // #if YOJIMBO_MESSAGE_KEYS
+        bool HasKey() const { return false; }
+#endif // #if YOJIMBO_MESSAGE_KEYS
+
+        /**
+            Get the key for this message.
+
+            @returns The key set with Message::SetKey, or zero if the message doesn't have a key.
+         */
+
+#if YOJIMBO_MESSAGE_KEYS
+        uint64_t GetKey() const { return m_key; }
+#else // #if YOJIMBO_MESSAGE_KEYS
+        uint64_t GetKey() const { return 0; }
+#endif // #if YOJIMBO_MESSAGE_KEYS
+
+        /**
+            Set the time to live for this message.
+
+            When a message with a time to live is sent over a reliable-ordered channel with ChannelConfig::expireMessages set, and it still hasn't been acked this long after it was sent, it expires. The channel stops resending it, and sends just its id in its place, so the receiver skips it and the messages after it are still received in order. Use this for data that is worthless once it's late, like hit markers.
+
+            Expired messages are never received, so only set this on messages the receiver can do without. Block messages never expire, and messages with a time to live are not aggregated.
+
+            IMPORTANT: Only available when YOJIMBO_MESSAGE_TIME_TO_LIVE is 1, since it makes every message bigger. ChannelConfig::messageTimeToLive works either way.
+
+            @param seconds The time to live in seconds. Zero means the message uses ChannelConfig::messageTimeToLive.
+         */
+
+#if YOJIMBO_MESSAGE_TIME_TO_LIVE
+        void SetTimeToLive( float seconds ) { assert( seconds >= 0.0f ); m_timeToLive = seconds; }
+#endif // #if YOJIMBO_MESSAGE_TIME_TO_LIVE
+
+        /**
+            Get the time to live for this message.
+
+            @returns The time to live set with Message::SetTimeToLive, or zero if the message doesn't have one. Always zero when YOJIMBO_MESSAGE_TIME_TO_LIVE is 0.
+         */
+
+#if YOJIMBO_MESSAGE_TIME_TO_LIVE
+        float GetTimeToLive() const { return m_timeToLive; }
+#else // #if YOJIMBO_MESSAGE_TIME_TO_LIVE
+        float GetTimeToLive() const { return 0.0f; }
+#endif // #if YOJIMBO_MESSAGE_TIME_TO_LIVE
+
+        /**
+            Get the serialized bits cached for this message.
+
+            Reliable-ordered channels with ChannelConfig::cacheSerializedMessages set serialize each message once when it is sent, and copy these bits into every packet the message is included in.
+
+            @returns The cached serialized message data, or NULL if the message has not been cached. Always NULL when YOJIMBO_MESSAGE_CACHE is 0.
+
+            @see MessageFactory::CacheSerializedMessage
+         */
+
+#if YOJIMBO_MESSAGE_CACHE
+        const uint8_t * GetSerializedData() const { return m_serializedData ? m_serializedData + 4 : NULL; }
+#else // #if YOJIMBO_MESSAGE_CACHE
+        const uint8_t * GetSerializedData() const { return NULL; }
+#endif // #if YOJIMBO_MESSAGE_CACHE
+
+        /**
+            Get the number of serialized bits cached for this message.
+
+            @returns The number of bits of cached serialized message data. Zero if the message has not been cached.
+         */
+
+        int GetSerializedBits() const
+        {
+#if YOJIMBO_MESSAGE_CACHE
+            if ( !m_serializedData )
+                return 0;
+            uint32_t bits;
+            memcpy( &bits, m_serializedData, 4 );
+            return (int) bits;
+#else // #if YOJIMBO_MESSAGE_CACHE
+            return 0;
+#endif // #if YOJIMBO_MESSAGE_CACHE
+        }
+
         /**
             Virtual serialize function (read).
 
@@ -200,17 +375,47 @@ namespace yojimbo
             This is called when a message is included in a packet and added to the receive queue. 
 
             This way we don't have to pass messages by value (more efficient) and messages get cleaned up when they are delivered and no packets refer to them.
+
+            Broadcast messages are shared between clients that may be updated on different threads (see JobScheduler), and messages created by a thread-safe message factory are passed between threads (see MessageFactory::SetThreadSafe), so their reference count is changed atomically. Define YOJIMBO_ATOMIC_MESSAGE_REFS to 1 to change the reference count of every message atomically.
+
+            @param threadSafe True if the message factory is thread-safe. Passed in by the factory, so messages don't need to store it.
          */
 
-        void AddRef() { m_refCount++; }
+        void AddRef( bool threadSafe )
+        {
+#if YOJIMBO_ATOMIC_MESSAGE_REFS
+            (void) threadSafe;
+            atomic_increment_relaxed( &m_refCount );
+#else // #if YOJIMBO_ATOMIC_MESSAGE_REFS
+            if ( threadSafe || IsBroadcastMessage() )
+                atomic_increment_relaxed( &m_refCount );
+            else
+                m_refCount++;
+#endif // #if YOJIMBO_ATOMIC_MESSAGE_REFS
+        }
 
         /**
             Remove a reference from the message.
 
             Message are deleted when the number of references reach zero. Messages have reference count of 1 after creation.
+
+            @param threadSafe True if the message factory is thread-safe.
+
+            @returns The number of references remaining.
          */
 
-        void Release() { assert( m_refCount > 0 ); m_refCount--; }
+        int Release( bool threadSafe )
+        {
+            assert( m_refCount > 0 );
+#if YOJIMBO_ATOMIC_MESSAGE_REFS
+            (void) threadSafe;
+            return atomic_decrement_acq_rel( &m_refCount );
+#else // #if YOJIMBO_ATOMIC_MESSAGE_REFS
+            if ( threadSafe || IsBroadcastMessage() )
+                return atomic_decrement_acq_rel( &m_refCount );
+            return --m_refCount;
+#endif // #if YOJIMBO_ATOMIC_MESSAGE_REFS
+        }
 
         /**
             Message destructor.
@@ -234,9 +439,188 @@ namespace yojimbo
         const Message & operator = ( const Message & other );
 
         int m_refCount;                                                     ///< Number of references on this message object. Starts at 1. Message is destroyed when it reaches 0.
-        uint32_t m_id : 16;                                                 ///< The message id. For messages sent over reliable-ordered channels, this starts at 0 and increases with each message sent. For unreliable-unordered channels this is set to the sequence number of the packet the message was included in.
-        uint32_t m_type : 15;                                               ///< The message type. Corresponds to the type integer used when the message was created though the message factory.
+        uint32_t m_id : 16;                                                 ///< The message id. For messages sent over reliable-ordered channels, this starts at 0 and increases with each message sent. For unreliable-unordered channels this is set to the sequence number of the packet the message was included in, unless the channel has a redundancy window.
+        uint32_t m_type : 15;                                               ///< The message type. Corresponds to the type integer used when the message was created though the message factory. Wide enough for MaxMessageTypes types.
         uint32_t m_blockMessage : 1;                                        ///< 1 if this is a block message. 0 otherwise. If 1 then you can cast the Message* to BlockMessage*. In short, it's a lightweight RTTI.
+#if YOJIMBO_MESSAGE_CACHE
+        uint8_t * m_serializedData;                                         ///< Serialized message bits cached by MessageFactory::CacheSerializedMessage, prefixed by the number of bits as a 32 bit integer. NULL if the message has not been cached. Allocated with the allocator of the message factory.
+#endif // #if YOJIMBO_MESSAGE_CACHE
+#if YOJIMBO_MESSAGE_KEYS
+        uint64_t m_key;                                                     ///< The key for this message. Queued messages on unreliable channels are replaced by newer messages with the same key. Only valid if m_hasKey is true.
+        bool m_hasKey;                                                      ///< True if the message has a key. See Message::SetKey.
+#endif // #if YOJIMBO_MESSAGE_KEYS
+#if YOJIMBO_MESSAGE_TIME_TO_LIVE
+        float m_timeToLive;                                                 ///< The time to live for this message in seconds, or zero if it doesn't have one. See Message::SetTimeToLive.
+#endif // #if YOJIMBO_MESSAGE_TIME_TO_LIVE
+    };
+
+    /**
+        Read-only block data that can be attached to many block messages at once.
+
+        Normally a block is allocated with the message factory allocator and owned by one message, so sending the same large block to many clients means copying it into the allocator of each client. A shared block instead references memory that lives outside of any message factory, such as a memory-mapped file. Block messages hold a reference to it while they exist, and fragments are read straight from it when they are sent, so memory per-client doesn't depend on the size of the block.
+
+        Shared blocks are reference counted atomically, since the connections that hold them may be updated on different threads (see JobScheduler). They have one reference after creation. When the last reference is released, SharedBlock::Destroy is called to free the memory and the shared block itself.
+
+        IMPORTANT: Shared block data must not change while any message references it, or clients may receive a mix of old and new data.
+
+        @see BlockMessage::AttachSharedBlock
+        @see MappedFileBlock
+     */
+
+    class SharedBlock
+    {
+    public:
+
+        /**
+            Shared block constructor.
+
+            @param data The block data. Must stay valid until SharedBlock::Destroy is called.
+            @param size The size of the block (bytes).
+         */
+
+        SharedBlock( const uint8_t * data, int size ) : m_refCount( 1 ), m_data( data ), m_size( size )
+        {
+            assert( data );
+            assert( size > 0 );
+        }
+
+        /// Add a reference to the shared block.
+
+        void AddRef()
+        {
+            atomic_increment_relaxed( &m_refCount );
+        }
+
+        /**
+            Remove a reference from the shared block.
+
+            The shared block is destroyed when the last reference is released.
+         */
+
+        void Release()
+        {
+            assert( atomic_load( &m_refCount ) > 0 );
+
+            if ( atomic_decrement_acq_rel( &m_refCount ) == 0 )
+                Destroy();
+        }
+
+        /**
+            Get the number of references to the shared block.
+
+            @returns The reference count. One for the creator, plus one for each block message it is attached to.
+         */
+
+        int GetRefCount() const
+        {
+            return atomic_load( &m_refCount );
+        }
+
+        /**
+            Get the block data.
+
+            @returns The read-only block data.
+         */
+
+        const uint8_t * GetData() const
+        {
+            return m_data;
+        }
+
+        /**
+            Get the size of the block.
+
+            @returns The size of the block (bytes).
+         */
+
+        int GetSize() const
+        {
+            return m_size;
+        }
+
+    protected:
+
+        /// Protected because shared blocks are reference counted. Use SharedBlock::Release instead.
+
+        virtual ~SharedBlock()
+        {
+            assert( m_refCount == 0 );
+        }
+
+        /**
+            Free the block data and the shared block.
+
+            Called when the last reference is released. Override this to free the block data however it was allocated, and to delete the shared block with the allocator it was created with.
+         */
+
+        virtual void Destroy() = 0;
+
+    private:
+
+        int m_refCount;                                                         ///< Reference count. Changed atomically.
+        const uint8_t * m_data;                                                 ///< The block data.
+        int m_size;                                                             ///< The size of the block (bytes).
+    };
+
+    /**
+        A shared block that maps a file read-only into memory.
+
+        Pages of the file are read from disk as fragments are sent, and shared with every other process mapping the same file, so sending a large asset to many clients costs no heap memory at all.
+
+        @see SharedBlock
+        @see platform_mapped_file_open
+     */
+
+    class MappedFileBlock : public SharedBlock
+    {
+    public:
+
+        /**
+            Map a file into a shared block.
+
+            @param allocator The allocator used to allocate the shared block. It must outlive the shared block.
+            @param path The path of the file. The file must not be empty, and must be no larger than 2GB.
+
+            @returns The shared block with one reference, or NULL if the file could not be mapped. Release it with SharedBlock::Release.
+         */
+
+        static MappedFileBlock * Open( Allocator & allocator, const char * path )
+        {
+            PlatformMappedFile * file = platform_mapped_file_open( allocator, path );
+            if ( !file )
+                return NULL;
+
+            if ( platform_mapped_file_size( file ) > size_t( 0x7FFFFFFF ) )
+            {
+                platform_mapped_file_close( allocator, file );
+                return NULL;
+            }
+
+            MappedFileBlock * block = YOJIMBO_NEW( allocator, MappedFileBlock, allocator, file );
+            if ( !block )
+                platform_mapped_file_close( allocator, file );
+
+            return block;
+        }
+
+    protected:
+
+        MappedFileBlock( Allocator & allocator, PlatformMappedFile * file ) : SharedBlock( (const uint8_t*) platform_mapped_file_data( file ), (int) platform_mapped_file_size( file ) ), m_allocator( &allocator ), m_file( file ) {}
+
+        /// Unmaps the file and deletes the shared block.
+
+        void Destroy()
+        {
+            Allocator & allocator = *m_allocator;
+            platform_mapped_file_close( allocator, m_file );
+            MappedFileBlock * block = this;
+            YOJIMBO_DELETE( allocator, MappedFileBlock, block );
+        }
+
+    private:
+
+        Allocator * m_allocator;                                                ///< The allocator the shared block was created with.
+        PlatformMappedFile * m_file;                                            ///< The mapped file.
     };
 
     /**
@@ -265,7 +649,7 @@ namespace yojimbo
             @see MessageFactory::Create
          */
 
-        explicit BlockMessage() : Message( 1 ), m_allocator(NULL), m_blockData(NULL), m_blockSize(0) {}
+        explicit BlockMessage() : Message( 1 ), m_allocator(NULL), m_sharedBlock(NULL), m_blockData(NULL), m_blockSize(0) {}
 
         /**
             Attach a block to this message.
@@ -284,17 +668,49 @@ namespace yojimbo
             m_blockSize = blockSize;
         }
 
+        /**
+            Attach a shared block to this message.
+
+            The message holds a reference to the shared block until it is destroyed, and the block data is never copied, so the same shared block can be attached to messages sent to any number of clients. Received blocks are always regular blocks allocated by the receiver.
+
+            You can only attach one block. This method will assert if a block is already attached.
+
+            IMPORTANT: The block data of a shared block is read-only. Don't write to the pointer returned by BlockMessage::GetBlockData.
+
+            @param sharedBlock The shared block to attach. Its size must not exceed ChannelConfig::maxBlockSize.
+
+            @see SharedBlock
+         */
+
+        void AttachSharedBlock( SharedBlock * sharedBlock )
+        {
+            assert( sharedBlock );
+            assert( !m_blockData );
+
+            sharedBlock->AddRef();
+
+            m_sharedBlock = sharedBlock;
+            m_blockData = const_cast<uint8_t*>( sharedBlock->GetData() );
+            m_blockSize = sharedBlock->GetSize();
+        }
+
         /** 
             Detach the block from this message.
 
             By doing this you are responsible for copying the block pointer and allocator and making sure the block is freed.
 
             This could be used for example, if you wanted to copy off the block and store it somewhere, without the cost of copying it.
+
+            If a shared block is attached, the reference the message holds on it is released instead.
          */
 
         void DetachBlock()
         {
+            if ( m_sharedBlock )
+                m_sharedBlock->Release();
+
             m_allocator = NULL;
+            m_sharedBlock = NULL;
             m_blockData = NULL;
             m_blockSize = 0;
         }
@@ -310,6 +726,17 @@ namespace yojimbo
             return m_allocator;
         }
 
+        /**
+            Get the shared block attached to this message.
+
+            @returns The shared block. NULL if no block is attached, or if the block attached is a regular block.
+         */
+
+        SharedBlock * GetSharedBlock()
+        {
+            return m_sharedBlock;
+        }
+
         /**
             Get the block data pointer.
 
@@ -372,245 +799,1382 @@ namespace yojimbo
                 m_blockSize = 0;
                 m_allocator = NULL;
             }
+
+            if ( m_sharedBlock )
+            {
+                m_sharedBlock->Release();
+                m_sharedBlock = NULL;
+            }
         }
 
     private:
 
-        Allocator * m_allocator;                                                ///< Allocator for the block attached to the message. NULL if no block is attached.
+        Allocator * m_allocator;                                                ///< Allocator for the block attached to the message. NULL if no block is attached, or if the block is a shared block.
+        SharedBlock * m_sharedBlock;                                            ///< The shared block attached to the message. NULL if no block is attached, or if the block is a regular block.
         uint8_t * m_blockData;                                                  ///< The block data. NULL if no block is attached.
         int m_blockSize;                                                        ///< The block size (bytes). 0 if no block is attached.
     };
 
     /**
-        Message factory error level.
-     */
+        A message that can be serialized relative to a baseline message of the same type.
 
-    enum MessageFactoryError
-    {
-        MESSAGE_FACTORY_ERROR_NONE,                                             ///< No error. All is well.
-        MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE,                       ///< Failed to allocate a message. Typically this means we ran out of memory on the allocator backing the message factory.
-    };
+        When a delta message is sent over a snapshot channel, the channel sets the baseline to the most recent message of the same type that the other side acked, and clears it when serialize is done. The receiver sets the same baseline before it reads the message. Derive your snapshot messages from this, and in your serialize function only serialize the fields that differ from the baseline, eg:
 
-    /**
-        Defines the set of message types that can be created.
+            const PositionMessage * baseline = (const PositionMessage*) GetBaseline();
+            bool changed = Stream::IsWriting ? ( !baseline || x != baseline->x ) : false;
+            serialize_bool( stream, changed );
+            if ( changed )
+                serialize_float( stream, x );
+            else if ( Stream::IsReading )
+                x = baseline ? baseline->x : 0.0f;
 
-        You can derive a message factory yourself to create your own message types, or you can use these helper macros to do it for you:
+        When there is no baseline, GetBaseline returns NULL and the message must serialize in full.
 
-            YOJIMBO_MESSAGE_FACTORY_START
-            YOJIMBO_DECLARE_MESSAGE_TYPE
-            YOJIMBO_MESSAGE_FACTORY_FINISH
+        IMPORTANT: Delta messages are serialized into their own stream by the snapshot channel, so the stream context and user context are not available in their serialize functions.
 
-        See tests/shared.h for an example showing how to use the macros.
+        @see SnapshotChannel
+        @see CHANNEL_TYPE_SNAPSHOT
      */
 
-    class MessageFactory
-    {        
-        #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-        std::map<void*,int> allocated_messages;                                 ///< The set of allocated messages for this factory. Used to track down message leaks.
-        #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-
-        Allocator * m_allocator;                                                ///< The allocator used to create messages.
-
-        int m_numTypes;                                                         ///< The number of message types.
-        
-        int m_error;                                                            ///< The message factory error level.
-
+    class DeltaMessage : public Message
+    {
     public:
 
         /**
-            Message factory allocator.
+            Delta message constructor.
 
-            Pass in the number of message types for the message factory from the derived class.
+            Don't call this directly, use a message factory instead.
 
-            @param allocator The allocator used to create messages.
-            @param numTypes The number of message types. Valid types are in [0,numTypes-1].
+            @see MessageFactory::Create
          */
 
-        MessageFactory( Allocator & allocator, int numTypes )
-        {
-            m_allocator = &allocator;
-            m_numTypes = numTypes;
-            m_error = MESSAGE_FACTORY_ERROR_NONE;
-        }
+        explicit DeltaMessage() : Message(), m_baseline( NULL ) {}
 
         /**
-            Message factory destructor.
+            Is this a delta message?
+
+            @returns Always true.
+         */
+
+        bool IsDeltaMessage() const { return true; }
+
+        /**
+            Get the baseline this message is being serialized relative to.
+
+            @returns The baseline message. It is always the same type as this message. NULL if there is no baseline, in which case the message must serialize in full.
+         */
+
+        const DeltaMessage * GetBaseline() const { return m_baseline; }
+
+        /**
+            Set the baseline to serialize relative to.
+
+            This is called by the snapshot channel around serialize. You shouldn't need to call it yourself.
+
+            @param baseline The baseline message. NULL for no baseline.
+         */
+
+        void SetBaseline( const DeltaMessage * baseline ) { m_baseline = baseline; }
+
+    private:
+
+        const DeltaMessage * m_baseline;                                    ///< The baseline message. Only set while the message is being serialized by a snapshot channel.
+    };
+
+    class MessageFactory;
+
+    /**
+        A message shared by the connections of many clients, that is serialized once and then copied as bits into every packet that includes it.
+
+        Normally each client has their own message factory, so sending the same message to many clients means creating, measuring and serializing one copy of the message per-client. A broadcast message wraps a single message created with the server global message factory instead. It is measured once on creation, and serialized once per bit alignment it is written at (at most 8 times) no matter how many clients it is sent to.
+
+        Broadcast messages are reference counted across all the client message factories that hold them. When the last reference is released, the broadcast message is destroyed with the allocator it was created with and the wrapped message is released back to its own message factory.
+
+        On the receiving side broadcast messages are indistinguishable from regular messages of the same type.
+
+        IMPORTANT: Broadcast messages can't have blocks attached to them.
+
+        @see Server::BroadcastMsg
+     */
+
+    class BroadcastMessage : public Message
+    {
+    public:
+
+        /**
+            Broadcast message constructor.
+
+            Don't call this directly, use Server::BroadcastMsg instead.
+
+            @param allocator The allocator used to create the broadcast message and its serialized bits.
+            @param messageFactory The message factory the wrapped message was created with.
+            @param message The message to broadcast. The broadcast message takes ownership of this message. Must not be a block message.
+         */
+
+        BroadcastMessage( Allocator & allocator, MessageFactory & messageFactory, Message * message ) : Message()
+        {
+            assert( message );
+            assert( !message->IsBlockMessage() );
+            assert( !message->IsBroadcastMessage() );
+
+            m_allocator = &allocator;
+            m_messageFactory = &messageFactory;
+            m_message = message;
+            m_next = NULL;
+
+            SetType( message->GetType() );
+
+            MeasureStream measureStream( allocator );
+            message->SerializeInternal( measureStream );
+            m_measuredBits = measureStream.GetBitsProcessed();
+
+            for ( int i = 0; i < 8; ++i )
+            {
+                m_data[i] = NULL;
+                m_bytes[i] = 0;
+                m_bits[i] = 0;
+            }
+        }
+
+        /**
+            Is this a broadcast message?
+
+            @returns Always true.
+         */
+
+        bool IsBroadcastMessage() const { return true; }
+
+        /**
+            Get the allocator used to create this broadcast message.
+
+            @returns The allocator.
+         */
+
+        Allocator & GetAllocator()
+        {
+            assert( m_allocator );
+            return *m_allocator;
+        }
+
+        /**
+            Get the message being broadcast.
+
+            @returns The wrapped message.
+         */
+
+        Message * GetMessage()
+        {
+            return m_message;
+        }
+
+        /**
+            Get the next broadcast message in the list of broadcast messages held by the server.
+
+            @returns The next broadcast message, or NULL if this is the last one.
+
+            @see Server::BroadcastMsg
+         */
+
+        BroadcastMessage * GetNext()
+        {
+            return m_next;
+        }
+
+        /**
+            Set the next broadcast message in the list of broadcast messages held by the server.
+
+            @param next The next broadcast message. May be NULL.
+         */
+
+        void SetNext( BroadcastMessage * next )
+        {
+            m_next = next;
+        }
+
+        /**
+            Broadcast messages are send only. They are received as regular messages.
+
+            @returns Always false.
+         */
+
+        bool SerializeInternal( ReadStream & stream )
+        {
+            (void) stream;
+            assert( !"broadcast messages can't be read" );
+            return false;
+        }
+
+        /**
+            Write the serialized bits of the wrapped message to the stream.
+
+            If the message has not yet been serialized at the bit alignment the stream is currently at, it is serialized now and cached. The alignment matters because serialize_align and serialize_bytes pad to the next byte in the stream.
+
+            @param stream The write stream.
+
+            @returns True if the bits were written, false if the message failed to serialize or the stream ran out of room.
+         */
+
+        bool SerializeInternal( WriteStream & stream )
+        {
+            const int offset = stream.GetBitsProcessed() % 8;
+
+            if ( !m_data[offset] && !Pack( offset, stream.GetUserContext() ) )
+                return false;
+
+            BitReader reader( m_data[offset], m_bytes[offset] );
+
+            if ( offset > 0 )
+                reader.ReadBits( offset );
+
+            int bits = m_bits[offset];
+
+            while ( bits > 0 )
+            {
+                const int n = bits < 32 ? bits : 32;
+                uint32_t value = reader.ReadBits( n );
+                if ( !stream.SerializeBits( value, n ) )
+                    return false;
+                bits -= n;
+            }
+
+            return true;
+        }
+
+        /**
+            Measure the wrapped message.
+
+            This adds the bits measured once when the broadcast message was created, instead of measuring again.
+
+            @param stream The measure stream.
+
+            @returns Always true.
+         */
+
+        bool SerializeInternal( MeasureStream & stream )
+        {
+            int bits = m_measuredBits;
+
+            while ( bits > 0 )
+            {
+                const int n = bits < 32 ? bits : 32;
+                uint32_t value = 0;
+                stream.SerializeBits( value, n );
+                bits -= n;
+            }
+
+            return true;
+        }
+
+    protected:
+
+        /**
+            Releases the wrapped message and frees the cached serialized bits.
+         */
+
+        ~BroadcastMessage();
+
+    private:
+
+        /**
+            Serialize the wrapped message as it would be written starting at a bit offset in [0,7] in the stream, and cache the result.
+
+            IMPORTANT: The cached bits are shared by every connection the message is broadcast to, so the message is serialized without the stream context. Per-connection state like the string dictionary must not end up in the cached bits, so interned strings are sent inline.
+
+            @param offset The bit offset within the current byte of the stream.
+            @param userContext The stream user context, as set on the stream the message is being written to.
+
+            @returns True if the message was serialized, false otherwise.
+         */
+
+        bool Pack( int offset, void * userContext )
+        {
+            assert( offset >= 0 );
+            assert( offset < 8 );
+            assert( !m_data[offset] );
+
+            // IMPORTANT: measured bits are conservative, so they always have room for what is actually written
+
+            const int bytes = ( ( offset + m_measuredBits + 31 ) / 32 ) * 4;
+
+            uint8_t * data = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, bytes );
+            if ( !data )
+                return false;
+
+            WriteStream stream( data, bytes, *m_allocator );
+            stream.SetUserContext( userContext );
+
+            uint32_t zero = 0;
+            if ( offset > 0 )
+                stream.SerializeBits( zero, offset );
+
+            if ( !m_message->SerializeInternal( stream ) )
+            {
+                YOJIMBO_FREE( *m_allocator, data );
+                return false;
+            }
+
+            stream.Flush();
+
+            m_data[offset] = data;
+            m_bytes[offset] = bytes;
+            m_bits[offset] = stream.GetBitsProcessed() - offset;
+
+            return true;
+        }
+
+        Allocator * m_allocator;                                                ///< The allocator used to create this broadcast message and its cached bits.
+        MessageFactory * m_messageFactory;                                      ///< The message factory the wrapped message was created with. The wrapped message is released back to this factory.
+        Message * m_message;                                                    ///< The message being broadcast.
+        BroadcastMessage * m_next;                                              ///< The next broadcast message held by the server. The server keeps a reference to each broadcast message until all clients are done with it, so the message is only ever destroyed on the server thread.
+        int m_measuredBits;                                                     ///< The number of bits measured for the wrapped message.
+        uint8_t * m_data[8];                                                    ///< The wrapped message serialized at each bit offset in [0,7]. NULL until the message is first written at that offset.
+        int m_bytes[8];                                                         ///< The size of each cached buffer (bytes).
+        int m_bits[8];                                                          ///< The number of bits written for the message at each offset, not counting the offset bits.
+    };
+
+    /**
+        A run of small messages of the same type, queued as a single message on a reliable-ordered channel.
+
+        Reliable-ordered channels keep an entry in the send queue and in the sent packet entries for each message, and write an id and type for each message included in a packet. For many tiny messages, this bookkeeping costs more than the message data itself. When ChannelConfig::maxAggregateMessages is greater than one, consecutive small messages of the same type that are sent before the first of them is included in a packet are combined into an aggregate message instead, which has one id, one type and one send queue entry.
+
+        Aggregate messages are created and unpacked by the channel. On the receiving side, the messages in the aggregate are returned by ReceiveMsg one at a time, and are indistinguishable from messages sent on their own, except that they share the id of the aggregate.
+
+        @see ChannelConfig::maxAggregateMessages
+     */
+
+    class AggregateMessage : public Message
+    {
+    public:
+
+        /**
+            Aggregate message constructor.
+
+            Don't call this directly, use MessageFactory::CreateAggregate instead.
+
+            @param messageFactory The message factory the messages in the aggregate are created with.
+            @param type The type of the messages in the aggregate.
+            @param maxMessages The maximum number of messages in the aggregate in [2,MaxAggregateMessages].
+         */
+
+        AggregateMessage( MessageFactory & messageFactory, int type, int maxMessages ) : Message()
+        {
+            assert( maxMessages > 1 );
+            assert( maxMessages <= MaxAggregateMessages );
+
+            m_messageFactory = &messageFactory;
+            m_maxMessages = maxMessages;
+            m_numMessages = 0;
+            m_readIndex = 0;
+
+            SetType( type );
+        }
+
+        /**
+            Is this an aggregate message?
+
+            @returns Always true.
+         */
+
+        bool IsAggregateMessage() const { return true; }
+
+        /**
+            Get the number of messages in the aggregate.
+
+            @returns The number of messages in [0,maxMessages], including messages that have already been popped.
+         */
+
+        int GetNumMessages() const
+        {
+            return m_numMessages;
+        }
+
+        /**
+            Is the aggregate full?
+
+            @returns True if no more messages can be added to the aggregate.
+         */
+
+        bool IsFull() const
+        {
+            return m_numMessages == m_maxMessages;
+        }
+
+        /**
+            Add a message to the end of the aggregate.
+
+            @param message The message to add. The aggregate takes ownership of this message. It must have the same type as the aggregate, and must not be a block, broadcast or aggregate message.
+         */
+
+        void AddMessage( Message * message )
+        {
+            assert( message );
+            assert( message->GetType() == GetType() );
+            assert( !message->IsBlockMessage() );
+            assert( !message->IsBroadcastMessage() );
+            assert( !message->IsAggregateMessage() );
+            assert( !IsFull() );
+
+            m_messages[m_numMessages++] = message;
+        }
+
+        /**
+            Pop the next message off the front of the aggregate.
+
+            The message id is set to the id of the aggregate.
+
+            @returns The next message, or NULL if all messages have been popped. Ownership of the message is passed to the caller.
+         */
+
+        Message * PopMessage()
+        {
+            if ( m_readIndex == m_numMessages )
+                return NULL;
+
+            Message * message = m_messages[m_readIndex];
+            m_messages[m_readIndex++] = NULL;
+            message->SetId( GetId() );
+            return message;
+        }
+
+        /**
+            Are there any messages left to pop?
+
+            @returns True if all messages in the aggregate have been popped.
+         */
+
+        bool IsEmpty() const
+        {
+            return m_readIndex == m_numMessages;
+        }
+
+        bool SerializeInternal( ReadStream & stream );
+
+        bool SerializeInternal( WriteStream & stream );
+
+        bool SerializeInternal( MeasureStream & stream );
+
+    protected:
+
+        /**
+            Releases any messages that have not been popped.
+         */
+
+        ~AggregateMessage();
+
+    private:
+
+        /**
+            Serialize the number of messages followed by each message.
+
+            There is no type per-message, since all messages in the aggregate have the type of the aggregate.
+         */
+
+        template <typename Stream> bool Serialize( Stream & stream );
+
+        MessageFactory * m_messageFactory;                                      ///< The message factory the messages in the aggregate are created with and released to.
+        int m_maxMessages;                                                      ///< The maximum number of messages in the aggregate. Both sides must agree on this, since the number of messages is serialized in [1,maxMessages].
+        int m_numMessages;                                                      ///< The number of messages in the aggregate.
+        int m_readIndex;                                                        ///< The index of the next message to pop.
+        Message * m_messages[MaxAggregateMessages];                             ///< The messages in the aggregate. Popped messages are set to NULL.
+    };
+
+    /**
+        Message factory error level.
+     */
+
+    enum MessageFactoryError
+    {
+        MESSAGE_FACTORY_ERROR_NONE,                                             ///< No error. All is well.
+        MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE,                       ///< Failed to allocate a message. Typically this means we ran out of memory on the allocator backing the message factory.
+        MESSAGE_FACTORY_ERROR_TOO_MANY_MESSAGE_TYPES,                           ///< The message factory was created with more than MaxMessageTypes message types. Creating a message always fails.
+    };
+
+    /**
+        A fixed size pool of messages of one type.
+
+        Used for message types declared with YOJIMBO_DECLARE_POOLED_MESSAGE_TYPE. Free slots are linked together through their first bytes, so creating and destroying a pooled message is a pointer pop and push instead of a trip through the allocator.
+     */
+
+    struct MessagePool
+    {
+        uint8_t * data;                                                         ///< The memory backing the pool. NULL until the first message of this type is created.
+        void * freeList;                                                        ///< The first free slot. Each free slot stores a pointer to the next free slot. NULL if the pool is exhausted.
+        int slotSize;                                                           ///< The size of each slot in bytes. This is the message size rounded up for alignment.
+        int numSlots;                                                           ///< The number of slots in the pool.
+    };
+
+    /**
+        Defines the set of message types that can be created.
+
+        You can derive a message factory yourself to create your own message types, or you can use these helper macros to do it for you:
+
+            YOJIMBO_MESSAGE_FACTORY_START
+            YOJIMBO_DECLARE_MESSAGE_TYPE
+            YOJIMBO_DECLARE_POOLED_MESSAGE_TYPE
+            YOJIMBO_MESSAGE_FACTORY_FINISH
+
+        Alternatively, declare the whole factory from a list of message types with YOJIMBO_MESSAGE_FACTORY_TYPE_LIST. This also lets the channels serialize messages without going through the message virtuals.
+
+        See tests/shared.h for an example showing how to use the macros.
+     */
+
+    class MessageFactory
+    {        
+        #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+        LeakTracker allocated_messages;                                         ///< The set of allocated messages for this factory. Used to track down message leaks.
+        #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+
+        Allocator * m_allocator;                                                ///< The allocator used to create messages.
+
+        int m_numTypes;                                                         ///< The number of message types.
+
+        MessagePool * m_pools;                                                  ///< Message pools indexed by message type. Only used by types declared with YOJIMBO_DECLARE_POOLED_MESSAGE_TYPE.
+        
+        int m_error;                                                            ///< The message factory error level.
+
+        bool m_typedSerialize;                                                  ///< True if this factory dispatches message serialization by type. Set by factories declared with YOJIMBO_MESSAGE_FACTORY_TYPE_LIST.
+
+        bool m_threadSafe;                                                      ///< True if messages may be created and released on more than one thread. See MessageFactory::SetThreadSafe.
+
+        int m_lock;                                                             ///< Spin lock guarding the message pools and the leak tracking map while the factory is thread-safe. 1 while held, 0 otherwise.
+
+        uint8_t * m_typeCodeBits;                                               ///< The prefix code length of each message type (bits). NULL if no type frequencies are set, in which case message types are serialized with a fixed number of bits. See MessageFactory::SetTypeFrequencies.
+
+        uint32_t * m_typeCodes;                                                 ///< The prefix code of each message type, with its bits reversed so the first bit of the code is the first bit written.
+
+        uint16_t * m_typeCodeTypes;                                             ///< Message types sorted by prefix code. Used to decode message types on read.
+
+        int m_maxTypeCodeBits;                                                  ///< The longest prefix code of any message type (bits).
+
+        uint32_t m_typeCodeFirst[MaxMessageTypeCodeBits+1];                     ///< The first canonical prefix code of each code length.
+
+        int m_typeCodeCount[MaxMessageTypeCodeBits+1];                          ///< The number of message types with each code length.
+
+        int m_typeCodeOffset[MaxMessageTypeCodeBits+1];                         ///< The index in m_typeCodeTypes of the first message type with each code length.
+
+    public:
+
+        /**
+            Message factory allocator.
+
+            Pass in the number of message types for the message factory from the derived class.
+
+            @param allocator The allocator used to create messages.
+            @param numTypes The number of message types. Valid types are in [0,numTypes-1]. Must be no more than MaxMessageTypes, otherwise the error level is set to MESSAGE_FACTORY_ERROR_TOO_MANY_MESSAGE_TYPES and creating a message always fails.
+         */
+
+        MessageFactory( Allocator & allocator, int numTypes )
+        {
+            assert( numTypes <= MaxMessageTypes );
+            m_allocator = &allocator;
+            m_numTypes = numTypes;
+            m_error = numTypes <= MaxMessageTypes ? MESSAGE_FACTORY_ERROR_NONE : MESSAGE_FACTORY_ERROR_TOO_MANY_MESSAGE_TYPES;
+            m_typedSerialize = false;
+            m_threadSafe = false;
+            m_lock = 0;
+            m_typeCodeBits = NULL;
+            m_typeCodes = NULL;
+            m_typeCodeTypes = NULL;
+            m_maxTypeCodeBits = 0;
+            m_pools = (MessagePool*) YOJIMBO_ALLOCATE( allocator, sizeof( MessagePool ) * numTypes );
+            if ( m_pools )
+                memset( m_pools, 0, sizeof( MessagePool ) * numTypes );
+        }
+
+        /**
+            Message factory destructor.
 
             Checks for message leaks if YOJIMBO_DEBUG_MESSAGE_LEAKS is defined and not equal to zero. This is on by default in debug build.
          */
 
-        virtual ~MessageFactory()
-        {
-            assert( m_allocator );
+        virtual ~MessageFactory()
+        {
+            assert( m_allocator );
+
+            if ( m_pools )
+            {
+                for ( int i = 0; i < m_numTypes; ++i )
+                    YOJIMBO_FREE( *m_allocator, m_pools[i].data );
+                YOJIMBO_FREE( *m_allocator, m_pools );
+            }
+
+            FreeTypeCode();
+
+            m_allocator = NULL;
+
+            #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+            if ( allocated_messages.GetNumLive() )
+            {
+                printf( "you leaked messages!\n" );
+                allocated_messages.Report( "messages" );
+                exit(1);
+            }
+            #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+        }
+
+        /**
+            Create a message by type.
+
+            IMPORTANT: Check the message pointer returned by this call. It can be NULL if there is no memory to create a message!
+
+            Messages returned from this function have one reference added to them. When you are finished with the message, pass it to MessageFactory::Release.
+
+            @param type The message type in [0,numTypes-1].
+
+            @returns The allocated message, or NULL if the message could not be allocated. If the message allocation fails, the message factory error level is set to MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE.
+
+            @see MessageFactory::AddRef
+            @see MessageFactory::Release
+         */
+
+        Message * Create( int type )
+        {
+            assert( type >= 0 );
+            assert( type < m_numTypes );
+
+            // IMPORTANT: The message type is stored in 15 bits of the message, so types past MaxMessageTypes would be truncated. Fail instead, even in release builds.
+
+            if ( m_numTypes > MaxMessageTypes )
+            {
+                m_error = MESSAGE_FACTORY_ERROR_TOO_MANY_MESSAGE_TYPES;
+                return NULL;
+            }
+
+            Lock();
+
+            Message * message = CreateMessage( type );
+
+            if ( !message )
+            {
+                m_error = MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE;
+                Unlock();
+                return NULL;
+            }
+
+            #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+            allocated_messages.Add( message, 0, NULL, type );
+            #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+
+            Unlock();
+
+            return message;
+        }
+
+        /**
+            Add a reference to a message.
+
+            @param message The message to add a reference to.
+
+            @see MessageFactory::Create
+            @see MessageFactory::Release
+         */   
+
+        void AddRef( Message * message )
+        {
+            assert( message );
+            if ( !message )
+                return;
+
+            message->AddRef( m_threadSafe );
+        }
+
+        /**
+            Remove a reference from a message.
+
+            Messages have 1 reference when created. When the reference count reaches 0, they are destroyed.
+
+            @see MessageFactory::Create
+            @see MessageFactory::AddRef
+         */
+
+        void Release( Message * message )
+        {
+            assert( message );
+            if ( !message )
+                return;
+
+            const int refCount = message->Release( m_threadSafe );
+
+            if ( message->IsBroadcastMessage() )
+            {
+                // broadcast messages are shared between factories, so they are destroyed with their own allocator, not the allocator of this factory
+
+                if ( refCount == 0 )
+                {
+                    Allocator & allocator = ( (BroadcastMessage*) message )->GetAllocator();
+                    YOJIMBO_DELETE( allocator, Message, message );
+                }
+
+                return;
+            }
+            
+            if ( refCount == 0 )
+            {
+                Lock();
+
+                #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+                allocated_messages.Remove( message );
+                #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+            
+                assert( m_allocator );
+
+#if YOJIMBO_MESSAGE_CACHE
+                YOJIMBO_FREE( *m_allocator, message->m_serializedData );
+#endif // #if YOJIMBO_MESSAGE_CACHE
+
+                MessagePool * pool = FindPool( message );
+
+                if ( pool )
+                {
+                    message->~Message();
+                    *( (void**) message ) = pool->freeList;
+                    pool->freeList = message;
+                }
+                else
+                {
+                    YOJIMBO_DELETE( *m_allocator, Message, message );
+                }
+
+                Unlock();
+            }
+        }
+
+        /**
+            Serialize a message once and cache the bits on the message.
+
+            Used by reliable-ordered channels with ChannelConfig::cacheSerializedMessages set, so messages are not serialized again each time they are resent. Any bits previously cached for the message are freed first.
+
+            IMPORTANT: The message is serialized outside of any packet, so its serialization must not depend on the stream context. Don't modify a message after it is cached, or packets will carry the old bits.
+
+            When YOJIMBO_MESSAGE_CACHE is 0, messages have nowhere to cache bits, so the message is only measured. It is serialized again each time it is written, and the bits in the packet are the same.
+
+            @param message The message to cache. Must not be a broadcast message, since those are shared between the message factories of different connections.
+
+            @returns The number of bits cached, or -1 if the message failed to serialize or the cache could not be allocated.
+
+            @see Message::GetSerializedData
+         */
+
+        int CacheSerializedMessage( Message * message )
+        {
+            assert( message );
+            assert( !message->IsBroadcastMessage() );
+            assert( m_allocator );
+
+#if !YOJIMBO_MESSAGE_CACHE
+
+            MeasureStream stream( *m_allocator );
+
+            if ( !SerializeMessage( message, stream ) )
+                return -1;
+
+            return stream.GetBitsProcessed();
+
+#else // #if !YOJIMBO_MESSAGE_CACHE
+
+            FreeSerializedMessage( message );
+
+            // IMPORTANT: measured bits are conservative, so they always have room for what is actually written
+
+            MeasureStream measureStream( *m_allocator );
+
+            if ( !SerializeMessage( message, measureStream ) )
+                return -1;
+
+            const int bytes = max( 4, ( ( measureStream.GetBitsProcessed() + 31 ) / 32 ) * 4 );
+
+            uint8_t * data = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, 4 + bytes );
+            if ( !data )
+                return -1;
+
+            WriteStream writeStream( data + 4, bytes, *m_allocator );
+
+            if ( !SerializeMessage( message, writeStream ) )
+            {
+                YOJIMBO_FREE( *m_allocator, data );
+                return -1;
+            }
+
+            writeStream.Flush();
+
+            const uint32_t bits = writeStream.GetBitsProcessed();
+
+            memcpy( data, &bits, 4 );
+
+            message->m_serializedData = data;
+
+            return (int) bits;
+
+#endif // #if !YOJIMBO_MESSAGE_CACHE
+        }
+
+        /**
+            Free the serialized bits cached for a message.
+
+            Call this when the message changes after it was cached. Does nothing if the message has not been cached.
+
+            @param message The message to free the cached bits of.
+
+            @see MessageFactory::CacheSerializedMessage
+         */
+
+        void FreeSerializedMessage( Message * message )
+        {
+            assert( message );
+            assert( m_allocator );
+            (void) message;
+#if YOJIMBO_MESSAGE_CACHE
+            YOJIMBO_FREE( *m_allocator, message->m_serializedData );
+#endif // #if YOJIMBO_MESSAGE_CACHE
+        }
+
+        /**
+            Create an aggregate message.
+
+            Called by reliable-ordered channels to combine small messages. Aggregate messages are released with MessageFactory::Release, like any other message.
+
+            @param type The type of the messages in the aggregate.
+            @param maxMessages The maximum number of messages in the aggregate. See ChannelConfig::maxAggregateMessages.
+
+            @returns The aggregate message created, or NULL if it could not be allocated. If the allocation fails, the message factory error level is set to MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE.
+
+            @see AggregateMessage
+         */
+
+        AggregateMessage * CreateAggregate( int type, int maxMessages )
+        {
+            assert( type >= 0 );
+            assert( type < m_numTypes );
+            assert( m_allocator );
+
+            if ( m_numTypes > MaxMessageTypes )
+            {
+                m_error = MESSAGE_FACTORY_ERROR_TOO_MANY_MESSAGE_TYPES;
+                return NULL;
+            }
+
+            AggregateMessage * message = YOJIMBO_NEW( *m_allocator, AggregateMessage, *this, type, maxMessages );
+
+            if ( !message )
+            {
+                m_error = MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE;
+                return NULL;
+            }
+
+            #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+            Lock();
+            allocated_messages.Add( message, 0, NULL, type );
+            Unlock();
+            #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+
+            return message;
+        }
+
+        /**
+            Get the number of message types supported by this message factory.
+
+            @returns The number of message types.
+         */
+
+        int GetNumTypes() const
+        {
+            return m_numTypes;
+        }
+
+        /**
+            Get the allocator used to create messages.
+
+            @returns The allocator.
+         */
+
+        Allocator & GetAllocator()
+        {
+            assert( m_allocator );
+            return *m_allocator;
+        }
+
+        /**
+            Get the error level.
+
+            When used with a client or server, an error level on a message factory other than MESSAGE_FACTORY_ERROR_NONE triggers a client disconnect.
+         */
+
+        int GetError() const
+        {
+            return m_error;
+        }
+
+        /**
+            Clear the error level back to no error.
+         */
+
+        void ClearError()
+        {
+            m_error = MESSAGE_FACTORY_ERROR_NONE;
+        }
+
+        /**
+            Set whether messages may be created and released on more than one thread.
+
+            While this is on, creating and destroying messages is guarded by a spin lock, and messages created by the factory have their reference count changed atomically. This lets a message created on one thread be released on another. The allocator passed in to the factory must also be safe to use from those threads, eg. ThreadedTLSF_Allocator.
+
+            Messages created while this is off keep a non-atomic reference count, so only turn this on or off while no other thread is using the factory.
+
+            @param threadSafe True to make the message factory thread-safe.
+
+            @see Client::StartNetworkThread
+         */
+
+        void SetThreadSafe( bool threadSafe )
+        {
+            m_threadSafe = threadSafe;
+        }
+
+        /**
+            Is the message factory thread-safe?
+
+            @returns True if messages may be created and released on more than one thread. See MessageFactory::SetThreadSafe.
+         */
+
+        bool IsThreadSafe() const
+        {
+            return m_threadSafe;
+        }
+
+        /**
+            Serialize a message created by this factory.
+
+            The channels call this instead of Message::SerializeInternal. For a factory declared with YOJIMBO_MESSAGE_FACTORY_TYPE_LIST, this switches on the message type and calls the templated serialize function of the concrete message class directly, so it can be inlined into the dispatch. Otherwise it calls through the message virtuals as before.
+
+            Broadcast and aggregate messages always go through their virtuals, since they write cached bits or several messages instead of a single message of their type.
+
+            @param message The message to serialize. Must be a message created by this factory, or a broadcast message.
+            @param stream The stream to serialize with. May be a read, write or measure stream.
+
+            @returns True if the message serialized successfully, false otherwise.
+         */
+
+        template <typename Stream> bool SerializeMessage( Message * message, Stream & stream )
+        {
+            assert( message );
+            if ( m_typedSerialize && !message->IsBroadcastMessage() && !message->IsAggregateMessage() )
+                return SerializeTypedMessage( message, stream );
+            return message->SerializeInternal( stream );
+        }
+
+        /**
+            Set how often each message type is sent, so message types are serialized with a prefix code instead of a fixed number of bits.
+
+            By default each message type takes bits_required( 0, numTypes - 1 ) bits in a packet. When most messages sent are of a few types, a canonical prefix code (Huffman code) built from the type frequencies gives those types shorter codes and the rarely sent types longer ones, up to MaxMessageTypeCodeBits.
+
+            The channels budget packets with the code length of each message type, so the bits measured for a packet stay exact.
+
+            IMPORTANT: Message types are serialized differently once this is set, so both sides of the connection must set the same frequencies on their message factories before connecting. Only set this while no packets are being read or written with the factory.
+
+            @param frequencies The relative frequency of each message type, indexed by message type. Zero frequencies are treated as one. Pass NULL to go back to serializing message types with a fixed number of bits.
+
+            @returns True if the prefix code was set. False if the prefix code could not be allocated, in which case message types are serialized with a fixed number of bits.
+
+            @see MessageFactory::GetTypeBits
+         */
+
+        bool SetTypeFrequencies( const uint32_t * frequencies )
+        {
+            assert( m_allocator );
+
+            FreeTypeCode();
+
+            if ( !frequencies || m_numTypes < 2 )
+                return true;
+
+            m_typeCodeBits = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_numTypes );
+            m_typeCodes = (uint32_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint32_t ) * m_numTypes );
+            m_typeCodeTypes = (uint16_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint16_t ) * m_numTypes );
+
+            uint64_t * scratch = (uint64_t*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( uint64_t ) * 2 * m_numTypes );
+
+            const bool result = m_typeCodeBits && m_typeCodes && m_typeCodeTypes && scratch && calculate_prefix_code_lengths( frequencies, m_numTypes, MaxMessageTypeCodeBits, m_typeCodeBits, scratch );
+
+            YOJIMBO_FREE( *m_allocator, scratch );
+
+            if ( !result )
+            {
+                FreeTypeCode();
+                return false;
+            }
+
+            // canonical code: types are sorted by code length, then by type. codes of each length are consecutive, so the decoder only needs the first code and the count of each length
+
+            memset( m_typeCodeCount, 0, sizeof( m_typeCodeCount ) );
+
+            for ( int i = 0; i < m_numTypes; ++i )
+            {
+                m_typeCodeCount[m_typeCodeBits[i]]++;
+                m_maxTypeCodeBits = max( m_maxTypeCodeBits, int( m_typeCodeBits[i] ) );
+            }
+
+            uint32_t code = 0;
+            int offset = 0;
+
+            for ( int bits = 1; bits <= MaxMessageTypeCodeBits; ++bits )
+            {
+                code = ( code + m_typeCodeCount[bits-1] ) << 1;
+                m_typeCodeFirst[bits] = code;
+                m_typeCodeOffset[bits] = offset;
+                offset += m_typeCodeCount[bits];
+            }
+
+            int next[MaxMessageTypeCodeBits+1];
+
+            memcpy( next, m_typeCodeOffset, sizeof( next ) );
+
+            for ( int i = 0; i < m_numTypes; ++i )
+            {
+                const int bits = m_typeCodeBits[i];
+                const int index = next[bits]++;
+                m_typeCodeTypes[index] = uint16_t( i );
+                m_typeCodes[i] = reverse_bits( m_typeCodeFirst[bits] + uint32_t( index - m_typeCodeOffset[bits] ) ) >> ( 32 - bits );
+            }
+
+            return true;
+        }
+
+        /**
+            Get the number of bits a message type takes in a packet.
+
+            @param type The message type in [0,numTypes-1].
+
+            @returns The prefix code length of the message type if type frequencies are set, otherwise bits_required( 0, numTypes - 1 ).
+
+            @see MessageFactory::SetTypeFrequencies
+         */
+
+        int GetTypeBits( int type ) const
+        {
+            assert( type >= 0 );
+            assert( type < m_numTypes );
+            if ( m_typeCodeBits )
+                return m_typeCodeBits[type];
+            return bits_required( 0, m_numTypes - 1 );
+        }
+
+        /**
+            Serialize a message type.
+
+            The channels call this to write the type of each message in a packet. Message types are written with the prefix code set by MessageFactory::SetTypeFrequencies, or with a fixed number of bits if no frequencies are set.
+
+            @param stream The stream to serialize with. May be a read, write or measure stream.
+            @param type The message type in [0,numTypes-1]. Set to the message type read, on read.
+
+            @returns True if the message type serialized successfully, false otherwise.
+         */
+
+        template <typename Stream> bool SerializeType( Stream & stream, int & type ) const
+        {
+            if ( !m_typeCodeBits )
+            {
+                if ( m_numTypes > 1 )
+                    serialize_int( stream, type, 0, m_numTypes - 1 );
+                else
+                    type = 0;
+                return true;
+            }
+
+            if ( Stream::IsWriting )
+            {
+                assert( type >= 0 );
+                assert( type < m_numTypes );
+                uint32_t code = m_typeCodes[type];
+                serialize_bits( stream, code, m_typeCodeBits[type] );
+                return true;
+            }
+
+            // IMPORTANT: read one bit at a time until the code read so far is a valid code of its length. canonical codes of each length are consecutive, so this is a range check
+
+            uint32_t code = 0;
+
+            for ( int bits = 1; bits <= m_maxTypeCodeBits; ++bits )
+            {
+                uint32_t bit = 0;
+                serialize_bits( stream, bit, 1 );
+                code = ( code << 1 ) | bit;
+
+                const uint32_t index = code - m_typeCodeFirst[bits];
+
+                if ( index < uint32_t( m_typeCodeCount[bits] ) )
+                {
+                    type = m_typeCodeTypes[m_typeCodeOffset[bits] + index];
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+    protected:
+
+        /**
+            Turn on serialization by type for this factory.
+
+            This is called from the constructor generated by YOJIMBO_MESSAGE_FACTORY_TYPE_LIST. Only call this if you also override the SerializeTypedMessage methods.
+         */
+
+        void EnableTypedSerialize() { m_typedSerialize = true; }
+
+        /**
+            Serialize a message by type (read).
+
+            Overridden by YOJIMBO_MESSAGE_FACTORY_TYPE_LIST to switch on the message type. Types not handled by the override call down to here, which calls the message virtual.
+
+            @param message The message to serialize.
+            @param stream The read stream.
+
+            @returns True if the message serialized successfully, false otherwise.
+         */
+
+        virtual bool SerializeTypedMessage( Message * message, ReadStream & stream ) { return message->SerializeInternal( stream ); }
+
+        /**
+            Serialize a message by type (write).
+
+            @param message The message to serialize.
+            @param stream The write stream.
+
+            @returns True if the message serialized successfully, false otherwise.
+         */
+
+        virtual bool SerializeTypedMessage( Message * message, WriteStream & stream ) { return message->SerializeInternal( stream ); }
+
+        /**
+            Serialize a message by type (measure).
+
+            @param message The message to serialize.
+            @param stream The measure stream.
+
+            @returns True if the message serialized successfully, false otherwise.
+         */
+
+        virtual bool SerializeTypedMessage( Message * message, MeasureStream & stream ) { return message->SerializeInternal( stream ); }
+
+        /**
+            This method is overridden to create messages by type.
+
+            @param type The type of message to be created.
 
-            m_allocator = NULL;
+            @returns The message created. Its reference count is 1.
+         */
 
-            #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-            if ( allocated_messages.size() )
-            {
-                printf( "you leaked messages!\n" );
-                printf( "%d messages leaked\n", (int) allocated_messages.size() );
-                typedef std::map<void*,int>::iterator itor_type;
-                for ( itor_type i = allocated_messages.begin(); i != allocated_messages.end(); ++i ) 
-                {
-                    Message * message = (Message*) i->first;
-                    printf( "leaked message %p (type %d, refcount %d)\n", message, message->GetType(), message->GetRefCount() );
-                }
-                exit(1);
-            }
-            #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-        }
+        virtual Message * CreateMessage( int type ) { (void) type; return NULL; }
 
         /**
-            Create a message by type.
+            Set the message type of a message.
 
-            IMPORTANT: Check the message pointer returned by this call. It can be NULL if there is no memory to create a message!
+            Put here because Message::SetMessageType is protected, but we need to be able to call this inside the overridden MessageFactory::CreateMessage method.
+            
+            @param message The message object.
+            @param type The message type to set.
+         */
 
-            Messages returned from this function have one reference added to them. When you are finished with the message, pass it to MessageFactory::Release.
+        void SetMessageType( Message * message, int type ) { message->SetType( type ); }
 
-            @param type The message type in [0,numTypes-1].
+        /**
+            Create a message from the pool for its type.
 
-            @returns The allocated message, or NULL if the message could not be allocated. If the message allocation fails, the message factory error level is set to MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE.
+            This is called from the message factory CreateMessage generated by YOJIMBO_DECLARE_POOLED_MESSAGE_TYPE. The pool is allocated the first time a message of that type is created.
 
-            @see MessageFactory::AddRef
-            @see MessageFactory::Release
+            If all slots in the pool are in use, the message is created with the allocator instead, so an undersized pool costs performance, not correctness.
+
+            @param type The message type.
+            @param poolSize The number of messages of this type that can exist in the pool at the same time.
+
+            @returns The message created. Its reference count is 1. NULL if the message could not be allocated.
          */
 
-        Message * Create( int type )
+        template <typename T> T * CreatePooledMessage( int type, int poolSize )
         {
             assert( type >= 0 );
             assert( type < m_numTypes );
+            assert( poolSize > 0 );
 
-            Message * message = CreateMessage( type );
-
-            if ( !message )
-            {
-                m_error = MESSAGE_FACTORY_ERROR_FAILED_TO_ALLOCATE_MESSAGE;
+            if ( !m_pools )
                 return NULL;
-            }
 
-            #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-            allocated_messages[message] = 1;
-            assert( allocated_messages.find( message ) != allocated_messages.end() );
-            #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
+            MessagePool & pool = m_pools[type];
 
-            return message;
-        }
+            if ( !pool.data && !InitializePool( pool, sizeof( T ), poolSize ) )
+                return NULL;
 
-        /**
-            Add a reference to a message.
+            assert( pool.slotSize >= (int) sizeof( T ) );
 
-            @param message The message to add a reference to.
+            void * slot = pool.freeList;
 
-            @see MessageFactory::Create
-            @see MessageFactory::Release
-         */   
+            if ( !slot )
+                return YOJIMBO_NEW( *m_allocator, T );
 
-        void AddRef( Message * message )
-        {
-            assert( message );
-            if ( !message )
-                return;
+            pool.freeList = *( (void**) slot );
 
-            message->AddRef();
+            return new ( slot ) T();
         }
 
-        /**
-            Remove a reference from a message.
-
-            Messages have 1 reference when created. When the reference count reaches 0, they are destroyed.
+    private:
 
-            @see MessageFactory::Create
-            @see MessageFactory::AddRef
+        /**
+            Free the prefix code set by MessageFactory::SetTypeFrequencies, going back to serializing message types with a fixed number of bits.
          */
 
-        void Release( Message * message )
+        void FreeTypeCode()
         {
-            assert( message );
-            if ( !message )
-                return;
-
-            message->Release();
-            
-            if ( message->GetRefCount() == 0 )
-            {
-                #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-                assert( allocated_messages.find( message ) != allocated_messages.end() );
-                allocated_messages.erase( message );
-                #endif // #if YOJIMBO_DEBUG_MESSAGE_LEAKS
-            
-                assert( m_allocator );
-
-                YOJIMBO_DELETE( *m_allocator, Message, message );
-            }
+            assert( m_allocator );
+            YOJIMBO_FREE( *m_allocator, m_typeCodeBits );
+            YOJIMBO_FREE( *m_allocator, m_typeCodes );
+            YOJIMBO_FREE( *m_allocator, m_typeCodeTypes );
+            m_maxTypeCodeBits = 0;
         }
 
         /**
-            Get the number of message types supported by this message factory.
+            Take the lock guarding the message pools, if the factory is thread-safe.
 
-            @returns The number of message types.
+            Held only for the few instructions it takes to pop or push a pool slot, so spinning is cheaper than sleeping.
          */
 
-        int GetNumTypes() const
+        void Lock()
         {
-            return m_numTypes;
+            if ( !m_threadSafe )
+                return;
+            while ( !atomic_compare_exchange( &m_lock, 0, 1 ) ) {}
         }
 
         /**
-            Get the allocator used to create messages.
-
-            @returns The allocator.
+            Release the lock taken by MessageFactory::Lock.
          */
 
-        Allocator & GetAllocator()
+        void Unlock()
         {
-            assert( m_allocator );
-            return *m_allocator;
+            if ( !m_threadSafe )
+                return;
+            atomic_store( &m_lock, 0 );
         }
 
         /**
-            Get the error level.
+            Allocate the memory for a message pool and link all slots into the free list.
 
-            When used with a client or server, an error level on a message factory other than MESSAGE_FACTORY_ERROR_NONE triggers a client disconnect.
+            @param pool The message pool to initialize.
+            @param messageSize The size of the message class stored in the pool (bytes).
+            @param poolSize The number of slots in the pool.
+
+            @returns True if the pool was allocated, false if the allocator is out of memory.
          */
 
-        int GetError() const
+        bool InitializePool( MessagePool & pool, int messageSize, int poolSize )
         {
-            return m_error;
+            assert( m_allocator );
+
+            const int slotSize = ( messageSize + 15 ) & ~15;
+
+            pool.data = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, slotSize * poolSize );
+            if ( !pool.data )
+                return false;
+
+            pool.slotSize = slotSize;
+            pool.numSlots = poolSize;
+            pool.freeList = NULL;
+
+            for ( int i = poolSize - 1; i >= 0; --i )
+            {
+                void * slot = pool.data + i * slotSize;
+                *( (void**) slot ) = pool.freeList;
+                pool.freeList = slot;
+            }
+
+            return true;
         }
 
         /**
-            Clear the error level back to no error.
+            Find the pool that a message was created from.
+
+            @param message The message.
+
+            @returns The pool the message belongs to, or NULL if the message was created with the allocator.
          */
 
-        void ClearError()
+        MessagePool * FindPool( Message * message )
         {
-            m_error = MESSAGE_FACTORY_ERROR_NONE;
-        }
+            if ( !m_pools )
+                return NULL;
 
-    protected:
+            const int type = message->GetType();
 
-        /**
-            This method is overridden to create messages by type.
+            assert( type >= 0 );
+            assert( type < m_numTypes );
 
-            @param type The type of message to be created.
+            MessagePool & pool = m_pools[type];
 
-            @returns The message created. Its reference count is 1.
-         */
+            const uint8_t * p = (const uint8_t*) message;
 
-        virtual Message * CreateMessage( int type ) { (void) type; return NULL; }
+            if ( p < pool.data || p >= pool.data + pool.slotSize * pool.numSlots )
+                return NULL;
 
-        /**
-            Set the message type of a message.
+            return &pool;
+        }
 
-            Put here because Message::SetMessageType is protected, but we need to be able to call this inside the overridden MessageFactory::CreateMessage method.
-            
-            @param message The message object.
-            @param type The message type to set.
-         */
+        MessageFactory( const MessageFactory & other );
 
-        void SetMessageType( Message * message, int type ) { message->SetType( type ); }
+        MessageFactory & operator = ( const MessageFactory & other );
     };
+
+    inline BroadcastMessage::~BroadcastMessage()
+    {
+        assert( m_messageFactory );
+
+        m_messageFactory->Release( m_message );
+
+        for ( int i = 0; i < 8; ++i )
+            YOJIMBO_FREE( *m_allocator, m_data[i] );
+
+        m_messageFactory = NULL;
+        m_allocator = NULL;
+    }
+
+    inline AggregateMessage::~AggregateMessage()
+    {
+        assert( m_messageFactory );
+
+        for ( int i = m_readIndex; i < m_numMessages; ++i )
+            m_messageFactory->Release( m_messages[i] );
+
+        m_messageFactory = NULL;
+    }
+
+    template <typename Stream> bool AggregateMessage::Serialize( Stream & stream )
+    {
+        assert( m_messageFactory );
+
+        int numMessages = m_numMessages;
+
+        serialize_int( stream, numMessages, 1, m_maxMessages );
+
+        for ( int i = 0; i < numMessages; ++i )
+        {
+            if ( Stream::IsReading )
+            {
+                Message * message = m_messageFactory->Create( GetType() );
+                if ( !message )
+                    return false;
+                m_messages[m_numMessages++] = message;
+            }
+
+            if ( !m_messageFactory->SerializeMessage( m_messages[i], stream ) )
+                return false;
+        }
+
+        return true;
+    }
+
+    inline bool AggregateMessage::SerializeInternal( ReadStream & stream ) { return Serialize( stream ); }
+
+    inline bool AggregateMessage::SerializeInternal( WriteStream & stream ) { return Serialize( stream ); }
+
+    inline bool AggregateMessage::SerializeInternal( MeasureStream & stream ) { return Serialize( stream ); }
 }
 
 /** 
@@ -662,6 +2226,27 @@ namespace yojimbo
                     SetMessageType( message, message_type );                                                                            \
                     return message;
 
+/** 
+    Add a pooled message type to a message factory.
+
+    Messages of this type are created from a fixed size pool owned by the message factory, instead of being allocated and freed individually. Use this for small message types that are created and destroyed at a high rate.
+
+    @param message_type The message type value. This is typically an enum value.
+    @param message_class The message class to instantiate when a message of this type is created.
+    @param pool_size The number of messages of this type that can exist at the same time before falling back to the allocator.
+
+    See tests/test.cpp for an example of usage.
+ */
+
+#define YOJIMBO_DECLARE_POOLED_MESSAGE_TYPE( message_type, message_class, pool_size )                                                   \
+                                                                                                                                        \
+                case message_type:                                                                                                      \
+                    message = CreatePooledMessage<message_class>( message_type, pool_size );                                            \
+                    if ( !message )                                                                                                     \
+                        return NULL;                                                                                                    \
+                    SetMessageType( message, message_type );                                                                            \
+                    return message;
+
 /** 
     Finish the definition of a new message factory.
 
@@ -677,4 +2262,149 @@ namespace yojimbo
         }                                                                                                                               \
     };
 
+namespace yojimbo
+{
+    /**
+        Read a message by type, picking checked or unchecked reads at compile time. Used internally by serialize_message_type.
+     */
+
+    template <bool Bounded> struct MessageTypeReader
+    {
+        template <typename MessageClass> static bool Read( Message * message, ReadStream & stream )
+        {
+            return static_cast<MessageClass*>( message )->Serialize( stream );
+        }
+    };
+
+    template <> struct MessageTypeReader<true>
+    {
+        template <typename MessageClass> static bool Read( Message * message, ReadStream & stream )
+        {
+            // IMPORTANT: packets truncated inside the message fall back to checked reads, so they fail cleanly instead of reading past the end.
+
+            if ( stream.GetBitsRemaining() < MessageClass::MaxSerializeBits )
+                return static_cast<MessageClass*>( message )->Serialize( stream );
+
+#ifndef NDEBUG
+            const int startBits = stream.GetBitsProcessed();
+#endif // #ifndef NDEBUG
+
+            UncheckedReadStream uncheckedStream( stream );
+            const bool result = static_cast<MessageClass*>( message )->Serialize( uncheckedStream );
+
+            assert( stream.GetBitsProcessed() - startBits <= MessageClass::MaxSerializeBits );
+
+            return result;
+        }
+    };
+
+    /**
+        Serialize a message by calling the templated serialize function of its class directly.
+
+        @param message The message to serialize. Must be of type MessageClass.
+        @param stream The stream to serialize with.
+
+        @returns True if the message serialized successfully, false otherwise.
+     */
+
+    template <typename MessageClass, typename Stream> bool serialize_message_type( Message * message, Stream & stream )
+    {
+        return static_cast<MessageClass*>( message )->Serialize( stream );
+    }
+
+    /**
+        Serialize a message by calling the templated serialize function of its class directly (read).
+
+        If the message class has a maximum size (see Message::MaxSerializeBits), the end of the packet is checked once for the whole message rather than once per field.
+
+        @param message The message to read. Must be of type MessageClass.
+        @param stream The read stream.
+
+        @returns True if the message was read successfully, false otherwise.
+     */
+
+    template <typename MessageClass> bool serialize_message_type( Message * message, ReadStream & stream )
+    {
+        return MessageTypeReader<( MessageClass::MaxSerializeBits > 0 )>::template Read<MessageClass>( message, stream );
+    }
+}
+
+/** 
+    Serialize a message type by calling the templated serialize function of its class directly.
+
+    This is used internally by YOJIMBO_MESSAGE_FACTORY_TYPE_LIST. You shouldn't need to use it yourself.
+
+    @param message_type The message type value.
+    @param message_class The message class. It must have a public templated Serialize function, as set up for YOJIMBO_VIRTUAL_SERIALIZE_FUNCTIONS.
+ */
+
+#define YOJIMBO_SERIALIZE_MESSAGE_TYPE( message_type, message_class )                                                                   \
+                                                                                                                                        \
+                case message_type:                                                                                                      \
+                    return yojimbo::serialize_message_type<message_class>( message, stream );
+
+/** 
+    Serialize messages by type for one stream type. Used internally by YOJIMBO_MESSAGE_FACTORY_TYPE_LIST.
+ */
+
+#define YOJIMBO_MESSAGE_FACTORY_SERIALIZE_TYPES( base_factory_class, stream_class, type_list )                                          \
+                                                                                                                                        \
+        bool SerializeTypedMessage( yojimbo::Message * message, stream_class & stream )                                                 \
+        {                                                                                                                               \
+            switch ( message->GetType() )                                                                                               \
+            {                                                                                                                           \
+                type_list( YOJIMBO_SERIALIZE_MESSAGE_TYPE )                                                                             \
+                default: return base_factory_class::SerializeTypedMessage( message, stream );                                           \
+            }                                                                                                                           \
+        }
+
+/** 
+    Define a message factory from a list of message types.
+
+    This generates the same CreateMessage as YOJIMBO_MESSAGE_FACTORY_START, YOJIMBO_DECLARE_MESSAGE_TYPE and YOJIMBO_MESSAGE_FACTORY_FINISH. It also generates a switch over the concrete message types for read, write and measure, so when the channels serialize a message they call the templated serialize function of its class directly instead of through the SerializeInternal virtuals, and the compiler can inline each message serialize function into the dispatch.
+
+    The type list is a macro that takes a macro and applies it to (message_type, message_class) for each message type, with no separators:
+
+        #define GAME_MESSAGE_TYPES( declare )                        \
+            declare( GAME_MESSAGE_POSITION, PositionMessage )        \
+            declare( GAME_MESSAGE_CHAT, ChatMessage )
+
+        YOJIMBO_MESSAGE_FACTORY_TYPE_LIST( GameMessageFactory, MessageFactory, NUM_GAME_MESSAGE_TYPES, GAME_MESSAGE_TYPES );
+
+    IMPORTANT: Each message class must have a public templated Serialize function. Messages of types not in the list are serialized by the base factory, so you can derive from a factory declared with the start/finish macros.
+
+    @param factory_class The name of the message factory class to generate.
+    @param base_factory_class The name of the message factory class to derive from. If you don't have a custom base class, pass in MessageFactory.
+    @param num_message_types The number of message types for this factory.
+    @param type_list The macro listing the message types.
+
+    See tests/shared.h for an example of usage.
+ */
+
+#define YOJIMBO_MESSAGE_FACTORY_TYPE_LIST( factory_class, base_factory_class, num_message_types, type_list )                             \
+                                                                                                                                        \
+    class factory_class : public base_factory_class                                                                                     \
+    {                                                                                                                                   \
+    public:                                                                                                                             \
+        factory_class( yojimbo::Allocator & allocator = yojimbo::GetDefaultAllocator(), int numMessageTypes = num_message_types )       \
+         : base_factory_class( allocator, numMessageTypes ) { EnableTypedSerialize(); }                                                 \
+        yojimbo::Message * CreateMessage( int type )                                                                                    \
+        {                                                                                                                               \
+            yojimbo::Message * message = base_factory_class::CreateMessage( type );                                                     \
+            if ( message )                                                                                                              \
+                return message;                                                                                                         \
+            yojimbo::Allocator & allocator = GetAllocator();                                                                            \
+            (void) allocator;                                                                                                           \
+            switch ( type )                                                                                                             \
+            {                                                                                                                           \
+                type_list( YOJIMBO_DECLARE_MESSAGE_TYPE )                                                                               \
+                default: return NULL;                                                                                                   \
+            }                                                                                                                           \
+        }                                                                                                                               \
+    protected:                                                                                                                          \
+        YOJIMBO_MESSAGE_FACTORY_SERIALIZE_TYPES( base_factory_class, yojimbo::ReadStream, type_list )                                   \
+        YOJIMBO_MESSAGE_FACTORY_SERIALIZE_TYPES( base_factory_class, yojimbo::WriteStream, type_list )                                  \
+        YOJIMBO_MESSAGE_FACTORY_SERIALIZE_TYPES( base_factory_class, yojimbo::MeasureStream, type_list )                                \
+    };
+
 #endif
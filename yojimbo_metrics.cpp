@@ -0,0 +1,357 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_config.h"
+#include "yojimbo_metrics.h"
+#include "yojimbo_transport.h"
+#include "yojimbo_server.h"
+#include "yojimbo_client.h"
+#include "yojimbo_connection.h"
+#include "yojimbo_channel.h"
+#include "yojimbo_profile.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+
+namespace yojimbo
+{
+    static bool metrics_append( char * buffer, int bufferSize, int & bytesWritten, const char * format, ... )
+    {
+        assert( bytesWritten < bufferSize );
+
+        va_list args;
+        va_start( args, format );
+        const int result = vsnprintf( buffer + bytesWritten, bufferSize - bytesWritten, format, args );
+        va_end( args );
+
+        if ( result < 0 || result >= bufferSize - bytesWritten )
+            return false;
+
+        bytesWritten += result;
+
+        return true;
+    }
+
+    static bool metrics_same_quantile( const char * a, const char * b )
+    {
+        if ( !a || !b )
+            return a == b;
+        return strcmp( a, b ) == 0;
+    }
+
+    static bool metrics_same_series( const Metric & a, const Metric & b )
+    {
+        return a.clientIndex == b.clientIndex && a.channelIndex == b.channelIndex && metrics_same_quantile( a.quantile, b.quantile ) && strcmp( a.name, b.name ) == 0 && strcmp( a.group, b.group ) == 0;
+    }
+
+    static bool metrics_same_name( const Metric & a, const Metric & b )
+    {
+        return strcmp( a.name, b.name ) == 0 && strcmp( a.group, b.group ) == 0;
+    }
+
+    MetricsSnapshot::MetricsSnapshot( Metric * metrics, int maxMetrics )
+    {
+        assert( metrics );
+        assert( maxMetrics > 0 );
+
+        m_metrics = metrics;
+        m_maxMetrics = maxMetrics;
+
+        Reset();
+    }
+
+    void MetricsSnapshot::Reset()
+    {
+        m_numMetrics = 0;
+        m_overflow = false;
+    }
+
+    bool MetricsSnapshot::AddMetric( const char * group, const char * name, MetricType type, uint64_t value, int clientIndex, int channelIndex, const char * quantile )
+    {
+        assert( group );
+        assert( name );
+
+        if ( m_numMetrics == m_maxMetrics )
+        {
+            m_overflow = true;
+            return false;
+        }
+
+        Metric & metric = m_metrics[m_numMetrics++];
+
+        metric.group = group;
+        metric.name = name;
+        metric.type = type;
+        metric.clientIndex = clientIndex;
+        metric.channelIndex = channelIndex;
+        metric.quantile = quantile;
+        metric.value = value;
+
+        return true;
+    }
+
+    void MetricsSnapshot::AddTransport( const Transport & transport )
+    {
+        for ( int i = 0; i < TRANSPORT_COUNTER_NUM_COUNTERS; ++i )
+            AddMetric( "transport", GetTransportCounterName( i ), METRIC_TYPE_COUNTER, transport.GetCounter( i ) );
+
+        AddMetric( "transport", "send_queue_size", METRIC_TYPE_GAUGE, transport.GetSendQueueSize() );
+        AddMetric( "transport", "receive_queue_size", METRIC_TYPE_GAUGE, transport.GetReceiveQueueSize() );
+    }
+
+    void MetricsSnapshot::AddServer( const Server & server )
+    {
+        for ( int i = 0; i < NUM_SERVER_COUNTERS; ++i )
+            AddMetric( "server", GetServerCounterName( i ), METRIC_TYPE_COUNTER, server.GetCounter( i ) );
+
+        AddMetric( "server", "connected_clients", METRIC_TYPE_GAUGE, server.GetNumConnectedClients() );
+
+        if ( !server.IsRunning() )
+            return;
+
+        for ( int i = 0; i < server.GetMaxClients(); ++i )
+        {
+            const Connection * connection = server.GetClientConnection( i );
+            if ( connection )
+                AddConnection( *connection, i );
+        }
+    }
+
+    void MetricsSnapshot::AddClient( const Client & client )
+    {
+        const Connection * connection = client.GetConnection();
+        if ( connection )
+            AddConnection( *connection );
+    }
+
+    void MetricsSnapshot::AddConnection( const Connection & connection, int clientIndex )
+    {
+        for ( int i = 0; i < CONNECTION_COUNTER_NUM_COUNTERS; ++i )
+            AddMetric( "connection", GetConnectionCounterName( i ), METRIC_TYPE_COUNTER, connection.GetCounter( i ), clientIndex );
+
+        for ( int channelIndex = 0; channelIndex < connection.GetNumChannels(); ++channelIndex )
+        {
+            const Channel * channel = connection.GetChannel( channelIndex );
+
+            assert( channel );
+
+            for ( int i = 0; i < CHANNEL_COUNTER_NUM_COUNTERS; ++i )
+                AddMetric( "channel", GetChannelCounterName( i ), METRIC_TYPE_COUNTER, channel->GetCounter( i ), clientIndex, channelIndex );
+
+            AddMetric( "channel", "bits_written", METRIC_TYPE_COUNTER, connection.GetChannelBitsWritten( channelIndex ), clientIndex, channelIndex );
+            AddMetric( "channel", "fragment_bits_written", METRIC_TYPE_COUNTER, connection.GetChannelFragmentBitsWritten( channelIndex ), clientIndex, channelIndex );
+            AddMetric( "channel", "queued_messages", METRIC_TYPE_GAUGE, channel->GetNumQueuedMessages(), clientIndex, channelIndex );
+        }
+    }
+
+    void MetricsSnapshot::AddProfile()
+    {
+        static const char * quantiles[] = { "0.5", "0.99", "0.999" };
+
+        static const double quantileValues[] = { 0.5, 0.99, 0.999 };
+
+        for ( int i = 0; i < NUM_PROFILE_STAGES; ++i )
+        {
+            const LatencyHistogram & histogram = GetProfileHistogram( i );
+
+            const uint64_t count = histogram.GetCount();
+
+            if ( count == 0 )
+                continue;
+
+            AddMetric( "profile_count", GetProfileStageName( i ), METRIC_TYPE_COUNTER, count );
+
+            for ( int j = 0; j < int( sizeof( quantiles ) / sizeof( quantiles[0] ) ); ++j )
+            {
+                const double seconds = profile_ticks_to_seconds( histogram.GetPercentile( quantileValues[j] ) );
+
+                AddMetric( "profile", GetProfileStageName( i ), METRIC_TYPE_GAUGE, uint64_t( seconds * 1000000000.0 + 0.5 ), -1, -1, quantiles[j] );
+            }
+        }
+    }
+
+    const Metric & MetricsSnapshot::GetMetric( int index ) const
+    {
+        assert( index >= 0 );
+        assert( index < m_numMetrics );
+        return m_metrics[index];
+    }
+
+    const Metric * MetricsSnapshot::FindMetric( const char * group, const char * name, int clientIndex, int channelIndex, const char * quantile ) const
+    {
+        assert( group );
+        assert( name );
+
+        for ( int i = 0; i < m_numMetrics; ++i )
+        {
+            const Metric & metric = m_metrics[i];
+            if ( metric.clientIndex == clientIndex && metric.channelIndex == channelIndex && metrics_same_quantile( metric.quantile, quantile ) && strcmp( metric.name, name ) == 0 && strcmp( metric.group, group ) == 0 )
+                return &metric;
+        }
+
+        return NULL;
+    }
+
+    int MetricsSnapshot::WritePrometheus( char * buffer, int bufferSize, const char * prefix ) const
+    {
+        assert( buffer );
+        assert( bufferSize > 0 );
+        assert( prefix );
+
+        int bytesWritten = 0;
+
+        buffer[0] = '\0';
+
+        // IMPORTANT: per-client metrics are added client by client, but the text format requires all samples for a metric name to be in one group.
+        // Each metric name is written the first time it is seen, together with all later metrics of the same name.
+
+        for ( int i = 0; i < m_numMetrics; ++i )
+        {
+            const Metric & first = m_metrics[i];
+
+            bool alreadyWritten = false;
+            for ( int j = 0; j < i; ++j )
+            {
+                if ( metrics_same_name( m_metrics[j], first ) )
+                {
+                    alreadyWritten = true;
+                    break;
+                }
+            }
+
+            if ( alreadyWritten )
+                continue;
+
+            if ( !metrics_append( buffer, bufferSize, bytesWritten, "# TYPE %s_%s_%s %s\n", prefix, first.group, first.name, GetMetricTypeName( first.type ) ) )
+                return -1;
+
+            for ( int j = i; j < m_numMetrics; ++j )
+            {
+                const Metric & metric = m_metrics[j];
+
+                if ( !metrics_same_name( metric, first ) )
+                    continue;
+
+                if ( !metrics_append( buffer, bufferSize, bytesWritten, "%s_%s_%s", prefix, metric.group, metric.name ) )
+                    return -1;
+
+                const char * separator = "{";
+
+                if ( metric.clientIndex >= 0 )
+                {
+                    if ( !metrics_append( buffer, bufferSize, bytesWritten, "%sclient=\"%d\"", separator, metric.clientIndex ) )
+                        return -1;
+                    separator = ",";
+                }
+
+                if ( metric.channelIndex >= 0 )
+                {
+                    if ( !metrics_append( buffer, bufferSize, bytesWritten, "%schannel=\"%d\"", separator, metric.channelIndex ) )
+                        return -1;
+                    separator = ",";
+                }
+
+                if ( metric.quantile )
+                {
+                    if ( !metrics_append( buffer, bufferSize, bytesWritten, "%squantile=\"%s\"", separator, metric.quantile ) )
+                        return -1;
+                    separator = ",";
+                }
+
+                if ( !metrics_append( buffer, bufferSize, bytesWritten, "%s %" PRIu64 "\n", separator[0] == ',' ? "}" : "", metric.value ) )
+                    return -1;
+            }
+        }
+
+        return bytesWritten;
+    }
+
+    int MetricsSnapshot::WriteStatsD( char * buffer, int bufferSize, const char * prefix, const MetricsSnapshot * previous ) const
+    {
+        assert( buffer );
+        assert( bufferSize > 0 );
+        assert( prefix );
+
+        int bytesWritten = 0;
+
+        buffer[0] = '\0';
+
+        for ( int i = 0; i < m_numMetrics; ++i )
+        {
+            const Metric & metric = m_metrics[i];
+
+            uint64_t value = metric.value;
+
+            const char * type = "g";
+
+            if ( metric.type == METRIC_TYPE_COUNTER && previous )
+            {
+                // snapshots are normally taken from the same objects in the same order, so check the same index first
+
+                const Metric * previousMetric = NULL;
+
+                if ( i < previous->m_numMetrics && metrics_same_series( previous->m_metrics[i], metric ) )
+                    previousMetric = &previous->m_metrics[i];
+                else
+                    previousMetric = previous->FindMetric( metric.group, metric.name, metric.clientIndex, metric.channelIndex );
+
+                // a counter that went backwards was reset, so its current value is the increment since the previous snapshot
+
+                if ( previousMetric && previousMetric->value <= value )
+                    value -= previousMetric->value;
+
+                type = "c";
+            }
+
+            if ( !metrics_append( buffer, bufferSize, bytesWritten, "%s.%s.", prefix, metric.group ) )
+                return -1;
+
+            if ( metric.clientIndex >= 0 && !metrics_append( buffer, bufferSize, bytesWritten, "client_%d.", metric.clientIndex ) )
+                return -1;
+
+            if ( metric.channelIndex >= 0 && !metrics_append( buffer, bufferSize, bytesWritten, "channel_%d.", metric.channelIndex ) )
+                return -1;
+
+            if ( !metrics_append( buffer, bufferSize, bytesWritten, "%s", metric.name ) )
+                return -1;
+
+            // quantiles are written as a percentile suffix, eg. "0.99" -> ".p99" and "0.5" -> ".p50"
+
+            if ( metric.quantile )
+            {
+                const char * digits = strchr( metric.quantile, '.' );
+                digits = digits ? digits + 1 : metric.quantile;
+                if ( !metrics_append( buffer, bufferSize, bytesWritten, ".p%s%s", digits, digits[0] && !digits[1] ? "0" : "" ) )
+                    return -1;
+            }
+
+            if ( !metrics_append( buffer, bufferSize, bytesWritten, ":%" PRIu64 "|%s\n", value, type ) )
+                return -1;
+        }
+
+        return bytesWritten;
+    }
+}
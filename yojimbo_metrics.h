@@ -0,0 +1,283 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef YOJIMBO_METRICS_H
+#define YOJIMBO_METRICS_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_common.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    class Transport;
+    class Server;
+    class Client;
+    class Connection;
+
+    /**
+        The type of a metric.
+     */
+
+    enum MetricType
+    {
+        METRIC_TYPE_COUNTER,                                                ///< The metric is a counter that only goes up. eg. number of packets sent. Reset with the ResetCounters function of the object it comes from.
+        METRIC_TYPE_GAUGE                                                   ///< The metric is a value that goes up and down. eg. the number of packets in a queue.
+    };
+
+    /**
+        Get the name of a metric type.
+
+        @param type The metric type.
+
+        @returns The metric type as used in the Prometheus text format, eg. "counter".
+     */
+
+    inline const char * GetMetricTypeName( MetricType type )
+    {
+        switch ( type )
+        {
+            case METRIC_TYPE_COUNTER:       return "counter";
+            case METRIC_TYPE_GAUGE:         return "gauge";
+            default:
+                assert( false );
+                return "???";
+        }
+    }
+
+    /**
+        A single metric value in a metrics snapshot.
+
+        The group and name strings are not copied. They must outlive the snapshot, which is always the case for the names from GetTransportCounterName, GetServerCounterName, GetConnectionCounterName and GetChannelCounterName.
+     */
+
+    struct Metric
+    {
+        const char * group;                                                 ///< The group the metric belongs to, eg. "transport", "server", "connection" or "channel".
+        const char * name;                                                  ///< The name of the metric within its group, eg. "packets_sent".
+        MetricType type;                                                    ///< The metric type.
+        int clientIndex;                                                    ///< The client index the metric belongs to. -1 if the metric is not per-client.
+        int channelIndex;                                                   ///< The channel index the metric belongs to. -1 if the metric is not per-channel.
+        const char * quantile;                                              ///< The quantile of a latency percentile metric, eg. "0.99". NULL if the metric is not a percentile. See MetricsSnapshot::AddProfile.
+        uint64_t value;                                                     ///< The metric value.
+    };
+
+    /**
+        A snapshot of metrics gathered from transports, servers, clients, connections and channels.
+
+        Counters are otherwise spread across the objects that own them, and are read one at a time with GetCounter. A snapshot collects all of them in one place, along with a name and type for each, plus gauges for queue depths.
+
+        The snapshot doesn't allocate. Metrics are written to an array passed in by the caller, so taking a snapshot every frame is fine. Once the array is full, further metrics are dropped and MetricsSnapshot::Overflowed returns true.
+
+        The snapshot can be written out in the Prometheus text exposition format or as StatsD lines, so dedicated servers can be scraped by fleet dashboards.
+
+        Usage:
+
+            Metric metricArray[1024];
+            MetricsSnapshot snapshot( metricArray, 1024 );
+            snapshot.AddTransport( transport );
+            snapshot.AddServer( server );
+            snapshot.WritePrometheus( buffer, sizeof( buffer ) );
+     */
+
+    class MetricsSnapshot
+    {
+    public:
+
+        /**
+            Metrics snapshot constructor.
+
+            @param metrics The array the metrics are written to. Must stay valid for the lifetime of the snapshot.
+            @param maxMetrics The number of entries in the metrics array.
+         */
+
+        MetricsSnapshot( Metric * metrics, int maxMetrics );
+
+        /**
+            Clear all metrics from the snapshot, so it can be reused for the next snapshot.
+         */
+
+        void Reset();
+
+        /**
+            Add a metric.
+
+            @param group The group the metric belongs to, eg. "transport". Not copied.
+            @param name The name of the metric within its group, eg. "packets_sent". Not copied.
+            @param type The metric type.
+            @param value The metric value.
+            @param clientIndex The client index the metric belongs to, or -1 if it is not per-client.
+            @param channelIndex The channel index the metric belongs to, or -1 if it is not per-channel.
+            @param quantile The quantile of a percentile metric, eg. "0.99", or NULL if it is not a percentile. Not copied.
+
+            @returns True if the metric was added. False if the snapshot is full.
+         */
+
+        bool AddMetric( const char * group, const char * name, MetricType type, uint64_t value, int clientIndex = -1, int channelIndex = -1, const char * quantile = NULL );
+
+        /**
+            Add transport counters and packet queue gauges.
+
+            @param transport The transport.
+
+            @see TransportCounters
+         */
+
+        void AddTransport( const Transport & transport );
+
+        /**
+            Add server counters and gauges, plus connection and channel metrics for each connected client.
+
+            @param server The server.
+
+            @see ServerCounters
+         */
+
+        void AddServer( const Server & server );
+
+        /**
+            Add connection and channel metrics for a client.
+
+            Does nothing if the client has no connection object.
+
+            @param client The client.
+         */
+
+        void AddClient( const Client & client );
+
+        /**
+            Add connection counters, plus channel counters, bits written and send queue gauges for each channel.
+
+            @param connection The connection.
+            @param clientIndex The client index to label the metrics with, or -1 if not per-client.
+
+            @see ConnectionCounters
+            @see ChannelCounters
+         */
+
+        void AddConnection( const Connection & connection, int clientIndex = -1 );
+
+        /**
+            Add latency percentiles for each profile stage.
+
+            For each stage that has recorded at least one value, adds the number of values recorded to the "profile_count" group, and gauges with the 50th, 99th and 99.9th percentiles in nanoseconds to the "profile" group.
+
+            Stages are only timed when YOJIMBO_PROFILE is 1, otherwise this adds nothing.
+
+            @see ProfileStage
+            @see GetProfileHistogram
+         */
+
+        void AddProfile();
+
+        /**
+            Get the number of metrics in the snapshot.
+
+            @returns The number of metrics.
+         */
+
+        int GetNumMetrics() const { return m_numMetrics; }
+
+        /**
+            Get a metric.
+
+            @param index The index of the metric in [0,GetNumMetrics()-1].
+
+            @returns The metric.
+         */
+
+        const Metric & GetMetric( int index ) const;
+
+        /**
+            Find a metric by group and name.
+
+            This is O(n) so it is intended for tests and tools, not for per-frame use.
+
+            @param group The metric group, eg. "transport".
+            @param name The metric name, eg. "packets_sent".
+            @param clientIndex The client index to match, or -1 for metrics that are not per-client.
+            @param channelIndex The channel index to match, or -1 for metrics that are not per-channel.
+            @param quantile The quantile to match, eg. "0.99", or NULL for metrics that are not percentiles.
+
+            @returns The metric, or NULL if the snapshot doesn't have it.
+         */
+
+        const Metric * FindMetric( const char * group, const char * name, int clientIndex = -1, int channelIndex = -1, const char * quantile = NULL ) const;
+
+        /**
+            Did metrics get dropped because the snapshot array was full?
+
+            @returns True if at least one metric was dropped since the last reset.
+         */
+
+        bool Overflowed() const { return m_overflow; }
+
+        /**
+            Write the snapshot in the Prometheus text exposition format.
+
+            Each metric is named "<prefix>_<group>_<name>", with client, channel and quantile labels for per-client, per-channel and percentile metrics. Metrics with the same name are written together after a single TYPE line, as the format requires.
+
+            @param buffer The buffer to write to. The output is null terminated.
+            @param bufferSize The size of the buffer (bytes).
+            @param prefix The prefix for each metric name.
+
+            @returns The number of bytes written, not including the null terminator. -1 if the buffer is too small.
+         */
+
+        int WritePrometheus( char * buffer, int bufferSize, const char * prefix = "yojimbo" ) const;
+
+        /**
+            Write the snapshot as StatsD lines.
+
+            Each metric is named "<prefix>.<group>[.client_<n>][.channel_<n>].<name>[.p<n>]", eg. ".p99" for the 0.99 quantile. StatsD counters are increments, not totals, so counters are only written as counters ("|c") when a previous snapshot is passed in, in which case the difference between the two is written. Otherwise, and for gauges, the current value is written as a gauge ("|g").
+
+            @param buffer The buffer to write to. The output is null terminated.
+            @param bufferSize The size of the buffer (bytes).
+            @param prefix The prefix for each metric name.
+            @param previous The previous snapshot, taken from the same objects in the same order. NULL to write every metric as a gauge.
+
+            @returns The number of bytes written, not including the null terminator. -1 if the buffer is too small.
+         */
+
+        int WriteStatsD( char * buffer, int bufferSize, const char * prefix = "yojimbo", const MetricsSnapshot * previous = NULL ) const;
+
+    private:
+
+        MetricsSnapshot( const MetricsSnapshot & other );
+
+        MetricsSnapshot & operator = ( const MetricsSnapshot & other );
+
+        Metric * m_metrics;                                                 ///< The array of metrics passed in to the constructor.
+
+        int m_maxMetrics;                                                   ///< The number of entries in the metrics array.
+
+        int m_numMetrics;                                                   ///< The number of metrics in the snapshot.
+
+        bool m_overflow;                                                    ///< True if a metric was dropped because the metrics array is full.
+    };
+}
+
+#endif // #ifndef YOJIMBO_METRICS_H
@@ -27,20 +27,98 @@
 
 namespace yojimbo
 {
-    NetworkSimulator::NetworkSimulator( Allocator & allocator, int numPackets )
+    // IMPORTANT: packet buffers are prefixed with their reference count and a magic word. The prefix is 8 bytes so packet data keeps the alignment of the allocation
+
+    static const int PacketBufferHeaderBytes = 8;
+
+    static const uint32_t PacketBufferMagic = 0x504B5442;
+
+    struct PacketBufferHeader
+    {
+        int refCount;
+        uint32_t magic;
+    };
+
+    static PacketBufferHeader & packet_buffer_header( const uint8_t * packetData )
+    {
+        assert( packetData );
+
+        PacketBufferHeader & header = *( (PacketBufferHeader*) ( packetData - PacketBufferHeaderBytes ) );
+
+        // IMPORTANT: if this fires, the packet data was not created with CreatePacket, or it was already released
+
+        assert( header.magic == PacketBufferMagic );
+
+        return header;
+    }
+
+    static uint8_t * create_packet_buffer( Allocator & allocator, int packetSize )
+    {
+        assert( packetSize > 0 );
+
+        // IMPORTANT: the buffer is rounded up to the next 4 bytes, since packets may be read in place and the bit reader reads dwords
+
+        uint8_t * buffer = (uint8_t*) YOJIMBO_ALLOCATE( allocator, PacketBufferHeaderBytes + ( ( packetSize + 3 ) & ~3 ) );
+        if ( !buffer )
+            return NULL;
+
+        PacketBufferHeader & header = *( (PacketBufferHeader*) buffer );
+
+        header.refCount = 1;
+        header.magic = PacketBufferMagic;
+
+        return buffer + PacketBufferHeaderBytes;
+    }
+
+    static void release_packet_buffer( Allocator & allocator, uint8_t * packetData )
+    {
+        if ( !packetData )
+            return;
+
+        PacketBufferHeader & header = packet_buffer_header( packetData );
+
+        assert( header.refCount > 0 );
+
+        if ( --header.refCount > 0 )
+            return;
+
+        header.magic = 0;
+
+        uint8_t * buffer = packetData - PacketBufferHeaderBytes;
+
+        YOJIMBO_FREE( allocator, buffer );
+    }
+
+    NetworkSimulator::NetworkSimulator( Allocator & allocator, int numPackets, int numLinks )
     {
         m_allocator = &allocator;
 
         assert( numPackets > 0 );
+        assert( numLinks > 0 );
 
         m_numPacketEntries = numPackets;
         m_packetEntries = (PacketEntry*) YOJIMBO_ALLOCATE( allocator, sizeof( PacketEntry ) * numPackets );
         memset( m_packetEntries, 0, sizeof( PacketEntry ) * numPackets );
 
+        m_sendSequence = 0;
+
+        m_deliveryHeapSize = 0;
+        m_deliveryHeap = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * numPackets );
+        m_deliveryHeapPosition = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * numPackets );
+        for ( int i = 0; i < numPackets; ++i )
+            m_deliveryHeapPosition[i] = -1;
+
         m_numPendingReceivePackets = 0;
         m_pendingReceivePackets = (PacketEntry*) YOJIMBO_ALLOCATE( allocator, sizeof( PacketEntry ) * numPackets );
         memset( m_pendingReceivePackets, 0, sizeof( PacketEntry ) * numPackets );
 
+        m_pendingReceiveNext = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * numPackets );
+        m_pendingReceiveAddressMap = YOJIMBO_NEW( allocator, AddressMap, allocator, numPackets );
+
+        m_maxLinks = numLinks;
+        m_links = (Link*) YOJIMBO_ALLOCATE( allocator, sizeof( Link ) * ( numLinks + 1 ) );
+        m_linkAddressMap = YOJIMBO_NEW( allocator, AddressMap, allocator, numLinks );
+
         m_lastPendingReceiveTime = -10000.0;
 
         m_currentIndex = 0;
@@ -51,6 +129,17 @@ namespace yojimbo
         m_jitter = 0.0f;
         m_packetLoss = 0.0f;
         m_duplicate = 0.0f;
+        m_bandwidth = 0.0f;
+        m_queueSize = 64 * 1024;
+        m_burstEnter = 0.0f;
+        m_burstExit = 0.0f;
+        m_burstLoss = 0.0f;
+
+        m_packetCapture = NULL;
+        m_packetReplay = NULL;
+        m_packetReplayIndex = 0;
+
+        SetSeed( ( uint64_t( rand() ) << 32 ) | uint64_t( rand() ) );
 
         UpdateActive();
     }
@@ -62,7 +151,13 @@ namespace yojimbo
 
         DiscardPackets();
 
+        YOJIMBO_DELETE( *m_allocator, AddressMap, m_linkAddressMap );
+        YOJIMBO_FREE( *m_allocator, m_links );
+        YOJIMBO_DELETE( *m_allocator, AddressMap, m_pendingReceiveAddressMap );
+        YOJIMBO_FREE( *m_allocator, m_pendingReceiveNext );
         YOJIMBO_FREE( *m_allocator, m_pendingReceivePackets );
+        YOJIMBO_FREE( *m_allocator, m_deliveryHeapPosition );
+        YOJIMBO_FREE( *m_allocator, m_deliveryHeap );
         YOJIMBO_FREE( *m_allocator, m_packetEntries );
 
         m_numPacketEntries = 0;
@@ -95,6 +190,55 @@ namespace yojimbo
         UpdateActive();
     }
 
+    void NetworkSimulator::SetBandwidth( float kbps )
+    {
+        assert( kbps >= 0.0f );
+        m_bandwidth = kbps;
+        UpdateActive();
+    }
+
+    void NetworkSimulator::SetQueueSize( int bytes )
+    {
+        assert( bytes > 0 );
+        m_queueSize = bytes;
+    }
+
+    void NetworkSimulator::SetBurstLoss( float enterPercent, float exitPercent, float lossPercent )
+    {
+        m_burstEnter = enterPercent;
+        m_burstExit = exitPercent;
+        m_burstLoss = lossPercent;
+        UpdateActive();
+    }
+
+    void NetworkSimulator::SetSeed( uint64_t seed )
+    {
+        // IMPORTANT: Xorshift gets stuck on zero, so mix the seed with a constant and never let the state be zero.
+
+        m_randomState = seed ^ 0x9E3779B97F4A7C15ULL;
+
+        if ( m_randomState == 0 )
+            m_randomState = 1;
+    }
+
+    void NetworkSimulator::SetPacketCapture( PacketCapture * packetCapture )
+    {
+        m_packetCapture = packetCapture;
+        UpdateActive();
+    }
+
+    void NetworkSimulator::SetPacketReplay( const PacketCapture * packetReplay )
+    {
+        m_packetReplay = packetReplay;
+        m_packetReplayIndex = 0;
+        UpdateActive();
+    }
+
+    bool NetworkSimulator::IsReplayFinished() const
+    {
+        return !m_packetReplay || m_packetReplayIndex == m_packetReplay->GetNumPackets();
+    }
+
     bool NetworkSimulator::IsActive() const
     {
         return m_active;
@@ -102,7 +246,40 @@ namespace yojimbo
 
     void NetworkSimulator::UpdateActive()
     {
-        m_active = m_latency != 0.0f || m_jitter != 0.0f || m_packetLoss != 0.0f || m_duplicate != 0.0f;
+        m_active = m_latency != 0.0f || m_jitter != 0.0f || m_packetLoss != 0.0f || m_duplicate != 0.0f || m_bandwidth != 0.0f || m_burstEnter != 0.0f || m_packetCapture != NULL || m_packetReplay != NULL;
+    }
+
+    float NetworkSimulator::RandomFloat( float a, float b )
+    {
+        assert( a < b );
+
+        m_randomState ^= m_randomState << 13;
+        m_randomState ^= m_randomState >> 7;
+        m_randomState ^= m_randomState << 17;
+
+        const float random = float( m_randomState >> 40 ) / float( ( 1 << 24 ) - 1 );
+
+        return a + random * ( b - a );
+    }
+
+    int NetworkSimulator::GetLinkIndex( const Address & from )
+    {
+        int index = m_linkAddressMap->Find( from );
+
+        if ( index == -1 )
+        {
+            if ( m_linkAddressMap->GetNumEntries() == m_maxLinks )
+                return m_maxLinks;
+
+            index = m_linkAddressMap->GetNumEntries();
+
+            m_linkAddressMap->Insert( from, index );
+
+            m_links[index].busyUntil = 0.0;
+            m_links[index].burst = false;
+        }
+
+        return index;
     }
 
     void NetworkSimulator::UpdatePendingReceivePackets()
@@ -114,32 +291,222 @@ namespace yojimbo
 
         m_lastPendingReceiveTime = m_time;
         
-        // free any pending receive packets that are still in the buffer
+        // free any pending receive packets that are still in the buffer. removing each address from the map (vs. clearing it) keeps this proportional to the number of pending packets
 
         for ( int i = 0; i < m_numPendingReceivePackets; ++i )
         {
-            YOJIMBO_FREE( *m_allocator, m_pendingReceivePackets[i].packetData );
+            ReleasePacket( m_pendingReceivePackets[i].packetData );
+
+            m_pendingReceiveAddressMap->Remove( m_pendingReceivePackets[i].to );
         }
 
         m_numPendingReceivePackets = 0;
 
-        // walk across packet entries and move any that are ready to be received into the pending receive buffer
+        if ( m_packetReplay )
+        {
+            // deliver packets from the replay capture once time reaches the time they were originally delivered
 
-        for ( int i = 0; i < m_numPacketEntries; ++i )
+            while ( m_packetReplayIndex < m_packetReplay->GetNumPackets() && m_numPendingReceivePackets < m_numPacketEntries )
+            {
+                const PacketCaptureEntry & entry = m_packetReplay->GetPacket( m_packetReplayIndex );
+
+                if ( entry.time > m_time )
+                    break;
+
+                if ( entry.type == PACKET_CAPTURE_RECEIVE )
+                {
+                    uint8_t * packetData = CreatePacket( entry.packetBytes );
+                    if ( !packetData )
+                        break;
+
+                    memcpy( packetData, m_packetReplay->GetPacketData( m_packetReplayIndex ), entry.packetBytes );
+
+                    PacketEntry & pendingEntry = m_pendingReceivePackets[m_numPendingReceivePackets++];
+
+                    pendingEntry = PacketEntry();
+                    pendingEntry.from = entry.from;
+                    pendingEntry.to = entry.to;
+                    pendingEntry.deliveryTime = entry.time;
+                    pendingEntry.packetData = packetData;
+                    pendingEntry.packetSize = entry.packetBytes;
+                }
+
+                m_packetReplayIndex++;
+            }
+        }
+
+        // pop packets that are ready to be received off the delivery heap into the pending receive buffer, in delivery order
+
+        while ( m_deliveryHeapSize > 0 )
         {
-            if ( !m_packetEntries[i].packetData )
-                continue;
+            const int slot = m_deliveryHeap[0];
+
+            if ( m_packetEntries[slot].deliveryTime >= m_time )
+                break;
 
-            if ( m_packetEntries[i].deliveryTime < m_time )
+            RemoveFromDeliveryHeap( slot );
+
+            m_pendingReceivePackets[m_numPendingReceivePackets] = m_packetEntries[slot];
+            m_numPendingReceivePackets++;
+            m_packetEntries[slot].packetData = NULL;
+        }
+
+        if ( m_packetCapture )
+        {
+            for ( int i = 0; i < m_numPendingReceivePackets; ++i )
             {
-                m_pendingReceivePackets[m_numPendingReceivePackets] = m_packetEntries[i];
-                m_numPendingReceivePackets++;
-                m_packetEntries[i].packetData = NULL;
+                const PacketEntry & entry = m_pendingReceivePackets[i];
+                m_packetCapture->AddPacket( PACKET_CAPTURE_RECEIVE, m_time, entry.from, entry.to, entry.packetData, entry.packetSize );
             }
         }
+
+        // link pending receive packets into a list per-address. walk backwards so each list is in delivery order
+
+        for ( int i = m_numPendingReceivePackets - 1; i >= 0; --i )
+        {
+            m_pendingReceiveNext[i] = m_pendingReceiveAddressMap->Find( m_pendingReceivePackets[i].to );
+
+            m_pendingReceiveAddressMap->Insert( m_pendingReceivePackets[i].to, i );
+        }
+    }
+
+    bool NetworkSimulator::IsDeliveredBefore( int a, int b ) const
+    {
+        const PacketEntry & entryA = m_packetEntries[a];
+        const PacketEntry & entryB = m_packetEntries[b];
+
+        if ( entryA.deliveryTime != entryB.deliveryTime )
+            return entryA.deliveryTime < entryB.deliveryTime;
+
+        return entryA.sendSequence < entryB.sendSequence;
+    }
+
+    void NetworkSimulator::AddToDeliveryHeap( int slot )
+    {
+        assert( slot >= 0 );
+        assert( slot < m_numPacketEntries );
+        assert( m_deliveryHeapPosition[slot] == -1 );
+        assert( m_deliveryHeapSize < m_numPacketEntries );
+
+        const int position = m_deliveryHeapSize++;
+
+        m_deliveryHeap[position] = slot;
+        m_deliveryHeapPosition[slot] = position;
+
+        SiftUpDeliveryHeap( position );
+    }
+
+    void NetworkSimulator::RemoveFromDeliveryHeap( int slot )
+    {
+        assert( slot >= 0 );
+        assert( slot < m_numPacketEntries );
+
+        const int position = m_deliveryHeapPosition[slot];
+
+        assert( position >= 0 );
+        assert( position < m_deliveryHeapSize );
+        assert( m_deliveryHeap[position] == slot );
+
+        m_deliveryHeapPosition[slot] = -1;
+
+        m_deliveryHeapSize--;
+
+        if ( position == m_deliveryHeapSize )
+            return;
+
+        // move the last entry into the hole, then restore heap order in whichever direction it's out of order
+
+        const int lastSlot = m_deliveryHeap[m_deliveryHeapSize];
+
+        m_deliveryHeap[position] = lastSlot;
+        m_deliveryHeapPosition[lastSlot] = position;
+
+        if ( position > 0 && IsDeliveredBefore( lastSlot, m_deliveryHeap[(position-1)/2] ) )
+            SiftUpDeliveryHeap( position );
+        else
+            SiftDownDeliveryHeap( position );
+    }
+
+    void NetworkSimulator::SiftUpDeliveryHeap( int position )
+    {
+        const int slot = m_deliveryHeap[position];
+
+        while ( position > 0 )
+        {
+            const int parent = ( position - 1 ) / 2;
+
+            if ( !IsDeliveredBefore( slot, m_deliveryHeap[parent] ) )
+                break;
+
+            m_deliveryHeap[position] = m_deliveryHeap[parent];
+            m_deliveryHeapPosition[m_deliveryHeap[position]] = position;
+
+            position = parent;
+        }
+
+        m_deliveryHeap[position] = slot;
+        m_deliveryHeapPosition[slot] = position;
+    }
+
+    void NetworkSimulator::SiftDownDeliveryHeap( int position )
+    {
+        const int slot = m_deliveryHeap[position];
+
+        while ( true )
+        {
+            int child = position * 2 + 1;
+
+            if ( child >= m_deliveryHeapSize )
+                break;
+
+            if ( child + 1 < m_deliveryHeapSize && IsDeliveredBefore( m_deliveryHeap[child+1], m_deliveryHeap[child] ) )
+                child++;
+
+            if ( !IsDeliveredBefore( m_deliveryHeap[child], slot ) )
+                break;
+
+            m_deliveryHeap[position] = m_deliveryHeap[child];
+            m_deliveryHeapPosition[m_deliveryHeap[position]] = position;
+
+            position = child;
+        }
+
+        m_deliveryHeap[position] = slot;
+        m_deliveryHeapPosition[slot] = position;
     }
 
-    void NetworkSimulator::SendPacket( const Address & from, const Address & to, uint8_t * packetData, int packetSize )
+    uint8_t * NetworkSimulator::CreatePacket( int packetSize )
+    {
+        assert( m_allocator );
+        return create_packet_buffer( *m_allocator, packetSize );
+    }
+
+    void NetworkSimulator::ReleasePacket( uint8_t * packetData )
+    {
+        assert( m_allocator );
+        release_packet_buffer( *m_allocator, packetData );
+    }
+
+    bool NetworkSimulator::IsPacketShared( const uint8_t * packetData ) const
+    {
+        return packet_buffer_header( packetData ).refCount > 1;
+    }
+
+    void NetworkSimulator::SendPacket( const Address & from, const Address & to, const uint8_t * packetData, int packetSize )
+    {
+        assert( packetData );
+        assert( packetSize > 0 );
+
+        uint8_t * packetDataCopy = CreatePacket( packetSize );
+        if ( !packetDataCopy )
+            return;
+
+        memcpy( packetDataCopy, packetData, packetSize );
+
+        SendCreatedPacket( from, to, packetDataCopy, packetSize );
+    }
+
+    void NetworkSimulator::SendCreatedPacket( const Address & from, const Address & to, uint8_t * packetData, int packetSize )
     {
         assert( m_allocator );
 
@@ -149,9 +516,59 @@ namespace yojimbo
         assert( packetData );
         assert( packetSize > 0 );
 
-        if ( random_float( 0.0f, 100.0f ) <= m_packetLoss )
+        if ( m_packetCapture )
+            m_packetCapture->AddPacket( PACKET_CAPTURE_SEND, m_time, from, to, packetData, packetSize );
+
+        // IMPORTANT: While replaying, packets are delivered from the capture instead. Sending them too would deliver them twice.
+
+        if ( m_packetReplay )
         {
-            YOJIMBO_FREE( *m_allocator, packetData );
+            ReleasePacket( packetData );
+            return;
+        }
+
+        double delay = m_latency / 1000.0;
+
+        float packetLoss = m_packetLoss;
+
+        if ( m_bandwidth > 0.0f || m_burstEnter > 0.0f )
+        {
+            Link & link = m_links[GetLinkIndex( from )];
+
+            if ( m_bandwidth > 0.0f )
+            {
+                // packets are transmitted one after another. a packet waits until the packets queued before it are sent, and is dropped if the queue is full
+
+                const double bytesPerSecond = m_bandwidth * 1000.0 / 8.0;
+
+                const double transmitStart = max( m_time, link.busyUntil );
+
+                if ( ( transmitStart - m_time ) * bytesPerSecond + packetSize > m_queueSize )
+                {
+                    ReleasePacket( packetData );
+                    return;
+                }
+
+                link.busyUntil = transmitStart + packetSize / bytesPerSecond;
+
+                delay += link.busyUntil - m_time;
+            }
+
+            if ( m_burstEnter > 0.0f )
+            {
+                if ( link.burst )
+                    link.burst = !( RandomFloat( 0.0f, 100.0f ) <= m_burstExit );
+                else
+                    link.burst = RandomFloat( 0.0f, 100.0f ) <= m_burstEnter;
+
+                if ( link.burst )
+                    packetLoss = m_burstLoss;
+            }
+        }
+
+        if ( RandomFloat( 0.0f, 100.0f ) <= packetLoss )
+        {
+            ReleasePacket( packetData );
             return;
         }
 
@@ -159,36 +576,48 @@ namespace yojimbo
 
         if ( packetEntry.packetData )
         {
-            YOJIMBO_FREE( *m_allocator, packetEntry.packetData );
+            RemoveFromDeliveryHeap( m_currentIndex );
+            ReleasePacket( packetEntry.packetData );
             packetEntry = PacketEntry();
         }
 
-        double delay = m_latency / 1000.0;
-
         if ( m_jitter > 0 )
-            delay += random_float( -m_jitter, +m_jitter ) / 1000.0;
+            delay += RandomFloat( -m_jitter, +m_jitter ) / 1000.0;
 
         packetEntry.from = from;
         packetEntry.to = to;
         packetEntry.packetData = packetData;
         packetEntry.packetSize = packetSize;
         packetEntry.deliveryTime = m_time + delay;
+        packetEntry.sendSequence = m_sendSequence++;
+
+        AddToDeliveryHeap( m_currentIndex );
 
         m_currentIndex = ( m_currentIndex + 1 ) % m_numPacketEntries;
 
-        if ( random_float( 0.0f, 100.0f ) <= m_duplicate )
+        if ( RandomFloat( 0.0f, 100.0f ) <= m_duplicate )
         {
-            uint8_t * duplicatePacketData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, packetSize );
+            // the duplicate shares the packet buffer instead of copying it
 
-            memcpy( duplicatePacketData, packetData, packetSize );
+            packet_buffer_header( packetData ).refCount++;
 
             PacketEntry & nextPacketEntry = m_packetEntries[m_currentIndex];
 
+            if ( nextPacketEntry.packetData )
+            {
+                RemoveFromDeliveryHeap( m_currentIndex );
+                ReleasePacket( nextPacketEntry.packetData );
+                nextPacketEntry = PacketEntry();
+            }
+
             nextPacketEntry.from = from;
             nextPacketEntry.to = to;
-            nextPacketEntry.packetData = duplicatePacketData;
+            nextPacketEntry.packetData = packetData;
             nextPacketEntry.packetSize = packetSize;
-            nextPacketEntry.deliveryTime = m_time + delay + random_float( 0, +1.0 );
+            nextPacketEntry.deliveryTime = m_time + delay + RandomFloat( 0.0f, 1.0f );
+            nextPacketEntry.sendSequence = m_sendSequence++;
+
+            AddToDeliveryHeap( m_currentIndex );
 
             m_currentIndex = ( m_currentIndex + 1 ) % m_numPacketEntries;
         }
@@ -198,7 +627,7 @@ namespace yojimbo
     {
         int numPackets = 0;
 
-        for ( int i = 0; i < min( maxPackets, m_numPendingReceivePackets ); ++i )
+        for ( int i = 0; i < m_numPendingReceivePackets && numPackets < maxPackets; ++i )
         {
             if ( !m_pendingReceivePackets[i].packetData )
                 continue;
@@ -220,28 +649,40 @@ namespace yojimbo
     {
         int numPackets = 0;
 
-        for ( int i = 0; i < min( maxPackets, m_numPendingReceivePackets ); ++i )
+        int i = m_pendingReceiveAddressMap->Find( to );
+
+        while ( i != -1 && numPackets < maxPackets )
         {
-            if ( !m_pendingReceivePackets[i].packetData )
-                continue;
+            assert( i < m_numPendingReceivePackets );
+            assert( m_pendingReceivePackets[i].to == to );
 
-            if ( m_pendingReceivePackets[i].to != to )
-                continue;
+            if ( m_pendingReceivePackets[i].packetData )
+            {
+                packetData[numPackets] = m_pendingReceivePackets[i].packetData;
+                packetSize[numPackets] = m_pendingReceivePackets[i].packetSize;
+                from[numPackets] = m_pendingReceivePackets[i].from;
 
-            packetData[numPackets] = m_pendingReceivePackets[i].packetData;
-            packetSize[numPackets] = m_pendingReceivePackets[i].packetSize;
-            from[numPackets] = m_pendingReceivePackets[i].from;
+                m_pendingReceivePackets[i].packetData = NULL;
 
-            m_pendingReceivePackets[i].packetData = NULL;
+                numPackets++;
+            }
 
-            numPackets++;
+            i = m_pendingReceiveNext[i];
         }
 
+        // skip the packets already received the next time packets sent to this address are received
+
+        if ( i != -1 )
+            m_pendingReceiveAddressMap->Insert( to, i );
+        else
+            m_pendingReceiveAddressMap->Remove( to );
+
         return numPackets;
     }
 
     void NetworkSimulator::DiscardPackets()
     {
+        m_linkAddressMap->Clear();
         for ( int i = 0; i < m_numPacketEntries; ++i )
         {
             PacketEntry & packetEntry = m_packetEntries[i];
@@ -249,19 +690,25 @@ namespace yojimbo
             if ( !packetEntry.packetData )
                 continue;
 
-            YOJIMBO_FREE( *m_allocator, packetEntry.packetData );
+            ReleasePacket( packetEntry.packetData );
 
             packetEntry = PacketEntry();
+
+            m_deliveryHeapPosition[i] = -1;
         }
 
+        m_deliveryHeapSize = 0;
+
         for ( int i = 0; i < m_numPendingReceivePackets; ++i )
         {
             PacketEntry & packetEntry = m_pendingReceivePackets[i];
 
+            m_pendingReceiveAddressMap->Remove( packetEntry.to );
+
             if ( !packetEntry.packetData )
                 continue;
 
-            YOJIMBO_FREE( *m_allocator, packetEntry.packetData );
+            ReleasePacket( packetEntry.packetData );
 
             packetEntry = PacketEntry();
         }
@@ -281,7 +728,9 @@ namespace yojimbo
             if ( packetEntry.from != address )
                 continue;
 
-            YOJIMBO_FREE( *m_allocator, packetEntry.packetData );
+            RemoveFromDeliveryHeap( i );
+
+            ReleasePacket( packetEntry.packetData );
 
             packetEntry = PacketEntry();
         }
@@ -296,9 +745,11 @@ namespace yojimbo
             if ( packetEntry.from != address )
                 continue;
 
-            YOJIMBO_FREE( *m_allocator, packetEntry.packetData );
+            // IMPORTANT: keep the addresses of pending receive packets. They are still linked into the per-address lists until the next update
 
-            packetEntry = PacketEntry();
+            ReleasePacket( packetEntry.packetData );
+
+            packetEntry.packetData = NULL;
         }
     }
 
@@ -308,4 +759,421 @@ namespace yojimbo
 
         UpdatePendingReceivePackets();
     }
+
+    double NetworkSimulator::GetNextDeliveryTime() const
+    {
+        double deliveryTime = NoEventTime;
+
+        if ( m_deliveryHeapSize > 0 )
+            deliveryTime = m_packetEntries[m_deliveryHeap[0]].deliveryTime;
+
+        if ( m_packetReplay && m_packetReplayIndex < m_packetReplay->GetNumPackets() )
+            deliveryTime = min( deliveryTime, m_packetReplay->GetPacket( m_packetReplayIndex ).time );
+
+        return deliveryTime;
+    }
+
+    // =====================================================
+
+    ThreadedNetworkSimulator::ThreadedNetworkSimulator( Allocator & allocator, int maxAddresses, int numPacketsPerAddress )
+    {
+        assert( maxAddresses > 0 );
+        assert( numPacketsPerAddress > 0 );
+
+        m_allocator = &allocator;
+
+        m_maxAddresses = maxAddresses;
+        m_numAddresses = 0;
+        m_numPacketsPerAddress = numPacketsPerAddress;
+
+        uint32_t numInboxes = 1;
+        while ( numInboxes < uint32_t( maxAddresses ) * 2 )
+            numInboxes <<= 1;
+
+        m_inboxMask = numInboxes - 1;
+
+        m_inboxes = (Inbox*) YOJIMBO_ALLOCATE( allocator, sizeof( Inbox ) * numInboxes );
+        for ( uint32_t i = 0; i < numInboxes; ++i )
+        {
+            new ( &m_inboxes[i] ) Inbox();
+            m_inboxes[i].state = INBOX_FREE;
+            m_inboxes[i].open = 0;
+            m_inboxes[i].sendList = NULL;
+            m_inboxes[i].numPackets = 0;
+            m_inboxes[i].deliveryHeap = NULL;
+        }
+
+        m_deliveryHeaps = (PacketEntry**) YOJIMBO_ALLOCATE( allocator, sizeof( PacketEntry* ) * maxAddresses * numPacketsPerAddress );
+
+        m_sendSequence = 0;
+
+        m_latency = 0.0f;
+        m_jitter = 0.0f;
+        m_packetLoss = 0.0f;
+        m_duplicate = 0.0f;
+
+        SetSeed( ( uint64_t( rand() ) << 32 ) | uint64_t( rand() ) );
+    }
+
+    ThreadedNetworkSimulator::~ThreadedNetworkSimulator()
+    {
+        assert( m_allocator );
+        assert( m_inboxes );
+
+        for ( uint32_t i = 0; i <= m_inboxMask; ++i )
+        {
+            if ( m_inboxes[i].state == INBOX_CLAIMED )
+                DiscardPacketsSentToAddress( m_inboxes[i].address );
+        }
+
+        YOJIMBO_FREE( *m_allocator, m_deliveryHeaps );
+        YOJIMBO_FREE( *m_allocator, m_inboxes );
+
+        m_allocator = NULL;
+    }
+
+    void ThreadedNetworkSimulator::SetLatency( float milliseconds )
+    {
+        m_latency = milliseconds;
+    }
+
+    void ThreadedNetworkSimulator::SetJitter( float milliseconds )
+    {
+        m_jitter = milliseconds;
+    }
+
+    void ThreadedNetworkSimulator::SetPacketLoss( float percent )
+    {
+        m_packetLoss = percent;
+    }
+
+    void ThreadedNetworkSimulator::SetDuplicate( float percent )
+    {
+        m_duplicate = percent;
+    }
+
+    void ThreadedNetworkSimulator::SetSeed( uint64_t seed )
+    {
+        m_seed = seed;
+    }
+
+    float ThreadedNetworkSimulator::RandomFloat( uint32_t sendSequence, int index, float a, float b ) const
+    {
+        assert( a < b );
+        assert( index >= 0 );
+        assert( index < 4 );
+
+        // IMPORTANT: Each random number is a hash of the seed, the send sequence and the index, so threads never share random number generator state. This is the splitmix64 finalizer.
+
+        uint64_t x = m_seed + ( ( uint64_t( sendSequence ) << 2 ) | uint64_t( index ) ) * 0x9E3779B97F4A7C15ULL;
+
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ULL;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBULL;
+        x ^= x >> 31;
+
+        const float random = float( x >> 40 ) / float( ( 1 << 24 ) - 1 );
+
+        return a + random * ( b - a );
+    }
+
+    ThreadedNetworkSimulator::Inbox * ThreadedNetworkSimulator::FindInbox( const Address & address, bool add )
+    {
+        assert( address.IsValid() );
+
+        uint32_t index = uint32_t( address.GetHash() ) & m_inboxMask;
+
+        while ( true )
+        {
+            Inbox & inbox = m_inboxes[index];
+
+            const int state = atomic_load( &inbox.state );
+
+            if ( state == INBOX_FREE )
+            {
+                if ( !add )
+                    return NULL;
+
+                // another thread claimed this slot first. look at it again, it might be for the same address
+
+                if ( !atomic_compare_exchange( &inbox.state, INBOX_FREE, INBOX_CLAIMING ) )
+                    continue;
+
+                const int addressIndex = atomic_increment( &m_numAddresses ) - 1;
+
+                if ( addressIndex >= m_maxAddresses )
+                {
+                    atomic_decrement( &m_numAddresses );
+                    atomic_store( &inbox.state, INBOX_FREE );
+                    return NULL;
+                }
+
+                inbox.address = address;
+                inbox.open = 0;
+                inbox.sendList = NULL;
+                inbox.numPackets = 0;
+                inbox.deliveryHeap = m_deliveryHeaps + addressIndex * m_numPacketsPerAddress;
+
+                atomic_store( &inbox.state, INBOX_CLAIMED );
+
+                return &inbox;
+            }
+
+            // IMPORTANT: Wait for a slot being claimed to finish, because it might be claimed for this address. Claiming only takes a few instructions.
+
+            if ( state == INBOX_CLAIMING )
+                continue;
+
+            if ( inbox.address == address )
+                return &inbox;
+
+            index = ( index + 1 ) & m_inboxMask;
+        }
+    }
+
+    bool ThreadedNetworkSimulator::AddAddress( const Address & address )
+    {
+        Inbox * inbox = FindInbox( address, true );
+        if ( !inbox )
+            return false;
+
+        atomic_store( &inbox->open, 1 );
+
+        return true;
+    }
+
+    void ThreadedNetworkSimulator::RemoveAddress( const Address & address )
+    {
+        Inbox * inbox = FindInbox( address, false );
+        if ( !inbox )
+            return;
+
+        atomic_store( &inbox->open, 0 );
+
+        DiscardPacketsSentToAddress( address );
+    }
+
+    bool ThreadedNetworkSimulator::IsDeliveredBefore( const PacketEntry * a, const PacketEntry * b )
+    {
+        if ( a->deliveryTime != b->deliveryTime )
+            return a->deliveryTime < b->deliveryTime;
+
+        return int32_t( a->sendSequence - b->sendSequence ) < 0;
+    }
+
+    void ThreadedNetworkSimulator::FreePacketEntry( PacketEntry * entry )
+    {
+        assert( entry );
+        ReleasePacket( entry->packetData );
+        YOJIMBO_FREE( *m_allocator, entry );
+    }
+
+    uint8_t * ThreadedNetworkSimulator::CreatePacket( int packetSize )
+    {
+        assert( m_allocator );
+        return create_packet_buffer( *m_allocator, packetSize );
+    }
+
+    void ThreadedNetworkSimulator::ReleasePacket( uint8_t * packetData )
+    {
+        assert( m_allocator );
+        release_packet_buffer( *m_allocator, packetData );
+    }
+
+    void ThreadedNetworkSimulator::SendPacket( const Address & from, const Address & to, const uint8_t * packetData, int packetSize, double time )
+    {
+        assert( packetData );
+        assert( packetSize > 0 );
+
+        uint8_t * packetDataCopy = CreatePacket( packetSize );
+        if ( !packetDataCopy )
+            return;
+
+        memcpy( packetDataCopy, packetData, packetSize );
+
+        SendCreatedPacket( from, to, packetDataCopy, packetSize, time );
+    }
+
+    void ThreadedNetworkSimulator::SendCreatedPacket( const Address & from, const Address & to, uint8_t * packetData, int packetSize, double time )
+    {
+        assert( m_allocator );
+
+        assert( from.IsValid() );
+        assert( to.IsValid() );
+
+        assert( packetData );
+        assert( packetSize > 0 );
+
+        Inbox * inbox = FindInbox( to, false );
+
+        const uint32_t sendSequence = (uint32_t) atomic_increment( &m_sendSequence );
+
+        if ( !inbox || !atomic_load( &inbox->open ) || RandomFloat( sendSequence, 0, 0.0f, 100.0f ) <= m_packetLoss )
+        {
+            ReleasePacket( packetData );
+            return;
+        }
+
+        double delay = m_latency / 1000.0;
+
+        if ( m_jitter > 0 )
+            delay += RandomFloat( sendSequence, 1, -m_jitter, +m_jitter ) / 1000.0;
+
+        // IMPORTANT: Copy the packet data for the duplicate before either packet is pushed, because the receiving thread can release the packet data as soon as it is pushed. Duplicates don't share the buffer here, since the reference count is not atomic.
+
+        uint8_t * duplicatePacketData = NULL;
+
+        if ( RandomFloat( sendSequence, 2, 0.0f, 100.0f ) <= m_duplicate )
+        {
+            duplicatePacketData = CreatePacket( packetSize );
+            if ( duplicatePacketData )
+                memcpy( duplicatePacketData, packetData, packetSize );
+        }
+
+        PushPacket( *inbox, from, packetData, packetSize, time + delay, sendSequence );
+
+        if ( duplicatePacketData )
+            PushPacket( *inbox, from, duplicatePacketData, packetSize, time + delay + RandomFloat( sendSequence, 3, 0.0f, 1.0f ), (uint32_t) atomic_increment( &m_sendSequence ) );
+    }
+
+    void ThreadedNetworkSimulator::PushPacket( Inbox & inbox, const Address & from, uint8_t * packetData, int packetSize, double deliveryTime, uint32_t sendSequence )
+    {
+        PacketEntry * entry = (PacketEntry*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( PacketEntry ) );
+        if ( !entry )
+        {
+            ReleasePacket( packetData );
+            return;
+        }
+
+        entry->from = from;
+        entry->deliveryTime = deliveryTime;
+        entry->sendSequence = sendSequence;
+        entry->packetData = packetData;
+        entry->packetSize = packetSize;
+
+        // IMPORTANT: The entry must be fully written before it is pushed, because the receiving thread can take it as soon as the compare and exchange succeeds.
+
+        while ( true )
+        {
+            void * head = atomic_load_pointer( &inbox.sendList );
+
+            entry->next = (PacketEntry*) head;
+
+            if ( atomic_compare_exchange_pointer( &inbox.sendList, head, entry ) )
+                break;
+        }
+    }
+
+    void ThreadedNetworkSimulator::UpdateDeliveryHeap( Inbox & inbox )
+    {
+        PacketEntry * entry = (PacketEntry*) atomic_exchange_pointer( &inbox.sendList, NULL );
+
+        while ( entry )
+        {
+            PacketEntry * next = entry->next;
+
+            if ( inbox.numPackets == m_numPacketsPerAddress )
+            {
+                FreePacketEntry( entry );
+                entry = next;
+                continue;
+            }
+
+            // sift the new packet up toward the root, until its parent is delivered before it
+
+            int position = inbox.numPackets++;
+
+            while ( position > 0 )
+            {
+                const int parent = ( position - 1 ) / 2;
+
+                if ( !IsDeliveredBefore( entry, inbox.deliveryHeap[parent] ) )
+                    break;
+
+                inbox.deliveryHeap[position] = inbox.deliveryHeap[parent];
+
+                position = parent;
+            }
+
+            inbox.deliveryHeap[position] = entry;
+
+            entry = next;
+        }
+    }
+
+    int ThreadedNetworkSimulator::ReceivePacketsSentToAddress( double time, int maxPackets, const Address & to, uint8_t * packetData[], int packetSize[], Address from[] )
+    {
+        Inbox * inbox = FindInbox( to, false );
+        if ( !inbox )
+            return 0;
+
+        UpdateDeliveryHeap( *inbox );
+
+        int numPackets = 0;
+
+        while ( numPackets < maxPackets && inbox->numPackets > 0 && inbox->deliveryHeap[0]->deliveryTime < time )
+        {
+            PacketEntry * entry = inbox->deliveryHeap[0];
+
+            packetData[numPackets] = entry->packetData;
+            packetSize[numPackets] = entry->packetSize;
+            from[numPackets] = entry->from;
+
+            numPackets++;
+
+            YOJIMBO_FREE( *m_allocator, entry );
+
+            // move the last packet into the root, then sift it down until it is delivered before both of its children
+
+            PacketEntry * last = inbox->deliveryHeap[--inbox->numPackets];
+
+            int position = 0;
+
+            while ( true )
+            {
+                int child = position * 2 + 1;
+
+                if ( child >= inbox->numPackets )
+                    break;
+
+                if ( child + 1 < inbox->numPackets && IsDeliveredBefore( inbox->deliveryHeap[child+1], inbox->deliveryHeap[child] ) )
+                    child++;
+
+                if ( !IsDeliveredBefore( inbox->deliveryHeap[child], last ) )
+                    break;
+
+                inbox->deliveryHeap[position] = inbox->deliveryHeap[child];
+
+                position = child;
+            }
+
+            inbox->deliveryHeap[position] = last;
+        }
+
+        return numPackets;
+    }
+
+    void ThreadedNetworkSimulator::DiscardPacketsSentToAddress( const Address & address )
+    {
+        Inbox * inbox = FindInbox( address, false );
+        if ( !inbox )
+            return;
+
+        PacketEntry * entry = (PacketEntry*) atomic_exchange_pointer( &inbox->sendList, NULL );
+
+        while ( entry )
+        {
+            PacketEntry * next = entry->next;
+            FreePacketEntry( entry );
+            entry = next;
+        }
+
+        for ( int i = 0; i < inbox->numPackets; ++i )
+        {
+            FreePacketEntry( inbox->deliveryHeap[i] );
+        }
+
+        inbox->numPackets = 0;
+    }
 }
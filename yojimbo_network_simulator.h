@@ -29,7 +29,9 @@
 #include "yojimbo_common.h"
 #include "yojimbo_address.h"
 #include "yojimbo_allocator.h"
+#include "yojimbo_address_map.h"
 #include "yojimbo_transport.h"
+#include "yojimbo_packet_capture.h"
 
 /** @file */
 
@@ -65,9 +67,10 @@ namespace yojimbo
 
             @param allocator The allocator to use.
             @param numPackets The maximum number of packets that can be stored in the simulator at any time.
+            @param numLinks The maximum number of sender addresses with their own link state for the bandwidth and burst loss models. Senders past this share a single link.
          */
 
-        NetworkSimulator( Allocator & allocator, int numPackets = 4096 );
+        NetworkSimulator( Allocator & allocator, int numPackets = 4096, int numLinks = 256 );
 
         /**
             Network simulator destructor.
@@ -115,16 +118,133 @@ namespace yojimbo
 
         void SetDuplicate( float percent );
 
+        /**
+            Set the bandwidth of each link in kilobits per second.
+
+            Each address sending packets has its own link. Packets sent on a link are transmitted one after the other at this rate, so packets sent faster than the link can carry wait in the link queue, and their latency increases. Latency and jitter are added on top of the time the packet spends in the queue.
+
+            @param kbps The link bandwidth in kilobits per second. 0 = unlimited bandwidth (default).
+
+            @see NetworkSimulator::SetQueueSize
+         */
+
+        void SetBandwidth( float kbps );
+
+        /**
+            Set the maximum number of bytes waiting for transmission on each link.
+
+            Packets sent when the link queue is full are dropped, like a router dropping packets when its buffer is full. Only applies when bandwidth is limited. See NetworkSimulator::SetBandwidth.
+
+            @param bytes The maximum number of bytes in the link queue. Defaults to 64k.
+         */
+
+        void SetQueueSize( int bytes );
+
+        /**
+            Set up bursts of correlated packet loss.
+
+            This is the Gilbert-Elliott model. Each link is either in the good state, where packets are lost at the rate set by NetworkSimulator::SetPacketLoss, or in the burst state, where packets are lost at the burst loss rate. On each packet sent, the link moves from the good state into the burst state with the enter percentage chance, and back out of it with the exit percentage chance.
+
+            The average burst is 100/exitPercent packets long.
+
+            @param enterPercent The percentage chance per-packet of a link entering the burst state. 0% = no bursts (default).
+            @param exitPercent The percentage chance per-packet of a link leaving the burst state.
+            @param lossPercent The packet loss percentage while in the burst state.
+         */
+
+        void SetBurstLoss( float enterPercent, float exitPercent, float lossPercent = 100.0f );
+
+        /**
+            Seed the random number generator used to simulate network conditions.
+
+            Each network simulator has its own random number generator, so two simulators with the same seed, network conditions and packets sent at the same times deliver exactly the same packets at the same times.
+
+            By default the generator is seeded with rand(), so network conditions differ from run to run.
+
+            @param seed The random seed.
+         */
+
+        void SetSeed( uint64_t seed );
+
+        /**
+            Record all packets sent and delivered into a packet capture.
+
+            IMPORTANT: The network simulator does not take ownership of the packet capture. It must stay valid until the simulator is destroyed, or the capture is cleared with SetPacketCapture( NULL ).
+
+            @param packetCapture The packet capture to record into, or NULL to stop recording.
+         */
+
+        void SetPacketCapture( PacketCapture * packetCapture );
+
+        /**
+            Replay packets delivered in a recorded packet capture.
+
+            While replaying, packets sent through the simulator are discarded, and each packet delivered in the capture is delivered again as soon as the simulator time reaches the time it was originally delivered.
+
+            IMPORTANT: The network simulator does not take ownership of the packet capture. It must stay valid until replay finishes or is stopped with SetPacketReplay( NULL ).
+
+            @param packetReplay The packet capture to replay, or NULL to stop replaying.
+
+            @see NetworkSimulator::IsReplayFinished
+         */
+
+        void SetPacketReplay( const PacketCapture * packetReplay );
+
+        /**
+            Has the packet replay delivered all packets in the capture?
+
+            @returns True if there is no packet replay set, or all packets in the replay have been delivered.
+         */
+
+        bool IsReplayFinished() const;
+
         /**
             Is the network simulator active?
 
-            The network simulator is active when packet loss, latency, duplicates or jitter are non-zero values.
+            The network simulator is active when packet loss, latency, duplicates, jitter, bandwidth or burst loss are non-zero values, or packets are being captured or replayed.
 
             This is used by the transport to know whether it should shunt packets through the simulator, or send them directly to the network. This is a minor optimization.
          */
 
         bool IsActive() const;
 
+        /**
+            Create a packet buffer to send through the network simulator.
+
+            Packet buffers are reference counted, so duplicate packets share one buffer instead of each having a copy of the packet data. They have one reference after creation. The buffer is rounded up to the next 4 bytes, so packets can be read in place with a bit reader.
+
+            @param packetSize The packet size (bytes).
+
+            @returns The packet buffer, or NULL if it could not be allocated.
+
+            @see NetworkSimulator::SendCreatedPacket
+            @see NetworkSimulator::ReleasePacket
+         */
+
+        uint8_t * CreatePacket( int packetSize );
+
+        /**
+            Release a reference to a packet buffer.
+
+            The packet buffer is freed when the last reference is released.
+
+            @param packetData The packet buffer created with NetworkSimulator::CreatePacket. May be NULL.
+         */
+
+        void ReleasePacket( uint8_t * packetData );
+
+        /**
+            Is a packet buffer shared with other packets?
+
+            Buffers are shared between a packet and its duplicates. Copy the packet data before modifying a shared buffer, eg. decrypting it in place, or the duplicates are modified too.
+
+            @param packetData The packet buffer created with NetworkSimulator::CreatePacket.
+
+            @returns True if the packet buffer has more than one reference.
+         */
+
+        bool IsPacketShared( const uint8_t * packetData ) const;
+
         /**
             Queue a packet up for send. 
 
@@ -134,14 +254,29 @@ namespace yojimbo
             @param to The address the packet is sent to.
             @param packetData The packet data.
             @param packetSize The packet size (bytes).
+
+            @see NetworkSimulator::SendCreatedPacket
          */
         
-        void SendPacket( const Address & from, const Address & to, uint8_t * packetData, int packetSize );
+        void SendPacket( const Address & from, const Address & to, const uint8_t * packetData, int packetSize );
+
+        /**
+            Queue a packet buffer up for send without copying it.
+
+            IMPORTANT: The reference to the packet buffer is transferred to the network simulator. It must be created with NetworkSimulator::CreatePacket.
+
+            @param from The address the packet is sent from.
+            @param to The address the packet is sent to.
+            @param packetData The packet buffer created with NetworkSimulator::CreatePacket.
+            @param packetSize The packet size (bytes).
+         */
+
+        void SendCreatedPacket( const Address & from, const Address & to, uint8_t * packetData, int packetSize );
 
         /**
             Receive packets sent to any address.
 
-            IMPORTANT: You take ownership of the packet data you receive and are responsible for freeing it. See NetworkSimulator::GetAllocator.
+            IMPORTANT: You take a reference to the packet buffers you receive and are responsible for releasing them with NetworkSimulator::ReleasePacket.
 
             @param maxPackets The maximum number of packets to receive.
             @param packetData Array of packet data pointers to be filled [out].
@@ -157,7 +292,7 @@ namespace yojimbo
         /** 
             Receive packets sent to a specified address.
 
-            IMPORTANT: You take ownership of the packet data you receive and are responsible for freeing it. See NetworkSimulator::GetAllocator.
+            IMPORTANT: You take a reference to the packet buffers you receive and are responsible for releasing them with NetworkSimulator::ReleasePacket.
 
             @param maxPackets The maximum number of packets to receive.
             @param to Only packets sent to this address will be received.
@@ -197,9 +332,19 @@ namespace yojimbo
         void AdvanceTime( double time );
 
         /**
-            Get the allocator to use to free packet data.
+            Get the time the next packet in the network simulator is delivered.
+
+            Packets are ready to receive after the first call to NetworkSimulator::AdvanceTime with a time later than this. Use this to drive the simulator in virtual time, jumping straight to the next delivery instead of stepping time in small increments.
+
+            @returns The delivery time of the next packet sent through the simulator or in the packet replay, or NoEventTime if there are no packets left to deliver.
+         */
+
+        double GetNextDeliveryTime() const;
+
+        /**
+            Get the allocator that packet buffers are allocated with.
 
-            @returns The allocator that packet data is allocated with.
+            @returns The allocator that packet buffers are allocated with.
          */
 
         Allocator & GetAllocator() { assert( m_allocator ); return *m_allocator; }
@@ -214,6 +359,31 @@ namespace yojimbo
 
         void UpdateActive();
 
+        /**
+            Generate a random float between a and b with the network simulator random number generator.
+
+            @param a The minimum value.
+            @param b The maximum value.
+
+            @returns A pseudo random float value in [a,b].
+
+            @see NetworkSimulator::SetSeed
+         */
+
+        float RandomFloat( float a, float b );
+
+        /**
+            Get the link carrying packets sent from an address.
+
+            A new link is set up the first time an address sends a packet. Once all links are in use, addresses without a link share the last one.
+
+            @param from The address sending the packet.
+
+            @returns The index of the link in the link array.
+         */
+
+        int GetLinkIndex( const Address & from );
+
         /**
             Packets ready to be received are removed from the main simulator buffer and put into pending receive packet arrays by this function.
 
@@ -222,6 +392,35 @@ namespace yojimbo
 
         void UpdatePendingReceivePackets();
 
+        /**
+            Is the packet in one slot due for delivery before the packet in another slot?
+
+            Packets with the same delivery time are ordered by when they were sent, so packets sent with no latency are received in order.
+
+            @param a The first packet slot index.
+            @param b The second packet slot index.
+
+            @returns True if the packet in slot a should be delivered before the packet in slot b.
+         */
+
+        bool IsDeliveredBefore( int a, int b ) const;
+
+        /// Add a packet slot to the delivery heap.
+
+        void AddToDeliveryHeap( int slot );
+
+        /// Remove a packet slot from the delivery heap. The slot must be in the heap.
+
+        void RemoveFromDeliveryHeap( int slot );
+
+        /// Move the entry at a heap position up toward the root, until its parent is delivered before it.
+
+        void SiftUpDeliveryHeap( int position );
+
+        /// Move the entry at a heap position down toward the leaves, until it is delivered before both of its children.
+
+        void SiftDownDeliveryHeap( int position );
+
     private:
 
         Allocator * m_allocator;                        ///< The allocator passed in to the constructor. It's used to allocate and free packet data.
@@ -234,8 +433,26 @@ namespace yojimbo
 
         float m_duplicate;                              ///< Duplicate packet percentage
 
+        float m_bandwidth;                              ///< Link bandwidth in kilobits per second. 0 for unlimited.
+
+        int m_queueSize;                                ///< Maximum bytes waiting for transmission on each link.
+
+        float m_burstEnter;                             ///< Percentage chance per-packet of a link entering the burst loss state.
+
+        float m_burstExit;                              ///< Percentage chance per-packet of a link leaving the burst loss state.
+
+        float m_burstLoss;                              ///< Packet loss percentage in the burst loss state.
+
         bool m_active;                                  ///< True if network simulator is active, eg. if any of the network settings above are enabled.
 
+        uint64_t m_randomState;                         ///< State of the xorshift random number generator used to simulate network conditions. See NetworkSimulator::SetSeed.
+
+        PacketCapture * m_packetCapture;                ///< Packets sent and delivered are recorded into this capture, if not NULL.
+
+        const PacketCapture * m_packetReplay;           ///< Packets delivered are replayed from this capture instead of being simulated, if not NULL.
+
+        int m_packetReplayIndex;                        ///< Index of the next packet in the replay capture to consider for delivery.
+
         /// A packet buffered in the network simulator.
 
         struct PacketEntry
@@ -243,6 +460,7 @@ namespace yojimbo
             PacketEntry()
             {
                 deliveryTime = 0.0;
+                sendSequence = 0;
                 packetData = NULL;
                 packetSize = 0;
             }
@@ -250,10 +468,25 @@ namespace yojimbo
             Address from;                               ///< Address the packet was sent from.
             Address to;                                 ///< Address the packet should be sent to.
             double deliveryTime;                        ///< Delivery time for this packet (seconds).
-            uint8_t * packetData;                       ///< Packet data (owns this pointer).
+            uint64_t sendSequence;                      ///< Incremented for each packet sent. Breaks ties between packets with the same delivery time, so they are received in the order they were sent.
+            uint8_t * packetData;                       ///< Packet buffer. Holds a reference to it. See NetworkSimulator::CreatePacket.
             int packetSize;                             ///< Size of packet in bytes.
         };
 
+        /// The state of the link carrying packets sent from one address.
+
+        struct Link
+        {
+            double busyUntil;                           ///< Time the link finishes transmitting the packets already queued on it. The queue is empty once time passes this.
+            bool burst;                                 ///< True if the link is in the burst loss state.
+        };
+
+        int m_maxLinks;                                 ///< The maximum number of links. One extra link is shared by addresses sending once all the others are in use.
+
+        Link * m_links;                                 ///< Array of link states.
+
+        AddressMap * m_linkAddressMap;                  ///< Maps each sending address to its link index.
+
         double m_time;                                  ///< Current time from last call to advance time.
 
         int m_currentIndex;                             ///< Current index in the packet entry array. New packets are inserted here.
@@ -262,12 +495,333 @@ namespace yojimbo
 
         PacketEntry * m_packetEntries;                  ///< Pointer to dynamically allocated packet entries. This is where buffered packets are stored.
 
+        uint64_t m_sendSequence;                        ///< The send sequence for the next packet sent. See PacketEntry::sendSequence.
+
+        int m_deliveryHeapSize;                         ///< The number of packet slots in the delivery heap.
+
+        int * m_deliveryHeap;                           ///< Binary min-heap of packet slot indices, ordered by delivery time. The next packet to deliver is always at the root, so each update only touches packets that are ready to be delivered.
+
+        int * m_deliveryHeapPosition;                   ///< The position of each packet slot in the delivery heap, or -1 if the slot is empty. Lets packets be removed from anywhere in the heap when their slot is overwritten or discarded.
+
         int m_numPendingReceivePackets;                 ///< Number of pending receive packets. This is an optimization to make receiving packets sent to an address faster.
 
         PacketEntry * m_pendingReceivePackets;          ///< List of packets pending receive. Updated each time you call NetworkSimulator::AdvanceTime.
 
+        int * m_pendingReceiveNext;                     ///< Index of the next pending receive packet sent to the same address, or -1 at the end of the list. Links pending receive packets into per-address lists.
+
+        AddressMap * m_pendingReceiveAddressMap;        ///< Maps each address with pending receive packets to the first pending receive packet sent to that address. Lets NetworkSimulator::ReceivePacketsSentToAddress walk only the packets sent to that address.
+
         double m_lastPendingReceiveTime;                ///< Time of last pending receive. Work-around multiple simulator updates when the simulator is set on multiple local transports.
     };
+
+    /**
+        Simulates packet loss, latency, jitter and duplicate packets between transports running on different threads.
+
+        This is the concurrent version of NetworkSimulator, for soak and load tests that spread clients and servers across threads. Any thread can send packets to any address, and each address has its own inbox that only the thread receiving packets for that address reads from.
+
+        Each inbox is a lock-free multiple producer, single consumer list. Senders push packets onto it with a compare and exchange, and the receiving thread takes the whole list at once when it receives, then keeps the packets in a private heap ordered by delivery time. Packets with the same delivery time are received in the order they were sent, just like NetworkSimulator.
+
+        There is no shared time for the simulator. Packets are timestamped with the sender's time on send and delivered once the receiver's time passes their delivery time, so all threads must use the same time base.
+
+        Packet loss, latency, jitter and duplicates are applied exactly like NetworkSimulator. The random numbers are derived from the seed and a global send sequence number, so no random number generator state is shared between threads.
+
+        IMPORTANT: Packet buffers are created on the sending thread and released on the receiving thread, so the allocator must be safe to use from multiple threads, eg. ThreadedTLSF_Allocator.
+
+        IMPORTANT: Set network conditions before any threads start sending packets. They are read without synchronization.
+
+        @see ThreadedLocalTransport
+     */
+
+    class ThreadedNetworkSimulator
+    {
+    public:
+
+        /**
+            Create a threaded network simulator.
+
+            Initial network conditions are the same as NetworkSimulator: no latency, jitter, packet loss or duplicates.
+
+            @param allocator The allocator to use. Must be thread safe.
+            @param maxAddresses The maximum number of addresses that can receive packets. See ThreadedNetworkSimulator::AddAddress.
+            @param numPacketsPerAddress The maximum number of packets in flight to each address. Packets sent to an address with a full inbox are dropped.
+         */
+
+        ThreadedNetworkSimulator( Allocator & allocator, int maxAddresses = 1024, int numPacketsPerAddress = 1024 );
+
+        /**
+            Threaded network simulator destructor.
+
+            Any packet data still in the simulator is destroyed. Make sure no other thread is still sending or receiving packets.
+         */
+
+        ~ThreadedNetworkSimulator();
+
+        /// Set the latency in milliseconds. See NetworkSimulator::SetLatency.
+
+        void SetLatency( float milliseconds );
+
+        /// Set the packet jitter in milliseconds. See NetworkSimulator::SetJitter.
+
+        void SetJitter( float milliseconds );
+
+        /// Set the amount of packet loss to apply on send. See NetworkSimulator::SetPacketLoss.
+
+        void SetPacketLoss( float percent );
+
+        /// Set percentage chance of packet duplicates. See NetworkSimulator::SetDuplicate.
+
+        void SetDuplicate( float percent );
+
+        /**
+            Seed the random numbers used to simulate network conditions.
+
+            Packets sent in the same order with the same seed see the same network conditions. With more than one thread sending, the order packets are sent in depends on thread scheduling.
+
+            @param seed The random seed.
+         */
+
+        void SetSeed( uint64_t seed );
+
+        /**
+            Start receiving packets sent to an address.
+
+            Packets sent to an address that hasn't been added are dropped, like packets sent to an address with nobody listening. Can be called from any thread.
+
+            @param address The address to receive packets for.
+
+            @returns True if the address was added, false if the simulator already has the maximum number of addresses.
+         */
+
+        bool AddAddress( const Address & address );
+
+        /**
+            Stop receiving packets sent to an address.
+
+            Packets already sent to the address are discarded, and packets sent to it from now on are dropped. Call this from the thread receiving packets for the address.
+
+            @param address The address to stop receiving packets for.
+         */
+
+        void RemoveAddress( const Address & address );
+
+        /**
+            Create a packet buffer to send through the network simulator.
+
+            Packet buffers are the same as NetworkSimulator packet buffers. Can be called from any thread.
+
+            @param packetSize The packet size (bytes).
+
+            @returns The packet buffer, or NULL if it could not be allocated.
+
+            @see ThreadedNetworkSimulator::SendCreatedPacket
+            @see ThreadedNetworkSimulator::ReleasePacket
+         */
+
+        uint8_t * CreatePacket( int packetSize );
+
+        /**
+            Release a reference to a packet buffer.
+
+            Duplicate packets get their own copy of the packet buffer, so received buffers are never shared between threads.
+
+            @param packetData The packet buffer created with ThreadedNetworkSimulator::CreatePacket. May be NULL.
+         */
+
+        void ReleasePacket( uint8_t * packetData );
+
+        /**
+            Queue a packet up for send.
+
+            Can be called from any thread.
+
+            IMPORTANT: Ownership of the packet data pointer is *not* transferred to the network simulator. It makes a copy of the data instead.
+
+            @param from The address the packet is sent from.
+            @param to The address the packet is sent to.
+            @param packetData The packet data.
+            @param packetSize The packet size (bytes).
+            @param time The current time on the sending thread.
+
+            @see ThreadedNetworkSimulator::SendCreatedPacket
+         */
+
+        void SendPacket( const Address & from, const Address & to, const uint8_t * packetData, int packetSize, double time );
+
+        /**
+            Queue a packet buffer up for send without copying it.
+
+            Can be called from any thread.
+
+            IMPORTANT: The reference to the packet buffer is transferred to the network simulator. It must be created with ThreadedNetworkSimulator::CreatePacket.
+
+            @param from The address the packet is sent from.
+            @param to The address the packet is sent to.
+            @param packetData The packet buffer created with ThreadedNetworkSimulator::CreatePacket.
+            @param packetSize The packet size (bytes).
+            @param time The current time on the sending thread.
+         */
+
+        void SendCreatedPacket( const Address & from, const Address & to, uint8_t * packetData, int packetSize, double time );
+
+        /**
+            Receive packets sent to an address that are due for delivery.
+
+            Only one thread may receive packets for an address at a time.
+
+            IMPORTANT: You take a reference to the packet buffers you receive and are responsible for releasing them with ThreadedNetworkSimulator::ReleasePacket.
+
+            @param time The current time on the receiving thread. Packets with a delivery time before this time are received.
+            @param maxPackets The maximum number of packets to receive.
+            @param to Only packets sent to this address will be received.
+            @param packetData Array of packet data pointers to be filled [out].
+            @param packetSize Array of packet sizes to be filled [out].
+            @param from Array of from addresses to be filled [out].
+
+            @returns The number of packets received.
+         */
+
+        int ReceivePacketsSentToAddress( double time, int maxPackets, const Address & to, uint8_t * packetData[], int packetSize[], Address from[] );
+
+        /**
+            Discard all packets sent to an address that have not been received yet.
+
+            Call this from the thread receiving packets for the address.
+
+            @param address Packets sent to this address will be discarded.
+         */
+
+        void DiscardPacketsSentToAddress( const Address & address );
+
+        /**
+            Get the allocator the network simulator uses.
+
+            @returns The allocator that packet buffers and packet entries are allocated with.
+         */
+
+        Allocator & GetAllocator() { assert( m_allocator ); return *m_allocator; }
+
+    protected:
+
+        /// A packet sent to an inbox. Linked into the inbox send list by the sender, then moved into the inbox delivery heap by the receiver.
+
+        struct PacketEntry
+        {
+            PacketEntry * next;                         ///< The next packet in the inbox send list.
+            Address from;                               ///< Address the packet was sent from.
+            double deliveryTime;                        ///< Delivery time for this packet (seconds).
+            uint32_t sendSequence;                      ///< Global send sequence number. Breaks ties between packets with the same delivery time, so they are received in the order they were sent.
+            uint8_t * packetData;                       ///< Packet buffer. Holds a reference to it. See ThreadedNetworkSimulator::CreatePacket.
+            int packetSize;                             ///< Size of packet in bytes.
+        };
+
+        /// Inbox state. An inbox goes from free to claiming to claimed when an address is first added, and stays claimed for the life of the simulator.
+
+        enum InboxState
+        {
+            INBOX_FREE,                                 ///< The inbox slot is not used.
+            INBOX_CLAIMING,                             ///< A thread is in the middle of adding an address to this inbox slot.
+            INBOX_CLAIMED                               ///< The inbox slot belongs to an address.
+        };
+
+        /// Packets in flight to one address.
+
+        struct Inbox
+        {
+            Address address;                            ///< The address receiving packets. Only valid once the inbox is claimed.
+            int state;                                  ///< The inbox state. See InboxState. Accessed with atomics.
+            int open;                                   ///< 1 while the address is receiving packets, 0 after it is removed. Accessed with atomics.
+            void * sendList;                            ///< Head of the lock-free list of packets sent to this address but not yet moved into the delivery heap. Pushed by any thread, taken all at once by the receiver.
+            int numPackets;                             ///< The number of packets in the delivery heap. Only accessed by the receiver.
+            PacketEntry ** deliveryHeap;                ///< Binary min-heap of packets ordered by delivery time. Only accessed by the receiver.
+        };
+
+        /**
+            Find the inbox for an address.
+
+            @param address The address.
+            @param add If true, claim a free inbox for the address if it doesn't have one yet.
+
+            @returns The inbox for the address, or NULL if there is none.
+         */
+
+        Inbox * FindInbox( const Address & address, bool add );
+
+        /**
+            Push a packet onto the send list of an inbox.
+
+            @param inbox The inbox of the address the packet is sent to.
+            @param from The address the packet is sent from.
+            @param packetData The packet buffer. The reference is transferred to the inbox.
+            @param packetSize The packet size (bytes).
+            @param deliveryTime The time the packet should be delivered.
+            @param sendSequence The send sequence number of the packet.
+         */
+
+        void PushPacket( Inbox & inbox, const Address & from, uint8_t * packetData, int packetSize, double deliveryTime, uint32_t sendSequence );
+
+        /**
+            Take packets sent to an inbox and add them to its delivery heap.
+
+            Packets that don't fit in the delivery heap are dropped.
+
+            @param inbox The inbox.
+         */
+
+        void UpdateDeliveryHeap( Inbox & inbox );
+
+        /// Is packet a delivered before packet b?
+
+        static bool IsDeliveredBefore( const PacketEntry * a, const PacketEntry * b );
+
+        /// Free a packet entry and release its packet buffer.
+
+        void FreePacketEntry( PacketEntry * entry );
+
+        /**
+            Generate a random float between a and b for a packet send.
+
+            @param sendSequence The send sequence number of the packet.
+            @param index Identifies which random number this is for the packet, so each random number for one send is different.
+            @param a The minimum value.
+            @param b The maximum value.
+
+            @returns A pseudo random float value in [a,b].
+         */
+
+        float RandomFloat( uint32_t sendSequence, int index, float a, float b ) const;
+
+    private:
+
+        Allocator * m_allocator;                        ///< The allocator passed in to the constructor. It's used to allocate and free packet data.
+
+        float m_latency;                                ///< Latency in milliseconds
+
+        float m_jitter;                                 ///< Jitter in milliseconds +/-
+
+        float m_packetLoss;                             ///< Packet loss percentage.
+
+        float m_duplicate;                              ///< Duplicate packet percentage
+
+        uint64_t m_seed;                                ///< The random seed. See ThreadedNetworkSimulator::SetSeed.
+
+        int m_sendSequence;                             ///< The send sequence for the next packet sent. Incremented with atomic_increment.
+
+        int m_maxAddresses;                             ///< The maximum number of addresses that can be added.
+
+        int m_numAddresses;                             ///< The number of addresses added so far. Incremented with atomic_increment. Each new address takes the next delivery heap.
+
+        int m_numPacketsPerAddress;                     ///< The size of the delivery heap in each inbox.
+
+        uint32_t m_inboxMask;                           ///< The number of inbox slots minus one. Inboxes are open addressed by address hash with linear probing.
+
+        Inbox * m_inboxes;                              ///< The inbox hash table. The number of slots is the next power of two at least twice the maximum number of addresses, so probes stay short.
+
+        PacketEntry ** m_deliveryHeaps;                 ///< Storage for the delivery heaps, one per-address added.
+
+        ThreadedNetworkSimulator( const ThreadedNetworkSimulator & other );
+
+        ThreadedNetworkSimulator & operator = ( const ThreadedNetworkSimulator & other );
+    };
 }
 
 #endif // #ifndef YOJIMBO_NETWORK_SIMULATOR_H
@@ -238,24 +238,44 @@ cleanup:
         m_error = PACKET_FACTORY_ERROR_NONE;
         m_numPacketTypes = numPacketTypes;
         m_allocator = &allocator;
+        m_pools = (PacketPool*) YOJIMBO_ALLOCATE( allocator, sizeof( PacketPool ) * numPacketTypes );
+        if ( m_pools )
+            memset( m_pools, 0, sizeof( PacketPool ) * numPacketTypes );
     }
 
     PacketFactory::~PacketFactory()
     {
 #if YOJIMBO_DEBUG_PACKET_LEAKS
-        if ( allocated_packets.size() )
+        if ( allocated_packets.GetNumLive() )
         {
             assert( false );
             printf( "you leaked packets!\n" );
-            printf( "%d packets leaked\n", (int) allocated_packets.size() );
-            typedef std::map<void*,int>::iterator itor_type;
-            for ( itor_type i = allocated_packets.begin(); i != allocated_packets.end(); ++i ) 
-            {
-                printf( "leaked packet %p (type %d)\n", i->first, i->second );
-            }
+            allocated_packets.Report( "packets" );
             exit(1);
         }
 #endif // #if YOJIMBO_DEBUG_PACKET_LEAKS
+
+        if ( m_pools )
+        {
+            for ( int i = 0; i < m_numPacketTypes; ++i )
+            {
+                PacketPool & pool = m_pools[i];
+
+                for ( int j = 0; j < pool.numFreeSlots; ++j )
+                {
+                    const int slot = pool.freeSlots[j];
+                    if ( pool.recycled[slot] )
+                    {
+                        Packet * packet = (Packet*) ( pool.data + slot * pool.slotSize );
+                        packet->~Packet();
+                    }
+                }
+
+                YOJIMBO_FREE( *m_allocator, pool.data );
+            }
+
+            YOJIMBO_FREE( *m_allocator, m_pools );
+        }
     }
 
     Packet * PacketFactory::Create( int type )
@@ -272,8 +292,7 @@ cleanup:
         }
 
 #if YOJIMBO_DEBUG_PACKET_LEAKS
-        allocated_packets[packet] = type;
-        assert( allocated_packets.find( packet ) != allocated_packets.end() );
+        allocated_packets.Add( packet, 0, NULL, type );
 #endif // #if YOJIMBO_DEBUG_PACKET_LEAKS
         
         return packet;
@@ -286,11 +305,85 @@ cleanup:
             return;
 
 #if YOJIMBO_DEBUG_PACKET_LEAKS
-        assert( allocated_packets.find( packet ) != allocated_packets.end() );
-        allocated_packets.erase( packet );
+        allocated_packets.Remove( packet );
 #endif // #if YOJIMBO_DEBUG_PACKET_LEAKS
 
-        YOJIMBO_DELETE( *m_allocator, Packet, packet );
+        PacketPool * pool = FindPool( packet );
+
+        if ( pool )
+        {
+            const int slot = int( ( (uint8_t*) packet - pool->data ) / pool->slotSize );
+
+            if ( packet->Recycle() )
+                pool->recycled[slot] = 1;
+            else
+                packet->~Packet();
+
+            pool->freeSlots[pool->numFreeSlots++] = slot;
+        }
+        else
+        {
+            YOJIMBO_DELETE( *m_allocator, Packet, packet );
+        }
+    }
+
+    PacketPool * PacketFactory::GetPool( int type, int packetSize, int poolSize )
+    {
+        assert( type >= 0 );
+        assert( type < m_numPacketTypes );
+        assert( poolSize > 0 );
+
+        if ( !m_pools )
+            return NULL;
+
+        PacketPool & pool = m_pools[type];
+
+        if ( pool.data )
+        {
+            assert( pool.slotSize >= packetSize );
+            return &pool;
+        }
+
+        // IMPORTANT: slots, free slot stack and recycled flags are carved out of one allocation. slot size is a multiple of 16 so the stack after the slots stays aligned.
+
+        const int slotSize = ( packetSize + 15 ) & ~15;
+
+        pool.data = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, ( slotSize + sizeof( int ) + 1 ) * poolSize );
+        if ( !pool.data )
+            return NULL;
+
+        pool.freeSlots = (int*) ( pool.data + slotSize * poolSize );
+        pool.recycled = (uint8_t*) ( pool.freeSlots + poolSize );
+        pool.slotSize = slotSize;
+        pool.numSlots = poolSize;
+        pool.numFreeSlots = poolSize;
+
+        for ( int i = 0; i < poolSize; ++i )
+            pool.freeSlots[i] = poolSize - 1 - i;
+
+        memset( pool.recycled, 0, poolSize );
+
+        return &pool;
+    }
+
+    PacketPool * PacketFactory::FindPool( Packet * packet )
+    {
+        if ( !m_pools )
+            return NULL;
+
+        const int type = packet->GetType();
+
+        assert( type >= 0 );
+        assert( type < m_numPacketTypes );
+
+        PacketPool & pool = m_pools[type];
+
+        const uint8_t * p = (const uint8_t*) packet;
+
+        if ( p < pool.data || p >= pool.data + pool.slotSize * pool.numSlots )
+            return NULL;
+
+        return &pool;
     }
 
     int PacketFactory::GetNumPacketTypes() const
@@ -30,10 +30,7 @@
 #include "yojimbo_bitpack.h"
 #include "yojimbo_stream.h"
 #include "yojimbo_serialize.h"
-
-#if YOJIMBO_DEBUG_PACKET_LEAKS
-#include <map>
-#endif // #if YOJIMBO_DEBUG_PACKET_LEAKS
+#include "yojimbo_allocator.h"
 
 /** @file */
 
@@ -129,6 +126,20 @@ namespace yojimbo
 
         virtual ~Packet() { m_packetFactory = NULL; m_type = -1; }
 
+        /**
+            Recycle the packet so it can be reused.
+
+            Called by the packet factory when a packet of a pooled packet type is destroyed. Return true if the packet has been restored to the state it has after construction, and it is kept alive in the pool and handed out again by PacketFactory::Create without being constructed again. Return false to have the packet destructed as usual, so only its memory is reused.
+
+            Override this to keep memory owned by the packet between uses, instead of freeing it in the destructor and allocating it again for the next packet.
+
+            @returns True if the packet was recycled, false if it should be destructed. The default implementation returns false.
+
+            @see YOJIMBO_DECLARE_POOLED_PACKET_TYPE
+         */
+
+        virtual bool Recycle() { return false; }
+
     private:
 
         PacketFactory * m_packetFactory;                                    ///< The factory that was used to create this packet. Used by Packet::Destroy to ensure that the packet is cleaned up by the factory that created it.
@@ -156,6 +167,22 @@ namespace yojimbo
         PACKET_FACTORY_ERROR_FAILED_TO_ALLOCATE_PACKET,                     ///< Tried to allocate a packet but failed. The allocator backing the packet factory is probably out of memory.
     };
 
+    /**
+        A fixed size pool of packets of one type.
+
+        Used for packet types declared with YOJIMBO_DECLARE_POOLED_PACKET_TYPE. Each slot either holds raw memory, or a packet object that was recycled with Packet::Recycle and is ready to be handed out again without being constructed.
+     */
+
+    struct PacketPool
+    {
+        uint8_t * data;                                                     ///< The memory backing the pool slots. NULL until the first packet of this type is created.
+        int * freeSlots;                                                    ///< Stack of free slot indices.
+        uint8_t * recycled;                                                 ///< Per-slot flag. 1 if the slot holds a recycled packet object, 0 if the slot is raw memory.
+        int slotSize;                                                       ///< The size of each slot in bytes. This is the packet size rounded up for alignment.
+        int numSlots;                                                       ///< The number of slots in the pool.
+        int numFreeSlots;                                                   ///< The number of free slots on top of the free slot stack.
+    };
+
     /**
         Defines the set of packet types and a function to create packets.
 
@@ -294,10 +321,66 @@ namespace yojimbo
 
         virtual Packet * CreatePacket( int type ) { (void) type; return NULL; }
 
+        /**
+            Create a packet from the pool for its type.
+
+            This is called from the packet factory CreatePacket generated by YOJIMBO_DECLARE_POOLED_PACKET_TYPE. The pool is allocated the first time a packet of that type is created.
+
+            If all slots in the pool are in use, or the pool could not be allocated, the packet is created with the allocator instead, so an undersized pool costs performance, not correctness.
+
+            @param type The packet type.
+            @param poolSize The number of packets of this type that can exist in the pool at the same time.
+
+            @returns The packet created, or NULL if the packet could not be allocated.
+         */
+
+        template <typename T> T * CreatePooledPacket( int type, int poolSize )
+        {
+            PacketPool * pool = GetPool( type, sizeof( T ), poolSize );
+
+            if ( !pool || pool->numFreeSlots == 0 )
+                return YOJIMBO_NEW( *m_allocator, T );
+
+            const int slot = pool->freeSlots[--pool->numFreeSlots];
+
+            void * packet = pool->data + slot * pool->slotSize;
+
+            if ( pool->recycled[slot] )
+            {
+                pool->recycled[slot] = 0;
+                return (T*) packet;
+            }
+
+            return new ( packet ) T();
+        }
+
     private:
 
+        /**
+            Get the pool for a packet type, allocating it if this is the first packet of that type.
+
+            @param type The packet type.
+            @param packetSize The size of the packet class stored in the pool (bytes).
+            @param poolSize The number of slots in the pool.
+
+            @returns The packet pool, or NULL if the allocator is out of memory.
+         */
+
+        PacketPool * GetPool( int type, int packetSize, int poolSize );
+
+        /**
+            Find the pool that a packet was created from.
+
+            @param packet The packet.
+
+            @returns The pool the packet belongs to, or NULL if the packet was created with the allocator.
+         */
+
+        PacketPool * FindPool( Packet * packet );
+
+
 #if YOJIMBO_DEBUG_PACKET_LEAKS
-        std::map<void*,int> allocated_packets;                                          ///< Tracks packets created by this packet factory. Used in debug builds to check that all packets created by the factory are destroyed before the packet factory is destroyed.
+        LeakTracker allocated_packets;                                                  ///< Tracks packets created by this packet factory. Used in debug builds to check that all packets created by the factory are destroyed before the packet factory is destroyed.
 #endif // #if YOJIMBO_DEBUG_PACKET_LEAKS
 
         Allocator * m_allocator;                                                        ///< The allocator used to create and destroy packet objects.
@@ -305,6 +388,8 @@ namespace yojimbo
         PacketFactoryError m_error;                                                     ///< The error level. Used to track failed packet allocations and take action.
 
         int m_numPacketTypes;                                                           ///< The number of packet types that can be created with this factory. Valid packet types are in range [0,m_numPacketTypes-1].
+
+        PacketPool * m_pools;                                                           ///< Packet pools indexed by packet type. Only used by types declared with YOJIMBO_DECLARE_POOLED_PACKET_TYPE.
         
         PacketFactory( const PacketFactory & other );
         
@@ -449,6 +534,28 @@ namespace yojimbo
                     SetPacketFactory( packet );                                                                     \
                     return packet;        
 
+/** 
+    Add a pooled packet type to a packet factory.
+
+    Packets of this type are created from a fixed size pool owned by the packet factory, instead of being allocated and freed individually. Packets that override Packet::Recycle are kept alive in the pool between uses.
+
+    @param packet_type The packet type value. This is typically an enum value.
+    @param packet_class The packet class to instantiate when a packet of this type is created.
+    @param pool_size The number of packets of this type that can exist at the same time before falling back to the allocator.
+
+    See yojimbo_client_server_packets.h for an example of usage.
+ */
+
+#define YOJIMBO_DECLARE_POOLED_PACKET_TYPE( packet_type, packet_class, pool_size )                                  \
+                                                                                                                    \
+                case packet_type:                                                                                   \
+                    packet = CreatePooledPacket<packet_class>( packet_type, pool_size );                            \
+                    if ( !packet )                                                                                  \
+                        return NULL;                                                                                \
+                    SetPacketType( packet, packet_type );                                                           \
+                    SetPacketFactory( packet );                                                                     \
+                    return packet;        
+
 /** 
     Finish the definition of a new packet factory.
 
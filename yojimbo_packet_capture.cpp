@@ -0,0 +1,202 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_config.h"
+#include "yojimbo_packet_capture.h"
+#include "yojimbo_stream.h"
+#include "yojimbo_serialize.h"
+
+namespace yojimbo
+{
+    PacketCapture::PacketCapture( Allocator & allocator, int maxPackets, int maxBytes )
+    {
+        assert( maxPackets > 0 );
+        assert( maxBytes > 0 );
+
+        m_allocator = &allocator;
+        m_maxPackets = maxPackets;
+        m_maxBytes = maxBytes;
+        m_packets = (PacketCaptureEntry*) YOJIMBO_ALLOCATE( allocator, sizeof( PacketCaptureEntry ) * maxPackets );
+        m_data = (uint8_t*) YOJIMBO_ALLOCATE( allocator, maxBytes );
+
+        Clear();
+    }
+
+    PacketCapture::~PacketCapture()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_packets );
+        YOJIMBO_FREE( *m_allocator, m_data );
+
+        m_allocator = NULL;
+    }
+
+    void PacketCapture::Clear()
+    {
+        m_numPackets = 0;
+        m_numBytes = 0;
+        m_numDroppedPackets = 0;
+    }
+
+    bool PacketCapture::AddPacket( PacketCaptureEventType type, double time, const Address & from, const Address & to, const uint8_t * packetData, int packetBytes )
+    {
+        assert( type >= 0 );
+        assert( type < PACKET_CAPTURE_NUM_EVENT_TYPES );
+        assert( packetData );
+        assert( packetBytes > 0 );
+
+        if ( m_numPackets == m_maxPackets || m_numBytes + packetBytes > m_maxBytes )
+        {
+            m_numDroppedPackets++;
+            return false;
+        }
+
+        PacketCaptureEntry & entry = m_packets[m_numPackets++];
+
+        entry.type = type;
+        entry.time = time;
+        entry.from = from;
+        entry.to = to;
+        entry.packetBytes = packetBytes;
+        entry.dataOffset = m_numBytes;
+
+        memcpy( m_data + m_numBytes, packetData, packetBytes );
+
+        m_numBytes += packetBytes;
+
+        return true;
+    }
+
+    template <typename Stream> bool PacketCapture::Serialize( Stream & stream )
+    {
+        uint32_t magic = PacketCaptureMagic;
+        uint32_t version = PacketCaptureVersion;
+
+        serialize_uint32( stream, magic );
+        serialize_uint32( stream, version );
+
+        if ( Stream::IsReading && ( magic != PacketCaptureMagic || version != PacketCaptureVersion ) )
+            return false;
+
+        // IMPORTANT: Counts and sizes are written as full 32 bit values, not bounded by the capture limits. This way the format doesn't depend on the limits of the capture that saved it.
+
+        uint32_t numPackets = m_numPackets;
+
+        serialize_uint32( stream, numPackets );
+
+        if ( Stream::IsReading && numPackets > uint32_t( m_maxPackets ) )
+            return false;
+
+        int numBytes = 0;
+
+        for ( int i = 0; i < int( numPackets ); ++i )
+        {
+            PacketCaptureEntry & entry = m_packets[i];
+
+            int type = entry.type;
+            uint32_t packetBytes = entry.packetBytes;
+
+            serialize_int( stream, type, 0, PACKET_CAPTURE_NUM_EVENT_TYPES - 1 );
+            serialize_double( stream, entry.time );
+            serialize_address( stream, entry.from );
+            serialize_address( stream, entry.to );
+            serialize_uint32( stream, packetBytes );
+
+            if ( Stream::IsReading )
+            {
+                if ( packetBytes == 0 || packetBytes > uint32_t( m_maxBytes - numBytes ) )
+                    return false;
+
+                entry.type = (PacketCaptureEventType) type;
+                entry.packetBytes = packetBytes;
+                entry.dataOffset = numBytes;
+            }
+
+            assert( entry.dataOffset == numBytes );
+
+            serialize_bytes( stream, m_data + numBytes, packetBytes );
+
+            numBytes += packetBytes;
+        }
+
+        if ( Stream::IsReading )
+        {
+            m_numPackets = int( numPackets );
+            m_numBytes = numBytes;
+        }
+
+        return true;
+    }
+
+    int PacketCapture::GetSaveBytes()
+    {
+        MeasureStream stream( *m_allocator );
+
+        if ( !Serialize( stream ) )
+            return 0;
+
+        // IMPORTANT: Round up to a whole number of words, because the bit writer and reader work on 32 bit words.
+
+        return ( stream.GetBytesProcessed() + 3 ) & ~3;
+    }
+
+    int PacketCapture::Save( uint8_t * buffer, int bufferSize )
+    {
+        assert( buffer );
+
+        if ( bufferSize < GetSaveBytes() )
+            return 0;
+
+        WriteStream stream( buffer, bufferSize & ~3, *m_allocator );
+
+        if ( !Serialize( stream ) )
+            return 0;
+
+        stream.Flush();
+
+        return ( stream.GetBytesProcessed() + 3 ) & ~3;
+    }
+
+    bool PacketCapture::Load( const uint8_t * buffer, int bufferSize )
+    {
+        assert( buffer );
+
+        Clear();
+
+        if ( bufferSize <= 0 || ( bufferSize % 4 ) != 0 )
+            return false;
+
+        ReadStream stream( buffer, bufferSize, *m_allocator );
+
+        if ( !Serialize( stream ) )
+        {
+            Clear();
+            return false;
+        }
+
+        return true;
+    }
+}
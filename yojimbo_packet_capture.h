@@ -0,0 +1,237 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef YOJIMBO_PACKET_CAPTURE_H
+#define YOJIMBO_PACKET_CAPTURE_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_common.h"
+#include "yojimbo_address.h"
+#include "yojimbo_allocator.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /// Identifies the packet capture file format. See PacketCapture::Save.
+
+    const uint32_t PacketCaptureMagic = 0x4d434a59;
+
+    /// The packet capture file format version. Bump this whenever the format changes, so old captures fail to load instead of replaying garbage.
+
+    const uint32_t PacketCaptureVersion = 1;
+
+    /// Packet capture event types.
+
+    enum PacketCaptureEventType
+    {
+        PACKET_CAPTURE_SEND,                                                ///< A packet was passed in to NetworkSimulator::SendPacket, before any packet loss, latency or duplicates are applied.
+        PACKET_CAPTURE_RECEIVE,                                             ///< A packet was delivered by the network simulator and is ready to be received.
+        PACKET_CAPTURE_NUM_EVENT_TYPES
+    };
+
+    /// A packet recorded in a packet capture.
+
+    struct PacketCaptureEntry
+    {
+        PacketCaptureEventType type;                                        ///< Whether the packet was sent or delivered.
+        double time;                                                        ///< The network simulator time when the packet was sent or delivered.
+        Address from;                                                       ///< The address the packet was sent from.
+        Address to;                                                         ///< The address the packet was sent to.
+        int packetBytes;                                                    ///< The size of the packet in bytes.
+        int dataOffset;                                                     ///< The offset of the packet data in the capture data buffer. See PacketCapture::GetPacketData.
+    };
+
+    /**
+        Records packets passing through a network simulator, so they can be saved and replayed later.
+
+        Set a packet capture on the network simulator with NetworkSimulator::SetPacketCapture to record every packet sent and every packet delivered.
+
+        Set a packet capture on a network simulator with NetworkSimulator::SetPacketReplay to deliver the recorded packets at the time they were originally delivered, instead of simulating the packets that are sent. This way a recorded session can be rerun against a server or client with exactly the same inputs.
+
+        The capture is saved to and loaded from a buffer in a simple binary format, so it can be written to a file and replayed on a different machine.
+
+        IMPORTANT: Replayed packets are only processed the same way they were originally if the receiver is in the same state it was in when the capture was recorded. For example, a secure server must use the same private key, and its time must advance in the same steps as it did during the capture.
+
+        @see NetworkSimulator
+     */
+
+    class PacketCapture
+    {
+    public:
+
+        /**
+            Packet capture constructor.
+
+            @param allocator The allocator to use.
+            @param maxPackets The maximum number of packets the capture can hold.
+            @param maxBytes The maximum number of bytes of packet data the capture can hold.
+         */
+
+        PacketCapture( Allocator & allocator, int maxPackets = 64 * 1024, int maxBytes = 16 * 1024 * 1024 );
+
+        /**
+            Packet capture destructor.
+         */
+
+        ~PacketCapture();
+
+        /**
+            Remove all packets from the capture.
+         */
+
+        void Clear();
+
+        /**
+            Add a packet to the capture.
+
+            If the capture is full, the packet is not added and the dropped packet counter is incremented. See PacketCapture::GetNumDroppedPackets.
+
+            @param type The packet capture event type.
+            @param time The time the packet was sent or delivered.
+            @param from The address the packet was sent from.
+            @param to The address the packet was sent to.
+            @param packetData The packet data. The capture makes a copy of the data.
+            @param packetBytes The size of the packet in bytes.
+
+            @returns True if the packet was added to the capture, false if the capture is full.
+         */
+
+        bool AddPacket( PacketCaptureEventType type, double time, const Address & from, const Address & to, const uint8_t * packetData, int packetBytes );
+
+        /**
+            Get the number of packets in the capture.
+
+            @returns The number of packets in the capture.
+         */
+
+        int GetNumPackets() const { return m_numPackets; }
+
+        /**
+            Get a packet in the capture.
+
+            Packets are stored in the order they were added to the capture.
+
+            @param index The index of the packet in [0,GetNumPackets()-1].
+
+            @returns The packet capture entry.
+         */
+
+        const PacketCaptureEntry & GetPacket( int index ) const
+        {
+            assert( index >= 0 );
+            assert( index < m_numPackets );
+            return m_packets[index];
+        }
+
+        /**
+            Get the data for a packet in the capture.
+
+            @param index The index of the packet in [0,GetNumPackets()-1].
+
+            @returns The packet data. The size of the data is PacketCaptureEntry::packetBytes.
+         */
+
+        const uint8_t * GetPacketData( int index ) const
+        {
+            assert( index >= 0 );
+            assert( index < m_numPackets );
+            return m_data + m_packets[index].dataOffset;
+        }
+
+        /**
+            Get the number of packets that were not added because the capture was full.
+
+            If this is non-zero, the capture is incomplete and replaying it will not reproduce the original session.
+
+            @returns The number of dropped packets.
+         */
+
+        uint64_t GetNumDroppedPackets() const { return m_numDroppedPackets; }
+
+        /**
+            Get the number of bytes needed to save the capture.
+
+            @returns The size of the buffer to pass in to PacketCapture::Save (bytes).
+         */
+
+        int GetSaveBytes();
+
+        /**
+            Save the capture to a buffer.
+
+            @param buffer The buffer to save the capture to.
+            @param bufferSize The size of the buffer (bytes). Must be at least PacketCapture::GetSaveBytes.
+
+            @returns The number of bytes written to the buffer, or zero if the buffer is too small.
+         */
+
+        int Save( uint8_t * buffer, int bufferSize );
+
+        /**
+            Load a capture from a buffer.
+
+            Any packets already in the capture are removed first.
+
+            @param buffer The buffer containing a capture written by PacketCapture::Save.
+            @param bufferSize The size of the buffer (bytes).
+
+            @returns True if the capture was loaded, false if the buffer is not a valid capture, or the capture is too large to fit.
+         */
+
+        bool Load( const uint8_t * buffer, int bufferSize );
+
+    protected:
+
+        /**
+            Serialize the capture (read/write/measure).
+
+            @param stream The stream to serialize with.
+
+            @returns True if the capture serialized successfully, false otherwise.
+         */
+
+        template <typename Stream> bool Serialize( Stream & stream );
+
+    private:
+
+        Allocator * m_allocator;                                            ///< The allocator passed in to the constructor.
+
+        int m_maxPackets;                                                   ///< The maximum number of packets in the capture.
+
+        int m_maxBytes;                                                     ///< The maximum number of bytes of packet data in the capture.
+
+        int m_numPackets;                                                   ///< The number of packets in the capture.
+
+        int m_numBytes;                                                     ///< The number of bytes of packet data in the capture.
+
+        uint64_t m_numDroppedPackets;                                       ///< The number of packets not added because the capture was full.
+
+        PacketCaptureEntry * m_packets;                                     ///< The array of packets in the capture, in the order they were added.
+
+        uint8_t * m_data;                                                   ///< The packet data buffer. Packet data is appended to this buffer as packets are added.
+    };
+}
+
+#endif // #ifndef YOJIMBO_PACKET_CAPTURE_H
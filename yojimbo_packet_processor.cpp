@@ -29,6 +29,7 @@
 #include "yojimbo_allocator.h"
 #include "yojimbo_packet.h"
 #include "yojimbo_common.h"
+#include "yojimbo_profile.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
@@ -50,14 +51,29 @@ namespace yojimbo
         assert( m_maxPacketSize % 4 == 0 );
         assert( m_maxPacketSize >= maxPacketSize );
 
-        m_absoluteMaxPacketSize = maxPacketSize + MaxPrefixBytes + MacBytes;
+        m_absoluteMaxPacketSize = m_maxPacketSize + MaxPrefixBytes + MacBytes;
+        m_absoluteMaxPacketSize += ( m_absoluteMaxPacketSize % 4 ) ? ( 4 - ( m_absoluteMaxPacketSize % 4 ) ) : 0;
+
+        assert( m_absoluteMaxPacketSize % 4 == 0 );
 
         m_context = NULL;
         m_userContext = NULL;
 
+        m_packetCipher = PACKET_CIPHER_XSALSA20_POLY1305;
+
         m_packetBuffer = (uint8_t*) YOJIMBO_ALLOCATE( allocator, m_absoluteMaxPacketSize );
 
-        m_scratchBuffer = (uint8_t*) YOJIMBO_ALLOCATE( allocator, m_absoluteMaxPacketSize );
+        m_compressor = YOJIMBO_NEW( allocator, PacketCompressor, allocator );
+
+        m_compressionBuffer = (uint8_t*) YOJIMBO_ALLOCATE( allocator, m_absoluteMaxPacketSize );
+
+        m_compressionThreshold = DefaultCompressionThreshold;
+
+        m_encryptBatchOpen = false;
+
+        m_numEncryptBatchEntries = 0;
+
+        m_encryptBatchEntries = (EncryptBatchEntry*) YOJIMBO_ALLOCATE( allocator, sizeof( EncryptBatchEntry ) * PacketSendBatchSize );
     }
 
     PacketProcessor::~PacketProcessor()
@@ -65,7 +81,14 @@ namespace yojimbo
         assert( m_allocator );
 
         YOJIMBO_FREE( *m_allocator, m_packetBuffer );
-        YOJIMBO_FREE( *m_allocator, m_scratchBuffer );
+
+        YOJIMBO_DELETE( *m_allocator, PacketCompressor, m_compressor );
+
+        YOJIMBO_FREE( *m_allocator, m_compressionBuffer );
+
+        assert( m_numEncryptBatchEntries == 0 );
+
+        YOJIMBO_FREE( *m_allocator, m_encryptBatchEntries );
 
         m_allocator = NULL;
     }
@@ -80,12 +103,143 @@ namespace yojimbo
         m_userContext = context;
     }
 
-    static const int ENCRYPTED_PACKET_FLAG = (1<<7);
+    void PacketProcessor::SetPacketCipher( PacketCipher cipher )
+    {
+        assert( cipher >= 0 );
+        assert( cipher < NUM_PACKET_CIPHERS );
+
+        if ( !IsPacketCipherAvailable( cipher ) )
+            debug_printf( "packet processor: packet cipher %d is not available. encrypted packets will fail to write and read\n", cipher );
+
+        m_packetCipher = cipher;
+    }
 
-    const uint8_t * PacketProcessor::WritePacket( Packet * packet, uint64_t sequence, int & packetBytes, bool encrypt, const uint8_t * key, Allocator & streamAllocator, PacketFactory & packetFactory )
+    bool PacketProcessor::SetCompressionDictionary( const uint8_t * dictionary, int dictionaryBytes )
+    {
+        assert( m_compressor );
+        return m_compressor->SetDictionary( dictionary, dictionaryBytes );
+    }
+
+    void PacketProcessor::SetCompressionThreshold( int bytes )
+    {
+        assert( bytes >= 0 );
+        m_compressionThreshold = bytes;
+    }
+
+    int PacketProcessor::CompressPacketData( uint8_t * packetData, int packetDataBytes )
+    {
+        assert( packetData );
+        assert( m_compressor );
+        assert( m_compressionBuffer );
+
+        if ( packetDataBytes < m_compressionThreshold || packetDataBytes <= 2 )
+            return 0;
+
+        // IMPORTANT: Only accept compressed data that saves more than the compressed packet prefix byte, so compression never makes a packet larger.
+
+        YOJIMBO_PROFILE_BEGIN( compressStart );
+        const int compressedBytes = m_compressor->Compress( packetData, packetDataBytes, m_compressionBuffer, packetDataBytes - 2 );
+        YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_COMPRESS, compressStart );
+
+        if ( !compressedBytes )
+            return 0;
+
+        assert( compressedBytes + 1 < packetDataBytes );
+
+        // IMPORTANT: The compressed data goes one byte later than the packet data, to make room for the compressed packet prefix in front of the packet.
+
+        memcpy( packetData + 1, m_compressionBuffer, compressedBytes );
+
+        return compressedBytes;
+    }
+
+    int PacketProcessor::DecompressPacketData( const uint8_t * packetData, int packetBytes, int headerBytes )
+    {
+        assert( packetData );
+        assert( m_compressor );
+        assert( m_compressionBuffer );
+        assert( headerBytes + m_maxPacketSize <= m_absoluteMaxPacketSize );
+
+        if ( packetBytes <= headerBytes )
+            return 0;
+
+        // IMPORTANT: Decompressed packet data goes after the same number of header bytes in the compression buffer, so it can be read exactly like an uncompressed packet.
+
+        YOJIMBO_PROFILE_BEGIN( decompressStart );
+        const int decompressedBytes = m_compressor->Decompress( packetData + headerBytes, packetBytes - headerBytes, m_compressionBuffer + headerBytes, m_maxPacketSize );
+        YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_DECOMPRESS, decompressStart );
+
+        return decompressedBytes ? headerBytes + decompressedBytes : 0;
+    }
+
+    bool PacketProcessor::EncryptPacketData( uint8_t * message, int messageLength, uint8_t * mac, uint64_t sequence, const uint8_t * key, const PacketCipherState * keyState, bool canDefer )
+    {
+        if ( canDefer && m_encryptBatchOpen && m_numEncryptBatchEntries < PacketSendBatchSize )
+        {
+            EncryptBatchEntry & entry = m_encryptBatchEntries[m_numEncryptBatchEntries++];
+            entry.message = message;
+            entry.messageLength = messageLength;
+            entry.mac = mac;
+            memcpy( entry.nonce, &sequence, NonceBytes );
+            entry.key = key;
+            entry.keyState = keyState;
+            return true;
+        }
+
+        YOJIMBO_ZONE( "packet_encrypt" );
+        YOJIMBO_PROFILE_BEGIN( encryptStart );
+        const bool encrypted = Encrypt_InPlace( m_packetCipher, message, messageLength, mac, (uint8_t*) &sequence, key, keyState );
+        YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_ENCRYPT, encryptStart );
+
+        return encrypted;
+    }
+
+    void PacketProcessor::BeginEncryptBatch()
+    {
+        assert( !m_encryptBatchOpen );
+        assert( m_numEncryptBatchEntries == 0 );
+        m_encryptBatchOpen = true;
+    }
+
+    bool PacketProcessor::FlushEncryptBatch()
+    {
+        if ( m_numEncryptBatchEntries == 0 )
+            return true;
+
+        YOJIMBO_ZONE( "packet_encrypt_batch" );
+        YOJIMBO_PLOT( "packet_encrypt_batch_size", m_numEncryptBatchEntries );
+
+        YOJIMBO_PROFILE_BEGIN( encryptStart );
+        const bool encrypted = EncryptBatch_InPlace( m_packetCipher, m_encryptBatchEntries, m_numEncryptBatchEntries );
+        YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_ENCRYPT, encryptStart );
+
+        m_numEncryptBatchEntries = 0;
+
+        if ( !encrypted )
+        {
+            debug_printf( "packet processor (flush encrypt batch): encrypt packet failed\n" );
+            m_error = PACKET_PROCESSOR_ERROR_ENCRYPT_FAILED;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool PacketProcessor::EndEncryptBatch()
+    {
+        const bool encrypted = FlushEncryptBatch();
+        m_encryptBatchOpen = false;
+        return encrypted;
+    }
+
+    const uint8_t * PacketProcessor::WritePacket( Packet * packet, uint64_t sequence, int & packetBytes, bool encrypt, const uint8_t * key, Allocator & streamAllocator, PacketFactory & packetFactory, uint8_t * packetBuffer, const PacketCipherState * keyState, bool compress )
     {
         m_error = PACKET_PROCESSOR_ERROR_NONE;
 
+        uint8_t * buffer = packetBuffer ? packetBuffer : m_packetBuffer;
+
+        assert( ( uintptr_t( buffer ) % 4 ) == 0 );
+
         if ( encrypt )
         {
             if ( !key )
@@ -95,47 +249,67 @@ namespace yojimbo
                 return NULL;
             }
 
+            uint8_t prefix[MaxPrefixBytes];
             int prefixBytes;
-            compress_packet_sequence( sequence, m_scratchBuffer[0], prefixBytes, m_scratchBuffer+1 );
-            m_scratchBuffer[0] |= ENCRYPTED_PACKET_FLAG;
+            compress_packet_sequence( sequence, prefix[0], prefixBytes, prefix+1 );
+            prefix[0] |= EncryptedPacketFlag;
             prefixBytes++;
 
+            // IMPORTANT: The stream writes zero bytes over the prefix and MAC, so the packet data lands exactly where it needs to be to encrypt in-place.
+
             PacketReadWriteInfo info;
             info.context = m_context;
             info.userContext = m_userContext;
             info.protocolId = m_protocolId;
             info.packetFactory = &packetFactory;
             info.streamAllocator = &streamAllocator;
+            info.prefixBytes = prefixBytes + MacBytes;
             info.rawFormat = 1;
 
-            packetBytes = yojimbo::WritePacket( info, packet, m_packetBuffer, m_maxPacketSize );
-            if ( packetBytes <= 0 )
+            YOJIMBO_PROFILE_BEGIN( serializeStart );
+            packetBytes = yojimbo::WritePacket( info, packet, buffer, m_absoluteMaxPacketSize );
+            YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_WRITE_SERIALIZE, serializeStart );
+
+            if ( packetBytes <= 0 || packetBytes - info.prefixBytes > m_maxPacketSize )
             {
                 debug_printf( "packet processor (write packet): write packet failed\n" );
                 m_error = PACKET_PROCESSOR_ERROR_WRITE_PACKET_FAILED;
                 return NULL;
             }
 
-            assert( packetBytes <= m_maxPacketSize );
+            uint8_t * header = buffer;
 
-            int encryptedPacketSize;
+            if ( compress )
+            {
+                const int compressedBytes = CompressPacketData( buffer + info.prefixBytes, packetBytes - info.prefixBytes );
+
+                if ( compressedBytes )
+                {
+                    buffer[0] = CompressedPacketPrefix;
+                    header = buffer + 1;
+                    packetBytes = 1 + info.prefixBytes + compressedBytes;
+                }
+            }
+
+            const int headerBytes = int( header - buffer );
+
+            memcpy( header, prefix, prefixBytes );
+
+            const bool encrypted = EncryptPacketData( header + prefixBytes + MacBytes,
+                                                      packetBytes - headerBytes - prefixBytes - MacBytes,
+                                                      header + prefixBytes,
+                                                      sequence, key, keyState, packetBuffer != NULL );
 
-            if ( !Encrypt( m_packetBuffer,
-                           packetBytes,
-                           m_scratchBuffer + prefixBytes,
-                           encryptedPacketSize, 
-                           (uint8_t*) &sequence, key ) )
+            if ( !encrypted )
             {
                 debug_printf( "packet processor (write packet): encrypt packet failed\n" );
                 m_error = PACKET_PROCESSOR_ERROR_ENCRYPT_FAILED;
                 return NULL;
             }
             
-            packetBytes = prefixBytes + encryptedPacketSize;
-
             assert( packetBytes <= m_absoluteMaxPacketSize );
 
-            return m_scratchBuffer;
+            return buffer;
         }
         else
         {
@@ -147,7 +321,9 @@ namespace yojimbo
             info.streamAllocator = &streamAllocator;
             info.prefixBytes = 1;
 
-            packetBytes = yojimbo::WritePacket( info, packet, m_packetBuffer, m_maxPacketSize );
+            YOJIMBO_PROFILE_BEGIN( serializeStart );
+            packetBytes = yojimbo::WritePacket( info, packet, buffer, m_maxPacketSize );
+            YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_WRITE_SERIALIZE, serializeStart );
 
             if ( packetBytes <= 0 )
             {
@@ -156,13 +332,92 @@ namespace yojimbo
                 return NULL;
             }
 
+            if ( compress )
+            {
+                const int compressedBytes = CompressPacketData( buffer + info.prefixBytes, packetBytes - info.prefixBytes );
+
+                if ( compressedBytes )
+                {
+                    buffer[0] = CompressedPacketPrefix;
+                    buffer[1] = 0;
+                    packetBytes = 1 + info.prefixBytes + compressedBytes;
+                }
+            }
+
             assert( packetBytes <= m_maxPacketSize );
 
-            return m_packetBuffer;
+            return buffer;
+        }
+    }
+
+    int PacketProcessor::SerializePacket( Packet * packet, uint8_t * buffer, int bufferSize, Allocator & streamAllocator, PacketFactory & packetFactory )
+    {
+        assert( packet );
+        assert( buffer );
+        assert( ( uintptr_t( buffer ) % 4 ) == 0 );
+        assert( ( bufferSize % 4 ) == 0 );
+
+        PacketReadWriteInfo info;
+        info.context = m_context;
+        info.userContext = m_userContext;
+        info.protocolId = m_protocolId;
+        info.packetFactory = &packetFactory;
+        info.streamAllocator = &streamAllocator;
+        info.prefixBytes = 0;
+        info.rawFormat = 1;
+
+        const int serializedBytes = yojimbo::WritePacket( info, packet, buffer, bufferSize );
+
+        if ( serializedBytes <= 0 || serializedBytes > m_maxPacketSize )
+        {
+            debug_printf( "packet processor (serialize packet): write packet failed\n" );
+            return 0;
+        }
+
+        return serializedBytes;
+    }
+
+    const uint8_t * PacketProcessor::WriteSerializedPacket( const uint8_t * serializedData, int serializedBytes, uint64_t sequence, int & packetBytes, const uint8_t * key, uint8_t * packetBuffer, const PacketCipherState * keyState )
+    {
+        assert( serializedData );
+        assert( serializedBytes > 0 );
+        assert( serializedBytes <= m_maxPacketSize );
+
+        m_error = PACKET_PROCESSOR_ERROR_NONE;
+
+        if ( !key )
+        {
+            debug_printf( "packet processor (write serialized packet): key is null\n" );
+            m_error = PACKET_PROCESSOR_ERROR_KEY_IS_NULL;
+            return NULL;
+        }
+
+        uint8_t * buffer = packetBuffer ? packetBuffer : m_packetBuffer;
+
+        int prefixBytes;
+        compress_packet_sequence( sequence, buffer[0], prefixBytes, buffer + 1 );
+        buffer[0] |= EncryptedPacketFlag;
+        prefixBytes++;
+
+        // IMPORTANT: The serialized packet data is exactly what WritePacket serializes after the prefix and MAC, since the stream writes whole bytes for them.
+
+        memcpy( buffer + prefixBytes + MacBytes, serializedData, serializedBytes );
+
+        packetBytes = prefixBytes + MacBytes + serializedBytes;
+
+        if ( !EncryptPacketData( buffer + prefixBytes + MacBytes, serializedBytes, buffer + prefixBytes, sequence, key, keyState, packetBuffer != NULL ) )
+        {
+            debug_printf( "packet processor (write serialized packet): encrypt packet failed\n" );
+            m_error = PACKET_PROCESSOR_ERROR_ENCRYPT_FAILED;
+            return NULL;
         }
+
+        assert( packetBytes <= m_absoluteMaxPacketSize );
+
+        return buffer;
     }
 
-    Packet * PacketProcessor::ReadPacket( const uint8_t * packetData, 
+    Packet * PacketProcessor::ReadPacket( uint8_t * packetData, 
                                           uint64_t & sequence, 
                                           int packetBytes, 
                                           bool & encrypted,  
@@ -171,13 +426,31 @@ namespace yojimbo
                                           const uint8_t * unencryptedPacketTypes,
                                           Allocator & streamAllocator,
                                           PacketFactory & packetFactory,
-                                          ReplayProtection * replayProtection )
+                                          ReplayProtection * replayProtection,
+                                          const PacketCipherState * keyState )
     {
         m_error = PACKET_PROCESSOR_ERROR_NONE;
 
+        // IMPORTANT: Skip over the compressed packet prefix. What follows it is read exactly like a regular packet, except the packet data is decompressed before it is serialized.
+
+        const bool compressed = packetData[0] == CompressedPacketPrefix;
+
+        if ( compressed )
+        {
+            if ( packetBytes < 2 )
+            {
+                debug_printf( "packet processor (read packet): compressed packet is too small\n" );
+                m_error = PACKET_PROCESSOR_ERROR_PACKET_TOO_SMALL;
+                return NULL;
+            }
+
+            packetData++;
+            packetBytes--;
+        }
+
         const uint8_t prefixByte = packetData[0];
 
-        encrypted = ( prefixByte & ENCRYPTED_PACKET_FLAG ) != 0;
+        encrypted = ( prefixByte & EncryptedPacketFlag ) != 0;
 
         if ( encrypted )
         {
@@ -208,9 +481,15 @@ namespace yojimbo
                 return NULL;
             }
 
-            int decryptedPacketBytes;
+            bool decrypted;
+            {
+                YOJIMBO_ZONE( "packet_decrypt" );
+                YOJIMBO_PROFILE_BEGIN( decryptStart );
+                decrypted = Decrypt_InPlace( m_packetCipher, packetData + prefixBytes + MacBytes, packetBytes - prefixBytes - MacBytes, packetData + prefixBytes, (uint8_t*)&sequence, key, keyState );
+                YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_DECRYPT, decryptStart );
+            }
 
-            if ( !Decrypt( packetData + prefixBytes, packetBytes - prefixBytes, m_scratchBuffer, decryptedPacketBytes, (uint8_t*)&sequence, key ) )
+            if ( !decrypted )
             {
                 debug_printf( "packet processor (read packet): decrypt failed\n" );
                 m_error = PACKET_PROCESSOR_ERROR_DECRYPT_FAILED;
@@ -223,11 +502,30 @@ namespace yojimbo
             info.packetFactory = &packetFactory;
             info.streamAllocator = &streamAllocator;
             info.allowedPacketTypes = encryptedPacketTypes;
+            info.prefixBytes = prefixBytes + MacBytes;
             info.rawFormat = 1;
 
+            const uint8_t * readData = packetData;
+            int readBytes = packetBytes;
+
+            if ( compressed )
+            {
+                readData = m_compressionBuffer;
+                readBytes = DecompressPacketData( packetData, packetBytes, info.prefixBytes );
+
+                if ( !readBytes )
+                {
+                    debug_printf( "packet processor (read packet): decompress failed (encrypted)\n" );
+                    m_error = PACKET_PROCESSOR_ERROR_DECOMPRESS_FAILED;
+                    return NULL;
+                }
+            }
+
             ReadPacketError readPacketError;
             
-            Packet * packet = yojimbo::ReadPacket( info, m_scratchBuffer, decryptedPacketBytes, &readPacketError );
+            YOJIMBO_PROFILE_BEGIN( serializeStart );
+            Packet * packet = yojimbo::ReadPacket( info, readData, readBytes, &readPacketError );
+            YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_READ_SERIALIZE, serializeStart );
 
             if ( !packet )
             {
@@ -249,10 +547,28 @@ namespace yojimbo
             info.prefixBytes = 1;
 
             sequence = 0;
+
+            const uint8_t * readData = packetData;
+            int readBytes = packetBytes;
+
+            if ( compressed )
+            {
+                readData = m_compressionBuffer;
+                readBytes = DecompressPacketData( packetData, packetBytes, info.prefixBytes );
+
+                if ( !readBytes )
+                {
+                    debug_printf( "packet processor (read packet): decompress failed (unencrypted)\n" );
+                    m_error = PACKET_PROCESSOR_ERROR_DECOMPRESS_FAILED;
+                    return NULL;
+                }
+            }
             
             ReadPacketError readPacketError;
 
-            Packet * packet = yojimbo::ReadPacket( info, packetData, packetBytes, &readPacketError );
+            YOJIMBO_PROFILE_BEGIN( serializeStart );
+            Packet * packet = yojimbo::ReadPacket( info, readData, readBytes, &readPacketError );
+            YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_READ_SERIALIZE, serializeStart );
 
             if ( !packet )
             {
@@ -264,4 +580,284 @@ namespace yojimbo
             return packet;
         }
     }
+
+    static const int CoalescedPacketSizeBytes = 2;
+
+    const uint8_t * PacketProcessor::WriteCoalescedPacket( Packet ** packets, int numPackets, int & numPacketsWritten, uint64_t sequence, int & packetBytes, int maxPacketBytes, const uint8_t * key, Allocator & streamAllocator, PacketFactory & packetFactory, uint8_t * packetBuffer, const PacketCipherState * keyState )
+    {
+        assert( packets );
+        assert( numPackets > 0 );
+        assert( numPackets <= MaxCoalescedPackets );
+
+        m_error = PACKET_PROCESSOR_ERROR_NONE;
+
+        numPacketsWritten = 0;
+
+        packetBytes = 0;
+
+        uint8_t * buffer = packetBuffer ? packetBuffer : m_packetBuffer;
+
+        assert( ( uintptr_t( buffer ) % 4 ) == 0 );
+
+        if ( !key )
+        {
+            debug_printf( "packet processor (write coalesced packet): key is null\n" );
+            m_error = PACKET_PROCESSOR_ERROR_KEY_IS_NULL;
+            return NULL;
+        }
+
+        if ( maxPacketBytes > m_absoluteMaxPacketSize )
+            maxPacketBytes = m_absoluteMaxPacketSize;
+
+        uint8_t * header = buffer + 1;
+
+        int prefixBytes;
+        compress_packet_sequence( sequence, header[0], prefixBytes, header + 1 );
+        header[0] |= EncryptedPacketFlag;
+        prefixBytes++;
+
+        const int headerBytes = 1 + prefixBytes + MacBytes;
+
+        // IMPORTANT: Each packet is serialized into the compression buffer first, because the packet stream needs a 4 byte aligned buffer and packets inside the coalesced packet generally aren't aligned.
+
+        PacketReadWriteInfo info;
+        info.context = m_context;
+        info.userContext = m_userContext;
+        info.protocolId = m_protocolId;
+        info.packetFactory = &packetFactory;
+        info.streamAllocator = &streamAllocator;
+        info.prefixBytes = 0;
+        info.rawFormat = 1;
+
+        int bytes = headerBytes;
+
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            assert( packets[i] );
+
+            YOJIMBO_PROFILE_BEGIN( serializeStart );
+            const int serializedBytes = yojimbo::WritePacket( info, packets[i], m_compressionBuffer, m_absoluteMaxPacketSize );
+            YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_WRITE_SERIALIZE, serializeStart );
+
+            if ( serializedBytes <= 0 || serializedBytes > m_maxPacketSize )
+            {
+                if ( i == 0 )
+                {
+                    debug_printf( "packet processor (write coalesced packet): write packet failed\n" );
+                    m_error = PACKET_PROCESSOR_ERROR_WRITE_PACKET_FAILED;
+                    return NULL;
+                }
+                break;
+            }
+
+            if ( bytes + CoalescedPacketSizeBytes + serializedBytes > maxPacketBytes || bytes + CoalescedPacketSizeBytes + serializedBytes - headerBytes > m_maxPacketSize )
+                break;
+
+            buffer[bytes] = uint8_t( serializedBytes >> 8 );
+            buffer[bytes+1] = uint8_t( serializedBytes & 0xFF );
+
+            memcpy( buffer + bytes + CoalescedPacketSizeBytes, m_compressionBuffer, serializedBytes );
+
+            bytes += CoalescedPacketSizeBytes + serializedBytes;
+
+            numPacketsWritten++;
+        }
+
+        if ( numPacketsWritten == 0 )
+            return NULL;
+
+        buffer[0] = CoalescedPacketPrefix;
+
+        const bool encrypted = EncryptPacketData( buffer + headerBytes,
+                                                  bytes - headerBytes,
+                                                  header + prefixBytes,
+                                                  sequence, key, keyState, packetBuffer != NULL );
+
+        if ( !encrypted )
+        {
+            debug_printf( "packet processor (write coalesced packet): encrypt packet failed\n" );
+            m_error = PACKET_PROCESSOR_ERROR_ENCRYPT_FAILED;
+            numPacketsWritten = 0;
+            return NULL;
+        }
+
+        assert( bytes <= maxPacketBytes );
+
+        packetBytes = bytes;
+
+        return buffer;
+    }
+
+    int PacketProcessor::ReadCoalescedPacket( uint8_t * packetData, int packetBytes, uint64_t & sequence, const uint8_t * key, const uint8_t * encryptedPacketTypes, Allocator & streamAllocator, PacketFactory & packetFactory, ReplayProtection * replayProtection, const PacketCipherState * keyState, Packet ** packets )
+    {
+        assert( packetData );
+        assert( packetData[0] == CoalescedPacketPrefix );
+        assert( packets );
+
+        m_error = PACKET_PROCESSOR_ERROR_NONE;
+
+        if ( packetBytes < 2 )
+        {
+            debug_printf( "packet processor (read coalesced packet): packet is too small\n" );
+            m_error = PACKET_PROCESSOR_ERROR_PACKET_TOO_SMALL;
+            return 0;
+        }
+
+        uint8_t * header = packetData + 1;
+
+        const uint8_t prefixByte = header[0];
+
+        if ( ( prefixByte & EncryptedPacketFlag ) == 0 )
+        {
+            debug_printf( "packet processor (read coalesced packet): packet is not encrypted\n" );
+            m_error = PACKET_PROCESSOR_ERROR_READ_PACKET_FAILED;
+            return 0;
+        }
+
+        if ( !key )
+        {
+            debug_printf( "packet processor (read coalesced packet): key is null\n" );
+            m_error = PACKET_PROCESSOR_ERROR_KEY_IS_NULL;
+            return 0;
+        }
+
+        const int prefixBytes = 1 + get_packet_sequence_bytes( prefixByte );
+
+        const int headerBytes = 1 + prefixBytes + MacBytes;
+
+        if ( packetBytes <= headerBytes )
+        {
+            debug_printf( "packet processor (read coalesced packet): packet is too small\n" );
+            m_error = PACKET_PROCESSOR_ERROR_PACKET_TOO_SMALL;
+            return 0;
+        }
+
+        sequence = decompress_packet_sequence( prefixByte, header + 1 );
+
+        if ( replayProtection && replayProtection->PacketAlreadyReceived( sequence ) )
+        {
+            debug_printf( "packet processor (read coalesced packet): packet already received - replay protection\n" );
+            m_error = PACKET_PROCESSOR_ERROR_PACKET_ALREADY_RECEIVED;
+            return 0;
+        }
+
+        bool decrypted;
+        {
+            YOJIMBO_ZONE( "packet_decrypt" );
+            YOJIMBO_PROFILE_BEGIN( decryptStart );
+            decrypted = Decrypt_InPlace( m_packetCipher, packetData + headerBytes, packetBytes - headerBytes, header + prefixBytes, (uint8_t*)&sequence, key, keyState );
+            YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_DECRYPT, decryptStart );
+        }
+
+        if ( !decrypted )
+        {
+            debug_printf( "packet processor (read coalesced packet): decrypt failed\n" );
+            m_error = PACKET_PROCESSOR_ERROR_DECRYPT_FAILED;
+            return 0;
+        }
+
+        PacketReadWriteInfo info;
+        info.context = m_context;
+        info.protocolId = m_protocolId;
+        info.packetFactory = &packetFactory;
+        info.streamAllocator = &streamAllocator;
+        info.allowedPacketTypes = encryptedPacketTypes;
+        info.prefixBytes = 0;
+        info.rawFormat = 1;
+
+        int numPackets = 0;
+
+        int offset = headerBytes;
+
+        bool malformed = false;
+
+        while ( offset < packetBytes )
+        {
+            if ( numPackets == MaxCoalescedPackets || offset + CoalescedPacketSizeBytes > packetBytes )
+            {
+                malformed = true;
+                break;
+            }
+
+            const int bytes = ( int( packetData[offset] ) << 8 ) | int( packetData[offset+1] );
+
+            offset += CoalescedPacketSizeBytes;
+
+            if ( bytes <= 0 || bytes > m_maxPacketSize || offset + bytes > packetBytes )
+            {
+                malformed = true;
+                break;
+            }
+
+            // IMPORTANT: Copy each packet to the compression buffer so it is 4 byte aligned for the packet stream.
+
+            memcpy( m_compressionBuffer, packetData + offset, bytes );
+
+            offset += bytes;
+
+            ReadPacketError readPacketError;
+
+            YOJIMBO_PROFILE_BEGIN( serializeStart );
+            Packet * packet = yojimbo::ReadPacket( info, m_compressionBuffer, bytes, &readPacketError );
+            YOJIMBO_PROFILE_END( PROFILE_STAGE_PACKET_READ_SERIALIZE, serializeStart );
+
+            if ( !packet )
+            {
+                debug_printf( "packet processor (read coalesced packet): read packet failed - error code %d\n", readPacketError );
+                malformed = true;
+                break;
+            }
+
+            packets[numPackets++] = packet;
+        }
+
+        if ( malformed )
+        {
+            debug_printf( "packet processor (read coalesced packet): coalesced packet is malformed\n" );
+
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                packets[i]->Destroy();
+                packets[i] = NULL;
+            }
+
+            m_error = PACKET_PROCESSOR_ERROR_READ_PACKET_FAILED;
+
+            return 0;
+        }
+
+        return numPackets;
+    }
+
+    bool PacketProcessor::CanDecryptPacket( const uint8_t * packetData, int packetBytes, uint64_t & sequence, const uint8_t * key, const PacketCipherState * keyState )
+    {
+        assert( packetData );
+        assert( key );
+
+        sequence = 0;
+
+        if ( packetBytes > 0 && ( packetData[0] == CompressedPacketPrefix || packetData[0] == CoalescedPacketPrefix ) )
+        {
+            packetData++;
+            packetBytes--;
+        }
+
+        if ( packetBytes <= 0 || ( packetData[0] & EncryptedPacketFlag ) == 0 )
+            return false;
+
+        const int prefixBytes = 1 + get_packet_sequence_bytes( packetData[0] );
+
+        if ( packetBytes <= prefixBytes + MacBytes || packetBytes > m_absoluteMaxPacketSize )
+            return false;
+
+        sequence = decompress_packet_sequence( packetData[0], packetData + 1 );
+
+        // IMPORTANT: Decrypting in place clobbers the packet when the key is wrong, so decrypt a copy of the packet instead.
+
+        const int encryptedBytes = packetBytes - prefixBytes - MacBytes;
+
+        memcpy( m_compressionBuffer, packetData + prefixBytes + MacBytes, encryptedBytes );
+
+        return Decrypt_InPlace( m_packetCipher, m_compressionBuffer, encryptedBytes, packetData + prefixBytes, (uint8_t*)&sequence, key, keyState );
+    }
 }
@@ -27,6 +27,8 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_packet.h"
+#include "yojimbo_encryption.h"
+#include "yojimbo_compression.h"
 
 /** @file */
 
@@ -34,6 +36,40 @@ namespace yojimbo
 {
     class ReplayProtection;
 
+    const uint8_t EncryptedPacketFlag = (1<<7);                     ///< Set on the prefix byte of encrypted packets. The rest of the prefix byte describes which bytes of the packet sequence number follow. See yojimbo::compress_packet_sequence.
+
+    const uint8_t FragmentPacketPrefix = 1;                         ///< The prefix byte of packet fragments written by BaseTransport. Unencrypted packets always have a zero prefix byte, and encrypted packets always have EncryptedPacketFlag set, so fragments can't be mistaken for either.
+
+    const uint8_t CompressedPacketPrefix = 2;                       ///< The prefix byte of compressed packets. It is followed by the regular packet prefix byte, and everything after the regular prefix (and MAC, if encrypted) is compressed.
+
+    const uint8_t CoalescedPacketPrefix = 3;                        ///< The prefix byte of coalesced packets. It is followed by a regular encrypted packet prefix and MAC, and the encrypted data holds multiple packets, each preceded by its size. See PacketProcessor::WriteCoalescedPacket.
+
+    const uint8_t FecPacketPrefix = 4;                              ///< The prefix byte of packets protected by forward error correction. It is followed by the group sequence and the index of the packet in the group, then the packet as it would otherwise have been sent. See ForwardErrorCorrection.
+
+    const uint8_t FecParityPacketPrefix = 5;                        ///< The prefix byte of forward error correction parity packets. The parity data is the XOR of all packets in the group, so any one packet in the group that is lost can be recovered from the others.
+
+    const uint8_t RelayPacketPrefix = 6;                            ///< The prefix byte of packets sent through a relay. It is followed by the address type, the address and the port of the other endpoint, then the packet as it would otherwise have been sent. Relays rewrite the address and forward the rest of the packet untouched, so encrypted packets stay encrypted. See NetworkTransport::EnableRelayMode.
+
+    const int MaxRelayHeaderBytes = 20;                             ///< The size of the relay header in front of a relayed packet with an IPv6 address: prefix byte, address type, 16 byte address and port. The header for IPv4 addresses is 8 bytes.
+
+    /**
+        Get the regular prefix byte of a packet written by the packet processor.
+
+        This skips over the compressed packet prefix, so you can check if a packet is encrypted whether it is compressed or not.
+
+        @param packetData The packet data.
+        @param packetBytes The size of the packet in bytes.
+
+        @returns The regular packet prefix byte.
+     */
+
+    inline uint8_t get_packet_prefix_byte( const uint8_t * packetData, int packetBytes )
+    {
+        assert( packetData );
+        assert( packetBytes > 0 );
+        return ( packetData[0] == CompressedPacketPrefix && packetBytes > 1 ) ? packetData[1] : packetData[0];
+    }
+
     /**
         Packet processor error codes.
      */
@@ -48,10 +84,17 @@ namespace yojimbo
         PACKET_PROCESSOR_ERROR_READ_PACKET_FAILED,              ///< Failed to read packet. See yojimbo::ReadPacket.
         PACKET_PROCESSOR_ERROR_ENCRYPT_FAILED,                  ///< Encrypt packet failed.
         PACKET_PROCESSOR_ERROR_DECRYPT_FAILED,                  ///< Decrypt packet failed.
+        PACKET_PROCESSOR_ERROR_DECOMPRESS_FAILED,               ///< A compressed packet was discarded because its payload failed to decompress.
     };
 
     /**
-        Adds packet encryption and decryption on top of low-level read and write packet functions.
+        Adds packet compression, encryption and decryption on top of low-level read and write packet functions.
+
+        Encrypted packets are laid out as [prefix byte][sequence bytes][MAC][encrypted packet data]. Packet data is serialized directly after the space reserved for the prefix and MAC, then encrypted and decrypted in-place, so no scratch buffer copies are needed in either direction.
+
+        Compression is optional and happens between serialization and encryption. Compressed packets are laid out as [yojimbo::CompressedPacketPrefix][regular packet], where the serialized packet data in the regular packet is compressed. Packet data is only compressed if it is at least the compression threshold in size and compressing it saves more than the extra prefix byte, otherwise it is sent as is.
+
+        Multiple encrypted packets going to the same address can be coalesced into one packet, so they share one UDP header, one sequence number and one MAC. See PacketProcessor::WriteCoalescedPacket.
 
         @see yojimbo::WritePacket
         @see yojimbo::ReadPacket
@@ -93,6 +136,63 @@ namespace yojimbo
 
         void SetUserContext( void * context );
 
+        /**
+            Set the cipher used to encrypt and decrypt packets.
+
+            @param cipher The packet cipher. Defaults to PACKET_CIPHER_XSALSA20_POLY1305.
+
+            @see ClientServerConfig::packetCipher
+         */
+
+        void SetPacketCipher( PacketCipher cipher );
+
+        /**
+            Get the cipher used to encrypt and decrypt packets.
+
+            @returns The packet cipher.
+         */
+
+        PacketCipher GetPacketCipher() const { return m_packetCipher; }
+
+        /**
+            Set the dictionary used to compress and decompress packets.
+
+            IMPORTANT: The sender and receiver must use the same dictionary. See PacketCompressor::SetDictionary.
+
+            @param dictionary The dictionary data. It is copied. Pass in NULL to clear the dictionary.
+            @param dictionaryBytes The size of the dictionary in bytes.
+
+            @returns True if the dictionary was set, false otherwise.
+         */
+
+        bool SetCompressionDictionary( const uint8_t * dictionary, int dictionaryBytes );
+
+        /**
+            Get the dictionary used to compress and decompress packets.
+
+            @returns The dictionary data. NULL if there is no dictionary. See PacketProcessor::GetCompressionDictionaryBytes.
+         */
+
+        const uint8_t * GetCompressionDictionary() const { return m_compressor->GetDictionary(); }
+
+        /**
+            Get the size of the dictionary used to compress and decompress packets.
+
+            @returns The dictionary size in bytes. Zero if there is no dictionary.
+         */
+
+        int GetCompressionDictionaryBytes() const { return m_compressor->GetDictionaryBytes(); }
+
+        /**
+            Set the size threshold for packet compression.
+
+            Packets with less packet data than this are never compressed, because small packets rarely compress enough to be worth the time spent compressing them.
+
+            @param bytes The minimum number of bytes of packet data for a packet to be compressed. Defaults to yojimbo::DefaultCompressionThreshold.
+         */
+
+        void SetCompressionThreshold( int bytes );
+
         /**
             Write a packet.
 
@@ -103,16 +203,53 @@ namespace yojimbo
             @param key The key used for packet encryption.
             @param streamAllocator The allocator to set on the stream. See BaseStream::GetAllocator.
             @param packetFactory The packet factory so we know the range of packet types supported.
+            @param packetBuffer The buffer to write the packet to. Must be 4 byte aligned and at least PacketProcessor::GetMaxPacketBufferSize bytes. If NULL, the packet is written to an internal buffer.
+            @param keyState Precomputed cipher state for the key. Optional. See EncryptionManager::GetSendKeyState.
+            @param compress Should this packet be compressed? The packet is still sent uncompressed if it is below the compression threshold, or if compression doesn't save any space.
 
-            @returns A pointer to the packet data written. NULL if the packet write failed. This is an internal scratch buffer. Do not cache it and do not free it.
+            @returns A pointer to the packet data written. NULL if the packet write failed. If no packet buffer is passed in, this is an internal buffer. Do not cache it and do not free it.
          */
 
-        const uint8_t * WritePacket( Packet * packet, uint64_t sequence, int & packetBytes, bool encrypt, const uint8_t * key, Allocator & streamAllocator, PacketFactory & packetFactory );
+        const uint8_t * WritePacket( Packet * packet, uint64_t sequence, int & packetBytes, bool encrypt, const uint8_t * key, Allocator & streamAllocator, PacketFactory & packetFactory, uint8_t * packetBuffer = NULL, const PacketCipherState * keyState = NULL, bool compress = false );
+
+        /**
+            Serialize a packet, so it can be written any number of times with PacketProcessor::WriteSerializedPacket.
+
+            The serialized packet data is the packet data of an encrypted packet before it is encrypted: the packet type and the packet serialize, without the prefix, sequence or MAC.
+
+            @param packet The packet to serialize.
+            @param buffer The buffer to serialize the packet to. Must be 4 byte aligned.
+            @param bufferSize The size of the buffer (bytes). Must be a multiple of 4.
+            @param streamAllocator The allocator to set on the stream. See BaseStream::GetAllocator.
+            @param packetFactory The packet factory so we know the range of packet types supported.
+
+            @returns The number of bytes of serialized packet data. Zero if the packet failed to serialize or didn't fit in the buffer.
+         */
+
+        int SerializePacket( Packet * packet, uint8_t * buffer, int bufferSize, Allocator & streamAllocator, PacketFactory & packetFactory );
+
+        /**
+            Write an encrypted packet from serialized packet data.
+
+            Only the prefix and sequence are written, and the packet data is encrypted, so this skips creating and serializing the packet each time it is sent.
+
+            @param serializedData The serialized packet data. See PacketProcessor::SerializePacket.
+            @param serializedBytes The number of bytes of serialized packet data.
+            @param sequence The sequence number of the packet. Used as the nonce.
+            @param packetBytes The number of bytes of packet data written [out].
+            @param key The key used for packet encryption.
+            @param packetBuffer The buffer to write the packet to. Must be 4 byte aligned and at least PacketProcessor::GetMaxPacketBufferSize bytes. If NULL, the packet is written to an internal buffer.
+            @param keyState Precomputed cipher state for the key. Optional. See EncryptionManager::GetSendKeyState.
+
+            @returns A pointer to the packet data written. NULL if the packet write failed. If no packet buffer is passed in, this is an internal buffer. Do not cache it and do not free it.
+         */
+
+        const uint8_t * WriteSerializedPacket( const uint8_t * serializedData, int serializedBytes, uint64_t sequence, int & packetBytes, const uint8_t * key, uint8_t * packetBuffer = NULL, const PacketCipherState * keyState = NULL );
 
         /**
             Read a packet.
 
-            @param packetData The packet data to read.
+            @param packetData The packet data to read. Must be 4 byte aligned. IMPORTANT: Encrypted packets are decrypted in-place, so the packet data is modified by this function. Compressed packets are decompressed into an internal buffer.
             @param sequence The packet sequence number [out]. Only set for encrypted packets. Set to 0 for unencrypted packets.
             @param packetBytes The number of bytes of packet data to read.
             @param encrypted Set to true if the packet is encrypted [out].
@@ -122,11 +259,107 @@ namespace yojimbo
             @param streamAllocator The allocator to set on the stream. See BaseStream::GetAllocator.
             @param packetFactory The packet factory used to create the packet.
             @param replayProtection The replay protection buffer. Optional. Pass in NULL if not used.
+            @param keyState Precomputed cipher state for the key. Optional. See EncryptionManager::GetReceiveKeyState.
 
             @returns The packet object if it was successfully read, NULL otherwise. You are responsible for destroying the packet created by this function.
          */
 
-        Packet * ReadPacket( const uint8_t * packetData, uint64_t & sequence, int packetBytes, bool & encrypted, const uint8_t * key, const uint8_t * encryptedPacketTypes, const uint8_t * unencryptedPacketTypes, Allocator & streamAllocator, PacketFactory & packetFactory, ReplayProtection * replayProtection );
+        Packet * ReadPacket( uint8_t * packetData, uint64_t & sequence, int packetBytes, bool & encrypted, const uint8_t * key, const uint8_t * encryptedPacketTypes, const uint8_t * unencryptedPacketTypes, Allocator & streamAllocator, PacketFactory & packetFactory, ReplayProtection * replayProtection, const PacketCipherState * keyState = NULL );
+
+        /**
+            Write multiple packets into one encrypted packet.
+
+            Coalesced packets are laid out as [yojimbo::CoalescedPacketPrefix][prefix byte][sequence bytes][MAC][encrypted packet data], where the packet data is a list of [packet size (2 bytes)][packet]. All packets share the one sequence number, MAC and encryption pass.
+
+            Packets are written in order until the next packet doesn't fit in the maximum coalesced packet size. Packets that don't fit are not written, and it's up to the caller to send them some other way.
+
+            @param packets The packets to write. They must all be sent to the same address, with the same key.
+            @param numPackets The number of packets in [1,yojimbo::MaxCoalescedPackets].
+            @param numPacketsWritten The number of packets written [out]. These are always the first packets in the array.
+            @param sequence The sequence number of the coalesced packet. Used as the nonce.
+            @param packetBytes The number of bytes of packet data written [out].
+            @param maxPacketBytes The maximum size of the coalesced packet (bytes). Typically this is the fragment size, so coalesced packets are never fragmented.
+            @param key The key used for packet encryption.
+            @param streamAllocator The allocator to set on the stream. See BaseStream::GetAllocator.
+            @param packetFactory The packet factory so we know the range of packet types supported.
+            @param packetBuffer The buffer to write the packet to. Must be 4 byte aligned and at least PacketProcessor::GetMaxPacketBufferSize bytes. If NULL, the packet is written to an internal buffer.
+            @param keyState Precomputed cipher state for the key. Optional. See EncryptionManager::GetSendKeyState.
+
+            @returns A pointer to the packet data written. NULL if no packets were written, either because the write failed (see PacketProcessor::GetError) or because the first packet doesn't fit.
+         */
+
+        const uint8_t * WriteCoalescedPacket( Packet ** packets, int numPackets, int & numPacketsWritten, uint64_t sequence, int & packetBytes, int maxPacketBytes, const uint8_t * key, Allocator & streamAllocator, PacketFactory & packetFactory, uint8_t * packetBuffer = NULL, const PacketCipherState * keyState = NULL );
+
+        /**
+            Read a coalesced packet.
+
+            Coalesced packets are always encrypted. If any packet inside fails to read, the whole coalesced packet is discarded.
+
+            @param packetData The packet data to read, starting with yojimbo::CoalescedPacketPrefix. Must be 4 byte aligned. IMPORTANT: The packet is decrypted in-place, so the packet data is modified by this function.
+            @param packetBytes The number of bytes of packet data to read.
+            @param sequence The sequence number of the coalesced packet [out]. This is the sequence number for all packets inside it.
+            @param key The key used to decrypt the packet.
+            @param encryptedPacketTypes Entry n is 1 if packet type n is encrypted. Packets of other types inside the coalesced packet are rejected.
+            @param streamAllocator The allocator to set on the stream. See BaseStream::GetAllocator.
+            @param packetFactory The packet factory used to create the packets.
+            @param replayProtection The replay protection buffer. Optional. Pass in NULL if not used.
+            @param keyState Precomputed cipher state for the key. Optional. See EncryptionManager::GetReceiveKeyState.
+            @param packets The array of packets read [out]. Must have room for yojimbo::MaxCoalescedPackets packets. You are responsible for destroying the packets created by this function.
+
+            @returns The number of packets read. Zero if the coalesced packet failed to read.
+         */
+
+        int ReadCoalescedPacket( uint8_t * packetData, int packetBytes, uint64_t & sequence, const uint8_t * key, const uint8_t * encryptedPacketTypes, Allocator & streamAllocator, PacketFactory & packetFactory, ReplayProtection * replayProtection, const PacketCipherState * keyState, Packet ** packets );
+
+        /**
+            Check if an encrypted packet decrypts with a key, without modifying the packet.
+
+            The packet is decrypted into a scratch buffer, so this can be called with several keys in turn to find which key a packet was encrypted with. This is how the transport finds the client a packet from an unknown address belongs to. See TRANSPORT_FLAG_ADDRESS_MIGRATION.
+
+            @param packetData The packet data. May start with yojimbo::CompressedPacketPrefix or yojimbo::CoalescedPacketPrefix.
+            @param packetBytes The number of bytes of packet data.
+            @param sequence The sequence number of the packet [out]. Set even if the packet doesn't decrypt.
+            @param key The key to try.
+            @param keyState Precomputed cipher state for the key. Optional. See EncryptionManager::GetReceiveKeyState.
+
+            @returns True if the packet is encrypted and decrypts with the key, false otherwise.
+         */
+
+        bool CanDecryptPacket( const uint8_t * packetData, int packetBytes, uint64_t & sequence, const uint8_t * key, const PacketCipherState * keyState = NULL );
+
+        /**
+            Start batching packet encryption.
+
+            While a batch is open, encrypted packets written to a packet buffer passed in to PacketProcessor::WritePacket or PacketProcessor::WriteCoalescedPacket are serialized, but not encrypted. They are encrypted together by PacketProcessor::FlushEncryptBatch, which is much faster than encrypting each packet on its own. See yojimbo::EncryptBatch_InPlace.
+
+            Packets written to the internal packet buffer are always encrypted immediately, because the next packet written overwrites them.
+
+            IMPORTANT: Packet data written while a batch is open is not safe to send until PacketProcessor::FlushEncryptBatch returns true. The packet buffers and keys must stay valid until then.
+
+            @see PacketProcessor::EndEncryptBatch
+         */
+
+        void BeginEncryptBatch();
+
+        /**
+            Encrypt all packets written since the batch started, or since the last flush.
+
+            The batch stays open, so packets written after this are batched up again.
+
+            @returns True if all packets were encrypted. False if any packet failed to encrypt, in which case none of the packets written since the last flush should be sent.
+         */
+
+        bool FlushEncryptBatch();
+
+        /**
+            Stop batching packet encryption.
+
+            Encrypts any packets still waiting in the batch. Packets written after this are encrypted immediately.
+
+            @returns True if all packets were encrypted. See PacketProcessor::FlushEncryptBatch.
+         */
+
+        bool EndEncryptBatch();
 
         /**
             Gets the maximum packet size to be generated.
@@ -136,6 +369,16 @@ namespace yojimbo
 
         int GetMaxPacketSize() const { return m_maxPacketSize; }
 
+        /**
+            Gets the size of buffer needed to hold any packet written by this packet processor, including the prefix and encryption overhead.
+
+            This is always a multiple of 4, so an array of packet buffers of this size keeps each packet buffer aligned.
+
+            @returns The maximum packet buffer size in bytes.
+         */
+
+        int GetMaxPacketBufferSize() const { return m_absoluteMaxPacketSize; }
+
         /**
             Get the packet processor error level.
 
@@ -151,6 +394,12 @@ namespace yojimbo
 
     private:
 
+        int CompressPacketData( uint8_t * packetData, int packetDataBytes );
+
+        int DecompressPacketData( const uint8_t * packetData, int packetBytes, int headerBytes );
+
+        bool EncryptPacketData( uint8_t * message, int messageLength, uint8_t * mac, uint64_t sequence, const uint8_t * key, const PacketCipherState * keyState, bool canDefer );
+
         Allocator * m_allocator;                            ///< The allocator passed in to the constructor.
 
         uint64_t m_protocolId;                              ///< The protocol id. This is used as part of the CRC32 for unencrypted packets.
@@ -159,15 +408,27 @@ namespace yojimbo
 
         int m_maxPacketSize;                                ///< The maximum packet size (as in, serialized packet).
 
-        int m_absoluteMaxPacketSize;                        ///< The absolute maximum packet size, considering header and encryption overhead.
+        int m_absoluteMaxPacketSize;                        ///< The absolute maximum packet size, considering header and encryption overhead. Rounded up to a multiple of 4.
         
-        uint8_t * m_packetBuffer;                           ///< The packet buffer for reading and writing packets.
-        
-        uint8_t * m_scratchBuffer;                          ///< Scratch buffer used when one packet buffer is just not enough.
+        uint8_t * m_packetBuffer;                           ///< The packet buffer for writing packets, when no packet buffer is passed in to PacketProcessor::WritePacket.
 
         void * m_context;                                   ///< Context to set on stream.
 
         void * m_userContext;                               ///< User context to set on stream.
+
+        PacketCipher m_packetCipher;                        ///< The cipher used to encrypt and decrypt packets. See PacketProcessor::SetPacketCipher.
+
+        PacketCompressor * m_compressor;                    ///< The compressor used to compress and decompress packet data.
+
+        uint8_t * m_compressionBuffer;                      ///< Scratch buffer for compressed packet data on write, and decompressed packet data on read. Also used by PacketProcessor::CanDecryptPacket. Same size as a packet buffer.
+
+        int m_compressionThreshold;                         ///< Packet data smaller than this is not compressed. See PacketProcessor::SetCompressionThreshold.
+
+        bool m_encryptBatchOpen;                            ///< True between PacketProcessor::BeginEncryptBatch and PacketProcessor::EndEncryptBatch.
+
+        int m_numEncryptBatchEntries;                       ///< The number of packets waiting to be encrypted in the batch.
+
+        EncryptBatchEntry * m_encryptBatchEntries;          ///< Packets waiting to be encrypted. Holds yojimbo::PacketSendBatchSize entries. If the batch fills up, more packets are encrypted immediately.
     };
 }
 
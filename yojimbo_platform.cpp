@@ -24,6 +24,7 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_platform.h"
+#include "yojimbo_allocator.h"
 #include <assert.h>
 
 #if __APPLE__
@@ -35,70 +36,926 @@
 #include <unistd.h>
 #include <mach/mach.h>
 #include <mach/mach_time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+namespace yojimbo
+{
+    static inline void platform_cpu_relax()
+    {
+#if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__( "yield" );
+#endif
+    }
+
+    void platform_sleep( double time )
+    {
+        usleep( (int) ( time * 1000000 ) );
+    }
+
+    uint64_t platform_time_ns()
+    {
+        static uint64_t start = 0;
+
+        static mach_timebase_info_data_t timebase_info;
+
+        if ( start == 0 )
+        {
+            mach_timebase_info( &timebase_info );
+            start = mach_absolute_time();
+            return 0;
+        }
+
+        uint64_t current = mach_absolute_time();
+
+        if ( current < start )
+            current = start;
+
+        // IMPORTANT: Split the conversion into whole and remainder parts, so multiplying by the timebase numerator can't overflow
+
+        const uint64_t ticks = current - start;
+
+        return ( ticks / timebase_info.denom ) * timebase_info.numer + ( ticks % timebase_info.denom ) * timebase_info.numer / timebase_info.denom;
+    }
+
+    double platform_time()
+    {
+        return double( platform_time_ns() ) / 1000000000.0;
+    }
+
+    static const uint64_t PlatformSleepSpinTime = 500000;              // spin for the last 0.5ms before a deadline instead of sleeping through it
+
+    void platform_sleep_until( uint64_t deadline )
+    {
+        const uint64_t current = platform_time_ns();
+
+        if ( current + PlatformSleepSpinTime < deadline )
+            usleep( useconds_t( ( deadline - current - PlatformSleepSpinTime ) / 1000 ) );
+
+        while ( platform_time_ns() < deadline )
+            platform_cpu_relax();
+    }
+
+    struct PlatformThread
+    {
+        pthread_t handle;
+        PlatformThreadFunction function;
+        void * data;
+    };
+
+    static void * platform_thread_start( void * arg )
+    {
+        PlatformThread * thread = (PlatformThread*) arg;
+        thread->function( thread->data );
+        return NULL;
+    }
+
+    PlatformThread * platform_thread_create( Allocator & allocator, PlatformThreadFunction function, void * data )
+    {
+        assert( function );
+
+        PlatformThread * thread = YOJIMBO_NEW( allocator, PlatformThread );
+        if ( !thread )
+            return NULL;
+
+        thread->function = function;
+        thread->data = data;
+
+        if ( pthread_create( &thread->handle, NULL, platform_thread_start, thread ) != 0 )
+        {
+            YOJIMBO_DELETE( allocator, PlatformThread, thread );
+            return NULL;
+        }
+
+        return thread;
+    }
+
+    void platform_thread_join( Allocator & allocator, PlatformThread * thread )
+    {
+        assert( thread );
+        pthread_join( thread->handle, NULL );
+        YOJIMBO_DELETE( allocator, PlatformThread, thread );
+    }
+
+    bool platform_thread_set_affinity( PlatformThread * thread, int cpu )
+    {
+        // IMPORTANT: MacOS only has affinity tags, which are hints for threads that share caches. Threads can't be pinned to a core.
+        (void) thread;
+        (void) cpu;
+        return false;
+    }
+
+    int platform_cpu_numa_node( int cpu )
+    {
+        (void) cpu;
+        return 0;
+    }
+
+    uint64_t platform_thread_id()
+    {
+        return uint64_t( uintptr_t( pthread_self() ) );
+    }
+
+    size_t platform_page_size()
+    {
+        return (size_t) sysconf( _SC_PAGESIZE );
+    }
+
+    void * platform_memory_reserve( size_t bytes )
+    {
+        assert( bytes > 0 );
+        void * memory = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+        return ( memory != MAP_FAILED ) ? memory : NULL;
+    }
+
+    void platform_memory_release( void * memory, size_t bytes )
+    {
+        assert( memory );
+        munmap( memory, bytes );
+    }
+
+    size_t platform_huge_page_size()
+    {
+        return 2 * 1024 * 1024;
+    }
+
+    void * platform_memory_reserve_huge_pages( size_t bytes, bool & hugePages )
+    {
+        assert( bytes > 0 );
+        assert( ( bytes % platform_huge_page_size() ) == 0 );
+
+        hugePages = false;
+
+#if defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+        // IMPORTANT: On MacOS the file descriptor argument to mmap carries the superpage flags for anonymous memory.
+        void * memory = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, VM_FLAGS_SUPERPAGE_SIZE_2MB, 0 );
+        if ( memory != MAP_FAILED )
+        {
+            hugePages = true;
+            return memory;
+        }
+#endif // #if defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+
+        const size_t alignment = platform_huge_page_size();
+
+        uint8_t * reserved = (uint8_t*) mmap( NULL, bytes + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+        if ( reserved == MAP_FAILED )
+            return NULL;
+
+        uint8_t * aligned = (uint8_t*) ( ( uintptr_t( reserved ) + alignment - 1 ) & ~uintptr_t( alignment - 1 ) );
+
+        const size_t headBytes = aligned - reserved;
+        if ( headBytes > 0 )
+            munmap( reserved, headBytes );
+
+        const size_t tailBytes = alignment - headBytes;
+        if ( tailBytes > 0 )
+            munmap( aligned + bytes, tailBytes );
+
+        return aligned;
+    }
+
+    bool platform_memory_set_numa_node( void * memory, size_t bytes, int node )
+    {
+        (void) memory;
+        (void) bytes;
+        (void) node;
+        return false;
+    }
+
+    void platform_memory_discard( void * memory, size_t bytes )
+    {
+        assert( memory );
+        assert( ( uintptr_t( memory ) & ( platform_page_size() - 1 ) ) == 0 );
+        assert( ( bytes & ( platform_page_size() - 1 ) ) == 0 );
+        madvise( memory, bytes, MADV_FREE );
+    }
+
+    struct PlatformSharedMemory
+    {
+        void * data;
+        size_t bytes;
+        bool owner;
+        char name[256];
+    };
+
+    static void platform_shared_memory_name( char * buffer, int bufferSize, const char * name )
+    {
+        // IMPORTANT: POSIX shared memory names must start with a slash to be portable
+        snprintf( buffer, bufferSize, "/%s", name );
+    }
+
+    PlatformSharedMemory * platform_shared_memory_create( Allocator & allocator, const char * name, size_t bytes )
+    {
+        assert( name );
+        assert( bytes > 0 );
+
+        PlatformSharedMemory * memory = YOJIMBO_NEW( allocator, PlatformSharedMemory );
+        if ( !memory )
+            return NULL;
+
+        platform_shared_memory_name( memory->name, sizeof( memory->name ), name );
+
+        shm_unlink( memory->name );
+
+        const int fd = shm_open( memory->name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+        if ( fd < 0 )
+        {
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
+
+        if ( ftruncate( fd, off_t( bytes ) ) != 0 )
+        {
+            close( fd );
+            shm_unlink( memory->name );
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
+
+        void * data = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+        close( fd );
+
+        if ( data == MAP_FAILED )
+        {
+            shm_unlink( memory->name );
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
+
+        memory->data = data;
+        memory->bytes = bytes;
+        memory->owner = true;
+
+        return memory;
+    }
+
+    PlatformSharedMemory * platform_shared_memory_open( Allocator & allocator, const char * name )
+    {
+        assert( name );
+
+        PlatformSharedMemory * memory = YOJIMBO_NEW( allocator, PlatformSharedMemory );
+        if ( !memory )
+            return NULL;
+
+        platform_shared_memory_name( memory->name, sizeof( memory->name ), name );
+
+        const int fd = shm_open( memory->name, O_RDWR, 0 );
+        if ( fd < 0 )
+        {
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
+
+        struct stat info;
+        if ( fstat( fd, &info ) != 0 || info.st_size <= 0 )
+        {
+            close( fd );
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
+
+        const size_t bytes = size_t( info.st_size );
+
+        void * data = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+        close( fd );
+
+        if ( data == MAP_FAILED )
+        {
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
+
+        memory->data = data;
+        memory->bytes = bytes;
+        memory->owner = false;
+
+        return memory;
+    }
+
+    void * platform_shared_memory_data( PlatformSharedMemory * memory )
+    {
+        assert( memory );
+        return memory->data;
+    }
+
+    size_t platform_shared_memory_size( PlatformSharedMemory * memory )
+    {
+        assert( memory );
+        return memory->bytes;
+    }
+
+    void platform_shared_memory_close( Allocator & allocator, PlatformSharedMemory * memory )
+    {
+        assert( memory );
+
+        munmap( memory->data, memory->bytes );
+
+        if ( memory->owner )
+            shm_unlink( memory->name );
+
+        YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+    }
+
+    struct PlatformMappedFile
+    {
+        void * data;
+        size_t bytes;
+    };
+
+    PlatformMappedFile * platform_mapped_file_open( Allocator & allocator, const char * path )
+    {
+        assert( path );
+
+        const int fd = open( path, O_RDONLY );
+        if ( fd < 0 )
+            return NULL;
+
+        struct stat info;
+        if ( fstat( fd, &info ) != 0 || info.st_size <= 0 )
+        {
+            close( fd );
+            return NULL;
+        }
+
+        const size_t bytes = size_t( info.st_size );
+
+        void * data = mmap( NULL, bytes, PROT_READ, MAP_SHARED, fd, 0 );
+
+        close( fd );
+
+        if ( data == MAP_FAILED )
+            return NULL;
+
+        PlatformMappedFile * file = YOJIMBO_NEW( allocator, PlatformMappedFile );
+        if ( !file )
+        {
+            munmap( data, bytes );
+            return NULL;
+        }
+
+        file->data = data;
+        file->bytes = bytes;
+
+        return file;
+    }
+
+    const void * platform_mapped_file_data( PlatformMappedFile * file )
+    {
+        assert( file );
+        return file->data;
+    }
+
+    size_t platform_mapped_file_size( PlatformMappedFile * file )
+    {
+        assert( file );
+        return file->bytes;
+    }
+
+    void platform_mapped_file_close( Allocator & allocator, PlatformMappedFile * file )
+    {
+        assert( file );
+        munmap( file->data, file->bytes );
+        YOJIMBO_DELETE( allocator, PlatformMappedFile, file );
+    }
+
+    void platform_wait_on_address( int * address, int value, double timeout )
+    {
+        assert( address );
+
+        if ( __atomic_load_n( address, __ATOMIC_ACQUIRE ) != value || timeout <= 0.0 )
+            return;
+
+        platform_sleep( timeout < 0.001 ? timeout : 0.001 );
+    }
+
+    void platform_wake_address( int * address )
+    {
+        assert( address );
+    }
+}
+
+#elif __linux
+
+// ===============================
+//              Linux
+// ===============================
+
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <dirent.h>
+#include <string.h>
+namespace yojimbo
+{
+    static inline void platform_cpu_relax()
+    {
+#if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__( "yield" );
+#endif
+    }
+
+    void platform_sleep( double time )
+    {
+        usleep( (int) ( time * 1000000 ) );
+    }
+
+    uint64_t platform_time_ns()
+    {
+        static uint64_t start = 0;
+
+        timespec ts;
+        clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
+        const uint64_t current = uint64_t( ts.tv_sec ) * 1000000000ULL + uint64_t( ts.tv_nsec );
+
+        if ( start == 0 )
+        {
+            start = current;
+            return 0;
+        }
+
+        if ( current < start )
+            return 0;
+
+        return current - start;
+    }
+
+    double platform_time()
+    {
+        return double( platform_time_ns() ) / 1000000000.0;
+    }
+
+    static const uint64_t PlatformSleepSpinTime = 200000;              // spin for the last 0.2ms before a deadline instead of sleeping through it
+
+    void platform_sleep_until( uint64_t deadline )
+    {
+        const uint64_t current = platform_time_ns();
+
+        if ( current + PlatformSleepSpinTime < deadline )
+        {
+            const uint64_t sleepTime = deadline - current - PlatformSleepSpinTime;
+
+            timespec ts;
+            ts.tv_sec = time_t( sleepTime / 1000000000ULL );
+            ts.tv_nsec = long( sleepTime % 1000000000ULL );
+
+            nanosleep( &ts, NULL );
+        }
+
+        while ( platform_time_ns() < deadline )
+            platform_cpu_relax();
+    }
+
+    struct PlatformThread
+    {
+        pthread_t handle;
+        PlatformThreadFunction function;
+        void * data;
+    };
+
+    static void * platform_thread_start( void * arg )
+    {
+        PlatformThread * thread = (PlatformThread*) arg;
+        thread->function( thread->data );
+        return NULL;
+    }
+
+    PlatformThread * platform_thread_create( Allocator & allocator, PlatformThreadFunction function, void * data )
+    {
+        assert( function );
+
+        PlatformThread * thread = YOJIMBO_NEW( allocator, PlatformThread );
+        if ( !thread )
+            return NULL;
+
+        thread->function = function;
+        thread->data = data;
+
+        if ( pthread_create( &thread->handle, NULL, platform_thread_start, thread ) != 0 )
+        {
+            YOJIMBO_DELETE( allocator, PlatformThread, thread );
+            return NULL;
+        }
+
+        return thread;
+    }
+
+    void platform_thread_join( Allocator & allocator, PlatformThread * thread )
+    {
+        assert( thread );
+        pthread_join( thread->handle, NULL );
+        YOJIMBO_DELETE( allocator, PlatformThread, thread );
+    }
+
+    bool platform_thread_set_affinity( PlatformThread * thread, int cpu )
+    {
+        assert( cpu >= 0 );
+
+        if ( cpu >= CPU_SETSIZE )
+            return false;
+
+        cpu_set_t cpus;
+        CPU_ZERO( &cpus );
+        CPU_SET( cpu, &cpus );
+
+        const pthread_t handle = thread ? thread->handle : pthread_self();
+
+        return pthread_setaffinity_np( handle, sizeof( cpus ), &cpus ) == 0;
+    }
+
+    int platform_cpu_numa_node( int cpu )
+    {
+        assert( cpu >= 0 );
+
+        // IMPORTANT: Each CPU core has a link to its NUMA node in sysfs, eg. /sys/devices/system/cpu/cpu3/node1.
+
+        char path[256];
+        snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%d", cpu );
+
+        DIR * dir = opendir( path );
+        if ( !dir )
+            return -1;
+
+        int node = -1;
+
+        struct dirent * entry;
+        while ( ( entry = readdir( dir ) ) != NULL )
+        {
+            if ( sscanf( entry->d_name, "node%d", &node ) == 1 )
+                break;
+            node = -1;
+        }
+
+        closedir( dir );
+
+        return node;
+    }
+
+    uint64_t platform_thread_id()
+    {
+        return uint64_t( uintptr_t( pthread_self() ) );
+    }
+
+    size_t platform_page_size()
+    {
+        return (size_t) sysconf( _SC_PAGESIZE );
+    }
+
+    void * platform_memory_reserve( size_t bytes )
+    {
+        assert( bytes > 0 );
+        void * memory = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+        return ( memory != MAP_FAILED ) ? memory : NULL;
+    }
+
+    void platform_memory_release( void * memory, size_t bytes )
+    {
+        assert( memory );
+        munmap( memory, bytes );
+    }
+
+    size_t platform_huge_page_size()
+    {
+        // IMPORTANT: MAP_HUGETLB uses the default huge page size, which is not 2MB on every system (eg. arm64 with 64KB pages), so read it once from /proc/meminfo.
+
+        static size_t hugePageSize = 0;
+
+        if ( hugePageSize == 0 )
+        {
+            size_t bytes = 2 * 1024 * 1024;
+
+            FILE * file = fopen( "/proc/meminfo", "r" );
+            if ( file )
+            {
+                char line[256];
+                unsigned long kilobytes;
+                while ( fgets( line, sizeof( line ), file ) )
+                {
+                    if ( sscanf( line, "Hugepagesize: %lu kB", &kilobytes ) == 1 && kilobytes > 0 )
+                    {
+                        bytes = size_t( kilobytes ) * 1024;
+                        break;
+                    }
+                }
+                fclose( file );
+            }
+
+            hugePageSize = bytes;
+        }
+
+        return hugePageSize;
+    }
+
+    void * platform_memory_reserve_huge_pages( size_t bytes, bool & hugePages )
+    {
+        assert( bytes > 0 );
+        assert( ( bytes % platform_huge_page_size() ) == 0 );
+
+        hugePages = false;
+
+#if defined(MAP_HUGETLB)
+        void * memory = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if ( memory != MAP_FAILED )
+        {
+            hugePages = true;
+            return memory;
+        }
+#endif // #if defined(MAP_HUGETLB)
+
+        // IMPORTANT: No huge pages are set aside for MAP_HUGETLB, so fall back to regular pages. Aligning the block to the huge page size lets the kernel back all of it with transparent huge pages.
+
+        const size_t alignment = platform_huge_page_size();
+
+        uint8_t * reserved = (uint8_t*) mmap( NULL, bytes + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+        if ( reserved == MAP_FAILED )
+            return NULL;
+
+        uint8_t * aligned = (uint8_t*) ( ( uintptr_t( reserved ) + alignment - 1 ) & ~uintptr_t( alignment - 1 ) );
+
+        const size_t headBytes = aligned - reserved;
+        if ( headBytes > 0 )
+            munmap( reserved, headBytes );
+
+        const size_t tailBytes = alignment - headBytes;
+        if ( tailBytes > 0 )
+            munmap( aligned + bytes, tailBytes );
+
+#if defined(MADV_HUGEPAGE)
+        madvise( aligned, bytes, MADV_HUGEPAGE );
+#endif // #if defined(MADV_HUGEPAGE)
+
+        return aligned;
+    }
+
+    bool platform_memory_set_numa_node( void * memory, size_t bytes, int node )
+    {
+        assert( memory );
+        assert( node >= 0 );
+
+#if defined(SYS_mbind)
+        const uintptr_t pageSize = platform_page_size();
+
+        const uintptr_t start = ( uintptr_t( memory ) + pageSize - 1 ) & ~( pageSize - 1 );
+        const uintptr_t end = ( uintptr_t( memory ) + bytes ) & ~( pageSize - 1 );
+
+        if ( end <= start )
+            return false;
+
+        unsigned long nodeMask[16];
+
+        if ( node >= int( sizeof( nodeMask ) * 8 ) )
+            return false;
+
+        memset( nodeMask, 0, sizeof( nodeMask ) );
+        nodeMask[node / ( sizeof( unsigned long ) * 8 )] = 1UL << ( node % ( sizeof( unsigned long ) * 8 ) );
+
+        // IMPORTANT: MPOL_PREFERRED falls back to other nodes when the node runs out of memory, instead of failing allocations like MPOL_BIND.
+
+        return syscall( SYS_mbind, (void*) start, end - start, MPOL_PREFERRED, nodeMask, sizeof( nodeMask ) * 8 + 1, MPOL_MF_MOVE ) == 0;
+#else // #if defined(SYS_mbind)
+        (void) memory;
+        (void) bytes;
+        (void) node;
+        return false;
+#endif // #if defined(SYS_mbind)
+    }
 
-namespace yojimbo
-{
-    void platform_sleep( double time )
+    void platform_memory_discard( void * memory, size_t bytes )
     {
-        usleep( (int) ( time * 1000000 ) );
+        assert( memory );
+        assert( ( uintptr_t( memory ) & ( platform_page_size() - 1 ) ) == 0 );
+        assert( ( bytes & ( platform_page_size() - 1 ) ) == 0 );
+        madvise( memory, bytes, MADV_DONTNEED );
     }
 
-    double platform_time()
+    struct PlatformSharedMemory
     {
-        static uint64_t start = 0;
+        void * data;
+        size_t bytes;
+        bool owner;
+        char name[256];
+    };
 
-        static mach_timebase_info_data_t timebase_info;
+    static void platform_shared_memory_name( char * buffer, int bufferSize, const char * name )
+    {
+        // IMPORTANT: POSIX shared memory names must start with a slash to be portable
+        snprintf( buffer, bufferSize, "/%s", name );
+    }
 
-        if ( start == 0 )
+    PlatformSharedMemory * platform_shared_memory_create( Allocator & allocator, const char * name, size_t bytes )
+    {
+        assert( name );
+        assert( bytes > 0 );
+
+        PlatformSharedMemory * memory = YOJIMBO_NEW( allocator, PlatformSharedMemory );
+        if ( !memory )
+            return NULL;
+
+        platform_shared_memory_name( memory->name, sizeof( memory->name ), name );
+
+        shm_unlink( memory->name );
+
+        const int fd = shm_open( memory->name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+        if ( fd < 0 )
         {
-            mach_timebase_info( &timebase_info );
-            start = mach_absolute_time();
-            return 0.0;
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
         }
 
-        uint64_t current = mach_absolute_time();
+        if ( ftruncate( fd, off_t( bytes ) ) != 0 )
+        {
+            close( fd );
+            shm_unlink( memory->name );
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
 
-        if ( current < start )
-            current = start;
+        void * data = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+        close( fd );
 
-        return ( double( current - start ) * double( timebase_info.numer ) / double( timebase_info.denom ) ) / 1000000000.0;
+        if ( data == MAP_FAILED )
+        {
+            shm_unlink( memory->name );
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
+
+        memory->data = data;
+        memory->bytes = bytes;
+        memory->owner = true;
+
+        return memory;
     }
-}
 
-#elif __linux
+    PlatformSharedMemory * platform_shared_memory_open( Allocator & allocator, const char * name )
+    {
+        assert( name );
 
-// ===============================
-//              Linux
-// ===============================
+        PlatformSharedMemory * memory = YOJIMBO_NEW( allocator, PlatformSharedMemory );
+        if ( !memory )
+            return NULL;
 
-#include <unistd.h>
-#include <time.h>
+        platform_shared_memory_name( memory->name, sizeof( memory->name ), name );
 
-namespace yojimbo
-{
-    void platform_sleep( double time )
+        const int fd = shm_open( memory->name, O_RDWR, 0 );
+        if ( fd < 0 )
+        {
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
+
+        struct stat info;
+        if ( fstat( fd, &info ) != 0 || info.st_size <= 0 )
+        {
+            close( fd );
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
+
+        const size_t bytes = size_t( info.st_size );
+
+        void * data = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+
+        close( fd );
+
+        if ( data == MAP_FAILED )
+        {
+            YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+            return NULL;
+        }
+
+        memory->data = data;
+        memory->bytes = bytes;
+        memory->owner = false;
+
+        return memory;
+    }
+
+    void * platform_shared_memory_data( PlatformSharedMemory * memory )
     {
-        usleep( (int) ( time * 1000000 ) );
+        assert( memory );
+        return memory->data;
     }
 
-    double platform_time()
+    size_t platform_shared_memory_size( PlatformSharedMemory * memory )
+    {
+        assert( memory );
+        return memory->bytes;
+    }
+
+    void platform_shared_memory_close( Allocator & allocator, PlatformSharedMemory * memory )
+    {
+        assert( memory );
+
+        munmap( memory->data, memory->bytes );
+
+        if ( memory->owner )
+            shm_unlink( memory->name );
+
+        YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+    }
+
+    struct PlatformMappedFile
+    {
+        void * data;
+        size_t bytes;
+    };
+
+    PlatformMappedFile * platform_mapped_file_open( Allocator & allocator, const char * path )
     {
-        static double start = -1;
+        assert( path );
+
+        const int fd = open( path, O_RDONLY );
+        if ( fd < 0 )
+            return NULL;
 
-        if ( start == -1 )
+        struct stat info;
+        if ( fstat( fd, &info ) != 0 || info.st_size <= 0 )
         {
-            timespec ts;
-            clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
-            start = ts.tv_sec + double( ts.tv_nsec ) / 1000000000.0;
-            return 0.0;
+            close( fd );
+            return NULL;
+        }
+
+        const size_t bytes = size_t( info.st_size );
+
+        void * data = mmap( NULL, bytes, PROT_READ, MAP_SHARED, fd, 0 );
+
+        close( fd );
+
+        if ( data == MAP_FAILED )
+            return NULL;
+
+        PlatformMappedFile * file = YOJIMBO_NEW( allocator, PlatformMappedFile );
+        if ( !file )
+        {
+            munmap( data, bytes );
+            return NULL;
         }
 
+        file->data = data;
+        file->bytes = bytes;
+
+        return file;
+    }
+
+    const void * platform_mapped_file_data( PlatformMappedFile * file )
+    {
+        assert( file );
+        return file->data;
+    }
+
+    size_t platform_mapped_file_size( PlatformMappedFile * file )
+    {
+        assert( file );
+        return file->bytes;
+    }
+
+    void platform_mapped_file_close( Allocator & allocator, PlatformMappedFile * file )
+    {
+        assert( file );
+        munmap( file->data, file->bytes );
+        YOJIMBO_DELETE( allocator, PlatformMappedFile, file );
+    }
+
+    void platform_wait_on_address( int * address, int value, double timeout )
+    {
+        assert( address );
+
+        if ( timeout <= 0.0 )
+            return;
+
         timespec ts;
-        clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
-        double current = ts.tv_sec + double( ts.tv_nsec ) / 1000000000.0;
-        if ( current < start )
-            current = start;
-        return current - start;
+        ts.tv_sec = time_t( timeout );
+        ts.tv_nsec = long( ( timeout - double( ts.tv_sec ) ) * 1000000000.0 );
+
+        // IMPORTANT: not FUTEX_PRIVATE_FLAG, the integer lives in memory shared with other processes
+
+        syscall( SYS_futex, address, FUTEX_WAIT, value, &ts, NULL, 0 );
+    }
+
+    void platform_wake_address( int * address )
+    {
+        assert( address );
+
+        syscall( SYS_futex, address, FUTEX_WAKE, INT_MAX, NULL, NULL, 0 );
     }
 }
 
@@ -110,6 +967,7 @@ namespace yojimbo
 
 #define NOMINMAX
 #include <windows.h>
+#include <string.h>
 
 namespace yojimbo
 {
@@ -123,7 +981,7 @@ namespace yojimbo
     static LARGE_INTEGER timer_frequency;
     static LARGE_INTEGER timer_start;
 
-    double platform_time()
+    uint64_t platform_time_ns()
     {
         if ( !timer_initialized )
         {
@@ -135,7 +993,370 @@ namespace yojimbo
         QueryPerformanceCounter( &now );
         if ( now.QuadPart < timer_start.QuadPart )
             now.QuadPart = timer_start.QuadPart;
-        return double( now.QuadPart - timer_start.QuadPart ) / double( timer_frequency.QuadPart );
+
+        // IMPORTANT: Split the conversion into whole seconds and the remainder, so multiplying by a billion can't overflow
+
+        const uint64_t counts = uint64_t( now.QuadPart - timer_start.QuadPart );
+        const uint64_t frequency = uint64_t( timer_frequency.QuadPart );
+
+        return ( counts / frequency ) * 1000000000ULL + ( counts % frequency ) * 1000000000ULL / frequency;
+    }
+
+    double platform_time()
+    {
+        return double( platform_time_ns() ) / 1000000000.0;
+    }
+
+    static const uint64_t PlatformSleepSpinTime = 2000000;             // spin for the last 2ms before a deadline, because Sleep is only precise to the timer resolution
+
+    void platform_sleep_until( uint64_t deadline )
+    {
+        const uint64_t current = platform_time_ns();
+
+        if ( current + PlatformSleepSpinTime < deadline )
+            Sleep( DWORD( ( deadline - current - PlatformSleepSpinTime ) / 1000000 ) );
+
+        while ( platform_time_ns() < deadline )
+            YieldProcessor();
+    }
+
+    struct PlatformThread
+    {
+        HANDLE handle;
+        PlatformThreadFunction function;
+        void * data;
+    };
+
+    static DWORD WINAPI platform_thread_start( LPVOID arg )
+    {
+        PlatformThread * thread = (PlatformThread*) arg;
+        thread->function( thread->data );
+        return 0;
+    }
+
+    PlatformThread * platform_thread_create( Allocator & allocator, PlatformThreadFunction function, void * data )
+    {
+        assert( function );
+
+        PlatformThread * thread = YOJIMBO_NEW( allocator, PlatformThread );
+        if ( !thread )
+            return NULL;
+
+        thread->function = function;
+        thread->data = data;
+        thread->handle = CreateThread( NULL, 0, platform_thread_start, thread, 0, NULL );
+
+        if ( thread->handle == NULL )
+        {
+            YOJIMBO_DELETE( allocator, PlatformThread, thread );
+            return NULL;
+        }
+
+        return thread;
+    }
+
+    void platform_thread_join( Allocator & allocator, PlatformThread * thread )
+    {
+        assert( thread );
+        WaitForSingleObject( thread->handle, INFINITE );
+        CloseHandle( thread->handle );
+        YOJIMBO_DELETE( allocator, PlatformThread, thread );
+    }
+
+    bool platform_thread_set_affinity( PlatformThread * thread, int cpu )
+    {
+        assert( cpu >= 0 );
+
+        // IMPORTANT: Windows numbers CPU cores within processor groups of up to 64 cores.
+
+        GROUP_AFFINITY affinity;
+        memset( &affinity, 0, sizeof( affinity ) );
+        affinity.Group = WORD( cpu / 64 );
+        affinity.Mask = KAFFINITY( 1 ) << ( cpu % 64 );
+
+        return SetThreadGroupAffinity( thread ? thread->handle : GetCurrentThread(), &affinity, NULL ) != 0;
+    }
+
+    int platform_cpu_numa_node( int cpu )
+    {
+        assert( cpu >= 0 );
+
+        PROCESSOR_NUMBER processor;
+        memset( &processor, 0, sizeof( processor ) );
+        processor.Group = WORD( cpu / 64 );
+        processor.Number = BYTE( cpu % 64 );
+
+        USHORT node = 0;
+        if ( !GetNumaProcessorNodeEx( &processor, &node ) || node == 0xFFFF )
+            return -1;
+
+        return int( node );
+    }
+
+    uint64_t platform_thread_id()
+    {
+        return uint64_t( GetCurrentThreadId() );
+    }
+
+    size_t platform_page_size()
+    {
+        SYSTEM_INFO info;
+        GetSystemInfo( &info );
+        return (size_t) info.dwPageSize;
+    }
+
+    void * platform_memory_reserve( size_t bytes )
+    {
+        assert( bytes > 0 );
+        return VirtualAlloc( NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+    }
+
+    void platform_memory_release( void * memory, size_t bytes )
+    {
+        assert( memory );
+        (void) bytes;
+        VirtualFree( memory, 0, MEM_RELEASE );
+    }
+
+    size_t platform_huge_page_size()
+    {
+        const size_t largePageSize = GetLargePageMinimum();
+        return largePageSize ? largePageSize : 2 * 1024 * 1024;
+    }
+
+    void * platform_memory_reserve_huge_pages( size_t bytes, bool & hugePages )
+    {
+        assert( bytes > 0 );
+        assert( ( bytes % platform_huge_page_size() ) == 0 );
+
+        hugePages = false;
+
+        // IMPORTANT: Large pages are only allocated if the process has the "Lock pages in memory" privilege (SeLockMemoryPrivilege) enabled. Otherwise this fails and we fall back to regular pages.
+
+        if ( GetLargePageMinimum() != 0 )
+        {
+            void * memory = VirtualAlloc( NULL, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+            if ( memory )
+            {
+                hugePages = true;
+                return memory;
+            }
+        }
+
+        return VirtualAlloc( NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+    }
+
+    bool platform_memory_set_numa_node( void * memory, size_t bytes, int node )
+    {
+        // IMPORTANT: Memory that is already allocated can't be moved to another node on Windows. Pages are placed on the node of the thread that first touches them.
+        (void) memory;
+        (void) bytes;
+        (void) node;
+        return false;
+    }
+
+    void platform_memory_discard( void * memory, size_t bytes )
+    {
+        // IMPORTANT: MEM_RESET keeps the pages committed, so they can be touched again without being recommitted, unlike MEM_DECOMMIT.
+
+        assert( memory );
+        assert( ( uintptr_t( memory ) & ( platform_page_size() - 1 ) ) == 0 );
+        assert( ( bytes & ( platform_page_size() - 1 ) ) == 0 );
+        VirtualAlloc( memory, bytes, MEM_RESET, PAGE_READWRITE );
+    }
+
+    struct PlatformSharedMemory
+    {
+        HANDLE handle;
+        void * data;
+        size_t bytes;
+    };
+
+    PlatformSharedMemory * platform_shared_memory_create( Allocator & allocator, const char * name, size_t bytes )
+    {
+        assert( name );
+        assert( bytes > 0 );
+
+        const uint64_t size = uint64_t( bytes );
+
+        HANDLE handle = CreateFileMappingA( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD( size >> 32 ), DWORD( size & 0xFFFFFFFF ), name );
+        if ( !handle )
+            return NULL;
+
+        if ( GetLastError() == ERROR_ALREADY_EXISTS )
+        {
+            CloseHandle( handle );
+            return NULL;
+        }
+
+        void * data = MapViewOfFile( handle, FILE_MAP_ALL_ACCESS, 0, 0, bytes );
+        if ( !data )
+        {
+            CloseHandle( handle );
+            return NULL;
+        }
+
+        PlatformSharedMemory * memory = YOJIMBO_NEW( allocator, PlatformSharedMemory );
+        if ( !memory )
+        {
+            UnmapViewOfFile( data );
+            CloseHandle( handle );
+            return NULL;
+        }
+
+        memory->handle = handle;
+        memory->data = data;
+        memory->bytes = bytes;
+
+        return memory;
+    }
+
+    PlatformSharedMemory * platform_shared_memory_open( Allocator & allocator, const char * name )
+    {
+        assert( name );
+
+        HANDLE handle = OpenFileMappingA( FILE_MAP_ALL_ACCESS, FALSE, name );
+        if ( !handle )
+            return NULL;
+
+        void * data = MapViewOfFile( handle, FILE_MAP_ALL_ACCESS, 0, 0, 0 );
+        if ( !data )
+        {
+            CloseHandle( handle );
+            return NULL;
+        }
+
+        MEMORY_BASIC_INFORMATION info;
+        if ( VirtualQuery( data, &info, sizeof( info ) ) == 0 )
+        {
+            UnmapViewOfFile( data );
+            CloseHandle( handle );
+            return NULL;
+        }
+
+        PlatformSharedMemory * memory = YOJIMBO_NEW( allocator, PlatformSharedMemory );
+        if ( !memory )
+        {
+            UnmapViewOfFile( data );
+            CloseHandle( handle );
+            return NULL;
+        }
+
+        memory->handle = handle;
+        memory->data = data;
+        memory->bytes = size_t( info.RegionSize );
+
+        return memory;
+    }
+
+    void * platform_shared_memory_data( PlatformSharedMemory * memory )
+    {
+        assert( memory );
+        return memory->data;
+    }
+
+    size_t platform_shared_memory_size( PlatformSharedMemory * memory )
+    {
+        assert( memory );
+        return memory->bytes;
+    }
+
+    void platform_shared_memory_close( Allocator & allocator, PlatformSharedMemory * memory )
+    {
+        assert( memory );
+        UnmapViewOfFile( memory->data );
+        CloseHandle( memory->handle );
+        YOJIMBO_DELETE( allocator, PlatformSharedMemory, memory );
+    }
+
+    struct PlatformMappedFile
+    {
+        HANDLE handle;
+        void * data;
+        size_t bytes;
+    };
+
+    PlatformMappedFile * platform_mapped_file_open( Allocator & allocator, const char * path )
+    {
+        assert( path );
+
+        HANDLE fileHandle = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+        if ( fileHandle == INVALID_HANDLE_VALUE )
+            return NULL;
+
+        LARGE_INTEGER size;
+        if ( !GetFileSizeEx( fileHandle, &size ) || size.QuadPart <= 0 )
+        {
+            CloseHandle( fileHandle );
+            return NULL;
+        }
+
+        // IMPORTANT: the mapping holds its own reference to the file, so the file handle can be closed straight away.
+
+        HANDLE handle = CreateFileMappingA( fileHandle, NULL, PAGE_READONLY, 0, 0, NULL );
+
+        CloseHandle( fileHandle );
+
+        if ( !handle )
+            return NULL;
+
+        void * data = MapViewOfFile( handle, FILE_MAP_READ, 0, 0, 0 );
+        if ( !data )
+        {
+            CloseHandle( handle );
+            return NULL;
+        }
+
+        PlatformMappedFile * file = YOJIMBO_NEW( allocator, PlatformMappedFile );
+        if ( !file )
+        {
+            UnmapViewOfFile( data );
+            CloseHandle( handle );
+            return NULL;
+        }
+
+        file->handle = handle;
+        file->data = data;
+        file->bytes = size_t( size.QuadPart );
+
+        return file;
+    }
+
+    const void * platform_mapped_file_data( PlatformMappedFile * file )
+    {
+        assert( file );
+        return file->data;
+    }
+
+    size_t platform_mapped_file_size( PlatformMappedFile * file )
+    {
+        assert( file );
+        return file->bytes;
+    }
+
+    void platform_mapped_file_close( Allocator & allocator, PlatformMappedFile * file )
+    {
+        assert( file );
+        UnmapViewOfFile( file->data );
+        CloseHandle( file->handle );
+        YOJIMBO_DELETE( allocator, PlatformMappedFile, file );
+    }
+
+    void platform_wait_on_address( int * address, int value, double timeout )
+    {
+        assert( address );
+
+        // IMPORTANT: WaitOnAddress only works between threads in the same process, so just sleep for a bit
+
+        if ( *( (volatile int*) address ) != value || timeout <= 0.0 )
+            return;
+
+        platform_sleep( timeout < 0.001 ? timeout : 0.001 );
+    }
+
+    void platform_wake_address( int * address )
+    {
+        assert( address );
     }
 }
 
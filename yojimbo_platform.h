@@ -26,6 +26,7 @@
 #define YOJIMBO_PLATFORM_H
 
 #include "yojimbo_config.h"
+#include <stddef.h>
 
 /** @file */
 
@@ -48,6 +49,303 @@ namespace yojimbo
      */
 
     double platform_time();
+
+    /**
+        Get a high precision time value in integer nanoseconds since the application has started.
+
+        This is the same clock as platform_time, which is just this value converted to seconds. Integer time never loses precision as time increases, which makes it a good base for fixed rate ticking.
+
+        @returns The current time value in nanoseconds since the program started.
+     */
+
+    uint64_t platform_time_ns();
+
+    /**
+        Sleep until a deadline on the platform_time_ns clock.
+
+        Sleeps until shortly before the deadline, then spins for the rest of the time. This wakes up much closer to the deadline than platform_sleep, which overshoots by the scheduler granularity, at the cost of a little CPU spent spinning.
+
+        Returns immediately if the deadline has already passed.
+
+        IMPORTANT: On Windows the default timer resolution is around 15ms, so call timeBeginPeriod( 1 ) if you want to spend less time spinning.
+
+        @param deadline The time to wake up at, in nanoseconds. See platform_time_ns.
+     */
+
+    void platform_sleep_until( uint64_t deadline );
+
+    /**
+        A function run on its own thread. See platform_thread_create.
+
+        @param data The data pointer passed in to platform_thread_create.
+     */
+
+    typedef void (*PlatformThreadFunction)( void * data );
+
+    /// Opaque platform thread handle. See platform_thread_create and platform_thread_join.
+
+    struct PlatformThread;
+
+    /**
+        Create a thread and start running a function on it.
+
+        @param allocator The allocator used to allocate the thread handle.
+        @param function The function to run on the new thread.
+        @param data The data pointer passed to the thread function.
+
+        @returns The thread handle, or NULL if the thread could not be created. You must call platform_thread_join on the thread handle to wait for the thread to complete and free the handle.
+     */
+
+    PlatformThread * platform_thread_create( class Allocator & allocator, PlatformThreadFunction function, void * data );
+
+    /**
+        Wait for a thread to finish running, then free the thread handle.
+
+        @param allocator The allocator that was passed in to platform_thread_create.
+        @param thread The thread handle returned by platform_thread_create.
+     */
+
+    void platform_thread_join( class Allocator & allocator, PlatformThread * thread );
+
+    /**
+        Pin a thread to a CPU core.
+
+        The thread only runs on that core from now on, so its caches stay warm and the memory it touches stays on the NUMA node of that core. Not supported on MacOS, which only takes affinity hints.
+
+        @param thread The thread handle returned by platform_thread_create. Pass in NULL to pin the calling thread, eg. a worker thread in your own job scheduler.
+        @param cpu The index of the CPU core to pin the thread to, as numbered by the operating system.
+
+        @returns True if the thread was pinned, false otherwise.
+     */
+
+    bool platform_thread_set_affinity( PlatformThread * thread, int cpu );
+
+    /**
+        Get the NUMA node a CPU core belongs to.
+
+        @param cpu The index of the CPU core, as numbered by the operating system.
+
+        @returns The NUMA node of the CPU core, or -1 if it is unknown. Always 0 on MacOS.
+     */
+
+    int platform_cpu_numa_node( int cpu );
+
+    /**
+        Get an identifier for the calling thread.
+
+        @returns A value that is unique to the calling thread while it is running. Only useful for comparing against values returned on other threads.
+     */
+
+    uint64_t platform_thread_id();
+
+    /**
+        Get the size of a page of virtual memory.
+
+        @returns The page size (bytes).
+     */
+
+    size_t platform_page_size();
+
+    /**
+        Reserve a block of virtual memory from the operating system.
+
+        The memory can be used straight away, but physical memory is only committed to each page the first time it is touched.
+
+        @param bytes The size of the block (bytes). Rounded up to a whole number of pages.
+
+        @returns The page aligned block of memory, or NULL if it could not be reserved. Free it with platform_memory_release.
+     */
+
+    void * platform_memory_reserve( size_t bytes );
+
+    /**
+        Return a block of virtual memory to the operating system.
+
+        @param memory The block returned by platform_memory_reserve.
+        @param bytes The size passed in to platform_memory_reserve (bytes).
+     */
+
+    void platform_memory_release( void * memory, size_t bytes );
+
+    /**
+        Get the size of a huge page of virtual memory.
+
+        Huge pages cover more memory with each TLB entry, so memory that is accessed all over the place, like allocator arenas, takes far fewer TLB misses.
+
+        @returns The huge page size (bytes). Blocks reserved with platform_memory_reserve_huge_pages must be a multiple of this size.
+     */
+
+    size_t platform_huge_page_size();
+
+    /**
+        Reserve a block of virtual memory backed by huge pages.
+
+        On Linux the block is backed with MAP_HUGETLB. This needs huge pages set aside ahead of time, eg. via /proc/sys/vm/nr_hugepages. On Windows it is allocated with MEM_LARGE_PAGES, which needs the "Lock pages in memory" privilege. On MacOS (x86 only) superpages are used.
+
+        When huge pages are not available, the block falls back to regular pages aligned to the huge page size. On Linux it is marked with MADV_HUGEPAGE, so the kernel backs it with transparent huge pages when it can.
+
+        @param bytes The size of the block (bytes). Must be a multiple of platform_huge_page_size.
+        @param hugePages Set to true if the block is backed by huge pages, false if it fell back to regular pages [out].
+
+        @returns The page aligned block of memory, or NULL if it could not be reserved. Free it with platform_memory_release.
+     */
+
+    void * platform_memory_reserve_huge_pages( size_t bytes, bool & hugePages );
+
+    /**
+        Place a range of memory on a NUMA node.
+
+        Pages that are touched from now on are allocated on that node when possible, and pages that were already touched are moved there. Threads on the same node access the memory without going across sockets. See platform_cpu_numa_node.
+
+        Only supported on Linux. On Windows, pages are placed on the node of the thread that first touches them, so touch memory first from the thread that works with it.
+
+        @param memory The start of the range. Rounded up to a page boundary.
+        @param bytes The size of the range (bytes). The end of the range is rounded down to a page boundary, so only whole pages inside the range are placed.
+        @param node The NUMA node to place the memory on.
+
+        @returns True if the memory was placed on the node, false otherwise.
+     */
+
+    bool platform_memory_set_numa_node( void * memory, size_t bytes, int node );
+
+    /**
+        Give the physical memory backing a range of pages back to the operating system.
+
+        The pages stay reserved and can be used again, but their contents are lost. Physical memory is committed to them again when they are next touched.
+
+        @param memory The start of the range. Must be page aligned, inside a block returned by platform_memory_reserve.
+        @param bytes The size of the range (bytes). Must be a whole number of pages.
+     */
+
+    void platform_memory_discard( void * memory, size_t bytes );
+
+    /// Opaque handle to a block of memory shared between processes. See platform_shared_memory_create and platform_shared_memory_open.
+
+    struct PlatformSharedMemory;
+
+    /**
+        Create a named block of memory that other processes on the same machine can open.
+
+        Any existing block with the same name is replaced, so a process that restarts after a crash can create its block again. On Windows the block is freed when the last process closes it, so there is nothing left over to replace, and this fails if another process has the block open.
+
+        @param allocator The allocator used to allocate the shared memory handle.
+        @param name The name of the block. Keep it short, without slashes. MacOS limits names to 30 characters.
+        @param bytes The size of the block (bytes). The contents are zeroed.
+
+        @returns The shared memory handle, or NULL if the block could not be created. Free it with platform_shared_memory_close.
+     */
+
+    PlatformSharedMemory * platform_shared_memory_create( class Allocator & allocator, const char * name, size_t bytes );
+
+    /**
+        Open a named block of memory created by another process with platform_shared_memory_create.
+
+        @param allocator The allocator used to allocate the shared memory handle.
+        @param name The name the block was created with.
+
+        @returns The shared memory handle, or NULL if there is no block with this name. Free it with platform_shared_memory_close.
+     */
+
+    PlatformSharedMemory * platform_shared_memory_open( class Allocator & allocator, const char * name );
+
+    /**
+        Get the memory in a shared memory block.
+
+        @param memory The shared memory handle.
+
+        @returns The page aligned start of the block, mapped into this process.
+     */
+
+    void * platform_shared_memory_data( PlatformSharedMemory * memory );
+
+    /**
+        Get the size of a shared memory block.
+
+        @param memory The shared memory handle.
+
+        @returns The size of the block (bytes). This can be rounded up to a whole number of pages when the block was opened rather than created.
+     */
+
+    size_t platform_shared_memory_size( PlatformSharedMemory * memory );
+
+    /**
+        Unmap a shared memory block and free the handle.
+
+        If this process created the block, its name is removed, so no other process can open it. Processes that already have it open keep using it until they close it too.
+
+        @param allocator The allocator that was passed in to platform_shared_memory_create or platform_shared_memory_open.
+        @param memory The shared memory handle.
+     */
+
+    void platform_shared_memory_close( class Allocator & allocator, PlatformSharedMemory * memory );
+
+    /// Opaque handle to a file mapped read-only into memory. See platform_mapped_file_open.
+
+    struct PlatformMappedFile;
+
+    /**
+        Map a file read-only into memory.
+
+        Pages of the file are read from disk as they are touched, and they are shared with every other mapping of the same file, so a large file costs address space rather than heap memory.
+
+        @param allocator The allocator used to allocate the mapped file handle.
+        @param path The path of the file. The file must not be empty.
+
+        @returns The mapped file handle, or NULL if the file could not be opened or mapped. Free it with platform_mapped_file_close.
+     */
+
+    PlatformMappedFile * platform_mapped_file_open( class Allocator & allocator, const char * path );
+
+    /**
+        Get the contents of a mapped file.
+
+        @param file The mapped file handle.
+
+        @returns The start of the file contents. The memory is read-only.
+     */
+
+    const void * platform_mapped_file_data( PlatformMappedFile * file );
+
+    /**
+        Get the size of a mapped file.
+
+        @param file The mapped file handle.
+
+        @returns The size of the file when it was mapped (bytes).
+     */
+
+    size_t platform_mapped_file_size( PlatformMappedFile * file );
+
+    /**
+        Unmap a file and free the handle.
+
+        @param allocator The allocator that was passed in to platform_mapped_file_open.
+        @param file The mapped file handle.
+     */
+
+    void platform_mapped_file_close( class Allocator & allocator, PlatformMappedFile * file );
+
+    /**
+        Wait for an integer in shared memory to change from a value.
+
+        On Linux this sleeps on a futex, so it wakes up as soon as another process calls platform_wake_address on the integer. On other platforms it just sleeps for up to a millisecond.
+
+        Wakeups can be spurious, so always check the value again after this returns.
+
+        @param address Pointer to the integer. Must be 4 byte aligned.
+        @param value Returns straight away if the integer no longer has this value.
+        @param timeout The maximum time to wait (seconds).
+     */
+
+    void platform_wait_on_address( int * address, int value, double timeout );
+
+    /**
+        Wake up any threads in any process waiting on an integer with platform_wait_on_address.
+
+        @param address Pointer to the integer.
+     */
+
+    void platform_wake_address( int * address );
 }
 
 #endif // #ifndef YOJIMBO_PLATFORM_H
@@ -0,0 +1,190 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_config.h"
+#include "yojimbo_profile.h"
+#include "yojimbo_platform.h"
+#include <string.h>
+
+#if YOJIMBO_ZONES == YOJIMBO_ZONES_PERFETTO
+PERFETTO_TRACK_EVENT_STATIC_STORAGE_IN_NAMESPACE( yojimbo_perfetto );
+#endif // #if YOJIMBO_ZONES == YOJIMBO_ZONES_PERFETTO
+
+namespace yojimbo
+{
+    static LatencyHistogram s_profileHistograms[NUM_PROFILE_STAGES];
+
+    static uint64_t s_profileCalibrationTicks = 0;
+
+    static double s_profileCalibrationTime = 0.0;
+
+    double profile_ticks_to_seconds( uint64_t ticks )
+    {
+        const uint64_t elapsedTicks = profile_ticks() - s_profileCalibrationTicks;
+        const double elapsedTime = platform_time() - s_profileCalibrationTime;
+
+        if ( elapsedTicks == 0 || elapsedTime <= 0.0 )
+            return 0.0;
+
+        return double( ticks ) * ( elapsedTime / double( elapsedTicks ) );
+    }
+
+    static inline uint64_t atomic_load_uint64( const uint64_t * value )
+    {
+#ifdef _MSC_VER
+        return *( (const volatile uint64_t*) value );
+#else // #ifdef _MSC_VER
+        return __atomic_load_n( value, __ATOMIC_RELAXED );
+#endif // #ifdef _MSC_VER
+    }
+
+    static inline void atomic_add_uint64( uint64_t * value, uint64_t amount )
+    {
+#ifdef _MSC_VER
+        _InterlockedExchangeAdd64( (volatile __int64*) value, (__int64) amount );
+#else // #ifdef _MSC_VER
+        __atomic_fetch_add( value, amount, __ATOMIC_RELAXED );
+#endif // #ifdef _MSC_VER
+    }
+
+    LatencyHistogram::LatencyHistogram()
+    {
+        Reset();
+    }
+
+    void LatencyHistogram::Reset()
+    {
+        m_count = 0;
+        memset( m_buckets, 0, sizeof( m_buckets ) );
+    }
+
+    int LatencyHistogram::GetBucketIndex( uint64_t value )
+    {
+        if ( value < (uint64_t) LatencyHistogramSubBuckets )
+            return (int) value;
+
+        const uint32_t high = uint32_t( value >> 32 );
+        const int exponent = high ? 32 + (int) log2( high ) : (int) log2( uint32_t( value ) );
+
+        const int subBucket = int( value >> ( exponent - LatencyHistogramSubBucketBits ) ) & ( LatencyHistogramSubBuckets - 1 );
+
+        const int index = ( exponent - LatencyHistogramSubBucketBits + 1 ) * LatencyHistogramSubBuckets + subBucket;
+
+        assert( index >= 0 );
+        assert( index < NumBuckets );
+
+        return index;
+    }
+
+    uint64_t LatencyHistogram::GetBucketLowerBound( int index )
+    {
+        assert( index >= 0 );
+        assert( index < NumBuckets );
+
+        if ( index < LatencyHistogramSubBuckets )
+            return (uint64_t) index;
+
+        const int exponent = index / LatencyHistogramSubBuckets + LatencyHistogramSubBucketBits - 1;
+        const int subBucket = index % LatencyHistogramSubBuckets;
+
+        return uint64_t( LatencyHistogramSubBuckets + subBucket ) << ( exponent - LatencyHistogramSubBucketBits );
+    }
+
+    uint64_t LatencyHistogram::GetBucketWidth( int index )
+    {
+        assert( index >= 0 );
+        assert( index < NumBuckets );
+
+        if ( index < LatencyHistogramSubBuckets )
+            return 1;
+
+        const int exponent = index / LatencyHistogramSubBuckets + LatencyHistogramSubBucketBits - 1;
+
+        return uint64_t( 1 ) << ( exponent - LatencyHistogramSubBucketBits );
+    }
+
+    void LatencyHistogram::Record( uint64_t value )
+    {
+        atomic_add_uint64( &m_buckets[GetBucketIndex( value )], 1 );
+        atomic_add_uint64( &m_count, 1 );
+    }
+
+    uint64_t LatencyHistogram::GetCount() const
+    {
+        return atomic_load_uint64( &m_count );
+    }
+
+    uint64_t LatencyHistogram::GetPercentile( double quantile ) const
+    {
+        assert( quantile >= 0.0 );
+        assert( quantile <= 1.0 );
+
+        const uint64_t count = GetCount();
+
+        if ( count == 0 )
+            return 0;
+
+        // IMPORTANT: the count is read before the buckets, so values recorded while walking the buckets can only push the walk past the target, never short of it
+
+        uint64_t target = uint64_t( quantile * double( count ) + 0.5 );
+        if ( target < 1 )
+            target = 1;
+        if ( target > count )
+            target = count;
+
+        uint64_t total = 0;
+
+        for ( int i = 0; i < NumBuckets; ++i )
+        {
+            total += atomic_load_uint64( &m_buckets[i] );
+
+            if ( total >= target )
+                return GetBucketLowerBound( i ) + GetBucketWidth( i ) / 2;
+        }
+
+        return GetBucketLowerBound( NumBuckets - 1 );
+    }
+
+    LatencyHistogram & GetProfileHistogram( int stage )
+    {
+        assert( stage >= 0 );
+        assert( stage < NUM_PROFILE_STAGES );
+        return s_profileHistograms[stage];
+    }
+
+    void ResetProfile()
+    {
+        for ( int i = 0; i < NUM_PROFILE_STAGES; ++i )
+            s_profileHistograms[i].Reset();
+
+        // IMPORTANT: the tick rate keeps being measured from the first reset, so it stays accurate when histograms are reset every reporting interval
+
+        if ( s_profileCalibrationTicks == 0 )
+        {
+            s_profileCalibrationTicks = profile_ticks();
+            s_profileCalibrationTime = platform_time();
+        }
+    }
+}
@@ -0,0 +1,306 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef YOJIMBO_PROFILE_H
+#define YOJIMBO_PROFILE_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_common.h"
+#include "yojimbo_platform.h"
+
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+#include <intrin.h>
+#endif // #if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        Hot path stages that are timed when YOJIMBO_PROFILE is 1.
+
+        @see GetProfileHistogram
+        @see MetricsSnapshot::AddProfile
+     */
+
+    enum ProfileStage
+    {
+        PROFILE_STAGE_TRANSPORT_READ_PACKETS,                               ///< BaseTransport::ReadPackets. Reading all packets from the network for this frame.
+        PROFILE_STAGE_TRANSPORT_WRITE_PACKETS,                              ///< BaseTransport::WritePackets. Writing all queued packets to the network for this frame.
+        PROFILE_STAGE_PACKET_READ_SERIALIZE,                                ///< Serializing a packet read in PacketProcessor::ReadPacket, not including decryption.
+        PROFILE_STAGE_PACKET_DECRYPT,                                       ///< Decrypting a packet in PacketProcessor::ReadPacket.
+        PROFILE_STAGE_PACKET_WRITE_SERIALIZE,                               ///< Serializing a packet written in PacketProcessor::WritePacket, not including encryption.
+        PROFILE_STAGE_PACKET_ENCRYPT,                                       ///< Encrypting a packet in PacketProcessor::WritePacket.
+        PROFILE_STAGE_PACKET_COMPRESS,                                      ///< Compressing packet data in PacketProcessor::WritePacket.
+        PROFILE_STAGE_PACKET_DECOMPRESS,                                    ///< Decompressing packet data in PacketProcessor::ReadPacket.
+        PROFILE_STAGE_CONNECTION_GENERATE_PACKET,                           ///< Connection::GeneratePacket.
+        PROFILE_STAGE_CONNECTION_PROCESS_PACKET,                            ///< Connection::ProcessPacket.
+        PROFILE_STAGE_SERVER_ADVANCE_TIME,                                  ///< Server::AdvanceTime.
+        NUM_PROFILE_STAGES                                                  ///< The number of profile stages.
+    };
+
+    /**
+        Get the name of a profile stage.
+
+        Names are lower case with underscores, so they can be used directly in metric names, eg. "transport_read_packets". See MetricsSnapshot::AddProfile.
+
+        @param stage The profile stage. See yojimbo::ProfileStage.
+
+        @returns The name of the profile stage.
+     */
+
+    inline const char * GetProfileStageName( int stage )
+    {
+        switch ( stage )
+        {
+            case PROFILE_STAGE_TRANSPORT_READ_PACKETS:          return "transport_read_packets";
+            case PROFILE_STAGE_TRANSPORT_WRITE_PACKETS:         return "transport_write_packets";
+            case PROFILE_STAGE_PACKET_READ_SERIALIZE:           return "packet_read_serialize";
+            case PROFILE_STAGE_PACKET_DECRYPT:                  return "packet_decrypt";
+            case PROFILE_STAGE_PACKET_WRITE_SERIALIZE:          return "packet_write_serialize";
+            case PROFILE_STAGE_PACKET_ENCRYPT:                  return "packet_encrypt";
+            case PROFILE_STAGE_PACKET_COMPRESS:                 return "packet_compress";
+            case PROFILE_STAGE_PACKET_DECOMPRESS:               return "packet_decompress";
+            case PROFILE_STAGE_CONNECTION_GENERATE_PACKET:      return "connection_generate_packet";
+            case PROFILE_STAGE_CONNECTION_PROCESS_PACKET:       return "connection_process_packet";
+            case PROFILE_STAGE_SERVER_ADVANCE_TIME:             return "server_advance_time";
+            default:
+                assert( false );
+                return "???";
+        }
+    }
+
+    /**
+        Read the profile timer.
+
+        This is the time stamp counter on x86 and the virtual counter on ARM64, so it costs a handful of cycles. Other platforms fall back to platform_time in nanoseconds. Convert ticks to seconds with profile_ticks_to_seconds.
+
+        @returns The current profile timer value (ticks).
+     */
+
+    inline uint64_t profile_ticks()
+    {
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+        return __rdtsc();
+#elif defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+        return __builtin_ia32_rdtsc();
+#elif defined( __GNUC__ ) && defined( __aarch64__ )
+        uint64_t value;
+        __asm__ __volatile__( "mrs %0, cntvct_el0" : "=r" ( value ) );
+        return value;
+#else
+        return uint64_t( platform_time() * 1000000000.0 );
+#endif
+    }
+
+    /**
+        Convert profile timer ticks to seconds.
+
+        The tick rate is measured against platform_time since the first call to ResetProfile, so it gets more accurate the longer the process runs.
+
+        @param ticks The number of ticks.
+
+        @returns The number of seconds.
+     */
+
+    double profile_ticks_to_seconds( uint64_t ticks );
+
+    /**
+        A latency histogram in the style of HDR histogram.
+
+        Values are recorded into buckets on a log-linear scale: each power of two is split into LatencyHistogramSubBuckets linear sub-buckets, so percentiles are accurate to within a few percent of the value, from a single tick up to the full 64 bit range, with a fixed amount of memory.
+
+        Recording is lock-free, so stages on worker threads can record into the same histogram as the main thread. Reading percentiles while other threads record gives a consistent enough result for telemetry, but is not an exact snapshot.
+     */
+
+    class LatencyHistogram
+    {
+    public:
+
+        LatencyHistogram();
+
+        /**
+            Clear all recorded values.
+         */
+
+        void Reset();
+
+        /**
+            Record a value.
+
+            @param value The value to record, eg. the duration of a stage in profile timer ticks.
+         */
+
+        void Record( uint64_t value );
+
+        /**
+            Get the number of values recorded.
+
+            @returns The number of values recorded since the last reset.
+         */
+
+        uint64_t GetCount() const;
+
+        /**
+            Get a percentile of the values recorded.
+
+            @param quantile The quantile in [0,1], eg. 0.99 for the 99th percentile.
+
+            @returns The value at that quantile. This is the middle of the bucket the quantile falls in. Zero if no values have been recorded.
+         */
+
+        uint64_t GetPercentile( double quantile ) const;
+
+        /**
+            Get the bucket index for a value.
+
+            @param value The value.
+
+            @returns The bucket index in [0,NumBuckets-1].
+         */
+
+        static int GetBucketIndex( uint64_t value );
+
+        /**
+            Get the smallest value that goes in a bucket.
+
+            @param index The bucket index in [0,NumBuckets-1].
+
+            @returns The smallest value in the bucket.
+         */
+
+        static uint64_t GetBucketLowerBound( int index );
+
+        /**
+            Get the number of values that go in a bucket.
+
+            @param index The bucket index in [0,NumBuckets-1].
+
+            @returns The width of the bucket.
+         */
+
+        static uint64_t GetBucketWidth( int index );
+
+        static const int NumBuckets = ( 64 - LatencyHistogramSubBucketBits + 1 ) * LatencyHistogramSubBuckets;          ///< The number of buckets needed to cover the full 64 bit range.
+
+    private:
+
+        uint64_t m_count;                                                   ///< The number of values recorded.
+
+        uint64_t m_buckets[NumBuckets];                                     ///< The number of values recorded in each bucket.
+    };
+
+    /**
+        Get the histogram for a profile stage.
+
+        There is one histogram per-stage, shared by all transports, connections and servers in the process.
+
+        @param stage The profile stage. See yojimbo::ProfileStage.
+
+        @returns The latency histogram for the stage, in profile timer ticks.
+     */
+
+    LatencyHistogram & GetProfileHistogram( int stage );
+
+    /**
+        Clear the histograms for all profile stages.
+
+        The first call also starts measuring the profile timer tick rate. See profile_ticks_to_seconds.
+
+        Called by InitializeYojimbo. Call it again after exporting the histograms, if you want percentiles per reporting interval instead of over the lifetime of the process.
+     */
+
+    void ResetProfile();
+
+    /**
+        Times a scope and records its duration in the histogram for a profile stage.
+
+        Use YOJIMBO_PROFILE_SCOPE instead of using this directly, so it compiles out when YOJIMBO_PROFILE is 0.
+     */
+
+    class ProfileScope
+    {
+    public:
+
+        explicit ProfileScope( int stage ) : m_stage( stage ), m_start( profile_ticks() ) {}
+
+        ~ProfileScope() { GetProfileHistogram( m_stage ).Record( profile_ticks() - m_start ); }
+
+    private:
+
+        int m_stage;                                                        ///< The profile stage that is being timed.
+
+        uint64_t m_start;                                                   ///< The profile timer value at the start of the scope.
+    };
+}
+
+#if YOJIMBO_PROFILE
+
+#define YOJIMBO_PROFILE_SCOPE( stage ) yojimbo::ProfileScope profileScope( stage )
+#define YOJIMBO_PROFILE_BEGIN( start ) const uint64_t start = yojimbo::profile_ticks()
+#define YOJIMBO_PROFILE_END( stage, start ) yojimbo::GetProfileHistogram( stage ).Record( yojimbo::profile_ticks() - start )
+
+#else // #if YOJIMBO_PROFILE
+
+#define YOJIMBO_PROFILE_SCOPE( stage ) do {} while (0)
+#define YOJIMBO_PROFILE_BEGIN( start ) do {} while (0)
+#define YOJIMBO_PROFILE_END( stage, start ) do {} while (0)
+
+#endif // #if YOJIMBO_PROFILE
+
+/*
+    Profiler zones and plots.
+
+    YOJIMBO_ZONE marks the rest of the enclosing scope as a named zone, and YOJIMBO_PLOT records a value on a named counter track, so yojimbo's work shows up in Tracy and Perfetto captures next to your game frames. Names must be string literals. Only one zone per scope.
+
+    With Perfetto, initialize tracing with perfetto::Tracing::Initialize before you call InitializeYojimbo, which registers the "yojimbo" track event category.
+
+    Both compile out completely when YOJIMBO_ZONES is YOJIMBO_ZONES_NONE, which is the default.
+ */
+
+#if YOJIMBO_ZONES == YOJIMBO_ZONES_TRACY
+
+#include "tracy/Tracy.hpp"
+
+#define YOJIMBO_ZONE( name ) ZoneScopedN( name )
+#define YOJIMBO_PLOT( name, value ) TracyPlot( name, int64_t( value ) )
+
+#elif YOJIMBO_ZONES == YOJIMBO_ZONES_PERFETTO
+
+#include <perfetto.h>
+
+PERFETTO_DEFINE_CATEGORIES_IN_NAMESPACE( yojimbo_perfetto, perfetto::Category( "yojimbo" ).SetDescription( "yojimbo network stages, queue depths and bytes sent" ) );
+
+#define YOJIMBO_ZONE( name ) PERFETTO_USE_CATEGORIES_FROM_NAMESPACE_SCOPED( yojimbo_perfetto ); TRACE_EVENT( "yojimbo", name )
+#define YOJIMBO_PLOT( name, value ) do { PERFETTO_USE_CATEGORIES_FROM_NAMESPACE_SCOPED( yojimbo_perfetto ); TRACE_COUNTER( "yojimbo", name, int64_t( value ) ); } while (0)
+
+#else // #if YOJIMBO_ZONES == YOJIMBO_ZONES_TRACY
+
+#define YOJIMBO_ZONE( name ) do {} while (0)
+#define YOJIMBO_PLOT( name, value ) do { (void) ( value ); } while (0)
+
+#endif // #if YOJIMBO_ZONES == YOJIMBO_ZONES_TRACY
+
+#endif // #ifndef YOJIMBO_PROFILE_H
@@ -27,6 +27,7 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_allocator.h"
+#include "yojimbo_common.h"
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -39,6 +40,8 @@ namespace yojimbo
         A simple templated queue.
 
         This is a FIFO queue. First entry in, first entry out.
+
+        The array backing the queue is rounded up to a power of two, so indexing into the circular buffer is a mask instead of a modulo. The queue still holds at most the size passed in to the constructor.
      */
 
     template <typename T> class Queue
@@ -55,12 +58,16 @@ namespace yojimbo
         Queue( Allocator & allocator, int size )
         {
             assert( size > 0 );
-            m_arraySize = size;
+            m_size = size;
+            m_arraySize = 1;
+            while ( m_arraySize < size )
+                m_arraySize *= 2;
+            m_arrayMask = m_arraySize - 1;
             m_startIndex = 0;
             m_numEntries = 0;
             m_allocator = &allocator;
-            m_entries = (T*) YOJIMBO_ALLOCATE( allocator, sizeof(T) * size );
-            memset( m_entries, 0, sizeof(T) * size );
+            m_entries = (T*) YOJIMBO_ALLOCATE( allocator, sizeof(T) * m_arraySize );
+            memset( m_entries, 0, sizeof(T) * m_arraySize );
         }
 
         /**
@@ -73,7 +80,9 @@ namespace yojimbo
             
             YOJIMBO_FREE( *m_allocator, m_entries );
 
+            m_size = 0;
             m_arraySize = 0;
+            m_arrayMask = 0;
             m_startIndex = 0;
             m_numEntries = 0;
 
@@ -102,7 +111,7 @@ namespace yojimbo
         {
             assert( !IsEmpty() );
             const T & entry = m_entries[m_startIndex];
-            m_startIndex = ( m_startIndex + 1 ) % m_arraySize;
+            m_startIndex = ( m_startIndex + 1 ) & m_arrayMask;
             m_numEntries--;
             return entry;
         }
@@ -118,11 +127,74 @@ namespace yojimbo
         void Push( const T & value )
         {
             assert( !IsFull() );
-            const int index = ( m_startIndex + m_numEntries ) % m_arraySize;
+            const int index = ( m_startIndex + m_numEntries ) & m_arrayMask;
             m_entries[index] = value;
             m_numEntries++;
         }
 
+        /**
+            Push multiple values on to the queue.
+
+            Values are copied into at most two contiguous segments of the circular buffer, one before and one after the wrap.
+
+            @param values The array of values to push onto the queue, oldest first.
+            @param numValues The number of values in the array.
+
+            @returns The number of values pushed. This is less than numValues if the queue fills up, in which case the values past that point are not pushed.
+         */
+
+        int PushN( const T * values, int numValues )
+        {
+            assert( values || numValues == 0 );
+            assert( numValues >= 0 );
+
+            const int numPushed = ( numValues < m_size - m_numEntries ) ? numValues : ( m_size - m_numEntries );
+
+            const int index = ( m_startIndex + m_numEntries ) & m_arrayMask;
+
+            const int numFirst = ( numPushed < m_arraySize - index ) ? numPushed : ( m_arraySize - index );
+
+            for ( int i = 0; i < numFirst; ++i )
+                m_entries[index + i] = values[i];
+
+            for ( int i = numFirst; i < numPushed; ++i )
+                m_entries[i - numFirst] = values[i];
+
+            m_numEntries += numPushed;
+
+            return numPushed;
+        }
+
+        /**
+            Pop multiple values off the queue, without copying them.
+
+            Returns a pointer to the oldest entries in the queue, which are contiguous in the circular buffer. If the entries wrap around the end of the buffer, only the entries up to the wrap are popped, so keep calling this until it returns zero to drain the queue.
+
+            IMPORTANT: The popped entries are still stored in the queue, so the pointer is only valid until the next time a value is pushed onto the queue.
+
+            @param values Set to point at the popped entries, oldest first. Set to NULL if the queue is empty.
+            @param maxValues The maximum number of values to pop.
+
+            @returns The number of values popped, in [0,maxValues].
+         */
+
+        int PopN( T * & values, int maxValues )
+        {
+            assert( maxValues >= 0 );
+
+            int numPopped = ( maxValues < m_numEntries ) ? maxValues : m_numEntries;
+
+            if ( numPopped > m_arraySize - m_startIndex )
+                numPopped = m_arraySize - m_startIndex;
+
+            values = ( numPopped > 0 ) ? m_entries + m_startIndex : NULL;
+
+            m_startIndex = ( m_startIndex + numPopped ) & m_arrayMask;
+            m_numEntries -= numPopped;
+
+            return numPopped;
+        }
+
         /**
             Random access for entries in the queue.
 
@@ -136,7 +208,7 @@ namespace yojimbo
             assert( !IsEmpty() );
             assert( index >= 0 );
             assert( index < m_numEntries );
-            return m_entries[ ( m_startIndex + index ) % m_arraySize ];
+            return m_entries[ ( m_startIndex + index ) & m_arrayMask ];
         }
 
         /**
@@ -152,7 +224,7 @@ namespace yojimbo
             assert( !IsEmpty() );
             assert( index >= 0 );
             assert( index < m_numEntries );
-            return m_entries[ ( m_startIndex + index ) % m_arraySize ];
+            return m_entries[ ( m_startIndex + index ) & m_arrayMask ];
         }
 
         /**
@@ -165,7 +237,7 @@ namespace yojimbo
 
         int GetSize() const
         {
-            return m_arraySize;
+            return m_size;
         }
 
         /**
@@ -176,7 +248,7 @@ namespace yojimbo
 
         bool IsFull() const
         {
-            return m_numEntries == m_arraySize;
+            return m_numEntries == m_size;
         }
 
         /**
@@ -208,12 +280,173 @@ namespace yojimbo
 
         T * m_entries;                                  ///< Array of entries backing the queue (circular buffer).
 
-        int m_arraySize;                                ///< The size of the array, in number of entries. This is the "size" of the queue.
+        int m_size;                                     ///< The maximum number of entries in the queue. This is the "size" of the queue.
+
+        int m_arraySize;                                ///< The size of the array, in number of entries. This is the queue size rounded up to the next power of two.
+
+        int m_arrayMask;                                ///< Mask applied to indices into the array (m_arraySize - 1). Replaces modulo when wrapping around the circular buffer.
     
         int m_startIndex;                               ///< The start index for the queue. This is the next value that gets popped off.
 
         int m_numEntries;                               ///< The number of entries currently stored in the queue.
     };
+
+    /**
+        A queue for passing values from one thread to another without locks.
+
+        One thread pushes values on to the queue and one other thread pops them off. Each side only writes its own index and reads the other side's index atomically, so neither thread ever waits on the other. Pushing to more than one thread, or popping from more than one thread, is not supported.
+
+        Used by the client network thread to pass messages to and from the game thread. See Client::StartNetworkThread.
+     */
+
+    template <typename T> class LockFreeQueue
+    {
+    public:
+
+        /**
+            Lock-free queue constructor.
+
+            @param allocator The allocator to use.
+            @param size The maximum number of entries in the queue.
+         */
+
+        LockFreeQueue( Allocator & allocator, int size )
+        {
+            assert( size > 0 );
+            m_size = size;
+            m_arraySize = 1;
+            while ( m_arraySize < size )
+                m_arraySize *= 2;
+            m_arrayMask = m_arraySize - 1;
+            m_indexMask = m_arraySize * 2 - 1;
+            m_readIndex = 0;
+            m_writeIndex = 0;
+            m_allocator = &allocator;
+            m_entries = (T*) YOJIMBO_ALLOCATE( allocator, sizeof(T) * m_arraySize );
+            memset( m_entries, 0, sizeof(T) * m_arraySize );
+        }
+
+        /**
+            Lock-free queue destructor.
+
+            Make sure neither thread is still using the queue.
+         */
+
+        ~LockFreeQueue()
+        {
+            assert( m_allocator );
+            YOJIMBO_FREE( *m_allocator, m_entries );
+            m_allocator = NULL;
+        }
+
+        /**
+            Push a value on to the queue.
+
+            Only call this from the thread pushing values.
+
+            @param value The value to push on to the queue.
+
+            @returns True if the value was pushed, false if the queue is full.
+         */
+
+        bool Push( const T & value )
+        {
+            const int readIndex = atomic_load( &m_readIndex );
+            const int writeIndex = m_writeIndex;
+            if ( ( ( writeIndex - readIndex ) & m_indexMask ) == m_size )
+                return false;
+            m_entries[writeIndex & m_arrayMask] = value;
+            atomic_store( &m_writeIndex, ( writeIndex + 1 ) & m_indexMask );
+            return true;
+        }
+
+        /**
+            Get the value at the front of the queue, without popping it off.
+
+            Only call this from the thread popping values.
+
+            @returns A pointer to the next value that would be popped, or NULL if the queue is empty.
+         */
+
+        T * Peek()
+        {
+            const int writeIndex = atomic_load( &m_writeIndex );
+            if ( writeIndex == m_readIndex )
+                return NULL;
+            return &m_entries[m_readIndex & m_arrayMask];
+        }
+
+        /**
+            Pop a value off the queue.
+
+            Only call this from the thread popping values.
+
+            @param value The value popped off the queue (out).
+
+            @returns True if a value was popped, false if the queue is empty.
+         */
+
+        bool Pop( T & value )
+        {
+            const int writeIndex = atomic_load( &m_writeIndex );
+            const int readIndex = m_readIndex;
+            if ( writeIndex == readIndex )
+                return false;
+            value = m_entries[readIndex & m_arrayMask];
+            atomic_store( &m_readIndex, ( readIndex + 1 ) & m_indexMask );
+            return true;
+        }
+
+        /**
+            Is the queue full?
+
+            Only exact on the thread pushing values. On the thread popping values, the queue may fill up right after this returns false.
+
+            @returns True if no more values can be pushed on to the queue.
+         */
+
+        bool IsFull() const
+        {
+            return ( ( atomic_load( &m_writeIndex ) - atomic_load( &m_readIndex ) ) & m_indexMask ) == m_size;
+        }
+
+        /**
+            Get the maximum number of entries in the queue.
+
+            @returns The maximum number of entries in the queue. This is the size passed in to the constructor.
+         */
+
+        int GetSize() const
+        {
+            return m_size;
+        }
+
+    private:
+
+        Allocator * m_allocator;                        ///< The allocator passed in to the constructor.
+
+        T * m_entries;                                  ///< Array of entries backing the queue (circular buffer).
+
+        int m_size;                                     ///< The maximum number of entries in the queue.
+
+        int m_arraySize;                                ///< The size of the array, in number of entries. This is the queue size rounded up to the next power of two.
+
+        int m_arrayMask;                                ///< Mask applied to indices into the array (m_arraySize - 1).
+
+        int m_indexMask;                                ///< Mask applied to the read and write indices (2 * m_arraySize - 1). Indices run over twice the array size, so a full queue can be told apart from an empty one without wasting an entry.
+
+        uint8_t m_readPadding[CacheLineBytes];          ///< Keeps the read index off the cache line holding the fields above, which both threads read.
+
+        int m_readIndex;                                ///< The index of the next entry to pop. Only written by the thread popping values.
+
+        uint8_t m_writePadding[CacheLineBytes];         ///< Keeps the read and write indices on different cache lines, so the two threads don't fight over one cache line.
+
+        int m_writeIndex;                               ///< The index of the next entry to push. Only written by the thread pushing values.
+
+        LockFreeQueue( const LockFreeQueue & other );
+
+        LockFreeQueue & operator = ( const LockFreeQueue & other );
+    };
 }
 
 #endif // #ifndef YOJIMBO_BITPACK_H
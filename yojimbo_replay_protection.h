@@ -27,6 +27,8 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_allocator.h"
+#include "yojimbo_common.h"
+#include "yojimbo_serialize.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
@@ -38,15 +40,19 @@ namespace yojimbo
     /**
         Provides protection against packets being sniffed and replayed.
         
-        Basically a ring buffer that stores packets indexed by packet sequence number modulo replay buffer size.
+        A sliding window with one bit per packet sequence number, in the style of RFC 6479. The window covers the most recent yojimbo::ReplayProtectionBufferSize sequence numbers.
 
         The logic is pretty much:
 
-            1. If a packet is older than what can be stored in the buffer, ignore it. 
+            1. If a packet is older than the window, ignore it. 
 
-            2. If an entry in the reply buffer exists and matches the packet sequence, it's already been received, so ignore it.
+            2. If the bit for the packet sequence is set, it's already been received, so ignore it.
 
-            3. Otherwise, this is the first time the packet has been received, so let it in.
+            3. Otherwise, this is the first time the packet has been received, so set its bit and let it in.
+
+        The bitmap is a ring of 64 bit words indexed by sequence / 64. When a newer sequence arrives the window slides forward by clearing the words it moves over, so nothing is ever shifted and each check touches a single word. One more word is kept than the window needs, so the oldest word in the window never shares a slot with the newest.
+
+        Each word is tagged with the generation it was last written in, and words from older generations read as zero, so a reset just starts a new generation.
 
         The whole point is to avoid the possibility of an attacker capturing and replaying encrypted packets, in an attempt to break some internal protocol state, like packet level acks or reliable-messages.
 
@@ -65,11 +71,19 @@ namespace yojimbo
 
         ReplayProtection()
         {
-            Reset( 0 );
+            assert( ReplayProtectionBufferSize > 0 );
+            assert( ( ReplayProtectionBufferSize % 64 ) == 0 );
+
+            m_mostRecentSequence = 0;
+            m_generation = 0;
+            memset( m_receivedPackets, 0, sizeof( m_receivedPackets ) );
+            memset( m_wordGeneration, 0, sizeof( m_wordGeneration ) );
         }
 
         /**
-            Reset the replay protection buffer at a particular sequence number.
+            Reset the replay protection window at a particular sequence number.
+
+            Takes constant time. The bitmap is only actually cleared when the generation counter wraps around.
 
             @param mostRecentSequence The sequence number to start at, defaulting to zero.
          */
@@ -77,7 +91,14 @@ namespace yojimbo
         void Reset( uint64_t mostRecentSequence = 0LL )
         {
             m_mostRecentSequence = mostRecentSequence;
-            memset( m_receivedPacket, 0xFF, sizeof( m_receivedPacket ) );
+
+            m_generation++;
+
+            if ( m_generation == 0 )
+            {
+                memset( m_receivedPackets, 0, sizeof( m_receivedPackets ) );
+                memset( m_wordGeneration, 0, sizeof( m_wordGeneration ) );
+            }
         }
 
         /**
@@ -99,22 +120,43 @@ namespace yojimbo
 
             if ( sequence + ReplayProtectionBufferSize <= m_mostRecentSequence )
                 return true;
-            
+
+            const uint64_t word = sequence >> 6;
+
             if ( sequence > m_mostRecentSequence )
+            {
+                // slide the window forward, clearing the words that are entering it
+
+                const uint64_t mostRecentWord = m_mostRecentSequence >> 6;
+
+                const uint64_t numWordsToClear = min( word - mostRecentWord, uint64_t( NumWords ) );
+
+                for ( uint64_t i = 1; i <= numWordsToClear; ++i )
+                {
+                    const int index = int( ( mostRecentWord + i ) % NumWords );
+                    m_receivedPackets[index] = 0;
+                    m_wordGeneration[index] = m_generation;
+                }
+
                 m_mostRecentSequence = sequence;
+            }
 
-            const int index = (int) ( sequence % ReplayProtectionBufferSize );
+            const int index = int( word % NumWords );
 
-            if ( m_receivedPacket[index] == 0xFFFFFFFFFFFFFFFFLL )
+            if ( m_wordGeneration[index] != m_generation )
             {
-                m_receivedPacket[index] = sequence;
-                return false;
+                m_receivedPackets[index] = 0;
+                m_wordGeneration[index] = m_generation;
             }
 
-            if ( m_receivedPacket[index] >= sequence )
+            uint64_t & bits = m_receivedPackets[index];
+
+            const uint64_t bit = 1ULL << ( sequence & 63 );
+
+            if ( bits & bit )
                 return true;
-            
-            m_receivedPacket[index] = sequence;
+
+            bits |= bit;
 
             return false;
         }
@@ -122,18 +164,57 @@ namespace yojimbo
         /**
             Get the most recent packet sequence number received.
 
-            Packets older than this sequence number minus yojimbo::ReplayProtectionBufferSize are discarded. This way we can keep the replay protection buffer small (about one seconds worth).
+            Packets older than this sequence number minus yojimbo::ReplayProtectionBufferSize are discarded.
 
             @returns The most recent packet sequence number.
          */
 
         uint64_t GetMostRecentSequence() const { return m_mostRecentSequence; }
 
+        /**
+            Serialize the replay protection window.
+
+            Used to carry the window over when a client session moves between servers. Words from older generations are written as zero, and words read in belong to the current generation.
+
+            @param stream The stream to read from, write to or measure.
+
+            @returns True if serialization succeeded, false otherwise.
+         */
+
+        template <typename Stream> bool Serialize( Stream & stream )
+        {
+            serialize_uint64( stream, m_mostRecentSequence );
+
+            for ( int i = 0; i < NumWords; ++i )
+            {
+                uint64_t bits = 0;
+
+                if ( Stream::IsWriting && m_wordGeneration[i] == m_generation )
+                    bits = m_receivedPackets[i];
+
+                serialize_uint64( stream, bits );
+
+                if ( Stream::IsReading )
+                {
+                    m_receivedPackets[i] = bits;
+                    m_wordGeneration[i] = m_generation;
+                }
+            }
+
+            return true;
+        }
+
     protected:
 
+        enum { NumWords = ReplayProtectionBufferSize / 64 + 1 };       ///< The number of words in the bitmap. One more than the window needs, so the window can start part way through a word.
+
         uint64_t m_mostRecentSequence;                                  ///< The most recent sequence number received.
 
-        uint64_t m_receivedPacket[ReplayProtectionBufferSize];          ///< The ring buffer that stores packet sequence numbers at index sequence modulo buffer size.
+        uint32_t m_generation;                                          ///< The current generation. Incremented by ReplayProtection::Reset.
+
+        uint64_t m_receivedPackets[NumWords];                           ///< Bitmap of received packets. Bit sequence % 64 of word ( sequence / 64 ) % NumWords is set if that packet sequence has been received. Only valid where the word generation matches the current generation.
+
+        uint32_t m_wordGeneration[NumWords];                            ///< The generation each word of the bitmap was last written in.
     };
 }
 
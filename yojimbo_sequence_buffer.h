@@ -25,6 +25,7 @@
 #ifndef YOJIMBO_SEQUENCE_BUFFER_H
 #define YOJIMBO_SEQUENCE_BUFFER_H
 
+#include "yojimbo_common.h"
 #include "yojimbo_allocator.h"
 
 /** @file */
@@ -34,7 +35,9 @@ namespace yojimbo
     /**
         Data structure that stores data indexed by sequence number.
 
-        Entries may or may not exist. If they don't exist the sequence value for the entry at that index is set to 0xFFFFFFFF. 
+        Entries may or may not exist. Which entries exist is tracked by an occupancy bitmap, so ranges of entries can be removed and the next existing entry found a word at a time.
+
+        Each word of the bitmap is tagged with the generation it was last written in. A word from an older generation reads as empty, so resetting the buffer or clearing it entirely just starts a new generation, and takes constant time no matter how large the buffer is.
 
         This provides a constant time lookup for an entry by sequence number. If the entry at sequence modulo buffer size doesn't have the same sequence number, that sequence number is not stored.
 
@@ -60,9 +63,13 @@ namespace yojimbo
             m_size = size;
             m_sequence = 0;
             m_allocator = &allocator;
+            m_numOccupiedWords = ( size + 63 ) / 64;
+            m_generation = 0;
+            m_occupied = (OccupiedWord*) YOJIMBO_ALLOCATE( allocator, sizeof( OccupiedWord ) * m_numOccupiedWords );
             m_entry_sequence = (uint32_t*) YOJIMBO_ALLOCATE( allocator, sizeof( uint32_t ) * size );
             m_entries = (T*) YOJIMBO_ALLOCATE( allocator, sizeof(T) * size );
-            Reset();
+            memset( m_occupied, 0, sizeof( OccupiedWord ) * m_numOccupiedWords );
+            memset( m_entry_sequence, 0xFF, sizeof( uint32_t ) * size );
         }
 
         /**
@@ -75,6 +82,7 @@ namespace yojimbo
 
             YOJIMBO_FREE( *m_allocator, m_entries );
             YOJIMBO_FREE( *m_allocator, m_entry_sequence );
+            YOJIMBO_FREE( *m_allocator, m_occupied );
 
             m_allocator = NULL;
         }
@@ -82,13 +90,15 @@ namespace yojimbo
         /**
             Reset the sequence buffer.
 
-            Removes all entries from the sequence buffer and restores it to initial state.
+            Removes all entries from the sequence buffer and restores it to initial state. Takes constant time, regardless of the size of the buffer.
+
+            @param sequence The sequence number to start at, defaulting to zero. Entries from this sequence number on can be inserted.
          */
 
-        void Reset()
+        void Reset( uint16_t sequence = 0 )
         {
-            m_sequence = 0;
-            memset( m_entry_sequence, 0xFF, sizeof( uint32_t ) * m_size );
+            m_sequence = sequence;
+            ClearAllOccupied();
         }
 
         /**
@@ -116,6 +126,8 @@ namespace yojimbo
 
             const int index = sequence % m_size;
 
+            WriteOccupiedWord( index >> 6 ) |= uint64_t(1) << ( index & 63 );
+
             m_entry_sequence[index] = sequence;
 
             return &m_entries[index];
@@ -129,7 +141,9 @@ namespace yojimbo
 
         void Remove( uint16_t sequence )
         {
-            m_entry_sequence[ sequence % m_size ] = 0xFFFFFFFF;
+            const int index = sequence % m_size;
+            WriteOccupiedWord( index >> 6 ) &= ~( uint64_t(1) << ( index & 63 ) );
+            m_entry_sequence[index] = 0xFFFFFFFF;
         }
 
         /**
@@ -144,7 +158,7 @@ namespace yojimbo
 
         bool Available( uint16_t sequence ) const
         {
-            return m_entry_sequence[ sequence % m_size ] == 0xFFFFFFFF;
+            return !IsOccupied( sequence % m_size );
         }
 
         /**
@@ -157,7 +171,8 @@ namespace yojimbo
 
         bool Exists( uint16_t sequence ) const
         {
-            return m_entry_sequence[ sequence % m_size ] == uint32_t( sequence );
+            const int index = sequence % m_size;
+            return IsOccupied( index ) && m_entry_sequence[index] == uint32_t( sequence );
         }
 
         /**
@@ -171,7 +186,7 @@ namespace yojimbo
         T * Find( uint16_t sequence )
         {
             const int index = sequence % m_size;
-            if ( m_entry_sequence[index] == uint32_t( sequence ) )
+            if ( IsOccupied( index ) && m_entry_sequence[index] == uint32_t( sequence ) )
                 return &m_entries[index];
             else
                 return NULL;
@@ -188,7 +203,7 @@ namespace yojimbo
         const T * Find( uint16_t sequence ) const
         {
             const int index = sequence % m_size;
-            if ( m_entry_sequence[index] == uint32_t( sequence ) )
+            if ( IsOccupied( index ) && m_entry_sequence[index] == uint32_t( sequence ) )
                 return &m_entries[index];
             else
                 return NULL;
@@ -208,7 +223,93 @@ namespace yojimbo
         {
             assert( index >= 0 );
             assert( index < m_size );
-            return m_entry_sequence[index] != 0xFFFFFFFF ? &m_entries[index] : NULL;
+            return IsOccupied( index ) ? &m_entries[index] : NULL;
+        }
+
+        /**
+            Find the next occupied entry index.
+
+            Use this to iterate across only the entries that exist, instead of calling GetAtIndex for every index in the sequence buffer.
+
+            @param index The index to start searching from in [0,GetSize()].
+
+            @returns The first index at or after the start index with an entry, or -1 if there are no more entries before the end of the buffer.
+         */
+
+        int GetNextIndex( int index ) const
+        {
+            assert( index >= 0 );
+            assert( index <= m_size );
+            return FindOccupiedIndex( index, m_size );
+        }
+
+        /**
+            Find the next entry in a range of sequence numbers.
+
+            This scans the occupancy bitmap a word at a time, so walking a sparse range of sequence numbers costs time proportional to the entries that exist, rather than the size of the range.
+
+            IMPORTANT: The entry found only occupies the index for that sequence number. Call SequenceBuffer::Find to check that it actually belongs to that sequence number.
+
+            @param sequence The first sequence number in the range.
+            @param count The number of sequence numbers in the range. Must be in [0,GetSize()].
+
+            @returns The offset from the first sequence number to the first occupied entry, in [0,count-1]. -1 if no entries are occupied in the range.
+         */
+
+        int GetNextEntryOffset( uint16_t sequence, int count ) const
+        {
+            assert( count >= 0 );
+            assert( count <= m_size );
+
+            int offset = 0;
+
+            while ( offset < count )
+            {
+                // IMPORTANT: runs are split where the index wraps around the end of the buffer and where the sequence number wraps around 65535, since these don't coincide unless the buffer size divides 65536.
+
+                const int index = sequence % m_size;
+                const int run = min( min( count - offset, m_size - index ), 65536 - int( sequence ) );
+
+                const int result = FindOccupiedIndex( index, index + run );
+                if ( result >= 0 )
+                    return offset + ( result - index );
+
+                offset += run;
+                sequence += uint16_t( run );
+            }
+
+            return -1;
+        }
+
+        /**
+            Get the occupancy bits for a run of consecutive sequence numbers.
+
+            This reads the occupancy bitmap directly, so it costs a few shifts and masks rather than a lookup per sequence number.
+
+            IMPORTANT: The occupancy bits only say the index for each sequence number is occupied. For sequence numbers among the most recent GetSize() sequence numbers, when the buffer size divides 65536, 
+            an occupied index always belongs to that sequence number, because each index is cleared as the buffer advances onto it. Call SequenceBuffer::Find to check older sequence numbers.
+
+            @param sequence The first sequence number in the run.
+            @param count The number of sequence numbers in the run. Must be in [0,32] and no larger than GetSize().
+
+            @returns The occupancy bits. Bit n is set if the index for sequence + n is occupied.
+         */
+
+        uint32_t GetOccupiedBits( uint16_t sequence, int count ) const
+        {
+            assert( count >= 0 );
+            assert( count <= 32 );
+            assert( count <= m_size );
+
+            const int index = sequence % m_size;
+            const int first = min( count, m_size - index );
+
+            uint32_t bits = ReadOccupied( index, first );
+
+            if ( first < count )
+                bits |= ReadOccupied( 0, count - first ) << first;
+
+            return bits;
         }
 
         /**
@@ -273,27 +374,195 @@ namespace yojimbo
 
             assert( finish_sequence >= start_sequence );
 
+            // IMPORTANT: only the occupancy bits are cleared. stale sequence numbers left behind are ignored because lookups check occupancy first.
+
             if ( finish_sequence - start_sequence < m_size )
             {
-                for ( int sequence = start_sequence; sequence <= finish_sequence; ++sequence )
-                    m_entry_sequence[sequence % m_size] = 0xFFFFFFFF;
+                const int start_index = start_sequence % m_size;
+                const int count = finish_sequence - start_sequence + 1;
+                if ( start_index + count <= m_size )
+                {
+                    ClearOccupied( start_index, start_index + count );
+                }
+                else
+                {
+                    ClearOccupied( start_index, m_size );
+                    ClearOccupied( 0, start_index + count - m_size );
+                }
             }
             else
             {
-                for ( int i = 0; i < m_size; ++i )
-                    m_entry_sequence[i] = 0xFFFFFFFF;
+                ClearAllOccupied();
             }
         }
 
+        /**
+            Does an entry exist at this index?
+
+            @param index The entry index in [0,GetSize()-1].
+
+            @returns True if the occupancy bit is set for this index.
+         */
+
+        bool IsOccupied( int index ) const
+        {
+            assert( index >= 0 );
+            assert( index < m_size );
+            return ( ReadOccupiedWord( index >> 6 ) >> ( index & 63 ) ) & 1;
+        }
+
+        /**
+            Read a word of the occupancy bitmap.
+
+            @param word The word index in [0,m_numOccupiedWords-1].
+
+            @returns The occupancy bits for the 64 indices in the word. Zero if the word was last written in an older generation.
+         */
+
+        uint64_t ReadOccupiedWord( int word ) const
+        {
+            const OccupiedWord & occupied = m_occupied[word];
+            return ( occupied.generation == m_generation ) ? occupied.bits : 0;
+        }
+
+        /**
+            Get a word of the occupancy bitmap to modify it.
+
+            If the word was last written in an older generation, it is cleared and moved to the current generation first.
+
+            @param word The word index in [0,m_numOccupiedWords-1].
+
+            @returns A reference to the occupancy bits for the 64 indices in the word.
+         */
+
+        uint64_t & WriteOccupiedWord( int word )
+        {
+            OccupiedWord & occupied = m_occupied[word];
+            if ( occupied.generation != m_generation )
+            {
+                occupied.bits = 0;
+                occupied.generation = m_generation;
+            }
+            return occupied.bits;
+        }
+
+        /**
+            Clear the occupancy bits for every index, by starting a new generation.
+
+            Only when the generation counter wraps around is the bitmap actually cleared, so stale words from 2^32 generations ago can't come back.
+         */
+
+        void ClearAllOccupied()
+        {
+            m_generation++;
+
+            if ( m_generation == 0 )
+                memset( m_occupied, 0, sizeof( OccupiedWord ) * m_numOccupiedWords );
+        }
+
+        /**
+            Clear the occupancy bits for a range of indices, a word at a time.
+
+            @param begin The first index to clear.
+            @param end One past the last index to clear. Must be <= GetSize().
+         */
+
+        void ClearOccupied( int begin, int end )
+        {
+            assert( begin >= 0 );
+            assert( end <= m_size );
+
+            while ( begin < end )
+            {
+                const int bit = begin & 63;
+                const int bits = min( 64 - bit, end - begin );
+                const uint64_t mask = ( bits == 64 ) ? ~uint64_t(0) : ( ( ( uint64_t(1) << bits ) - 1 ) << bit );
+                WriteOccupiedWord( begin >> 6 ) &= ~mask;
+                begin += bits;
+            }
+        }
+
+        /**
+            Find the first index with its occupancy bit set in a range of indices, a word at a time.
+
+            @param begin The first index to search.
+            @param end One past the last index to search. Must be <= GetSize().
+
+            @returns The first occupied index in [begin,end), or -1 if none are occupied.
+         */
+
+        int FindOccupiedIndex( int begin, int end ) const
+        {
+            assert( begin >= 0 );
+            assert( end <= m_size );
+
+            while ( begin < end )
+            {
+                const int bit = begin & 63;
+                const int bits = min( 64 - bit, end - begin );
+                uint64_t value = ReadOccupiedWord( begin >> 6 ) >> bit;
+                if ( bits < 64 )
+                    value &= ( uint64_t(1) << bits ) - 1;
+                if ( value )
+                    return begin + trailing_zeros( value );
+                begin += bits;
+            }
+
+            return -1;
+        }
+
+        /**
+            Read the occupancy bits for a run of up to 32 indices.
+
+            @param begin The first index to read.
+            @param count The number of indices to read in [0,32]. begin + count must be <= GetSize().
+
+            @returns The occupancy bits. Bit n is set if index begin + n is occupied.
+         */
+
+        uint32_t ReadOccupied( int begin, int count ) const
+        {
+            assert( begin >= 0 );
+            assert( count >= 0 );
+            assert( count <= 32 );
+            assert( begin + count <= m_size );
+
+            if ( count == 0 )
+                return 0;
+
+            const int bit = begin & 63;
+            uint64_t value = ReadOccupiedWord( begin >> 6 ) >> bit;
+            if ( bit + count > 64 )
+                value |= ReadOccupiedWord( ( begin >> 6 ) + 1 ) << ( 64 - bit );
+
+            return uint32_t( value & ( ( uint64_t(1) << count ) - 1 ) );
+        }
+
     private:
 
+        /**
+            A word of the occupancy bitmap, tagged with the generation it was last written in.
+         */
+
+        struct OccupiedWord
+        {
+            uint64_t bits;                                                  ///< Bit n is set if an entry exists at index n within this word. Only valid if the generation matches the current generation.
+            uint32_t generation;                                            ///< The generation this word was last written in.
+        };
+
         Allocator * m_allocator;                                            ///< The allocator passed in to the constructor.
 
         int m_size;                                                         ///< The size of the sequence buffer.
         
         uint16_t m_sequence;                                                ///< The most recent sequence number added to the buffer.
 
-        uint32_t * m_entry_sequence;                                        ///< Array of sequence numbers corresponding to each sequence buffer entry for fast lookup. Set to 0xFFFFFFFF if no entry exists at that index.
+        int m_numOccupiedWords;                                             ///< The number of 64 bit words in the occupancy bitmap.
+
+        uint32_t m_generation;                                              ///< The current generation. Incremented to clear the occupancy bitmap in constant time.
+
+        OccupiedWord * m_occupied;                                          ///< Occupancy bitmap. Bit n of word n / 64 is set if an entry exists at index n.
+
+        uint32_t * m_entry_sequence;                                        ///< Array of sequence numbers corresponding to each sequence buffer entry for fast lookup. Only valid where the occupancy bit is set.
         
         T * m_entries;                                                      ///< The sequence buffer entries. This is where the data is stored per-entry. Separate from the sequence numbers for fast lookup (hot/cold split) when the data per-sequence number is relatively large.
         
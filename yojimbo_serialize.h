@@ -29,11 +29,82 @@
 #include "yojimbo_bitpack.h"
 #include "yojimbo_stream.h"
 #include "yojimbo_address.h"
+#include <math.h>
 
 /** @file */
 
 namespace yojimbo
 {
+    /**
+        Get the stream to report serialize profiler fields to.
+
+        @param stream A read or write stream.
+
+        @returns Always NULL. Only measure streams can be profiled.
+     */
+
+    inline MeasureStream * serialize_profile_stream( BaseStream & stream )
+    {
+        (void) stream;
+        return NULL;
+    }
+
+    /**
+        Get the stream to report serialize profiler fields to.
+
+        @param stream A measure stream.
+
+        @returns The measure stream if it has a profiler attached, otherwise NULL.
+     */
+
+    inline MeasureStream * serialize_profile_stream( MeasureStream & stream )
+    {
+        return stream.GetProfiler() ? &stream : NULL;
+    }
+
+    /**
+        Reports the bits measured by a serialize macro to the serialize profiler, from construction until it goes out of scope.
+
+        Going out of scope covers early returns on error too, so nested macros always stay balanced.
+
+        For read and write streams the stream pointer is always NULL, so this compiles away.
+
+        @see ProfilingMeasureStream
+     */
+
+    class SerializeProfileScope
+    {
+    public:
+
+        SerializeProfileScope( MeasureStream * stream, const char * name, const char * file, int line ) : m_stream( stream )
+        {
+            if ( m_stream )
+                m_stream->SerializeProfileBegin( name, file, line );
+        }
+
+        ~SerializeProfileScope()
+        {
+            if ( m_stream )
+                m_stream->SerializeProfileEnd();
+        }
+
+    private:
+
+        MeasureStream * m_stream;                           ///< The measure stream with a profiler attached, or NULL if not profiling.
+    };
+
+    /**
+        Report the bits measured until the end of the current scope as a serialize profiler field.
+
+        Each serialize_* macro does this with the name of the value passed in, so you only need to call it yourself to group several macros under one field. 
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param name The field name. Must be a string that stays valid for the lifetime of the profiler, eg. a string literal.
+     */
+
+    #define serialize_profile_field( stream, name )                                                                         \
+        yojimbo::SerializeProfileScope serialize_profile_scope( yojimbo::serialize_profile_stream( stream ), name, __FILE__, __LINE__ )
+
     /**
         Serialize integer value (read/write/measure).
 
@@ -52,6 +123,7 @@ namespace yojimbo
     #define serialize_int( stream, value, min, max )                    \
         do                                                              \
         {                                                               \
+            serialize_profile_field( stream, #value );                  \
             assert( min < max );                                        \
             int32_t int32_value = 0;                                    \
             if ( Stream::IsWriting )                                    \
@@ -71,6 +143,42 @@ namespace yojimbo
             }                                                           \
         } while (0)
 
+    /**
+        Serialize integer value with bounds known at compile time (read/write/measure).
+
+        Use this instead of serialize_int when min and max are compile time constants. The number of bits is computed at compile time, which takes the range arithmetic off the per-field cost of serializing.
+
+        Writes exactly the same bits as serialize_int with the same bounds, so you can switch between the two without changing the wire format.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param value The integer value to serialize in [min,max].
+        @param min The minimum value. Must be a compile time constant.
+        @param max The maximum value. Must be a compile time constant.
+     */
+
+    #define serialize_int_constant( stream, value, min, max )                               \
+        do                                                                                  \
+        {                                                                                   \
+            serialize_profile_field( stream, #value );                                      \
+            int32_t int32_value = 0;                                                        \
+            if ( Stream::IsWriting )                                                        \
+            {                                                                               \
+                assert( int64_t(value) >= int64_t(min) );                                   \
+                assert( int64_t(value) <= int64_t(max) );                                   \
+                int32_value = (int32_t) value;                                              \
+            }                                                                               \
+            if ( !stream.template SerializeIntegerConstant<min,max>( int32_value ) )        \
+                return false;                                                               \
+            if ( Stream::IsReading )                                                        \
+            {                                                                               \
+                if ( int64_t(int32_value) > int64_t(max) )                                  \
+                    return false;                                                           \
+                value = int32_value;                                                        \
+            }                                                                               \
+        } while (0)
+
     /**
         Serialize bits to the stream (read/write/measure).
 
@@ -88,6 +196,7 @@ namespace yojimbo
     #define serialize_bits( stream, value, bits )                       \
         do                                                              \
         {                                                               \
+            serialize_profile_field( stream, #value );                  \
             assert( bits > 0 );                                         \
             assert( bits <= 32 );                                       \
             uint32_t uint32_value = 0;                                  \
@@ -115,6 +224,7 @@ namespace yojimbo
     #define serialize_bool( stream, value )                             \
         do                                                              \
         {                                                               \
+            serialize_profile_field( stream, #value );                  \
             uint32_t uint32_bool_value = 0;                             \
             if ( Stream::IsWriting )                                    \
                 uint32_bool_value = value ? 1 : 0;                      \
@@ -123,6 +233,64 @@ namespace yojimbo
                 value = uint32_bool_value ? true : false;               \
         } while (0)
 
+    template <typename Stream> bool serialize_bits_array_internal( Stream & stream, uint32_t * values, int count, int bits )
+    {
+        for ( int i = 0; i < count; ++i )
+        {
+            if ( !stream.SerializeBits( values[i], bits ) )
+                return false;
+        }
+        return true;
+    }
+
+    inline bool serialize_bits_array_internal( WriteStream & stream, uint32_t * values, int count, int bits )
+    {
+        return stream.SerializeBitsArray( values, count, bits );
+    }
+
+    inline bool serialize_bits_array_internal( ReadStream & stream, uint32_t * values, int count, int bits )
+    {
+        return stream.SerializeBitsArray( values, count, bits );
+    }
+
+    inline bool serialize_bits_array_internal( UncheckedReadStream & stream, uint32_t * values, int count, int bits )
+    {
+        return stream.SerializeBitsArray( values, count, bits );
+    }
+
+    inline bool serialize_bits_array_internal( MeasureStream & stream, uint32_t * values, int count, int bits )
+    {
+        return stream.SerializeBitsArray( values, count, bits );
+    }
+
+    /**
+        Serialize an array of values with the same number of bits (read/write/measure).
+
+        Writes exactly the same bits as calling serialize_bits on each value in turn, so you can switch a loop over serialize_bits to this without changing the wire format.
+
+        Use this for long runs of fixed width values, eg. entity ids or quantized components in a snapshot. The bitpacker keeps its state in registers for the whole array, and reads check the end of the buffer once for the whole array instead of once per value.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param values Pointer to the array of uint32_t values to serialize. Each value must be in [0,(1<<bits)-1].
+        @param count The number of values in the array.
+        @param bits The number of bits to serialize per value in [1,32].
+     */
+
+    #define serialize_bits_array( stream, values, count, bits )                                 \
+        do                                                                                      \
+        {                                                                                       \
+            serialize_profile_field( stream, #values );                                         \
+            assert( count >= 0 );                                                               \
+            assert( bits > 0 );                                                                 \
+            assert( bits <= 32 );                                                               \
+            if ( !yojimbo::serialize_bits_array_internal( stream, values, count, bits ) )       \
+                return false;                                                                   \
+        } while (0)
+
     template <typename Stream> bool serialize_float_internal( Stream & stream, float & value )
     {
         uint32_t int_value;
@@ -154,6 +322,7 @@ namespace yojimbo
     #define serialize_float( stream, value )                                        \
         do                                                                          \
         {                                                                           \
+            serialize_profile_field( stream, #value );                              \
             if ( !yojimbo::serialize_float_internal( stream, value ) )              \
                 return false;                                                       \
         } while (0)
@@ -205,6 +374,7 @@ namespace yojimbo
     #define serialize_uint64( stream, value )                                       \
         do                                                                          \
         {                                                                           \
+            serialize_profile_field( stream, #value );                              \
             if ( !yojimbo::serialize_uint64_internal( stream, value ) )             \
                 return false;                                                       \
         } while (0)
@@ -245,10 +415,211 @@ namespace yojimbo
     #define serialize_double( stream, value )                                       \
         do                                                                          \
         {                                                                           \
+            serialize_profile_field( stream, #value );                              \
             if ( !yojimbo::serialize_double_internal( stream, value ) )             \
                 return false;                                                       \
         } while (0)
 
+    /**
+        Quantize a float in [min,max] to an unsigned integer with a number of bits.
+
+        Values outside [min,max] are clamped. NaN quantizes to min. The endpoints min and max quantize exactly.
+
+        @param value The float value to quantize.
+        @param min The minimum value.
+        @param max The maximum value. Must be greater than min.
+
+        @returns The quantized value in [0,(1<<Bits)-1].
+     */
+
+    template <int Bits> uint32_t quantize_float( float value, float min, float max )
+    {
+        assert( Bits > 0 );
+        assert( Bits <= 32 );
+        assert( min < max );
+        const uint32_t maxValue = uint32_t( ( uint64_t(1) << Bits ) - 1 );
+        if ( !( value >= min ) )
+            return 0;
+        if ( value >= max )
+            return maxValue;
+        const double normalized = ( double( value ) - min ) / ( double( max ) - min );
+        return uint32_t( normalized * maxValue + 0.5 );
+    }
+
+    /**
+        Convert a quantized value back to a float in [min,max].
+
+        @param quantized The quantized value in [0,(1<<Bits)-1].
+        @param min The minimum value.
+        @param max The maximum value. Must be greater than min.
+
+        @returns The float value. It is within (max-min) / ((1<<Bits)-1) / 2 of the value that was quantized, if that value was in [min,max].
+     */
+
+    template <int Bits> float dequantize_float( uint32_t quantized, float min, float max )
+    {
+        assert( Bits > 0 );
+        assert( Bits <= 32 );
+        assert( min < max );
+        const uint32_t maxValue = uint32_t( ( uint64_t(1) << Bits ) - 1 );
+        if ( quantized >= maxValue )
+            return max;
+        return float( min + ( double( max ) - min ) * ( double( quantized ) / maxValue ) );
+    }
+
+    template <int Bits, typename Stream> bool serialize_quantized_float_internal( Stream & stream, float & value, float min, float max )
+    {
+        uint32_t quantized = 0;
+
+        if ( Stream::IsWriting )
+            quantized = quantize_float<Bits>( value, min, max );
+
+        if ( !stream.SerializeBits( quantized, Bits ) )
+            return false;
+
+        if ( Stream::IsReading )
+            value = dequantize_float<Bits>( quantized, min, max );
+
+        return true;
+    }
+
+    /**
+        Serialize a float with bounds and a fixed number of bits (read/write/measure).
+
+        This is a lossy encoding. The value is clamped to [min,max] and quantized to the nearest of (1<<bits) evenly spaced values, so the precision is (max-min) / ((1<<bits)-1). For example, a position in [-512,512] with 20 bits is accurate to about 1mm.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param value The float value to serialize.
+        @param min The minimum value.
+        @param max The maximum value. Must be greater than min.
+        @param bits The number of bits to serialize in [1,32]. Must be a compile time constant.
+     */
+
+    #define serialize_quantized_float( stream, value, min, max, bits )                                      \
+        do                                                                                                  \
+        {                                                                                                   \
+            serialize_profile_field( stream, #value );                                                      \
+            if ( !yojimbo::serialize_quantized_float_internal<bits>( stream, value, min, max ) )            \
+                return false;                                                                               \
+        } while (0)
+
+    template <int Bits, typename Stream> bool serialize_quantized_vector_internal( Stream & stream, float * vector, float min, float max )
+    {
+        assert( vector );
+
+        for ( int i = 0; i < 3; ++i )
+        {
+            if ( !serialize_quantized_float_internal<Bits>( stream, vector[i], min, max ) )
+                return false;
+        }
+
+        return true;
+    }
+
+    /**
+        Serialize a 3D vector with bounds and a fixed number of bits per component (read/write/measure).
+
+        Each component is serialized with serialize_quantized_float, so the vector takes 3 * bits.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param vector Pointer to the three float components of the vector (x,y,z).
+        @param min The minimum value of each component.
+        @param max The maximum value of each component. Must be greater than min.
+        @param bits The number of bits per component in [1,32]. Must be a compile time constant.
+     */
+
+    #define serialize_quantized_vector( stream, vector, min, max, bits )                                    \
+        do                                                                                                  \
+        {                                                                                                   \
+            serialize_profile_field( stream, #vector );                                                     \
+            if ( !yojimbo::serialize_quantized_vector_internal<bits>( stream, vector, min, max ) )          \
+                return false;                                                                               \
+        } while (0)
+
+    template <int Bits, typename Stream> bool serialize_quaternion_internal( Stream & stream, float * quaternion )
+    {
+        assert( quaternion );
+
+        // IMPORTANT: the three smallest components of a unit quaternion are always in [-1/sqrt(2),+1/sqrt(2)]
+
+        const float bound = 0.707107f;
+
+        uint32_t largest = 0;
+
+        float smallest[3] = { 0.0f, 0.0f, 0.0f };
+
+        if ( Stream::IsWriting )
+        {
+            for ( int i = 1; i < 4; ++i )
+            {
+                if ( fabsf( quaternion[i] ) > fabsf( quaternion[largest] ) )
+                    largest = i;
+            }
+
+            // q and -q are the same rotation, so flip the sign to make the largest component positive and drop it
+
+            const float sign = ( quaternion[largest] < 0.0f ) ? -1.0f : 1.0f;
+
+            for ( int i = 0, j = 0; i < 4; ++i )
+            {
+                if ( i != int( largest ) )
+                    smallest[j++] = quaternion[i] * sign;
+            }
+        }
+
+        serialize_bits( stream, largest, 2 );
+
+        for ( int i = 0; i < 3; ++i )
+        {
+            if ( !serialize_quantized_float_internal<Bits>( stream, smallest[i], -bound, bound ) )
+                return false;
+        }
+
+        if ( Stream::IsReading )
+        {
+            const float sum = smallest[0] * smallest[0] + smallest[1] * smallest[1] + smallest[2] * smallest[2];
+
+            const float largestValue = ( sum < 1.0f ) ? sqrtf( 1.0f - sum ) : 0.0f;
+
+            for ( int i = 0, j = 0; i < 4; ++i )
+                quaternion[i] = ( i == int( largest ) ) ? largestValue : smallest[j++];
+        }
+
+        return true;
+    }
+
+    /**
+        Serialize a unit quaternion with the smallest three encoding (read/write/measure).
+
+        The largest component is dropped and rebuilt on read from the other three, since the quaternion has unit length. The quaternion takes 2 bits for the index of the largest component, plus 3 * bits for the rest. 9 to 10 bits per component is good enough for most game rotations.
+
+        The quaternion read back has a non-negative largest component, so it may be the negation of the quaternion written. Both represent the same rotation.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param quaternion Pointer to the four float components of the quaternion (x,y,z,w). Must be normalized.
+        @param bits The number of bits per smallest component in [1,32]. Must be a compile time constant.
+     */
+
+    #define serialize_quaternion( stream, quaternion, bits )                                                \
+        do                                                                                                  \
+        {                                                                                                   \
+            serialize_profile_field( stream, #quaternion );                                                 \
+            if ( !yojimbo::serialize_quaternion_internal<bits>( stream, quaternion ) )                      \
+                return false;                                                                               \
+        } while (0)
+
     template <typename Stream> bool serialize_bytes_internal( Stream & stream, uint8_t * data, int bytes )
     {
         return stream.SerializeBytes( data, bytes );
@@ -271,6 +642,7 @@ namespace yojimbo
     #define serialize_bytes( stream, data, bytes )                                  \
         do                                                                          \
         {                                                                           \
+            serialize_profile_field( stream, #data );                               \
             if ( !yojimbo::serialize_bytes_internal( stream, data, bytes ) )        \
                 return false;                                                       \
         } while (0)
@@ -307,10 +679,81 @@ namespace yojimbo
     #define serialize_string( stream, string, buffer_size )                                 \
         do                                                                                  \
         {                                                                                   \
+            serialize_profile_field( stream, #string );                                     \
             if ( !yojimbo::serialize_string_internal( stream, string, buffer_size ) )       \
                 return false;                                                               \
         } while (0)
 
+    template <typename Stream> bool serialize_bytes_view_internal( Stream & stream, const uint8_t * & data, int bytes )
+    {
+        return stream.SerializeBytesView( data, bytes );
+    }
+
+    /**
+        Serialize an array of bytes to the stream without copying them on read (read/write/measure).
+
+        Writes exactly the same bits as serialize_bytes. On read, data is set to point at the bytes inside the buffer being read, eg. the decrypted packet data, instead of copying them into a buffer in the object being serialized. Use this for large read-only payloads so they don't need a fixed size array or a block message.
+
+        IMPORTANT: On read, data is only valid as long as the buffer being read. Packets read by a transport are read from a receive buffer that is reused, so consume or copy the bytes before the packet is processed. Packets read with PacketProcessor::ReadPacket from a buffer you own can keep views for as long as you keep that buffer.
+
+        Range coded streams can't view bytes in place, so this always fails on read from a RangeDecodeStream.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param data Pointer to the bytes to be written. Set to point at the bytes in the buffer on read. Must be a const uint8_t pointer.
+        @param bytes The number of bytes to serialize.
+     */
+
+    #define serialize_bytes_view( stream, data, bytes )                                     \
+        do                                                                                  \
+        {                                                                                   \
+            serialize_profile_field( stream, #data );                                       \
+            if ( !yojimbo::serialize_bytes_view_internal( stream, data, bytes ) )           \
+                return false;                                                               \
+        } while (0)
+
+    template <typename Stream> bool serialize_string_view_internal( Stream & stream, const char * & string, int & length, int max_length )
+    {
+        if ( Stream::IsWriting )
+        {
+            assert( string || length == 0 );
+            assert( length >= 0 );
+            assert( length <= max_length );
+        }
+        serialize_int( stream, length, 0, max_length );
+        const uint8_t * data = (const uint8_t*) string;
+        serialize_bytes_view( stream, data, length );
+        if ( Stream::IsReading )
+            string = (const char*) data;
+        return true;
+    }
+
+    /**
+        Serialize a string to the stream without copying it on read (read/write/measure).
+
+        The string is passed as a pointer and a length, because on read it points into the buffer being read and isn't null terminated. See serialize_bytes_view for how long the string stays valid on read.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param string The characters of the string to write. Set to point at the characters in the buffer on read. Must be a const char pointer.
+        @param length The length of the string in characters, not including any null terminator. Set to the length of the string on read. Must be an int.
+        @param max_length The maximum length of the string in characters.
+     */
+
+    #define serialize_string_view( stream, string, length, max_length )                                         \
+        do                                                                                                      \
+        {                                                                                                       \
+            serialize_profile_field( stream, #string );                                                         \
+            if ( !yojimbo::serialize_string_view_internal( stream, string, length, max_length ) )               \
+                return false;                                                                                   \
+        } while (0)
+
     /**
         Serialize an alignment to the stream (read/write/measure).
 
@@ -326,6 +769,7 @@ namespace yojimbo
     #define serialize_align( stream )                                                       \
         do                                                                                  \
         {                                                                                   \
+            serialize_profile_field( stream, "align" );                                     \
             if ( !stream.SerializeAlign() )                                                 \
                 return false;                                                               \
         } while (0)
@@ -345,6 +789,7 @@ namespace yojimbo
     #define serialize_check( stream )                                                       \
         do                                                                                  \
         {                                                                                   \
+            serialize_profile_field( stream, "check" );                                     \
             if ( !stream.SerializeCheck() )                                                 \
                 return false;                                                               \
         } while (0)
@@ -408,6 +853,7 @@ namespace yojimbo
     #define serialize_address( stream, value )                                              \
         do                                                                                  \
         {                                                                                   \
+            serialize_profile_field( stream, #value );                                      \
             if ( !yojimbo::serialize_address_internal( stream, value ) )                    \
                 return false;                                                               \
         } while (0)
@@ -439,7 +885,7 @@ namespace yojimbo
         serialize_bool( stream, twoBits );
         if ( twoBits )
         {
-            serialize_int( stream, difference, 2, 6 );
+            serialize_int_constant( stream, difference, 2, 6 );
             if ( Stream::IsReading )
                 current = previous + difference;
             return true;
@@ -451,7 +897,7 @@ namespace yojimbo
         serialize_bool( stream, fourBits );
         if ( fourBits )
         {
-            serialize_int( stream, difference, 7, 23 );
+            serialize_int_constant( stream, difference, 7, 23 );
             if ( Stream::IsReading )
                 current = previous + difference;
             return true;
@@ -463,7 +909,7 @@ namespace yojimbo
         serialize_bool( stream, eightBits );
         if ( eightBits )
         {
-            serialize_int( stream, difference, 24, 280 );
+            serialize_int_constant( stream, difference, 24, 280 );
             if ( Stream::IsReading )
                 current = previous + difference;
             return true;
@@ -475,7 +921,7 @@ namespace yojimbo
         serialize_bool( stream, twelveBits );
         if ( twelveBits )
         {
-            serialize_int( stream, difference, 281, 4377 );
+            serialize_int_constant( stream, difference, 281, 4377 );
             if ( Stream::IsReading )
                 current = previous + difference;
             return true;
@@ -487,7 +933,7 @@ namespace yojimbo
         serialize_bool( stream, sixteenBits );
         if ( sixteenBits )
         {
-            serialize_int( stream, difference, 4378, 69914 );
+            serialize_int_constant( stream, difference, 4378, 69914 );
             if ( Stream::IsReading )
                 current = previous + difference;
             return true;
@@ -518,10 +964,49 @@ namespace yojimbo
     #define serialize_int_relative( stream, previous, current )                             \
         do                                                                                  \
         {                                                                                   \
+            serialize_profile_field( stream, #current );                                    \
             if ( !yojimbo::serialize_int_relative_internal( stream, previous, current ) )   \
                 return false;                                                               \
         } while (0)
 
+    /**
+        Get the number of bits serialize_int_relative_internal takes to write an integer relative to the previous value.
+
+        This mirrors the encoding in serialize_int_relative_internal exactly, so you can budget packet space without running the value through a measure stream.
+
+        @param previous The previous integer value.
+        @param current The current integer value. Must be greater than previous.
+
+        @returns The number of bits that serialize_int_relative_internal would write.
+     */
+
+    inline int relative_int_bits( uint32_t previous, uint32_t current )
+    {
+        assert( previous < current );
+
+        const uint32_t difference = current - previous;
+
+        if ( difference == 1 )
+            return 1;
+
+        if ( difference <= 6 )
+            return 2 + BitsRequired<2,6>::result;
+
+        if ( difference <= 23 )
+            return 3 + BitsRequired<7,23>::result;
+
+        if ( difference <= 280 )
+            return 4 + BitsRequired<24,280>::result;
+
+        if ( difference <= 4377 )
+            return 5 + BitsRequired<281,4377>::result;
+
+        if ( difference <= 69914 )
+            return 6 + BitsRequired<4378,69914>::result;
+
+        return 6 + 32;
+    }
+
     template <typename Stream> bool serialize_ack_relative_internal( Stream & stream, uint16_t sequence, uint16_t & ack )
     {
         int ack_delta = 0;
@@ -544,7 +1029,7 @@ namespace yojimbo
 
         if ( ack_in_range )
         {
-            serialize_int( stream, ack_delta, 1, 64 );
+            serialize_int_constant( stream, ack_delta, 1, 64 );
             if ( Stream::IsReading )
                 ack = sequence - ack_delta;
         }
@@ -573,6 +1058,7 @@ namespace yojimbo
     #define serialize_ack_relative( stream, sequence, ack  )                                        \
         do                                                                                          \
         {                                                                                           \
+            serialize_profile_field( stream, #ack );                                                \
             if ( !yojimbo::serialize_ack_relative_internal( stream, sequence, ack ) )               \
                 return false;                                                                       \
         } while (0)
@@ -615,10 +1101,154 @@ namespace yojimbo
     #define serialize_sequence_relative( stream, sequence1, sequence2 )                             \
         do                                                                                          \
         {                                                                                           \
+            serialize_profile_field( stream, #sequence2 );                                          \
             if ( !yojimbo::serialize_sequence_relative_internal( stream, sequence1, sequence2 ) )   \
                 return false;                                                                       \
         } while (0)
 
+    /**
+        Get the number of bits serialize_sequence_relative_internal takes to write a sequence number relative to another.
+
+        @param sequence1 The first sequence number to serialize relative to.
+        @param sequence2 The second sequence number, encoded relative to the first. Must not be equal to sequence1.
+
+        @returns The number of bits that serialize_sequence_relative_internal would write.
+     */
+
+    inline int sequence_relative_bits( uint16_t sequence1, uint16_t sequence2 )
+    {
+        return relative_int_bits( sequence1, sequence2 + ( ( sequence1 > sequence2 ) ? 65536 : 0 ) );
+    }
+
+    /**
+        Get the number of significant bits in an unsigned integer plus one, as used by the varint encoding.
+
+        @param value The unsigned integer value.
+
+        @returns The number of bits in value + 1, in [1,33].
+     */
+
+    inline int varint_value_bits( uint32_t value )
+    {
+        return ( value == 0xFFFFFFFF ) ? 33 : bits_required( 0, value + 1 );
+    }
+
+    template <typename Stream> bool serialize_varint_internal( Stream & stream, uint32_t & value )
+    {
+        // IMPORTANT: Elias-gamma code for value + 1. With n significant bits, this is n-1 zero bits, a one bit, then the low n-1 bits of value + 1.
+
+        int zeros = 0;
+
+        if ( Stream::IsWriting )
+            zeros = varint_value_bits( value ) - 1;
+
+        if ( !stream.SerializeVarintPrefix( zeros ) )
+            return false;
+
+        uint32_t low = 0;
+
+        if ( zeros > 0 )
+        {
+            if ( Stream::IsWriting )
+                low = uint32_t( ( uint64_t( value ) + 1 ) & ( ( uint64_t(1) << zeros ) - 1 ) );
+            serialize_bits( stream, low, zeros );
+        }
+
+        if ( Stream::IsReading )
+        {
+            const uint64_t x = ( uint64_t(1) << zeros ) | low;
+
+            if ( x > uint64_t( 0xFFFFFFFF ) + 1 )
+                return false;
+
+            value = uint32_t( x - 1 );
+        }
+
+        return true;
+    }
+
+    /**
+        Serialize an unsigned integer with a variable length code (read/write/measure).
+
+        Small values take fewer bits: 0 takes 1 bit, 1-2 take 3 bits, 3-6 take 5 bits, and in general values below 2^k - 1 take at most 2k-1 bits, up to 65 bits for 0xFFFFFFFF. Use this for counts, ids and deltas that are usually small but have no fixed upper bound. If the range is known and the distribution is flat, serialize_int is smaller.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param value The unsigned integer value to serialize.
+
+        @see varint_bits
+     */
+
+    #define serialize_varint( stream, value )                                               \
+        do                                                                                  \
+        {                                                                                   \
+            serialize_profile_field( stream, #value );                                      \
+            uint32_t uint32_varint_value = 0;                                               \
+            if ( Stream::IsWriting )                                                        \
+                uint32_varint_value = (uint32_t) value;                                     \
+            if ( !yojimbo::serialize_varint_internal( stream, uint32_varint_value ) )       \
+                return false;                                                               \
+            if ( Stream::IsReading )                                                        \
+                value = uint32_varint_value;                                                \
+        } while (0)
+
+    /**
+        Serialize a signed integer with a zig-zag variable length code (read/write/measure).
+
+        The value is zig-zag encoded with signed_to_unsigned, so 0,-1,+1,-2,+2... become 0,1,2,3,4..., then serialized with serialize_varint. Values close to zero in either direction take few bits.
+
+        Serialize macros returns false on error so we don't need to use exceptions for error handling on read. This is an important safety measure because packet data comes from the network and may be malicious.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param value The signed integer value to serialize.
+
+        @see zigzag_bits
+     */
+
+    #define serialize_zigzag( stream, value )                                               \
+        do                                                                                  \
+        {                                                                                   \
+            serialize_profile_field( stream, #value );                                      \
+            uint32_t uint32_zigzag_value = 0;                                               \
+            if ( Stream::IsWriting )                                                        \
+                uint32_zigzag_value = (uint32_t) yojimbo::signed_to_unsigned( value );      \
+            if ( !yojimbo::serialize_varint_internal( stream, uint32_zigzag_value ) )       \
+                return false;                                                               \
+            if ( Stream::IsReading )                                                        \
+                value = yojimbo::unsigned_to_signed( uint32_zigzag_value );                 \
+        } while (0)
+
+    /**
+        Get the number of bits serialize_varint takes to write an unsigned integer.
+
+        @param value The unsigned integer value.
+
+        @returns The number of bits that serialize_varint would write.
+     */
+
+    inline int varint_bits( uint32_t value )
+    {
+        return varint_value_bits( value ) * 2 - 1;
+    }
+
+    /**
+        Get the number of bits serialize_zigzag takes to write a signed integer.
+
+        @param value The signed integer value.
+
+        @returns The number of bits that serialize_zigzag would write.
+     */
+
+    inline int zigzag_bits( int32_t value )
+    {
+        return varint_bits( (uint32_t) signed_to_unsigned( value ) );
+    }
+
     // read macros corresponding to each serialize_*. useful when you want separate read and write functions for some reason.
 
     #define read_bits( stream, value, bits )                                                \
@@ -644,6 +1274,13 @@ namespace yojimbo
                 return false;                                                               \
         } while (0)
 
+    #define read_int_constant           serialize_int_constant
+    #define read_quantized_float        serialize_quantized_float
+    #define read_quantized_vector       serialize_quantized_vector
+    #define read_quaternion             serialize_quaternion
+    #define read_varint                 serialize_varint
+    #define read_zigzag                 serialize_zigzag
+
     #define read_bool( stream, value ) read_bits( stream, value, 1 )
 
     #define read_float                  serialize_float
@@ -683,6 +1320,12 @@ namespace yojimbo
                 return false;                                                               \
         } while (0)
 
+    #define write_int_constant          serialize_int_constant
+    #define write_quantized_float       serialize_quantized_float
+    #define write_quantized_vector      serialize_quantized_vector
+    #define write_quaternion            serialize_quaternion
+    #define write_varint                serialize_varint
+    #define write_zigzag                serialize_zigzag
     #define write_float                 serialize_float
     #define write_uint32                serialize_uint32
     #define write_uint64                serialize_uint64
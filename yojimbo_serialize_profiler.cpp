@@ -0,0 +1,179 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_config.h"
+#include "yojimbo_serialize_profiler.h"
+#include "yojimbo_common.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace yojimbo
+{
+    static inline uint32_t serialize_profiler_hash( int line )
+    {
+        return uint32_t( line ) * 2654435761U;
+    }
+
+    static inline bool serialize_profiler_same_site( const SerializeProfileField & field, const char * file, int line )
+    {
+        // IMPORTANT: the same file can have a different __FILE__ pointer in each translation unit, eg. serialize functions defined in headers.
+
+        return field.line == line && ( field.file == file || strcmp( field.file, file ) == 0 );
+    }
+
+    static int serialize_profiler_compare( const void * a, const void * b )
+    {
+        const SerializeProfileField * fieldA = (const SerializeProfileField*) a;
+        const SerializeProfileField * fieldB = (const SerializeProfileField*) b;
+        if ( fieldA->bits > fieldB->bits )
+            return -1;
+        if ( fieldA->bits < fieldB->bits )
+            return 1;
+        return 0;
+    }
+
+    SerializeProfiler::SerializeProfiler( Allocator & allocator, int maxFields )
+    {
+        assert( maxFields > 0 );
+
+        m_allocator = &allocator;
+
+        m_maxFields = maxFields;
+
+        uint32_t tableSize = 1;
+        while ( tableSize < uint32_t( maxFields ) * 2 )
+            tableSize <<= 1;
+
+        m_tableMask = tableSize - 1;
+
+        m_fields = (SerializeProfileField*) YOJIMBO_ALLOCATE( allocator, sizeof( SerializeProfileField ) * maxFields );
+        m_table = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * tableSize );
+
+        Reset();
+    }
+
+    SerializeProfiler::~SerializeProfiler()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_fields );
+        YOJIMBO_FREE( *m_allocator, m_table );
+
+        m_allocator = NULL;
+    }
+
+    void SerializeProfiler::Reset()
+    {
+        m_numFields = 0;
+        m_totalBits = 0;
+        m_overflowBits = 0;
+
+        for ( uint32_t i = 0; i <= m_tableMask; ++i )
+            m_table[i] = -1;
+    }
+
+    void SerializeProfiler::AddField( const char * name, const char * file, int line, int bits )
+    {
+        assert( name );
+        assert( file );
+        assert( bits >= 0 );
+
+        m_totalBits += bits;
+
+        uint32_t index = serialize_profiler_hash( line ) & m_tableMask;
+
+        while ( m_table[index] >= 0 )
+        {
+            SerializeProfileField & field = m_fields[m_table[index]];
+            if ( serialize_profiler_same_site( field, file, line ) )
+            {
+                field.bits += bits;
+                field.count++;
+                return;
+            }
+            index = ( index + 1 ) & m_tableMask;
+        }
+
+        if ( m_numFields == m_maxFields )
+        {
+            m_overflowBits += bits;
+            return;
+        }
+
+        const int fieldIndex = m_numFields++;
+
+        SerializeProfileField & field = m_fields[fieldIndex];
+        field.name = name;
+        field.file = file;
+        field.line = line;
+        field.bits = bits;
+        field.count = 1;
+
+        m_table[index] = fieldIndex;
+    }
+
+    void SerializeProfiler::SortFields()
+    {
+        qsort( m_fields, m_numFields, sizeof( SerializeProfileField ), serialize_profiler_compare );
+
+        RebuildTable();
+    }
+
+    void SerializeProfiler::Report( int maxFields )
+    {
+        SortFields();
+
+        printf( "%" PRIu64 " bits measured in %d fields\n", m_totalBits, m_numFields );
+
+        if ( m_overflowBits )
+            printf( "%" PRIu64 " bits were in fields that didn't fit (max fields is %d)\n", m_overflowBits, m_maxFields );
+
+        for ( int i = 0; i < m_numFields && i < maxFields; ++i )
+        {
+            const SerializeProfileField & field = m_fields[i];
+            const double percent = m_totalBits ? 100.0 * double( field.bits ) / double( m_totalBits ) : 0.0;
+            const double average = double( field.bits ) / double( field.count );
+            printf( "%5.1f%% %10" PRIu64 " bits %8.1f avg - %s - %s:%d\n", percent, field.bits, average, field.name, field.file, field.line );
+        }
+
+        printf( "\n" );
+    }
+
+    void SerializeProfiler::RebuildTable()
+    {
+        for ( uint32_t i = 0; i <= m_tableMask; ++i )
+            m_table[i] = -1;
+
+        for ( int i = 0; i < m_numFields; ++i )
+        {
+            uint32_t index = serialize_profiler_hash( m_fields[i].line ) & m_tableMask;
+            while ( m_table[index] >= 0 )
+                index = ( index + 1 ) & m_tableMask;
+            m_table[index] = i;
+        }
+    }
+}
@@ -0,0 +1,185 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef YOJIMBO_SERIALIZE_PROFILER_H
+#define YOJIMBO_SERIALIZE_PROFILER_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_allocator.h"
+#include <assert.h>
+
+/** @file */
+
+namespace yojimbo
+{
+    /// The default maximum number of distinct fields tracked by a SerializeProfiler.
+
+    const int DefaultSerializeProfilerMaxFields = 1024;
+
+    /// Bits measured for one serialize call site, aggregated across every stream that reported to the profiler.
+
+    struct SerializeProfileField
+    {
+        const char * name;                                                  ///< The field name captured by the serialize macro, eg. "position.x".
+        const char * file;                                                  ///< The source file containing the serialize call.
+        int line;                                                           ///< The line number of the serialize call.
+        uint64_t bits;                                                      ///< The total number of bits measured for this field.
+        uint64_t count;                                                     ///< The number of times this field was measured.
+    };
+
+    /**
+        Aggregates the bits measured per serialize call site.
+
+        Attach a profiler to a measure stream (see ProfilingMeasureStream) and each serialize_* macro reports the bits it measured, keyed by the file and line it was called from. Keep the same profiler across many streams to aggregate over a whole session, then sort the fields to see which ones dominate bandwidth.
+
+        Composite macros such as serialize_bool and serialize_uint64 are reported once under the name passed in by the caller, not once for each of the primitives they are built from. Fields inside a serialize_object are reported individually.
+
+        Fields are kept in an open addressing hash table keyed by line, so reporting a field is a hash and a short probe with no allocation. Once the profiler is full, bits for new fields are only counted in GetNumOverflowBits.
+
+        @see ProfilingMeasureStream
+     */
+
+    class SerializeProfiler
+    {
+    public:
+
+        /**
+            Serialize profiler constructor.
+
+            @param allocator The allocator used to allocate the field table.
+            @param maxFields The maximum number of distinct fields tracked.
+         */
+
+        SerializeProfiler( Allocator & allocator, int maxFields = DefaultSerializeProfilerMaxFields );
+
+        /**
+            Serialize profiler destructor.
+         */
+
+        ~SerializeProfiler();
+
+        /**
+            Forget all fields measured so far.
+         */
+
+        void Reset();
+
+        /**
+            Add bits measured for a field.
+
+            This is called by MeasureStream when a serialize macro finishes. You don't need to call it yourself.
+
+            @param name The field name.
+            @param file The source file of the serialize call.
+            @param line The line number of the serialize call.
+            @param bits The number of bits measured.
+         */
+
+        void AddField( const char * name, const char * file, int line, int bits );
+
+        /**
+            Sort fields by the total number of bits measured, largest first.
+
+            Fields keep being aggregated correctly after sorting, but their indices change.
+         */
+
+        void SortFields();
+
+        /**
+            Print the fields to stdout, largest first.
+
+            @param maxFields The maximum number of fields to print.
+         */
+
+        void Report( int maxFields = DefaultSerializeProfilerMaxFields );
+
+        /**
+            Get the number of distinct fields measured.
+
+            @returns The number of fields in [0,maxFields].
+         */
+
+        int GetNumFields() const { return m_numFields; }
+
+        /**
+            Get a field by index.
+
+            @param index The field index in [0,GetNumFields()-1].
+
+            @returns The field data.
+         */
+
+        const SerializeProfileField & GetField( int index ) const
+        {
+            assert( index >= 0 );
+            assert( index < m_numFields );
+            return m_fields[index];
+        }
+
+        /**
+            Get the total number of bits measured across all fields, including fields that didn't fit in the profiler.
+
+            @returns The total number of bits measured.
+         */
+
+        uint64_t GetTotalBits() const { return m_totalBits; }
+
+        /**
+            Get the number of bits measured for fields that didn't fit in the profiler.
+
+            @returns The number of bits not attributed to any field. If this is non-zero, increase maxFields.
+         */
+
+        uint64_t GetNumOverflowBits() const { return m_overflowBits; }
+
+    protected:
+
+        /**
+            Rebuild the hash table from the field array.
+         */
+
+        void RebuildTable();
+
+    private:
+
+        Allocator * m_allocator;                                            ///< The allocator passed into the constructor.
+
+        int m_maxFields;                                                    ///< The maximum number of distinct fields tracked.
+
+        int m_numFields;                                                    ///< The number of fields in m_fields.
+
+        uint32_t m_tableMask;                                               ///< The hash table size minus one. The hash table is the next power of two at least twice maxFields.
+
+        SerializeProfileField * m_fields;                                   ///< Array of fields measured. Fields are never removed, except by Reset.
+
+        int * m_table;                                                      ///< Hash table from call site to index in m_fields, with -1 in empty slots.
+
+        uint64_t m_totalBits;                                               ///< The total number of bits measured.
+
+        uint64_t m_overflowBits;                                            ///< The number of bits measured for fields that didn't fit.
+    };
+}
+
+#endif // #ifndef YOJIMBO_SERIALIZE_PROFILER_H
@@ -24,6 +24,8 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_server.h"
+#include "yojimbo_profile.h"
+#include "yojimbo_platform.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <inttypes.h>
@@ -31,6 +33,411 @@
 
 namespace yojimbo
 {
+    static inline uint32_t hash_connect_token_mac( const uint8_t * mac )
+    {
+        return (uint32_t) murmur_hash_64( mac, MacBytes, 0 );
+    }
+
+    static const int ClientHandoffHeaderBytes = 8 + NonceBytes;
+
+    /**
+        The session of a client moved from one server to another. Written by Server::HandoffClient and read by Server::AcceptClientHandoff.
+     */
+
+    struct ClientHandoffData
+    {
+        uint64_t clientId;                                          ///< The globally unique client id.
+        Address address;                                            ///< The address of the client.
+        uint64_t sequence;                                          ///< The sequence number of the last packet sent to the client. The client replay protection window depends on it.
+        uint8_t clientToServerKey[KeyBytes];                        ///< Client to server packet encryption key.
+        uint8_t serverToClientKey[KeyBytes];                        ///< Server to client packet encryption key.
+        ReplayProtection * replayProtection;                        ///< The replay protection for packets sent from the client.
+        Connection * connection;                                    ///< The connection for the client. NULL if messages are disabled.
+
+        ClientHandoffData()
+        {
+            clientId = 0;
+            sequence = 0;
+            memset( clientToServerKey, 0, KeyBytes );
+            memset( serverToClientKey, 0, KeyBytes );
+            replayProtection = NULL;
+            connection = NULL;
+        }
+
+        template <typename Stream> bool Serialize( Stream & stream )
+        {
+            assert( replayProtection );
+
+            serialize_uint64( stream, clientId );
+            serialize_address( stream, address );
+            serialize_uint64( stream, sequence );
+            serialize_bytes( stream, clientToServerKey, KeyBytes );
+            serialize_bytes( stream, serverToClientKey, KeyBytes );
+
+            if ( !replayProtection->Serialize( stream ) )
+                return false;
+
+            bool hasConnection = Stream::IsWriting && connection != NULL;
+
+            serialize_bool( stream, hasConnection );
+
+            // IMPORTANT: both servers must agree on whether messages are enabled
+
+            if ( hasConnection != ( connection != NULL ) )
+                return false;
+
+            if ( connection && !connection->SerializeState( stream ) )
+                return false;
+
+            return true;
+        }
+    };
+
+    ConnectTokenTable::ConnectTokenTable( Allocator & allocator, int numEntries )
+    {
+        assert( numEntries > 0 );
+
+        m_allocator = &allocator;
+
+        m_numEntries = numEntries;
+
+        uint32_t tableSize = 1;
+        while ( tableSize < uint32_t( numEntries ) * 2 )
+            tableSize <<= 1;
+
+        m_tableMask = tableSize - 1;
+
+        m_entries = (ConnectTokenEntry*) YOJIMBO_ALLOCATE( allocator, sizeof( ConnectTokenEntry ) * numEntries );
+        m_table = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * tableSize );
+
+        Reset();
+    }
+
+    ConnectTokenTable::~ConnectTokenTable()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_entries );
+        YOJIMBO_FREE( *m_allocator, m_table );
+
+        m_allocator = NULL;
+    }
+
+    void ConnectTokenTable::Reset()
+    {
+        m_numUsedEntries = 0;
+        m_oldestEntry = 0;
+
+        for ( int i = 0; i < m_numEntries; ++i )
+            new ( &m_entries[i] ) ConnectTokenEntry();
+
+        for ( uint32_t i = 0; i <= m_tableMask; ++i )
+            m_table[i] = -1;
+    }
+
+    int ConnectTokenTable::FindSlot( const uint8_t * mac ) const
+    {
+        uint32_t slot = hash_connect_token_mac( mac ) & m_tableMask;
+
+        while ( m_table[slot] >= 0 && memcmp( m_entries[m_table[slot]].mac, mac, MacBytes ) != 0 )
+        {
+            slot = ( slot + 1 ) & m_tableMask;
+        }
+
+        return (int) slot;
+    }
+
+    void ConnectTokenTable::RemoveSlot( uint32_t slot )
+    {
+        assert( m_table[slot] >= 0 );
+
+        // backward shift deletion. see AddressMap::Remove
+
+        uint32_t next = slot;
+
+        while ( true )
+        {
+            next = ( next + 1 ) & m_tableMask;
+
+            if ( m_table[next] < 0 )
+                break;
+
+            const uint32_t ideal = hash_connect_token_mac( m_entries[m_table[next]].mac ) & m_tableMask;
+
+            if ( ( ( next - ideal ) & m_tableMask ) >= ( ( next - slot ) & m_tableMask ) )
+            {
+                m_table[slot] = m_table[next];
+                slot = next;
+            }
+        }
+
+        m_table[slot] = -1;
+    }
+
+    bool ConnectTokenTable::Find( const uint8_t * mac ) const
+    {
+        assert( mac );
+
+        return m_table[FindSlot( mac )] >= 0;
+    }
+
+    bool ConnectTokenTable::FindOrAdd( const Address & address, const uint8_t * mac, double time )
+    {
+        assert( address.IsValid() );
+        assert( mac );
+
+        int slot = FindSlot( mac );
+
+        // if an entry is found with the same mac *and* it has the same address, return true. otherwise somebody is trying to reuse this connect token in a replay attack!
+
+        if ( m_table[slot] >= 0 )
+            return m_entries[m_table[slot]].address == address;
+
+        // no entry is found with the mac. replace the oldest entry in the ring with (mac,address,time) and return true
+
+        ConnectTokenEntry & entry = m_entries[m_oldestEntry];
+
+        assert( entry.time <= time );
+
+        if ( m_numUsedEntries == m_numEntries )
+        {
+            const int oldSlot = FindSlot( entry.mac );
+
+            assert( m_table[oldSlot] == m_oldestEntry );
+
+            RemoveSlot( oldSlot );
+
+            slot = FindSlot( mac );
+        }
+        else
+        {
+            m_numUsedEntries++;
+        }
+
+        entry.time = time;
+        entry.address = address;
+        memcpy( entry.mac, mac, MacBytes );
+
+        assert( m_table[slot] == -1 );
+
+        m_table[slot] = m_oldestEntry;
+
+        m_oldestEntry = ( m_oldestEntry + 1 ) % m_numEntries;
+
+        return true;
+    }
+
+    static const int ConnectionRequestBucketProbes = 4;
+
+    static inline uint64_t connection_request_key( const Address & address, bool subnet )
+    {
+        // IMPORTANT: the port is ignored, so a source can't get fresh buckets just by changing port. subnets are /24 for IPv4 and /48 for IPv6
+
+        uint8_t data[16];
+        int bytes = 0;
+
+        if ( address.GetType() == ADDRESS_IPV4 )
+        {
+            const uint32_t ipv4 = address.GetAddress4();
+            memcpy( data, &ipv4, 4 );
+            bytes = subnet ? 3 : 4;
+        }
+        else
+        {
+            memcpy( data, address.GetAddress6(), 16 );
+            bytes = subnet ? 6 : 16;
+        }
+
+        return murmur_hash_64( data, bytes, uint64_t( address.GetType() ) * 2 + ( subnet ? 1 : 0 ) );
+    }
+
+    ConnectionRequestLimiter::ConnectionRequestLimiter( Allocator & allocator, int numBuckets )
+    {
+        assert( numBuckets > 0 );
+
+        m_allocator = &allocator;
+
+        uint32_t size = ConnectionRequestBucketProbes;
+        while ( size < uint32_t( numBuckets ) )
+            size <<= 1;
+
+        m_bucketMask = size - 1;
+
+        m_buckets = (ConnectionRequestBucket*) YOJIMBO_ALLOCATE( allocator, sizeof( ConnectionRequestBucket ) * size );
+
+        Reset();
+    }
+
+    ConnectionRequestLimiter::~ConnectionRequestLimiter()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_buckets );
+
+        m_allocator = NULL;
+    }
+
+    void ConnectionRequestLimiter::Reset()
+    {
+        for ( uint32_t i = 0; i <= m_bucketMask; ++i )
+            new ( &m_buckets[i] ) ConnectionRequestBucket();
+    }
+
+    bool ConnectionRequestLimiter::Consume( uint64_t key, double time, float rate, float burst )
+    {
+        const uint32_t index = uint32_t( key );
+
+        ConnectionRequestBucket * bucket = NULL;
+        ConnectionRequestBucket * oldest = NULL;
+
+        for ( int i = 0; i < ConnectionRequestBucketProbes; ++i )
+        {
+            ConnectionRequestBucket * candidate = &m_buckets[ ( index + i ) & m_bucketMask ];
+
+            if ( candidate->time >= 0.0 && candidate->key == key )
+            {
+                bucket = candidate;
+                break;
+            }
+
+            if ( !oldest || candidate->time < oldest->time )
+                oldest = candidate;
+        }
+
+        if ( bucket )
+        {
+            if ( time > bucket->time )
+            {
+                bucket->tokens += float( ( time - bucket->time ) * rate );
+                if ( bucket->tokens > burst )
+                    bucket->tokens = burst;
+                bucket->time = time;
+            }
+        }
+        else
+        {
+            // not found. replace the least recently used bucket in the probe run with a full bucket for this key
+
+            assert( oldest );
+
+            bucket = oldest;
+            bucket->key = key;
+            bucket->time = time;
+            bucket->tokens = burst;
+        }
+
+        if ( bucket->tokens < 1.0f )
+            return false;
+
+        bucket->tokens -= 1.0f;
+
+        return true;
+    }
+
+    static const int ConnectTokenCacheProbes = 4;
+
+    static inline uint64_t connect_token_cache_key( const ConnectionRequestPacket & packet )
+    {
+        return murmur_hash_64( packet.GetConnectTokenMac(), MacBytes, packet.connectTokenExpireTimestamp );
+    }
+
+    static inline bool connect_token_cache_match( const ConnectTokenCacheEntry & entry, const ConnectionRequestPacket & packet )
+    {
+        return entry.time >= 0.0 &&
+               entry.connectTokenExpireTimestamp == packet.connectTokenExpireTimestamp &&
+               memcmp( entry.connectTokenMac, packet.GetConnectTokenMac(), MacBytes ) == 0 &&
+               memcmp( entry.connectTokenNonce, packet.connectTokenNonce, NonceBytes ) == 0;
+    }
+
+    ConnectTokenCache::ConnectTokenCache( Allocator & allocator, int numEntries )
+    {
+        assert( numEntries > 0 );
+
+        m_allocator = &allocator;
+
+        uint32_t size = ConnectTokenCacheProbes;
+        while ( size < uint32_t( numEntries ) )
+            size <<= 1;
+
+        m_entryMask = size - 1;
+
+        m_entries = (ConnectTokenCacheEntry*) YOJIMBO_ALLOCATE( allocator, sizeof( ConnectTokenCacheEntry ) * size );
+
+        Reset();
+    }
+
+    ConnectTokenCache::~ConnectTokenCache()
+    {
+        assert( m_allocator );
+
+        // IMPORTANT: cached connect tokens hold the keys for clients that are connecting. don't leave them behind in freed memory
+
+        Reset();
+
+        YOJIMBO_FREE( *m_allocator, m_entries );
+
+        m_allocator = NULL;
+    }
+
+    void ConnectTokenCache::Reset()
+    {
+        for ( uint32_t i = 0; i <= m_entryMask; ++i )
+            new ( &m_entries[i] ) ConnectTokenCacheEntry();
+    }
+
+    ConnectTokenCacheEntry * ConnectTokenCache::Find( const ConnectionRequestPacket & packet, double time )
+    {
+        const uint32_t index = uint32_t( connect_token_cache_key( packet ) );
+
+        for ( int i = 0; i < ConnectTokenCacheProbes; ++i )
+        {
+            ConnectTokenCacheEntry * entry = &m_entries[ ( index + i ) & m_entryMask ];
+
+            if ( connect_token_cache_match( *entry, packet ) )
+            {
+                if ( time > entry->time )
+                    entry->time = time;
+                return entry;
+            }
+        }
+
+        return NULL;
+    }
+
+    ConnectTokenCacheEntry * ConnectTokenCache::Add( const ConnectionRequestPacket & packet, const ConnectToken & connectToken, double time )
+    {
+        const uint32_t index = uint32_t( connect_token_cache_key( packet ) );
+
+        ConnectTokenCacheEntry * oldest = NULL;
+
+        for ( int i = 0; i < ConnectTokenCacheProbes; ++i )
+        {
+            ConnectTokenCacheEntry * candidate = &m_entries[ ( index + i ) & m_entryMask ];
+
+            if ( connect_token_cache_match( *candidate, packet ) )
+            {
+                oldest = candidate;
+                break;
+            }
+
+            if ( !oldest || candidate->time < oldest->time )
+                oldest = candidate;
+        }
+
+        assert( oldest );
+
+        ConnectTokenCacheEntry * entry = oldest;
+
+        entry->time = time;
+        entry->connectTokenExpireTimestamp = packet.connectTokenExpireTimestamp;
+        memcpy( entry->connectTokenNonce, packet.connectTokenNonce, NonceBytes );
+        memcpy( entry->connectTokenMac, packet.GetConnectTokenMac(), MacBytes );
+        entry->connectToken = connectToken;
+        entry->challengeTokenValid = false;
+
+        return entry;
+    }
+
     void Server::Defaults()
     {
         m_allocator = NULL;
@@ -40,379 +447,1497 @@ namespace yojimbo
         m_userContext = NULL;
         m_allocateConnections = false;
         m_time = 0.0;
+        m_tickWorkTime = 0.0;
+        m_tickTime = 0.0;
+        m_overloaded = false;
+        m_deferringBlocks = false;
+        m_globalMemoryBytes = 0;
+        m_clientMemoryBytes = 0;
+        m_hugePageMemory = false;
         m_flags = 0;
         m_maxClients = -1;
         m_numConnectedClients = 0;
         m_challengeTokenNonce = 0;
         m_globalSequence = 1ULL<<63;
+        m_disconnectPacketBytes = 0;
         m_globalPacketFactory = NULL;
+        m_globalMessageFactory = NULL;
+        m_clientMemory = NULL;
+        m_clientAllocator = NULL;
+        m_clientTransportContext = NULL;
+        m_clientConnectionContext = NULL;
+        m_clientPacketFactory = NULL;
+        m_clientMessageFactory = NULL;
+        m_clientReplayProtection = NULL;
+        m_clientId = NULL;
+        m_clientAddress = NULL;
+        m_clientAddressMap = NULL;
+        m_clientIdMap = NULL;
+        m_clientTimerWheel = NULL;
+        m_expiredClients = NULL;
+        m_clientData = NULL;
+        m_clientTickMemory = NULL;
+        m_clientTick = NULL;
+        m_connectTokenTable = NULL;
+        m_connectionRequestLimiter = NULL;
+        m_pingLimiter = NULL;
+        m_connectTokenCache = NULL;
+        m_jobScheduler = NULL;
+        m_numJobClients = 0;
+        m_jobClients = NULL;
+        m_clientNumQueuedPackets = NULL;
+        m_clientQueuedPackets = NULL;
+        m_clientQueuedPacketReceiveTimes = NULL;
+        m_numQueuedConnectionRequests = 0;
+        m_queuedConnectionRequests = NULL;
+        m_queuedConnectionRequestAddresses = NULL;
+        m_queuedConnectTokens = NULL;
+        m_queuedConnectTokenDecrypted = NULL;
+        m_broadcastMessages = NULL;
 
         memset( m_privateKey, 0, KeyBytes );
         memset( m_challengeKey, 0, KeyBytes );
-        memset( m_clientMemory, 0, sizeof( m_clientMemory ) );
-        memset( m_clientAllocator, 0, sizeof( m_clientAllocator ) );
-        memset( m_clientMessageFactory, 0, sizeof( m_clientMessageFactory ) );
-        memset( m_clientPacketFactory, 0, sizeof( m_clientPacketFactory ) );
-        memset( m_clientReplayProtection, 0, sizeof( m_clientReplayProtection ) );
-        memset( m_clientConnection, 0, sizeof( m_clientConnection ) );
-        memset( m_clientSequence, 0, sizeof( m_clientSequence ) );
         memset( m_counters, 0, sizeof( m_counters ) );
-
-        for ( int i = 0; i < MaxClients; ++i )
-            ResetClientState( i );
     }
 
-    Server::Server( Allocator & allocator, Transport & transport, const ClientServerConfig & config, double time )
+    static uint64_t get_bytes_used( Allocator & allocator, uint64_t emptyFreeBytes )
     {
-        Defaults();
-        m_allocator = &allocator;
-        m_transport = &transport;
-        m_config = config;
-        m_config.connectionConfig.connectionPacketType = CLIENT_SERVER_PACKET_CONNECTION;
-        m_allocateConnections = m_config.enableMessages;
-        m_time = time;
+        AllocatorStats stats;
+        allocator.GetStats( stats );
+        return ( emptyFreeBytes > 0 ) ? emptyFreeBytes - stats.freeBytes : stats.bytesAllocated;
     }
 
-    Server::~Server()
+    static uint64_t measure_client_resources( Allocator & allocator, const ClientServerConfig & config, int numPacketTypes, int numMessageTypes, uint64_t & connectionBytes )
     {
-        // IMPORTANT: You must stop the server before you destroy it
-        assert( !IsRunning() );
+        // IMPORTANT: Keep this in step with Server::Start and Client::CreateConnectionResources.
 
-        assert( m_transport );
+        AllocatorStats stats;
+        allocator.GetStats( stats );
 
-        m_transport = NULL;
-    }
+        const uint64_t emptyFreeBytes = stats.freeBytes;
 
-    void Server::SetPrivateKey( const uint8_t * privateKey )
-    {
-        memcpy( m_privateKey, privateKey, KeyBytes );
-    }
+        PacketFactory * packetFactory = YOJIMBO_NEW( allocator, PacketFactory, allocator, numPacketTypes );
+        ReplayProtection * replayProtection = YOJIMBO_NEW( allocator, ReplayProtection );
+        MessageFactory * messageFactory = NULL;
+        Connection * connection = NULL;
 
-    void Server::SetUserContext( void * context )
-    {
-        assert( !IsRunning() );
-        m_userContext = context;
-    }
+        connectionBytes = 0;
 
-    void Server::SetServerAddress( const Address & address )
-    {
-        m_serverAddress = address;
+        if ( config.enableMessages )
+        {
+            messageFactory = YOJIMBO_NEW( allocator, MessageFactory, allocator, numMessageTypes );
+
+            ConnectionConfig connectionConfig = config.connectionConfig;
+            connectionConfig.connectionPacketType = CLIENT_SERVER_PACKET_CONNECTION;
+
+            const uint64_t bytesBefore = get_bytes_used( allocator, emptyFreeBytes );
+
+            connection = YOJIMBO_NEW( allocator, Connection, allocator, *packetFactory, *messageFactory, connectionConfig );
+
+            connectionBytes = get_bytes_used( allocator, emptyFreeBytes ) - bytesBefore;
+        }
+
+        const uint64_t bytes = get_bytes_used( allocator, emptyFreeBytes );
+
+        YOJIMBO_DELETE( allocator, Connection, connection );
+        YOJIMBO_DELETE( allocator, MessageFactory, messageFactory );
+        YOJIMBO_DELETE( allocator, ReplayProtection, replayProtection );
+        YOJIMBO_DELETE( allocator, PacketFactory, packetFactory );
+
+        return bytes;
     }
 
-    void Server::Start( int maxClients )
+    // IMPORTANT: The arrays of per-client data allocated by Server::AllocateClientData, as ( member, element type, number of elements ) with n the number of client slots.
+    // They are allocated, freed and sized for CalculateMemoryFootprint from this one list, so add new per-client arrays here and the memory footprint stays correct.
+
+    #define SERVER_CLIENT_DATA_ARRAYS( ARRAY )                                                                                          \
+        ARRAY( m_clientMemory, uint8_t*, n )                                                                                            \
+        ARRAY( m_clientAllocator, Allocator*, n )                                                                                       \
+        ARRAY( m_clientTransportContext, TransportContext, n )                                                                          \
+        ARRAY( m_clientConnectionContext, ConnectionContext, n )                                                                        \
+        ARRAY( m_clientPacketFactory, PacketFactory*, n )                                                                               \
+        ARRAY( m_clientMessageFactory, MessageFactory*, n )                                                                             \
+        ARRAY( m_clientReplayProtection, ReplayProtection*, n )                                                                         \
+        ARRAY( m_clientId, uint64_t, n )                                                                                                \
+        ARRAY( m_clientAddress, Address, n )                                                                                            \
+        ARRAY( m_clientData, ServerClientData, n )                                                                                      \
+        ARRAY( m_clientTickMemory, uint8_t, sizeof( ServerClientTickData ) * n + CacheLineBytes - 1 )                                   \
+        ARRAY( m_jobClients, int, n )                                                                                                   \
+        ARRAY( m_expiredClients, int, n )                                                                                               \
+        ARRAY( m_clientNumQueuedPackets, int, n )                                                                                       \
+        ARRAY( m_clientQueuedPackets, ConnectionPacket*, n * ServerQueuedPacketsPerClient )                                             \
+        ARRAY( m_clientQueuedPacketReceiveTimes, double, n * ServerQueuedPacketsPerClient )                                             \
+        ARRAY( m_queuedConnectionRequests, ConnectionRequestPacket*, ServerQueuedConnectionRequests )                                   \
+        ARRAY( m_queuedConnectionRequestAddresses, Address, ServerQueuedConnectionRequests )                                            \
+        ARRAY( m_queuedConnectTokens, ConnectToken, ServerQueuedConnectionRequests )                                                    \
+        ARRAY( m_queuedConnectTokenDecrypted, bool, ServerQueuedConnectionRequests )
+
+    static uint64_t get_server_client_data_bytes( const ClientServerConfig & config, int n )
     {
-        assert( maxClients > 0 );
-        assert( maxClients <= MaxClients );
+        uint64_t bytes = 0;
+
+        #define SERVER_CLIENT_DATA_ARRAY_BYTES( member, type, count ) bytes += uint64_t( sizeof( type ) ) * uint64_t( count );
+        SERVER_CLIENT_DATA_ARRAYS( SERVER_CLIENT_DATA_ARRAY_BYTES )
+        #undef SERVER_CLIENT_DATA_ARRAY_BYTES
+
+        DefaultAllocator allocator;
+
+        AddressMap * addressMap = YOJIMBO_NEW( allocator, AddressMap, allocator, n );
+        IdMap * idMap = YOJIMBO_NEW( allocator, IdMap, allocator, n );
+        TimerWheel * timerWheel = YOJIMBO_NEW( allocator, TimerWheel, allocator, n );
+
+        const int numConnectTokenEntries = ( config.serverConnectTokenEntries > 0 ) ? config.serverConnectTokenEntries : n * ConnectTokenEntriesPerClient;
+
+        ConnectTokenTable * connectTokenTable = YOJIMBO_NEW( allocator, ConnectTokenTable, allocator, numConnectTokenEntries );
+
+        ConnectTokenCache * connectTokenCache = NULL;
+
+        if ( config.serverConnectTokenCacheEntries >= 0 )
+        {
+            const int numConnectTokenCacheEntries = ( config.serverConnectTokenCacheEntries > 0 ) ? config.serverConnectTokenCacheEntries : n * ConnectTokenCacheEntriesPerClient;
+
+            connectTokenCache = YOJIMBO_NEW( allocator, ConnectTokenCache, allocator, numConnectTokenCacheEntries );
+        }
+
+        ConnectionRequestLimiter * connectionRequestLimiter = NULL;
+
+        if ( config.serverConnectionRequestRate > 0.0f )
+        {
+            const int numConnectionRequestBuckets = ( config.serverConnectionRequestBuckets > 0 ) ? config.serverConnectionRequestBuckets : n * ConnectionRequestBucketsPerClient;
+
+            connectionRequestLimiter = YOJIMBO_NEW( allocator, ConnectionRequestLimiter, allocator, numConnectionRequestBuckets );
+        }
+
+        ConnectionRequestLimiter * pingLimiter = NULL;
+
+        if ( config.enableServerPing && config.serverPingRate > 0.0f )
+            pingLimiter = YOJIMBO_NEW( allocator, ConnectionRequestLimiter, allocator, n * ConnectionRequestBucketsPerClient );
+
+        bytes += get_bytes_used( allocator, 0 );
+
+        YOJIMBO_DELETE( allocator, AddressMap, addressMap );
+        YOJIMBO_DELETE( allocator, IdMap, idMap );
+        YOJIMBO_DELETE( allocator, TimerWheel, timerWheel );
+        YOJIMBO_DELETE( allocator, ConnectTokenTable, connectTokenTable );
+        YOJIMBO_DELETE( allocator, ConnectTokenCache, connectTokenCache );
+        YOJIMBO_DELETE( allocator, ConnectionRequestLimiter, connectionRequestLimiter );
+        YOJIMBO_DELETE( allocator, ConnectionRequestLimiter, pingLimiter );
+
+        return bytes;
+    }
+
+    void CalculateMemoryFootprint( const ClientServerConfig & config, int maxClients, int numPacketTypes, int numMessageTypes, MemoryFootprint & footprint )
+    {
+        assert( maxClients > 0 );
+        assert( maxClients <= MaxClients );
+        assert( numPacketTypes >= CLIENT_SERVER_NUM_PACKETS );
+        assert( numMessageTypes >= 0 );
+
+        footprint = MemoryFootprint();
+
+        // IMPORTANT: The client resources are created twice. Once with a counting allocator, to find out how big a scratch heap they need, then again in the scratch heap, to measure exactly how much of it they take including heap overhead.
+
+        DefaultAllocator countingAllocator;
+
+        uint64_t connectionBytes = 0;
+
+        measure_client_resources( countingAllocator, config, numPacketTypes, numMessageTypes, connectionBytes );
+
+        AllocatorStats countingStats;
+        countingAllocator.GetStats( countingStats );
+
+        const size_t heapBytes = size_t( countingStats.peakBytesAllocated + countingStats.totalAllocations * 64 + 64 * 1024 );
+
+        void * heapMemory = YOJIMBO_ALLOCATE( GetDefaultAllocator(), heapBytes );
+
+        {
+            TLSF_Allocator heapAllocator( heapMemory, heapBytes );
+
+            footprint.clientHeapBytes = measure_client_resources( heapAllocator, config, numPacketTypes, numMessageTypes, footprint.connectionBytes );
+        }
+
+        YOJIMBO_FREE( GetDefaultAllocator(), heapMemory );
+
+        footprint.clientHeadroomBytes = int64_t( config.clientMemory ) - int64_t( footprint.clientHeapBytes );
+        footprint.serverClientHeadroomBytes = int64_t( config.serverPerClientMemory ) - int64_t( footprint.clientHeapBytes );
+
+        footprint.serverClientDataBytes = get_server_client_data_bytes( config, maxClients );
+
+        // IMPORTANT: Keep this in step with Server::CreateAllocators.
+
+        uint64_t globalMemoryBytes = config.serverGlobalMemory;
+        uint64_t clientMemoryBytes = config.serverPerClientMemory;
+
+        if ( config.serverHugePageMemory )
+        {
+            const uint64_t hugePageSize = platform_huge_page_size();
+            globalMemoryBytes = ( globalMemoryBytes + hugePageSize - 1 ) / hugePageSize * hugePageSize;
+            clientMemoryBytes = ( clientMemoryBytes + hugePageSize - 1 ) / hugePageSize * hugePageSize;
+        }
+
+        footprint.serverBytes = globalMemoryBytes + clientMemoryBytes * maxClients + sizeof( TLSF_Allocator ) * ( maxClients + 1 ) + footprint.serverClientDataBytes;
+    }
+
+    void Server::AllocateClientData()
+    {
+        assert( m_maxClients > 0 );
+        assert( m_maxClients <= MaxClients );
+        assert( sizeof( ServerClientTickData ) == CacheLineBytes );
+
+        // IMPORTANT: Per-client data is stored in arrays sized to the number of client slots, so small servers don't pay for MaxClients slots. State touched every tick is packed into one cache line per client in m_clientTick, and everything else lives in separate arrays so it doesn't get pulled into cache each tick.
+
+        const int n = m_maxClients;
+
+        #define SERVER_ALLOCATE_CLIENT_DATA_ARRAY( member, type, count ) member = (type*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( type ) * ( count ) );
+        SERVER_CLIENT_DATA_ARRAYS( SERVER_ALLOCATE_CLIENT_DATA_ARRAY )
+        #undef SERVER_ALLOCATE_CLIENT_DATA_ARRAY
+
+        // IMPORTANT: Each client's tick data must sit in exactly one cache line, so the array starts on a cache line boundary.
+
+        m_clientTick = (ServerClientTickData*) ( ( uintptr_t( m_clientTickMemory ) + CacheLineBytes - 1 ) & ~uintptr_t( CacheLineBytes - 1 ) );
+
+        m_clientAddressMap = YOJIMBO_NEW( *m_allocator, AddressMap, *m_allocator, n );
+        m_clientIdMap = YOJIMBO_NEW( *m_allocator, IdMap, *m_allocator, n );
+        m_clientTimerWheel = YOJIMBO_NEW( *m_allocator, TimerWheel, *m_allocator, n );
+
+        memset( m_clientMemory, 0, sizeof( uint8_t* ) * n );
+        memset( m_clientAllocator, 0, sizeof( Allocator* ) * n );
+        memset( m_clientPacketFactory, 0, sizeof( PacketFactory* ) * n );
+        memset( m_clientMessageFactory, 0, sizeof( MessageFactory* ) * n );
+        memset( m_clientReplayProtection, 0, sizeof( ReplayProtection* ) * n );
+        memset( m_clientNumQueuedPackets, 0, sizeof( int ) * n );
+
+        m_numJobClients = 0;
+
+        m_numQueuedConnectionRequests = 0;
+
+        for ( int i = 0; i < ServerQueuedConnectionRequests; ++i )
+        {
+            m_queuedConnectionRequests[i] = NULL;
+            new ( &m_queuedConnectionRequestAddresses[i] ) Address();
+            new ( &m_queuedConnectTokens[i] ) ConnectToken();
+            m_queuedConnectTokenDecrypted[i] = false;
+        }
+
+        for ( int i = 0; i < n; ++i )
+        {
+            new ( &m_clientTransportContext[i] ) TransportContext();
+            new ( &m_clientConnectionContext[i] ) ConnectionContext();
+            new ( &m_clientAddress[i] ) Address();
+            new ( &m_clientData[i] ) ServerClientData();
+            new ( &m_clientTick[i] ) ServerClientTickData();
+            ResetClientState( i );
+        }
+
+        const int numConnectTokenEntries = ( m_config.serverConnectTokenEntries > 0 ) ? m_config.serverConnectTokenEntries : n * ConnectTokenEntriesPerClient;
+
+        m_connectTokenTable = YOJIMBO_NEW( *m_allocator, ConnectTokenTable, *m_allocator, numConnectTokenEntries );
+
+        if ( m_config.serverConnectTokenCacheEntries >= 0 )
+        {
+            const int numConnectTokenCacheEntries = ( m_config.serverConnectTokenCacheEntries > 0 ) ? m_config.serverConnectTokenCacheEntries : n * ConnectTokenCacheEntriesPerClient;
+
+            m_connectTokenCache = YOJIMBO_NEW( *m_allocator, ConnectTokenCache, *m_allocator, numConnectTokenCacheEntries );
+        }
+
+        if ( m_config.serverConnectionRequestRate > 0.0f )
+        {
+            const int numConnectionRequestBuckets = ( m_config.serverConnectionRequestBuckets > 0 ) ? m_config.serverConnectionRequestBuckets : n * ConnectionRequestBucketsPerClient;
+
+            m_connectionRequestLimiter = YOJIMBO_NEW( *m_allocator, ConnectionRequestLimiter, *m_allocator, numConnectionRequestBuckets );
+        }
+
+        if ( m_config.enableServerPing && m_config.serverPingRate > 0.0f )
+        {
+            m_pingLimiter = YOJIMBO_NEW( *m_allocator, ConnectionRequestLimiter, *m_allocator, n * ConnectionRequestBucketsPerClient );
+        }
+    }
+
+    void Server::FreeClientData()
+    {
+        #define SERVER_FREE_CLIENT_DATA_ARRAY( member, type, count ) YOJIMBO_FREE( *m_allocator, member );
+        SERVER_CLIENT_DATA_ARRAYS( SERVER_FREE_CLIENT_DATA_ARRAY )
+        #undef SERVER_FREE_CLIENT_DATA_ARRAY
+
+        m_numJobClients = 0;
+
+        m_numQueuedConnectionRequests = 0;
+
+        YOJIMBO_DELETE( *m_allocator, AddressMap, m_clientAddressMap );
+        YOJIMBO_DELETE( *m_allocator, IdMap, m_clientIdMap );
+        YOJIMBO_DELETE( *m_allocator, TimerWheel, m_clientTimerWheel );
+        YOJIMBO_DELETE( *m_allocator, ConnectTokenTable, m_connectTokenTable );
+        YOJIMBO_DELETE( *m_allocator, ConnectionRequestLimiter, m_connectionRequestLimiter );
+        YOJIMBO_DELETE( *m_allocator, ConnectionRequestLimiter, m_pingLimiter );
+        YOJIMBO_DELETE( *m_allocator, ConnectTokenCache, m_connectTokenCache );
+    }
+
+    Server::Server( Allocator & allocator, Transport & transport, const ClientServerConfig & config, double time )
+    {
+        Defaults();
+        m_allocator = &allocator;
+        m_transport = &transport;
+        m_config = config;
+        m_config.connectionConfig.connectionPacketType = CLIENT_SERVER_PACKET_CONNECTION;
+        m_allocateConnections = m_config.enableMessages;
+        m_time = time;
+    }
+
+    Server::~Server()
+    {
+        // IMPORTANT: You must stop the server before you destroy it
+        assert( !IsRunning() );
+
+        assert( m_transport );
+
+        m_transport = NULL;
+    }
+
+    void Server::CreateClientResources( int clientIndex )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( !m_clientPacketFactory[clientIndex] );
+
+        // IMPORTANT: This runs on job scheduler threads for the slots pre-warmed in Server::Start, so it must only touch the client slot and its own allocator.
+
+        Allocator & clientAllocator = GetAllocator( SERVER_RESOURCE_PER_CLIENT, clientIndex );
+
+        m_clientPacketFactory[clientIndex] = CreatePacketFactory( clientAllocator, SERVER_RESOURCE_PER_CLIENT, clientIndex );
+
+        assert( m_clientPacketFactory[clientIndex] );
+
+        assert( m_clientPacketFactory[clientIndex]->GetNumPacketTypes() == m_globalPacketFactory->GetNumPacketTypes() );
+
+        m_clientReplayProtection[clientIndex] = YOJIMBO_NEW( clientAllocator, ReplayProtection );
+
+        m_clientTransportContext[clientIndex].allocator = m_clientAllocator[clientIndex];
+        m_clientTransportContext[clientIndex].packetFactory = m_clientPacketFactory[clientIndex];
+        m_clientTransportContext[clientIndex].replayProtection = m_clientReplayProtection[clientIndex];
+        m_clientTransportContext[clientIndex].userContext = m_userContext;
+
+        if ( m_allocateConnections )
+        {
+            m_clientMessageFactory[clientIndex] = CreateMessageFactory( clientAllocator, SERVER_RESOURCE_PER_CLIENT, clientIndex );
+
+            assert( m_clientMessageFactory[clientIndex] );
+
+            Connection * connection = YOJIMBO_NEW( clientAllocator, Connection, clientAllocator, *m_clientPacketFactory[clientIndex], *m_clientMessageFactory[clientIndex], m_config.connectionConfig );
+
+            connection->SetListener( this );
+
+            connection->SetClientIndex( clientIndex );
+
+            m_clientTick[clientIndex].connection = connection;
+
+            m_clientConnectionContext[clientIndex].messageFactory = m_clientMessageFactory[clientIndex];
+            m_clientConnectionContext[clientIndex].connectionConfig = &m_config.connectionConfig;
+            m_clientConnectionContext[clientIndex].bitCounters = connection->GetPacketBitCounters();
+            m_clientConnectionContext[clientIndex].channels = connection->GetChannels();
+            m_clientConnectionContext[clientIndex].stringDictionary = connection->GetStringDictionary();
+            m_clientTransportContext[clientIndex].connectionContext = &m_clientConnectionContext[clientIndex];
+        }
+    }
+
+    void Server::DestroyClientResources( int clientIndex )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+
+        Allocator & clientAllocator = GetAllocator( SERVER_RESOURCE_PER_CLIENT, clientIndex );
+
+        YOJIMBO_DELETE( clientAllocator, Connection, m_clientTick[clientIndex].connection );
+
+        YOJIMBO_DELETE( clientAllocator, MessageFactory, m_clientMessageFactory[clientIndex] );
+
+        YOJIMBO_DELETE( clientAllocator, PacketFactory, m_clientPacketFactory[clientIndex] );
+
+        YOJIMBO_DELETE( clientAllocator, ReplayProtection, m_clientReplayProtection[clientIndex] );
+    }
+
+    void Server::CreateClientResourcesJob( void * context, int index )
+    {
+        Server * server = (Server*) context;
+        server->CreateClientResources( index );
+    }
+
+    void Server::SetPrivateKey( const uint8_t * privateKey )
+    {
+        memcpy( m_privateKey, privateKey, KeyBytes );
+
+        if ( m_connectTokenCache )
+            m_connectTokenCache->Reset();
+    }
+
+    void Server::SetUserContext( void * context )
+    {
+        assert( !IsRunning() );
+        m_userContext = context;
+    }
+
+    void Server::SetJobScheduler( JobScheduler * jobScheduler )
+    {
+        m_jobScheduler = jobScheduler;
+    }
+
+    void Server::SetServerAddress( const Address & address )
+    {
+        m_serverAddress = address;
+    }
+
+    void Server::SetServerAlternateAddress( const Address & address )
+    {
+        m_serverAlternateAddress = address;
+    }
+
+    void Server::Start( int maxClients )
+    {
+        assert( maxClients > 0 );
+        assert( maxClients <= MaxClients );
+
+        Stop();
+
+        m_maxClients = maxClients;
+
+        m_tickWorkTime = 0.0;
+        m_tickTime = 0.0;
+        m_overloaded = false;
+        m_deferringBlocks = false;
+
+        AllocateClientData();
+
+        CreateAllocators();
+
+        // roll a new challenge key. security measure because multiple servers are generating challenge tokens and otherwise we risk using the same nonce multiple times and exposing the private key.
+
+        GenerateKey( m_challengeKey );
+
+        m_challengeTokenNonce = 0;
+
+        // global resources
+
+        Allocator & globalAllocator = GetAllocator( SERVER_RESOURCE_GLOBAL );
+
+        if ( !m_globalPacketFactory )
+        {
+            m_globalPacketFactory = CreatePacketFactory( globalAllocator, SERVER_RESOURCE_GLOBAL );
+
+            assert( m_globalPacketFactory );
+        }
+
+        if ( m_allocateConnections )
+        {
+            m_globalMessageFactory = CreateMessageFactory( globalAllocator, SERVER_RESOURCE_GLOBAL );
+
+            assert( m_globalMessageFactory );
+        }
+
+        m_globalTransportContext = TransportContext( *m_globalAllocator, *m_globalPacketFactory );;
+
+        m_globalTransportContext.userContext = m_userContext;
+
+        m_transport->SetContext( m_globalTransportContext );
+
+        // IMPORTANT: Disconnect packets are the same for every client, so serialize one up front. Only encryption is done per-client when it is sent.
+
+        m_disconnectPacketBytes = 0;
+
+        Packet * disconnectPacket = CreateGlobalPacket( CLIENT_SERVER_PACKET_DISCONNECT );
+
+        if ( disconnectPacket )
+        {
+            m_disconnectPacketBytes = m_transport->SerializePacket( disconnectPacket, (uint8_t*) m_disconnectPacketData, SerializedControlPacketBytes );
+
+            disconnectPacket->Destroy();
+        }
+
+        // per-client resources. slots that aren't pre-warmed create them when a client first connects, so starting the server doesn't touch their memory
+
+        const int numPrewarmedClients = m_config.serverPrewarmedClients < 0 ? m_maxClients : min( m_config.serverPrewarmedClients, m_maxClients );
+
+        if ( m_jobScheduler && numPrewarmedClients > 1 )
+        {
+            m_jobScheduler->Run( CreateClientResourcesJob, this, numPrewarmedClients );
+        }
+        else
+        {
+            for ( int clientIndex = 0; clientIndex < numPrewarmedClients; ++clientIndex )
+                CreateClientResources( clientIndex );
+        }
+
+        SetEncryptedPacketTypes();
+
+        OnStart( maxClients );
+    }
+
+    void Server::Stop()
+    {
+        if ( !IsRunning() )
+            return;
+
+        OnStop();
+
+        DisconnectAllClients();
+
+        m_transport->ClearContext();
+
+        m_transport->Reset();
+
+        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+            DestroyClientResources( clientIndex );
+
+        Allocator & globalAllocator = GetAllocator( SERVER_RESOURCE_GLOBAL );
+
+        // IMPORTANT: the global message factory must be destroyed after the client connections, because they hold references to broadcast messages
+
+        ReleaseBroadcastMessages( true );
+
+        YOJIMBO_DELETE( globalAllocator, MessageFactory, m_globalMessageFactory );
+
+        YOJIMBO_DELETE( globalAllocator, PacketFactory, m_globalPacketFactory );
+
+        DestroyAllocators();
+
+        FreeClientData();
+
+        m_maxClients = -1;
+    }
+
+    void Server::DisconnectClient( int clientIndex, bool sendDisconnectPacket )
+    {
+        assert( IsRunning() );
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( m_numConnectedClients > 0 );
+        assert( m_clientTick[clientIndex].connected );
+
+        OnClientDisconnect( clientIndex );
+
+        if ( sendDisconnectPacket )
+        {
+            for ( int i = 0; i < m_config.numDisconnectPackets; ++i )
+            {
+                if ( SendSerializedPacketToConnectedClient( clientIndex, CLIENT_SERVER_PACKET_DISCONNECT, (const uint8_t*) m_disconnectPacketData, m_disconnectPacketBytes, true ) )
+                    continue;
+
+                DisconnectPacket * packet = (DisconnectPacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_DISCONNECT );
+                if ( packet )
+                {
+                    SendPacketToConnectedClient( clientIndex, packet, true );
+                }
+            }
+        }
+
+        m_transport->RemoveContextMapping( m_clientData[clientIndex].address );
+
+#if !YOJIMBO_SECURE_MODE
+        if ( !m_clientData[clientIndex].insecure )
+#endif // #if !YOJIMBO_SECURE_MODE
+        {
+            m_transport->RemoveEncryptionMapping( m_clientData[clientIndex].address );
+        }
+
+        m_clientAddressMap->Remove( m_clientAddress[clientIndex] );
+
+        m_clientIdMap->Remove( m_clientId[clientIndex] );
+
+        m_clientTimerWheel->Cancel( clientIndex );
+
+        ResetClientState( clientIndex );
+
+        // IMPORTANT: Everything the client had allocated has been freed by resetting its state, so the slot's free memory can go back to the operating system until the next client connects.
+
+        if ( m_config.serverReserveClientMemory && !m_config.serverHugePageMemory )
+            m_clientAllocator[clientIndex]->DiscardFreeMemory();
+
+        m_counters[SERVER_COUNTER_CLIENT_DISCONNECTS]++;
+
+        m_numConnectedClients--;
+    }
+
+    void Server::DisconnectAllClients( bool sendDisconnectPacket )
+    {
+        assert( IsRunning() );
+
+        for ( int i = 0; i < m_maxClients; ++i )
+        {
+            if ( m_clientTick[i].connected )
+                DisconnectClient( i, sendDisconnectPacket );
+        }
+    }
+
+    int Server::HandoffClient( int clientIndex, const Address & serverAddress, uint8_t * sessionData, int maxSessionBytes )
+    {
+        assert( IsRunning() );
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( m_clientTick[clientIndex].connected );
+        assert( serverAddress.IsValid() );
+        assert( sessionData );
+
+        ClientHandoffData handoffData;
+        handoffData.clientId = m_clientId[clientIndex];
+        handoffData.address = m_clientAddress[clientIndex];
+        handoffData.replayProtection = m_clientReplayProtection[clientIndex];
+        handoffData.connection = m_clientTick[clientIndex].connection;
+
+        // IMPORTANT: the handoff packets are sent from this server, so the other server carries on from the sequence number after them
+
+        handoffData.sequence = m_clientTick[clientIndex].sequence + m_config.numDisconnectPackets;
+
+        if ( !m_transport->GetEncryptionMappingKeys( handoffData.address, handoffData.serverToClientKey, handoffData.clientToServerKey ) )
+            return 0;
+
+        MeasureStream measureStream;
+        if ( !handoffData.Serialize( measureStream ) )
+            return 0;
+
+        const int dataBytes = ( measureStream.GetBytesProcessed() + 3 ) & ~3;
+
+        const int sessionBytes = ClientHandoffHeaderBytes + dataBytes + MacBytes;
+
+        if ( sessionBytes > maxSessionBytes )
+            return 0;
+
+        uint8_t * data = (uint8_t*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), dataBytes );
+        if ( !data )
+            return 0;
+
+        memset( data, 0, dataBytes );
+
+        WriteStream stream( data, dataBytes );
+        const bool result = handoffData.Serialize( stream );
+        stream.Flush();
+
+        // IMPORTANT: the expire timestamp is sent in the clear, so it goes into the additional data. The nonce is random, since several servers encrypt with the same private key.
+
+        const uint64_t expireTimestamp = uint64_t( ::time( NULL ) ) + uint64_t( ceil( m_config.connectionTimeOut ) );
+        uint64_t expireTimestampNetworkOrder = host_to_network( expireTimestamp );          // network order is little endian
+        memcpy( sessionData, &expireTimestampNetworkOrder, 8 );
+
+        uint8_t * nonce = sessionData + 8;
+        RandomBytes( nonce, NonceBytes );
+
+        uint64_t encryptedLength = 0;
+
+        const bool encrypted = result && Encrypt_AEAD( data, dataBytes, sessionData + ClientHandoffHeaderBytes, encryptedLength, sessionData, 8, nonce, m_privateKey );
+
+        YOJIMBO_FREE( GetGlobalAllocator(), data );
+
+        if ( !encrypted )
+            return 0;
+
+        assert( int( encryptedLength ) == dataBytes + MacBytes );
+
+        for ( int i = 0; i < m_config.numDisconnectPackets; ++i )
+        {
+            HandoffPacket * packet = (HandoffPacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_HANDOFF );
+            if ( packet )
+            {
+                packet->serverAddress = serverAddress;
+                SendPacketToConnectedClient( clientIndex, packet, true );
+            }
+        }
+
+        m_counters[SERVER_COUNTER_CLIENT_HANDOFFS]++;
+
+        DisconnectClient( clientIndex, false );
+
+        return sessionBytes;
+    }
+
+    int Server::AcceptClientHandoff( const uint8_t * sessionData, int sessionBytes )
+    {
+        assert( IsRunning() );
+        assert( sessionData );
+
+        const int dataBytes = sessionBytes - ClientHandoffHeaderBytes - MacBytes;
+
+        if ( dataBytes <= 0 || ( dataBytes % 4 ) != 0 )
+            return -1;
+
+        uint64_t expireTimestamp;
+        memcpy( &expireTimestamp, sessionData, 8 );
+        expireTimestamp = network_to_host( expireTimestamp );
+
+        if ( expireTimestamp <= uint64_t( ::time( NULL ) ) )
+            return -1;
+
+        if ( m_numConnectedClients == m_maxClients )
+            return -1;
+
+        uint8_t * data = (uint8_t*) YOJIMBO_ALLOCATE( GetGlobalAllocator(), dataBytes );
+        if ( !data )
+            return -1;
+
+        uint64_t decryptedLength = 0;
+
+        if ( !Decrypt_AEAD( sessionData + ClientHandoffHeaderBytes, dataBytes + MacBytes, data, decryptedLength, sessionData, 8, sessionData + 8, m_privateKey ) )
+        {
+            YOJIMBO_FREE( GetGlobalAllocator(), data );
+            return -1;
+        }
+
+        assert( int( decryptedLength ) == dataBytes );
+
+        const int clientIndex = FindFreeClientIndex();
+
+        assert( clientIndex != -1 );
+
+        if ( !m_clientPacketFactory[clientIndex] )
+            CreateClientResources( clientIndex );
+
+        ClientHandoffData handoffData;
+        handoffData.replayProtection = m_clientReplayProtection[clientIndex];
+        handoffData.connection = m_clientTick[clientIndex].connection;
+
+        // IMPORTANT: connections in free client slots aren't advanced, so bring it up to date before messages are read in
+
+        if ( handoffData.connection )
+            handoffData.connection->AdvanceTime( GetTime() );
+
+        ReadStream stream( data, dataBytes );
+
+        bool result = handoffData.Serialize( stream );
+
+        YOJIMBO_FREE( GetGlobalAllocator(), data );
+
+        if ( result )
+        {
+            result = handoffData.address.IsValid() &&
+                     FindClientIndex( handoffData.address ) == -1 &&
+                     FindClientIndex( handoffData.clientId ) == -1 &&
+                     m_transport->AddEncryptionMapping( handoffData.address, handoffData.serverToClientKey, handoffData.clientToServerKey, m_config.connectionTimeOut );
+        }
+
+        if ( !result )
+        {
+            // IMPORTANT: the replay protection and connection of the free client slot were read into, so put them back
+
+            ResetClientState( clientIndex );
+            return -1;
+        }
+
+        m_clientTick[clientIndex].sequence = handoffData.sequence;
+
+        m_counters[SERVER_COUNTER_CLIENT_HANDOFFS_ACCEPTED]++;
+
+        ConnectClient( clientIndex, handoffData.address, handoffData.clientId );
+
+        return clientIndex;
+    }
+
+    Message * Server::CreateMsg( int clientIndex, int type )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( m_clientMessageFactory[clientIndex] );
+        return m_clientMessageFactory[clientIndex]->Create( type );
+    }
+
+    bool Server::CanSendMsg( int clientIndex, int channelId ) const
+    {
+        if ( !IsRunning() )
+            return false;
+
+        if ( !IsClientConnected( clientIndex ) )
+            return false;
+
+        assert( m_clientMessageFactory );
+        
+        assert( m_clientTick[clientIndex].connection );
+
+        return m_clientTick[clientIndex].connection->CanSendMsg( channelId );
+    }
+
+    void Server::SendMsg( int clientIndex, Message * message, int channelId )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( m_clientMessageFactory[clientIndex] );
+
+        if ( !m_clientTick[clientIndex].connected )
+        {
+            m_clientMessageFactory[clientIndex]->Release( message );
+            return;
+        }
+
+        assert( m_clientTick[clientIndex].connection );
+
+        m_clientTick[clientIndex].connection->SendMsg( message, channelId );
+    }
+
+    void Server::SendMsgs( int clientIndex, Message ** messages, int numMessages, int channelId )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( m_clientMessageFactory[clientIndex] );
+        assert( messages );
+
+        if ( !m_clientTick[clientIndex].connected )
+        {
+            for ( int i = 0; i < numMessages; ++i )
+                m_clientMessageFactory[clientIndex]->Release( messages[i] );
+            return;
+        }
+
+        assert( m_clientTick[clientIndex].connection );
+
+        m_clientTick[clientIndex].connection->SendMsgs( messages, numMessages, channelId );
+    }
+
+    Message * Server::CreateBroadcastMsg( int type )
+    {
+        assert( m_globalMessageFactory );
+        return m_globalMessageFactory->Create( type );
+    }
+
+    void Server::BroadcastMsg( Message * message, int channelId )
+    {
+        assert( message );
+        assert( m_globalMessageFactory );
+
+        assert( !message->IsBlockMessage() );
+
+        if ( message->IsBlockMessage() )
+        {
+            m_globalMessageFactory->Release( message );
+            return;
+        }
+
+        Allocator & globalAllocator = GetAllocator( SERVER_RESOURCE_GLOBAL );
+
+        BroadcastMessage * broadcastMessage = YOJIMBO_NEW( globalAllocator, BroadcastMessage, globalAllocator, *m_globalMessageFactory, message );
+
+        if ( !broadcastMessage )
+        {
+            m_globalMessageFactory->Release( message );
+            return;
+        }
+
+        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+        {
+            if ( !m_clientTick[clientIndex].connected )
+                continue;
+
+            assert( m_clientTick[clientIndex].connection );
+
+            m_clientMessageFactory[clientIndex]->AddRef( broadcastMessage );
+
+            m_clientTick[clientIndex].connection->SendMsg( broadcastMessage, channelId );
+        }
+
+        // IMPORTANT: the server keeps its reference until all client connections are done with the broadcast message. This way it is always destroyed here on the calling thread, even when the client connections release their references from job scheduler threads.
+
+        broadcastMessage->SetNext( m_broadcastMessages );
+
+        m_broadcastMessages = broadcastMessage;
+    }
+
+    bool Server::ForwardBroadcastMsg( Message * message, int channelId )
+    {
+        assert( message );
+        assert( m_globalMessageFactory );
+
+        if ( message->IsBlockMessage() )
+            return false;
+
+        Message * copy = m_globalMessageFactory->Create( message->GetType() );
+        if ( !copy )
+            return false;
+
+        Allocator & globalAllocator = GetAllocator( SERVER_RESOURCE_GLOBAL );
+
+        // IMPORTANT: the message is copied by writing it and reading it back into a message created with the global message factory. Measured bits are conservative, so the buffer always has room for what is actually written.
+
+        MeasureStream measureStream( globalAllocator );
+
+        if ( !message->SerializeInternal( measureStream ) )
+        {
+            m_globalMessageFactory->Release( copy );
+            return false;
+        }
+
+        const int bytes = max( 4, ( ( measureStream.GetBitsProcessed() + 31 ) / 32 ) * 4 );
+
+        uint8_t * buffer = (uint8_t*) YOJIMBO_ALLOCATE( globalAllocator, bytes );
+        if ( !buffer )
+        {
+            m_globalMessageFactory->Release( copy );
+            return false;
+        }
+
+        WriteStream writeStream( buffer, bytes, globalAllocator );
+
+        bool result = message->SerializeInternal( writeStream );
+
+        if ( result )
+        {
+            writeStream.Flush();
+
+            ReadStream readStream( buffer, bytes, globalAllocator );
+
+            result = copy->SerializeInternal( readStream );
+        }
+
+        YOJIMBO_FREE( globalAllocator, buffer );
+
+        if ( !result )
+        {
+            m_globalMessageFactory->Release( copy );
+            return false;
+        }
+
+        BroadcastMsg( copy, channelId );
+
+        return true;
+    }
+
+    void Server::ReleaseBroadcastMsg( Message * message )
+    {
+        assert( message );
+        assert( m_globalMessageFactory );
+        m_globalMessageFactory->Release( message );
+    }
+
+    void Server::ReleaseBroadcastMessages( bool releaseAll )
+    {
+        BroadcastMessage * previous = NULL;
+        BroadcastMessage * message = m_broadcastMessages;
+
+        while ( message )
+        {
+            BroadcastMessage * next = message->GetNext();
+
+            if ( releaseAll || message->GetRefCount() == 1 )
+            {
+                if ( previous )
+                    previous->SetNext( next );
+                else
+                    m_broadcastMessages = next;
+
+                assert( m_globalMessageFactory );
+
+                m_globalMessageFactory->Release( message );
+            }
+            else
+            {
+                previous = message;
+            }
+
+            message = next;
+        }
+    }
+
+    Message * Server::ReceiveMsg( int clientIndex, int channelId )
+    {
+        assert( m_clientMessageFactory );
+
+        if ( !m_clientTick[clientIndex].connected )
+            return NULL;
+
+        assert( m_clientTick[clientIndex].connection );
+
+        return m_clientTick[clientIndex].connection->ReceiveMsg( channelId );
+    }
+
+    int Server::ReceiveMsgs( int clientIndex, Message ** messages, int maxMessages, int channelId )
+    {
+        assert( m_clientMessageFactory );
+
+        if ( !m_clientTick[clientIndex].connected )
+            return 0;
+
+        assert( m_clientTick[clientIndex].connection );
+
+        return m_clientTick[clientIndex].connection->ReceiveMsgs( messages, maxMessages, channelId );
+    }
+
+    void Server::ReleaseMsg( int clientIndex, Message * message )
+    {
+        assert( message );
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( m_clientMessageFactory[clientIndex] );
+        m_clientMessageFactory[clientIndex]->Release( message );
+    }
+
+    MessageFactory & Server::GetMsgFactory( int clientIndex )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( m_clientMessageFactory[clientIndex] );
+        return *m_clientMessageFactory[clientIndex];
+    }
+
+    Packet * Server::CreateGlobalPacket( int type )
+    {
+        return m_globalPacketFactory->Create( type );
+    }
+
+    Packet * Server::CreateClientPacket( int clientIndex, int type )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( m_clientPacketFactory[clientIndex] );
+        return m_clientPacketFactory[clientIndex]->Create( type );
+    }
+
+    void Server::SendPackets()
+    {
+        YOJIMBO_ZONE( "server_send_packets" );
+
+        if ( !IsRunning() )
+            return;
+
+        const double workStartTime = platform_time();
+
+        const double time = GetTime();
+
+        // IMPORTANT: Connections are kept across client resets, so clients that connect while the server is overloaded hold back block fragments too.
+
+        if ( m_deferringBlocks != m_overloaded && m_allocateConnections )
+        {
+            for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+            {
+                if ( m_clientTick[clientIndex].connection )
+                    m_clientTick[clientIndex].connection->SetDeferBlocks( m_overloaded );
+            }
+
+            m_deferringBlocks = m_overloaded;
+        }
+
+        if ( m_jobScheduler )
+        {
+            m_numJobClients = 0;
+
+            for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+            {
+                const ServerClientTickData & clientTick = m_clientTick[clientIndex];
+
+                if ( clientTick.connected && clientTick.fullyConnected && clientTick.connection && ClientReadyToSend( clientIndex, time ) )
+                    m_jobClients[m_numJobClients++] = clientIndex;
+            }
+
+            if ( m_numJobClients > 0 )
+                m_jobScheduler->Run( GeneratePacketJob, this, m_numJobClients );
+
+            m_numJobClients = 0;
+        }
+
+        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+        {
+            ServerClientTickData & clientTick = m_clientTick[clientIndex];
+
+            if ( !clientTick.connected )
+                continue;
+
+            if ( clientTick.fullyConnected )
+            {
+                if ( clientTick.connection && ( m_jobScheduler ? clientTick.jobPacket != NULL : ClientReadyToSend( clientIndex, time ) ) )
+                {
+                    ConnectionPacket * packet = m_jobScheduler ? clientTick.jobPacket : clientTick.connection->GeneratePacket();
+
+                    clientTick.jobPacket = NULL;
+
+                    ClientPacketGenerated( clientIndex, time );
+
+                    if ( packet )
+                    {
+                        SendPacketToConnectedClient( clientIndex, packet );
+                    }
+                }
+            }
+
+            bool sendResumeToken = false;
+
+            if ( m_config.enableResumeTokens && clientTick.fullyConnected )
+            {
+                ServerClientData & clientData = m_clientData[clientIndex];
+
+                if ( clientData.resumeTokenValid && clientData.resumeTokenRefreshTime <= time )
+                    GenerateResumeToken( clientIndex );
+
+                sendResumeToken = clientData.resumeTokenPending;
+            }
+
+            const float keepAliveSendRate = ( m_config.connectionIdleKeepAliveSendRate > 0.0f && !( clientTick.connection && clientTick.connection->HasMessagesToSend() ) ) ? m_config.connectionIdleKeepAliveSendRate : m_config.connectionKeepAliveSendRate;
+
+            if ( sendResumeToken || clientTick.lastPacketSendTime + ( 1.0f / keepAliveSendRate ) <= time )
+            {
+                const ServerClientData & clientData = m_clientData[clientIndex];
+
+                // IMPORTANT: Keep-alive packets that carry a resume token are different each time, so only the plain keep-alive packet is sent from serialized data.
+
+                const bool hasResumeToken = clientData.resumeTokenValid && ( clientData.resumeTokenPending || !clientTick.fullyConnected );
+
+                if ( !hasResumeToken && SendSerializedPacketToConnectedClient( clientIndex, CLIENT_SERVER_PACKET_KEEPALIVE, (const uint8_t*) clientData.keepAlivePacketData, clientData.keepAlivePacketBytes ) )
+                    continue;
+
+                KeepAlivePacket * packet = CreateKeepAlivePacket( clientIndex );
+
+                if ( packet )
+                {
+                    SendPacketToConnectedClient( clientIndex, packet );
+
+                    clientTick.lastPacketSendTime = GetTime();
+
+#if !YOJIMBO_SECURE_MODE
+                    debug_printf( "server send keep alive packet to client %d - clientSalt = %" PRIx64 "\n", clientIndex, packet->clientSalt );
+#else // #if !YOJIMBO_SECURE_MODE
+                    debug_printf( "server send keep alive packet to client %d - clientSalt = %" PRIx64 "\n", clientIndex );
+#endif // #if !YOJIMBO_SECURE_MODE
+                }
+            }
+        }
+
+        m_tickWorkTime += platform_time() - workStartTime;
+    }
+
+    void Server::ReceivePackets()
+    {
+        YOJIMBO_ZONE( "server_receive_packets" );
+
+        const double workStartTime = platform_time();
+
+        // IMPORTANT: Address migrations happen as the transport reads packets, so client slots must follow them before any packets from the new addresses are processed.
+
+        if ( IsRunning() && m_transport->GetNumAddressMigrations() > 0 )
+            ProcessAddressMigrations();
+
+        // when overloaded, bound the work done here. packets left in the transport receive queue are processed by the next call
+
+        const int maxPackets = ( m_overloaded && m_config.serverOverloadReceivePackets > 0 ) ? m_config.serverOverloadReceivePackets : -1;
+
+        int numPackets = 0;
+
+        while ( true )
+        {
+            if ( numPackets == maxPackets )
+            {
+                m_counters[SERVER_COUNTER_RECEIVE_PACKETS_DEFERRED]++;
+                break;
+            }
+
+            Address address;
+            uint64_t sequence;
+            double receiveTime;
+            Packet * packet = m_transport->ReceivePacket( address, &sequence, &receiveTime );
+
+            if ( !packet )
+                break;
+
+            numPackets++;
+
+            if ( m_jobScheduler && IsRunning() && packet->GetType() == CLIENT_SERVER_PACKET_CONNECTION )
+            {
+                const int clientIndex = FindClientIndex( address );
+
+                if ( clientIndex != -1 && m_clientTick[clientIndex].connection )
+                {
+                    OnPacketReceived( packet->GetType(), address );
+
+                    m_clientTick[clientIndex].pendingAcks = true;
+
+                    QueueConnectionPacket( clientIndex, (ConnectionPacket*) packet, receiveTime );
+
+                    continue;
+                }
+            }
+
+            if ( m_jobScheduler && IsRunning() && packet->GetType() == CLIENT_SERVER_PACKET_CONNECTION_REQUEST )
+            {
+                OnPacketReceived( packet->GetType(), address );
+
+                QueueConnectionRequest( (ConnectionRequestPacket*) packet, address );
+
+                continue;
+            }
 
-        Stop();
+            // IMPORTANT: queued connection packets and connection requests must be processed before any other packet, since other packets can connect and disconnect clients
 
-        m_maxClients = maxClients;
+            if ( m_numJobClients > 0 )
+                ProcessQueuedConnectionPackets();
 
-        CreateAllocators();
+            if ( m_numQueuedConnectionRequests > 0 )
+                ProcessQueuedConnectionRequests();
 
-        // roll a new challenge key. security measure because multiple servers are generating challenge tokens and otherwise we risk using the same nonce multiple times and exposing the private key.
+            if ( IsRunning() )
+                ProcessPacket( packet, address, sequence, receiveTime );
 
-        GenerateKey( m_challengeKey );
+            packet->Destroy();
+        }
 
-        m_challengeTokenNonce = 0;
+        if ( m_numJobClients > 0 )
+            ProcessQueuedConnectionPackets();
 
-        // global resources
+        if ( m_numQueuedConnectionRequests > 0 )
+            ProcessQueuedConnectionRequests();
 
-        Allocator & globalAllocator = GetAllocator( SERVER_RESOURCE_GLOBAL );
+        m_tickWorkTime += platform_time() - workStartTime;
+    }
 
-        if ( !m_globalPacketFactory )
+    void Server::ProcessAddressMigrations()
+    {
+        for ( int i = 0; i < m_transport->GetNumAddressMigrations(); ++i )
         {
-            m_globalPacketFactory = CreatePacketFactory( globalAllocator, SERVER_RESOURCE_GLOBAL );
-
-            assert( m_globalPacketFactory );
-        }
+            Address from, to;
 
-        m_globalTransportContext = TransportContext( *m_globalAllocator, *m_globalPacketFactory );;
+            m_transport->GetAddressMigration( i, from, to );
 
-        m_globalTransportContext.userContext = m_userContext;
+            // IMPORTANT: Migrations stay on the transport until it reads packets again, so a migration may already have been processed.
 
-        m_transport->SetContext( m_globalTransportContext );
+            const int clientIndex = FindClientIndex( from );
 
-        // per-client resources
+            if ( clientIndex == -1 || FindClientIndex( to ) != -1 )
+                continue;
 
-        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
-        {
-            Allocator & clientAllocator = GetAllocator( SERVER_RESOURCE_PER_CLIENT, clientIndex );
+            m_clientAddressMap->Remove( from );
+            m_clientAddressMap->Insert( to, clientIndex );
 
-            m_clientPacketFactory[clientIndex] = CreatePacketFactory( clientAllocator, SERVER_RESOURCE_PER_CLIENT, clientIndex );
+            m_clientAddress[clientIndex] = to;
+            m_clientData[clientIndex].address = to;
 
-            assert( m_clientPacketFactory[clientIndex] );
+            m_counters[SERVER_COUNTER_CLIENT_ADDRESS_MIGRATIONS]++;
 
-            assert( m_clientPacketFactory[clientIndex]->GetNumPacketTypes() == m_globalPacketFactory->GetNumPacketTypes() );
+            char fromString[MaxAddressLength];
+            char toString[MaxAddressLength];
+            from.ToString( fromString, sizeof( fromString ) );
+            to.ToString( toString, sizeof( toString ) );
+            debug_printf( "server client %d migrated from %s to %s\n", clientIndex, fromString, toString );
 
-            m_clientReplayProtection[clientIndex] = YOJIMBO_NEW( clientAllocator, ReplayProtection );
+            OnClientMigrate( clientIndex, from );
         }
+    }
 
-        if ( m_allocateConnections )
-        {
-            for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
-            {
-                Allocator & clientAllocator = GetAllocator( SERVER_RESOURCE_PER_CLIENT, clientIndex );
-
-                m_clientMessageFactory[clientIndex] = CreateMessageFactory( clientAllocator, SERVER_RESOURCE_PER_CLIENT, clientIndex );
-                
-                assert( m_clientMessageFactory[clientIndex] );
+    void Server::QueueConnectionRequest( ConnectionRequestPacket * packet, const Address & address )
+    {
+        assert( m_jobScheduler );
+        assert( packet );
+        assert( m_numQueuedConnectionRequests < ServerQueuedConnectionRequests );
 
-                m_clientConnection[clientIndex] = YOJIMBO_NEW( clientAllocator, Connection, clientAllocator, *m_clientPacketFactory[clientIndex], *m_clientMessageFactory[clientIndex], m_config.connectionConfig );
-               
-                m_clientConnection[clientIndex]->SetListener( this );
+        // IMPORTANT: the checks before decrypting the connect token are done right away, so rate limited and expired requests are never decrypted
 
-                m_clientConnection[clientIndex]->SetClientIndex( clientIndex );
-            }
+        if ( !AcceptConnectionRequest( *packet, address ) )
+        {
+            packet->Destroy();
+            return;
         }
 
-        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
-        {
-            m_clientTransportContext[clientIndex].allocator = m_clientAllocator[clientIndex];
-            m_clientTransportContext[clientIndex].packetFactory = m_clientPacketFactory[clientIndex];
-            m_clientTransportContext[clientIndex].replayProtection = m_clientReplayProtection[clientIndex];
-            m_clientTransportContext[clientIndex].userContext = m_userContext;
+        const int index = m_numQueuedConnectionRequests++;
 
-            if ( m_allocateConnections )
-            {
-                m_clientConnectionContext[clientIndex].messageFactory = m_clientMessageFactory[clientIndex];
-                m_clientConnectionContext[clientIndex].connectionConfig = &m_config.connectionConfig;
-                m_clientTransportContext[clientIndex].connectionContext = &m_clientConnectionContext[clientIndex];
-            }
-        }     
+        m_queuedConnectionRequests[index] = packet;
+        m_queuedConnectionRequestAddresses[index] = address;
 
-        SetEncryptedPacketTypes();
+        // IMPORTANT: connect tokens found in the cache are marked as decrypted here, so the decrypt job skips them
 
-        OnStart( maxClients );
+        m_queuedConnectTokenDecrypted[index] = FindCachedConnectToken( *packet, m_queuedConnectTokens[index] );
+
+        if ( m_numQueuedConnectionRequests == ServerQueuedConnectionRequests )
+            ProcessQueuedConnectionRequests();
     }
 
-    void Server::Stop()
+    void Server::ProcessQueuedConnectionRequests()
     {
-        if ( !IsRunning() )
-            return;
-
-        OnStop();
+        assert( m_jobScheduler );
+        assert( m_numQueuedConnectionRequests > 0 );
 
-        DisconnectAllClients();
-
-        m_transport->ClearContext();
+        if ( m_numQueuedConnectionRequests == 1 )
+            DecryptConnectTokenJob( this, 0 );
+        else
+            m_jobScheduler->Run( DecryptConnectTokenJob, this, m_numQueuedConnectionRequests );
 
-        m_transport->Reset();
+        // IMPORTANT: process the requests in the order they were received, so client slots are assigned the same way as without a job scheduler
 
-        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+        for ( int i = 0; i < m_numQueuedConnectionRequests; ++i )
         {
-            Allocator & clientAllocator = GetAllocator( SERVER_RESOURCE_PER_CLIENT, clientIndex );
+            if ( IsRunning() )
+                ProcessConnectionRequestToken( *m_queuedConnectionRequests[i], m_queuedConnectionRequestAddresses[i], m_queuedConnectTokenDecrypted[i], m_queuedConnectTokens[i] );
 
-            YOJIMBO_DELETE( clientAllocator, Connection, m_clientConnection[clientIndex] );
+            m_queuedConnectionRequests[i]->Destroy();
 
-            YOJIMBO_DELETE( clientAllocator, MessageFactory, m_clientMessageFactory[clientIndex] );
+            m_queuedConnectionRequests[i] = NULL;
+        }
 
-            YOJIMBO_DELETE( clientAllocator, PacketFactory, m_clientPacketFactory[clientIndex] );
+        m_numQueuedConnectionRequests = 0;
+    }
 
-            YOJIMBO_DELETE( clientAllocator, ReplayProtection, m_clientReplayProtection[clientIndex] );
-        }
+    void Server::DecryptConnectTokenJob( void * context, int index )
+    {
+        Server * server = (Server*) context;
 
-        Allocator & globalAllocator = GetAllocator( SERVER_RESOURCE_GLOBAL );
+        const ConnectionRequestPacket * packet = server->m_queuedConnectionRequests[index];
 
-        YOJIMBO_DELETE( globalAllocator, PacketFactory, m_globalPacketFactory );
+        assert( packet );
 
-        DestroyAllocators();
+        if ( server->m_queuedConnectTokenDecrypted[index] )
+            return;
 
-        m_maxClients = -1;
+        server->m_queuedConnectTokenDecrypted[index] = DecryptConnectToken( packet->connectTokenData, server->m_queuedConnectTokens[index], packet->connectTokenNonce, server->m_privateKey, packet->connectTokenExpireTimestamp );
     }
 
-    void Server::DisconnectClient( int clientIndex, bool sendDisconnectPacket )
+    void Server::QueueConnectionPacket( int clientIndex, ConnectionPacket * packet, double receiveTime )
     {
-        assert( IsRunning() );
+        assert( m_jobScheduler );
         assert( clientIndex >= 0 );
         assert( clientIndex < m_maxClients );
-        assert( m_numConnectedClients > 0 );
-        assert( m_clientConnected[clientIndex] );
+        assert( packet );
 
-        OnClientDisconnect( clientIndex );
+        int & numQueuedPackets = m_clientNumQueuedPackets[clientIndex];
 
-        if ( sendDisconnectPacket )
-        {
-            for ( int i = 0; i < m_config.numDisconnectPackets; ++i )
-            {
-                DisconnectPacket * packet = (DisconnectPacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_DISCONNECT );
-                if ( packet )
-                {
-                    SendPacketToConnectedClient( clientIndex, packet, true );
-                }
-            }
-        }
+        assert( numQueuedPackets < ServerQueuedPacketsPerClient );
 
-        m_transport->RemoveContextMapping( m_clientData[clientIndex].address );
+        if ( numQueuedPackets == 0 )
+            m_jobClients[m_numJobClients++] = clientIndex;
 
-#if !YOJIMBO_SECURE_MODE
-        if ( !m_clientData[clientIndex].insecure )
-#endif // #if !YOJIMBO_SECURE_MODE
-        {
-            m_transport->RemoveEncryptionMapping( m_clientData[clientIndex].address );
-        }
+        m_clientQueuedPackets[clientIndex*ServerQueuedPacketsPerClient + numQueuedPackets] = packet;
+        m_clientQueuedPacketReceiveTimes[clientIndex*ServerQueuedPacketsPerClient + numQueuedPackets] = receiveTime;
 
-        ResetClientState( clientIndex );
+        numQueuedPackets++;
 
-        m_counters[SERVER_COUNTER_CLIENT_DISCONNECTS]++;
+        if ( numQueuedPackets == ServerQueuedPacketsPerClient )
+            ProcessQueuedConnectionPackets();
+    }
 
-        m_numConnectedClients--;
+    void Server::ProcessQueuedConnectionPackets()
+    {
+        assert( m_jobScheduler );
+        assert( m_numJobClients > 0 );
+
+        m_jobScheduler->Run( ProcessConnectionPacketsJob, this, m_numJobClients );
+
+        m_numJobClients = 0;
     }
 
-    void Server::DisconnectAllClients( bool sendDisconnectPacket )
+    void Server::GeneratePacketJob( void * context, int index )
     {
-        assert( IsRunning() );
+        Server * server = (Server*) context;
 
-        for ( int i = 0; i < m_maxClients; ++i )
-        {
-            if ( m_clientConnected[i] )
-                DisconnectClient( i, sendDisconnectPacket );
-        }
+        const int clientIndex = server->m_jobClients[index];
+
+        assert( server->m_clientTick[clientIndex].connection );
+        assert( !server->m_clientTick[clientIndex].jobPacket );
+
+        server->m_clientTick[clientIndex].jobPacket = server->m_clientTick[clientIndex].connection->GeneratePacket();
     }
 
-    Message * Server::CreateMsg( int clientIndex, int type )
+    bool Server::ClientReadyToSend( int clientIndex, double time ) const
     {
         assert( clientIndex >= 0 );
         assert( clientIndex < m_maxClients );
-        assert( m_clientMessageFactory[clientIndex] );
-        return m_clientMessageFactory[clientIndex]->Create( type );
-    }
+        assert( m_clientTick[clientIndex].connection );
 
-    bool Server::CanSendMsg( int clientIndex, int channelId ) const
-    {
-        if ( !IsRunning() )
-            return false;
+        const ServerClientTickData & clientTick = m_clientTick[clientIndex];
 
-        if ( !IsClientConnected( clientIndex ) )
+        if ( GetClientTickSendRate( clientIndex ) > 0.0f && clientTick.nextSendTime > time )
             return false;
 
-        assert( m_clientMessageFactory );
-        
-        assert( m_clientConnection[clientIndex] );
+        if ( !m_config.serverSendIdleClients && !clientTick.pendingAcks && !clientTick.connection->HasMessagesToSend() )
+            return false;
 
-        return m_clientConnection[clientIndex]->CanSendMsg( channelId );
+        return clientTick.connection->ReadyToSendPacket();
     }
 
-    void Server::SendMsg( int clientIndex, Message * message, int channelId )
+    void Server::ClientPacketGenerated( int clientIndex, double time )
     {
         assert( clientIndex >= 0 );
         assert( clientIndex < m_maxClients );
-        assert( m_clientMessageFactory[clientIndex] );
-
-        if ( !m_clientConnected[clientIndex] )
-        {
-            m_clientMessageFactory[clientIndex]->Release( message );
-            return;
-        }
 
-        assert( m_clientConnection[clientIndex] );
+        ServerClientTickData & clientTick = m_clientTick[clientIndex];
 
-        m_clientConnection[clientIndex]->SendMsg( message, channelId );
-    }
+        clientTick.pendingAcks = false;
 
-    Message * Server::ReceiveMsg( int clientIndex, int channelId )
-    {
-        assert( m_clientMessageFactory );
+        const float sendRate = GetClientTickSendRate( clientIndex );
 
-        if ( !m_clientConnected[clientIndex] )
-            return NULL;
+        if ( sendRate > 0.0f )
+        {
+            // IMPORTANT: Advance from the previous deadline so the send rate holds even when it doesn't divide evenly into the update rate. Only snap to the current time if we fell more than a whole send interval behind.
 
-        assert( m_clientConnection[clientIndex] );
+            const double sendInterval = 1.0 / sendRate;
 
-        return m_clientConnection[clientIndex]->ReceiveMsg( channelId );
+            clientTick.nextSendTime = ( clientTick.nextSendTime + sendInterval > time ) ? clientTick.nextSendTime + sendInterval : time + sendInterval;
+        }
     }
 
-    void Server::ReleaseMsg( int clientIndex, Message * message )
+    float Server::GetClientTickSendRate( int clientIndex ) const
     {
-        assert( message );
         assert( clientIndex >= 0 );
         assert( clientIndex < m_maxClients );
-        assert( m_clientMessageFactory[clientIndex] );
-        m_clientMessageFactory[clientIndex]->Release( message );
-    }
 
-    MessageFactory & Server::GetMsgFactory( int clientIndex )
-    {
-        assert( clientIndex >= 0 );
-        assert( clientIndex < m_maxClients );
-        assert( m_clientMessageFactory[clientIndex] );
-        return *m_clientMessageFactory[clientIndex];
-    }
+        const ServerClientTickData & clientTick = m_clientTick[clientIndex];
 
-    Packet * Server::CreateGlobalPacket( int type )
-    {
-        return m_globalPacketFactory->Create( type );
+        if ( !m_overloaded || !clientTick.lowPriority || m_config.serverOverloadSendRate <= 0.0f )
+            return clientTick.sendRate;
+
+        // IMPORTANT: A send rate of zero means a packet every tick, which is faster than any overload send rate.
+
+        return ( clientTick.sendRate > 0.0f && clientTick.sendRate < m_config.serverOverloadSendRate ) ? clientTick.sendRate : m_config.serverOverloadSendRate;
     }
 
-    Packet * Server::CreateClientPacket( int clientIndex, int type )
+    void Server::UpdateOverload()
     {
-        assert( clientIndex >= 0 );
-        assert( clientIndex < m_maxClients );
-        assert( m_clientPacketFactory[clientIndex] );
-        return m_clientPacketFactory[clientIndex]->Create( type );
+        m_tickTime = m_tickWorkTime;
+
+        m_tickWorkTime = 0.0;
+
+        if ( m_config.serverTickBudget <= 0.0f )
+        {
+            m_overloaded = false;
+            return;
+        }
+
+        // IMPORTANT: Shedding load makes ticks cheaper, so only recover once well under budget. Otherwise the server flips in and out of overload every other tick.
+
+        if ( m_tickTime > m_config.serverTickBudget )
+            m_overloaded = true;
+        else if ( m_tickTime < m_config.serverTickBudget * 0.5 )
+            m_overloaded = false;
+
+        if ( m_overloaded )
+            m_counters[SERVER_COUNTER_OVERLOADED_TICKS]++;
     }
 
-    void Server::SendPackets()
+    void Server::ProcessConnectionPacketsJob( void * context, int index )
     {
-        if ( !IsRunning() )
-            return;
+        Server * server = (Server*) context;
 
-        const double time = GetTime();
+        const int clientIndex = server->m_jobClients[index];
 
-        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
-        {
-            if ( !m_clientConnected[clientIndex] )
-                continue;
+        assert( server->m_clientTick[clientIndex].connection );
 
-            if ( m_clientData[clientIndex].fullyConnected )
-            {
-                if ( m_clientConnection[clientIndex] )
-                {
-                    ConnectionPacket * packet = m_clientConnection[clientIndex]->GeneratePacket();
+        const int numQueuedPackets = server->m_clientNumQueuedPackets[clientIndex];
 
-                    if ( packet )
-                    {
-                        SendPacketToConnectedClient( clientIndex, packet );
-                    }
-                }
-            }
+        assert( numQueuedPackets > 0 );
 
-            if ( m_clientData[clientIndex].lastPacketSendTime + ( 1.0f / m_config.connectionKeepAliveSendRate ) <= time )
-            {
-                KeepAlivePacket * packet = CreateKeepAlivePacket( clientIndex );
+        ConnectionPacket ** queuedPackets = &server->m_clientQueuedPackets[clientIndex*ServerQueuedPacketsPerClient];
 
-                if ( packet )
-                {
-                    SendPacketToConnectedClient( clientIndex, packet );
+        const double * queuedPacketReceiveTimes = &server->m_clientQueuedPacketReceiveTimes[clientIndex*ServerQueuedPacketsPerClient];
 
-                    m_clientData[clientIndex].lastPacketSendTime = GetTime();
+        for ( int i = 0; i < numQueuedPackets; ++i )
+        {
+            server->m_clientTick[clientIndex].connection->ProcessPacket( queuedPackets[i], queuedPacketReceiveTimes[i] );
 
-#if !YOJIMBO_SECURE_MODE
-                    debug_printf( "server send keep alive packet to client %d - clientSalt = %" PRIx64 "\n", clientIndex, packet->clientSalt );
-#else // #if !YOJIMBO_SECURE_MODE
-                    debug_printf( "server send keep alive packet to client %d - clientSalt = %" PRIx64 "\n", clientIndex );
-#endif // #if !YOJIMBO_SECURE_MODE
-                }
-            }
+            queuedPackets[i]->Destroy();
+
+            queuedPackets[i] = NULL;
         }
+
+        server->m_clientTick[clientIndex].lastPacketReceiveTime = server->GetTime();
+
+        server->m_clientTick[clientIndex].fullyConnected = true;
+
+        server->m_clientNumQueuedPackets[clientIndex] = 0;
     }
 
-    void Server::ReceivePackets()
+    void Server::AdvanceTimeJob( void * context, int index )
     {
-        while ( true )
-        {
-            Address address;
-            uint64_t sequence;
-            Packet * packet = m_transport->ReceivePacket( address, &sequence );
+        Server * server = (Server*) context;
 
-            if ( !packet )
-                break;
+        const int clientIndex = server->m_jobClients[index];
 
-            if ( IsRunning() )
-                ProcessPacket( packet, address, sequence );
+        assert( server->m_clientTick[clientIndex].connection );
 
-            packet->Destroy();
-        }
+        server->m_clientTick[clientIndex].connection->AdvanceTime( server->GetTime() );
     }
 
     void Server::CheckForTimeOut()
@@ -422,12 +1947,19 @@ namespace yojimbo
 
         const double time = GetTime();
 
-        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+        const int numExpiredClients = m_clientTimerWheel->AdvanceTime( time, m_expiredClients );
+
+        for ( int i = 0; i < numExpiredClients; ++i )
         {
-            if ( !m_clientConnected[clientIndex] )
-                continue;
+            const int clientIndex = m_expiredClients[i];
 
-            if ( m_clientData[clientIndex].lastPacketReceiveTime + m_config.connectionTimeOut < time )
+            assert( m_clientTick[clientIndex].connected );
+
+            // IMPORTANT: Receiving a packet doesn't reschedule the timer, so the real deadline may have moved since the timer was scheduled.
+
+            const double deadline = m_clientTick[clientIndex].lastPacketReceiveTime + m_config.connectionTimeOut;
+
+            if ( deadline < time )
             {
                 OnClientError( clientIndex, SERVER_CLIENT_ERROR_TIMEOUT );
 
@@ -435,13 +1967,43 @@ namespace yojimbo
 
                 DisconnectClient( clientIndex, false );
             }
+            else
+            {
+                m_clientTimerWheel->Schedule( clientIndex, deadline );
+            }
         }
     }
 
     void Server::AdvanceTime( double time )
     {
+        YOJIMBO_PROFILE_SCOPE( PROFILE_STAGE_SERVER_ADVANCE_TIME );
+        YOJIMBO_ZONE( "server_advance_time" );
+        YOJIMBO_PLOT( "server_connected_clients", m_numConnectedClients );
+
+        UpdateOverload();
+
+        const double workStartTime = platform_time();
+
         m_time = time;
 
+        ReleaseBroadcastMessages( false );
+
+        if ( m_jobScheduler && IsRunning() )
+        {
+            m_numJobClients = 0;
+
+            for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+            {
+                if ( m_clientTick[clientIndex].connected && m_clientTick[clientIndex].connection )
+                    m_jobClients[m_numJobClients++] = clientIndex;
+            }
+
+            if ( m_numJobClients > 0 )
+                m_jobScheduler->Run( AdvanceTimeJob, this, m_numJobClients );
+
+            m_numJobClients = 0;
+        }
+
         // check for global allocator error, increase counter and clear error. nothing we can do but take note.
 
         if ( m_globalAllocator->GetError() )
@@ -508,23 +2070,77 @@ namespace yojimbo
 
                 // check for connection error
 
-                if ( m_clientConnection[clientIndex] )
-                {
-                    m_clientConnection[clientIndex]->AdvanceTime( time );
+                if ( m_clientTick[clientIndex].connection )
+                {
+                    if ( !m_jobScheduler )
+                        m_clientTick[clientIndex].connection->AdvanceTime( time );
+
+                    if ( m_clientTick[clientIndex].connection->GetError() )
+                    {
+                        OnClientError( clientIndex, SERVER_CLIENT_ERROR_CONNECTION );
+
+                        m_counters[SERVER_COUNTER_CLIENT_CONNECTION_ERRORS]++;
+
+                        DisconnectClient( clientIndex, true );
+
+                        continue;
+                    }
+                }
+            }
+        }
+
+        m_tickWorkTime += platform_time() - workStartTime;
+    }
+
+    double Server::GetNextEventTime() const
+    {
+        if ( !IsRunning() )
+            return NoEventTime;
+
+        const double time = GetTime();
+
+        double nextEventTime = NoEventTime;
+
+        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+        {
+            const ServerClientTickData & clientTick = m_clientTick[clientIndex];
+
+            if ( !clientTick.connected )
+                continue;
+
+            const bool hasMessagesToSend = clientTick.connection && clientTick.connection->HasMessagesToSend();
+
+            const float keepAliveSendRate = ( m_config.connectionIdleKeepAliveSendRate > 0.0f && !hasMessagesToSend ) ? m_config.connectionIdleKeepAliveSendRate : m_config.connectionKeepAliveSendRate;
+
+            nextEventTime = min( nextEventTime, clientTick.lastPacketSendTime + ( 1.0f / keepAliveSendRate ) );
+
+            nextEventTime = min( nextEventTime, clientTick.lastPacketReceiveTime + m_config.connectionTimeOut );
+
+            if ( !clientTick.fullyConnected )
+                continue;
+
+            if ( clientTick.connection && ( m_config.serverSendIdleClients || clientTick.pendingAcks || hasMessagesToSend ) )
+            {
+                double sendTime = clientTick.connection->GetNextSendTime();
 
-                    if ( m_clientConnection[clientIndex]->GetError() )
-                    {
-                        OnClientError( clientIndex, SERVER_CLIENT_ERROR_CONNECTION );
+                if ( GetClientTickSendRate( clientIndex ) > 0.0f )
+                    sendTime = max( sendTime, clientTick.nextSendTime );
 
-                        m_counters[SERVER_COUNTER_CLIENT_CONNECTION_ERRORS]++;
+                nextEventTime = min( nextEventTime, sendTime );
+            }
 
-                        DisconnectClient( clientIndex, true );
+            if ( m_config.enableResumeTokens )
+            {
+                const ServerClientData & clientData = m_clientData[clientIndex];
 
-                        continue;
-                    }
-                }
+                if ( clientData.resumeTokenPending )
+                    nextEventTime = time;
+                else if ( clientData.resumeTokenValid )
+                    nextEventTime = min( nextEventTime, clientData.resumeTokenRefreshTime );
             }
         }
+
+        return max( nextEventTime, time );
     }
 
     void Server::SetFlags( uint64_t flags )
@@ -546,7 +2162,14 @@ namespace yojimbo
     {
         assert( clientIndex >= 0 );
         assert( clientIndex < m_maxClients );
-        return m_clientConnected[clientIndex];
+        return m_clientTick[clientIndex].connected;
+    }
+
+    bool Server::HasClientResources( int clientIndex ) const
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        return m_clientPacketFactory[clientIndex] != NULL;
     }
 
     const Address & Server::GetServerAddress() const
@@ -556,13 +2179,10 @@ namespace yojimbo
 
     int Server::FindClientIndex( uint64_t clientId ) const
     {
-        for ( int i = 0; i < m_maxClients; ++i )
-        {   
-            if ( m_clientConnected[i] && m_clientId[i] == clientId )
-                return i;
-        }
+        if ( !m_clientIdMap || m_numConnectedClients == 0 )
+            return -1;
 
-        return -1;
+        return m_clientIdMap->Find( clientId );
     }
 
     int Server::FindClientIndex( const Address & address ) const
@@ -570,13 +2190,10 @@ namespace yojimbo
         if ( !address.IsValid() )
             return -1;
 
-        for ( int i = 0; i < m_maxClients; ++i )
-        {   
-            if ( m_clientConnected[i] && m_clientAddress[i] == address )
-                return i;
-        }
+        if ( !m_clientAddressMap || m_numConnectedClients == 0 )
+            return -1;
 
-        return -1;
+        return m_clientAddressMap->Find( address );
     }
 
     uint64_t Server::GetClientId( int clientIndex ) const
@@ -598,6 +2215,17 @@ namespace yojimbo
         return m_numConnectedClients;
     }
 
+    void Server::GetLoadReport( ServerLoadReport & report, float tickHeadroom ) const
+    {
+        report.serverAddress = m_serverAddress;
+        report.numConnectedClients = m_numConnectedClients;
+        report.maxClients = m_maxClients;
+        report.tickHeadroom = clamp( tickHeadroom, 0.0f, 1.0f );
+        report.packetsSent = m_transport->GetCounter( TRANSPORT_COUNTER_PACKETS_SENT );
+        report.packetsReceived = m_transport->GetCounter( TRANSPORT_COUNTER_PACKETS_RECEIVED );
+        report.packetsDropped = m_transport->GetCounter( TRANSPORT_COUNTER_SEND_QUEUE_OVERFLOW ) + m_transport->GetCounter( TRANSPORT_COUNTER_RECEIVE_QUEUE_OVERFLOW );
+    }
+
     uint64_t Server::GetCounter( int index ) const 
     {
         assert( index >= 0 );
@@ -605,6 +2233,97 @@ namespace yojimbo
         return m_counters[index];
     }
 
+    void Server::GetClientNetworkInfo( int clientIndex, NetworkInfo & info ) const
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+
+        if ( !m_clientTick[clientIndex].connected || !m_clientTick[clientIndex].connection )
+        {
+            info = NetworkInfo();
+            return;
+        }
+
+        m_clientTick[clientIndex].connection->GetNetworkInfo( info );
+    }
+
+    void Server::SetClientSendRate( int clientIndex, float sendRate )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( sendRate >= 0.0f );
+
+        if ( !m_clientTick[clientIndex].connected )
+            return;
+
+        ServerClientTickData & clientTick = m_clientTick[clientIndex];
+
+        const double time = GetTime();
+
+        // IMPORTANT: Don't let a slow previous rate hold back the first packet at the new rate.
+
+        if ( sendRate > 0.0f && clientTick.nextSendTime > time + 1.0 / sendRate )
+            clientTick.nextSendTime = time + 1.0 / sendRate;
+
+        clientTick.sendRate = sendRate;
+    }
+
+    float Server::GetClientSendRate( int clientIndex ) const
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+
+        if ( !m_clientTick[clientIndex].connected )
+            return 0.0f;
+
+        return m_clientTick[clientIndex].sendRate;
+    }
+
+    void Server::SetClientLowPriority( int clientIndex, bool lowPriority )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+
+        if ( !m_clientTick[clientIndex].connected )
+            return;
+
+        m_clientTick[clientIndex].lowPriority = lowPriority;
+    }
+
+    bool Server::IsClientLowPriority( int clientIndex ) const
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+
+        return m_clientTick[clientIndex].connected && m_clientTick[clientIndex].lowPriority;
+    }
+
+    bool Server::IsOverloaded() const
+    {
+        return m_overloaded;
+    }
+
+    double Server::GetTickTime() const
+    {
+        return m_tickTime;
+    }
+
+    bool Server::IsUsingHugePages() const
+    {
+        return m_hugePageMemory;
+    }
+
+    const Connection * Server::GetClientConnection( int clientIndex ) const
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+
+        if ( !m_clientTick[clientIndex].connected )
+            return NULL;
+
+        return m_clientTick[clientIndex].connection;
+    }
+
     void Server::ResetCounters()
     {
         memset( m_counters, 0, sizeof( m_counters ) );
@@ -624,15 +2343,85 @@ namespace yojimbo
     {
         assert( m_globalMemory == NULL );
 
-        m_globalMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.serverGlobalMemory );
+        m_globalMemoryBytes = m_config.serverGlobalMemory;
+        m_clientMemoryBytes = m_config.serverPerClientMemory;
+        m_hugePageMemory = false;
+
+        if ( m_config.serverHugePageMemory )
+        {
+            const size_t hugePageSize = platform_huge_page_size();
+
+            m_globalMemoryBytes = ( m_globalMemoryBytes + hugePageSize - 1 ) / hugePageSize * hugePageSize;
+            m_clientMemoryBytes = ( m_clientMemoryBytes + hugePageSize - 1 ) / hugePageSize * hugePageSize;
+
+            int numFallbacks = 0;
+
+            bool hugePages = false;
+
+            m_globalMemory = (uint8_t*) platform_memory_reserve_huge_pages( m_globalMemoryBytes, hugePages );
+
+            if ( !hugePages )
+                numFallbacks++;
 
-        m_globalAllocator = CreateAllocator( *m_allocator, m_globalMemory, m_config.serverGlobalMemory );
+            for ( int i = 0; i < m_maxClients; ++i )
+            {
+                m_clientMemory[i] = (uint8_t*) platform_memory_reserve_huge_pages( m_clientMemoryBytes, hugePages );
+
+                if ( !hugePages )
+                    numFallbacks++;
+            }
+
+            m_hugePageMemory = numFallbacks == 0;
+
+            if ( numFallbacks > 0 )
+                debug_printf( "server huge pages not available for %d of %d memory blocks. falling back to regular pages\n", numFallbacks, m_maxClients + 1 );
+        }
+        else
+        {
+            // IMPORTANT: Memory placed on a NUMA node must be reserved from the operating system, so it starts on page boundaries and isn't shared with other allocations.
+
+            if ( m_config.serverNumaNode >= 0 )
+                m_globalMemory = (uint8_t*) platform_memory_reserve( m_globalMemoryBytes );
+            else
+                m_globalMemory = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_globalMemoryBytes );
+
+            for ( int i = 0; i < m_maxClients; ++i )
+            {
+                if ( m_config.serverReserveClientMemory || m_config.serverNumaNode >= 0 )
+                    m_clientMemory[i] = (uint8_t*) platform_memory_reserve( m_clientMemoryBytes );
+                else
+                    m_clientMemory[i] = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_clientMemoryBytes );
+            }
+        }
+
+        assert( m_globalMemory );
+
+        if ( m_config.serverNumaNode >= 0 )
+        {
+            int numFailures = 0;
+
+            if ( !platform_memory_set_numa_node( m_globalMemory, m_globalMemoryBytes, m_config.serverNumaNode ) )
+                numFailures++;
+
+            for ( int i = 0; i < m_maxClients; ++i )
+            {
+                assert( m_clientMemory[i] );
+
+                if ( !platform_memory_set_numa_node( m_clientMemory[i], m_clientMemoryBytes, m_config.serverNumaNode ) )
+                    numFailures++;
+            }
+
+            if ( numFailures > 0 )
+                debug_printf( "server failed to place %d of %d memory blocks on numa node %d\n", numFailures, m_maxClients + 1, m_config.serverNumaNode );
+        }
+
+        m_globalAllocator = CreateAllocator( *m_allocator, m_globalMemory, m_globalMemoryBytes );
 
         for ( int i = 0; i < m_maxClients; ++i )
         {
-            m_clientMemory[i] = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_config.serverPerClientMemory );
+            assert( m_clientMemory[i] );
 
-            m_clientAllocator[i] = CreateAllocator( *m_allocator, m_clientMemory[i], m_config.serverPerClientMemory );
+            m_clientAllocator[i] = CreateAllocator( *m_allocator, m_clientMemory[i], m_clientMemoryBytes );
         }
     }
 
@@ -647,11 +2436,31 @@ namespace yojimbo
             assert( m_clientAllocator[i] );
 
             YOJIMBO_DELETE( *m_allocator, Allocator, m_clientAllocator[i] );
-            YOJIMBO_FREE( *m_allocator, m_clientMemory[i] );
+
+            if ( m_config.serverReserveClientMemory || m_config.serverHugePageMemory || m_config.serverNumaNode >= 0 )
+            {
+                platform_memory_release( m_clientMemory[i], m_clientMemoryBytes );
+                m_clientMemory[i] = NULL;
+            }
+            else
+            {
+                YOJIMBO_FREE( *m_allocator, m_clientMemory[i] );
+            }
         }
 
         YOJIMBO_DELETE( *m_allocator, Allocator, m_globalAllocator );
-        YOJIMBO_FREE( *m_allocator, m_globalMemory );
+
+        if ( m_config.serverHugePageMemory || m_config.serverNumaNode >= 0 )
+        {
+            platform_memory_release( m_globalMemory, m_globalMemoryBytes );
+            m_globalMemory = NULL;
+        }
+        else
+        {
+            YOJIMBO_FREE( *m_allocator, m_globalMemory );
+        }
+
+        m_hugePageMemory = false;
     }
 
     Allocator * Server::CreateAllocator( Allocator & allocator, void * memory, size_t bytes )
@@ -669,7 +2478,7 @@ namespace yojimbo
         else
         {
             assert( clientIndex >= 0 );
-            assert( clientIndex <= m_maxClients );
+            assert( clientIndex < m_maxClients );
             assert( m_clientAllocator[clientIndex] );
             return *m_clientAllocator[clientIndex];
         }
@@ -677,9 +2486,36 @@ namespace yojimbo
 
     void Server::SetEncryptedPacketTypes()
     {
+        m_transport->SetPacketCipher( m_config.packetCipher );
+
         m_transport->EnablePacketEncryption();
 
         m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_CONNECTION_REQUEST );
+
+        m_transport->SetMaxUnencryptedPacketBytes( CLIENT_SERVER_PACKET_CONNECTION_REQUEST, ConnectionRequestPacketMaxBytes );
+
+        if ( m_config.enableStatelessChallenge )
+        {
+            m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_CHALLENGE_RESPONSE );
+
+            m_transport->SetMaxUnencryptedPacketBytes( CLIENT_SERVER_PACKET_CHALLENGE_RESPONSE, ChallengeResponsePacketMaxBytes );
+        }
+
+        if ( m_config.enableResumeTokens )
+        {
+            m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_RESUME_REQUEST );
+
+            m_transport->SetMaxUnencryptedPacketBytes( CLIENT_SERVER_PACKET_RESUME_REQUEST, ResumeRequestPacketMaxBytes );
+        }
+
+        if ( m_config.enableServerPing )
+        {
+            m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_PING );
+            m_transport->DisableEncryptionForPacketType( CLIENT_SERVER_PACKET_PONG );
+
+            m_transport->SetMaxUnencryptedPacketBytes( CLIENT_SERVER_PACKET_PING, PingPacketMaxBytes );
+            m_transport->SetMaxUnencryptedPacketBytes( CLIENT_SERVER_PACKET_PONG, PongPacketMaxBytes );
+        }
     }
 
     PacketFactory * Server::CreatePacketFactory( Allocator & allocator, ServerResourceType /*type*/, int /*clientIndex*/ )
@@ -696,13 +2532,24 @@ namespace yojimbo
     void Server::ResetClientState( int clientIndex )
     {
         assert( clientIndex >= 0 );
-        assert( clientIndex < MaxClients );
+        assert( clientIndex < m_maxClients );
 
-        m_clientConnected[clientIndex] = false;
         m_clientId[clientIndex] = 0;
         m_clientAddress[clientIndex] = Address();
         m_clientData[clientIndex] = ServerClientData();
-        m_clientSequence[clientIndex] = 0;
+
+        // IMPORTANT: The connection object and job packet belong to the client slot, not the client, so they are kept.
+
+        ServerClientTickData & clientTick = m_clientTick[clientIndex];
+        clientTick.lastPacketSendTime = 0.0;
+        clientTick.lastPacketReceiveTime = 0.0;
+        clientTick.nextSendTime = 0.0;
+        clientTick.sequence = 0;
+        clientTick.sendRate = 0.0f;
+        clientTick.connected = false;
+        clientTick.fullyConnected = false;
+        clientTick.pendingAcks = false;
+        clientTick.lowPriority = false;
 
         if ( m_clientAllocator[clientIndex] )
             m_clientAllocator[clientIndex]->ClearError();
@@ -713,8 +2560,8 @@ namespace yojimbo
         if ( m_clientMessageFactory[clientIndex] )
             m_clientMessageFactory[clientIndex]->ClearError();
 
-        if ( m_clientConnection[clientIndex] )
-            m_clientConnection[clientIndex]->Reset();
+        if ( m_clientTick[clientIndex].connection )
+            m_clientTick[clientIndex].connection->Reset();
 
         if ( m_clientReplayProtection[clientIndex] )
             m_clientReplayProtection[clientIndex]->Reset();
@@ -722,75 +2569,41 @@ namespace yojimbo
 
     int Server::FindFreeClientIndex() const
     {
+        // IMPORTANT: Prefer free slots that already have their per-client resources, so clients only create them once the pre-warmed slots are used up.
+
+        int freeClientIndex = -1;
+
         for ( int i = 0; i < m_maxClients; ++i )
         {
-            if ( !m_clientConnected[i] )
+            if ( m_clientTick[i].connected )
+                continue;
+
+            if ( m_clientPacketFactory[i] )
                 return i;
+
+            if ( freeClientIndex == -1 )
+                freeClientIndex = i;
         }
-        return -1;
+
+        return freeClientIndex;
     }
 
     bool Server::FindConnectTokenEntry( const uint8_t * mac )
     {
-        for ( int i = 0; i < MaxConnectTokenEntries; ++i )
-        {
-            if ( memcmp( mac, m_connectTokenEntries[i].mac, MacBytes ) == 0 )
-                return true;
-        }
+        assert( m_connectTokenTable );
 
-        return false;
+        return m_connectTokenTable->Find( mac );
     }
 
     bool Server::FindOrAddConnectTokenEntry( const Address & address, const uint8_t * mac )
     {
-        // find the matching entry for the token mac, and the oldest token. constant time worst case. This is intentional!
-
-        const double time = GetTime();
-
         assert( address.IsValid() );
 
         assert( mac );
 
-        int matchingTokenIndex = -1;
-        int oldestTokenIndex = -1;
-        double oldestTokenTime = 0.0;
-        for ( int i = 0; i < MaxConnectTokenEntries; ++i )
-        {
-            if ( memcmp( mac, m_connectTokenEntries[i].mac, MacBytes ) == 0 )
-            {
-                matchingTokenIndex = i;
-            }
-
-            if ( oldestTokenIndex == -1 || m_connectTokenEntries[i].time < oldestTokenTime )
-            {
-                oldestTokenTime = m_connectTokenEntries[i].time;
-                oldestTokenIndex = i;
-            }
-        }
-
-        // if no entry is found with the mac, replace the oldest entry with this (mac,address,time) and return true
-
-        assert( oldestTokenIndex != -1 );
-
-        if ( matchingTokenIndex == -1 )
-        {
-            m_connectTokenEntries[oldestTokenIndex].time = time;
-            m_connectTokenEntries[oldestTokenIndex].address = address;
-            memcpy( m_connectTokenEntries[oldestTokenIndex].mac, mac, MacBytes );
-            return true;
-        }
-
-        // if an entry is found with the same mac *and* it has the same address, return true
+        assert( m_connectTokenTable );
 
-        assert( matchingTokenIndex >= 0 );
-        assert( matchingTokenIndex < MaxConnectTokenEntries );
-
-        if ( m_connectTokenEntries[matchingTokenIndex].address == address )
-            return true;
-
-        // otherwise an entry exists with the same mac but a different address, somebody is trying to reuse this connect token in a replay attack!
-
-        return false;
+        return m_connectTokenTable->FindOrAdd( address, mac, GetTime() );
     }
 
     void Server::ConnectClient( int clientIndex, const Address & clientAddress, uint64_t clientId )
@@ -800,7 +2613,10 @@ namespace yojimbo
         assert( clientIndex < m_maxClients );
         assert( m_numConnectedClients >= 0 );
         assert( m_numConnectedClients < m_maxClients );
-        assert( !m_clientConnected[clientIndex] );
+        assert( !m_clientTick[clientIndex].connected );
+
+        if ( !m_clientPacketFactory[clientIndex] )
+            CreateClientResources( clientIndex );
 
         const double time = GetTime();
 
@@ -808,16 +2624,25 @@ namespace yojimbo
 
         m_numConnectedClients++;
 
-        m_clientConnected[clientIndex] = true;
+        m_clientTick[clientIndex].connected = true;
         m_clientId[clientIndex] = clientId;
         m_clientAddress[clientIndex] = clientAddress;
 
+        m_clientAddressMap->Insert( clientAddress, clientIndex );
+        m_clientIdMap->Insert( clientId, clientIndex );
+
         m_clientData[clientIndex].address = clientAddress;
         m_clientData[clientIndex].clientId = clientId;
         m_clientData[clientIndex].connectTime = time;
-        m_clientData[clientIndex].lastPacketSendTime = time;
-        m_clientData[clientIndex].lastPacketReceiveTime = time;
-        m_clientData[clientIndex].fullyConnected = false;
+        m_clientTick[clientIndex].lastPacketSendTime = time;
+        m_clientTick[clientIndex].lastPacketReceiveTime = time;
+        m_clientTick[clientIndex].nextSendTime = time;
+        m_clientTick[clientIndex].sendRate = m_config.serverClientSendRate;
+        m_clientTick[clientIndex].pendingAcks = false;
+        m_clientTick[clientIndex].lowPriority = false;
+        m_clientTick[clientIndex].fullyConnected = false;
+
+        m_clientTimerWheel->Schedule( clientIndex, time + m_config.connectionTimeOut );
 #if !YOJIMBO_SECURE_MODE
         m_clientData[clientIndex].insecure = false;
 #endif // #if !YOJIMBO_SECURE_MODE
@@ -826,6 +2651,13 @@ namespace yojimbo
 
         m_transport->AddContextMapping( clientAddress, m_clientTransportContext[clientIndex] );
 
+        // IMPORTANT: only secure clients have an encryption mapping, and only they are issued resume tokens
+
+        if ( m_config.enableResumeTokens && m_clientTransportContext[clientIndex].encryptionIndex != -1 )
+            GenerateResumeToken( clientIndex );
+
+        SerializeKeepAlivePacket( clientIndex );
+
         OnClientConnect( clientIndex );
 
         KeepAlivePacket * keepAlivePacket = CreateKeepAlivePacket( clientIndex );
@@ -845,24 +2677,133 @@ namespace yojimbo
         OnPacketSent( packet->GetType(), address, immediate );
     }
 
+    bool Server::SendPacketWithKeys( const Address & address, Packet * packet, const uint8_t * sendKey, const uint8_t * receiveKey )
+    {
+        assert( IsRunning() );
+        assert( packet );
+        assert( sendKey );
+        assert( receiveKey );
+
+        // IMPORTANT: if there is no encryption mapping for this address, add one just long enough to encrypt and send the packet immediately
+
+        if ( m_transport->FindEncryptionMapping( address ) != -1 )
+        {
+            SendPacket( address, packet, true );
+            return true;
+        }
+
+        if ( !m_transport->AddEncryptionMapping( address, sendKey, receiveKey, m_config.connectionTimeOut ) )
+        {
+            packet->Destroy();
+            return false;
+        }
+
+        SendPacket( address, packet, true );
+
+        m_transport->RemoveEncryptionMapping( address );
+
+        return true;
+    }
+
     void Server::SendPacketToConnectedClient( int clientIndex, Packet * packet, bool immediate )
     {
         assert( IsRunning() );
         assert( packet );
         assert( clientIndex >= 0 );
         assert( clientIndex < m_maxClients );
-        assert( m_clientConnected[clientIndex] );
+        assert( m_clientTick[clientIndex].connected );
+
+        const double time = GetTime();
+        
+        m_clientTick[clientIndex].lastPacketSendTime = time;
+        
+        m_transport->SendPacket( m_clientAddress[clientIndex], packet, ++m_clientTick[clientIndex].sequence, immediate );
+        
+        OnPacketSent( packet->GetType(), m_clientAddress[clientIndex], immediate );
+    }
+
+    bool Server::SendSerializedPacketToConnectedClient( int clientIndex, int packetType, const uint8_t * packetData, int packetBytes, bool immediate )
+    {
+        assert( IsRunning() );
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+        assert( m_clientTick[clientIndex].connected );
+
+        if ( packetBytes <= 0 )
+            return false;
+
+        // IMPORTANT: The sequence number is only used up if the packet is sent. Otherwise the caller falls back to sending a packet object, which takes the next sequence number instead.
+
+        ServerClientTickData & clientTick = m_clientTick[clientIndex];
+
+        if ( !m_transport->SendSerializedPacket( m_clientAddress[clientIndex], packetType, packetData, packetBytes, clientTick.sequence + 1, immediate ) )
+            return false;
+
+        clientTick.sequence++;
+
+        clientTick.lastPacketSendTime = GetTime();
+
+        OnPacketSent( packetType, m_clientAddress[clientIndex], immediate );
+
+        return true;
+    }
+
+    void Server::SerializeKeepAlivePacket( int clientIndex )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+
+        ServerClientData & clientData = m_clientData[clientIndex];
+
+        clientData.keepAlivePacketBytes = 0;
+
+        KeepAlivePacket * packet = (KeepAlivePacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_KEEPALIVE );
+
+        if ( !packet )
+            return;
+
+        packet->clientIndex = clientIndex;
+#if !YOJIMBO_SECURE_MODE
+        packet->clientSalt = clientData.clientSalt;
+#endif // #if !YOJIMBO_SECURE_MODE
+
+        clientData.keepAlivePacketBytes = m_transport->SerializePacket( packet, (uint8_t*) clientData.keepAlivePacketData, SerializedControlPacketBytes );
+
+        packet->Destroy();
+    }
+
+    void Server::ProcessConnectionRequest( const ConnectionRequestPacket & packet, const Address & address )
+    {
+        assert( IsRunning() );
+
+        if ( !AcceptConnectionRequest( packet, address ) )
+            return;
+
+        ConnectToken connectToken;
+
+        const bool decrypted = FindCachedConnectToken( packet, connectToken ) || DecryptConnectToken( packet.connectTokenData, connectToken, packet.connectTokenNonce, m_privateKey, packet.connectTokenExpireTimestamp );
+
+        ProcessConnectionRequestToken( packet, address, decrypted, connectToken );
+    }
+
+    bool Server::FindCachedConnectToken( const ConnectionRequestPacket & packet, ConnectToken & connectToken )
+    {
+        if ( !m_connectTokenCache )
+            return false;
+
+        const ConnectTokenCacheEntry * entry = m_connectTokenCache->Find( packet, GetTime() );
 
-        const double time = GetTime();
-        
-        m_clientData[clientIndex].lastPacketSendTime = time;
-        
-        m_transport->SendPacket( m_clientAddress[clientIndex], packet, ++m_clientSequence[clientIndex], immediate );
-        
-        OnPacketSent( packet->GetType(), m_clientAddress[clientIndex], immediate );
+        if ( !entry )
+            return false;
+
+        connectToken = entry->connectToken;
+
+        m_counters[SERVER_COUNTER_CONNECTION_REQUEST_CONNECT_TOKEN_CACHE_HITS]++;
+
+        return true;
     }
 
-    void Server::ProcessConnectionRequest( const ConnectionRequestPacket & packet, const Address & address )
+    bool Server::AcceptConnectionRequest( const ConnectionRequestPacket & packet, const Address & address )
     {
         assert( IsRunning() );
 
@@ -871,11 +2812,34 @@ namespace yojimbo
             debug_printf( "ignored connection request: flag is set\n" );
             OnConnectionRequest( SERVER_CONNECTION_REQUEST_IGNORED_BECAUSE_FLAG_IS_SET, packet, address, ConnectToken() );
             m_counters[SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_BECAUSE_FLAG_IS_SET]++;
-            return;
+            return false;
         }
 
         m_counters[SERVER_COUNTER_CONNECTION_REQUEST_PACKETS_RECEIVED]++;
 
+        // IMPORTANT: rate limit connection requests per source address and subnet *before* decrypting the connect token, because decrypting is the expensive part
+
+        if ( m_connectionRequestLimiter )
+        {
+            const double time = GetTime();
+
+            if ( !m_connectionRequestLimiter->Consume( connection_request_key( address, false ), time, m_config.serverConnectionRequestRate, m_config.serverConnectionRequestBurst ) )
+            {
+                debug_printf( "ignored connection request: address rate limited\n" );
+                OnConnectionRequest( SERVER_CONNECTION_REQUEST_IGNORED_ADDRESS_RATE_LIMITED, packet, address, ConnectToken() );
+                m_counters[SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_ADDRESS_RATE_LIMITED]++;
+                return false;
+            }
+
+            if ( m_config.serverConnectionRequestSubnetRate > 0.0f && !m_connectionRequestLimiter->Consume( connection_request_key( address, true ), time, m_config.serverConnectionRequestSubnetRate, m_config.serverConnectionRequestSubnetBurst ) )
+            {
+                debug_printf( "ignored connection request: subnet rate limited\n" );
+                OnConnectionRequest( SERVER_CONNECTION_REQUEST_IGNORED_SUBNET_RATE_LIMITED, packet, address, ConnectToken() );
+                m_counters[SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_SUBNET_RATE_LIMITED]++;
+                return false;
+            }
+        }
+
         uint64_t timestamp = (uint64_t) ::time( NULL );
 
         if ( packet.connectTokenExpireTimestamp <= timestamp )
@@ -883,11 +2847,17 @@ namespace yojimbo
             debug_printf( "ignored connection request: connect token has expired\n" );
             OnConnectionRequest( SERVER_CONNECTION_REQUEST_IGNORED_CONNECT_TOKEN_EXPIRED, packet, address, ConnectToken() );
             m_counters[SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_CONNECT_TOKEN_EXPIRED]++;
-            return;
+            return false;
         }
 
-        ConnectToken connectToken;
-        if ( !DecryptConnectToken( packet.connectTokenData, connectToken, packet.connectTokenNonce, m_privateKey, packet.connectTokenExpireTimestamp ) )
+        return true;
+    }
+
+    void Server::ProcessConnectionRequestToken( const ConnectionRequestPacket & packet, const Address & address, bool decrypted, const ConnectToken & connectToken )
+    {
+        assert( IsRunning() );
+
+        if ( !decrypted )
         {
             debug_printf( "ignored connection request: failed to decrypt connect token\n" );
             OnConnectionRequest( SERVER_CONNECTION_REQUEST_IGNORED_FAILED_TO_DECRYPT_CONNECT_TOKEN, packet, address, ConnectToken() );
@@ -895,11 +2865,21 @@ namespace yojimbo
             return;
         }
 
+        ConnectTokenCacheEntry * cacheEntry = NULL;
+
+        if ( m_connectTokenCache )
+        {
+            cacheEntry = m_connectTokenCache->Find( packet, GetTime() );
+
+            if ( !cacheEntry )
+                cacheEntry = m_connectTokenCache->Add( packet, connectToken, GetTime() );
+        }
+
         bool serverAddressInConnectTokenWhiteList = false;
 
         for ( int i = 0; i < connectToken.numServerAddresses; ++i )
         {
-            if ( m_serverAddress == connectToken.serverAddresses[i] )
+            if ( m_serverAddress == connectToken.serverAddresses[i] || ( m_serverAlternateAddress.IsValid() && m_serverAlternateAddress == connectToken.serverAddresses[i] ) )
             {
                 serverAddressInConnectTokenWhiteList = true;
                 break;
@@ -946,7 +2926,11 @@ namespace yojimbo
             return;
         }
 
-        if ( !FindConnectTokenEntry( packet.connectTokenData ) )
+        // IMPORTANT: with stateless challenge, nothing is added for this client until it replies with a valid challenge response
+
+        const bool stateless = m_config.enableStatelessChallenge;
+
+        if ( !stateless && !FindConnectTokenEntry( packet.GetConnectTokenMac() ) )
         {
             if ( !m_transport->AddEncryptionMapping( address, connectToken.serverToClientKey, connectToken.clientToServerKey, m_config.connectionTimeOut ) )
             {
@@ -968,12 +2952,15 @@ namespace yojimbo
             ConnectionDeniedPacket * connectionDeniedPacket = (ConnectionDeniedPacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_CONNECTION_DENIED );
             if ( connectionDeniedPacket )
             {
-                SendPacket( address, connectionDeniedPacket );
+                if ( stateless )
+                    SendPacketWithKeys( address, connectionDeniedPacket, connectToken.serverToClientKey, connectToken.clientToServerKey );
+                else
+                    SendPacket( address, connectionDeniedPacket );
             }
             return;
         }
 
-        if ( !FindOrAddConnectTokenEntry( address, packet.connectTokenData ) )
+        if ( !stateless && !FindOrAddConnectTokenEntry( address, packet.GetConnectTokenMac() ) )
         {
             debug_printf( "ignored connection request: connect token already used\n" );
             OnConnectionRequest( SERVER_CONNECTION_REQUEST_IGNORED_CONNECT_TOKEN_ALREADY_USED, packet, address, connectToken );
@@ -981,8 +2968,12 @@ namespace yojimbo
             return;
         }
 
+        // IMPORTANT: the challenge token only depends on the connect token, so the one generated for the first connection request is sent again in response to resent connection requests
+
+        const bool cachedChallengeToken = cacheEntry && cacheEntry->challengeTokenValid;
+
         ChallengeToken challengeToken;
-        if ( !GenerateChallengeToken( connectToken, packet.connectTokenData, challengeToken ) )
+        if ( !cachedChallengeToken && !GenerateChallengeToken( connectToken, packet.GetConnectTokenMac(), challengeToken ) )
         {
             debug_printf( "ignored connection request: failed to generate challenge token\n" );
             OnConnectionRequest( SERVER_CONNECTION_REQUEST_IGNORED_FAILED_TO_GENERATE_CHALLENGE_TOKEN, packet, address, connectToken );
@@ -999,21 +2990,49 @@ namespace yojimbo
             return;
         }
 
-        memcpy( challengePacket->challengeTokenNonce, (uint8_t*) &m_challengeTokenNonce, NonceBytes );
-
-        if ( !EncryptChallengeToken( challengeToken, challengePacket->challengeTokenData, challengePacket->challengeTokenNonce, m_challengeKey ) )
+        if ( cachedChallengeToken )
         {
-            debug_printf( "ignored connection request: failed to encrypt challenge token\n" );
-            OnConnectionRequest( SERVER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ENCRYPT_CHALLENGE_TOKEN, packet, address, connectToken );
-            m_counters[SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ENCRYPT_CHALLENGE_TOKEN]++;
-            return;
+            memcpy( challengePacket->challengeTokenNonce, cacheEntry->challengeTokenNonce, NonceBytes );
+            memcpy( challengePacket->challengeTokenData, cacheEntry->challengeTokenData, ChallengeTokenBytes );
         }
+        else
+        {
+            memcpy( challengePacket->challengeTokenNonce, (uint8_t*) &m_challengeTokenNonce, NonceBytes );
 
-        m_challengeTokenNonce++;
+            if ( !EncryptChallengeToken( challengeToken, challengePacket->challengeTokenData, challengePacket->challengeTokenNonce, m_challengeKey ) )
+            {
+                debug_printf( "ignored connection request: failed to encrypt challenge token\n" );
+                OnConnectionRequest( SERVER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ENCRYPT_CHALLENGE_TOKEN, packet, address, connectToken );
+                m_counters[SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ENCRYPT_CHALLENGE_TOKEN]++;
+                return;
+            }
 
-        m_counters[SERVER_COUNTER_CONNECTION_REQUEST_CHALLENGE_PACKETS_SENT]++;
+            m_challengeTokenNonce++;
+
+            if ( cacheEntry )
+            {
+                memcpy( cacheEntry->challengeTokenNonce, challengePacket->challengeTokenNonce, NonceBytes );
+                memcpy( cacheEntry->challengeTokenData, challengePacket->challengeTokenData, ChallengeTokenBytes );
+                cacheEntry->challengeTokenValid = true;
+            }
+        }
+
+        if ( stateless )
+        {
+            if ( !SendPacketWithKeys( address, challengePacket, connectToken.serverToClientKey, connectToken.clientToServerKey ) )
+            {
+                debug_printf( "ignored connection request: failed to add encryption mapping\n" );
+                OnConnectionRequest( SERVER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING, packet, address, connectToken );
+                m_counters[SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING]++;
+                return;
+            }
+        }
+        else
+        {
+            SendPacket( address, challengePacket );
+        }
 
-        SendPacket( address, challengePacket );
+        m_counters[SERVER_COUNTER_CONNECTION_REQUEST_CHALLENGE_PACKETS_SENT]++;
 
         OnConnectionRequest( SERVER_CONNECTION_REQUEST_CHALLENGE_PACKET_SENT, packet, address, connectToken );
     }
@@ -1041,6 +3060,16 @@ namespace yojimbo
             return;
         }
 
+        const bool stateless = m_config.enableStatelessChallenge;
+
+        if ( stateless && challengeToken.expireTimestamp <= (uint64_t) ::time( NULL ) )
+        {
+            debug_printf( "ignored challenge response: challenge token has expired\n" );
+            OnChallengeResponse( SERVER_CHALLENGE_RESPONSE_IGNORED_CHALLENGE_TOKEN_EXPIRED, packet, address, challengeToken );
+            m_counters[SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_CHALLENGE_TOKEN_EXPIRED]++;
+            return;
+        }
+
         if ( FindClientIndex( address ) >= 0 )
         {
             debug_printf( "ignored challenge response: address already connected\n" );
@@ -1067,12 +3096,34 @@ namespace yojimbo
 
             if ( connectionDeniedPacket )
             {
-                SendPacket( address, connectionDeniedPacket );
+                if ( stateless )
+                    SendPacketWithKeys( address, connectionDeniedPacket, challengeToken.serverToClientKey, challengeToken.clientToServerKey );
+                else
+                    SendPacket( address, connectionDeniedPacket );
             }
 
             return;
         }
 
+        if ( stateless )
+        {
+            if ( !FindOrAddConnectTokenEntry( address, challengeToken.connectTokenMac ) )
+            {
+                debug_printf( "ignored challenge response: connect token already used\n" );
+                OnChallengeResponse( SERVER_CHALLENGE_RESPONSE_IGNORED_CONNECT_TOKEN_ALREADY_USED, packet, address, challengeToken );
+                m_counters[SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_CONNECT_TOKEN_ALREADY_USED]++;
+                return;
+            }
+
+            if ( !m_transport->AddEncryptionMapping( address, challengeToken.serverToClientKey, challengeToken.clientToServerKey, m_config.connectionTimeOut ) )
+            {
+                debug_printf( "ignored challenge response: failed to add encryption mapping\n" );
+                OnChallengeResponse( SERVER_CHALLENGE_RESPONSE_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING, packet, address, challengeToken );
+                m_counters[SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING]++;
+                return;
+            }
+        }
+
         const int clientIndex = FindFreeClientIndex();
 
         assert( clientIndex != -1 );
@@ -1084,6 +3135,110 @@ namespace yojimbo
         ConnectClient( clientIndex, address, challengeToken.clientId );
     }
 
+    void Server::ProcessResumeRequest( const ResumeRequestPacket & packet, const Address & address )
+    {
+        assert( IsRunning() );
+
+        if ( !m_config.enableResumeTokens )
+            return;
+
+        m_counters[SERVER_COUNTER_RESUME_REQUEST_PACKETS_RECEIVED]++;
+
+        ResumeToken resumeToken;
+        if ( !DecryptResumeToken( packet.resumeTokenData, resumeToken, packet.resumeTokenNonce, m_challengeKey ) )
+        {
+            debug_printf( "ignored resume request: failed to decrypt resume token\n" );
+            m_counters[SERVER_COUNTER_RESUME_REQUEST_IGNORED_FAILED_TO_DECRYPT_RESUME_TOKEN]++;
+            return;
+        }
+
+        if ( resumeToken.expireTimestamp <= (uint64_t) ::time( NULL ) )
+        {
+            debug_printf( "ignored resume request: resume token has expired\n" );
+            m_counters[SERVER_COUNTER_RESUME_REQUEST_IGNORED_RESUME_TOKEN_EXPIRED]++;
+            return;
+        }
+
+        if ( FindClientIndex( address ) >= 0 )
+        {
+            debug_printf( "ignored resume request: address already connected\n" );
+            m_counters[SERVER_COUNTER_RESUME_REQUEST_IGNORED_ADDRESS_ALREADY_CONNECTED]++;
+            return;
+        }
+
+        if ( FindClientIndex( resumeToken.clientId ) >= 0 )
+        {
+            debug_printf( "ignored resume request: client id already connected\n" );
+            m_counters[SERVER_COUNTER_RESUME_REQUEST_IGNORED_CLIENT_ID_ALREADY_CONNECTED]++;
+            return;
+        }
+
+        if ( m_numConnectedClients == m_maxClients )
+        {
+            debug_printf( "resume request denied: server is full\n" );
+            m_counters[SERVER_COUNTER_RESUME_REQUEST_DENIED_SERVER_IS_FULL]++;
+
+            ConnectionDeniedPacket * connectionDeniedPacket = (ConnectionDeniedPacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_CONNECTION_DENIED );
+
+            if ( connectionDeniedPacket )
+                SendPacketWithKeys( address, connectionDeniedPacket, resumeToken.serverToClientKey, resumeToken.clientToServerKey );
+
+            return;
+        }
+
+        // IMPORTANT: resume tokens share the connect token table, keyed on the resume token MAC. This binds each resume token to the first address it is used from, so a resume request captured on the wire can't be replayed from somewhere else.
+
+        if ( !FindOrAddConnectTokenEntry( address, packet.resumeTokenData + ResumeTokenBytes - MacBytes ) )
+        {
+            debug_printf( "ignored resume request: resume token already used\n" );
+            m_counters[SERVER_COUNTER_RESUME_REQUEST_IGNORED_RESUME_TOKEN_ALREADY_USED]++;
+            return;
+        }
+
+        if ( !m_transport->AddEncryptionMapping( address, resumeToken.serverToClientKey, resumeToken.clientToServerKey, m_config.connectionTimeOut ) )
+        {
+            debug_printf( "ignored resume request: failed to add encryption mapping\n" );
+            m_counters[SERVER_COUNTER_RESUME_REQUEST_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING]++;
+            return;
+        }
+
+        const int clientIndex = FindFreeClientIndex();
+
+        assert( clientIndex != -1 );
+
+        debug_printf( "resume request accepted\n" );
+        m_counters[SERVER_COUNTER_RESUME_REQUEST_ACCEPTED]++;
+
+        ConnectClient( clientIndex, address, resumeToken.clientId );
+    }
+
+    void Server::ProcessPing( const PingPacket & packet, const Address & address )
+    {
+        assert( IsRunning() );
+
+        if ( !m_config.enableServerPing )
+            return;
+
+        m_counters[SERVER_COUNTER_PING_PACKETS_RECEIVED]++;
+
+        if ( m_pingLimiter && !m_pingLimiter->Consume( connection_request_key( address, false ), GetTime(), m_config.serverPingRate, m_config.serverPingBurst ) )
+        {
+            m_counters[SERVER_COUNTER_PING_IGNORED_RATE_LIMITED]++;
+            return;
+        }
+
+        PongPacket * pongPacket = (PongPacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_PONG );
+        if ( !pongPacket )
+            return;
+
+        pongPacket->pingId = packet.pingId;
+        pongPacket->pingTime = packet.pingTime;
+
+        // IMPORTANT: send the pong immediately, so time spent waiting for the next Server::SendPackets isn't measured as latency
+
+        SendPacket( address, pongPacket, true );
+    }
+
     void Server::ProcessKeepAlive( const KeepAlivePacket & /*packet*/, const Address & address )
     {
         assert( IsRunning() );
@@ -1097,9 +3252,9 @@ namespace yojimbo
 
         const double time = GetTime();
         
-        m_clientData[clientIndex].lastPacketReceiveTime = time;
+        m_clientTick[clientIndex].lastPacketReceiveTime = time;
 
-        m_clientData[clientIndex].fullyConnected = true;
+        m_clientTick[clientIndex].fullyConnected = true;
     }
 
     void Server::ProcessDisconnect( const DisconnectPacket & /*packet*/, const Address & address )
@@ -1171,7 +3326,7 @@ namespace yojimbo
 
 #endif // #if !YOJIMBO_SECURE_MODE
 
-    void Server::ProcessConnectionPacket( ConnectionPacket & packet, const Address & address )
+    void Server::ProcessConnectionPacket( ConnectionPacket & packet, const Address & address, double receiveTime )
     {
         const int clientIndex = FindClientIndex( address );
         if ( clientIndex == -1 )
@@ -1180,15 +3335,17 @@ namespace yojimbo
         assert( clientIndex >= 0 );
         assert( clientIndex < m_maxClients );
 
-        if ( m_clientConnection[clientIndex] )
-            m_clientConnection[clientIndex]->ProcessPacket( &packet );
+        if ( m_clientTick[clientIndex].connection )
+            m_clientTick[clientIndex].connection->ProcessPacket( &packet, receiveTime );
+
+        m_clientTick[clientIndex].lastPacketReceiveTime = GetTime();
 
-        m_clientData[clientIndex].lastPacketReceiveTime = GetTime();
+        m_clientTick[clientIndex].pendingAcks = true;
 
-        m_clientData[clientIndex].fullyConnected = true;
+        m_clientTick[clientIndex].fullyConnected = true;
     }
 
-    void Server::ProcessPacket( Packet * packet, const Address & address, uint64_t /*sequence*/ )
+    void Server::ProcessPacket( Packet * packet, const Address & address, uint64_t /*sequence*/, double receiveTime )
     {
         OnPacketReceived( packet->GetType(), address );
         
@@ -1202,6 +3359,14 @@ namespace yojimbo
                 ProcessChallengeResponse( *(ChallengeResponsePacket*)packet, address );
                 return;
 
+            case CLIENT_SERVER_PACKET_RESUME_REQUEST:
+                ProcessResumeRequest( *(ResumeRequestPacket*)packet, address );
+                return;
+
+            case CLIENT_SERVER_PACKET_PING:
+                ProcessPing( *(PingPacket*)packet, address );
+                return;
+
             case CLIENT_SERVER_PACKET_KEEPALIVE:
                 ProcessKeepAlive( *(KeepAlivePacket*)packet, address );
                 return;
@@ -1217,7 +3382,7 @@ namespace yojimbo
 #endif // #if !YOJIMBO_SECURE_MODE
 
             case CLIENT_SERVER_PACKET_CONNECTION:
-                ProcessConnectionPacket( *(ConnectionPacket*)packet, address );
+                ProcessConnectionPacket( *(ConnectionPacket*)packet, address, receiveTime );
                 return;
 
             default:
@@ -1232,9 +3397,46 @@ namespace yojimbo
         if ( !ProcessUserPacket( clientIndex, packet ) )
             return;
 
-        m_clientData[clientIndex].lastPacketReceiveTime = GetTime();
+        m_clientTick[clientIndex].lastPacketReceiveTime = GetTime();
+
+        m_clientTick[clientIndex].fullyConnected = true;
+    }
+
+    void Server::GenerateResumeToken( int clientIndex )
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+
+        ServerClientData & clientData = m_clientData[clientIndex];
+
+        ResumeToken resumeToken;
+        resumeToken.clientId = clientData.clientId;
+        resumeToken.expireTimestamp = (uint64_t) ::time( NULL ) + (uint64_t) m_config.resumeTokenTimeOut;
+        GenerateKey( resumeToken.clientToServerKey );
+        GenerateKey( resumeToken.serverToClientKey );
+
+        memcpy( clientData.resumeTokenNonce, (uint8_t*) &m_challengeTokenNonce, NonceBytes );
+
+        if ( !EncryptResumeToken( resumeToken, clientData.resumeTokenData, clientData.resumeTokenNonce, m_challengeKey ) )
+        {
+            debug_printf( "failed to encrypt resume token\n" );
+            clientData.resumeTokenValid = false;
+            clientData.resumeTokenPending = false;
+            return;
+        }
+
+        m_challengeTokenNonce++;
+
+        // IMPORTANT: refresh after a third of the time out, so a client that misses one refresh still holds a valid resume token until the next
 
-        m_clientData[clientIndex].fullyConnected = true;
+        clientData.resumeTokenValid = true;
+        clientData.resumeTokenPending = true;
+        clientData.resumeTokenRefreshTime = GetTime() + m_config.resumeTokenTimeOut / 3.0;
+        clientData.resumeTokenExpireTimestamp = resumeToken.expireTimestamp;
+        memcpy( clientData.resumeClientToServerKey, resumeToken.clientToServerKey, KeyBytes );
+        memcpy( clientData.resumeServerToClientKey, resumeToken.serverToClientKey, KeyBytes );
+
+        m_counters[SERVER_COUNTER_RESUME_TOKENS_ISSUED]++;
     }
 
     KeepAlivePacket * Server::CreateKeepAlivePacket( int clientIndex )
@@ -1242,7 +3444,7 @@ namespace yojimbo
         assert( clientIndex >= 0 );
         assert( clientIndex < m_maxClients );
 
-        assert( m_clientConnected[clientIndex] );
+        assert( m_clientTick[clientIndex].connected );
 
         KeepAlivePacket * packet = (KeepAlivePacket*) CreateClientPacket( clientIndex, CLIENT_SERVER_PACKET_KEEPALIVE );
 
@@ -1252,6 +3454,21 @@ namespace yojimbo
 #if !YOJIMBO_SECURE_MODE
             packet->clientSalt = m_clientData[clientIndex].clientSalt;
 #endif // #if !YOJIMBO_SECURE_MODE
+
+            // IMPORTANT: the resume token goes out with every keep-alive until the client is fully connected, because the client may miss the first
+
+            ServerClientData & clientData = m_clientData[clientIndex];
+
+            if ( clientData.resumeTokenValid && ( clientData.resumeTokenPending || !m_clientTick[clientIndex].fullyConnected ) )
+            {
+                packet->hasResumeToken = true;
+                packet->resumeTokenExpireTimestamp = clientData.resumeTokenExpireTimestamp;
+                memcpy( packet->resumeTokenData, clientData.resumeTokenData, ResumeTokenBytes );
+                memcpy( packet->resumeTokenNonce, clientData.resumeTokenNonce, NonceBytes );
+                memcpy( packet->resumeClientToServerKey, clientData.resumeClientToServerKey, KeyBytes );
+                memcpy( packet->resumeServerToClientKey, clientData.resumeServerToClientKey, KeyBytes );
+                clientData.resumeTokenPending = false;
+            }
         }
 
         return packet;
@@ -1293,6 +3510,12 @@ namespace yojimbo
         (void) clientIndex;
     }
 
+    void Server::OnClientMigrate( int clientIndex, const Address & from )
+    {
+        (void) clientIndex;
+        (void) from;
+    }
+
     void Server::OnClientError( int clientIndex, ServerClientError error )
     {
         (void) clientIndex;
@@ -1341,10 +3564,153 @@ namespace yojimbo
         (void) numFragmentsInBlock;
     }
 
+    void Server::OnConnectionBlockDataReceived( Connection * connection, int channelId, uint16_t messageId, BlockMessage * blockMessage, int blockOffset, const uint8_t * data, int dataBytes, bool blockComplete )
+    {
+        (void) connection;
+        (void) channelId;
+        (void) messageId;
+        (void) blockMessage;
+        (void) blockOffset;
+        (void) data;
+        (void) dataBytes;
+        (void) blockComplete;
+    }
+
     bool Server::ProcessUserPacket( int clientIndex, Packet * packet )
     { 
         (void) clientIndex;
         (void) packet;
         return false; 
     }
+
+    // =====================================================
+
+    ServerGroup::ServerGroup( Allocator & allocator, int maxServers )
+    {
+        assert( maxServers > 0 );
+
+        m_allocator = &allocator;
+        m_jobScheduler = NULL;
+        m_maxServers = maxServers;
+        m_numServers = 0;
+        m_servers = (Server**) YOJIMBO_ALLOCATE( allocator, sizeof( Server* ) * m_maxServers );
+        m_transports = (Transport**) YOJIMBO_ALLOCATE( allocator, sizeof( Transport* ) * m_maxServers );
+        m_time = 0.0;
+    }
+
+    ServerGroup::~ServerGroup()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_servers );
+        YOJIMBO_FREE( *m_allocator, m_transports );
+    }
+
+    void ServerGroup::SetJobScheduler( JobScheduler * jobScheduler )
+    {
+        m_jobScheduler = jobScheduler;
+    }
+
+    bool ServerGroup::AddServer( Server & server, Transport & transport )
+    {
+        if ( m_numServers == m_maxServers )
+            return false;
+
+        m_servers[m_numServers] = &server;
+        m_transports[m_numServers] = &transport;
+        m_numServers++;
+
+        return true;
+    }
+
+    void ServerGroup::RemoveServer( Server & server )
+    {
+        for ( int i = 0; i < m_numServers; ++i )
+        {
+            if ( m_servers[i] == &server )
+            {
+                m_servers[i] = m_servers[m_numServers-1];
+                m_transports[i] = m_transports[m_numServers-1];
+                m_numServers--;
+                return;
+            }
+        }
+    }
+
+    int ServerGroup::GetNumServers() const
+    {
+        return m_numServers;
+    }
+
+    Server & ServerGroup::GetServer( int index )
+    {
+        assert( index >= 0 );
+        assert( index < m_numServers );
+        return *m_servers[index];
+    }
+
+    void ServerGroup::SendPackets()
+    {
+        RunJobs( SendPacketsJob );
+    }
+
+    void ServerGroup::ReceivePackets()
+    {
+        RunJobs( ReceivePacketsJob );
+    }
+
+    void ServerGroup::CheckForTimeOut()
+    {
+        RunJobs( CheckForTimeOutJob );
+    }
+
+    void ServerGroup::AdvanceTime( double time )
+    {
+        m_time = time;
+
+        RunJobs( AdvanceTimeJob );
+    }
+
+    void ServerGroup::RunJobs( JobFunction function )
+    {
+        if ( m_numServers == 0 )
+            return;
+
+        if ( m_jobScheduler )
+        {
+            m_jobScheduler->Run( function, this, m_numServers );
+        }
+        else
+        {
+            for ( int i = 0; i < m_numServers; ++i )
+                function( this, i );
+        }
+    }
+
+    void ServerGroup::SendPacketsJob( void * context, int index )
+    {
+        ServerGroup * group = (ServerGroup*) context;
+        group->m_servers[index]->SendPackets();
+        group->m_transports[index]->WritePackets();
+    }
+
+    void ServerGroup::ReceivePacketsJob( void * context, int index )
+    {
+        ServerGroup * group = (ServerGroup*) context;
+        group->m_transports[index]->ReadPackets();
+        group->m_servers[index]->ReceivePackets();
+    }
+
+    void ServerGroup::CheckForTimeOutJob( void * context, int index )
+    {
+        ServerGroup * group = (ServerGroup*) context;
+        group->m_servers[index]->CheckForTimeOut();
+    }
+
+    void ServerGroup::AdvanceTimeJob( void * context, int index )
+    {
+        ServerGroup * group = (ServerGroup*) context;
+        group->m_servers[index]->AdvanceTime( group->m_time );
+        group->m_transports[index]->AdvanceTime( group->m_time );
+    }
 }
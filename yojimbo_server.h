@@ -30,6 +30,9 @@
 #include "yojimbo_allocator.h"
 #include "yojimbo_transport.h"
 #include "yojimbo_encryption.h"
+#include "yojimbo_address_map.h"
+#include "yojimbo_id_map.h"
+#include "yojimbo_timer_wheel.h"
 #include "yojimbo_connection.h"
 #include "yojimbo_packet_processor.h"
 #include "yojimbo_client_server_packets.h"
@@ -61,7 +64,7 @@ namespace yojimbo
     /**
         Per-client data stored on the server. 
 
-        Stores data for connected clients such as their address, globally unique client id, last packet send and receive times used for timeouts and keep-alive packets and so on.
+        Stores data for connected clients that is rarely accessed, such as their address, globally unique client id and connect time. State accessed every tick lives in ServerClientTickData.
      */
 
     struct ServerClientData
@@ -69,25 +72,73 @@ namespace yojimbo
         Address address;                                            ///< The address of this client. Packets are sent and received from the client using this address, therefore only one client with the address may be connected at any time.
         uint64_t clientId;                                          ///< Globally unique client id. Only one client with a specific client id may be connected to the server at any time.
         double connectTime;                                         ///< The time that the client connected to the server. Used to determine how long the client has been connected.
-        double lastPacketSendTime;                                  ///< The last time a packet was sent to this client. Used to determine when it's necessary to send keep-alive packets.
-        double lastPacketReceiveTime;                               ///< The last time a packet was received from this client. Used for timeouts.
-        bool fullyConnected;                                        ///< True if this client is 'fully connected'. Fully connected means the client has received a keep-alive packet from the server containing its client index and replied back to the server with a keep-alive packet confirming that it knows its client index.
 #if !YOJIMBO_SECURE_MODE
         uint64_t clientSalt;                                        ///< The client salt is a random number rolled on each insecure client connect. It is used to distinguish one client connect session from another, so reconnects are more reliable. See Client::InsecureConnect for details.
         bool insecure;                                              ///< True if this client connected in insecure mode. This means the client connected via Client::InsecureConnect and is sending and receiving packets without encryption. Please use insecure mode only during development, it is not suitable for production use.
 #endif // #if !YOJIMBO_SECURE_MODE
+        bool resumeTokenValid;                                      ///< True if a resume token has been issued to this client. Only secure clients are issued resume tokens, and only if ClientServerConfig::enableResumeTokens is true.
+        bool resumeTokenPending;                                    ///< True if the current resume token has not been sent to the client yet. The next keep-alive packet sent to the client carries it.
+        double resumeTokenRefreshTime;                              ///< The time the server issues this client a fresh resume token, so the client always holds one that stays valid for a while after it disconnects.
+        uint64_t resumeTokenExpireTimestamp;                        ///< The timestamp when the current resume token expires.
+        uint8_t resumeTokenData[ResumeTokenBytes];                  ///< The current encrypted resume token.
+        uint8_t resumeTokenNonce[NonceBytes];                       ///< Nonce the current resume token was encrypted with.
+        uint8_t resumeClientToServerKey[KeyBytes];                  ///< Client to server packet encryption key for a session resumed with the current resume token.
+        uint8_t resumeServerToClientKey[KeyBytes];                  ///< Server to client packet encryption key for a session resumed with the current resume token.
+        uint32_t keepAlivePacketData[SerializedControlPacketBytes/4];   ///< Keep-alive packet for this client without a resume token, serialized once when the client connects. Stored as words so it is 4 byte aligned. See Transport::SerializePacket.
+        int keepAlivePacketBytes;                                   ///< The number of bytes of serialized keep-alive packet data. 0 if the packet could not be serialized, in which case keep-alive packets are created and serialized each time they are sent.
 
         ServerClientData()
         {
             clientId = 0;
             connectTime = 0.0;
-            lastPacketSendTime = 0.0;
-            lastPacketReceiveTime = 0.0;
-            fullyConnected = false;
 #if !YOJIMBO_SECURE_MODE
             clientSalt = 0;
             insecure = false;
 #endif // #if !YOJIMBO_SECURE_MODE
+            resumeTokenValid = false;
+            resumeTokenPending = false;
+            resumeTokenRefreshTime = 0.0;
+            resumeTokenExpireTimestamp = 0;
+            keepAlivePacketBytes = 0;
+        }
+    };
+
+    /**
+        Per-client state that the server touches every tick.
+
+        Server::SendPackets, Server::CheckForTimeOut and the per-client jobs read and write these fields for every connected client, so they are packed into one cache line per client. Jobs running on different threads never write to the same cache line.
+
+        @see ServerClientData
+     */
+
+    struct ServerClientTickData
+    {
+        double lastPacketSendTime;                                  ///< The last time a packet was sent to this client. Used to determine when it's necessary to send keep-alive packets.
+        double lastPacketReceiveTime;                               ///< The last time a packet was received from this client. Used for timeouts.
+        double nextSendTime;                                        ///< The next time a connection packet may be sent to this client. Only used if the send rate for this client is non-zero.
+        uint64_t sequence;                                          ///< Sequence number for packets sent to this client. Resets to zero each time the client slot is reset.
+        Connection * connection;                                    ///< The connection object for this client slot. NULL unless ClientServerConfig::enableMessages is true. Allocated in Server::Start and kept across client resets.
+        ConnectionPacket * jobPacket;                               ///< Connection packet generated by the job scheduler in Server::SendPackets. Sent and cleared back to NULL on the calling thread.
+        float sendRate;                                             ///< The rate connection packets are sent to this client (packets per-second). Zero sends a connection packet on every call to Server::SendPackets. See Server::SetClientSendRate.
+        bool connected;                                             ///< True if a client is connected in this slot.
+        bool fullyConnected;                                        ///< True if this client is 'fully connected'. Fully connected means the client has received a keep-alive packet from the server containing its client index and replied back to the server with a keep-alive packet confirming that it knows its client index.
+        bool pendingAcks;                                           ///< True if the server has received connection packets from this client since it last sent a connection packet to it. Those packets are acked by the next connection packet sent.
+        bool lowPriority;                                           ///< True if this client is sent connection packets less often while the server is overloaded. See Server::SetClientLowPriority.
+        uint8_t padding[CacheLineBytes - 4 * 8 - 2 * sizeof( void* ) - 4 - 4];    ///< Pads the structure out to exactly one cache line.
+
+        ServerClientTickData()
+        {
+            lastPacketSendTime = 0.0;
+            lastPacketReceiveTime = 0.0;
+            nextSendTime = 0.0;
+            sequence = 0;
+            connection = NULL;
+            jobPacket = NULL;
+            sendRate = 0.0f;
+            connected = false;
+            fullyConnected = false;
+            pendingAcks = false;
+            lowPriority = false;
         }
     };
 
@@ -99,7 +150,7 @@ namespace yojimbo
 
     struct ConnectTokenEntry
     {
-        double time;                                                ///< The time for this entry. Used to replace the oldest entries once the connect token array fills up.
+        double time;                                                ///< The time for this entry. Entries are added in time order, so the oldest entry is always the next one to be replaced in the eviction ring once it fills up.
         Address address;                                            ///< Address of the client that sent this connect token. Binds a connect token to a particular address so it can't be exploited.
         uint8_t mac[MacBytes];                                      ///< HMAC of connect token. We use this to avoid replay attacks where the same token is sent repeatedly for different addresses.
 
@@ -110,6 +161,303 @@ namespace yojimbo
         }
     };
 
+    /**
+        Remembers recently used connect tokens, so the server can reject connect tokens being replayed from a different address.
+
+        Entries are stored in a fixed size ring in the order they were added. Once the ring fills up, the oldest entry is evicted to make room for the new one.
+
+        Entries are indexed by a hash of the connect token MAC (open addressing, linear probing, backward shift deletion), so finding and adding an entry is O(1) regardless of the number of entries. This lets the table be sized to tens of thousands of recent tokens without making connection request floods more expensive.
+
+        @see ClientServerConfig::serverConnectTokenEntries
+     */
+
+    class ConnectTokenTable
+    {
+    public:
+
+        /**
+            Connect token table constructor.
+
+            @param allocator The allocator used to allocate the entry ring and the hash table.
+            @param numEntries The number of entries in the ring. This is the number of recent connect tokens remembered.
+         */
+
+        ConnectTokenTable( Allocator & allocator, int numEntries );
+
+        /**
+            Connect token table destructor.
+         */
+
+        ~ConnectTokenTable();
+
+        /**
+            Forget all connect tokens.
+         */
+
+        void Reset();
+
+        /**
+            Is there an entry for this connect token MAC?
+
+            @param mac The connect token MAC (MacBytes).
+
+            @returns True if an entry exists for the MAC, false otherwise.
+         */
+
+        bool Find( const uint8_t * mac ) const;
+
+        /**
+            Find the entry for this connect token MAC, or add it if it doesn't exist.
+
+            If no entry exists for the MAC, the oldest entry is replaced with (mac,address,time) and true is returned.
+
+            If an entry exists for the MAC with the same address, true is returned.
+
+            Otherwise, an entry exists for the MAC with a different address. Somebody is trying to reuse this connect token in a replay attack, so false is returned.
+
+            @param address The address the connect token was sent from.
+            @param mac The connect token MAC (MacBytes).
+            @param time The current time. Must not go backwards between calls, so the ring stays in time order.
+
+            @returns True if the connect token is OK to use from this address, false if it has already been used from a different address.
+         */
+
+        bool FindOrAdd( const Address & address, const uint8_t * mac, double time );
+
+        /**
+            Get the number of entries in the ring.
+
+            @returns The maximum number of connect tokens remembered.
+         */
+
+        int GetNumEntries() const { return m_numEntries; }
+
+        /**
+            Get the number of entries currently in use.
+
+            @returns The number of connect tokens remembered in [0,GetNumEntries()].
+         */
+
+        int GetNumUsedEntries() const { return m_numUsedEntries; }
+
+    protected:
+
+        int FindSlot( const uint8_t * mac ) const;
+
+        void RemoveSlot( uint32_t slot );
+
+    private:
+
+        Allocator * m_allocator;                                    ///< The allocator passed in to the constructor.
+
+        int m_numEntries;                                           ///< The number of entries in the ring.
+
+        int m_numUsedEntries;                                       ///< The number of entries in the ring that are in use. Once this reaches m_numEntries, each new entry evicts the oldest.
+
+        int m_oldestEntry;                                          ///< Index of the next ring entry to write. Once the ring is full, this is the oldest entry.
+
+        uint32_t m_tableMask;                                       ///< The hash table size minus one. The hash table size is always a power of two at least twice the number of entries.
+
+        ConnectTokenEntry * m_entries;                              ///< The ring of connect token entries, in time order starting at m_oldestEntry.
+
+        int * m_table;                                              ///< The hash table. Each slot holds the ring index of an entry, or -1 if the slot is empty.
+    };
+
+    /**
+        A token bucket used to rate limit connection requests from a source address or subnet.
+
+        @see ConnectionRequestLimiter
+     */
+
+    struct ConnectionRequestBucket
+    {
+        uint64_t key;                                               ///< Hash of the source address or subnet this bucket belongs to.
+        double time;                                                ///< The last time tokens were added to this bucket. Negative if the bucket is empty.
+        float tokens;                                               ///< The number of connection requests that may be admitted right now.
+
+        ConnectionRequestBucket()
+        {
+            key = 0;
+            time = -1.0;
+            tokens = 0.0f;
+        }
+    };
+
+    /**
+        Rate limits connection requests per source address and subnet, so the server can drop floods of connection requests before decrypting their connect tokens.
+
+        Each source address or subnet gets a token bucket that refills at a fixed rate up to a maximum burst. Each connection request admitted consumes one token.
+
+        Buckets are stored in a fixed size hash table. A key is looked up in a short run of slots starting at its hash. If it is not found, the least recently used bucket in that run is replaced with a full bucket for the key, so the table never grows and never fails.
+
+        @see ClientServerConfig::serverConnectionRequestRate
+     */
+
+    class ConnectionRequestLimiter
+    {
+    public:
+
+        /**
+            Connection request limiter constructor.
+
+            @param allocator The allocator used to allocate the buckets.
+            @param numBuckets The number of buckets. Rounded up to the next power of two.
+         */
+
+        ConnectionRequestLimiter( Allocator & allocator, int numBuckets );
+
+        /**
+            Connection request limiter destructor.
+         */
+
+        ~ConnectionRequestLimiter();
+
+        /**
+            Empty all buckets.
+         */
+
+        void Reset();
+
+        /**
+            Try to take one token from the bucket for a key.
+
+            @param key The key for the source address or subnet.
+            @param time The current time (seconds).
+            @param rate The rate that tokens are added to the bucket (tokens per-second).
+            @param burst The maximum number of tokens in the bucket. New buckets start full.
+
+            @returns True if a token was taken and the connection request should be admitted, false if the connection request should be dropped.
+         */
+
+        bool Consume( uint64_t key, double time, float rate, float burst );
+
+        /**
+            Get the number of buckets.
+
+            @returns The number of buckets in the hash table.
+         */
+
+        int GetNumBuckets() const { return int( m_bucketMask + 1 ); }
+
+    private:
+
+        Allocator * m_allocator;                                    ///< The allocator passed in to the constructor.
+
+        uint32_t m_bucketMask;                                      ///< The number of buckets minus one. The number of buckets is always a power of two.
+
+        ConnectionRequestBucket * m_buckets;                        ///< The hash table of buckets.
+    };
+
+    /**
+        A connect token cached by the server, along with the challenge token generated for it.
+
+        @see ConnectTokenCache
+     */
+
+    struct ConnectTokenCacheEntry
+    {
+        double time;                                                ///< The last time this entry was used. Negative if the entry is empty.
+        uint64_t connectTokenExpireTimestamp;                       ///< The expire timestamp the connect token was sent with. Part of the additional data authenticated by the connect token MAC.
+        uint8_t connectTokenNonce[NonceBytes];                      ///< The nonce the connect token was encrypted with.
+        uint8_t connectTokenMac[MacBytes];                          ///< The MAC at the end of the encrypted connect token.
+        ConnectToken connectToken;                                  ///< The decrypted connect token.
+        bool challengeTokenValid;                                   ///< True if a challenge token has been generated for this connect token.
+        uint8_t challengeTokenNonce[NonceBytes];                    ///< The nonce the challenge token was encrypted with. Only valid if challengeTokenValid is true.
+        uint8_t challengeTokenData[ChallengeTokenBytes];            ///< The encrypted challenge token. Only valid if challengeTokenValid is true.
+
+        ConnectTokenCacheEntry()
+        {
+            time = -1.0;
+            connectTokenExpireTimestamp = 0;
+            memset( connectTokenNonce, 0, NonceBytes );
+            memset( connectTokenMac, 0, MacBytes );
+            challengeTokenValid = false;
+            memset( challengeTokenNonce, 0, NonceBytes );
+            memset( challengeTokenData, 0, ChallengeTokenBytes );
+        }
+    };
+
+    /**
+        Caches recently decrypted connect tokens, so the server doesn't decrypt the same connect token again when a client resends its connection request.
+
+        Clients resend connection requests at ClientServerConfig::connectionNegotiationSendRate until they receive a challenge, and every resend carries the same encrypted connect token. A cache hit costs a hash lookup, instead of decrypting and parsing the connect token and generating and encrypting a new challenge token.
+
+        Entries are keyed by the connect token MAC, nonce and expire timestamp. The MAC authenticates the encrypted connect token under a key derived from the nonce, so a different connect token can't match a cached entry without forging the MAC.
+
+        Entries are stored in a fixed size hash table. A connect token is looked up in a short run of slots starting at its hash. When a connect token is added, the least recently used entry in that run is replaced, the same way as ConnectionRequestLimiter.
+
+        @see ClientServerConfig::serverConnectTokenCacheEntries
+     */
+
+    class ConnectTokenCache
+    {
+    public:
+
+        /**
+            Connect token cache constructor.
+
+            @param allocator The allocator used to allocate the entries.
+            @param numEntries The number of entries. Rounded up to the next power of two.
+         */
+
+        ConnectTokenCache( Allocator & allocator, int numEntries );
+
+        /**
+            Connect token cache destructor.
+         */
+
+        ~ConnectTokenCache();
+
+        /**
+            Empty all entries.
+
+            Call this whenever the keys used to decrypt connect tokens or encrypt challenge tokens change.
+         */
+
+        void Reset();
+
+        /**
+            Find the cache entry for the connect token in a connection request.
+
+            @param packet The connection request packet.
+            @param time The current time (seconds). Marks the entry as recently used.
+
+            @returns The cache entry, or NULL if the connect token is not in the cache.
+         */
+
+        ConnectTokenCacheEntry * Find( const ConnectionRequestPacket & packet, double time );
+
+        /**
+            Add the decrypted connect token for a connection request to the cache.
+
+            Replaces the least recently used entry in the probe run for the connect token. The new entry has no challenge token yet.
+
+            @param packet The connection request packet. The connect token in this packet must have been successfully decrypted.
+            @param connectToken The decrypted connect token.
+            @param time The current time (seconds).
+
+            @returns The new cache entry.
+         */
+
+        ConnectTokenCacheEntry * Add( const ConnectionRequestPacket & packet, const ConnectToken & connectToken, double time );
+
+        /**
+            Get the number of entries.
+
+            @returns The number of entries in the hash table.
+         */
+
+        int GetNumEntries() const { return int( m_entryMask + 1 ); }
+
+    private:
+
+        Allocator * m_allocator;                                    ///< The allocator passed in to the constructor.
+
+        uint32_t m_entryMask;                                       ///< The number of entries minus one. The number of entries is always a power of two.
+
+        ConnectTokenCacheEntry * m_entries;                         ///< The hash table of entries.
+    };
+
     /**
         Server counters provide insight into the number of times an action was performed by the server.
 
@@ -136,6 +484,9 @@ namespace yojimbo
         SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ALLOCATE_CHALLENGE_PACKET,          ///< Number of times the server ignored a connection request because it could not allocate a challenge packet to send back to the client. This would indicate that the server has insufficient global resources (packet factory, allocator) to handle the connection negotiation load. @see ClientServerConfig::serverGlobalMemory.
         SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_GENERATE_CHALLENGE_TOKEN,           ///< Number of times the server ignored a connection request because it could not generate a challenge token to send back to the client. Something is probably wrong with libsodium.
         SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ENCRYPT_CHALLENGE_TOKEN,            ///< Number of times the server ignored a connection request because it could not encrypt a challenge token to send back to the client. Something is probably wrong with libsodium.
+        SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_ADDRESS_RATE_LIMITED,                         ///< Number of times the server dropped a connection request before decrypting the connect token, because the source address sent more requests than ClientServerConfig::serverConnectionRequestRate allows.
+        SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_SUBNET_RATE_LIMITED,                          ///< Number of times the server dropped a connection request before decrypting the connect token, because the source subnet sent more requests than ClientServerConfig::serverConnectionRequestSubnetRate allows.
+        SERVER_COUNTER_CONNECTION_REQUEST_CONNECT_TOKEN_CACHE_HITS,                             ///< Number of connection requests whose connect token was found in the connect token cache, so it didn't have to be decrypted again. Typically these are connection requests resent by clients waiting for a challenge. See ClientServerConfig::serverConnectTokenCacheEntries.
 
         SERVER_COUNTER_CHALLENGE_RESPONSE_PACKETS_RECEIVED,                                     ///< Number of challenge response packets received by the server.
         SERVER_COUNTER_CHALLENGE_RESPONSE_ACCEPTED,                                             ///< Number of times the server accepted a challenge response and transitioned that client to connected.
@@ -144,9 +495,29 @@ namespace yojimbo
         SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_ADDRESS_ALREADY_CONNECTED,                    ///< Number of times the server ignored a challenge response packet because a client with that address is already connected.
         SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_CLIENT_ID_ALREADY_CONNECTED,                  ///< Number of times the server ignored a challenge response because a client with that client id is already connected. 
         SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_FAILED_TO_DECRYPT_CHALLENGE_TOKEN,            ///< Number of times the server ignored a challenge response because it couldn't decrypt the challenge token.
+        SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_CHALLENGE_TOKEN_EXPIRED,                      ///< Number of times the server ignored a challenge response because the connect token it corresponds to has expired. Only checked when ClientServerConfig::enableStatelessChallenge is true.
+        SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_CONNECT_TOKEN_ALREADY_USED,                   ///< Number of times the server ignored a challenge response because a client has already used that connect token to connect to this server. Only checked when ClientServerConfig::enableStatelessChallenge is true.
+        SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING,             ///< Number of times the server ignored a challenge response because it could not add an encryption mapping for that client. Only happens when ClientServerConfig::enableStatelessChallenge is true.
+
+        SERVER_COUNTER_RESUME_TOKENS_ISSUED,                                                    ///< Number of resume tokens issued to connected clients. See ClientServerConfig::enableResumeTokens.
+        SERVER_COUNTER_RESUME_REQUEST_PACKETS_RECEIVED,                                         ///< Number of resume request packets received by the server.
+        SERVER_COUNTER_RESUME_REQUEST_ACCEPTED,                                                 ///< Number of times the server accepted a resume request and transitioned that client to connected.
+        SERVER_COUNTER_RESUME_REQUEST_DENIED_SERVER_IS_FULL,                                    ///< Number of times the server denied a resume request because the server is full.
+        SERVER_COUNTER_RESUME_REQUEST_IGNORED_ADDRESS_ALREADY_CONNECTED,                        ///< Number of times the server ignored a resume request because a client with that address is already connected. Typically these are resume requests resent by a client that has just resumed.
+        SERVER_COUNTER_RESUME_REQUEST_IGNORED_CLIENT_ID_ALREADY_CONNECTED,                      ///< Number of times the server ignored a resume request because a client with that client id is already connected. This happens when a client resumes from a new address before the server times out its previous session.
+        SERVER_COUNTER_RESUME_REQUEST_IGNORED_FAILED_TO_DECRYPT_RESUME_TOKEN,                   ///< Number of times the server ignored a resume request because it couldn't decrypt the resume token. Resume tokens issued before the server was restarted fail to decrypt.
+        SERVER_COUNTER_RESUME_REQUEST_IGNORED_RESUME_TOKEN_EXPIRED,                             ///< Number of times the server ignored a resume request because the resume token has expired. See ClientServerConfig::resumeTokenTimeOut.
+        SERVER_COUNTER_RESUME_REQUEST_IGNORED_RESUME_TOKEN_ALREADY_USED,                        ///< Number of times the server ignored a resume request because the resume token was already used from a different address. A non-zero value indicates shennanigans!
+        SERVER_COUNTER_RESUME_REQUEST_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING,                 ///< Number of times the server ignored a resume request because it could not add an encryption mapping for that client.
+
+        SERVER_COUNTER_PING_PACKETS_RECEIVED,                                                   ///< Number of ping packets received by the server. See ClientServerConfig::enableServerPing.
+        SERVER_COUNTER_PING_IGNORED_RATE_LIMITED,                                               ///< Number of pings the server dropped without replying, because the source address sent more pings than ClientServerConfig::serverPingRate allows.
         
         SERVER_COUNTER_CLIENT_CONNECTS,                                                         ///< Number of times a client has connected to the server.
         SERVER_COUNTER_CLIENT_DISCONNECTS,                                                      ///< Number of times a client has been disconnected from the server.
+        SERVER_COUNTER_CLIENT_ADDRESS_MIGRATIONS,                                               ///< Number of times a connected client moved to a new address without reconnecting. See TRANSPORT_FLAG_ADDRESS_MIGRATION.
+        SERVER_COUNTER_CLIENT_HANDOFFS,                                                         ///< Number of connected clients handed off to another server. See Server::HandoffClient.
+        SERVER_COUNTER_CLIENT_HANDOFFS_ACCEPTED,                                                ///< Number of clients handed off from another server and accepted by this server. See Server::AcceptClientHandoff.
         SERVER_COUNTER_CLIENT_CLEAN_DISCONNECTS,                                                ///< Number of clean disconnects where the client sent disconnect packets to the server. You want lots of these.
         SERVER_COUNTER_CLIENT_TIMEOUTS,                                                         ///< Number of timeouts where the client disconnected without sending disconnect packets to the server. You want few of these.
         SERVER_COUNTER_CLIENT_ALLOCATOR_ERRORS,                                                 ///< Number of times a client was disconnected from the server because their allocator entered into an error state (eg. failed to allocate a block of memory). This indicates that the client has exhausted their per-client resources. See yojimbo::serverPerClientMemory.
@@ -155,10 +526,88 @@ namespace yojimbo
         SERVER_COUNTER_CLIENT_PACKET_FACTORY_ERRORS,                                            ///< Number of times a client was disconnected from the server because their message factory went into an error state. This indicates that the client tried to create a message but failed to do so.
         SERVER_COUNTER_GLOBAL_PACKET_FACTORY_ERRORS,                                            ///< Number of times the global packet factory entered into an error state because it could not allocate a packet. This probably indicates insufficient global memory for the connection negotiation process on the server. See ClientServerConfig::serverGlobalMemory.
         SERVER_COUNTER_GLOBAL_ALLOCATOR_ERRORS,                                                 ///< Number of times the global allocator went into error state because it could not perform an allocation. This probably indicates insufficient global memory for the connection negotiation process on the server. See ClientServerConfig::serverGlobalMemory.
+        SERVER_COUNTER_OVERLOADED_TICKS,                                                        ///< Number of ticks the server shed load because it was over its tick budget. See ClientServerConfig::serverTickBudget.
+        SERVER_COUNTER_RECEIVE_PACKETS_DEFERRED,                                                ///< Number of times Server::ReceivePackets left packets in the transport receive queue for the next call because the server was overloaded. See ClientServerConfig::serverOverloadReceivePackets.
         
         NUM_SERVER_COUNTERS                                                                     ///< The number of server counters.
     };
 
+    /**
+        Get the name of a server counter.
+
+        Names are lower case with underscores, so they can be used directly in metric names, eg. "client_connects". See MetricsSnapshot.
+
+        @param index The server counter index. See yojimbo::ServerCounters.
+
+        @returns The name of the counter.
+     */
+
+    inline const char * GetServerCounterName( int index )
+    {
+        switch ( index )
+        {
+            case SERVER_COUNTER_CONNECTION_REQUEST_PACKETS_RECEIVED:                                 return "connection_request_packets_received";
+            case SERVER_COUNTER_CONNECTION_REQUEST_CHALLENGE_PACKETS_SENT:                           return "connection_request_challenge_packets_sent";
+            case SERVER_COUNTER_CONNECTION_REQUEST_DENIED_SERVER_IS_FULL:                            return "connection_request_denied_server_is_full";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_BECAUSE_FLAG_IS_SET:                      return "connection_request_ignored_because_flag_is_set";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_DECRYPT_CONNECT_TOKEN:          return "connection_request_ignored_failed_to_decrypt_connect_token";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_SERVER_ADDRESS_NOT_IN_WHITELIST:          return "connection_request_ignored_server_address_not_in_whitelist";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_PROTOCOL_ID_MISMATCH:                     return "connection_request_ignored_protocol_id_mismatch";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_CLIENT_ID_IS_ZERO:                        return "connection_request_ignored_client_id_is_zero";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_ADDRESS_ALREADY_CONNECTED:                return "connection_request_ignored_address_already_connected";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_CLIENT_ID_ALREADY_CONNECTED:              return "connection_request_ignored_client_id_already_connected";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_CONNECT_TOKEN_EXPIRED:                    return "connection_request_ignored_connect_token_expired";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_CONNECT_TOKEN_ALREADY_USED:               return "connection_request_ignored_connect_token_already_used";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING:         return "connection_request_ignored_failed_to_add_encryption_mapping";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ALLOCATE_CHALLENGE_PACKET:      return "connection_request_ignored_failed_to_allocate_challenge_packet";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_GENERATE_CHALLENGE_TOKEN:       return "connection_request_ignored_failed_to_generate_challenge_token";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ENCRYPT_CHALLENGE_TOKEN:        return "connection_request_ignored_failed_to_encrypt_challenge_token";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_ADDRESS_RATE_LIMITED:                     return "connection_request_ignored_address_rate_limited";
+            case SERVER_COUNTER_CONNECTION_REQUEST_IGNORED_SUBNET_RATE_LIMITED:                      return "connection_request_ignored_subnet_rate_limited";
+            case SERVER_COUNTER_CONNECTION_REQUEST_CONNECT_TOKEN_CACHE_HITS:                         return "connection_request_connect_token_cache_hits";
+            case SERVER_COUNTER_CHALLENGE_RESPONSE_PACKETS_RECEIVED:                                 return "challenge_response_packets_received";
+            case SERVER_COUNTER_CHALLENGE_RESPONSE_ACCEPTED:                                         return "challenge_response_accepted";
+            case SERVER_COUNTER_CHALLENGE_RESPONSE_DENIED_SERVER_IS_FULL:                            return "challenge_response_denied_server_is_full";
+            case SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_BECAUSE_FLAG_IS_SET:                      return "challenge_response_ignored_because_flag_is_set";
+            case SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_ADDRESS_ALREADY_CONNECTED:                return "challenge_response_ignored_address_already_connected";
+            case SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_CLIENT_ID_ALREADY_CONNECTED:              return "challenge_response_ignored_client_id_already_connected";
+            case SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_FAILED_TO_DECRYPT_CHALLENGE_TOKEN:        return "challenge_response_ignored_failed_to_decrypt_challenge_token";
+            case SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_CHALLENGE_TOKEN_EXPIRED:                  return "challenge_response_ignored_challenge_token_expired";
+            case SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_CONNECT_TOKEN_ALREADY_USED:               return "challenge_response_ignored_connect_token_already_used";
+            case SERVER_COUNTER_CHALLENGE_RESPONSE_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING:         return "challenge_response_ignored_failed_to_add_encryption_mapping";
+            case SERVER_COUNTER_RESUME_TOKENS_ISSUED:                                                return "resume_tokens_issued";
+            case SERVER_COUNTER_RESUME_REQUEST_PACKETS_RECEIVED:                                     return "resume_request_packets_received";
+            case SERVER_COUNTER_RESUME_REQUEST_ACCEPTED:                                             return "resume_request_accepted";
+            case SERVER_COUNTER_RESUME_REQUEST_DENIED_SERVER_IS_FULL:                                return "resume_request_denied_server_is_full";
+            case SERVER_COUNTER_RESUME_REQUEST_IGNORED_ADDRESS_ALREADY_CONNECTED:                    return "resume_request_ignored_address_already_connected";
+            case SERVER_COUNTER_RESUME_REQUEST_IGNORED_CLIENT_ID_ALREADY_CONNECTED:                  return "resume_request_ignored_client_id_already_connected";
+            case SERVER_COUNTER_RESUME_REQUEST_IGNORED_FAILED_TO_DECRYPT_RESUME_TOKEN:               return "resume_request_ignored_failed_to_decrypt_resume_token";
+            case SERVER_COUNTER_RESUME_REQUEST_IGNORED_RESUME_TOKEN_EXPIRED:                         return "resume_request_ignored_resume_token_expired";
+            case SERVER_COUNTER_RESUME_REQUEST_IGNORED_RESUME_TOKEN_ALREADY_USED:                    return "resume_request_ignored_resume_token_already_used";
+            case SERVER_COUNTER_RESUME_REQUEST_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING:             return "resume_request_ignored_failed_to_add_encryption_mapping";
+            case SERVER_COUNTER_PING_PACKETS_RECEIVED:                                               return "ping_packets_received";
+            case SERVER_COUNTER_PING_IGNORED_RATE_LIMITED:                                           return "ping_ignored_rate_limited";
+            case SERVER_COUNTER_CLIENT_CONNECTS:                                                     return "client_connects";
+            case SERVER_COUNTER_CLIENT_DISCONNECTS:                                                  return "client_disconnects";
+            case SERVER_COUNTER_CLIENT_ADDRESS_MIGRATIONS:                                           return "client_address_migrations";
+            case SERVER_COUNTER_CLIENT_HANDOFFS:                                                     return "client_handoffs";
+            case SERVER_COUNTER_CLIENT_HANDOFFS_ACCEPTED:                                            return "client_handoffs_accepted";
+            case SERVER_COUNTER_CLIENT_CLEAN_DISCONNECTS:                                            return "client_clean_disconnects";
+            case SERVER_COUNTER_CLIENT_TIMEOUTS:                                                     return "client_timeouts";
+            case SERVER_COUNTER_CLIENT_ALLOCATOR_ERRORS:                                             return "client_allocator_errors";
+            case SERVER_COUNTER_CLIENT_CONNECTION_ERRORS:                                            return "client_connection_errors";
+            case SERVER_COUNTER_CLIENT_MESSAGE_FACTORY_ERRORS:                                       return "client_message_factory_errors";
+            case SERVER_COUNTER_CLIENT_PACKET_FACTORY_ERRORS:                                        return "client_packet_factory_errors";
+            case SERVER_COUNTER_GLOBAL_PACKET_FACTORY_ERRORS:                                        return "global_packet_factory_errors";
+            case SERVER_COUNTER_GLOBAL_ALLOCATOR_ERRORS:                                             return "global_allocator_errors";
+            case SERVER_COUNTER_OVERLOADED_TICKS:                                                    return "overloaded_ticks";
+            case SERVER_COUNTER_RECEIVE_PACKETS_DEFERRED:                                            return "receive_packets_deferred";
+            default:
+                assert( false );
+                return "???";
+        }
+    }
+
     /**
         The action taken by the server in response to a connection request packet.
 
@@ -181,7 +630,9 @@ namespace yojimbo
         SERVER_CONNECTION_REQUEST_IGNORED_CONNECT_TOKEN_ALREADY_USED,                           ///< The server ignored the connection request because another client has already used that connect token to connect to this server. This is bad.
         SERVER_CONNECTION_REQUEST_IGNORED_FAILED_TO_GENERATE_CHALLENGE_TOKEN,                   ///< The server ignored the connection request because it couldn't generate a challenge token. This is bad.
         SERVER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ALLOCATE_CHALLENGE_PACKET,                  ///< The server ignored the connection request because it couldn't allocate a challenge packet to send back to the client. This is bad.
-        SERVER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ENCRYPT_CHALLENGE_TOKEN                     ///< The server ignored the connection request because it couldn't encrypt the challenge token to send back to the client. This is bad.
+        SERVER_CONNECTION_REQUEST_IGNORED_FAILED_TO_ENCRYPT_CHALLENGE_TOKEN,                    ///< The server ignored the connection request because it couldn't encrypt the challenge token to send back to the client. This is bad.
+        SERVER_CONNECTION_REQUEST_IGNORED_ADDRESS_RATE_LIMITED,                                 ///< The server dropped the connection request without decrypting it, because the source address is sending connection requests too quickly.
+        SERVER_CONNECTION_REQUEST_IGNORED_SUBNET_RATE_LIMITED                                   ///< The server dropped the connection request without decrypting it, because the source subnet is sending connection requests too quickly.
     };
 
     /**
@@ -198,12 +649,51 @@ namespace yojimbo
         SERVER_CHALLENGE_RESPONSE_IGNORED_FAILED_TO_DECRYPT_CHALLENGE_TOKEN,                    ///< The server ignored the challenge response because it could not decrypt the challenge token.
         SERVER_CHALLENGE_RESPONSE_IGNORED_ADDRESS_ALREADY_CONNECTED,                            ///< The server ignored the challenge response because a client with that address is already connected.
         SERVER_CHALLENGE_RESPONSE_IGNORED_CLIENT_ID_ALREADY_CONNECTED,                          ///< The server ignored the challenge response because a client with that client id is already connected.
+        SERVER_CHALLENGE_RESPONSE_IGNORED_CHALLENGE_TOKEN_EXPIRED,                              ///< The server ignored the challenge response because the connect token it corresponds to has expired. Stateless challenge only.
+        SERVER_CHALLENGE_RESPONSE_IGNORED_CONNECT_TOKEN_ALREADY_USED,                           ///< The server ignored the challenge response because another client has already used that connect token to connect to this server. Stateless challenge only.
+        SERVER_CHALLENGE_RESPONSE_IGNORED_FAILED_TO_ADD_ENCRYPTION_MAPPING,                     ///< The server ignored the challenge response because it could not add an encryption mapping for that client. Stateless challenge only.
     };
 
     /**
         Server flags are used to enable and disable server features.                            
      */
 
+    /**
+        A job function run by the job scheduler.
+
+        @param context The context pointer passed to JobScheduler::Run.
+        @param index The index of the job in [0,numJobs-1].
+     */
+
+    typedef void (*JobFunction)( void * context, int index );
+
+    /**
+        Interface for running server work across multiple threads.
+
+        Implement this interface on top of your own thread pool or job system and pass it to Server::SetJobScheduler. The server uses it to generate packets, process received packets and advance time for each connected client in parallel, and to decrypt connect tokens for bursts of connection requests.
+
+        Each job only touches the data belonging to one client or one connection request, so jobs may be run in any order and on any thread, but JobScheduler::Run must not return until every job has finished.
+
+        @see Server::SetJobScheduler
+     */
+
+    class JobScheduler
+    {
+    public:
+
+        virtual ~JobScheduler() {}
+
+        /**
+            Run a set of jobs and wait for all of them to complete.
+
+            @param function The job function to call for each job.
+            @param context The context pointer to pass to each job.
+            @param numJobs The number of jobs to run. Call the job function once for each index in [0,numJobs-1].
+         */
+
+        virtual void Run( JobFunction function, void * context, int numJobs ) = 0;
+    };
+
     enum ServerFlags
     {
         SERVER_FLAG_IGNORE_CONNECTION_REQUESTS = (1<<0),                                        ///< When this flag is set the server ignores all connection requests.
@@ -213,6 +703,88 @@ namespace yojimbo
 #endif // #if !YOJIMBO_SECURE_MODE
     };
 
+    /**
+        A snapshot of how loaded a dedicated server is.
+
+        Dedicated servers report this to the matcher periodically with Matcher::ReportServerLoad, so the matcher can order the server addresses in connect tokens by real load instead of a static assignment.
+
+        @see Server::GetLoadReport
+     */
+
+    struct ServerLoadReport
+    {
+        Address serverAddress;                                              ///< The address clients connect to this server on. See Server::SetServerAddress.
+
+        int numConnectedClients;                                            ///< The number of clients connected to the server.
+
+        int maxClients;                                                     ///< The number of client slots on the server.
+
+        float tickHeadroom;                                                 ///< The fraction of the tick interval left over after the server tick, in [0,1]. Servers close to zero are overloaded, even if they have free slots.
+
+        uint64_t packetsSent;                                               ///< Number of packets sent by the server transport. See TRANSPORT_COUNTER_PACKETS_SENT.
+
+        uint64_t packetsReceived;                                           ///< Number of packets received by the server transport. See TRANSPORT_COUNTER_PACKETS_RECEIVED.
+
+        uint64_t packetsDropped;                                            ///< Number of packets dropped because the transport send or receive queue overflowed.
+
+        ServerLoadReport()
+        {
+            numConnectedClients = 0;
+            maxClients = 0;
+            tickHeadroom = 1.0f;
+            packetsSent = 0;
+            packetsReceived = 0;
+            packetsDropped = 0;
+        }
+    };
+
+    /**
+        The memory a client server config takes, so it can be sized before the server is started.
+
+        Per-client memory is dominated by the channel configs: message send and receive queue sizes, sent packet buffer sizes, messages per-packet and block sizes are all allocated up front by each connection.
+
+        @see CalculateMemoryFootprint
+     */
+
+    struct MemoryFootprint
+    {
+        uint64_t clientHeapBytes;                                           ///< Memory taken up front from each client heap by the packet factory, replay protection, message factory and connection, including heap overhead (bytes). The same for the client and for each client slot on the server.
+
+        uint64_t connectionBytes;                                           ///< The part of clientHeapBytes taken by the connection: channels, message queues, sent and received packet buffers and block buffers (bytes). Zero if messages are disabled.
+
+        int64_t clientHeadroomBytes;                                        ///< ClientServerConfig::clientMemory minus clientHeapBytes. What is left in the client heap for packets and messages in flight (bytes). Negative if the client resources don't fit.
+
+        int64_t serverClientHeadroomBytes;                                  ///< ClientServerConfig::serverPerClientMemory minus clientHeapBytes. What is left in each client slot heap for packets and messages in flight (bytes). Negative if the client resources don't fit.
+
+        uint64_t serverClientDataBytes;                                     ///< Memory the server allocates for client slot bookkeeping outside the client heaps: client state, address and id maps, timers, connect token tables and queued packets (bytes).
+
+        uint64_t serverBytes;                                               ///< Total memory the server takes in Server::Start: global memory, the heap for each client slot, heap allocators and client slot bookkeeping (bytes). Includes memory reserved from the operating system, eg. with ClientServerConfig::serverReserveClientMemory.
+
+        MemoryFootprint()
+        {
+            clientHeapBytes = 0;
+            connectionBytes = 0;
+            clientHeadroomBytes = 0;
+            serverClientHeadroomBytes = 0;
+            serverClientDataBytes = 0;
+            serverBytes = 0;
+        }
+    };
+
+    /**
+        Calculate the memory a client server config takes on the client and on a server.
+
+        The client resources are created in a scratch heap and measured, so the result is exact for this build, including heap overhead. Assumes packet and message factories with no members of their own, like the ones declared with YOJIMBO_PACKET_FACTORY_START and YOJIMBO_MESSAGE_FACTORY_START, and the default Server::CreateAllocator and Client::CreateAllocator.
+
+        @param config The client server config.
+        @param maxClients The number of client slots the server is started with.
+        @param numPacketTypes The number of packet types in the packet factory. CLIENT_SERVER_NUM_PACKETS unless you add your own packet types.
+        @param numMessageTypes The number of message types in the message factory.
+        @param footprint The memory footprint (out).
+     */
+
+    void CalculateMemoryFootprint( const ClientServerConfig & config, int maxClients, int numPacketTypes, int numMessageTypes, MemoryFootprint & footprint );
+
     /** 
         A server with n slots for clients to connect to.
 
@@ -266,6 +838,30 @@ namespace yojimbo
 
         void SetUserContext( void * context );
 
+        /**
+            Set the job scheduler.
+
+            By default the server does all its work on the thread that calls it. When a job scheduler is set, the per-client work in Server::SendPackets, Server::ReceivePackets and Server::AdvanceTime is split into one job per connected client and run with the job scheduler. This covers generating connection packets, processing connection packets received from clients and advancing connection time, which is where most of the server's time goes when there are many clients.
+
+            Connection requests received in the same call to Server::ReceivePackets are queued, and their connect tokens are decrypted in parallel with one job per-request. This spreads the cost of decrypting connect tokens when many clients connect at once, eg. at the start of a match. The requests are then processed in the order they were received, so client slots are assigned exactly as they would be without a job scheduler.
+
+            Connection negotiation, serializing and encrypting packets, and sending and receiving packets on the transport stay on the calling thread.
+
+            IMPORTANT: While a job scheduler is set, the connection callbacks Server::OnConnectionPacketGenerated, Server::OnConnectionPacketAcked, Server::OnConnectionPacketReceived, Server::OnConnectionFragmentReceived and Server::OnConnectionBlockDataReceived are called from the job scheduler threads, possibly for several clients at the same time. Don't change the job scheduler in the middle of a server update.
+
+            @param jobScheduler The job scheduler to use. Pass in NULL to do all work on the calling thread (default).
+         */
+
+        void SetJobScheduler( JobScheduler * jobScheduler );
+
+        /**
+            Get the job scheduler.
+
+            @returns The job scheduler set with Server::SetJobScheduler, or NULL if there is none.
+         */
+
+        JobScheduler * GetJobScheduler() { return m_jobScheduler; }
+
         /**      
             Set the server IP address. 
 
@@ -276,17 +872,29 @@ namespace yojimbo
 
         void SetServerAddress( const Address & address );
 
+        /**
+            Set a second server IP address, in the other IP family to the server address.
+
+            Servers on a dual-stack transport (see SOCKET_FLAG_DUAL_STACK) are reachable on a public IPv4 address and a public IPv6 address. Connect tokens listing either address are accepted, so IPv4 and IPv6 clients share one server and one set of client slots.
+
+            @param address The server address in the other IP family. Pass an invalid address to clear it.
+
+            @see Server::SetServerAddress
+         */
+
+        void SetServerAlternateAddress( const Address & address );
+
         /**
             Start the server and allocate client slots.
             
             Each client that connects to this server occupies one of the client slots allocated by this function.
 
-            @param maxClients The number of client slots to allocate. Must be in range [1,MaxClients]
+            @param maxClients The number of client slots to allocate. Must be in range [1,MaxClients]. All per-client data is allocated from the server allocator according to this value.
 
             @see Server::Stop
          */
 
-        void Start( int maxClients = MaxClients );
+        void Start( int maxClients = DefaultMaxClients );
 
         /**
             Stop the server and free client slots.
@@ -323,6 +931,44 @@ namespace yojimbo
 
         void DisconnectAllClients( bool sendDisconnectPacket = true );
 
+        /**
+            Hand off a connected client to another server, without the client reconnecting.
+
+            The session of the client is written to a blob: its encryption keys, packet sequence numbers, replay protection window and the state of its reliable-ordered channels. The blob is encrypted with the private key, so it can only be read by servers sharing the same private key. Pass it to the other server through your backend, and call Server::AcceptClientHandoff there.
+
+            The client is told to switch to the other server address, and is removed from this server without sending disconnect packets. Messages queued for the client carry over, and are delivered by the other server.
+
+            IMPORTANT: The other server must accept the handoff within ClientServerConfig::connectionTimeOut, otherwise the client times out. The blob expires after this time as well.
+
+            The handoff fails if the client connected insecurely, if a reliable-ordered channel is part way through receiving a block, or if a broadcast message is waiting to be acked. The client stays connected to this server in that case. Unreliable and snapshot channel state is not carried over.
+
+            @param clientIndex The index of the client to hand off, in [0,maxClients-1].
+            @param serverAddress The address of the server taking over the client. Sent to the client.
+            @param sessionData The buffer the session blob is written to.
+            @param maxSessionBytes The size of the session data buffer (bytes).
+
+            @returns The size of the session blob (bytes), or zero if the client could not be handed off.
+
+            @see Server::AcceptClientHandoff
+         */
+
+        int HandoffClient( int clientIndex, const Address & serverAddress, uint8_t * sessionData, int maxSessionBytes );
+
+        /**
+            Accept a client handed off from another server.
+
+            The client is connected to a free client slot and carries on with the session from the other server. Server::OnClientConnect is called for it, the same as for a client that connects normally.
+
+            @param sessionData The session blob written by Server::HandoffClient on the other server.
+            @param sessionBytes The size of the session blob (bytes).
+
+            @returns The client index the client was connected to, or -1 if the blob is invalid or has expired, the server is full, or a client with the same address or client id is already connected.
+
+            @see Server::HandoffClient
+         */
+
+        int AcceptClientHandoff( const uint8_t * sessionData, int sessionBytes );
+
         /**
             Send packets to connected clients.
          
@@ -346,9 +992,9 @@ namespace yojimbo
         /**
             Check for timeouts.
 
-            Walks across the set of connected clients and compares the last time a packet was received from that client vs. the current time.
+            Each connected client has a timer in a timer wheel, so only clients whose timer has expired are checked. For those clients, the last time a packet was received from that client is compared vs. the current time.
 
-            If no packet has been received within the timeout period, the client is disconnected and its client slot is made available for other clients to connect to.
+            If no packet has been received within the timeout period, the client is disconnected and its client slot is made available for other clients to connect to. Otherwise, the timer is rescheduled for the new deadline.
 
             @see Server::AdvanceTime
             @see ClientServerConfig::connectionTimeOut
@@ -367,6 +1013,18 @@ namespace yojimbo
 
         void AdvanceTime( double time );
 
+        /**
+            Get the next time the server has something to do without receiving packets.
+
+            This is the earliest connection packet send, keep-alive, resume token refresh or timeout over all connected clients. Use this to drive the server in virtual time, jumping straight to the next event instead of stepping time in small increments. See Client::GetNextEventTime.
+
+            IMPORTANT: This walks every client slot, so it is meant for simulations and tests rather than calling every frame on a full server.
+
+            @returns The time of the next server event. The current time if something is due now. NoEventTime if the server is not running or has no connected clients.
+         */
+
+        double GetNextEventTime() const;
+
         /**
             Is the server running?
 
@@ -380,64 +1038,175 @@ namespace yojimbo
         bool IsRunning() const;
 
         /**
-            Get the maximum number of clients that can connect to the server.
+            Get the maximum number of clients that can connect to the server.
+
+            Corresponds to the maxClients parameter passed into the last call to Server::Start.
+
+            @returns The maximum number of clients that can connect to the server. In other words, the number of client slots.
+         */
+
+        int GetMaxClients() const;
+
+        /**
+            Is a client connected to a client slot?
+
+            @param clientIndex the index of the client slot in [0,maxClients-1], where maxClients corresponds to the value passed into the last call to Server::Start.
+
+            @returns True if the client is connected.
+         */
+
+        bool IsClientConnected( int clientIndex ) const;
+
+        /**
+            Does a client slot have its per-client resources?
+
+            Slots past ClientServerConfig::serverPrewarmedClients create their packet factory, replay protection, message factory and connection the first time a client connects to them.
+
+            @param clientIndex the index of the client slot in [0,maxClients-1], where maxClients corresponds to the value passed into the last call to Server::Start.
+
+            @returns True if the per-client resources for the slot have been created.
+         */
+
+        bool HasClientResources( int clientIndex ) const;
+
+        /** 
+            Get the number of clients that are currently connected to the server.
+
+            @returns the number of connected clients.
+         */
+
+        int GetNumConnectedClients() const;
+
+        /**
+            Get a load report for this server, to send to the matcher.
+
+            The server tick is mostly game code, so the server can't measure its own tick time. Measure how long your tick takes and pass in the headroom.
+
+            @param report The load report to fill [out].
+            @param tickHeadroom The fraction of the tick interval left over after the last tick, in [0,1]. eg. 0.75 if a 60HZ tick took 4ms.
+
+            @see Matcher::ReportServerLoad
+         */
+
+        void GetLoadReport( ServerLoadReport & report, float tickHeadroom ) const;
+
+        /**
+            Find the client index for the client with the specified client id.
+
+            This is an O(1) hash lookup, so it's safe to call per-packet even on servers with a large number of client slots.
+
+            @returns The client index if a client with the client id is connected to the server, otherwise -1.
+         */
+
+        int FindClientIndex( uint64_t clientId ) const;
+
+        /**
+            Find the client index for the client with the specified address.
+
+            This is an O(1) hash lookup. It's called for every packet received from a connected client.
+
+            @returns The client index if a client with the address is connected to the server, otherwise -1.
+         */
+
+        int FindClientIndex( const Address & address ) const;
+
+        /**
+            Get the client id for the client at the specified client index.
+
+            @returns The client id of the client.
+         */
+
+        uint64_t GetClientId( int clientIndex ) const;
+
+        /**
+            Get the address of the client at the specified client index.
+
+            @returns The address of the client.
+         */
+
+        const Address & GetClientAddress( int clientIndex ) const;
+
+        /**
+            Set the rate connection packets are sent to a client.
+
+            Use this to send packets less frequently to clients that don't need a full rate update, eg. spectators. Keep-alive packets are still sent at ClientServerConfig::connectionKeepAliveSendRate if no other packets are sent to the client.
+
+            IMPORTANT: The send rate is reset to ClientServerConfig::serverClientSendRate each time a client connects to the client slot.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+            @param sendRate The send rate in packets per-second. Zero sends a connection packet to the client on every call to Server::SendPackets.
+         */
+
+        void SetClientSendRate( int clientIndex, float sendRate );
+
+        /**
+            Get the rate connection packets are sent to a client.
 
-            Corresponds to the maxClients parameter passed into the last call to Server::Start.
+            @param clientIndex The index of the client slot in [0,maxClients-1].
 
-            @returns The maximum number of clients that can connect to the server. In other words, the number of client slots.
+            @returns The send rate in packets per-second. Zero if a connection packet is sent to the client on every call to Server::SendPackets.
+
+            @see Server::SetClientSendRate
          */
 
-        int GetMaxClients() const;
+        float GetClientSendRate( int clientIndex ) const;
 
         /**
-            Is a client connected to a client slot?
-
-            @param clientIndex the index of the client slot in [0,maxClients-1], where maxClients corresponds to the value passed into the last call to Server::Start.
+            Set whether a client is low priority.
 
-            @returns True if the client is connected.
-         */
+            While the server is overloaded, low priority clients are sent connection packets at no more than ClientServerConfig::serverOverloadSendRate, so clients whose updates are critical stay on schedule. eg. spectators and idle players could be low priority.
 
-        bool IsClientConnected( int clientIndex ) const;
+            IMPORTANT: Clients are not low priority when they connect to the client slot.
 
-        /** 
-            Get the number of clients that are currently connected to the server.
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+            @param lowPriority True if the client is low priority.
 
-            @returns the number of connected clients.
+            @see Server::IsOverloaded
          */
 
-        int GetNumConnectedClients() const;
+        void SetClientLowPriority( int clientIndex, bool lowPriority );
 
         /**
-            Find the client index for the client with the specified client id.
+            Is a client low priority?
 
-            @returns The client index if a client with the client id is connected to the server, otherwise -1.
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+
+            @returns True if the client is low priority, false otherwise.
+
+            @see Server::SetClientLowPriority
          */
 
-        int FindClientIndex( uint64_t clientId ) const;
+        bool IsClientLowPriority( int clientIndex ) const;
 
         /**
-            Find the client index for the client with the specified address.
+            Is the server overloaded?
 
-            @returns The client index if a client with the address is connected to the server, otherwise -1.
+            The server is overloaded once the work it did in a tick went over ClientServerConfig::serverTickBudget, and stays overloaded until a tick takes less than half the budget. This is checked each time Server::AdvanceTime is called.
+
+            @returns True if the server is shedding load, false otherwise.
          */
 
-        int FindClientIndex( const Address & address ) const;
+        bool IsOverloaded() const;
 
         /**
-            Get the client id for the client at the specified client index.
+            Get the time the server spent on the last tick.
 
-            @returns The client id of the client.
+            Measures the time spent in Server::AdvanceTime, Server::ReceivePackets and Server::SendPackets, from one call to Server::AdvanceTime to the next.
+
+            @returns The time spent on the last tick (seconds).
          */
 
-        uint64_t GetClientId( int clientIndex ) const;
+        double GetTickTime() const;
 
         /**
-            Get the address of the client at the specified client index.
+            Is server memory backed by huge pages?
 
-            @returns The address of the client.
+            Only true if ClientServerConfig::serverHugePageMemory is set and the global memory and the memory for every client slot were all backed by huge pages when the server started. If this is false with huge page memory enabled, some of the memory fell back to regular pages, eg. because no huge pages were set aside on Linux (see /proc/sys/vm/nr_hugepages) or the process lacks the "Lock pages in memory" privilege on Windows.
+
+            @returns True if all server memory is backed by huge pages, false otherwise.
          */
 
-        const Address & GetClientAddress( int clientIndex ) const;
+        bool IsUsingHugePages() const;
 
         /**
             Get the server address.
@@ -483,6 +1252,31 @@ namespace yojimbo
 
         uint64_t GetCounter( int index ) const;
 
+        /**
+            Get network statistics for the connection to a client.
+
+            RTT, jitter, packet loss and bandwidth are estimated by the connection from connection packets and their acks. They are useful for debugging, telemetry and adapting send rates to network conditions.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+            @param info The network info struct to fill. All values are zero if the client is not connected, or the server has no connection objects.
+
+            @see Connection::GetNetworkInfo
+         */
+
+        void GetClientNetworkInfo( int clientIndex, NetworkInfo & info ) const;
+
+        /**
+            Get the connection object for a client.
+
+            Lets telemetry read per-client connection and channel counters. See MetricsSnapshot::AddServer.
+
+            @param clientIndex The index of the client slot in [0,maxClients-1].
+
+            @returns The connection for the client, or NULL if the client is not connected, or the server has no connection objects.
+         */
+
+        const Connection * GetClientConnection( int clientIndex ) const;
+
         /** 
             Reset all counters to zero.
 
@@ -552,6 +1346,79 @@ namespace yojimbo
 
         void SendMsg( int clientIndex, Message * message, int channelId = 0 );
 
+        /**
+            Queue a batch of messages to be sent to a client.
+
+            Equivalent to calling Server::SendMsg for each message, except the client lookup and the channel send queue check are done once for the whole batch. If the send queue doesn't have room for all of the messages, none of them are queued and the client is disconnected with a runtime error, just like Server::SendMsg.
+
+            IMPORTANT: This function takes ownership of all messages in the array.
+
+            @param clientIndex The index of the client the messages will be sent to.
+            @param messages The array of messages to be sent. They must be allocated from the message factory set on this client.
+            @param numMessages The number of messages in the array.
+            @param channelId The id of the channel to send the messages across in [0,numChannels-1].
+
+            @see Server::SendMsg
+         */
+
+        void SendMsgs( int clientIndex, Message ** messages, int numMessages, int channelId = 0 );
+
+        /**
+            Create a message of the specified type to broadcast to all connected clients.
+
+            The message is created with the global message factory, instead of the message factory of any particular client. It is typically passed to Server::BroadcastMsg, which takes ownership of the message pointer and will release it for you.
+
+            If you don't end up broadcasting the message, you are responsible for releasing it via Server::ReleaseBroadcastMsg.
+
+            @param type The message type. The set of message types is the same as the per-client message factories.
+
+            @returns A pointer to the message created, or NULL if no message could be created.
+
+            @see Server::BroadcastMsg
+         */
+
+        Message * CreateBroadcastMsg( int type );
+
+        /**
+            Queue a message to be sent to all connected clients.
+
+            The message is measured once and wrapped in a single BroadcastMessage, which is shared by the connections of all connected clients. Each bit alignment the message is written at is serialized once, and the bits are copied into the packets sent to every client, so broadcasting to many clients costs roughly the same as serializing for one.
+
+            IMPORTANT: This function takes ownership of the message and ensures that the message is released once it has finished being sent to all clients. Block messages can't be broadcast.
+
+            @param message The message to broadcast. It must be created with Server::CreateBroadcastMsg.
+            @param channelId The id of the channel to send the message across in [0,numChannels-1].
+
+            @see BroadcastMessage
+         */
+
+        void BroadcastMsg( Message * message, int channelId = 0 );
+
+        /**
+            Broadcast a copy of a message received from somewhere else to all connected clients.
+
+            This is the building block of spectator fan-out trees. The game server sends one stream of messages to each spectator relay, which connects to it as a regular client. Each relay runs its own server for spectators, and forwards every message it receives from the game server with this function. The message is copied into the global message factory once, then broadcast as with Server::BroadcastMsg, so it is serialized once per bit alignment for all spectators on the relay. Only the per-spectator packet encryption scales with the number of spectators, and that cost is paid by the relays instead of the game server. Relays can connect to other relays to build deeper trees.
+
+            The copy is made by serializing the message, so it must not depend on the stream context. Unlike Server::BroadcastMsg, this does not take ownership of the message. Release it back to the client or server it was received from as usual.
+
+            @param message The message to forward, eg. a message received with Client::ReceiveMsg. Block messages can't be broadcast.
+            @param channelId The id of the channel to send the message across in [0,numChannels-1].
+
+            @returns True if the message was broadcast, false if it is a block message or could not be copied.
+
+            @see Server::BroadcastMsg
+         */
+
+        bool ForwardBroadcastMsg( Message * message, int channelId = 0 );
+
+        /**
+            Release a message created with Server::CreateBroadcastMsg that was not broadcast.
+
+            @param message The message to release. Must be non-NULL.
+         */
+
+        void ReleaseBroadcastMsg( Message * message );
+
         /** 
             Poll this method to receive messages sent from a client.
 
@@ -567,6 +1434,23 @@ namespace yojimbo
 
         Message * ReceiveMsg( int clientIndex, int channelId = 0 );
 
+        /** 
+            Receive a batch of messages sent from a client.
+
+            Fills the array with messages until the channel receive queue runs dry or the array is full.
+
+            IMPORTANT: Each message returned by this function has one reference. You are responsible for releasing these messages via Server::ReleaseMsg.
+
+            @param clientIndex The index of the client that we want to receive messages from.
+            @param messages The array of message pointers to fill [out].
+            @param maxMessages The size of the message pointer array.
+            @param channelId The id of the channel to receive messages from.
+
+            @returns The number of messages received in [0,maxMessages].
+         */
+
+        int ReceiveMsgs( int clientIndex, Message ** messages, int maxMessages, int channelId = 0 );
+
         /**
             Release a message returned by Server::ReceiveMsg.
 
@@ -601,7 +1485,7 @@ namespace yojimbo
 
             Typically, this means data structures that correspond to connection negotiation, processing connection requests and so on.
 
-            The amount of memory backing this allocator is specified by ClientServerConfig::serverGlobalMemory.
+            The amount of memory backing this allocator is specified by ClientServerConfig::serverGlobalMemory. Use Allocator::GetStats to see how much of it is used.
 
             @returns The global allocator.
          */
@@ -613,7 +1497,7 @@ namespace yojimbo
 
             Per-client allocations are allocations that are tied to a particular client index. The idea is to silo each client on the server to their own set of resources, making it impossible for a client to exhaust resources shared with other clients connected to the server.
 
-            The amount of memory backing this allocator is specified by ClientServerConfig::perClientMemory. There is one allocator per-client slot allocated in Server::Start. These allocators are undefined outside of Start/Stop and will assert in that case.
+            The amount of memory backing this allocator is specified by ClientServerConfig::serverPerClientMemory. There is one allocator per-client slot allocated in Server::Start. These allocators are undefined outside of Start/Stop and will assert in that case. Use Allocator::GetStats to see how much memory each client slot uses.
 
             @param clientIndex The index of the client.
 
@@ -705,6 +1589,19 @@ namespace yojimbo
 
         virtual void OnClientDisconnect( int clientIndex );
 
+        /**
+            Override this method to get a callback when a connected client moves to a new address.
+
+            This only happens when TRANSPORT_FLAG_ADDRESS_MIGRATION is set on the server transport, and an encrypted packet from the new address decrypted with the client's key. The client keeps its slot and connection state.
+
+            IMPORTANT: The client address has already been updated at the point this callback is made, so Server::GetClientAddress returns the new address.
+
+            @param clientIndex The client slot index of the client that moved.
+            @param from The address the client moved from.
+         */
+
+        virtual void OnClientMigrate( int clientIndex, const Address & from );
+
         /**
             Override this method to get a callback when an error occurs that will result in a client being disconnected from the server.
 
@@ -796,6 +1693,26 @@ namespace yojimbo
 
         virtual void OnConnectionFragmentReceived( Connection * connection, int channelId, uint16_t messageId, uint16_t fragmentId, int fragmentBytes, int numFragmentsReceived, int numFragmentsInBlock );
 
+        /**
+            Override this method to get block data as it is streamed in from a client.
+
+            Only called for channels with ChannelConfig::streamBlocks set. Block data is passed in order as soon as all data before it has been received, so large blocks can be processed incrementally and never have to be held in memory in full.
+
+            @param connection The connection that the block belongs to. To get the client index call Connection::GetClientIndex.
+            @param channelId The channel the block is being sent over.
+            @param messageId The message id the block is attached to.
+            @param blockMessage The message the block is attached to. It is received once the block completes, without the block attached.
+            @param blockOffset The offset of this data in the block (bytes).
+            @param data The block data. Only valid for the duration of the callback.
+            @param dataBytes The size of the block data (bytes).
+            @param blockComplete True if this is the end of the block.
+
+            @see Connection::GetClientIndex
+            @see ChannelConfig::streamBlocks
+         */
+
+        virtual void OnConnectionBlockDataReceived( Connection * connection, int channelId, uint16_t messageId, BlockMessage * blockMessage, int blockOffset, const uint8_t * data, int dataBytes, bool blockComplete );
+
         /** 
             Override this method to process user packets sent from a client.
 
@@ -839,12 +1756,32 @@ namespace yojimbo
 
         void SendPacket( const Address & address, Packet * packet, bool immediate = false );
 
+        bool SendPacketWithKeys( const Address & address, Packet * packet, const uint8_t * sendKey, const uint8_t * receiveKey );
+
         void SendPacketToConnectedClient( int clientIndex, Packet * packet, bool immediate = false );
 
+        bool SendSerializedPacketToConnectedClient( int clientIndex, int packetType, const uint8_t * packetData, int packetBytes, bool immediate = false );
+
         void ProcessConnectionRequest( const ConnectionRequestPacket & packet, const Address & address );
 
+        bool AcceptConnectionRequest( const ConnectionRequestPacket & packet, const Address & address );
+
+        void ProcessConnectionRequestToken( const ConnectionRequestPacket & packet, const Address & address, bool decrypted, const ConnectToken & connectToken );
+
+        void QueueConnectionRequest( ConnectionRequestPacket * packet, const Address & address );
+
+        bool FindCachedConnectToken( const ConnectionRequestPacket & packet, ConnectToken & connectToken );
+
+        void ProcessQueuedConnectionRequests();
+
+        static void DecryptConnectTokenJob( void * context, int index );
+
         void ProcessChallengeResponse( const ChallengeResponsePacket & packet, const Address & address );
 
+        void ProcessResumeRequest( const ResumeRequestPacket & packet, const Address & address );
+
+        void ProcessPing( const PingPacket & packet, const Address & address );
+
         void ProcessKeepAlive( const KeepAlivePacket & packet, const Address & address );
 
         void ProcessDisconnect( const DisconnectPacket & packet, const Address & address );
@@ -853,29 +1790,71 @@ namespace yojimbo
         void ProcessInsecureConnect( const InsecureConnectPacket & /*packet*/, const Address & address );
 #endif // #if !YOJIMBO_SECURE_MODE
 
-        void ProcessConnectionPacket( ConnectionPacket & packet, const Address & address );
+        void ProcessConnectionPacket( ConnectionPacket & packet, const Address & address, double receiveTime );
+
+        void ProcessPacket( Packet * packet, const Address & address, uint64_t sequence, double receiveTime );
 
-        void ProcessPacket( Packet * packet, const Address & address, uint64_t sequence );
+        void ProcessAddressMigrations();
+
+        void GenerateResumeToken( int clientIndex );
 
         KeepAlivePacket * CreateKeepAlivePacket( int clientIndex );
 
+        void SerializeKeepAlivePacket( int clientIndex );
+
         Transport * GetTransport() { return m_transport; }
 
     private:
 
         void Defaults();
 
+        void ReleaseBroadcastMessages( bool releaseAll );
+
+        void QueueConnectionPacket( int clientIndex, ConnectionPacket * packet, double receiveTime );
+
+        void ProcessQueuedConnectionPackets();
+
+        static void GeneratePacketJob( void * context, int index );
+
+        bool ClientReadyToSend( int clientIndex, double time ) const;
+
+        void ClientPacketGenerated( int clientIndex, double time );
+
+        float GetClientTickSendRate( int clientIndex ) const;
+
+        void UpdateOverload();
+
+        static void ProcessConnectionPacketsJob( void * context, int index );
+
+        static void AdvanceTimeJob( void * context, int index );
+
+        void AllocateClientData();
+
+        void FreeClientData();
+
+        void CreateClientResources( int clientIndex );
+
+        void DestroyClientResources( int clientIndex );
+
+        static void CreateClientResourcesJob( void * context, int index );
+
         ClientServerConfig m_config;                                        ///< The client/server configuration passed in to the constructor.
 
         Allocator * m_allocator;                                            ///< The allocator passed in to the constructor. All memory used by the server is allocated using this.
 
-        uint8_t * m_globalMemory;                                           ///< The block of memory backing the global allocator. Allocated with m_allocator.
+        uint8_t * m_globalMemory;                                           ///< The block of memory backing the global allocator. Allocated with m_allocator, or reserved from the operating system if ClientServerConfig::serverHugePageMemory is true.
+
+        uint8_t ** m_clientMemory;                                          ///< Array of memory blocks backing the per-client allocators. Allocated with m_allocator, or reserved from the operating system if ClientServerConfig::serverReserveClientMemory or ClientServerConfig::serverHugePageMemory is true.
 
-        uint8_t * m_clientMemory[MaxClients];                               ///< The block of memory backing the per-client allocators. Allocated with m_allocator.
+        size_t m_globalMemoryBytes;                                         ///< The size of the global memory block (bytes). Rounded up to a whole number of huge pages if ClientServerConfig::serverHugePageMemory is true.
+
+        size_t m_clientMemoryBytes;                                         ///< The size of each per-client memory block (bytes). Rounded up to a whole number of huge pages if ClientServerConfig::serverHugePageMemory is true.
+
+        bool m_hugePageMemory;                                              ///< True if the global memory and all per-client memory is backed by huge pages. See Server::IsUsingHugePages.
 
         Allocator * m_globalAllocator;                                      ///< The global allocator. This is used for allocations related to connection negotiation.
 
-        Allocator * m_clientAllocator[MaxClients];                          ///< Array of per-client allocator. These are used for allocations related to connected clients.
+        Allocator ** m_clientAllocator;                                     ///< Array of per-client allocator. These are used for allocations related to connected clients.
 
         Transport * m_transport;                                            ///< Transport interface for sending and receiving packets.
 
@@ -883,17 +1862,19 @@ namespace yojimbo
 
         TransportContext m_globalTransportContext;                          ///< Global transport context for reading and writing packets. Used for packets that don't belong to a connected client. eg. connection negotiation packets.
 
-        TransportContext m_clientTransportContext[MaxClients];              ///< Array of per-client transport contexts for reading and writing packets that belong to connected clients.
+        TransportContext * m_clientTransportContext;                        ///< Array of per-client transport contexts for reading and writing packets that belong to connected clients.
 
-        ConnectionContext m_clientConnectionContext[MaxClients];            ///< Connection context for reading and writing connection packets to connected clients. These packets contain messages sent between the client and server.
+        ConnectionContext * m_clientConnectionContext;                      ///< Array of per-client connection contexts for reading and writing connection packets to connected clients. These packets contain messages sent between the client and server.
 
         PacketFactory * m_globalPacketFactory;                              ///< Global packet factory for creating global packets such as connection request packets and challenge response packets sent during connection negotiation.
 
-        PacketFactory * m_clientPacketFactory[MaxClients];                  ///< Per-client packet factory for creating and destroying packets sent to and received from connected clients.
+        PacketFactory ** m_clientPacketFactory;                             ///< Per-client packet factory for creating and destroying packets sent to and received from connected clients.
 
-        MessageFactory * m_clientMessageFactory[MaxClients];                ///< Per-client message factory for creating and destroying messages. These are only allocated if ClientServerConfig::enableMessages is true.
+        MessageFactory ** m_clientMessageFactory;                           ///< Per-client message factory for creating and destroying messages. These are only allocated if ClientServerConfig::enableMessages is true.
 
-        ReplayProtection * m_clientReplayProtection[MaxClients];            ///< Per-client protection against packet replay attacks. Discards old and already received packets.
+        MessageFactory * m_globalMessageFactory;                            ///< Global message factory for creating messages broadcast to all clients. Only allocated if ClientServerConfig::enableMessages is true. See Server::BroadcastMsg.
+
+        ReplayProtection ** m_clientReplayProtection;                       ///< Per-client protection against packet replay attacks. Discards old and already received packets.
 
         uint8_t m_privateKey[KeyBytes];                                     ///< Private key used for encrypting and decrypting connect and challenge tokens. Must be the same between the matcher and the server and not know to clients.
 
@@ -903,31 +1884,81 @@ namespace yojimbo
 
         double m_time;                                                      ///< Current server time. See Server::AdvanceTime
 
+        double m_tickWorkTime;                                              ///< Time spent in Server::AdvanceTime, Server::ReceivePackets and Server::SendPackets since the last call to Server::AdvanceTime (seconds).
+
+        double m_tickTime;                                                  ///< Time spent on the last tick (seconds). See Server::GetTickTime.
+
+        bool m_overloaded;                                                  ///< True if the server is shedding load. See Server::IsOverloaded.
+
+        bool m_deferringBlocks;                                             ///< True if the client connections are holding back block fragments. Follows m_overloaded in Server::SendPackets.
+
         uint64_t m_flags;                                                   ///< Server flags. See Server::SetFlags.
 
         int m_maxClients;                                                   ///< The maximum number of clients supported by this server. Corresponds to maxClients passed in to the last Server::Start call.
 
         int m_numConnectedClients;                                          ///< The number of clients that are currently connected to the server.
         
-        bool m_clientConnected[MaxClients];                                 ///< Array of connected flags per-client. Provides quick testing if a client is connected by client index.
-        
-        uint64_t m_clientId[MaxClients];                                    ///< Array of client id values per-client. Provides quick access to client id by client index.
+        uint64_t * m_clientId;                                              ///< Array of client id values per-client. Provides quick access to client id by client index.
 
         Address m_serverAddress;                                            ///< The address of this server (the address that clients will be connecting to).
 
+        Address m_serverAlternateAddress;                                   ///< The address of this server in the other IP family, for dual-stack servers. Invalid if not set. See Server::SetServerAlternateAddress.
+
         uint64_t m_globalSequence;                                          ///< The global sequence number for packets sent not corresponding to any particular connected client, eg. packets sent as part of connection negotiation.
 
-        uint64_t m_clientSequence[MaxClients];                              ///< Per-client sequence number for packets sent to this client. Resets to zero each time the client slot is reset.
+        uint32_t m_disconnectPacketData[SerializedControlPacketBytes/4];    ///< Disconnect packet serialized once in Server::Start and sent to each client that is disconnected. Stored as words so it is 4 byte aligned. See Transport::SerializePacket.
+
+        int m_disconnectPacketBytes;                                        ///< The number of bytes of serialized disconnect packet data. 0 if the packet could not be serialized.
 
-        Address m_clientAddress[MaxClients];                                ///< Array of client addresses. Provides quick access to client address by client index.
+        Address * m_clientAddress;                                          ///< Array of client addresses. Provides quick access to client address by client index.
         
-        ServerClientData m_clientData[MaxClients];                          ///< Per-client data. This is the bulk of the data, and contains duplicates of data used for fast access.
+        AddressMap * m_clientAddressMap;                                    ///< Hash index from address to client index for connected clients. Updated in Server::ConnectClient and Server::DisconnectClient.
+
+        IdMap * m_clientIdMap;                                              ///< Hash index from client id to client index for connected clients. Updated in Server::ConnectClient and Server::DisconnectClient.
+
+        TimerWheel * m_clientTimerWheel;                                    ///< Time out timer per-client slot. Scheduled in Server::ConnectClient, cancelled in Server::DisconnectClient and checked in Server::CheckForTimeOut.
+
+        int * m_expiredClients;                                             ///< Client indices whose time out timer expired. Filled by TimerWheel::AdvanceTime in Server::CheckForTimeOut.
+
+        ServerClientData * m_clientData;                                    ///< Per-client data that is rarely accessed. Contains duplicates of data used for fast access.
+
+        uint8_t * m_clientTickMemory;                                       ///< Memory block backing m_clientTick. Allocated with one extra cache line, so m_clientTick can start on a cache line boundary.
+
+        ServerClientTickData * m_clientTick;                                ///< Per-client state touched every tick, one cache line per client. Indexed by client index.
 
         bool m_allocateConnections;                                         ///< True if we should allocate connection objects in start. This is true if ClientServerConfig::enableMessages is true.
 
-        Connection * m_clientConnection[MaxClients];                        ///< Per-client connection object. The connect object manages the set of channels and sending and receiving messages between client and server. Allocated in Server::Start according to maxClients and freed in Server::Stop.
+        ConnectTokenTable * m_connectTokenTable;                            ///< Table of recently used connect tokens. Used to avoid replay attacks of the same connect token for different addresses. Allocated in Server::Start and freed in Server::Stop.
 
-        ConnectTokenEntry m_connectTokenEntries[MaxConnectTokenEntries];    ///< Array of connect tokens entries. Used to avoid replay attacks of the same connect token for different addresses.
+        ConnectionRequestLimiter * m_connectionRequestLimiter;              ///< Rate limits connection requests per source address and subnet before the connect token is decrypted. NULL if ClientServerConfig::serverConnectionRequestRate is zero. Allocated in Server::Start and freed in Server::Stop.
+
+        ConnectionRequestLimiter * m_pingLimiter;                           ///< Rate limits pings per source address. NULL if ClientServerConfig::enableServerPing is false or ClientServerConfig::serverPingRate is zero. Allocated in Server::Start and freed in Server::Stop.
+
+        ConnectTokenCache * m_connectTokenCache;                            ///< Cache of recently decrypted connect tokens and the challenge tokens generated for them. NULL if ClientServerConfig::serverConnectTokenCacheEntries is negative. Allocated in Server::Start and freed in Server::Stop.
+
+        JobScheduler * m_jobScheduler;                                      ///< The job scheduler for running per-client work in parallel. NULL if all work is done on the calling thread. See Server::SetJobScheduler.
+
+        int m_numJobClients;                                                ///< The number of entries in m_jobClients.
+
+        int * m_jobClients;                                                 ///< Client indices with a job to run. Each job index passed to the job functions maps to a client index via this array.
+
+        int * m_clientNumQueuedPackets;                                     ///< Per-client number of connection packets received and queued for processing by the job scheduler.
+
+        ConnectionPacket ** m_clientQueuedPackets;                          ///< Per-client queue of received connection packets waiting to be processed by the job scheduler. Sized ServerQueuedPacketsPerClient entries per-client.
+
+        double * m_clientQueuedPacketReceiveTimes;                          ///< Receive time of each packet in m_clientQueuedPackets. See Transport::ReceivePacket.
+
+        int m_numQueuedConnectionRequests;                                  ///< The number of connection requests queued for their connect tokens to be decrypted by the job scheduler.
+
+        ConnectionRequestPacket ** m_queuedConnectionRequests;              ///< Connection request packets queued in Server::ReceivePackets, in the order they were received. Sized ServerQueuedConnectionRequests.
+
+        Address * m_queuedConnectionRequestAddresses;                       ///< The address each queued connection request was received from.
+
+        ConnectToken * m_queuedConnectTokens;                               ///< The connect token decrypted from each queued connection request by Server::DecryptConnectTokenJob.
+
+        bool * m_queuedConnectTokenDecrypted;                               ///< True if the connect token for the queued connection request was decrypted successfully.
+
+        BroadcastMessage * m_broadcastMessages;                             ///< List of broadcast messages the server holds a reference to. Released in Server::AdvanceTime once no client connection references them. This way broadcast messages are only destroyed on the calling thread.
 
         uint64_t m_counters[NUM_SERVER_COUNTERS];                           ///< Array of server counters. Used for debugging, testing and telemetry in production environments.
 
@@ -937,12 +1968,146 @@ namespace yojimbo
         
         const Server & operator = ( const Server & other );
     };
+
+    /**
+        Updates several servers in the same process, running the work for each server as one job on a shared job scheduler.
+
+        Use this to host many matches in one process, each with its own Server and transport, eg. SharedServerTransport instances on one SharedServerSocket. Each server and its transport only touch their own data, so different servers can be updated at the same time on different threads.
+
+        Each update function runs one job per server with the job scheduler, or runs them in turn on the calling thread if there is no job scheduler. The function does not return until every server has been updated.
+
+        IMPORTANT: Don't set a job scheduler on the servers themselves with Server::SetJobScheduler while they are updated by a server group, since jobs run by the server would be run from inside a server group job. Servers in a group must also use separate allocators, or allocators that are safe to use from several threads at once.
+
+        @see JobScheduler
+        @see SharedServerSocket
+     */
+
+    class ServerGroup
+    {
+    public:
+
+        /**
+            Server group constructor.
+
+            @param allocator The allocator used for the server list.
+            @param maxServers The maximum number of servers in the group.
+         */
+
+        ServerGroup( Allocator & allocator, int maxServers );
+
+        /**
+            Server group destructor.
+
+            Servers and transports in the group are not destroyed.
+         */
+
+        ~ServerGroup();
+
+        /**
+            Set the job scheduler used to update servers in parallel.
+
+            @param jobScheduler The job scheduler. Pass in NULL to update servers in turn on the calling thread (default).
+         */
+
+        void SetJobScheduler( JobScheduler * jobScheduler );
+
+        /**
+            Add a server to the group.
+
+            @param server The server to add.
+            @param transport The transport the server was created with. The group reads and writes packets on it, and advances its time.
+
+            @returns True if the server was added, false if the group already has the maximum number of servers.
+         */
+
+        bool AddServer( Server & server, Transport & transport );
+
+        /**
+            Remove a server from the group.
+
+            @param server The server to remove. Does nothing if the server is not in the group.
+         */
+
+        void RemoveServer( Server & server );
+
+        /**
+            Get the number of servers in the group.
+
+            @returns The number of servers in [0,maxServers].
+         */
+
+        int GetNumServers() const;
+
+        /**
+            Get a server in the group.
+
+            @param index The server index in [0,GetNumServers()-1]. Removing a server moves the last server in the group to its index.
+
+            @returns The server.
+         */
+
+        Server & GetServer( int index );
+
+        /// Calls Server::SendPackets and then Transport::WritePackets for each server.
+
+        void SendPackets();
+
+        /// Calls Transport::ReadPackets and then Server::ReceivePackets for each server. When servers use a SharedServerSocket, call SharedServerSocket::ReceivePackets before this.
+
+        void ReceivePackets();
+
+        /// Calls Server::CheckForTimeOut for each server.
+
+        void CheckForTimeOut();
+
+        /**
+            Calls Server::AdvanceTime and then Transport::AdvanceTime for each server.
+
+            @param time The new time value in seconds.
+         */
+
+        void AdvanceTime( double time );
+
+    protected:
+
+        /// Runs a job for each server, with the job scheduler if there is one.
+
+        void RunJobs( JobFunction function );
+
+        static void SendPacketsJob( void * context, int index );
+
+        static void ReceivePacketsJob( void * context, int index );
+
+        static void CheckForTimeOutJob( void * context, int index );
+
+        static void AdvanceTimeJob( void * context, int index );
+
+    private:
+
+        Allocator * m_allocator;                                            ///< The allocator passed in to the constructor.
+
+        JobScheduler * m_jobScheduler;                                      ///< The job scheduler. NULL if servers are updated in turn on the calling thread.
+
+        int m_maxServers;                                                   ///< The maximum number of servers in the group.
+
+        int m_numServers;                                                   ///< The number of servers in the group.
+
+        Server ** m_servers;                                                ///< The servers in the group.
+
+        Transport ** m_transports;                                          ///< The transport of each server in the group.
+
+        double m_time;                                                      ///< The time passed in to ServerGroup::AdvanceTime, for the jobs it runs.
+
+        ServerGroup( const ServerGroup & other );
+        
+        const ServerGroup & operator = ( const ServerGroup & other );
+    };
 }
 
 /** 
     Helper macro to set the server allocator class.
 
-    You can use this macro to specify that the server uses your own custom allocator class. The default allocator to use is TLSF_Allocator. 
+    You can use this macro to specify that the server uses your own custom allocator class. The default allocator to use is TLSF_Allocator. Use ThreadedTLSF_Allocator if messages are released on a different thread to the one that creates them.
 
     The constructor of your derived allocator class must match the signature of the TLSF_Allocator constructor to work with this macro.
     
@@ -44,11 +44,16 @@
     #pragma comment( lib, "IPHLPAPI.lib" )
     #endif // #if YOJIMBO_SOCKETS
 
+    #if YOJIMBO_SOCKETS_RIO
+    #include <mswsock.h>
+    #endif // #if YOJIMBO_SOCKETS_RIO
+
 #elif YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC || YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX
 
     #include <netdb.h>
     #include <sys/types.h>
     #include <sys/socket.h>
+    #include <sys/select.h>
     #include <netinet/in.h>
     #include <ifaddrs.h>
     #include <net/if.h>
@@ -57,6 +62,84 @@
     #include <arpa/inet.h>
     #include <unistd.h>
     #include <errno.h>
+
+    #if YOJIMBO_SOCKETS_BATCH_IO
+    #include <sys/uio.h>
+    #endif // #if YOJIMBO_SOCKETS_BATCH_IO
+
+    #if YOJIMBO_SOCKETS_RECVMSG_X
+
+    #include <sys/uio.h>
+    #include <alloca.h>
+
+    // IMPORTANT: recvmsg_x is exported by libSystem, but it's only declared in the private kernel headers. This matches the declaration in xnu bsd/sys/socket.h.
+
+    struct msghdr_x
+    {
+        void * msg_name;
+        socklen_t msg_namelen;
+        struct iovec * msg_iov;
+        int msg_iovlen;
+        void * msg_control;
+        socklen_t msg_controllen;
+        int msg_flags;
+        size_t msg_datalen;
+    };
+
+    extern "C" ssize_t recvmsg_x( int s, const struct msghdr_x * msgp, u_int cnt, int flags );
+
+    #endif // #if YOJIMBO_SOCKETS_RECVMSG_X
+
+    #if YOJIMBO_SOCKETS_KQUEUE
+    #include <sys/event.h>
+    #include <time.h>
+    #endif // #if YOJIMBO_SOCKETS_KQUEUE
+
+    #ifdef __linux__
+    #include <linux/filter.h>
+    #include <linux/errqueue.h>
+    #endif // #ifdef __linux__
+
+    #if YOJIMBO_SOCKETS_TIMESTAMPS || YOJIMBO_SOCKETS_TXTIME
+    #include <time.h>
+    #endif // #if YOJIMBO_SOCKETS_TIMESTAMPS || YOJIMBO_SOCKETS_TXTIME
+
+    #if YOJIMBO_SOCKETS_TXTIME
+    #include <linux/net_tstamp.h>
+    #ifndef SO_TXTIME
+    #define SO_TXTIME 61
+    #define SCM_TXTIME SO_TXTIME
+    #endif // #ifndef SO_TXTIME
+    #ifndef SO_MAX_PACING_RATE
+    #define SO_MAX_PACING_RATE 47
+    #endif // #ifndef SO_MAX_PACING_RATE
+    #endif // #if YOJIMBO_SOCKETS_TXTIME
+
+    #if YOJIMBO_SOCKETS_IO_URING
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <signal.h>
+    #endif // #if YOJIMBO_SOCKETS_IO_URING
+
+    #if YOJIMBO_SOCKETS_AF_XDP
+    #include <linux/if_xdp.h>
+    #include <linux/if_link.h>
+    #include <linux/bpf.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <sys/ioctl.h>
+    #include <stddef.h>
+    #include <stdio.h>
+    #include <poll.h>
+    #include <dirent.h>
+    #ifndef AF_XDP
+    #define AF_XDP 44
+    #endif // #ifndef AF_XDP
+    #ifndef SOL_XDP
+    #define SOL_XDP 283
+    #endif // #ifndef SOL_XDP
+    #endif // #if YOJIMBO_SOCKETS_AF_XDP
     
 #else
 
@@ -65,248 +148,3670 @@
 #endif
 
 #include "yojimbo_sockets.h"
+#include "yojimbo_platform.h"
 
 #include <memory.h>
 #include <string.h>
 
 namespace yojimbo
 {
-    Socket::Socket( const Address & address, int sendBufferSize, int receiveBufferSize )
-    {
-        assert( IsNetworkInitialized() );
-
-        assert( address.IsValid() );
+    /**
+        Convert an address to a socket address to send to.
 
-        m_error = SOCKET_ERROR_NONE;
+        @param address The address to convert.
+        @param dualStack True if sending from a dual-stack IPv6 socket. IPv4 addresses are converted to IPv4-mapped IPv6 addresses, since a dual-stack socket only sends to IPv6 socket addresses.
+        @param socketAddress The socket address [out].
 
-        // create socket
+        @returns The size of the socket address (bytes), or 0 if the address is not valid.
+     */
 
-        m_socket = socket( ( address.GetType() == ADDRESS_IPV6 ) ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+    static int socket_address( const Address & address, bool dualStack, sockaddr_storage & socketAddress )
+    {
+        memset( &socketAddress, 0, sizeof( socketAddress ) );
 
-#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
-        if ( m_socket == INVALID_SOCKET )
-#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
-        if ( m_socket <= 0 )
-#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        if ( address.GetType() == ADDRESS_IPV6 )
         {
-            m_error = SOCKET_ERROR_CREATE_FAILED;
-            return;
+            sockaddr_in6 * socket_address = (sockaddr_in6*) &socketAddress;
+            socket_address->sin6_family = AF_INET6;
+            socket_address->sin6_port = htons( address.GetPort() );
+            memcpy( &socket_address->sin6_addr, address.GetAddress6(), sizeof( socket_address->sin6_addr ) );
+            return sizeof( sockaddr_in6 );
+        }
+        else if ( address.GetType() == ADDRESS_IPV4 && dualStack )
+        {
+            sockaddr_in6 * socket_address = (sockaddr_in6*) &socketAddress;
+            socket_address->sin6_family = AF_INET6;
+            socket_address->sin6_port = htons( address.GetPort() );
+            uint8_t * bytes = (uint8_t*) &socket_address->sin6_addr;
+            bytes[10] = 0xFF;
+            bytes[11] = 0xFF;
+            const uint32_t address4 = address.GetAddress4();
+            memcpy( bytes + 12, &address4, 4 );
+            return sizeof( sockaddr_in6 );
+        }
+        else if ( address.GetType() == ADDRESS_IPV4 )
+        {
+            sockaddr_in * socket_address = (sockaddr_in*) &socketAddress;
+            socket_address->sin_family = AF_INET;
+            socket_address->sin_addr.s_addr = address.GetAddress4();
+            socket_address->sin_port = htons( (unsigned short) address.GetPort() );
+            return sizeof( sockaddr_in );
         }
 
-        // force IPv6 only if necessary
+        return 0;
+    }
+
+#if YOJIMBO_SOCKETS_TIMESTAMPS
 
-        if ( address.GetType() == ADDRESS_IPV6 )
+    static const int SocketTimestampControlSize = int( CMSG_SPACE( sizeof( timespec ) ) );
+
+    /**
+        Find the kernel receive timestamp in a received message and convert it to platform_time.
+
+        The kernel stamps packets with CLOCK_REALTIME, so the timestamp is converted by working out how long ago the packet arrived.
+
+        @param message The received message. Its control data is searched for SCM_TIMESTAMPNS.
+        @param realTime CLOCK_REALTIME sampled after the message was received.
+        @param time platform_time sampled along with realTime. Returned if the message has no timestamp.
+
+        @returns The time the packet was received, in the same time base as platform_time.
+     */
+
+    static double socket_receive_time( msghdr & message, const timespec & realTime, double time )
+    {
+        for ( cmsghdr * cmsg = CMSG_FIRSTHDR( &message ); cmsg; cmsg = CMSG_NXTHDR( &message, cmsg ) )
         {
-            int yes = 1;
-            if ( setsockopt( m_socket, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&yes, sizeof(yes) ) != 0 )
-            {
-                m_error = SOCKET_ERROR_SOCKOPT_IPV6_ONLY_FAILED;
-                return;
-            }
+            if ( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS )
+                continue;
+
+            timespec timestamp;
+            memcpy( &timestamp, CMSG_DATA( cmsg ), sizeof( timestamp ) );
+
+            const double age = double( realTime.tv_sec - timestamp.tv_sec ) + double( realTime.tv_nsec - timestamp.tv_nsec ) / 1000000000.0;
+
+            return ( age > 0.0 ) ? time - age : time;
         }
 
-        // increase socket send and receive buffer sizes
+        return time;
+    }
 
-        if ( setsockopt( m_socket, SOL_SOCKET, SO_SNDBUF, (char*)&sendBufferSize, sizeof(int) ) != 0 )
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+
+#if YOJIMBO_SOCKETS_IO_URING
+
+    /// One io_uring instance. The submission and completion rings are shared with the kernel through a single mapping.
+
+    struct SocketUring
+    {
+        int fd;                                                     ///< The io_uring file descriptor. -1 if not created.
+        void * ringMemory;                                          ///< The mapping holding the submission and completion rings.
+        size_t ringMemorySize;                                      ///< The size of the ring mapping (bytes).
+        io_uring_sqe * sqes;                                        ///< The mapping holding the submission queue entries.
+        size_t sqesSize;                                            ///< The size of the submission queue entry mapping (bytes).
+        unsigned * sqHead;                                          ///< Submission ring head. Advanced by the kernel as it consumes entries.
+        unsigned * sqTail;                                          ///< Submission ring tail. Published by us when entries are submitted.
+        unsigned * sqFlags;                                         ///< Submission ring flags. The kernel sets IORING_SQ_TASKRUN here when completions are waiting to be posted.
+        unsigned * sqArray;                                         ///< Submission ring array of indices into sqes.
+        unsigned sqMask;                                            ///< Submission ring index mask.
+        unsigned sqEntries;                                         ///< Number of submission queue entries.
+        unsigned sqLocalTail;                                       ///< Tail including entries filled in but not yet submitted.
+        unsigned * cqHead;                                          ///< Completion ring head. Advanced by us as completions are consumed.
+        unsigned * cqTail;                                          ///< Completion ring tail. Advanced by the kernel as completions are posted.
+        unsigned cqMask;                                            ///< Completion ring index mask.
+        io_uring_cqe * cqes;                                        ///< The completion queue entries.
+    };
+
+    /// A send in flight. Holds a copy of the packet, since the caller's packet data can be reused as soon as Socket::SendPackets returns.
+
+    struct SocketRingSendSlot
+    {
+        msghdr message;                                             ///< The message header passed to IORING_OP_SENDMSG.
+        iovec buffer;                                               ///< The buffer pointing at the packet data.
+        sockaddr_storage address;                                   ///< The address the packet is sent to.
+        uint8_t data[SocketRingMaxPacketSize];                      ///< The packet data.
+    };
+
+    /**
+        The io_uring state for a socket created with SOCKET_FLAG_IO_URING.
+
+        Receives and sends use separate rings, so the receive thread of a ThreadedNetworkTransport and the thread sending packets never share a ring.
+     */
+
+    struct SocketRing
+    {
+        SocketUring receive;                                        ///< The ring the multishot receive is posted on.
+        SocketUring send;                                           ///< The ring sends are submitted on.
+        int socket;                                                 ///< The socket handle.
+        bool dualStack;                                             ///< True if the socket is a dual-stack IPv6 socket. See SOCKET_FLAG_DUAL_STACK.
+        io_uring_buf_ring * bufferRing;                             ///< The ring of receive buffers provided to the kernel. The kernel picks a buffer from here for each packet received.
+        uint16_t bufferRingTail;                                    ///< Tail of the buffer ring including buffers added but not yet published.
+        uint8_t * receiveBuffers;                                   ///< The receive buffers. Buffer i starts at receiveBuffers + i * receiveBufferSize.
+        int receiveBufferSize;                                      ///< The size of each receive buffer (bytes). Holds an io_uring_recvmsg_out header, the source address and the receive timestamp ahead of the packet data.
+        msghdr receiveMessage;                                      ///< Message header for the multishot receive. Only its name and control lengths are used, to lay out each receive buffer.
+        bool receiveArmed;                                          ///< True while the multishot receive is posted.
+        bool receiveUnsupported;                                    ///< True if the kernel rejected the multishot receive. The socket receives with recvmmsg instead.
+        SocketRingSendSlot * sendSlots;                             ///< The send slots.
+        int freeSendSlots[SocketRingNumSendSlots];                  ///< Stack of free send slot indices.
+        int numFreeSendSlots;                                       ///< Number of free send slots.
+        uint8_t * memory;                                           ///< The anonymous mapping holding the buffer ring, this structure, the send slots and the receive buffers.
+        size_t memorySize;                                          ///< The size of the anonymous mapping (bytes).
+    };
+
+    static const uint64_t SocketRingReceiveUserData = ~uint64_t( 0 );
+    static const uint64_t SocketRingCancelUserData = ~uint64_t( 0 ) - 1;
+
+    static size_t socket_ring_align( size_t value, size_t alignment )
+    {
+        return ( value + alignment - 1 ) & ~( alignment - 1 );
+    }
+
+    static int uring_enter( int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void * arg, size_t argSize )
+    {
+        return (int) syscall( __NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize );
+    }
+
+    static void uring_destroy( SocketUring & ring )
+    {
+        if ( ring.sqes )
+            munmap( ring.sqes, ring.sqesSize );
+        if ( ring.ringMemory )
+            munmap( ring.ringMemory, ring.ringMemorySize );
+        if ( ring.fd >= 0 )
+            close( ring.fd );
+        memset( &ring, 0, sizeof( ring ) );
+        ring.fd = -1;
+    }
+
+    static bool uring_create( SocketUring & ring, unsigned entries, unsigned completionEntries )
+    {
+        memset( &ring, 0, sizeof( ring ) );
+        ring.fd = -1;
+
+        // IMPORTANT: Cooperative task running stops the kernel interrupting this thread to post completions. Instead it sets IORING_SQ_TASKRUN,
+        // and completions are posted the next time we enter the kernel. This is what lets the receive path skip syscalls while nothing arrives.
+
+        io_uring_params params;
+        memset( &params, 0, sizeof( params ) );
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+        params.cq_entries = completionEntries;
+
+        ring.fd = (int) syscall( __NR_io_uring_setup, entries, &params );
+        if ( ring.fd < 0 )
         {
-            m_error = SOCKET_ERROR_SOCKOPT_SNDBUF_FAILED;
-            return;
+            ring.fd = -1;
+            return false;
         }
 
-        if ( setsockopt( m_socket, SOL_SOCKET, SO_RCVBUF, (char*)&receiveBufferSize, sizeof(int) ) != 0 )
+        if ( !( params.features & IORING_FEAT_SINGLE_MMAP ) || !( params.features & IORING_FEAT_EXT_ARG ) )
         {
-            m_error = SOCKET_ERROR_SOCKOPT_RCVBUF_FAILED;
-            return;
+            uring_destroy( ring );
+            return false;
         }
 
-        // bind to port
+        const size_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+        const size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
 
-        if ( address.GetType() == ADDRESS_IPV6 )
+        ring.ringMemorySize = ( sqRingSize > cqRingSize ) ? sqRingSize : cqRingSize;
+        ring.ringMemory = mmap( NULL, ring.ringMemorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING );
+        if ( ring.ringMemory == MAP_FAILED )
         {
-            sockaddr_in6 sock_address;
-            memset( &sock_address, 0, sizeof( sockaddr_in6 ) );
-            sock_address.sin6_family = AF_INET6;
-            memcpy( &sock_address.sin6_addr, address.GetAddress6(), sizeof( sock_address.sin6_addr ) );
-            sock_address.sin6_port = htons( address.GetPort() );
-
-            if ( ::bind( m_socket, (const sockaddr*) &sock_address, sizeof(sock_address) ) < 0 )
-            {
-                m_error = SOCKET_ERROR_BIND_IPV6_FAILED;
-                return;
-            }
+            ring.ringMemory = NULL;
+            uring_destroy( ring );
+            return false;
         }
-        else
-        {
-            sockaddr_in sock_address;
-            sock_address.sin_family = AF_INET;
-            sock_address.sin_addr.s_addr = address.GetAddress4();
-            sock_address.sin_port = htons( address.GetPort() );
 
-            if ( ::bind( m_socket, (const sockaddr*) &sock_address, sizeof(sock_address) ) < 0 )
-            {
-                m_error = SOCKET_ERROR_BIND_IPV4_FAILED;
-                return;
-            }
+        ring.sqesSize = params.sq_entries * sizeof( io_uring_sqe );
+        ring.sqes = (io_uring_sqe*) mmap( NULL, ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES );
+        if ( ring.sqes == MAP_FAILED )
+        {
+            ring.sqes = NULL;
+            uring_destroy( ring );
+            return false;
         }
 
-        m_address = address;
+        uint8_t * memory = (uint8_t*) ring.ringMemory;
 
-        // if bound to port 0 find the actual port we got
+        ring.sqHead = (unsigned*) ( memory + params.sq_off.head );
+        ring.sqTail = (unsigned*) ( memory + params.sq_off.tail );
+        ring.sqFlags = (unsigned*) ( memory + params.sq_off.flags );
+        ring.sqArray = (unsigned*) ( memory + params.sq_off.array );
+        ring.sqMask = *(unsigned*) ( memory + params.sq_off.ring_mask );
+        ring.sqEntries = params.sq_entries;
+        ring.sqLocalTail = *ring.sqTail;
 
-        if ( address.GetPort() == 0 )
-        {
-            if ( address.GetType() == ADDRESS_IPV6 )
-            {
-                struct sockaddr_in6 sin;
-                socklen_t len = sizeof( sin );
-                if ( getsockname( m_socket, (struct sockaddr*)&sin, &len ) == -1 )
-                {
-                    m_error = SOCKET_ERROR_GET_SOCKNAME_IPV6_FAILED;
-                    return;
-                }
-                m_address.SetPort( ntohs( sin.sin6_port ) );
-            }
-            else
-            {
-                struct sockaddr_in sin;
-                socklen_t len = sizeof( sin );
-                if ( getsockname( m_socket, (struct sockaddr*)&sin, &len ) == -1 )
-                {
-                    m_error = SOCKET_ERROR_GET_SOCKNAME_IPV4_FAILED;
-                    return;
-                }
-                m_address.SetPort( ntohs( sin.sin_port ) );
-            }
-        }
+        ring.cqHead = (unsigned*) ( memory + params.cq_off.head );
+        ring.cqTail = (unsigned*) ( memory + params.cq_off.tail );
+        ring.cqMask = *(unsigned*) ( memory + params.cq_off.ring_mask );
+        ring.cqes = (io_uring_cqe*) ( memory + params.cq_off.cqes );
 
-        // set non-blocking io
+        return true;
+    }
 
-        #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC || YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX
-    
-            int nonBlocking = 1;
-            if ( fcntl( m_socket, F_SETFL, O_NONBLOCK, nonBlocking ) == -1 )
-            {
-                m_error = SOCKET_ERROR_SET_NON_BLOCKING_FAILED;
-                return;
-            }
-        
-        #elif YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
-    
-            DWORD nonBlocking = 1;
-            if ( ioctlsocket( m_socket, FIONBIO, &nonBlocking ) != 0 )
-            {
-                m_error = SOCKET_ERROR_SET_NON_BLOCKING_FAILED;
-                return;
-            }
+    static io_uring_sqe * uring_get_sqe( SocketUring & ring )
+    {
+        if ( ring.sqLocalTail - __atomic_load_n( ring.sqHead, __ATOMIC_ACQUIRE ) >= ring.sqEntries )
+            return NULL;
 
-        #else
+        const unsigned index = ring.sqLocalTail & ring.sqMask;
 
-            #error unsupported platform
+        ring.sqArray[index] = index;
+        ring.sqLocalTail++;
 
-        #endif
+        io_uring_sqe * sqe = &ring.sqes[index];
+        memset( sqe, 0, sizeof( io_uring_sqe ) );
+        return sqe;
     }
 
-    Socket::~Socket()
+    static int uring_submit( SocketUring & ring )
     {
-        assert( IsNetworkInitialized() );
+        const unsigned toSubmit = ring.sqLocalTail - __atomic_load_n( ring.sqHead, __ATOMIC_ACQUIRE );
+        if ( toSubmit == 0 )
+            return 0;
 
-        if ( m_socket != 0 )
+        __atomic_store_n( ring.sqTail, ring.sqLocalTail, __ATOMIC_RELEASE );
+
+        return uring_enter( ring.fd, toSubmit, 0, 0, NULL, 0 );
+    }
+
+    static bool uring_has_completions( SocketUring & ring )
+    {
+        return *ring.cqHead != __atomic_load_n( ring.cqTail, __ATOMIC_ACQUIRE );
+    }
+
+    static io_uring_cqe * uring_peek_completion( SocketUring & ring )
+    {
+        if ( !uring_has_completions( ring ) )
         {
-            #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC || YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX
-            close( m_socket );
-            #elif YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
-            closesocket( m_socket );
-            #else
-            #error unsupported platform
-            #endif
-            m_socket = 0;
+            if ( !( __atomic_load_n( ring.sqFlags, __ATOMIC_RELAXED ) & IORING_SQ_TASKRUN ) )
+                return NULL;
+
+            uring_enter( ring.fd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0 );
+
+            if ( !uring_has_completions( ring ) )
+                return NULL;
         }
+
+        return &ring.cqes[*ring.cqHead & ring.cqMask];
     }
 
-    bool Socket::IsError() const
+    static void uring_completion_seen( SocketUring & ring )
     {
-        return m_error != SOCKET_ERROR_NONE;
+        __atomic_store_n( ring.cqHead, *ring.cqHead + 1, __ATOMIC_RELEASE );
     }
 
-    SocketError Socket::GetError() const
+    static bool uring_wait( SocketUring & ring, double timeout )
     {
-        return m_error;
+        if ( uring_peek_completion( ring ) )
+            return true;
+
+        __kernel_timespec waitTime;
+        waitTime.tv_sec = (int64_t) timeout;
+        waitTime.tv_nsec = (long long) ( ( timeout - waitTime.tv_sec ) * 1000000000.0 );
+
+        io_uring_getevents_arg arg;
+        memset( &arg, 0, sizeof( arg ) );
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t) (uintptr_t) &waitTime;
+
+        uring_enter( ring.fd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof( arg ) );
+
+        return uring_has_completions( ring );
     }
 
-    void Socket::SendPacket( const Address & to, const void * packetData, size_t packetBytes )
+    static void socket_ring_add_buffer( SocketRing * ring, int bufferId )
     {
-        assert( packetData );
-        assert( packetBytes > 0 );
-        assert( to.IsValid() );
-        assert( m_socket );
-        assert( !IsError() );
+        // IMPORTANT: In C++ the flexible bufs array in io_uring_buf_ring is declared after an empty struct, which shifts it off the start of the ring. The kernel expects the buffers at the start, so index from there directly.
 
-        if ( to.GetType() == ADDRESS_IPV6 )
-        {
-            sockaddr_in6 socket_address;
-            memset( &socket_address, 0, sizeof( socket_address ) );
-            socket_address.sin6_family = AF_INET6;
-            socket_address.sin6_port = htons( to.GetPort() );
-            memcpy( &socket_address.sin6_addr, to.GetAddress6(), sizeof( socket_address.sin6_addr ) );
-            sendto( m_socket, (const char*)packetData, (int) packetBytes, 0, (sockaddr*)&socket_address, sizeof( sockaddr_in6 ) );
-        }
-        else if ( to.GetType() == ADDRESS_IPV4 )
-        {
-            sockaddr_in socket_address;
-            memset( &socket_address, 0, sizeof( socket_address ) );
-            socket_address.sin_family = AF_INET;
-            socket_address.sin_addr.s_addr = to.GetAddress4();
-            socket_address.sin_port = htons( (unsigned short) to.GetPort() );
-            sendto( m_socket, (const char*)packetData, (int) packetBytes, 0, (sockaddr*)&socket_address, sizeof( sockaddr_in ) );
-        }
+        io_uring_buf * buffer = ( (io_uring_buf*) ring->bufferRing ) + ( ring->bufferRingTail & ( SocketRingNumReceiveBuffers - 1 ) );
+        buffer->addr = (uint64_t) (uintptr_t) ( ring->receiveBuffers + size_t( bufferId ) * ring->receiveBufferSize );
+        buffer->len = ring->receiveBufferSize;
+        buffer->bid = (uint16_t) bufferId;
+        ring->bufferRingTail++;
     }
 
-    int Socket::ReceivePacket( Address & from, void * packetData, int maxPacketSize )
+    static void socket_ring_publish_buffers( SocketRing * ring )
     {
-        assert( m_socket );
-        assert( packetData );
-        assert( maxPacketSize > 0 );
+        __atomic_store_n( &ring->bufferRing->tail, ring->bufferRingTail, __ATOMIC_RELEASE );
+    }
 
-#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
-        typedef int socklen_t;
-#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
-        
-        sockaddr_storage sockaddr_from;
-        socklen_t fromLength = sizeof( sockaddr_from );
+    static bool socket_ring_arm_receive( SocketRing * ring )
+    {
+        io_uring_sqe * sqe = uring_get_sqe( ring->receive );
+        if ( !sqe )
+            return false;
 
-        int result = recvfrom( m_socket, (char*)packetData, maxPacketSize, 0, (sockaddr*)&sockaddr_from, &fromLength );
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = ring->socket;
+        sqe->addr = (uint64_t) (uintptr_t) &ring->receiveMessage;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->user_data = SocketRingReceiveUserData;
 
-#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
-        if ( result == SOCKET_ERROR )
-        {
-            int error = WSAGetLastError();
+        if ( uring_submit( ring->receive ) < 0 )
+            return false;
 
-            if ( error == WSAEWOULDBLOCK )
-                return 0;
+        ring->receiveArmed = true;
 
-            debug_printf( "recvfrom failed with error %d\n", error );
+        return true;
+    }
 
-            return 0;
+    static void socket_ring_free( SocketRing * ring )
+    {
+        uring_destroy( ring->receive );
+        uring_destroy( ring->send );
+        uint8_t * memory = ring->memory;
+        const size_t memorySize = ring->memorySize;
+        munmap( memory, memorySize );
+    }
+
+    static SocketRing * socket_ring_create( int socket, bool dualStack )
+    {
+        // IMPORTANT: Everything the kernel reads or writes for us lives in one anonymous mapping. The buffer ring must be page aligned, so it goes first.
+
+        const size_t pageSize = (size_t) sysconf( _SC_PAGESIZE );
+#if YOJIMBO_SOCKETS_TIMESTAMPS
+        const int receiveControlSize = SocketTimestampControlSize;
+#else // #if YOJIMBO_SOCKETS_TIMESTAMPS
+        const int receiveControlSize = 0;
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+        const int receiveBufferSize = int( sizeof( io_uring_recvmsg_out ) + sizeof( sockaddr_storage ) ) + receiveControlSize + SocketRingMaxPacketSize;
+        const size_t ringOffset = socket_ring_align( sizeof( io_uring_buf ) * SocketRingNumReceiveBuffers, 64 );
+        const size_t sendSlotsOffset = socket_ring_align( ringOffset + sizeof( SocketRing ), 64 );
+        const size_t receiveBuffersOffset = socket_ring_align( sendSlotsOffset + sizeof( SocketRingSendSlot ) * SocketRingNumSendSlots, 64 );
+        const size_t memorySize = socket_ring_align( receiveBuffersOffset + size_t( receiveBufferSize ) * SocketRingNumReceiveBuffers, pageSize );
+
+        uint8_t * memory = (uint8_t*) mmap( NULL, memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( memory == MAP_FAILED )
+            return NULL;
+
+        SocketRing * ring = (SocketRing*) ( memory + ringOffset );
+        ring->receive.fd = -1;
+        ring->send.fd = -1;
+        ring->socket = socket;
+        ring->dualStack = dualStack;
+        ring->bufferRing = (io_uring_buf_ring*) memory;
+        ring->receiveBuffers = memory + receiveBuffersOffset;
+        ring->receiveBufferSize = receiveBufferSize;
+        ring->receiveMessage.msg_namelen = sizeof( sockaddr_storage );
+        ring->receiveMessage.msg_controllen = receiveControlSize;
+        ring->sendSlots = (SocketRingSendSlot*) ( memory + sendSlotsOffset );
+        ring->memory = memory;
+        ring->memorySize = memorySize;
+
+        for ( int i = 0; i < SocketRingNumSendSlots; ++i )
+            ring->freeSendSlots[i] = i;
+        ring->numFreeSendSlots = SocketRingNumSendSlots;
+
+        // IMPORTANT: Each receive buffer in the completion ring holds one buffer, so sizing the completion ring to the number of buffers means it can't overflow.
+
+        if ( !uring_create( ring->receive, 8, SocketRingNumReceiveBuffers * 2 ) || !uring_create( ring->send, SocketRingNumSendSlots, SocketRingNumSendSlots * 2 ) )
+        {
+            socket_ring_free( ring );
+            return NULL;
         }
-#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
-        if ( result <= 0 )
+
+        io_uring_buf_reg bufferRingRegistration;
+        memset( &bufferRingRegistration, 0, sizeof( bufferRingRegistration ) );
+        bufferRingRegistration.ring_addr = (uint64_t) (uintptr_t) ring->bufferRing;
+        bufferRingRegistration.ring_entries = SocketRingNumReceiveBuffers;
+        bufferRingRegistration.bgid = 0;
+
+        if ( syscall( __NR_io_uring_register, ring->receive.fd, IORING_REGISTER_PBUF_RING, &bufferRingRegistration, 1 ) != 0 )
         {
-            if ( errno == EAGAIN )
-                return 0;
+            socket_ring_free( ring );
+            return NULL;
+        }
 
-            debug_printf( "recvfrom failed with error %d\n", errno );
+        for ( int i = 0; i < SocketRingNumReceiveBuffers; ++i )
+            socket_ring_add_buffer( ring, i );
 
-            return 0;
+        socket_ring_publish_buffers( ring );
+
+        if ( !socket_ring_arm_receive( ring ) )
+        {
+            socket_ring_free( ring );
+            return NULL;
         }
-#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
 
-        from = Address( &sockaddr_from );
+        return ring;
+    }
 
-        assert( result >= 0 );
+    static void socket_ring_reap_sends( SocketRing * ring )
+    {
+        while ( io_uring_cqe * cqe = uring_peek_completion( ring->send ) )
+        {
+            if ( cqe->res < 0 )
+                debug_printf( "io_uring send failed with error %d\n", -cqe->res );
 
-        const int bytesRead = result;
+            assert( cqe->user_data < uint64_t( SocketRingNumSendSlots ) );
+            assert( ring->numFreeSendSlots < SocketRingNumSendSlots );
 
-        return bytesRead;
+            ring->freeSendSlots[ring->numFreeSendSlots++] = (int) cqe->user_data;
+
+            uring_completion_seen( ring->send );
+        }
+    }
+
+    static void socket_ring_destroy( SocketRing * ring )
+    {
+        // IMPORTANT: The kernel writes packets into our receive buffers and reads packets from our send slots, so wait for it to finish with them before they are unmapped.
+
+        if ( ring->receiveArmed )
+        {
+            io_uring_sqe * sqe = uring_get_sqe( ring->receive );
+            if ( sqe )
+            {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = SocketRingReceiveUserData;
+                sqe->user_data = SocketRingCancelUserData;
+                uring_submit( ring->receive );
+            }
+
+            for ( int i = 0; i < 100 && ring->receiveArmed; ++i )
+            {
+                uring_wait( ring->receive, 0.01 );
+
+                while ( io_uring_cqe * cqe = uring_peek_completion( ring->receive ) )
+                {
+                    if ( cqe->user_data == SocketRingReceiveUserData && !( cqe->flags & IORING_CQE_F_MORE ) )
+                        ring->receiveArmed = false;
+                    uring_completion_seen( ring->receive );
+                }
+            }
+        }
+
+        for ( int i = 0; i < 100 && ring->numFreeSendSlots < SocketRingNumSendSlots; ++i )
+        {
+            uring_wait( ring->send, 0.01 );
+            socket_ring_reap_sends( ring );
+        }
+
+        socket_ring_free( ring );
+    }
+
+    static bool socket_ring_queue_send( SocketRing * ring, const Address & to, const uint8_t * packetData, int packetBytes )
+    {
+        if ( packetBytes > SocketRingMaxPacketSize || ring->numFreeSendSlots == 0 )
+            return false;
+
+        const int slotIndex = ring->freeSendSlots[ring->numFreeSendSlots - 1];
+
+        SocketRingSendSlot & slot = ring->sendSlots[slotIndex];
+
+        const int addressLength = socket_address( to, ring->dualStack, slot.address );
+        if ( !addressLength )
+            return true;
+
+        io_uring_sqe * sqe = uring_get_sqe( ring->send );
+        if ( !sqe )
+            return false;
+
+        ring->numFreeSendSlots--;
+
+        memcpy( slot.data, packetData, packetBytes );
+        slot.buffer.iov_base = slot.data;
+        slot.buffer.iov_len = packetBytes;
+        memset( &slot.message, 0, sizeof( slot.message ) );
+        slot.message.msg_name = &slot.address;
+        slot.message.msg_namelen = addressLength;
+        slot.message.msg_iov = &slot.buffer;
+        slot.message.msg_iovlen = 1;
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = ring->socket;
+        sqe->addr = (uint64_t) (uintptr_t) &slot.message;
+        sqe->len = 1;
+        sqe->user_data = uint64_t( slotIndex );
+
+        return true;
+    }
+
+    static int socket_ring_receive( SocketRing * ring, int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes )
+    {
+        int numPackets = 0;
+
+        double time = 0.0;
+#if YOJIMBO_SOCKETS_TIMESTAMPS
+        timespec realTime;
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+
+        if ( receiveTimes )
+        {
+#if YOJIMBO_SOCKETS_TIMESTAMPS
+            clock_gettime( CLOCK_REALTIME, &realTime );
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+            time = platform_time();
+        }
+
+        bool buffersAdded = false;
+
+        while ( numPackets < maxPackets )
+        {
+            io_uring_cqe * cqe = uring_peek_completion( ring->receive );
+            if ( !cqe )
+                break;
+
+            if ( cqe->user_data == SocketRingReceiveUserData )
+            {
+                if ( cqe->flags & IORING_CQE_F_BUFFER )
+                {
+                    const int bufferId = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+                    const uint8_t * buffer = ring->receiveBuffers + size_t( bufferId ) * ring->receiveBufferSize;
+
+                    const io_uring_recvmsg_out * header = (const io_uring_recvmsg_out*) buffer;
+
+                    const int bytes = (int) header->payloadlen;
+
+                    // IMPORTANT: Packets too large for the buffer or for the caller are discarded, like recvfrom does for packets larger than maxPacketSize.
+
+                    if ( cqe->res > 0 && !( header->flags & MSG_TRUNC ) && bytes > 0 && bytes <= maxPacketSize )
+                    {
+                        sockaddr_storage address;
+                        memset( &address, 0, sizeof( address ) );
+                        memcpy( &address, buffer + sizeof( io_uring_recvmsg_out ), ( header->namelen < sizeof( address ) ) ? header->namelen : sizeof( address ) );
+
+                        const uint8_t * payload = buffer + sizeof( io_uring_recvmsg_out ) + ring->receiveMessage.msg_namelen + ring->receiveMessage.msg_controllen;
+
+                        memcpy( packetData + numPackets * maxPacketSize, payload, bytes );
+                        from[numPackets] = Address( &address );
+                        packetBytes[numPackets] = bytes;
+
+                        if ( receiveTimes )
+                        {
+#if YOJIMBO_SOCKETS_TIMESTAMPS
+                            msghdr message;
+                            memset( &message, 0, sizeof( message ) );
+                            message.msg_control = (void*) ( buffer + sizeof( io_uring_recvmsg_out ) + ring->receiveMessage.msg_namelen );
+                            message.msg_controllen = header->controllen;
+                            receiveTimes[numPackets] = socket_receive_time( message, realTime, time );
+#else // #if YOJIMBO_SOCKETS_TIMESTAMPS
+                            receiveTimes[numPackets] = time;
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+                        }
+
+                        numPackets++;
+                    }
+
+                    socket_ring_add_buffer( ring, bufferId );
+
+                    buffersAdded = true;
+                }
+                else if ( cqe->res < 0 && cqe->res != -ENOBUFS )
+                {
+                    debug_printf( "io_uring receive failed with error %d\n", -cqe->res );
+
+                    if ( cqe->res == -EINVAL )
+                        ring->receiveUnsupported = true;
+                }
+
+                // IMPORTANT: The multishot receive stops when it runs out of buffers or hits an error. It is posted again once buffers have been returned.
+
+                if ( !( cqe->flags & IORING_CQE_F_MORE ) )
+                    ring->receiveArmed = false;
+            }
+
+            uring_completion_seen( ring->receive );
+        }
+
+        if ( buffersAdded )
+            socket_ring_publish_buffers( ring );
+
+        if ( !ring->receiveArmed && !ring->receiveUnsupported )
+            socket_ring_arm_receive( ring );
+
+        return numPackets;
+    }
+
+#endif // #if YOJIMBO_SOCKETS_IO_URING
+
+#if YOJIMBO_SOCKETS_AF_XDP
+
+    /// One ring shared with the kernel by an AF_XDP socket. The fill and completion rings hold frame addresses, the receive and send rings hold frame descriptors.
+
+    struct SocketXdpRing
+    {
+        uint32_t * producer;                                        ///< Producer index. Advanced by the side that fills the ring.
+        uint32_t * consumer;                                        ///< Consumer index. Advanced by the side that empties the ring.
+        uint32_t * flags;                                           ///< Ring flags. The kernel sets XDP_RING_NEED_WAKEUP here when it needs a syscall to make progress.
+        void * entries;                                             ///< The ring entries. Frame addresses (uint64_t) for the fill and completion rings, xdp_desc for the receive and send rings.
+        uint32_t mask;                                              ///< Ring index mask.
+        uint32_t localProducer;                                     ///< Producer index including entries filled in but not yet published. Only used for the send ring.
+        void * memory;                                              ///< The mapping holding the ring.
+        size_t memorySize;                                          ///< The size of the ring mapping (bytes).
+    };
+
+    /// The AF_XDP socket for one receive queue of the network interface, and the frames it shares with the kernel.
+
+    struct SocketXdpQueue
+    {
+        int fd;                                                     ///< The AF_XDP socket. -1 if not created.
+        uint8_t * frames;                                           ///< The frames shared with the kernel (UMEM). Frame addresses in the rings are offsets from here.
+        SocketXdpRing fill;                                         ///< Frames given to the kernel to receive packets into.
+        SocketXdpRing completion;                                   ///< Frames the kernel has finished sending.
+        SocketXdpRing receive;                                      ///< Packets received by the kernel.
+        SocketXdpRing send;                                         ///< Packets for the kernel to send.
+        uint64_t freeSendFrames[SocketXdpNumFrames/2];              ///< Stack of frames free to send packets from.
+        int numFreeSendFrames;                                      ///< Number of free send frames.
+    };
+
+    /// An entry in the table of ethernet addresses learned from received packets.
+
+    struct SocketXdpNeighbor
+    {
+        int sequence;                                               ///< Odd while the entry is being written. Packets may be sent on another thread, so the send path reads this before and after the entry to catch a torn read.
+        int type;                                                   ///< The type of the remote address. ADDRESS_NONE if the entry is empty.
+        uint8_t address[16];                                        ///< The remote IP address. IPv4 addresses use the first 4 bytes.
+        uint8_t remoteMac[6];                                       ///< The source ethernet address of packets from the remote address. This is the next hop on the way back.
+        uint8_t localMac[6];                                        ///< The ethernet address of the network interface packets from the remote address arrived on.
+    };
+
+    /**
+        The XDP state for a socket created with SOCKET_FLAG_AF_XDP, or filtering packets with Socket::SetFilter.
+
+        Packets are received on every queue, but only sent through the first queue. Receives only touch the fill and receive rings, and sends only touch the send and completion rings, so the receive thread of a ThreadedNetworkTransport and the thread sending packets never share a ring.
+
+        Sockets that only filter packets have no queues, and packets that pass the filter go to the regular socket.
+     */
+
+    struct SocketXdp
+    {
+        int socket;                                                 ///< The regular socket. Polled along with the AF_XDP sockets in Socket::WaitForPackets.
+        int ifindex;                                                ///< The index of the network interface the socket address belongs to.
+        int mtu;                                                    ///< The MTU of the network interface. Larger packets are sent with sendto, so the kernel can fragment them.
+        int mapFd;                                                  ///< The map from receive queue to AF_XDP socket that the XDP program redirects packets through. -1 if not created.
+        int programFd;                                              ///< The XDP program. -1 if not loaded.
+        int linkFd;                                                 ///< The link attaching the XDP program to the network interface. The program is detached when this is closed. -1 if not attached.
+        bool filter;                                                ///< True if the XDP program filters packets. See Socket::SetFilter.
+        SocketFilterConfig filterConfig;                            ///< The packets the filter lets through. Only used if filter is true.
+        int knownMapFd;                                             ///< The addresses the filter does not rate limit. -1 if not created.
+        int sourceMapFd;                                            ///< The start of the current one second window, and the number of packets received in it, for each source IP the filter rate limits. -1 if not created.
+        int counterMapFd;                                           ///< Per-CPU counters for packets dropped by the filter, indexed by SocketFilterCounter. -1 if not created.
+        int numCpus;                                                ///< The number of possible CPUs. Each per-CPU counter has a value for each of them.
+        bool ipv6;                                                  ///< True if the socket is bound to an IPv6 address.
+        uint8_t localAddress[16];                                   ///< The IP address the socket is bound to. IPv4 addresses use the first 4 bytes.
+        uint16_t port;                                              ///< The port the socket is bound to.
+        uint16_t ipId;                                              ///< The IPv4 identification of the next packet sent.
+        int numQueues;                                              ///< The number of receive queues with an AF_XDP socket. Zero if the socket only filters packets.
+        SocketXdpQueue queues[SocketXdpMaxQueues];                  ///< The AF_XDP socket for each receive queue.
+        SocketXdpNeighbor neighbors[SocketXdpNumNeighbors];         ///< Ethernet addresses learned from received packets, indexed by a hash of the remote IP address. Colliding addresses replace each other.
+        uint8_t * memory;                                           ///< The anonymous mapping holding this structure and the frames of every queue.
+        size_t memorySize;                                          ///< The size of the anonymous mapping (bytes).
+    };
+
+    /// The key of an address in the known address map of the packet filter. Matches the stack layout the XDP program builds from each packet.
+
+    struct SocketFilterKnownKey
+    {
+        uint8_t address[16];                                        ///< The IP address. IPv4 addresses use the first 4 bytes.
+        uint16_t port;                                              ///< The port, in network byte order.
+        uint16_t padding;                                           ///< Always zero.
+    };
+
+    static const int SocketXdpEthernetHeaderBytes = 14;
+    static const int SocketXdpUdpHeaderBytes = 8;
+    static const int SocketXdpMaxInstructions = 256;
+
+    /// Places in the XDP program that jumps go to. Jumps are patched once the program is complete and every label has a position.
+
+    enum SocketXdpLabel
+    {
+        SOCKET_XDP_LABEL_PASS,                                      ///< Pass the packet to the kernel.
+        SOCKET_XDP_LABEL_ACCEPT,                                    ///< The packet is for the socket, and passed the filter. Redirect it to an AF_XDP socket, or pass it to the kernel.
+        SOCKET_XDP_LABEL_NOT_ENCRYPTED,                             ///< Check a packet without EncryptedPacketFlag set on its first byte.
+        SOCKET_XDP_LABEL_CHECK_SOURCE,                              ///< Rate limit the packet by its source.
+        SOCKET_XDP_LABEL_RESET_SOURCE,                              ///< Start a new one second window for the source.
+        SOCKET_XDP_LABEL_NEW_SOURCE,                                ///< Add the source to the source map.
+        SOCKET_XDP_LABEL_DROP_SIZE,                                 ///< Drop the packet, counting SOCKET_FILTER_COUNTER_PACKET_SIZE.
+        SOCKET_XDP_LABEL_DROP_PREFIX,                               ///< Drop the packet, counting SOCKET_FILTER_COUNTER_PREFIX_BYTE.
+        SOCKET_XDP_LABEL_DROP_TYPE,                                 ///< Drop the packet, counting SOCKET_FILTER_COUNTER_PACKET_TYPE.
+        SOCKET_XDP_LABEL_DROP_RATE,                                 ///< Drop the packet, counting SOCKET_FILTER_COUNTER_RATE_LIMIT.
+        SOCKET_XDP_LABEL_DROP,                                      ///< Count the drop in the counter with the index on the stack, and drop the packet.
+        SOCKET_XDP_LABEL_DROP_RETURN,                               ///< Drop the packet.
+        SOCKET_XDP_NUM_LABELS
+    };
+
+    /// An XDP program being put together.
+
+    struct SocketXdpProgram
+    {
+        bpf_insn instructions[SocketXdpMaxInstructions];
+        int numInstructions;
+        int jumps[SocketXdpMaxInstructions];
+        int jumpLabels[SocketXdpMaxInstructions];
+        int numJumps;
+        int labels[SOCKET_XDP_NUM_LABELS];
+    };
+
+    static inline void socket_xdp_write16( uint8_t * p, uint16_t value )
+    {
+        p[0] = uint8_t( value >> 8 );
+        p[1] = uint8_t( value );
+    }
+
+    static inline uint16_t socket_xdp_read16( const uint8_t * p )
+    {
+        return uint16_t( ( uint16_t( p[0] ) << 8 ) | p[1] );
+    }
+
+    static uint32_t socket_xdp_checksum_add( uint32_t sum, const uint8_t * data, int bytes )
+    {
+        for ( int i = 0; i + 1 < bytes; i += 2 )
+            sum += ( uint32_t( data[i] ) << 8 ) | data[i+1];
+
+        if ( bytes & 1 )
+            sum += uint32_t( data[bytes-1] ) << 8;
+
+        return sum;
+    }
+
+    static uint16_t socket_xdp_checksum_finish( uint32_t sum )
+    {
+        while ( sum >> 16 )
+            sum = ( sum & 0xFFFF ) + ( sum >> 16 );
+
+        return uint16_t( ~sum );
+    }
+
+    static int socket_xdp_bpf( int command, bpf_attr & attr )
+    {
+        return (int) syscall( __NR_bpf, command, &attr, sizeof( attr ) );
+    }
+
+    static int socket_xdp_create_map( uint32_t type, int keyBytes, int valueBytes, int maxEntries )
+    {
+        bpf_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+        attr.map_type = type;
+        attr.key_size = keyBytes;
+        attr.value_size = valueBytes;
+        attr.max_entries = maxEntries;
+
+        const int fd = socket_xdp_bpf( BPF_MAP_CREATE, attr );
+
+        return ( fd >= 0 ) ? fd : -1;
+    }
+
+    static void socket_xdp_emit( SocketXdpProgram & program, uint8_t code, uint8_t dst, uint8_t src, int16_t offset, int32_t imm )
+    {
+        assert( program.numInstructions < SocketXdpMaxInstructions );
+
+        bpf_insn & instruction = program.instructions[program.numInstructions++];
+        memset( &instruction, 0, sizeof( instruction ) );
+        instruction.code = code;
+        instruction.dst_reg = dst;
+        instruction.src_reg = src;
+        instruction.off = offset;
+        instruction.imm = imm;
+    }
+
+    static void socket_xdp_emit_jump( SocketXdpProgram & program, uint8_t code, uint8_t dst, uint8_t src, int32_t imm, int label )
+    {
+        assert( label >= 0 );
+        assert( label < SOCKET_XDP_NUM_LABELS );
+
+        program.jumps[program.numJumps] = program.numInstructions;
+        program.jumpLabels[program.numJumps] = label;
+        program.numJumps++;
+
+        socket_xdp_emit( program, code, dst, src, 0, imm );
+    }
+
+    static void socket_xdp_set_label( SocketXdpProgram & program, int label )
+    {
+        assert( label >= 0 );
+        assert( label < SOCKET_XDP_NUM_LABELS );
+
+        program.labels[label] = program.numInstructions;
+    }
+
+    static void socket_xdp_emit_load( SocketXdpProgram & program, uint8_t size, uint8_t dst, uint8_t src, int16_t offset )
+    {
+        socket_xdp_emit( program, BPF_LDX | BPF_MEM | size, dst, src, offset, 0 );
+    }
+
+    static void socket_xdp_emit_load_map( SocketXdpProgram & program, uint8_t dst, int mapFd )
+    {
+        socket_xdp_emit( program, BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, mapFd );
+        socket_xdp_emit( program, 0, 0, 0, 0, 0 );
+    }
+
+    static void socket_xdp_emit_load_imm64( SocketXdpProgram & program, uint8_t dst, uint64_t value )
+    {
+        socket_xdp_emit( program, BPF_LD | BPF_DW | BPF_IMM, dst, 0, 0, int32_t( uint32_t( value ) ) );
+        socket_xdp_emit( program, 0, 0, 0, 0, int32_t( uint32_t( value >> 32 ) ) );
+    }
+
+    static void socket_xdp_emit_stack_pointer( SocketXdpProgram & program, uint8_t dst, int16_t offset )
+    {
+        socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_X, dst, BPF_REG_10, 0, 0 );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, offset );
+    }
+
+    /**
+        Add the packet filter to the XDP program. See Socket::SetFilter.
+
+        On entry r2 and r3 hold the start and end of the packet, and the packet is a UDP packet for the socket address, with headers at fixed offsets.
+
+        Packets that pass the filter jump to SOCKET_XDP_LABEL_ACCEPT.
+     */
+
+    static void socket_xdp_emit_filter( SocketXdp * xdp, SocketXdpProgram & program, int udpOffset )
+    {
+        const SocketFilterConfig & config = xdp->filterConfig;
+
+        // r8 = the size of the UDP payload. a UDP length smaller than the header makes this negative, so the size checks are signed
+
+        socket_xdp_emit_load( program, BPF_H, BPF_REG_8, BPF_REG_2, udpOffset + 4 );
+        socket_xdp_emit( program, BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_8, 0, 0, 16 );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_8, 0, 0, -SocketXdpUdpHeaderBytes );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JSLT | BPF_K, BPF_REG_8, 0, config.minPacketBytes > 1 ? config.minPacketBytes : 1, SOCKET_XDP_LABEL_DROP_SIZE );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JSGT | BPF_K, BPF_REG_8, 0, config.maxPacketBytes, SOCKET_XDP_LABEL_DROP_SIZE );
+
+        // r9 = the UDP payload. the UDP length can claim more bytes than the packet has, so check against the end of the packet too
+
+        socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_9, BPF_REG_2, 0, 0 );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_9, 0, 0, udpOffset + SocketXdpUdpHeaderBytes );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_9, 0, 0 );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 1 );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, SOCKET_XDP_LABEL_DROP_SIZE );
+
+        socket_xdp_emit_load( program, BPF_B, BPF_REG_5, BPF_REG_9, 0 );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JLT | BPF_K, BPF_REG_5, 0, 0x80, SOCKET_XDP_LABEL_NOT_ENCRYPTED );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JSLT | BPF_K, BPF_REG_8, 0, config.minEncryptedPacketBytes, SOCKET_XDP_LABEL_DROP_SIZE );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JA, 0, 0, 0, SOCKET_XDP_LABEL_CHECK_SOURCE );
+
+        socket_xdp_set_label( program, SOCKET_XDP_LABEL_NOT_ENCRYPTED );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JGT | BPF_K, BPF_REG_5, 0, config.maxPrefixByte, SOCKET_XDP_LABEL_DROP_PREFIX );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, SOCKET_XDP_LABEL_CHECK_SOURCE );
+
+        if ( config.unencryptedPacketTypes == 0 )
+        {
+            socket_xdp_emit_jump( program, BPF_JMP | BPF_JA, 0, 0, 0, SOCKET_XDP_LABEL_DROP_TYPE );
+        }
+        else if ( config.numPacketTypes >= 2 && config.numPacketTypes <= 64 )
+        {
+            // IMPORTANT: The packet type is serialized right after the zero prefix byte and the CRC32, so it's in the low bits of the sixth byte. See yojimbo::WritePacket.
+
+            const int packetTypeBits = bits_required( 0, config.numPacketTypes - 1 );
+
+            socket_xdp_emit_jump( program, BPF_JMP | BPF_JSLT | BPF_K, BPF_REG_8, 0, 6, SOCKET_XDP_LABEL_DROP_TYPE );
+            socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_9, 0, 0 );
+            socket_xdp_emit( program, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, 6 );
+            socket_xdp_emit_jump( program, BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, SOCKET_XDP_LABEL_DROP_SIZE );
+            socket_xdp_emit_load( program, BPF_B, BPF_REG_1, BPF_REG_9, 5 );
+            socket_xdp_emit( program, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_1, 0, 0, ( 1 << packetTypeBits ) - 1 );
+            socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, 1 );
+            socket_xdp_emit( program, BPF_ALU64 | BPF_LSH | BPF_X, BPF_REG_4, BPF_REG_1, 0, 0 );
+            socket_xdp_emit_load_imm64( program, BPF_REG_5, config.unencryptedPacketTypes );
+            socket_xdp_emit( program, BPF_ALU64 | BPF_AND | BPF_X, BPF_REG_4, BPF_REG_5, 0, 0 );
+            socket_xdp_emit_jump( program, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 0, SOCKET_XDP_LABEL_DROP_TYPE );
+        }
+
+        socket_xdp_set_label( program, SOCKET_XDP_LABEL_CHECK_SOURCE );
+
+        if ( config.unknownSourcePacketsPerSecond <= 0 )
+            return;
+
+        // build the known address key at fp-24 and the source key at fp-40. see SocketFilterKnownKey
+
+        const int ipAddressOffset = SocketXdpEthernetHeaderBytes + ( xdp->ipv6 ? 8 : 12 );
+        const int ipAddressWords = xdp->ipv6 ? 4 : 1;
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            if ( i < ipAddressWords )
+            {
+                socket_xdp_emit_load( program, BPF_W, BPF_REG_1, BPF_REG_2, ipAddressOffset + i * 4 );
+                socket_xdp_emit( program, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_1, -24 + i * 4, 0 );
+                socket_xdp_emit( program, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_1, -40 + i * 4, 0 );
+            }
+            else
+            {
+                socket_xdp_emit( program, BPF_ST | BPF_MEM | BPF_W, BPF_REG_10, 0, -24 + i * 4, 0 );
+                socket_xdp_emit( program, BPF_ST | BPF_MEM | BPF_W, BPF_REG_10, 0, -40 + i * 4, 0 );
+            }
+        }
+
+        socket_xdp_emit_load( program, BPF_H, BPF_REG_1, BPF_REG_2, udpOffset );
+        socket_xdp_emit( program, BPF_STX | BPF_MEM | BPF_H, BPF_REG_10, BPF_REG_1, -8, 0 );
+        socket_xdp_emit( program, BPF_ST | BPF_MEM | BPF_H, BPF_REG_10, 0, -6, 0 );
+
+        socket_xdp_emit_load_map( program, BPF_REG_1, xdp->knownMapFd );
+        socket_xdp_emit_stack_pointer( program, BPF_REG_2, -24 );
+        socket_xdp_emit( program, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_0, 0, 0, SOCKET_XDP_LABEL_ACCEPT );
+
+        // IMPORTANT: Sources are counted over fixed one second windows. The count is not updated atomically, so packets from one source arriving on several CPUs at once can be undercounted. The limit is approximate, which is fine for stopping floods.
+
+        socket_xdp_emit( program, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_ktime_get_ns );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_7, BPF_REG_0, 0, 0 );
+
+        socket_xdp_emit_load_map( program, BPF_REG_1, xdp->sourceMapFd );
+        socket_xdp_emit_stack_pointer( program, BPF_REG_2, -40 );
+        socket_xdp_emit( program, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 0, SOCKET_XDP_LABEL_NEW_SOURCE );
+
+        socket_xdp_emit_load( program, BPF_DW, BPF_REG_1, BPF_REG_0, 0 );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_7, 0, 0 );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_SUB | BPF_X, BPF_REG_2, BPF_REG_1, 0, 0 );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JGT | BPF_K, BPF_REG_2, 0, 1000000000, SOCKET_XDP_LABEL_RESET_SOURCE );
+        socket_xdp_emit_load( program, BPF_DW, BPF_REG_1, BPF_REG_0, 8 );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_1, 0, 0, 1 );
+        socket_xdp_emit( program, BPF_STX | BPF_MEM | BPF_DW, BPF_REG_0, BPF_REG_1, 8, 0 );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JGT | BPF_K, BPF_REG_1, 0, config.unknownSourcePacketsPerSecond, SOCKET_XDP_LABEL_DROP_RATE );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JA, 0, 0, 0, SOCKET_XDP_LABEL_ACCEPT );
+
+        socket_xdp_set_label( program, SOCKET_XDP_LABEL_RESET_SOURCE );
+        socket_xdp_emit( program, BPF_STX | BPF_MEM | BPF_DW, BPF_REG_0, BPF_REG_7, 0, 0 );
+        socket_xdp_emit( program, BPF_ST | BPF_MEM | BPF_DW, BPF_REG_0, 0, 8, 1 );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JA, 0, 0, 0, SOCKET_XDP_LABEL_ACCEPT );
+
+        socket_xdp_set_label( program, SOCKET_XDP_LABEL_NEW_SOURCE );
+        socket_xdp_emit( program, BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_7, -56, 0 );
+        socket_xdp_emit( program, BPF_ST | BPF_MEM | BPF_DW, BPF_REG_10, 0, -48, 1 );
+        socket_xdp_emit_load_map( program, BPF_REG_1, xdp->sourceMapFd );
+        socket_xdp_emit_stack_pointer( program, BPF_REG_2, -40 );
+        socket_xdp_emit_stack_pointer( program, BPF_REG_3, -56 );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, BPF_ANY );
+        socket_xdp_emit( program, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_update_elem );
+    }
+
+    static void socket_xdp_emit_drop( SocketXdpProgram & program, int label, int counter, bool last )
+    {
+        socket_xdp_set_label( program, label );
+        socket_xdp_emit( program, BPF_ST | BPF_MEM | BPF_W, BPF_REG_10, 0, -64, counter );
+        if ( !last )
+            socket_xdp_emit_jump( program, BPF_JMP | BPF_JA, 0, 0, 0, SOCKET_XDP_LABEL_DROP );
+    }
+
+    static int socket_xdp_load_program( SocketXdp * xdp )
+    {
+        // IMPORTANT: The program only looks at UDP packets sent to the socket address, and passes everything else to the kernel.
+        // That includes IPv4 packets with options, fragments and VLAN tagged packets, which then arrive on the regular socket as usual, without being filtered.
+        // Packets for the socket address are dropped if they fail the filter, then redirected to the AF_XDP socket for the queue they arrived on.
+
+        SocketXdpProgram program;
+        memset( &program, 0, sizeof( program ) );
+
+        const int ipHeaderBytes = xdp->ipv6 ? 40 : 20;
+        const int headerBytes = SocketXdpEthernetHeaderBytes + ipHeaderBytes + SocketXdpUdpHeaderBytes;
+        const int udpOffset = SocketXdpEthernetHeaderBytes + ipHeaderBytes;
+
+        socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0 );
+        socket_xdp_emit_load( program, BPF_W, BPF_REG_2, BPF_REG_6, offsetof( xdp_md, data ) );
+        socket_xdp_emit_load( program, BPF_W, BPF_REG_3, BPF_REG_6, offsetof( xdp_md, data_end ) );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0 );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, headerBytes );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, SOCKET_XDP_LABEL_PASS );
+
+        socket_xdp_emit_load( program, BPF_H, BPF_REG_5, BPF_REG_2, 12 );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, htons( xdp->ipv6 ? 0x86DD : 0x0800 ), SOCKET_XDP_LABEL_PASS );
+
+        if ( xdp->ipv6 )
+        {
+            socket_xdp_emit_load( program, BPF_B, BPF_REG_5, BPF_REG_2, SocketXdpEthernetHeaderBytes + 6 );
+            socket_xdp_emit_jump( program, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, IPPROTO_UDP, SOCKET_XDP_LABEL_PASS );
+
+            for ( int i = 0; i < 4; ++i )
+            {
+                int32_t word;
+                memcpy( &word, xdp->localAddress + i * 4, 4 );
+                socket_xdp_emit_load( program, BPF_W, BPF_REG_5, BPF_REG_2, SocketXdpEthernetHeaderBytes + 24 + i * 4 );
+                socket_xdp_emit_jump( program, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_5, 0, word, SOCKET_XDP_LABEL_PASS );
+            }
+        }
+        else
+        {
+            socket_xdp_emit_load( program, BPF_B, BPF_REG_5, BPF_REG_2, SocketXdpEthernetHeaderBytes );
+            socket_xdp_emit_jump( program, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 0x45, SOCKET_XDP_LABEL_PASS );
+
+            socket_xdp_emit_load( program, BPF_B, BPF_REG_5, BPF_REG_2, SocketXdpEthernetHeaderBytes + 9 );
+            socket_xdp_emit_jump( program, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, IPPROTO_UDP, SOCKET_XDP_LABEL_PASS );
+
+            socket_xdp_emit_load( program, BPF_H, BPF_REG_5, BPF_REG_2, SocketXdpEthernetHeaderBytes + 6 );
+            socket_xdp_emit( program, BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, htons( 0x3FFF ) );
+            socket_xdp_emit_jump( program, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, SOCKET_XDP_LABEL_PASS );
+
+            int32_t word;
+            memcpy( &word, xdp->localAddress, 4 );
+            socket_xdp_emit_load( program, BPF_W, BPF_REG_5, BPF_REG_2, SocketXdpEthernetHeaderBytes + 16 );
+            socket_xdp_emit_jump( program, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_5, 0, word, SOCKET_XDP_LABEL_PASS );
+        }
+
+        socket_xdp_emit_load( program, BPF_H, BPF_REG_5, BPF_REG_2, udpOffset + 2 );
+        socket_xdp_emit_jump( program, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, htons( xdp->port ), SOCKET_XDP_LABEL_PASS );
+
+        if ( xdp->filter )
+            socket_xdp_emit_filter( xdp, program, udpOffset );
+
+        socket_xdp_set_label( program, SOCKET_XDP_LABEL_ACCEPT );
+
+        if ( xdp->numQueues > 0 )
+        {
+            // return bpf_redirect_map( map, rx_queue_index, XDP_PASS ). queues without an AF_XDP socket pass the packet to the kernel.
+
+            socket_xdp_emit_load( program, BPF_W, BPF_REG_2, BPF_REG_6, offsetof( xdp_md, rx_queue_index ) );
+            socket_xdp_emit_load_map( program, BPF_REG_1, xdp->mapFd );
+            socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS );
+            socket_xdp_emit( program, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map );
+            socket_xdp_emit( program, BPF_JMP | BPF_EXIT, 0, 0, 0, 0 );
+        }
+
+        socket_xdp_set_label( program, SOCKET_XDP_LABEL_PASS );
+        socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS );
+        socket_xdp_emit( program, BPF_JMP | BPF_EXIT, 0, 0, 0, 0 );
+
+        if ( xdp->filter )
+        {
+            socket_xdp_emit_drop( program, SOCKET_XDP_LABEL_DROP_SIZE, SOCKET_FILTER_COUNTER_PACKET_SIZE, false );
+            socket_xdp_emit_drop( program, SOCKET_XDP_LABEL_DROP_PREFIX, SOCKET_FILTER_COUNTER_PREFIX_BYTE, false );
+            socket_xdp_emit_drop( program, SOCKET_XDP_LABEL_DROP_TYPE, SOCKET_FILTER_COUNTER_PACKET_TYPE, false );
+            socket_xdp_emit_drop( program, SOCKET_XDP_LABEL_DROP_RATE, SOCKET_FILTER_COUNTER_RATE_LIMIT, true );
+
+            socket_xdp_set_label( program, SOCKET_XDP_LABEL_DROP );
+            socket_xdp_emit_load_map( program, BPF_REG_1, xdp->counterMapFd );
+            socket_xdp_emit_stack_pointer( program, BPF_REG_2, -64 );
+            socket_xdp_emit( program, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem );
+            socket_xdp_emit_jump( program, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 0, SOCKET_XDP_LABEL_DROP_RETURN );
+            socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, 1 );
+            socket_xdp_emit( program, BPF_STX | BPF_XADD | BPF_DW, BPF_REG_0, BPF_REG_1, 0, 0 );
+
+            socket_xdp_set_label( program, SOCKET_XDP_LABEL_DROP_RETURN );
+            socket_xdp_emit( program, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_DROP );
+            socket_xdp_emit( program, BPF_JMP | BPF_EXIT, 0, 0, 0, 0 );
+        }
+
+        for ( int i = 0; i < program.numJumps; ++i )
+        {
+            const int index = program.jumps[i];
+            program.instructions[index].off = int16_t( program.labels[program.jumpLabels[i]] - index - 1 );
+        }
+
+        static const char license[] = "Dual BSD/GPL";
+
+        bpf_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.insns = (uint64_t) (uintptr_t) program.instructions;
+        attr.insn_cnt = program.numInstructions;
+        attr.license = (uint64_t) (uintptr_t) license;
+        attr.expected_attach_type = BPF_XDP;
+
+        return socket_xdp_bpf( BPF_PROG_LOAD, attr );
+    }
+
+    static bool socket_xdp_map_ring( int fd, SocketXdpRing & ring, const xdp_ring_offset & offsets, uint32_t numEntries, size_t entryBytes, off_t pageOffset )
+    {
+        ring.memorySize = offsets.desc + numEntries * entryBytes;
+        ring.memory = mmap( NULL, ring.memorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pageOffset );
+        if ( ring.memory == MAP_FAILED )
+        {
+            ring.memory = NULL;
+            return false;
+        }
+
+        uint8_t * memory = (uint8_t*) ring.memory;
+
+        ring.producer = (uint32_t*) ( memory + offsets.producer );
+        ring.consumer = (uint32_t*) ( memory + offsets.consumer );
+        ring.flags = (uint32_t*) ( memory + offsets.flags );
+        ring.entries = memory + offsets.desc;
+        ring.mask = numEntries - 1;
+        ring.localProducer = *ring.producer;
+
+        return true;
+    }
+
+    static void socket_xdp_unmap_ring( SocketXdpRing & ring )
+    {
+        if ( ring.memory )
+            munmap( ring.memory, ring.memorySize );
+        memset( &ring, 0, sizeof( ring ) );
+    }
+
+    static void socket_xdp_queue_destroy( SocketXdpQueue & queue )
+    {
+        socket_xdp_unmap_ring( queue.fill );
+        socket_xdp_unmap_ring( queue.completion );
+        socket_xdp_unmap_ring( queue.receive );
+        socket_xdp_unmap_ring( queue.send );
+        if ( queue.fd >= 0 )
+            close( queue.fd );
+        queue.fd = -1;
+    }
+
+    static bool socket_xdp_queue_create( SocketXdp * xdp, SocketXdpQueue & queue, int queueId, uint8_t * frames )
+    {
+        queue.fd = socket( AF_XDP, SOCK_RAW, 0 );
+        if ( queue.fd < 0 )
+        {
+            queue.fd = -1;
+            return false;
+        }
+
+        queue.frames = frames;
+
+        xdp_umem_reg umem;
+        memset( &umem, 0, sizeof( umem ) );
+        umem.addr = (uint64_t) (uintptr_t) frames;
+        umem.len = uint64_t( SocketXdpNumFrames ) * SocketXdpFrameSize;
+        umem.chunk_size = SocketXdpFrameSize;
+        umem.headroom = 0;
+
+        if ( setsockopt( queue.fd, SOL_XDP, XDP_UMEM_REG, &umem, sizeof( umem ) ) != 0 )
+            return false;
+
+        // IMPORTANT: Half of the frames are given to the kernel to receive into and the other half are kept for sending. Each ring can hold all the frames in its half, so none of them can overflow.
+
+        const int numRingEntries = SocketXdpNumFrames / 2;
+
+        if ( setsockopt( queue.fd, SOL_XDP, XDP_UMEM_FILL_RING, &numRingEntries, sizeof( numRingEntries ) ) != 0 ||
+             setsockopt( queue.fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &numRingEntries, sizeof( numRingEntries ) ) != 0 ||
+             setsockopt( queue.fd, SOL_XDP, XDP_RX_RING, &numRingEntries, sizeof( numRingEntries ) ) != 0 ||
+             setsockopt( queue.fd, SOL_XDP, XDP_TX_RING, &numRingEntries, sizeof( numRingEntries ) ) != 0 )
+        {
+            return false;
+        }
+
+        xdp_mmap_offsets offsets;
+        socklen_t offsetsLength = sizeof( offsets );
+        if ( getsockopt( queue.fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsetsLength ) != 0 )
+            return false;
+
+        if ( !socket_xdp_map_ring( queue.fd, queue.fill, offsets.fr, numRingEntries, sizeof( uint64_t ), XDP_UMEM_PGOFF_FILL_RING ) ||
+             !socket_xdp_map_ring( queue.fd, queue.completion, offsets.cr, numRingEntries, sizeof( uint64_t ), XDP_UMEM_PGOFF_COMPLETION_RING ) ||
+             !socket_xdp_map_ring( queue.fd, queue.receive, offsets.rx, numRingEntries, sizeof( xdp_desc ), XDP_PGOFF_RX_RING ) ||
+             !socket_xdp_map_ring( queue.fd, queue.send, offsets.tx, numRingEntries, sizeof( xdp_desc ), XDP_PGOFF_TX_RING ) )
+        {
+            return false;
+        }
+
+        const uint32_t fillProducer = *queue.fill.producer;
+
+        for ( int i = 0; i < numRingEntries; ++i )
+            ( (uint64_t*) queue.fill.entries )[( fillProducer + i ) & queue.fill.mask] = uint64_t( i ) * SocketXdpFrameSize;
+
+        __atomic_store_n( queue.fill.producer, fillProducer + numRingEntries, __ATOMIC_RELEASE );
+
+        for ( int i = 0; i < numRingEntries; ++i )
+            queue.freeSendFrames[i] = uint64_t( numRingEntries + i ) * SocketXdpFrameSize;
+
+        queue.numFreeSendFrames = numRingEntries;
+
+        // try zero copy first. not every driver supports it, so fall back to copy mode, which still bypasses the kernel network stack
+
+        sockaddr_xdp address;
+        memset( &address, 0, sizeof( address ) );
+        address.sxdp_family = AF_XDP;
+        address.sxdp_ifindex = xdp->ifindex;
+        address.sxdp_queue_id = queueId;
+        address.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_ZEROCOPY;
+
+        if ( ::bind( queue.fd, (const sockaddr*) &address, sizeof( address ) ) != 0 )
+        {
+            address.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+
+            if ( ::bind( queue.fd, (const sockaddr*) &address, sizeof( address ) ) != 0 )
+                return false;
+        }
+
+        return true;
+    }
+
+    static void socket_xdp_close_filter_maps( SocketXdp * xdp )
+    {
+        if ( xdp->knownMapFd >= 0 )
+            close( xdp->knownMapFd );
+
+        if ( xdp->sourceMapFd >= 0 )
+            close( xdp->sourceMapFd );
+
+        if ( xdp->counterMapFd >= 0 )
+            close( xdp->counterMapFd );
+
+        xdp->knownMapFd = -1;
+        xdp->sourceMapFd = -1;
+        xdp->counterMapFd = -1;
+    }
+
+    static void socket_xdp_destroy( SocketXdp * xdp )
+    {
+        if ( xdp->linkFd >= 0 )
+            close( xdp->linkFd );
+
+        if ( xdp->programFd >= 0 )
+            close( xdp->programFd );
+
+        for ( int i = 0; i < xdp->numQueues; ++i )
+            socket_xdp_queue_destroy( xdp->queues[i] );
+
+        if ( xdp->mapFd >= 0 )
+            close( xdp->mapFd );
+
+        socket_xdp_close_filter_maps( xdp );
+
+        uint8_t * memory = xdp->memory;
+        const size_t memorySize = xdp->memorySize;
+        munmap( memory, memorySize );
+    }
+
+    /**
+        Find the network interface an address belongs to.
+
+        @param address The address to look for. The port is ignored.
+        @param allowLoopback If false, loopback interfaces are skipped.
+        @param name The name of the network interface [out]. Must be at least IF_NAMESIZE bytes.
+
+        @returns True if a network interface has this address.
+     */
+
+    static bool socket_xdp_find_interface( const Address & address, bool allowLoopback, char * name )
+    {
+        ifaddrs * addresses = NULL;
+        if ( getifaddrs( &addresses ) != 0 )
+            return false;
+
+        bool found = false;
+
+        for ( ifaddrs * i = addresses; i && !found; i = i->ifa_next )
+        {
+            if ( !i->ifa_addr || ( !allowLoopback && ( i->ifa_flags & IFF_LOOPBACK ) ) )
+                continue;
+
+            if ( address.GetType() == ADDRESS_IPV4 && i->ifa_addr->sa_family == AF_INET )
+            {
+                const sockaddr_in * interfaceAddress = (const sockaddr_in*) i->ifa_addr;
+                found = interfaceAddress->sin_addr.s_addr == address.GetAddress4();
+            }
+            else if ( address.GetType() == ADDRESS_IPV6 && i->ifa_addr->sa_family == AF_INET6 )
+            {
+                const sockaddr_in6 * interfaceAddress = (const sockaddr_in6*) i->ifa_addr;
+                found = memcmp( &interfaceAddress->sin6_addr, address.GetAddress6(), 16 ) == 0;
+            }
+
+            if ( found )
+            {
+                snprintf( name, IF_NAMESIZE, "%s", i->ifa_name );
+            }
+        }
+
+        freeifaddrs( addresses );
+
+        return found;
+    }
+
+    static int socket_xdp_num_receive_queues( const char * name )
+    {
+        char path[256];
+        snprintf( path, sizeof( path ), "/sys/class/net/%s/queues", name );
+
+        DIR * directory = opendir( path );
+        if ( !directory )
+            return 1;
+
+        int numQueues = 0;
+
+        while ( dirent * entry = readdir( directory ) )
+        {
+            if ( strncmp( entry->d_name, "rx-", 3 ) == 0 )
+                numQueues++;
+        }
+
+        closedir( directory );
+
+        return ( numQueues > 0 ) ? numQueues : 1;
+    }
+
+    static int socket_xdp_num_possible_cpus()
+    {
+        // the file holds a range of CPU indices like "0-63". per-CPU map values are read for every possible CPU, not just online ones
+
+        FILE * file = fopen( "/sys/devices/system/cpu/possible", "r" );
+        if ( !file )
+            return (int) sysconf( _SC_NPROCESSORS_CONF );
+
+        char buffer[256];
+        const bool read = fgets( buffer, sizeof( buffer ), file ) != NULL;
+        fclose( file );
+
+        if ( !read )
+            return (int) sysconf( _SC_NPROCESSORS_CONF );
+
+        const char * last = buffer;
+        for ( const char * p = buffer; *p; ++p )
+        {
+            if ( *p == '-' || *p == ',' )
+                last = p + 1;
+        }
+
+        return atoi( last ) + 1;
+    }
+
+    /**
+        Create the XDP state for a socket. The XDP program is not attached until socket_xdp_attach is called.
+
+        @param socket The regular socket.
+        @param address The address the socket is bound to.
+        @param bypass If true, create an AF_XDP socket on each receive queue to bypass the kernel network stack. Otherwise the XDP state is only used to filter packets.
+
+        @returns The XDP state, or NULL if XDP is not available for this address.
+     */
+
+    static SocketXdp * socket_xdp_create( int socket, const Address & address, bool bypass )
+    {
+        assert( address.IsValid() );
+
+        // IMPORTANT: Loopback can't bypass the kernel. There is nothing to bypass, and the kernel drops packets with loopback addresses sent through AF_XDP as martians. Filtering on loopback works though.
+
+        char name[IF_NAMESIZE];
+        if ( !socket_xdp_find_interface( address, !bypass, name ) )
+            return NULL;
+
+        const int ifindex = (int) if_nametoindex( name );
+        if ( ifindex == 0 )
+            return NULL;
+
+        ifreq request;
+        memset( &request, 0, sizeof( request ) );
+        snprintf( request.ifr_name, IF_NAMESIZE, "%s", name );
+        if ( ioctl( socket, SIOCGIFMTU, &request ) != 0 )
+            return NULL;
+
+        int numQueues = bypass ? socket_xdp_num_receive_queues( name ) : 0;
+        if ( numQueues > SocketXdpMaxQueues )
+            numQueues = SocketXdpMaxQueues;
+
+        // IMPORTANT: Everything lives in one anonymous mapping, with the frames for each queue after this structure. The frames must be page aligned.
+
+        const size_t pageSize = (size_t) sysconf( _SC_PAGESIZE );
+        const size_t framesOffset = ( sizeof( SocketXdp ) + pageSize - 1 ) & ~( pageSize - 1 );
+        const size_t framesSize = size_t( SocketXdpNumFrames ) * SocketXdpFrameSize;
+        const size_t memorySize = framesOffset + framesSize * numQueues;
+
+        uint8_t * memory = (uint8_t*) mmap( NULL, memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( memory == MAP_FAILED )
+            return NULL;
+
+        SocketXdp * xdp = (SocketXdp*) memory;
+        xdp->socket = socket;
+        xdp->ifindex = ifindex;
+        xdp->mtu = request.ifr_mtu;
+        xdp->mapFd = -1;
+        xdp->programFd = -1;
+        xdp->linkFd = -1;
+        xdp->filter = false;
+        xdp->filterConfig = SocketFilterConfig();
+        xdp->knownMapFd = -1;
+        xdp->sourceMapFd = -1;
+        xdp->counterMapFd = -1;
+        xdp->numCpus = socket_xdp_num_possible_cpus();
+        xdp->ipv6 = address.GetType() == ADDRESS_IPV6;
+        xdp->port = address.GetPort();
+        xdp->memory = memory;
+        xdp->memorySize = memorySize;
+
+        if ( xdp->ipv6 )
+        {
+            memcpy( xdp->localAddress, address.GetAddress6(), 16 );
+        }
+        else
+        {
+            const uint32_t address4 = address.GetAddress4();
+            memcpy( xdp->localAddress, &address4, 4 );
+        }
+
+        if ( !bypass )
+            return xdp;
+
+        xdp->mapFd = socket_xdp_create_map( BPF_MAP_TYPE_XSKMAP, sizeof( uint32_t ), sizeof( uint32_t ), SocketXdpMaxQueues );
+        if ( xdp->mapFd < 0 )
+        {
+            socket_xdp_destroy( xdp );
+            return NULL;
+        }
+
+        for ( int i = 0; i < numQueues; ++i )
+        {
+            SocketXdpQueue & queue = xdp->queues[i];
+
+            xdp->numQueues++;
+
+            if ( !socket_xdp_queue_create( xdp, queue, i, memory + framesOffset + framesSize * i ) )
+            {
+                debug_printf( "failed to create AF_XDP socket for queue %d. error %d\n", i, errno );
+                socket_xdp_destroy( xdp );
+                return NULL;
+            }
+
+            const uint32_t key = uint32_t( i );
+            const uint32_t value = uint32_t( queue.fd );
+
+            bpf_attr attr;
+            memset( &attr, 0, sizeof( attr ) );
+            attr.map_fd = xdp->mapFd;
+            attr.key = (uint64_t) (uintptr_t) &key;
+            attr.value = (uint64_t) (uintptr_t) &value;
+            attr.flags = BPF_ANY;
+
+            if ( socket_xdp_bpf( BPF_MAP_UPDATE_ELEM, attr ) != 0 )
+            {
+                socket_xdp_destroy( xdp );
+                return NULL;
+            }
+        }
+
+        return xdp;
+    }
+
+    /**
+        Load the XDP program for the current state, and attach it to the network interface.
+
+        If a program is already attached it's replaced in place, so no packets slip past the program while it changes.
+
+        @returns True if the program is attached. If this fails the previous program, if any, stays attached.
+     */
+
+    static bool socket_xdp_attach( SocketXdp * xdp )
+    {
+        const int programFd = socket_xdp_load_program( xdp );
+        if ( programFd < 0 )
+        {
+            debug_printf( "failed to load XDP program. error %d\n", errno );
+            return false;
+        }
+
+        bpf_attr attr;
+
+        if ( xdp->linkFd >= 0 )
+        {
+            memset( &attr, 0, sizeof( attr ) );
+            attr.link_update.link_fd = xdp->linkFd;
+            attr.link_update.new_prog_fd = programFd;
+
+            if ( socket_xdp_bpf( BPF_LINK_UPDATE, attr ) != 0 )
+            {
+                debug_printf( "failed to replace XDP program. error %d\n", errno );
+                close( programFd );
+                return false;
+            }
+        }
+        else
+        {
+            // attach the program in driver mode if the driver supports XDP, otherwise in generic mode
+
+            const uint32_t attachFlags[] = { XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE };
+
+            for ( int i = 0; i < 2 && xdp->linkFd < 0; ++i )
+            {
+                memset( &attr, 0, sizeof( attr ) );
+                attr.link_create.prog_fd = programFd;
+                attr.link_create.target_ifindex = xdp->ifindex;
+                attr.link_create.attach_type = BPF_XDP;
+                attr.link_create.flags = attachFlags[i];
+
+                xdp->linkFd = socket_xdp_bpf( BPF_LINK_CREATE, attr );
+                if ( xdp->linkFd < 0 )
+                    xdp->linkFd = -1;
+            }
+
+            if ( xdp->linkFd < 0 )
+            {
+                // IMPORTANT: Only one XDP program can be attached to a network interface, so this fails if another socket on the same interface is already using XDP.
+
+                debug_printf( "failed to attach XDP program to interface %d. error %d\n", xdp->ifindex, errno );
+                close( programFd );
+                return false;
+            }
+        }
+
+        if ( xdp->programFd >= 0 )
+            close( xdp->programFd );
+
+        xdp->programFd = programFd;
+
+        return true;
+    }
+
+    static bool socket_xdp_set_filter( SocketXdp * xdp, const SocketFilterConfig & config )
+    {
+        if ( xdp->knownMapFd < 0 )
+        {
+            xdp->knownMapFd = socket_xdp_create_map( BPF_MAP_TYPE_LRU_HASH, sizeof( SocketFilterKnownKey ), sizeof( uint32_t ), SocketFilterMaxKnownAddresses );
+            xdp->sourceMapFd = socket_xdp_create_map( BPF_MAP_TYPE_LRU_HASH, 16, 2 * sizeof( uint64_t ), SocketFilterMaxSources );
+            xdp->counterMapFd = socket_xdp_create_map( BPF_MAP_TYPE_PERCPU_ARRAY, sizeof( uint32_t ), sizeof( uint64_t ), SOCKET_FILTER_NUM_COUNTERS );
+
+            if ( xdp->knownMapFd < 0 || xdp->sourceMapFd < 0 || xdp->counterMapFd < 0 )
+            {
+                socket_xdp_close_filter_maps( xdp );
+                return false;
+            }
+        }
+
+        const bool previousFilter = xdp->filter;
+        const SocketFilterConfig previousConfig = xdp->filterConfig;
+
+        xdp->filter = true;
+        xdp->filterConfig = config;
+
+        if ( !socket_xdp_attach( xdp ) )
+        {
+            xdp->filter = previousFilter;
+            xdp->filterConfig = previousConfig;
+            return false;
+        }
+
+        return true;
+    }
+
+    static void socket_xdp_known_key( const Address & address, SocketFilterKnownKey & key )
+    {
+        memset( &key, 0, sizeof( key ) );
+
+        if ( address.GetType() == ADDRESS_IPV6 )
+        {
+            memcpy( key.address, address.GetAddress6(), 16 );
+        }
+        else
+        {
+            const uint32_t address4 = address.GetAddress4();
+            memcpy( key.address, &address4, 4 );
+        }
+
+        key.port = htons( address.GetPort() );
+    }
+
+    static uint32_t socket_xdp_neighbor_index( const uint8_t * address, int addressBytes )
+    {
+        uint32_t hash = 2166136261U;
+        for ( int i = 0; i < addressBytes; ++i )
+        {
+            hash ^= address[i];
+            hash *= 16777619U;
+        }
+        return hash & ( SocketXdpNumNeighbors - 1 );
+    }
+
+    static void socket_xdp_learn_neighbor( SocketXdp * xdp, int type, const uint8_t * address, int addressBytes, const uint8_t * frame )
+    {
+        const uint8_t * localMac = frame;
+        const uint8_t * remoteMac = frame + 6;
+
+        SocketXdpNeighbor & neighbor = xdp->neighbors[socket_xdp_neighbor_index( address, addressBytes )];
+
+        // nearly every packet is from an address already in the table, so only write the entry when it changes
+
+        if ( neighbor.type == type && memcmp( neighbor.address, address, addressBytes ) == 0 && memcmp( neighbor.remoteMac, remoteMac, 6 ) == 0 && memcmp( neighbor.localMac, localMac, 6 ) == 0 )
+            return;
+
+        const int sequence = neighbor.sequence;
+
+        __atomic_store_n( &neighbor.sequence, sequence + 1, __ATOMIC_RELAXED );
+        __atomic_thread_fence( __ATOMIC_RELEASE );
+
+        neighbor.type = type;
+        memset( neighbor.address, 0, sizeof( neighbor.address ) );
+        memcpy( neighbor.address, address, addressBytes );
+        memcpy( neighbor.remoteMac, remoteMac, 6 );
+        memcpy( neighbor.localMac, localMac, 6 );
+
+        __atomic_store_n( &neighbor.sequence, sequence + 2, __ATOMIC_RELEASE );
+    }
+
+    static bool socket_xdp_find_neighbor( SocketXdp * xdp, int type, const uint8_t * address, int addressBytes, uint8_t * remoteMac, uint8_t * localMac )
+    {
+        const SocketXdpNeighbor & neighbor = xdp->neighbors[socket_xdp_neighbor_index( address, addressBytes )];
+
+        const int sequence = __atomic_load_n( &neighbor.sequence, __ATOMIC_ACQUIRE );
+        if ( sequence & 1 )
+            return false;
+
+        const bool match = neighbor.type == type && memcmp( neighbor.address, address, addressBytes ) == 0;
+
+        memcpy( remoteMac, neighbor.remoteMac, 6 );
+        memcpy( localMac, neighbor.localMac, 6 );
+
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+        return match && __atomic_load_n( &neighbor.sequence, __ATOMIC_RELAXED ) == sequence;
+    }
+
+    static void socket_xdp_reap_sends( SocketXdp * xdp )
+    {
+        assert( xdp->numQueues > 0 );
+
+        SocketXdpQueue & queue = xdp->queues[0];
+
+        const uint32_t consumer = *queue.completion.consumer;
+        const uint32_t producer = __atomic_load_n( queue.completion.producer, __ATOMIC_ACQUIRE );
+
+        for ( uint32_t i = consumer; i != producer; ++i )
+        {
+            assert( queue.numFreeSendFrames < SocketXdpNumFrames / 2 );
+            queue.freeSendFrames[queue.numFreeSendFrames++] = ( (const uint64_t*) queue.completion.entries )[i & queue.completion.mask] & ~uint64_t( SocketXdpFrameSize - 1 );
+        }
+
+        __atomic_store_n( queue.completion.consumer, producer, __ATOMIC_RELEASE );
+    }
+
+    /**
+        Write a packet into a send frame, with ethernet, IP and UDP headers in front of it.
+
+        The packet is only queued. Call socket_xdp_flush_sends to hand queued packets to the kernel.
+
+        @returns True if the packet was queued. False if it should be sent with sendto instead, because it's too large, there is no free frame, or the ethernet address to send it to has not been learned yet.
+     */
+
+    static bool socket_xdp_queue_send( SocketXdp * xdp, const Address & to, const uint8_t * packetData, int packetBytes )
+    {
+        assert( xdp->numQueues > 0 );
+
+        SocketXdpQueue & queue = xdp->queues[0];
+
+        const int type = xdp->ipv6 ? ADDRESS_IPV6 : ADDRESS_IPV4;
+        if ( to.GetType() != type )
+            return false;
+
+        const int ipHeaderBytes = xdp->ipv6 ? 40 : 20;
+        const int udpBytes = SocketXdpUdpHeaderBytes + packetBytes;
+        const int frameBytes = SocketXdpEthernetHeaderBytes + ipHeaderBytes + udpBytes;
+
+        if ( frameBytes > SocketXdpFrameSize || ipHeaderBytes + udpBytes > xdp->mtu )
+            return false;
+
+        uint8_t remoteAddress[16];
+        const int addressBytes = xdp->ipv6 ? 16 : 4;
+        if ( xdp->ipv6 )
+        {
+            memcpy( remoteAddress, to.GetAddress6(), 16 );
+        }
+        else
+        {
+            const uint32_t address4 = to.GetAddress4();
+            memcpy( remoteAddress, &address4, 4 );
+        }
+
+        uint8_t remoteMac[6];
+        uint8_t localMac[6];
+        if ( !socket_xdp_find_neighbor( xdp, type, remoteAddress, addressBytes, remoteMac, localMac ) )
+            return false;
+
+        if ( queue.numFreeSendFrames == 0 )
+            return false;
+
+        const uint64_t frameAddress = queue.freeSendFrames[--queue.numFreeSendFrames];
+
+        uint8_t * frame = queue.frames + frameAddress;
+
+        memcpy( frame, remoteMac, 6 );
+        memcpy( frame + 6, localMac, 6 );
+        socket_xdp_write16( frame + 12, xdp->ipv6 ? 0x86DD : 0x0800 );
+
+        uint8_t * ip = frame + SocketXdpEthernetHeaderBytes;
+        uint8_t * udp = ip + ipHeaderBytes;
+
+        socket_xdp_write16( udp, xdp->port );
+        socket_xdp_write16( udp + 2, to.GetPort() );
+        socket_xdp_write16( udp + 4, uint16_t( udpBytes ) );
+        socket_xdp_write16( udp + 6, 0 );
+        memcpy( udp + SocketXdpUdpHeaderBytes, packetData, packetBytes );
+
+        uint32_t sum = 0;
+
+        if ( xdp->ipv6 )
+        {
+            ip[0] = 0x60;
+            ip[1] = 0;
+            ip[2] = 0;
+            ip[3] = 0;
+            socket_xdp_write16( ip + 4, uint16_t( udpBytes ) );
+            ip[6] = IPPROTO_UDP;
+            ip[7] = 64;
+            memcpy( ip + 8, xdp->localAddress, 16 );
+            memcpy( ip + 24, remoteAddress, 16 );
+
+            sum = socket_xdp_checksum_add( sum, ip + 8, 32 );
+        }
+        else
+        {
+            ip[0] = 0x45;
+            ip[1] = 0;
+            socket_xdp_write16( ip + 2, uint16_t( ipHeaderBytes + udpBytes ) );
+            socket_xdp_write16( ip + 4, xdp->ipId++ );
+            socket_xdp_write16( ip + 6, 0x4000 );
+            ip[8] = 64;
+            ip[9] = IPPROTO_UDP;
+            socket_xdp_write16( ip + 10, 0 );
+            memcpy( ip + 12, xdp->localAddress, 4 );
+            memcpy( ip + 16, remoteAddress, 4 );
+            socket_xdp_write16( ip + 10, socket_xdp_checksum_finish( socket_xdp_checksum_add( 0, ip, ipHeaderBytes ) ) );
+
+            sum = socket_xdp_checksum_add( sum, ip + 12, 8 );
+        }
+
+        sum += IPPROTO_UDP + udpBytes;
+        sum = socket_xdp_checksum_add( sum, udp, udpBytes );
+
+        const uint16_t checksum = socket_xdp_checksum_finish( sum );
+        socket_xdp_write16( udp + 6, checksum ? checksum : 0xFFFF );
+
+        xdp_desc & descriptor = ( (xdp_desc*) queue.send.entries )[queue.send.localProducer & queue.send.mask];
+        descriptor.addr = frameAddress;
+        descriptor.len = frameBytes;
+        descriptor.options = 0;
+
+        queue.send.localProducer++;
+
+        return true;
+    }
+
+    static void socket_xdp_flush_sends( SocketXdp * xdp )
+    {
+        assert( xdp->numQueues > 0 );
+
+        SocketXdpQueue & queue = xdp->queues[0];
+
+        if ( queue.send.localProducer == *queue.send.producer )
+            return;
+
+        __atomic_store_n( queue.send.producer, queue.send.localProducer, __ATOMIC_RELEASE );
+
+        if ( __atomic_load_n( queue.send.flags, __ATOMIC_RELAXED ) & XDP_RING_NEED_WAKEUP )
+            sendto( queue.fd, NULL, 0, MSG_DONTWAIT, NULL, 0 );
+    }
+
+    /**
+        Read the packet out of a received frame.
+
+        The XDP program only redirects UDP packets sent to the socket address, without IPv4 options, so the headers are at fixed offsets. The UDP checksum is not checked, corrupt packets are caught by the packet CRC32 or encryption instead.
+
+        @returns The size of the packet (bytes), or 0 if the frame is malformed or the packet is larger than maxPacketSize.
+     */
+
+    static int socket_xdp_read_frame( SocketXdp * xdp, const uint8_t * frame, int frameBytes, Address & from, uint8_t * packetData, int maxPacketSize )
+    {
+        const uint8_t * ip = frame + SocketXdpEthernetHeaderBytes;
+
+        sockaddr_storage address;
+        memset( &address, 0, sizeof( address ) );
+
+        const uint8_t * udp = NULL;
+        int udpBytes = 0;
+
+        if ( xdp->ipv6 )
+        {
+            if ( frameBytes < SocketXdpEthernetHeaderBytes + 40 + SocketXdpUdpHeaderBytes )
+                return 0;
+
+            const int payloadBytes = socket_xdp_read16( ip + 4 );
+            if ( SocketXdpEthernetHeaderBytes + 40 + payloadBytes > frameBytes )
+                return 0;
+
+            udp = ip + 40;
+            udpBytes = socket_xdp_read16( udp + 4 );
+            if ( udpBytes < SocketXdpUdpHeaderBytes || udpBytes > payloadBytes )
+                return 0;
+
+            sockaddr_in6 * address6 = (sockaddr_in6*) &address;
+            address6->sin6_family = AF_INET6;
+            memcpy( &address6->sin6_addr, ip + 8, 16 );
+            memcpy( &address6->sin6_port, udp, 2 );
+
+            socket_xdp_learn_neighbor( xdp, ADDRESS_IPV6, ip + 8, 16, frame );
+        }
+        else
+        {
+            if ( frameBytes < SocketXdpEthernetHeaderBytes + 20 + SocketXdpUdpHeaderBytes )
+                return 0;
+
+            const int totalBytes = socket_xdp_read16( ip + 2 );
+            if ( totalBytes < 20 + SocketXdpUdpHeaderBytes || SocketXdpEthernetHeaderBytes + totalBytes > frameBytes )
+                return 0;
+
+            udp = ip + 20;
+            udpBytes = socket_xdp_read16( udp + 4 );
+            if ( udpBytes < SocketXdpUdpHeaderBytes || udpBytes > totalBytes - 20 )
+                return 0;
+
+            sockaddr_in * address4 = (sockaddr_in*) &address;
+            address4->sin_family = AF_INET;
+            memcpy( &address4->sin_addr, ip + 12, 4 );
+            memcpy( &address4->sin_port, udp, 2 );
+
+            socket_xdp_learn_neighbor( xdp, ADDRESS_IPV4, ip + 12, 4, frame );
+        }
+
+        const int packetBytes = udpBytes - SocketXdpUdpHeaderBytes;
+        if ( packetBytes <= 0 || packetBytes > maxPacketSize )
+            return 0;
+
+        memcpy( packetData, udp + SocketXdpUdpHeaderBytes, packetBytes );
+
+        from = Address( &address );
+
+        return packetBytes;
+    }
+
+    static int socket_xdp_receive( SocketXdp * xdp, int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes )
+    {
+        int numPackets = 0;
+
+        const double time = receiveTimes ? platform_time() : 0.0;
+
+        for ( int i = 0; i < xdp->numQueues && numPackets < maxPackets; ++i )
+        {
+            SocketXdpQueue & queue = xdp->queues[i];
+
+            const uint32_t consumer = *queue.receive.consumer;
+            const uint32_t available = __atomic_load_n( queue.receive.producer, __ATOMIC_ACQUIRE ) - consumer;
+
+            uint32_t fillProducer = *queue.fill.producer;
+
+            uint32_t numRead = 0;
+
+            for ( ; numRead < available && numPackets < maxPackets; ++numRead )
+            {
+                const xdp_desc & descriptor = ( (const xdp_desc*) queue.receive.entries )[( consumer + numRead ) & queue.receive.mask];
+
+                const int bytes = socket_xdp_read_frame( xdp, queue.frames + descriptor.addr, (int) descriptor.len, from[numPackets], packetData + numPackets * maxPacketSize, maxPacketSize );
+
+                if ( bytes > 0 )
+                {
+                    packetBytes[numPackets] = bytes;
+                    if ( receiveTimes )
+                        receiveTimes[numPackets] = time;
+                    numPackets++;
+                }
+
+                // the packet has been copied out, so the frame goes straight back to the kernel to receive into again
+
+                ( (uint64_t*) queue.fill.entries )[fillProducer++ & queue.fill.mask] = descriptor.addr & ~uint64_t( SocketXdpFrameSize - 1 );
+            }
+
+            if ( numRead > 0 )
+            {
+                __atomic_store_n( queue.receive.consumer, consumer + numRead, __ATOMIC_RELEASE );
+                __atomic_store_n( queue.fill.producer, fillProducer, __ATOMIC_RELEASE );
+            }
+
+            if ( __atomic_load_n( queue.fill.flags, __ATOMIC_RELAXED ) & XDP_RING_NEED_WAKEUP )
+                recvfrom( queue.fd, NULL, 0, MSG_DONTWAIT, NULL, NULL );
+        }
+
+        return numPackets;
+    }
+
+    static bool socket_xdp_wait( SocketXdp * xdp, double timeout )
+    {
+        for ( int i = 0; i < xdp->numQueues; ++i )
+        {
+            SocketXdpQueue & queue = xdp->queues[i];
+            if ( __atomic_load_n( queue.receive.producer, __ATOMIC_ACQUIRE ) != *queue.receive.consumer )
+                return true;
+        }
+
+        pollfd fds[SocketXdpMaxQueues+1];
+
+        fds[0].fd = xdp->socket;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+
+        for ( int i = 0; i < xdp->numQueues; ++i )
+        {
+            fds[i+1].fd = xdp->queues[i].fd;
+            fds[i+1].events = POLLIN;
+            fds[i+1].revents = 0;
+        }
+
+        timespec waitTime;
+        waitTime.tv_sec = (time_t) timeout;
+        waitTime.tv_nsec = (long) ( ( timeout - waitTime.tv_sec ) * 1000000000.0 );
+
+        return ppoll( fds, xdp->numQueues + 1, &waitTime, NULL ) > 0;
+    }
+
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+
+#if YOJIMBO_SOCKETS_RIO
+
+    /**
+        The Registered I/O state for a socket created with SOCKET_FLAG_RIO.
+
+        Receive buffers, send slots and the addresses that go with them all live in one block of memory registered with the kernel once, so posting a receive or send never pins or copies a buffer description.
+
+        Receives and sends complete on separate completion queues, so the receive thread of a ThreadedNetworkTransport and the thread sending packets never dequeue from the same queue.
+     */
+
+    struct SocketRio
+    {
+        RIO_EXTENSION_FUNCTION_TABLE functions;                     ///< The Registered I/O functions, looked up from the socket.
+        RIO_CQ receiveQueue;                                        ///< The completion queue for receives.
+        RIO_CQ sendQueue;                                           ///< The completion queue for sends.
+        RIO_RQ requestQueue;                                        ///< The request queue receives and sends are posted on. Closed with the socket.
+        RIO_BUFFERID bufferId;                                      ///< The registered buffer id for memory.
+        HANDLE receiveEvent;                                        ///< Signalled by RIONotify when receives complete. See Socket::WaitForPackets.
+        SRWLOCK requestLock;                                        ///< Held while posting to the request queue, since RIO requests on one queue must not be posted from two threads at once.
+        bool dualStack;                                             ///< True if the socket is a dual-stack IPv6 socket. See SOCKET_FLAG_DUAL_STACK.
+        uint32_t receiveBuffersOffset;                              ///< Offset of the receive buffers in memory. Buffer i starts at receiveBuffersOffset + i * SocketRioMaxPacketSize.
+        uint32_t receiveAddressesOffset;                            ///< Offset of the receive source addresses in memory. One SOCKADDR_INET per receive buffer.
+        uint32_t sendBuffersOffset;                                 ///< Offset of the send slot buffers in memory. Slot i starts at sendBuffersOffset + i * SocketRioMaxPacketSize.
+        uint32_t sendAddressesOffset;                               ///< Offset of the send slot destination addresses in memory. One SOCKADDR_INET per send slot.
+        int freeSendSlots[SocketRioNumSendSlots];                   ///< Stack of free send slot indices.
+        int numFreeSendSlots;                                       ///< Number of free send slots.
+        uint8_t * memory;                                           ///< The registered memory.
+        size_t memorySize;                                          ///< The size of the registered memory (bytes).
+    };
+
+    static bool socket_rio_post_receive( SocketRio * rio, int bufferIndex, DWORD flags )
+    {
+        RIO_BUF data;
+        data.BufferId = rio->bufferId;
+        data.Offset = rio->receiveBuffersOffset + uint32_t( bufferIndex ) * SocketRioMaxPacketSize;
+        data.Length = SocketRioMaxPacketSize;
+
+        RIO_BUF address;
+        address.BufferId = rio->bufferId;
+        address.Offset = rio->receiveAddressesOffset + uint32_t( bufferIndex ) * sizeof( SOCKADDR_INET );
+        address.Length = sizeof( SOCKADDR_INET );
+
+        if ( !rio->functions.RIOReceiveEx( rio->requestQueue, &data, 1, NULL, &address, NULL, NULL, flags, (PVOID) (uintptr_t) bufferIndex ) )
+        {
+            debug_printf( "RIOReceiveEx failed with error %d\n", WSAGetLastError() );
+            return false;
+        }
+
+        return true;
+    }
+
+    static void socket_rio_commit_receives( SocketRio * rio )
+    {
+        if ( !rio->functions.RIOReceiveEx( rio->requestQueue, NULL, 0, NULL, NULL, NULL, NULL, RIO_MSG_COMMIT_ONLY, NULL ) )
+            debug_printf( "RIOReceiveEx commit failed with error %d\n", WSAGetLastError() );
+    }
+
+    static void socket_rio_free( SocketRio * rio )
+    {
+        if ( rio->receiveQueue != RIO_INVALID_CQ )
+            rio->functions.RIOCloseCompletionQueue( rio->receiveQueue );
+        if ( rio->sendQueue != RIO_INVALID_CQ )
+            rio->functions.RIOCloseCompletionQueue( rio->sendQueue );
+        if ( rio->bufferId != RIO_INVALID_BUFFERID )
+            rio->functions.RIODeregisterBuffer( rio->bufferId );
+        if ( rio->receiveEvent )
+            CloseHandle( rio->receiveEvent );
+        VirtualFree( rio->memory, 0, MEM_RELEASE );
+    }
+
+    static SocketRio * socket_rio_create( SOCKET socket, bool dualStack )
+    {
+        // IMPORTANT: Everything the kernel reads or writes for us lives in one block of memory, registered as a single buffer. Page aligned memory from VirtualAlloc keeps registration cheap.
+
+        const size_t receiveBuffersOffset = ( sizeof( SocketRio ) + 63 ) & ~size_t( 63 );
+        const size_t receiveAddressesOffset = receiveBuffersOffset + size_t( SocketRioMaxPacketSize ) * SocketRioNumReceiveBuffers;
+        const size_t sendBuffersOffset = receiveAddressesOffset + sizeof( SOCKADDR_INET ) * SocketRioNumReceiveBuffers;
+        const size_t sendAddressesOffset = sendBuffersOffset + size_t( SocketRioMaxPacketSize ) * SocketRioNumSendSlots;
+        const size_t memorySize = sendAddressesOffset + sizeof( SOCKADDR_INET ) * SocketRioNumSendSlots;
+
+        uint8_t * memory = (uint8_t*) VirtualAlloc( NULL, memorySize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+        if ( !memory )
+            return NULL;
+
+        SocketRio * rio = (SocketRio*) memory;
+        memset( rio, 0, sizeof( SocketRio ) );
+        rio->receiveQueue = RIO_INVALID_CQ;
+        rio->sendQueue = RIO_INVALID_CQ;
+        rio->requestQueue = RIO_INVALID_RQ;
+        rio->bufferId = RIO_INVALID_BUFFERID;
+        rio->dualStack = dualStack;
+        rio->receiveBuffersOffset = uint32_t( receiveBuffersOffset );
+        rio->receiveAddressesOffset = uint32_t( receiveAddressesOffset );
+        rio->sendBuffersOffset = uint32_t( sendBuffersOffset );
+        rio->sendAddressesOffset = uint32_t( sendAddressesOffset );
+        rio->memory = memory;
+        rio->memorySize = memorySize;
+
+        InitializeSRWLock( &rio->requestLock );
+
+        for ( int i = 0; i < SocketRioNumSendSlots; ++i )
+            rio->freeSendSlots[i] = i;
+        rio->numFreeSendSlots = SocketRioNumSendSlots;
+
+        GUID functionTableId = WSAID_MULTIPLE_RIO;
+        rio->functions.cbSize = sizeof( rio->functions );
+        DWORD bytes = 0;
+        if ( WSAIoctl( socket, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &functionTableId, sizeof( functionTableId ), &rio->functions, sizeof( rio->functions ), &bytes, NULL, NULL ) != 0 )
+        {
+            VirtualFree( memory, 0, MEM_RELEASE );
+            return NULL;
+        }
+
+        rio->receiveEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+        if ( !rio->receiveEvent )
+        {
+            socket_rio_free( rio );
+            return NULL;
+        }
+
+        RIO_NOTIFICATION_COMPLETION notification;
+        memset( &notification, 0, sizeof( notification ) );
+        notification.Type = RIO_EVENT_COMPLETION;
+        notification.Event.EventHandle = rio->receiveEvent;
+        notification.Event.NotifyReset = TRUE;
+
+        // IMPORTANT: Each posted receive or send completes exactly once, so sizing each completion queue to the number of requests that can be posted on it means it can't overflow.
+
+        rio->receiveQueue = rio->functions.RIOCreateCompletionQueue( SocketRioNumReceiveBuffers, &notification );
+        rio->sendQueue = rio->functions.RIOCreateCompletionQueue( SocketRioNumSendSlots, NULL );
+        rio->bufferId = rio->functions.RIORegisterBuffer( (PCHAR) memory, DWORD( memorySize ) );
+
+        if ( rio->receiveQueue == RIO_INVALID_CQ || rio->sendQueue == RIO_INVALID_CQ || rio->bufferId == RIO_INVALID_BUFFERID )
+        {
+            socket_rio_free( rio );
+            return NULL;
+        }
+
+        rio->requestQueue = rio->functions.RIOCreateRequestQueue( socket, SocketRioNumReceiveBuffers, 1, SocketRioNumSendSlots, 1, rio->receiveQueue, rio->sendQueue, NULL );
+        if ( rio->requestQueue == RIO_INVALID_RQ )
+        {
+            socket_rio_free( rio );
+            return NULL;
+        }
+
+        for ( int i = 0; i < SocketRioNumReceiveBuffers; ++i )
+        {
+            if ( !socket_rio_post_receive( rio, i, RIO_MSG_DEFER ) )
+            {
+                socket_rio_free( rio );
+                return NULL;
+            }
+        }
+
+        socket_rio_commit_receives( rio );
+
+        return rio;
+    }
+
+    static void socket_rio_destroy( SocketRio * rio )
+    {
+        // IMPORTANT: Call this only after the socket is closed. Closing the socket completes the receives still posted and frees the request queue, so the kernel is done with the registered memory.
+
+        socket_rio_free( rio );
+    }
+
+    static void socket_rio_reap_sends( SocketRio * rio )
+    {
+        RIORESULT results[64];
+
+        while ( true )
+        {
+            const ULONG numResults = rio->functions.RIODequeueCompletion( rio->sendQueue, results, 64 );
+
+            if ( numResults == 0 || numResults == RIO_CORRUPT_CQ )
+                break;
+
+            for ( ULONG i = 0; i < numResults; ++i )
+            {
+                if ( results[i].Status != 0 )
+                    debug_printf( "RIO send failed with error %d\n", (int) results[i].Status );
+
+                assert( results[i].RequestContext < uint64_t( SocketRioNumSendSlots ) );
+                assert( rio->numFreeSendSlots < SocketRioNumSendSlots );
+
+                rio->freeSendSlots[rio->numFreeSendSlots++] = (int) results[i].RequestContext;
+            }
+        }
+    }
+
+    static bool socket_rio_queue_send( SocketRio * rio, const Address & to, const uint8_t * packetData, int packetBytes )
+    {
+        if ( packetBytes > SocketRioMaxPacketSize || rio->numFreeSendSlots == 0 )
+            return false;
+
+        sockaddr_storage socketAddress;
+
+        const int addressLength = socket_address( to, rio->dualStack, socketAddress );
+        if ( !addressLength )
+            return true;
+
+        const int slotIndex = rio->freeSendSlots[rio->numFreeSendSlots - 1];
+
+        RIO_BUF data;
+        data.BufferId = rio->bufferId;
+        data.Offset = rio->sendBuffersOffset + uint32_t( slotIndex ) * SocketRioMaxPacketSize;
+        data.Length = packetBytes;
+
+        RIO_BUF address;
+        address.BufferId = rio->bufferId;
+        address.Offset = rio->sendAddressesOffset + uint32_t( slotIndex ) * sizeof( SOCKADDR_INET );
+        address.Length = sizeof( SOCKADDR_INET );
+
+        memcpy( rio->memory + data.Offset, packetData, packetBytes );
+        memset( rio->memory + address.Offset, 0, sizeof( SOCKADDR_INET ) );
+        memcpy( rio->memory + address.Offset, &socketAddress, addressLength );
+
+        AcquireSRWLockExclusive( &rio->requestLock );
+        const BOOL result = rio->functions.RIOSendEx( rio->requestQueue, &data, 1, NULL, &address, NULL, NULL, RIO_MSG_DEFER, (PVOID) (uintptr_t) slotIndex );
+        ReleaseSRWLockExclusive( &rio->requestLock );
+
+        if ( !result )
+        {
+            debug_printf( "RIOSendEx failed with error %d\n", WSAGetLastError() );
+            return false;
+        }
+
+        rio->numFreeSendSlots--;
+
+        return true;
+    }
+
+    static void socket_rio_flush_sends( SocketRio * rio )
+    {
+        AcquireSRWLockExclusive( &rio->requestLock );
+        const BOOL result = rio->functions.RIOSendEx( rio->requestQueue, NULL, 0, NULL, NULL, NULL, NULL, RIO_MSG_COMMIT_ONLY, NULL );
+        ReleaseSRWLockExclusive( &rio->requestLock );
+
+        if ( !result )
+            debug_printf( "RIOSendEx commit failed with error %d\n", WSAGetLastError() );
+    }
+
+    static int socket_rio_receive( SocketRio * rio, int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes )
+    {
+        RIORESULT results[64];
+
+        const double time = receiveTimes ? platform_time() : 0.0;
+
+        int numPackets = 0;
+
+        while ( numPackets < maxPackets )
+        {
+            const ULONG numResults = rio->functions.RIODequeueCompletion( rio->receiveQueue, results, ULONG( ( maxPackets - numPackets < 64 ) ? maxPackets - numPackets : 64 ) );
+
+            if ( numResults == RIO_CORRUPT_CQ )
+            {
+                debug_printf( "RIODequeueCompletion failed\n" );
+                break;
+            }
+
+            if ( numResults == 0 )
+                break;
+
+            AcquireSRWLockExclusive( &rio->requestLock );
+
+            for ( ULONG i = 0; i < numResults; ++i )
+            {
+                const int bufferIndex = (int) results[i].RequestContext;
+
+                assert( bufferIndex >= 0 );
+                assert( bufferIndex < SocketRioNumReceiveBuffers );
+
+                const int bytes = (int) results[i].BytesTransferred;
+
+                // IMPORTANT: Packets too large for the buffer or for the caller are discarded, like recvfrom does for packets larger than maxPacketSize.
+
+                if ( results[i].Status == 0 && bytes > 0 && bytes <= maxPacketSize )
+                {
+                    const uint8_t * buffer = rio->memory + rio->receiveBuffersOffset + size_t( bufferIndex ) * SocketRioMaxPacketSize;
+
+                    sockaddr_storage address;
+                    memset( &address, 0, sizeof( address ) );
+                    memcpy( &address, rio->memory + rio->receiveAddressesOffset + size_t( bufferIndex ) * sizeof( SOCKADDR_INET ), sizeof( SOCKADDR_INET ) );
+
+                    memcpy( packetData + numPackets * maxPacketSize, buffer, bytes );
+                    from[numPackets] = Address( &address );
+                    packetBytes[numPackets] = bytes;
+
+                    if ( receiveTimes )
+                        receiveTimes[numPackets] = time;
+
+                    numPackets++;
+                }
+
+                socket_rio_post_receive( rio, bufferIndex, RIO_MSG_DEFER );
+            }
+
+            socket_rio_commit_receives( rio );
+
+            ReleaseSRWLockExclusive( &rio->requestLock );
+        }
+
+        return numPackets;
+    }
+
+    static bool socket_rio_wait( SocketRio * rio, double timeout )
+    {
+        // IMPORTANT: RIONotify signals the event as soon as the completion queue is not empty, including for completions that were already waiting when it was called.
+
+        const int result = rio->functions.RIONotify( rio->receiveQueue );
+        if ( result != ERROR_SUCCESS && result != WSAEALREADY )
+        {
+            debug_printf( "RIONotify failed with error %d\n", result );
+            return false;
+        }
+
+        return WaitForSingleObject( rio->receiveEvent, DWORD( timeout * 1000.0 ) ) == WAIT_OBJECT_0;
+    }
+
+#endif // #if YOJIMBO_SOCKETS_RIO
+
+#if YOJIMBO_SOCKETS_RECVMSG_X
+
+    static int socket_receive_x( SocketHandle socket, int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes )
+    {
+        msghdr_x * messages = (msghdr_x*) alloca( sizeof( msghdr_x ) * maxPackets );
+        iovec * buffers = (iovec*) alloca( sizeof( iovec ) * maxPackets );
+        sockaddr_storage * addresses = (sockaddr_storage*) alloca( sizeof( sockaddr_storage ) * maxPackets );
+
+        memset( messages, 0, sizeof( msghdr_x ) * maxPackets );
+
+        for ( int i = 0; i < maxPackets; ++i )
+        {
+            buffers[i].iov_base = packetData + i * maxPacketSize;
+            buffers[i].iov_len = maxPacketSize;
+            messages[i].msg_name = &addresses[i];
+            messages[i].msg_namelen = sizeof( sockaddr_storage );
+            messages[i].msg_iov = &buffers[i];
+            messages[i].msg_iovlen = 1;
+        }
+
+        // IMPORTANT: recvmsg_x returns the number of datagrams read, and sets msg_datalen to the size of each one.
+
+        const int result = (int) recvmsg_x( socket, messages, (u_int) maxPackets, MSG_DONTWAIT );
+
+        if ( result <= 0 )
+        {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                return 0;
+
+            debug_printf( "recvmsg_x failed with error %d\n", errno );
+
+            return 0;
+        }
+
+        const double time = receiveTimes ? platform_time() : 0.0;
+
+        int numPackets = 0;
+
+        for ( int i = 0; i < result; ++i )
+        {
+            if ( messages[i].msg_datalen == 0 )
+                continue;
+
+            if ( numPackets != i )
+                memmove( packetData + numPackets * maxPacketSize, packetData + i * maxPacketSize, messages[i].msg_datalen );
+
+            from[numPackets] = Address( &addresses[i] );
+            packetBytes[numPackets] = (int) messages[i].msg_datalen;
+
+            if ( receiveTimes )
+                receiveTimes[numPackets] = time;
+
+            numPackets++;
+        }
+
+        return numPackets;
+    }
+
+#endif // #if YOJIMBO_SOCKETS_RECVMSG_X
+
+    Socket::Socket( const Address & address, int sendBufferSize, int receiveBufferSize, int flags )
+    {
+        assert( IsNetworkInitialized() );
+
+        assert( address.IsValid() );
+
+        m_error = SOCKET_ERROR_NONE;
+
+        m_ring = NULL;
+
+        m_xdp = NULL;
+
+        m_rio = NULL;
+
+        m_kqueue = -1;
+
+        m_dualStack = ( flags & SOCKET_FLAG_DUAL_STACK ) != 0;
+
+        m_txTime = false;
+
+        m_receiveErrors = false;
+
+        assert( !m_dualStack || address.GetType() == ADDRESS_IPV6 );
+
+        // create socket
+
+#if YOJIMBO_SOCKETS_RIO
+        // IMPORTANT: Registered I/O only works on sockets created with WSA_FLAG_REGISTERED_IO. Regular socket calls still work on these sockets, so they fall back cleanly.
+        if ( flags & SOCKET_FLAG_RIO )
+            m_socket = WSASocketW( ( address.GetType() == ADDRESS_IPV6 ) ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_REGISTERED_IO );
+        else
+#endif // #if YOJIMBO_SOCKETS_RIO
+        m_socket = socket( ( address.GetType() == ADDRESS_IPV6 ) ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        if ( m_socket == INVALID_SOCKET )
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        if ( m_socket <= 0 )
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        {
+            m_error = SOCKET_ERROR_CREATE_FAILED;
+            return;
+        }
+
+        // force IPv6 only if necessary. dual-stack sockets clear this so they can send and receive IPv4 packets too
+
+        if ( address.GetType() == ADDRESS_IPV6 )
+        {
+            int ipv6Only = m_dualStack ? 0 : 1;
+            if ( setsockopt( m_socket, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&ipv6Only, sizeof(ipv6Only) ) != 0 )
+            {
+                m_error = SOCKET_ERROR_SOCKOPT_IPV6_ONLY_FAILED;
+                return;
+            }
+        }
+
+        // increase socket send and receive buffer sizes
+
+        if ( setsockopt( m_socket, SOL_SOCKET, SO_SNDBUF, (char*)&sendBufferSize, sizeof(int) ) != 0 )
+        {
+            m_error = SOCKET_ERROR_SOCKOPT_SNDBUF_FAILED;
+            return;
+        }
+
+        if ( setsockopt( m_socket, SOL_SOCKET, SO_RCVBUF, (char*)&receiveBufferSize, sizeof(int) ) != 0 )
+        {
+            m_error = SOCKET_ERROR_SOCKOPT_RCVBUF_FAILED;
+            return;
+        }
+
+#ifdef SO_RCVBUFFORCE
+
+        // the kernel quietly caps SO_RCVBUF at net.core.rmem_max. processes with CAP_NET_ADMIN can go past it, so buffers sized for many clients aren't cut down without anybody noticing
+
+        int actualReceiveBufferSize = 0;
+        socklen_t optionLength = sizeof( actualReceiveBufferSize );
+        if ( getsockopt( m_socket, SOL_SOCKET, SO_RCVBUF, (char*)&actualReceiveBufferSize, &optionLength ) == 0 && actualReceiveBufferSize < receiveBufferSize )
+        {
+            if ( setsockopt( m_socket, SOL_SOCKET, SO_RCVBUFFORCE, (char*)&receiveBufferSize, sizeof(int) ) != 0 )
+                debug_printf( "socket receive buffer capped at %d bytes by net.core.rmem_max\n", actualReceiveBufferSize / 2 );
+        }
+
+#endif // #ifdef SO_RCVBUFFORCE
+
+#if YOJIMBO_SOCKETS_TIMESTAMPS
+
+        // ask the kernel to timestamp packets as they are received. this is not fatal, without it packets are timestamped when they are read
+
+        int timestamps = 1;
+        if ( setsockopt( m_socket, SOL_SOCKET, SO_TIMESTAMPNS, (char*)&timestamps, sizeof(timestamps) ) != 0 )
+            debug_printf( "failed to enable socket receive timestamps\n" );
+
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+
+        // busy poll the device queue on receive. this is not fatal, without it receives wait for interrupts as usual
+
+        if ( flags & SOCKET_FLAG_BUSY_POLL )
+        {
+#ifdef SO_BUSY_POLL
+            int busyPoll = SocketBusyPollMicroseconds;
+            if ( setsockopt( m_socket, SOL_SOCKET, SO_BUSY_POLL, (char*)&busyPoll, sizeof(busyPoll) ) != 0 )
+                debug_printf( "failed to enable socket busy polling\n" );
+#ifdef SO_PREFER_BUSY_POLL
+            int preferBusyPoll = 1;
+            if ( setsockopt( m_socket, SOL_SOCKET, SO_PREFER_BUSY_POLL, (char*)&preferBusyPoll, sizeof(preferBusyPoll) ) != 0 )
+                debug_printf( "failed to prefer socket busy polling\n" );
+#endif // #ifdef SO_PREFER_BUSY_POLL
+#else // #ifdef SO_BUSY_POLL
+            debug_printf( "socket busy polling is not supported on this platform\n" );
+#endif // #ifdef SO_BUSY_POLL
+        }
+
+        // mark packets for QoS. this is not fatal, networks are free to ignore the marking anyway
+
+        if ( flags & SOCKET_FLAG_DSCP_EF )
+        {
+            if ( !SetDscp( SocketDscpExpedited ) )
+                debug_printf( "failed to mark socket packets with the expedited forwarding DSCP\n" );
+        }
+
+        // send with the don't fragment bit set, so packets larger than the path MTU are dropped instead of fragmented
+
+        if ( flags & SOCKET_FLAG_PMTU_PROBE )
+        {
+#if defined( IP_PMTUDISC_PROBE ) && defined( IPV6_PMTUDISC_PROBE )
+            const bool ipv6 = address.GetType() == ADDRESS_IPV6;
+            int probe = ipv6 ? IPV6_PMTUDISC_PROBE : IP_PMTUDISC_PROBE;
+            if ( setsockopt( m_socket, ipv6 ? IPPROTO_IPV6 : IPPROTO_IP, ipv6 ? IPV6_MTU_DISCOVER : IP_MTU_DISCOVER, (char*)&probe, sizeof(probe) ) != 0 )
+            {
+                m_error = SOCKET_ERROR_SOCKOPT_MTU_DISCOVER_FAILED;
+                return;
+            }
+
+            // IMPORTANT: IPv4 packets sent to a dual-stack socket go out as IPv4, so they need the IPv4 option as well.
+
+            int probe4 = IP_PMTUDISC_PROBE;
+            if ( m_dualStack && setsockopt( m_socket, IPPROTO_IP, IP_MTU_DISCOVER, (char*)&probe4, sizeof(probe4) ) != 0 )
+                debug_printf( "failed to set IPv4 path MTU probing on dual-stack socket\n" );
+#else // #if defined( IP_PMTUDISC_PROBE ) && defined( IPV6_PMTUDISC_PROBE )
+            m_error = SOCKET_ERROR_SOCKOPT_MTU_DISCOVER_FAILED;
+            return;
+#endif // #if defined( IP_PMTUDISC_PROBE ) && defined( IPV6_PMTUDISC_PROBE )
+        }
+
+        // share the port with other sockets
+
+        if ( flags & SOCKET_FLAG_REUSE_PORT )
+        {
+#ifdef SO_REUSEPORT
+            int yes = 1;
+            if ( setsockopt( m_socket, SOL_SOCKET, SO_REUSEPORT, (char*)&yes, sizeof(yes) ) != 0 )
+            {
+                m_error = SOCKET_ERROR_SOCKOPT_REUSEPORT_FAILED;
+                return;
+            }
+#else // #ifdef SO_REUSEPORT
+            m_error = SOCKET_ERROR_SOCKOPT_REUSEPORT_FAILED;
+            return;
+#endif // #ifdef SO_REUSEPORT
+        }
+
+        // bind to port
+
+        if ( address.GetType() == ADDRESS_IPV6 )
+        {
+            sockaddr_in6 sock_address;
+            memset( &sock_address, 0, sizeof( sockaddr_in6 ) );
+            sock_address.sin6_family = AF_INET6;
+            memcpy( &sock_address.sin6_addr, address.GetAddress6(), sizeof( sock_address.sin6_addr ) );
+            sock_address.sin6_port = htons( address.GetPort() );
+
+            if ( ::bind( m_socket, (const sockaddr*) &sock_address, sizeof(sock_address) ) < 0 )
+            {
+                m_error = SOCKET_ERROR_BIND_IPV6_FAILED;
+                return;
+            }
+        }
+        else
+        {
+            sockaddr_in sock_address;
+            sock_address.sin_family = AF_INET;
+            sock_address.sin_addr.s_addr = address.GetAddress4();
+            sock_address.sin_port = htons( address.GetPort() );
+
+            if ( ::bind( m_socket, (const sockaddr*) &sock_address, sizeof(sock_address) ) < 0 )
+            {
+                m_error = SOCKET_ERROR_BIND_IPV4_FAILED;
+                return;
+            }
+        }
+
+        m_address = address;
+
+        // steer packets to the sockets sharing the port by the CPU they were received on
+
+        if ( flags & SOCKET_FLAG_STEER_BY_CPU )
+        {
+            assert( flags & SOCKET_FLAG_REUSE_PORT );
+
+#if defined( SO_ATTACH_REUSEPORT_CBPF ) && defined( SKF_AD_CPU )
+
+            // IMPORTANT: The program returns the index of the socket in the reuseport group to deliver to. Returning the CPU id maps CPU N to the Nth socket bound.
+            // The program belongs to the whole group, so every socket attaching it is harmless, and means it doesn't matter which socket is bound first.
+
+            struct sock_filter code[] = 
+            {
+                { BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32_t( SKF_AD_OFF + SKF_AD_CPU ) },
+                { BPF_RET | BPF_A, 0, 0, 0 },
+            };
+
+            struct sock_fprog program;
+            program.len = sizeof( code ) / sizeof( code[0] );
+            program.filter = code;
+
+            if ( setsockopt( m_socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof( program ) ) != 0 )
+            {
+                m_error = SOCKET_ERROR_ATTACH_CPU_STEERING_FAILED;
+                return;
+            }
+
+#else // #if defined( SO_ATTACH_REUSEPORT_CBPF ) && defined( SKF_AD_CPU )
+
+            m_error = SOCKET_ERROR_ATTACH_CPU_STEERING_FAILED;
+            return;
+
+#endif // #if defined( SO_ATTACH_REUSEPORT_CBPF ) && defined( SKF_AD_CPU )
+        }
+
+        // if bound to port 0 find the actual port we got
+
+        if ( address.GetPort() == 0 )
+        {
+            if ( address.GetType() == ADDRESS_IPV6 )
+            {
+                struct sockaddr_in6 sin;
+                socklen_t len = sizeof( sin );
+                if ( getsockname( m_socket, (struct sockaddr*)&sin, &len ) == -1 )
+                {
+                    m_error = SOCKET_ERROR_GET_SOCKNAME_IPV6_FAILED;
+                    return;
+                }
+                m_address.SetPort( ntohs( sin.sin6_port ) );
+            }
+            else
+            {
+                struct sockaddr_in sin;
+                socklen_t len = sizeof( sin );
+                if ( getsockname( m_socket, (struct sockaddr*)&sin, &len ) == -1 )
+                {
+                    m_error = SOCKET_ERROR_GET_SOCKNAME_IPV4_FAILED;
+                    return;
+                }
+                m_address.SetPort( ntohs( sin.sin_port ) );
+            }
+        }
+
+        // set non-blocking io
+
+        #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC || YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX
+    
+            int nonBlocking = 1;
+            if ( fcntl( m_socket, F_SETFL, O_NONBLOCK, nonBlocking ) == -1 )
+            {
+                m_error = SOCKET_ERROR_SET_NON_BLOCKING_FAILED;
+                return;
+            }
+        
+        #elif YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+    
+            DWORD nonBlocking = 1;
+            if ( ioctlsocket( m_socket, FIONBIO, &nonBlocking ) != 0 )
+            {
+                m_error = SOCKET_ERROR_SET_NON_BLOCKING_FAILED;
+                return;
+            }
+
+        #else
+
+            #error unsupported platform
+
+        #endif
+
+        // send and receive packets for the socket address through AF_XDP, if it's available. packets it can't handle still go through the socket
+
+#if YOJIMBO_SOCKETS_AF_XDP
+        if ( ( flags & SOCKET_FLAG_AF_XDP ) && !m_dualStack )
+        {
+            m_xdp = socket_xdp_create( m_socket, m_address, true );
+
+            if ( m_xdp && !socket_xdp_attach( m_xdp ) )
+            {
+                socket_xdp_destroy( m_xdp );
+                m_xdp = NULL;
+            }
+        }
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+
+        // send and receive through io_uring, if it's available
+
+#if YOJIMBO_SOCKETS_IO_URING
+        if ( ( flags & SOCKET_FLAG_IO_URING ) && !m_xdp )
+            m_ring = socket_ring_create( m_socket, m_dualStack );
+#endif // #if YOJIMBO_SOCKETS_IO_URING
+
+        // send and receive through registered I/O, if it's available
+
+#if YOJIMBO_SOCKETS_RIO
+        if ( flags & SOCKET_FLAG_RIO )
+            m_rio = socket_rio_create( (SOCKET) m_socket, m_dualStack );
+#endif // #if YOJIMBO_SOCKETS_RIO
+
+        // wait for packets with kqueue, if it's available. this is not fatal, without it sockets wait with select
+
+#if YOJIMBO_SOCKETS_KQUEUE
+        m_kqueue = kqueue();
+        if ( m_kqueue >= 0 )
+        {
+            struct kevent change;
+            EV_SET( &change, m_socket, EVFILT_READ, EV_ADD, 0, 0, NULL );
+            if ( kevent( m_kqueue, &change, 1, NULL, 0, NULL ) == -1 )
+            {
+                close( m_kqueue );
+                m_kqueue = -1;
+            }
+        }
+        if ( m_kqueue < 0 )
+            debug_printf( "failed to create kqueue for socket\n" );
+#endif // #if YOJIMBO_SOCKETS_KQUEUE
+
+        // queue errors for sent packets. this is not fatal, without it errors for packets sent from unconnected sockets are dropped by the kernel
+        // IMPORTANT: Each error also fails the next receive call on the socket. The receive paths here read again when that happens, but an io_uring multishot receive would stop, so sockets using io_uring don't queue errors.
+
+#if defined( IP_RECVERR ) && defined( IPV6_RECVERR )
+        if ( ( flags & SOCKET_FLAG_RECEIVE_ERRORS ) && !m_ring )
+        {
+            const bool ipv6 = address.GetType() == ADDRESS_IPV6;
+            int receiveErrors = 1;
+            if ( setsockopt( m_socket, ipv6 ? IPPROTO_IPV6 : IPPROTO_IP, ipv6 ? IPV6_RECVERR : IP_RECVERR, (char*)&receiveErrors, sizeof(receiveErrors) ) == 0 )
+            {
+                m_receiveErrors = true;
+
+                // IMPORTANT: IPv4 packets sent from a dual-stack socket go out as IPv4, so they need the IPv4 option as well.
+
+                if ( m_dualStack && setsockopt( m_socket, IPPROTO_IP, IP_RECVERR, (char*)&receiveErrors, sizeof(receiveErrors) ) != 0 )
+                    debug_printf( "failed to queue IPv4 errors on dual-stack socket\n" );
+            }
+            else
+            {
+                debug_printf( "failed to queue socket errors\n" );
+            }
+        }
+#else // #if defined( IP_RECVERR ) && defined( IPV6_RECVERR )
+        if ( flags & SOCKET_FLAG_RECEIVE_ERRORS )
+            debug_printf( "queueing socket errors is not supported on this platform\n" );
+#endif // #if defined( IP_RECVERR ) && defined( IPV6_RECVERR )
+    }
+
+    Socket::~Socket()
+    {
+        assert( IsNetworkInitialized() );
+
+#if YOJIMBO_SOCKETS_IO_URING
+        if ( m_ring )
+        {
+            socket_ring_destroy( m_ring );
+            m_ring = NULL;
+        }
+#endif // #if YOJIMBO_SOCKETS_IO_URING
+
+#if YOJIMBO_SOCKETS_AF_XDP
+        if ( m_xdp )
+        {
+            socket_xdp_destroy( m_xdp );
+            m_xdp = NULL;
+        }
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+
+#if YOJIMBO_SOCKETS_KQUEUE
+        if ( m_kqueue >= 0 )
+        {
+            close( m_kqueue );
+            m_kqueue = -1;
+        }
+#endif // #if YOJIMBO_SOCKETS_KQUEUE
+
+        if ( m_socket != 0 )
+        {
+            #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_MAC || YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_UNIX
+            close( m_socket );
+            #elif YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+            closesocket( m_socket );
+            #else
+            #error unsupported platform
+            #endif
+            m_socket = 0;
+        }
+
+#if YOJIMBO_SOCKETS_RIO
+        if ( m_rio )
+        {
+            socket_rio_destroy( m_rio );
+            m_rio = NULL;
+        }
+#endif // #if YOJIMBO_SOCKETS_RIO
+    }
+
+    bool Socket::IsError() const
+    {
+        return m_error != SOCKET_ERROR_NONE;
+    }
+
+    SocketError Socket::GetError() const
+    {
+        return m_error;
+    }
+
+    void Socket::SendPacket( const Address & to, const void * packetData, size_t packetBytes )
+    {
+        assert( packetData );
+        assert( packetBytes > 0 );
+        assert( to.IsValid() );
+        assert( m_socket );
+        assert( !IsError() );
+
+#if YOJIMBO_SOCKETS_AF_XDP
+        if ( m_xdp && m_xdp->numQueues > 0 && socket_xdp_queue_send( m_xdp, to, (const uint8_t*) packetData, (int) packetBytes ) )
+        {
+            socket_xdp_flush_sends( m_xdp );
+            return;
+        }
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+
+#if YOJIMBO_SOCKETS_RIO
+        if ( m_rio )
+        {
+            socket_rio_reap_sends( m_rio );
+
+            if ( socket_rio_queue_send( m_rio, to, (const uint8_t*) packetData, (int) packetBytes ) )
+            {
+                socket_rio_flush_sends( m_rio );
+                return;
+            }
+        }
+#endif // #if YOJIMBO_SOCKETS_RIO
+
+        sockaddr_storage address;
+
+        const int addressLength = socket_address( to, m_dualStack, address );
+        if ( !addressLength )
+            return;
+
+        sendto( m_socket, (const char*)packetData, (int) packetBytes, 0, (sockaddr*)&address, addressLength );
+    }
+
+    void Socket::SendPackets( int numPackets, const Address * to, const uint8_t * packetData, int maxPacketSize, const int * packetBytes, const float * sendDelays )
+    {
+        assert( numPackets >= 0 );
+        assert( to );
+        assert( packetData );
+        assert( maxPacketSize > 0 );
+        assert( packetBytes );
+        assert( m_socket );
+        assert( !IsError() );
+
+#if YOJIMBO_SOCKETS_AF_XDP
+
+        if ( m_xdp && m_xdp->numQueues > 0 )
+        {
+            socket_xdp_reap_sends( m_xdp );
+
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                assert( packetBytes[i] > 0 );
+                assert( packetBytes[i] <= maxPacketSize );
+                assert( to[i].IsValid() );
+
+                // IMPORTANT: Packets that are too large, or sent to an address no packet has been received from yet, go out with sendto instead.
+
+                if ( !socket_xdp_queue_send( m_xdp, to[i], packetData + i * maxPacketSize, packetBytes[i] ) )
+                    SendPacket( to[i], packetData + i * maxPacketSize, packetBytes[i] );
+            }
+
+            socket_xdp_flush_sends( m_xdp );
+
+            return;
+        }
+
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+
+#if YOJIMBO_SOCKETS_IO_URING
+
+        if ( m_ring )
+        {
+            socket_ring_reap_sends( m_ring );
+
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                assert( packetBytes[i] > 0 );
+                assert( packetBytes[i] <= maxPacketSize );
+                assert( to[i].IsValid() );
+
+                // IMPORTANT: Packets that don't fit in a send slot, or are sent while every slot is in flight, go out with sendto instead.
+
+                if ( !socket_ring_queue_send( m_ring, to[i], packetData + i * maxPacketSize, packetBytes[i] ) )
+                    SendPacket( to[i], packetData + i * maxPacketSize, packetBytes[i] );
+            }
+
+            if ( uring_submit( m_ring->send ) < 0 )
+                debug_printf( "io_uring submit failed with error %d\n", errno );
+
+            return;
+        }
+
+#endif // #if YOJIMBO_SOCKETS_IO_URING
+
+#if YOJIMBO_SOCKETS_RIO
+
+        if ( m_rio )
+        {
+            socket_rio_reap_sends( m_rio );
+
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                assert( packetBytes[i] > 0 );
+                assert( packetBytes[i] <= maxPacketSize );
+                assert( to[i].IsValid() );
+
+                // IMPORTANT: Packets that don't fit in a send slot, or are sent while every slot is in flight, go out with sendto instead.
+
+                if ( !socket_rio_queue_send( m_rio, to[i], packetData + i * maxPacketSize, packetBytes[i] ) )
+                {
+                    sockaddr_storage address;
+                    const int addressLength = socket_address( to[i], m_dualStack, address );
+                    if ( addressLength )
+                        sendto( m_socket, (const char*) ( packetData + i * maxPacketSize ), packetBytes[i], 0, (sockaddr*)&address, addressLength );
+                }
+            }
+
+            socket_rio_flush_sends( m_rio );
+
+            return;
+        }
+
+#endif // #if YOJIMBO_SOCKETS_RIO
+
+#if YOJIMBO_SOCKETS_BATCH_IO
+
+        if ( numPackets == 0 )
+            return;
+
+        mmsghdr * messages = (mmsghdr*) alloca( sizeof( mmsghdr ) * numPackets );
+        iovec * buffers = (iovec*) alloca( sizeof( iovec ) * numPackets );
+        sockaddr_storage * addresses = (sockaddr_storage*) alloca( sizeof( sockaddr_storage ) * numPackets );
+
+        memset( messages, 0, sizeof( mmsghdr ) * numPackets );
+
+#if YOJIMBO_SOCKETS_TXTIME
+
+        // IMPORTANT: Departure times are absolute CLOCK_MONOTONIC times in nanoseconds, so the delays are added to the clock sampled once for the whole batch.
+
+        const int txTimeControlSize = int( CMSG_SPACE( sizeof( uint64_t ) ) );
+
+        uint8_t * txTimeControl = NULL;
+
+        uint64_t txTimeNow = 0;
+
+        if ( m_txTime && sendDelays )
+        {
+            txTimeControl = (uint8_t*) alloca( txTimeControlSize * numPackets );
+            memset( txTimeControl, 0, txTimeControlSize * numPackets );
+            timespec now;
+            clock_gettime( CLOCK_MONOTONIC, &now );
+            txTimeNow = uint64_t( now.tv_sec ) * 1000000000ULL + uint64_t( now.tv_nsec );
+        }
+
+#else // #if YOJIMBO_SOCKETS_TXTIME
+
+        (void) sendDelays;
+
+#endif // #if YOJIMBO_SOCKETS_TXTIME
+
+        int numMessages = 0;
+
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            assert( packetBytes[i] > 0 );
+            assert( packetBytes[i] <= maxPacketSize );
+            assert( to[i].IsValid() );
+
+            sockaddr_storage & address = addresses[numMessages];
+
+            const int addressLength = socket_address( to[i], m_dualStack, address );
+            if ( !addressLength )
+                continue;
+
+            buffers[numMessages].iov_base = (void*) ( packetData + i * maxPacketSize );
+            buffers[numMessages].iov_len = packetBytes[i];
+            messages[numMessages].msg_hdr.msg_name = &address;
+            messages[numMessages].msg_hdr.msg_namelen = addressLength;
+            messages[numMessages].msg_hdr.msg_iov = &buffers[numMessages];
+            messages[numMessages].msg_hdr.msg_iovlen = 1;
+
+#if YOJIMBO_SOCKETS_TXTIME
+            if ( txTimeControl )
+            {
+                msghdr & message = messages[numMessages].msg_hdr;
+                message.msg_control = txTimeControl + numMessages * txTimeControlSize;
+                message.msg_controllen = txTimeControlSize;
+                cmsghdr * cmsg = CMSG_FIRSTHDR( &message );
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_TXTIME;
+                cmsg->cmsg_len = CMSG_LEN( sizeof( uint64_t ) );
+                const uint64_t txTime = txTimeNow + uint64_t( max( sendDelays[i], 0.0f ) * 1000000000.0 );
+                memcpy( CMSG_DATA( cmsg ), &txTime, sizeof( txTime ) );
+            }
+#endif // #if YOJIMBO_SOCKETS_TXTIME
+
+            numMessages++;
+        }
+
+        int numMessagesSent = 0;
+
+        while ( numMessagesSent < numMessages )
+        {
+            int result = (int) sendmmsg( m_socket, messages + numMessagesSent, numMessages - numMessagesSent, 0 );
+
+            if ( result <= 0 )
+            {
+                // IMPORTANT: sendmmsg reports the error for the first message it could not send. Drop that packet (as sendto would) and carry on with the rest of the batch.
+
+                debug_printf( "sendmmsg failed with error %d\n", errno );
+                numMessagesSent++;
+                continue;
+            }
+
+            numMessagesSent += result;
+        }
+
+#else // #if YOJIMBO_SOCKETS_BATCH_IO
+
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            SendPacket( to[i], packetData + i * maxPacketSize, packetBytes[i] );
+        }
+
+#endif // #if YOJIMBO_SOCKETS_BATCH_IO
+    }
+
+    int Socket::ReceivePacket( Address & from, void * packetData, int maxPacketSize, double * receiveTime )
+    {
+        assert( m_socket );
+        assert( packetData );
+        assert( maxPacketSize > 0 );
+
+#if YOJIMBO_SOCKETS_AF_XDP
+        if ( m_xdp && m_xdp->numQueues > 0 )
+        {
+            int packetBytes = 0;
+            if ( socket_xdp_receive( m_xdp, 1, &from, (uint8_t*) packetData, maxPacketSize, &packetBytes, receiveTime ) )
+                return packetBytes;
+        }
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+
+#if YOJIMBO_SOCKETS_IO_URING
+        if ( m_ring && !m_ring->receiveUnsupported )
+        {
+            int packetBytes = 0;
+            if ( !socket_ring_receive( m_ring, 1, &from, (uint8_t*) packetData, maxPacketSize, &packetBytes, receiveTime ) )
+                return 0;
+            return packetBytes;
+        }
+#endif // #if YOJIMBO_SOCKETS_IO_URING
+
+#if YOJIMBO_SOCKETS_RIO
+        if ( m_rio )
+        {
+            int packetBytes = 0;
+            if ( !socket_rio_receive( m_rio, 1, &from, (uint8_t*) packetData, maxPacketSize, &packetBytes, receiveTime ) )
+                return 0;
+            return packetBytes;
+        }
+#endif // #if YOJIMBO_SOCKETS_RIO
+
+#if YOJIMBO_SOCKETS_TIMESTAMPS && YOJIMBO_SOCKETS_BATCH_IO
+        // IMPORTANT: recvfrom doesn't return the kernel receive timestamp, so read a batch of one through recvmmsg instead
+        if ( receiveTime )
+        {
+            int packetBytes = 0;
+            if ( !ReceiveSocketPackets( 1, &from, (uint8_t*) packetData, maxPacketSize, &packetBytes, receiveTime ) )
+                return 0;
+            return packetBytes;
+        }
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS && YOJIMBO_SOCKETS_BATCH_IO
+
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        typedef int socklen_t;
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        
+        sockaddr_storage sockaddr_from;
+        socklen_t fromLength = sizeof( sockaddr_from );
+
+        int result = recvfrom( m_socket, (char*)packetData, maxPacketSize, 0, (sockaddr*)&sockaddr_from, &fromLength );
+
+#if YOJIMBO_PLATFORM != YOJIMBO_PLATFORM_WINDOWS
+
+        // IMPORTANT: Errors queued with SOCKET_FLAG_RECEIVE_ERRORS fail the next receive call, even when packets are waiting. See Socket::ReceiveErrors.
+
+        if ( result < 0 && m_receiveErrors && errno != EAGAIN && errno != EWOULDBLOCK )
+        {
+            fromLength = sizeof( sockaddr_from );
+            result = recvfrom( m_socket, (char*)packetData, maxPacketSize, 0, (sockaddr*)&sockaddr_from, &fromLength );
+        }
+
+#endif // #if YOJIMBO_PLATFORM != YOJIMBO_PLATFORM_WINDOWS
+
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        if ( result == SOCKET_ERROR )
+        {
+            int error = WSAGetLastError();
+
+            if ( error == WSAEWOULDBLOCK )
+                return 0;
+
+            debug_printf( "recvfrom failed with error %d\n", error );
+
+            return 0;
+        }
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        if ( result <= 0 )
+        {
+            if ( errno == EAGAIN )
+                return 0;
+
+            debug_printf( "recvfrom failed with error %d\n", errno );
+
+            return 0;
+        }
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+
+        from = Address( &sockaddr_from );
+
+        if ( receiveTime )
+            *receiveTime = platform_time();
+
+        assert( result >= 0 );
+
+        const int bytesRead = result;
+
+        return bytesRead;
+    }
+
+    int Socket::ReceivePackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes )
+    {
+        assert( m_socket );
+        assert( maxPackets > 0 );
+        assert( from );
+        assert( packetData );
+        assert( maxPacketSize > 0 );
+        assert( packetBytes );
+
+#if YOJIMBO_SOCKETS_AF_XDP
+        if ( m_xdp && m_xdp->numQueues > 0 )
+        {
+            // IMPORTANT: Packets the XDP program passes to the kernel still arrive on the regular socket, so read those after the AF_XDP sockets.
+
+            const int numPackets = socket_xdp_receive( m_xdp, maxPackets, from, packetData, maxPacketSize, packetBytes, receiveTimes );
+            if ( numPackets == maxPackets )
+                return numPackets;
+
+            return numPackets + ReceiveSocketPackets( maxPackets - numPackets, from + numPackets, packetData + numPackets * maxPacketSize, maxPacketSize, packetBytes + numPackets, receiveTimes ? receiveTimes + numPackets : NULL );
+        }
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+
+        return ReceiveSocketPackets( maxPackets, from, packetData, maxPacketSize, packetBytes, receiveTimes );
+    }
+
+    int Socket::ReceiveSocketPackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes )
+    {
+        assert( m_socket );
+        assert( maxPackets > 0 );
+
+#if YOJIMBO_SOCKETS_IO_URING
+        if ( m_ring && !m_ring->receiveUnsupported )
+            return socket_ring_receive( m_ring, maxPackets, from, packetData, maxPacketSize, packetBytes, receiveTimes );
+#endif // #if YOJIMBO_SOCKETS_IO_URING
+
+#if YOJIMBO_SOCKETS_RIO
+        if ( m_rio )
+            return socket_rio_receive( m_rio, maxPackets, from, packetData, maxPacketSize, packetBytes, receiveTimes );
+#endif // #if YOJIMBO_SOCKETS_RIO
+
+#if YOJIMBO_SOCKETS_RECVMSG_X
+        return socket_receive_x( m_socket, maxPackets, from, packetData, maxPacketSize, packetBytes, receiveTimes );
+#elif YOJIMBO_SOCKETS_BATCH_IO
+
+        mmsghdr * messages = (mmsghdr*) alloca( sizeof( mmsghdr ) * maxPackets );
+        iovec * buffers = (iovec*) alloca( sizeof( iovec ) * maxPackets );
+        sockaddr_storage * addresses = (sockaddr_storage*) alloca( sizeof( sockaddr_storage ) * maxPackets );
+
+#if YOJIMBO_SOCKETS_TIMESTAMPS
+        uint8_t * control = receiveTimes ? (uint8_t*) alloca( SocketTimestampControlSize * maxPackets ) : NULL;
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+
+        memset( messages, 0, sizeof( mmsghdr ) * maxPackets );
+
+        for ( int i = 0; i < maxPackets; ++i )
+        {
+            buffers[i].iov_base = packetData + i * maxPacketSize;
+            buffers[i].iov_len = maxPacketSize;
+            messages[i].msg_hdr.msg_name = &addresses[i];
+            messages[i].msg_hdr.msg_namelen = sizeof( sockaddr_storage );
+            messages[i].msg_hdr.msg_iov = &buffers[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+#if YOJIMBO_SOCKETS_TIMESTAMPS
+            if ( control )
+            {
+                messages[i].msg_hdr.msg_control = control + i * SocketTimestampControlSize;
+                messages[i].msg_hdr.msg_controllen = SocketTimestampControlSize;
+            }
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+        }
+
+        int result = (int) recvmmsg( m_socket, messages, maxPackets, MSG_DONTWAIT, NULL );
+
+        // IMPORTANT: With SOCKET_FLAG_RECEIVE_ERRORS the kernel fails the next receive call with each error it queues, even when packets are waiting. The error stays queued for Socket::ReceiveErrors, so just read again.
+
+        if ( result < 0 && m_receiveErrors && errno != EAGAIN && errno != EWOULDBLOCK )
+            result = (int) recvmmsg( m_socket, messages, maxPackets, MSG_DONTWAIT, NULL );
+
+        if ( result <= 0 )
+        {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                return 0;
+
+            debug_printf( "recvmmsg failed with error %d\n", errno );
+
+            return 0;
+        }
+
+        double time = 0.0;
+#if YOJIMBO_SOCKETS_TIMESTAMPS
+        timespec realTime;
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+
+        if ( receiveTimes )
+        {
+#if YOJIMBO_SOCKETS_TIMESTAMPS
+            clock_gettime( CLOCK_REALTIME, &realTime );
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+            time = platform_time();
+        }
+
+        int numPackets = 0;
+
+        for ( int i = 0; i < result; ++i )
+        {
+            if ( messages[i].msg_len == 0 )
+                continue;
+
+            if ( numPackets != i )
+                memmove( packetData + numPackets * maxPacketSize, packetData + i * maxPacketSize, messages[i].msg_len );
+
+            from[numPackets] = Address( &addresses[i] );
+            packetBytes[numPackets] = (int) messages[i].msg_len;
+
+            if ( receiveTimes )
+            {
+#if YOJIMBO_SOCKETS_TIMESTAMPS
+                receiveTimes[numPackets] = socket_receive_time( messages[i].msg_hdr, realTime, time );
+#else // #if YOJIMBO_SOCKETS_TIMESTAMPS
+                receiveTimes[numPackets] = time;
+#endif // #if YOJIMBO_SOCKETS_TIMESTAMPS
+            }
+
+            numPackets++;
+        }
+
+        return numPackets;
+
+#else // #if YOJIMBO_SOCKETS_RECVMSG_X
+
+        int numPackets = 0;
+
+        while ( numPackets < maxPackets )
+        {
+            const int bytesRead = ReceivePacket( from[numPackets], packetData + numPackets * maxPacketSize, maxPacketSize, receiveTimes ? &receiveTimes[numPackets] : NULL );
+            if ( !bytesRead )
+                break;
+
+            packetBytes[numPackets] = bytesRead;
+            numPackets++;
+        }
+
+        return numPackets;
+
+#endif // #if YOJIMBO_SOCKETS_RECVMSG_X
+    }
+
+    bool Socket::WaitForPackets( double timeout )
+    {
+        assert( m_socket );
+        assert( timeout >= 0.0 );
+
+#if YOJIMBO_SOCKETS_AF_XDP
+        if ( m_xdp && m_xdp->numQueues > 0 )
+            return socket_xdp_wait( m_xdp, timeout );
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+
+#if YOJIMBO_SOCKETS_IO_URING
+        if ( m_ring && !m_ring->receiveUnsupported )
+            return uring_wait( m_ring->receive, timeout );
+#endif // #if YOJIMBO_SOCKETS_IO_URING
+
+#if YOJIMBO_SOCKETS_RIO
+        if ( m_rio )
+            return socket_rio_wait( m_rio, timeout );
+#endif // #if YOJIMBO_SOCKETS_RIO
+
+#if YOJIMBO_SOCKETS_KQUEUE
+        if ( m_kqueue >= 0 )
+        {
+            // IMPORTANT: Unlike select, kqueue has no FD_SETSIZE limit on the socket descriptor, and the socket is registered once when it's created rather than on every wait.
+
+            timespec waitTime;
+            waitTime.tv_sec = (time_t) timeout;
+            waitTime.tv_nsec = (long) ( ( timeout - waitTime.tv_sec ) * 1000000000.0 );
+
+            struct kevent event;
+            return kevent( m_kqueue, NULL, 0, &event, 1, &waitTime ) > 0;
+        }
+#endif // #if YOJIMBO_SOCKETS_KQUEUE
+
+        fd_set readSet;
+        FD_ZERO( &readSet );
+
+#if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        FD_SET( (SOCKET) m_socket, &readSet );
+#else // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+        FD_SET( m_socket, &readSet );
+#endif // #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
+
+        timeval waitTime;
+        waitTime.tv_sec = (long) timeout;
+        waitTime.tv_usec = (long) ( ( timeout - waitTime.tv_sec ) * 1000000.0 );
+
+        // IMPORTANT: the first parameter of select is ignored on windows
+
+        return select( (int) m_socket + 1, &readSet, NULL, NULL, &waitTime ) > 0;
+    }
+
+    bool Socket::IsDualStack() const
+    {
+        return m_dualStack;
+    }
+
+    bool Socket::SetDscp( int dscp )
+    {
+        assert( m_socket );
+        assert( dscp >= 0 );
+        assert( dscp <= 63 );
+
+        const int trafficClass = dscp << 2;
+
+        if ( m_address.GetType() == ADDRESS_IPV6 )
+        {
+#ifdef IPV6_TCLASS
+            if ( setsockopt( m_socket, IPPROTO_IPV6, IPV6_TCLASS, (char*)&trafficClass, sizeof(trafficClass) ) != 0 )
+                return false;
+#else // #ifdef IPV6_TCLASS
+            return false;
+#endif // #ifdef IPV6_TCLASS
+
+            // IMPORTANT: IPv4 packets sent from a dual-stack socket go out as IPv4, so they need the IPv4 option as well.
+
+            if ( !m_dualStack )
+                return true;
+        }
+
+        return setsockopt( m_socket, IPPROTO_IP, IP_TOS, (char*)&trafficClass, sizeof(trafficClass) ) == 0;
+    }
+
+    int Socket::ReceiveErrors( int maxErrors, Address * to, int * errors )
+    {
+        assert( maxErrors >= 0 );
+        assert( to );
+        assert( errors );
+
+#if defined( IP_RECVERR ) && defined( IPV6_RECVERR )
+
+        if ( !m_receiveErrors )
+            return 0;
+
+        int numErrors = 0;
+
+        while ( numErrors < maxErrors )
+        {
+            // IMPORTANT: The error queue holds the packet that caused each error, and the message name is the address it was sent to. Only the error itself is needed, so the packet data is truncated.
+
+            sockaddr_storage address;
+            uint8_t data[1];
+            uint8_t control[256];
+
+            iovec buffer;
+            buffer.iov_base = data;
+            buffer.iov_len = sizeof( data );
+
+            msghdr message;
+            memset( &message, 0, sizeof( message ) );
+            message.msg_name = &address;
+            message.msg_namelen = sizeof( address );
+            message.msg_iov = &buffer;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof( control );
+
+            if ( recvmsg( m_socket, &message, MSG_ERRQUEUE | MSG_DONTWAIT ) < 0 )
+                break;
+
+            for ( cmsghdr * cmsg = CMSG_FIRSTHDR( &message ); cmsg; cmsg = CMSG_NXTHDR( &message, cmsg ) )
+            {
+                if ( !( cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR ) && !( cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR ) )
+                    continue;
+
+                sock_extended_err error;
+                memcpy( &error, CMSG_DATA( cmsg ), sizeof( error ) );
+
+                to[numErrors] = Address( &address );
+                errors[numErrors] = int( error.ee_errno );
+                numErrors++;
+
+                break;
+            }
+        }
+
+        return numErrors;
+
+#else // #if defined( IP_RECVERR ) && defined( IPV6_RECVERR )
+
+        (void) maxErrors;
+        (void) to;
+        (void) errors;
+
+        return 0;
+
+#endif // #if defined( IP_RECVERR ) && defined( IPV6_RECVERR )
+    }
+
+    bool Socket::IsReceivingErrors() const
+    {
+        return m_receiveErrors;
+    }
+
+    int GetSocketReceiveBufferSize( int maxClients, float packetsPerSecond, double tickTime, int packetBytes )
+    {
+        assert( maxClients > 0 );
+        assert( packetsPerSecond > 0.0f );
+        assert( tickTime > 0.0 );
+        assert( packetBytes > 0 );
+
+        // IMPORTANT: The kernel charges each packet against the receive buffer with the size of its buffer and bookkeeping, not just its data. Small game packets cost several times their size.
+
+        const int PacketOverheadBytes = 768;
+        const int BufferedTicks = 2;
+        const int MinBufferSize = 64 * 1024;
+
+        const double packets = double( maxClients ) * packetsPerSecond * tickTime * BufferedTicks;
+
+        const double bytes = ceil( packets ) * double( packetBytes + PacketOverheadBytes );
+
+        return ( bytes < MinBufferSize ) ? MinBufferSize : ( bytes > 0x7FFFFFFF ) ? 0x7FFFFFFF : int( bytes );
+    }
+
+    bool Socket::EnableTxTime()
+    {
+        assert( m_socket );
+
+#if YOJIMBO_SOCKETS_TXTIME
+
+        if ( m_txTime )
+            return true;
+
+        sock_txtime config;
+        memset( &config, 0, sizeof( config ) );
+        config.clockid = CLOCK_MONOTONIC;
+        config.flags = 0;
+
+        if ( setsockopt( m_socket, SOL_SOCKET, SO_TXTIME, (char*)&config, sizeof(config) ) != 0 )
+        {
+            debug_printf( "failed to enable socket departure times (SO_TXTIME)\n" );
+            return false;
+        }
+
+        m_txTime = true;
+
+        return true;
+
+#else // #if YOJIMBO_SOCKETS_TXTIME
+
+        return false;
+
+#endif // #if YOJIMBO_SOCKETS_TXTIME
+    }
+
+    bool Socket::IsUsingTxTime() const
+    {
+        return m_txTime;
+    }
+
+    bool Socket::SetMaxPacingRate( uint32_t bytesPerSecond )
+    {
+        assert( m_socket );
+
+#if YOJIMBO_SOCKETS_TXTIME
+
+        uint32_t rate = bytesPerSecond ? bytesPerSecond : ~0U;
+
+        if ( setsockopt( m_socket, SOL_SOCKET, SO_MAX_PACING_RATE, (char*)&rate, sizeof(rate) ) != 0 )
+        {
+            debug_printf( "failed to set socket max pacing rate (SO_MAX_PACING_RATE)\n" );
+            return false;
+        }
+
+        return true;
+
+#else // #if YOJIMBO_SOCKETS_TXTIME
+
+        (void) bytesPerSecond;
+
+        return false;
+
+#endif // #if YOJIMBO_SOCKETS_TXTIME
+    }
+
+    bool Socket::IsUsingRing() const
+    {
+        return m_ring != NULL;
+    }
+
+    bool Socket::IsUsingRio() const
+    {
+        return m_rio != NULL;
+    }
+
+    bool Socket::IsUsingXdp() const
+    {
+#if YOJIMBO_SOCKETS_AF_XDP
+        return m_xdp && m_xdp->numQueues > 0;
+#else // #if YOJIMBO_SOCKETS_AF_XDP
+        return false;
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+    }
+
+    bool Socket::SetFilter( const SocketFilterConfig & config )
+    {
+        assert( m_socket );
+        assert( config.minPacketBytes <= config.maxPacketBytes );
+        assert( config.maxPrefixByte >= 0 );
+        assert( config.maxPrefixByte < 0x80 );
+
+#if YOJIMBO_SOCKETS_AF_XDP
+
+        if ( IsError() || m_dualStack )
+            return false;
+
+        const bool created = m_xdp == NULL;
+
+        if ( created )
+        {
+            m_xdp = socket_xdp_create( m_socket, m_address, false );
+            if ( !m_xdp )
+                return false;
+        }
+
+        if ( !socket_xdp_set_filter( m_xdp, config ) )
+        {
+            if ( created )
+            {
+                socket_xdp_destroy( m_xdp );
+                m_xdp = NULL;
+            }
+
+            return false;
+        }
+
+        return true;
+
+#else // #if YOJIMBO_SOCKETS_AF_XDP
+
+        (void) config;
+
+        return false;
+
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+    }
+
+    void Socket::ClearFilter()
+    {
+#if YOJIMBO_SOCKETS_AF_XDP
+
+        if ( !m_xdp || !m_xdp->filter )
+            return;
+
+        if ( m_xdp->numQueues == 0 )
+        {
+            socket_xdp_destroy( m_xdp );
+            m_xdp = NULL;
+            return;
+        }
+
+        m_xdp->filter = false;
+
+        if ( !socket_xdp_attach( m_xdp ) )
+        {
+            m_xdp->filter = true;
+            return;
+        }
+
+        socket_xdp_close_filter_maps( m_xdp );
+
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+    }
+
+    bool Socket::IsFiltering() const
+    {
+#if YOJIMBO_SOCKETS_AF_XDP
+        return m_xdp && m_xdp->filter;
+#else // #if YOJIMBO_SOCKETS_AF_XDP
+        return false;
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+    }
+
+    bool Socket::AddKnownAddress( const Address & address )
+    {
+        assert( address.IsValid() );
+
+#if YOJIMBO_SOCKETS_AF_XDP
+
+        if ( !IsFiltering() )
+            return false;
+
+        SocketFilterKnownKey key;
+        socket_xdp_known_key( address, key );
+
+        const uint32_t value = 1;
+
+        bpf_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+        attr.map_fd = m_xdp->knownMapFd;
+        attr.key = (uint64_t) (uintptr_t) &key;
+        attr.value = (uint64_t) (uintptr_t) &value;
+        attr.flags = BPF_ANY;
+
+        return socket_xdp_bpf( BPF_MAP_UPDATE_ELEM, attr ) == 0;
+
+#else // #if YOJIMBO_SOCKETS_AF_XDP
+
+        (void) address;
+
+        return false;
+
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+    }
+
+    bool Socket::RemoveKnownAddress( const Address & address )
+    {
+        assert( address.IsValid() );
+
+#if YOJIMBO_SOCKETS_AF_XDP
+
+        if ( !IsFiltering() )
+            return false;
+
+        SocketFilterKnownKey key;
+        socket_xdp_known_key( address, key );
+
+        bpf_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+        attr.map_fd = m_xdp->knownMapFd;
+        attr.key = (uint64_t) (uintptr_t) &key;
+
+        return socket_xdp_bpf( BPF_MAP_DELETE_ELEM, attr ) == 0;
+
+#else // #if YOJIMBO_SOCKETS_AF_XDP
+
+        (void) address;
+
+        return false;
+
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+    }
+
+    void Socket::ClearKnownAddresses()
+    {
+#if YOJIMBO_SOCKETS_AF_XDP
+
+        if ( !IsFiltering() )
+            return;
+
+        // IMPORTANT: Always ask for the first key, since the key just deleted can't be used to find the one after it.
+
+        SocketFilterKnownKey key;
+
+        bpf_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+        attr.map_fd = m_xdp->knownMapFd;
+        attr.key = 0;
+        attr.next_key = (uint64_t) (uintptr_t) &key;
+
+        for ( int i = 0; i < SocketFilterMaxKnownAddresses && socket_xdp_bpf( BPF_MAP_GET_NEXT_KEY, attr ) == 0; ++i )
+        {
+            bpf_attr deleteAttr;
+            memset( &deleteAttr, 0, sizeof( deleteAttr ) );
+            deleteAttr.map_fd = m_xdp->knownMapFd;
+            deleteAttr.key = (uint64_t) (uintptr_t) &key;
+            socket_xdp_bpf( BPF_MAP_DELETE_ELEM, deleteAttr );
+        }
+
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
+    }
+
+    uint64_t Socket::GetFilterCounter( int index ) const
+    {
+        assert( index >= 0 );
+        assert( index < SOCKET_FILTER_NUM_COUNTERS );
+
+#if YOJIMBO_SOCKETS_AF_XDP
+
+        if ( !IsFiltering() )
+            return 0;
+
+        uint64_t * values = (uint64_t*) alloca( sizeof( uint64_t ) * m_xdp->numCpus );
+        memset( values, 0, sizeof( uint64_t ) * m_xdp->numCpus );
+
+        const uint32_t key = uint32_t( index );
+
+        bpf_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+        attr.map_fd = m_xdp->counterMapFd;
+        attr.key = (uint64_t) (uintptr_t) &key;
+        attr.value = (uint64_t) (uintptr_t) values;
+
+        if ( socket_xdp_bpf( BPF_MAP_LOOKUP_ELEM, attr ) != 0 )
+            return 0;
+
+        uint64_t count = 0;
+        for ( int i = 0; i < m_xdp->numCpus; ++i )
+            count += values[i];
+
+        return count;
+
+#else // #if YOJIMBO_SOCKETS_AF_XDP
+
+        (void) index;
+
+        return 0;
+
+#endif // #if YOJIMBO_SOCKETS_AF_XDP
     }
 
     const Address & Socket::GetAddress() const
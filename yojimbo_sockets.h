@@ -49,15 +49,84 @@ namespace yojimbo
         SOCKET_ERROR_NONE,                                                  ///< No socket error. All is well!
         SOCKET_ERROR_CREATE_FAILED,                                         ///< Create socket failed.
         SOCKET_ERROR_SET_NON_BLOCKING_FAILED,                               ///< Setting the socket as non-blocking failed.
-        SOCKET_ERROR_SOCKOPT_IPV6_ONLY_FAILED,                              ///< Setting the socket as IPv6 only failed.
+        SOCKET_ERROR_SOCKOPT_IPV6_ONLY_FAILED,                              ///< Setting the socket as IPv6 only, or as dual-stack with SOCKET_FLAG_DUAL_STACK, failed.
         SOCKET_ERROR_SOCKOPT_RCVBUF_FAILED,                                 ///< Setting the socket receive buffer size failed.
         SOCKET_ERROR_SOCKOPT_SNDBUF_FAILED,                                 ///< Setting the socket send buffer size failed.
         SOCKET_ERROR_BIND_IPV4_FAILED,                                      ///< Failed to bind the socket (IPv4).
         SOCKET_ERROR_BIND_IPV6_FAILED,                                      ///< Failed to bind the socket (IPv6).
         SOCKET_ERROR_GET_SOCKNAME_IPV4_FAILED,                              ///< Call to getsockname failed on the socket (IPv4).
-        SOCKET_ERROR_GET_SOCKNAME_IPV6_FAILED                               ///< Call to getsockname failed on the socket (IPv6).
+        SOCKET_ERROR_GET_SOCKNAME_IPV6_FAILED,                              ///< Call to getsockname failed on the socket (IPv6).
+        SOCKET_ERROR_SOCKOPT_REUSEPORT_FAILED,                              ///< Setting the socket to share its port with other sockets failed, or is not supported on this platform. See SOCKET_FLAG_REUSE_PORT.
+        SOCKET_ERROR_ATTACH_CPU_STEERING_FAILED,                            ///< Attaching the program that steers packets to sockets by CPU failed, or is not supported on this platform. See SOCKET_FLAG_STEER_BY_CPU.
+        SOCKET_ERROR_SOCKOPT_MTU_DISCOVER_FAILED                            ///< Setting the socket to send packets with the don't fragment bit set failed, or is not supported on this platform. See SOCKET_FLAG_PMTU_PROBE.
     };
 
+    /**
+        Socket flags. Passed in to the Socket constructor.
+     */
+
+    enum SocketFlags
+    {
+        SOCKET_FLAG_REUSE_PORT = (1<<0),                                    ///< Bind with SO_REUSEPORT, so several sockets in this process can bind to the same address and port. On Linux the kernel spreads incoming packets across the sockets by a hash of the source address, so packets from one client always arrive at the same socket. Not supported on Windows.
+        SOCKET_FLAG_STEER_BY_CPU = (1<<1),                                  ///< Linux only. Requires SOCKET_FLAG_REUSE_PORT. Instead of hashing, each packet goes to the socket whose position in the group of sockets sharing the port matches the CPU the packet was received on, so the Nth socket bound gets the packets received on CPU N. Packets received on CPUs without a matching socket fall back to hashing.
+        SOCKET_FLAG_IO_URING = (1<<2),                                      ///< Linux only. Send and receive through io_uring. A multishot receive stays posted into a ring of buffers provided to the kernel, and batches of sends are queued with a single submit, so most packets cost no syscall at all. If io_uring is not available the socket quietly falls back to regular batched IO. See Socket::IsUsingRing.
+        SOCKET_FLAG_DUAL_STACK = (1<<3),                                    ///< IPv6 sockets only. Clear IPV6_V6ONLY so the socket sends and receives both IPv6 and IPv4 packets. IPv4 addresses are sent to as IPv4-mapped IPv6 addresses, and packets received from IPv4-mapped addresses come back as IPv4 addresses, so one socket serves clients of either family. See Socket::IsDualStack.
+        SOCKET_FLAG_PMTU_PROBE = (1<<4),                                    ///< Linux only. Send packets with the don't fragment bit set, ignoring the path MTU cached by the kernel (IP_PMTUDISC_PROBE). Packets too large for the path are dropped instead of being fragmented by IP, so probe packets measure the real path MTU. Use with ConnectionConfig::enableMtuDiscovery.
+        SOCKET_FLAG_AF_XDP = (1<<5),                                        ///< Linux only. Receive and send through AF_XDP sockets, bypassing the kernel network stack. An XDP program steers UDP packets for the socket address to AF_XDP sockets on each receive queue of the network interface. Packets are then read straight out of frames in memory shared with the kernel. Replies are written straight into frames as well, using the ethernet addresses learned from received packets. The socket must be bound to the IP address of a network interface, not the any address. Anything the XDP path can't handle goes through the regular socket, and if AF_XDP is not available the socket quietly falls back to regular IO. See Socket::IsUsingXdp.
+        SOCKET_FLAG_RIO = (1<<6),                                           ///< Windows only. Send and receive through Registered I/O. Packets are received into a pool of buffers registered with the kernel up front and kept posted, and completions are dequeued in batches, so receiving a batch of packets costs no syscall. Sends are copied into registered send buffers and committed as a batch. If Registered I/O is not available the socket quietly falls back to regular IO. See Socket::IsUsingRio.
+        SOCKET_FLAG_BUSY_POLL = (1<<7),                                     ///< Linux only. Busy poll the network device queue for up to yojimbo::SocketBusyPollMicroseconds on receive calls instead of waiting for an interrupt (SO_BUSY_POLL), and prefer busy polling over interrupts while the socket is busy (SO_PREFER_BUSY_POLL). Trades CPU for lower and steadier receive latency. Raising the busy poll time above net.core.busy_read needs CAP_NET_ADMIN, otherwise it is quietly left at the system setting.
+        SOCKET_FLAG_DSCP_EF = (1<<8),                                       ///< Mark packets sent with the expedited forwarding DSCP, so networks that honor QoS markings queue them ahead of bulk traffic. See Socket::SetDscp.
+        SOCKET_FLAG_RECEIVE_ERRORS = (1<<9),                                ///< Linux only. Queue the ICMP errors caused by packets sent from the socket (IP_RECVERR), eg. port and host unreachable, so an address that has gone away is noticed without waiting for a timeout. See Socket::ReceiveErrors. Ignored for sockets using io_uring.
+        SOCKET_FLAGS_LOW_LATENCY = SOCKET_FLAG_BUSY_POLL | SOCKET_FLAG_DSCP_EF | SOCKET_FLAG_RECEIVE_ERRORS      ///< Socket options for latency critical servers. Combine with a receive buffer sized by yojimbo::GetSocketReceiveBufferSize.
+    };
+
+    /**
+        Counters for packets dropped by the socket packet filter. See Socket::GetFilterCounter.
+     */
+
+    enum SocketFilterCounter
+    {
+        SOCKET_FILTER_COUNTER_PACKET_SIZE,                                  ///< Number of packets dropped because their size is impossible for the protocol.
+        SOCKET_FILTER_COUNTER_PREFIX_BYTE,                                  ///< Number of packets dropped because their first byte is not a valid packet prefix.
+        SOCKET_FILTER_COUNTER_PACKET_TYPE,                                  ///< Number of unencrypted packets dropped because their packet type is not allowed unencrypted.
+        SOCKET_FILTER_COUNTER_RATE_LIMIT,                                   ///< Number of packets dropped because their source address is unknown and has sent too many packets in the last second.
+        SOCKET_FILTER_NUM_COUNTERS
+    };
+
+    /**
+        Describes the packets a socket packet filter lets through. See Socket::SetFilter.
+
+        The defaults let everything through. NetworkTransport::EnablePacketFilter fills this in from the packet format of the transport.
+     */
+
+    struct SocketFilterConfig
+    {
+        int minPacketBytes;                                                 ///< Packets smaller than this are dropped (bytes).
+        int maxPacketBytes;                                                 ///< Packets larger than this are dropped (bytes).
+        int minEncryptedPacketBytes;                                        ///< Packets with the high bit of the first byte set are encrypted. Encrypted packets smaller than this are dropped (bytes).
+        int maxPrefixByte;                                                  ///< Packets with a first byte from 1 to this are allowed. Packets with a first byte above this that are not encrypted are dropped. A first byte of zero is an unencrypted packet.
+        int numPacketTypes;                                                 ///< The number of packet types. If this is from 2 to 64, unencrypted packets are dropped unless their packet type is set in unencryptedPacketTypes. The packet type is read from the bits after the first byte and the CRC32.
+        uint64_t unencryptedPacketTypes;                                    ///< Bitmask of the packet types allowed in unencrypted packets. If this is zero, all unencrypted packets are dropped.
+        int unknownSourcePacketsPerSecond;                                  ///< If this is greater than zero, packets from source addresses that have not been added with Socket::AddKnownAddress are dropped once the source IP has sent this many packets in the last second.
+
+        SocketFilterConfig()
+        {
+            minPacketBytes = 1;
+            maxPacketBytes = 65535;
+            minEncryptedPacketBytes = 1;
+            maxPrefixByte = 0x7F;
+            numPacketTypes = 0;
+            unencryptedPacketTypes = ~uint64_t(0);
+            unknownSourcePacketsPerSecond = 0;
+        }
+    };
+
+    struct SocketRing;
+
+    struct SocketXdp;
+
+    struct SocketRio;
+
     /// Platfrom independent socket handle.
 
 #if YOJIMBO_PLATFORM == YOJIMBO_PLATFORM_WINDOWS
@@ -88,9 +157,10 @@ namespace yojimbo
             @param address The address to bind the socket to.
             @param sendBufferSize The size of the send buffer to set on the socket (SO_SNDBUF).
             @param receiveBufferSize The size of the receive buffer to set on the socket (SO_RCVBUF).
+            @param flags Socket flags. See yojimbo::SocketFlags.
          */
 
-        explicit Socket( const Address & address, int sendBufferSize = 1024*1024, int receiveBufferSize = 1024*1024 );
+        explicit Socket( const Address & address, int sendBufferSize = 1024*1024, int receiveBufferSize = 1024*1024, int flags = 0 );
 
         /**
             Socket destructor.
@@ -133,6 +203,23 @@ namespace yojimbo
          */
 
         void SendPacket( const Address & to, const void * packetData, size_t packetBytes );
+
+        /**
+            Send a batch of packets using this socket.
+
+            On Linux this sends all packets with a single call to sendmmsg (more if the kernel accepts only part of the batch). On other platforms it falls back to calling Socket::SendPacket in a loop.
+
+            Packet i is read from packetData + i * maxPacketSize.
+
+            @param numPackets The number of packets to send.
+            @param to Array of addresses to send each packet to.
+            @param packetData The buffer containing the packet data to send.
+            @param maxPacketSize The stride between packets in the packet data buffer (bytes).
+            @param packetBytes Array of packet sizes to send (bytes).
+            @param sendDelays Array of delays before each packet departs (seconds). Only used after Socket::EnableTxTime succeeds, and only for packets sent with sendmmsg. Pass NULL to send every packet right away.
+         */
+
+        void SendPackets( int numPackets, const Address * to, const uint8_t * packetData, int maxPacketSize, const int * packetBytes, const float * sendDelays = NULL );
     
         /**
             Receive a packet from the network (non-blocking).
@@ -140,11 +227,217 @@ namespace yojimbo
             @param from The address that sent the packet [out]
             @param packetData The buffer where the packet data will be copied to. Must be at least maxPacketSize large in bytes.
             @param maxPacketSize The maximum packet size to read in bytes. Any packets received larger than this are discarded.
+            @param receiveTime The time the packet was received, in the same time base as platform_time [out]. On Linux this comes from the kernel receive timestamp (SO_TIMESTAMPNS), otherwise it's the time the packet was read from the socket. Pass NULL if you don't need it.
 
             @returns The size of the packet received in [1,maxPacketSize], or 0 if no packet is available to read.
          */
 
-        int ReceivePacket( Address & from, void * packetData, int maxPacketSize );
+        int ReceivePacket( Address & from, void * packetData, int maxPacketSize, double * receiveTime = NULL );
+
+        /**
+            Receive a batch of packets from the network (non-blocking).
+
+            On Linux this reads up to maxPackets packets with a single call to recvmmsg. On other platforms it falls back to calling Socket::ReceivePacket in a loop.
+
+            Packet i is written to packetData + i * maxPacketSize.
+
+            @param maxPackets The maximum number of packets to receive.
+            @param from Array of addresses that sent each packet [out]. Must have at least maxPackets entries.
+            @param packetData The buffer where packet data will be copied to. Must be at least maxPackets * maxPacketSize large in bytes.
+            @param maxPacketSize The maximum packet size to read in bytes. This is also the stride between packets in the packet data buffer.
+            @param packetBytes Array of packet sizes in bytes [out]. Must have at least maxPackets entries.
+            @param receiveTimes Array of times each packet was received, in the same time base as platform_time [out]. See Socket::ReceivePacket. Pass NULL if you don't need them, otherwise it must have at least maxPackets entries.
+
+            @returns The number of packets received in [0,maxPackets].
+         */
+
+        int ReceivePackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes = NULL );
+
+        /**
+            Block until a packet is available to read on this socket, or the timeout elapses.
+
+            This lets a thread dedicated to receiving packets sleep while the socket is idle, instead of spinning on Socket::ReceivePacket. It's used by ThreadedNetworkTransport. For io_uring sockets it sleeps waiting for completions instead.
+
+            @param timeout The maximum time to wait (seconds).
+
+            @returns True if a packet is available to read, false if the wait timed out.
+         */
+
+        bool WaitForPackets( double timeout );
+
+        /**
+            Is this socket sending and receiving through io_uring?
+
+            @returns True if the socket was created with SOCKET_FLAG_IO_URING and io_uring is available, false otherwise.
+         */
+
+        bool IsUsingRing() const;
+
+        /**
+            Is this socket receiving and sending through AF_XDP?
+
+            @returns True if the socket was created with SOCKET_FLAG_AF_XDP and AF_XDP is available, false otherwise.
+         */
+
+        bool IsUsingXdp() const;
+
+        /**
+            Is this socket sending and receiving through Registered I/O?
+
+            @returns True if the socket was created with SOCKET_FLAG_RIO and Registered I/O is available, false otherwise.
+         */
+
+        bool IsUsingRio() const;
+
+        /**
+            Drop packets that can't be valid for the protocol before they reach the socket.
+
+            Loads an XDP program on the network interface the socket is bound to, which drops packets that fail the checks in the config, and rate limits packets from unknown source addresses. Everything else goes through to the socket as usual. Garbage and flood traffic is dropped in the driver, before the kernel allocates memory for it, so it costs the server next to no CPU.
+
+            Call this again to change the config. If the socket uses AF_XDP, the filter runs in the same XDP program, before packets are redirected to the AF_XDP sockets.
+
+            IMPORTANT: Linux only. Requires CAP_NET_ADMIN and CAP_BPF. The socket must be bound to the IP address of a network interface, not the any address. Only one XDP program can be attached to a network interface, so only one socket per interface can filter packets.
+
+            @param config The packets to let through.
+
+            @returns True if the filter is running, false if XDP is not available.
+
+            @see NetworkTransport::EnablePacketFilter
+         */
+
+        bool SetFilter( const SocketFilterConfig & config );
+
+        /**
+            Stop filtering packets.
+
+            @see Socket::SetFilter
+         */
+
+        void ClearFilter();
+
+        /**
+            Is the packet filter running?
+
+            @returns True if Socket::SetFilter succeeded and the filter has not been cleared since.
+         */
+
+        bool IsFiltering() const;
+
+        /**
+            Add an address that is not rate limited by the packet filter.
+
+            Typically this is the address of a connected client. Known addresses are kept in a table of SocketFilterMaxKnownAddresses entries. If the table is full, the least recently used address is evicted.
+
+            @param address The address to add. The port must match too.
+
+            @returns True if the address was added, false if the packet filter is not running.
+         */
+
+        bool AddKnownAddress( const Address & address );
+
+        /**
+            Remove an address added with Socket::AddKnownAddress.
+
+            @param address The address to remove.
+
+            @returns True if the address was removed, false if it was not known or the packet filter is not running.
+         */
+
+        bool RemoveKnownAddress( const Address & address );
+
+        /**
+            Remove all addresses added with Socket::AddKnownAddress.
+         */
+
+        void ClearKnownAddresses();
+
+        /**
+            Get the number of packets dropped by the packet filter, for one drop reason.
+
+            Counters keep counting while the filter config is changed, and are reset when the filter is cleared.
+
+            @param index The counter index. See yojimbo::SocketFilterCounter.
+
+            @returns The number of packets dropped, summed across all CPUs. Zero if the packet filter is not running.
+         */
+
+        uint64_t GetFilterCounter( int index ) const;
+
+        /**
+            Does this socket send and receive both IPv4 and IPv6 packets?
+
+            @returns True if the socket was created with SOCKET_FLAG_DUAL_STACK, false otherwise.
+         */
+
+        bool IsDualStack() const;
+
+        /**
+            Give packets sent on this socket a departure time.
+
+            Sets SO_TXTIME with CLOCK_MONOTONIC. After this, the send delays passed to Socket::SendPackets go to the kernel with each packet, and the kernel holds each packet until it is due. A batch written all at once then leaves the network card spread out over time.
+
+            Departure times are honored by the fq qdisc (Linux 4.20 or later) and the etf qdisc. With any other qdisc they are ignored, and packets are sent right away.
+
+            IMPORTANT: Only packets sent with sendmmsg are timed. Sockets sending through io_uring, AF_XDP or Registered I/O send packets right away.
+
+            @returns True if the socket accepted SO_TXTIME, false if it's not supported on this platform or kernel.
+         */
+
+        bool EnableTxTime();
+
+        /**
+            Are packets sent on this socket given departure times?
+
+            @returns True if Socket::EnableTxTime succeeded, false otherwise.
+         */
+
+        bool IsUsingTxTime() const;
+
+        /**
+            Cap the rate the kernel sends packets from this socket at.
+
+            Sets SO_MAX_PACING_RATE. The fq qdisc spaces packets from the socket out so it never sends faster than this.
+
+            @param bytesPerSecond The maximum send rate (bytes per-second). Pass zero to remove the cap.
+
+            @returns True if the rate was set, false if it's not supported on this platform.
+         */
+
+        bool SetMaxPacingRate( uint32_t bytesPerSecond );
+
+        /**
+            Mark packets sent on this socket with a differentiated services code point.
+
+            Sets IP_TOS for IPv4, IPV6_TCLASS for IPv6, and both for dual-stack sockets. The code point goes in the top six bits, and the ECN bits are left clear.
+
+            @param dscp The code point in [0,63]. eg. yojimbo::SocketDscpExpedited for gameplay packets. Pass zero to clear the marking.
+
+            @returns True if the marking was set, false otherwise. Windows only honors markings set through its QoS APIs, so it ignores this.
+         */
+
+        bool SetDscp( int dscp );
+
+        /**
+            Read errors caused by packets sent from this socket.
+
+            With SOCKET_FLAG_RECEIVE_ERRORS the kernel queues the ICMP errors that come back for sent packets. Each error is reported with the address the packet was sent to, so a client that has gone away can be dropped straight away.
+
+            @param maxErrors The maximum number of errors to read.
+            @param to Array of addresses the packets causing each error were sent to [out]. Must have at least maxErrors entries.
+            @param errors Array of errno values for each error [out]. eg. ECONNREFUSED for port unreachable, EHOSTUNREACH for host unreachable and EMSGSIZE for packets larger than the path MTU. Must have at least maxErrors entries.
+
+            @returns The number of errors read in [0,maxErrors]. Always zero unless the socket was created with SOCKET_FLAG_RECEIVE_ERRORS on Linux.
+         */
+
+        int ReceiveErrors( int maxErrors, Address * to, int * errors );
+
+        /**
+            Is this socket queueing errors for packets it sends?
+
+            @returns True if the socket was created with SOCKET_FLAG_RECEIVE_ERRORS and the kernel supports it, false otherwise.
+         */
+
+        bool IsReceivingErrors() const;
 
         /**
             Get the socket address including the dynamically assigned port # for sockets bound to port 0.
@@ -156,13 +449,46 @@ namespace yojimbo
 
     private:
 
+        /// Receive a batch of packets through the regular socket, io_uring or Registered I/O, skipping AF_XDP. See Socket::ReceivePackets.
+
+        int ReceiveSocketPackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes );
+
         SocketError m_error;                                        ///< The socket error level.
 
         Address m_address;                                          ///< The address the socket is bound on. If the socket was bound to 0, the port number is resolved to the actual port number assigned by the system.
         
         SocketHandle m_socket;                                      ///< The socket handle in a platform independent form.
+
+        SocketRing * m_ring;                                        ///< The io_uring state for sockets created with SOCKET_FLAG_IO_URING. NULL if the socket doesn't use io_uring.
+
+        SocketXdp * m_xdp;                                          ///< The XDP state for sockets created with SOCKET_FLAG_AF_XDP, or filtering packets with Socket::SetFilter. NULL if the socket doesn't use XDP.
+
+        SocketRio * m_rio;                                          ///< The Registered I/O state for sockets created with SOCKET_FLAG_RIO. NULL if the socket doesn't use Registered I/O.
+
+        int m_kqueue;                                               ///< The kqueue the socket waits for packets on. macOS and BSD only, see YOJIMBO_SOCKETS_KQUEUE. -1 if the socket waits with select.
+
+        bool m_dualStack;                                           ///< True if the socket was created with SOCKET_FLAG_DUAL_STACK.
+
+        bool m_txTime;                                              ///< True if packets sent with sendmmsg carry departure times. See Socket::EnableTxTime.
+
+        bool m_receiveErrors;                                       ///< True if the kernel queues errors for packets sent from this socket. See SOCKET_FLAG_RECEIVE_ERRORS.
     };
 
+    /**
+        Work out a socket receive buffer size from the load a server expects.
+
+        A fixed receive buffer is either too small for big servers, so packets are dropped when a frame runs long, or wastes kernel memory on small ones. This sizes the buffer to hold two ticks of packets from every client, counting the memory the kernel uses for each packet on top of its data.
+
+        @param maxClients The number of clients the server expects.
+        @param packetsPerSecond The number of packets each client sends per-second.
+        @param tickTime The time between the server reading packets (seconds).
+        @param packetBytes The typical size of a packet (bytes).
+
+        @returns The receive buffer size to pass to the NetworkTransport constructor (bytes). At least 64k.
+     */
+
+    int GetSocketReceiveBufferSize( int maxClients, float packetsPerSecond, double tickTime, int packetBytes );
+
 #endif // #if YOJIMBO_SOCKETS
 }
 
@@ -28,6 +28,7 @@
 #include "yojimbo_config.h"
 #include "yojimbo_bitpack.h"
 #include "yojimbo_allocator.h"
+#include "yojimbo_serialize_profiler.h"
 #ifndef NDEBUG
 #include <stdio.h>
 #endif // #ifndef NDEBUG
@@ -180,6 +181,27 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Serialize an integer with bounds known at compile time (write).
+
+            The number of bits is computed at compile time, so this is just a subtract and a write of bits.
+
+            @param value The integer value in [min,max].
+
+            @returns Always returns true. All checking is performed by debug asserts only on write.
+
+            @see serialize_int_constant
+         */
+
+        template <int32_t min, int32_t max> bool SerializeIntegerConstant( int32_t value )
+        {
+            assert( min < max );
+            assert( value >= min );
+            assert( value <= max );
+            m_writer.WriteBits( uint32_t( value - min ), BitsRequired<min,max>::result );
+            return true;
+        }
+
         /**
             Serialize a number of bits (write).
 
@@ -197,6 +219,71 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Serialize an array of values with the same number of bits (write).
+
+            @param values The values to write. Each value must be in [0,(1<<bits)-1].
+            @param count The number of values to write.
+            @param bits The number of bits to write per value in [1,32].
+
+            @returns Always returns true. All checking is performed by debug asserts only on write.
+
+            @see serialize_bits_array
+         */
+
+        bool SerializeBitsArray( const uint32_t * values, int count, int bits )
+        {
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            m_writer.WriteBitsArray( values, count, bits );
+            return true;
+        }
+
+        /**
+            Overwrite bits that have already been written (write).
+
+            Use this to fill in a placeholder once its value is known, eg. the size of the data written after it.
+
+            @param bitIndex The index of the first bit to overwrite, relative to the start of the stream.
+            @param value The value to write. Must be in [0,(1<<bits)-1].
+            @param bits The number of bits to overwrite in [1,32].
+
+            @see BitWriter::OverwriteBits
+         */
+
+        void OverwriteBits( int bitIndex, uint32_t value, int bits )
+        {
+            m_writer.OverwriteBits( bitIndex, value, bits );
+        }
+
+        /**
+            Serialize the prefix of a variable length integer (write).
+
+            Writes zero bits followed by a one bit.
+
+            @param zeros The number of zero bits to write in [0,32].
+
+            @returns Always returns true. All checking is performed by debug asserts on write.
+
+            @see serialize_varint
+         */
+
+        bool SerializeVarintPrefix( int zeros )
+        {
+            assert( zeros >= 0 );
+            assert( zeros <= 32 );
+            if ( zeros < 32 )
+            {
+                m_writer.WriteBits( 1U << zeros, zeros + 1 );
+            }
+            else
+            {
+                m_writer.WriteBits( 0, 32 );
+                m_writer.WriteBits( 1, 1 );
+            }
+            return true;
+        }
+
         /**
             Serialize an array of bytes (write).
 
@@ -215,6 +302,24 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Serialize an array of bytes viewed in place (write).
+
+            Writes the same bits as SerializeBytes.
+
+            @param data Array of bytes to be written.
+            @param bytes The number of bytes to write.
+
+            @returns Always returns true. All checking is performed by debug asserts on write.
+
+            @see serialize_bytes_view
+         */
+
+        bool SerializeBytesView( const uint8_t * & data, int bytes )
+        {
+            return SerializeBytes( data, bytes );
+        }
+
         /**
             Serialize an align (write).
 
@@ -362,6 +467,26 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Serialize an integer with bounds known at compile time (read).
+
+            @param value The integer value read is stored here. The caller must check it is in [min,max], since bits read can encode values past max when the range is not a power of two.
+
+            @returns Returns true if the serialize succeeded, false if it would read past the end of the buffer.
+
+            @see serialize_int_constant
+         */
+
+        template <int32_t min, int32_t max> bool SerializeIntegerConstant( int32_t & value )
+        {
+            assert( min < max );
+            const int bits = BitsRequired<min,max>::result;
+            if ( m_reader.WouldReadPastEnd( bits ) )
+                return false;
+            value = (int32_t) m_reader.ReadBits( bits ) + min;
+            return true;
+        }
+
         /**
             Serialize a number of bits (read).
 
@@ -382,6 +507,86 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Serialize an array of values with the same number of bits (read).
+
+            The end of the buffer is checked once for the whole array.
+
+            @param values The values read are stored here. Each value will be in [0,(1<<bits)-1].
+            @param count The number of values to read.
+            @param bits The number of bits to read per value in [1,32].
+
+            @returns Returns true if the values were read, false if they would read past the end of the buffer.
+
+            @see serialize_bits_array
+         */
+
+        bool SerializeBitsArray( uint32_t * values, int count, int bits )
+        {
+            assert( count >= 0 );
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            if ( int64_t( count ) * bits > m_reader.GetBitsRemaining() )
+                return false;
+            m_reader.ReadBitsArray( values, count, bits );
+            return true;
+        }
+
+        /**
+            Skip over bits without reading them (read).
+
+            @param bits The number of bits to skip.
+
+            @returns Returns true if the bits were skipped, false if they would skip past the end of the buffer.
+         */
+
+        bool SkipBits( int bits )
+        {
+            if ( bits < 0 || m_reader.WouldReadPastEnd( bits ) )
+                return false;
+            m_reader.SkipBits( bits );
+            return true;
+        }
+
+        /**
+            Serialize the prefix of a variable length integer (read).
+
+            Counts the zero bits up to and including the first one bit. The bits are peeked a word at a time and skipped in one read, instead of being read one bit at a time.
+
+            @param zeros The number of zero bits read is stored here. Will be in range [0,32].
+
+            @returns Returns true if the prefix was read, false if it has more than 32 zero bits or runs past the end of the buffer.
+
+            @see serialize_varint
+         */
+
+        bool SerializeVarintPrefix( int & zeros )
+        {
+            const int remaining = m_reader.GetBitsRemaining();
+            if ( remaining <= 0 )
+                return false;
+
+            const int peekBits = remaining < 32 ? remaining : 32;
+            const uint32_t peek = m_reader.PeekBits( peekBits );
+
+            if ( peek != 0 )
+            {
+                zeros = trailing_zeros( peek );
+                m_reader.ReadBits( zeros + 1 );
+                return true;
+            }
+
+            if ( peekBits < 32 || remaining < 33 )
+                return false;
+
+            m_reader.ReadBits( 32 );
+            if ( m_reader.ReadBits( 1 ) == 0 )
+                return false;
+
+            zeros = 32;
+            return true;
+        }
+
         /**
             Serialize an array of bytes (read).
 
@@ -401,6 +606,32 @@ namespace yojimbo
             return true;
         }
 
+        /**
+            Serialize an array of bytes viewed in place (read).
+
+            The bytes are not copied. On success, data points at the bytes in the buffer being read.
+
+            IMPORTANT: data is only valid as long as the buffer passed in to the stream constructor.
+
+            @param data Set to point at the bytes read.
+            @param bytes The number of bytes to read.
+
+            @returns Returns true if the serialize read succeeded. False otherwise.
+
+            @see serialize_bytes_view
+         */
+
+        bool SerializeBytesView( const uint8_t * & data, int bytes )
+        {
+            assert( bytes >= 0 );
+            if ( !SerializeAlign() )
+                return false;
+            if ( m_reader.WouldReadPastEnd( bytes * 8 ) )
+                return false;
+            data = m_reader.ReadBytesView( bytes );
+            return true;
+        }
+
         /**
             Serialize an align (read).
 
@@ -476,161 +707,1173 @@ namespace yojimbo
             return ( m_reader.GetBitsRead() + 7 ) / 8;
         }
 
+        /**
+            How many bits are left to read?
+
+            @returns The number of bits remaining in the buffer.
+         */
+
+        int GetBitsRemaining() const
+        {
+            return m_reader.GetBitsRemaining();
+        }
+
     private:
 
+        friend class UncheckedReadStream;
+
         BitReader m_reader;                                 ///< The bit reader used for all bitpacked read operations.
     };
 
     /**
-        Stream class for estimating how many bits it would take to serialize something.
+        Stream class for reading a bounded amount of bitpacked data without checking each read against the end of the buffer.
 
-        This class acts like a bit writer (IsWriting is 1, IsReading is 0), but it doesn't actually write anything, it just counts how many bits would be written.
+        This reads through the bit reader of a ReadStream, but integers, bits and aligns skip the WouldReadPastEnd check. The caller checks once up front that at least as many bits remain as the data being read could possibly take, eg. a message with a fixed maximum size (see Message::MaxSerializeBits).
 
-        It's used by the connection channel classes to work out how many messages will fit in the channel packet budget.
+        Variable length reads (bytes and varint prefixes) are still checked, since their size comes from the packet data. Values are still range checked by the serialize macros, so malicious data can't produce values outside [min,max].
 
-        Note that when the serialization includes alignment to byte (see MeasureStream::SerializeAlign), this is an estimate and not an exact measurement. The estimate is guaranteed to be conservative. 
+        IMPORTANT: If more bits are read than were checked up front, this reads past the end of the packet. Only use it when the maximum number of bits is a true upper bound.
 
-        @see BitWriter
-        @see BitReader
+        @see MessageFactory::SerializeMessage
      */
 
-    class MeasureStream : public BaseStream
+    class UncheckedReadStream : public BaseStream
     {
     public:
 
-        enum { IsWriting = 1 };
-        enum { IsReading = 0 };
+        enum { IsWriting = 0 };
+        enum { IsReading = 1 };
 
         /**
-            Measure stream constructor.
+            Unchecked read stream constructor.
 
-            @param allocator The allocator to use for stream allocations. This lets you dynamically allocate memory as you read and write packets.
+            The context, user context and allocator are copied from the read stream.
+
+            @param stream The read stream to read from. Must have at least as many bits remaining as will be read through this stream.
          */
 
-        explicit MeasureStream( Allocator & allocator = GetDefaultAllocator() ) : BaseStream( allocator ), m_bitsWritten(0) {}
+        explicit UncheckedReadStream( ReadStream & stream ) : BaseStream( stream.GetAllocator() ), m_stream( stream ), m_reader( stream.m_reader )
+        {
+            SetContext( stream.GetContext() );
+            SetUserContext( stream.GetUserContext() );
+        }
 
         /**
-            Serialize an integer (measure).
+            Serialize an integer (unchecked read).
 
-            @param value The integer value to write. Not actually used or checked.
-            @param min The minimum value.
-            @param max The maximum value.
+            @param value The integer value read is stored here.
+            @param min The minimum allowed value.
+            @param max The maximum allowed value.
 
-            @returns Always returns true. All checking is performed by debug asserts only on measure.
+            @returns Always returns true. The serialize macro checks the value is in range.
          */
 
-        bool SerializeInteger( int32_t value, int32_t min, int32_t max )
-        {   
-            (void) value;
+        bool SerializeInteger( int32_t & value, int32_t min, int32_t max )
+        {
             assert( min < max );
-            assert( value >= min );
-            assert( value <= max );
             const int bits = bits_required( min, max );
-            m_bitsWritten += bits;
+            value = (int32_t) m_reader.ReadBits( bits ) + min;
             return true;
         }
 
         /**
-            Serialize a number of bits (write).
+            Serialize an integer with bounds known at compile time (unchecked read).
 
-            @param value The unsigned integer value to serialize. Not actually used or checked.
-            @param bits The number of bits to write in [1,32].
+            @param value The integer value read is stored here. The caller must check it is in [min,max].
 
-            @returns Always returns true. All checking is performed by debug asserts on write.
+            @returns Always returns true.
          */
 
-        bool SerializeBits( uint32_t value, int bits )
+        template <int32_t min, int32_t max> bool SerializeIntegerConstant( int32_t & value )
         {
-            (void) value;
-            assert( bits > 0 );
-            assert( bits <= 32 );
-            m_bitsWritten += bits;
+            assert( min < max );
+            value = (int32_t) m_reader.ReadBits( BitsRequired<min,max>::result ) + min;
             return true;
         }
 
         /**
-            Serialize an array of bytes (measure).
+            Serialize a number of bits (unchecked read).
 
-            @param data Array of bytes to 'write'. Not actually used.
-            @param bytes The number of bytes to 'write'.
+            @param value The integer value read is stored here. Will be in range [0,(1<<bits)-1].
+            @param bits The number of bits to read in [1,32].
 
-            @returns Always returns true. All checking is performed by debug asserts on write.
+            @returns Always returns true.
          */
 
-        bool SerializeBytes( const uint8_t * data, int bytes )
+        bool SerializeBits( uint32_t & value, int bits )
         {
-            (void) data;
-            SerializeAlign();
-            m_bitsWritten += bytes * 8;
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            value = m_reader.ReadBits( bits );
             return true;
         }
 
         /**
-            Serialize an align (measure).
+            Serialize an array of values with the same number of bits (checked read).
 
-            @returns Always returns true. All checking is performed by debug asserts on write.
+            The array length comes from the caller rather than the message type, so the end of the buffer is still checked, once for the whole array.
+
+            @param values The values read are stored here.
+            @param count The number of values to read.
+            @param bits The number of bits to read per value in [1,32].
+
+            @returns Returns true if the values were read, false if they would read past the end of the buffer.
          */
 
-        bool SerializeAlign()
+        bool SerializeBitsArray( uint32_t * values, int count, int bits )
         {
-            const int alignBits = GetAlignBits();
-            m_bitsWritten += alignBits;
-            return true;
+            return m_stream.SerializeBitsArray( values, count, bits );
         }
 
-        /** 
-            If we were to write an align right now, how many bits would be required?
+        /**
+            Serialize the prefix of a variable length integer (checked read).
 
-            IMPORTANT: Since the number of bits required for alignment depends on where an object is written in the final bit stream, this measurement is conservative. 
+            @param zeros The number of zero bits read is stored here. Will be in range [0,32].
 
-            @returns Always returns worst case 7 bits.
+            @returns Returns true if the prefix was read, false if it is invalid or runs past the end of the buffer.
          */
 
-        int GetAlignBits() const
+        bool SerializeVarintPrefix( int & zeros )
         {
-            return 7;
+            return m_stream.SerializeVarintPrefix( zeros );
         }
 
         /**
-            Serialize a safety check to the stream (measure).
+            Serialize an array of bytes (checked read).
 
-            @returns Always returns true. All checking is performed by debug asserts on write.
+            @param data Array of bytes to read.
+            @param bytes The number of bytes to read.
+
+            @returns Returns true if the serialize read succeeded. False otherwise.
          */
 
-        bool SerializeCheck()
+        bool SerializeBytes( uint8_t * data, int bytes )
         {
-#if YOJIMBO_SERIALIZE_CHECKS
-            SerializeAlign();
-            m_bitsWritten += 32;
-#endif // #if YOJIMBO_SERIALIZE_CHECKS
-            return true;
+            return m_stream.SerializeBytes( data, bytes );
         }
 
         /**
-            Get number of bits written so far.
+            Serialize an array of bytes viewed in place (checked read).
 
-            @returns Number of bits written.
+            @param data Set to point at the bytes read.
+            @param bytes The number of bytes to read.
+
+            @returns Returns true if the serialize read succeeded. False otherwise.
          */
 
-        int GetBitsProcessed() const
+        bool SerializeBytesView( const uint8_t * & data, int bytes )
         {
-            return m_bitsWritten;
+            return m_stream.SerializeBytesView( data, bytes );
         }
 
         /**
-            How many bytes have been written so far?
+            Serialize an align (unchecked read).
 
-            @returns Number of bytes written.
+            @returns Returns true if the pad bits are all zero. False otherwise.
          */
 
-        int GetBytesProcessed() const
+        bool SerializeAlign()
         {
-            return ( m_bitsWritten + 7 ) / 8;
+            return m_reader.ReadAlign();
         }
 
-    private:
+        /** 
+            If we were to read an align right now, how many bits would we need to read?
 
-        int m_bitsWritten;                                  ///< Counter for the number of bits written.
+            @returns The number of zero pad bits required to achieve byte alignment in [0,7].
+         */
+
+        int GetAlignBits() const
+        {
+            return m_reader.GetAlignBits();
+        }
+
+        /**
+            Serialize a safety check from the stream (checked read).
+
+            @returns Returns true if the serialize check passed. False otherwise.
+         */
+
+        bool SerializeCheck()
+        {
+            return m_stream.SerializeCheck();
+        }
+
+        /**
+            Get number of bits read so far.
+
+            @returns Number of bits read, including bits read through the read stream before this stream was created.
+         */
+
+        int GetBitsProcessed() const
+        {
+            return m_reader.GetBitsRead();
+        }
+
+        /**
+            How many bytes have been read so far?
+
+            @returns Number of bytes read, rounded up to the next byte where necessary.
+         */
+
+        int GetBytesProcessed() const
+        {
+            return ( m_reader.GetBitsRead() + 7 ) / 8;
+        }
+
+    private:
+
+        ReadStream & m_stream;                              ///< The read stream used for checked reads.
+        BitReader & m_reader;                               ///< The bit reader of the read stream. Used directly for unchecked reads.
+    };
+
+    /**
+        Stream class for estimating how many bits it would take to serialize something.
+
+        This class acts like a bit writer (IsWriting is 1, IsReading is 0), but it doesn't actually write anything, it just counts how many bits would be written.
+
+        It's used by the connection channel classes to work out how many messages will fit in the channel packet budget.
+
+        Note that when the serialization includes alignment to byte (see MeasureStream::SerializeAlign), this is an estimate and not an exact measurement. The estimate is guaranteed to be conservative. 
+
+        @see BitWriter
+        @see BitReader
+     */
+
+    class MeasureStream : public BaseStream
+    {
+    public:
+
+        enum { IsWriting = 1 };
+        enum { IsReading = 0 };
+
+        /**
+            Measure stream constructor.
+
+            @param allocator The allocator to use for stream allocations. This lets you dynamically allocate memory as you read and write packets.
+         */
+
+        explicit MeasureStream( Allocator & allocator = GetDefaultAllocator() ) : BaseStream( allocator ), m_bitsWritten(0), m_profiler( NULL ), m_profileDepth(0), m_profileName( NULL ), m_profileFile( NULL ), m_profileLine(0), m_profileStartBits(0) {}
+
+        /**
+            Attach a serialize profiler to the stream.
+
+            While a profiler is attached, the bits measured by each serialize_* macro are added to the profiler under the field name, file and line of the macro.
+
+            @param profiler The profiler to add fields to. Pass in NULL to stop profiling.
+
+            @see ProfilingMeasureStream
+         */
+
+        void SetProfiler( SerializeProfiler * profiler )
+        {
+            assert( m_profileDepth == 0 );
+            m_profiler = profiler;
+        }
+
+        /**
+            Get the serialize profiler attached to the stream.
+
+            @returns The profiler, or NULL if this stream isn't profiling.
+         */
+
+        SerializeProfiler * GetProfiler() const
+        {
+            return m_profiler;
+        }
+
+        /**
+            Begin measuring a field for the serialize profiler (measure).
+
+            This is called by the serialize_* macros via SerializeProfileScope, only while a profiler is attached.
+
+            IMPORTANT: Only the outermost field is measured. Serialize macros built on other serialize macros report all their bits under the name passed in by the caller.
+
+            @param name The field name.
+            @param file The source file of the serialize call.
+            @param line The line number of the serialize call.
+         */
+
+        void SerializeProfileBegin( const char * name, const char * file, int line )
+        {
+            assert( m_profiler );
+
+            if ( m_profileDepth++ > 0 )
+                return;
+
+            m_profileName = name;
+            m_profileFile = file;
+            m_profileLine = line;
+            m_profileStartBits = m_bitsWritten;
+        }
+
+        /**
+            Finish measuring a field for the serialize profiler (measure).
+
+            When the outermost field finishes, the bits measured since it began are added to the profiler.
+         */
+
+        void SerializeProfileEnd()
+        {
+            assert( m_profiler );
+            assert( m_profileDepth > 0 );
+
+            if ( --m_profileDepth > 0 )
+                return;
+
+            m_profiler->AddField( m_profileName, m_profileFile, m_profileLine, m_bitsWritten - m_profileStartBits );
+        }
+
+        /**
+            Serialize an integer (measure).
+
+            @param value The integer value to write. Not actually used or checked.
+            @param min The minimum value.
+            @param max The maximum value.
+
+            @returns Always returns true. All checking is performed by debug asserts only on measure.
+         */
+
+        bool SerializeInteger( int32_t value, int32_t min, int32_t max )
+        {   
+            (void) value;
+            assert( min < max );
+            assert( value >= min );
+            assert( value <= max );
+            const int bits = bits_required( min, max );
+            m_bitsWritten += bits;
+            return true;
+        }
+
+        /**
+            Serialize an integer with bounds known at compile time (measure).
+
+            @param value The integer value to write. Not actually used or checked.
+
+            @returns Always returns true. All checking is performed by debug asserts only on measure.
+
+            @see serialize_int_constant
+         */
+
+        template <int32_t min, int32_t max> bool SerializeIntegerConstant( int32_t value )
+        {
+            (void) value;
+            assert( min < max );
+            assert( value >= min );
+            assert( value <= max );
+            m_bitsWritten += BitsRequired<min,max>::result;
+            return true;
+        }
+
+        /**
+            Serialize a number of bits (write).
+
+            @param value The unsigned integer value to serialize. Not actually used or checked.
+            @param bits The number of bits to write in [1,32].
+
+            @returns Always returns true. All checking is performed by debug asserts on write.
+         */
+
+        bool SerializeBits( uint32_t value, int bits )
+        {
+            (void) value;
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            m_bitsWritten += bits;
+            return true;
+        }
+
+        /**
+            Serialize an array of values with the same number of bits (measure).
+
+            @param values The values to write. Not actually used or checked.
+            @param count The number of values to write.
+            @param bits The number of bits to write per value in [1,32].
+
+            @returns Always returns true. All checking is performed by debug asserts on measure.
+
+            @see serialize_bits_array
+         */
+
+        bool SerializeBitsArray( const uint32_t * values, int count, int bits )
+        {
+            (void) values;
+            assert( count >= 0 );
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            m_bitsWritten += count * bits;
+            return true;
+        }
+
+        /**
+            Serialize the prefix of a variable length integer (measure).
+
+            @param zeros The number of zero bits to 'write' in [0,32].
+
+            @returns Always returns true. All checking is performed by debug asserts on measure.
+
+            @see serialize_varint
+         */
+
+        bool SerializeVarintPrefix( int zeros )
+        {
+            assert( zeros >= 0 );
+            assert( zeros <= 32 );
+            m_bitsWritten += zeros + 1;
+            return true;
+        }
+
+        /**
+            Serialize an array of bytes (measure).
+
+            @param data Array of bytes to 'write'. Not actually used.
+            @param bytes The number of bytes to 'write'.
+
+            @returns Always returns true. All checking is performed by debug asserts on write.
+         */
+
+        bool SerializeBytes( const uint8_t * data, int bytes )
+        {
+            (void) data;
+            SerializeAlign();
+            m_bitsWritten += bytes * 8;
+            return true;
+        }
+
+        /**
+            Serialize an array of bytes viewed in place (measure).
+
+            @param data Array of bytes to 'write'. Not actually used.
+            @param bytes The number of bytes to 'write'.
+
+            @returns Always returns true. All checking is performed by debug asserts on write.
+         */
+
+        bool SerializeBytesView( const uint8_t * & data, int bytes )
+        {
+            return SerializeBytes( data, bytes );
+        }
+
+        /**
+            Serialize an align (measure).
+
+            @returns Always returns true. All checking is performed by debug asserts on write.
+         */
+
+        bool SerializeAlign()
+        {
+            const int alignBits = GetAlignBits();
+            m_bitsWritten += alignBits;
+            return true;
+        }
+
+        /** 
+            If we were to write an align right now, how many bits would be required?
+
+            IMPORTANT: Since the number of bits required for alignment depends on where an object is written in the final bit stream, this measurement is conservative. 
+
+            @returns Always returns worst case 7 bits.
+         */
+
+        int GetAlignBits() const
+        {
+            return 7;
+        }
+
+        /**
+            Serialize a safety check to the stream (measure).
+
+            @returns Always returns true. All checking is performed by debug asserts on write.
+         */
+
+        bool SerializeCheck()
+        {
+#if YOJIMBO_SERIALIZE_CHECKS
+            SerializeAlign();
+            m_bitsWritten += 32;
+#endif // #if YOJIMBO_SERIALIZE_CHECKS
+            return true;
+        }
+
+        /**
+            Get number of bits written so far.
+
+            @returns Number of bits written.
+         */
+
+        int GetBitsProcessed() const
+        {
+            return m_bitsWritten;
+        }
+
+        /**
+            How many bytes have been written so far?
+
+            @returns Number of bytes written.
+         */
+
+        int GetBytesProcessed() const
+        {
+            return ( m_bitsWritten + 7 ) / 8;
+        }
+
+    private:
+
+        int m_bitsWritten;                                  ///< Counter for the number of bits written.
+        SerializeProfiler * m_profiler;                     ///< The serialize profiler to add fields to. NULL if not profiling.
+        int m_profileDepth;                                 ///< The number of serialize macros currently nested. Only the outermost is reported.
+        const char * m_profileName;                         ///< The name of the outermost field being measured.
+        const char * m_profileFile;                         ///< The source file of the outermost field being measured.
+        int m_profileLine;                                  ///< The line number of the outermost field being measured.
+        int m_profileStartBits;                             ///< The number of bits written when the outermost field began.
+    };
+
+    /**
+        Measure stream that reports bits per field to a serialize profiler.
+
+        Pass this stream to the same serialize functions you'd pass a measure stream to, eg. Message::SerializeInternal, and the profiler aggregates how many bits each field takes. Use one profiler across many streams to find the fields that dominate bandwidth over a session.
+
+        Profiling costs a few branches per field and nothing at all for read and write streams, but it's still intended for development builds.
+
+        @see SerializeProfiler
+     */
+
+    class ProfilingMeasureStream : public MeasureStream
+    {
+    public:
+
+        /**
+            Profiling measure stream constructor.
+
+            @param profiler The profiler to add fields to. Must outlive the stream.
+            @param allocator The allocator to use for stream allocations.
+         */
+
+        explicit ProfilingMeasureStream( SerializeProfiler & profiler, Allocator & allocator = GetDefaultAllocator() ) : MeasureStream( allocator )
+        {
+            SetProfiler( &profiler );
+        }
+    };
+
+    const int RangeModelNumSlots = 64;                      ///< The number of adaptive models kept by range coder streams. Fields are hashed to a model slot by their range.
+
+    const int RangeModelTreeBits = 8;                       ///< The number of most significant bits of each value coded with adaptive probabilities. Lower bits are coded directly.
+
+    /**
+        Adaptive probability models shared by RangeEncodeStream and RangeDecodeStream.
+
+        Each field is mapped to a model by a key derived from its range, eg. serialize_int with the same min and max share a model, serialize_bits with the same number of bits share a model.
+
+        The most significant bits of each value are coded with a binary tree of adaptive probabilities, so the model learns the distribution of values for that field. 
+
+        The encoder and decoder look up models in exactly the same order, so if two fields collide on a slot, both sides reset the model the same way and stay in sync.
+
+        IMPORTANT: Models start from scratch for each stream. Nothing is carried over from one packet to the next, so packets can be lost or reordered without desyncing the coder.
+     */
+
+    struct RangeCoderModels
+    {
+        uint32_t key[RangeModelNumSlots];                   ///< The key of the field currently using each model slot.
+        int treeBits[RangeModelNumSlots];                   ///< The number of bits coded by the tree in each model slot. Zero if the slot is unused.
+        uint16_t tree[RangeModelNumSlots][1<<RangeModelTreeBits];     ///< Bit tree probabilities for each model slot. Node 1 is the root, the children of node n are 2n and 2n+1.
+        uint16_t byteTree[256];                             ///< Bit tree probabilities for bytes written with serialize_bytes and serialize_string.
+
+        RangeCoderModels()
+        {
+            for ( int i = 0; i < RangeModelNumSlots; ++i )
+            {
+                key[i] = 0;
+                treeBits[i] = 0;
+            }
+
+            for ( int i = 0; i < 256; ++i )
+                byteTree[i] = RangeProbabilityInit;
+        }
+
+        /**
+            Get the bit tree model for a field.
+
+            @param fieldKey The key for the field.
+            @param fieldTreeBits The number of bits coded by the tree in [1,RangeModelTreeBits].
+
+            @returns The bit tree probabilities for the field. If the slot was last used by a different field, it is reset first.
+         */
+
+        uint16_t * GetTree( uint32_t fieldKey, int fieldTreeBits )
+        {
+            assert( fieldTreeBits > 0 );
+            assert( fieldTreeBits <= RangeModelTreeBits );
+
+            const int slot = int( ( fieldKey * 2654435761U ) >> 26 );
+
+            assert( slot >= 0 );
+            assert( slot < RangeModelNumSlots );
+
+            if ( key[slot] != fieldKey || treeBits[slot] != fieldTreeBits )
+            {
+                key[slot] = fieldKey;
+                treeBits[slot] = fieldTreeBits;
+                for ( int i = 0; i < ( 1 << fieldTreeBits ); ++i )
+                    tree[slot][i] = RangeProbabilityInit;
+            }
+
+            return tree[slot];
+        }
+    };
+
+    /**
+        Get the range coder model key for an integer field.
+
+        @param min The minimum value for the field.
+        @param max The maximum value for the field.
+
+        @returns The model key. Integer fields with the same range share a model.
+     */
+
+    inline uint32_t range_model_integer_key( int32_t min, int32_t max )
+    {
+        return ( uint32_t( min ) * 0x9E3779B1U ) ^ uint32_t( max ) ^ 0x40000000U;
+    }
+
+    /**
+        Get the range coder model key for a bits field.
+
+        @param bits The number of bits in the field.
+
+        @returns The model key. Bit fields of the same size share a model.
+     */
+
+    inline uint32_t range_model_bits_key( int bits )
+    {
+        return 0x80000000U | uint32_t( bits );
+    }
+
+    const uint32_t RangeModelVarintKey = 0xC0000000U;       ///< The model key for variable length integer prefixes.
+
+    const int RangeModelVarintBits = 6;                     ///< The number of bits used to code a variable length integer prefix. Prefixes are in [0,32].
+
+    /**
+        Stream class for writing adaptive range coded data.
+
+        Has the same interface as WriteStream, so templated serialize functions work with it unchanged. Each field is coded with an adaptive model keyed on its range, so fields with skewed distributions (bools that are usually false, integers that are usually small or clustered) take a fraction of their bitpacked size.
+
+        Alignment is meaningless inside a range coded stream, so serialize_align is a no-op and serialize_bytes goes through the coder as well.
+
+        IMPORTANT: Range coding costs much more CPU per bit than bitpacking. Use this for data where size matters more than CPU, eg. high frequency state updates.
+
+        @see RangeDecodeStream
+        @see RangeEncoder
+        @see RangeCoderModels
+     */
+
+    class RangeEncodeStream : public BaseStream
+    {
+    public:
+
+        enum { IsWriting = 1 };
+        enum { IsReading = 0 };
+
+        /**
+            Range encode stream constructor.
+
+            @param buffer The buffer to write to.
+            @param bytes The number of bytes in the buffer.
+            @param allocator The allocator to use for stream allocations. The probability models are allocated with this allocator.
+         */
+
+        RangeEncodeStream( uint8_t * buffer, int bytes, Allocator & allocator = GetDefaultAllocator() ) : BaseStream( allocator ), m_encoder( buffer, bytes )
+        {
+            m_models = YOJIMBO_NEW( allocator, RangeCoderModels );
+        }
+
+        /**
+            Range encode stream destructor.
+
+            Frees the probability models.
+         */
+
+        ~RangeEncodeStream()
+        {
+            YOJIMBO_DELETE( GetAllocator(), RangeCoderModels, m_models );
+        }
+
+        /**
+            Serialize an integer (write).
+
+            @param value The integer value in [min,max].
+            @param min The minimum value.
+            @param max The maximum value.
+
+            @returns True if the value was written, false if the buffer is full.
+         */
+
+        bool SerializeInteger( int32_t value, int32_t min, int32_t max )
+        {
+            assert( min < max );
+            assert( value >= min );
+            assert( value <= max );
+            EncodeValue( range_model_integer_key( min, max ), uint32_t( value - min ), bits_required( min, max ) );
+            return !m_encoder.IsOverflow();
+        }
+
+        /**
+            Serialize an integer with bounds known at compile time (write).
+
+            @param value The integer value in [min,max].
+
+            @returns True if the value was written, false if the buffer is full.
+
+            @see serialize_int_constant
+         */
+
+        template <int32_t min, int32_t max> bool SerializeIntegerConstant( int32_t value )
+        {
+            return SerializeInteger( value, min, max );
+        }
+
+        /**
+            Serialize a number of bits (write).
+
+            @param value The unsigned integer value to serialize. Must be in range [0,(1<<bits)-1].
+            @param bits The number of bits to write in [1,32].
+
+            @returns True if the value was written, false if the buffer is full.
+         */
+
+        bool SerializeBits( uint32_t value, int bits )
+        {
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            EncodeValue( range_model_bits_key( bits ), value, bits );
+            return !m_encoder.IsOverflow();
+        }
+
+        /**
+            Serialize the prefix of a variable length integer (write).
+
+            The number of zeros is coded as a value with its own adaptive model, instead of as a run of bits.
+
+            @param zeros The number of zero bits in [0,32].
+
+            @returns True if the prefix was written, false if the buffer is full.
+
+            @see serialize_varint
+         */
+
+        bool SerializeVarintPrefix( int zeros )
+        {
+            assert( zeros >= 0 );
+            assert( zeros <= 32 );
+            EncodeValue( RangeModelVarintKey, uint32_t( zeros ), RangeModelVarintBits );
+            return !m_encoder.IsOverflow();
+        }
+
+        /**
+            Serialize an array of bytes (write).
+
+            @param data Array of bytes to be written.
+            @param bytes The number of bytes to write.
+
+            @returns True if the bytes were written, false if the buffer is full.
+         */
+
+        bool SerializeBytes( const uint8_t * data, int bytes )
+        {
+            assert( data );
+            assert( bytes >= 0 );
+            for ( int i = 0; i < bytes; ++i )
+                EncodeTree( m_models->byteTree, data[i], 8 );
+            return !m_encoder.IsOverflow();
+        }
+
+        /**
+            Serialize an array of bytes viewed in place (write).
+
+            @param data Array of bytes to be written.
+            @param bytes The number of bytes to write.
+
+            @returns True if the bytes were written, false if the buffer is full.
+         */
+
+        bool SerializeBytesView( const uint8_t * & data, int bytes )
+        {
+            return SerializeBytes( data, bytes );
+        }
+
+        /**
+            Serialize an align (write).
+
+            Range coded data has no bit alignment, so this does nothing.
+
+            @returns Always returns true.
+         */
+
+        bool SerializeAlign()
+        {
+            return true;
+        }
+
+        /** 
+            If we were to write an align right now, how many bits would be required?
+
+            @returns Always returns zero. Range coded data has no bit alignment.
+         */
+
+        int GetAlignBits() const
+        {
+            return 0;
+        }
+
+        /**
+            Serialize a safety check to the stream (write).
+
+            The check value is coded as direct bits, so it costs 32 bits regardless of the models.
+
+            @returns True if the check was written, false if the buffer is full.
+         */
+
+        bool SerializeCheck()
+        {
+#if YOJIMBO_SERIALIZE_CHECKS
+            m_encoder.EncodeDirectBits( SerializeCheckValue, 32 );
+#endif // #if YOJIMBO_SERIALIZE_CHECKS
+            return !m_encoder.IsOverflow();
+        }
+
+        /**
+            Flush the stream to memory after you finish writing.
+
+            Always call this after you finish writing and before you call RangeEncodeStream::GetData, or the last few values you wrote won't decode.
+
+            @see RangeEncoder::Flush
+         */
+
+        void Flush()
+        {
+            m_encoder.Flush();
+        }
+
+        /**
+            Did the data written run past the end of the buffer?
+
+            @returns True if the buffer was too small for the data written.
+         */
+
+        bool IsOverflow() const
+        {
+            return m_encoder.IsOverflow();
+        }
+
+        /**
+            Get a pointer to the data written by the stream.
+
+            IMPORTANT: Call RangeEncodeStream::Flush before you call this function!
+
+            @returns A pointer to the data written by the stream
+         */
+
+        const uint8_t * GetData() const
+        {
+            return m_encoder.GetData();
+        }
+
+        /**
+            How many bytes have been written so far?
+
+            @returns Number of bytes written. After RangeEncodeStream::Flush, this is effectively the packet size.
+         */
+
+        int GetBytesProcessed() const
+        {
+            return m_encoder.GetBytesWritten();
+        }
+
+        /**
+            Get number of bits written so far.
+
+            IMPORTANT: Range coded values don't take a whole number of bits, so this is a conservative estimate that includes bytes still pending in the encoder.
+
+            @returns Number of bits written.
+         */
+
+        int GetBitsProcessed() const
+        {
+            return m_encoder.GetBitsWritten();
+        }
+
+    private:
+
+        void EncodeTree( uint16_t * tree, uint32_t value, int bits )
+        {
+            uint32_t node = 1;
+            for ( int i = bits - 1; i >= 0; --i )
+            {
+                const uint32_t bit = ( value >> i ) & 1;
+                m_encoder.EncodeBit( tree[node], bit );
+                node = ( node << 1 ) | bit;
+            }
+        }
+
+        void EncodeValue( uint32_t key, uint32_t value, int bits )
+        {
+            const int treeBits = min( bits, RangeModelTreeBits );
+            const int directBits = bits - treeBits;
+            EncodeTree( m_models->GetTree( key, treeBits ), value >> directBits, treeBits );
+            if ( directBits > 0 )
+                m_encoder.EncodeDirectBits( value & ( ( 1U << directBits ) - 1 ), directBits );
+        }
+
+        RangeEncoder m_encoder;                             ///< The range encoder used for all write operations.
+        RangeCoderModels * m_models;                        ///< The adaptive probability models. Allocated with the stream allocator.
+
+        RangeEncodeStream( const RangeEncodeStream & other );
+        RangeEncodeStream & operator = ( const RangeEncodeStream & other );
+    };
+
+    /**
+        Stream class for reading adaptive range coded data.
+
+        Has the same interface as ReadStream, so templated serialize functions work with it unchanged. Reads data written by RangeEncodeStream.
+
+        Reading past the end of the buffer is detected and fails the serialize, so truncated or corrupt packets are rejected instead of reading out of bounds.
+
+        @see RangeEncodeStream
+        @see RangeDecoder
+        @see RangeCoderModels
+     */
+
+    class RangeDecodeStream : public BaseStream
+    {
+    public:
+
+        enum { IsWriting = 0 };
+        enum { IsReading = 1 };
+
+        /**
+            Range decode stream constructor.
+
+            @param buffer The buffer to read from.
+            @param bytes The number of bytes in the buffer.
+            @param allocator The allocator to use for stream allocations. The probability models are allocated with this allocator.
+         */
+
+        RangeDecodeStream( const uint8_t * buffer, int bytes, Allocator & allocator = GetDefaultAllocator() ) : BaseStream( allocator ), m_decoder( buffer, bytes )
+        {
+            m_models = YOJIMBO_NEW( allocator, RangeCoderModels );
+        }
+
+        /**
+            Range decode stream destructor.
+
+            Frees the probability models.
+         */
+
+        ~RangeDecodeStream()
+        {
+            YOJIMBO_DELETE( GetAllocator(), RangeCoderModels, m_models );
+        }
+
+        /**
+            Serialize an integer (read).
+
+            @param value The integer value read is stored here. The caller must check it is in [min,max], since values past max can be decoded from corrupt data.
+            @param min The minimum allowed value.
+            @param max The maximum allowed value.
+
+            @returns Returns true if the serialize succeeded, false if it ran past the end of the buffer.
+         */
+
+        bool SerializeInteger( int32_t & value, int32_t min, int32_t max )
+        {
+            assert( min < max );
+            value = (int32_t) DecodeValue( range_model_integer_key( min, max ), bits_required( min, max ) ) + min;
+            return !m_decoder.IsOverflow();
+        }
+
+        /**
+            Serialize an integer with bounds known at compile time (read).
+
+            @param value The integer value read is stored here. The caller must check it is in [min,max].
+
+            @returns Returns true if the serialize succeeded, false if it ran past the end of the buffer.
+
+            @see serialize_int_constant
+         */
+
+        template <int32_t min, int32_t max> bool SerializeIntegerConstant( int32_t & value )
+        {
+            return SerializeInteger( value, min, max );
+        }
+
+        /**
+            Serialize a number of bits (read).
+
+            @param value The integer value read is stored here. Will be in range [0,(1<<bits)-1].
+            @param bits The number of bits to read in [1,32].
+
+            @returns Returns true if the serialize succeeded, false if it ran past the end of the buffer.
+         */
+
+        bool SerializeBits( uint32_t & value, int bits )
+        {
+            assert( bits > 0 );
+            assert( bits <= 32 );
+            value = DecodeValue( range_model_bits_key( bits ), bits );
+            return !m_decoder.IsOverflow();
+        }
+
+        /**
+            Serialize the prefix of a variable length integer (read).
+
+            @param zeros The number of zero bits is stored here. Will be in range [0,32].
+
+            @returns Returns true if the prefix was read, false if it is out of range or runs past the end of the buffer.
+
+            @see serialize_varint
+         */
+
+        bool SerializeVarintPrefix( int & zeros )
+        {
+            const uint32_t value = DecodeValue( RangeModelVarintKey, RangeModelVarintBits );
+            if ( m_decoder.IsOverflow() || value > 32 )
+                return false;
+            zeros = int( value );
+            return true;
+        }
+
+        /**
+            Serialize an array of bytes (read).
+
+            @param data Array of bytes to read.
+            @param bytes The number of bytes to read.
+
+            @returns Returns true if the serialize succeeded, false if it ran past the end of the buffer.
+         */
+
+        bool SerializeBytes( uint8_t * data, int bytes )
+        {
+            assert( data );
+            assert( bytes >= 0 );
+            for ( int i = 0; i < bytes; ++i )
+            {
+                data[i] = uint8_t( DecodeTree( m_models->byteTree, 8 ) );
+                if ( m_decoder.IsOverflow() )
+                    return false;
+            }
+            return true;
+        }
+
+        /**
+            Serialize an array of bytes viewed in place (read).
+
+            Range coded bytes are not stored as they are in the buffer, so there is nothing to point at. Use SerializeBytes instead.
+
+            @param data Set to NULL.
+            @param bytes The number of bytes to read.
+
+            @returns Always returns false.
+         */
+
+        bool SerializeBytesView( const uint8_t * & data, int bytes )
+        {
+            (void) bytes;
+            data = NULL;
+            return false;
+        }
+
+        /**
+            Serialize an align (read).
+
+            Range coded data has no bit alignment, so this does nothing.
+
+            @returns Always returns true.
+         */
+
+        bool SerializeAlign()
+        {
+            return true;
+        }
+
+        /** 
+            If we were to read an align right now, how many bits would we need to read?
+
+            @returns Always returns zero. Range coded data has no bit alignment.
+         */
+
+        int GetAlignBits() const
+        {
+            return 0;
+        }
+
+        /**
+            Serialize a safety check from the stream (read).
+
+            @returns Returns true if the serialize check passed. False otherwise.
+         */
+
+        bool SerializeCheck()
+        {
+#if YOJIMBO_SERIALIZE_CHECKS
+            const uint32_t value = m_decoder.DecodeDirectBits( 32 );
+            if ( m_decoder.IsOverflow() )
+                return false;
+            if ( value != SerializeCheckValue )
+            {
+                debug_printf( "serialize check failed: expected %x, got %x\n", SerializeCheckValue, value );
+            }
+            return value == SerializeCheckValue;
+#else // #if YOJIMBO_SERIALIZE_CHECKS
+            return true;
+#endif // #if YOJIMBO_SERIALIZE_CHECKS
+        }
+
+        /**
+            Get number of bits read so far.
+
+            @returns Number of bits read. Since the decoder reads whole bytes ahead of the values decoded, this is always a multiple of eight.
+         */
+
+        int GetBitsProcessed() const
+        {
+            return m_decoder.GetBytesRead() * 8;
+        }
+
+        /**
+            How many bytes have been read so far?
+
+            @returns Number of bytes read.
+         */
+
+        int GetBytesProcessed() const
+        {
+            return m_decoder.GetBytesRead();
+        }
+
+    private:
+
+        uint32_t DecodeTree( uint16_t * tree, int bits )
+        {
+            uint32_t node = 1;
+            for ( int i = 0; i < bits; ++i )
+                node = ( node << 1 ) | m_decoder.DecodeBit( tree[node] );
+            return node - ( 1U << bits );
+        }
+
+        uint32_t DecodeValue( uint32_t key, int bits )
+        {
+            const int treeBits = min( bits, RangeModelTreeBits );
+            const int directBits = bits - treeBits;
+            uint32_t value = DecodeTree( m_models->GetTree( key, treeBits ), treeBits );
+            if ( directBits > 0 )
+                value = ( value << directBits ) | m_decoder.DecodeDirectBits( directBits );
+            return value;
+        }
+
+        RangeDecoder m_decoder;                             ///< The range decoder used for all read operations.
+        RangeCoderModels * m_models;                        ///< The adaptive probability models. Allocated with the stream allocator.
+
+        RangeDecodeStream( const RangeDecodeStream & other );
+        RangeDecodeStream & operator = ( const RangeDecodeStream & other );
     };
 }
 
@@ -0,0 +1,292 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_config.h"
+#include "yojimbo_string_dictionary.h"
+#include "yojimbo_connection.h"
+#include "yojimbo_common.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    static inline uint64_t hash_string( const char * string )
+    {
+        return murmur_hash_64( string, (uint32_t) strlen( string ), 0 );
+    }
+
+    template <typename Stream> bool serialize_dictionary_string( Stream & stream, char * string, int maxStringLength )
+    {
+        int length = 0;
+        if ( Stream::IsWriting )
+        {
+            length = (int) strlen( string );
+            assert( length <= maxStringLength );
+        }
+        serialize_int( stream, length, 0, maxStringLength );
+        serialize_bytes( stream, (uint8_t*)string, length );
+        if ( Stream::IsReading )
+            string[length] = '\0';
+        return true;
+    }
+
+    StringDictionary::StringDictionary( Allocator & allocator, int maxStrings, int maxStringLength, int sentPacketBufferSize ) : m_sendMap( allocator, maxStrings )
+    {
+        assert( maxStrings > 0 );
+        assert( maxStrings <= MaxInternedStrings );
+        assert( maxStringLength > 0 );
+
+        m_allocator = &allocator;
+        m_maxStrings = maxStrings;
+        m_maxStringLength = maxStringLength;
+
+        m_sendStrings = (char*) YOJIMBO_ALLOCATE( allocator, maxStrings * ( maxStringLength + 1 ) );
+        m_sendAcked = (uint8_t*) YOJIMBO_ALLOCATE( allocator, maxStrings );
+        m_sentPackets = YOJIMBO_NEW( allocator, SequenceBuffer<StringDictionarySentPacket>, allocator, sentPacketBufferSize );
+        m_receiveStrings = (char*) YOJIMBO_ALLOCATE( allocator, maxStrings * ( maxStringLength + 1 ) );
+        m_receiveValid = (uint8_t*) YOJIMBO_ALLOCATE( allocator, maxStrings );
+
+        Reset();
+    }
+
+    StringDictionary::~StringDictionary()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_sendStrings );
+        YOJIMBO_FREE( *m_allocator, m_sendAcked );
+        YOJIMBO_DELETE( *m_allocator, SequenceBuffer<StringDictionarySentPacket>, m_sentPackets );
+        YOJIMBO_FREE( *m_allocator, m_receiveStrings );
+        YOJIMBO_FREE( *m_allocator, m_receiveValid );
+
+        m_allocator = NULL;
+    }
+
+    void StringDictionary::Reset()
+    {
+        m_numSendStrings = 0;
+        m_packetSequence = 0;
+
+        m_sendMap.Clear();
+        m_sentPackets->Reset();
+
+        memset( m_sendAcked, 0, m_maxStrings );
+        memset( m_receiveValid, 0, m_maxStrings );
+    }
+
+    void StringDictionary::BeginPacket( uint16_t sequence )
+    {
+        m_packetSequence = sequence;
+    }
+
+    void StringDictionary::ProcessAck( uint16_t sequence )
+    {
+        const StringDictionarySentPacket * packetData = m_sentPackets->Find( sequence );
+        if ( !packetData )
+            return;
+
+        for ( int i = 0; i < packetData->numDefinitions; ++i )
+            m_sendAcked[packetData->definitions[i]] = 1;
+
+        m_sentPackets->Remove( sequence );
+    }
+
+    int StringDictionary::FindOrAddSendString( const char * string )
+    {
+        assert( string );
+
+        const int length = (int) strlen( string );
+
+        if ( length > m_maxStringLength )
+            return -1;
+
+        const uint64_t hash = hash_string( string );
+
+        const int id = m_sendMap.Find( hash );
+
+        if ( id >= 0 )
+            return strcmp( GetSendString( id ), string ) == 0 ? id : -1;
+
+        if ( m_numSendStrings == m_maxStrings )
+            return -1;
+
+        const int newId = m_numSendStrings++;
+
+        memcpy( GetSendString( newId ), string, length + 1 );
+
+        m_sendAcked[newId] = 0;
+
+        m_sendMap.Insert( hash, newId );
+
+        return newId;
+    }
+
+    bool StringDictionary::IsSendStringAcked( int id ) const
+    {
+        assert( id >= 0 );
+        assert( id < m_numSendStrings );
+        return m_sendAcked[id] != 0;
+    }
+
+    void StringDictionary::DefinitionWritten( int id )
+    {
+        assert( id >= 0 );
+        assert( id < m_numSendStrings );
+
+        StringDictionarySentPacket * packetData = m_sentPackets->Find( m_packetSequence );
+
+        if ( !packetData )
+        {
+            packetData = m_sentPackets->Insert( m_packetSequence );
+            if ( !packetData )
+                return;
+            packetData->numDefinitions = 0;
+        }
+
+        // IMPORTANT: a string may be written more than once per-packet, and a packet may be written more than once. only record each definition once
+
+        for ( int i = 0; i < packetData->numDefinitions; ++i )
+        {
+            if ( packetData->definitions[i] == id )
+                return;
+        }
+
+        if ( packetData->numDefinitions < MaxStringDefinitionsPerPacket )
+            packetData->definitions[packetData->numDefinitions++] = uint16_t( id );
+    }
+
+    bool StringDictionary::AddReceiveString( int id, const char * string )
+    {
+        assert( string );
+
+        if ( id < 0 || id >= m_maxStrings )
+            return false;
+
+        const int length = (int) strlen( string );
+
+        if ( length > m_maxStringLength )
+            return false;
+
+        memcpy( GetReceiveStringBuffer( id ), string, length + 1 );
+
+        m_receiveValid[id] = 1;
+
+        return true;
+    }
+
+    const char * StringDictionary::GetReceiveString( int id ) const
+    {
+        if ( id < 0 || id >= m_maxStrings || !m_receiveValid[id] )
+            return NULL;
+
+        return m_receiveStrings + id * ( m_maxStringLength + 1 );
+    }
+
+    template <typename Stream> bool StringDictionary::SerializeStateInternal( Stream & stream )
+    {
+        if ( Stream::IsReading )
+            Reset();
+
+        serialize_int( stream, m_numSendStrings, 0, m_maxStrings );
+
+        for ( int id = 0; id < m_numSendStrings; ++id )
+        {
+            char * string = GetSendString( id );
+
+            if ( !serialize_dictionary_string( stream, string, m_maxStringLength ) )
+                return false;
+
+            bool acked = Stream::IsWriting && m_sendAcked[id];
+
+            serialize_bool( stream, acked );
+
+            if ( Stream::IsReading )
+            {
+                if ( !m_sendMap.Insert( hash_string( string ), id ) )
+                    return false;
+
+                m_sendAcked[id] = acked ? 1 : 0;
+            }
+        }
+
+        int numReceiveStrings = 0;
+
+        if ( Stream::IsWriting )
+        {
+            for ( int id = 0; id < m_maxStrings; ++id )
+                numReceiveStrings += m_receiveValid[id];
+        }
+
+        serialize_int( stream, numReceiveStrings, 0, m_maxStrings );
+
+        int id = -1;
+
+        for ( int i = 0; i < numReceiveStrings; ++i )
+        {
+            if ( Stream::IsWriting )
+            {
+                id++;
+                while ( !m_receiveValid[id] )
+                    id++;
+            }
+
+            serialize_int( stream, id, 0, m_maxStrings - 1 );
+
+            char * string = GetReceiveStringBuffer( id );
+
+            if ( !serialize_dictionary_string( stream, string, m_maxStringLength ) )
+                return false;
+
+            if ( Stream::IsReading )
+                m_receiveValid[id] = 1;
+        }
+
+        return true;
+    }
+
+    bool StringDictionary::SerializeState( ReadStream & stream )
+    {
+        return SerializeStateInternal( stream );
+    }
+
+    bool StringDictionary::SerializeState( WriteStream & stream )
+    {
+        return SerializeStateInternal( stream );
+    }
+
+    bool StringDictionary::SerializeState( MeasureStream & stream )
+    {
+        return SerializeStateInternal( stream );
+    }
+
+    StringDictionary * GetStringDictionary( void * context )
+    {
+        ConnectionContext * connectionContext = (ConnectionContext*) context;
+
+        if ( !connectionContext || connectionContext->magic != ConnectionContextMagic )
+            return NULL;
+
+        return connectionContext->stringDictionary;
+    }
+}
@@ -0,0 +1,371 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef YOJIMBO_STRING_DICTIONARY_H
+#define YOJIMBO_STRING_DICTIONARY_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_allocator.h"
+#include "yojimbo_serialize.h"
+#include "yojimbo_id_map.h"
+#include "yojimbo_sequence_buffer.h"
+#include <string.h>
+
+/** @file */
+
+namespace yojimbo
+{
+    /// The maximum number of string definitions recorded per-connection packet. Definitions past this in one packet are still written, but are sent again until a packet that recorded them is acked.
+
+    const int MaxStringDefinitionsPerPacket = 16;
+
+    /// Data stored per-sent connection packet in a sequence buffer, so the definitions it carried are known to have arrived once it is acked.
+
+    struct StringDictionarySentPacket
+    {
+        int numDefinitions;                                                     ///< The number of string definitions recorded for the packet.
+        uint16_t definitions[MaxStringDefinitionsPerPacket];                    ///< The ids of the send strings defined in the packet.
+    };
+
+    /**
+        Per-connection dictionary of interned strings.
+
+        Strings serialized with serialize_interned_string are assigned a small id the first time they are written. The string is sent along with its id (a definition) until a connection packet carrying the definition is acked, and from then on only the id is sent. 
+        
+        Each side of the connection has a send table, for strings it writes, and a receive table, for definitions read from the other side. Ids are never reused, so once the send table is full, new strings are sent inline like serialize_string.
+
+        Because the id is only sent on its own once a packet with the definition has been acked, this works regardless of which channel the message is sent over, and regardless of the order packets arrive in.
+
+        IMPORTANT: Messages serialized outside of a connection packet, eg. broadcast messages and messages cached with ChannelConfig::cacheSerializedMessages, have no dictionary, so their interned strings are always sent inline.
+
+        @see ConnectionConfig::maxInternedStrings
+        @see Connection::GetStringDictionary
+     */
+
+    class StringDictionary
+    {
+    public:
+
+        /**
+            String dictionary constructor.
+
+            @param allocator The allocator used for the send and receive tables.
+            @param maxStrings The maximum number of strings in each of the send and receive tables. Must be in [1,MaxInternedStrings].
+            @param maxStringLength The longest string that can be interned, not including the null terminator. Longer strings are sent inline.
+            @param sentPacketBufferSize The number of sent connection packets definitions are recorded for. Acks for older packets are ignored. See ConnectionConfig::slidingWindowSize.
+         */
+
+        StringDictionary( Allocator & allocator, int maxStrings, int maxStringLength, int sentPacketBufferSize );
+
+        /**
+            String dictionary destructor.
+         */
+
+        ~StringDictionary();
+
+        /**
+            Reset the string dictionary.
+
+            Clears the send and receive tables. Both sides of the connection must reset their dictionaries together, eg. when the connection is reset.
+         */
+
+        void Reset();
+
+        /**
+            Set the sequence number of the connection packet being written.
+
+            Definitions written from now on are recorded against this packet, so they are known to have arrived once it is acked.
+
+            @param sequence The connection packet sequence number.
+         */
+
+        void BeginPacket( uint16_t sequence );
+
+        /**
+            Called when a connection packet is acked.
+
+            Strings whose definition was carried by this packet are sent by id from now on.
+
+            @param sequence The sequence number of the acked connection packet.
+         */
+
+        void ProcessAck( uint16_t sequence );
+
+        /**
+            Find the id of a string in the send table, adding it if it is not there yet.
+
+            @param string The string to find.
+
+            @returns The id of the string, or -1 if the string is too long, the send table is full, or another string has the same hash. Strings without an id are sent inline.
+         */
+
+        int FindOrAddSendString( const char * string );
+
+        /**
+            Is the send string acked?
+
+            @param id The id of the string in the send table.
+
+            @returns True if a packet carrying the definition of the string has been acked, so it can be sent by id alone.
+         */
+
+        bool IsSendStringAcked( int id ) const;
+
+        /**
+            Record that the definition of a send string was written to the current connection packet.
+
+            @param id The id of the string in the send table.
+
+            @see StringDictionary::BeginPacket
+         */
+
+        void DefinitionWritten( int id );
+
+        /**
+            Add a definition read from the other side to the receive table.
+
+            @param id The id of the string.
+            @param string The string. Must be null terminated.
+
+            @returns True if the definition was added, false if the id or string length is out of range.
+         */
+
+        bool AddReceiveString( int id, const char * string );
+
+        /**
+            Get a string in the receive table.
+
+            @param id The id of the string.
+
+            @returns The string, or NULL if the id is out of range or no definition has been read for it.
+         */
+
+        const char * GetReceiveString( int id ) const;
+
+        /**
+            Get the maximum number of strings in each table.
+
+            @returns The maximum number of strings passed in to the constructor.
+         */
+
+        int GetMaxStrings() const { return m_maxStrings; }
+
+        /**
+            Get the longest string that can be interned.
+
+            @returns The maximum string length passed in to the constructor, not including the null terminator.
+         */
+
+        int GetMaxStringLength() const { return m_maxStringLength; }
+
+        /**
+            Get the number of strings in the send table.
+
+            @returns The number of strings in [0,maxStrings].
+         */
+
+        int GetNumSendStrings() const { return m_numSendStrings; }
+
+        /**
+            Read the dictionary state written by another dictionary.
+
+            Used by Connection::SerializeState so a connection handed off to another server keeps the strings interned on both sides. Definitions that were not acked yet are sent again.
+
+            @param stream The stream to read the dictionary state from.
+
+            @returns True if the state was read successfully, false otherwise.
+         */
+
+        bool SerializeState( ReadStream & stream );
+
+        /**
+            Write the dictionary state, so another dictionary can carry on from it.
+
+            @param stream The stream to write the dictionary state to.
+
+            @returns Always true.
+         */
+
+        bool SerializeState( WriteStream & stream );
+
+        /**
+            Measure the dictionary state.
+
+            @param stream The stream to measure the dictionary state with.
+
+            @returns Always true.
+         */
+
+        bool SerializeState( MeasureStream & stream );
+
+    protected:
+
+        template <typename Stream> bool SerializeStateInternal( Stream & stream );
+
+        char * GetSendString( int id ) { return m_sendStrings + id * ( m_maxStringLength + 1 ); }
+
+        char * GetReceiveStringBuffer( int id ) { return m_receiveStrings + id * ( m_maxStringLength + 1 ); }
+
+    private:
+
+        Allocator * m_allocator;                                                ///< The allocator passed in to the constructor.
+
+        int m_maxStrings;                                                       ///< The maximum number of strings in each table.
+
+        int m_maxStringLength;                                                  ///< The longest string that can be interned, not including the null terminator.
+
+        int m_numSendStrings;                                                   ///< The number of strings in the send table. Ids are assigned in order, so these are the ids in [0,m_numSendStrings-1].
+
+        uint16_t m_packetSequence;                                              ///< The sequence number of the connection packet being written. See StringDictionary::BeginPacket.
+
+        IdMap m_sendMap;                                                        ///< Maps the hash of each send string to its id.
+
+        char * m_sendStrings;                                                   ///< The send table. Null terminated strings of up to m_maxStringLength characters, indexed by id.
+
+        uint8_t * m_sendAcked;                                                  ///< 1 if the definition of the send string has been acked, 0 otherwise. Indexed by id.
+
+        SequenceBuffer<StringDictionarySentPacket> * m_sentPackets;             ///< The definitions written to each sent connection packet. See StringDictionary::ProcessAck.
+
+        char * m_receiveStrings;                                                ///< The receive table. Null terminated strings of up to m_maxStringLength characters, indexed by id.
+
+        uint8_t * m_receiveValid;                                               ///< 1 if a definition has been read for this id, 0 otherwise.
+
+        StringDictionary( const StringDictionary & other );
+
+        const StringDictionary & operator = ( const StringDictionary & other );
+    };
+
+    /**
+        Get the string dictionary for the connection a stream is serializing packets for.
+
+        @param context The stream context. See BaseStream::GetContext.
+
+        @returns The string dictionary, or NULL if the context is not a connection context or interned strings are disabled for the connection.
+
+        @see ConnectionContext::stringDictionary
+     */
+
+    StringDictionary * GetStringDictionary( void * context );
+
+    /// Interned strings are written in one of three ways. See serialize_interned_string.
+
+    enum InternedStringMode
+    {
+        INTERNED_STRING_INLINE,                                                 ///< The string is written like serialize_string, without an id.
+        INTERNED_STRING_DEFINE,                                                 ///< The string is written along with its id.
+        INTERNED_STRING_REFERENCE                                               ///< Only the id of the string is written.
+    };
+
+    inline bool is_measure_stream( const MeasureStream * stream ) { (void) stream; return true; }
+
+    inline bool is_measure_stream( const void * stream ) { (void) stream; return false; }
+
+    template <typename Stream> bool serialize_interned_string_internal( Stream & stream, char * string, int buffer_size )
+    {
+        StringDictionary * dictionary = GetStringDictionary( stream.GetContext() );
+
+        // IMPORTANT: messages are measured without a dictionary, but may later be written with a definition, so measure the largest form
+
+        const bool measure = is_measure_stream( &stream );
+
+        int maxStrings = ( dictionary && !measure ) ? dictionary->GetMaxStrings() : MaxInternedStrings;
+
+        int mode = INTERNED_STRING_INLINE;
+        int id = 0;
+
+        if ( measure )
+        {
+            mode = INTERNED_STRING_DEFINE;
+        }
+        else if ( Stream::IsWriting && dictionary )
+        {
+            id = dictionary->FindOrAddSendString( string );
+            if ( id >= 0 )
+                mode = dictionary->IsSendStringAcked( id ) ? INTERNED_STRING_REFERENCE : INTERNED_STRING_DEFINE;
+            else
+                id = 0;
+        }
+
+        serialize_int( stream, mode, INTERNED_STRING_INLINE, INTERNED_STRING_REFERENCE );
+
+        if ( mode != INTERNED_STRING_INLINE )
+        {
+            if ( Stream::IsReading && !dictionary )
+                return false;
+
+            serialize_int( stream, id, 0, maxStrings - 1 );
+        }
+
+        if ( mode == INTERNED_STRING_REFERENCE )
+        {
+            if ( Stream::IsReading )
+            {
+                const char * value = dictionary->GetReceiveString( id );
+                if ( !value || (int) strlen( value ) >= buffer_size )
+                    return false;
+                strcpy( string, value );
+            }
+            return true;
+        }
+
+        if ( !serialize_string_internal( stream, string, buffer_size ) )
+            return false;
+
+        if ( mode == INTERNED_STRING_DEFINE && !measure )
+        {
+            if ( Stream::IsReading )
+                return dictionary->AddReceiveString( id, string );
+
+            dictionary->DefinitionWritten( id );
+        }
+
+        return true;
+    }
+
+    /**
+        Serialize a string through the per-connection string dictionary (read/write/measure).
+
+        Use this instead of serialize_string for strings that are sent over and over, like player names, item ids and map names. The first time a string is written it is sent with a small id. Once the other side has acked a packet with the string, only the id is sent.
+
+        Falls back to sending the string inline when the stream isn't serializing a connection packet, the string is longer than ConnectionConfig::maxInternedStringLength or the dictionary is full. Strings are always measured as if they were sent with an id, so messages with interned strings measure slightly larger than with serialize_string.
+
+        IMPORTANT: This macro must be called inside a templated serialize function with template \<typename Stream\>. The serialize method must have a bool return value.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param string The string to serialize write/measure. Pointer to buffer to be filled on read.
+        @param buffer_size The size of the string buffer. String with terminating null character must fit into this buffer.
+
+        @see StringDictionary
+     */
+
+    #define serialize_interned_string( stream, string, buffer_size )                                \
+        do                                                                                          \
+        {                                                                                           \
+            serialize_profile_field( stream, #string );                                             \
+            if ( !yojimbo::serialize_interned_string_internal( stream, string, buffer_size ) )      \
+                return false;                                                                       \
+        } while (0)
+}
+
+#endif // #ifndef YOJIMBO_STRING_DICTIONARY_H
@@ -0,0 +1,216 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_config.h"
+#include "yojimbo_timer_wheel.h"
+#include "yojimbo_common.h"
+
+namespace yojimbo
+{
+    TimerWheel::TimerWheel( Allocator & allocator, int numTimers )
+    {
+        assert( numTimers > 0 );
+        assert( ( TimerWheelSlots & ( TimerWheelSlots - 1 ) ) == 0 );
+
+        m_allocator = &allocator;
+
+        m_numTimers = numTimers;
+
+        m_next = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * numTimers );
+        m_prev = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * numTimers );
+        m_slot = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * numTimers );
+        m_expireTime = (double*) YOJIMBO_ALLOCATE( allocator, sizeof( double ) * numTimers );
+
+        Reset( 0.0 );
+    }
+
+    TimerWheel::~TimerWheel()
+    {
+        assert( m_allocator );
+
+        YOJIMBO_FREE( *m_allocator, m_next );
+        YOJIMBO_FREE( *m_allocator, m_prev );
+        YOJIMBO_FREE( *m_allocator, m_slot );
+        YOJIMBO_FREE( *m_allocator, m_expireTime );
+
+        m_allocator = NULL;
+    }
+
+    void TimerWheel::Reset( double time )
+    {
+        m_numScheduledTimers = 0;
+
+        m_currentTick = GetTick( time );
+
+        for ( int i = 0; i < TimerWheelSlots; ++i )
+            m_head[i] = -1;
+
+        for ( int i = 0; i < m_numTimers; ++i )
+        {
+            m_next[i] = -1;
+            m_prev[i] = -1;
+            m_slot[i] = -1;
+            m_expireTime[i] = 0.0;
+        }
+    }
+
+    uint64_t TimerWheel::GetTick( double time ) const
+    {
+        if ( time <= 0.0 )
+            return 0;
+
+        return uint64_t( time / TimerWheelTickTime );
+    }
+
+    void TimerWheel::Link( int timer, uint64_t tick )
+    {
+        assert( m_slot[timer] == -1 );
+
+        const int slot = int( tick & uint64_t( TimerWheelSlots - 1 ) );
+
+        m_slot[timer] = slot;
+        m_prev[timer] = -1;
+        m_next[timer] = m_head[slot];
+
+        if ( m_head[slot] != -1 )
+            m_prev[m_head[slot]] = timer;
+
+        m_head[slot] = timer;
+
+        m_numScheduledTimers++;
+    }
+
+    void TimerWheel::Unlink( int timer )
+    {
+        const int slot = m_slot[timer];
+
+        assert( slot >= 0 );
+        assert( slot < TimerWheelSlots );
+
+        if ( m_prev[timer] != -1 )
+            m_next[m_prev[timer]] = m_next[timer];
+        else
+            m_head[slot] = m_next[timer];
+
+        if ( m_next[timer] != -1 )
+            m_prev[m_next[timer]] = m_prev[timer];
+
+        m_next[timer] = -1;
+        m_prev[timer] = -1;
+        m_slot[timer] = -1;
+
+        assert( m_numScheduledTimers > 0 );
+
+        m_numScheduledTimers--;
+    }
+
+    void TimerWheel::Schedule( int timer, double expireTime )
+    {
+        assert( timer >= 0 );
+        assert( timer < m_numTimers );
+
+        if ( m_slot[timer] != -1 )
+            Unlink( timer );
+
+        // IMPORTANT: timers that are already due go in the current tick, so they expire on the next call to AdvanceTime instead of a full rotation later
+
+        uint64_t tick = GetTick( expireTime );
+        if ( tick < m_currentTick )
+            tick = m_currentTick;
+
+        m_expireTime[timer] = expireTime;
+
+        Link( timer, tick );
+    }
+
+    void TimerWheel::Cancel( int timer )
+    {
+        assert( timer >= 0 );
+        assert( timer < m_numTimers );
+
+        if ( m_slot[timer] != -1 )
+            Unlink( timer );
+    }
+
+    bool TimerWheel::IsScheduled( int timer ) const
+    {
+        assert( timer >= 0 );
+        assert( timer < m_numTimers );
+
+        return m_slot[timer] != -1;
+    }
+
+    int TimerWheel::AdvanceTime( double time, int * expiredTimers )
+    {
+        assert( expiredTimers );
+
+        int numExpiredTimers = 0;
+
+        if ( m_numScheduledTimers == 0 )
+        {
+            const uint64_t tick = GetTick( time );
+            if ( tick > m_currentTick )
+                m_currentTick = tick;
+            return 0;
+        }
+
+        // visit the slots from the current tick up to and including the tick for this time. the last slot is visited again next time, because it can hold timers that expire later in the same tick
+
+        const uint64_t targetTick = GetTick( time );
+
+        uint64_t numTicks = ( targetTick >= m_currentTick ) ? targetTick - m_currentTick + 1 : 1;
+
+        if ( numTicks > uint64_t( TimerWheelSlots ) )
+            numTicks = TimerWheelSlots;
+
+        for ( uint64_t i = 0; i < numTicks; ++i )
+        {
+            const int slot = int( ( m_currentTick + i ) & uint64_t( TimerWheelSlots - 1 ) );
+
+            int timer = m_head[slot];
+
+            while ( timer != -1 )
+            {
+                const int next = m_next[timer];
+
+                // IMPORTANT: timers due in a later rotation of the wheel share this slot. leave them where they are
+
+                if ( m_expireTime[timer] <= time )
+                {
+                    Unlink( timer );
+                    assert( numExpiredTimers < m_numTimers );
+                    expiredTimers[numExpiredTimers++] = timer;
+                }
+
+                timer = next;
+            }
+        }
+
+        if ( targetTick > m_currentTick )
+            m_currentTick = targetTick;
+
+        return numExpiredTimers;
+    }
+}
@@ -0,0 +1,166 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef YOJIMBO_TIMER_WHEEL_H
+#define YOJIMBO_TIMER_WHEEL_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_allocator.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    /**
+        A hashed timing wheel for expiring a fixed set of timers.
+
+        Each timer is identified by an integer in [0,numTimers-1], typically the index into an array of per-slot data like encryption mappings or client slots. At most one expiration is scheduled per-timer.
+
+        Time is divided into ticks of TimerWheelTickTime seconds, and each timer is linked into the wheel slot for the tick it expires in. Advancing time only visits the slots for ticks that have passed, so the cost per-tick is proportional to the number of timers in those slots, instead of the total number of timers. Scheduling and cancelling a timer is O(1).
+
+        Timers are only scheduled and cancelled explicitly. The typical pattern for timeouts that are refreshed constantly (eg. every time a packet is received) is to leave the timer alone when the timeout is refreshed, and when the timer expires, check the real deadline and reschedule the timer if it has moved. This keeps the per-packet cost to a single store.
+
+        @see EncryptionManager
+        @see Server::CheckForTimeOut
+     */
+
+    class TimerWheel
+    {
+    public:
+
+        /**
+            Timer wheel constructor.
+
+            @param allocator The allocator used to allocate the timers.
+            @param numTimers The number of timers. Timers are identified by integers in [0,numTimers-1].
+         */
+
+        TimerWheel( Allocator & allocator, int numTimers );
+
+        /**
+            Timer wheel destructor.
+         */
+
+        ~TimerWheel();
+
+        /**
+            Cancel all timers.
+
+            @param time The current time. The next call to TimerWheel::AdvanceTime will only visit ticks after this time.
+         */
+
+        void Reset( double time );
+
+        /**
+            Schedule a timer to expire at a certain time.
+
+            If the timer is already scheduled, it is rescheduled.
+
+            @param timer The timer to schedule, in [0,numTimers-1].
+            @param expireTime The time the timer expires. The timer is returned from TimerWheel::AdvanceTime once time reaches this value.
+         */
+
+        void Schedule( int timer, double expireTime );
+
+        /**
+            Cancel a timer.
+
+            Does nothing if the timer is not scheduled.
+
+            @param timer The timer to cancel, in [0,numTimers-1].
+         */
+
+        void Cancel( int timer );
+
+        /**
+            Is this timer scheduled?
+
+            @param timer The timer, in [0,numTimers-1].
+
+            @returns True if the timer is scheduled and has not expired yet.
+         */
+
+        bool IsScheduled( int timer ) const;
+
+        /**
+            Advance time and collect expired timers.
+
+            Expired timers are no longer scheduled once they are returned. Reschedule them with TimerWheel::Schedule if their deadline has moved.
+
+            @param time The current time.
+            @param expiredTimers Array that the expired timers are written to [out]. Must have room for numTimers entries.
+
+            @returns The number of expired timers written to the array.
+         */
+
+        int AdvanceTime( double time, int * expiredTimers );
+
+        /**
+            Get the number of timers.
+
+            @returns The number of timers passed in to the constructor.
+         */
+
+        int GetNumTimers() const { return m_numTimers; }
+
+        /**
+            Get the number of timers currently scheduled.
+
+            @returns The number of scheduled timers in [0,numTimers].
+         */
+
+        int GetNumScheduledTimers() const { return m_numScheduledTimers; }
+
+    protected:
+
+        void Link( int timer, uint64_t tick );
+
+        void Unlink( int timer );
+
+        uint64_t GetTick( double time ) const;
+
+    private:
+
+        Allocator * m_allocator;                                ///< The allocator passed into the constructor.
+
+        int m_numTimers;                                        ///< The number of timers.
+
+        int m_numScheduledTimers;                               ///< The number of timers currently linked into the wheel.
+
+        uint64_t m_currentTick;                                 ///< The next tick to be processed by TimerWheel::AdvanceTime. Timers are never linked into a tick before this one.
+
+        int m_head[TimerWheelSlots];                            ///< The first timer in each slot, or -1 if the slot is empty.
+
+        int * m_next;                                           ///< The next timer in the same slot per-timer, or -1 at the end of the slot.
+
+        int * m_prev;                                           ///< The previous timer in the same slot per-timer, or -1 at the start of the slot.
+
+        int * m_slot;                                           ///< The slot each timer is linked into, or -1 if the timer is not scheduled.
+
+        double * m_expireTime;                                  ///< The time each timer expires. Only valid if the timer is scheduled.
+    };
+}
+
+#endif // #ifndef YOJIMBO_TIMER_WHEEL_H
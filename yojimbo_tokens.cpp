@@ -25,6 +25,7 @@
 #include "yojimbo_config.h"
 #include "yojimbo_tokens.h"
 #include "yojimbo_encryption.h"
+#include "yojimbo_platform.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -37,6 +38,19 @@
 
 using namespace rapidjson;    
 
+namespace yojimbo
+{
+    // IMPORTANT: Connect tokens are parsed with a document whose values and parse stack both live in a fixed size buffer on the stack, so reading a connect token doesn't allocate.
+
+    typedef GenericDocument< UTF8<>, MemoryPoolAllocator<>, MemoryPoolAllocator<> > ConnectTokenDocument;
+
+    static const int ConnectTokenDocumentBytes = 4 * 1024;
+
+    static const int ConnectTokenDocumentStackBytes = 512;
+
+    static bool read_connect_token_from_document( const Value & doc, ConnectToken & connectToken );
+}
+
 namespace yojimbo
 {
     bool ConnectToken::operator == ( const ConnectToken & other ) const
@@ -111,9 +125,112 @@ namespace yojimbo
         return true;
     }
 
+    static void write_compact_connect_token_header( uint8_t * header, int connectTokenBytes )
+    {
+        header[0] = 'Y';
+        header[1] = 'J';
+        header[2] = 'C';
+        header[3] = 'T';
+        header[4] = (uint8_t) CompactConnectTokenVersion;
+        header[5] = 0;
+        header[6] = (uint8_t) ( connectTokenBytes & 0xFF );
+        header[7] = (uint8_t) ( connectTokenBytes >> 8 );
+    }
+
+    int GetConnectTokenBytes( const uint8_t * connectTokenData )
+    {
+        assert( connectTokenData );
+
+        const uint8_t * header = connectTokenData;
+
+        if ( header[0] != 'Y' || header[1] != 'J' || header[2] != 'C' || header[3] != 'T' )
+            return ConnectTokenBytes;
+
+        if ( header[4] != CompactConnectTokenVersion || header[5] != 0 )
+            return ConnectTokenBytes;
+
+        const int connectTokenBytes = int( header[6] ) | ( int( header[7] ) << 8 );
+
+        const int encryptedBytes = connectTokenBytes - CompactConnectTokenHeaderBytes - MacBytes;
+
+        if ( connectTokenBytes < MinCompactConnectTokenBytes || connectTokenBytes > ConnectTokenBytes || ( encryptedBytes % 4 ) != 0 )
+            return ConnectTokenBytes;
+
+        return connectTokenBytes;
+    }
+
+    bool EncryptCompactConnectToken( const ConnectToken & token, uint8_t * encryptedMessage, const uint8_t * nonce, const uint8_t * key )
+    {
+        const int MaxMessageBytes = ConnectTokenBytes - CompactConnectTokenHeaderBytes - MacBytes;
+
+        uint8_t message[MaxMessageBytes];
+        memset( message, 0, MaxMessageBytes );
+        WriteStream stream( message, MaxMessageBytes );
+        ConnectToken writeToken = token;
+        if ( !writeToken.Serialize( stream ) )
+            return false;
+
+        stream.Flush();
+
+        // IMPORTANT: Round up to a whole number of dwords so the server can read the decrypted token with a ReadStream.
+        // Never go below the size of a challenge token, so the server's challenge packet is never larger than the request that triggered it.
+
+        int messageBytes = ( stream.GetBytesProcessed() + 3 ) & ~3;
+
+        if ( messageBytes < MinCompactConnectTokenBytes - CompactConnectTokenHeaderBytes - MacBytes )
+            messageBytes = MinCompactConnectTokenBytes - CompactConnectTokenHeaderBytes - MacBytes;
+
+        const int connectTokenBytes = CompactConnectTokenHeaderBytes + messageBytes + MacBytes;
+
+        assert( connectTokenBytes <= ConnectTokenBytes );
+
+        write_compact_connect_token_header( encryptedMessage, connectTokenBytes );
+
+        // IMPORTANT: The header is sent in the clear, so it goes into the additional data alongside the expire timestamp. Modifying it in flight fails the decrypt.
+
+        uint8_t additionalData[8+CompactConnectTokenHeaderBytes];
+        uint64_t expireTimestampNetworkOrder = host_to_network( token.expireTimestamp );        // network order is little endian
+        memcpy( additionalData, &expireTimestampNetworkOrder, 8 );
+        memcpy( additionalData + 8, encryptedMessage, CompactConnectTokenHeaderBytes );
+
+        uint64_t encryptedLength;
+
+        if ( !Encrypt_AEAD( message, messageBytes, encryptedMessage + CompactConnectTokenHeaderBytes, encryptedLength, additionalData, sizeof( additionalData ), nonce, key ) )
+            return false;
+
+        assert( int( encryptedLength ) == messageBytes + MacBytes );
+
+        return true;
+    }
+
+    static bool decrypt_compact_connect_token( const uint8_t * encryptedMessage, int connectTokenBytes, ConnectToken & decryptedToken, const uint8_t * nonce, const uint8_t * key, uint64_t expireTimestamp )
+    {
+        uint8_t additionalData[8+CompactConnectTokenHeaderBytes];
+        uint64_t expireTimestampNetworkOrder = host_to_network( expireTimestamp );              // network order is little endian
+        memcpy( additionalData, &expireTimestampNetworkOrder, 8 );
+        memcpy( additionalData + 8, encryptedMessage, CompactConnectTokenHeaderBytes );
+
+        uint64_t decryptedMessageLength;
+        uint8_t decryptedMessage[ConnectTokenBytes];
+
+        if ( !Decrypt_AEAD( encryptedMessage + CompactConnectTokenHeaderBytes, connectTokenBytes - CompactConnectTokenHeaderBytes, decryptedMessage, decryptedMessageLength, additionalData, sizeof( additionalData ), nonce, key ) )
+            return false;
+
+        assert( int( decryptedMessageLength ) == connectTokenBytes - CompactConnectTokenHeaderBytes - MacBytes );
+
+        ReadStream stream( decryptedMessage, int( decryptedMessageLength ) );
+        if ( !decryptedToken.Serialize( stream ) )
+            return false;
+
+        return decryptedToken.expireTimestamp == expireTimestamp;
+    }
+
     bool DecryptConnectToken( const uint8_t * encryptedMessage, ConnectToken & decryptedToken, const uint8_t * nonce, const uint8_t * key, uint64_t expireTimestamp )
     {
-        const int encryptedMessageLength = ConnectTokenBytes;
+        const int encryptedMessageLength = GetConnectTokenBytes( encryptedMessage );
+
+        if ( encryptedMessageLength != ConnectTokenBytes )
+            return decrypt_compact_connect_token( encryptedMessage, encryptedMessageLength, decryptedToken, nonce, key, expireTimestamp );
 
         uint64_t decryptedMessageLength;
         uint8_t decryptedMessage[ConnectTokenBytes];
@@ -125,7 +242,19 @@ namespace yojimbo
 
         assert( decryptedMessageLength == ConnectTokenBytes - MacBytes );
 
-        return ReadConnectTokenFromJSON( (const char*) decryptedMessage, decryptedToken );
+        // IMPORTANT: The decrypted message is ours to modify, so parse it in-situ. Strings are decoded in place instead of being copied into the document.
+
+        decryptedMessage[decryptedMessageLength-1] = '\0';
+
+        char documentBuffer[ConnectTokenDocumentBytes];
+        MemoryPoolAllocator<> documentAllocator( documentBuffer, sizeof( documentBuffer ) );
+        ConnectTokenDocument doc( &documentAllocator, ConnectTokenDocumentStackBytes, &documentAllocator );
+
+        doc.ParseInsitu( (char*) decryptedMessage );
+        if ( doc.HasParseError() )
+            return false;
+
+        return read_connect_token_from_document( doc, decryptedToken );
     }
 
     static void insert_number_as_string( Writer<StringBuffer> & writer, const char * key, uint64_t number )
@@ -193,7 +322,7 @@ namespace yojimbo
         return true;
     }
 
-    static bool read_int_from_string( Document & doc, const char * key, int & value )
+    static bool read_int_from_string( const Value & doc, const char * key, int & value )
     {
         if ( !doc.HasMember( key ) )
             return false;
@@ -206,7 +335,7 @@ namespace yojimbo
         return true;
     }
 
-    static bool read_uint64_from_string( Document & doc, const char * key, uint64_t & value )
+    static bool read_uint64_from_string( const Value & doc, const char * key, uint64_t & value )
     {
         if ( !doc.HasMember( key ) )
             return false;
@@ -219,7 +348,7 @@ namespace yojimbo
         return true;
     }
 
-    static bool read_data_from_base64_string( Document & doc, const char * key, uint8_t * data, int data_bytes )
+    static bool read_data_from_base64_string( const Value & doc, const char * key, uint8_t * data, int data_bytes )
     {
         if ( !doc.HasMember( key ) )
             return false;
@@ -236,13 +365,9 @@ namespace yojimbo
         return read_data_bytes == data_bytes;
     }
 
-    bool ReadConnectTokenFromJSON( const char * json, ConnectToken & connectToken )
+    static bool read_connect_token_from_document( const Value & doc, ConnectToken & connectToken )
     {
-        assert( json );
-
-        Document doc;
-        doc.Parse( json );
-        if ( doc.HasParseError() )
+        if ( !doc.IsObject() )
             return false;
 
         if ( !read_uint64_from_string( doc, "protocolId", connectToken.protocolId ) )
@@ -260,6 +385,9 @@ namespace yojimbo
         if ( connectToken.numServerAddresses < 0 || connectToken.numServerAddresses > MaxServersPerConnect )
             return false;
 
+        if ( !doc.HasMember( "serverAddresses" ) )
+            return false;
+
         const Value & serverAddresses = doc["serverAddresses"];
 
         if ( !serverAddresses.IsArray() )
@@ -301,6 +429,21 @@ namespace yojimbo
         return true;
     }
 
+    bool ReadConnectTokenFromJSON( const char * json, ConnectToken & connectToken )
+    {
+        assert( json );
+
+        char documentBuffer[ConnectTokenDocumentBytes];
+        MemoryPoolAllocator<> documentAllocator( documentBuffer, sizeof( documentBuffer ) );
+        ConnectTokenDocument doc( &documentAllocator, ConnectTokenDocumentStackBytes, &documentAllocator );
+
+        doc.Parse( json );
+        if ( doc.HasParseError() )
+            return false;
+
+        return read_connect_token_from_document( doc, connectToken );
+    }
+
     bool GenerateChallengeToken( const ConnectToken & connectToken, const uint8_t * connectTokenMac, ChallengeToken & challengeToken )
     {
         if ( connectToken.clientId == 0 )
@@ -308,8 +451,14 @@ namespace yojimbo
 
         challengeToken.clientId = connectToken.clientId;
 
+        challengeToken.expireTimestamp = connectToken.expireTimestamp;
+
         memcpy( challengeToken.connectTokenMac, connectTokenMac, MacBytes );
 
+        memcpy( challengeToken.clientToServerKey, connectToken.clientToServerKey, KeyBytes );
+
+        memcpy( challengeToken.serverToClientKey, connectToken.serverToClientKey, KeyBytes );
+
         return true;
     }
 
@@ -351,4 +500,172 @@ namespace yojimbo
 
         return true;
     }
+
+    bool EncryptResumeToken( ResumeToken & token, uint8_t * encryptedMessage, const uint8_t * nonce, const uint8_t * key )
+    {
+        uint8_t message[ResumeTokenBytes - MacBytes];
+        memset( message, 0, ResumeTokenBytes - MacBytes );
+        WriteStream stream( message, ResumeTokenBytes - MacBytes );
+        if ( !token.Serialize( stream ) )
+            return false;
+
+        stream.Flush();
+        
+        uint64_t encryptedLength;
+
+        if ( !Encrypt_AEAD( message, ResumeTokenBytes - MacBytes, encryptedMessage, encryptedLength, NULL, 0, nonce, key ) )
+            return false;
+
+        assert( encryptedLength == ResumeTokenBytes );
+
+        return true;
+    }
+
+    bool DecryptResumeToken( const uint8_t * encryptedMessage, ResumeToken & decryptedToken, const uint8_t * nonce, const uint8_t * key )
+    {
+        const int encryptedMessageLength = ResumeTokenBytes;
+
+        uint64_t decryptedMessageLength;
+        uint8_t decryptedMessage[ResumeTokenBytes];
+
+        if ( !Decrypt_AEAD( encryptedMessage, encryptedMessageLength, decryptedMessage, decryptedMessageLength, NULL, 0, nonce, key ) )
+            return false;
+
+        assert( decryptedMessageLength == ResumeTokenBytes - MacBytes );
+
+        ReadStream stream( decryptedMessage, ResumeTokenBytes - MacBytes );
+        if ( !decryptedToken.Serialize( stream ) )
+            return false;
+
+        return true;
+    }
+
+    struct IssueConnectTokensJob
+    {
+        const uint64_t * clientIds;
+        int numClientIds;
+        const ConnectToken * templateToken;
+        const uint8_t * key;
+        uint64_t firstNonce;
+        IssuedConnectToken * issuedTokens;
+        bool result;
+    };
+
+    static void issue_connect_tokens( IssueConnectTokensJob & job )
+    {
+        job.result = true;
+
+        ConnectToken token = *job.templateToken;
+
+        for ( int i = 0; i < job.numClientIds; ++i )
+        {
+            IssuedConnectToken & issuedToken = job.issuedTokens[i];
+
+            token.clientId = job.clientIds[i];
+            GenerateKey( token.clientToServerKey );
+            GenerateKey( token.serverToClientKey );
+
+            const uint64_t nonceNetworkOrder = host_to_network( job.firstNonce + i );       // network order is little endian
+            memcpy( issuedToken.connectTokenNonce, &nonceNetworkOrder, NonceBytes );
+
+            if ( !EncryptCompactConnectToken( token, issuedToken.connectTokenData, issuedToken.connectTokenNonce, job.key ) )
+            {
+                job.result = false;
+                issuedToken.connectTokenBytes = 0;
+                continue;
+            }
+
+            issuedToken.clientId = token.clientId;
+            issuedToken.connectTokenExpireTimestamp = token.expireTimestamp;
+            issuedToken.connectTokenBytes = GetConnectTokenBytes( issuedToken.connectTokenData );
+            memcpy( issuedToken.clientToServerKey, token.clientToServerKey, KeyBytes );
+            memcpy( issuedToken.serverToClientKey, token.serverToClientKey, KeyBytes );
+        }
+    }
+
+    static void issue_connect_tokens_thread_function( void * data )
+    {
+        issue_connect_tokens( *(IssueConnectTokensJob*) data );
+    }
+
+    bool IssueConnectTokens( const uint64_t * clientIds, 
+                             int numClientIds, 
+                             int numServerAddresses, 
+                             const Address * serverAddresses, 
+                             uint64_t protocolId, 
+                             int expireSeconds, 
+                             const uint8_t * key, 
+                             uint64_t & nonce, 
+                             IssuedConnectToken * issuedTokens, 
+                             int numThreads, 
+                             Allocator & allocator )
+    {
+        assert( clientIds );
+        assert( numClientIds >= 0 );
+        assert( key );
+        assert( issuedTokens );
+
+        if ( numClientIds == 0 )
+            return true;
+
+        // IMPORTANT: Everything except the client id and keys is the same for each token in the batch, so it's set up once here.
+
+        ConnectToken templateToken;
+        GenerateConnectToken( templateToken, 0, numServerAddresses, serverAddresses, protocolId, expireSeconds );
+
+        if ( numThreads < 1 )
+            numThreads = 1;
+        if ( numThreads > MaxConnectTokenIssueThreads )
+            numThreads = MaxConnectTokenIssueThreads;
+        if ( numThreads > numClientIds )
+            numThreads = numClientIds;
+
+        IssueConnectTokensJob jobs[MaxConnectTokenIssueThreads];
+        PlatformThread * threads[MaxConnectTokenIssueThreads];
+
+        int firstClientIndex = 0;
+
+        for ( int i = 0; i < numThreads; ++i )
+        {
+            const int numJobClientIds = numClientIds / numThreads + ( i < numClientIds % numThreads ? 1 : 0 );
+
+            IssueConnectTokensJob & job = jobs[i];
+            job.clientIds = clientIds + firstClientIndex;
+            job.numClientIds = numJobClientIds;
+            job.templateToken = &templateToken;
+            job.key = key;
+            job.firstNonce = nonce + firstClientIndex;
+            job.issuedTokens = issuedTokens + firstClientIndex;
+            job.result = false;
+
+            firstClientIndex += numJobClientIds;
+        }
+
+        assert( firstClientIndex == numClientIds );
+
+        // IMPORTANT: The first job runs on the calling thread while the worker threads run the rest.
+
+        threads[0] = NULL;
+
+        for ( int i = 1; i < numThreads; ++i )
+            threads[i] = platform_thread_create( allocator, issue_connect_tokens_thread_function, &jobs[i] );
+
+        issue_connect_tokens( jobs[0] );
+
+        bool result = jobs[0].result;
+
+        for ( int i = 1; i < numThreads; ++i )
+        {
+            if ( threads[i] )
+                platform_thread_join( allocator, threads[i] );
+            else
+                issue_connect_tokens( jobs[i] );
+
+            result = result && jobs[i].result;
+        }
+
+        nonce += numClientIds;
+
+        return result;
+    }
 }
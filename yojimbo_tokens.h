@@ -51,6 +51,66 @@ namespace yojimbo
         @see ConnectionRequestPacket
      */
 
+    /**
+        Serialize a server address in a connect token as raw binary (read/write/measure).
+
+        Unlike serialize_address, which writes the address as a string, this writes an IPv4 or IPv6 flag followed by the address bytes in network order and the port. This keeps compact connect tokens small.
+
+        @param stream The stream object. May be a read, write or measure stream.
+        @param address The address to serialize. Must be an IPv4 or IPv6 address when writing.
+
+        @returns True if the address serialized successfully, false otherwise.
+
+        @see EncryptCompactConnectToken
+     */
+
+    template <typename Stream> bool serialize_connect_token_address( Stream & stream, Address & address )
+    {
+        bool ipv6 = false;
+        uint32_t port = 0;
+        uint8_t addressBytes[16];
+        memset( addressBytes, 0, sizeof( addressBytes ) );
+
+        if ( Stream::IsWriting )
+        {
+            assert( address.GetType() == ADDRESS_IPV4 || address.GetType() == ADDRESS_IPV6 );
+            ipv6 = address.GetType() == ADDRESS_IPV6;
+            port = address.GetPort();
+            if ( ipv6 )
+            {
+                memcpy( addressBytes, address.GetAddress6(), 16 );
+            }
+            else
+            {
+                const uint32_t ipv4 = address.GetAddress4();
+                memcpy( addressBytes, &ipv4, 4 );
+            }
+        }
+
+        serialize_bool( stream, ipv6 );
+
+        serialize_bytes( stream, addressBytes, ipv6 ? 16 : 4 );
+
+        serialize_bits( stream, port, 16 );
+
+        if ( Stream::IsReading )
+        {
+            if ( ipv6 )
+            {
+                uint16_t fields[8];
+                for ( int i = 0; i < 8; ++i )
+                    fields[i] = ( uint16_t( addressBytes[i*2] ) << 8 ) | addressBytes[i*2+1];
+                address = Address( fields, uint16_t( port ) );
+            }
+            else
+            {
+                address = Address( addressBytes[0], addressBytes[1], addressBytes[2], addressBytes[3], uint16_t( port ) );
+            }
+        }
+
+        return true;
+    }
+
     struct ConnectToken
     {
         uint64_t protocolId;                                                ///< The protocol id the connect token corresponds to. Filters out unrelated protocols from connecting.
@@ -77,6 +137,29 @@ namespace yojimbo
             memset( serverToClientKey, 0, KeyBytes );
         }
 
+        template <typename Stream> bool Serialize( Stream & stream )
+        {
+            serialize_uint64( stream, protocolId );
+
+            serialize_uint64( stream, clientId );
+
+            serialize_uint64( stream, expireTimestamp );
+
+            serialize_int_constant( stream, numServerAddresses, 1, MaxServersPerConnect );
+
+            for ( int i = 0; i < numServerAddresses; ++i )
+            {
+                if ( !serialize_connect_token_address( stream, serverAddresses[i] ) )
+                    return false;
+            }
+
+            serialize_bytes( stream, clientToServerKey, KeyBytes );
+
+            serialize_bytes( stream, serverToClientKey, KeyBytes );
+
+            return true;
+        }
+
         bool operator == ( const ConnectToken & other ) const;
         bool operator != ( const ConnectToken & other ) const;
     };
@@ -90,6 +173,8 @@ namespace yojimbo
 
         This stops clients from connecting with spoofed packet source addresses.
 
+        The challenge token also carries the keys and expire timestamp from the connect token. This lets a server running with ClientServerConfig::enableStatelessChallenge keep no state for a client until it replies with a valid challenge response.
+
         @see ConnectionRequestPacket
         @see ChallengeResponsePacket
      */
@@ -98,20 +183,75 @@ namespace yojimbo
     {
         uint64_t clientId;                                                  ///< The unique client id. Maximum of one connection per-client id, per-server at any time.
 
+        uint64_t expireTimestamp;                                           ///< Timestamp when the connect token this challenge corresponds to expires.
+
         uint8_t connectTokenMac[MacBytes];                                  ///< Mac of the initial connect token this challenge corresponds to. Used to quickly map the challenge response from a client to a pending connection entry on the server.
+
+        uint8_t clientToServerKey[KeyBytes];                                ///< The key for encrypted communication from client -> server. Copied from the connect token.
+
+        uint8_t serverToClientKey[KeyBytes];                                ///< The key for encrypted communication from server -> client. Copied from the connect token.
      
         ChallengeToken()
         {
             clientId = 0;
+            expireTimestamp = 0;
             memset( connectTokenMac, 0, MacBytes );
+            memset( clientToServerKey, 0, KeyBytes );
+            memset( serverToClientKey, 0, KeyBytes );
         }
 
         template <typename Stream> bool Serialize( Stream & stream )
         {
             serialize_uint64( stream, clientId );
 
+            serialize_uint64( stream, expireTimestamp );
+
             serialize_bytes( stream, connectTokenMac, MacBytes );
 
+            serialize_bytes( stream, clientToServerKey, KeyBytes );
+
+            serialize_bytes( stream, serverToClientKey, KeyBytes );
+
+            return true;
+        }
+    };
+
+    /**
+        A resume token is issued by the server to a connected client so it can reconnect later without a connect token.
+
+        The server encrypts it with the same random key as challenge tokens, so it is opaque to the client and only valid until the server restarts. It carries fresh packet encryption keys for the resumed session, which the server sends to the client alongside the token inside an encrypted keep-alive packet.
+
+        @see Client::Resume
+     */
+
+    struct ResumeToken
+    {
+        uint64_t clientId;                                                  ///< The unique client id. The resumed session keeps the client id of the session the resume token was issued for.
+
+        uint64_t expireTimestamp;                                           ///< Timestamp when the resume token expires. See ClientServerConfig::resumeTokenTimeOut.
+
+        uint8_t clientToServerKey[KeyBytes];                                ///< The key for encrypted communication from client -> server in the resumed session.
+
+        uint8_t serverToClientKey[KeyBytes];                                ///< The key for encrypted communication from server -> client in the resumed session.
+
+        ResumeToken()
+        {
+            clientId = 0;
+            expireTimestamp = 0;
+            memset( clientToServerKey, 0, KeyBytes );
+            memset( serverToClientKey, 0, KeyBytes );
+        }
+
+        template <typename Stream> bool Serialize( Stream & stream )
+        {
+            serialize_uint64( stream, clientId );
+
+            serialize_uint64( stream, expireTimestamp );
+
+            serialize_bytes( stream, clientToServerKey, KeyBytes );
+
+            serialize_bytes( stream, serverToClientKey, KeyBytes );
+
             return true;
         }
     };
@@ -156,6 +296,44 @@ namespace yojimbo
 
     bool EncryptConnectToken( const ConnectToken & token, uint8_t * encryptedMessage, const uint8_t * nonce, const uint8_t * key );
 
+    /**
+        Encrypt a connect token in the compact binary format.
+
+        Serializes the connect token with a bitpacked stream instead of JSON, so a token with a few server addresses is yojimbo::MinCompactConnectTokenBytes instead of yojimbo::ConnectTokenBytes. This shrinks every connection request packet the client sends.
+
+        The encrypted token is prefixed with an unencrypted yojimbo::CompactConnectTokenHeaderBytes header carrying the total token size. The header is authenticated along with the expire timestamp as the AEAD additional data.
+
+        Servers accept both formats. DecryptConnectToken looks at the header to tell them apart.
+
+        SUPER FUCKING IMPORTANT: The same nonce rules as EncryptConnectToken apply. Never reuse a nonce!
+
+        @param token The connect token data to encrypt.
+        @param encryptedMessage The buffer to receive the encrypted message. Must be at least yojimbo::ConnectTokenBytes bytes large. Call GetConnectTokenBytes on it afterwards to get the actual size.
+        @param nonce The nonce for the encryption. Treat this as a sequence number and increase it each time you generate a new connect token.
+        @param key The private key used to encrypt the connect token.
+
+        @returns True if the connect token was encrypted successfully, false otherwise.
+
+        @see GetConnectTokenBytes
+        @see DecryptConnectToken
+     */
+
+    bool EncryptCompactConnectToken( const ConnectToken & token, uint8_t * encryptedMessage, const uint8_t * nonce, const uint8_t * key );
+
+    /**
+        Get the size of an encrypted connect token.
+
+        Compact connect tokens start with a header that carries their size. Anything without a valid header is treated as a token in the original JSON format, which is always yojimbo::ConnectTokenBytes.
+
+        This only reads the unencrypted header. The size is not trusted until the token decrypts, because the header is part of the AEAD additional data.
+
+        @param connectTokenData The encrypted connect token. Must point to at least yojimbo::CompactConnectTokenHeaderBytes bytes.
+
+        @returns The size of the encrypted connect token in bytes, in [MinCompactConnectTokenBytes, ConnectTokenBytes].
+     */
+
+    int GetConnectTokenBytes( const uint8_t * connectTokenData );
+
     /**
         Decrypt a connect token.
 
@@ -163,7 +341,7 @@ namespace yojimbo
 
         Uses libsodium's AEAD construction with the token expire timestamp as the additional data for quick rejection of expired tokens.
 
-        @param encryptedMessage The encrypted connect token that should be decrypted. The buffer must be of length yojimbo::ConnectTokenBytes.
+        @param encryptedMessage The encrypted connect token that should be decrypted. Either format is accepted. The buffer must be at least GetConnectTokenBytes bytes long.
         @param decryptedToken The decrypted connect token [out]. Valid only if this function returns true.
         @param nonce The nonce used to encrypt the connect token.
         @param key The private key used to encrypt the connect token.
@@ -238,6 +416,128 @@ namespace yojimbo
      */
 
     bool DecryptChallengeToken( const uint8_t * encryptedMessage, ChallengeToken & decryptedToken, const uint8_t * nonce, const uint8_t * key );
+
+    /**
+        Encrypt a resume token.
+
+        Writes the resume token to a binary format and encrypts that buffer using libsodium's AEAD primitive.
+
+        @param token The resume token to encrypt.
+        @param encryptedMessage The buffer that the encrypted message should be written to. Should be at least yojimbo::ResumeTokenBytes large.
+        @param nonce The nonce to encrypt the resume token with. The server shares one nonce sequence between challenge and resume tokens, since they are encrypted with the same key.
+        @param key The private key used to encrypt the resume token. This key must not be known by clients.
+     */
+
+    bool EncryptResumeToken( ResumeToken & token, uint8_t * encryptedMessage, const uint8_t * nonce, const uint8_t * key );
+
+    /**
+        Decrypt a resume token.
+
+        Used by the server to decrypt the resume token contained in a resume request packet sent from the client.
+
+        @param encryptedMessage The encrypted resume token to decrypt.
+        @param decryptedToken The decrypted resume token data [out]. Only valid if this function returns true.
+        @param nonce The nonce used to encrypt the resume token.
+        @param key The key used to encrypt the resume token.
+
+        @returns True if the resume token was successfully decrypted, false otherwise.
+     */
+
+    bool DecryptResumeToken( const uint8_t * encryptedMessage, ResumeToken & decryptedToken, const uint8_t * nonce, const uint8_t * key );
+
+    /**
+        A connect token issued by IssueConnectTokens, with everything the client needs to connect.
+
+        This is the binary equivalent of the JSON match response from matcher.go. The backend sends it to the client over HTTPS, and the client passes the fields straight to Client::Connect.
+
+        Serialize it with a WriteStream to get a compact binary record. Only the bytes of connect token data actually used are written.
+     */
+
+    struct IssuedConnectToken
+    {
+        uint64_t clientId;                                                  ///< The client id the connect token was issued for.
+
+        uint64_t connectTokenExpireTimestamp;                               ///< Timestamp when the connect token expires. Pass to Client::Connect.
+
+        uint8_t connectTokenNonce[NonceBytes];                              ///< Nonce the connect token was encrypted with. Pass to Client::Connect.
+
+        uint8_t clientToServerKey[KeyBytes];                                ///< The key for encrypted communication from client -> server. Pass to Client::Connect.
+
+        uint8_t serverToClientKey[KeyBytes];                                ///< The key for encrypted communication from server -> client. Pass to Client::Connect.
+
+        int connectTokenBytes;                                              ///< The size of the encrypted connect token (bytes). See GetConnectTokenBytes.
+
+        uint8_t connectTokenData[ConnectTokenBytes];                        ///< The encrypted connect token. Pass to Client::Connect.
+
+        IssuedConnectToken()
+        {
+            clientId = 0;
+            connectTokenExpireTimestamp = 0;
+            connectTokenBytes = 0;
+            memset( connectTokenNonce, 0, NonceBytes );
+            memset( clientToServerKey, 0, KeyBytes );
+            memset( serverToClientKey, 0, KeyBytes );
+            memset( connectTokenData, 0, ConnectTokenBytes );
+        }
+
+        template <typename Stream> bool Serialize( Stream & stream )
+        {
+            serialize_uint64( stream, clientId );
+
+            serialize_uint64( stream, connectTokenExpireTimestamp );
+
+            serialize_bytes( stream, connectTokenNonce, NonceBytes );
+
+            serialize_bytes( stream, clientToServerKey, KeyBytes );
+
+            serialize_bytes( stream, serverToClientKey, KeyBytes );
+
+            serialize_int_constant( stream, connectTokenBytes, MinCompactConnectTokenBytes, ConnectTokenBytes );
+
+            serialize_bytes( stream, connectTokenData, connectTokenBytes );
+
+            if ( Stream::IsReading && GetConnectTokenBytes( connectTokenData ) != connectTokenBytes )
+                return false;
+
+            return true;
+        }
+    };
+
+    /**
+        Issue a batch of connect tokens.
+
+        This is for backends written in C++ that want to hand out connect tokens directly, instead of going through matcher.go. It generates and encrypts one compact connect token per-client id, all for the same list of server addresses.
+
+        The batch is split across threads. Each thread encrypts a contiguous range of client ids with its own contiguous range of nonces, starting from the nonce passed in, so the threads never share any state.
+
+        SUPER FUCKING IMPORTANT: Nonces are sequence numbers, not random values. Random 64 bit nonces collide after a few billion tokens, and a reused nonce breaks the security model. Keep the nonce across calls (persist it if the backend restarts) so each nonce is used only once per-key!
+
+        @param clientIds The client ids to issue connect tokens for. Each must be globally unique.
+        @param numClientIds The number of client ids.
+        @param numServerAddresses The number of server addresses in each connect token.
+        @param serverAddresses The server addresses each connect token is valid for.
+        @param protocolId The protocol id of the connections to be established.
+        @param expireSeconds The number of seconds until the connect tokens expire.
+        @param key The private key used to encrypt the connect tokens. Shared with the dedicated servers.
+        @param nonce The nonce sequence number [in/out]. The first token uses this value, and on return it is advanced past the last nonce used.
+        @param issuedTokens The array of issued connect tokens [out]. Must have room for numClientIds entries. Entry i corresponds to clientIds[i].
+        @param numThreads The number of threads to issue tokens on, including the calling thread. Clamped to [1,MaxConnectTokenIssueThreads]. If worker threads can't be created, their work is done on the calling thread.
+        @param allocator The allocator used for the worker thread handles.
+
+        @returns True if all connect tokens were issued, false otherwise.
+     */
+
+    bool IssueConnectTokens( const uint64_t * clientIds, 
+                             int numClientIds, 
+                             int numServerAddresses, 
+                             const Address * serverAddresses, 
+                             uint64_t protocolId, 
+                             int expireSeconds, 
+                             const uint8_t * key, 
+                             uint64_t & nonce, 
+                             IssuedConnectToken * issuedTokens, 
+                             int numThreads = 1, 
+                             Allocator & allocator = GetDefaultAllocator() );
 }
 
 #endif // #ifndef YOJIMBO_TOKENS_H
@@ -0,0 +1,66 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_config.h"
+#include "yojimbo_trace.h"
+
+namespace yojimbo
+{
+    static PacketTraceFunction s_packetTraceFunction = NULL;
+
+    static void * s_packetTraceContext = NULL;
+
+    void SetPacketTraceFunction( PacketTraceFunction function, void * context )
+    {
+        s_packetTraceFunction = function;
+        s_packetTraceContext = context;
+    }
+
+    void trace_packet( const PacketTraceEvent & event )
+    {
+        if ( s_packetTraceFunction )
+            s_packetTraceFunction( s_packetTraceContext, event );
+    }
+
+    void trace_packet( PacketTraceEventType type, const Transport * transport, const Address & address, int packetType, int packetBytes, bool encrypted, uint64_t sequence, double time, uint64_t startTicks )
+    {
+        if ( !s_packetTraceFunction )
+            return;
+
+        PacketTraceEvent event;
+        event.type = type;
+        event.transport = transport;
+        event.address = address;
+        event.packetType = packetType;
+        event.packetBytes = packetBytes;
+        event.encrypted = encrypted;
+        event.sequence = sequence;
+        event.time = time;
+        event.ticks = profile_ticks();
+        event.durationTicks = event.ticks - startTicks;
+
+        s_packetTraceFunction( s_packetTraceContext, event );
+    }
+}
@@ -0,0 +1,147 @@
+/*
+    Yojimbo Client/Server Network Protocol Library.
+    
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef YOJIMBO_TRACE_H
+#define YOJIMBO_TRACE_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_common.h"
+#include "yojimbo_address.h"
+#include "yojimbo_profile.h"
+
+/** @file */
+
+namespace yojimbo
+{
+    class Transport;
+
+    /**
+        The type of a packet trace event.
+
+        @see PacketTraceEvent
+     */
+
+    enum PacketTraceEventType
+    {
+        PACKET_TRACE_WRITE,                                                 ///< A packet was serialized (and encrypted, if it is an encrypted packet type) by BaseTransport::WritePacket, ready to be sent.
+        PACKET_TRACE_READ                                                   ///< A packet was decrypted (if encrypted) and serialized by BaseTransport::ReadPacket, after it was received.
+    };
+
+    /**
+        Get the name of a packet trace event type.
+
+        @param type The packet trace event type. See yojimbo::PacketTraceEventType.
+
+        @returns The name of the packet trace event type, eg. "write".
+     */
+
+    inline const char * GetPacketTraceEventTypeName( int type )
+    {
+        switch ( type )
+        {
+            case PACKET_TRACE_WRITE:    return "write";
+            case PACKET_TRACE_READ:     return "read";
+            default:
+                assert( false );
+                return "???";
+        }
+    }
+
+    /**
+        Describes a single packet passing through a transport.
+
+        Passed to the packet trace function when YOJIMBO_TRACE is 1. See SetPacketTraceFunction.
+     */
+
+    struct PacketTraceEvent
+    {
+        PacketTraceEventType type;                                          ///< Whether the packet was written or read.
+        const Transport * transport;                                        ///< The transport that wrote or read the packet.
+        Address address;                                                    ///< The address the packet was sent to (write) or received from (read).
+        int packetType;                                                     ///< The packet type. See PacketFactory.
+        int packetBytes;                                                    ///< The size of the packet on the wire, in bytes. For a packet split into fragments, this is the whole packet before fragmentation (write) or after reassembly (read).
+        bool encrypted;                                                     ///< True if the packet was encrypted on the wire.
+        uint64_t sequence;                                                  ///< The packet sequence number. Zero for unencrypted packets.
+        double time;                                                        ///< The transport time when the packet was written or read. See Transport::GetTime.
+        uint64_t ticks;                                                     ///< The profile timer value when the packet was written or read. See profile_ticks.
+        uint64_t durationTicks;                                             ///< How long it took to serialize and encrypt (write) or decrypt and serialize (read) the packet, in profile timer ticks. See profile_ticks_to_seconds.
+    };
+
+    /**
+        The packet trace callback.
+
+        IMPORTANT: This is called from inside the transport, for every packet, on whatever thread is reading or writing packets. Keep it quick and don't call back into the transport.
+
+        @param context The context pointer passed in to SetPacketTraceFunction.
+        @param event The packet trace event.
+     */
+
+    typedef void (*PacketTraceFunction)( void * context, const PacketTraceEvent & event );
+
+    /**
+        Set the function that receives packet trace events.
+
+        This only has an effect when YOJIMBO_TRACE is 1. When YOJIMBO_TRACE is 0 the trace points compile out entirely, so there is no cost per-packet.
+
+        There is one trace function for the whole process. Set it before creating transports, or at least before they start reading and writing packets.
+
+        @param function The trace function. Pass in NULL to stop tracing.
+        @param context Passed back to the trace function with each event.
+     */
+
+    void SetPacketTraceFunction( PacketTraceFunction function, void * context );
+
+    /**
+        Pass a packet trace event to the trace function, if one is set.
+
+        Use YOJIMBO_TRACE_PACKET instead of calling this directly, so it compiles out when YOJIMBO_TRACE is 0.
+
+        @param event The packet trace event.
+     */
+
+    void trace_packet( const PacketTraceEvent & event );
+
+    /**
+        Fill a packet trace event and pass it to the trace function, if one is set.
+
+        Use YOJIMBO_TRACE_PACKET instead of calling this directly, so it compiles out when YOJIMBO_TRACE is 0.
+     */
+
+    void trace_packet( PacketTraceEventType type, const Transport * transport, const Address & address, int packetType, int packetBytes, bool encrypted, uint64_t sequence, double time, uint64_t startTicks );
+}
+
+#if YOJIMBO_TRACE
+
+#define YOJIMBO_TRACE_BEGIN( start ) const uint64_t start = yojimbo::profile_ticks()
+#define YOJIMBO_TRACE_PACKET( type, transport, address, packetType, packetBytes, encrypted, sequence, time, start ) yojimbo::trace_packet( type, transport, address, packetType, packetBytes, encrypted, sequence, time, start )
+
+#else // #if YOJIMBO_TRACE
+
+#define YOJIMBO_TRACE_BEGIN( start ) do {} while (0)
+#define YOJIMBO_TRACE_PACKET( type, transport, address, packetType, packetBytes, encrypted, sequence, time, start ) do {} while (0)
+
+#endif // #if YOJIMBO_TRACE
+
+#endif // #ifndef YOJIMBO_TRACE_H
@@ -24,15 +24,21 @@
 
 #include "yojimbo_config.h"
 #include "yojimbo_transport.h"
+#include "yojimbo_profile.h"
+#include "yojimbo_trace.h"
 #include "yojimbo_network_simulator.h"
+#include "yojimbo_fec.h"
 #include "yojimbo_sockets.h"
 #include "yojimbo_common.h"
+#include "yojimbo_platform.h"
+#include "yojimbo_address_map.h"
+#include "yojimbo_server.h"
 #include <stdint.h>
 #include <inttypes.h>
 
 namespace yojimbo
 {
-    TransportContextManager::TransportContextManager()
+    TransportContextManager::TransportContextManager( Allocator & allocator ) : m_addressMap( allocator, MaxContextMappings )
     {
         ResetContextMappings();
     }
@@ -44,13 +50,14 @@ namespace yojimbo
         assert( context.allocator );
         assert( context.packetFactory );
 
-        for ( int i = 0; i < m_numContextMappings; ++i )
+        const int index = m_addressMap.Find( address );
+
+        if ( index != -1 )
         {
-            if ( m_allocated[i] && m_address[i] == address )
-            {
-                m_context[i] = context;
-                return true;
-            }
+            assert( m_allocated[index] );
+            assert( m_address[index] == address );
+            m_context[index] = context;
+            return true;
         }
 
         for ( int i = 0; i < MaxContextMappings; ++i )
@@ -60,6 +67,7 @@ namespace yojimbo
                 m_allocated[i] = true;
                 m_context[i] = context;
                 m_address[i] = address;
+                m_addressMap.Insert( address, i );
                 if ( i + 1 > m_numContextMappings )
                     m_numContextMappings = i + 1;
                 return true;
@@ -77,37 +85,41 @@ namespace yojimbo
 
     bool TransportContextManager::RemoveContextMapping( const Address & address )
     {
-        for ( int i = 0; i < m_numContextMappings; ++i )
+        const int i = m_addressMap.Find( address );
+
+        if ( i == -1 )
         {
-            if ( m_allocated[i] && m_address[i] == address )
-            {
-                m_allocated[i] = false;
-                m_address[i] = Address();
-                m_context[i] = TransportContext();
+#if YOJIMBO_DEBUG_SPAM
+            char addressString[MaxAddressLength];
+            address.ToString( addressString, MaxAddressLength );
+            debug_printf( "failed to remove context mapping for %s\n", addressString );
+#endif // #if YOJIMBO_DEBUG_SPAM
 
-                if ( i + 1 == m_numContextMappings )
-                {
-                    int index = i - 1;
-                    while ( index >= 0 )
-                    {
-                        if ( m_allocated[index] )
-                            break;
-                        index--;
-                    }
-                    m_numContextMappings = index + 1;
-                }
+            return false;
+        }
 
-                return true;
+        assert( m_allocated[i] );
+        assert( m_address[i] == address );
+
+        m_addressMap.Remove( address );
+
+        m_allocated[i] = false;
+        m_address[i] = Address();
+        m_context[i] = TransportContext();
+
+        if ( i + 1 == m_numContextMappings )
+        {
+            int index = i - 1;
+            while ( index >= 0 )
+            {
+                if ( m_allocated[index] )
+                    break;
+                index--;
             }
+            m_numContextMappings = index + 1;
         }
 
-#if YOJIMBO_DEBUG_SPAM
-        char addressString[MaxAddressLength];
-        address.ToString( addressString, MaxAddressLength );
-        debug_printf( "failed to remove context mapping for %s\n", addressString );
-#endif // #if YOJIMBO_DEBUG_SPAM
-
-        return false;
+        return true;
     }
 
     void TransportContextManager::ResetContextMappings()
@@ -122,16 +134,57 @@ namespace yojimbo
         memset( m_context, 0, sizeof( m_context ) );        
 
         memset( m_allocated, 0, sizeof( m_allocated ) );
+
+        m_addressMap.Clear();
     }
 
     const TransportContext * TransportContextManager::GetContext( const Address & address ) const
     {
-        for ( int i = 0; i < m_numContextMappings; ++i )
-        {
-            if ( m_allocated[i] && m_address[i] == address )
-                return &m_context[i];
-        }
-        return NULL;
+        if ( m_numContextMappings == 0 )
+            return NULL;
+
+        const int index = m_addressMap.Find( address );
+
+        if ( index == -1 )
+            return NULL;
+
+        assert( m_allocated[index] );
+
+        return &m_context[index];
+    }
+
+    bool TransportContextManager::MoveContextMapping( const Address & from, const Address & to )
+    {
+        assert( to.IsValid() );
+
+        const int index = m_addressMap.Find( from );
+
+        if ( index == -1 || m_addressMap.Find( to ) != -1 )
+            return false;
+
+        assert( m_allocated[index] );
+        assert( m_address[index] == from );
+
+        m_addressMap.Remove( from );
+
+        m_address[index] = to;
+
+        m_addressMap.Insert( to, index );
+
+        return true;
+    }
+
+    const TransportContext * TransportContextManager::GetContextAtIndex( int index, Address & address ) const
+    {
+        assert( index >= 0 );
+        assert( index < MaxContextMappings );
+
+        if ( !m_allocated[index] )
+            return NULL;
+
+        address = m_address[index];
+
+        return &m_context[index];
     }
 
     // =================================================================
@@ -166,15 +219,56 @@ namespace yojimbo
         
         memset( m_counters, 0, sizeof( m_counters ) );
 
+        m_numAddressMigrationAttempts = 0;
+        m_numAddressMigrations = 0;
+
+        const int packetBufferSize = m_packetProcessor->GetMaxPacketBufferSize();
+
+        m_receiveBatchPacketData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, PacketReceiveBatchSize * packetBufferSize );
+        m_receiveBatchPacketBytes = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * PacketReceiveBatchSize );
+        m_receiveBatchFrom = (Address*) YOJIMBO_ALLOCATE( allocator, sizeof( Address ) * PacketReceiveBatchSize );
+        m_receiveBatchReceiveTimes = (double*) YOJIMBO_ALLOCATE( allocator, sizeof( double ) * PacketReceiveBatchSize );
+
+        m_sendBatchPacketData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, PacketSendBatchSize * packetBufferSize );
+        m_sendBatchPacketBytes = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * PacketSendBatchSize );
+        m_sendBatchTo = (Address*) YOJIMBO_ALLOCATE( allocator, sizeof( Address ) * PacketSendBatchSize );
+
+        m_fragmentSize = DefaultFragmentSize;
+        m_fragmentSequence = 0;
+        m_fragmentPacketBuffer = (uint8_t*) YOJIMBO_ALLOCATE( allocator, packetBufferSize );
+        m_fragmentReassembly = (FragmentReassemblyEntry*) YOJIMBO_ALLOCATE( allocator, sizeof( FragmentReassemblyEntry ) * FragmentReassemblyBufferSize );
+        m_fragmentReassemblyData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, FragmentReassemblyBufferSize * packetBufferSize );
+
+        ResetFragmentReassembly();
+
+        m_fec = NULL;
+        m_fecPacketBuffer = NULL;
+
+        m_numReceiveWorkers = 0;
+        m_receiveWorkers = NULL;
+        m_receiveWorkersQuit = 0;
+        m_receiveWorkState = 0;
+        m_numReceiveGroups = 0;
+        m_numReceiveGroupsDone = 0;
+        m_receiveGroupFirstJob = NULL;
+        m_receivedPacketJobs = NULL;
+        m_receivedPacketJobData = NULL;
+        m_numReceivedPacketJobs = 0;
+        m_numDecodedPacketJobs = 0;
+
 #if !YOJIMBO_SECURE_MODE
         m_allPacketTypes = NULL;
 #endif // #if !YOJIMBO_SECURE_MODE
         m_packetTypeIsEncrypted = NULL;
         m_packetTypeIsUnencrypted = NULL;
+        m_packetTypeIsCompressed = NULL;
+        m_unencryptedPacketMaxBytes = NULL;
 
-        m_contextManager = YOJIMBO_NEW( allocator, TransportContextManager );
+        m_contextManager = YOJIMBO_NEW( allocator, TransportContextManager, allocator );
 
-        m_encryptionManager = YOJIMBO_NEW( allocator, EncryptionManager );
+        m_encryptionManager = YOJIMBO_NEW( allocator, EncryptionManager, allocator );
+
+        m_frameAllocator = YOJIMBO_NEW( allocator, FrameAllocator, allocator, TransportFrameAllocatorSize );
 
         (void) allocateNetworkSimulator;
 
@@ -197,11 +291,29 @@ namespace yojimbo
         assert( m_contextManager );
         assert( m_encryptionManager );
 
+        DisableParallelReceive();
+
         ClearContext();
 
         YOJIMBO_DELETE( *m_allocator, PacketProcessor, m_packetProcessor );
         YOJIMBO_DELETE( *m_allocator, EncryptionManager, m_encryptionManager );
         YOJIMBO_DELETE( *m_allocator, TransportContextManager, m_contextManager );
+        YOJIMBO_DELETE( *m_allocator, FrameAllocator, m_frameAllocator );
+
+        YOJIMBO_FREE( *m_allocator, m_receiveBatchPacketData );
+        YOJIMBO_FREE( *m_allocator, m_receiveBatchPacketBytes );
+        YOJIMBO_FREE( *m_allocator, m_receiveBatchFrom );
+        YOJIMBO_FREE( *m_allocator, m_receiveBatchReceiveTimes );
+
+        YOJIMBO_FREE( *m_allocator, m_sendBatchPacketData );
+        YOJIMBO_FREE( *m_allocator, m_sendBatchPacketBytes );
+        YOJIMBO_FREE( *m_allocator, m_sendBatchTo );
+
+        YOJIMBO_FREE( *m_allocator, m_fragmentPacketBuffer );
+        YOJIMBO_FREE( *m_allocator, m_fragmentReassembly );
+        YOJIMBO_FREE( *m_allocator, m_fragmentReassemblyData );
+
+        DisableForwardErrorCorrection();
 
         if ( m_allocateNetworkSimulator )
         {
@@ -229,12 +341,16 @@ namespace yojimbo
 #endif // #if !YOJIMBO_SECURE_MODE
         m_packetTypeIsEncrypted = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, numPacketTypes );
         m_packetTypeIsUnencrypted = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, numPacketTypes );
+        m_packetTypeIsCompressed = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, numPacketTypes );
+        m_unencryptedPacketMaxBytes = (int*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( int ) * numPacketTypes );
 
 #if !YOJIMBO_SECURE_MODE
         memset( m_allPacketTypes, 1, m_context.packetFactory->GetNumPacketTypes() );
 #endif // #if !YOJIMBO_SECURE_MODE
         memset( m_packetTypeIsEncrypted, 0, m_context.packetFactory->GetNumPacketTypes() );
         memset( m_packetTypeIsUnencrypted, 1, m_context.packetFactory->GetNumPacketTypes() );
+        memset( m_packetTypeIsCompressed, 0, m_context.packetFactory->GetNumPacketTypes() );
+        memset( m_unencryptedPacketMaxBytes, 0, sizeof( int ) * m_context.packetFactory->GetNumPacketTypes() );
     }
 
     void BaseTransport::ClearContext()
@@ -247,6 +363,8 @@ namespace yojimbo
 #endif // #if !YOJIMBO_SECURE_MODE
         YOJIMBO_FREE( *m_allocator, m_packetTypeIsEncrypted );
         YOJIMBO_FREE( *m_allocator, m_packetTypeIsUnencrypted );
+        YOJIMBO_FREE( *m_allocator, m_packetTypeIsCompressed );
+        YOJIMBO_FREE( *m_allocator, m_unencryptedPacketMaxBytes );
 
         m_context = TransportContext();
     }
@@ -257,6 +375,10 @@ namespace yojimbo
         ClearReceiveQueue();
         ResetContextMappings();
         ResetEncryptionMappings();
+        ResetFragmentReassembly();
+
+        if ( m_fec )
+            m_fec->Reset();
 
         if ( m_networkSimulator )
         {
@@ -276,12 +398,16 @@ namespace yojimbo
         for ( int i = 0; i < m_sendQueue.GetNumEntries(); ++i )
         {
             PacketEntry & entry = m_sendQueue[i];
-            assert( entry.packet );
-            assert( entry.packet->IsValid() );
+            assert( entry.packet || entry.serializedData );
             assert( entry.address.IsValid() );
-            entry.packet->Destroy();
+            if ( entry.packet )
+            {
+                assert( entry.packet->IsValid() );
+                entry.packet->Destroy();
+            }
             entry.address = Address();
             entry.packet = NULL;
+            entry.serializedData = NULL;
         }
 
         m_sendQueue.Clear();
@@ -341,7 +467,77 @@ namespace yojimbo
         m_counters[TRANSPORT_COUNTER_PACKETS_SENT]++;
     }
 
-    Packet * BaseTransport::ReceivePacket( Address & from, uint64_t * sequence )
+    int BaseTransport::SerializePacket( Packet * packet, uint8_t * buffer, int bufferSize )
+    {
+        assert( m_packetProcessor );
+        assert( m_context.allocator );
+        assert( m_context.packetFactory );
+
+        assert( packet );
+        assert( packet->IsValid() );
+
+        m_packetProcessor->SetContext( m_context.connectionContext );
+
+        m_packetProcessor->SetUserContext( m_context.userContext );
+
+        return m_packetProcessor->SerializePacket( packet, buffer, bufferSize, *m_context.allocator, *m_context.packetFactory );
+    }
+
+    bool BaseTransport::SendSerializedPacket( const Address & address, int type, const uint8_t * packetData, int packetBytes, uint64_t sequence, bool immediate )
+    {
+        assert( m_context.packetFactory );
+        assert( type >= 0 );
+        assert( type < m_context.packetFactory->GetNumPacketTypes() );
+        assert( packetData );
+        assert( packetBytes > 0 );
+        assert( address.IsValid() );
+
+        // IMPORTANT: Serialized packets are only ever written encrypted, in one piece. Anything else goes through the regular write path, which knows how to compress, fragment and send unencrypted packets.
+
+        if ( !IsEncryptedPacketType( type ) || IsCompressedPacketType( type ) )
+            return false;
+
+        if ( 1 + 8 + MacBytes + packetBytes > m_fragmentSize )
+            return false;
+
+        const TransportContext * context = m_contextManager->GetContext( address );
+
+        if ( ( !context || context->encryptionIndex == -1 ) && m_encryptionManager->FindEncryptionMapping( address, GetTime() ) == -1 )
+            return false;
+
+        if ( immediate )
+        {
+            int wireBytes = 0;
+
+            const uint8_t * wireData = WriteSerializedPacket( address, type, packetData, packetBytes, sequence, wireBytes );
+
+            if ( wireData )
+                SendPacketData( address, wireData, wireBytes );
+        }
+        else
+        {
+            if ( m_sendQueue.IsFull() )
+            {
+                m_counters[TRANSPORT_COUNTER_SEND_QUEUE_OVERFLOW]++;
+                return true;
+            }
+
+            PacketEntry entry;
+            entry.sequence = sequence;
+            entry.address = address;
+            entry.serializedData = packetData;
+            entry.serializedBytes = packetBytes;
+            entry.serializedType = type;
+
+            m_sendQueue.Push( entry );
+        }
+
+        m_counters[TRANSPORT_COUNTER_PACKETS_SENT]++;
+
+        return true;
+    }
+
+    Packet * BaseTransport::ReceivePacket( Address & from, uint64_t * sequence, double * receiveTime )
     {
         if ( !m_context.packetFactory )
             return NULL;
@@ -364,13 +560,28 @@ namespace yojimbo
         if ( sequence )
             *sequence = entry.sequence;
 
+        if ( receiveTime )
+            *receiveTime = entry.receiveTime;
+
         m_counters[TRANSPORT_COUNTER_PACKETS_RECEIVED]++;
 
         return entry.packet;
     }
 
+    static int SumPacketBytes( const int * packetBytes, int numPackets )
+    {
+        int totalBytes = 0;
+        for ( int i = 0; i < numPackets; ++i )
+            totalBytes += packetBytes[i];
+        return totalBytes;
+    }
+
     void BaseTransport::WritePackets()
     {
+        YOJIMBO_PROFILE_SCOPE( PROFILE_STAGE_TRANSPORT_WRITE_PACKETS );
+        YOJIMBO_ZONE( "transport_write_packets" );
+        YOJIMBO_PLOT( "transport_send_queue", m_sendQueue.GetNumEntries() );
+
         if ( !m_context.packetFactory )
             return;
 
@@ -381,217 +592,392 @@ namespace yojimbo
 
         bool useSimulator = ShouldPacketsGoThroughSimulator();
 
-        while ( !m_sendQueue.IsEmpty() )
-        {
-            PacketEntry entry = m_sendQueue.Pop();
+        const bool coalesce = ( GetFlags() & TRANSPORT_FLAG_COALESCE_PACKETS ) != 0;
 
-            assert( entry.packet );
-            assert( entry.packet->IsValid() );
-            assert( entry.address.IsValid() );
+        if ( useSimulator )
+        {
+            PacketEntry * entries;
 
-            if ( useSimulator )
-            {
-                WritePacketToSimulator( entry.address, entry.packet, entry.sequence );
-            }
-            else
+            while ( true )
             {
-                WriteAndFlushPacket( entry.address, entry.packet, entry.sequence );
-            }
+                const int numEntries = m_sendQueue.PopN( entries, m_sendQueue.GetNumEntries() );
+                if ( !numEntries )
+                    break;
 
-            entry.packet->Destroy();
-        }
-    }
+                for ( int i = 0; i < numEntries; ++i )
+                {
+                    PacketEntry & entry = entries[i];
 
-    const uint8_t * BaseTransport::WritePacket( const Address & address, Packet * packet, uint64_t sequence, int & packetBytes )
-    {
-        assert( m_context.allocator );
-        assert( m_context.packetFactory );
+                    // IMPORTANT: Entries for packets that were already sent inside a coalesced packet are cleared to NULL.
 
-        assert( packet );
-        assert( packet->IsValid() );
-        assert( address.IsValid() );
+                    if ( !entry.packet )
+                    {
+                        if ( entry.serializedData )
+                        {
+                            int packetBytes = 0;
 
-        const int packetType = packet->GetType();
+                            const uint8_t * packetData = WriteSerializedPacket( entry.address, entry.serializedType, entry.serializedData, entry.serializedBytes, entry.sequence, packetBytes );
 
-        assert( packetType >= 0 );
-        assert( packetType < m_context.packetFactory->GetNumPacketTypes() );
+                            if ( packetData )
+                                SendPacketDataToSimulator( entry.address, packetData, packetBytes );
+                        }
 
-        const TransportContext * context = m_contextManager->GetContext( address );
+                        continue;
+                    }
 
-        if ( !context )
-            context = &m_context;
+                    assert( entry.packet->IsValid() );
+                    assert( entry.address.IsValid() );
 
-        const int encryptionIndex = ( context->encryptionIndex != -1 ) ? context->encryptionIndex : m_encryptionManager->FindEncryptionMapping( address, GetTime() );
+                    if ( coalesce )
+                    {
+                        int packetBytes = 0;
 
-        const uint8_t * key = m_encryptionManager->GetSendKey( encryptionIndex );
+                        const uint8_t * packetData = WriteCoalescedPacket( entries, numEntries, i, packetBytes );
 
-#if !YOJIMBO_SECURE_MODE
-        const bool encrypt = ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE ) ? IsEncryptedPacketType( packetType ) && key : IsEncryptedPacketType( packetType );
-#else // #if !YOJIMBO_SECURE_MODE
-        const bool encrypt = IsEncryptedPacketType( packetType );
-#endif // #if !YOJIMBO_SECURE_MODE
+                        if ( packetData )
+                        {
+                            SendPacketDataToSimulator( entry.address, packetData, packetBytes );
+                            continue;
+                        }
+                    }
 
-        assert( context->allocator );
-        assert( context->packetFactory );
+                    WritePacketToSimulator( entry.address, entry.packet, entry.sequence );
 
-        Allocator & allocator = *context->allocator;
+                    entry.packet->Destroy();
+                }
+            }
 
-        PacketFactory & packetFactory = *(context->packetFactory);
+            return;
+        }
 
-        m_packetProcessor->SetContext( context->connectionContext );
+        // IMPORTANT: Packets are written and encrypted directly into the send batch buffer. Each packet buffer in the batch is the maximum packet buffer size, which keeps them all aligned.
+        // Encryption is deferred until the send batch is flushed, so all packets in the batch are encrypted together. See PacketProcessor::BeginEncryptBatch.
 
-        m_packetProcessor->SetUserContext( context->userContext );
+        const int packetBufferSize = m_packetProcessor->GetMaxPacketBufferSize();
 
-        const uint8_t * packetData = m_packetProcessor->WritePacket( packet, sequence, packetBytes, encrypt, key, allocator, packetFactory );
+        m_packetProcessor->BeginEncryptBatch();
 
-        if ( !packetData )
+        int numPackets = 0;
+
+        int bytesWritten = 0;
+
+        PacketEntry * entries;
+
+        while ( true )
         {
-            switch ( m_packetProcessor->GetError() )
+            const int numEntries = m_sendQueue.PopN( entries, m_sendQueue.GetNumEntries() );
+            if ( !numEntries )
+                break;
+
+            for ( int j = 0; j < numEntries; ++j )
             {
-                case PACKET_PROCESSOR_ERROR_KEY_IS_NULL:                
+                PacketEntry & entry = entries[j];
+
+                if ( !entry.packet && !entry.serializedData )
+                    continue;
+
+                assert( !entry.packet || entry.packet->IsValid() );
+                assert( entry.address.IsValid() );
+
+                int packetBytes = 0;
+
+                if ( coalesce && entry.packet )
                 {
-                    debug_printf( "base transport packet processor key is null (write packet)\n" );
-                    m_counters[TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES]++;         
+                    const uint8_t * packetData = WriteCoalescedPacket( entries, numEntries, j, packetBytes, m_sendBatchPacketData + numPackets * packetBufferSize );
+
+                    if ( packetData )
+                    {
+                        m_sendBatchPacketBytes[numPackets] = packetBytes;
+                        m_sendBatchTo[numPackets] = entry.address;
+                        numPackets++;
+
+                        if ( numPackets == PacketSendBatchSize )
+                        {
+                            bytesWritten += FlushSendBatch( numPackets );
+                            numPackets = 0;
+                        }
+
+                        continue;
+                    }
                 }
-                break;
 
-                case PACKET_PROCESSOR_ERROR_ENCRYPT_FAILED:
+                const uint8_t * packetData;
+
+                if ( entry.packet )
                 {
-                    debug_printf( "base transport encrypt failed (write packet)\n" );
-                    m_counters[TRANSPORT_COUNTER_ENCRYPT_PACKET_FAILURES]++;
-                }
-                break;
+                    packetData = WritePacket( entry.address, entry.packet, entry.sequence, packetBytes, m_sendBatchPacketData + numPackets * packetBufferSize );
 
-                case PACKET_PROCESSOR_ERROR_WRITE_PACKET_FAILED:
+                    entry.packet->Destroy();
+                }
+                else
                 {
-                    debug_printf( "base transport write packet failed (write packet)\n" );
-                    m_counters[TRANSPORT_COUNTER_WRITE_PACKET_FAILURES]++;               
+                    packetData = WriteSerializedPacket( entry.address, entry.serializedType, entry.serializedData, entry.serializedBytes, entry.sequence, packetBytes, m_sendBatchPacketData + numPackets * packetBufferSize );
                 }
-                break;
 
-                default:
-                    break;
-            }
+                if ( !packetData )
+                    continue;
 
-            return NULL;
-        }
+                assert( packetBytes > 0 );
+                assert( packetBytes <= packetBufferSize );
 
-        m_counters[TRANSPORT_COUNTER_PACKETS_WRITTEN]++;
+                if ( ShouldFragmentPacket( packetData, packetBytes ) )
+                {
+                    // IMPORTANT: Fragments are copied out of the packet, so it must be encrypted first. This encrypts the packets already in the send batch along with it.
 
-        if ( encrypt )
-            m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_WRITTEN]++;
-        else
-            m_counters[TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_WRITTEN]++;
+                    if ( !m_packetProcessor->FlushEncryptBatch() )
+                    {
+                        debug_printf( "base transport encrypt batch failed (write packets)\n" );
+                        m_counters[TRANSPORT_COUNTER_ENCRYPT_PACKET_FAILURES]++;
+                        numPackets = 0;
+                        continue;
+                    }
 
-        return packetData;
-    }
+                    // IMPORTANT: The packet was written into the send batch slot where its first fragment goes, so move it out of the way before writing fragments over it.
 
-    void BaseTransport::WritePacketToSimulator( const Address & address, Packet * packet, uint64_t sequence )
-    {
-        assert( packet );
-        assert( packet->IsValid() );
-        assert( address.IsValid() );
+                    memcpy( m_fragmentPacketBuffer, packetData, packetBytes );
 
-        int packetBytes = 0;
+                    const int numFragments = GetNumFragments( packetBytes );
 
-        const uint8_t * packetData = WritePacket( address, packet, sequence, packetBytes );
+                    for ( int i = 0; i < numFragments; ++i )
+                    {
+                        m_sendBatchPacketBytes[numPackets] = WriteFragment( m_sendBatchPacketData + numPackets * packetBufferSize, m_fragmentPacketBuffer, packetBytes, m_fragmentSequence, i, numFragments );
+                        m_sendBatchTo[numPackets] = entry.address;
+                        numPackets++;
+
+                        if ( numPackets == PacketSendBatchSize )
+                        {
+                            bytesWritten += FlushSendBatch( numPackets );
+                            numPackets = 0;
+                        }
+                    }
 
-        if ( !packetData )
-            return;
+                    m_fragmentSequence++;
 
-        assert( m_networkSimulator );
+                    continue;
+                }
 
-        Allocator & allocator = m_networkSimulator->GetAllocator();
+                m_sendBatchPacketBytes[numPackets] = packetBytes;
+                m_sendBatchTo[numPackets] = entry.address;
+                numPackets++;
 
-        uint8_t * packetDataCopy = (uint8_t*) YOJIMBO_ALLOCATE( allocator, packetBytes );
-        if ( !packetDataCopy )
-            return;
+                if ( numPackets == PacketSendBatchSize )
+                {
+                    bytesWritten += FlushSendBatch( numPackets );
+                    numPackets = 0;
+                }
+            }
+        }
 
-        memcpy( packetDataCopy, packetData, packetBytes );
+        if ( numPackets > 0 )
+        {
+            bytesWritten += FlushSendBatch( numPackets );
+        }
+
+        m_packetProcessor->EndEncryptBatch();
 
-        m_networkSimulator->SendPacket( GetAddress(), address, packetDataCopy, packetBytes );
+        YOJIMBO_PLOT( "transport_bytes_written", bytesWritten );
     }
 
-    void BaseTransport::WriteAndFlushPacket( const Address & address, Packet * packet, uint64_t sequence )
+    int BaseTransport::FlushSendBatch( int numPackets )
     {
-        int packetBytes = 0;
+        assert( numPackets > 0 );
+        assert( numPackets <= PacketSendBatchSize );
 
-        const uint8_t * packetData = WritePacket( address, packet, sequence, packetBytes );
+        const int packetBufferSize = m_packetProcessor->GetMaxPacketBufferSize();
 
-        if ( !packetData )
-            return;
+        // IMPORTANT: If the batch fails to encrypt, some packets in it may still be plaintext, so none of them can be sent.
 
-        InternalSendPacket( address, packetData, packetBytes );
-    }
+        if ( !m_packetProcessor->FlushEncryptBatch() )
+        {
+            debug_printf( "base transport encrypt batch failed (flush send batch)\n" );
+            m_counters[TRANSPORT_COUNTER_ENCRYPT_PACKET_FAILURES]++;
+            return 0;
+        }
 
-    Packet * BaseTransport::ReadPacket( const Address & address, uint8_t * packetBuffer, int packetBytes, uint64_t & sequence )
-    {
-        bool encrypted = false;
+        if ( !m_fec )
+        {
+            InternalSendPackets( numPackets, m_sendBatchTo, m_sendBatchPacketData, packetBufferSize, m_sendBatchPacketBytes );
+            return SumPacketBytes( m_sendBatchPacketBytes, numPackets );
+        }
 
-        const uint8_t * encryptedPacketTypes = m_packetTypeIsEncrypted;
-        const uint8_t * unencryptedPacketTypes = m_packetTypeIsUnencrypted;
+        int parityBytesWritten = 0;
 
-#if !YOJIMBO_SECURE_MODE
-        if ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE )
+        // IMPORTANT: When a group completes, the batch is sent up to the packet that completed it before its parity packet is sent. Otherwise the parity packet would get ahead of packets in its own group, and the receiver would recover packets that aren't lost.
+
+        int firstPacket = 0;
+
+        for ( int i = 0; i < numPackets; ++i )
         {
-            encryptedPacketTypes = m_allPacketTypes;
-            unencryptedPacketTypes = m_allPacketTypes;
+            uint8_t * packetData = m_sendBatchPacketData + i * packetBufferSize;
+
+            const int protectedBytes = m_fec->EncodePacket( m_sendBatchTo[i], packetData, m_sendBatchPacketBytes[i], packetData );
+            if ( !protectedBytes )
+                continue;
+
+            m_sendBatchPacketBytes[i] = protectedBytes;
+
+            int parityBytes = 0;
+            const uint8_t * parityData = m_fec->GetParityPacket( parityBytes );
+            if ( !parityData )
+                continue;
+
+            InternalSendPackets( i + 1 - firstPacket, m_sendBatchTo + firstPacket, m_sendBatchPacketData + firstPacket * packetBufferSize, packetBufferSize, m_sendBatchPacketBytes + firstPacket );
+
+            firstPacket = i + 1;
+
+            InternalSendPacket( m_sendBatchTo[i], parityData, parityBytes );
+
+            parityBytesWritten += parityBytes;
+
+            m_counters[TRANSPORT_COUNTER_FEC_PARITY_PACKETS_WRITTEN]++;
         }
-#endif // #if !YOJIMBO_SECURE_MODE
+
+        if ( firstPacket < numPackets )
+        {
+            InternalSendPackets( numPackets - firstPacket, m_sendBatchTo + firstPacket, m_sendBatchPacketData + firstPacket * packetBufferSize, packetBufferSize, m_sendBatchPacketBytes + firstPacket );
+        }
+
+        return SumPacketBytes( m_sendBatchPacketBytes, numPackets ) + parityBytesWritten;
+    }
+
+    void BaseTransport::SendPacketData( const Address & address, const uint8_t * packetData, int packetBytes )
+    {
+        if ( !m_fec )
+        {
+            InternalSendPacket( address, packetData, packetBytes );
+            return;
+        }
+
+        const int protectedBytes = m_fec->EncodePacket( address, packetData, packetBytes, m_fecPacketBuffer );
+        if ( !protectedBytes )
+        {
+            InternalSendPacket( address, packetData, packetBytes );
+            return;
+        }
+
+        InternalSendPacket( address, m_fecPacketBuffer, protectedBytes );
+
+        int parityBytes = 0;
+        const uint8_t * parityData = m_fec->GetParityPacket( parityBytes );
+        if ( parityData )
+        {
+            InternalSendPacket( address, parityData, parityBytes );
+            m_counters[TRANSPORT_COUNTER_FEC_PARITY_PACKETS_WRITTEN]++;
+        }
+    }
+
+    void BaseTransport::SendPacketDataToSimulator( const Address & address, const uint8_t * packetData, int packetBytes )
+    {
+        assert( m_networkSimulator );
+
+        uint8_t * packetDataCopy = m_networkSimulator->CreatePacket( packetBytes + ( m_fec ? FecPacketHeaderBytes : 0 ) );
+        if ( !packetDataCopy )
+            return;
+
+        const int protectedBytes = m_fec ? m_fec->EncodePacket( address, packetData, packetBytes, packetDataCopy ) : 0;
+
+        if ( !protectedBytes )
+        {
+            memcpy( packetDataCopy, packetData, packetBytes );
+            m_networkSimulator->SendCreatedPacket( GetAddress(), address, packetDataCopy, packetBytes );
+            return;
+        }
+
+        m_networkSimulator->SendCreatedPacket( GetAddress(), address, packetDataCopy, protectedBytes );
+
+        int parityBytes = 0;
+        const uint8_t * parityData = m_fec->GetParityPacket( parityBytes );
+        if ( !parityData )
+            return;
+
+        m_networkSimulator->SendPacket( GetAddress(), address, parityData, parityBytes );
+
+        m_counters[TRANSPORT_COUNTER_FEC_PARITY_PACKETS_WRITTEN]++;
+    }
+
+    void BaseTransport::InternalSendPackets( int numPackets, const Address * to, const uint8_t * packetData, int maxPacketSize, const int * packetBytes )
+    {
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            InternalSendPacket( to[i], packetData + i * maxPacketSize, packetBytes[i] );
+        }
+    }
+
+    const uint8_t * BaseTransport::WritePacket( const Address & address, Packet * packet, uint64_t sequence, int & packetBytes, uint8_t * packetBuffer )
+    {
+        assert( m_context.allocator );
+        assert( m_context.packetFactory );
+
+        assert( packet );
+        assert( packet->IsValid() );
+        assert( address.IsValid() );
+
+        const int packetType = packet->GetType();
+
+        assert( packetType >= 0 );
+        assert( packetType < m_context.packetFactory->GetNumPacketTypes() );
 
         const TransportContext * context = m_contextManager->GetContext( address );
 
         if ( !context )
             context = &m_context;
 
-        const int encryptionIndex = ( context->encryptionIndex != -1 ) ? context->encryptionIndex : m_encryptionManager->FindEncryptionMapping( address, GetTime() );
+        int encryptionIndex = context->encryptionIndex;
+
+        if ( encryptionIndex != -1 )
+            m_encryptionManager->TouchEncryptionMapping( encryptionIndex, GetTime() );
+        else
+            encryptionIndex = m_encryptionManager->FindEncryptionMapping( address, GetTime() );
+
+        const uint8_t * key = m_encryptionManager->GetSendKey( encryptionIndex );
+
+        const PacketCipherState * keyState = m_encryptionManager->GetSendKeyState( encryptionIndex );
+
+#if !YOJIMBO_SECURE_MODE
+        const bool encrypt = ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE ) ? IsEncryptedPacketType( packetType ) && key : IsEncryptedPacketType( packetType );
+#else // #if !YOJIMBO_SECURE_MODE
+        const bool encrypt = IsEncryptedPacketType( packetType );
+#endif // #if !YOJIMBO_SECURE_MODE
 
-        const uint8_t * key = m_encryptionManager->GetReceiveKey( encryptionIndex );
-       
         assert( context->allocator );
         assert( context->packetFactory );
 
-        Allocator & allocator = *(context->allocator);
-        
-        PacketFactory & packetFactory = *(context->packetFactory);
+        Allocator & allocator = *context->allocator;
 
-        ReplayProtection * replayProtection = context->replayProtection;
+        PacketFactory & packetFactory = *(context->packetFactory);
 
         m_packetProcessor->SetContext( context->connectionContext );
 
         m_packetProcessor->SetUserContext( context->userContext );
 
-        Packet * packet = m_packetProcessor->ReadPacket( packetBuffer, sequence, packetBytes, encrypted, key, encryptedPacketTypes, unencryptedPacketTypes, allocator, packetFactory, replayProtection );
+        YOJIMBO_TRACE_BEGIN( traceStart );
 
-        if ( !packet )
+        const bool compress = IsCompressedPacketType( packetType );
+
+        const uint8_t * packetData = m_packetProcessor->WritePacket( packet, sequence, packetBytes, encrypt, key, allocator, packetFactory, packetBuffer, keyState, compress );
+
+        if ( !packetData )
         {
             switch ( m_packetProcessor->GetError() )
             {
-                case PACKET_PROCESSOR_ERROR_KEY_IS_NULL:
+                case PACKET_PROCESSOR_ERROR_KEY_IS_NULL:                
                 {
-                    debug_printf( "base transport key is null (read packet)\n" );
-                    m_counters[TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES]++;
+                    debug_printf( "base transport packet processor key is null (write packet)\n" );
+                    m_counters[TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES]++;         
                 }
                 break;
 
-                case PACKET_PROCESSOR_ERROR_DECRYPT_FAILED:
+                case PACKET_PROCESSOR_ERROR_ENCRYPT_FAILED:
                 {
-                    debug_printf( "base transport decrypt failed (read packet)\n" );
+                    debug_printf( "base transport encrypt failed (write packet)\n" );
                     m_counters[TRANSPORT_COUNTER_ENCRYPT_PACKET_FAILURES]++;
                 }
                 break;
 
-                case PACKET_PROCESSOR_ERROR_PACKET_TOO_SMALL:
-                {
-                    debug_printf( "base transport packet too small (read packet)\n" );
-                    m_counters[TRANSPORT_COUNTER_DECRYPT_PACKET_FAILURES]++;
-                }
-                break;
-
-                case PACKET_PROCESSOR_ERROR_READ_PACKET_FAILED:
+                case PACKET_PROCESSOR_ERROR_WRITE_PACKET_FAILED:
                 {
-                    debug_printf( "base transport read packet failed (read packet)\n" );
-                    m_counters[TRANSPORT_COUNTER_READ_PACKET_FAILURES]++;
+                    debug_printf( "base transport write packet failed (write packet)\n" );
+                    m_counters[TRANSPORT_COUNTER_WRITE_PACKET_FAILURES]++;               
                 }
                 break;
 
@@ -602,401 +988,4490 @@ namespace yojimbo
             return NULL;
         }
 
-        m_counters[TRANSPORT_COUNTER_PACKETS_READ]++;
+        m_counters[TRANSPORT_COUNTER_PACKETS_WRITTEN]++;
 
-        if ( encrypted )
-            m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_READ]++;
+        if ( encrypt )
+            m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_WRITTEN]++;
         else
-            m_counters[TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_READ]++;
+            m_counters[TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_WRITTEN]++;
 
-        return packet;
+        if ( packetData[0] == CompressedPacketPrefix )
+            m_counters[TRANSPORT_COUNTER_COMPRESSED_PACKETS_WRITTEN]++;
+
+        YOJIMBO_TRACE_PACKET( PACKET_TRACE_WRITE, this, address, packetType, packetBytes, encrypt, sequence, GetTime(), traceStart );
+
+        return packetData;
     }
 
-    void BaseTransport::ReadPackets()
+    const uint8_t * BaseTransport::WriteSerializedPacket( const Address & address, int type, const uint8_t * serializedData, int serializedBytes, uint64_t sequence, int & packetBytes, uint8_t * packetBuffer )
     {
-        if ( !m_context.packetFactory )
-            return;
-
-        assert( m_allocator );
-        assert( m_packetProcessor );
-        assert( m_context.allocator );
-        assert( m_context.packetFactory );
+        assert( serializedData );
+        assert( address.IsValid() );
 
-        const int maxPacketSize = GetMaxPacketSize();
+        const TransportContext * context = m_contextManager->GetContext( address );
 
-        if ( m_allocateNetworkSimulator )
-        {
-            assert( m_networkSimulator );
+        if ( !context )
+            context = &m_context;
 
-            const int maxPackets = m_receiveQueue.GetSize();
+        int encryptionIndex = context->encryptionIndex;
 
-            uint8_t ** packetData = (uint8_t**) alloca( sizeof( uint8_t*) * maxPackets );
-            int * packetBytes = (int*) alloca( sizeof(int) * maxPackets );
-            Address * from = (Address*) alloca( sizeof(Address) * maxPackets );
-            Address * to = (Address*) alloca( sizeof(Address) * maxPackets );
+        if ( encryptionIndex != -1 )
+            m_encryptionManager->TouchEncryptionMapping( encryptionIndex, GetTime() );
+        else
+            encryptionIndex = m_encryptionManager->FindEncryptionMapping( address, GetTime() );
 
-            int numPackets = m_networkSimulator->ReceivePackets( maxPackets, packetData, packetBytes, from, to );
+        const uint8_t * key = m_encryptionManager->GetSendKey( encryptionIndex );
 
-            Allocator & allocator = m_networkSimulator->GetAllocator();
+        const PacketCipherState * keyState = m_encryptionManager->GetSendKeyState( encryptionIndex );
 
-            for ( int i = 0; i < numPackets; ++i )
-            {
-                assert( packetData[i] );
-                assert( packetBytes[i] > 0 );
-                assert( packetBytes[i] <= maxPacketSize );
+        YOJIMBO_TRACE_BEGIN( traceStart );
 
-                InternalSendPacket( to[i], packetData[i], packetBytes[i] );
+        const uint8_t * packetData = m_packetProcessor->WriteSerializedPacket( serializedData, serializedBytes, sequence, packetBytes, key, packetBuffer, keyState );
 
-                YOJIMBO_FREE( allocator, packetData[i] );
+        if ( !packetData )
+        {
+            if ( m_packetProcessor->GetError() == PACKET_PROCESSOR_ERROR_KEY_IS_NULL )
+            {
+                debug_printf( "base transport packet processor key is null (write serialized packet)\n" );
+                m_counters[TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES]++;
+            }
+            else
+            {
+                debug_printf( "base transport encrypt failed (write serialized packet)\n" );
+                m_counters[TRANSPORT_COUNTER_ENCRYPT_PACKET_FAILURES]++;
             }
+
+            return NULL;
         }
 
-        uint8_t * packetData = (uint8_t*) alloca( maxPacketSize );
+        m_counters[TRANSPORT_COUNTER_PACKETS_WRITTEN]++;
+        m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_WRITTEN]++;
+        m_counters[TRANSPORT_COUNTER_SERIALIZED_PACKETS_WRITTEN]++;
 
-        while ( true )
+        YOJIMBO_TRACE_PACKET( PACKET_TRACE_WRITE, this, address, type, packetBytes, true, sequence, GetTime(), traceStart );
+
+        (void) type;
+
+        return packetData;
+    }
+
+    void BaseTransport::WritePacketToSimulator( const Address & address, Packet * packet, uint64_t sequence )
+    {
+        assert( packet );
+        assert( packet->IsValid() );
+        assert( address.IsValid() );
+
+        int packetBytes = 0;
+
+        const uint8_t * packetData = WritePacket( address, packet, sequence, packetBytes );
+
+        if ( !packetData )
+            return;
+
+        assert( m_networkSimulator );
+
+        if ( ShouldFragmentPacket( packetData, packetBytes ) )
         {
-            Address address;
-            int packetBytes = InternalReceivePacket( address, packetData, maxPacketSize );
-            if ( !packetBytes )
-                break;
+            // IMPORTANT: Each fragment goes through the simulator on its own, so simulated packet loss applies per-fragment, just like it would on a real network.
 
-            assert( packetBytes > 0 );
-            assert( packetBytes <= maxPacketSize );
+            const int numFragments = GetNumFragments( packetBytes );
 
-            if ( m_receiveQueue.IsFull() )
+            for ( int i = 0; i < numFragments; ++i )
             {
-                debug_printf( "base transport receive queue overflow (recv packet)\n" );
-                m_counters[TRANSPORT_COUNTER_RECEIVE_QUEUE_OVERFLOW]++;
-                break;
+                const int fragmentBytes = WriteFragment( m_fragmentPacketBuffer, packetData, packetBytes, m_fragmentSequence, i, numFragments );
+
+                SendPacketDataToSimulator( address, m_fragmentPacketBuffer, fragmentBytes );
             }
 
-            PacketEntry entry;
-            entry.address = address;
-            entry.packet = ReadPacket( address, packetData, packetBytes, entry.sequence );
-            if ( !entry.packet )
-                continue;
+            m_fragmentSequence++;
 
-            m_receiveQueue.Push( entry );
+            return;
         }
-    }
 
-    int BaseTransport::GetMaxPacketSize() const 
-    {
-        return m_packetProcessor->GetMaxPacketSize();
+        SendPacketDataToSimulator( address, packetData, packetBytes );
     }
 
-    void BaseTransport::SetNetworkConditions( float latency, float jitter, float packetLoss, float duplicate )
+    static const int CoalescedPacketLookahead = 2 * MaxCoalescedPackets;
+
+    const uint8_t * BaseTransport::WriteCoalescedPacket( PacketEntry * entries, int numEntries, int index, int & packetBytes, uint8_t * packetBuffer )
     {
-        if ( m_networkSimulator )
+        assert( entries );
+        assert( index >= 0 );
+        assert( index < numEntries );
+        assert( entries[index].packet );
+
+        const Address address = entries[index].address;
+
+        const uint64_t sequence = entries[index].sequence;
+
+        // IMPORTANT: Only look a limited number of entries ahead for packets to the same address, so a send queue full of packets to different addresses doesn't take quadratic time.
+
+        Packet * packets[MaxCoalescedPackets];
+        int packetEntryIndex[MaxCoalescedPackets];
+        int numPackets = 0;
+
+        const int lastEntry = min( numEntries, index + CoalescedPacketLookahead );
+
+        for ( int i = index; i < lastEntry && numPackets < MaxCoalescedPackets; ++i )
         {
-            m_networkSimulator->SetLatency( latency );
-            m_networkSimulator->SetJitter( jitter );
-            m_networkSimulator->SetPacketLoss( packetLoss );
-            m_networkSimulator->SetDuplicate( duplicate );
+            Packet * packet = entries[i].packet;
+
+            if ( !packet || entries[i].address != address )
+                continue;
+
+            const int packetType = packet->GetType();
+
+            if ( !IsEncryptedPacketType( packetType ) || IsCompressedPacketType( packetType ) )
+            {
+                if ( i == index )
+                    return NULL;
+                continue;
+            }
+
+            packets[numPackets] = packet;
+            packetEntryIndex[numPackets] = i;
+            numPackets++;
         }
-    }
 
-    void BaseTransport::ClearNetworkConditions()
-    {
-        if ( m_networkSimulator )
+        if ( numPackets < 2 )
+            return NULL;
+
+        const TransportContext * context = m_contextManager->GetContext( address );
+
+        if ( !context )
+            context = &m_context;
+
+        int encryptionIndex = context->encryptionIndex;
+
+        if ( encryptionIndex != -1 )
+            m_encryptionManager->TouchEncryptionMapping( encryptionIndex, GetTime() );
+        else
+            encryptionIndex = m_encryptionManager->FindEncryptionMapping( address, GetTime() );
+
+        const uint8_t * key = m_encryptionManager->GetSendKey( encryptionIndex );
+
+        // IMPORTANT: Without a key, fall back to writing packets one at a time, which counts the failure or sends them unencrypted in insecure mode.
+
+        if ( !key )
+            return NULL;
+
+        const PacketCipherState * keyState = m_encryptionManager->GetSendKeyState( encryptionIndex );
+
+        assert( context->allocator );
+        assert( context->packetFactory );
+
+        m_packetProcessor->SetContext( context->connectionContext );
+
+        m_packetProcessor->SetUserContext( context->userContext );
+
+        YOJIMBO_TRACE_BEGIN( traceStart );
+
+        int numPacketsWritten = 0;
+
+        const uint8_t * packetData = m_packetProcessor->WriteCoalescedPacket( packets, numPackets, numPacketsWritten, sequence, packetBytes, m_fragmentSize, key, *context->allocator, *context->packetFactory, packetBuffer, keyState );
+
+        if ( !packetData || numPacketsWritten < 2 )
+            return NULL;
+
+        for ( int i = 0; i < numPacketsWritten; ++i )
         {
-            m_networkSimulator->SetLatency( 0.0f );
-            m_networkSimulator->SetJitter( 0.0f );
-            m_networkSimulator->SetPacketLoss( 0.0f );
-            m_networkSimulator->SetDuplicate( 0.0f );
+            m_counters[TRANSPORT_COUNTER_PACKETS_WRITTEN]++;
+            m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_WRITTEN]++;
+            m_counters[TRANSPORT_COUNTER_COALESCED_PACKETS_WRITTEN]++;
+
+            YOJIMBO_TRACE_PACKET( PACKET_TRACE_WRITE, this, address, packets[i]->GetType(), packetBytes, true, sequence, GetTime(), traceStart );
+
+            PacketEntry & entry = entries[packetEntryIndex[i]];
+            entry.packet->Destroy();
+            entry.packet = NULL;
         }
-    }
 
-    bool BaseTransport::ShouldPacketsGoThroughSimulator()
-    {
-        return m_allocateNetworkSimulator && m_networkSimulator->IsActive();
+        return packetData;
     }
 
-    void BaseTransport::EnablePacketEncryption()
+    void BaseTransport::WriteAndFlushPacket( const Address & address, Packet * packet, uint64_t sequence )
     {
-        assert( m_context.packetFactory );
-        memset( m_packetTypeIsEncrypted, 1, m_context.packetFactory->GetNumPacketTypes() );
-        memset( m_packetTypeIsUnencrypted, 0, m_context.packetFactory->GetNumPacketTypes() );
+        int packetBytes = 0;
+
+        const uint8_t * packetData = WritePacket( address, packet, sequence, packetBytes );
+
+        if ( !packetData )
+            return;
+
+        if ( ShouldFragmentPacket( packetData, packetBytes ) )
+        {
+            const int numFragments = GetNumFragments( packetBytes );
+
+            for ( int i = 0; i < numFragments; ++i )
+            {
+                const int fragmentBytes = WriteFragment( m_fragmentPacketBuffer, packetData, packetBytes, m_fragmentSequence, i, numFragments );
+
+                SendPacketData( address, m_fragmentPacketBuffer, fragmentBytes );
+            }
+
+            m_fragmentSequence++;
+
+            return;
+        }
+
+        SendPacketData( address, packetData, packetBytes );
+    }
+
+    static const int MaxReceivedPacketJobs = 2 * PacketReceiveBatchSize;
+
+    static bool is_encrypted_packet_data( const uint8_t * packetData, int packetBytes )
+    {
+        const int prefixIndex = ( packetData[0] == CompressedPacketPrefix || packetData[0] == CoalescedPacketPrefix ) ? 1 : 0;
+
+        return packetBytes > prefixIndex && ( packetData[prefixIndex] & EncryptedPacketFlag ) != 0;
+    }
+
+    const TransportContext * BaseTransport::FindReceiveContext( const Address & address, const uint8_t * packetBuffer, int packetBytes, const uint8_t * & key, const PacketCipherState * & keyState )
+    {
+        const TransportContext * context = m_contextManager->GetContext( address );
+
+        if ( !context && ( GetFlags() & TRANSPORT_FLAG_ADDRESS_MIGRATION ) && is_encrypted_packet_data( packetBuffer, packetBytes ) )
+        {
+            // IMPORTANT: A client only migrates for a packet newer than any received from its old address, so packets waiting to be decoded in parallel must be decoded first. Otherwise their sequence numbers aren't in the replay protection yet.
+
+            DecodeReceivedPackets();
+
+            if ( MigrateAddress( address, packetBuffer, packetBytes ) )
+                context = m_contextManager->GetContext( address );
+        }
+
+        if ( !context )
+            context = &m_context;
+
+        int encryptionIndex = context->encryptionIndex;
+
+        if ( encryptionIndex != -1 )
+            m_encryptionManager->TouchEncryptionMapping( encryptionIndex, GetTime() );
+        else
+            encryptionIndex = m_encryptionManager->FindEncryptionMapping( address, GetTime() );
+
+        key = m_encryptionManager->GetReceiveKey( encryptionIndex );
+
+        keyState = m_encryptionManager->GetReceiveKeyState( encryptionIndex );
+
+        assert( context->allocator );
+        assert( context->packetFactory );
+
+        return context;
+    }
+
+    void BaseTransport::CountReadPacketError( int error )
+    {
+        switch ( error )
+        {
+            case PACKET_PROCESSOR_ERROR_KEY_IS_NULL:
+            {
+                debug_printf( "base transport key is null (read packet)\n" );
+                m_counters[TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES]++;
+            }
+            break;
+
+            case PACKET_PROCESSOR_ERROR_DECRYPT_FAILED:
+            {
+                debug_printf( "base transport decrypt failed (read packet)\n" );
+                m_counters[TRANSPORT_COUNTER_ENCRYPT_PACKET_FAILURES]++;
+            }
+            break;
+
+            case PACKET_PROCESSOR_ERROR_PACKET_TOO_SMALL:
+            {
+                debug_printf( "base transport packet too small (read packet)\n" );
+                m_counters[TRANSPORT_COUNTER_DECRYPT_PACKET_FAILURES]++;
+            }
+            break;
+
+            case PACKET_PROCESSOR_ERROR_READ_PACKET_FAILED:
+            {
+                debug_printf( "base transport read packet failed (read packet)\n" );
+                m_counters[TRANSPORT_COUNTER_READ_PACKET_FAILURES]++;
+            }
+            break;
+
+            case PACKET_PROCESSOR_ERROR_DECOMPRESS_FAILED:
+            {
+                debug_printf( "base transport decompress failed (read packet)\n" );
+                m_counters[TRANSPORT_COUNTER_DECOMPRESS_PACKET_FAILURES]++;
+            }
+            break;
+
+            default:
+                break;
+        }
+    }
+
+    void BaseTransport::CountReadCoalescedPacketError( int error )
+    {
+        switch ( error )
+        {
+            case PACKET_PROCESSOR_ERROR_KEY_IS_NULL:
+            {
+                debug_printf( "base transport key is null (read coalesced packet)\n" );
+                m_counters[TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES]++;
+            }
+            break;
+
+            case PACKET_PROCESSOR_ERROR_DECRYPT_FAILED:
+            case PACKET_PROCESSOR_ERROR_PACKET_TOO_SMALL:
+            {
+                debug_printf( "base transport decrypt failed (read coalesced packet)\n" );
+                m_counters[TRANSPORT_COUNTER_DECRYPT_PACKET_FAILURES]++;
+            }
+            break;
+
+            case PACKET_PROCESSOR_ERROR_READ_PACKET_FAILED:
+            {
+                debug_printf( "base transport read packet failed (read coalesced packet)\n" );
+                m_counters[TRANSPORT_COUNTER_READ_PACKET_FAILURES]++;
+            }
+            break;
+
+            default:
+                break;
+        }
+    }
+
+    Packet * BaseTransport::ReadPacket( const Address & address, uint8_t * packetBuffer, int packetBytes, uint64_t & sequence )
+    {
+        if ( packetBuffer[0] == FragmentPacketPrefix )
+        {
+            int reassembledPacketBytes = 0;
+
+            packetBuffer = ReadFragment( address, packetBuffer, packetBytes, reassembledPacketBytes );
+
+            if ( !packetBuffer )
+                return NULL;
+
+            packetBytes = reassembledPacketBytes;
+
+#if YOJIMBO_SECURE_MODE
+            if ( ( get_packet_prefix_byte( packetBuffer, packetBytes ) & EncryptedPacketFlag ) == 0 )
+            {
+                debug_printf( "base transport reassembled packet is not encrypted (read packet)\n" );
+                m_counters[TRANSPORT_COUNTER_READ_PACKET_FAILURES]++;
+                return NULL;
+            }
+#endif // #if YOJIMBO_SECURE_MODE
+        }
+
+        bool encrypted = false;
+
+        const bool compressed = packetBuffer[0] == CompressedPacketPrefix;
+
+        const uint8_t * encryptedPacketTypes = m_packetTypeIsEncrypted;
+        const uint8_t * unencryptedPacketTypes = m_packetTypeIsUnencrypted;
+
+#if !YOJIMBO_SECURE_MODE
+        if ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE )
+        {
+            encryptedPacketTypes = m_allPacketTypes;
+            unencryptedPacketTypes = m_allPacketTypes;
+        }
+#endif // #if !YOJIMBO_SECURE_MODE
+
+        const uint8_t * key = NULL;
+
+        const PacketCipherState * keyState = NULL;
+
+        const TransportContext * context = FindReceiveContext( address, packetBuffer, packetBytes, key, keyState );
+
+        Allocator & allocator = *(context->allocator);
+        
+        PacketFactory & packetFactory = *(context->packetFactory);
+
+        ReplayProtection * replayProtection = context->replayProtection;
+
+        m_packetProcessor->SetContext( context->connectionContext );
+
+        m_packetProcessor->SetUserContext( context->userContext );
+
+        YOJIMBO_TRACE_BEGIN( traceStart );
+
+        Packet * packet = m_packetProcessor->ReadPacket( packetBuffer, sequence, packetBytes, encrypted, key, encryptedPacketTypes, unencryptedPacketTypes, allocator, packetFactory, replayProtection, keyState );
+
+        if ( !packet )
+        {
+            CountReadPacketError( m_packetProcessor->GetError() );
+            return NULL;
+        }
+
+        m_counters[TRANSPORT_COUNTER_PACKETS_READ]++;
+
+        if ( encrypted )
+            m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_READ]++;
+        else
+            m_counters[TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_READ]++;
+
+        if ( compressed )
+            m_counters[TRANSPORT_COUNTER_COMPRESSED_PACKETS_READ]++;
+
+        YOJIMBO_TRACE_PACKET( PACKET_TRACE_READ, this, address, packet->GetType(), packetBytes, encrypted, sequence, GetTime(), traceStart );
+
+        return packet;
+    }
+
+    int BaseTransport::ReadCoalescedPacket( const Address & address, uint8_t * packetBuffer, int packetBytes, uint64_t & sequence, Packet ** packets )
+    {
+        assert( packetBuffer );
+        assert( packetBuffer[0] == CoalescedPacketPrefix );
+        assert( packets );
+
+        const uint8_t * encryptedPacketTypes = m_packetTypeIsEncrypted;
+
+#if !YOJIMBO_SECURE_MODE
+        if ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE )
+            encryptedPacketTypes = m_allPacketTypes;
+#endif // #if !YOJIMBO_SECURE_MODE
+
+        const uint8_t * key = NULL;
+
+        const PacketCipherState * keyState = NULL;
+
+        const TransportContext * context = FindReceiveContext( address, packetBuffer, packetBytes, key, keyState );
+
+        m_packetProcessor->SetContext( context->connectionContext );
+
+        m_packetProcessor->SetUserContext( context->userContext );
+
+        YOJIMBO_TRACE_BEGIN( traceStart );
+
+        const int numPackets = m_packetProcessor->ReadCoalescedPacket( packetBuffer, packetBytes, sequence, key, encryptedPacketTypes, *context->allocator, *context->packetFactory, context->replayProtection, keyState, packets );
+
+        if ( !numPackets )
+        {
+            CountReadCoalescedPacketError( m_packetProcessor->GetError() );
+            return 0;
+        }
+
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            m_counters[TRANSPORT_COUNTER_PACKETS_READ]++;
+            m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_READ]++;
+            m_counters[TRANSPORT_COUNTER_COALESCED_PACKETS_READ]++;
+
+            YOJIMBO_TRACE_PACKET( PACKET_TRACE_READ, this, address, packets[i]->GetType(), packetBytes, true, sequence, GetTime(), traceStart );
+        }
+
+        return numPackets;
+    }
+
+    void BaseTransport::PushReceivedPackets( PacketEntry * entries, int numEntries )
+    {
+        const int numPushed = m_receiveQueue.PushN( entries, numEntries );
+
+        for ( int i = numPushed; i < numEntries; ++i )
+        {
+            debug_printf( "base transport receive queue overflow (recv packet)\n" );
+            m_counters[TRANSPORT_COUNTER_RECEIVE_QUEUE_OVERFLOW]++;
+            entries[i].packet->Destroy();
+            entries[i].packet = NULL;
+        }
+    }
+
+    bool BaseTransport::MigrateAddress( const Address & address, const uint8_t * packetBuffer, int packetBytes )
+    {
+        assert( packetBuffer );
+
+        // only encrypted packets can migrate. this skips connection requests and other unencrypted packets without spending an attempt on them
+
+        if ( !is_encrypted_packet_data( packetBuffer, packetBytes ) )
+            return false;
+
+        if ( m_numAddressMigrationAttempts >= MaxAddressMigrationAttempts )
+            return false;
+
+        // IMPORTANT: Clients still negotiating a connection have an encryption mapping but no context mapping. Those packets aren't from a new address.
+
+        if ( m_encryptionManager->FindEncryptionMapping( address, GetTime() ) != -1 )
+            return false;
+
+        m_numAddressMigrationAttempts++;
+
+        for ( int i = 0; i < m_contextManager->GetNumContextMappings(); ++i )
+        {
+            Address oldAddress;
+
+            const TransportContext * context = m_contextManager->GetContextAtIndex( i, oldAddress );
+
+            if ( !context || context->encryptionIndex == -1 )
+                continue;
+
+            const uint8_t * key = m_encryptionManager->GetReceiveKey( context->encryptionIndex );
+
+            const PacketCipherState * keyState = m_encryptionManager->GetReceiveKeyState( context->encryptionIndex );
+
+            uint64_t sequence;
+
+            if ( !m_packetProcessor->CanDecryptPacket( packetBuffer, packetBytes, sequence, key, keyState ) )
+                continue;
+
+            // IMPORTANT: Only a packet newer than any received from the old address can move the client. Otherwise anybody could replay a packet they captured from their own address, and take the client's address away from it.
+
+            if ( context->replayProtection && sequence <= context->replayProtection->GetMostRecentSequence() )
+                return false;
+
+            if ( !m_encryptionManager->MoveEncryptionMapping( context->encryptionIndex, address, GetTime() ) )
+                return false;
+
+            const bool moved = m_contextManager->MoveContextMapping( oldAddress, address );
+
+            assert( moved );
+            (void) moved;
+
+            assert( m_numAddressMigrations < MaxAddressMigrationAttempts );
+
+            m_addressMigrationFrom[m_numAddressMigrations] = oldAddress;
+            m_addressMigrationTo[m_numAddressMigrations] = address;
+            m_numAddressMigrations++;
+
+            m_counters[TRANSPORT_COUNTER_ADDRESS_MIGRATIONS]++;
+
+#if YOJIMBO_DEBUG_SPAM
+            char fromString[MaxAddressLength];
+            char toString[MaxAddressLength];
+            oldAddress.ToString( fromString, sizeof( fromString ) );
+            address.ToString( toString, sizeof( toString ) );
+            debug_printf( "base transport migrated %s to %s\n", fromString, toString );
+#endif // #if YOJIMBO_DEBUG_SPAM
+
+            return true;
+        }
+
+        return false;
+    }
+
+    void BaseTransport::ReadPackets()
+    {
+        YOJIMBO_PROFILE_SCOPE( PROFILE_STAGE_TRANSPORT_READ_PACKETS );
+        YOJIMBO_ZONE( "transport_read_packets" );
+
+        if ( !m_context.packetFactory )
+            return;
+
+        assert( m_allocator );
+        assert( m_packetProcessor );
+        assert( m_context.allocator );
+        assert( m_context.packetFactory );
+
+        const int packetBufferSize = m_packetProcessor->GetMaxPacketBufferSize();
+
+        (void) packetBufferSize;
+
+        m_numAddressMigrationAttempts = 0;
+        m_numAddressMigrations = 0;
+
+        if ( m_allocateNetworkSimulator )
+        {
+            assert( m_networkSimulator );
+
+            const int maxPackets = m_receiveQueue.GetSize();
+
+            // IMPORTANT: These arrays are sized by the receive queue, which is too large for the stack. They are released when the frame allocator is reset in AdvanceTime.
+
+            uint8_t ** packetData = (uint8_t**) YOJIMBO_ALLOCATE( *m_frameAllocator, sizeof( uint8_t*) * maxPackets );
+            int * packetBytes = (int*) YOJIMBO_ALLOCATE( *m_frameAllocator, sizeof(int) * maxPackets );
+            Address * from = (Address*) YOJIMBO_ALLOCATE( *m_frameAllocator, sizeof(Address) * maxPackets );
+            Address * to = (Address*) YOJIMBO_ALLOCATE( *m_frameAllocator, sizeof(Address) * maxPackets );
+
+            if ( !packetData || !packetBytes || !from || !to )
+                return;
+
+            int numPackets = m_networkSimulator->ReceivePackets( maxPackets, packetData, packetBytes, from, to );
+
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                assert( packetData[i] );
+                assert( packetBytes[i] > 0 );
+                assert( packetBytes[i] <= packetBufferSize );
+
+                InternalSendPacket( to[i], packetData[i], packetBytes[i] );
+
+                m_networkSimulator->ReleasePacket( packetData[i] );
+            }
+        }
+
+        while ( true )
+        {
+            // IMPORTANT: Only read as many packets as there is room for in the receive queue, so a nearly full queue doesn't pull a whole batch off the socket just to drop it.
+
+            const int numFreeEntries = m_receiveQueue.GetSize() - m_receiveQueue.GetNumEntries();
+
+            const int maxPackets = ( numFreeEntries > 0 ) ? min( PacketReceiveBatchSize, numFreeEntries ) : 1;
+
+            uint8_t * receivePacketData[PacketReceiveBatchSize];
+
+            const int numPackets = InternalReceivePacketsInPlace( maxPackets, m_receiveBatchFrom, receivePacketData, m_receiveBatchPacketBytes, m_receiveBatchReceiveTimes );
+
+            assert( numPackets >= 0 );
+            assert( numPackets <= maxPackets );
+
+            PacketEntry entries[PacketReceiveBatchSize];
+
+            int numEntries = 0;
+
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                const int packetBytes = m_receiveBatchPacketBytes[i];
+
+                assert( packetBytes > 0 );
+                assert( packetBytes <= packetBufferSize );
+
+                if ( numFreeEntries == 0 )
+                {
+                    debug_printf( "base transport receive queue overflow (recv packet)\n" );
+                    m_counters[TRANSPORT_COUNTER_RECEIVE_QUEUE_OVERFLOW]++;
+                    break;
+                }
+
+                uint8_t * packetData = receivePacketData[i];
+
+                if ( packetData[0] == FecPacketPrefix || packetData[0] == FecParityPacketPrefix )
+                {
+                    if ( packetData[0] == FecParityPacketPrefix )
+                        m_counters[TRANSPORT_COUNTER_FEC_PARITY_PACKETS_READ]++;
+
+                    if ( !m_fec )
+                    {
+                        // IMPORTANT: Without forward error correction, protected packets are still read. Parity packets are ignored.
+
+                        if ( packetData[0] == FecPacketPrefix && packetBytes > FecPacketHeaderBytes )
+                            ReadPacketData( m_receiveBatchFrom[i], m_receiveBatchReceiveTimes[i], packetData + FecPacketHeaderBytes, packetBytes - FecPacketHeaderBytes, entries, numEntries );
+
+                        continue;
+                    }
+
+                    int innerBytes = 0;
+
+                    uint8_t * innerData = m_fec->DecodePacket( m_receiveBatchFrom[i], packetData, packetBytes, innerBytes );
+
+                    int recoveredBytes = 0;
+
+                    uint8_t * recoveredData = m_fec->GetRecoveredPacket( recoveredBytes );
+
+                    if ( innerData )
+                        ReadPacketData( m_receiveBatchFrom[i], m_receiveBatchReceiveTimes[i], innerData, innerBytes, entries, numEntries );
+
+                    if ( recoveredData )
+                    {
+                        m_counters[TRANSPORT_COUNTER_FEC_PACKETS_RECOVERED]++;
+
+                        ReadPacketData( m_receiveBatchFrom[i], m_receiveBatchReceiveTimes[i], recoveredData, recoveredBytes, entries, numEntries );
+                    }
+
+                    continue;
+                }
+
+                ReadPacketData( m_receiveBatchFrom[i], m_receiveBatchReceiveTimes[i], packetData, packetBytes, entries, numEntries );
+            }
+
+            if ( m_receiveWorkers )
+                FinishReceivedPackets( entries, numEntries );
+
+            // IMPORTANT: No more than numFreeEntries packets were read, so the batch fits in the receive queue, unless coalesced packets expanded into more packets than that. Any packets that don't fit are dropped.
+
+            PushReceivedPackets( entries, numEntries );
+
+            if ( numFreeEntries == 0 || numPackets < maxPackets )
+                break;
+        }
+
+        YOJIMBO_PLOT( "transport_receive_queue", m_receiveQueue.GetNumEntries() );
+    }
+
+    bool BaseTransport::ShouldRejectPacket( const Address & address, const uint8_t * packetData, int packetBytes )
+    {
+        assert( packetData );
+        assert( packetBytes > 0 );
+
+        uint8_t prefixByte = packetData[0];
+
+        // IMPORTANT: Fragments wrap other packets, so they are checked once they are reassembled. Coalesced packets are always encrypted.
+
+        if ( prefixByte == FragmentPacketPrefix )
+            return false;
+
+        const bool compressed = prefixByte == CompressedPacketPrefix;
+
+        if ( compressed )
+        {
+            if ( packetBytes < 2 )
+            {
+                m_counters[TRANSPORT_COUNTER_REJECTED_PACKET_SIZE]++;
+                return true;
+            }
+
+            prefixByte = packetData[1];
+            packetData++;
+            packetBytes--;
+        }
+
+        const bool encrypted = ( !compressed && prefixByte == CoalescedPacketPrefix ) || ( prefixByte & EncryptedPacketFlag ) != 0;
+
+        if ( !encrypted && prefixByte != 0 )
+        {
+            m_counters[TRANSPORT_COUNTER_REJECTED_PREFIX_BYTE]++;
+            return true;
+        }
+
+        if ( encrypted )
+        {
+            const int prefixBytes = ( prefixByte == CoalescedPacketPrefix ) ? 1 : 1 + get_packet_sequence_bytes( prefixByte );
+
+            if ( packetBytes <= prefixBytes + MacBytes )
+            {
+                m_counters[TRANSPORT_COUNTER_REJECTED_PACKET_SIZE]++;
+                return true;
+            }
+
+            // IMPORTANT: With address migration, packets from an address without an encryption mapping may be from a client whose address just changed.
+
+            if ( GetFlags() & TRANSPORT_FLAG_ADDRESS_MIGRATION )
+                return false;
+
+            const TransportContext * context = m_contextManager->GetContext( address );
+
+            if ( ( !context || context->encryptionIndex == -1 ) && m_encryptionManager->FindEncryptionMapping( address, GetTime() ) == -1 )
+            {
+                debug_printf( "base transport rejected encrypted packet without encryption mapping\n" );
+                m_counters[TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES]++;
+                return true;
+            }
+
+            return false;
+        }
+
+        // unencrypted packets are the prefix byte, the CRC32, then the packet type bits in the low bits of the bytes that follow. compressed packets have to be decompressed to read their packet type
+
+        const int numPacketTypes = m_context.packetFactory->GetNumPacketTypes();
+
+        const int packetTypeBits = ( numPacketTypes > 1 ) ? bits_required( 0, numPacketTypes - 1 ) : 0;
+
+        const int headerBytes = 1 + 4 + ( packetTypeBits + 7 ) / 8;
+
+        if ( packetBytes < headerBytes )
+        {
+            m_counters[TRANSPORT_COUNTER_REJECTED_PACKET_SIZE]++;
+            return true;
+        }
+
+        if ( compressed )
+            return false;
+
+        int packetType = 0;
+
+        if ( packetTypeBits > 0 )
+        {
+            uint32_t bits = 0;
+            for ( int i = 5; i < headerBytes; ++i )
+                bits |= uint32_t( packetData[i] ) << ( ( i - 5 ) * 8 );
+            packetType = int( bits & uint32_t( ( uint64_t(1) << packetTypeBits ) - 1 ) );
+        }
+
+        const uint8_t * unencryptedPacketTypes = m_packetTypeIsUnencrypted;
+
+#if !YOJIMBO_SECURE_MODE
+        if ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE )
+            unencryptedPacketTypes = m_allPacketTypes;
+#endif // #if !YOJIMBO_SECURE_MODE
+
+        if ( packetType >= numPacketTypes || !unencryptedPacketTypes[packetType] )
+        {
+            m_counters[TRANSPORT_COUNTER_REJECTED_PACKET_TYPE]++;
+            return true;
+        }
+
+        if ( m_unencryptedPacketMaxBytes[packetType] > 0 && packetBytes > m_unencryptedPacketMaxBytes[packetType] )
+        {
+            m_counters[TRANSPORT_COUNTER_REJECTED_PACKET_SIZE]++;
+            return true;
+        }
+
+        return false;
+    }
+
+    void BaseTransport::ReadPacketData( const Address & address, double receiveTime, uint8_t * packetData, int packetBytes, PacketEntry * entries, int & numEntries )
+    {
+        assert( packetData );
+        assert( packetBytes > 0 );
+
+        if ( ShouldRejectPacket( address, packetData, packetBytes ) )
+            return;
+
+        if ( m_receiveWorkers )
+        {
+            QueueReceivedPacket( address, receiveTime, packetData, packetBytes, entries, numEntries );
+            return;
+        }
+
+        if ( packetData[0] == CoalescedPacketPrefix )
+        {
+            Packet * packets[MaxCoalescedPackets];
+
+            uint64_t sequence = 0;
+
+            const int numCoalescedPackets = ReadCoalescedPacket( address, packetData, packetBytes, sequence, packets );
+
+            for ( int i = 0; i < numCoalescedPackets; ++i )
+            {
+                if ( numEntries == PacketReceiveBatchSize )
+                {
+                    PushReceivedPackets( entries, numEntries );
+                    numEntries = 0;
+                }
+
+                PacketEntry & entry = entries[numEntries++];
+                entry.address = address;
+                entry.receiveTime = receiveTime;
+                entry.sequence = sequence;
+                entry.packet = packets[i];
+            }
+
+            return;
+        }
+
+        if ( numEntries == PacketReceiveBatchSize )
+        {
+            PushReceivedPackets( entries, numEntries );
+            numEntries = 0;
+        }
+
+        PacketEntry & entry = entries[numEntries];
+        entry.address = address;
+        entry.receiveTime = receiveTime;
+        entry.packet = ReadPacket( entry.address, packetData, packetBytes, entry.sequence );
+        if ( !entry.packet )
+            return;
+
+        numEntries++;
+    }
+
+    static bool receive_contexts_overlap( const TransportContext & a, const TransportContext & b )
+    {
+        return a.allocator == b.allocator ||
+               a.packetFactory == b.packetFactory ||
+               ( a.connectionContext && a.connectionContext == b.connectionContext ) ||
+               ( a.replayProtection && a.replayProtection == b.replayProtection );
+    }
+
+    void BaseTransport::QueueReceivedPacket( const Address & address, double receiveTime, uint8_t * packetData, int packetBytes, PacketEntry * entries, int & numEntries )
+    {
+        assert( m_receiveWorkers );
+
+        if ( m_numReceivedPacketJobs == MaxReceivedPacketJobs )
+            FinishReceivedPackets( entries, numEntries );
+
+        if ( packetData[0] == FragmentPacketPrefix )
+        {
+            int reassembledPacketBytes = 0;
+
+            packetData = ReadFragment( address, packetData, packetBytes, reassembledPacketBytes );
+
+            if ( !packetData )
+                return;
+
+            packetBytes = reassembledPacketBytes;
+
+#if YOJIMBO_SECURE_MODE
+            if ( ( get_packet_prefix_byte( packetData, packetBytes ) & EncryptedPacketFlag ) == 0 )
+            {
+                debug_printf( "base transport reassembled packet is not encrypted (queue received packet)\n" );
+                m_counters[TRANSPORT_COUNTER_READ_PACKET_FAILURES]++;
+                return;
+            }
+#endif // #if YOJIMBO_SECURE_MODE
+        }
+
+        const int packetBufferSize = m_packetProcessor->GetMaxPacketBufferSize();
+
+        assert( packetBytes <= packetBufferSize );
+
+        // IMPORTANT: Packets in the receive batch stay where they are until the receive batch is finished. Reassembled and recovered packets are in buffers that the next packet may reuse, so they are copied.
+
+        if ( packetData < m_receiveBatchPacketData || packetData >= m_receiveBatchPacketData + PacketReceiveBatchSize * packetBufferSize )
+        {
+            uint8_t * jobPacketData = m_receivedPacketJobData + m_numReceivedPacketJobs * packetBufferSize;
+            memcpy( jobPacketData, packetData, packetBytes );
+            packetData = jobPacketData;
+        }
+
+        ReceivedPacketJob & job = m_receivedPacketJobs[m_numReceivedPacketJobs];
+
+        job.address = address;
+        job.receiveTime = receiveTime;
+        job.packetData = packetData;
+        job.packetBytes = packetBytes;
+        job.coalesced = packetData[0] == CoalescedPacketPrefix;
+        job.compressed = packetData[0] == CompressedPacketPrefix;
+        job.encryptedPacketTypes = m_packetTypeIsEncrypted;
+        job.unencryptedPacketTypes = m_packetTypeIsUnencrypted;
+
+#if !YOJIMBO_SECURE_MODE
+        if ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE )
+        {
+            job.encryptedPacketTypes = m_allPacketTypes;
+            job.unencryptedPacketTypes = m_allPacketTypes;
+        }
+#endif // #if !YOJIMBO_SECURE_MODE
+
+        job.context = *FindReceiveContext( address, packetData, packetBytes, job.key, job.keyState );
+
+        job.nextJob = -1;
+        job.traceStart = 0;
+        job.error = PACKET_PROCESSOR_ERROR_NONE;
+        job.encrypted = false;
+        job.sequence = 0;
+        job.numPackets = 0;
+
+        m_numReceivedPacketJobs++;
+    }
+
+    void BaseTransport::DecodeReceivedPackets()
+    {
+        const int firstJob = m_numDecodedPacketJobs;
+        const int numJobs = m_numReceivedPacketJobs - firstJob;
+
+        if ( numJobs <= 0 )
+            return;
+
+        ReceivedPacketJob * jobs = m_receivedPacketJobs + firstJob;
+
+        // Packets whose contexts share an allocator, packet factory, connection context or replay protection go in the same group, and are decoded in order on one thread.
+
+        int root[MaxReceivedPacketJobs];
+
+        for ( int i = 0; i < numJobs; ++i )
+        {
+            root[i] = i;
+
+            for ( int j = 0; j < i; ++j )
+            {
+                if ( !receive_contexts_overlap( jobs[i].context, jobs[j].context ) )
+                    continue;
+
+                int a = i;
+                while ( root[a] != a )
+                    a = root[a];
+
+                int b = j;
+                while ( root[b] != b )
+                    b = root[b];
+
+                if ( a < b )
+                    root[b] = a;
+                else
+                    root[a] = b;
+            }
+        }
+
+        int groupIndex[MaxReceivedPacketJobs];
+        int groupLastJob[MaxReceivedPacketJobs];
+        int numGroups = 0;
+
+        for ( int i = 0; i < numJobs; ++i )
+        {
+            int r = i;
+            while ( root[r] != r )
+                r = root[r];
+
+            if ( r == i )
+            {
+                groupIndex[i] = numGroups;
+                m_receiveGroupFirstJob[numGroups] = firstJob + i;
+                groupLastJob[numGroups] = i;
+                numGroups++;
+                continue;
+            }
+
+            const int group = groupIndex[r];
+            jobs[groupLastJob[group]].nextJob = firstJob + i;
+            groupLastJob[group] = i;
+        }
+
+        if ( numGroups == 1 )
+        {
+            for ( int i = 0; i < numJobs; ++i )
+                DecodeReceivedPacket( *m_packetProcessor, jobs[i] );
+        }
+        else
+        {
+            atomic_store( &m_numReceiveGroupsDone, 0 );
+            atomic_store( &m_numReceiveGroups, numGroups );
+
+            const int pass = ( ( atomic_load( &m_receiveWorkState ) >> 16 ) + 1 ) & 0x7FFF;
+
+            atomic_store( &m_receiveWorkState, pass << 16 );
+
+            platform_wake_address( &m_receiveWorkState );
+
+            DecodeReceivedPacketGroups( pass, *m_packetProcessor );
+
+            while ( true )
+            {
+                const int numGroupsDone = atomic_load( &m_numReceiveGroupsDone );
+                if ( numGroupsDone == numGroups )
+                    break;
+                platform_wait_on_address( &m_numReceiveGroupsDone, numGroupsDone, 0.001 );
+            }
+        }
+
+        m_numDecodedPacketJobs = m_numReceivedPacketJobs;
+    }
+
+    void BaseTransport::DecodeReceivedPacketGroups( int pass, PacketProcessor & packetProcessor )
+    {
+        while ( true )
+        {
+            const int state = atomic_load( &m_receiveWorkState );
+
+            if ( ( state >> 16 ) != pass )
+                return;
+
+            const int group = state & 0xFFFF;
+
+            if ( group >= atomic_load( &m_numReceiveGroups ) )
+                return;
+
+            if ( !atomic_compare_exchange( &m_receiveWorkState, state, state + 1 ) )
+                continue;
+
+            for ( int i = m_receiveGroupFirstJob[group]; i != -1; i = m_receivedPacketJobs[i].nextJob )
+                DecodeReceivedPacket( packetProcessor, m_receivedPacketJobs[i] );
+
+            if ( atomic_increment( &m_numReceiveGroupsDone ) == atomic_load( &m_numReceiveGroups ) )
+                platform_wake_address( &m_numReceiveGroupsDone );
+        }
+    }
+
+    void BaseTransport::DecodeReceivedPacket( PacketProcessor & packetProcessor, ReceivedPacketJob & job )
+    {
+        packetProcessor.SetContext( job.context.connectionContext );
+
+        packetProcessor.SetUserContext( job.context.userContext );
+
+#if YOJIMBO_TRACE
+        job.traceStart = profile_ticks();
+#endif // #if YOJIMBO_TRACE
+
+        if ( job.coalesced )
+        {
+            job.encrypted = true;
+            job.numPackets = packetProcessor.ReadCoalescedPacket( job.packetData, job.packetBytes, job.sequence, job.key, job.encryptedPacketTypes, *job.context.allocator, *job.context.packetFactory, job.context.replayProtection, job.keyState, job.packets );
+        }
+        else
+        {
+            job.packets[0] = packetProcessor.ReadPacket( job.packetData, job.sequence, job.packetBytes, job.encrypted, job.key, job.encryptedPacketTypes, job.unencryptedPacketTypes, *job.context.allocator, *job.context.packetFactory, job.context.replayProtection, job.keyState );
+            job.numPackets = job.packets[0] ? 1 : 0;
+        }
+
+        job.error = packetProcessor.GetError();
+    }
+
+    void BaseTransport::FinishReceivedPackets( PacketEntry * entries, int & numEntries )
+    {
+        DecodeReceivedPackets();
+
+        for ( int i = 0; i < m_numReceivedPacketJobs; ++i )
+        {
+            ReceivedPacketJob & job = m_receivedPacketJobs[i];
+
+            if ( !job.numPackets )
+            {
+                if ( job.coalesced )
+                    CountReadCoalescedPacketError( job.error );
+                else
+                    CountReadPacketError( job.error );
+                continue;
+            }
+
+            for ( int j = 0; j < job.numPackets; ++j )
+            {
+                m_counters[TRANSPORT_COUNTER_PACKETS_READ]++;
+
+                if ( job.encrypted )
+                    m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_READ]++;
+                else
+                    m_counters[TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_READ]++;
+
+                if ( job.coalesced )
+                    m_counters[TRANSPORT_COUNTER_COALESCED_PACKETS_READ]++;
+                else if ( job.compressed )
+                    m_counters[TRANSPORT_COUNTER_COMPRESSED_PACKETS_READ]++;
+
+                // IMPORTANT: The trace duration runs from when the packet started decoding until now, so it includes waiting for other packets in the pass to decode.
+
+                YOJIMBO_TRACE_PACKET( PACKET_TRACE_READ, this, job.address, job.packets[j]->GetType(), job.packetBytes, job.encrypted, job.sequence, GetTime(), job.traceStart );
+
+                if ( numEntries == PacketReceiveBatchSize )
+                {
+                    PushReceivedPackets( entries, numEntries );
+                    numEntries = 0;
+                }
+
+                PacketEntry & entry = entries[numEntries++];
+                entry.address = job.address;
+                entry.receiveTime = job.receiveTime;
+                entry.sequence = job.sequence;
+                entry.packet = job.packets[j];
+            }
+        }
+
+        m_numReceivedPacketJobs = 0;
+        m_numDecodedPacketJobs = 0;
+    }
+
+    void BaseTransport::ReceiveWorkerFunction( void * data )
+    {
+        ReceiveWorker * worker = (ReceiveWorker*) data;
+        worker->transport->ReceiveWorkerThread( *worker );
+    }
+
+    void BaseTransport::ReceiveWorkerThread( ReceiveWorker & worker )
+    {
+        int pass = atomic_load( &m_receiveWorkState ) >> 16;
+
+        while ( !atomic_load( &m_receiveWorkersQuit ) )
+        {
+            const int state = atomic_load( &m_receiveWorkState );
+
+            if ( ( state >> 16 ) == pass )
+            {
+                platform_wait_on_address( &m_receiveWorkState, state, 0.1 );
+                continue;
+            }
+
+            pass = state >> 16;
+
+            DecodeReceivedPacketGroups( pass, *worker.packetProcessor );
+        }
+    }
+
+    int BaseTransport::InternalReceivePackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes )
+    {
+        int numPackets = 0;
+
+        while ( numPackets < maxPackets )
+        {
+            const int bytesRead = InternalReceivePacket( from[numPackets], packetData + numPackets * maxPacketSize, maxPacketSize );
+            if ( !bytesRead )
+                break;
+
+            packetBytes[numPackets] = bytesRead;
+            receiveTimes[numPackets] = platform_time();
+            numPackets++;
+        }
+
+        return numPackets;
+    }
+
+    int BaseTransport::InternalReceivePacketsInPlace( int maxPackets, Address * from, uint8_t ** packetData, int * packetBytes, double * receiveTimes )
+    {
+        assert( maxPackets <= PacketReceiveBatchSize );
+
+        const int packetBufferSize = m_packetProcessor->GetMaxPacketBufferSize();
+
+        const int numPackets = InternalReceivePackets( maxPackets, from, m_receiveBatchPacketData, packetBufferSize, packetBytes, receiveTimes );
+
+        for ( int i = 0; i < numPackets; ++i )
+            packetData[i] = m_receiveBatchPacketData + i * packetBufferSize;
+
+        return numPackets;
+    }
+
+    bool BaseTransport::WaitForPacket( double timeout )
+    {
+        assert( timeout >= 0.0 );
+
+        if ( !m_receiveQueue.IsEmpty() )
+            return true;
+
+        return InternalWaitForPacket( timeout );
+    }
+
+    bool BaseTransport::InternalWaitForPacket( double timeout )
+    {
+        if ( timeout > 0.0 )
+            platform_sleep( timeout );
+
+        return false;
+    }
+
+    static const int FragmentHeaderBytes = 5;
+
+    bool BaseTransport::ShouldFragmentPacket( const uint8_t * packetData, int packetBytes ) const
+    {
+        if ( packetBytes <= m_fragmentSize )
+            return false;
+
+#if YOJIMBO_SECURE_MODE
+        return ( get_packet_prefix_byte( packetData, packetBytes ) & EncryptedPacketFlag ) != 0;
+#else // #if YOJIMBO_SECURE_MODE
+        (void) packetData;
+        return true;
+#endif // #if YOJIMBO_SECURE_MODE
+    }
+
+    int BaseTransport::GetNumFragments( int packetBytes ) const
+    {
+        const int fragmentPayloadBytes = m_fragmentSize - FragmentHeaderBytes;
+
+        const int numFragments = ( packetBytes + fragmentPayloadBytes - 1 ) / fragmentPayloadBytes;
+
+        assert( numFragments >= 2 );
+        assert( numFragments <= MaxFragmentsPerPacket );
+
+        return numFragments;
+    }
+
+    int BaseTransport::WriteFragment( uint8_t * fragmentData, const uint8_t * packetData, int packetBytes, uint16_t fragmentSequence, int fragmentId, int numFragments )
+    {
+        assert( fragmentData );
+        assert( packetData );
+        assert( fragmentId >= 0 );
+        assert( fragmentId < numFragments );
+        assert( numFragments <= MaxFragmentsPerPacket );
+
+        const int fragmentPayloadBytes = m_fragmentSize - FragmentHeaderBytes;
+
+        const int offset = fragmentId * fragmentPayloadBytes;
+
+        const int bytes = ( fragmentId == numFragments - 1 ) ? ( packetBytes - offset ) : fragmentPayloadBytes;
+
+        assert( bytes > 0 );
+        assert( bytes <= fragmentPayloadBytes );
+
+        fragmentData[0] = FragmentPacketPrefix;
+        fragmentData[1] = uint8_t( fragmentSequence >> 8 );
+        fragmentData[2] = uint8_t( fragmentSequence & 0xFF );
+        fragmentData[3] = uint8_t( fragmentId );
+        fragmentData[4] = uint8_t( numFragments - 1 );
+
+        memcpy( fragmentData + FragmentHeaderBytes, packetData + offset, bytes );
+
+        m_counters[TRANSPORT_COUNTER_FRAGMENTS_WRITTEN]++;
+
+        return FragmentHeaderBytes + bytes;
+    }
+
+    uint8_t * BaseTransport::ReadFragment( const Address & address, const uint8_t * fragmentData, int fragmentBytes, int & packetBytes )
+    {
+        assert( fragmentData );
+        assert( fragmentData[0] == FragmentPacketPrefix );
+
+        const int packetBufferSize = m_packetProcessor->GetMaxPacketBufferSize();
+
+        const int fragmentPayloadBytes = m_fragmentSize - FragmentHeaderBytes;
+
+        if ( fragmentBytes <= FragmentHeaderBytes )
+        {
+            debug_printf( "base transport fragment is too small (read fragment)\n" );
+            m_counters[TRANSPORT_COUNTER_FRAGMENTS_DISCARDED]++;
+            return NULL;
+        }
+
+        const uint16_t sequence = uint16_t( ( fragmentData[1] << 8 ) | fragmentData[2] );
+        const int fragmentId = fragmentData[3];
+        const int numFragments = fragmentData[4] + 1;
+        const int bytes = fragmentBytes - FragmentHeaderBytes;
+        const int offset = fragmentId * fragmentPayloadBytes;
+
+        if ( numFragments < 2 || numFragments > MaxFragmentsPerPacket || fragmentId >= numFragments )
+        {
+            debug_printf( "base transport fragment header is invalid (read fragment)\n" );
+            m_counters[TRANSPORT_COUNTER_FRAGMENTS_DISCARDED]++;
+            return NULL;
+        }
+
+        // IMPORTANT: Every fragment except the last must be exactly the fragment payload size. This is how we detect a sender using a different fragment size.
+
+        if ( ( fragmentId < numFragments - 1 && bytes != fragmentPayloadBytes ) || bytes > fragmentPayloadBytes || offset + bytes > packetBufferSize )
+        {
+            debug_printf( "base transport fragment size mismatch (read fragment)\n" );
+            m_counters[TRANSPORT_COUNTER_FRAGMENTS_DISCARDED]++;
+            return NULL;
+        }
+
+        const int index = int( ( uint32_t( address.GetHash() ) + sequence ) % FragmentReassemblyBufferSize );
+
+        FragmentReassemblyEntry & entry = m_fragmentReassembly[index];
+
+        if ( entry.numFragments != numFragments || entry.sequence != sequence || entry.address != address )
+        {
+            entry.address = address;
+            entry.sequence = sequence;
+            entry.numFragments = numFragments;
+            entry.numFragmentsReceived = 0;
+            entry.packetBytes = 0;
+            entry.receivedMask = 0;
+        }
+
+        const uint64_t fragmentBit = uint64_t( 1 ) << fragmentId;
+
+        if ( entry.receivedMask & fragmentBit )
+        {
+            debug_printf( "base transport fragment already received (read fragment)\n" );
+            m_counters[TRANSPORT_COUNTER_FRAGMENTS_DISCARDED]++;
+            return NULL;
+        }
+
+        uint8_t * packetData = m_fragmentReassemblyData + index * packetBufferSize;
+
+        memcpy( packetData + offset, fragmentData + FragmentHeaderBytes, bytes );
+
+        entry.receivedMask |= fragmentBit;
+        entry.numFragmentsReceived++;
+
+        if ( fragmentId == numFragments - 1 )
+            entry.packetBytes = offset + bytes;
+
+        m_counters[TRANSPORT_COUNTER_FRAGMENTS_READ]++;
+
+        if ( entry.numFragmentsReceived < entry.numFragments )
+            return NULL;
+
+        packetBytes = entry.packetBytes;
+
+        entry = FragmentReassemblyEntry();
+
+        return packetData;
+    }
+
+    void BaseTransport::ResetFragmentReassembly()
+    {
+        for ( int i = 0; i < FragmentReassemblyBufferSize; ++i )
+            m_fragmentReassembly[i] = FragmentReassemblyEntry();
+    }
+
+    int BaseTransport::GetMaxPacketSize() const 
+    {
+        return m_packetProcessor->GetMaxPacketSize();
+    }
+
+    void BaseTransport::SetNetworkConditions( float latency, float jitter, float packetLoss, float duplicate )
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetLatency( latency );
+            m_networkSimulator->SetJitter( jitter );
+            m_networkSimulator->SetPacketLoss( packetLoss );
+            m_networkSimulator->SetDuplicate( duplicate );
+        }
+    }
+
+    void BaseTransport::ClearNetworkConditions()
+    {
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->SetLatency( 0.0f );
+            m_networkSimulator->SetJitter( 0.0f );
+            m_networkSimulator->SetPacketLoss( 0.0f );
+            m_networkSimulator->SetDuplicate( 0.0f );
+        }
+    }
+
+    bool BaseTransport::ShouldPacketsGoThroughSimulator()
+    {
+        return m_allocateNetworkSimulator && m_networkSimulator->IsActive();
+    }
+
+    void BaseTransport::EnablePacketEncryption()
+    {
+        assert( m_context.packetFactory );
+        memset( m_packetTypeIsEncrypted, 1, m_context.packetFactory->GetNumPacketTypes() );
+        memset( m_packetTypeIsUnencrypted, 0, m_context.packetFactory->GetNumPacketTypes() );
+    }
+
+    void BaseTransport::DisablePacketEncryption()
+    {
+        assert( m_context.packetFactory );
+        memset( m_packetTypeIsEncrypted, 0, m_context.packetFactory->GetNumPacketTypes() );
+        memset( m_packetTypeIsUnencrypted, 1, m_context.packetFactory->GetNumPacketTypes() );
+    }
+
+    void BaseTransport::DisableEncryptionForPacketType( int type )
+    {
+        assert( m_context.packetFactory );
+        assert( type >= 0 );
+        assert( type < m_context.packetFactory->GetNumPacketTypes() );
+        m_packetTypeIsEncrypted[type] = 0;
+        m_packetTypeIsUnencrypted[type] = 1;
+    }
+
+    bool BaseTransport::IsEncryptedPacketType( int type ) const
+    {
+        assert( m_context.packetFactory );
+        assert( type >= 0 );
+        assert( type < m_context.packetFactory->GetNumPacketTypes() );
+        return m_packetTypeIsEncrypted[type] != 0;
+    }
+
+    void BaseTransport::SetMaxUnencryptedPacketBytes( int type, int bytes )
+    {
+        assert( m_context.packetFactory );
+        assert( type >= 0 );
+        assert( type < m_context.packetFactory->GetNumPacketTypes() );
+        assert( bytes >= 0 );
+        m_unencryptedPacketMaxBytes[type] = bytes;
+    }
+
+    void BaseTransport::EnablePacketCompression()
+    {
+        assert( m_context.packetFactory );
+        memset( m_packetTypeIsCompressed, 1, m_context.packetFactory->GetNumPacketTypes() );
+    }
+
+    void BaseTransport::DisablePacketCompression()
+    {
+        assert( m_context.packetFactory );
+        memset( m_packetTypeIsCompressed, 0, m_context.packetFactory->GetNumPacketTypes() );
+    }
+
+    void BaseTransport::EnableCompressionForPacketType( int type )
+    {
+        assert( m_context.packetFactory );
+        assert( type >= 0 );
+        assert( type < m_context.packetFactory->GetNumPacketTypes() );
+        m_packetTypeIsCompressed[type] = 1;
+    }
+
+    void BaseTransport::DisableCompressionForPacketType( int type )
+    {
+        assert( m_context.packetFactory );
+        assert( type >= 0 );
+        assert( type < m_context.packetFactory->GetNumPacketTypes() );
+        m_packetTypeIsCompressed[type] = 0;
+    }
+
+    bool BaseTransport::IsCompressedPacketType( int type ) const
+    {
+        assert( m_context.packetFactory );
+        assert( type >= 0 );
+        assert( type < m_context.packetFactory->GetNumPacketTypes() );
+        return m_packetTypeIsCompressed[type] != 0;
+    }
+
+    bool BaseTransport::SetCompressionDictionary( const uint8_t * dictionary, int dictionaryBytes )
+    {
+        assert( m_packetProcessor );
+
+        for ( int i = 0; i < m_numReceiveWorkers; ++i )
+            m_receiveWorkers[i].packetProcessor->SetCompressionDictionary( dictionary, dictionaryBytes );
+
+        return m_packetProcessor->SetCompressionDictionary( dictionary, dictionaryBytes );
+    }
+
+    void BaseTransport::SetCompressionThreshold( int bytes )
+    {
+        assert( m_packetProcessor );
+        m_packetProcessor->SetCompressionThreshold( bytes );
+    }
+
+    void BaseTransport::EnableForwardErrorCorrection( int groupSize )
+    {
+        assert( groupSize >= 2 );
+        assert( groupSize <= MaxFecGroupSize );
+
+        DisableForwardErrorCorrection();
+
+        const int packetBufferSize = m_packetProcessor->GetMaxPacketBufferSize();
+
+        m_fec = YOJIMBO_NEW( *m_allocator, ForwardErrorCorrection, *m_allocator, packetBufferSize, groupSize );
+        m_fecPacketBuffer = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, packetBufferSize );
+    }
+
+    void BaseTransport::DisableForwardErrorCorrection()
+    {
+        YOJIMBO_DELETE( *m_allocator, ForwardErrorCorrection, m_fec );
+        YOJIMBO_FREE( *m_allocator, m_fecPacketBuffer );
+    }
+
+    bool BaseTransport::EnableParallelReceive( int numWorkers, const int * workerCpus )
+    {
+        assert( numWorkers >= 1 );
+        assert( numWorkers <= MaxReceiveWorkers );
+
+        DisableParallelReceive();
+
+        const int packetBufferSize = m_packetProcessor->GetMaxPacketBufferSize();
+
+        m_receiveGroupFirstJob = (int*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( int ) * MaxReceivedPacketJobs );
+        m_receivedPacketJobs = (ReceivedPacketJob*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( ReceivedPacketJob ) * MaxReceivedPacketJobs );
+        m_receivedPacketJobData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, MaxReceivedPacketJobs * packetBufferSize );
+        m_receiveWorkers = (ReceiveWorker*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( ReceiveWorker ) * numWorkers );
+
+        for ( int i = 0; i < MaxReceivedPacketJobs; ++i )
+            new ( &m_receivedPacketJobs[i] ) ReceivedPacketJob();
+
+        m_numReceivedPacketJobs = 0;
+        m_numDecodedPacketJobs = 0;
+        m_receiveWorkState = 0;
+        m_numReceiveGroups = 0;
+        m_numReceiveGroupsDone = 0;
+
+        atomic_store( &m_receiveWorkersQuit, 0 );
+
+        for ( int i = 0; i < numWorkers; ++i )
+        {
+            ReceiveWorker & worker = m_receiveWorkers[i];
+
+            worker.transport = this;
+            worker.packetProcessor = YOJIMBO_NEW( *m_allocator, PacketProcessor, *m_allocator, m_protocolId, m_packetProcessor->GetMaxPacketSize() );
+            worker.packetProcessor->SetPacketCipher( m_packetProcessor->GetPacketCipher() );
+            worker.packetProcessor->SetCompressionDictionary( m_packetProcessor->GetCompressionDictionary(), m_packetProcessor->GetCompressionDictionaryBytes() );
+            worker.thread = NULL;
+
+            m_numReceiveWorkers++;
+
+            worker.thread = platform_thread_create( *m_allocator, ReceiveWorkerFunction, &worker );
+
+            if ( !worker.thread )
+            {
+                debug_printf( "base transport failed to create receive worker thread\n" );
+                DisableParallelReceive();
+                return false;
+            }
+
+            if ( workerCpus && workerCpus[i] >= 0 && !platform_thread_set_affinity( worker.thread, workerCpus[i] ) )
+                debug_printf( "base transport failed to pin receive worker thread to cpu %d\n", workerCpus[i] );
+        }
+
+        return true;
+    }
+
+    void BaseTransport::DisableParallelReceive()
+    {
+        if ( !m_receiveWorkers )
+            return;
+
+        assert( m_numReceivedPacketJobs == 0 );
+
+        atomic_store( &m_receiveWorkersQuit, 1 );
+
+        platform_wake_address( &m_receiveWorkState );
+
+        for ( int i = 0; i < m_numReceiveWorkers; ++i )
+        {
+            ReceiveWorker & worker = m_receiveWorkers[i];
+
+            if ( worker.thread )
+                platform_thread_join( *m_allocator, worker.thread );
+
+            YOJIMBO_DELETE( *m_allocator, PacketProcessor, worker.packetProcessor );
+        }
+
+        m_numReceiveWorkers = 0;
+
+        YOJIMBO_FREE( *m_allocator, m_receiveWorkers );
+        YOJIMBO_FREE( *m_allocator, m_receiveGroupFirstJob );
+        YOJIMBO_FREE( *m_allocator, m_receivedPacketJobs );
+        YOJIMBO_FREE( *m_allocator, m_receivedPacketJobData );
+    }
+
+    bool BaseTransport::AddEncryptionMapping( const Address & address, const uint8_t * sendKey, const uint8_t * receiveKey, double timeout )
+    {
+        return m_encryptionManager->AddEncryptionMapping( address, sendKey, receiveKey, GetTime(), timeout );
+    }
+
+    bool BaseTransport::RemoveEncryptionMapping( const Address & address )
+    {
+        return m_encryptionManager->RemoveEncryptionMapping( address, GetTime() );
+    }
+
+    int BaseTransport::FindEncryptionMapping( const Address & address )
+    {
+        return m_encryptionManager->FindEncryptionMapping( address, GetTime() );
+    }
+
+    bool BaseTransport::GetEncryptionMappingKeys( const Address & address, uint8_t * sendKey, uint8_t * receiveKey )
+    {
+        assert( sendKey );
+        assert( receiveKey );
+
+        const int index = m_encryptionManager->FindEncryptionMapping( address, GetTime() );
+        if ( index == -1 )
+            return false;
+
+        memcpy( sendKey, m_encryptionManager->GetSendKey( index ), KeyBytes );
+        memcpy( receiveKey, m_encryptionManager->GetReceiveKey( index ), KeyBytes );
+
+        return true;
+    }
+
+    void BaseTransport::ResetEncryptionMappings()
+    {
+        m_encryptionManager->ResetEncryptionMappings();
+    }
+
+    bool BaseTransport::AddContextMapping( const Address & address, const TransportContext & context )
+    {
+        assert( context.allocator );
+        assert( context.packetFactory );
+
+        assert( m_context.packetFactory );
+        assert( m_context.packetFactory->GetNumPacketTypes() == context.packetFactory->GetNumPacketTypes() );
+
+        return m_contextManager->AddContextMapping( address, context );
+    }
+
+    bool BaseTransport::RemoveContextMapping( const Address & address )
+    {
+        return m_contextManager->RemoveContextMapping( address );
+    }
+
+    void BaseTransport::ResetContextMappings()
+    {
+        m_contextManager->ResetContextMappings();
+        m_numAddressMigrations = 0;
+    }
+
+    void BaseTransport::AdvanceTime( double time )
+    {
+        m_time = time;
+
+        m_frameAllocator->Reset();
+
+        m_encryptionManager->AdvanceTime( time );
+     
+        if ( m_networkSimulator )
+        {
+            m_networkSimulator->AdvanceTime( time );
+        }
+    }
+
+    double BaseTransport::GetTime() const
+    {
+        return m_time;
+    }
+
+    uint64_t BaseTransport::GetCounter( int index ) const
+    {
+        assert( index >= 0 );
+        assert( index < TRANSPORT_COUNTER_NUM_COUNTERS );
+        return m_counters[index];
+    }
+
+    void BaseTransport::ResetCounters()
+    {
+        memset( m_counters, 0, sizeof( m_counters ) );
+    }
+
+    int BaseTransport::GetSendQueueSize() const
+    {
+        return m_sendQueue.GetNumEntries();
+    }
+
+    int BaseTransport::GetReceiveQueueSize() const
+    {
+        return m_receiveQueue.GetNumEntries();
+    }
+
+    void BaseTransport::SetFlags( uint64_t flags )
+    {
+        m_flags = flags;
+    }
+
+    uint64_t BaseTransport::GetFlags() const
+    {
+        return m_flags;
+    }
+
+    void BaseTransport::SetFragmentSize( int bytes )
+    {
+        assert( bytes > FragmentHeaderBytes );
+        assert( ( bytes - FragmentHeaderBytes ) * MaxFragmentsPerPacket >= m_packetProcessor->GetMaxPacketBufferSize() );
+        m_fragmentSize = bytes;
+    }
+
+    int BaseTransport::GetFragmentSize() const
+    {
+        return m_fragmentSize;
+    }
+
+    void BaseTransport::SetPacketCipher( PacketCipher cipher )
+    {
+        m_packetProcessor->SetPacketCipher( cipher );
+
+        for ( int i = 0; i < m_numReceiveWorkers; ++i )
+            m_receiveWorkers[i].packetProcessor->SetPacketCipher( cipher );
+
+        m_encryptionManager->SetPacketCipher( cipher );
+    }
+
+    PacketCipher BaseTransport::GetPacketCipher() const
+    {
+        return m_packetProcessor->GetPacketCipher();
+    }
+
+    int BaseTransport::GetNumAddressMigrations() const
+    {
+        return m_numAddressMigrations;
+    }
+
+    void BaseTransport::GetAddressMigration( int index, Address & from, Address & to ) const
+    {
+        assert( index >= 0 );
+        assert( index < m_numAddressMigrations );
+        from = m_addressMigrationFrom[index];
+        to = m_addressMigrationTo[index];
+    }
+
+    const Address & BaseTransport::GetAddress() const
+    {
+        return m_address;
+    }
+
+    uint64_t BaseTransport::GetProtocolId() const
+    {
+        return m_protocolId;
+    }
+
+    // =====================================================
+
+    LocalTransport::LocalTransport( Allocator & allocator, NetworkSimulator & networkSimulator, const Address & address, uint64_t protocolId, double time, int maxPacketSize, int sendQueueSize, int receiveQueueSize )
+        : BaseTransport( allocator, address, protocolId, time, maxPacketSize, sendQueueSize, receiveQueueSize, false ) 
+    { 
+        m_networkSimulator = &networkSimulator;
+
+        m_receivePacketIndex = 0;
+        m_numReceivePackets = 0;
+        m_maxReceivePackets = receiveQueueSize;
+        m_receivePacketData = (uint8_t**) YOJIMBO_ALLOCATE( allocator, sizeof( uint8_t*) * m_maxReceivePackets );
+        m_receivePacketBytes = (int*) YOJIMBO_ALLOCATE( allocator, sizeof(int) * m_maxReceivePackets );
+        m_receiveFrom = (Address*) YOJIMBO_ALLOCATE( allocator, sizeof(Address) * m_maxReceivePackets );
+    }
+
+    LocalTransport::~LocalTransport()
+    {
+        assert( m_allocator );
+        assert( m_networkSimulator );
+
+        DiscardReceivePackets();
+
+        YOJIMBO_FREE( *m_allocator, m_receivePacketData );
+        YOJIMBO_FREE( *m_allocator, m_receivePacketBytes );
+        YOJIMBO_FREE( *m_allocator, m_receiveFrom );
+
+        m_networkSimulator = NULL;
+    }
+
+    void LocalTransport::Reset()
+    {
+        DiscardReceivePackets();
+
+        BaseTransport::Reset();
+    }
+
+    void LocalTransport::AdvanceTime( double time )
+    {
+        BaseTransport::AdvanceTime( time );
+
+        DiscardReceivePackets();
+
+        PumpReceivePacketsFromSimulator();
+    }
+
+    void LocalTransport::DiscardReceivePackets()
+    {
+        assert( m_networkSimulator );
+
+        // IMPORTANT: packets read in place are released here rather than when they are read, since they are still being read until the batch is done
+
+        for ( int i = 0; i < m_numReceivePackets; ++i )
+        {
+            m_networkSimulator->ReleasePacket( m_receivePacketData[i] );
+        }
+
+        m_numReceivePackets = 0;
+        m_receivePacketIndex = 0;
+    }
+
+    void LocalTransport::PumpReceivePacketsFromSimulator()
+    {
+        assert( m_networkSimulator );
+
+        assert( m_numReceivePackets == 0 );        
+
+        m_numReceivePackets = m_networkSimulator->ReceivePacketsSentToAddress( m_maxReceivePackets, GetAddress(), m_receivePacketData, m_receivePacketBytes, m_receiveFrom );
+    }
+
+    void LocalTransport::InternalSendPacket( const Address & to, const void * packetData, int packetBytes )
+    {
+        assert( m_networkSimulator );
+
+        m_networkSimulator->SendPacket( GetAddress(), to, (const uint8_t*) packetData, packetBytes );
+    }
+
+    int LocalTransport::InternalReceivePacket( Address & from, void * packetData, int maxPacketSize )
+    {
+        (void) maxPacketSize;
+
+        if ( m_receivePacketIndex >= m_numReceivePackets )
+            return 0;
+
+        const int index = m_receivePacketIndex;
+
+        assert( m_receivePacketData[index] );
+        assert( m_receivePacketBytes[index] > 0 );
+        assert( m_receivePacketBytes[index] <= maxPacketSize );
+
+        memcpy( packetData, m_receivePacketData[index], m_receivePacketBytes[index] );
+
+        m_networkSimulator->ReleasePacket( m_receivePacketData[index] );
+
+        m_receivePacketData[index] = NULL;
+
+        from = m_receiveFrom[index];
+
+        m_receivePacketIndex++;
+
+        return m_receivePacketBytes[index];
+    }
+
+    int LocalTransport::InternalReceivePacketsInPlace( int maxPackets, Address * from, uint8_t ** packetData, int * packetBytes, double * receiveTimes )
+    {
+        assert( m_networkSimulator );
+
+        const double receiveTime = platform_time();
+
+        int numPackets = 0;
+
+        while ( numPackets < maxPackets && m_receivePacketIndex < m_numReceivePackets )
+        {
+            const int index = m_receivePacketIndex++;
+
+            assert( m_receivePacketData[index] );
+            assert( m_receivePacketBytes[index] > 0 );
+
+            // IMPORTANT: duplicates of a packet share its buffer. Reading a packet modifies it, so shared buffers are copied first
+
+            if ( m_networkSimulator->IsPacketShared( m_receivePacketData[index] ) )
+            {
+                uint8_t * packetDataCopy = m_networkSimulator->CreatePacket( m_receivePacketBytes[index] );
+                if ( !packetDataCopy )
+                    continue;
+
+                memcpy( packetDataCopy, m_receivePacketData[index], m_receivePacketBytes[index] );
+
+                m_networkSimulator->ReleasePacket( m_receivePacketData[index] );
+
+                m_receivePacketData[index] = packetDataCopy;
+            }
+
+            from[numPackets] = m_receiveFrom[index];
+            packetData[numPackets] = m_receivePacketData[index];
+            packetBytes[numPackets] = m_receivePacketBytes[index];
+            receiveTimes[numPackets] = receiveTime;
+
+            numPackets++;
+        }
+
+        return numPackets;
+    }
+
+    // =====================================================
+
+    ThreadedLocalTransport::ThreadedLocalTransport( Allocator & allocator, ThreadedNetworkSimulator & networkSimulator, const Address & address, uint64_t protocolId, double time, int maxPacketSize, int sendQueueSize, int receiveQueueSize )
+        : BaseTransport( allocator, address, protocolId, time, maxPacketSize, sendQueueSize, receiveQueueSize, false ) 
+    { 
+        m_threadedNetworkSimulator = &networkSimulator;
+
+        if ( !networkSimulator.AddAddress( address ) )
+        {
+            debug_printf( "threaded local transport could not add address to network simulator. it won't receive packets\n" );
+        }
+
+        m_receivePacketIndex = 0;
+        m_numReceivePackets = 0;
+        m_maxReceivePackets = receiveQueueSize;
+        m_receivePacketData = (uint8_t**) YOJIMBO_ALLOCATE( allocator, sizeof( uint8_t*) * m_maxReceivePackets );
+        m_receivePacketBytes = (int*) YOJIMBO_ALLOCATE( allocator, sizeof(int) * m_maxReceivePackets );
+        m_receiveFrom = (Address*) YOJIMBO_ALLOCATE( allocator, sizeof(Address) * m_maxReceivePackets );
+    }
+
+    ThreadedLocalTransport::~ThreadedLocalTransport()
+    {
+        assert( m_allocator );
+        assert( m_threadedNetworkSimulator );
+
+        DiscardReceivePackets();
+
+        m_threadedNetworkSimulator->RemoveAddress( GetAddress() );
+
+        YOJIMBO_FREE( *m_allocator, m_receivePacketData );
+        YOJIMBO_FREE( *m_allocator, m_receivePacketBytes );
+        YOJIMBO_FREE( *m_allocator, m_receiveFrom );
+
+        m_threadedNetworkSimulator = NULL;
+    }
+
+    void ThreadedLocalTransport::Reset()
+    {
+        DiscardReceivePackets();
+
+        // IMPORTANT: Packets in flight are held in the inbox of the address they are sent to, so discard packets sent to this transport, instead of packets sent from it like LocalTransport.
+
+        m_threadedNetworkSimulator->DiscardPacketsSentToAddress( GetAddress() );
+
+        BaseTransport::Reset();
+    }
+
+    void ThreadedLocalTransport::AdvanceTime( double time )
+    {
+        BaseTransport::AdvanceTime( time );
+
+        DiscardReceivePackets();
+
+        m_numReceivePackets = m_threadedNetworkSimulator->ReceivePacketsSentToAddress( time, m_maxReceivePackets, GetAddress(), m_receivePacketData, m_receivePacketBytes, m_receiveFrom );
+    }
+
+    void ThreadedLocalTransport::DiscardReceivePackets()
+    {
+        assert( m_threadedNetworkSimulator );
+
+        for ( int i = 0; i < m_numReceivePackets; ++i )
+        {
+            m_threadedNetworkSimulator->ReleasePacket( m_receivePacketData[i] );
+        }
+
+        m_numReceivePackets = 0;
+        m_receivePacketIndex = 0;
+    }
+
+    void ThreadedLocalTransport::InternalSendPacket( const Address & to, const void * packetData, int packetBytes )
+    {
+        assert( m_threadedNetworkSimulator );
+
+        m_threadedNetworkSimulator->SendPacket( GetAddress(), to, (const uint8_t*) packetData, packetBytes, GetTime() );
+    }
+
+    int ThreadedLocalTransport::InternalReceivePacket( Address & from, void * packetData, int maxPacketSize )
+    {
+        (void) maxPacketSize;
+
+        if ( m_receivePacketIndex >= m_numReceivePackets )
+            return 0;
+
+        const int index = m_receivePacketIndex;
+
+        assert( m_receivePacketData[index] );
+        assert( m_receivePacketBytes[index] > 0 );
+        assert( m_receivePacketBytes[index] <= maxPacketSize );
+
+        memcpy( packetData, m_receivePacketData[index], m_receivePacketBytes[index] );
+
+        m_threadedNetworkSimulator->ReleasePacket( m_receivePacketData[index] );
+
+        m_receivePacketData[index] = NULL;
+
+        from = m_receiveFrom[index];
+
+        m_receivePacketIndex++;
+
+        return m_receivePacketBytes[index];
+    }
+
+    // =====================================================
+
+    LoopbackTransport::LoopbackTransport( Allocator & allocator, const Address & address, uint64_t protocolId, double time, int maxPacketSize, int sendQueueSize, int receiveQueueSize )
+        : BaseTransport( allocator, address, protocolId, time, maxPacketSize, sendQueueSize, receiveQueueSize, false )
+    {
+        m_pairedTransport = NULL;
+        m_packetBuffer = (uint8_t*) YOJIMBO_ALLOCATE( allocator, m_packetProcessor->GetMaxPacketBufferSize() );
+    }
+
+    LoopbackTransport::~LoopbackTransport()
+    {
+        assert( m_allocator );
+
+        Unpair();
+
+        YOJIMBO_FREE( *m_allocator, m_packetBuffer );
+    }
+
+    void LoopbackTransport::Pair( LoopbackTransport & other )
+    {
+        assert( &other != this );
+
+        Unpair();
+        other.Unpair();
+
+        m_pairedTransport = &other;
+        other.m_pairedTransport = this;
+    }
+
+    void LoopbackTransport::Unpair()
+    {
+        if ( !m_pairedTransport )
+            return;
+
+        assert( m_pairedTransport->m_pairedTransport == this );
+
+        m_pairedTransport->m_pairedTransport = NULL;
+        m_pairedTransport = NULL;
+    }
+
+    LoopbackTransport * LoopbackTransport::GetPairedTransport() const
+    {
+        return m_pairedTransport;
+    }
+
+    void LoopbackTransport::SendPacket( const Address & address, Packet * packet, uint64_t sequence, bool immediate )
+    {
+        if ( !immediate )
+        {
+            BaseTransport::SendPacket( address, packet, sequence, false );
+            return;
+        }
+
+        assert( packet );
+        assert( packet->IsValid() );
+        assert( address.IsValid() );
+
+        HandPacketToPair( address, packet, sequence );
+
+        m_counters[TRANSPORT_COUNTER_PACKETS_SENT]++;
+    }
+
+    bool LoopbackTransport::SendSerializedPacket( const Address & address, int type, const uint8_t * packetData, int packetBytes, uint64_t sequence, bool immediate )
+    {
+        (void) address;
+        (void) type;
+        (void) packetData;
+        (void) packetBytes;
+        (void) sequence;
+        (void) immediate;
+        return false;
+    }
+
+    void LoopbackTransport::WritePackets()
+    {
+        YOJIMBO_PROFILE_SCOPE( PROFILE_STAGE_TRANSPORT_WRITE_PACKETS );
+        YOJIMBO_ZONE( "transport_write_packets" );
+
+        if ( !m_context.packetFactory )
+            return;
+
+        while ( !m_sendQueue.IsEmpty() )
+        {
+            PacketEntry entry = m_sendQueue.Pop();
+
+            assert( entry.packet );
+            assert( entry.packet->IsValid() );
+            assert( entry.address.IsValid() );
+
+            HandPacketToPair( entry.address, entry.packet, entry.sequence );
+        }
+    }
+
+    void LoopbackTransport::HandPacketToPair( const Address & address, Packet * packet, uint64_t sequence )
+    {
+        LoopbackTransport * pair = m_pairedTransport;
+
+        if ( !pair || pair->GetAddress() != address || pair->GetProtocolId() != GetProtocolId() || !pair->m_context.packetFactory )
+        {
+            packet->Destroy();
+            return;
+        }
+
+        const TransportContext * writeContext = m_contextManager->GetContext( address );
+
+        if ( !writeContext )
+            writeContext = &m_context;
+
+        assert( writeContext->allocator );
+        assert( writeContext->packetFactory );
+
+        PacketReadWriteInfo writeInfo;
+        writeInfo.rawFormat = true;
+        writeInfo.protocolId = m_protocolId;
+        writeInfo.packetFactory = writeContext->packetFactory;
+        writeInfo.streamAllocator = writeContext->allocator;
+        writeInfo.context = writeContext->connectionContext;
+        writeInfo.userContext = writeContext->userContext;
+
+        const int packetBytes = yojimbo::WritePacket( writeInfo, packet, m_packetBuffer, m_packetProcessor->GetMaxPacketBufferSize() );
+
+        packet->Destroy();
+
+        if ( packetBytes <= 0 || packetBytes > GetMaxPacketSize() )
+        {
+            debug_printf( "loopback transport write packet failed\n" );
+            m_counters[TRANSPORT_COUNTER_WRITE_PACKET_FAILURES]++;
+            return;
+        }
+
+        m_counters[TRANSPORT_COUNTER_PACKETS_WRITTEN]++;
+
+        // IMPORTANT: the packet is read with the context the paired transport has for this address, so messages are created by its own message factory, just like a packet read from the network
+
+        const TransportContext * readContext = pair->m_contextManager->GetContext( GetAddress() );
+
+        if ( !readContext )
+            readContext = &pair->m_context;
+
+        assert( readContext->allocator );
+        assert( readContext->packetFactory );
+
+        PacketReadWriteInfo readInfo;
+        readInfo.rawFormat = true;
+        readInfo.protocolId = pair->m_protocolId;
+        readInfo.packetFactory = readContext->packetFactory;
+        readInfo.streamAllocator = readContext->allocator;
+        readInfo.context = readContext->connectionContext;
+        readInfo.userContext = readContext->userContext;
+
+        Packet * receivedPacket = yojimbo::ReadPacket( readInfo, m_packetBuffer, packetBytes );
+
+        if ( !receivedPacket )
+        {
+            debug_printf( "loopback transport read packet failed\n" );
+            pair->m_counters[TRANSPORT_COUNTER_READ_PACKET_FAILURES]++;
+            return;
+        }
+
+        pair->m_counters[TRANSPORT_COUNTER_PACKETS_READ]++;
+
+        if ( pair->m_receiveQueue.IsFull() )
+        {
+            pair->m_counters[TRANSPORT_COUNTER_RECEIVE_QUEUE_OVERFLOW]++;
+            receivedPacket->Destroy();
+            return;
+        }
+
+        PacketEntry entry;
+        entry.sequence = sequence;
+        entry.receiveTime = platform_time();
+        entry.address = GetAddress();
+        entry.packet = receivedPacket;
+
+        pair->m_receiveQueue.Push( entry );
+    }
+
+    void LoopbackTransport::InternalSendPacket( const Address & to, const void * packetData, int packetBytes )
+    {
+        (void) to;
+        (void) packetData;
+        (void) packetBytes;
+
+        // IMPORTANT: packets are handed straight to the paired transport in LoopbackTransport::HandPacketToPair, so there is nothing to send here
+    }
+
+    int LoopbackTransport::InternalReceivePacket( Address & from, void * packetData, int maxPacketSize )
+    {
+        (void) from;
+        (void) packetData;
+        (void) maxPacketSize;
+
+        return 0;
+    }
+
+    // =====================================================
+
+    static const int SharedMemoryMagic = 0x534D4A59;                    // "YJMS". written last when the shared memory block is created, so the other side never sees a partially initialized header.
+
+    static const int SharedMemorySlotHeaderBytes = 8;                   // each packet slot starts with the packet size, padded so packet data is 8 byte aligned
+
+    static const int SharedMemoryDetached = 0;
+    static const int SharedMemoryAttaching = 1;
+    static const int SharedMemoryAttached = 2;
+
+    struct SharedMemoryRing
+    {
+        int writeIndex;                                                 // index of the next slot to write a packet into. only written by the sending side.
+        int padding0[15];
+        int readIndex;                                                  // index of the next slot to read a packet from. only written by the receiving side.
+        int padding1[15];
+        int waiting;                                                    // set to 1 by the receiving side before it sleeps in InternalWaitForPacket. cleared by the sending side when it wakes it up.
+        int padding2[15];
+    };
+
+    struct SharedMemoryHeader
+    {
+        int magic;
+        int attachState;                                                // SharedMemoryDetached, SharedMemoryAttaching or SharedMemoryAttached. claimed by the transport that opens the block.
+        int attachCount;                                                // incremented each time a transport opens the block
+        int maxPacketBufferSize;
+        int ringSize;
+        int padding;
+        uint64_t protocolId;
+        char address[2][MaxAddressLength];                              // address of the transport that created the block, and the transport that opened it
+        SharedMemoryRing ring[2];                                       // ring 0 carries packets from the transport that created the block, ring 1 from the transport that opened it
+    };
+
+    SharedMemoryTransport::SharedMemoryTransport( Allocator & allocator,
+                                                  const char * name,
+                                                  bool create,
+                                                  const Address & address,
+                                                  uint64_t protocolId,
+                                                  double time,
+                                                  int maxPacketSize,
+                                                  int sendQueueSize,
+                                                  int receiveQueueSize,
+                                                  int ringSize )
+        : BaseTransport( allocator, 
+                         address,
+                         protocolId,
+                         time,
+                         maxPacketSize,
+                         sendQueueSize,
+                         receiveQueueSize,
+                         false )
+    {
+        assert( name );
+        assert( ringSize >= 2 );
+
+        m_sharedMemory = NULL;
+        m_header = NULL;
+        m_error = SHARED_MEMORY_ERROR_NONE;
+        m_side = create ? 0 : 1;
+        m_ringSize = ringSize;
+        m_sendSlots = NULL;
+        m_receiveSlots = NULL;
+        m_peerAttachCount = 0;
+
+        const int maxPacketBufferSize = m_packetProcessor->GetMaxPacketBufferSize();
+
+        m_slotSize = ( SharedMemorySlotHeaderBytes + maxPacketBufferSize + 63 ) & ~63;
+
+        const size_t headerBytes = ( sizeof( SharedMemoryHeader ) + 63 ) & ~63;
+
+        const size_t bytes = headerBytes + 2 * size_t( ringSize ) * size_t( m_slotSize );
+
+        if ( create )
+        {
+            m_sharedMemory = platform_shared_memory_create( allocator, name, bytes );
+            if ( !m_sharedMemory )
+            {
+                m_error = SHARED_MEMORY_ERROR_CREATE_FAILED;
+                return;
+            }
+
+            // IMPORTANT: new shared memory is zeroed, so the rings start out empty and the block starts out detached
+
+            m_header = (SharedMemoryHeader*) platform_shared_memory_data( m_sharedMemory );
+            m_header->maxPacketBufferSize = maxPacketBufferSize;
+            m_header->ringSize = ringSize;
+            m_header->protocolId = protocolId;
+            m_address.ToString( m_header->address[0], MaxAddressLength );
+
+            atomic_store( &m_header->magic, SharedMemoryMagic );
+        }
+        else
+        {
+            m_sharedMemory = platform_shared_memory_open( allocator, name );
+            if ( !m_sharedMemory )
+            {
+                m_error = SHARED_MEMORY_ERROR_OPEN_FAILED;
+                return;
+            }
+
+            SharedMemoryHeader * header = (SharedMemoryHeader*) platform_shared_memory_data( m_sharedMemory );
+
+            if ( platform_shared_memory_size( m_sharedMemory ) < bytes ||
+                 atomic_load( &header->magic ) != SharedMemoryMagic ||
+                 header->protocolId != protocolId ||
+                 header->maxPacketBufferSize != maxPacketBufferSize ||
+                 header->ringSize != ringSize )
+            {
+                m_error = SHARED_MEMORY_ERROR_MISMATCH;
+                platform_shared_memory_close( allocator, m_sharedMemory );
+                return;
+            }
+
+            if ( !atomic_compare_exchange( &header->attachState, SharedMemoryDetached, SharedMemoryAttaching ) )
+            {
+                m_error = SHARED_MEMORY_ERROR_ALREADY_ATTACHED;
+                platform_shared_memory_close( allocator, m_sharedMemory );
+                return;
+            }
+
+            m_header = header;
+
+            // discard packets sent to a transport that opened the block before us, and never read them
+
+            SharedMemoryRing & ring = m_header->ring[0];
+            atomic_store( &ring.readIndex, atomic_load( &ring.writeIndex ) );
+
+            m_address.ToString( m_header->address[1], MaxAddressLength );
+
+            atomic_increment( &m_header->attachCount );
+
+            atomic_store( &m_header->attachState, SharedMemoryAttached );
+        }
+
+        uint8_t * slots = ( (uint8_t*) m_header ) + headerBytes;
+
+        m_sendSlots = slots + size_t( m_side ) * size_t( ringSize ) * size_t( m_slotSize );
+        m_receiveSlots = slots + size_t( 1 - m_side ) * size_t( ringSize ) * size_t( m_slotSize );
+
+        UpdatePeerAddress();
+    }
+
+    SharedMemoryTransport::~SharedMemoryTransport()
+    {
+        assert( m_allocator );
+
+        if ( !m_header )
+            return;
+
+        if ( m_side == 1 )
+            atomic_store( &m_header->attachState, SharedMemoryDetached );
+
+        platform_shared_memory_close( *m_allocator, m_sharedMemory );
+    }
+
+    bool SharedMemoryTransport::IsError() const
+    {
+        return m_error != SHARED_MEMORY_ERROR_NONE;
+    }
+
+    int SharedMemoryTransport::GetError() const
+    {
+        return m_error;
+    }
+
+    bool SharedMemoryTransport::IsPeerAttached()
+    {
+        UpdatePeerAddress();
+        return m_peerAddress.IsValid();
+    }
+
+    const Address & SharedMemoryTransport::GetPeerAddress()
+    {
+        UpdatePeerAddress();
+        return m_peerAddress;
+    }
+
+    void SharedMemoryTransport::UpdatePeerAddress()
+    {
+        if ( !m_header )
+            return;
+
+        if ( m_side == 1 )
+        {
+            if ( !m_peerAddress.IsValid() )
+                m_peerAddress = Address( m_header->address[0] );
+            return;
+        }
+
+        if ( atomic_load( &m_header->attachState ) != SharedMemoryAttached )
+        {
+            m_peerAddress = Address();
+            return;
+        }
+
+        const int attachCount = atomic_load( &m_header->attachCount );
+
+        if ( !m_peerAddress.IsValid() || attachCount != m_peerAttachCount )
+        {
+            m_peerAddress = Address( m_header->address[1] );
+            m_peerAttachCount = attachCount;
+        }
+    }
+
+    void SharedMemoryTransport::InternalSendPacket( const Address & to, const void * packetData, int packetBytes )
+    {
+        assert( packetData );
+        assert( packetBytes > 0 );
+
+        if ( !m_header )
+            return;
+
+        UpdatePeerAddress();
+
+        if ( !m_peerAddress.IsValid() || to != m_peerAddress )
+            return;
+
+        if ( packetBytes > m_slotSize - SharedMemorySlotHeaderBytes )
+            return;
+
+        SharedMemoryRing & ring = m_header->ring[m_side];
+
+        const int writeIndex = ring.writeIndex;
+
+        const int nextWriteIndex = ( writeIndex + 1 ) % m_ringSize;
+
+        // IMPORTANT: when the ring is full the packet is dropped, just like a full socket send buffer
+
+        if ( nextWriteIndex == atomic_load( &ring.readIndex ) )
+            return;
+
+        uint8_t * slot = m_sendSlots + size_t( writeIndex ) * size_t( m_slotSize );
+
+        *( (int*) slot ) = packetBytes;
+
+        memcpy( slot + SharedMemorySlotHeaderBytes, packetData, packetBytes );
+
+        atomic_store( &ring.writeIndex, nextWriteIndex );
+
+        if ( atomic_compare_exchange( &ring.waiting, 1, 0 ) )
+            platform_wake_address( &ring.writeIndex );
+    }
+
+    int SharedMemoryTransport::InternalReceivePacket( Address & from, void * packetData, int maxPacketSize )
+    {
+        assert( packetData );
+
+        if ( !m_header )
+            return 0;
+
+        UpdatePeerAddress();
+
+        SharedMemoryRing & ring = m_header->ring[1-m_side];
+
+        while ( true )
+        {
+            const int readIndex = ring.readIndex;
+
+            if ( readIndex == atomic_load( &ring.writeIndex ) )
+                return 0;
+
+            const uint8_t * slot = m_receiveSlots + size_t( readIndex ) * size_t( m_slotSize );
+
+            const int packetBytes = *( (const int*) slot );
+
+            // IMPORTANT: the other side is another process, so don't trust the packet size. packets left behind by a transport that has since detached are dropped too.
+
+            const bool valid = m_peerAddress.IsValid() && packetBytes > 0 && packetBytes <= maxPacketSize && packetBytes <= m_slotSize - SharedMemorySlotHeaderBytes;
+
+            if ( valid )
+                memcpy( packetData, slot + SharedMemorySlotHeaderBytes, packetBytes );
+
+            atomic_store( &ring.readIndex, ( readIndex + 1 ) % m_ringSize );
+
+            if ( valid )
+            {
+                from = m_peerAddress;
+                return packetBytes;
+            }
+        }
+    }
+
+    bool SharedMemoryTransport::InternalWaitForPacket( double timeout )
+    {
+        if ( !m_header )
+            return BaseTransport::InternalWaitForPacket( timeout );
+
+        SharedMemoryRing & ring = m_header->ring[1-m_side];
+
+        const double finishTime = platform_time() + timeout;
+
+        while ( true )
+        {
+            const int writeIndex = atomic_load( &ring.writeIndex );
+
+            if ( writeIndex != ring.readIndex )
+                return true;
+
+            const double timeRemaining = finishTime - platform_time();
+
+            if ( timeRemaining <= 0.0 )
+                return false;
+
+            // IMPORTANT: flag that we are waiting before checking the ring one last time, so a packet sent in between always wakes us up
+
+            atomic_compare_exchange( &ring.waiting, 0, 1 );
+
+            if ( atomic_load( &ring.writeIndex ) != writeIndex )
+                continue;
+
+            platform_wait_on_address( &ring.writeIndex, writeIndex, timeRemaining );
+        }
+    }
+
+    // =====================================================
+
+#if YOJIMBO_SOCKETS
+
+    NetworkTransport::NetworkTransport( Allocator & allocator, 
+                                        const Address & address,
+                                        uint64_t protocolId,
+                                        double time,
+                                        int maxPacketSize, 
+                                        int sendQueueSize, 
+                                        int receiveQueueSize,
+                                        int socketSendBufferSize,
+                                        int socketReceiveBufferSize,
+                                        bool allocateNetworkSimulator,
+                                        int socketFlags )
+        : BaseTransport( allocator, 
+                         address,
+                         protocolId,
+                         time,
+                         maxPacketSize,
+                         sendQueueSize,
+                         receiveQueueSize,
+                         allocateNetworkSimulator )
+    {
+        m_socket = YOJIMBO_NEW( allocator, Socket, address, socketSendBufferSize, socketReceiveBufferSize, socketFlags );
+
+        if ( m_address.GetPort() == 0 && !m_socket->IsError() )
+        {
+            m_address.SetPort( m_socket->GetAddress().GetPort() );
+        }
+
+        m_numRelays = 0;
+        m_numRelayRoutes = 0;
+        m_relayRouteMap = NULL;
+        m_relayRouteAddress = NULL;
+        m_relayRouteRelay = NULL;
+        m_relayRouteTime = NULL;
+        m_relayPacketBufferSize = m_packetProcessor->GetMaxPacketBufferSize() + MaxRelayHeaderBytes;
+        m_relayReceivePacketData = NULL;
+        m_relaySendPacketData = NULL;
+        m_relayOrigins = NULL;
+        m_relayLimiter = NULL;
+        m_relayPacketsPerSecond = 0.0f;
+        m_relayPacketBurst = 0.0f;
+        m_pacingInterval = 0.0;
+        m_kernelPacing = false;
+        m_numSendErrors = 0;
+        m_pacingStartTime = 0.0;
+        m_pacingGap = 0.0;
+        m_pacingIndex = 0;
+        m_pacingQueueSize = 0;
+        m_pacingQueueHead = 0;
+        m_numPacedPackets = 0;
+        m_pacingSlotSize = m_packetProcessor->GetMaxPacketBufferSize();
+        m_pacedPacketData = NULL;
+        m_pacedPacketTo = NULL;
+        m_pacedPacketBytes = NULL;
+        m_pacedPacketTime = NULL;
+    }
+
+    NetworkTransport::~NetworkTransport()
+    {
+        assert( m_socket );
+        assert( m_allocator );
+
+        DisableRelayMode();
+
+        if ( m_pacedPacketData )
+        {
+            for ( int i = 0; i < m_pacingQueueSize; ++i )
+                m_pacedPacketTo[i].~Address();
+
+            YOJIMBO_FREE( *m_allocator, m_pacedPacketData );
+            YOJIMBO_FREE( *m_allocator, m_pacedPacketTo );
+            YOJIMBO_FREE( *m_allocator, m_pacedPacketBytes );
+            YOJIMBO_FREE( *m_allocator, m_pacedPacketTime );
+        }
+
+        if ( m_relayRouteMap )
+        {
+            for ( int i = 0; i < DefaultMaxRelayRoutes; ++i )
+                m_relayRouteAddress[i].~Address();
+
+            YOJIMBO_DELETE( *m_allocator, AddressMap, m_relayRouteMap );
+            YOJIMBO_FREE( *m_allocator, m_relayRouteAddress );
+            YOJIMBO_FREE( *m_allocator, m_relayRouteRelay );
+            YOJIMBO_FREE( *m_allocator, m_relayRouteTime );
+            YOJIMBO_FREE( *m_allocator, m_relayReceivePacketData );
+            YOJIMBO_FREE( *m_allocator, m_relaySendPacketData );
+        }
+
+        YOJIMBO_DELETE( *m_allocator, Socket, m_socket );
+    }
+
+    bool NetworkTransport::IsError() const
+    {
+        return m_socket->IsError();
+    }
+
+    int NetworkTransport::GetError() const
+    {
+        return m_socket->GetError();
+    }
+
+    bool NetworkTransport::EnablePacketFilter( int unknownSourcePacketsPerSecond )
+    {
+        assert( m_context.packetFactory );
+        assert( unknownSourcePacketsPerSecond >= 0 );
+
+        if ( m_socket->IsError() )
+            return false;
+
+        const int numPacketTypes = m_context.packetFactory->GetNumPacketTypes();
+
+        const uint8_t * unencryptedPacketTypes = m_packetTypeIsUnencrypted;
+
+#if !YOJIMBO_SECURE_MODE
+        if ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE )
+            unencryptedPacketTypes = m_allPacketTypes;
+#endif // #if !YOJIMBO_SECURE_MODE
+
+        SocketFilterConfig config;
+
+        config.maxPacketBytes = m_packetProcessor->GetMaxPacketBufferSize() + MaxRelayHeaderBytes;
+        config.minEncryptedPacketBytes = 2 + MacBytes;
+        config.maxPrefixByte = RelayPacketPrefix;
+        config.numPacketTypes = numPacketTypes;
+        config.unknownSourcePacketsPerSecond = unknownSourcePacketsPerSecond;
+
+        if ( numPacketTypes <= 64 )
+        {
+            config.unencryptedPacketTypes = 0;
+
+            for ( int i = 0; i < numPacketTypes; ++i )
+            {
+                if ( unencryptedPacketTypes[i] )
+                    config.unencryptedPacketTypes |= uint64_t(1) << i;
+            }
+        }
+
+        return m_socket->SetFilter( config );
+    }
+
+    void NetworkTransport::DisablePacketFilter()
+    {
+        m_socket->ClearFilter();
+    }
+
+    bool NetworkTransport::IsPacketFilterEnabled() const
+    {
+        return m_socket->IsFiltering();
+    }
+
+    uint64_t NetworkTransport::GetPacketFilterCounter( int index ) const
+    {
+        assert( index >= 0 );
+        assert( index < SOCKET_FILTER_NUM_COUNTERS );
+        return m_socket->GetFilterCounter( index );
+    }
+
+    static int write_relay_header( uint8_t * buffer, const Address & address )
+    {
+        assert( buffer );
+        assert( address.IsValid() );
+
+        uint8_t * p = buffer;
+
+        *p++ = RelayPacketPrefix;
+        *p++ = (uint8_t) address.GetType();
+
+        // IMPORTANT: addresses are written in network byte order, the same as they are stored in yojimbo::Address. The port is little endian like the rest of the protocol.
+
+        if ( address.GetType() == ADDRESS_IPV4 )
+        {
+            const uint32_t ipv4 = address.GetAddress4();
+            memcpy( p, &ipv4, 4 );
+            p += 4;
+        }
+        else
+        {
+            memcpy( p, address.GetAddress6(), 16 );
+            p += 16;
+        }
+
+        const uint16_t port = address.GetPort();
+        *p++ = (uint8_t) ( port & 0xFF );
+        *p++ = (uint8_t) ( port >> 8 );
+
+        return (int) ( p - buffer );
+    }
+
+    static int read_relay_header( const uint8_t * packetData, int packetBytes, Address & address )
+    {
+        assert( packetData );
+
+        if ( packetBytes < 2 || packetData[0] != RelayPacketPrefix )
+            return 0;
+
+        const int addressBytes = ( packetData[1] == ADDRESS_IPV4 ) ? 4 : ( packetData[1] == ADDRESS_IPV6 ? 16 : 0 );
+
+        const int headerBytes = 2 + addressBytes + 2;
+
+        // IMPORTANT: a relayed packet must hold at least one byte of the packet inside it.
+
+        if ( addressBytes == 0 || packetBytes <= headerBytes )
+            return 0;
+
+        const uint8_t * p = packetData + 2 + addressBytes;
+
+        const uint16_t port = uint16_t( p[0] ) | ( uint16_t( p[1] ) << 8 );
+
+        p = packetData + 2;
+
+        if ( addressBytes == 4 )
+        {
+            address = Address( p[0], p[1], p[2], p[3], port );
+        }
+        else
+        {
+            uint16_t ipv6[8];
+            for ( int i = 0; i < 8; ++i )
+                ipv6[i] = ( uint16_t( p[i*2] ) << 8 ) | uint16_t( p[i*2+1] );
+            address = Address( ipv6, port );
+        }
+
+        return address.IsValid() && address.GetPort() != 0 ? headerBytes : 0;
+    }
+
+    void NetworkTransport::InitializeRelays()
+    {
+        if ( m_relayRouteMap )
+            return;
+
+        assert( m_allocator );
+
+        m_relayRouteMap = YOJIMBO_NEW( *m_allocator, AddressMap, *m_allocator, DefaultMaxRelayRoutes );
+        m_relayRouteAddress = (Address*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( Address ) * DefaultMaxRelayRoutes );
+        m_relayRouteRelay = (int*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( int ) * DefaultMaxRelayRoutes );
+        m_relayRouteTime = (double*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( double ) * DefaultMaxRelayRoutes );
+        m_relayReceivePacketData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, PacketReceiveBatchSize * m_relayPacketBufferSize );
+        m_relaySendPacketData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, PacketReceiveBatchSize * m_relayPacketBufferSize );
+
+        for ( int i = 0; i < DefaultMaxRelayRoutes; ++i )
+            new ( &m_relayRouteAddress[i] ) Address();
+    }
+
+    bool NetworkTransport::AddRelay( const Address & relayAddress )
+    {
+        assert( relayAddress.IsValid() );
+
+        if ( FindRelay( relayAddress ) >= 0 )
+            return true;
+
+        if ( m_numRelays == MaxRelays )
+            return false;
+
+        InitializeRelays();
+
+        m_relays[m_numRelays++] = relayAddress;
+
+        if ( m_socket->IsFiltering() )
+            m_socket->AddKnownAddress( relayAddress );
+
+        return true;
+    }
+
+    bool NetworkTransport::AddRelayRoute( const Address & address, const Address & relayAddress )
+    {
+        assert( address.IsValid() );
+
+        if ( !AddRelay( relayAddress ) )
+            return false;
+
+        return SetRelayRoute( address, FindRelay( relayAddress ), false );
+    }
+
+    bool NetworkTransport::RemoveRelayRoute( const Address & address )
+    {
+        if ( m_numRelayRoutes == 0 )
+            return false;
+
+        const int index = m_relayRouteMap->Find( address );
+        if ( index < 0 )
+            return false;
+
+        m_relayRouteMap->Remove( address );
+
+        // IMPORTANT: the last route is moved into the hole, so routes stay packed at the front of the table.
+
+        const int lastIndex = --m_numRelayRoutes;
+
+        if ( index != lastIndex )
+        {
+            m_relayRouteAddress[index] = m_relayRouteAddress[lastIndex];
+            m_relayRouteRelay[index] = m_relayRouteRelay[lastIndex];
+            m_relayRouteTime[index] = m_relayRouteTime[lastIndex];
+            m_relayRouteMap->Insert( m_relayRouteAddress[index], index );
+        }
+
+        m_relayRouteAddress[lastIndex] = Address();
+
+        return true;
+    }
+
+    void NetworkTransport::ResetRelays()
+    {
+        if ( m_socket->IsFiltering() )
+        {
+            for ( int i = 0; i < m_numRelays; ++i )
+                m_socket->RemoveKnownAddress( m_relays[i] );
+        }
+
+        for ( int i = 0; i < m_numRelays; ++i )
+            m_relays[i] = Address();
+
+        m_numRelays = 0;
+
+        if ( !m_relayRouteMap )
+            return;
+
+        m_relayRouteMap->Clear();
+
+        for ( int i = 0; i < m_numRelayRoutes; ++i )
+            m_relayRouteAddress[i] = Address();
+
+        m_numRelayRoutes = 0;
+    }
+
+    Address NetworkTransport::GetRelayRouteAddress( const Address & address ) const
+    {
+        if ( m_numRelayRoutes == 0 )
+            return Address();
+
+        const int index = m_relayRouteMap->Find( address );
+        if ( index < 0 )
+            return Address();
+
+        return m_relays[m_relayRouteRelay[index]];
+    }
+
+    void NetworkTransport::EnableRelayMode( const Address * originAddresses, int numOriginAddresses, float packetsPerSecond, float packetBurst )
+    {
+        assert( originAddresses );
+        assert( numOriginAddresses > 0 );
+        assert( numOriginAddresses <= MaxRelayOrigins );
+        assert( packetsPerSecond > 0.0f );
+        assert( packetBurst >= 1.0f );
+
+        DisableRelayMode();
+
+        InitializeRelays();
+
+        m_relayOrigins = YOJIMBO_NEW( *m_allocator, AddressMap, *m_allocator, MaxRelayOrigins );
+        m_relayLimiter = YOJIMBO_NEW( *m_allocator, ConnectionRequestLimiter, *m_allocator, DefaultMaxRelayRoutes );
+
+        for ( int i = 0; i < numOriginAddresses; ++i )
+            m_relayOrigins->Insert( originAddresses[i], i );
+
+        m_relayPacketsPerSecond = packetsPerSecond;
+        m_relayPacketBurst = packetBurst;
+    }
+
+    void NetworkTransport::DisableRelayMode()
+    {
+        if ( !m_relayOrigins )
+            return;
+
+        assert( m_allocator );
+
+        YOJIMBO_DELETE( *m_allocator, AddressMap, m_relayOrigins );
+        YOJIMBO_DELETE( *m_allocator, ConnectionRequestLimiter, m_relayLimiter );
+
+        m_relayOrigins = NULL;
+        m_relayLimiter = NULL;
+    }
+
+    bool NetworkTransport::IsRelayModeEnabled() const
+    {
+        return m_relayOrigins != NULL;
+    }
+
+    void NetworkTransport::EnablePacing( double interval, bool useTxTime )
+    {
+        assert( interval > 0.0 );
+        assert( m_allocator );
+
+        m_pacingInterval = interval;
+
+        m_kernelPacing = useTxTime && m_socket->EnableTxTime();
+
+        if ( m_kernelPacing || m_pacedPacketData )
+            return;
+
+        // IMPORTANT: Without SO_TXTIME the transport holds packets itself. It can hold a full send queue, so a tick's packets are only sent early if fragmentation or parity packets push it past that.
+
+        m_pacingQueueSize = m_sendQueue.GetSize();
+        m_pacedPacketData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, m_pacingQueueSize * m_pacingSlotSize );
+        m_pacedPacketTo = (Address*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( Address ) * m_pacingQueueSize );
+        m_pacedPacketBytes = (int*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( int ) * m_pacingQueueSize );
+        m_pacedPacketTime = (double*) YOJIMBO_ALLOCATE( *m_allocator, sizeof( double ) * m_pacingQueueSize );
+
+        for ( int i = 0; i < m_pacingQueueSize; ++i )
+            new ( &m_pacedPacketTo[i] ) Address();
+    }
+
+    void NetworkTransport::DisablePacing()
+    {
+        if ( m_numPacedPackets > 0 )
+            SendPacedPacketsDue( m_pacedPacketTime[ ( m_pacingQueueHead + m_numPacedPackets - 1 ) % m_pacingQueueSize ] );
+
+        m_pacingInterval = 0.0;
+        m_kernelPacing = false;
+        m_numSendErrors = 0;
+    }
+
+    bool NetworkTransport::IsPacingEnabled() const
+    {
+        return m_pacingInterval > 0.0;
+    }
+
+    bool NetworkTransport::IsKernelPacing() const
+    {
+        return m_pacingInterval > 0.0 && m_kernelPacing;
+    }
+
+    void NetworkTransport::SendPacedPackets()
+    {
+        if ( m_numPacedPackets > 0 )
+            SendPacedPacketsDue( platform_time() );
+    }
+
+    bool NetworkTransport::SetMaxPacingRate( uint32_t bytesPerSecond )
+    {
+        return m_socket->SetMaxPacingRate( bytesPerSecond );
+    }
+
+    bool NetworkTransport::SetDscp( int dscp )
+    {
+        return m_socket->SetDscp( dscp );
+    }
+
+    int NetworkTransport::GetNumSendErrors() const
+    {
+        return m_numSendErrors;
+    }
+
+    const Address & NetworkTransport::GetSendErrorAddress( int index ) const
+    {
+        assert( index >= 0 );
+        assert( index < m_numSendErrors );
+        return m_sendErrorAddress[index];
+    }
+
+    int NetworkTransport::GetSendError( int index ) const
+    {
+        assert( index >= 0 );
+        assert( index < m_numSendErrors );
+        return m_sendError[index];
+    }
+
+    void NetworkTransport::Reset()
+    {
+        BaseTransport::Reset();
+
+        m_pacingQueueHead = 0;
+        m_numPacedPackets = 0;
+        m_pacingIndex = 0;
+    }
+
+    void NetworkTransport::WritePackets()
+    {
+        if ( m_pacingInterval > 0.0 )
+        {
+            // IMPORTANT: Packets still held from the last tick are overdue, so they go out before any packets from this tick.
+
+            if ( m_numPacedPackets > 0 )
+                SendPacedPacketsDue( m_pacedPacketTime[ ( m_pacingQueueHead + m_numPacedPackets - 1 ) % m_pacingQueueSize ] );
+
+            m_pacingStartTime = platform_time();
+            m_pacingGap = m_pacingInterval / max( m_sendQueue.GetNumEntries(), 1 );
+            m_pacingIndex = 0;
+        }
+
+        BaseTransport::WritePackets();
+    }
+
+    void NetworkTransport::QueuePacedPackets( int numPackets, const Address * to, const uint8_t * packetData, int maxPacketSize, const int * packetBytes )
+    {
+        assert( m_pacedPacketData );
+        assert( m_pacingQueueSize > 0 );
+
+        for ( int i = 0; i < numPackets; ++i )
+        {
+            assert( packetBytes[i] <= m_pacingSlotSize );
+
+            if ( m_numPacedPackets == m_pacingQueueSize )
+            {
+                m_socket->SendPacket( m_pacedPacketTo[m_pacingQueueHead], m_pacedPacketData + m_pacingQueueHead * m_pacingSlotSize, m_pacedPacketBytes[m_pacingQueueHead] );
+                m_pacingQueueHead = ( m_pacingQueueHead + 1 ) % m_pacingQueueSize;
+                m_numPacedPackets--;
+            }
+
+            const int index = ( m_pacingQueueHead + m_numPacedPackets ) % m_pacingQueueSize;
+
+            memcpy( m_pacedPacketData + index * m_pacingSlotSize, packetData + i * maxPacketSize, packetBytes[i] );
+            m_pacedPacketTo[index] = to[i];
+            m_pacedPacketBytes[index] = packetBytes[i];
+            m_pacedPacketTime[index] = m_pacingStartTime + m_pacingIndex * m_pacingGap;
+
+            m_pacingIndex++;
+            m_numPacedPackets++;
+        }
+    }
+
+    void NetworkTransport::SendPacedPacketsDue( double time )
+    {
+        // IMPORTANT: Held packets depart in the order they were queued, so due packets are always at the head of the ring. Runs that don't wrap around the end of the ring go out as one batch.
+
+        while ( m_numPacedPackets > 0 )
+        {
+            const int maxPackets = min( min( m_numPacedPackets, m_pacingQueueSize - m_pacingQueueHead ), PacketSendBatchSize );
+
+            int numPackets = 0;
+            while ( numPackets < maxPackets && m_pacedPacketTime[m_pacingQueueHead + numPackets] <= time )
+                numPackets++;
+
+            if ( numPackets == 0 )
+                break;
+
+            m_socket->SendPackets( numPackets, m_pacedPacketTo + m_pacingQueueHead, m_pacedPacketData + m_pacingQueueHead * m_pacingSlotSize, m_pacingSlotSize, m_pacedPacketBytes + m_pacingQueueHead );
+
+            m_pacingQueueHead = ( m_pacingQueueHead + numPackets ) % m_pacingQueueSize;
+            m_numPacedPackets -= numPackets;
+        }
+    }
+
+    int NetworkTransport::FindRelay( const Address & address ) const
+    {
+        for ( int i = 0; i < m_numRelays; ++i )
+        {
+            if ( m_relays[i] == address )
+                return i;
+        }
+
+        return -1;
+    }
+
+    bool NetworkTransport::SetRelayRoute( const Address & address, int relayIndex, bool learned )
+    {
+        assert( m_relayRouteMap );
+        assert( relayIndex >= 0 );
+        assert( relayIndex < m_numRelays );
+
+        int index = m_relayRouteMap->Find( address );
+
+        if ( index >= 0 )
+        {
+            if ( learned && m_relayRouteTime[index] < 0.0 )
+                return true;
+
+            m_relayRouteRelay[index] = relayIndex;
+            m_relayRouteTime[index] = learned ? m_time : -1.0;
+
+            return true;
+        }
+
+        if ( m_numRelayRoutes == DefaultMaxRelayRoutes )
+        {
+            // IMPORTANT: the table only fills up on busy origin servers, so a linear search for the least recently used learned route is cheap compared to the packets that filled it.
+
+            int oldestIndex = -1;
+
+            for ( int i = 0; i < m_numRelayRoutes; ++i )
+            {
+                if ( m_relayRouteTime[i] >= 0.0 && ( oldestIndex < 0 || m_relayRouteTime[i] < m_relayRouteTime[oldestIndex] ) )
+                    oldestIndex = i;
+            }
+
+            if ( oldestIndex < 0 )
+                return false;
+
+            RemoveRelayRoute( m_relayRouteAddress[oldestIndex] );
+        }
+
+        index = m_numRelayRoutes++;
+
+        m_relayRouteAddress[index] = address;
+        m_relayRouteRelay[index] = relayIndex;
+        m_relayRouteTime[index] = learned ? m_time : -1.0;
+
+        m_relayRouteMap->Insert( address, index );
+
+        return true;
+    }
+
+    bool NetworkTransport::ReadRelayPacket( Address & from, const uint8_t * & packetData, int & packetBytes )
+    {
+        assert( packetData );
+        assert( packetBytes > 0 );
+
+        if ( packetData[0] != RelayPacketPrefix )
+            return true;
+
+        const int relayIndex = FindRelay( from );
+
+        Address address;
+
+        const int headerBytes = ( relayIndex >= 0 ) ? read_relay_header( packetData, packetBytes, address ) : 0;
+
+        if ( !headerBytes )
+        {
+            m_counters[TRANSPORT_COUNTER_RELAY_PACKETS_DROPPED]++;
+            return false;
+        }
+
+        SetRelayRoute( address, relayIndex, true );
+
+        from = address;
+        packetData += headerBytes;
+        packetBytes -= headerBytes;
+
+        return true;
+    }
+
+    void NetworkTransport::ForwardRelayPackets()
+    {
+        assert( m_relayOrigins );
+        assert( m_relayLimiter );
+
+        while ( true )
+        {
+            const int numPackets = InternalReceivePackets( PacketReceiveBatchSize, m_relayAddress, m_relayReceivePacketData, m_relayPacketBufferSize, m_relayPacketBytes, m_relayReceiveTimes );
+
+            // IMPORTANT: packet i is always read before packet numForwardPackets <= i is written, so the address and size arrays are shared between packets received and packets forwarded.
+
+            int numForwardPackets = 0;
+
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                const Address from = m_relayAddress[i];
+                const uint8_t * packetData = m_relayReceivePacketData + i * m_relayPacketBufferSize;
+                const int packetBytes = m_relayPacketBytes[i];
+
+                m_counters[TRANSPORT_COUNTER_PACKETS_READ]++;
+
+                Address to;
+
+                const int headerBytes = read_relay_header( packetData, packetBytes, to );
+
+                const bool fromOrigin = m_relayOrigins->Find( from ) >= 0;
+
+                if ( !headerBytes || ( !fromOrigin && m_relayOrigins->Find( to ) < 0 ) )
+                {
+                    m_counters[TRANSPORT_COUNTER_RELAY_PACKETS_DROPPED]++;
+                    continue;
+                }
+
+                if ( !fromOrigin )
+                {
+                    // IMPORTANT: the port is ignored, so a source can't get a fresh bucket just by changing port.
+
+                    Address source = from;
+                    source.SetPort( 0 );
+
+                    if ( !m_relayLimiter->Consume( source.GetHash(), m_time, m_relayPacketsPerSecond, m_relayPacketBurst ) )
+                    {
+                        m_counters[TRANSPORT_COUNTER_RELAY_PACKETS_RATE_LIMITED]++;
+                        continue;
+                    }
+                }
+
+                uint8_t * forwardPacketData = m_relaySendPacketData + numForwardPackets * m_relayPacketBufferSize;
+
+                const int forwardHeaderBytes = write_relay_header( forwardPacketData, from );
+
+                const int innerBytes = packetBytes - headerBytes;
+
+                if ( forwardHeaderBytes + innerBytes > m_relayPacketBufferSize )
+                {
+                    m_counters[TRANSPORT_COUNTER_RELAY_PACKETS_DROPPED]++;
+                    continue;
+                }
+
+                memcpy( forwardPacketData + forwardHeaderBytes, packetData + headerBytes, innerBytes );
+
+                m_relayAddress[numForwardPackets] = to;
+                m_relayPacketBytes[numForwardPackets] = forwardHeaderBytes + innerBytes;
+                numForwardPackets++;
+            }
+
+            if ( numForwardPackets > 0 )
+            {
+                m_socket->SendPackets( numForwardPackets, m_relayAddress, m_relaySendPacketData, m_relayPacketBufferSize, m_relayPacketBytes );
+
+                m_counters[TRANSPORT_COUNTER_PACKETS_WRITTEN] += numForwardPackets;
+                m_counters[TRANSPORT_COUNTER_RELAY_PACKETS_FORWARDED] += numForwardPackets;
+            }
+
+            if ( numPackets < PacketReceiveBatchSize )
+                break;
+        }
+    }
+
+    bool NetworkTransport::AddEncryptionMapping( const Address & address, const uint8_t * sendKey, const uint8_t * receiveKey, double timeout )
+    {
+        if ( !BaseTransport::AddEncryptionMapping( address, sendKey, receiveKey, timeout ) )
+            return false;
+
+        if ( m_socket->IsFiltering() )
+            m_socket->AddKnownAddress( address );
+
+        return true;
+    }
+
+    bool NetworkTransport::RemoveEncryptionMapping( const Address & address )
+    {
+        if ( m_socket->IsFiltering() )
+            m_socket->RemoveKnownAddress( address );
+
+        if ( m_numRelayRoutes > 0 )
+        {
+            const int index = m_relayRouteMap->Find( address );
+
+            if ( index >= 0 && m_relayRouteTime[index] >= 0.0 )
+                RemoveRelayRoute( address );
+        }
+
+        return BaseTransport::RemoveEncryptionMapping( address );
+    }
+
+    void NetworkTransport::ResetEncryptionMappings()
+    {
+        m_socket->ClearKnownAddresses();
+
+        BaseTransport::ResetEncryptionMappings();
+    }
+
+    void NetworkTransport::ReadPackets()
+    {
+        if ( m_relayOrigins )
+        {
+            ForwardRelayPackets();
+            return;
+        }
+
+        BaseTransport::ReadPackets();
+
+        m_numSendErrors = m_socket->IsReceivingErrors() ? m_socket->ReceiveErrors( MaxSocketErrors, m_sendErrorAddress, m_sendError ) : 0;
+
+        m_counters[TRANSPORT_COUNTER_SEND_ERRORS] += m_numSendErrors;
+
+        if ( !m_socket->IsFiltering() )
+            return;
+
+        for ( int i = 0; i < m_numAddressMigrations; ++i )
+        {
+            m_socket->RemoveKnownAddress( m_addressMigrationFrom[i] );
+            m_socket->AddKnownAddress( m_addressMigrationTo[i] );
+        }
+    }
+
+    void NetworkTransport::InternalSendPacket( const Address & to, const void * packetData, int packetBytes )
+    {
+        const int index = ( m_numRelayRoutes > 0 ) ? m_relayRouteMap->Find( to ) : -1;
+
+        if ( index < 0 )
+        {
+            m_socket->SendPacket( to, packetData, packetBytes );
+            return;
+        }
+
+        assert( packetBytes + MaxRelayHeaderBytes <= m_relayPacketBufferSize );
+
+        const int headerBytes = write_relay_header( m_relaySendPacketData, to );
+
+        memcpy( m_relaySendPacketData + headerBytes, packetData, packetBytes );
+
+        m_socket->SendPacket( m_relays[m_relayRouteRelay[index]], m_relaySendPacketData, headerBytes + packetBytes );
+    }
+
+    void NetworkTransport::InternalSendPackets( int numPackets, const Address * to, const uint8_t * packetData, int maxPacketSize, const int * packetBytes )
+    {
+        if ( m_numRelayRoutes > 0 )
+        {
+            BaseTransport::InternalSendPackets( numPackets, to, packetData, maxPacketSize, packetBytes );
+            return;
+        }
+
+        if ( m_pacingInterval <= 0.0 )
+        {
+            m_socket->SendPackets( numPackets, to, packetData, maxPacketSize, packetBytes );
+            return;
+        }
+
+        if ( !m_kernelPacing )
+        {
+            QueuePacedPackets( numPackets, to, packetData, maxPacketSize, packetBytes );
+            SendPacedPacketsDue( platform_time() );
+            return;
+        }
+
+        for ( int firstPacket = 0; firstPacket < numPackets; firstPacket += PacketSendBatchSize )
+        {
+            const int batchPackets = min( numPackets - firstPacket, PacketSendBatchSize );
+
+            const double time = platform_time();
+
+            for ( int i = 0; i < batchPackets; ++i )
+            {
+                m_pacingDelays[i] = float( m_pacingStartTime + m_pacingIndex * m_pacingGap - time );
+                m_pacingIndex++;
+            }
+
+            m_socket->SendPackets( batchPackets, to + firstPacket, packetData + firstPacket * maxPacketSize, maxPacketSize, packetBytes + firstPacket, m_pacingDelays );
+        }
+    }
+
+    int NetworkTransport::InternalReceivePacket( Address & from, void * packetData, int maxPacketSize )
+    {
+        if ( m_numRelays > 0 )
+        {
+            int packetBytes = 0;
+            double receiveTime = 0.0;
+
+            if ( InternalReceivePackets( 1, &from, (uint8_t*) packetData, maxPacketSize, &packetBytes, &receiveTime ) == 0 )
+                return 0;
+
+            return packetBytes;
+        }
+
+        return m_socket->ReceivePacket( from, packetData, maxPacketSize );
+    }
+
+    int NetworkTransport::InternalReceivePackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes )
+    {
+        if ( m_numRelays == 0 || m_relayOrigins )
+            return m_socket->ReceivePackets( maxPackets, from, packetData, maxPacketSize, packetBytes, receiveTimes );
+
+        // IMPORTANT: relayed packets are larger than the packets inside them, so they are read into the relay receive buffer and copied out once their relay header is removed.
+
+        int numPackets = 0;
+
+        while ( numPackets < maxPackets )
+        {
+            const int numRead = min( maxPackets - numPackets, PacketReceiveBatchSize );
+
+            const int numReceived = m_socket->ReceivePackets( numRead, m_relayAddress, m_relayReceivePacketData, m_relayPacketBufferSize, m_relayPacketBytes, m_relayReceiveTimes );
+
+            for ( int i = 0; i < numReceived; ++i )
+            {
+                Address address = m_relayAddress[i];
+                const uint8_t * data = m_relayReceivePacketData + i * m_relayPacketBufferSize;
+                int bytes = m_relayPacketBytes[i];
+
+                if ( !ReadRelayPacket( address, data, bytes ) || bytes > maxPacketSize )
+                    continue;
+
+                from[numPackets] = address;
+                memcpy( packetData + numPackets * maxPacketSize, data, bytes );
+                packetBytes[numPackets] = bytes;
+                if ( receiveTimes )
+                    receiveTimes[numPackets] = m_relayReceiveTimes[i];
+                numPackets++;
+            }
+
+            if ( numReceived < numRead )
+                break;
+        }
+
+        return numPackets;
+    }
+
+    bool NetworkTransport::InternalWaitForPacket( double timeout )
+    {
+        if ( m_socket->IsError() )
+            return BaseTransport::InternalWaitForPacket( timeout );
+
+        if ( m_numPacedPackets == 0 )
+            return m_socket->WaitForPackets( timeout );
+
+        // IMPORTANT: While packets are held for pacing, the wait is cut short at each departure time so held packets are sent as they come due.
+
+        double time = platform_time();
+
+        const double finishTime = time + timeout;
+
+        while ( true )
+        {
+            SendPacedPacketsDue( time );
+
+            double waitTime = finishTime - time;
+
+            if ( m_numPacedPackets > 0 )
+                waitTime = min( waitTime, m_pacedPacketTime[m_pacingQueueHead] - time );
+
+            if ( m_socket->WaitForPackets( max( waitTime, 0.0 ) ) )
+                return true;
+
+            time = platform_time();
+
+            if ( time >= finishTime )
+            {
+                SendPacedPacketsDue( time );
+                return false;
+            }
+        }
+    }
+
+    // =====================================================
+
+    ThreadedNetworkTransport::ThreadedNetworkTransport( Allocator & allocator, 
+                                                        const Address & address,
+                                                        uint64_t protocolId,
+                                                        double time,
+                                                        int maxPacketSize, 
+                                                        int sendQueueSize, 
+                                                        int receiveQueueSize,
+                                                        int socketSendBufferSize,
+                                                        int socketReceiveBufferSize,
+                                                        bool allocateNetworkSimulator,
+                                                        int receiveRingSize,
+                                                        int socketFlags )
+        : NetworkTransport( allocator, 
+                            address,
+                            protocolId,
+                            time,
+                            maxPacketSize,
+                            sendQueueSize,
+                            receiveQueueSize,
+                            socketSendBufferSize,
+                            socketReceiveBufferSize,
+                            allocateNetworkSimulator,
+                            socketFlags )
+    {
+        assert( receiveRingSize > 1 );
+
+        m_thread = NULL;
+        m_quit = 0;
+        m_ringSize = receiveRingSize;
+        m_packetBufferSize = m_relayPacketBufferSize;
+        m_ringReadIndex = 0;
+        m_ringWriteIndex = 0;
+
+        // IMPORTANT: packet slots in the ring have room for a relay header in front of a packet of maximum size, so relayed packets are read whole. The header is removed as packets are taken off the ring.
+
+        m_ringPacketData = (uint8_t*) YOJIMBO_ALLOCATE( allocator, m_ringSize * m_packetBufferSize );
+        m_ringPacketBytes = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * m_ringSize );
+        m_ringFrom = (Address*) YOJIMBO_ALLOCATE( allocator, sizeof( Address ) * m_ringSize );
+        m_ringReceiveTime = (double*) YOJIMBO_ALLOCATE( allocator, sizeof( double ) * m_ringSize );
+
+        for ( int i = 0; i < m_ringSize; ++i )
+            new ( &m_ringFrom[i] ) Address();
+
+        if ( !m_socket->IsError() )
+        {
+            m_thread = platform_thread_create( allocator, ReceiveThreadFunction, this );
+
+            if ( !m_thread )
+                debug_printf( "failed to create receive thread\n" );
+        }
+    }
+
+    bool ThreadedNetworkTransport::SetReceiveThreadAffinity( int cpu )
+    {
+        assert( cpu >= 0 );
+
+        if ( !m_thread || !platform_thread_set_affinity( m_thread, cpu ) )
+            return false;
+
+        const int node = platform_cpu_numa_node( cpu );
+
+        if ( node >= 0 && !platform_memory_set_numa_node( m_ringPacketData, size_t( m_ringSize ) * m_packetBufferSize, node ) )
+            debug_printf( "threaded network transport could not place receive ring on numa node %d\n", node );
+
+        return true;
+    }
+
+    ThreadedNetworkTransport::~ThreadedNetworkTransport()
+    {
+        assert( m_allocator );
+
+        if ( m_thread )
+        {
+            atomic_store( &m_quit, 1 );
+            platform_thread_join( *m_allocator, m_thread );
+            m_thread = NULL;
+        }
+
+        for ( int i = 0; i < m_ringSize; ++i )
+            m_ringFrom[i].~Address();
+
+        YOJIMBO_FREE( *m_allocator, m_ringPacketData );
+        YOJIMBO_FREE( *m_allocator, m_ringPacketBytes );
+        YOJIMBO_FREE( *m_allocator, m_ringFrom );
+        YOJIMBO_FREE( *m_allocator, m_ringReceiveTime );
+    }
+
+    void ThreadedNetworkTransport::Reset()
+    {
+        NetworkTransport::Reset();
+
+        atomic_store( &m_ringReadIndex, atomic_load( &m_ringWriteIndex ) );
+    }
+
+    bool ThreadedNetworkTransport::IsReceiveThreadRunning() const
+    {
+        return m_thread != NULL;
+    }
+
+    int ThreadedNetworkTransport::InternalReceivePacket( Address & from, void * packetData, int maxPacketSize )
+    {
+        int packetBytes = 0;
+        double receiveTime = 0.0;
+
+        if ( InternalReceivePackets( 1, &from, (uint8_t*) packetData, maxPacketSize, &packetBytes, &receiveTime ) == 0 )
+            return 0;
+
+        return packetBytes;
+    }
+
+    int ThreadedNetworkTransport::InternalReceivePackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes )
+    {
+        if ( !m_thread )
+            return NetworkTransport::InternalReceivePackets( maxPackets, from, packetData, maxPacketSize, packetBytes, receiveTimes );
+
+        const int writeIndex = atomic_load( &m_ringWriteIndex );
+
+        int readIndex = m_ringReadIndex;
+
+        int numPackets = 0;
+
+        while ( numPackets < maxPackets && readIndex != writeIndex )
+        {
+            Address address = m_ringFrom[readIndex];
+            const uint8_t * data = m_ringPacketData + readIndex * m_packetBufferSize;
+            int bytes = m_ringPacketBytes[readIndex];
+
+            assert( bytes > 0 );
+            assert( bytes <= m_packetBufferSize );
+
+            if ( ( m_numRelays == 0 || m_relayOrigins || ReadRelayPacket( address, data, bytes ) ) && bytes <= maxPacketSize )
+            {
+                from[numPackets] = address;
+                memcpy( packetData + numPackets * maxPacketSize, data, bytes );
+                packetBytes[numPackets] = bytes;
+                receiveTimes[numPackets] = m_ringReceiveTime[readIndex];
+                numPackets++;
+            }
+
+            readIndex = ( readIndex + 1 ) % m_ringSize;
+        }
+
+        atomic_store( &m_ringReadIndex, readIndex );
+
+        return numPackets;
+    }
+
+    bool ThreadedNetworkTransport::InternalWaitForPacket( double timeout )
+    {
+        if ( !m_thread )
+            return NetworkTransport::InternalWaitForPacket( timeout );
+
+        // IMPORTANT: The receive thread is the only thing blocking on the socket, so poll the receive ring in short sleeps until it has packets or the timeout elapses.
+
+        const double finishTime = platform_time() + timeout;
+
+        while ( true )
+        {
+            SendPacedPackets();
+
+            if ( m_ringReadIndex != atomic_load( &m_ringWriteIndex ) )
+                return true;
+
+            const double timeRemaining = finishTime - platform_time();
+
+            if ( timeRemaining <= 0.0 )
+                return false;
+
+            platform_sleep( min( timeRemaining, 0.001 ) );
+        }
+    }
+
+    void ThreadedNetworkTransport::ReceiveThreadFunction( void * data )
+    {
+        ThreadedNetworkTransport * transport = (ThreadedNetworkTransport*) data;
+        transport->ReceiveThread();
+    }
+
+    void ThreadedNetworkTransport::ReceiveThread()
+    {
+        int writeIndex = m_ringWriteIndex;
+
+        while ( !atomic_load( &m_quit ) )
+        {
+            const int readIndex = atomic_load( &m_ringReadIndex );
+
+            // number of free slots we can receive into without wrapping around. one slot is always left empty, so a full ring can be told apart from an empty one.
+
+            const int numFreeSlots = ( readIndex > writeIndex ) ? ( readIndex - writeIndex - 1 ) : ( m_ringSize - writeIndex - ( readIndex == 0 ? 1 : 0 ) );
+
+            if ( numFreeSlots == 0 )
+            {
+                platform_sleep( 0.001 );
+                continue;
+            }
+
+            const int maxPackets = min( numFreeSlots, PacketReceiveBatchSize );
+
+            const int numPackets = m_socket->ReceivePackets( maxPackets, &m_ringFrom[writeIndex], m_ringPacketData + writeIndex * m_packetBufferSize, m_packetBufferSize, &m_ringPacketBytes[writeIndex], &m_ringReceiveTime[writeIndex] );
+
+            assert( numPackets >= 0 );
+            assert( numPackets <= maxPackets );
+
+            if ( numPackets == 0 )
+            {
+                // IMPORTANT: wake up regularly even if no packets arrive, so the thread exits promptly when the transport is destroyed.
+
+                m_socket->WaitForPackets( 0.01 );
+                continue;
+            }
+
+            writeIndex = ( writeIndex + numPackets ) % m_ringSize;
+
+            atomic_store( &m_ringWriteIndex, writeIndex );
+        }
     }
 
-    void BaseTransport::DisablePacketEncryption()
+    // =====================================================
+
+    PacketQueueTransport::PacketQueueTransport( Allocator & allocator, const Address & address, uint64_t protocolId, double time, int maxPacketSize, int sendQueueSize, int receiveQueueSize )
+        : BaseTransport( allocator, address, protocolId, time, maxPacketSize, sendQueueSize, receiveQueueSize, false )
     {
-        assert( m_context.packetFactory );
-        memset( m_packetTypeIsEncrypted, 0, m_context.packetFactory->GetNumPacketTypes() );
-        memset( m_packetTypeIsUnencrypted, 1, m_context.packetFactory->GetNumPacketTypes() );
+        m_receiveQueueSize = receiveQueueSize;
+        m_receiveQueueHead = 0;
+        m_numReceivePackets = 0;
+        m_receivePacketData = (uint8_t**) YOJIMBO_ALLOCATE( allocator, sizeof( uint8_t* ) * m_receiveQueueSize );
+        m_receivePacketBytes = (int*) YOJIMBO_ALLOCATE( allocator, sizeof( int ) * m_receiveQueueSize );
+        m_receiveFrom = (Address*) YOJIMBO_ALLOCATE( allocator, sizeof( Address ) * m_receiveQueueSize );
+        m_receiveTimes = (double*) YOJIMBO_ALLOCATE( allocator, sizeof( double ) * m_receiveQueueSize );
+
+        for ( int i = 0; i < m_receiveQueueSize; ++i )
+            new ( &m_receiveFrom[i] ) Address();
     }
 
-    void BaseTransport::DisableEncryptionForPacketType( int type )
+    PacketQueueTransport::~PacketQueueTransport()
     {
-        assert( m_context.packetFactory );
-        assert( type >= 0 );
-        assert( type < m_context.packetFactory->GetNumPacketTypes() );
-        m_packetTypeIsEncrypted[type] = 0;
-        m_packetTypeIsUnencrypted[type] = 1;
+        assert( m_allocator );
+
+        DiscardReceivePackets();
+
+        for ( int i = 0; i < m_receiveQueueSize; ++i )
+            m_receiveFrom[i].~Address();
+
+        YOJIMBO_FREE( *m_allocator, m_receivePacketData );
+        YOJIMBO_FREE( *m_allocator, m_receivePacketBytes );
+        YOJIMBO_FREE( *m_allocator, m_receiveFrom );
+        YOJIMBO_FREE( *m_allocator, m_receiveTimes );
+    }
+
+    bool PacketQueueTransport::QueueReceivedPacket( const Address & from, const uint8_t * packetData, int packetBytes, double receiveTime )
+    {
+        assert( packetData );
+        assert( packetBytes > 0 );
+
+        if ( m_numReceivePackets == m_receiveQueueSize )
+            return false;
+
+        uint8_t * packetDataCopy = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, packetBytes );
+        if ( !packetDataCopy )
+            return false;
+
+        memcpy( packetDataCopy, packetData, packetBytes );
+
+        const int index = ( m_receiveQueueHead + m_numReceivePackets ) % m_receiveQueueSize;
+
+        m_receivePacketData[index] = packetDataCopy;
+        m_receivePacketBytes[index] = packetBytes;
+        m_receiveFrom[index] = from;
+        m_receiveTimes[index] = receiveTime;
+
+        m_numReceivePackets++;
+
+        return true;
+    }
+
+    void PacketQueueTransport::DiscardReceivePackets()
+    {
+        for ( int i = 0; i < m_numReceivePackets; ++i )
+        {
+            const int index = ( m_receiveQueueHead + i ) % m_receiveQueueSize;
+            YOJIMBO_FREE( *m_allocator, m_receivePacketData[index] );
+        }
+
+        m_receiveQueueHead = 0;
+        m_numReceivePackets = 0;
+    }
+
+    int PacketQueueTransport::InternalReceivePacket( Address & from, void * packetData, int maxPacketSize )
+    {
+        if ( m_numReceivePackets == 0 )
+            return 0;
+
+        const int index = m_receiveQueueHead;
+
+        const int packetBytes = m_receivePacketBytes[index];
+
+        assert( m_receivePacketData[index] );
+        assert( packetBytes > 0 );
+
+        // IMPORTANT: packets larger than the buffer are discarded, just like a socket would.
+
+        if ( packetBytes <= maxPacketSize )
+            memcpy( packetData, m_receivePacketData[index], packetBytes );
+
+        YOJIMBO_FREE( *m_allocator, m_receivePacketData[index] );
+
+        from = m_receiveFrom[index];
+
+        m_receiveQueueHead = ( m_receiveQueueHead + 1 ) % m_receiveQueueSize;
+        m_numReceivePackets--;
+
+        return ( packetBytes <= maxPacketSize ) ? packetBytes : 0;
+    }
+
+    int PacketQueueTransport::InternalReceivePackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes )
+    {
+        int numPackets = 0;
+
+        while ( numPackets < maxPackets && m_numReceivePackets > 0 )
+        {
+            const double receiveTime = m_receiveTimes[m_receiveQueueHead];
+
+            const int bytesRead = InternalReceivePacket( from[numPackets], packetData + numPackets * maxPacketSize, maxPacketSize );
+            if ( !bytesRead )
+                continue;
+
+            packetBytes[numPackets] = bytesRead;
+            receiveTimes[numPackets] = receiveTime;
+            numPackets++;
+        }
+
+        return numPackets;
+    }
+
+    // =====================================================
+
+    ClientSocketPool::ClientSocketPool( Allocator & allocator, 
+                                        const Address & address, 
+                                        int numSockets, 
+                                        int maxRoutes, 
+                                        int socketSendBufferSize, 
+                                        int socketReceiveBufferSize, 
+                                        int socketFlags )
+    {
+        assert( address.IsValid() );
+        assert( numSockets > 0 );
+        assert( maxRoutes > 0 );
+
+        m_allocator = &allocator;
+        m_numSockets = numSockets;
+        m_maxRoutes = maxRoutes;
+        m_numRoutes = 0;
+        m_numTransports = 0;
+        m_packetBufferSize = 0;
+        m_receivePacketData = NULL;
+        m_numUnroutedPackets = 0;
+        m_numDroppedPackets = 0;
+
+        m_sockets = (Socket**) YOJIMBO_ALLOCATE( allocator, sizeof( Socket* ) * m_numSockets );
+        m_socketRoutes = (AddressMap**) YOJIMBO_ALLOCATE( allocator, sizeof( AddressMap* ) * m_numSockets );
+
+        for ( int i = 0; i < m_numSockets; ++i )
+        {
+            Address socketAddress = address;
+            if ( address.GetPort() != 0 )
+                socketAddress.SetPort( address.GetPort() + i );
+
+            m_sockets[i] = YOJIMBO_NEW( allocator, Socket, socketAddress, socketSendBufferSize, socketReceiveBufferSize, socketFlags );
+
+            // IMPORTANT: every route could be on the same socket, eg. when all transports connect to different servers.
+
+            m_socketRoutes[i] = YOJIMBO_NEW( allocator, AddressMap, allocator, m_maxRoutes );
+        }
+
+        m_routes = (Route*) YOJIMBO_ALLOCATE( allocator, sizeof( Route ) * m_maxRoutes );
+
+        for ( int i = 0; i < m_maxRoutes; ++i )
+        {
+            new ( &m_routes[i] ) Route();
+            m_routes[i].transport = NULL;
+            m_routes[i].socketIndex = -1;
+            m_routes[i].nextFree = ( i + 1 < m_maxRoutes ) ? i + 1 : -1;
+        }
+
+        m_firstFreeRoute = 0;
+    }
+
+    ClientSocketPool::~ClientSocketPool()
+    {
+        assert( m_allocator );
+        assert( m_numTransports == 0 );
+        assert( m_numRoutes == 0 );
+
+        for ( int i = 0; i < m_numSockets; ++i )
+        {
+            YOJIMBO_DELETE( *m_allocator, Socket, m_sockets[i] );
+            YOJIMBO_DELETE( *m_allocator, AddressMap, m_socketRoutes[i] );
+        }
+
+        for ( int i = 0; i < m_maxRoutes; ++i )
+            m_routes[i].~Route();
+
+        YOJIMBO_FREE( *m_allocator, m_sockets );
+        YOJIMBO_FREE( *m_allocator, m_socketRoutes );
+        YOJIMBO_FREE( *m_allocator, m_routes );
+        YOJIMBO_FREE( *m_allocator, m_receivePacketData );
+    }
+
+    bool ClientSocketPool::IsError() const
+    {
+        for ( int i = 0; i < m_numSockets; ++i )
+        {
+            if ( m_sockets[i]->IsError() )
+                return true;
+        }
+
+        return false;
+    }
+
+    int ClientSocketPool::GetNumSockets() const
+    {
+        return m_numSockets;
+    }
+
+    const Address & ClientSocketPool::GetSocketAddress( int index ) const
+    {
+        assert( index >= 0 );
+        assert( index < m_numSockets );
+        return m_sockets[index]->GetAddress();
+    }
+
+    void ClientSocketPool::ReceivePackets()
+    {
+        if ( !m_receivePacketData )
+            return;
+
+        for ( int i = 0; i < m_numSockets; ++i )
+        {
+            Socket * socket = m_sockets[i];
+
+            if ( socket->IsError() )
+                continue;
+
+            while ( true )
+            {
+                const int numPackets = socket->ReceivePackets( PacketReceiveBatchSize, m_receiveFrom, m_receivePacketData, m_packetBufferSize, m_receivePacketBytes, m_receiveTimes );
+
+                assert( numPackets >= 0 );
+                assert( numPackets <= PacketReceiveBatchSize );
+
+                for ( int j = 0; j < numPackets; ++j )
+                {
+                    const int routeIndex = m_socketRoutes[i]->Find( m_receiveFrom[j] );
+
+                    if ( routeIndex < 0 )
+                    {
+                        m_numUnroutedPackets++;
+                        continue;
+                    }
+
+                    assert( routeIndex < m_maxRoutes );
+                    assert( m_routes[routeIndex].transport );
+                    assert( m_routes[routeIndex].socketIndex == i );
+
+                    if ( !m_routes[routeIndex].transport->QueueReceivedPacket( m_receiveFrom[j], m_receivePacketData + j * m_packetBufferSize, m_receivePacketBytes[j], m_receiveTimes[j] ) )
+                        m_numDroppedPackets++;
+                }
+
+                if ( numPackets < PacketReceiveBatchSize )
+                    break;
+            }
+        }
+    }
+
+    int ClientSocketPool::GetNumRoutes() const
+    {
+        return m_numRoutes;
+    }
+
+    uint64_t ClientSocketPool::GetNumUnroutedPackets() const
+    {
+        return m_numUnroutedPackets;
+    }
+
+    uint64_t ClientSocketPool::GetNumDroppedPackets() const
+    {
+        return m_numDroppedPackets;
+    }
+
+    void ClientSocketPool::AddTransport( int packetBufferSize )
+    {
+        assert( packetBufferSize > 0 );
+
+        m_numTransports++;
+
+        if ( packetBufferSize <= m_packetBufferSize )
+            return;
+
+        YOJIMBO_FREE( *m_allocator, m_receivePacketData );
+
+        m_packetBufferSize = packetBufferSize;
+
+        m_receivePacketData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, PacketReceiveBatchSize * m_packetBufferSize );
+    }
+
+    void ClientSocketPool::RemoveTransport()
+    {
+        assert( m_numTransports > 0 );
+        m_numTransports--;
+    }
+
+    int ClientSocketPool::AddRoute( PooledNetworkTransport * transport, const Address & address )
+    {
+        assert( transport );
+        assert( address.IsValid() );
+
+        if ( m_firstFreeRoute < 0 )
+            return -1;
+
+        for ( int i = 0; i < m_numSockets; ++i )
+        {
+            if ( m_sockets[i]->IsError() || m_socketRoutes[i]->Find( address ) >= 0 )
+                continue;
+
+            const int routeIndex = m_firstFreeRoute;
+
+            Route & route = m_routes[routeIndex];
+
+            assert( route.transport == NULL );
+
+            if ( !m_socketRoutes[i]->Insert( address, routeIndex ) )
+                return -1;
+
+            m_firstFreeRoute = route.nextFree;
+
+            route.address = address;
+            route.transport = transport;
+            route.socketIndex = i;
+            route.nextFree = -1;
+
+            m_numRoutes++;
+
+            return routeIndex;
+        }
+
+        return -1;
+    }
+
+    void ClientSocketPool::RemoveRoute( int routeIndex )
+    {
+        assert( routeIndex >= 0 );
+        assert( routeIndex < m_maxRoutes );
+
+        Route & route = m_routes[routeIndex];
+
+        assert( route.transport );
+        assert( route.socketIndex >= 0 );
+        assert( route.socketIndex < m_numSockets );
+
+        m_socketRoutes[route.socketIndex]->Remove( route.address );
+
+        route.address = Address();
+        route.transport = NULL;
+        route.socketIndex = -1;
+        route.nextFree = m_firstFreeRoute;
+
+        m_firstFreeRoute = routeIndex;
+
+        assert( m_numRoutes > 0 );
+        m_numRoutes--;
     }
 
-    bool BaseTransport::IsEncryptedPacketType( int type ) const
-    {
-        assert( m_context.packetFactory );
-        assert( type >= 0 );
-        assert( type < m_context.packetFactory->GetNumPacketTypes() );
-        return m_packetTypeIsEncrypted[type] != 0;
+    void ClientSocketPool::SendPacket( int routeIndex, const void * packetData, int packetBytes )
+    {
+        assert( routeIndex >= 0 );
+        assert( routeIndex < m_maxRoutes );
+
+        const Route & route = m_routes[routeIndex];
+
+        assert( route.transport );
+
+        m_sockets[route.socketIndex]->SendPacket( route.address, packetData, packetBytes );
+    }
+
+    void ClientSocketPool::DropPacket()
+    {
+        m_numDroppedPackets++;
+    }
+
+    // =====================================================
+
+    PooledNetworkTransport::PooledNetworkTransport( Allocator & allocator, ClientSocketPool & socketPool, uint64_t protocolId, double time, int maxPacketSize, int sendQueueSize, int receiveQueueSize )
+        : PacketQueueTransport( allocator, socketPool.GetSocketAddress( 0 ), protocolId, time, maxPacketSize, sendQueueSize, receiveQueueSize )
+    {
+        m_socketPool = &socketPool;
+        m_numRoutes = 0;
+
+        for ( int i = 0; i < MaxServersPerConnect; ++i )
+            m_routes[i] = -1;
+
+        m_socketPool->AddTransport( m_packetProcessor->GetMaxPacketBufferSize() );
+    }
+
+    PooledNetworkTransport::~PooledNetworkTransport()
+    {
+        assert( m_allocator );
+        assert( m_socketPool );
+
+        RemoveRoutes();
+
+        m_socketPool->RemoveTransport();
+
+        m_socketPool = NULL;
+    }
+
+    void PooledNetworkTransport::Reset()
+    {
+        RemoveRoutes();
+
+        DiscardReceivePackets();
+
+        BaseTransport::Reset();
+    }
+
+    Address PooledNetworkTransport::GetRouteAddress( const Address & address ) const
+    {
+        const int index = FindRoute( address );
+        if ( index < 0 )
+            return Address();
+
+        return m_socketPool->GetSocketAddress( m_socketPool->m_routes[m_routes[index]].socketIndex );
+    }
+
+    void PooledNetworkTransport::RemoveRoutes()
+    {
+        for ( int i = 0; i < m_numRoutes; ++i )
+        {
+            m_socketPool->RemoveRoute( m_routes[i] );
+            m_routes[i] = -1;
+            m_routeAddresses[i] = Address();
+        }
+
+        m_numRoutes = 0;
+    }
+
+    int PooledNetworkTransport::FindRoute( const Address & address ) const
+    {
+        for ( int i = 0; i < m_numRoutes; ++i )
+        {
+            if ( m_routeAddresses[i] == address )
+                return i;
+        }
+
+        return -1;
+    }
+
+    void PooledNetworkTransport::InternalSendPacket( const Address & to, const void * packetData, int packetBytes )
+    {
+        assert( m_socketPool );
+
+        int index = FindRoute( to );
+
+        if ( index < 0 )
+        {
+            if ( m_numRoutes == MaxServersPerConnect )
+            {
+                m_socketPool->RemoveRoute( m_routes[0] );
+
+                for ( int i = 1; i < m_numRoutes; ++i )
+                {
+                    m_routes[i-1] = m_routes[i];
+                    m_routeAddresses[i-1] = m_routeAddresses[i];
+                }
+
+                m_numRoutes--;
+            }
+
+            const int routeIndex = m_socketPool->AddRoute( this, to );
+
+            if ( routeIndex < 0 )
+            {
+                m_socketPool->DropPacket();
+                return;
+            }
+
+            index = m_numRoutes++;
+
+            m_routes[index] = routeIndex;
+            m_routeAddresses[index] = to;
+        }
+
+        m_socketPool->SendPacket( m_routes[index], packetData, packetBytes );
     }
 
-    bool BaseTransport::AddEncryptionMapping( const Address & address, const uint8_t * sendKey, const uint8_t * receiveKey, double timeout )
-    {
-        return m_encryptionManager->AddEncryptionMapping( address, sendKey, receiveKey, GetTime(), timeout );
-    }
+    // =====================================================
 
-    bool BaseTransport::RemoveEncryptionMapping( const Address & address )
+    SharedServerSocket::SharedServerSocket( Allocator & allocator, 
+                                            const Address & address, 
+                                            int maxTransports, 
+                                            int maxClients, 
+                                            double routeTimeout, 
+                                            int socketSendBufferSize, 
+                                            int socketReceiveBufferSize, 
+                                            int socketFlags )
     {
-        return m_encryptionManager->RemoveEncryptionMapping( address, GetTime() );
-    }
+        assert( address.IsValid() );
+        assert( maxTransports > 0 );
+        assert( maxClients > 0 );
+        assert( routeTimeout > 0.0 );
 
-    int BaseTransport::FindEncryptionMapping( const Address & address )
-    {
-        return m_encryptionManager->FindEncryptionMapping( address, GetTime() );
-    }
+        m_allocator = &allocator;
+        m_socket = YOJIMBO_NEW( allocator, Socket, address, socketSendBufferSize, socketReceiveBufferSize, socketFlags );
+        m_maxTransports = maxTransports;
+        m_numTransports = 0;
+        m_transports = (SharedServerTransport**) YOJIMBO_ALLOCATE( allocator, sizeof( SharedServerTransport* ) * m_maxTransports );
+        m_maxRoutes = maxClients;
+        m_numRoutes = 0;
+        m_routeTimeout = routeTimeout;
+        m_routeMap = YOJIMBO_NEW( allocator, AddressMap, allocator, m_maxRoutes );
+        m_routes = (Route*) YOJIMBO_ALLOCATE( allocator, sizeof( Route ) * m_maxRoutes );
+        m_packetBufferSize = 0;
+        m_receivePacketData = NULL;
+        m_numDroppedPackets = 0;
+
+        for ( int i = 0; i < m_maxTransports; ++i )
+            m_transports[i] = NULL;
+
+        for ( int i = 0; i < m_maxRoutes; ++i )
+        {
+            new ( &m_routes[i] ) Route();
+            m_routes[i].transport = NULL;
+            m_routes[i].lastReceiveTime = 0.0;
+            m_routes[i].nextFree = ( i + 1 < m_maxRoutes ) ? i + 1 : -1;
+        }
 
-    void BaseTransport::ResetEncryptionMappings()
-    {
-        m_encryptionManager->ResetEncryptionMappings();
+        m_firstFreeRoute = 0;
     }
 
-    bool BaseTransport::AddContextMapping( const Address & address, const TransportContext & context )
+    SharedServerSocket::~SharedServerSocket()
     {
-        assert( context.allocator );
-        assert( context.packetFactory );
+        assert( m_allocator );
+        assert( m_numTransports == 0 );
+        assert( m_numRoutes == 0 );
 
-        assert( m_context.packetFactory );
-        assert( m_context.packetFactory->GetNumPacketTypes() == context.packetFactory->GetNumPacketTypes() );
+        for ( int i = 0; i < m_maxRoutes; ++i )
+            m_routes[i].~Route();
 
-        return m_contextManager->AddContextMapping( address, context );
+        YOJIMBO_DELETE( *m_allocator, Socket, m_socket );
+        YOJIMBO_DELETE( *m_allocator, AddressMap, m_routeMap );
+
+        YOJIMBO_FREE( *m_allocator, m_transports );
+        YOJIMBO_FREE( *m_allocator, m_routes );
+        YOJIMBO_FREE( *m_allocator, m_receivePacketData );
     }
 
-    bool BaseTransport::RemoveContextMapping( const Address & address )
+    bool SharedServerSocket::IsError() const
     {
-        return m_contextManager->RemoveContextMapping( address );
+        return m_socket->IsError();
     }
 
-    void BaseTransport::ResetContextMappings()
+    const Address & SharedServerSocket::GetAddress() const
     {
-        m_contextManager->ResetContextMappings();
+        return m_socket->GetAddress();
     }
 
-    void BaseTransport::AdvanceTime( double time )
+    void SharedServerSocket::ReceivePackets( double time )
     {
-        m_time = time;
-     
-        if ( m_networkSimulator )
+        UpdateRoutes( time );
+
+        if ( !m_receivePacketData || m_socket->IsError() )
+            return;
+
+        while ( true )
         {
-            m_networkSimulator->AdvanceTime( time );
-        }
-    }
+            const int numPackets = m_socket->ReceivePackets( PacketReceiveBatchSize, m_receiveFrom, m_receivePacketData, m_packetBufferSize, m_receivePacketBytes, m_receiveTimes );
 
-    double BaseTransport::GetTime() const
-    {
-        return m_time;
-    }
+            assert( numPackets >= 0 );
+            assert( numPackets <= PacketReceiveBatchSize );
 
-    uint64_t BaseTransport::GetCounter( int index ) const
-    {
-        assert( index >= 0 );
-        assert( index < TRANSPORT_COUNTER_NUM_COUNTERS );
-        return m_counters[index];
-    }
+            for ( int i = 0; i < numPackets; ++i )
+            {
+                const uint8_t * packetData = m_receivePacketData + i * m_packetBufferSize;
 
-    void BaseTransport::ResetCounters()
-    {
-        memset( m_counters, 0, sizeof( m_counters ) );
-    }
+                const int routeIndex = m_routeMap->Find( m_receiveFrom[i] );
 
-    void BaseTransport::SetFlags( uint64_t flags )
-    {
-        m_flags = flags;
+                if ( routeIndex >= 0 )
+                {
+                    Route & route = m_routes[routeIndex];
+
+                    assert( route.transport );
+
+                    route.lastReceiveTime = time;
+
+                    if ( !route.transport->QueueReceivedPacket( m_receiveFrom[i], packetData, m_receivePacketBytes[i], m_receiveTimes[i] ) )
+                        m_numDroppedPackets++;
+
+                    continue;
+                }
+
+                // IMPORTANT: packets from addresses without a route go to every transport. Only the server the connect token is for replies, and claims the route.
+
+                for ( int j = 0; j < m_numTransports; ++j )
+                {
+                    if ( !m_transports[j]->QueueReceivedPacket( m_receiveFrom[i], packetData, m_receivePacketBytes[i], m_receiveTimes[i] ) )
+                        m_numDroppedPackets++;
+                }
+            }
+
+            if ( numPackets < PacketReceiveBatchSize )
+                break;
+        }
     }
 
-    uint64_t BaseTransport::GetFlags() const
+    int SharedServerSocket::GetNumRoutes() const
     {
-        return m_flags;
+        return m_numRoutes;
     }
 
-    const Address & BaseTransport::GetAddress() const
+    uint64_t SharedServerSocket::GetNumDroppedPackets() const
     {
-        return m_address;
+        return m_numDroppedPackets;
     }
 
-    uint64_t BaseTransport::GetProtocolId() const
+    bool SharedServerSocket::AddTransport( SharedServerTransport * transport )
     {
-        return m_protocolId;
-    }
+        assert( transport );
 
-    // =====================================================
+        if ( m_numTransports == m_maxTransports )
+            return false;
 
-    LocalTransport::LocalTransport( Allocator & allocator, NetworkSimulator & networkSimulator, const Address & address, uint64_t protocolId, double time, int maxPacketSize, int sendQueueSize, int receiveQueueSize )
-        : BaseTransport( allocator, address, protocolId, time, maxPacketSize, sendQueueSize, receiveQueueSize, false ) 
-    { 
-        m_networkSimulator = &networkSimulator;
+        m_transports[m_numTransports++] = transport;
 
-        m_receivePacketIndex = 0;
-        m_numReceivePackets = 0;
-        m_maxReceivePackets = receiveQueueSize;
-        m_receivePacketData = (uint8_t**) YOJIMBO_ALLOCATE( allocator, sizeof( uint8_t*) * m_maxReceivePackets );
-        m_receivePacketBytes = (int*) YOJIMBO_ALLOCATE( allocator, sizeof(int) * m_maxReceivePackets );
-        m_receiveFrom = (Address*) YOJIMBO_ALLOCATE( allocator, sizeof(Address) * m_maxReceivePackets );
-    }
+        const int packetBufferSize = transport->m_packetProcessor->GetMaxPacketBufferSize();
 
-    LocalTransport::~LocalTransport()
-    {
-        assert( m_allocator );
-        assert( m_networkSimulator );
+        if ( packetBufferSize > m_packetBufferSize )
+        {
+            YOJIMBO_FREE( *m_allocator, m_receivePacketData );
 
-        DiscardReceivePackets();
+            m_packetBufferSize = packetBufferSize;
 
-        YOJIMBO_FREE( *m_allocator, m_receivePacketData );
-        YOJIMBO_FREE( *m_allocator, m_receivePacketBytes );
-        YOJIMBO_FREE( *m_allocator, m_receiveFrom );
+            m_receivePacketData = (uint8_t*) YOJIMBO_ALLOCATE( *m_allocator, PacketReceiveBatchSize * m_packetBufferSize );
+        }
 
-        m_networkSimulator = NULL;
+        return true;
     }
 
-    void LocalTransport::Reset()
+    void SharedServerSocket::RemoveTransport( SharedServerTransport * transport )
     {
-        DiscardReceivePackets();
+        assert( transport );
 
-        BaseTransport::Reset();
+        for ( int i = 0; i < m_maxRoutes; ++i )
+        {
+            if ( m_routes[i].transport == transport )
+                RemoveRoute( i );
+        }
+
+        for ( int i = 0; i < m_numTransports; ++i )
+        {
+            if ( m_transports[i] == transport )
+            {
+                m_transports[i] = m_transports[m_numTransports-1];
+                m_transports[m_numTransports-1] = NULL;
+                m_numTransports--;
+                break;
+            }
+        }
     }
 
-    void LocalTransport::AdvanceTime( double time )
+    SharedServerTransport * SharedServerSocket::FindRoute( const Address & address ) const
     {
-        BaseTransport::AdvanceTime( time );
+        const int routeIndex = m_routeMap->Find( address );
+        if ( routeIndex < 0 )
+            return NULL;
 
-        DiscardReceivePackets();
+        assert( m_routes[routeIndex].transport );
 
-        PumpReceivePacketsFromSimulator();
+        return m_routes[routeIndex].transport;
     }
 
-    void LocalTransport::DiscardReceivePackets()
+    void SharedServerSocket::SendPacket( const Address & to, const void * packetData, int packetBytes )
     {
-        assert( m_networkSimulator );
+        if ( m_socket->IsError() )
+            return;
 
-        Allocator & allocator = m_networkSimulator->GetAllocator();
+        m_socket->SendPacket( to, packetData, packetBytes );
+    }
 
-        for ( int i = 0; i < m_numReceivePackets; ++i )
+    void SharedServerSocket::UpdateRoutes( double time )
+    {
+        for ( int i = 0; i < m_numTransports; ++i )
         {
-            YOJIMBO_FREE( allocator, m_receivePacketData[i] );
-        }
+            SharedServerTransport * transport = m_transports[i];
 
-        m_numReceivePackets = 0;
-        m_receivePacketIndex = 0;
-    }
+            // IMPORTANT: claims are applied before releases. Servers add an encryption mapping, send a connection denied packet and remove the mapping right away, and that route should not be left behind.
 
-    void LocalTransport::PumpReceivePacketsFromSimulator()
-    {
-        assert( m_networkSimulator );
+            for ( int j = 0; j < transport->m_numClaimedRoutes; ++j )
+            {
+                const Address & address = transport->m_claimedRoutes[j];
 
-        assert( m_numReceivePackets == 0 );        
+                if ( m_routeMap->Find( address ) >= 0 )
+                    continue;
 
-        m_numReceivePackets = m_networkSimulator->ReceivePacketsSentToAddress( m_maxReceivePackets, GetAddress(), m_receivePacketData, m_receivePacketBytes, m_receiveFrom );
-    }
+                if ( m_firstFreeRoute < 0 )
+                {
+                    m_numDroppedPackets++;
+                    continue;
+                }
 
-    void LocalTransport::InternalSendPacket( const Address & to, const void * packetData, int packetBytes )
-    {
-        assert( m_networkSimulator );
+                const int routeIndex = m_firstFreeRoute;
 
-        Allocator & allocator = m_networkSimulator->GetAllocator();
+                Route & route = m_routes[routeIndex];
 
-        uint8_t * packetDataCopy = (uint8_t*) YOJIMBO_ALLOCATE( allocator, packetBytes );
-        if ( !packetDataCopy )
-            return;
+                assert( route.transport == NULL );
 
-        memcpy( packetDataCopy, packetData, packetBytes );
+                if ( !m_routeMap->Insert( address, routeIndex ) )
+                {
+                    m_numDroppedPackets++;
+                    continue;
+                }
 
-        m_networkSimulator->SendPacket( GetAddress(), to, packetDataCopy, packetBytes );
-    }
+                m_firstFreeRoute = route.nextFree;
 
-    int LocalTransport::InternalReceivePacket( Address & from, void * packetData, int maxPacketSize )
-    {
-        (void) maxPacketSize;
+                route.address = address;
+                route.transport = transport;
+                route.lastReceiveTime = time;
+                route.nextFree = -1;
 
-        if ( m_receivePacketIndex >= m_numReceivePackets )
-            return 0;
+                m_numRoutes++;
+            }
 
-        const int index = m_receivePacketIndex;
+            if ( transport->m_releaseAllRoutes )
+            {
+                for ( int j = 0; j < m_maxRoutes; ++j )
+                {
+                    if ( m_routes[j].transport == transport )
+                        RemoveRoute( j );
+                }
+            }
+            else
+            {
+                for ( int j = 0; j < transport->m_numReleasedRoutes; ++j )
+                {
+                    const int routeIndex = m_routeMap->Find( transport->m_releasedRoutes[j] );
+                    if ( routeIndex >= 0 && m_routes[routeIndex].transport == transport )
+                        RemoveRoute( routeIndex );
+                }
+            }
 
-        assert( m_receivePacketData[index] );
-        assert( m_receivePacketBytes[index] > 0 );
-        assert( m_receivePacketBytes[index] <= maxPacketSize );
+            m_numDroppedPackets += transport->m_numDroppedPackets;
 
-        memcpy( packetData, m_receivePacketData[index], m_receivePacketBytes[index] );
+            transport->m_numClaimedRoutes = 0;
+            transport->m_numReleasedRoutes = 0;
+            transport->m_releaseAllRoutes = false;
+            transport->m_numDroppedPackets = 0;
+        }
+
+        for ( int i = 0; i < m_maxRoutes; ++i )
+        {
+            if ( m_routes[i].transport && m_routes[i].lastReceiveTime + m_routeTimeout <= time )
+                RemoveRoute( i );
+        }
+    }
 
-        Allocator & allocator = m_networkSimulator->GetAllocator();
+    void SharedServerSocket::RemoveRoute( int routeIndex )
+    {
+        assert( routeIndex >= 0 );
+        assert( routeIndex < m_maxRoutes );
 
-        YOJIMBO_FREE( allocator, m_receivePacketData[index] );
+        Route & route = m_routes[routeIndex];
 
-        from = m_receiveFrom[index];
+        assert( route.transport );
 
-        m_receivePacketIndex++;
+        m_routeMap->Remove( route.address );
 
-        return m_receivePacketBytes[index];
+        route.address = Address();
+        route.transport = NULL;
+        route.nextFree = m_firstFreeRoute;
+
+        m_firstFreeRoute = routeIndex;
+
+        assert( m_numRoutes > 0 );
+        m_numRoutes--;
     }
 
     // =====================================================
 
-#if YOJIMBO_SOCKETS
+    SharedServerTransport::SharedServerTransport( Allocator & allocator, SharedServerSocket & sharedSocket, uint64_t protocolId, double time, int maxPacketSize, int sendQueueSize, int receiveQueueSize )
+        : PacketQueueTransport( allocator, sharedSocket.GetAddress(), protocolId, time, maxPacketSize, sendQueueSize, receiveQueueSize )
+    {
+        m_sharedSocket = &sharedSocket;
+        m_releaseAllRoutes = false;
+        m_numClaimedRoutes = 0;
+        m_numReleasedRoutes = 0;
+        m_numDroppedPackets = 0;
+        m_added = m_sharedSocket->AddTransport( this );
+    }
 
-    NetworkTransport::NetworkTransport( Allocator & allocator, 
-                                        const Address & address,
-                                        uint64_t protocolId,
-                                        double time,
-                                        int maxPacketSize, 
-                                        int sendQueueSize, 
-                                        int receiveQueueSize,
-                                        int socketSendBufferSize,
-                                        int socketReceiveBufferSize,
-                                        bool allocateNetworkSimulator )
-        : BaseTransport( allocator, 
-                         address,
-                         protocolId,
-                         time,
-                         maxPacketSize,
-                         sendQueueSize,
-                         receiveQueueSize,
-                         allocateNetworkSimulator )
+    SharedServerTransport::~SharedServerTransport()
     {
-        m_socket = YOJIMBO_NEW( allocator, Socket, address, socketSendBufferSize, socketReceiveBufferSize );
+        assert( m_sharedSocket );
 
-        if ( m_address.GetPort() == 0 && !m_socket->IsError() )
-        {
-            m_address.SetPort( m_socket->GetAddress().GetPort() );
-        }
+        if ( m_added )
+            m_sharedSocket->RemoveTransport( this );
+
+        m_sharedSocket = NULL;
     }
 
-    NetworkTransport::~NetworkTransport()
+    bool SharedServerTransport::IsError() const
     {
-        assert( m_socket );
-        assert( m_allocator );
-        YOJIMBO_DELETE( *m_allocator, Socket, m_socket );
+        return !m_added;
     }
 
-    bool NetworkTransport::IsError() const
+    void SharedServerTransport::Reset()
     {
-        return m_socket->IsError();
+        m_releaseAllRoutes = true;
+        m_numClaimedRoutes = 0;
+        m_numReleasedRoutes = 0;
+
+        DiscardReceivePackets();
+
+        BaseTransport::Reset();
     }
 
-    int NetworkTransport::GetError() const
+    bool SharedServerTransport::RemoveEncryptionMapping( const Address & address )
     {
-        return m_socket->GetError();
+        if ( m_numReleasedRoutes < MaxSharedSocketRouteChanges )
+            m_releasedRoutes[m_numReleasedRoutes++] = address;
+        else
+            m_releaseAllRoutes = true;
+
+        return BaseTransport::RemoveEncryptionMapping( address );
     }
 
-    void NetworkTransport::InternalSendPacket( const Address & to, const void * packetData, int packetBytes )
+    void SharedServerTransport::ResetEncryptionMappings()
     {
-        m_socket->SendPacket( to, packetData, packetBytes );
+        m_releaseAllRoutes = true;
+        m_numClaimedRoutes = 0;
+        m_numReleasedRoutes = 0;
+
+        BaseTransport::ResetEncryptionMappings();
     }
 
-    int NetworkTransport::InternalReceivePacket( Address & from, void * packetData, int maxPacketSize )
+    void SharedServerTransport::InternalSendPacket( const Address & to, const void * packetData, int packetBytes )
     {
-        return m_socket->ReceivePacket( from, packetData, maxPacketSize );
+        assert( m_sharedSocket );
+
+        const SharedServerTransport * transport = m_sharedSocket->FindRoute( to );
+
+        if ( transport != this )
+        {
+            if ( transport )
+            {
+                m_numDroppedPackets++;
+                return;
+            }
+
+            bool claimed = false;
+
+            for ( int i = 0; i < m_numClaimedRoutes; ++i )
+            {
+                if ( m_claimedRoutes[i] == to )
+                {
+                    claimed = true;
+                    break;
+                }
+            }
+
+            if ( !claimed )
+            {
+                if ( m_numClaimedRoutes == MaxSharedSocketRouteChanges )
+                {
+                    m_numDroppedPackets++;
+                    return;
+                }
+
+                m_claimedRoutes[m_numClaimedRoutes++] = to;
+            }
+        }
+
+        m_sharedSocket->SendPacket( to, packetData, packetBytes );
     }
 
 #endif // #if YOJIMBO_SOCKETS
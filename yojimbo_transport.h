@@ -43,8 +43,10 @@ namespace yojimbo
     enum TransportFlags
     {
 #if !YOJIMBO_SECURE_MODE
-        TRANSPORT_FLAG_INSECURE_MODE = (1<<0)                                       ///< When insecure secure mode is enabled on a transport, it supports receiving unencrypted packets that would normally be rejected if they weren't encrypted. This allows a mix of secure and insecure clients on the same server. Don't turn this on in production!
+        TRANSPORT_FLAG_INSECURE_MODE = (1<<0),                                      ///< When insecure secure mode is enabled on a transport, it supports receiving unencrypted packets that would normally be rejected if they weren't encrypted. This allows a mix of secure and insecure clients on the same server. Don't turn this on in production!
 #endif // #if !YOJIMBO_SECURE_MODE
+        TRANSPORT_FLAG_COALESCE_PACKETS = (1<<1),                                   ///< When packet coalescing is enabled on a transport, encrypted packets queued for the same address are combined into one packet up to the fragment size when they are written, so they share one UDP header, sequence number and MAC. Compressed packet types are not coalesced. Receiving coalesced packets works whether this flag is set or not.
+        TRANSPORT_FLAG_ADDRESS_MIGRATION = (1<<2)                                   ///< When address migration is enabled on a transport, an encrypted packet from an address without an encryption mapping is checked against the receive key of each context mapping. If it decrypts with one, and is newer than any packet received from that address, the encryption mapping and context mapping move to the new address. This lets a client keep its connection when its address changes, eg. after a NAT rebinding. See Transport::GetNumAddressMigrations.
     };
 
     /**
@@ -72,9 +74,84 @@ namespace yojimbo
         TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_READ,                                 ///< Number of unencrypted packets read from the network.
         TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_WRITTEN,                              ///< Number of unencrypted packets written to the network.
         TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES,                              ///< Number of encryption mapping failures. This is when an encrypted packet is sent to us, but we don't can't find any key to decrypt that packet corresponding to it's source address. See Transport::AddEncryptionMapping.
+        TRANSPORT_COUNTER_FRAGMENTS_WRITTEN,                                        ///< Number of packet fragments written to the network. Packets larger than the fragment size are split into fragments when they are written. See Transport::SetFragmentSize.
+        TRANSPORT_COUNTER_FRAGMENTS_READ,                                           ///< Number of packet fragments read from the network and stored for reassembly.
+        TRANSPORT_COUNTER_FRAGMENTS_DISCARDED,                                      ///< Number of packet fragments discarded because they were malformed, duplicates, or didn't match the fragment size of this transport.
+        TRANSPORT_COUNTER_COMPRESSED_PACKETS_READ,                                  ///< Number of compressed packets read from the network.
+        TRANSPORT_COUNTER_COMPRESSED_PACKETS_WRITTEN,                               ///< Number of compressed packets written to the network. Packets of compressed types are only counted here if compression actually made them smaller. See Transport::EnablePacketCompression.
+        TRANSPORT_COUNTER_DECOMPRESS_PACKET_FAILURES,                               ///< Number of compressed packets that failed to decompress. Non-zero usually indicates the sender and receiver have different compression dictionaries.
+        TRANSPORT_COUNTER_COALESCED_PACKETS_READ,                                   ///< Number of packets read from the network inside coalesced packets. These are also counted as packets read.
+        TRANSPORT_COUNTER_COALESCED_PACKETS_WRITTEN,                                ///< Number of packets written to the network inside coalesced packets. These are also counted as packets written. See TRANSPORT_FLAG_COALESCE_PACKETS.
+        TRANSPORT_COUNTER_ADDRESS_MIGRATIONS,                                       ///< Number of times an encryption mapping and context mapping moved to a new address. See TRANSPORT_FLAG_ADDRESS_MIGRATION.
+        TRANSPORT_COUNTER_FEC_PARITY_PACKETS_WRITTEN,                               ///< Number of forward error correction parity packets written to the network. See Transport::EnableForwardErrorCorrection.
+        TRANSPORT_COUNTER_FEC_PARITY_PACKETS_READ,                                  ///< Number of forward error correction parity packets read from the network.
+        TRANSPORT_COUNTER_FEC_PACKETS_RECOVERED,                                    ///< Number of lost packets recovered from forward error correction parity packets. Recovered packets are also counted as packets read, as if they were never lost.
+        TRANSPORT_COUNTER_REJECTED_PREFIX_BYTE,                                     ///< Number of packets discarded as soon as they were received because their prefix byte is not one this transport writes.
+        TRANSPORT_COUNTER_REJECTED_PACKET_SIZE,                                     ///< Number of packets discarded as soon as they were received because they are too small for their prefix byte, or unencrypted and larger than the max size for their packet type. See Transport::SetMaxUnencryptedPacketBytes.
+        TRANSPORT_COUNTER_REJECTED_PACKET_TYPE,                                     ///< Number of unencrypted packets discarded as soon as they were received because their packet type is unknown or not allowed unencrypted.
+        TRANSPORT_COUNTER_RELAY_PACKETS_FORWARDED,                                  ///< Number of packets forwarded by a transport in relay mode. See NetworkTransport::EnableRelayMode.
+        TRANSPORT_COUNTER_RELAY_PACKETS_DROPPED,                                    ///< Number of relayed packets discarded because their relay header is malformed, they came from an address that isn't a relay, or (in relay mode) they are not to or from an origin server.
+        TRANSPORT_COUNTER_RELAY_PACKETS_RATE_LIMITED,                               ///< Number of packets a transport in relay mode discarded because their source address sent more than its rate limit. See NetworkTransport::EnableRelayMode.
+        TRANSPORT_COUNTER_SEND_ERRORS,                                              ///< Number of errors reported by the network for packets sent, for example ICMP port unreachable. Only counted when the socket was created with SOCKET_FLAG_RECEIVE_ERRORS. See NetworkTransport::GetNumSendErrors.
+        TRANSPORT_COUNTER_SERIALIZED_PACKETS_WRITTEN,                               ///< Number of packets written to the network from pre-serialized packet data. These are also counted as packets written. See Transport::SendSerializedPacket.
         TRANSPORT_COUNTER_NUM_COUNTERS                                              ///< The number of transport counters.
     };
 
+    /**
+        Get the name of a transport counter.
+
+        Names are lower case with underscores, so they can be used directly in metric names, eg. "packets_sent". See MetricsSnapshot.
+
+        @param index The transport counter index. See yojimbo::TransportCounters.
+
+        @returns The name of the counter.
+     */
+
+    inline const char * GetTransportCounterName( int index )
+    {
+        switch ( index )
+        {
+            case TRANSPORT_COUNTER_PACKETS_SENT:                     return "packets_sent";
+            case TRANSPORT_COUNTER_PACKETS_RECEIVED:                 return "packets_received";
+            case TRANSPORT_COUNTER_PACKETS_READ:                     return "packets_read";
+            case TRANSPORT_COUNTER_PACKETS_WRITTEN:                  return "packets_written";
+            case TRANSPORT_COUNTER_SEND_QUEUE_OVERFLOW:              return "send_queue_overflow";
+            case TRANSPORT_COUNTER_RECEIVE_QUEUE_OVERFLOW:           return "receive_queue_overflow";
+            case TRANSPORT_COUNTER_READ_PACKET_FAILURES:             return "read_packet_failures";
+            case TRANSPORT_COUNTER_WRITE_PACKET_FAILURES:            return "write_packet_failures";
+            case TRANSPORT_COUNTER_ENCRYPT_PACKET_FAILURES:          return "encrypt_packet_failures";
+            case TRANSPORT_COUNTER_DECRYPT_PACKET_FAILURES:          return "decrypt_packet_failures";
+            case TRANSPORT_COUNTER_ENCRYPTED_PACKETS_READ:           return "encrypted_packets_read";
+            case TRANSPORT_COUNTER_ENCRYPTED_PACKETS_WRITTEN:        return "encrypted_packets_written";
+            case TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_READ:         return "unencrypted_packets_read";
+            case TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_WRITTEN:      return "unencrypted_packets_written";
+            case TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES:      return "encryption_mapping_failures";
+            case TRANSPORT_COUNTER_FRAGMENTS_WRITTEN:                return "fragments_written";
+            case TRANSPORT_COUNTER_FRAGMENTS_READ:                   return "fragments_read";
+            case TRANSPORT_COUNTER_FRAGMENTS_DISCARDED:              return "fragments_discarded";
+            case TRANSPORT_COUNTER_COMPRESSED_PACKETS_READ:          return "compressed_packets_read";
+            case TRANSPORT_COUNTER_COMPRESSED_PACKETS_WRITTEN:       return "compressed_packets_written";
+            case TRANSPORT_COUNTER_DECOMPRESS_PACKET_FAILURES:       return "decompress_packet_failures";
+            case TRANSPORT_COUNTER_COALESCED_PACKETS_READ:           return "coalesced_packets_read";
+            case TRANSPORT_COUNTER_COALESCED_PACKETS_WRITTEN:        return "coalesced_packets_written";
+            case TRANSPORT_COUNTER_ADDRESS_MIGRATIONS:               return "address_migrations";
+            case TRANSPORT_COUNTER_FEC_PARITY_PACKETS_WRITTEN:       return "fec_parity_packets_written";
+            case TRANSPORT_COUNTER_FEC_PARITY_PACKETS_READ:          return "fec_parity_packets_read";
+            case TRANSPORT_COUNTER_FEC_PACKETS_RECOVERED:            return "fec_packets_recovered";
+            case TRANSPORT_COUNTER_REJECTED_PREFIX_BYTE:             return "rejected_prefix_byte";
+            case TRANSPORT_COUNTER_REJECTED_PACKET_SIZE:             return "rejected_packet_size";
+            case TRANSPORT_COUNTER_REJECTED_PACKET_TYPE:             return "rejected_packet_type";
+            case TRANSPORT_COUNTER_RELAY_PACKETS_FORWARDED:          return "relay_packets_forwarded";
+            case TRANSPORT_COUNTER_RELAY_PACKETS_DROPPED:            return "relay_packets_dropped";
+            case TRANSPORT_COUNTER_RELAY_PACKETS_RATE_LIMITED:       return "relay_packets_rate_limited";
+            case TRANSPORT_COUNTER_SEND_ERRORS:                      return "send_errors";
+            case TRANSPORT_COUNTER_SERIALIZED_PACKETS_WRITTEN:       return "serialized_packets_written";
+            default:
+                assert( false );
+                return "???";
+        }
+    }
+
     /** 
         Gives the transport access to resources it needs to read and write packets.
 
@@ -143,7 +220,13 @@ namespace yojimbo
     {
     public:
 
-        TransportContextManager();
+        /**
+            Transport context manager constructor.
+
+            @param allocator The allocator used to allocate the address hash table.
+         */
+
+        explicit TransportContextManager( Allocator & allocator );
 
         /**
             Add a context mapping.
@@ -190,12 +273,43 @@ namespace yojimbo
 
         const TransportContext * GetContext( const Address & address ) const;
 
+        /**
+            Move a context mapping to a different address.
+
+            The context mapping keeps its index and context data. This is used to follow a client whose address changes. See TRANSPORT_FLAG_ADDRESS_MIGRATION.
+
+            @param from The address the context mapping currently belongs to.
+            @param to The new address for the context mapping.
+            @returns True if the context mapping was moved, false if there is no context mapping for the old address, or there is already a context mapping for the new address.
+         */
+
+        bool MoveContextMapping( const Address & from, const Address & to );
+
+        /**
+            Get the number of context mapping indices in use.
+
+            @returns One past the highest context mapping index in use. Indices below this may be free. See TransportContextManager::GetContextAtIndex.
+         */
+
+        int GetNumContextMappings() const { return m_numContextMappings; }
+
+        /**
+            Get a context mapping by index.
+
+            @param index The context mapping index in [0,GetNumContextMappings()-1].
+            @param address The address of the context mapping [out]. Not set if the index is free.
+            @returns A const pointer to the context, or NULL if no context mapping is allocated at this index.
+         */
+
+        const TransportContext * GetContextAtIndex( int index, Address & address ) const;
+
     private:
 
         int m_numContextMappings;                                                   ///< The current number of context mappings in [0,MaxContextMappings-1]
         int m_allocated[MaxContextMappings];                                        ///< Array of allocated flags per-context entry. True if a context mapping is allocated at this index.
-        Address m_address[MaxContextMappings];                                      ///< Array of addresses. Used by the O(n) for a context by address. OK because n is typically small.
+        Address m_address[MaxContextMappings];                                      ///< Array of addresses corresponding to the context at the same index in the context array.
         TransportContext m_context[MaxContextMappings];                             ///< Array of context data corresponding to the address at the same index in the address array.
+        AddressMap m_addressMap;                                                    ///< Hash table from address to context mapping index. Keeps TransportContextManager::GetContext O(1) per-packet, regardless of the number of context mappings.
     };
 
     /** 
@@ -266,6 +380,41 @@ namespace yojimbo
 
         virtual void SendPacket( const Address & address, Packet * packet, uint64_t sequence = 0, bool immediate = false ) = 0;
 
+        /**
+            Serialize a packet once, so it can be sent many times with Transport::SendSerializedPacket.
+
+            This is for packets that are sent over and over with the same contents, like keep-alive and disconnect packets. Serializing them once up front skips packet creation, serialization and destruction each time they are sent. Only encryption is done per-send, since the sequence number is the nonce.
+
+            The packet is serialized with the transport context set by Transport::SetContext. Ownership of the packet is not transferred, the caller is still responsible for destroying it.
+
+            @param packet The packet to serialize.
+            @param buffer The buffer to serialize the packet into. Must be 4 byte aligned.
+            @param bufferSize The size of the buffer (bytes). Must be a multiple of 4.
+
+            @returns The number of bytes of serialized packet data, or 0 if the packet failed to serialize or is larger than the max packet size.
+         */
+
+        virtual int SerializePacket( Packet * packet, uint8_t * buffer, int bufferSize ) = 0;
+
+        /**
+            Send a packet serialized with Transport::SerializePacket.
+
+            Only encrypted packet types can be sent this way, and only to addresses with an encryption mapping. Otherwise this function returns false and nothing is sent, so the caller should fall back to creating the packet and sending it with Transport::SendPacket.
+
+            IMPORTANT: Unless the packet is sent immediately, the packet data is not copied. It must not change or be freed until the next call to Transport::WritePackets.
+
+            @param address The address the packet should be sent to.
+            @param type The packet type that was serialized.
+            @param packetData The serialized packet data.
+            @param packetBytes The number of bytes of serialized packet data.
+            @param sequence The 64 bit sequence number of the packet used as a nonce for packet encryption.
+            @param immediate If true the the packet is written and flushed to the network immediately, rather than in the next call to Transport::WritePackets.
+
+            @returns True if the packet was sent (or queued to be sent), false if it can't be sent from serialized data.
+         */
+
+        virtual bool SendSerializedPacket( const Address & address, int type, const uint8_t * packetData, int packetBytes, uint64_t sequence = 0, bool immediate = false ) = 0;
+
         /**
             Receive a packet.
 
@@ -277,10 +426,11 @@ namespace yojimbo
 
             @param from The address that the packet was received from.
             @param sequence Pointer to an unsigned 64 bit sequence number (optional). If the pointer is not NULL, it will be dereferenced to store the sequence number of the received packet. Only encrypted packets have these sequence numbers.
+            @param receiveTime Pointer to the time the packet was received (optional), in the same time base as platform_time. Network transports on Linux use the kernel receive timestamp, so this doesn't include time spent waiting in socket buffers for Transport::ReadPackets to be called. Otherwise it's the time the packet was read from the socket.
             @returns The next packet in the receive queue, or NULL if no packets are left in the receive queue.
          */
 
-        virtual Packet * ReceivePacket( Address & from, uint64_t * sequence = NULL ) = 0;
+        virtual Packet * ReceivePacket( Address & from, uint64_t * sequence = NULL, double * receiveTime = NULL ) = 0;
 
         /**
             Iterates across all packets in the send queue and writes them to the network.
@@ -298,6 +448,20 @@ namespace yojimbo
 
         virtual void ReadPackets() = 0;
 
+        /**
+            Block until packets are ready to be read, or the timeout elapses.
+
+            Use this in place of sleeping in your main loop. Wait until the time of your next tick, and whenever this returns true call Transport::ReadPackets and process received packets straight away. This cuts the latency added by sleeping through packet arrival without spinning the CPU.
+
+            IMPORTANT: Packets delayed by the network simulator only show up when Transport::ReadPackets is called, so always bound the timeout by your next tick deadline rather than waiting indefinitely.
+
+            @param timeout The maximum time to wait (seconds). Pass 0 to poll.
+
+            @returns True if packets are ready to be read, false if the wait timed out.
+         */
+
+        virtual bool WaitForPacket( double timeout ) = 0;
+
         /**
             Returns the maximum packet size supported by this transport.
 
@@ -394,6 +558,147 @@ namespace yojimbo
 
         virtual bool IsEncryptedPacketType( int type ) const = 0;
 
+        /**
+            Set the largest unencrypted packet of a type that can be received.
+
+            Unencrypted packets larger than this are discarded as soon as they are received, before their CRC32 is checked or they are deserialized. For example, the client/server protocol limits connection request packets to the size of a connection request, so oversized connection requests cost almost nothing to reject.
+
+            @param type The packet type.
+            @param bytes The maximum size of an unencrypted packet of this type, including the prefix byte and CRC32 (bytes). Pass zero for no limit, which is the default.
+
+            @see TRANSPORT_COUNTER_REJECTED_PACKET_SIZE
+         */
+
+        virtual void SetMaxUnencryptedPacketBytes( int type, int bytes ) = 0;
+
+        /**
+            Turns on packet compression for all packet types.
+
+            Packet data is compressed after it is serialized and before it is encrypted. Packets below the compression threshold, and packets that don't get any smaller, are sent uncompressed. Compressed packets are flagged in their prefix byte, so the receiver always knows which packets to decompress, regardless of packet type.
+
+            Compression works best with a dictionary of typical packet data. See Transport::SetCompressionDictionary.
+
+            @see Transport::DisablePacketCompression
+            @see Transport::EnableCompressionForPacketType
+            @see Transport::DisableCompressionForPacketType
+         */
+
+        virtual void EnablePacketCompression() = 0;
+
+        /**
+            Disables compression for all packet types.
+
+            This is the default.
+
+            @see Transport::EnablePacketCompression
+         */
+
+        virtual void DisablePacketCompression() = 0;
+
+        /**
+            Enables compression for a specific packet type.
+
+            Typical usage is to enable compression only for large packets that repeat a lot of data, like world state snapshots.
+
+            @param type The packet type that should be compressed.
+         */
+
+        virtual void EnableCompressionForPacketType( int type ) = 0;
+
+        /**
+            Disables compression for a specific packet type.
+
+            @param type The packet type that should not be compressed.
+         */
+
+        virtual void DisableCompressionForPacketType( int type ) = 0;
+
+        /**
+            Is a packet type compressed?
+
+            @returns True if packets of this type are compressed when they are written, false otherwise.
+         */
+
+        virtual bool IsCompressedPacketType( int type ) const = 0;
+
+        /**
+            Set the dictionary used to compress and decompress packets.
+
+            Load the dictionary once at startup. A good dictionary is a concatenation of typical packet data, with the most common data at the end.
+
+            IMPORTANT: Both sides of a connection must set exactly the same dictionary, otherwise compressed packets fail to decompress and are dropped.
+
+            @param dictionary The dictionary data. It is copied. Pass in NULL to clear the dictionary.
+            @param dictionaryBytes The size of the dictionary in bytes. At most yojimbo::MaxCompressionDictionaryBytes.
+
+            @returns True if the dictionary was set, false otherwise.
+         */
+
+        virtual bool SetCompressionDictionary( const uint8_t * dictionary, int dictionaryBytes ) = 0;
+
+        /**
+            Set the minimum size of packet data that is compressed.
+
+            @param bytes Packets with less data than this are sent uncompressed. Defaults to yojimbo::DefaultCompressionThreshold.
+         */
+
+        virtual void SetCompressionThreshold( int bytes ) = 0;
+
+        /**
+            Turns on forward error correction for packets sent by this transport.
+
+            After every groupSize packets sent to an address, a parity packet is sent that lets the receiver recover any one of those packets if it is lost, without waiting for a resend. This applies to every packet written to the network, including fragments and coalesced packets. See ForwardErrorCorrection.
+
+            Smaller groups recover more packets under heavy packet loss, but cost more bandwidth. A group size of 4 sends one parity packet for every four packets, which is 25% extra.
+
+            Packets protected with forward error correction are always read, whether or not forward error correction is enabled on the receiver, but lost packets are only recovered if it is enabled.
+
+            @param groupSize The number of packets protected by each parity packet, in [2,yojimbo::MaxFecGroupSize].
+
+            @see Transport::DisableForwardErrorCorrection
+         */
+
+        virtual void EnableForwardErrorCorrection( int groupSize ) = 0;
+
+        /**
+            Turns off forward error correction.
+
+            This is the default.
+
+            @see Transport::EnableForwardErrorCorrection
+         */
+
+        virtual void DisableForwardErrorCorrection() = 0;
+
+        /**
+            Turns on parallel decoding of received packets.
+
+            Transport::ReadPackets normally decrypts and deserializes each packet received in turn. With parallel receive, packets are grouped by the allocator, packet factory and connection context of the address they came from, and the groups are decoded on worker threads at the same time. On a server each client has its own, so packets from different clients are decoded in parallel. The thread calling Transport::ReadPackets decodes packets too, and packets are added to the receive queue in the order they were received.
+
+            Everything else, like fragment reassembly, forward error correction, encryption mapping lookups and counters, stays on the thread calling Transport::ReadPackets.
+
+            IMPORTANT: Packet serialize functions run on worker threads, so they must only touch the allocator, packet factory and contexts of the packet being read. If several context mappings share a user context, it must be safe to read from several threads at once.
+
+            @param numWorkers The number of worker threads to create, in [1,yojimbo::MaxReceiveWorkers].
+            @param workerCpus Optional array of numWorkers CPU cores to pin the worker threads to, eg. cores on the same NUMA node as the thread calling Transport::ReadPackets. A negative entry leaves that worker unpinned. Pass in NULL to leave all workers to the operating system. See platform_thread_set_affinity.
+
+            @returns True if parallel receive was turned on. False if the worker threads could not be created, in which case packets are decoded one at a time as before.
+
+            @see Transport::DisableParallelReceive
+         */
+
+        virtual bool EnableParallelReceive( int numWorkers, const int * workerCpus = NULL ) = 0;
+
+        /**
+            Turns off parallel decoding of received packets, and stops the worker threads.
+
+            This is the default.
+
+            @see Transport::EnableParallelReceive
+         */
+
+        virtual void DisableParallelReceive() = 0;
+
         /**
             Associates an address with keys for packet encryption.
 
@@ -433,6 +738,20 @@ namespace yojimbo
 
         virtual int FindEncryptionMapping( const Address & address ) = 0;
 
+        /**
+            Get the keys of the encryption mapping for an address.
+
+            Used to move an encrypted session from one address to another, eg. when a client is handed off between servers. See Server::HandoffClient.
+
+            @param address The address of the encryption mapping.
+            @param sendKey The key used to encrypt packets sent to this address (out). Must have room for yojimbo::KeyBytes bytes.
+            @param receiveKey The key used to decrypt packets received from this address (out). Must have room for yojimbo::KeyBytes bytes.
+
+            @returns True if an encryption mapping for the address exists and its keys were copied out, false otherwise.
+         */
+
+        virtual bool GetEncryptionMappingKeys( const Address & address, uint8_t * sendKey, uint8_t * receiveKey ) = 0;
+
         /**
             Reset all encryption mappings.
 
@@ -518,6 +837,26 @@ namespace yojimbo
 
         virtual void ResetCounters() = 0;
 
+        /**
+            Get the number of packets in the send queue.
+
+            Packets sent via Transport::SendPacket wait in the send queue until the next call to Transport::WritePackets. Exported as a gauge by MetricsSnapshot::AddTransport.
+
+            @returns The number of packets waiting to be written to the network.
+         */
+
+        virtual int GetSendQueueSize() const = 0;
+
+        /**
+            Get the number of packets in the receive queue.
+
+            Packets read from the network in Transport::ReadPackets wait in the receive queue until they are popped off by Transport::ReceivePacket.
+
+            @returns The number of packets waiting to be received.
+         */
+
+        virtual int GetReceiveQueueSize() const = 0;
+
         /**
             Set transport flags.
 
@@ -540,6 +879,79 @@ namespace yojimbo
 
         virtual uint64_t GetFlags() const = 0;
 
+        /**
+            Set the fragment size.
+
+            Packets larger than the fragment size are split into fragments no larger than this when they are written, and are reassembled by the transport on the other side before they are read. This lets you send packets larger than the network MTU without relying on IP fragmentation.
+
+            IMPORTANT: Both sides must use the same fragment size, otherwise fragments are discarded when they are received. In secure mode only encrypted packets are fragmented, and reassembled packets are discarded unless they are encrypted.
+
+            @param bytes The fragment size, including fragment header and packet encryption overhead (bytes). Must be large enough that a packet of maximum size fits in yojimbo::MaxFragmentsPerPacket fragments.
+
+            @see Transport::GetFragmentSize
+         */
+
+        virtual void SetFragmentSize( int bytes ) = 0;
+
+        /**
+            Get the fragment size.
+
+            @returns The fragment size (bytes). Packets larger than this are split into fragments.
+
+            @see Transport::SetFragmentSize
+         */
+
+        virtual int GetFragmentSize() const = 0;
+
+        /**
+            Set the cipher used to encrypt packets.
+
+            The client and server set this from ClientServerConfig::packetCipher, so you only need to call this if you use the transport directly.
+
+            IMPORTANT: Both sides must use the same packet cipher, otherwise encrypted packets fail to decrypt.
+
+            @param cipher The packet cipher. Defaults to PACKET_CIPHER_XSALSA20_POLY1305.
+
+            @see IsPacketCipherAvailable
+            @see Transport::GetPacketCipher
+         */
+
+        virtual void SetPacketCipher( PacketCipher cipher ) = 0;
+
+        /**
+            Get the cipher used to encrypt packets.
+
+            @returns The packet cipher.
+
+            @see Transport::SetPacketCipher
+         */
+
+        virtual PacketCipher GetPacketCipher() const = 0;
+
+        /**
+            Get the number of address migrations from the last call to Transport::ReadPackets.
+
+            Address migrations only happen when TRANSPORT_FLAG_ADDRESS_MIGRATION is set. The server uses these to move client slots to their new addresses.
+
+            @returns The number of address migrations in [0,yojimbo::MaxAddressMigrationAttempts].
+
+            @see Transport::GetAddressMigration
+         */
+
+        virtual int GetNumAddressMigrations() const = 0;
+
+        /**
+            Get an address migration from the last call to Transport::ReadPackets.
+
+            Packets from the new address are read with the encryption mapping and context mapping of the old address from the point of migration onwards.
+
+            @param index The address migration index in [0,GetNumAddressMigrations()-1].
+            @param from The old address [out].
+            @param to The new address [out].
+         */
+
+        virtual void GetAddressMigration( int index, Address & from, Address & to ) const = 0;
+
         /**
             Get the address of the transport.
 
@@ -599,12 +1011,18 @@ namespace yojimbo
 
         void SendPacket( const Address & address, Packet * packet, uint64_t sequence, bool immediate );
 
-        Packet * ReceivePacket( Address & from, uint64_t * sequence );
+        int SerializePacket( Packet * packet, uint8_t * buffer, int bufferSize );
+
+        bool SendSerializedPacket( const Address & address, int type, const uint8_t * packetData, int packetBytes, uint64_t sequence, bool immediate );
+
+        Packet * ReceivePacket( Address & from, uint64_t * sequence = NULL, double * receiveTime = NULL );
 
         void WritePackets();
 
         void ReadPackets();
 
+        bool WaitForPacket( double timeout );
+
         int GetMaxPacketSize() const;
 
         void SetNetworkConditions( float latency, float jitter, float packetLoss, float duplicate );
@@ -619,12 +1037,38 @@ namespace yojimbo
 
         bool IsEncryptedPacketType( int type ) const;
 
+        void SetMaxUnencryptedPacketBytes( int type, int bytes );
+
+        void EnablePacketCompression();
+
+        void DisablePacketCompression();
+
+        void EnableCompressionForPacketType( int type );
+
+        void DisableCompressionForPacketType( int type );
+
+        bool IsCompressedPacketType( int type ) const;
+
+        bool SetCompressionDictionary( const uint8_t * dictionary, int dictionaryBytes );
+
+        void SetCompressionThreshold( int bytes );
+
+        void EnableForwardErrorCorrection( int groupSize );
+
+        void DisableForwardErrorCorrection();
+
+        bool EnableParallelReceive( int numWorkers, const int * workerCpus = NULL );
+
+        void DisableParallelReceive();
+
         bool AddEncryptionMapping( const Address & address, const uint8_t * sendKey, const uint8_t * receiveKey, double timeout );
 
         bool RemoveEncryptionMapping( const Address & address );
 
         int FindEncryptionMapping( const Address & address );
 
+        bool GetEncryptionMappingKeys( const Address & address, uint8_t * sendKey, uint8_t * receiveKey );
+
         void ResetEncryptionMappings();
 
         bool AddContextMapping( const Address & address, const TransportContext & context );
@@ -641,16 +1085,34 @@ namespace yojimbo
 
         void ResetCounters();
 
+        int GetSendQueueSize() const;
+
+        int GetReceiveQueueSize() const;
+
         void SetFlags( uint64_t flags );
 
         uint64_t GetFlags() const;
 
+        void SetFragmentSize( int bytes );
+
+        int GetFragmentSize() const;
+
+        void SetPacketCipher( PacketCipher cipher );
+
+        PacketCipher GetPacketCipher() const;
+
+        int GetNumAddressMigrations() const;
+
+        void GetAddressMigration( int index, Address & from, Address & to ) const;
+
         const Address & GetAddress() const;
 
         uint64_t GetProtocolId() const;
 
     protected:
 
+        struct PacketEntry;
+
         /// Clear the packet send queue.
 
         void ClearSendQueue();
@@ -668,11 +1130,30 @@ namespace yojimbo
             @param packet The packet object to be serialized (written).
             @param sequence The sequence number of the packet being written. If this is an encrypted packet, this serves as the nonce, and it is the users responsibility to increase this value with each packet sent per-encryption context. Not used for unencrypted packets (pass in zero).
             @param packetBytes The number of packet bytes written to the buffer [out]. This is the wire size of the packet to be sent via sendto or equivalent.
+            @param packetBuffer Optional buffer to write the packet directly into, eg. a slot in the send batch. Must be 4 byte aligned and at least PacketProcessor::GetMaxPacketBufferSize bytes.
+
+            @returns A const pointer to the packet data written. If no packet buffer is passed in, this is a scratch buffer. Don't hold on to this pointer and don't free it. The scratch buffer is internal and managed by the transport.
+         */
+
+        const uint8_t * WritePacket( const Address & address, Packet * packet, uint64_t sequence, int & packetBytes, uint8_t * packetBuffer = NULL );
 
-            @returns A const pointer to the packet data written to a scratch buffer. Don't hold on to this pointer and don't free it. The scratch buffer is internal and managed by the transport.
+        /**
+            Encrypts pre-serialized packet data into a scratch buffer and returns a pointer to the packet data.
+
+            @param address The address the packet is being sent to.
+            @param type The packet type that was serialized.
+            @param serializedData The packet data serialized with Transport::SerializePacket.
+            @param serializedBytes The number of bytes of serialized packet data.
+            @param sequence The sequence number of the packet being written. This serves as the nonce for encryption.
+            @param packetBytes The number of packet bytes written to the buffer [out].
+            @param packetBuffer Optional buffer to write the packet directly into, eg. a slot in the send batch. Must be 4 byte aligned and at least PacketProcessor::GetMaxPacketBufferSize bytes.
+
+            @returns A const pointer to the packet data written, or NULL if the packet could not be written.
+
+            @see Transport::SendSerializedPacket
          */
 
-        const uint8_t * WritePacket( const Address & address, Packet * packet, uint64_t sequence, int & packetBytes );
+        const uint8_t * WriteSerializedPacket( const Address & address, int type, const uint8_t * serializedData, int serializedBytes, uint64_t sequence, int & packetBytes, uint8_t * packetBuffer = NULL );
 
         /**
             Write a packet and queue it up in the network simulator.
@@ -692,6 +1173,24 @@ namespace yojimbo
 
         void WritePacketToSimulator( const Address & address, Packet * packet, uint64_t sequence );
 
+        /**
+            Coalesce packets queued for the same address into one packet.
+
+            Looks ahead in the send queue entries for other encrypted packets to the same address as the first entry, and writes as many of them as fit in the fragment size into one coalesced packet. Packets that are written are destroyed and their entries are cleared to NULL. Packets that don't fit are left for their own entries to send.
+
+            @param entries The send queue entries being written.
+            @param numEntries The number of entries.
+            @param index The index of the first entry to coalesce. Its packet must not be NULL.
+            @param packetBytes The number of bytes of packet data written [out].
+            @param packetBuffer Optional buffer to write the packet directly into, eg. a slot in the send batch. Must be 4 byte aligned and at least PacketProcessor::GetMaxPacketBufferSize bytes.
+
+            @returns A const pointer to the coalesced packet data written. NULL if fewer than two packets could be coalesced, in which case no packets are written and none of the entries are modified.
+
+            @see TRANSPORT_FLAG_COALESCE_PACKETS
+         */
+
+        const uint8_t * WriteCoalescedPacket( PacketEntry * entries, int numEntries, int index, int & packetBytes, uint8_t * packetBuffer = NULL );
+
         /**
             Write a packet and flush it to the network.
 
@@ -721,35 +1220,299 @@ namespace yojimbo
         Packet * ReadPacket( const Address & address, uint8_t * packetBuffer, int packetBytes, uint64_t & sequence );
 
         /**
-            Should sent packets go through the simulator first before they are flushed to the network?
-
-            This is true in the case where network conditions are set on the simulator, which is how latency and packet loss is added on top of the transport.
+            Read a coalesced packet that arrived from the network and deserialize all packets inside it.
 
-            Returning false means packets are written and flushed directly to the network via BaseTransport::InternalSendPacket.
-
-            @returns True if packets should be directed through the simulator (see BaseTransport::WritePacketToSimulator) and false if packets should be flushed directly to the network (see BaseTransport::WriteAndFlushPacket).
+            @param address The address that sent the packet.
+            @param packetBuffer The byte buffer containing the coalesced packet data received from the network. It is decrypted in-place.
+            @param packetBytes The size of the packet data being read in bytes.
+            @param sequence The sequence number of the coalesced packet [out]. This is the sequence number for all packets inside it.
+            @param packets The array of packets read [out]. Must have room for yojimbo::MaxCoalescedPackets packets. The caller owns these packets and is responsible for destroying them.
 
-            @see Transport::SetNetworkConditions
+            @returns The number of packets read. Zero if the coalesced packet failed to read.
          */
 
-        virtual bool ShouldPacketsGoThroughSimulator();
+        int ReadCoalescedPacket( const Address & address, uint8_t * packetBuffer, int packetBytes, uint64_t & sequence, Packet ** packets );
 
         /**
-            Internal function to send a packet over the network.
+            Try to move a client to the address an encrypted packet arrived from.
 
-            IMPORTANT: Override this to implement your own packet send function for derived transport classes.
+            Called for packets from addresses without a context mapping when TRANSPORT_FLAG_ADDRESS_MIGRATION is set. The packet is checked against the receive key of each context mapping, and if it decrypts with one, and is newer than any packet received from that context mapping's address, the encryption mapping and context mapping are moved to the new address together.
 
-            @param to The address the packet should be sent to.
-            @param packetData The serialized, and potentially encrypted packet data generated by BaseTransport::WritePacket.
+            @param address The address that sent the packet.
+            @param packetBuffer The packet data. It is not modified.
             @param packetBytes The size of the packet data in bytes.
+
+            @returns True if a client was moved to the address, false otherwise.
          */
 
-        virtual void InternalSendPacket( const Address & to, const void * packetData, int packetBytes ) = 0;
+        bool MigrateAddress( const Address & address, const uint8_t * packetBuffer, int packetBytes );
 
         /**
-            Internal function to receive a packet from the network.
+            Push a batch of packets read from the network onto the receive queue.
 
-            IMPORTANT: Override this to implement your own packet receive function for derived transport classes. 
+            Packets that don't fit in the receive queue are destroyed and counted as receive queue overflows.
+
+            @param entries The packet entries to push.
+            @param numEntries The number of packet entries.
+         */
+
+        void PushReceivedPackets( PacketEntry * entries, int numEntries );
+
+        /**
+            Should this packet be split into fragments before it is sent?
+
+            @param packetData The packet data written by BaseTransport::WritePacket.
+            @param packetBytes The size of the packet data (bytes).
+
+            @returns True if the packet is larger than the fragment size and should be fragmented. In secure mode, unencrypted packets are never fragmented.
+         */
+
+        /**
+            Should a packet just received be discarded without reading it?
+
+            Looks only at the prefix byte, the packet size, the packet type of unencrypted packets and whether the sender has an encryption mapping, so packets that can't possibly be read are discarded before any CRC32, decryption, decompression or fragment reassembly work is done on them. Each discarded packet is counted by reason.
+
+            @param address The address the packet was received from.
+            @param packetData The packet data, as received or as unwrapped from a forward error correction packet.
+            @param packetBytes The size of the packet data (bytes).
+
+            @returns True if the packet can't possibly be read and should be discarded, false otherwise.
+
+            @see TRANSPORT_COUNTER_REJECTED_PREFIX_BYTE
+            @see TRANSPORT_COUNTER_REJECTED_PACKET_SIZE
+            @see TRANSPORT_COUNTER_REJECTED_PACKET_TYPE
+            @see TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES
+         */
+
+        bool ShouldRejectPacket( const Address & address, const uint8_t * packetData, int packetBytes );
+
+        bool ShouldFragmentPacket( const uint8_t * packetData, int packetBytes ) const;
+
+        /**
+            Get the number of fragments a packet is split into.
+
+            @param packetBytes The size of the packet data (bytes).
+
+            @returns The number of fragments in [2,yojimbo::MaxFragmentsPerPacket].
+         */
+
+        int GetNumFragments( int packetBytes ) const;
+
+        /**
+            Write one fragment of a packet.
+
+            Fragments are laid out as [FragmentPacketPrefix][fragment sequence (2 bytes)][fragment id][num fragments - 1][packet data]. Every fragment except the last carries exactly fragment size minus header bytes of packet data, so the receiver knows where each fragment goes without any extra information.
+
+            @param fragmentData The buffer to write the fragment to. Must be at least the fragment size.
+            @param packetData The packet data being fragmented.
+            @param packetBytes The size of the packet data (bytes).
+            @param fragmentSequence The fragment sequence number. This identifies which packet the fragment belongs to on the receiver side.
+            @param fragmentId The index of the fragment to write in [0,numFragments-1].
+            @param numFragments The number of fragments the packet is split into. See BaseTransport::GetNumFragments.
+
+            @returns The size of the fragment written (bytes).
+         */
+
+        int WriteFragment( uint8_t * fragmentData, const uint8_t * packetData, int packetBytes, uint16_t fragmentSequence, int fragmentId, int numFragments );
+
+        /**
+            Read a fragment and store it in the reassembly buffer.
+
+            @param address The address that sent the fragment.
+            @param fragmentData The fragment data received from the network.
+            @param fragmentBytes The size of the fragment data (bytes).
+            @param packetBytes The size of the reassembled packet (bytes) [out]. Only set when this function returns non-NULL.
+
+            @returns The reassembled packet data if this was the last fragment needed to complete the packet, NULL otherwise. The packet data is owned by the reassembly buffer and must be read before the next fragment is processed.
+         */
+
+        uint8_t * ReadFragment( const Address & address, const uint8_t * fragmentData, int fragmentBytes, int & packetBytes );
+
+        /// Discard all packets being reassembled.
+
+        void ResetFragmentReassembly();
+
+        /**
+            Send the packets in the send batch to the network.
+
+            Packets in the send batch are encrypted together first. See PacketProcessor::FlushEncryptBatch.
+
+            If forward error correction is enabled, each packet is protected in place in its send batch slot, and parity packets are sent as groups complete.
+
+            @param numPackets The number of packets in the send batch.
+
+            @returns The number of bytes sent, including parity packets. Zero if the batch failed to encrypt.
+         */
+
+        int FlushSendBatch( int numPackets );
+
+        /**
+            Send packet data to the network immediately.
+
+            If forward error correction is enabled, the packet is protected before it is sent, followed by a parity packet if that completes a group.
+
+            @param address The address to send the packet to.
+            @param packetData The packet data written by BaseTransport::WritePacket, or a fragment of it.
+            @param packetBytes The size of the packet data (bytes).
+         */
+
+        void SendPacketData( const Address & address, const uint8_t * packetData, int packetBytes );
+
+        /**
+            Send packet data through the network simulator.
+
+            The packet data is copied, and protected with forward error correction if it is enabled, so simulated packet loss applies to protected packets and parity packets just like it would on a real network.
+
+            @param address The address to send the packet to.
+            @param packetData The packet data written by BaseTransport::WritePacket, or a fragment of it.
+            @param packetBytes The size of the packet data (bytes).
+         */
+
+        void SendPacketDataToSimulator( const Address & address, const uint8_t * packetData, int packetBytes );
+
+        /**
+            Read packet data received from the network, and add the packets in it to the receive batch.
+
+            Coalesced packets add every packet inside them. Fragments only add a packet when they complete it.
+
+            @param address The address the packet data was received from.
+            @param receiveTime The time the packet data was received.
+            @param packetData The packet data, with any forward error correction header removed.
+            @param packetBytes The size of the packet data (bytes).
+            @param entries The receive batch. Pushed to the receive queue when it is full.
+            @param numEntries The number of entries in the receive batch [in/out].
+         */
+
+        void ReadPacketData( const Address & address, double receiveTime, uint8_t * packetData, int packetBytes, PacketEntry * entries, int & numEntries );
+
+        /**
+            Find the context and receive key for packet data received from an address.
+
+            If there is no context mapping for the address, and TRANSPORT_FLAG_ADDRESS_MIGRATION is set, this tries to migrate a client to the address. See BaseTransport::MigrateAddress.
+
+            @param address The address the packet data was received from.
+            @param packetBuffer The packet data.
+            @param packetBytes The size of the packet data (bytes).
+            @param key The receive key for the address [out]. NULL if there is no encryption mapping for the address.
+            @param keyState The precomputed receive key state for the address [out].
+
+            @returns The context mapped to the address, or the default context if there is none. Never NULL.
+         */
+
+        const TransportContext * FindReceiveContext( const Address & address, const uint8_t * packetBuffer, int packetBytes, const uint8_t * & key, const PacketCipherState * & keyState );
+
+        /// Update counters for a packet that failed to read. See BaseTransport::ReadPacket.
+
+        void CountReadPacketError( int error );
+
+        /// Update counters for a coalesced packet that failed to read. See BaseTransport::ReadCoalescedPacket.
+
+        void CountReadCoalescedPacketError( int error );
+
+        struct ReceivedPacketJob;
+
+        /**
+            Prepare packet data received from the network to be decoded in parallel.
+
+            Everything that touches transport state is done here, on the thread calling Transport::ReadPackets: fragment reassembly and finding the context and receive key. Decrypting and deserializing the packet is left for BaseTransport::DecodeReceivedPackets.
+
+            @param address The address the packet data was received from.
+            @param receiveTime The time the packet data was received.
+            @param packetData The packet data. Copied if it is not in the receive batch, because the buffer it is in may be reused before the packet is decoded.
+            @param packetBytes The size of the packet data (bytes).
+            @param entries The receive batch. See BaseTransport::FinishReceivedPackets.
+            @param numEntries The number of entries in the receive batch [in/out].
+         */
+
+        void QueueReceivedPacket( const Address & address, double receiveTime, uint8_t * packetData, int packetBytes, PacketEntry * entries, int & numEntries );
+
+        /**
+            Decode all queued received packets that haven't been decoded yet, on the worker threads and the calling thread.
+
+            Returns once they are all decoded. The decoded packets stay queued until BaseTransport::FinishReceivedPackets.
+         */
+
+        void DecodeReceivedPackets();
+
+        /**
+            Decode received packet groups for a decode pass until there are none left to take.
+
+            Called by the worker threads and the thread calling Transport::ReadPackets.
+
+            @param pass The decode pass the groups belong to.
+            @param packetProcessor The packet processor to decode with. Each thread has its own.
+         */
+
+        void DecodeReceivedPacketGroups( int pass, PacketProcessor & packetProcessor );
+
+        /**
+            Decrypt and deserialize a queued received packet.
+
+            @param packetProcessor The packet processor to decode with.
+            @param job The queued packet. The result is written back into it.
+         */
+
+        void DecodeReceivedPacket( PacketProcessor & packetProcessor, ReceivedPacketJob & job );
+
+        /**
+            Decode any queued received packets that are left, then add all queued packets to the receive batch in the order they were received.
+
+            @param entries The receive batch. Pushed to the receive queue when it is full.
+            @param numEntries The number of entries in the receive batch [in/out].
+         */
+
+        void FinishReceivedPackets( PacketEntry * entries, int & numEntries );
+
+        struct ReceiveWorker;
+
+        static void ReceiveWorkerFunction( void * data );
+
+        void ReceiveWorkerThread( ReceiveWorker & worker );
+
+        /**
+            Should sent packets go through the simulator first before they are flushed to the network?
+
+            This is true in the case where network conditions are set on the simulator, which is how latency and packet loss is added on top of the transport.
+
+            Returning false means packets are written and flushed directly to the network via BaseTransport::InternalSendPacket.
+
+            @returns True if packets should be directed through the simulator (see BaseTransport::WritePacketToSimulator) and false if packets should be flushed directly to the network (see BaseTransport::WriteAndFlushPacket).
+
+            @see Transport::SetNetworkConditions
+         */
+
+        virtual bool ShouldPacketsGoThroughSimulator();
+
+        /**
+            Internal function to send a packet over the network.
+
+            IMPORTANT: Override this to implement your own packet send function for derived transport classes.
+
+            @param to The address the packet should be sent to.
+            @param packetData The serialized, and potentially encrypted packet data generated by BaseTransport::WritePacket.
+            @param packetBytes The size of the packet data in bytes.
+         */
+
+        virtual void InternalSendPacket( const Address & to, const void * packetData, int packetBytes ) = 0;
+
+        /**
+            Internal function to send a batch of packets over the network.
+
+            The default implementation calls BaseTransport::InternalSendPacket in a loop. Override this in derived transport classes that can send multiple packets with a single call (eg. sendmmsg).
+
+            @param numPackets The number of packets to send.
+            @param to Array of addresses to send each packet to.
+            @param packetData The serialized, and potentially encrypted packet data generated by BaseTransport::WritePacket. Packet i is at packetData + i * maxPacketSize.
+            @param maxPacketSize The stride between packets in the packet data buffer (bytes).
+            @param packetBytes Array of packet sizes in bytes.
+         */
+
+        virtual void InternalSendPackets( int numPackets, const Address * to, const uint8_t * packetData, int maxPacketSize, const int * packetBytes );
+
+        /**
+            Internal function to receive a packet from the network.
+
+            IMPORTANT: Override this to implement your own packet receive function for derived transport classes. 
 
             IMPORTANT: This call must be non-blocking.
 
@@ -762,6 +1525,55 @@ namespace yojimbo
     
         virtual int InternalReceivePacket( Address & from, void * packetData, int maxPacketSize ) = 0;
 
+        /**
+            Internal function to receive a batch of packets from the network.
+
+            The default implementation calls BaseTransport::InternalReceivePacket in a loop. Override this in derived transport classes that can read multiple packets with a single call (eg. recvmmsg).
+
+            IMPORTANT: This call must be non-blocking.
+
+            @param maxPackets The maximum number of packets to receive.
+            @param from Array of addresses that sent each packet [out].
+            @param packetData The buffer which will receive packet data read from the network. Packet i is written to packetData + i * maxPacketSize.
+            @param maxPacketSize The maximum packet size in bytes. This is also the stride between packets in the packet data buffer.
+            @param packetBytes Array of packet sizes in bytes [out].
+            @param receiveTimes Array of times each packet was received, in the same time base as platform_time [out].
+
+            @returns The number of packets read from the network in [0,maxPackets].
+         */
+
+        virtual int InternalReceivePackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes );
+
+        /**
+            Internal function to receive a batch of packets without copying them into the receive batch buffer.
+
+            The default implementation calls BaseTransport::InternalReceivePackets with the receive batch buffer. Override this in derived transport classes that already hold received packets in memory, so they can be read in place (eg. LocalTransport).
+
+            IMPORTANT: The packet data is modified while it is read, eg. packets are decrypted in place, so it must be writable and not shared with anything else. It must stay valid until the next call.
+
+            @param maxPackets The maximum number of packets to receive.
+            @param from Array of addresses that sent each packet [out].
+            @param packetData Array of pointers to the data of each packet [out].
+            @param packetBytes Array of packet sizes in bytes [out].
+            @param receiveTimes Array of times each packet was received, in the same time base as platform_time [out].
+
+            @returns The number of packets received in [0,maxPackets].
+         */
+
+        virtual int InternalReceivePacketsInPlace( int maxPackets, Address * from, uint8_t ** packetData, int * packetBytes, double * receiveTimes );
+
+        /**
+            Internal function to block until packets are available to read from the network.
+
+            Called by BaseTransport::WaitForPacket when the packet receive queue is empty. The default implementation just sleeps for the timeout. Override this in derived transport classes that can wake up when a packet arrives.
+
+            @param timeout The maximum time to wait (seconds).
+
+            @returns True if packets are available to read, false if the wait timed out.
+         */
+
+        virtual bool InternalWaitForPacket( double timeout );
+
     protected:
 
         TransportContext m_context;                                     ///< The default transport context used if no context can be found for the specific address.
@@ -783,12 +1595,20 @@ namespace yojimbo
             PacketEntry()
             {
                 sequence = 0;
+                receiveTime = 0.0;
                 packet = NULL;
+                serializedData = NULL;
+                serializedBytes = 0;
+                serializedType = 0;
             }
 
             uint64_t sequence;                                          ///< The sequence number of the packet. Always 0 if the packet is not encrypted.
+            double receiveTime;                                         ///< The time the packet was received, in the same time base as platform_time. Only set for packets in the receive queue.
             Address address;                                            ///< The address of the packet. Depending on the queue, this is the address the packet should be sent to, or the address that sent the packet.
             Packet * packet;                                            ///< The packet object. While the packet in a queue, it is owned by that queue, and the queue is responsible for destroying that packet, or handing ownership off to somebody else (eg. after ReceivePacket).
+            const uint8_t * serializedData;                             ///< Pre-serialized packet data to send when the packet is NULL. Owned by the caller of Transport::SendSerializedPacket. Only set for packets in the send queue.
+            int serializedBytes;                                        ///< The number of bytes of pre-serialized packet data.
+            int serializedType;                                         ///< The packet type of the pre-serialized packet data.
         };
 
         Queue<PacketEntry> m_sendQueue;                                 ///< The packet send queue. Packets sent via Transport::SendPacket are added to this queue (unless the immediate flag is true). This queue is flushed to the network each time Transport::WritePackets is called.
@@ -803,6 +1623,10 @@ namespace yojimbo
 
         uint8_t * m_packetTypeIsUnencrypted;                            ///< An array with each entry set to 1 if that packet type is NOT encrypted.
 
+        uint8_t * m_packetTypeIsCompressed;                             ///< An array with each entry set to 1 if that packet type is compressed. See Transport::EnablePacketCompression.
+
+        int * m_unencryptedPacketMaxBytes;                              ///< An array with the maximum size of unencrypted packets of each type, or zero for no limit. See Transport::SetMaxUnencryptedPacketBytes.
+
         EncryptionManager * m_encryptionManager;                        ///< The encryption manager. Manages encryption contexts and lets the transport look up send and receive keys for encrypting and decrypting packets.
 
         TransportContextManager * m_contextManager;                     ///< The context manager. Manages the set of contexts on the transport, which allows certain addresses to be assigned to their own set of resources (like packet factories, message factories and allocators).
@@ -811,7 +1635,115 @@ namespace yojimbo
 
         class NetworkSimulator * m_networkSimulator;                    ///< The network simulator. May be NULL.
 
+        FrameAllocator * m_frameAllocator;                              ///< Allocator for temporary arrays that only live until the next call to AdvanceTime.
+
         uint64_t m_counters[TRANSPORT_COUNTER_NUM_COUNTERS];            ///< The array of transport counters. Used for stats, debugging and telemetry.
+
+        int m_numAddressMigrationAttempts;                              ///< The number of packets checked for address migration since the start of the last call to Transport::ReadPackets. See yojimbo::MaxAddressMigrationAttempts.
+
+        int m_numAddressMigrations;                                     ///< The number of address migrations since the start of the last call to Transport::ReadPackets.
+
+        Address m_addressMigrationFrom[MaxAddressMigrationAttempts];    ///< The old address of each address migration. See Transport::GetAddressMigration.
+
+        Address m_addressMigrationTo[MaxAddressMigrationAttempts];      ///< The new address of each address migration.
+
+        uint8_t * m_receiveBatchPacketData;                             ///< Pre-allocated buffer for packets read from the network in a batch. Holds yojimbo::PacketReceiveBatchSize packets of maximum packet size.
+
+        int * m_receiveBatchPacketBytes;                                ///< Array of packet sizes for the current receive batch (bytes).
+
+        Address * m_receiveBatchFrom;                                   ///< Array of from addresses for the current receive batch.
+
+        double * m_receiveBatchReceiveTimes;                            ///< Array of receive times for the current receive batch.
+
+        uint8_t * m_sendBatchPacketData;                                ///< Pre-allocated buffer for packets written to the network in a batch. Holds yojimbo::PacketSendBatchSize packets of maximum packet size.
+
+        int * m_sendBatchPacketBytes;                                   ///< Array of packet sizes for the current send batch (bytes).
+
+        Address * m_sendBatchTo;                                        ///< Array of destination addresses for the current send batch.
+
+        struct FragmentReassemblyEntry
+        {
+            FragmentReassemblyEntry()
+            {
+                sequence = 0;
+                numFragments = 0;
+                numFragmentsReceived = 0;
+                packetBytes = 0;
+                receivedMask = 0;
+            }
+
+            Address address;                                            ///< The address that sent the fragments. Invalid if this entry is not in use.
+            uint16_t sequence;                                          ///< The fragment sequence number of the packet being reassembled.
+            int numFragments;                                           ///< The number of fragments in the packet being reassembled. Zero if this entry is not in use.
+            int numFragmentsReceived;                                   ///< The number of fragments received so far.
+            int packetBytes;                                            ///< The size of the reassembled packet (bytes). Only known once the last fragment has been received.
+            uint64_t receivedMask;                                      ///< Bit n is set if fragment n has been received.
+        };
+
+        int m_fragmentSize;                                             ///< The fragment size (bytes). Packets larger than this are split into fragments. See Transport::SetFragmentSize.
+
+        uint16_t m_fragmentSequence;                                    ///< The fragment sequence number. Incremented each time a packet is fragmented, so the receiver can tell which fragments belong together.
+
+        uint8_t * m_fragmentPacketBuffer;                               ///< Scratch buffer of maximum packet size. Holds a packet while it is being split into fragments in the send batch, or a fragment being flushed immediately.
+
+        FragmentReassemblyEntry * m_fragmentReassembly;                 ///< The fragment reassembly buffer. Packets are assigned an entry by hashing the sender address and fragment sequence. A new packet that lands on an entry in use replaces it.
+
+        uint8_t * m_fragmentReassemblyData;                             ///< Packet data for each entry in the fragment reassembly buffer. Entry i is at m_fragmentReassemblyData + i * maximum packet buffer size.
+
+        class ForwardErrorCorrection * m_fec;                           ///< Forward error correction for packets sent and received. NULL unless forward error correction is enabled. See Transport::EnableForwardErrorCorrection.
+
+        uint8_t * m_fecPacketBuffer;                                    ///< Scratch buffer of maximum packet size. Holds a packet protected with forward error correction while it is flushed immediately. NULL unless forward error correction is enabled.
+
+        struct ReceivedPacketJob
+        {
+            Address address;                                            ///< The address the packet was received from.
+            double receiveTime;                                         ///< The time the packet was received.
+            uint8_t * packetData;                                       ///< The packet data. Decrypted in-place.
+            int packetBytes;                                            ///< The size of the packet data (bytes).
+            bool coalesced;                                             ///< True if this is a coalesced packet.
+            bool compressed;                                            ///< True if this is a compressed packet.
+            TransportContext context;                                   ///< Copy of the context for the address, so it can't change under the worker threads.
+            const uint8_t * key;                                        ///< The receive key for the address. NULL if there is no encryption mapping.
+            const PacketCipherState * keyState;                         ///< The precomputed receive key state for the address.
+            const uint8_t * encryptedPacketTypes;                       ///< Packet types allowed if the packet is encrypted.
+            const uint8_t * unencryptedPacketTypes;                     ///< Packet types allowed if the packet is not encrypted.
+            int nextJob;                                                ///< The next job in the same decode group. -1 if this is the last one.
+            uint64_t traceStart;                                        ///< Profile ticks when the packet started decoding. Only set when YOJIMBO_TRACE is 1.
+            int error;                                                  ///< The packet processor error if the packet failed to read.
+            bool encrypted;                                             ///< True if the packet was encrypted.
+            uint64_t sequence;                                          ///< The sequence number of the packet. Zero if it was not encrypted.
+            int numPackets;                                             ///< The number of packets read. Zero if the packet failed to read.
+            Packet * packets[MaxCoalescedPackets];                      ///< The packets read. Owned by the job until they are added to the receive batch.
+        };
+
+        struct ReceiveWorker
+        {
+            BaseTransport * transport;                                  ///< The transport the worker decodes packets for.
+            PacketProcessor * packetProcessor;                          ///< The worker's own packet processor. Packet processors have scratch buffers and error state, so they can't be shared between threads.
+            struct PlatformThread * thread;                             ///< The worker thread.
+        };
+
+        int m_numReceiveWorkers;                                        ///< The number of receive worker threads. Zero unless parallel receive is enabled. See Transport::EnableParallelReceive.
+
+        ReceiveWorker * m_receiveWorkers;                               ///< The receive worker threads. NULL unless parallel receive is enabled.
+
+        int m_receiveWorkersQuit;                                       ///< Set to 1 to tell the receive worker threads to exit. Accessed with atomic_load and atomic_store.
+
+        int m_receiveWorkState;                                         ///< The current decode pass in the high 16 bits, and the next decode group to take in the low 16 bits. Groups are taken with atomic_compare_exchange, so a worker that wakes up late can't take a group from a later pass.
+
+        int m_numReceiveGroups;                                         ///< The number of decode groups in the current decode pass. Accessed with atomic_load and atomic_store.
+
+        int m_numReceiveGroupsDone;                                     ///< The number of decode groups in the current decode pass that have been decoded. Accessed with atomic operations.
+
+        int * m_receiveGroupFirstJob;                                   ///< The first job in each decode group of the current decode pass.
+
+        ReceivedPacketJob * m_receivedPacketJobs;                       ///< Received packets queued to be decoded in parallel, in the order they were received.
+
+        uint8_t * m_receivedPacketJobData;                              ///< Packet data for queued received packets that had to be copied. Job i is at m_receivedPacketJobData + i * maximum packet buffer size.
+
+        int m_numReceivedPacketJobs;                                    ///< The number of queued received packets.
+
+        int m_numDecodedPacketJobs;                                     ///< The number of queued received packets that have been decoded. Always the first ones in the queue.
     };
 
     /**
@@ -866,6 +1798,10 @@ namespace yojimbo
     
         int InternalReceivePacket( Address & from, void * packetData, int maxPacketSize );
 
+        /// Hands out the packet buffers received from the simulator, so packets are read without being copied. Buffers shared with duplicate packets are copied first.
+
+        int InternalReceivePacketsInPlace( int maxPackets, Address * from, uint8_t ** packetData, int * packetBytes, double * receiveTimes );
+
     private:
 
         int m_receivePacketIndex;                           ///< Current index into receive packet (for InternalReceivePacket)
@@ -874,86 +1810,1547 @@ namespace yojimbo
         
         int m_maxReceivePackets;                            ///< Size of receive packet buffer (matches size of packet receive queue)
         
-        uint8_t ** m_receivePacketData;                     ///< Array of packet data to be received. pointers are owned and must be freed with simulator allocator.
+        uint8_t ** m_receivePacketData;                     ///< Array of packet buffers to be received. Holds a reference to each buffer, released with NetworkSimulator::ReleasePacket. NULL once a packet has been copied out and released.
         
         int * m_receivePacketBytes;                         ///< Array of packet sizes in bytes.
         
         Address * m_receiveFrom;                            ///< Array of packet from addresses.
     };
 
-#if YOJIMBO_SOCKETS
-
     /**
-        Implements a network transport built on top of non-blocking sendto and recvfrom socket APIs.
+        A local transport that can run on its own thread.
+
+        This works like LocalTransport, but packets go through a ThreadedNetworkSimulator, so transports sharing the simulator can each be updated on a different thread. Each transport must only be used from one thread at a time.
+
+        @see ThreadedNetworkSimulator
      */
 
-    class NetworkTransport : public BaseTransport
+    class ThreadedLocalTransport : public BaseTransport
     {
     public:
 
         /**
-            Network transport constructor.
+            Threaded local transport constructor.
+
+            The transport address is added to the network simulator, so it starts receiving packets sent to it. See ThreadedNetworkSimulator::AddAddress.
 
             @param allocator The allocator used for transport allocations.
-            @param address The address to send packets to that would be received by this transport.
+            @param networkSimulator The threaded network simulator to use. One simulator is shared by all transports, across all threads.
+            @param address The address of the transport. This is how other transports send packets to this transport.
             @param protocolId The protocol id for this transport. Protocol id is included in the packet header, packets received with a different protocol id are discarded. This allows multiple versions of your protocol to exist on the same network.
             @param time The current time value in seconds.
             @param maxPacketSize The maximum packet size that can be sent across this transport.
             @param sendQueueSize The size of the packet send queue (number of packets).
             @param receiveQueueSize The size of the packet receive queue (number of packets).
-            @param socketSendBufferSize The size of the send buffers to set on the socket (SO_SNDBUF).
-            @param socketReceiveBufferSize The size of the send buffers to set on the socket (SO_RCVBUF).
-            @param allocateNetworkSimulator If true then a network simulator is allocated for simulating network conditions. Pass false to disable this.
          */
 
-        NetworkTransport( Allocator & allocator,
-                          const Address & address,
-                          uint64_t protocolId,
-                          double time,
-                          int maxPacketSize = DefaultMaxPacketSize,
-                          int sendQueueSize = DefaultPacketSendQueueSize,
-                          int receiveQueueSize = DefaultPacketReceiveQueueSize,
-                          int socketSendBufferSize = DefaultSocketSendBufferSize,
-                          int socketReceiveBufferSize = DefaultSocketReceiveBufferSize,
-                          bool allocateNetworkSimulator = true );
-
-        ~NetworkTransport();
+        ThreadedLocalTransport( Allocator & allocator,
+                                class ThreadedNetworkSimulator & networkSimulator,
+                                const Address & address,
+                                uint64_t protocolId,
+                                double time,
+                                int maxPacketSize = DefaultMaxPacketSize,
+                                int sendQueueSize = DefaultPacketSendQueueSize,
+                                int receiveQueueSize = DefaultPacketReceiveQueueSize );
 
         /**
+            Threaded local transport destructor.
 
-            You should call this after creating a network transport, to make sure the socket was created successfully.
-
-            @returns True if the socket is in error state.
-
-            @see NetworkTransport::GetError
+            The transport address is removed from the network simulator, so packets sent to it from now on are dropped.
          */
 
-        bool IsError() const;
+        ~ThreadedLocalTransport();
 
-        /** 
-            Get the socket error code. 
+        /// Packets sent to this transport prior to a call to reset are discarded, and will not be received after it.
 
-            @returns The socket error code. One of the values in yojimbo::SocketError enum.
+        void Reset();
 
-            @see yojimbo::SocketError
-            @see NetworkTransport::IsError
-         */
+        /// Packets due for delivery are received from the simulator inside this function, just like LocalTransport.
 
-        int GetError() const;
+        void AdvanceTime( double time );
 
     protected:
 
-        /// Overridden internal packet send function. Effectively just calls through to sendto.
+        void DiscardReceivePackets();
 
-        virtual void InternalSendPacket( const Address & to, const void * packetData, int packetBytes );
+        void InternalSendPacket( const Address & to, const void * packetData, int packetBytes );
     
-        /// Overridden internal packet receive function. Effectively just wraps recvfrom.
+        int InternalReceivePacket( Address & from, void * packetData, int maxPacketSize );
+
+    private:
+
+        class ThreadedNetworkSimulator * m_threadedNetworkSimulator;    ///< The threaded network simulator passed in to the constructor.
+
+        int m_receivePacketIndex;                           ///< Current index into receive packet (for InternalReceivePacket)
+
+        int m_numReceivePackets;                            ///< Number of receive packets from last AdvanceTime update
+        
+        int m_maxReceivePackets;                            ///< Size of receive packet buffer (matches size of packet receive queue)
+        
+        uint8_t ** m_receivePacketData;                     ///< Array of packet data to be received. pointers are owned and must be freed with simulator allocator.
+        
+        int * m_receivePacketBytes;                         ///< Array of packet sizes in bytes.
+        
+        Address * m_receiveFrom;                            ///< Array of packet from addresses.
+    };
+
+    /**
+        A transport that hands packets straight to another transport in the same process.
+
+        Use this to run a Client and Server in the same process, eg. for listen servers and single player. Packets sent to the address of the paired transport are serialized directly into a packet object on the other side, and pushed onto its receive queue. There is no packet header, CRC32, encryption, compression, fragmentation or forward error correction, and no network simulator in between, so sending a packet costs one serialize write and one serialize read.
+
+        Packets are still serialized, rather than passing the packet object itself, because connection packets reference messages created by the factory on the sending side. Each side needs its own copy, created by its own factory, so they can be released independently.
+
+        Encryption mappings are kept as usual, so the client and server go through the same connection process, but packets are never encrypted. Only pair transports you trust. Packets sent to any other address are dropped.
+     */
+
+    class LoopbackTransport : public BaseTransport
+    {
+    public:
+
+        /**
+            Loopback transport constructor.
+
+            @param allocator The allocator used for transport allocations.
+            @param address The address of the transport. This is how the paired transport sends packets to this transport.
+            @param protocolId The protocol id for this transport. Packets are only handed to a paired transport with the same protocol id.
+            @param time The current time value in seconds.
+            @param maxPacketSize The maximum packet size that can be sent across this transport.
+            @param sendQueueSize The size of the packet send queue (number of packets).
+            @param receiveQueueSize The size of the packet receive queue (number of packets).
+         */
+
+        LoopbackTransport( Allocator & allocator,
+                           const Address & address,
+                           uint64_t protocolId,
+                           double time,
+                           int maxPacketSize = DefaultMaxPacketSize,
+                           int sendQueueSize = DefaultPacketSendQueueSize,
+                           int receiveQueueSize = DefaultPacketReceiveQueueSize );
+
+        /**
+            Loopback transport destructor.
+
+            The transport is unpaired, so the other transport stops sending packets to it.
+         */
+
+        ~LoopbackTransport();
+
+        /**
+            Pair this transport with another loopback transport.
+
+            From now on, packets sent to the address of either transport are handed to it by the other. Any previous pairing of either transport is undone.
+
+            @param other The loopback transport to pair with.
+         */
+
+        void Pair( LoopbackTransport & other );
+
+        /**
+            Undo the pairing of this transport, if it is paired.
+
+            Packets already handed to the other transport stay in its receive queue.
+         */
+
+        void Unpair();
+
+        /**
+            Get the transport this transport is paired with.
+
+            @returns The paired transport, or NULL if this transport is not paired.
+         */
+
+        LoopbackTransport * GetPairedTransport() const;
+
+        /// Packets sent with the immediate flag are handed to the paired transport right away. Other packets are handed over in WritePackets.
+
+        void SendPacket( const Address & address, Packet * packet, uint64_t sequence = 0, bool immediate = false );
+
+        /// Packets are handed to the paired transport as packet objects, never as packet data, so this always returns false and the caller falls back to Transport::SendPacket.
+
+        bool SendSerializedPacket( const Address & address, int type, const uint8_t * packetData, int packetBytes, uint64_t sequence = 0, bool immediate = false );
+
+        /// Hands each packet in the send queue to the paired transport.
+
+        void WritePackets();
+
+    protected:
+
+        /**
+            Hand a packet to the paired transport.
+
+            The packet is serialized into a new packet, created with the context the paired transport has for this address, and pushed onto its receive queue. The packet passed in is destroyed.
+
+            @param address The address the packet is sent to. If this is not the address of the paired transport, the packet is dropped.
+            @param packet The packet to hand over.
+            @param sequence The sequence number of the packet. Passed through to Transport::ReceivePacket on the other side.
+         */
+
+        void HandPacketToPair( const Address & address, Packet * packet, uint64_t sequence );
+
+        void InternalSendPacket( const Address & to, const void * packetData, int packetBytes );
+    
+        int InternalReceivePacket( Address & from, void * packetData, int maxPacketSize );
+
+    private:
+
+        LoopbackTransport * m_pairedTransport;                  ///< The transport packets are handed to. NULL if this transport is not paired.
+
+        uint8_t * m_packetBuffer;                               ///< Scratch buffer of maximum packet buffer size. Packets are serialized into this buffer, then read back out of it on the paired transport.
+    };
+
+    /// Shared memory transport error values. See SharedMemoryTransport::GetError.
+
+    enum SharedMemoryError
+    {
+        SHARED_MEMORY_ERROR_NONE,                                           ///< No shared memory error. All is well!
+        SHARED_MEMORY_ERROR_CREATE_FAILED,                                  ///< Creating the shared memory block failed.
+        SHARED_MEMORY_ERROR_OPEN_FAILED,                                    ///< There is no shared memory block with this name, or it could not be opened.
+        SHARED_MEMORY_ERROR_MISMATCH,                                       ///< The shared memory block was not created by a shared memory transport, or was created with a different protocol id, maximum packet size or ring size.
+        SHARED_MEMORY_ERROR_ALREADY_ATTACHED                                ///< Another transport has already opened the shared memory block. Only two transports can share a block, the one that created it and one that opened it.
+    };
+
+    /**
+        A transport that exchanges packets with a transport in another process on the same machine, through shared memory.
+
+        Use this for bots, replay recorders and spectator relays running next to a server, so they don't go through the kernel network stack. One transport creates a named block of shared memory and the other opens it. The block holds two lock-free single producer, single consumer rings of packet slots, one in each direction, so sending a packet is a copy into the ring and receiving it is a copy out.
+
+        Packets still go through the usual packet processing, so encryption, compression and fragmentation work as they do with NetworkTransport.
+
+        On Linux, Transport::WaitForPacket sleeps on a futex and wakes up as soon as the other process sends a packet. On other platforms it polls the ring.
+
+        Packets sent to any address other than the transport on the other side are dropped, as are packets sent when the ring is full.
+     */
+
+    class SharedMemoryTransport : public BaseTransport
+    {
+    public:
+
+        /**
+            Shared memory transport constructor.
+
+            Check SharedMemoryTransport::IsError after creating the transport, to make sure the shared memory block was created or opened.
+
+            @param allocator The allocator used for transport allocations.
+            @param name The name of the shared memory block. See platform_shared_memory_create.
+            @param create If true, create the shared memory block, replacing any block left behind with the same name. If false, open a block created by a transport in another process.
+            @param address The address of this transport. This is the address packets from this transport appear to come from on the other side.
+            @param protocolId The protocol id for this transport. Protocol id is included in the packet header, packets received with a different protocol id are discarded. Both transports must use the same protocol id.
+            @param time The current time value in seconds.
+            @param maxPacketSize The maximum packet size that can be sent across this transport. Both transports must use the same maximum packet size.
+            @param sendQueueSize The size of the packet send queue (number of packets).
+            @param receiveQueueSize The size of the packet receive queue (number of packets).
+            @param ringSize The size of each ring in the shared memory block (number of packets). Both transports must use the same ring size.
+         */
+
+        SharedMemoryTransport( Allocator & allocator,
+                               const char * name,
+                               bool create,
+                               const Address & address,
+                               uint64_t protocolId,
+                               double time,
+                               int maxPacketSize = DefaultMaxPacketSize,
+                               int sendQueueSize = DefaultPacketSendQueueSize,
+                               int receiveQueueSize = DefaultPacketReceiveQueueSize,
+                               int ringSize = DefaultSharedMemoryRingSize );
+
+        /**
+            Shared memory transport destructor.
+
+            If this transport opened the shared memory block, it detaches from it, so another transport can open it. If this transport created the block, the block is removed.
+         */
+
+        ~SharedMemoryTransport();
+
+        /**
+            Is the shared memory transport in an error state?
+
+            @returns True if the shared memory block could not be created or opened. See SharedMemoryTransport::GetError.
+         */
+
+        bool IsError() const;
+
+        /**
+            Get the shared memory error code.
+
+            @returns The shared memory error code. One of the values in the yojimbo::SharedMemoryError enum.
+         */
+
+        int GetError() const;
+
+        /**
+            Is there a transport on the other side of the shared memory block?
+
+            @returns True if both transports are attached to the shared memory block.
+         */
+
+        bool IsPeerAttached();
+
+        /**
+            Get the address of the transport on the other side of the shared memory block.
+
+            @returns The address of the other transport, or an invalid address if there is no transport on the other side.
+         */
+
+        const Address & GetPeerAddress();
+
+    protected:
+
+        /// Overridden internal packet send function. Copies the packet into a slot in the outgoing ring.
+
+        virtual void InternalSendPacket( const Address & to, const void * packetData, int packetBytes );
+
+        /// Overridden internal packet receive function. Copies a packet out of the incoming ring.
 
         virtual int InternalReceivePacket( Address & from, void * packetData, int maxPacketSize );
 
+        /// Overridden internal wait function. Waits for the other transport to push a packet onto the incoming ring.
+
+        virtual bool InternalWaitForPacket( double timeout );
+
     private:
 
-        class Socket * m_socket;                                ///< The socket used for sending and receiving UDP packets.
+        void UpdatePeerAddress();
+
+        struct PlatformSharedMemory * m_sharedMemory;           ///< The shared memory block. NULL if it could not be created or opened.
+
+        struct SharedMemoryHeader * m_header;                   ///< The header at the start of the shared memory block.
+
+        int m_error;                                            ///< The shared memory error code. One of the values in the yojimbo::SharedMemoryError enum.
+
+        int m_side;                                             ///< 0 if this transport created the shared memory block, 1 if it opened it. This transport sends on ring m_side and receives on the other ring.
+
+        int m_ringSize;                                         ///< The number of packet slots in each ring. One slot is always left empty, so each ring holds up to m_ringSize - 1 packets.
+
+        int m_slotSize;                                         ///< The size of each packet slot (bytes). Holds the packet size, followed by up to the maximum packet buffer size of packet data.
+
+        uint8_t * m_sendSlots;                                  ///< Packet slots of the ring this transport sends on.
+
+        uint8_t * m_receiveSlots;                               ///< Packet slots of the ring this transport receives on.
+
+        Address m_peerAddress;                                  ///< The address of the transport on the other side. Invalid if there is no transport on the other side.
+
+        int m_peerAttachCount;                                  ///< The number of times a transport had opened the shared memory block when m_peerAddress was last read. When this changes, a different transport is on the other side.
+    };
+
+#if YOJIMBO_SOCKETS
+
+    /**
+        Implements a network transport built on top of non-blocking sendto and recvfrom socket APIs.
+     */
+
+    class NetworkTransport : public BaseTransport
+    {
+    public:
+
+        /**
+            Network transport constructor.
+
+            @param allocator The allocator used for transport allocations.
+            @param address The address to send packets to that would be received by this transport.
+            @param protocolId The protocol id for this transport. Protocol id is included in the packet header, packets received with a different protocol id are discarded. This allows multiple versions of your protocol to exist on the same network.
+            @param time The current time value in seconds.
+            @param maxPacketSize The maximum packet size that can be sent across this transport.
+            @param sendQueueSize The size of the packet send queue (number of packets).
+            @param receiveQueueSize The size of the packet receive queue (number of packets).
+            @param socketSendBufferSize The size of the send buffers to set on the socket (SO_SNDBUF).
+            @param socketReceiveBufferSize The size of the send buffers to set on the socket (SO_RCVBUF).
+            @param allocateNetworkSimulator If true then a network simulator is allocated for simulating network conditions. Pass false to disable this.
+            @param socketFlags Flags passed to the socket. Pass SOCKET_FLAG_REUSE_PORT to create several transports on the same address, one per-thread or server instance, and let the kernel spread clients across them. Pass SOCKET_FLAG_DUAL_STACK with an IPv6 address to serve IPv4 and IPv6 clients from one transport. Pass SOCKET_FLAG_RIO on Windows dedicated servers to send and receive through Registered I/O. See yojimbo::SocketFlags.
+         */
+
+        NetworkTransport( Allocator & allocator,
+                          const Address & address,
+                          uint64_t protocolId,
+                          double time,
+                          int maxPacketSize = DefaultMaxPacketSize,
+                          int sendQueueSize = DefaultPacketSendQueueSize,
+                          int receiveQueueSize = DefaultPacketReceiveQueueSize,
+                          int socketSendBufferSize = DefaultSocketSendBufferSize,
+                          int socketReceiveBufferSize = DefaultSocketReceiveBufferSize,
+                          bool allocateNetworkSimulator = true,
+                          int socketFlags = 0 );
+
+        ~NetworkTransport();
+
+        /**
+
+            You should call this after creating a network transport, to make sure the socket was created successfully.
+
+            @returns True if the socket is in error state.
+
+            @see NetworkTransport::GetError
+         */
+
+        bool IsError() const;
+
+        /** 
+            Get the socket error code. 
+
+            @returns The socket error code. One of the values in yojimbo::SocketError enum.
+
+            @see yojimbo::SocketError
+            @see NetworkTransport::IsError
+         */
+
+        int GetError() const;
+
+        /**
+            Filter packets in the kernel before they reach the socket.
+
+            Generates an XDP program from the packet format of this transport and attaches it to the network interface the socket is bound to, so packets that could never be read are dropped without being copied to the socket. Packets are dropped if they are larger than the max packet buffer size, are encrypted but too small to hold a MAC, have an unknown prefix byte, or are unencrypted with a packet type that isn't allowed unencrypted.
+
+            Packets from addresses with encryption mappings are always let through to the socket. Packets from other addresses are limited to a number of packets per-second for each source IP, which keeps floods of connection requests from burying packets from connected clients.
+
+            You must set a context before calling this, because the packet types come from the packet factory. Call this again after changing the context, the unencrypted packet types or TRANSPORT_FLAG_INSECURE_MODE.
+
+            IMPORTANT: Only encryption mappings added after this is called are let through without rate limiting, so call this before starting the server or connecting the client.
+
+            Requires Linux and privileges to load BPF programs (CAP_NET_ADMIN and CAP_BPF). When packet filtering is not available this returns false and packets are received as usual.
+
+            @param unknownSourcePacketsPerSecond The maximum number of packets per-second from each source IP without an encryption mapping. Pass zero to disable the rate limit.
+
+            @returns True if the packet filter was attached, false otherwise.
+
+            @see NetworkTransport::DisablePacketFilter
+            @see Socket::SetFilter
+         */
+
+        bool EnablePacketFilter( int unknownSourcePacketsPerSecond = DefaultUnknownSourcePacketsPerSecond );
+
+        /**
+            Stop filtering packets in the kernel.
+
+            @see NetworkTransport::EnablePacketFilter
+         */
+
+        void DisablePacketFilter();
+
+        /**
+            Is the packet filter enabled?
+
+            @returns True if packets are being filtered in the kernel, false otherwise.
+         */
+
+        bool IsPacketFilterEnabled() const;
+
+        /**
+            Get the number of packets dropped by the packet filter.
+
+            @param index The counter index. One of the values in yojimbo::SocketFilterCounter.
+
+            @returns The number of packets dropped for that reason since the packet filter was enabled.
+         */
+
+        uint64_t GetPacketFilterCounter( int index ) const;
+
+        /**
+            Trust a relay to forward packets to and from this transport.
+
+            Relays forward packets between clients and origin servers without terminating the protocol. Each relayed packet starts with a small header holding the address of the other endpoint, followed by the packet exactly as it would have been sent directly, so encrypted packets are never decrypted by the relay. See yojimbo::RelayPacketPrefix.
+
+            Call this on origin servers behind a relay. Packets received from the relay are read as if they came from the address in their relay header, and a route to that address through the relay is learned, so packets sent back to it go through the same relay. Relayed packets from addresses that are not trusted relays are discarded.
+
+            IMPORTANT: Relayed packets are larger than the packets inside them by up to yojimbo::MaxRelayHeaderBytes. Leave that much room below the path MTU when setting the fragment size of transports that send through relays. See Transport::SetFragmentSize.
+
+            @param relayAddress The address of the relay.
+
+            @returns True if the relay was added, false if there are already yojimbo::MaxRelays relays.
+
+            @see NetworkTransport::AddRelayRoute
+            @see NetworkTransport::ResetRelays
+         */
+
+        bool AddRelay( const Address & relayAddress );
+
+        /**
+            Send packets for an address through a relay.
+
+            Call this on clients connecting through a relay, once for each server address. The relay is trusted as if NetworkTransport::AddRelay was called for it, and the route is never replaced by a learned one.
+
+            @param address The address that packets are sent to, eg. the address of the origin server.
+            @param relayAddress The address of the relay to send them through.
+
+            @returns True if the route was added, false if there are already yojimbo::MaxRelays relays or the route table is full of routes added with this function.
+         */
+
+        bool AddRelayRoute( const Address & address, const Address & relayAddress );
+
+        /**
+            Stop sending packets for an address through a relay.
+
+            Learned routes are also removed when the encryption mapping for their address is removed. See Transport::RemoveEncryptionMapping.
+
+            @param address The address to send packets to directly again.
+
+            @returns True if there was a route for the address, false otherwise.
+         */
+
+        bool RemoveRelayRoute( const Address & address );
+
+        /**
+            Remove all relays and relay routes.
+
+            Relayed packets received after this are discarded, and all packets are sent directly.
+         */
+
+        void ResetRelays();
+
+        /**
+            Get the relay that packets for an address are sent through.
+
+            @param address The address packets are sent to.
+
+            @returns The address of the relay, or an invalid address if packets for the address are sent directly.
+         */
+
+        Address GetRelayRouteAddress( const Address & address ) const;
+
+        /**
+            Turn this transport into a relay.
+
+            In relay mode, Transport::ReadPackets forwards packets instead of receiving them. A relayed packet from an origin server is sent to the client address in its relay header, and a relayed packet from anywhere else is sent to the origin server in its relay header, with the relay header rewritten to the address the packet came from. The rest of the packet is forwarded untouched. Nothing is decrypted, so a relay needs no context, packet factory or keys.
+
+            Packets to origin servers are rate limited per-source IP address, so floods are absorbed by the relay instead of reaching origin servers. Relayed packets to addresses that are not origin servers are discarded, so a relay can't be used to send packets anywhere else.
+
+            @param originAddresses The addresses of the origin servers behind this relay.
+            @param numOriginAddresses The number of origin server addresses. At most yojimbo::MaxRelayOrigins.
+            @param packetsPerSecond The number of packets per-second forwarded to origin servers from each source IP address.
+            @param packetBurst The number of packets forwarded to origin servers in a burst from each source IP address.
+
+            @see NetworkTransport::DisableRelayMode
+         */
+
+        void EnableRelayMode( const Address * originAddresses, int numOriginAddresses, float packetsPerSecond = DefaultRelayPacketsPerSecond, float packetBurst = DefaultRelayPacketBurst );
+
+        /**
+            Stop forwarding packets and receive them as usual.
+
+            @see NetworkTransport::EnableRelayMode
+         */
+
+        void DisableRelayMode();
+
+        /**
+            Is relay mode enabled?
+
+            @returns True if this transport forwards packets as a relay, false otherwise.
+         */
+
+        bool IsRelayModeEnabled() const;
+
+        /**
+            Spread the packets written each tick evenly over the tick.
+
+            Servers write a packet for every client at once in Transport::WritePackets, so they leave the network card as a burst that can overflow shallow switch and NIC queues on the first hop. With pacing enabled, the packets written by each call to WritePackets are spaced evenly over the interval instead.
+
+            Where the socket supports SO_TXTIME, every packet is handed to the kernel right away along with its departure time, and the kernel holds it until then. This needs the fq or etf qdisc on the network interface, eg. "tc qdisc replace dev eth0 root fq". See Socket::EnableTxTime.
+
+            Otherwise the transport holds packets and sends them as they come due, from Transport::WaitForPacket and NetworkTransport::SendPacedPackets. Anything still held when WritePackets is next called is sent first.
+
+            Packets sent through relays, forward error correction parity packets and packets sent immediately are not paced.
+
+            @param interval The time to spread each tick's packets over (seconds). Typically a little less than the tick time, so the last packet goes out before the next tick.
+            @param useTxTime Pace packets with SO_TXTIME where the socket supports it. The kernel silently ignores departure times unless the network interface uses the fq or etf qdisc, so pass false to always hold packets in the transport instead.
+
+            @see NetworkTransport::DisablePacing
+         */
+
+        void EnablePacing( double interval, bool useTxTime = true );
+
+        /**
+            Stop pacing packets. Any packets held by the transport are sent right away.
+
+            @see NetworkTransport::EnablePacing
+         */
+
+        void DisablePacing();
+
+        /**
+            Is pacing enabled?
+
+            @returns True if packets written each tick are spread over the pacing interval, false otherwise.
+         */
+
+        bool IsPacingEnabled() const;
+
+        /**
+            Is the kernel pacing packets?
+
+            @returns True if packets are paced with SO_TXTIME departure times, false if pacing is disabled or the transport holds packets itself.
+         */
+
+        bool IsKernelPacing() const;
+
+        /**
+            Send packets held by the transport that are due.
+
+            Only needed when the transport paces packets itself, and the application doesn't wait for packets with Transport::WaitForPacket between ticks. Call it as often as you can between ticks.
+
+            @see NetworkTransport::EnablePacing
+         */
+
+        void SendPacedPackets();
+
+        /**
+            Cap the rate packets are sent from the socket at.
+
+            Wraps Socket::SetMaxPacingRate. Enforced by the fq qdisc.
+
+            @param bytesPerSecond The maximum send rate (bytes per-second). Pass zero to remove the cap.
+
+            @returns True if the rate was set, false if it's not supported on this platform.
+         */
+
+        bool SetMaxPacingRate( uint32_t bytesPerSecond );
+
+        /**
+            Mark packets sent from the socket with a DSCP value for QoS.
+
+            Wraps Socket::SetDscp. Pass SOCKET_FLAG_DSCP_EF to the constructor to mark packets as expedited forwarding from the start.
+
+            @param dscp The differentiated services code point (0..63).
+
+            @returns True if the marking was set, false otherwise.
+         */
+
+        bool SetDscp( int dscp );
+
+        /**
+            Get the number of errors the network reported for packets sent, read by the last call to ReadPackets.
+
+            Errors are only reported when the socket was created with SOCKET_FLAG_RECEIVE_ERRORS. A server can use them to notice a client that has gone away (port unreachable) without waiting for it to time out.
+
+            @returns The number of send errors, up to yojimbo::MaxSocketErrors.
+
+            @see NetworkTransport::GetSendErrorAddress
+            @see NetworkTransport::GetSendError
+         */
+
+        int GetNumSendErrors() const;
+
+        /**
+            Get the address a packet was sent to when the network reported an error for it.
+
+            @param index The index of the send error in [0,GetNumSendErrors()-1].
+
+            @returns The address the failed packet was sent to.
+         */
+
+        const Address & GetSendErrorAddress( int index ) const;
+
+        /**
+            Get the errno value for a send error, eg. ECONNREFUSED for port unreachable.
+
+            @param index The index of the send error in [0,GetNumSendErrors()-1].
+
+            @returns The errno value the network reported.
+         */
+
+        int GetSendError( int index ) const;
+
+        /// Overridden to drop packets held for pacing.
+
+        void Reset();
+
+        /// Overridden to spread the packets written over the pacing interval. See NetworkTransport::EnablePacing.
+
+        void WritePackets();
+
+        /// Overridden to let packets from the address through the packet filter.
+
+        bool AddEncryptionMapping( const Address & address, const uint8_t * sendKey, const uint8_t * receiveKey, double timeout );
+
+        /// Overridden to rate limit packets from the address in the packet filter again, and remove any relay route learned for it.
+
+        bool RemoveEncryptionMapping( const Address & address );
+
+        /// Overridden to rate limit packets from all addresses in the packet filter again.
+
+        void ResetEncryptionMappings();
+
+        /// Overridden to move addresses that migrated in the packet filter, and to forward packets in relay mode.
+
+        void ReadPackets();
+
+    protected:
+
+        /**
+            Remove the relay header from a packet received from a relay.
+
+            Packets without the relay prefix byte are left untouched. Called on each packet received when relays have been added.
+
+            @param from The address the packet came from. Set to the address in the relay header [in/out].
+            @param packetData The packet data. Moved past the relay header [in/out].
+            @param packetBytes The size of the packet (bytes). Reduced by the size of the relay header [in/out].
+
+            @returns True if the packet should be read, false if it should be discarded.
+         */
+
+        bool ReadRelayPacket( Address & from, const uint8_t * & packetData, int & packetBytes );
+
+        /// Read packets from the socket in relay mode and forward them. See NetworkTransport::EnableRelayMode.
+
+        void ForwardRelayPackets();
+
+        /// Allocate the relay route table and packet buffers the first time a relay is added.
+
+        void InitializeRelays();
+
+        /// Find a relay by address. Returns the relay index, or -1 if the address is not a relay.
+
+        int FindRelay( const Address & address ) const;
+
+        /// Add or refresh a route to an address through a relay. Learned routes never replace routes added with NetworkTransport::AddRelayRoute.
+
+        bool SetRelayRoute( const Address & address, int relayIndex, bool learned );
+
+        /// Hold packets to be sent as they come due, when pacing without SO_TXTIME. If the pacing queue is full, the oldest held packet is sent early to make room.
+
+        void QueuePacedPackets( int numPackets, const Address * to, const uint8_t * packetData, int maxPacketSize, const int * packetBytes );
+
+        /// Send held packets that are due at the time passed in, oldest first.
+
+        void SendPacedPacketsDue( double time );
+
+        /// Overridden internal packet send function. Effectively just calls through to sendto.
+
+        virtual void InternalSendPacket( const Address & to, const void * packetData, int packetBytes );
+    
+        /// Overridden internal batch packet send function. Sends multiple packets per-syscall via sendmmsg where available. Packets are paced when pacing is enabled.
+
+        virtual void InternalSendPackets( int numPackets, const Address * to, const uint8_t * packetData, int maxPacketSize, const int * packetBytes );
+
+        /// Overridden internal packet receive function. Effectively just wraps recvfrom.
+
+        virtual int InternalReceivePacket( Address & from, void * packetData, int maxPacketSize );
+
+        /// Overridden internal batch packet receive function. Reads multiple packets per-syscall via recvmmsg where available.
+
+        virtual int InternalReceivePackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes );
+
+        /// Overridden internal wait function. Blocks on the socket until a packet arrives. Wakes up to send held packets as they come due when pacing without SO_TXTIME.
+
+        virtual bool InternalWaitForPacket( double timeout );
+
+    protected:
+
+        class Socket * m_socket;                                ///< The socket used for sending and receiving UDP packets.
+
+        double m_pacingInterval;                                ///< The time each tick's packets are spread over (seconds). Zero if pacing is disabled. See NetworkTransport::EnablePacing.
+
+        bool m_kernelPacing;                                    ///< True if packets are paced by the kernel with SO_TXTIME departure times, false if the transport holds them itself.
+
+        double m_pacingStartTime;                               ///< The time the current call to WritePackets started sending packets. Departure times are measured from here.
+
+        double m_pacingGap;                                     ///< The time between the departures of consecutive packets written this tick (seconds).
+
+        int m_pacingIndex;                                      ///< The number of packets paced so far this tick. The next packet departs at m_pacingStartTime + m_pacingIndex * m_pacingGap.
+
+        int m_pacingQueueSize;                                  ///< The number of packets the transport can hold for pacing. Zero until pacing without SO_TXTIME is enabled.
+
+        int m_pacingQueueHead;                                  ///< The index of the held packet that departs first. Held packets form a ring starting here.
+
+        int m_numPacedPackets;                                  ///< The number of packets currently held for pacing.
+
+        int m_pacingSlotSize;                                   ///< The size of each slot in the held packet buffer (bytes). The maximum packet buffer size.
+
+        uint8_t * m_pacedPacketData;                            ///< Held packet data. Packet i is at m_pacedPacketData + i * m_pacingSlotSize.
+
+        Address * m_pacedPacketTo;                              ///< The address each held packet is sent to.
+
+        int * m_pacedPacketBytes;                               ///< The size of each held packet (bytes).
+
+        double * m_pacedPacketTime;                             ///< The time each held packet departs, in the same time base as platform_time.
+
+        float m_pacingDelays[PacketSendBatchSize];              ///< Scratch array of send delays passed to Socket::SendPackets when pacing with SO_TXTIME.
+
+        int m_numSendErrors;                                    ///< The number of send errors read by the last call to ReadPackets.
+
+        Address m_sendErrorAddress[MaxSocketErrors];            ///< The address each packet with a send error was sent to.
+
+        int m_sendError[MaxSocketErrors];                       ///< The errno value of each send error.
+
+        int m_numRelays;                                        ///< The number of trusted relays. See NetworkTransport::AddRelay.
+
+        Address m_relays[MaxRelays];                            ///< The addresses of trusted relays.
+
+        int m_numRelayRoutes;                                   ///< The number of routes in the relay route table. Routes are packed at the front of the table.
+
+        class AddressMap * m_relayRouteMap;                     ///< Hash table from address to relay route index. NULL until a relay is added.
+
+        Address * m_relayRouteAddress;                          ///< The address each relay route sends packets to.
+
+        int * m_relayRouteRelay;                                ///< The index of the relay each relay route goes through.
+
+        double * m_relayRouteTime;                              ///< The time a packet was last received through each learned relay route, or -1 for routes added with NetworkTransport::AddRelayRoute. The learned route with the oldest time is replaced when the table is full.
+
+        int m_relayPacketBufferSize;                            ///< The size of each packet buffer used for relayed packets (bytes). Large enough for a packet of maximum size with a relay header in front.
+
+        uint8_t * m_relayReceivePacketData;                     ///< Relayed packets are read from the socket into this buffer before their relay header is removed. Packet i is at m_relayReceivePacketData + i * m_relayPacketBufferSize.
+
+        uint8_t * m_relaySendPacketData;                        ///< Packets are written here with a relay header in front before they are sent to a relay. Packet i is at m_relaySendPacketData + i * m_relayPacketBufferSize.
+
+        int m_relayPacketBytes[PacketReceiveBatchSize];         ///< The size of each packet read into or written to the relay packet buffers (bytes).
+
+        Address m_relayAddress[PacketReceiveBatchSize];         ///< The address each packet in the relay packet buffers came from or is sent to.
+
+        double m_relayReceiveTimes[PacketReceiveBatchSize];     ///< The time each packet read into the relay receive buffer was received. See Socket::ReceivePackets.
+
+        class AddressMap * m_relayOrigins;                      ///< The origin servers packets are forwarded to in relay mode. NULL if relay mode is not enabled.
+
+        class ConnectionRequestLimiter * m_relayLimiter;        ///< Per-source IP rate limit for packets forwarded to origin servers in relay mode. NULL if relay mode is not enabled.
+
+        float m_relayPacketsPerSecond;                          ///< The number of packets per-second forwarded to origin servers from each source IP address in relay mode.
+
+        float m_relayPacketBurst;                               ///< The number of packets forwarded to origin servers in a burst from each source IP address in relay mode.
+    };
+
+    /**
+        A network transport that receives packets on a dedicated thread.
+
+        The receive thread continuously drains the socket into a lock-free single producer, single consumer ring of packet buffers, so packets keep being pulled out of the kernel receive buffer during long frames on the game thread. Transport::ReadPackets then takes packets from the ring instead of the socket.
+
+        Only the socket reads move to the receive thread. Decryption and packet deserialization stay in Transport::ReadPackets, since they depend on encryption mappings, contexts and packet factories owned by the game thread.
+
+        If the ring fills up the receive thread stops reading until there is room in the ring, and packets queue up in the socket receive buffer as they would with NetworkTransport.
+     */
+
+    class ThreadedNetworkTransport : public NetworkTransport
+    {
+    public:
+
+        /**
+            Threaded network transport constructor.
+
+            The receive thread is started here, unless the socket is in an error state. See NetworkTransport::IsError.
+
+            @param allocator The allocator used for transport allocations.
+            @param address The address to send packets to that would be received by this transport.
+            @param protocolId The protocol id for this transport. Protocol id is included in the packet header, packets received with a different protocol id are discarded. This allows multiple versions of your protocol to exist on the same network.
+            @param time The current time value in seconds.
+            @param maxPacketSize The maximum packet size that can be sent across this transport.
+            @param sendQueueSize The size of the packet send queue (number of packets).
+            @param receiveQueueSize The size of the packet receive queue (number of packets).
+            @param socketSendBufferSize The size of the send buffers to set on the socket (SO_SNDBUF).
+            @param socketReceiveBufferSize The size of the send buffers to set on the socket (SO_RCVBUF).
+            @param allocateNetworkSimulator If true then a network simulator is allocated for simulating network conditions. Pass false to disable this.
+            @param receiveRingSize The size of the ring buffer that packets are received into on the receive thread (number of packets).
+            @param socketFlags Flags passed to the socket. See NetworkTransport::NetworkTransport and yojimbo::SocketFlags.
+         */
+
+        ThreadedNetworkTransport( Allocator & allocator,
+                                  const Address & address,
+                                  uint64_t protocolId,
+                                  double time,
+                                  int maxPacketSize = DefaultMaxPacketSize,
+                                  int sendQueueSize = DefaultPacketSendQueueSize,
+                                  int receiveQueueSize = DefaultPacketReceiveQueueSize,
+                                  int socketSendBufferSize = DefaultSocketSendBufferSize,
+                                  int socketReceiveBufferSize = DefaultSocketReceiveBufferSize,
+                                  bool allocateNetworkSimulator = true,
+                                  int receiveRingSize = DefaultPacketReceiveRingSize,
+                                  int socketFlags = 0 );
+
+        /// Stops the receive thread and waits for it to exit.
+
+        ~ThreadedNetworkTransport();
+
+        /// Discards any packets in the receive ring, in addition to resetting the transport. See Transport::Reset.
+
+        void Reset();
+
+        /**
+            Is the receive thread running?
+
+            @returns True if the receive thread is running. False if the socket is in an error state or the thread could not be created, in which case packets are read directly from the socket like NetworkTransport.
+         */
+
+        bool IsReceiveThreadRunning() const;
+
+        /**
+            Pin the receive thread to a CPU core.
+
+            The receive ring is also placed on the NUMA node of that core, since the receive thread writes every packet into it. Pin the thread calling Transport::ReadPackets to a core on the same node too, so packets never cross sockets on the way in.
+
+            @param cpu The CPU core to pin the receive thread to. See platform_thread_set_affinity.
+
+            @returns True if the receive thread was pinned, false if it isn't running or couldn't be pinned.
+         */
+
+        bool SetReceiveThreadAffinity( int cpu );
+
+    protected:
+
+        /// Overridden internal packet receive function. Pops one packet off the receive ring.
+
+        virtual int InternalReceivePacket( Address & from, void * packetData, int maxPacketSize );
+
+        /// Overridden internal batch packet receive function. Pops up to maxPackets packets off the receive ring.
+
+        virtual int InternalReceivePackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes );
+
+        /// Overridden internal wait function. Waits for the receive thread to push a packet onto the receive ring.
+
+        virtual bool InternalWaitForPacket( double timeout );
+
+    private:
+
+        static void ReceiveThreadFunction( void * data );
+
+        void ReceiveThread();
+
+        struct PlatformThread * m_thread;                       ///< The receive thread. NULL if the receive thread is not running.
+
+        int m_quit;                                             ///< Set to 1 to tell the receive thread to exit. Accessed with atomic_load and atomic_store.
+
+        int m_ringSize;                                         ///< The number of packet slots in the receive ring. One slot is always left empty, so the ring holds up to m_ringSize - 1 packets.
+
+        int m_packetBufferSize;                                 ///< The size of each packet slot in the receive ring (bytes).
+
+        int m_ringReadIndex;                                    ///< Index of the next packet to pop off the receive ring. Only written by the game thread.
+
+        int m_ringWriteIndex;                                   ///< Index of the next slot to receive a packet into. Only written by the receive thread.
+
+        uint8_t * m_ringPacketData;                             ///< Packet data for each slot in the receive ring. Slot i is at m_ringPacketData + i * m_packetBufferSize.
+
+        int * m_ringPacketBytes;                                ///< Size of the packet in each slot of the receive ring (bytes).
+
+        Address * m_ringFrom;                                   ///< The address that sent the packet in each slot of the receive ring.
+
+        double * m_ringReceiveTime;                             ///< The time the packet in each slot of the receive ring was received. See Socket::ReceivePacket.
+    };
+
+    /**
+        A transport that receives packets queued for it by a socket it shares with other transports.
+
+        This is the common base of PooledNetworkTransport and SharedServerTransport. The owner of the socket reads packets and calls PacketQueueTransport::QueueReceivedPacket, and Transport::ReadPackets takes them off the queue in the order they were queued.
+     */
+
+    class PacketQueueTransport : public BaseTransport
+    {
+    public:
+
+        /**
+            Packet queue transport constructor.
+
+            @param allocator The allocator used for transport allocations.
+            @param address The address of the transport.
+            @param protocolId The protocol id for this transport. Protocol id is included in the packet header, packets received with a different protocol id are discarded. This allows multiple versions of your protocol to exist on the same network.
+            @param time The current time value in seconds.
+            @param maxPacketSize The maximum packet size that can be sent across this transport.
+            @param sendQueueSize The size of the packet send queue (number of packets).
+            @param receiveQueueSize The size of the packet receive queue (number of packets). This is also the number of packets that can be queued for this transport between calls to Transport::ReadPackets.
+         */
+
+        PacketQueueTransport( Allocator & allocator,
+                              const Address & address,
+                              uint64_t protocolId,
+                              double time,
+                              int maxPacketSize,
+                              int sendQueueSize,
+                              int receiveQueueSize );
+
+        /// Frees any queued packets.
+
+        ~PacketQueueTransport();
+
+        /**
+            Queue a packet received on the shared socket.
+
+            @param from The address that sent the packet.
+            @param packetData The packet data.
+            @param packetBytes The size of the packet (bytes).
+            @param receiveTime The time the packet was received.
+
+            @returns True if the packet was queued, false if the queue is full.
+         */
+
+        bool QueueReceivedPacket( const Address & from, const uint8_t * packetData, int packetBytes, double receiveTime );
+
+    protected:
+
+        /// Frees all queued packets, so they are not received.
+
+        void DiscardReceivePackets();
+
+        int InternalReceivePacket( Address & from, void * packetData, int maxPacketSize );
+
+        int InternalReceivePackets( int maxPackets, Address * from, uint8_t * packetData, int maxPacketSize, int * packetBytes, double * receiveTimes );
+
+    private:
+
+        int m_receiveQueueSize;                                 ///< The maximum number of queued packets.
+
+        int m_receiveQueueHead;                                 ///< Index of the oldest queued packet.
+
+        int m_numReceivePackets;                                ///< The number of queued packets.
+
+        uint8_t ** m_receivePacketData;                         ///< Packet data for each queued packet. Allocated with the transport allocator.
+
+        int * m_receivePacketBytes;                             ///< The size of each queued packet (bytes).
+
+        Address * m_receiveFrom;                                ///< The address that sent each queued packet.
+
+        double * m_receiveTimes;                                ///< The time each queued packet was received.
+    };
+
+    /**
+        A pool of client sockets shared by many PooledNetworkTransport instances.
+
+        Use this for bot farms and load testers that run thousands of Client instances in one process. Instead of each client binding its own socket, clients send and receive through a small number of sockets owned by the pool, and the pool reads packets from all of its sockets in one place, so the cost of polling sockets no longer grows with the number of clients.
+
+        Servers identify clients by address, so two clients connected to the same server must send from different sockets. The first time a transport sends a packet to a server, it takes a route to that server on the lowest numbered socket that doesn't already have a route to it, and keeps it until the transport is reset or destroyed. Packets received on a socket are handed to the transport with a route from that socket to the address that sent them. Packets without a route are dropped.
+
+        This means a pool with n sockets can connect n clients to each server, and sockets are shared by clients connected to different servers. To connect more clients to a single server than there are sockets in the pool, use more sockets or more pools.
+
+        IMPORTANT: The pool and all transports using it must be used from the same thread.
+
+        @see PooledNetworkTransport
+     */
+
+    class ClientSocketPool
+    {
+    public:
+
+        /**
+            Client socket pool constructor.
+
+            Sockets are bound to the address passed in, plus the socket index if the port is not zero. Pass in port zero to bind each socket to an ephemeral port.
+
+            @param allocator The allocator used for pool allocations.
+            @param address The address to bind the sockets to.
+            @param numSockets The number of sockets in the pool. This is the maximum number of transports that can have a route to the same server at the same time.
+            @param maxRoutes The maximum number of routes across all sockets. Each transport takes one route for each server it sends packets to.
+            @param socketSendBufferSize The size of the send buffers to set on each socket (SO_SNDBUF).
+            @param socketReceiveBufferSize The size of the receive buffers to set on each socket (SO_RCVBUF).
+            @param socketFlags Flags passed to each socket. See yojimbo::SocketFlags.
+         */
+
+        ClientSocketPool( Allocator & allocator,
+                          const Address & address,
+                          int numSockets,
+                          int maxRoutes,
+                          int socketSendBufferSize = DefaultSocketSendBufferSize,
+                          int socketReceiveBufferSize = DefaultSocketReceiveBufferSize,
+                          int socketFlags = 0 );
+
+        /**
+            Client socket pool destructor.
+
+            IMPORTANT: All transports using the pool must be destroyed before the pool.
+         */
+
+        ~ClientSocketPool();
+
+        /**
+            You should call this after creating a pool, to make sure all sockets were created successfully.
+
+            @returns True if any socket in the pool is in error state.
+         */
+
+        bool IsError() const;
+
+        /**
+            Get the number of sockets in the pool.
+
+            @returns The number of sockets passed in to the constructor.
+         */
+
+        int GetNumSockets() const;
+
+        /**
+            Get the address a socket in the pool is bound to.
+
+            @param index The socket index in [0,GetNumSockets()-1].
+
+            @returns The socket address. If the socket was bound to port zero, this is the ephemeral port it ended up on.
+         */
+
+        const Address & GetSocketAddress( int index ) const;
+
+        /**
+            Read packets from all sockets and hand them to the transports they are routed to.
+
+            Call this once per-frame, before calling Transport::ReadPackets on each transport using the pool.
+         */
+
+        void ReceivePackets();
+
+        /**
+            Get the number of routes currently held by transports.
+
+            @returns The number of routes in [0,maxRoutes].
+         */
+
+        int GetNumRoutes() const;
+
+        /**
+            Get the number of packets received that were not routed to any transport.
+
+            @returns The number of packets received from an address that no transport had a route to on that socket.
+         */
+
+        uint64_t GetNumUnroutedPackets() const;
+
+        /**
+            Get the number of packets dropped by the pool.
+
+            @returns The number of packets dropped because the receive queue of their transport was full, or sent to a server that no socket had a free route to.
+         */
+
+        uint64_t GetNumDroppedPackets() const;
+
+    protected:
+
+        friend class PooledNetworkTransport;
+
+        /**
+            Add a transport to the pool.
+
+            Grows the receive buffer if the transport can receive packets larger than any transport added before it.
+
+            @param packetBufferSize The maximum packet buffer size of the transport. See PacketProcessor::GetMaxPacketBufferSize.
+         */
+
+        void AddTransport( int packetBufferSize );
+
+        /**
+            Remove a transport from the pool.
+
+            The transport must have released all of its routes.
+         */
+
+        void RemoveTransport();
+
+        /**
+            Add a route from a transport to a server.
+
+            @param transport The transport taking the route.
+            @param address The server address.
+
+            @returns The route index, or -1 if every socket already has a route to this server or the pool is out of routes.
+         */
+
+        int AddRoute( class PooledNetworkTransport * transport, const Address & address );
+
+        /**
+            Release a route added with ClientSocketPool::AddRoute.
+
+            @param routeIndex The route index.
+         */
+
+        void RemoveRoute( int routeIndex );
+
+        /**
+            Send a packet along a route.
+
+            @param routeIndex The route index.
+            @param packetData The packet data to send.
+            @param packetBytes The size of the packet (bytes).
+         */
+
+        void SendPacket( int routeIndex, const void * packetData, int packetBytes );
+
+        /// Counts a packet dropped by a transport.
+
+        void DropPacket();
+
+    private:
+
+        /// A route from a transport to a server, through one of the pool sockets.
+
+        struct Route
+        {
+            Address address;                                    ///< The server address.
+            class PooledNetworkTransport * transport;           ///< The transport that holds this route. NULL if the route is free.
+            int socketIndex;                                    ///< The index of the socket packets are sent and received on.
+            int nextFree;                                       ///< The index of the next free route, if this route is free. -1 if there are no more free routes.
+        };
+
+        Allocator * m_allocator;                                ///< The allocator passed in to the constructor.
+
+        int m_numSockets;                                       ///< The number of sockets in the pool.
+
+        int m_maxRoutes;                                        ///< The maximum number of routes across all sockets.
+
+        int m_numRoutes;                                        ///< The number of routes currently held by transports.
+
+        int m_firstFreeRoute;                                   ///< The index of the first free route. -1 if all routes are taken.
+
+        int m_numTransports;                                    ///< The number of transports using the pool.
+
+        int m_packetBufferSize;                                 ///< The size of each packet in the receive buffer (bytes). The largest maximum packet buffer size of all transports added to the pool.
+
+        class Socket ** m_sockets;                              ///< The sockets in the pool.
+
+        AddressMap ** m_socketRoutes;                           ///< Hash table from server address to route index, for each socket.
+
+        Route * m_routes;                                       ///< The route table. Routes are indexed by the values stored in m_socketRoutes.
+
+        uint8_t * m_receivePacketData;                          ///< Buffer packets are read into from each socket, PacketReceiveBatchSize packets at a time. Packet i is at m_receivePacketData + i * m_packetBufferSize.
+
+        int m_receivePacketBytes[PacketReceiveBatchSize];       ///< The size of each packet read into the receive buffer (bytes).
+
+        Address m_receiveFrom[PacketReceiveBatchSize];          ///< The address that sent each packet read into the receive buffer.
+
+        double m_receiveTimes[PacketReceiveBatchSize];          ///< The time each packet read into the receive buffer was received. See Socket::ReceivePackets.
+
+        uint64_t m_numUnroutedPackets;                          ///< The number of packets received without a route.
+
+        uint64_t m_numDroppedPackets;                           ///< The number of packets dropped because the transport receive queue was full, or no route was available.
+    };
+
+    /**
+        A network transport that sends and receives through a ClientSocketPool.
+
+        Use this instead of NetworkTransport for clients in bot farms and load testers, so thousands of clients can run in one process without each binding their own socket. Everything above the socket works the same as NetworkTransport, including encryption, and each client keeps its own transport context and encryption mappings.
+
+        Packets received are queued by ClientSocketPool::ReceivePackets, and picked up by Transport::ReadPackets. See PacketQueueTransport.
+
+        @see ClientSocketPool
+     */
+
+    class PooledNetworkTransport : public PacketQueueTransport
+    {
+    public:
+
+        /**
+            Pooled network transport constructor.
+
+            @param allocator The allocator used for transport allocations.
+            @param socketPool The socket pool to send and receive packets through.
+            @param protocolId The protocol id for this transport. Protocol id is included in the packet header, packets received with a different protocol id are discarded. This allows multiple versions of your protocol to exist on the same network.
+            @param time The current time value in seconds.
+            @param maxPacketSize The maximum packet size that can be sent across this transport.
+            @param sendQueueSize The size of the packet send queue (number of packets).
+            @param receiveQueueSize The size of the packet receive queue (number of packets). This is also the number of packets the pool can queue for this transport between calls to Transport::ReadPackets.
+         */
+
+        PooledNetworkTransport( Allocator & allocator,
+                                ClientSocketPool & socketPool,
+                                uint64_t protocolId,
+                                double time,
+                                int maxPacketSize = DefaultMaxPacketSize,
+                                int sendQueueSize = DefaultPacketSendQueueSize,
+                                int receiveQueueSize = DefaultPacketReceiveQueueSize );
+
+        /// Releases all routes held by this transport.
+
+        ~PooledNetworkTransport();
+
+        /// Releases all routes held by this transport and discards queued packets, in addition to resetting the transport. See Transport::Reset.
+
+        void Reset();
+
+        /**
+            Get the address of the pool socket packets to a server are sent from.
+
+            @param address The server address.
+
+            @returns The socket address, or an invalid address if this transport has no route to the server.
+         */
+
+        Address GetRouteAddress( const Address & address ) const;
+
+    protected:
+
+        void RemoveRoutes();
+
+        int FindRoute( const Address & address ) const;
+
+        void InternalSendPacket( const Address & to, const void * packetData, int packetBytes );
+
+    private:
+
+        ClientSocketPool * m_socketPool;                        ///< The socket pool passed in to the constructor.
+
+        int m_numRoutes;                                        ///< The number of routes held by this transport.
+
+        int m_routes[MaxServersPerConnect];                     ///< Route indices held by this transport, oldest first. When all are taken, the oldest is released to make room for a new one.
+
+        Address m_routeAddresses[MaxServersPerConnect];         ///< Server address of each route held by this transport.
+    };
+
+    /**
+        A server socket shared by several SharedServerTransport instances, so many Server instances can run on one port.
+
+        Use this to host many small matches in one process, each with its own Server, without binding a socket for each match.
+
+        Packets are routed to transports by client address. Each Server is given its own address with Server::SetServerAddress, different from the socket address, and the matchmaker puts that address in the connect token whitelist while telling clients to connect to the socket address. Packets from addresses without a route are handed to every transport. Servers drop connection requests whose connect token doesn't list their address, so only the server the connect token is for replies. When a transport first sends a packet to an address without a route, it claims the route, and from then on packets from that address are only handed to it.
+
+        Routes are released when the server removes the encryption mapping for the client, when the transport is reset, and when no packets are received from the client address for the route timeout.
+
+        Every server decrypts the connect token of connection requests from addresses without a route, so connecting costs one decrypt per server on the socket. Insecure connects are accepted by every server that allows them, so only enable SERVER_FLAG_ALLOW_INSECURE_CONNECT on one server per shared socket.
+
+        IMPORTANT: The shared socket routes packets in SharedServerSocket::ReceivePackets. Servers using the socket may be updated in parallel on different threads, eg. with ServerGroup, but not while SharedServerSocket::ReceivePackets is running.
+
+        @see SharedServerTransport
+        @see ServerGroup
+     */
+
+    class SharedServerSocket
+    {
+    public:
+
+        /**
+            Shared server socket constructor.
+
+            @param allocator The allocator used for socket allocations.
+            @param address The address to bind the socket to. This is the address clients connect to.
+            @param maxTransports The maximum number of transports that can use the socket.
+            @param maxClients The maximum number of client addresses routed at the same time, across all transports.
+            @param routeTimeout The time after which the route to a client address is released, if no packets are received from it (seconds).
+            @param socketSendBufferSize The size of the send buffer to set on the socket (SO_SNDBUF).
+            @param socketReceiveBufferSize The size of the receive buffer to set on the socket (SO_RCVBUF).
+            @param socketFlags Flags passed to the socket. See yojimbo::SocketFlags.
+         */
+
+        SharedServerSocket( Allocator & allocator,
+                            const Address & address,
+                            int maxTransports,
+                            int maxClients,
+                            double routeTimeout = DefaultSharedSocketRouteTimeout,
+                            int socketSendBufferSize = DefaultSocketSendBufferSize,
+                            int socketReceiveBufferSize = DefaultSocketReceiveBufferSize,
+                            int socketFlags = 0 );
+
+        /**
+            Shared server socket destructor.
+
+            IMPORTANT: All transports using the socket must be destroyed before the socket.
+         */
+
+        ~SharedServerSocket();
+
+        /**
+            You should call this after creating a shared socket, to make sure the socket was created successfully.
+
+            @returns True if the socket is in error state.
+         */
+
+        bool IsError() const;
+
+        /**
+            Get the address the socket is bound to.
+
+            @returns The socket address. If the socket was bound to port zero, this is the ephemeral port it ended up on.
+         */
+
+        const Address & GetAddress() const;
+
+        /**
+            Update routes and hand packets read from the socket to the transports they are routed to.
+
+            Routes claimed and released by transports since the last call are applied first, then routes that timed out are released, then the socket is drained.
+
+            Call this once per-frame, before calling Server::ReceivePackets on each server using the socket.
+
+            @param time The current time in seconds. Used for route timeouts.
+         */
+
+        void ReceivePackets( double time );
+
+        /**
+            Get the number of routes.
+
+            @returns The number of client addresses currently routed to a transport.
+         */
+
+        int GetNumRoutes() const;
+
+        /**
+            Get the number of packets dropped by the socket.
+
+            @returns The number of packets dropped because the receive queue of their transport was full, because no more routes could be added, or because they were sent to a client address routed to another transport.
+         */
+
+        uint64_t GetNumDroppedPackets() const;
+
+    protected:
+
+        friend class SharedServerTransport;
+
+        /**
+            Add a transport to the socket.
+
+            @param transport The transport to add.
+
+            @returns True if the transport was added, false if the socket already has the maximum number of transports.
+         */
+
+        bool AddTransport( class SharedServerTransport * transport );
+
+        /**
+            Remove a transport from the socket, releasing all routes to it.
+
+            @param transport The transport to remove.
+         */
+
+        void RemoveTransport( class SharedServerTransport * transport );
+
+        /**
+            Find the transport a client address is routed to.
+
+            This only reads the route table, so it is safe to call from transports being updated in parallel.
+
+            @param address The client address.
+
+            @returns The transport, or NULL if the address has no route.
+         */
+
+        class SharedServerTransport * FindRoute( const Address & address ) const;
+
+        /**
+            Send a packet from the socket.
+
+            @param to The address to send the packet to.
+            @param packetData The packet data to send.
+            @param packetBytes The size of the packet (bytes).
+         */
+
+        void SendPacket( const Address & to, const void * packetData, int packetBytes );
+
+        /// Applies the routes claimed and released by each transport.
+
+        void UpdateRoutes( double time );
+
+        /// Releases a route.
+
+        void RemoveRoute( int routeIndex );
+
+    private:
+
+        /// A route from a client address to the transport of the server it is connected to.
+
+        struct Route
+        {
+            Address address;                                    ///< The client address.
+            class SharedServerTransport * transport;            ///< The transport packets from the client are handed to. NULL if the route is free.
+            double lastReceiveTime;                             ///< The time the route was claimed, or a packet was last received from the client. Used for route timeouts.
+            int nextFree;                                       ///< The index of the next free route, if this route is free. -1 if there are no more free routes.
+        };
+
+        Allocator * m_allocator;                                ///< The allocator passed in to the constructor.
+
+        class Socket * m_socket;                                ///< The shared socket.
+
+        int m_maxTransports;                                    ///< The maximum number of transports that can use the socket.
+
+        int m_numTransports;                                    ///< The number of transports using the socket.
+
+        class SharedServerTransport ** m_transports;            ///< The transports using the socket.
+
+        int m_maxRoutes;                                        ///< The maximum number of routes.
+
+        int m_numRoutes;                                        ///< The number of routes.
+
+        int m_firstFreeRoute;                                   ///< The index of the first free route. -1 if all routes are taken.
+
+        double m_routeTimeout;                                  ///< Routes are released if no packets are received from the client address for this long (seconds).
+
+        AddressMap * m_routeMap;                                ///< Hash table from client address to route index.
+
+        Route * m_routes;                                       ///< The route table. Routes are indexed by the values stored in m_routeMap.
+
+        int m_packetBufferSize;                                 ///< The size of each packet in the receive buffer (bytes). The largest maximum packet buffer size of all transports added to the socket.
+
+        uint8_t * m_receivePacketData;                          ///< Buffer packets are read into from the socket, PacketReceiveBatchSize packets at a time. Packet i is at m_receivePacketData + i * m_packetBufferSize.
+
+        int m_receivePacketBytes[PacketReceiveBatchSize];       ///< The size of each packet read into the receive buffer (bytes).
+
+        Address m_receiveFrom[PacketReceiveBatchSize];          ///< The address that sent each packet read into the receive buffer.
+
+        double m_receiveTimes[PacketReceiveBatchSize];          ///< The time each packet read into the receive buffer was received. See Socket::ReceivePackets.
+
+        uint64_t m_numDroppedPackets;                           ///< The number of packets dropped by the socket. Transports count packets they drop in SharedServerTransport::InternalSendPacket themselves, and they are added here in SharedServerSocket::UpdateRoutes.
+    };
+
+    /**
+        A server transport that sends and receives through a SharedServerSocket.
+
+        Use this instead of NetworkTransport for each Server hosted on a shared socket. Everything above the socket works the same as NetworkTransport, and each server keeps its own transport context, encryption mappings and packet processing, so servers on the same socket can be updated in parallel.
+
+        Packets received are queued by SharedServerSocket::ReceivePackets, and picked up by Transport::ReadPackets. See PacketQueueTransport.
+
+        @see SharedServerSocket
+     */
+
+    class SharedServerTransport : public PacketQueueTransport
+    {
+    public:
+
+        /**
+            Shared server transport constructor.
+
+            The transport address is the socket address. Set the address the server is known by in connect tokens with Server::SetServerAddress.
+
+            @param allocator The allocator used for transport allocations.
+            @param sharedSocket The shared socket to send and receive packets through.
+            @param protocolId The protocol id for this transport. Protocol id is included in the packet header, packets received with a different protocol id are discarded. This allows multiple versions of your protocol to exist on the same network.
+            @param time The current time value in seconds.
+            @param maxPacketSize The maximum packet size that can be sent across this transport.
+            @param sendQueueSize The size of the packet send queue (number of packets).
+            @param receiveQueueSize The size of the packet receive queue (number of packets). This is also the number of packets the shared socket can queue for this transport between calls to Transport::ReadPackets.
+         */
+
+        SharedServerTransport( Allocator & allocator,
+                               SharedServerSocket & sharedSocket,
+                               uint64_t protocolId,
+                               double time,
+                               int maxPacketSize = DefaultMaxPacketSize,
+                               int sendQueueSize = DefaultPacketSendQueueSize,
+                               int receiveQueueSize = DefaultPacketReceiveQueueSize );
+
+        /// Removes the transport from the shared socket, releasing all routes to it.
+
+        ~SharedServerTransport();
+
+        /**
+            Was this transport added to the shared socket?
+
+            @returns True if the shared socket already had the maximum number of transports when this transport was created. Packets are never received in that case.
+         */
+
+        bool IsError() const;
+
+        /// Releases all routes to this transport and discards queued packets, in addition to resetting the transport. See Transport::Reset.
+
+        void Reset();
+
+        /// Overridden to release the route to the address.
+
+        bool RemoveEncryptionMapping( const Address & address );
+
+        /// Overridden to release all routes to this transport.
+
+        void ResetEncryptionMappings();
+
+    protected:
+
+        friend class SharedServerSocket;
+
+        /// Overridden internal packet send function. Claims the route to addresses without one, and drops packets to addresses routed to another transport.
+
+        void InternalSendPacket( const Address & to, const void * packetData, int packetBytes );
+
+    private:
+
+        SharedServerSocket * m_sharedSocket;                    ///< The shared socket passed in to the constructor.
+
+        bool m_added;                                           ///< True if the transport was added to the shared socket.
+
+        bool m_releaseAllRoutes;                                ///< Set when all routes to this transport should be released in the next SharedServerSocket::ReceivePackets.
+
+        int m_numClaimedRoutes;                                 ///< The number of routes claimed since the last SharedServerSocket::ReceivePackets.
+
+        int m_numReleasedRoutes;                                ///< The number of routes released since the last SharedServerSocket::ReceivePackets.
+
+        Address m_claimedRoutes[MaxSharedSocketRouteChanges];   ///< Client addresses this transport sent packets to without a route. Routed to this transport in the next SharedServerSocket::ReceivePackets, unless another transport claimed them first.
+
+        Address m_releasedRoutes[MaxSharedSocketRouteChanges];  ///< Client addresses whose encryption mapping was removed. Their routes are released in the next SharedServerSocket::ReceivePackets. If this fills up, all routes to this transport are released instead.
+
+        uint64_t m_numDroppedPackets;                           ///< Packets dropped in InternalSendPacket since the last SharedServerSocket::ReceivePackets.
     };
 
 #endif // #if YOJIMBO_SOCKETS